@@ -6143,6 +6143,19 @@ typedef NS_ENUM(NSUInteger, BackupHeartbeatStatus) {
  */
 - (void)startStreamingNode:(MEGANode *)node startPos:(NSNumber *)startPos size:(NSNumber *)size;
 
+/**
+ * @brief Set the size of the pieces in which streaming transfers deliver their data
+ *
+ * By default, [MEGATransferDelegate onTransferData:transfer:] is called for each piece of data as
+ * it arrives from the network. With a chunk size set, the data is held back until there is at
+ * least that much (or the end of the requested range is reached), so that fewer, larger
+ * NSData objects are created.
+ *
+ * @param bytes Minimum size of the data delivered by each callback, or 0 to deliver
+ * the data as it arrives
+ */
+- (void)setStreamingChunkSize:(NSUInteger)bytes;
+
 /**
  * @brief Reset the number of total downloads
  * This function resets the number returned by [MEGASdk totalDownloads]
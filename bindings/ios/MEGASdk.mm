@@ -1695,6 +1695,10 @@ using namespace mega;
     self.megaApi->startStreaming((node != nil) ? [node getCPtr] : NULL, (startPos != nil) ? [startPos longLongValue] : 0, (size != nil) ? [size longLongValue] : 0, NULL);
 }
 
+- (void)setStreamingChunkSize:(NSUInteger)bytes {
+    self.megaApi->setStreamingChunkSize(bytes);
+}
+
 - (void)resetTotalDownloads {
     self.megaApi->resetTotalDownloads();
 }
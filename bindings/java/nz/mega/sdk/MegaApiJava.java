@@ -6534,6 +6534,21 @@ public class MegaApiJava {
         megaApi.startStreaming(node, startPos, size, createDelegateTransferListener(listener));
     }
 
+    /**
+     * Set the size of the pieces in which streaming transfers deliver their data
+     * <p>
+     * By default, MegaTransferListenerInterface.onTransferData is called for each piece of data as
+     * it arrives from the network. With a chunk size set, the data is held back until there is at
+     * least that much (or the end of the requested range is reached), so that fewer, larger
+     * byte arrays cross into Java.
+     *
+     * @param bytes Minimum size of the data delivered by each callback, or 0 to deliver
+     * the data as it arrives
+     */
+    public void setStreamingChunkSize(long bytes) {
+        megaApi.setStreamingChunkSize(bytes);
+    }
+
     /**
      * Cancel a transfer.
      * <p>
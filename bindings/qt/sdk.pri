@@ -41,6 +41,14 @@ SOURCES += src/attrmap.cpp \
     src/node.cpp \
     src/pubkeyaction.cpp \
     src/request.cpp \
+    src/searchindex.cpp \
+    src/statesnapshot.cpp \
+    src/streamingcache.cpp \
+    src/metrics.cpp \
+    src/binarylog.cpp \
+    src/threadconfig.cpp \
+    src/lazynodes.cpp \
+    src/asyncdbtable.cpp \
     src/serialize64.cpp \
     src/share.cpp \
     src/sharenodekeys.cpp \
@@ -58,6 +66,7 @@ SOURCES += src/attrmap.cpp \
     src/crypto/cryptopp.cpp  \
     src/crypto/sodium.cpp  \
     src/db/sqlite.cpp  \
+    src/db/memory.cpp  \
     src/gfx/external.cpp \
     src/mega_utf8proc.cpp \
     src/mega_ccronexpr.cpp \
@@ -105,6 +114,14 @@ CONFIG(USE_POLL) {
     DEFINES += USE_POLL
 }
 
+CONFIG(USE_EPOLL) {
+    DEFINES += USE_EPOLL
+}
+
+CONFIG(USE_KQUEUE) {
+    DEFINES += USE_KQUEUE
+}
+
 CONFIG(USE_CONSOLE) {
     win32 {
 
@@ -445,6 +462,14 @@ HEADERS  += include/mega.h \
             include/mega/node.h \
             include/mega/pubkeyaction.h \
             include/mega/request.h \
+            include/mega/searchindex.h \
+            include/mega/statesnapshot.h \
+            include/mega/streamingcache.h \
+            include/mega/metrics.h \
+            include/mega/binarylog.h \
+            include/mega/threadconfig.h \
+            include/mega/lazynodes.h \
+            include/mega/asyncdbtable.h \
             include/mega/serialize64.h \
             include/mega/share.h \
             include/mega/sharenodekeys.h \
@@ -464,6 +489,7 @@ HEADERS  += include/mega.h \
             include/mega/crypto/cryptopp.h  \
             include/mega/crypto/sodium.h  \
             include/mega/db/sqlite.h  \
+            include/mega/db/memory.h  \
             include/mega/gfx/qt.h \
             include/mega/gfx/freeimage.h \
             include/mega/gfx/external.h \
@@ -1955,7 +1955,7 @@ static void dumptree(Node* n, bool recurse, int depth, const char* title, ofstre
 
     if (n->type != FILENODE)
     {
-        for (node_list::iterator it = n->children.begin(); it != n->children.end(); it++)
+        for (auto it = n->children.begin(); it != n->children.end(); it++)
         {
             dumptree(*it, recurse, depth + 1, NULL, toFile);
         }
@@ -3262,7 +3262,7 @@ bool recursiveget(fs::path&& localpath, Node* n, bool folders, unsigned& queued)
                 return false;
             }
         }
-        for (node_list::iterator it = n->children.begin(); it != n->children.end(); it++)
+        for (auto it = n->children.begin(); it != n->children.end(); it++)
         {
             if (!recursiveget(std::move(newpath), *it, folders, queued))
             {
@@ -3283,7 +3283,7 @@ bool regexget(const string& expression, Node* n, unsigned& queued)
         if (n->type == FOLDERNODE || n->type == ROOTNODE)
         {
             DBTableTransactionCommitter committer(client->tctable);
-            for (node_list::iterator it = n->children.begin(); it != n->children.end(); it++)
+            for (auto it = n->children.begin(); it != n->children.end(); it++)
             {
                 if ((*it)->type == FILENODE)
                 {
@@ -4082,7 +4082,7 @@ void exec_get(autocomplete::ACState& s)
                 else
                 {
                     // ...or all files in the specified folder (non-recursive)
-                    for (node_list::iterator it = n->children.begin(); it != n->children.end(); it++)
+                    for (auto it = n->children.begin(); it != n->children.end(); it++)
                     {
                         if ((*it)->type == FILENODE)
                         {
@@ -4856,7 +4856,7 @@ void exec_getfa(autocomplete::ACState& s)
         }
         else
         {
-            for (node_list::iterator it = n->children.begin(); it != n->children.end(); it++)
+            for (auto it = n->children.begin(); it != n->children.end(); it++)
             {
                 if ((*it)->type == FILENODE && (*it)->hasfileattribute(type))
                 {
@@ -6518,7 +6518,7 @@ void exec_mediainfo(autocomplete::ACState& s)
             case ROOTNODE:
             case INCOMINGNODE:
             case RUBBISHNODE:
-                for (node_list::iterator m = n->children.begin(); m != n->children.end(); ++m)
+                for (auto m = n->children.begin(); m != n->children.end(); ++m)
                 {
                     if ((*m)->type == FILENODE && (*m)->hasfileattribute(fa_media))
                     {
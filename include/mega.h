@@ -53,6 +53,13 @@
 #include "mega/share.h"
 #include "mega/sharenodekeys.h"
 #include "mega/treeproc.h"
+#include "mega/searchindex.h"
+#include "mega/statesnapshot.h"
+#include "mega/streamingcache.h"
+#include "mega/metrics.h"
+#include "mega/threadconfig.h"
+#include "mega/lazynodes.h"
+#include "mega/asyncdbtable.h"
 #include "mega/user.h"
 #include "mega/pendingcontactrequest.h"
 #include "mega/utils.h"
@@ -79,6 +86,7 @@
 #include "megaconsolewaiter.h"
 
 #include "mega/db/sqlite.h"
+#include "mega/db/memory.h"
 
 #include "mega/gfx/qt.h"
 #include "mega/gfx/freeimage.h"
@@ -0,0 +1,135 @@
+/**
+ * @file mega/asyncdbtable.h
+ * @brief Database table whose commits are written by a thread of its own
+ *
+ * (c) 2013-2021 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#ifndef MEGA_ASYNCDBTABLE_H
+#define MEGA_ASYNCDBTABLE_H 1
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "db.h"
+
+namespace mega {
+
+// A table whose committed transactions are written to the underlying one by a writer thread, so
+// that commit() doesn't wait for the disk (with fsync, that can take hundreds of ms).  Each
+// transaction is still applied as a whole, in commit order; the ones that queue up while the
+// writer is busy are merged and committed together.  The table on disk is therefore always in a
+// state that was committed: a crash can lose the last commits, as if they had not happened yet,
+// but never applies part of one (such as the records of an update without its scsn).
+//
+// Reads see every change made through this table, committed or not: get() looks at the changes
+// not written yet before the underlying table (for other records, it may wait for a write in
+// progress), and rewind() waits for the writer first.  When a write fails, later put(), del()
+// and batch calls return false, which is how callers find out.
+class MEGA_API AsyncDbTable : public DbTable
+{
+public:
+    AsyncDbTable(PrnGen& rng, std::unique_ptr<DbTable> table);
+
+    // writes everything committed before returning
+    ~AsyncDbTable();
+
+    void rewind() override;
+    bool next(uint32_t*, string*) override;
+    bool get(uint32_t, string*) override;
+    bool put(uint32_t, char*, unsigned) override;
+    bool del(uint32_t) override;
+    bool putBatch(const RecordBatch&) override;
+    bool delBatch(const vector<uint32_t>&) override;
+    bool putNodeRecord(const DbNodeRecord&) override;
+    bool getChildren(handle, NodeRefs*) override;
+    bool getByFingerprint(const FileFingerprint&, NodeRefs*) override;
+    bool nodeIndexComplete() override;
+    void setNodeIndexComplete() override;
+    int64_t reclaimableBytes() override;
+    int64_t reclaimSpace(int64_t maxBytes) override;
+    bool vacuum() override;
+    void truncate() override;
+    void begin() override;
+    void commit() override;
+    void abort() override;
+    void remove() override;
+    void removeLater(vector<LocalPath>& files) override;
+    bool inTransaction() const override;
+
+    // wait until everything committed so far is in the underlying table
+    void flush();
+
+private:
+    // changes to the underlying table
+    struct Changes
+    {
+        bool truncate = false;
+        std::map<uint32_t, std::unique_ptr<string>> records;  // ids put, or deleted if null
+        std::map<uint32_t, DbNodeColumns> columns;            // of the records put as nodes
+        bool indexComplete = false;
+
+        bool empty() const { return !truncate && records.empty() && !indexComplete; }
+
+        // apply after these the changes made later
+        void merge(Changes&& later);
+
+        // whether these changes decide what the table holds for id, and if so, in found
+        bool lookup(uint32_t id, string* data, bool* found) const;
+    };
+
+    std::unique_ptr<DbTable> mTable;
+
+    // the transaction the caller is in
+    Changes mCurrent;
+    bool mInTransaction = false;
+
+    // committed and not written yet, and being written, under mMutex
+    Changes mCommitted;
+    Changes mWriting;
+    bool mStop = false;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+
+    // held by whoever uses mTable (the writer, or reads on the caller's thread)
+    std::mutex mTableMutex;
+
+    std::atomic<bool> mFailed;
+    std::thread mWriter;
+    bool mThreaded = false;
+
+    // where next() is: the records of mTable, then the ones put in mCurrent
+    bool mScanningTable = false;
+    bool mScanningCurrent = false;
+    std::map<uint32_t, std::unique_ptr<string>>::const_iterator mScanPos;
+
+    void enqueue();
+    void write(const Changes& changes);
+    void writerLoop();
+
+    // the result of a node query on the underlying table, with the current transaction on top
+    bool query(const std::function<bool(DbTable&, NodeRefs*)>& inTable,
+               const std::function<bool(const DbNodeColumns&)>& matches, NodeRefs* refs);
+};
+
+} // namespace
+
+#endif
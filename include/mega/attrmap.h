@@ -26,8 +26,54 @@
 
 namespace mega {
 
+// Attribute names to values, in a vector sorted by name.  Nodes carry a handful of attributes,
+// for which this is a single allocation rather than a tree node each, and the short values that
+// dominate (labels, favourite flags, ...) live in the strings' own inline buffers.  Unlike with
+// std::map, adding or removing an attribute invalidates iterators and references to the others.
+class MEGA_API FlatAttrMap
+{
+public:
+    using key_type = nameid;
+    using mapped_type = string;
+    using value_type = std::pair<nameid, string>;
+    using iterator = vector<value_type>::iterator;
+    using const_iterator = vector<value_type>::const_iterator;
+    using size_type = size_t;
+
+    FlatAttrMap() = default;
+    FlatAttrMap(std::initializer_list<value_type> values);
+
+    iterator begin() { return mEntries.begin(); }
+    iterator end() { return mEntries.end(); }
+    const_iterator begin() const { return mEntries.begin(); }
+    const_iterator end() const { return mEntries.end(); }
+
+    size_t size() const { return mEntries.size(); }
+    bool empty() const { return mEntries.empty(); }
+    void clear() { mEntries.clear(); }
+
+    iterator find(nameid name);
+    const_iterator find(nameid name) const;
+    size_t count(nameid name) const { return find(name) != end(); }
+
+    string& operator[](nameid name);
+    std::pair<iterator, bool> insert(const value_type& value);
+    std::pair<iterator, bool> emplace(nameid name, string value);
+
+    iterator erase(const_iterator it) { return mEntries.erase(mEntries.begin() + (it - mEntries.cbegin())); }
+    size_t erase(nameid name);
+
+    bool operator==(const FlatAttrMap& other) const { return mEntries == other.mEntries; }
+    bool operator!=(const FlatAttrMap& other) const { return mEntries != other.mEntries; }
+
+private:
+    iterator position(nameid name);
+
+    vector<value_type> mEntries;
+};
+
 // maps attribute names to attribute values
-typedef map<nameid, string> attr_map;
+typedef FlatAttrMap attr_map;
 
 struct MEGA_API AttrMap
 {
@@ -46,6 +92,9 @@ struct MEGA_API AttrMap
     // export as JSON string
     void getjson(string*) const;
 
+    // the same, appended to what the string already holds (see MegaClient::makeattr())
+    void appendjson(string*) const;
+
     // export as raw binary serialize
     void serialize(string*) const;
 
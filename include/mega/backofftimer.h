@@ -67,23 +67,98 @@ public:
     BackoffTimer(PrnGen &rng);
 };
 
+// Hierarchical timer wheel: LEVELS wheels of SLOTS slots each, the slots of each level spanning
+// all those of the level below, plus an overflow list for the deadlines beyond the top one.
+// Entries are intrusive, so adding and removing them is O(1) without any allocation, and the
+// entries in a slot move down a level when the time reaches it.  Entries are not called back:
+// advance() moves those whose deadline has come to a list of their own, that due() walks.
+class MEGA_API TimerWheel
+{
+public:
+    static const int LEVELS = 4;
+    static const int SLOTBITS = 6;
+    static const int SLOTS = 1 << SLOTBITS;
+
+    class Entry
+    {
+        friend class TimerWheel;
+
+        Entry* mPrev = nullptr;
+        Entry* mNext = nullptr;
+        Entry** mList = nullptr;
+        int mLevel = -1;
+        int mSlot = 0;
+        dstime mDeadline = 0;
+
+    public:
+        void* owner;
+
+        explicit Entry(void* o) : owner(o) { }
+        Entry(const Entry&) = delete;
+        Entry& operator=(const Entry&) = delete;
+
+        bool linked() const { return mList != nullptr; }
+        dstime deadline() const { return mDeadline; }
+    };
+
+    explicit TimerWheel(dstime now = 0);
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    void add(Entry*, dstime deadline);
+    void remove(Entry*);
+
+    // bring the wheel to now, moving the entries whose deadline has come to the due ones
+    void advance(dstime now);
+
+    // entries with a deadline up to the last advance(), that stay there until removed
+    template<typename F> void due(F f) const
+    {
+        for (Entry* e = mDue; e; e = e->mNext)
+        {
+            f(e);
+        }
+    }
+
+    // when advance() has to be called next: the last one if there are due entries, the earliest
+    // deadline if it is near, or when it moves down a level (a little early, then), NEVER if empty
+    dstime next() const;
+
+    size_t size() const { return mCount; }
+
+private:
+    dstime mNow;
+    size_t mCount = 0;
+
+    Entry* mSlots[LEVELS][SLOTS] = {};
+    uint64_t mOccupied[LEVELS] = {};
+    Entry* mDue = nullptr;
+    Entry* mOverflow = nullptr;
+
+    void link(Entry*, Entry** list, int level, int slot);
+    void place(Entry*);
+    void cascade(int level);
+    dstime nextstep() const;
+};
+
 class MEGA_API BackoffTimerTracked;
 
 // This class keeps track of a group of BackoffTimerTracked, which register and deregister themselves.
-// Timers are in the multimap when they have non-0 non-NEVER timeouts set, giving us a much smaller group should we need to iterate it.
+// Timers are in the wheel when they have non-0 non-NEVER timeouts set, so that
+// tracking a timer's backoff and finding out the soonest ones costs the same however many there are
 class MEGA_API BackoffTimerGroupTracker
 {
-    std::multimap<dstime, BackoffTimerTracked*> timeouts;
+    TimerWheel timeouts;
 
 public:
-    typedef std::multimap<dstime, BackoffTimerTracked*>::iterator Iter;
-
-    inline Iter add(BackoffTimerTracked* bt);
-    inline void remove(Iter i) { timeouts.erase(i); }
+    void add(BackoffTimerTracked* bt, TimerWheel::Entry* e);
+    inline void remove(TimerWheel::Entry* e) { timeouts.remove(e); }
 
     // Find out the soonest (non-0 and non-NEVER) timeout in the group.
     // For transfers, it calls set(0) on any timed out timers, as the old code did.
     void update(dstime* waituntil, bool transfers);
+
+    size_t size() const { return timeouts.size(); }
 };
 
 
@@ -94,7 +169,7 @@ class MEGA_API BackoffTimerTracked
     bool mIsEnabled;
     BackoffTimer bt;
     BackoffTimerGroupTracker& mTracker;
-    BackoffTimerGroupTracker::Iter mTrackerPos;
+    TimerWheel::Entry mTrackerPos;
 
     void untrack();
     void track();
@@ -118,17 +193,11 @@ public:
     inline bool enabled()           { return mIsEnabled; }
 };
 
-inline auto BackoffTimerGroupTracker::add(BackoffTimerTracked* bt) -> Iter
-{
-    return timeouts.emplace(bt->nextset() ? bt->nextset() : NEVER, bt);
-}
-
 inline void BackoffTimerTracked::untrack()
 {
-    if (mIsEnabled && bt.nextset() != 0 && bt.nextset() != NEVER)
+    if (mTrackerPos.linked())
     {
-        mTracker.remove(mTrackerPos);
-        mTrackerPos = BackoffTimerGroupTracker::Iter();
+        mTracker.remove(&mTrackerPos);
     }
 }
 
@@ -136,11 +205,11 @@ inline void BackoffTimerTracked::track()
 {
     if (mIsEnabled && bt.nextset() != 0 && bt.nextset() != NEVER)
     {
-        mTrackerPos = mTracker.add(this);
+        mTracker.add(this, &mTrackerPos);
     }
 }
 
-inline BackoffTimerTracked::BackoffTimerTracked(PrnGen &rng, BackoffTimerGroupTracker& tr) : mIsEnabled(true), bt(rng), mTracker(tr)
+inline BackoffTimerTracked::BackoffTimerTracked(PrnGen &rng, BackoffTimerGroupTracker& tr) : mIsEnabled(true), bt(rng), mTracker(tr), mTrackerPos(this)
 {
     track();
 }
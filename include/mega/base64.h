@@ -41,6 +41,11 @@ public:
 
     static void itoa(int64_t, string *);
     static int64_t atoi(string *);
+
+    // with vectorcodec (the default), runs of 12 bytes / 16 characters are converted at once
+    // with SSSE3 where the CPU has it.  The rest, and short strings such as handles, go through
+    // lookup tables
+    static bool vectorcodec;
 };
 
 template <unsigned BINARYSIZE>
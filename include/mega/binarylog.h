@@ -0,0 +1,166 @@
+/**
+ * @file mega/binarylog.h
+ * @brief Log records in a binary form, buffered in lock-free rings per thread
+ *
+ * (c) 2013-2021 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#ifndef MEGA_BINARYLOG_H
+#define MEGA_BINARYLOG_H 1
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mega {
+
+// The format of the binary logs: a header, then records of
+//   u32 size of what follows, u8 type, and by type:
+//   THREAD:  u16 thread, its name
+//   MESSAGE: u64 us since the epoch, u16 thread, u8 level, the message
+//   GAP:     u16 thread, u64 messages dropped there because its ring was full
+// in little endian.  The time and level stay numbers until a reader turns them into text (see
+// tests/tool/logdecode.cpp), which is what the threads that log save
+namespace BinaryLog {
+
+    const char MAGIC[] = "MEGALOG1";
+    const size_t MAGICSIZE = sizeof(MAGIC) - 1;
+
+    enum RecordType : uint8_t
+    {
+        THREAD = 1,
+        MESSAGE = 2,
+        GAP = 3,
+    };
+
+    struct Record
+    {
+        RecordType type = MESSAGE;
+        uint64_t us = 0;
+        uint16_t thread = 0;
+        int level = 0;
+        uint64_t dropped = 0;
+        std::string text;   // the message, or the name of the thread
+    };
+
+    // reads the records of a file's contents, header included
+    class Reader
+    {
+    public:
+        Reader(const char* data, size_t size);
+
+        // false if the header is not that of a binary log
+        bool valid() const;
+
+        // the next record, until the end or a truncated one
+        bool next(Record& r);
+
+        // more records (without the header), after those of the data before
+        void feed(const char* data, size_t size);
+
+        // a message as the text logs have it: time, thread, level and message, with its newline.
+        // The names of the threads are those of the THREAD records read before
+        std::string format(const Record& r) const;
+
+    private:
+        const char* mPos;
+        const char* mEnd;
+        bool mValid;
+        std::vector<std::string> mThreadNames;
+    };
+}
+
+// One thread's records, until the consumer takes them: a single producer, single consumer ring
+// where a record is written whole or not at all
+class BinaryLogRing
+{
+public:
+    explicit BinaryLogRing(size_t bytes);
+
+    struct Piece
+    {
+        const char* data;
+        size_t size;
+    };
+
+    // a record made of these pieces, or false if it doesn't fit (it is counted as dropped)
+    bool push(const Piece* pieces, int count);
+
+    // appends what was pushed, and a GAP record if any was dropped meanwhile.  Returns the bytes
+    // that were pending
+    size_t drain(std::string& out, uint16_t thread);
+
+    size_t pending() const;
+    size_t capacity() const;
+
+private:
+    std::vector<char> mBuffer;
+    size_t mMask;
+
+    // bytes written and read so far, each only changed by one side
+    std::atomic<size_t> mHead;
+    std::atomic<size_t> mTail;
+
+    std::atomic<uint64_t> mDropped;
+};
+
+// The rings of the threads that log, and the records they make.  log() takes no locks (except
+// on the first use by each thread, which registers its ring) and formats nothing: the consumer
+// (one thread at a time) calls drain() for the records to write
+class BinaryLogWriter
+{
+public:
+    explicit BinaryLogWriter(size_t ringBytes = 1 << 20);
+
+    // or the pieces of a message that comes in several (ENABLE_LOG_PERFORMANCE), instead of
+    // message.  Messages longer than a quarter of the ring are cut.  Returns whether the consumer
+    // should be woken: the ring of the thread just became half full, or dropped the message
+    bool log(int level, const char* message, const char** pieces = nullptr, const size_t* pieceSizes = nullptr, int pieceCount = 0);
+
+    // the records of all the threads since the last drain, with the names of all of them for a
+    // new file (otherwise, only those of the threads that are new)
+    void drain(std::string& out, bool threadNames = false);
+
+    // what goes at the start of a file
+    static std::string header();
+
+    // a record of the consumer itself, which has no ring
+    static std::string message(int level, const std::string& text);
+
+private:
+    BinaryLogRing* threadRing();
+
+    const size_t mRingBytes;
+    const uint64_t mId;
+
+    struct ThreadRing
+    {
+        std::string name;
+        std::unique_ptr<BinaryLogRing> ring;
+        bool named;
+    };
+
+    std::mutex mRingsMutex;
+    std::vector<ThreadRing> mRings;
+};
+
+} // namespace
+
+#endif
@@ -57,6 +57,14 @@ public:
     // some commands are guaranteed to work if we query without specifying a SID (eg. gmf)
     bool suppressSID;
 
+    // those whose order matters only relative to the others on the same node (pipelinekey) can go
+    // in batches sent while others are in flight (see RequestDispatcher::readytosend())
+    bool pipelinable = false;
+    handle pipelinekey = UNDEF;
+
+    // the "a" of the command, for the metrics by command type (a literal, as cmd() is given)
+    const char* commandStr = nullptr;
+
     void cmd(const char*);
     void notself(MegaClient*);
     virtual void cancel(void);
@@ -81,6 +89,9 @@ public:
     void openobject();
     void closeobject();
 
+    // room for the given number of bytes more, for commands that know they are large
+    void reserve(size_t);
+
     enum Outcome {  CmdError,            // The reply was an error, already extracted from the JSON.  The error code may have been 0 (API_OK)
                     //CmdActionpacket,     // The reply was a cmdseq string, and we have processed the corresponding actionpackets
                     CmdArray,            // The reply was an array, and we have already entered it
@@ -141,7 +152,7 @@ public:
 
     virtual bool procresult(Result) = 0;
 
-    const char* getstring();
+    const string& getstring() const;
 
     Command();
     virtual ~Command();
@@ -536,11 +547,19 @@ class MEGA_API CommandGetFile : public Command
     bool priv;
     byte filekey[FILENODEKEYLENGTH];
 
+    // requested ahead of a slot: the URLs are only kept for when the transfer gets one
+    Transfer* prefetch;
+    bool prefetching;
+    bool procprefetchresult(Result);
+
 public:
     void cancel() override;
     bool procresult(Result) override;
 
     CommandGetFile(MegaClient *client, TransferSlot*, const byte*, handle, bool, const char* = NULL, const char* = NULL, const char *chatauth = NULL);
+
+    // temporary URLs for a queued download (see MegaClient::prefetchdownloadurls)
+    CommandGetFile(MegaClient *client, Transfer*, handle, bool, const char* = NULL, const char* = NULL, const char *chatauth = NULL);
 };
 
 class MEGA_API CommandPutFile : public Command
@@ -592,11 +611,19 @@ class MEGA_API CommandPutNodes : public Command
     bool emptyResponse = false;
     handle targethandle;
 
-    void removePendingDBRecordsAndTempFiles();
+    // for uploads put together by MegaClient::batchputnode(), the tag of each node in nn: its
+    // result is reported with that tag, as if it had had a command of its own
+    vector<int> batchtags;
+
+    void removePendingDBRecordsAndTempFiles(int filetag);
+    void appresult(const Error&, bool targetOverride);
 
 public:
     bool procresult(Result) override;
 
+    // when set, gets the result instead of the app (for PUTNODES_APP)
+    std::function<void(const Error&, vector<NewNode>&)> mResultFunction;
+
     CommandPutNodes(MegaClient*, handle, const char*, vector<NewNode>&&, int, putsource_t = PUTNODES_APP, const char *cauth = NULL);
 };
 
@@ -96,13 +96,38 @@ private:
     CryptoPP::GCM<CryptoPP::AES>::Encryption aesgcm_e;
     CryptoPP::GCM<CryptoPP::AES>::Decryption aesgcm_d;
 
+    CryptoPP::CTR_Mode<CryptoPP::AES>::Encryption aesctr_e;
+
+    // the modes are keyed on their first use after setkey(): most keys are used with one or two
+    // of them (an attribute decryption is a single CBC pass), and the key schedules of the rest,
+    // the GCM tables above all, would cost more than the data they are used for
+    enum
+    {
+        ECB_E = 1 << 0, ECB_D = 1 << 1,
+        CBC_E = 1 << 2, CBC_D = 1 << 3,
+        CCM16_E = 1 << 4, CCM16_D = 1 << 5,
+        CCM8_E = 1 << 6, CCM8_D = 1 << 7,
+        GCM_E = 1 << 8, GCM_D = 1 << 9,
+        CTR_E = 1 << 10
+    };
+    unsigned keyedmodes = 0;
+
+    void keymode(unsigned mode)
+    {
+        if (!(keyedmodes & mode))
+        {
+            setmodekey(mode);
+        }
+    }
+    void setmodekey(unsigned mode);
+
 public:
     static byte zeroiv[CryptoPP::AES::BLOCKSIZE];
 
     static const int BLOCKSIZE = CryptoPP::AES::BLOCKSIZE;
     static const int KEYLENGTH = CryptoPP::AES::BLOCKSIZE;
 
-    byte key[KEYLENGTH];
+    byte key[KEYLENGTH] = {};
 
     typedef uint64_t ctr_iv;
 
@@ -130,6 +155,18 @@ public:
      */
     void ecb_decrypt(byte*, size_t = BLOCKSIZE);
 
+    /**
+     * @brief Decrypt (in-place) many keys wrapped with this one, in one pass.
+     *
+     * The blocks of all of them are decrypted together, so that they are
+     * pipelined with AES-NI or the ARMv8 crypto extensions where the CPU has them.
+     *
+     * @param keys The keys to decrypt.
+     * @param lengths Length of each key in bytes, a multiple of SymmCipher::BLOCKSIZE.
+     * @param count Number of keys.
+     */
+    void ecb_decrypt_keys(byte* const* keys, const unsigned* lengths, size_t count);
+
     /**
      * @brief Encrypt symmetrically using AES in CBC mode.
      *
@@ -284,7 +321,39 @@ public:
      */
     void serializekeyforjs(std::string *);
 
+    /**
+     * @brief Encrypt or decrypt symmetrically using AES in CTR mode, with the
+     * CBC-MAC of the plain text in mac (if not NULL).
+     *
+     * With pipelinedctr (the default), the keystream of many blocks is generated
+     * at once, with AES-NI or the ARMv8 crypto extensions where the CPU has them.
+     * Otherwise it goes block by block.
+     */
     void ctr_crypt(byte *, unsigned, m_off_t, ctr_iv, byte *, bool, bool initmac = true);
+    static bool pipelinedctr;
+
+    // bytes of keystream generated at once by the pipelined ctr_crypt()
+    static const unsigned CTRCHUNK = 4096;
+
+    // a piece of data for ctr_crypt_chunks(), with its own CBC-MAC
+    struct CtrChunk
+    {
+        byte* data;
+        unsigned len;
+        m_off_t pos;
+        byte* mac;
+        bool initmac;
+    };
+
+    /**
+     * @brief The same as ctr_crypt() for count independent pieces of data, each with
+     * its own CBC-MAC (eg. the chunks of a transfer).
+     *
+     * The CBC-MAC of one piece goes block by block, but those of up to MACLANES pieces
+     * advance together, so that their AES rounds run interleaved.
+     */
+    void ctr_crypt_chunks(CtrChunk* chunks, size_t count, ctr_iv ctriv, bool encrypt);
+    static const unsigned MACLANES = 8;
 
     static void setint64(int64_t, byte*);
 
@@ -442,11 +511,21 @@ public:
     void get(std::string*);
 };
 
+// CRC32 (of the IEEE polynomial, as zlib's).  On x86 CPUs with PCLMULQDQ, the data is folded 64
+// bytes at a time with carry-less multiplications; otherwise Crypto++ works it out (with the
+// ARMv8 CRC32 instructions where the CPU has them)
 class MEGA_API HashCRC32
 {
     CryptoPP::CRC32 hash;
 
+    bool clmul;
+    uint32_t crc;
+
 public:
+    // for comparison with Crypto++: to be set before the HashCRC32 are made
+    static bool clmulcrc;
+
+    HashCRC32();
     void add(const byte*, unsigned);
     void get(byte*);
 };
@@ -28,6 +28,30 @@ namespace mega {
 // generic host transactional database access interface
 class DBTableTransactionCommitter;
 
+// what a node record is indexed by, in the tables that can be queried for nodes
+struct MEGA_API DbNodeColumns
+{
+    DbNodeColumns() = default;
+    explicit DbNodeColumns(const Node&);
+
+    handle nodehandle = UNDEF;
+    handle parenthandle = UNDEF;
+    int type = TYPE_UNKNOWN;
+    m_off_t size = -1;
+    m_time_t ctime = 0;
+
+    // FileFingerprint::serializefingerprint(), for files with a valid fingerprint
+    string fingerprint;
+};
+
+// a node record and its columns
+struct MEGA_API DbNodeRecord
+{
+    uint32_t id;
+    DbNodeColumns columns;
+    string data;
+};
+
 class MEGA_API DbTable
 {
     static const int IDSPACING = 16;
@@ -41,6 +65,9 @@ protected:
     // should be called by the subclass' destructor
     void resetCommitter();
 
+    // the data stored for a Cacheable; false if it can't be serialized
+    bool encrypt(uint32_t type, Cacheable*, SymmCipher*, string*);
+
 public:
     // for a full sequential get: rewind to first record
     virtual void rewind() = 0;
@@ -49,6 +76,12 @@ public:
     virtual bool next(uint32_t*, string*) = 0;
     bool next(uint32_t*, string*, SymmCipher*);
 
+    // get next record without decrypting it (records of type 0 are not encrypted)
+    bool nextencrypted(uint32_t*, string*);
+
+    // a record with this id exists (for records read other than through next())
+    void reserveid(uint32_t);
+
     // get specific record by key
     virtual bool get(uint32_t, string*) = 0;
 
@@ -60,6 +93,61 @@ public:
     // delete specific record
     virtual bool del(uint32_t) = 0;
 
+    // records ready to be written by putBatch(): ids and padded, encrypted data
+    typedef vector<std::pair<uint32_t, string>> RecordBatch;
+
+    // serialize and encrypt a record into batch, assigning its id if it doesn't have one yet
+    void addToBatch(RecordBatch& batch, uint32_t type, Cacheable*, SymmCipher*);
+
+    // update or add / delete many records, stopping at the first failure.  These put() and del()
+    // one by one unless the implementation has something cheaper for bulk writes
+    virtual bool putBatch(const RecordBatch&);
+    virtual bool delBatch(const vector<uint32_t>&);
+
+    // delete the records with these ids, in ascending order, which are all the records from the
+    // first id to the last one: delBatch() unless the implementation can delete the range at once
+    virtual bool delRange(const vector<uint32_t>&);
+
+    // delete records with the ids that put() assigned, in any order.  Each id has a place of its
+    // own in steps of IDSPACING, so records in consecutive places (as the nodes of a subtree
+    // written together) are all the records of their range and go by delRange()
+    bool delSpaced(vector<uint32_t> ids);
+
+    // node records and their columns, written to the tables that keep them by putNodeRecord()
+    // (the others store them as they would any other record)
+    typedef vector<DbNodeRecord> NodeRecordBatch;
+    bool putNode(uint32_t type, Node*, SymmCipher*);
+    void addNodeToBatch(NodeRecordBatch& batch, uint32_t type, Node*, SymmCipher*);
+    bool putNodeBatch(const NodeRecordBatch&);
+    virtual bool putNodeRecord(const DbNodeRecord&);
+
+    // record ids and handles of the nodes found by the queries below
+    typedef vector<std::pair<uint32_t, handle>> NodeRefs;
+
+    // query the node records by column: false if the table can't answer (it has no columns, or
+    // holds node records written before it had them)
+    virtual bool getChildren(handle parent, NodeRefs*);
+    virtual bool getByFingerprint(const FileFingerprint&, NodeRefs*);
+
+    // whether all node records have columns.  Set, after writing them all again with their
+    // columns, by whoever has the key to read them, and by truncate()
+    virtual bool nodeIndexComplete();
+    virtual void setNodeIndexComplete();
+
+    // space in the table's file that no records use any more, left by put() and del() churn:
+    // how much there is, and give back up to maxBytes of it (returning how much was).  Both 0
+    // where the space can't be reclaimed a bit at a time, which vacuum() changes
+    virtual int64_t reclaimableBytes();
+    virtual int64_t reclaimSpace(int64_t maxBytes);
+
+    // rewrite the table compactly, in a layout that reclaimSpace() can work on from then on.
+    // Slow for large tables, and not available in a transaction
+    virtual bool vacuum();
+
+    // a number that changes whenever another connection commits to the table's database, for
+    // tables that another process writes.  0 where that can't be told
+    virtual int64_t dataVersion();
+
     // delete all records
     virtual void truncate() = 0;
 
@@ -75,6 +163,11 @@ public:
     // permanantly remove all database info
     virtual void remove() = 0;
 
+    // the same, but the files of the database are only moved out of the way, so that a new one can take
+    // their place: they are appended to files, for the caller to delete them when it suits (off the
+    // client thread at logout, for example).  Tables without files of their own just remove()
+    virtual void removeLater(vector<LocalPath>& files);
+
     // whether an unmatched begin() has been issued
     virtual bool inTransaction() const = 0;
 
@@ -149,19 +242,87 @@ public:
     MEGA_DISABLE_COPY_MOVE(DBTableTransactionCommitter)
 };
 
+// A table that another instance of the client owns and writes, read through one opened with
+// DB_OPEN_FLAG_READONLY.  Reads go to that table and see each of the owner's commits once it is
+// made.  Writes and remove() are dropped, as the owner makes the same changes to its records;
+// transactions are only kept track of, so that no read transaction holds back the owner's
+// checkpoints of the write-ahead log
+class MEGA_API ReadOnlyDbTable : public DbTable
+{
+public:
+    ReadOnlyDbTable(PrnGen& rng, std::unique_ptr<DbTable> table);
+    ~ReadOnlyDbTable();
+
+    void rewind() override;
+    bool next(uint32_t*, string*) override;
+    bool get(uint32_t, string*) override;
+    bool put(uint32_t, char*, unsigned) override;
+    bool del(uint32_t) override;
+    bool putBatch(const RecordBatch&) override;
+    bool delBatch(const vector<uint32_t>&) override;
+    bool putNodeRecord(const DbNodeRecord&) override;
+    bool getChildren(handle, NodeRefs*) override;
+    bool getByFingerprint(const FileFingerprint&, NodeRefs*) override;
+    bool nodeIndexComplete() override;
+    void setNodeIndexComplete() override;
+    int64_t dataVersion() override;
+    void truncate() override;
+    void begin() override;
+    void commit() override;
+    void abort() override;
+    void remove() override;
+    bool inTransaction() const override;
+
+private:
+    std::unique_ptr<DbTable> mTable;
+    bool mInTransaction = false;
+};
+
 enum DbOpenFlag
 {
     // Recycle legacy database, if present.
     DB_OPEN_FLAG_RECYCLE = 0x1,
     // Operations should always be transacted.
-    DB_OPEN_FLAG_TRANSACTED = 0x2
+    DB_OPEN_FLAG_TRANSACTED = 0x2,
+    // Only read an existing database, which another process writes (see ReadOnlyDbTable).
+    DB_OPEN_FLAG_READONLY = 0x4
 }; // DbOpenFlag
 
+// engine settings applied by DbAccess::open() to the tables it opens, zero for the engine's default
+struct MEGA_API DbTuning
+{
+    enum
+    {
+        PROFILE_DEFAULT = 0,     // the engine's defaults
+        PROFILE_LOW_MEMORY = 1,  // small caches, for devices short of memory
+        PROFILE_THROUGHPUT = 2,  // large caches and fewer waits for the disk, for desktops and servers
+    };
+
+    static DbTuning forProfile(int profile);
+
+    // wait for the disk in checkpoints only, not in every commit (with a write-ahead log, a power
+    // failure can then lose the last commits, but doesn't corrupt the database)
+    bool synchronousNormal = false;
+
+    int cacheSizeKiB = 0;
+    int64_t mmapSize = 0;
+
+    // only for databases created from now on
+    int pageSize = 0;
+
+    // checkpoint the write-ahead log after a commit every this many seconds, instead of from
+    // whichever commit makes it reach 1000 pages
+    int checkpointIntervalSecs = 0;
+};
+
 struct MEGA_API DbAccess
 {
     static const int LEGACY_DB_VERSION;
     static const int DB_VERSION;
 
+    // for the tables opened from now on
+    DbTuning tuning;
+
     DbAccess();
 
     virtual ~DbAccess() { }
@@ -172,6 +333,9 @@ struct MEGA_API DbAccess
 
     virtual const LocalPath& rootPath() const = 0;
 
+    // the memory the engine takes for its tables, or -1 if it can't tell
+    virtual m_off_t memoryUsed() const { return -1; }
+
     int currentDbVersion;
 };
 
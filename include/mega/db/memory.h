@@ -0,0 +1,119 @@
+/**
+ * @file mega/db/memory.h
+ * @brief Database access interface keeping its tables in memory
+ *
+ * (c) 2013-2021 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#ifndef MEGA_DB_MEMORY_H
+#define MEGA_DB_MEMORY_H 1
+
+#include <map>
+#include <set>
+#include <tuple>
+
+#include "mega/db.h"
+
+namespace mega {
+
+// the records of a table, and the columns of those put as nodes, indexed as SqliteDbTable does
+struct MEGA_API MemoryDbStore
+{
+    std::map<uint32_t, string> records;
+    std::map<uint32_t, DbNodeColumns> columns;
+
+    // (parenthandle, id) and (fingerprint, size, id) of the node records
+    std::set<std::pair<handle, uint32_t>> children;
+    std::set<std::tuple<string, m_off_t, uint32_t>> fingerprints;
+
+    // removed by its table: the name can be probed and opened again as a new, empty table
+    bool removed = false;
+
+    void put(uint32_t id, string data, const DbNodeColumns* columns);
+    void erase(uint32_t id);
+    void clear();
+};
+
+// A table that lives in memory, with the semantics of SqliteDbTable: transactions that can be
+// aborted, and node records that can be queried by column.  Its records outlive it in the
+// MemoryDbAccess that opened it, so a table opened again by name finds what was written to it
+class MEGA_API MemoryDbTable : public DbTable
+{
+public:
+    MemoryDbTable(PrnGen& rng, std::shared_ptr<MemoryDbStore> store, bool checkAlwaysTransacted);
+    ~MemoryDbTable();
+
+    void rewind() override;
+    bool next(uint32_t*, string*) override;
+    bool get(uint32_t, string*) override;
+    bool put(uint32_t, char*, unsigned) override;
+    bool del(uint32_t) override;
+    bool putNodeRecord(const DbNodeRecord&) override;
+    bool getChildren(handle, NodeRefs*) override;
+    bool getByFingerprint(const FileFingerprint&, NodeRefs*) override;
+    bool nodeIndexComplete() override;
+    void setNodeIndexComplete() override;
+    void truncate() override;
+    void begin() override;
+    void commit() override;
+    void abort() override;
+    void remove() override;
+    bool inTransaction() const override;
+
+private:
+    std::shared_ptr<MemoryDbStore> mStore;
+
+    // what the transaction in progress changed, to be put back by abort(): the store as of
+    // begin() if the transaction truncated it, and otherwise the records changed (null if they
+    // didn't exist) and the columns they had
+    bool mInTransaction = false;
+    unique_ptr<MemoryDbStore> mTruncated;
+    std::map<uint32_t, std::pair<unique_ptr<string>, unique_ptr<DbNodeColumns>>> mUndo;
+
+    // where next() is: records are found again by id, so that they can be deleted while scanned
+    bool mScanning = false;
+    uint32_t mScanId = 0;
+
+    void saveForUndo(uint32_t id);
+
+    // put back into store what mUndo saved, emptying it
+    void undo(MemoryDbStore& store);
+};
+
+class MEGA_API MemoryDbAccess : public DbAccess
+{
+public:
+    // rootPath is only where the client keeps other files (see DbAccess::rootPath())
+    explicit MemoryDbAccess(const LocalPath& rootPath = LocalPath());
+
+    MemoryDbTable* open(PrnGen& rng, FileSystemAccess& fsAccess, const string& name, const int flags = 0x0) override;
+
+    bool probe(FileSystemAccess& fsAccess, const string& name) const override;
+
+    const LocalPath& rootPath() const override;
+
+    // the data of the records and of their columns
+    m_off_t memoryUsed() const override;
+
+private:
+    LocalPath mRootPath;
+    std::map<string, std::shared_ptr<MemoryDbStore>> mStores;
+};
+
+} // namespace
+
+#endif
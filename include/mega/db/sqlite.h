@@ -34,19 +34,65 @@ class MEGA_API SqliteDbTable : public DbTable
     string dbfile;
     FileSystemAccess *fsaccess;
 
+    // compiled once and reused by get(), put() and del() (and their batch versions)
+    sqlite3_stmt* mGetStmt = nullptr;
+    sqlite3_stmt* mPutStmt = nullptr;
+    sqlite3_stmt* mDelStmt = nullptr;
+    sqlite3_stmt* mDelRangeStmt = nullptr;
+
+    // node records have a table of their own, with indexed columns (not in legacy databases)
+    bool mNodeTable;
+    sqlite3_stmt* mPutNodeStmt = nullptr;
+    sqlite3_stmt* mDelNodeStmt = nullptr;
+    sqlite3_stmt* mDelNodeRangeStmt = nullptr;
+    sqlite3_stmt* mChildrenStmt = nullptr;
+    sqlite3_stmt* mFingerprintStmt = nullptr;
+
+    // migrated from the layout without the node table, and node records not written again with
+    // their columns since may still be in statecache
+    bool mNodesInStatecache = false;
+
+    int prepare(sqlite3_stmt*& stmt, const char* sql);
+    bool putrecord(uint32_t, const char*, unsigned);
+    bool delrecord(uint32_t);
+    bool execid(sqlite3_stmt*& stmt, const char* sql, uint32_t);
+    bool execrange(sqlite3_stmt*& stmt, const char* sql, uint32_t, uint32_t);
+    bool querynodes(sqlite3_stmt* stmt, int rc, NodeRefs*);
+    int userversion();
+    int64_t pragma(const char* name);
+    void finalize();
+
+    // seconds between checkpoints run by commit(), if sqlite's automatic ones are disabled
+    int mCheckpointInterval;
+    std::chrono::steady_clock::time_point mLastCheckpoint;
+    void checkpoint();
+
 public:
     void rewind();
     bool next(uint32_t*, string*);
     bool get(uint32_t, string*);
     bool put(uint32_t, char*, unsigned);
     bool del(uint32_t);
+    bool putBatch(const RecordBatch&) override;
+    bool delBatch(const vector<uint32_t>&) override;
+    bool delRange(const vector<uint32_t>&) override;
+    bool putNodeRecord(const DbNodeRecord&) override;
+    bool getChildren(handle, NodeRefs*) override;
+    bool getByFingerprint(const FileFingerprint&, NodeRefs*) override;
+    bool nodeIndexComplete() override;
+    void setNodeIndexComplete() override;
+    int64_t reclaimableBytes() override;
+    int64_t reclaimSpace(int64_t maxBytes) override;
+    bool vacuum() override;
+    int64_t dataVersion() override;
     void truncate();
     void begin();
     void commit();
     void abort();
     void remove();
+    void removeLater(vector<LocalPath>& files) override;
 
-    SqliteDbTable(PrnGen &rng, sqlite3*, FileSystemAccess &fsAccess, const string &path, const bool checkAlwaysTransacted);
+    SqliteDbTable(PrnGen &rng, sqlite3*, FileSystemAccess &fsAccess, const string &path, const bool checkAlwaysTransacted, int checkpointIntervalSecs = 0, bool nodeTable = false);
     ~SqliteDbTable();
 
     bool inTransaction() const override;
@@ -58,6 +104,8 @@ class MEGA_API SqliteDbAccess : public DbAccess
 {
     LocalPath mRootPath;
 
+    SqliteDbTable* openReadOnly(PrnGen &rng, FileSystemAccess& fsAccess, const LocalPath& dbPath, const int flags);
+
 public:
     explicit SqliteDbAccess(const LocalPath& rootPath);
 
@@ -72,6 +120,9 @@ public:
     bool probe(FileSystemAccess& fsAccess, const string& name) const override;
 
     const LocalPath& rootPath() const override;
+
+    // that of all the databases of the process: SQLite doesn't tell them apart
+    m_off_t memoryUsed() const override;
 };
 
 } // namespace
@@ -50,6 +50,9 @@ struct MEGA_API File: public FileFingerprint
     // update localname
     virtual void updatelocalname() { }
 
+    // the scheduling class of transfers of this file: started by the app unless overridden
+    virtual transferclass_t transferclass() const { return TRANSFERCLASS_INTERACTIVE; }
+
     // generic filename for this transfer
     void displayname(string*);
 
@@ -78,6 +81,9 @@ struct MEGA_API File: public FileFingerprint
 
         // is the source file temporary?
         bool temporaryfile : 1;
+
+        // is its tctable record out of date? (see MegaClient::batchtransfercache)
+        bool cachedirty : 1;
     };
 
     // private auth to access the node
@@ -124,6 +130,8 @@ struct MEGA_API SyncFileGet: public File
     // update localname (may have changed due to renames/moves of the synced files)
     void updatelocalname();
 
+    transferclass_t transferclass() const override { return TRANSFERCLASS_SYNC; }
+
     // self-destruct after completion
     void completed(Transfer*, LocalNode*);
 
@@ -22,11 +22,14 @@
 #ifndef MEGA_FILEATTRIBUTEFETCH_H
 #define MEGA_FILEATTRIBUTEFETCH_H 1
 
+#include <list>
+
 #include "backofftimer.h"
 #include "types.h"
 #include "http.h"
 
 namespace mega {
+class DbTable;
 
 // file attribute fetching for a specific source cluster
 struct MEGA_API FileAttributeFetchChannel
@@ -36,24 +39,53 @@ struct MEGA_API FileAttributeFetchChannel
     handle fahref;
 
     BackoffTimer bt;
-    BackoffTimer timeout;
 
-    HttpReq req;
     dstime urltime;
     string posturl;
-    size_t inbytes;
 
+    // a CommandGetFA is asking for posturl
+    bool gettingurl;
+
+    // fresh (or retrying) and pending attributes
     faf_map fafs[2];
     error e;
 
-    // dispatch new and retrying attributes by POSTing to existing URL
+    // a POST of attribute handles to posturl, and the attributes it asked for
+    struct Fetch
+    {
+        HttpReq req;
+        BackoffTimer timeout;
+        size_t inbytes = 0;
+        vector<handle> handles;
+
+        explicit Fetch(PrnGen& rng) : timeout(rng) { }
+    };
+
+    // the fetches in flight, up to maxfetches at once: one more each time one completes while
+    // fresh attributes wait (up to MAXFETCHES), and back to one when one fails
+    std::vector<std::unique_ptr<Fetch>> fetches;
+    unsigned maxfetches;
+    static const unsigned MAXFETCHES = 4;
+
+    // attributes a fetch asks for, at the least, when the fresh ones are shared among fetches
+    static const size_t MINFETCHBATCH = 16;
+
+    // dispatch the fresh attributes by POSTing them to posturl, shared among the fetches there
+    // is room for
     void dispatch();
 
     // parse fetch result and remove completed attributes from pending
-    void parse(int, bool);
+    void parse(Fetch&, bool);
+
+    // notify app of the attributes of handles that are still pending: they failed to arrive
+    void failed(const vector<handle>& handles);
 
-    // notify app of nodes that failed to receive their requested attribute
-    void failed();
+    // the URL couldn't be had: the fresh attributes fail
+    void urlfailed(error);
+
+    // what a fetch asked for and didn't get goes back to the fresh attributes, without counting
+    // as a retry (its connection was torn down)
+    void requeue(const Fetch&);
 
     FileAttributeFetchChannel(MegaClient*);
 };
@@ -69,6 +101,71 @@ struct MEGA_API FileAttributeFetch
 
     FileAttributeFetch(handle, string, fatype, int);
 };
+
+// The file attributes (thumbnails, previews) fetched before, kept so that showing them again
+// doesn't download them again.  They are kept as they arrive from the storage servers, still
+// encrypted with the key of their node, and by attribute handle: new attributes of a node have
+// new handles, so nothing kept is ever stale.  In memory, or in a table once persist()ed, and up
+// to a capacity in bytes (0, the default, keeps nothing), beyond which the least recently used
+// are dropped
+class MEGA_API FileAttributeCache
+{
+public:
+    FileAttributeCache();
+    ~FileAttributeCache();
+
+    void setCapacity(m_off_t bytes);
+    m_off_t capacity() const { return mCapacity; }
+
+    // bytes kept
+    m_off_t size() const { return mSize; }
+
+    bool contains(handle fah) const;
+
+    // the encrypted data of attribute fah, if kept
+    bool get(handle fah, string& data);
+
+    // keep the encrypted data of attribute fah
+    void put(handle fah, const char* data, size_t len);
+
+    // load the index of the attributes kept in table, and keep them there (rather than in memory)
+    // from now on
+    void persist(std::unique_ptr<DbTable> table);
+    bool persisted() const;
+
+    // write what was put since the last commit, in one transaction
+    void commit();
+
+    // forget what's kept, and close the table, deleting it if remove
+    void close(bool remove);
+
+private:
+    struct Entry
+    {
+        uint32_t id = 0;
+        size_t size = 0;
+
+        // when not persisted
+        string data;
+
+        std::list<handle>::iterator lru;
+    };
+
+    std::map<handle, Entry> mEntries;
+
+    // most recently used first
+    std::list<handle> mLru;
+
+    m_off_t mCapacity = 0;
+    m_off_t mSize = 0;
+
+    std::unique_ptr<DbTable> mTable;
+    uint32_t mNextId = 1;
+    bool mUncommitted = false;
+
+    void begin();
+    void evict();
+};
 } // namespace
 
 #endif
@@ -22,6 +22,10 @@
 #pragma once
 
 #include <array>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
 
 #include "types.h"
 #include "filesystem.h"
@@ -55,12 +59,20 @@ struct MEGA_API FileFingerprint : public Cacheable
 
     bool serialize(string* d) override;
     static FileFingerprint* unserialize(string* d);
+
+    // read a serialized fingerprint in place, advancing ptr past it
+    static bool unserialize(const char*& ptr, const char* end, FileFingerprint& fp);
 };
 
 // orders transfers by file fingerprints, ordered by size / mtime / sparse CRC
 struct MEGA_API FileFingerprintCmp
 {
     bool operator()(const FileFingerprint* a, const FileFingerprint* b) const;
+
+    bool operator()(const FileFingerprint& a, const FileFingerprint& b) const
+    {
+        return (*this)(&a, &b);
+    }
 };
 
 bool operator==(const FileFingerprint& lhs, const FileFingerprint& rhs);
@@ -87,4 +99,130 @@ struct MEGA_API LightFileFingerprintCmp
 
 bool operator==(const LightFileFingerprint& lhs, const LightFileFingerprint& rhs);
 
+class DbTable;
+
+// The fingerprints of local files by path, trusted for as long as a file keeps the size, mtime and
+// fsid (where the filesystem has them) that it had: a file found unchanged that way is not read
+// again to be fingerprinted.  That's the trust that syncs place in LightFileFingerprint.  With a
+// table to persist to, the fingerprints of files with an fsid are also kept by fsid across
+// restarts (and renames)
+class MEGA_API FileFingerprintCache
+{
+public:
+    FileFingerprintCache();
+    ~FileFingerprintCache();
+
+    // fingerprint the file at path, open in fa, as FileFingerprint::genfingerprint() does
+    void genfingerprint(const LocalPath& path, FileAccess* fa, FileFingerprint& fp);
+
+    // the two halves of genfingerprint(), for callers that read the file without holding what
+    // guards the cache: whether fp could be had from the cache, and keep what the file gave
+    bool lookup(const LocalPath& path, FileAccess* fa, FileFingerprint& fp);
+    void store(const LocalPath& path, FileAccess* fa, const FileFingerprint& fp);
+
+    // load the fingerprints kept in table, and keep those of files with an fsid there from now
+    // on.  The records aren't encrypted: they only hold what the filesystem tells anyone who can
+    // read the files (fsid, size, mtime and the CRCs of samples of the data)
+    void persist(std::unique_ptr<DbTable> table);
+    bool persisted() const;
+
+    // write what was stored since the last commit, in one transaction
+    void commit();
+
+    void clear();
+    size_t size() const;
+
+    // the files fingerprinted from the cache, and read
+    size_t hits = 0;
+    size_t misses = 0;
+
+    // entries beyond which the first ones added are dropped
+    static const size_t MAX_ENTRIES = 65536;
+
+    // fsids beyond which no more are persisted
+    static const size_t MAX_PERSISTED = 1 << 20;
+
+private:
+    struct Entry
+    {
+        LightFileFingerprint light;
+        handle fsid;
+        FileFingerprint fingerprint;
+    };
+
+    std::map<LocalPath, Entry> mEntries;
+    std::deque<LocalPath> mAdded;
+
+    struct Persisted
+    {
+        uint32_t id;
+        LightFileFingerprint light;
+        FileFingerprint fingerprint;
+    };
+
+    std::unique_ptr<DbTable> mTable;
+    std::map<handle, Persisted> mByFsid;
+    uint32_t mNextId = 1;
+    bool mUncommitted = false;
+};
+
+// Fingerprints local files on the worker threads of a MegaClientAsyncQueue, so that the reads of
+// their samples (slow on a network share) don't hold up the client's thread, and several files can
+// be read at once.  The workers wake the client's waiter up as they finish
+class MEGA_API AsyncFingerprinter
+{
+public:
+    explicit AsyncFingerprinter(MegaClientAsyncQueue& queue);
+
+    // start fingerprinting the file at path through fa, not open yet, unless it's requested
+    // already.  False if too many requests are pending, in which case nothing is done.
+    // A file found with the size and mtime of known is not read (it hasn't changed)
+    bool request(const LocalPath& path, unique_ptr<FileAccess> fa, const FileFingerprint* known = nullptr);
+
+    // what was found at a path: whether it opened, its type, size and mtime, and for files the
+    // fingerprint
+    struct Result
+    {
+        bool opened = false;
+        nodetype_t type = TYPE_UNKNOWN;
+        m_off_t size = -1;
+        m_time_t mtime = 0;
+        FileFingerprint fingerprint;
+    };
+
+    enum State { NOT_REQUESTED, PENDING, DONE };
+
+    // once DONE, out has the result, and the path is no longer requested
+    State take(const LocalPath& path, Result& out);
+
+    // fingerprint the file at path, open in fa, as FileFingerprint::genfingerprint() does: with
+    // the result of a request, waiting for it if need be, if the file still has its size and mtime
+    bool genfingerprint(const LocalPath& path, FileAccess* fa, FileFingerprint& fp);
+
+    // forget the request for a path, if any (in progress, it finishes to no one)
+    void forget(const LocalPath& path);
+
+    // forget all requests (those in progress finish to no one)
+    void clear();
+
+    size_t requested() const;
+
+    static const size_t MAX_REQUESTED = 256;
+
+    // how far ahead of what they're processing callers should request
+    static const size_t LOOKAHEAD = 32;
+
+private:
+    struct Job
+    {
+        std::mutex mutex;
+        std::condition_variable finished;
+        bool done = false;
+        Result result;
+    };
+
+    MegaClientAsyncQueue& mQueue;
+    std::map<LocalPath, std::shared_ptr<Job>> mJobs;
+};
+
 } // mega
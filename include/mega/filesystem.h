@@ -137,6 +137,12 @@ public:
     bool beginsWithSeparator() const;
     size_t reportSize() const { return localpath.size() * sizeof(separator_t); } // only for reporting, not logic
 
+    // in characters of the platform encoding, as the byte positions taken by truncate() or subpathFrom()
+    size_t length() const { return localpath.size(); }
+
+    // make room for a path this long, so that building it by appending doesn't reallocate
+    void reserve(size_t length) { localpath.reserve(length); }
+
     // get the index of the leaf name.  A trailing separator is considered part of the leaf.
     size_t getLeafnameByteIndex(const FileSystemAccess& fsaccess) const;
     bool backEqual(size_t bytePos, const LocalPath& compareTo) const;
@@ -178,6 +184,7 @@ public:
     bool operator==(const LocalPath& p) const { return localpath == p.localpath; }
     bool operator!=(const LocalPath& p) const { return localpath != p.localpath; }
     bool operator<(const LocalPath& p) const { return localpath < p.localpath; }
+    size_t hash() const { return std::hash<decltype(localpath)>()(localpath); }
 };
 
 void AddHiddenFileAttribute(mega::LocalPath& path);
@@ -322,6 +329,18 @@ struct MEGA_API FileAccess
     // Truncate a file.
     virtual bool ftruncate() = 0;
 
+    // Reserve the disk space for a file being written that will end up size bytes long, so that
+    // writes at scattered offsets don't leave it fragmented.  The file keeps the size it has, and
+    // what isn't written yet reads as zeros.  False where the platform or filesystem can't
+    // (writes then allocate as they go, as before)
+    virtual bool fpreallocate(m_off_t) { return false; }
+
+    // The file is read once, front to back (as an upload reads it): from the next open, ask the
+    // OS for more read-ahead, and to drop from its cache what has been read, so that a large file
+    // doesn't push everything else out of memory.  Only hints, which filesystems (network ones,
+    // say) are free to ignore
+    virtual void setreadonce() { }
+
     FileAccess(Waiter *waiter);
     virtual ~FileAccess();
 
@@ -376,12 +395,30 @@ public:
 // generic host directory enumeration
 struct MEGA_API DirAccess
 {
+    // an entry of the folder, with what a FileAccess opened for it would find (if statok)
+    struct Entry
+    {
+        LocalPath name;
+        nodetype_t type = TYPE_UNKNOWN;
+        bool statok = false;
+        m_off_t size = 0;
+        m_time_t mtime = 0;
+        handle fsid = 0;
+        bool fsidvalid = false;
+        bool isSymLink = false;
+    };
+
     // open for scanning
     virtual bool dopen(LocalPath*, FileAccess*, bool) = 0;
 
     // get next record
     virtual bool dnext(LocalPath&, LocalPath&, bool = true, nodetype_t* = NULL) = 0;
 
+    // append the next records (up to max) of the folder at path to entries, with their type,
+    // size, mtime and fsid, in as few system calls as the platform allows and without opening
+    // them.  False if there were none left.  By default, dnext() and a FileAccess opened from it
+    virtual bool dnextbulk(LocalPath& path, vector<Entry>& entries, size_t max, bool followsymlinks, FileSystemAccess& fsaccess);
+
     virtual ~DirAccess() { }
 };
 
@@ -392,19 +429,49 @@ struct Notification
     LocalNode* localnode;
 };
 
-struct NotificationDeque : ThreadSafeDeque<Notification>
+// The notifications of a queue, coalesced by the path they are for: a path notified again before
+// it is processed goes once, to the back (the queue stays in the order of the last notification of
+// each path, so in the order they are ready once the delay after their last change is over).
+// The entries a scan queues for a new folder take the place of the notifications of its contents
+// that came before, as they are the same paths.
+// Notifications are pushed from any thread; the rest is for the sync thread only
+struct NotificationDeque
 {
-    void replaceLocalNodePointers(LocalNode* check, LocalNode* newvalue)
+    void pushBack(Notification&& n)
     {
-        std::lock_guard<std::mutex> g(m);
-        for (auto& n : mNotifications)
-        {
-            if (n.localnode == check)
-            {
-                n.localnode = newvalue;
-            }
-        }
+        mIncoming.push(std::move(n));
     }
+
+    bool peekFront(Notification&);
+    bool popFront(Notification&);
+    void unpopFront(const Notification&);
+
+    bool empty();
+    size_t size();
+
+    // call f with the first count notifications, front first, and the full paths they are for,
+    // until it returns false
+    void peek(size_t count, std::function<bool(const Notification&, const LocalPath&)> f);
+
+    void replaceLocalNodePointers(LocalNode* check, LocalNode* newvalue);
+
+private:
+    MpscQueue<Notification> mIncoming;
+
+    struct Queued
+    {
+        Notification notification;
+
+        // the full path notified
+        LocalPath path;
+    };
+
+    std::list<Queued> mQueued;
+    std::map<LocalPath, std::list<Queued>::iterator> mByPath;
+
+    // move the notifications pushed into mQueued
+    void collect();
+    void queue(Notification&&, bool front);
 };
 
 // generic filesystem change notification
@@ -551,6 +618,13 @@ struct MEGA_API FileSystemAccess : public EventTrigger
     // get the absolute path corresponding to a path
     virtual bool expanselocalpath(LocalPath& path, LocalPath& absolutepath) = 0;
 
+    // the current position (opaque) in the change journal of the filesystem of path, if it keeps one
+    virtual bool changecursor(const LocalPath&, string&) { return false; }
+
+    // the paths under path (relative to it) changed since cursor.  False if the journal no longer
+    // goes back that far, or can't tell
+    virtual bool changessince(const LocalPath&, const string&, vector<LocalPath>&) { return false; }
+
     // default permissions for new files
     int getdefaultfilepermissions() { return 0600; }
     void setdefaultfilepermissions(int) { }
@@ -22,6 +22,8 @@
 #ifndef GFX_H
 #define GFX_H 1
 
+#include <atomic>
+#include <condition_variable>
 #include <mutex>
 
 #include "megawaiter.h"
@@ -60,12 +62,16 @@ class MEGA_API GfxJobQueue
 {
     protected:
         std::deque<GfxJob *> jobs;
+
+        // popped only when there are no others
+        std::deque<GfxJob *> backgroundjobs;
         std::mutex mutex;
 
     public:
         GfxJobQueue();
-        void push(GfxJob *job);
+        void push(GfxJob *job, bool background = false);
         GfxJob *pop();
+        size_t size();
 };
 
 // bitmap graphics processor
@@ -76,11 +82,36 @@ class MEGA_API GfxProc
     std::mutex mutex;
     THREAD_CLASS thread;
     bool threadstarted = false;
+
+    // the threads startProcessingThread() asked for, started with the first job
+    unsigned threadsrequested = 0;
+    std::once_flag threadsonce;
+    void startthreads();
     SymmCipher mCheckEventsKey;
     GfxJobQueue requests;
     GfxJobQueue responses;
+
+    // more processors, each with its own thread, that take the requests of this one and push
+    // the results to its responses.  Of a worker, the processor it works for
+    std::vector<std::unique_ptr<GfxProc>> workers;
+    GfxProc* owner = this;
+
+    // the memory the bitmaps being processed are estimated to take (of the owner, for all its
+    // threads): a job waits for others to free theirs rather than take it beyond memorybudget,
+    // unless it would be the only one
+    std::atomic<m_off_t> memorybudget;
+
+    // of the owner, for all its threads
+    std::atomic<int> previewquality;
+    m_off_t memoryinuse = 0;
+    std::mutex budgetmutex;
+    std::condition_variable budgetfreed;
+    bool reservememory(m_off_t bytes);
+    void releasememory(m_off_t bytes);
+
     static void *threadEntryPoint(void *param);
     void loop();
+    void notifyworkers();
 
     // read and store bitmap
     virtual bool readbitmap(FileAccess*, const LocalPath&, int) = 0;
@@ -95,12 +126,23 @@ protected:
     // coordinate transformation
     static void transform(int&, int&, int&, int&, int&, int&);
 
+    // the JPEG quality (1-100) resizebitmap() is to encode at, 0 for that of the backend
+    int jpegquality = 0;
+
     // list of supported extensions (NULL if no pre-filtering is needed)
     virtual const char* supportedformats();
 
     // list of supported video extensions (NULL if no pre-filtering is needed)
     virtual const char* supportedvideoformats();
 
+    // another processor of the same kind, for one more processing thread (NULL if the bitmaps
+    // can't be processed on several threads at once)
+    virtual GfxProc* newprocessor();
+
+    // the memory readbitmap() would take for the file at size, estimated from its header (0 if
+    // unknown, which is counted as UNKNOWNBITMAPMEMORY)
+    virtual m_off_t bitmapmemory(const LocalPath&, int size);
+
 public:
     virtual int checkevents(Waiter*);
 
@@ -114,7 +156,8 @@ public:
     // handle is uploadhandle or nodehandle
     // - must respect JPEG EXIF rotation tag
     // - must save at 85% quality (120*120 pixel result: ~4 KB)
-    int gendimensionsputfa(FileAccess*, const LocalPath&, handle, SymmCipher*, int = -1, bool checkAccess = true);
+    // background jobs (syncs, attributes missing from existing nodes) wait for all the others
+    int gendimensionsputfa(FileAccess*, const LocalPath&, handle, SymmCipher*, int = -1, bool checkAccess = true, bool background = false);
 
     // FIXME: read dynamically from API server
     typedef enum { THUMBNAIL, PREVIEW } meta_t;
@@ -128,11 +171,38 @@ public:
     static const int dimensions[][2];
     static const int dimensionsavatar[][2];
 
+    // area-averaging downscale of a bitmap of 32-bit pixels (4 channels of 8 bits, in any order),
+    // src of sw*sh to dst of dw*dh (no larger).  Strides are in bytes, negative for the bitmaps
+    // stored bottom-up.  Vectorized where SSE2 or NEON are available, with the same results
+    static void downscale(const byte* src, int sw, int sh, ptrdiff_t srcstride, byte* dst, int dw, int dh, ptrdiff_t dststride);
+
     MegaClient* client;
     int w, h;
 
-    // start a thread that will do the processing
-    void startProcessingThread();
+    // have threads do the processing: this processor's, and threads - 1 more when newprocessor()
+    // provides processors for them.  They are started when the first file comes to be processed,
+    // so that clients that never make thumbnails don't run them
+    void startProcessingThread(unsigned threads = 1);
+
+    // the memory the bitmaps processed at once may take (0: no limit, the default)
+    void setmemorybudget(m_off_t bytes);
+
+    // the JPEG quality of the previews made for file attributes (0: that of the backend, the
+    // default).  Thumbnails and the images of savefa() keep that of the backend
+    void setpreviewquality(int quality);
+
+    // whether the files waiting to be processed are so many that uploads should wait for them
+    bool behind();
+
+    // the files waiting to be processed, and the memory taken by the bitmaps being processed
+    size_t pendingjobs();
+    m_off_t bitmapmemoryinuse();
+
+    // a bitmap whose size can't be estimated (an 8 megapixel photo)
+    static const m_off_t UNKNOWNBITMAPMEMORY = 32 * 1024 * 1024;
+
+    // files waiting per processing thread beyond which it's behind
+    static const size_t BEHINDJOBS = 16;
 
     GfxProc();
     virtual ~GfxProc();
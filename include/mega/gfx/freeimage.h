@@ -42,6 +42,12 @@ protected:
     string sformats;
     const char* supportedformats();
 
+    // each one has its own bitmap
+    GfxProc* newprocessor();
+
+    // from the header, for the formats whose loaders can read it alone
+    m_off_t bitmapmemory(const LocalPath&, int size);
+
 #ifdef HAVE_FFMPEG
     static std::mutex gfxMutex;
     const char* supportedformatsFfmpeg();
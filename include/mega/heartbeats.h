@@ -81,6 +81,13 @@ protected:
     m_time_t mLastAction = -1;   //timestamps of the last action
     m_time_t mLastBeat = -1;     //timestamps of the last beat
 
+    // what the last beat reported, so that another one saying the same can be skipped
+    int mSentStatus = -1;
+    int8_t mSentProgress = -1;
+    int32_t mSentUps = -1;
+    int32_t mSentDowns = -1;
+    handle mSentLastItem = UNDEF;
+
     void updateLastActionTime();
 };
 
@@ -120,6 +127,17 @@ public:
     MEGA_DISABLE_COPY(HeartBeatSyncInfo)
 
     virtual void updateStatus(UnifiedSync& us) override;
+
+    // how long (ds) the notifications of the sync waited to be scanned once the delay for their
+    // writes to settle was over: the last one, and the longest since the last beat
+    void addScanLatency(dstime ds);
+    dstime lastScanLatency() const { return mLastScanLatency; }
+    dstime maxScanLatency() const { return mMaxScanLatency; }
+
+private:
+    friend class BackupMonitor;
+    dstime mLastScanLatency = 0;
+    dstime mMaxScanLatency = 0;
 };
 #endif
 
@@ -192,7 +210,8 @@ class BackupMonitor
 public:
     explicit BackupMonitor(MegaClient * client);
 
-    void beat(); // produce heartbeats!
+    // produce heartbeats! returns how long (ds) to wait before the next ones
+    dstime beat();
 
     void onSyncConfigChanged();
     void updateOrRegisterSync(UnifiedSync&);
@@ -202,12 +221,18 @@ private:
 
     static constexpr int MAX_HEARBEAT_SECS_DELAY = 60*30; // max time to wait before a heartbeat for unchanged backup
 
+    // how often the backups are checked: while they change, and at most when they have been idle for long
+    static constexpr dstime MIN_BEAT_DELAY_DS = 300;
+    static constexpr dstime MAX_BEAT_DELAY_DS = 2400;
+
     mega::MegaClient *mClient = nullptr;
+    dstime mBeatDelay = MIN_BEAT_DELAY_DS;
 
     void updateBackupInfo(handle backupId, const BackupInfo &info);
 
 #ifdef ENABLE_SYNC
-    void beatBackupInfo(UnifiedSync& us);
+    // queues a heartbeat if the backup changed, or it has not beaten for maxAge seconds
+    bool beatBackupInfo(UnifiedSync& us, m_time_t maxAge);
 #endif
 };
 }
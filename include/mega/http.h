@@ -111,6 +111,9 @@ public:
     m_off_t lastRequestSpeed();
     dstime requestElapsedDs();
 
+    // from the start of the request to its first data (or to now, if none came yet)
+    dstime requestFirstDataDs();
+
 protected:
     // a circular buffer of bytes received/transmitted per decisecond
     std::array<m_off_t, SPEED_MEAN_MAX_INTERVAL_DS> mCircularBuf;
@@ -126,6 +129,25 @@ protected:
     m_off_t mRequestPos = 0;
     dstime mRequestStart = 0;
     dstime mLastRequestUpdate = 0;
+    dstime mRequestFirstData = 0;
+};
+
+// socket and buffer settings for the connections of transfers (GET and PUT), for links with a
+// large bandwidth-delay product, where the default windows limit each connection.  0 (or empty)
+// leaves the default of the OS or of the network layer
+struct MEGA_API TransferNetworkProfile
+{
+    // SO_RCVBUF and SO_SNDBUF, in bytes
+    int socketbuffer = 0;
+
+    // TCP_NOTSENT_LOWAT, in bytes: how much unsent data the socket keeps queued (where the OS has it)
+    int notsentlowat = 0;
+
+    // TCP_CONGESTION, eg. "bbr" (Linux, if the kernel has it and allows it to the process)
+    string congestion;
+
+    // the receive buffer of the network layer for downloads, in bytes
+    long receivebuffer = 0;
 };
 
 // generic host HTTP I/O interface
@@ -152,6 +174,20 @@ struct MEGA_API HttpIO : public EventTrigger
 
     virtual void disconnect() { }
 
+    // the settings of the transfer connections opened from now on.  Returns false if the network
+    // layer doesn't support them
+    TransferNetworkProfile transferprofile;
+    virtual bool settransferprofile(const TransferNetworkProfile&) { return false; }
+
+    // requests will go to url soon (a temp URL just received): get ready for them, eg. resolving its host
+    virtual void prewarm(const string&) { }
+
+    // the DNS cache, kept across restarts (see MegaClient::savednscache()).  dnscachechanged is
+    // set whenever an address is learned or dropped
+    bool dnscachechanged = false;
+    virtual bool serializednscache(string*) { return false; }
+    virtual void unserializednscache(const string&) { }
+
     // track Internet connectivity issues
     dstime noinetds;
     bool inetback;
@@ -211,6 +247,84 @@ struct MEGA_API HttpIO : public EventTrigger
     virtual ~HttpIO() { }
 };
 
+// The buffers that download data goes through (the ones HttpReqDL receives into, and the
+// FilePieces that raid parts and reassembled file data are kept in).  They are recycled by size,
+// rather than allocated and faulted in again for every request of up to MAX_REQ_SIZE.  Shared by
+// all clients in the process, and thread safe: pieces are released on the worker threads too
+class MEGA_API TransferBufferPool
+{
+public:
+    static TransferBufferPool& instance();
+
+    // a buffer of at least size bytes, from those released if there is one of its size class
+    byte* allocate(size_t size);
+
+    // give back a buffer from allocate() (NULL is ignored).  It's kept while the idle buffers take
+    // less than the idle limit, and freed otherwise
+    void release(byte* buf);
+
+    // the memory in buffers handed out beyond which no more downloads are started (0: no limit).
+    // Allocations are never refused: the downloads in progress carry on, and free their buffers
+    void setCeiling(size_t bytes);
+    bool overCeiling() const;
+
+    void setIdleLimit(size_t bytes);
+
+    size_t inUse() const;
+    size_t idle() const;
+
+    // sizes from GRANULE up are rounded up to a multiple of it, and smaller ones to a power of two
+    static const size_t GRANULE = 65536;
+    static const size_t DEFAULT_IDLE_LIMIT = 64 << 20;
+
+private:
+    mutable std::mutex mMutex;
+    std::map<size_t, std::vector<byte*>> mIdle;
+    std::map<byte*, size_t> mInUse;
+    size_t mInUseBytes = 0;
+    size_t mIdleBytes = 0;
+    size_t mCeiling = 0;
+    size_t mIdleLimit = DEFAULT_IDLE_LIMIT;
+
+    static size_t sizeClass(size_t size);
+
+    // free idle buffers, the largest first, until they take no more than the idle limit
+    void trim();
+};
+
+// A rate limit on the transfer data of the requests that count against it: a second's worth of
+// bytes at most can go in a burst, and what goes beyond that is paid back before more can go.
+// Data that arrives in blocks that can't be split (downloads) may take it into debt
+class MEGA_API TokenBucket
+{
+public:
+    // bytes per second, 0 for no limit
+    void setRate(m_off_t bps);
+    m_off_t rate() const;
+
+    // how many bytes can go now (at ds), which is 0 or less if the requests must wait
+    m_off_t allowance(dstime ds);
+
+    void consume(m_off_t bytes);
+
+    // the ds from which something can go again
+    dstime availableAt(dstime ds) const;
+
+    // the same over all the limits a request counts against, the tightest one deciding
+    static m_off_t allowance(const vector<TokenBucket*>& limits, dstime ds);
+    static void consume(const vector<TokenBucket*>& limits, m_off_t bytes);
+    static dstime availableAt(const vector<TokenBucket*>& limits, dstime ds);
+
+    static const m_off_t MIN_BURST = 65536;
+
+private:
+    m_off_t mRate = 0;
+    m_off_t mTokens = 0;
+    dstime mRefilled = 0;
+
+    m_off_t burst() const;
+};
+
 // outgoing HTTP request
 struct MEGA_API HttpReq
 {
@@ -219,6 +333,14 @@ struct MEGA_API HttpReq
 
     int httpstatus;
 
+    // how long the TCP handshake of the request's connection took, in ms (about a round trip): 0
+    // if it reused one that was open, or if the HttpIO doesn't tell
+    int connectms = 0;
+
+    // until the first byte of the response, in ms from the start of the request (0 if the HttpIO
+    // doesn't tell)
+    int ttfbms = 0;
+
     httpmethod_t method;
     contenttype_t type;
     int timeoutms;
@@ -241,6 +363,9 @@ struct MEGA_API HttpReq
     // if the out payload includes a fetch nodes command
     bool includesFetchingNodes = false;
 
+    // the response is consumed while it downloads: don't reserve space for all of it
+    bool streamed = false;
+
     byte* buf;
     m_off_t buflen, bufpos, notifiedbufpos;
 
@@ -253,6 +378,10 @@ struct MEGA_API HttpReq
     // Content-Type of the response
     string contenttype;
 
+    // Content-Encoding of the response, if it came compressed (what is put in `in` is decoded
+    // already, as it arrives)
+    string contentencoding;
+
     // HttpIO implementation-specific identifier for this connection
     void* httpiohandle;
 
@@ -291,7 +420,7 @@ struct MEGA_API HttpReq
         size_t start;
         size_t end;
 
-        http_buf_t(byte* b, size_t s, size_t e);  // takes ownership of the byte*, which must have been allocated with new[]
+        http_buf_t(byte* b, size_t s, size_t e);  // takes ownership of the byte*, which must come from TransferBufferPool::allocate()
         ~http_buf_t();
         void swap(http_buf_t& other);
         bool isNull();
@@ -321,6 +450,10 @@ struct MEGA_API HttpReq
     // timestamp of last data sent or received
     dstime lastdata;
 
+    // the rate limits its transfer data counts against, besides the global one of the HttpIO
+    // (see TokenBucket).  The HttpIO pauses the request while any of them is exhausted
+    vector<TokenBucket*> ratelimits;
+
     // prevent raw data from being dumped in debug mode
     bool binary;
 
@@ -372,12 +505,18 @@ public:
 
     bool encrypt(m_off_t pos, m_off_t npos, string& urlSuffix);
 
-private:
+protected:
     SymmCipher* key;
     chunkmac_map* macs;
     uint64_t ctriv;     // initialization vector for CTR mode
     byte crc[CRCSIZE];
-    void updateCRC(byte* data, unsigned size, unsigned offset);
+    static void updateCRC(byte* crc, byte* data, unsigned size, unsigned offset);
+
+    // encrypt and MAC the chunks from starts[i] to starts[i + 1], in a buffer holding the data
+    // from bufferpos, on the threads of queue and the calling one, with their CRC at their offset
+    // from pos.  meanwhile runs on the calling thread before it joins in
+    void encryptchunks(MegaClientAsyncQueue& queue, byte* buffer, m_off_t bufferpos, const vector<m_off_t>& starts,
+                       m_off_t pos, const std::function<void()>& meanwhile = nullptr);
 };
 
 class MEGA_API EncryptBufferByChunks : public EncryptByChunks
@@ -389,6 +528,12 @@ class MEGA_API EncryptBufferByChunks : public EncryptByChunks
 
 public:
     EncryptBufferByChunks(byte* b, SymmCipher* k, chunkmac_map* m, uint64_t iv);
+
+    using EncryptByChunks::encrypt;
+
+    // the same, with the chunks encrypted and MACed in parallel on the threads of queue (and the
+    // calling one); the chunk MACs and the CRC come out as from the sequential version
+    bool encrypt(MegaClientAsyncQueue& queue, m_off_t pos, m_off_t npos, string& urlSuffix);
 };
 
 // file chunk I/O
@@ -408,6 +553,9 @@ struct MEGA_API HttpReqUL : public HttpReqXfer
 
     void prepare(const char*, SymmCipher*, uint64_t, m_off_t, m_off_t);
 
+    // the same, spreading the chunks of the request over the threads of queue
+    void prepare(const char*, SymmCipher*, uint64_t, m_off_t, m_off_t, MegaClientAsyncQueue*);
+
     m_off_t transferred(MegaClient*);
 
     ~HttpReqUL() { }
@@ -26,6 +26,26 @@
 
 namespace mega {
 
+// characters of the buffer being scanned (eg. a name, or the contents of a string value), for
+// callers that only look at them or copy them once.  Valid for as long as the buffer is
+struct MEGA_API JSONView
+{
+    const char* data = nullptr;
+    size_t size = 0;
+
+    JSONView() = default;
+    JSONView(const char* d, size_t s) : data(d), size(s) { }
+
+    bool empty() const { return !size; }
+    string str() const { return string(data, size); }
+    void assignto(string* s) const { s->assign(data, size); }
+
+    bool operator==(const char* s) const { return !strncmp(data, s, size) && !s[size]; }
+    bool operator==(const string& s) const { return !s.compare(0, string::npos, data, size); }
+    bool operator!=(const char* s) const { return !(*this == s); }
+    bool operator!=(const string& s) const { return !(*this == s); }
+};
+
 // linear non-strict JSON scanner
 struct MEGA_API JSON
 {
@@ -49,6 +69,9 @@ struct MEGA_API JSON
     double getfloat();
     const char* getvalue();
 
+    // as getvalue(), but the extent of the value's contents (without quotes) is returned
+    JSONView getvalueview();
+
     fsfp_t getfp();
     uint64_t getuint64();
 
@@ -56,6 +79,7 @@ struct MEGA_API JSON
     nameid getnameid(const char*) const;
     string getname();
     string getnameWithoutAdvance() const;
+    JSONView getnameview();
 
     bool is(const char*);
 
@@ -73,9 +97,20 @@ struct MEGA_API JSON
     bool leaveobject();
 
     bool storeobject(string* = NULL);
+    bool storeobject(JSONView&);
 
     static void unescape(string*);
 
+    // one past the end of the object or array starting at ptr, or NULL if it doesn't end before end
+    static const char* objectend(const char* ptr, const char* end);
+
+    // the closing quote of the string whose contents start at ptr, or its terminating NUL
+    static const char* stringend(const char* ptr);
+
+    // use SSE2/NEON to skip over string contents where the build targets them (on by default; the
+    // byte-by-byte path gives identical results and is kept for platforms without them, and for tests)
+    static bool vectorscan;
+
     /**
      * @brief Extract a string value for a name in a JSON string
      * @param json JSON string to check
@@ -129,6 +164,12 @@ public:
     void openobject();
     void closeobject();
 
+    // preallocate for n more bytes, so that large documents are not reallocated as they grow
+    void reserve(size_t n);
+
+    // the length of the base64 encoding of a binary value of the given size
+    static size_t b64size(size_t n);
+
     const byte* getbytes() const;
     const string& getstring() const;
 
@@ -0,0 +1,80 @@
+/**
+ * @file mega/lazynodes.h
+ * @brief Index of the nodes left in the local cache by lazy loading
+ *
+ * (c) 2013-2021 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#ifndef MEGA_LAZYNODES_H
+#define MEGA_LAZYNODES_H 1
+
+#include <list>
+#include <unordered_map>
+
+#include "types.h"
+
+namespace mega {
+
+// Nodes that are in the state cache table but not in memory, by handle and by parent, so that
+// MegaClient can materialize single nodes and whole folders from their table records on demand.
+// An entry is a few dozen bytes, against the hundreds of a Node with its attributes.
+//
+// Also keeps the folders whose children were materialized in least recently used order, so that
+// the cold ones can be given back to the table.
+class MEGA_API LazyNodeIndex
+{
+public:
+    // node h, child of parent, is left in the table as record dbid
+    void add(handle h, handle parent, uint32_t dbid);
+
+    // remove node h from the index, returning its record and parent
+    bool take(handle h, uint32_t* dbid, handle* parent);
+
+    // remove the children of parent from the index, returning their records
+    bool takechildren(handle parent, std::vector<uint32_t>* dbids);
+
+    bool contains(handle h) const;
+    bool parentof(handle h, handle* parent) const;
+    bool haschildren(handle parent) const;
+
+    size_t size() const { return mEntries.size(); }
+    bool empty() const { return mEntries.empty(); }
+    void clear();
+
+    // folder was accessed: it becomes the most recently used
+    void touch(handle folder);
+
+    // remove and return the least recently used folder
+    bool leastrecent(handle* folder);
+
+private:
+    struct Entry
+    {
+        handle parent;
+        uint32_t dbid;
+    };
+
+    std::unordered_map<handle, Entry> mEntries;
+    std::unordered_map<handle, std::vector<handle>> mChildren;
+
+    std::list<handle> mRecent;  // most recent first
+    std::unordered_map<handle, std::list<handle>::iterator> mRecentPos;
+};
+
+} // namespace
+
+#endif
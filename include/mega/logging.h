@@ -123,6 +123,28 @@ enum LogLevel
     logMax
 };
 
+// Subsystems whose messages can be logged in more detail than the others, without the cost of a
+// higher level everywhere (see SimpleLogger::setModuleLogLevel).  A source file logs as one by
+// defining MEGA_LOG_MODULE, before its includes
+enum LogModule
+{
+    logModuleGeneral = 0,
+    logModuleTransfers,
+    logModuleSync,
+    logModuleSc,
+    logModuleNet,
+    LOG_MODULES
+};
+
+#ifndef MEGA_LOG_MODULE
+#define MEGA_LOG_MODULE ::mega::logModuleGeneral
+#endif
+
+// messages more detailed than this (eg. 3 for logInfo) are not even compiled
+#ifndef MEGA_MAX_LOG_LEVEL
+#define MEGA_MAX_LOG_LEVEL ::mega::logMax
+#endif
+
 // Output Log Interface
 class Logger
 {
@@ -370,6 +392,14 @@ public:
 
     static enum LogLevel logCurrentLevel;
 
+    // the levels of the modules, when more detailed than logCurrentLevel
+    static enum LogLevel logModuleLevels[LOG_MODULES];
+
+    static bool isLogging(enum LogLevel ll, enum LogModule module)
+    {
+        return logCurrentLevel >= ll || logModuleLevels[module] >= ll;
+    }
+
     static long long maxPayloadLogSize; //above this, the msg will be truncated by [ ... ]
 
     SimpleLogger(const enum LogLevel ll, const char* filename, const int line)
@@ -562,6 +592,15 @@ public:
         SimpleLogger::logCurrentLevel = ll;
     }
 
+    // log the messages of a module up to ll, whatever the current level (logFatal to follow it)
+    static void setModuleLogLevel(enum LogModule module, enum LogLevel ll)
+    {
+        if (module > logModuleGeneral && module < LOG_MODULES)
+        {
+            SimpleLogger::logModuleLevels[module] = ll;
+        }
+    }
+
     // set the limit of size to requests payload
     static void setMaxPayloadLogSize(long long size)
     {
@@ -588,30 +627,21 @@ template<std::size_t N> inline const char* log_file_leafname(const char(&fullpat
     return fullpath;
 }
 
-#define LOG_verbose \
-    if (::mega::SimpleLogger::logCurrentLevel < ::mega::logMax) ;\
-    else \
-        ::mega::SimpleLogger(::mega::logMax, ::mega::log_file_leafname(__FILE__), __LINE__)
+// whether a message of level ll of this source file would be logged: for the code that prepares
+// what it logs.  The operands of the LOG_ macros are only evaluated when it is
+#define MEGA_LOG_ENABLED(ll) \
+    ((ll) <= MEGA_MAX_LOG_LEVEL && ::mega::SimpleLogger::isLogging((ll), MEGA_LOG_MODULE))
 
-#define LOG_debug \
-    if (::mega::SimpleLogger::logCurrentLevel < ::mega::logDebug) ;\
+#define MEGA_LOG_AT(ll) \
+    if (!MEGA_LOG_ENABLED(ll)) ;\
     else \
-        ::mega::SimpleLogger(::mega::logDebug, ::mega::log_file_leafname(__FILE__), __LINE__)
+        ::mega::SimpleLogger((ll), ::mega::log_file_leafname(__FILE__), __LINE__)
 
-#define LOG_info \
-    if (::mega::SimpleLogger::logCurrentLevel < ::mega::logInfo) ;\
-    else \
-        ::mega::SimpleLogger(::mega::logInfo, ::mega::log_file_leafname(__FILE__), __LINE__)
-
-#define LOG_warn \
-    if (::mega::SimpleLogger::logCurrentLevel < ::mega::logWarning) ;\
-    else \
-        ::mega::SimpleLogger(::mega::logWarning, ::mega::log_file_leafname(__FILE__), __LINE__)
-
-#define LOG_err \
-    if (::mega::SimpleLogger::logCurrentLevel < ::mega::logError) ;\
-    else \
-        ::mega::SimpleLogger(::mega::logError, ::mega::log_file_leafname(__FILE__), __LINE__)
+#define LOG_verbose MEGA_LOG_AT(::mega::logMax)
+#define LOG_debug MEGA_LOG_AT(::mega::logDebug)
+#define LOG_info MEGA_LOG_AT(::mega::logInfo)
+#define LOG_warn MEGA_LOG_AT(::mega::logWarning)
+#define LOG_err MEGA_LOG_AT(::mega::logError)
 
 #define LOG_fatal \
     ::mega::SimpleLogger(::mega::logFatal, ::mega::log_file_leafname(__FILE__), __LINE__)
@@ -25,6 +25,9 @@
 #include "types.h"
 #include "json.h"
 #include "filesystem.h"
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <string>
 
 namespace mega {
@@ -137,6 +140,46 @@ struct MEGA_API MediaFileInfo
     // Check if we should retry video property extraction, due to previous failure with older library
     bool timeToRetryMediaPropertyExtraction(const std::string& fileattributes, uint32_t fakey[4]);
 
+    // The properties are extracted on the client's workers, starting when an upload is queued, so
+    // that mediainfo reading the file doesn't hold up exec().  They are kept by fingerprint, for the
+    // transfer's completion to find, and for the same file transferred again
+    struct Extraction
+    {
+        std::atomic<bool> done;
+        MediaProperties vp;
+
+        Extraction() : done(false) { }
+    };
+
+    // start extracting the properties of the file at localpath, whose fingerprint is fp, unless that
+    // fingerprint was extracted (or is being extracted) already
+    std::shared_ptr<Extraction> requestExtraction(MegaClient* client, const LocalPath& localpath, const FileFingerprint& fp);
+
+    // as queueMediaPropertiesFileAttributesForUpload() and sendOrQueueMediaPropertiesFileAttributesForExistingFile(),
+    // with the properties of the file once extracted.  An upload still waiting for them counts it
+    // (returns 1), and its completion resumes from checkExtractions()
+    unsigned queueExtractionForUpload(const LocalPath& localpath, const FileFingerprint& fp, uint32_t fakey[4], MegaClient* client, handle uploadHandle);
+    void queueExtractionForExistingFile(const LocalPath& localpath, const FileFingerprint& fp, uint32_t fakey[4], MegaClient* client, handle fileHandle);
+
+    // from exec(): hand over the extractions that finished to the transfers waiting for them
+    void checkExtractions(MegaClient* client);
+
+    // the extractions kept, by serialized fingerprint, and the order they were requested in
+    std::map<std::string, std::shared_ptr<Extraction>> extractions;
+    std::deque<std::string> extractionorder;
+
+    struct ExtractionWait
+    {
+        std::shared_ptr<Extraction> extraction;
+        bool upload;
+        ::mega::handle handle;
+        uint32_t fakey[4];
+    };
+    std::vector<ExtractionWait> extractionwaits;
+
+    // extractions kept beyond which the first requested are dropped
+    static const size_t MAXEXTRACTIONS = 256;
+
     MediaFileInfo();
 };
 
@@ -349,6 +349,9 @@ struct MEGA_API MegaApp
 
     virtual void notify_dbcommit() { }
 
+    // the instance that owns the local cache committed to it (see MegaClient::readonlystatecache)
+    virtual void notify_dbexternalcommit() { }
+
     virtual void notify_storage(int) { }
 
     virtual void notify_business_status(BizStatus) { }
@@ -39,10 +39,16 @@
 #include "useralerts.h"
 #include "user.h"
 #include "sync.h"
+#include "searchindex.h"
+#include "lazynodes.h"
+#include "streamingcache.h"
+#include "fileattributefetch.h"
+#include "metrics.h"
 
 namespace mega {
 
 class SyncConfigBag;
+class StateSnapshot;
 
 class MEGA_API FetchNodesStats
 {
@@ -69,6 +75,9 @@ public:
     void init();
     void toJsonArray(string *json);
 
+    // the startup report: the times to each step and the phases, as an object of json (ms)
+    void toJson(JSONWriter& json) const;
+
     //////////////////
     // General info //
     //////////////////
@@ -179,6 +188,80 @@ public:
      * The resumption of transfers is done after the filesystem is current
      */
     dstime timeToTransfersResumed;
+
+    /////////////////////////////////////
+    // Phases of the load from DB (ms) //
+    /////////////////////////////////////
+
+    /**
+     * @brief Time spent reading the records from the database
+     */
+    long long dbReadTimeMs;
+
+    /**
+     * @brief Time spent decrypting and parsing the records, summed over the threads doing it
+     */
+    long long dbParseTimeMs;
+
+    /**
+     * @brief Time spent creating and linking the nodes, users, pcrs and chats from the parsed records
+     *
+     * The three phases overlap in a pipeline, so their sum can exceed timeToLastByte
+     */
+    long long dbLinkTimeMs;
+
+    ///////////////////////////////////////////////////////////////////////
+    // Phases on the client's thread, until the filesystem is current (us) //
+    ///////////////////////////////////////////////////////////////////////
+
+    /**
+     * @brief Time spent parsing the response to fetchnodes and creating the nodes
+     *
+     * Whether the response is parsed as it downloads or once complete.  Merging the shares
+     * and applying the keys are not included: they have their own phases
+     */
+    long long apiParseTimeUs;
+
+    /**
+     * @brief Time spent in mergenewshares() (from DB or API, and with the action packets)
+     */
+    long long mergeSharesTimeUs;
+
+    /**
+     * @brief Time spent in applykeys(): decrypting the keys and attributes of the nodes
+     */
+    long long applyKeysTimeUs;
+
+    /**
+     * @brief Time spent resuming the syncs, including the load of their state caches
+     */
+    long long syncsResumeTimeUs;
+
+    /**
+     * @brief Time spent loading the transfers and files of the transfer cache
+     */
+    long long transfersLoadTimeUs;
+
+    /**
+     * @brief Time spent starting the cached transfers again, once the filesystem is current
+     *
+     * It's done in slices, between the other work of the client
+     */
+    long long transfersResumeTimeUs;
+
+    // adds the time of the scope it's declared in to a phase (none if null)
+    class PhaseTimer
+    {
+    public:
+        explicit PhaseTimer(long long* us) : mUs(us), mStart(std::chrono::steady_clock::now()) { }
+        ~PhaseTimer();
+
+        MEGA_DISABLE_COPY_MOVE(PhaseTimer)
+
+    private:
+        long long* mUs;
+        std::chrono::steady_clock::time_point mStart;
+    };
 };
 
 /**
@@ -243,6 +326,17 @@ public:
     // salt of the account (for v2 accounts)
     string accountsalt;
 
+    // the password keys derived by pw_key() and pbkdf2key() in this session, so that login
+    // retries and password checks don't run the (slow by design) derivation again.  Indexed by
+    // an HMAC of the inputs under a random key, never by the passwords themselves
+    mutable map<string, string> derivedkeys;
+    byte derivedkeyssecret[32];
+    static const size_t MAXDERIVEDKEYS = 8;
+
+    bool cachedderivedkey(const string& id, byte* key, size_t len) const;
+    void cachederivedkey(const string& id, const byte* key, size_t len) const;
+    string derivedkeyid(char type, const char* password, const string& salt) const;
+
     // timestamp of the creation of the account
     m_time_t accountsince;
 
@@ -412,9 +506,19 @@ public:
     // load all trees: nodes, shares, contacts
     void fetchnodes(bool nocache = false);
 
+    // the tree of a browseonly client arrived: fetchnodes is complete
+    void browseonlyfetched(int tag);
+
     // fetchnodes stats
     FetchNodesStats fnstats;
 
+    // log the startup report and send it as an event, once the filesystem is current and the
+    // cached transfers have been resumed
+    void reportstartup();
+
+    // fnstats.PhaseTimer's phase while the filesystem is not current yet
+    long long* startupphase(long long& us);
+
     // load cryptographic keys: RSA, Ed25519, Cu25519 and their signatures
     void fetchkeys();
 
@@ -460,6 +564,13 @@ public:
     // convenience version of the above (frequently we are passing a NodeBase's attrstring)
     void makeattr(SymmCipher*, const std::unique_ptr<string>&, const char*, int = -1) const;
 
+    // the same, serializing the attributes straight into the output (no intermediate json string)
+    void makeattr(SymmCipher*, string*, const AttrMap&) const;
+    void makeattr(SymmCipher*, const std::unique_ptr<string>&, const AttrMap&) const;
+
+    // zero-pad "MEGA{...}" to whole cipher blocks and encrypt it in place
+    static void padandencryptattr(SymmCipher*, string*);
+
     // check node access level
     int checkaccess(Node*, accesslevel_t);
 
@@ -526,6 +637,9 @@ public:
     // number of parallel connections per transfer (PUT/GET)
     unsigned char connections[2];
 
+    // how many transfers run at once (FixedTransferConcurrency unless the app picks another)
+    unique_ptr<TransferConcurrencyPolicy> transferpolicy;
+
     // generate & return next upload handle
     handle uploadhandle(int);
 
@@ -545,6 +659,10 @@ public:
     // queue file attribute retrieval
     error getfa(handle h, string *fileattrstring, const string &nodekey, fatype, int = 0);
 
+    // fetch attribute t of n into facache ahead of a getfa() for it, through the same channels
+    // (so batched per cluster).  Nothing to do if it's kept already, or nothing is kept
+    error prefetchfa(Node* n, fatype t);
+
     // notify delayed upload completion subsystem about new file attribute
     void checkfacompletion(handle, Transfer* = NULL);
 
@@ -857,6 +975,24 @@ public:
     // set max upload speed
     bool setmaxuploadspeed(m_off_t bpslimit);
 
+    // a limit on the speed of a class of transfers in a direction (GET or PUT) for part of each
+    // day: from fromminute up to tominute, in minutes of the day in local time (round midnight if
+    // tominute comes first, all day if they are equal).  Where rules overlap, the last one applies
+    struct TransferRateRule
+    {
+        transferclass_t transferclass;
+        direction_t direction;
+        int fromminute;
+        int tominute;
+        m_off_t bps;
+    };
+
+    // replace the rules, which take effect straight away
+    void settransferraterules(vector<TransferRateRule> rules);
+
+    // limit the speed of a transfer (0: no limit of its own)
+    void settransferspeed(Transfer*, m_off_t bpslimit);
+
     // get max download speed
     m_off_t getmaxdownloadspeed();
 
@@ -982,6 +1118,11 @@ private:
     std::unique_ptr<HttpReq> pendingscUserAlerts;
     BackoffTimer btsc;
 
+    // the request for the packets after those of pendingsc, sent while they are processed (see
+    // prefetchsc), and the sequence number it was sent for
+    std::unique_ptr<HttpReq> nextsc;
+    string nextscsn;
+
     // account is blocked: stops querying for action packets, pauses transfer & removes transfer slot availability
     bool mBlocked = false;
     bool mBlockedSet = false; //value set in current execution
@@ -1034,17 +1175,12 @@ private:
     // just one notification after fetchnodes and catch-up actionpackets
     bool notifyStorageChangeOnStateCurrent = false;
 
-    // maximum number of concurrent transfers (uploads + downloads)
-    static const unsigned MAXTOTALTRANSFERS;
-
-    // maximum number of concurrent transfers (uploads or downloads)
-    static const unsigned MAXTRANSFERS;
-
     // maximum number of queued putfa before halting the upload queue
     static const int MAXQUEUEDFA;
 
-    // maximum number of concurrent putfa
+    // number of concurrent putfa to start with, and the most they grow to
     static const int MAXPUTFA;
+    static const int MAXPUTFASLOTS;
 
 #ifdef ENABLE_SYNC
     Sync *getSyncContainingNodeHandle(mega::handle nodeHandle);
@@ -1129,6 +1265,21 @@ private:
     // execute pending direct reads
     bool execdirectreads();
 
+    // the results of the batches in pipelinedcs, and the next ones to send that way
+    bool execpipelinedcs();
+
+    // a new unique request ID
+    string nextreqid();
+
+    // post a batch of API requests with the given request ID
+    void postcs(HttpReq*, const string& id, bool suppressSID);
+
+    // post a server-client request for the action packets after sequence number sn
+    void postsc(HttpReq*, const char* sn);
+
+    // send nextsc for the sequence number that ends the pendingsc response, if it is a batch of packets
+    void prefetchnextsc();
+
     // maximum number parallel connections for the direct read subsystem
     static const int MAXDRSLOTS = 16;
 
@@ -1168,6 +1319,213 @@ public:
     // there is data to commit to the database when possible
     bool pendingsccommit;
 
+    // keep a StateSnapshot of sctable, and resume sessions from it when it matches the table
+    bool usestatesnapshot = false;
+
+    // write node records in the compact encoding (see Node::serializecompact()) and, with
+    // compressnoderecords too, deflate those it makes smaller.  Records are read in any encoding
+    bool compactnoderecords = false;
+    bool compressnoderecords = false;
+
+    // write the tctable records of transfers and files in batches, up to TRANSFERCACHEFLUSHDS after
+    // they change or once TRANSFERCACHEBATCH of them are pending, rather than on every change.
+    // Queuing many transfers then costs one put per record; a crash loses the changes since the
+    // last flush, so resumption may restart the affected transfers from an earlier state
+    bool batchtransfercache = false;
+    static const dstime TRANSFERCACHEFLUSHDS = 20;
+    static const size_t TRANSFERCACHEBATCH = 2000;
+
+    // put the nodes of completed uploads that the app started (not those of syncs, or to a user's
+    // inbox) in one putnodes per target folder, sent PUTNODESBATCHDS after the first one, or once
+    // it has MAX_NEWNODES.  Each upload still gets its own putnodes_result().  The API adds a
+    // batch as a whole, so an error fails all uploads in it
+    bool batchputnodes = false;
+    static const dstime PUTNODESBATCHDS = 5;
+
+    // ask for the temporary URLs of the next PREFETCHURLS queued downloads ahead of their slots,
+    // all in the same cs request, so that a download starts transferring as soon as it gets a
+    // slot.  URLs that wait longer than PREFETCHURLSEXPIRYDS for that are not used
+    bool prefetchdownloadurls = false;
+
+    // fingerprint the files to upload through fingerprintcache, so that one not changed since
+    // it was last fingerprinted (same size, mtime and fsid) is not read again.  When it matches a
+    // node, the upload is then a copy of it, as with any fingerprint that matches
+    bool cachefingerprints = false;
+    FileFingerprintCache fingerprintcache;
+
+    // persist the cache in a table of its own, which isn't tied to the account (it's about the
+    // files of this device), once exec() first runs with cachefingerprints set
+    void openfingerprintcache();
+    bool fingerprintcacheopened = false;
+    static const unsigned PREFETCHURLS = 16;
+    static const dstime PREFETCHURLSEXPIRYDS = 3000;
+
+    // keep the temporary URLs last fetched for a file, by downloads and DirectReads alike, and
+    // start the next download or DirectRead of it with them rather than asking the API again.
+    // They are used for up to TEMPURLCACHEEXPIRYDS, and dropped when a transfer with them fails.
+    // Keyed by handle and type, as hdrns is (see encodehandletype())
+    bool sharetempurls = false;
+    static const dstime TEMPURLCACHEEXPIRYDS = 3000;
+    void cachetempurls(handle h, bool p, const vector<string>& urls, m_off_t size);
+    bool cachedtempurls(handle h, bool p, vector<string>& urls, m_off_t& size);
+    void uncachetempurls(handle h, bool p);
+
+    struct CachedTempUrls
+    {
+        vector<string> urls;
+        m_off_t size;
+        dstime fetched;
+    };
+    std::map<handle, CachedTempUrls> tempurlcache;
+
+    // size the requests of each connection of a (non-raid) download from what its last request
+    // measured, between minrequestsize and maxrequestsize: larger while the wait for the first
+    // data takes more than a tenth of a request, and halved when a request fails, so that less is
+    // fetched again.  Otherwise, requests are limited to TransferSlot::maxRequestSize
+    bool adaptiverequestsize = false;
+
+    // share the transfers started in each direction between the classes of transfer (see
+    // transferclass_t) by their transferclassweights, rather than in plain queue order, so that
+    // a long sync or backup doesn't hold back what the app asks for.  Within a class, queue
+    // order still applies
+    bool fairtransferclasses = false;
+    std::array<unsigned, TRANSFERCLASSES> transferclassweights = {{ 16, 4, 1 }};
+
+    // when an upload fails for a reason its upload URL survives (a timeout, say), keep the chunks
+    // the storage server acknowledged and the URL, so that the retry continues from there rather
+    // than from the start.  What was acknowledged is in the cached transfer too, so a restart
+    // continues from there as well, for as long as the URL is valid.  A URL the server turns down
+    // sends the upload back to the start with a new one
+    bool keepuploadprogress = false;
+
+    // reserve the whole size of the downloads of at least PREALLOCATEDOWNLOADSIZE bytes when their
+    // files are opened (see FileAccess::fpreallocate()), so that the pieces written out of order
+    // don't fragment them
+    bool preallocatedownloads = false;
+    static const m_off_t PREALLOCATEDOWNLOADSIZE = 64 * 1024 * 1024;
+
+    // read the files of uploads of at least READONCEUPLOADSIZE bytes as read once (see
+    // FileAccess::setreadonce()): more read-ahead, and no page cache left holding an archive of
+    // many GB that is already sent
+    bool readuploadsonce = false;
+    static const m_off_t READONCEUPLOADSIZE = 64 * 1024 * 1024;
+
+    // send the uploads of at least STRIPEDUPLOADSIZE bytes on up to maxstripedconnections
+    // connections (no more than MAX_NUM_CONNECTIONS), starting from connections[PUT] and tuned by
+    // the speed and round trip measured (see StripedUploadTuner).  Chunks complete in any order;
+    // their MACs are assembled by position in chunkmacs either way
+    bool stripeduploads = false;
+    unsigned maxstripedconnections = MAX_NUM_CONNECTIONS;
+    static const m_off_t STRIPEDUPLOADSIZE = 64 * 1024 * 1024;
+
+    // verify the fingerprints of finished downloads on the worker threads (see
+    // Transfer::verification) rather than reading each file on this one.  The rest of their
+    // completion (moving the files into place, the callbacks to the app) still happens here, in
+    // the order the downloads finished: verifyingdownloads
+    bool asynccompletions = false;
+    std::deque<Transfer*> verifyingdownloads;
+
+    // how many DirectReads can have a slot at once (MAXDRSLOTS by default), and how many
+    // connections those can have to any one storage host (0: no limit).  Reads of nodes without a
+    // slot get one first.  Changes apply as reads are queued or finish
+    unsigned maxdrslots = MAXDRSLOTS;
+    unsigned maxdrslotsperhost = 0;
+
+    // the limits that the transfer rules keep, by class and direction.  The requests of a
+    // transfer count against the one of its class, and against its own (see Transfer::ratelimit)
+    std::array<std::array<TokenBucket, 2>, TRANSFERCLASSES> classratelimits;
+    vector<TransferRateRule> transferraterules;
+    dstime nexttransferratesds = 0;
+    void applytransferraterules();
+    m_off_t minrequestsize = 1048576;
+    m_off_t maxrequestsize = 33554432;
+
+    // Long jobs done a slice at a time from exec(), so that a pass of the loop doesn't keep
+    // network I/O and callbacks waiting for them.  A job is called with the time its slice ends
+    // and returns true once it is finished; otherwise it is called again in the next pass (the
+    // client doesn't wait in between).  A pass spends up to EXECSLICEMS on them, in order.
+    // Jobs belong to the session: locallogout() drops the ones left
+    typedef std::function<bool(std::chrono::steady_clock::time_point deadline)> SlicedJob;
+    std::deque<SlicedJob> slicedjobs;
+    static const int EXECSLICEMS = 20;
+    void runslicedjobs();
+
+    // procsc() applies action packets for up to SCSLICEMS, then leaves the rest of them for the
+    // next pass (setting scsliced), so that a large batch doesn't hold up transfer I/O, requests
+    // and the app's calls in between
+    static const int SCSLICEMS = 50;
+    bool scsliced = false;
+
+    // write the node records of a cache migrated from before the node table again, with their
+    // columns (see DbTable::nodeIndexComplete())
+    void indexcachednodes();
+
+    // give back to the file system the space that sctable's records no longer use: on opening it,
+    // by rewriting a database that wastes STATECACHEVACUUMBYTES or more and can't be compacted a
+    // bit at a time, and then up to STATECACHERECLAIMBYTES at a time while the client is idle
+    bool compactstatecache = false;
+    static const int64_t STATECACHEVACUUMBYTES = 64 << 20;
+    static const int64_t STATECACHERECLAIMBYTES = 4 << 20;
+
+    // bytes reclaimed by compactstatecache in this session, and when to try again
+    int64_t statecachereclaimed = 0;
+    dstime nextstatecachereclaim = 0;
+    void reclaimstatecache();
+
+    // write sctable's commits on a thread of its own (see AsyncDbTable), so that the disk doesn't
+    // hold up the SDK thread.  The table on disk stays consistent, but may lag the last commits.
+    // The state caches of the syncs opened after it's set are written the same way
+    bool asyncstatecache = false;
+
+#ifdef ENABLE_SYNC
+    // write the LocalNodes queued for the state cache of each sync at most every this many ds,
+    // as one transaction (0: on every pass of exec() that finds some queued, as before)
+    dstime syncstatecacheflushds = 0;
+#endif
+
+    // read the local cache of a session that another instance of the client, logged into the same
+    // session, owns and writes (a UI process and a worker, for example): sctable and the status
+    // table are opened read-only through a ReadOnlyDbTable, so this instance resumes from the
+    // owner's records without a copy of its own, and with lazynodes only holds the nodes it uses.
+    // It keeps its nodes current from the action packets, as the owner does.  Transfers aren't
+    // cached here: the owner resumes its own.  Set before login; the owner must have created the
+    // cache, or this instance fetches the nodes with no cache at all
+    bool readonlystatecache = false;
+
+    // only browse the folder links logged into (a gateway serving many links, for example): the
+    // tree is fetched with no local cache (no sctable, status or transfer tables), and once it
+    // arrives fetchnodes completes without the action-packet channel, which is never opened, so
+    // the client costs the tree in memory and one request.  Its nodes don't follow later
+    // changes to the folder: log in again for a fresh copy.  Set before fetchnodes; accounts
+    // logged into aren't affected
+    bool browseonly = false;
+    bool browsingonly() { return browseonly && loggedinfolderlink(); }
+
+    // the owner's commits to sctable, seen from its DbTable::dataVersion(), checked every 10 ds
+    int64_t sctabledataversion = 0;
+    dstime nextsctablecheck = 0;
+    void checksctable();
+
+    // on resumption from sctable, materialize only the nodes without a parent (root nodes and
+    // inshares) and leave the rest in the table until they are looked up or their folder is listed.
+    // Memory then follows what is used rather than the size of the account, at the cost of searches,
+    // fingerprint lookups and node counters only covering the nodes in memory.  Meant for clients
+    // that work on a few known folders; synced folders are always loaded whole
+    bool lazynodes = false;
+
+    // with lazynodes, the number of nodes in memory above which the children of the least recently
+    // listed folders are given back to sctable
+    size_t lazynodeslimit = 100000;
+
+    // on resumption from sctable, leave the previous versions of files in the table too: they are
+    // materialized when the versions of a file are listed or one of them is looked up.  Their sizes
+    // stay in the node counters, held by the file they were left under (see Node::lazyversion()).
+    // For accounts that keep many versions; with lazynodes they are left in the table anyway
+    bool lazyversions = false;
+
+    // the nodes in sctable that lazynodes (or lazyversions) left out of memory
+    LazyNodeIndex lazyindex;
+
     // transfer cache table
     unique_ptr<DbTable> tctable;
 
@@ -1177,6 +1535,17 @@ public:
     // status cache table for logged in user. For data pertaining status which requires immediate commits
     unique_ptr<DbTable> statusTable;
 
+    // the DNS cache of httpio, kept in statusTable (as its CACHEDDNS record) so that the first
+    // requests after a restart don't wait for lookups.  Written by savednscache() when it changed
+    struct CachedDns : public Cacheable
+    {
+        string data;
+
+        bool serialize(string* d) override;
+    };
+    CachedDns cacheddns;
+    void savednscache();
+
     // scsn as read from sctable
     handle cachedscsn;
 
@@ -1185,6 +1554,63 @@ public:
     bool fetchingnodes;
     int fetchnodestag;
 
+    // read the nodes of an 'f' response while it downloads, instead of buffering all of it first
+    bool streamfetchnodes = true;
+
+    // progress through the node arrays of the 'f' response being streamed
+    struct FetchNodesStream
+    {
+        enum { PREFIX, NODES, NEXTARRAY, DONE, FAILED, DISABLED } state = PREFIX;
+
+        // nodes received before their parents
+        node_vector dp;
+
+        // nodes read whose keys have not been applied yet, and how many to collect before applying them
+        node_vector pending;
+        static const size_t KEYBATCH = 4096;
+
+        // true once nodes have been read from the response (MegaClient's nodes must not be purged after that)
+        bool started() const { return state != PREFIX && state != DISABLED; }
+    };
+    std::unique_ptr<FetchNodesStream> mFetchNodesStream;
+
+    // read the complete node records received so far for the 'f' command in req and drop them from
+    // its buffer.  When final, the rest of the response is left in req->in for CommandFetchNodes
+    // as if the node arrays had been empty
+    void readfetchnodeschunk(HttpReq* req, bool final);
+
+    // When the servers can't catch us up from our scsn (too many pending updates), the tree is
+    // fetched again.  Instead of purging the nodes in memory, which fails the syncs and makes the
+    // app (and sctable) start over, the reloaded tree can be merged into them: only the nodes added,
+    // changed or removed meanwhile are then notified and rewritten
+    bool reconcilereloads = true;
+
+    // the 'f' response being read is merged into the nodes in memory (see reconcilenodes())
+    bool reconcilingnodes = false;
+
+    // a node that can't be merged (such as one that changed type) was found: reload from scratch
+    bool reconcilefailed = false;
+
+    // nodes of the reloaded tree, and the ones already in memory that it changed
+    std::unordered_set<handle> reconcileseen;
+    node_vector reconciled;
+
+    // start a merging reload.  Returns false if the nodes in memory can't be merged into (for
+    // example, some are only in sctable because of lazynodes) and a regular reload is needed
+    bool reconcilenodes();
+
+    // the reloaded tree has been read: notify what changed and remove the nodes it doesn't have
+    void endreconcile();
+
+    // the merge failed: throw the nodes away and reload them with fetchnodes()
+    void abortreconcile();
+
+    // update n, already in memory, from its reloaded attributes.  Returns true if they changed
+    bool reconcilenode(Node* n, const char* a, const char* fa);
+
+    // drop the sc requests in progress and the scsn they were for
+    void discardsc();
+
     // have we just completed fetching new nodes?  (ie, caught up on all the historic actionpackets since the fetchnodes)
     bool statecurrent;
 
@@ -1194,6 +1620,14 @@ public:
     // current file attributes being sent
     putfa_list activefa;
 
+    // how many may be sent at once: one more for each one stored while others wait, up to
+    // MAXPUTFASLOTS, and halved (to no less than MAXPUTFA) when the servers ask to slow down
+    int putfaslots = MAXPUTFA;
+
+    // send queued file attributes while there are slots for them.  Their ufa commands go in
+    // the same batch, and each posts its data as soon as its URL arrives
+    void dispatchputfa();
+
     // API request queue double buffering:
     // reqs[r] is open for adding commands
     // reqs[r^1] is being processed on the API server
@@ -1203,6 +1637,17 @@ public:
     // ourselves in cases where many clients get 500s for a while and then recover at the same time
     bool pendingcs_serverBusySent = false;
 
+    // how many batches of API requests can be in flight at once.  Those after the first are only
+    // sent when RequestDispatcher::readytosend() allows it (1: one after another, as always)
+    unsigned csdepth = 1;
+
+    // the batches sent while pendingcs is in flight, by request id
+    map<string, unique_ptr<HttpReq>> pipelinedcs;
+
+    // request the next action packets as soon as a batch has arrived, rather than once it has been
+    // processed, so that the wait on the server overlaps the processing here
+    bool prefetchsc = true;
+
     // pending HTTP requests
     pendinghttp_map pendinghttp;
 
@@ -1210,7 +1655,7 @@ public:
     enum { CACHEDSCSN, CACHEDNODE, CACHEDUSER, CACHEDLOCALNODE, CACHEDPCR, CACHEDTRANSFER, CACHEDFILE, CACHEDCHAT} sctablerectype;
 
     // record type indicator for statusTable
-    enum StatusTableRecType { CACHEDSTATUS };
+    enum StatusTableRecType { CACHEDSTATUS, CACHEDSYNCDELETIONS, CACHEDDNS };
 
     // open/create state cache database table
     void opensctable();
@@ -1223,6 +1668,13 @@ public:
     void updatesc();
     void finalizesc(bool);
 
+    // the snapshot of sctable, if usestatesnapshot was set when it was opened
+    StateSnapshot* statesnapshot() const;
+
+    // rewrite the snapshot image from the nodes, users, pcrs and chats in memory if it's due and
+    // sctable has just been committed (so both hold the same state)
+    void writestatesnapshot();
+
     void initStatusTable();
 
     // flag to pause / resume the processing of action packets
@@ -1270,18 +1722,41 @@ public:
     // file attribute fetch channels
     fafc_map fafcs;
 
+    // the file attributes fetched before, kept in a table of the session once exec() first runs
+    // with a capacity set (and in memory where there's no dbaccess)
+    FileAttributeCache facache;
+    void openfacache();
+    bool facacheopened = false;
+
+    // attributes getfa() found in facache, for exec() to pass to the app as the channels do
+    std::deque<std::pair<std::unique_ptr<FileAttributeFetch>, string>> facachehits;
+
     // generate attribute string based on the pending attributes for this upload
     void pendingattrstring(handle, string*);
 
     // active/pending direct reads
     handledrn_map hdrns;   // DirectReadNodes, main ownership.  One per file, each with one DirectRead per client request.
     dsdrn_map dsdrns;      // indicates the time at which DRNs should be retried
-    dr_list drq;           // DirectReads that are in DirectReadNodes which have fectched URLs
-    drs_list drss;         // DirectReadSlot for each DR in drq, up to Max
+    dr_list drq;           // DirectReads that are in DirectReadNodes which have fectched URLs, waiting for a slot
+    drs_list drss;         // DirectReadSlot for each DR taken from drq, up to maxdrslots
+    bool drqdirty = false; // a read was queued or a slot freed since drq was last looked at
+    std::map<string, unsigned> drhostconnections;  // of the slots, by storage host
+
+    // the data streamed, to serve reads of the same bytes again, and to read ahead into
+    // (nothing is kept until its capacity is set)
+    StreamingCache streamingcache;
 
     // merge newly received share into nodes
     void mergenewshares(bool);
-    void mergenewshare(NewShare *s, bool notify);    // merge only the given share
+
+    // merge only the given share.  The nodes that received their share key are added to keyed, for
+    // the caller to apply the keys below them at once, and key rewrites are left in nodekeyrewrite
+    void mergenewshare(NewShare *s, bool notify, node_vector& keyed);
+
+    // nodes with outgoing shares (pending ones included), by the user handle of the sharee (or
+    // the id of the pending contact request).  Not complete while lazyindex holds nodes back
+    std::map<handle, handle_set> outsharesbypeer;
+    void indexoutshare(handle peer, handle h, bool add);
 
     // transfer queues (PUT/GET)
     transfer_map transfers[2];
@@ -1293,9 +1768,26 @@ public:
     // cached transfers (PUT/GET)
     transfer_map cachedtransfers[2];
 
-    // cached files and their dbids
+    // cached transfer records not unserialized yet, by fingerprint (PUT/GET)
+    struct CachedTransferRecord
+    {
+        uint32_t dbid;
+        m_time_t lastaccesstime;
+        uint64_t priority;
+        string data;
+    };
+    map<FileFingerprint, CachedTransferRecord, FileFingerprintCmp> cachedtransferrecords[2];
+
+    // unserialize the cached transfer of a fingerprint into cachedtransfers, if not done yet
+    void hydratecachedtransfer(direction_t, const FileFingerprint&);
+
+    // cached files and their dbids, and how many resumecachedfiles() has been through
     vector<string> cachedfiles;
     vector<uint32_t> cachedfilesdbids;
+    size_t cachedfilesresumed = 0;
+
+    // resume the transfers of cachedfiles until deadline, returning true once all are
+    bool resumecachedfiles(std::chrono::steady_clock::time_point deadline);
 
     // database IDs of cached files and transfers
     // waiting for the completion of a putnodes
@@ -1317,6 +1809,17 @@ public:
     // FileFingerprint to node mapping
     Fingerprints mFingerprints;
 
+    // file nodes by creation time, for getRecentNodes()
+    CtimeIndex mNodesByCtime;
+
+#ifdef ENABLE_SEARCH_INDEX
+    // file and folder names, for searches that don't walk the node tree
+    SearchIndex mSearchIndex;
+
+    // (re)index the node's name and file type, after its attributes changed
+    void updatesearchindex(Node*);
+#endif
+
     // flag to skip removing nodes from mFingerprints when all nodes get deleted
     bool mOptimizePurgeNodes = false;
 
@@ -1369,6 +1872,29 @@ public:
     // remove a file from the persistent cache
     void filecachedel(File*, DBTableTransactionCommitter* committer);
 
+    // with batchtransfercache: the transfers whose record, or those of some of their files
+    // (File::cachedirty), are to be written, and since when
+    std::set<Transfer*> dirtytransfers;
+    size_t dirtytransfercache = 0;
+    dstime transfercachedirtyds = 0;
+
+    // write the pending records of dirtytransfers to tctable, or forget them
+    void flushtransfercache();
+    void discardtransfercache();
+
+    // with batchputnodes: the nodes waiting to be put in each target folder, with the tags of
+    // their uploads, and since when
+    struct PutNodesBatch
+    {
+        vector<NewNode> nodes;
+        vector<int> tags;
+    };
+    std::map<handle, PutNodesBatch> putnodesbatches;
+    dstime putnodesbatchds = 0;
+
+    void batchputnode(handle target, NewNode&&, int tag);
+    void flushputnodes();
+
 #ifdef ENABLE_CHAT
     textchat_map chatnotify;
     void notifychat(TextChat *);
@@ -1387,6 +1913,16 @@ public:
 
     Node* nodeByHandle(NodeHandle) const;
     Node* nodebyhandle(handle) const;
+
+    // lazynodes: materialize a node from sctable (with its ancestors), the children of a folder,
+    // or everything below a folder, and evict cold folders once over lazynodeslimit
+    Node* loadnode(handle);
+    void loadchildren(Node*);
+    void loadedversion(Node*);
+    bool leaveversion(const NodeRecord&, uint32_t dbid);
+    void loadtree(Node*);
+    void loadnodesbyfingerprint(const FileFingerprint&);
+    void evictnodes();
     Node* nodebyfingerprint(FileFingerprint*);
 #ifdef ENABLE_SYNC
     Node* nodebyfingerprint(LocalNode*);
@@ -1444,8 +1980,20 @@ public:
     // scan required flag
     bool syncdownrequired;
 
+    // apply action packets that don't touch synced trees without stopping for syncdown() after each,
+    // so that their node changes are merged, written and notified once per sc response
+    bool batchactionpackets = true;
+
+    // an action packet applied since procsc() last stopped for syncdown() changed a synced tree
+    bool scsyncchanged = false;
+
     bool syncuprequired;
 
+    // the next syncdown()/syncup() passes go through every folder, not only those marked by
+    // LocalNode::setsyncdirty(), for changes that aren't known to be of a given folder
+    bool syncdownfull = true;
+    bool syncupfull = true;
+
     // block local fs updates processing while locked ops are in progress
     bool syncfsopsfailed;
 
@@ -1500,12 +2048,18 @@ public:
     bool syncup(LocalNode* l, dstime* nds, size_t& parentPending);
     bool syncup(LocalNode* l, dstime* nds);
 
+    // syncup() of the marked folders below l, whose own children didn't change
+    bool syncupsubtree(LocalNode* l, dstime* nds, size_t& parentPending);
+
     // sync putnodes() completion
     void putnodes_sync_result(error, vector<NewNode>&);
 
     // start downloading/copy missing files, create missing directories
     bool syncdown(LocalNode*, LocalPath&, bool);
 
+    // syncdown() of the marked folders below l, whose own children didn't change
+    bool syncdownsubtree(LocalNode*, LocalPath&, bool);
+
     // move nodes to //bin/SyncDebris/yyyy-mm-dd/ or unlink directly
     void movetosyncdebris(Node*, bool);
 
@@ -1517,6 +2071,21 @@ public:
     void execsyncunlink();
     node_set tounlink;
 
+    // The handles of the nodes in todebris and tounlink, kept in statusTable (as its
+    // CACHEDSYNCDELETIONS record) so that the deletions a restart interrupts are resumed, instead
+    // of the nodes being synced down again.  Written by execsyncdeletions() when they changed
+    struct SyncDeletions : public Cacheable
+    {
+        vector<handle> todebris;
+        vector<handle> tounlink;
+
+        bool serialize(string*) override;
+        bool unserialize(const string&);
+    };
+    SyncDeletions syncdeletions;
+    void savesyncdeletions();
+    void resumesyncdeletions(const string& data, uint32_t dbid);
+
     // commit all queueud deletions
     void execsyncdeletions();
 
@@ -1540,6 +2109,9 @@ public:
     // transfer queue dispatch/retry handling
     void dispatchTransfers();
 
+    // with prefetchdownloadurls: request the temporary URLs of the downloads next in the queue
+    void prefetchurls();
+
     void defer(direction_t, int td, int = 0);
     void freeq(direction_t);
 
@@ -1564,6 +2136,8 @@ public:
 
     // process object arrays by the API server
     int readnodes(JSON*, int, putsource_t, vector<NewNode>*, int, bool applykeys);
+    bool readnode(JSON*, int, putsource_t, vector<NewNode>*, int, bool applykeys, node_vector& dp, node_vector* added = nullptr);
+    void attachorphans(node_vector& dp);
 
     void readok(JSON*);
     void readokelement(JSON*);
@@ -1674,6 +2248,9 @@ public:
     // apply keys
     void applykeys();
 
+    // apply the keys of these nodes, decrypting symmetric keys and attributes on the worker threads
+    void applykeys(const node_vector&);
+
     // send andy key rewrites prepared when keys were applied
     void sendkeyrewrites();
 
@@ -1696,8 +2273,12 @@ public:
     void queuepubkeyreq(User*, std::unique_ptr<PubKeyAction>);
     void queuepubkeyreq(const char*, std::unique_ptr<PubKeyAction>);
 
-    // rewrite foreign keys of the node (tree)
-    void rewriteforeignkeys(Node* n);
+    // the temporary users (not contacts) whose public key is being fetched, by the uid it was
+    // requested with, so that requests for the same one share it
+    map<string, User*> pubkeyusers;
+
+    // rewrite foreign keys of the node (tree), sending the rewrites now or leaving them queued
+    void rewriteforeignkeys(Node* n, bool send = true);
 
     // simple string hash
     static void stringhash(const char*, byte*, SymmCipher*);
@@ -1732,6 +2313,13 @@ public:
     // hash password
     error pw_key(const char*, byte*) const;
 
+    // derive the 2 * SymmCipher::KEYLENGTH bytes of the password key of a v2 account (PBKDF2 of
+    // the password with the binary salt of the account)
+    void pbkdf2key(const char* password, const string& salt, byte* derivedKey) const;
+
+    // forget the password keys derived in this session
+    void clearDerivedKeys();
+
     // Since it's quite expensive to create a SymmCipher, these are provided to use for quick operations - just set the key and use.
     SymmCipher tmpnodecipher;
     SymmCipher tmptransfercipher;
@@ -1832,6 +2420,17 @@ public:
 
     MegaClientAsyncQueue mAsyncQueue;
 
+    // fingerprints the files that MegaApi uploads ahead of sending them to startxfer(), and the
+    // new files that sync scans find, and those of the next filesystem notifications, ahead of
+    // checkpath(), several at a time on the worker threads, while asyncfingerprints is set
+    AsyncFingerprinter fingerprinter;
+    bool asyncfingerprints = false;
+
+#ifdef ENABLE_SYNC
+    // lists the subfolders of the folders that sync scans go through, ahead of them
+    AsyncDirLister dirlister;
+#endif
+
     // Keep track of high level operation counts and times, for performance analysis
     struct PerformanceStats
     {
@@ -1846,19 +2445,37 @@ public:
         CodeCounter::ScopeStats dispatchTransfers = { "dispatchTransfers" };
         CodeCounter::ScopeStats csResponseProcessingTime = { "cs batch response processing" };
         CodeCounter::ScopeStats scProcessingTime = { "sc processing" };
+        CodeCounter::ScopeStats execFileAttributes = { "exec file attributes" };
+        CodeCounter::ScopeStats execTransfers = { "exec transfers" };
+        CodeCounter::ScopeStats execSyncs = { "exec syncs" };
+        CodeCounter::ScopeStats slicedJobs = { "sliced jobs" };
+        uint64_t scSlices = 0;
         uint64_t transferStarts = 0, transferFinishes = 0;
         uint64_t transferTempErrors = 0, transferFails = 0;
+        uint64_t requestSizeGrowths = 0, requestSizeShrinks = 0;
         uint64_t prepwaitImmediate = 0, prepwaitZero = 0, prepwaitHttpio = 0, prepwaitFsaccess = 0, nonzeroWait = 0;
         CodeCounter::DurationSum csRequestWaitTime;
         CodeCounter::DurationSum transfersActiveTime;
+
         std::string report(bool reset, HttpIO* httpio, Waiter* waiter, const RequestDispatcher& reqs);
     } performanceStats;
 
+    // the durations of the main operations, kept in every build (see MegaApi::getMetrics())
+    ClientMetrics metrics;
+
+    // metrics as a json object: the histograms, and the current depth of the queues
+    string metricsjson();
+
+    // the approximate memory taken by nodes, LocalNodes, transfers and the buffers and caches of
+    // the client, as members of the object being written (see MegaApi::getMemoryUsage())
+    void memoryjson(JSONWriter& json);
+
     std::string getDeviceid() const;
 
     std::string getDeviceidHash() const;
 
-    MegaClient(MegaApp*, Waiter*, HttpIO*, FileSystemAccess*, DbAccess*, GfxProc*, const char*, const char*, unsigned workerThreadCount);
+    // the worker threads are those of workerPool when given (shared with other clients)
+    MegaClient(MegaApp*, Waiter*, HttpIO*, FileSystemAccess*, DbAccess*, GfxProc*, const char*, const char*, unsigned workerThreadCount, std::shared_ptr<MegaWorkerPool> workerPool = nullptr);
     ~MegaClient();
 };
 } // namespace
@@ -0,0 +1,291 @@
+/**
+ * @file mega/metrics.h
+ * @brief Always-on latency histograms of the client's main operations
+ *
+ * (c) 2013-2021 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#ifndef MEGA_METRICS_H
+#define MEGA_METRICS_H 1
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <initializer_list>
+#include <mutex>
+#include <thread>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "types.h"
+
+namespace mega {
+
+class JSONWriter;
+
+// The durations of an operation, counted in log-linear buckets of microseconds (as HDR histograms
+// do: SUBBUCKETS per power of two, so within 12.5%) rather than summed, for their percentiles.
+// Recording is a few relaxed atomic operations, cheap enough to be always on, and snapshots can be
+// taken from any thread while it records
+class MEGA_API LatencyHistogram
+{
+public:
+    static const int SUBBUCKETBITS = 3;
+    static const int SUBBUCKETS = 1 << SUBBUCKETBITS;
+
+    // up to 2^40 us (12 days), beyond which durations count in the last one
+    static const int BUCKETS = (40 - SUBBUCKETBITS + 1) * SUBBUCKETS;
+
+    LatencyHistogram();
+
+    void record(std::chrono::steady_clock::duration d);
+    void record(uint64_t us);
+
+    struct Snapshot
+    {
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+        std::array<uint64_t, BUCKETS> buckets{};
+
+        // the duration (us) that fraction of them didn't exceed, to the precision of the buckets
+        uint64_t percentile(double fraction) const;
+    };
+
+    Snapshot snapshot() const;
+
+    // the bucket of a duration, and the shortest duration of a bucket
+    static int bucket(uint64_t us);
+    static uint64_t lowerbound(int bucket);
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> mBuckets;
+    std::atomic<uint64_t> mCount;
+    std::atomic<uint64_t> mSum;
+    std::atomic<uint64_t> mMax;
+};
+
+// The last events of the transfers, for MegaApi::dumpTransferTrace() to give as Chrome trace JSON
+// (chrome://tracing, ui.perfetto.dev): a process per transfer, and a thread per connection of its
+// slot, 0 being the transfer as a whole.  Nothing is kept while the capacity is 0 (the default).
+// Events can be added from any thread
+class MEGA_API TraceRing
+{
+public:
+    struct Arg
+    {
+        const char* name;   // a literal
+        int64_t value;
+    };
+
+    static const int MAXARGS = 4;
+
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    TraceRing();
+
+    // the events kept, dropping the oldest
+    void setCapacity(size_t events);
+
+    bool enabled() const;
+
+    // a span from start until now, and an instant
+    void span(const char* name, int transfer, int lane, time_point start, std::initializer_list<Arg> args = {});
+    void instant(const char* name, int transfer, int lane, std::initializer_list<Arg> args = {});
+
+    // the events kept as {"traceEvents":[...]}, times in us from when it was created
+    string tojson();
+
+private:
+    struct Event
+    {
+        const char* name;
+        char phase;
+        int transfer;
+        int lane;
+        time_point start;
+        time_point end;
+        int nargs;
+        Arg args[MAXARGS];
+    };
+
+    void add(const char* name, char phase, int transfer, int lane, time_point start, time_point end, std::initializer_list<Arg> args);
+
+    std::mutex mMutex;
+    std::atomic<size_t> mCapacity;
+    vector<Event> mEvents;
+    size_t mNext = 0;
+    time_point mEpoch;
+};
+
+// Watches the thread of a loop (the SDK's) from a thread of its own, for passes so long that the
+// app sees the SDK frozen.  The loop marks the start of each pass and its waits; a pass longer
+// than the threshold is logged with the scopes active on the loop's thread at that moment (those
+// of ClientMetrics::Timer, and Scopes) and, where supported (glibc and Apple platforms), a sample
+// of its stack.  At most one stall is logged per LOGINTERVAL, the others counted in the next log
+class MEGA_API StallWatchdog
+{
+public:
+    StallWatchdog();
+    ~StallWatchdog();
+
+    // on the thread of the loop: it is the one watched, and the one whose scopes are tracked
+    void watch();
+
+    // from any thread: log the passes longer than thresholdMs (0 stops watching, the default),
+    // with a stack sample of each if stackSamples.  The samples interrupt the loop's thread
+    // with SIGURG, for which a handler is installed on the first use
+    void configure(int thresholdMs, bool stackSamples);
+
+    // on the watched thread: a pass starts, and the loop waits until the next one
+    void pass();
+    void idle();
+
+    // a part of a pass, named by a string that outlives it (a literal).  Tracked on the watched
+    // thread only, up to MAXSCOPES deep
+    class Scope
+    {
+    public:
+        explicit Scope(const char* name);
+        ~Scope();
+
+        MEGA_DISABLE_COPY_MOVE(Scope)
+
+    private:
+        StallWatchdog* mWatchdog;
+    };
+
+    // the scopes active on the watched thread, outermost first, separated by " > "
+    string scopes() const;
+
+    // the stalls found so far, logged or not
+    uint64_t stalls() const;
+
+    static const int MAXSCOPES = 16;
+    static const std::chrono::seconds LOGINTERVAL;
+
+private:
+    void run();
+    void report(int64_t passUs);
+    string stackSample();
+
+    // us on the steady clock since when the current pass runs, 0 while waiting
+    std::atomic<int64_t> mPassStart{0};
+    std::atomic<uint64_t> mPass{0};
+
+    std::array<std::atomic<const char*>, MAXSCOPES> mScopes;
+    std::atomic<int> mDepth{0};
+
+    std::atomic<bool> mWatching{false};
+#ifndef _WIN32
+    pthread_t mWatched;
+#endif
+
+    std::mutex mMutex;
+    std::condition_variable mChanged;
+    std::thread mThread;
+    int mThresholdMs = 0;
+    bool mStackSamples = false;
+    bool mStop = false;
+
+    std::atomic<uint64_t> mStalls{0};
+    uint64_t mReportedPass = 0;
+    uint64_t mSuppressed = 0;
+    std::chrono::steady_clock::time_point mLastLog;
+};
+
+// The API commands of one type (their "a"), over all the cs batches they went in
+struct MEGA_API CommandMetrics
+{
+    uint64_t count = 0;
+
+    // times they were in a batch sent again (see ClientMetrics::csEAgain)
+    uint64_t retries = 0;
+
+    // those the API answered with an error
+    uint64_t errors = 0;
+
+    // bytes of their results
+    uint64_t responseBytes = 0;
+
+    // from when their batch was last sent until its response arrived
+    LatencyHistogram latency;
+
+    // processing their results
+    LatencyHistogram parse;
+};
+
+// The metrics of a MegaClient, compiled in whatever the build (unlike the CodeCounter ones of
+// MEGA_MEASURE_CODE), for monitoring to read through MegaApi::getMetrics()
+struct MEGA_API ClientMetrics
+{
+    // each exec() pass
+    LatencyHistogram exec;
+
+    // each dispatchTransfers() pass
+    LatencyHistogram dispatchTransfers;
+
+    // each procsc() call, with the action packets it processes
+    LatencyHistogram scProcessing;
+
+    // each response to a batch of cs requests
+    LatencyHistogram csResponse;
+
+    // each commit of the state cache table
+    LatencyHistogram dbCommit;
+
+    // by command type.  Unlike the histograms, these are only used on the client thread, and read
+    // with the client locked
+    map<string, CommandMetrics> commands;
+    CommandMetrics& command(const char* name);
+
+    // cs batches sent again: after -3/-4 (EAGAIN), after a 500, and after other failures
+    uint64_t csEAgain = 0;
+    uint64_t csServerBusy = 0;
+    uint64_t csFailures = 0;
+
+    // shared with the jobs on the workers, which may end after the client
+    std::shared_ptr<TraceRing> transferTrace = std::make_shared<TraceRing>();
+
+    // times the scope it's declared in into a histogram, as a StallWatchdog::Scope of that name
+    class Timer
+    {
+    public:
+        Timer(LatencyHistogram& h, const char* name) : mScope(name), mHistogram(h), mStart(std::chrono::steady_clock::now()) { }
+        ~Timer() { mHistogram.record(std::chrono::steady_clock::now() - mStart); }
+
+        MEGA_DISABLE_COPY_MOVE(Timer)
+
+    private:
+        StallWatchdog::Scope mScope;
+        LatencyHistogram& mHistogram;
+        std::chrono::steady_clock::time_point mStart;
+    };
+
+    // the histograms as objects of json: count, sum, max and percentiles, in us.  Then those of
+    // the commands, in "commands"
+    void tojson(JSONWriter& json) const;
+
+    static void tojson(JSONWriter& json, const char* name, const LatencyHistogram& h);
+};
+
+} // namespace
+
+#endif
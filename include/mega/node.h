@@ -27,17 +27,31 @@
 #include "file.h"
 #include "attrmap.h"
 
+#include <atomic>
+#include <unordered_map>
+
 namespace mega {
 
-struct LocalPathPtrCmp
+// A child's name, with its hash computed once: the children of a folder are ordered by the hash
+// first, so that finding one compares whole names only on a hash match.  (A std::map rather than
+// an unordered_map, as the sync adds and removes children while iterating them.)
+struct LocalNameKey
+{
+    LocalNameKey(const LocalPath* n) : hash(n->hash()), name(n) {}
+
+    size_t hash;
+    const LocalPath* name;
+};
+
+struct LocalNameKeyCmp
 {
-    bool operator()(const LocalPath* a, const LocalPath* b) const
+    bool operator()(const LocalNameKey& a, const LocalNameKey& b) const
     {
-        return *a < *b;
+        return a.hash != b.hash ? a.hash < b.hash : *a.name < *b.name;
     }
 };
 
-typedef map<const LocalPath*, LocalNode*, LocalPathPtrCmp> localnode_map;
+typedef map<LocalNameKey, LocalNode*, LocalNameKeyCmp> localnode_map;
 typedef map<const string*, Node*, StringCmp> remotenode_map;
 
 struct MEGA_API NodeCore
@@ -112,13 +126,178 @@ struct Fingerprints
     Node* nodebyfingerprint(FileFingerprint* fingerprint);
     node_vector *nodesbyfingerprint(FileFingerprint* fingerprint);
 
+    // index of file nodes by their original fingerprint ('c0' attribute)
+    // updateoriginal() must be called whenever a node's attributes change
+    void updateoriginal(Node* n);
+    void removeoriginal(Node* n);
+    void nodesbyoriginalfingerprint(const char* originalfingerprint, node_vector& nv) const;
+
 private:
     fingerprint_set mFingerprints;
     m_off_t mSumSizes = 0;
+
+    using original_map = std::multimap<string, Node*>;
+    original_map mOriginalFingerprints;
+
+    // position of each indexed node in mOriginalFingerprints, so it can be removed after its attributes changed
+    std::unordered_map<Node*, original_map::iterator> mOriginalFingerprintNodes;
+};
+
+// File nodes ordered by creation time, most recent first, so recent-nodes queries only visit the
+// nodes in range.  A node's ctime must not change while it is indexed: remove() it first, add() it back after.
+struct CtimeIndex
+{
+    struct NodeCtimeCmp
+    {
+        bool operator()(const Node* a, const Node* b) const;
+    };
+
+    using ctime_set = std::set<Node*, NodeCtimeCmp>;
+    using const_iterator = ctime_set::const_iterator;
+
+    void add(Node* n);
+    void remove(Node* n);
+    void clear();
+
+    const_iterator begin() const { return mNodes.begin(); }
+    const_iterator end() const { return mNodes.end(); }
+
+private:
+    ctime_set mNodes;
+};
+
+
+// Children of a Node, in insertion order, in contiguous storage.
+// Erasing only nulls out the entry (the iterators skip those), so it is O(1) and does not invalidate
+// iterators - children may be removed while their siblings are being walked.  The storage is compacted
+// on insertion once enough entries have been erased, which like any insertion invalidates iterators.
+// Folders with many children also get an index by name, built on the first lookup that needs it.
+class MEGA_API NodeChildren
+{
+public:
+    class iterator
+    {
+        Node* const* mPos = nullptr;
+        Node* const* mEnd = nullptr;
+
+        void skiperased() { while (mPos != mEnd && !*mPos) ++mPos; }
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef Node* value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef Node* const* pointer;
+        typedef Node* const& reference;
+
+        iterator() = default;
+        iterator(Node* const* pos, Node* const* end) : mPos(pos), mEnd(end) { skiperased(); }
+
+        reference operator*() const { return *mPos; }
+        iterator& operator++() { ++mPos; skiperased(); return *this; }
+        iterator operator++(int) { iterator i = *this; ++*this; return i; }
+        bool operator==(const iterator& i) const { return mPos == i.mPos; }
+        bool operator!=(const iterator& i) const { return mPos != i.mPos; }
+    };
+    typedef iterator const_iterator;
+
+    NodeChildren() = default;
+    ~NodeChildren();
+    MEGA_DISABLE_COPY_MOVE(NodeChildren)
+
+    iterator begin() const  { return iterator(mNodes.data(), mNodes.data() + mNodes.size()); }
+    iterator end() const    { return iterator(mNodes.data() + mNodes.size(), mNodes.data() + mNodes.size()); }
+
+    size_t size() const     { return mNodes.size() - mErased; }
+    bool empty() const      { return mNodes.size() == mErased; }
+
+    // most recently added child (for files, their previous version)
+    Node* back() const;
+
+    // maintained on insertion/removal, so no need to scan the children
+    size_t numFiles() const     { return mFiles; }
+    size_t numFolders() const   { return size() - mFiles; }
+
+    void push_back(Node*);
+    void erase(Node*);
+
+    // must be called whenever a child's name may have changed, to keep the name index consistent
+    void nameChanged(Node*);
+
+    // children whose display name is exactly `name` (which must already be normalized), in insertion order
+    node_vector byname(const char* name);
+
+private:
+    vector<Node*> mNodes;
+    size_t mErased = 0;
+    size_t mFiles = 0;
+
+    // from name hash to child, and the hash each child was indexed under
+    struct NameIndex
+    {
+        std::unordered_multimap<size_t, Node*> nodes;
+        std::unordered_map<Node*, size_t> hashes;
+    };
+    unique_ptr<NameIndex> mNameIndex;
+
+    // folders with fewer children than this are just scanned
+    static const size_t NAMEINDEXTHRESHOLD = 64;
+
+    void compact();
+    void indexname(Node*);
+    void unindexname(Node*);
 };
 
+// a node record of the local cache (see Node::serialize()) read into its parts without touching
+// the client, so that records can be parsed on other threads and only the Node created on the
+// client's (see MegaClient::fetchsc())
+struct MEGA_API NodeRecord
+{
+    handle h = UNDEF;
+    handle ph = UNDEF;
+    handle owner = UNDEF;
+    nodetype_t type = TYPE_UNKNOWN;
+    m_off_t size = 0;
+    m_time_t ctime = 0;
+    string key;
+    string fileattrstring;
+    AttrMap attrs;
+    vector<unique_ptr<NewShare>> shares;
+
+    bool exported = false;
+    handle linkhandle = UNDEF;
+    m_time_t linkcts = 0;
+    m_time_t linkets = 0;
+    bool linktakendown = false;
+    string linkauthkey;
+
+    // either encoding (see Node::serialize() and Node::serializecompact())
+    bool unserialize(const string&, const FileSystemAccess&);
+
+    // the part of a compact record after its header, inflated into buffer if it was deflated.
+    // False if d is not a compact record, or is a corrupt one
+    static bool compactbody(const string& d, string* buffer, CacheableReader* body);
+
+private:
+    bool unserializecompact(const string&, const FileSystemAccess&);
+};
 
 // filesystem node
+// The values of a node that the app's sort orders compare, worked out once instead of on each
+// comparison (see Node::sortkeys())
+struct MEGA_API NodeSortKeys
+{
+    explicit NodeSortKeys(const Node& node);
+
+    // the display name, arranged so that comparing it byte by byte orders it as the natural
+    // sorting of names does (see naturalsorting_compare() in megaapi_impl.cpp)
+    string name;
+
+    int label = LBL_UNKNOWN;
+    bool favourite = false;
+    bool photo = false;
+    bool video = false;
+};
+
 struct MEGA_API Node : public NodeCore, FileFingerprint
 {
     MegaClient* client = nullptr;
@@ -135,6 +314,11 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
     // change parent node association
     bool setparent(Node*);
 
+    // for the top node of a removed subtree, before it is deleted: its counts leave those of
+    // its ancestors and it leaves its parent at once, so that the nodes below it are
+    // deleted without updating the nodes that are deleted with them
+    void detachremoved();
+
     // follow the parent links all the way to the top
     const Node* firstancestor() const;
 
@@ -144,12 +328,28 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
     // try to resolve node key string
     bool applykey();
 
+    // applykey() in two steps, so that the decryption can run elsewhere (see MegaClient::applykeys()):
+    // the encrypted key to apply now and the cipher that decrypts it, or NULL if there is none yet
+    const char* keytoapply(SymmCipher** cipher);
+
+    // store the decrypted node key (attributes are left alone)
+    void setappliedkey(const byte* key);
+
     // set up nodekey in a static SymmCipher
     SymmCipher* nodecipher();
 
     // decrypt attribute string and set fileattrs
     void setattr();
 
+    // the decryption part of setattr(), with cipher set up with the node key: no side effects on the node
+    bool decryptattrs(SymmCipher& cipher, attr_map& map) const;
+
+    // the rest of setattr(): take decrypted attributes and drop the encrypted ones
+    void setattrs(attr_map&& map);
+
+    // to be called after attrs change, updates the indexes that depend on them
+    void attrschanged();
+
     // display name (UTF-8)
     const char* displayname() const;
 
@@ -193,8 +393,30 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
     // app-private pointer
     void* appdata = nullptr;
 
+    // node data shared by the MegaNode objects created since its last change (see MegaNodeSnapshot).
+    // Use std::atomic_load/atomic_store: MegaNodes may be created while sdkMutex is held in shared mode.
+    std::shared_ptr<const MegaNodeSnapshot> apisnapshot;
+
+    // what the app's sort orders compare, built by the first sort that needs them after a change.
+    // Sorts may run with sdkMutex in shared mode: the first one to build them sets them, and they
+    // are only dropped while it's held exclusively
+    const NodeSortKeys& sortkeys() const;
+    mutable std::atomic<const NodeSortKeys*> mSortKeys{nullptr};
+
+    // drops apisnapshot and the sort keys, so that they are built again
+    void dropsnapshot();
+
     bool foreignkey = false;
 
+#ifdef ENABLE_SYNC
+    // state of removal to //bin / SyncDebris
+    // (kept next to the small fields above to avoid padding)
+    syncdel_t syncdeleted = SYNCDEL_NONE;
+#endif
+
+    // source tag.  The tag of the request or transfer that last modified this node (available in MegaApi)
+    int tag = 0;
+
     struct
     {
         bool removed : 1;
@@ -224,16 +446,24 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
 
     void faspec(string*);
 
+    // counts of this node and everything below it (O(1) for folders and root nodes)
     NodeCounter subnodeCounts() const;
 
     // parent
     Node* parent = nullptr;
 
+    // subnodeCounts() of folders and root nodes, updated as nodes get attached, moved and deleted.
+    // For files, the counts of the versions below them that lazyversions left in sctable, if any
+    std::unique_ptr<NodeCounter> counter;
+
+    // count (or stop counting) here and above a version of this file left in sctable
+    void lazyversion(m_off_t versionsize, bool add);
+
     // children
-    node_list children;
+    NodeChildren children;
 
     // own position in parent's children
-    node_list::iterator child_it;
+    size_t child_index = 0;
 
     // own position in fingerprint set (only valid for file nodes)
     Fingerprints::iterator fingerprint_it;
@@ -245,20 +475,10 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
     // active sync get
     struct SyncFileGet* syncget = nullptr;
 
-    // state of removal to //bin / SyncDebris
-    syncdel_t syncdeleted = SYNCDEL_NONE;
-
-    // location in the todebris node_set
-    node_set::iterator todebris_it;
-
-    // location in the tounlink node_set
-    // FIXME: merge todebris / tounlink
-    node_set::iterator tounlink_it;
+    // membership of MegaClient::todebris / tounlink is looked up by value rather than
+    // by storing iterators here, as those sets are almost always empty or tiny
 #endif
 
-    // source tag.  The tag of the request or transfer that last modified this node (available in MegaApi)
-    int tag = 0;
-
     // check if node is below this node
     bool isbelow(Node*) const;
 
@@ -270,9 +490,27 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
     bool serialize(string*) override;
     static Node* unserialize(MegaClient*, const string*, node_vector*);
 
+    // the record written by serialize() when MegaClient::compactnoderecords is set: varints instead
+    // of fixed width fields and short codes for common attribute names, deflated if that makes it
+    // smaller and MegaClient::compressnoderecords is set too
+    void serializecompact(string*);
+
+    // create the node read by NodeRecord::unserialize(), taking its attributes and shares
+    static Node* unserialize(MegaClient*, NodeRecord&, node_vector*);
+
+    // handle and parent handle of a serialized node, without unserializing the rest
+    static bool unserializehandles(const string*, handle* h, handle* ph);
+
     Node(MegaClient*, vector<Node*>*, handle, handle, nodetype_t, m_off_t, handle, const char*, m_time_t);
     ~Node();
 
+#ifdef ENABLE_NODE_ARENA
+    // Nodes come from a slab pool instead of the general heap: no per-allocation
+    // header, and nodes created together (eg. by fetchnodes) end up next to each other
+    static void* operator new(size_t);
+    static void operator delete(void*, size_t);
+#endif
+
 #ifdef ENABLE_SYNC
     void detach(const bool recreate = false);
 #endif // ENABLE_SYNC
@@ -302,6 +540,8 @@ inline bool Node::keyApplied() const
 
 
 #ifdef ENABLE_SYNC
+// There is one of these for every file and folder synced, so the members are kept in an order
+// that wastes no padding, and what few of them have is allocated only for those (as schildren)
 struct MEGA_API LocalNode : public File
 {
     class Sync* sync = nullptr;
@@ -318,17 +558,36 @@ struct MEGA_API LocalNode : public File
     // whether this node knew its shortname (otherwise it was loaded from an old db)
     bool slocalname_in_db = false;
 
+    // whether this node is the one for fsid in the client's fsidnode
+    bool fsid_mapped = false;
+
+    struct
+    {
+        // was actively deleted
+        bool deleted : 1;
+
+        // has been created remotely
+        bool created : 1;
+
+        // an issue has been reported
+        bool reported : 1;
+
+        // checked for missing attributes
+        bool checked : 1;
+    };
+
     // children by name
     localnode_map children;
 
     // for botched filesystems with legacy secondary ("short") names
     // Filesystem notifications could arrive with long or short names, and we need to recognise which LocalNode corresponds.
     std::unique_ptr<LocalPath> slocalname;   // null means either the entry has no shortname or it's the same as the (normal) longname
-    localnode_map schildren;
+
+    // children by short name, if any has one (null otherwise)
+    std::unique_ptr<localnode_map> schildren;
 
     // local filesystem node ID (inode...) for rename/move detection
     handle fsid = mega::UNDEF;
-    handlelocalnode_map::iterator fsid_it{};
 
     // related cloud node, if any
     crossref_ptr<Node, LocalNode> node;
@@ -336,6 +595,9 @@ struct MEGA_API LocalNode : public File
     // related pending node creation or NULL
     crossref_ptr<NewNode, LocalNode> newnode;
 
+    // global sync reference
+    handle syncid = mega::UNDEF;
+
     // FILENODE or FOLDERNODE
     nodetype_t type = TYPE_UNKNOWN;
 
@@ -345,24 +607,6 @@ struct MEGA_API LocalNode : public File
     // number of iterations since last seen
     int notseen = 0;
 
-    // global sync reference
-    handle syncid = mega::UNDEF;
-
-    struct
-    {
-        // was actively deleted
-        bool deleted : 1;
-
-        // has been created remotely
-        bool created : 1;
-
-        // an issue has been reported
-        bool reported : 1;
-
-        // checked for missing attributes
-        bool checked : 1;
-    };
-
     // current subtree sync state: current and displayed
     treestate_t ts = TREESTATE_NONE;
     treestate_t dts = TREESTATE_NONE;
@@ -377,12 +621,32 @@ struct MEGA_API LocalNode : public File
     dstime nagleds = 0;
     void bumpnagleds();
 
+    // the passes of syncdown() and syncup() compare the children of a folder with those of its
+    // Node only if they changed since (...dirty), and go down only the way to such folders
+    // (...subtree: set for this folder or any below it)
+    bool syncdowndirty = true;
+    bool syncdownsubtree = true;
+    bool syncupdirty = true;
+    bool syncupsubtree = true;
+
+    // the children of this folder (or of the folder of this file) changed, locally or remotely
+    void setsyncdirty();
+
+    // a pass over this folder ended: whether it or a folder below needs another, made known
+    // on the way up
+    void endsyncdown();
+    void endsyncup();
+
     // if delage > 0, own iterator inside MegaClient::localsyncnotseen
     localnode_set::iterator notseen_it{};
 
     // build full local path to this node
     void getlocalpath(LocalPath&) const;
     LocalPath getLocalPath() const;
+
+    // the path of the parent first, then this name: the names are written once, front to back,
+    // after making room for all of them (length: that of the names below)
+    void appendlocalpath(LocalPath&, size_t length) const;
     string localnodedisplaypath(FileSystemAccess& fsa) const;
 
     // return child node by name
@@ -397,6 +661,9 @@ struct MEGA_API LocalNode : public File
     void completed(Transfer*, LocalNode*) override;
     void terminated() override;
 
+    // uploads of backups are below those of two-way syncs
+    transferclass_t transferclass() const override;
+
     void setnode(Node*);
 
     void setnotseen(int);
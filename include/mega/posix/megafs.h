@@ -39,11 +39,28 @@
 #include <aio.h>
 #endif
 
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#include <mutex>
+#include <thread>
+#endif
+
 #include "mega.h"
 
+#if defined(USE_INOTIFY) && defined(__linux__)
+#include <sys/fanotify.h>
+
+// filesystem-wide notifications naming the changed entries (Linux 5.9)
+#ifdef FAN_REPORT_DFID_NAME
+#define MEGA_FANOTIFY 1
+#endif
+#endif
+
 #define DEBRISFOLDER ".debris"
 
 namespace mega {
+
+class PosixDirNotify;
 struct MEGA_API PosixDirAccess : public DirAccess
 {
     DIR* dp;
@@ -56,6 +73,7 @@ struct MEGA_API PosixDirAccess : public DirAccess
 
     bool dopen(LocalPath*, FileAccess*, bool) override;
     bool dnext(LocalPath&, LocalPath&, bool, nodetype_t*) override;
+    bool dnextbulk(LocalPath&, vector<Entry>&, size_t, bool, FileSystemAccess&) override;
 
     PosixDirAccess();
     virtual ~PosixDirAccess();
@@ -78,6 +96,22 @@ public:
     string lastname;
 #endif
 
+#ifdef MEGA_FANOTIFY
+    // if the process may have them (CAP_SYS_ADMIN and CAP_DAC_READ_SEARCH), the filesystems of
+    // the syncs are marked with fanotify, rather than with an inotify watch per folder
+    int fanotifyfd = -1;
+    vector<PosixDirNotify*> fanotifyroots;
+
+    // skip the FAN_MOVED_FROM component in moves if followed by FAN_MOVED_TO
+    PosixDirNotify* fanlastroot = nullptr;
+    string fanlastpath;
+
+    bool fanotifyadd(PosixDirNotify*);
+    void fanotifyremove(PosixDirNotify*);
+    int checkfanotify();
+    void fanotifynotify(PosixDirNotify*, const string&);
+#endif
+
 #ifdef USE_IOS
     static char *appbasepath;
 #endif
@@ -130,14 +164,53 @@ public:
     bool cwd(LocalPath& path) const override;
 };
 
-#ifdef HAVE_AIO_RT
+#if defined(HAVE_AIO_RT) || defined(HAVE_LIBURING)
 struct MEGA_API PosixAsyncIOContext : public AsyncIOContext
 {
     PosixAsyncIOContext();
     virtual ~PosixAsyncIOContext();
     virtual void finish();
 
+#ifdef HAVE_AIO_RT
     struct aiocb *aiocb;
+#endif
+
+    // of a FileAccess read once, to drop the pages read from the cache once they are
+    int readoncefd = -1;
+};
+#endif
+
+#ifdef HAVE_LIBURING
+// The io_uring of the process, where PosixFileAccess queues the async reads and writes of
+// transfers instead of handing them to POSIX AIO (which glibc runs on threads of its own, with an
+// allocation and a couple of thread hand-offs per operation).  A thread of its own reaps the
+// completions and calls the contexts back, as SIGEV_THREAD does for AIO
+class MEGA_API PosixIoUring
+{
+public:
+    // null if the kernel can't set up a ring (older than 5.1, or io_uring blocked by a sandbox),
+    // in which case async I/O goes through AIO as before
+    static PosixIoUring* instance();
+
+    // queue the READ or WRITE of context on fd.  The context is always called back, from the
+    // reaper thread or (if it can't be queued) from here
+    void submit(int fd, AsyncIOContext* context);
+
+    ~PosixIoUring();
+
+private:
+    static const unsigned ENTRIES = 256;
+
+    struct io_uring mRing;
+    std::mutex mSubmitMutex;
+    std::thread mReaper;
+
+    PosixIoUring() = default;
+    bool init();
+    void reap();
+
+    // set the results of context from the cqe result, and call it back
+    static void complete(AsyncIOContext* context, int result);
 };
 #endif
 
@@ -162,12 +235,17 @@ public:
     bool fwrite(const byte *, unsigned, m_off_t) override;
 
     bool ftruncate() override;
+    bool fpreallocate(m_off_t size) override;
+    void setreadonce() override;
 
     bool sysread(byte *, unsigned, m_off_t) override;
     bool sysstat(m_time_t*, m_off_t*) override;
     bool sysopen(bool async = false) override;
     void sysclose() override;
 
+    // with setreadonce(): done with what was read from fd (see PosixAsyncIOContext::readoncefd)
+    static void readdone(int fd, m_off_t pos, m_off_t len);
+
     PosixFileAccess(Waiter *w, int defaultfilepermissions = 0600, bool followSymLinks = true);
 
     // async interface
@@ -178,14 +256,17 @@ public:
 
     ~PosixFileAccess();
 
-#ifdef HAVE_AIO_RT
+#if defined(HAVE_AIO_RT) || defined(HAVE_LIBURING)
 protected:
     virtual AsyncIOContext* newasynccontext();
+#endif
+#ifdef HAVE_AIO_RT
     static void asyncopfinished(union sigval sigev_value);
 #endif
 
 private:
     bool mFollowSymLinks = true;
+    bool mReadOnce = false;
 
 };
 
@@ -200,6 +281,16 @@ public:
     fsfp_t fsfingerprint() const override;
     bool fsstableids() const override;
 
+#ifdef MEGA_FANOTIFY
+    // the filesystem of the sync is marked: no watches per folder, and the folders events
+    // carry by handle are opened through the root
+    bool fanotify = false;
+    int rootfd = -1;
+    fsid_t fsid;
+
+    ~PosixDirNotify();
+#endif
+
     PosixDirNotify(LocalPath&, const LocalPath&);
 };
 
@@ -103,6 +103,9 @@ protected:
     bool ipv6requestsenabled;
     std::queue<CurlHttpContext *> pendingrequests;
     std::map<string, CurlDNSEntry> dnscache;
+
+    // hosts being resolved by prewarm(), with the lookups pending for each
+    std::map<string, int> prewarming;
     int pkpErrors;
 
     void send_pending_requests();
@@ -145,6 +148,9 @@ protected:
 
     static void proxy_ready_callback(void*, int, int, struct hostent*);
     static void ares_completed_callback(void*, int, int, struct hostent*);
+    static void prewarm_callback(void*, int, int, struct hostent*);
+    static void ares_socket_state_callback(void*, ares_socket_t, int, int);
+    void applytransferprofile(curl_socket_t);
     static void send_request(CurlHttpContext*);
     void request_proxy_ip();
     static struct curl_slist* clone_curl_slist(struct curl_slist*);
@@ -154,6 +160,7 @@ protected:
     void filterDNSservers();
 
     bool curlipv6;
+    bool curlhttp2;
     bool reset;
     bool statechange;
     bool dnsok;
@@ -177,6 +184,12 @@ protected:
     bool arerequestspaused[3];
     int numconnections[3];
     set<CURL *>pausedrequests[3];
+
+    // requests paused by their own rate limits (see HttpReq::ratelimits), and the ds they resume at
+    std::map<CURL *, dstime> throttledrequests[3];
+    void throttle(CurlHttpContext*, dstime resumeds);
+    void resumethrottled(direction_t d);
+
     m_off_t partialdata[2];
     m_off_t maxspeed[2];
     bool curlsocketsprocessed;
@@ -193,6 +206,40 @@ public:
 
     void addevents(Waiter*, int) override;
 
+    // requests of each direction (API, GET, PUT) to the same server share a connection, with
+    // HTTP/2 where available.  Call setmultiplexing() after a change
+    bool multiplex[3];
+    void setmultiplexing();
+
+    void prewarm(const string& url) override;
+    bool settransferprofile(const TransferNetworkProfile&) override;
+
+    // what the transfer connections got: the socket buffers the OS granted (the sum, over the
+    // sockets opened) and the bytes and seconds of their requests, per direction
+    struct TransferSocketStats
+    {
+        uint64_t sockets = 0;
+        uint64_t rcvbuf = 0;
+        uint64_t sndbuf = 0;
+        uint64_t requests[2] = {};
+        uint64_t bytes[2] = {};
+        double seconds[2] = {};
+
+        std::string report(bool reset);
+    } transferSocketStats;
+
+    // the bytes of the API responses as they arrived, and once decoded (the API compresses them
+    // with any of the encodings libcurl offers: see CURLOPT_ENCODING)
+    struct ApiResponseBytes
+    {
+        uint64_t wire = 0;
+        uint64_t decoded = 0;
+
+        std::string report(bool reset);
+    } apiResponseBytes;
+    bool serializednscache(string*) override;
+    void unserializednscache(const string&) override;
+
     void setuseragent(string*) override;
     void setproxy(Proxy*);
     void setdnsservers(const char*);
@@ -261,6 +308,11 @@ struct MEGA_API CurlDNSEntry
     dstime ipv6timestamp;
 
     bool mNeedsResolvingAgain = false;
+
+    // when IPv6 last failed for this host: until IPV6_RETRY_INTERVAL_DS later, its requests go
+    // straight to IPv4
+    m_time_t ipv6failed = 0;
+    bool ipv6disabled() const;
 };
 
 } // namespace
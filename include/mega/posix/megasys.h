@@ -117,7 +117,7 @@
 #include <stdexcept>
 
 
-#ifndef USE_POLL
+#if !defined(USE_POLL) && !defined(USE_EPOLL) && !defined(USE_KQUEUE)
 #ifndef FD_COPY
 #define FD_COPY(s, d) ( memcpy(( d ), ( s ), sizeof( fd_set )))
 #endif
@@ -23,9 +23,18 @@
 #define WAIT_CLASS PosixWaiter
 
 #include "mega/waiter.h"
-#include <mutex>
+#include <atomic>
 
-#ifndef USE_POLL
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+    #define MEGA_EVENT_WAITER 1
+#endif
+
+#ifdef __linux__
+    // notify() signals an eventfd rather than writing to a pipe: one fd, and one read clears it
+    #define MEGA_NOTIFY_EVENTFD 1
+#endif
+
+#if !defined(USE_POLL) && !defined(MEGA_EVENT_WAITER)
     #define MEGA_FD_ZERO FD_ZERO
     #define MEGA_FD_SET FD_SET
     #define MEGA_FD_ISSET FD_ISSET
@@ -54,7 +63,7 @@ struct PosixWaiter : public Waiter
     mega_fd_set_t rfds, wfds, efds;
     mega_fd_set_t ignorefds;
 
-#ifdef USE_POLL
+#if defined(USE_POLL) || defined(MEGA_EVENT_WAITER)
 
     static void clear_fdset(mega_fd_set_t *s)
     {
@@ -76,12 +85,32 @@ struct PosixWaiter : public Waiter
     int wait();
     void bumpmaxfd(int);
 
+    // wakes up wait(), from any thread.  Only the first call after a wait writes to the fd:
+    // the others until the next wait find it signalled already
     void notify();
 
+#ifdef MEGA_EVENT_WAITER
+    // an fd given in the sets is about to be closed: the kernel drops it from the epoll/kqueue
+    // instance then, and the number may come back for another one
+    void forget(int fd);
+#else
+    void forget(int) { }
+#endif
+
 protected:
+    // the read and write ends of the pipe, or the eventfd twice
     int m_pipe[2];
-    std::mutex mMutex;
-    bool alreadyNotified = false;
+
+#ifdef MEGA_EVENT_WAITER
+    // the sets are still given for each wait, as for select(), but only their changes since the
+    // previous one are passed to the kernel, and only the fds that are ready come back in them
+    enum { EVREAD = 1, EVWRITE = 2, EVEXCEPT = 4 };
+    int mEventFd = -1;
+    std::map<int, int> mRegistered;
+
+    bool registerfd(int fd, int events, int previous);
+#endif
+    std::atomic<bool> alreadyNotified{false};
 };
 } // namespace
 
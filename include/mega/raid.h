@@ -111,9 +111,28 @@ namespace mega {
         // indicate that this connection has responded with headers, and see if we now know which is the slowest connection, and make that the unused one
         bool detectSlowestRaidConnection(unsigned thisConnection, unsigned& slowestConnection);
 
+        // With hedging, all 6 parts of a raid file stay in flight, and each run of raid lines is
+        // built from the first 5 parts to arrive.  The data the sixth sends for those lines is
+        // dropped.  If it falls a whole chunk behind, it is restarted from where the others are
+        // (see isRaidConnectionSuperseded()).  A slow server then costs a sixth more data rather
+        // than a stall.  Set before setIsRaid().  On by default for DirectRead streaming
+        void setHedging(bool hedge);
+        bool isHedging() const;
+
+        // with hedging: connectionNum is a whole chunk of lines behind those built already, so its
+        // request is better dropped and sent again from there
+        bool isRaidConnectionSuperseded(unsigned connectionNum);
+
         // returns how far we are through the file on average, including uncombined data
         m_off_t progress() const;
 
+        // interleave the sectors of partslen bytes of each part (a multiple of RAIDSECTOR) into
+        // dest, one raid line after another.  One of the parts can be missing (null): the data
+        // parts are then recovered from the parity of the others.  With vectorcombine (the
+        // default), a whole sector is one SSE2 or NEON register where the CPU has them
+        static void combineRaidLines(byte* dest, byte* const inputbufs[RAIDPARTS], size_t partslen);
+        static bool vectorcombine;
+
         RaidBufferManager();
         ~RaidBufferManager();
 
@@ -136,6 +155,9 @@ namespace mega {
         // of the six raid URLs, which 5 are we downloading from
         unsigned unusedRaidConnection;
 
+        // see setHedging()
+        bool hedging = false;
+
         // storage server access URLs.  It either has 6 entries for a raid file, or 1 entry for a non-raid file, or empty if we have not looked up a tempurl yet.
         std::vector<std::string> tempurls;
         std::string emptyReturnString;
@@ -175,8 +197,8 @@ namespace mega {
 
         // take raid input part buffers and combine to form the asyncoutputbuffers
         void combineRaidParts(unsigned connectionNum);
-        FilePiece* combineRaidParts(size_t partslen, size_t bufflen, m_off_t filepos, FilePiece& prevleftoverchunk);
-        void recoverSectorFromParity(byte* dest, byte* inputbufs[], unsigned offset);
+        FilePiece* combineRaidParts(size_t partslen, size_t bufflen, m_off_t filepos, FilePiece& prevleftoverchunk, unsigned skippedpart);
+        static void recoverSectorFromParity(byte* dest, byte* const inputbufs[], unsigned offset);
         void combineLastRaidLine(byte* dest, size_t nbytes);
         void rollInputBuffers(size_t dataToDiscard);
         virtual void bufferWriteCompletedAction(FilePiece& r);
@@ -56,6 +56,20 @@ public:
 
     // if contains only one command and that command is FetchNodes
     bool isFetchNodes() const;
+
+    // the request id it was first sent with (empty until then): a retry goes with the same one,
+    // so that the API doesn't execute it twice
+    string id;
+
+    // for the metrics of its commands: when it was last sent, how long its response took, and
+    // the times it was sent again
+    std::chrono::steady_clock::time_point sent;
+    std::chrono::steady_clock::duration latency{};
+    unsigned retries = 0;
+
+    // if all its commands may be sent while other batches are in flight, adding the nodes they
+    // change to keys
+    bool pipelinable(set<handle>& keys) const;
 };
 
 
@@ -64,6 +78,13 @@ class MEGA_API RequestDispatcher
     // these ones have been sent to the server, but we haven't received the response yet
     Request inflightreq;
 
+    // those sent on connections of their own while inflightreq is in flight, by request id (see
+    // MegaClient::csdepth)
+    map<string, Request> pipelinedreqs;
+
+    // the one whose response is being processed
+    Request* processingreq = nullptr;
+
     // client-server request double-buffering, in batches of up to MAX_COMMANDS
     deque<Request> nextreqs;
 
@@ -86,13 +107,30 @@ public:
      * @param suppressSID
      * @param includesFetchingNodes set to whether the commands include fetch nodes
      */
-    void serverrequest(string*, bool& suppressSID, bool &includesFetchingNodes);
+    void serverrequest(string*, bool& suppressSID, bool &includesFetchingNodes, string& id);
 
     // once the server response is determined, call one of these to specify the results
     void requeuerequest();
     void serverresponse(string&& movestring, MegaClient*);
     void servererror(const std::string &e, MegaClient*);
 
+    // whether the next batch can be sent now: when none is in flight, or when it and all those in
+    // flight have only pipelinable commands, none on the same node.  So the batches of commands
+    // whose order matters still go one after another
+    bool readytosend() const;
+
+    size_t pipelined() const;
+
+    // the next batch, sent while others are in flight.  id is the request id to send it with (the
+    // one of its first try, if it's a retry, or else the one given)
+    void pipelinerequest(string*, bool& suppressSID, string& id);
+
+    // the results of a pipelined batch.  One that failed goes back to the front of the queue, and
+    // is sent again as the others are
+    void pipelinedresponse(const string& id, string&& movestring, MegaClient*);
+    void pipelinederror(const string& id, const std::string& e, MegaClient*);
+    void pipelinedrequeue(const string& id);
+
     void clear();
 
 #ifdef MEGA_MEASURE_CODE
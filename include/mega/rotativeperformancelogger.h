@@ -46,7 +46,9 @@ public:
 
     static RotativePerformanceLogger& Instance();
 
-    void initialize(const char * logsPath, const char * logFileName, bool logToStdout);
+    // binary: the log (named logFileName.bin) keeps records that tests/tool/logdecode.cpp turns
+    // into text, which costs the threads that log much less
+    void initialize(const char * logsPath, const char * logFileName, bool logToStdout, bool binary = false);
 
     void log(const char *time, int loglevel, const char *source, const char *message
 #ifdef ENABLE_LOG_PERFORMANCE
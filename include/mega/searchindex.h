@@ -0,0 +1,78 @@
+/**
+ * @file mega/searchindex.h
+ * @brief Node name index for substring searches
+ *
+ * (c) 2013-2021 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#ifndef MEGA_SEARCHINDEX_H
+#define MEGA_SEARCHINDEX_H 1
+
+#include <unordered_map>
+#include <unordered_set>
+
+#include "types.h"
+
+namespace mega {
+
+// Index of node names for case-insensitive substring searches without walking the node tree.
+// Names are lower-cased (ASCII only, like strcasestr()) and indexed by their byte trigrams.  A query
+// only visits the nodes containing the rarest trigram of the search string and confirms them by
+// substring match.  Each entry also keeps a bitmap of the file types its extension belongs to, so
+// searches by type do not have to examine every node either.
+class MEGA_API SearchIndex
+{
+public:
+    enum
+    {
+        TYPE_PHOTO = 1,
+        TYPE_AUDIO = 2,
+        TYPE_VIDEO = 4,
+        TYPE_DOCUMENT = 8,
+    };
+
+    // (re)index node under name, replacing its previous entry
+    void update(Node* n, const string& name, unsigned types);
+    void remove(Node* n);
+    void clear();
+
+    // nodes whose name contains search (any name if null or empty) and, unless types is 0,
+    // whose type bitmap has any of types set.  Order is unspecified.
+    node_vector find(const char* search, unsigned types) const;
+
+    size_t size() const { return mEntries.size(); }
+
+private:
+    struct Entry
+    {
+        string name;
+        unsigned types;
+    };
+
+    using trigram = uint32_t;
+
+    static string lowercase(const char* s);
+    static void trigrams(const string& name, std::vector<trigram>& out);
+    void unindex(Node* n, const Entry& e);
+
+    std::unordered_map<Node*, Entry> mEntries;
+    std::unordered_map<trigram, std::unordered_set<Node*>> mTrigrams;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,150 @@
+/**
+ * @file mega/statesnapshot.h
+ * @brief Compacted copy of the local state cache for fast session resumption
+ *
+ * (c) 2013-2021 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#ifndef MEGA_STATESNAPSHOT_H
+#define MEGA_STATESNAPSHOT_H 1
+
+#include <unordered_map>
+
+#include "db.h"
+
+namespace mega {
+
+// The records of the state cache table (still encrypted, exactly as stored in the table) in a flat
+// image file, nodes ordered parents first, plus a log of the puts and deletions committed to the
+// table since the image was written.  Both files are plain sequences of fixed-size headers and
+// record data, so loading them is one sequential read each instead of a database step per row.
+//
+// The image is only usable while the last scsn committed to the image and log matches the one in
+// the table: anything else (no image yet, a crash between the table commit and the log append,
+// a table written by an older client) makes load() fail so the table is read as before.
+class MEGA_API StateSnapshot
+{
+public:
+    // the files are named after the state cache table (see SqliteDbAccess::databasePath())
+    StateSnapshot(FileSystemAccess& fsaccess, const LocalPath& rootpath, const string& name);
+
+    // read the image and the committed part of the log, and check them against the table's scsn
+    bool load(handle scsn);
+
+    // records of a successful load(), in order: those of the image not changed since, then the
+    // ones put since.  Returns false when there are no more
+    bool next(uint32_t* id, string* data);
+
+    // replace the image: beginimage(), addrecord() for every record of the table, endimage()
+    bool beginimage();
+    bool addrecord(uint32_t id, const char* data, size_t size);
+    bool endimage();
+
+    // changes of the table, kept until the transaction they belong to commits
+    void logput(uint32_t id, const char* data, unsigned size);
+    void logdel(uint32_t id);
+    void logcommit();
+    void logabort();
+
+    // the table has been emptied (or the image can't be trusted anymore): drop both files
+    void discard();
+
+    // a new image should be written once the table matches the nodes in memory
+    bool imagedue() const;
+
+private:
+    static const char MAGIC[8];
+
+    // log entries with this id end a transaction, and this size marks a deletion (neither is a
+    // valid table id or record size)
+    static const uint32_t COMMIT = 0xFFFFFFFF;
+    static const uint32_t DELETED = 0xFFFFFFFF;
+
+    FileSystemAccess& mFsAccess;
+    LocalPath mImagePath;
+    LocalPath mTempPath;
+    LocalPath mLogPath;
+
+    // image being written, and the size of the current one
+    std::unique_ptr<FileAccess> mImageFile;
+    string mImageBuffer;
+    m_off_t mImageSize = 0;
+
+    // log being appended to, if the image matches the table
+    std::unique_ptr<FileAccess> mLogFile;
+    m_off_t mLogSize = 0;
+    string mPending;
+
+    // loaded image and log, and where next() is in them
+    string mImage;
+    string mLog;
+    std::unordered_map<uint32_t, size_t> mChanged;  // id => log offset of its latest put, or size_t(-1) if deleted
+    std::vector<size_t> mPuts;                       // log offsets of the latest puts, in log order
+    size_t mImagePos = 0;
+    size_t mPutPos = 0;
+
+    // don't keep retrying on a disk that fails
+    bool mWriteFailed = false;
+
+    LocalPath path(const LocalPath& rootpath, const string& name, const char* suffix) const;
+    bool openlog(const string& committed);
+    bool flushimage();
+    void writefailed();
+    void release();
+};
+
+// the state cache table, with the changes committed to it mirrored into a StateSnapshot log
+class MEGA_API SnapshottedDbTable : public DbTable
+{
+public:
+    SnapshottedDbTable(PrnGen& rng, std::unique_ptr<DbTable> table, std::unique_ptr<StateSnapshot> snapshot);
+    ~SnapshottedDbTable();
+
+    StateSnapshot& snapshot();
+
+    void rewind() override;
+    bool next(uint32_t*, string*) override;
+    bool get(uint32_t, string*) override;
+    bool put(uint32_t, char*, unsigned) override;
+    bool del(uint32_t) override;
+    bool putBatch(const RecordBatch&) override;
+    bool delBatch(const vector<uint32_t>&) override;
+    bool delRange(const vector<uint32_t>&) override;
+    bool putNodeRecord(const DbNodeRecord&) override;
+    bool getChildren(handle, NodeRefs*) override;
+    bool getByFingerprint(const FileFingerprint&, NodeRefs*) override;
+    bool nodeIndexComplete() override;
+    void setNodeIndexComplete() override;
+    int64_t reclaimableBytes() override;
+    int64_t reclaimSpace(int64_t maxBytes) override;
+    bool vacuum() override;
+    void truncate() override;
+    void begin() override;
+    void commit() override;
+    void abort() override;
+    void remove() override;
+    void removeLater(vector<LocalPath>& files) override;
+    bool inTransaction() const override;
+
+private:
+    std::unique_ptr<DbTable> mTable;
+    std::unique_ptr<StateSnapshot> mSnapshot;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,99 @@
+/**
+ * @file mega/streamingcache.h
+ * @brief Decrypted file data kept for streaming reads
+ *
+ * (c) 2013-2021 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#ifndef MEGA_STREAMINGCACHE_H
+#define MEGA_STREAMINGCACHE_H 1
+
+#include <list>
+#include <map>
+
+#include "types.h"
+
+namespace mega {
+
+// The decrypted data of the files streamed with MegaClient::pread(), kept so that reads of the
+// same bytes (a player seeking back, or scrubbing) don't download them again.  Data is kept in
+// the segments it arrived in, per node, and the least recently used segments are dropped when
+// the capacity is exceeded.  A capacity of 0 (the default) keeps nothing.
+//
+// It also follows how fast each node is read, so that reads can fetch ahead of what the app
+// asks for (see readahead())
+class MEGA_API StreamingCache
+{
+public:
+    // seconds of playback fetched ahead of a read
+    static const int READAHEADSECONDS = 10;
+
+    void setCapacity(m_off_t bytes);
+    m_off_t capacity() const { return mCapacity; }
+
+    // bytes kept
+    m_off_t size() const { return mSize; }
+
+    // keep a copy of the len bytes at pos of node h (those not kept already)
+    void put(handle h, m_off_t pos, const byte* data, size_t len);
+
+    // append to out the bytes kept from pos on, up to len and until the first gap.  Returns how
+    // many were appended
+    size_t get(handle h, m_off_t pos, m_off_t len, string& out);
+
+    // a read of count bytes at offset of node h starts: how many more to fetch after it, given
+    // how fast the node has been read in sequence (at least minrate bytes per second)
+    m_off_t readahead(handle h, m_off_t offset, m_off_t count, m_off_t minrate);
+
+    void remove(handle h);
+    void clear();
+
+private:
+    typedef std::pair<handle, m_off_t> SegmentKey;
+
+    struct Segment
+    {
+        string data;
+        std::list<SegmentKey>::iterator lru;
+    };
+
+    struct NodeData
+    {
+        std::map<m_off_t, Segment> segments;
+
+        // the last read, to tell a sequential one after it, and the rate they go at
+        m_off_t readoffset = 0;
+        m_off_t readend = -1;
+        dstime readstart = 0;
+        m_off_t rate = 0;
+    };
+
+    std::map<handle, NodeData> mNodes;
+
+    // most recently used first
+    std::list<SegmentKey> mLru;
+
+    m_off_t mCapacity = 0;
+    m_off_t mSize = 0;
+
+    void insert(handle h, NodeData& node, m_off_t pos, const byte* data, size_t len);
+    void evict();
+};
+
+} // namespace
+
+#endif
@@ -95,6 +95,10 @@ public:
     // returns the type of the sync
     Type getType() const;
 
+    // whether remote changes are brought down: not for TYPE_UP and TYPE_BACKUP, which only
+    // upload the local changes (syncdown() doesn't run for them)
+    bool isDownSync() const;
+
     // This is where the remote root node was, last time we checked
 
     // error code or warning (errors mean the sync was stopped)
@@ -157,6 +161,10 @@ public:
     // This one is not serialized
     LocalPath mExternalDrivePath;
 
+    // position in the change journal of the filesystem (opaque, see FileSystemAccess::changecursor())
+    // up to which the changes are in the state cache.  Empty if unknown
+    string mChangeCursor;
+
     // enum to string conversion
     static const char* syncstatename(const syncstate_t state);
     static const char* synctypename(const Type type);
@@ -203,6 +211,61 @@ private:
 using SyncCompletionFunction =
   std::function<void(UnifiedSync*, const SyncError&, error)>;
 
+// Lists local folders on the worker threads of a MegaClientAsyncQueue for the scans of the syncs:
+// the subfolders of the folder being scanned are requested, and listed several at once while it is
+// processed, so that the latency of each directory (high on a network share) overlaps the others.
+// Each entry is what DirAccess::dnextbulk() found (the type, size, mtime and fsid that
+// Sync::checkpath() compares with its LocalNodes)
+class MEGA_API AsyncDirLister
+{
+public:
+    AsyncDirLister(MegaClientAsyncQueue& queue, FileSystemAccess& fsaccess);
+
+    typedef DirAccess::Entry Entry;
+
+    struct Listing
+    {
+        bool opened = false;
+        vector<Entry> entries;
+    };
+
+    // list the folder at path on the calling thread
+    static void list(FileSystemAccess& fsaccess, LocalPath path, bool followsymlinks, Listing& out);
+
+    // start listing it on a worker, unless it's requested already.  False if too many requests
+    // are pending, in which case nothing is done
+    bool request(const LocalPath& path, bool followsymlinks);
+
+    // the listing of a requested folder, waiting for it if it's in progress.  False if it wasn't
+    // requested, or was listed too long ago to be trusted
+    bool take(const LocalPath& path, Listing& out);
+
+    // forget all requests (those in progress finish to no one)
+    void clear();
+
+    static const size_t MAX_REQUESTED = 64;
+
+    // entries read from the folder per DirAccess::dnextbulk()
+    static const size_t BULKENTRIES = 512;
+
+    // deciseconds after its request after which a listing found done is stale
+    static const dstime MAXAGE = 100;
+
+private:
+    struct Job
+    {
+        std::mutex mutex;
+        std::condition_variable finished;
+        bool done = false;
+        dstime requested = 0;
+        Listing listing;
+    };
+
+    MegaClientAsyncQueue& mQueue;
+    FileSystemAccess& mFsAccess;
+    std::map<LocalPath, std::shared_ptr<Job>> mJobs;
+};
+
 class MEGA_API Sync
 {
 public:
@@ -252,27 +315,64 @@ public:
     // Caches all synchronized LocalNode
     void cachenodes();
 
+    // cachenodes(), at most every MegaClient::syncstatecacheflushds
+    void cachenodesifdue();
+
+    // when cachenodesifdue() is due to write what is queued (NEVER if nothing is to be written)
+    dstime statecacheflushds() const;
+
+    // whether cachenodes() would write something now
+    bool statecachepending() const;
+
     // change state, signal to application
     void changestate(syncstate_t, SyncError newSyncError, bool newEnableFlag, bool notifyApp);
 
     // skip duplicates and self-caused
     bool checkValidNotification(int q, Notification& notification);
 
-    // process and remove one directory notification queue item from *notify
-    dstime procscanq(int);
+    // process and remove directory notification queue items from *notify, until deadline
+    // (at least one, if any is ready)
+    dstime procscanq(int, std::chrono::steady_clock::time_point deadline);
+
+    // have the files of the notifications ready by dsmin, at the front of queue q, fingerprinted
+    // on the workers ahead of checkpath()
+    void prefetchfingerprints(int q, dstime dsmin);
 
     // recursively look for vanished child nodes and delete them
     void deletemissing(LocalNode*);
 
+    // a folder was moved: undo the deletions noted, by the notifications of their old paths, for
+    // the nodes below it that are at their new path, so they are not deleted and uploaded again
+    void keepmoved(LocalNode*);
+
     // scan specific path
-    LocalNode* checkpath(LocalNode*, LocalPath*, string* const, dstime*, bool wejustcreatedthisfolder, DirAccess* iteratingDir);
+    // (scanned: the entry of localpath in the listing of the folder being scanned, if it's that)
+    LocalNode* checkpath(LocalNode*, LocalPath*, string* const, dstime*, bool wejustcreatedthisfolder, AsyncDirLister::Entry* scanned);
 
     m_off_t localbytes = 0;
     unsigned localnodes[2]{};
 
+    // the uploads of LocalNodes of the sync, and the downloads to it, in flight: syncup() and
+    // syncdown() start about MAXTRANSFERS of each at most, and the rest as half of these end, so
+    // that the transfers of a large initial sync don't all exist at once
+    unsigned uploadsinflight = 0;
+    unsigned downloadsinflight = 0;
+    bool uploadsheldback = false;
+    bool downloadsheldback = false;
+    void uploadended();
+    void downloadended();
+
     // look up LocalNode relative to localroot
     LocalNode* localnodebypath(LocalNode*, const LocalPath&, LocalNode** = nullptr, LocalPath* outpath = nullptr);
 
+    // the folder at localpath (of l) is listed the same as at the last rescan, or isn't due to be
+    // listed yet: its children are marked as seen without checking them, and its subfolders
+    // scanned
+    void scanunchanged(LocalPath& localpath, LocalNode* l);
+
+    // whether a rescan lists the folder at localpath (always, but for network folders not due)
+    bool polldue(const LocalPath& localpath);
+
     // Assigns fs IDs to those local nodes that match the fingerprint retrieved from disk.
     // The fs IDs of unmatched nodes are invalidated.
     bool assignfsids();
@@ -281,6 +381,15 @@ public:
     // LocalNode
     bool scan(LocalPath*, FileAccess*);
 
+    // instead of the initial scan: queue only the paths that the change journal of the
+    // filesystem has changed since the cursor of the config, if the cached LocalNodes were
+    // loaded and the journal still goes back that far
+    bool replaychanges();
+
+    // at a point where the notifications are processed: persist the journal cursor taken at the
+    // previous one (the changes before it have been notified and cached by now), and take another
+    void updatechangecursor();
+
     // rescan sequence number (incremented when a full rescan or a new
     // notification batch starts)
     int scanseqno = 0;
@@ -295,6 +404,9 @@ public:
     // state cache table
     DbTable* statecachetable = nullptr;
 
+    // when cachenodes() last wrote to it
+    dstime statecacheflushed = 0;
+
     // move file or folder to localdebris
     bool movetolocaldebris(LocalPath& localpath);
 
@@ -310,9 +422,33 @@ public:
     // true if the sync hasn't loaded cached LocalNodes yet
     bool initializing = true;
 
+    // true if readstatecache() found LocalNodes
+    bool statecacheloaded = false;
+
     // true if the local synced folder is a network folder
     bool isnetwork = false;
 
+    // The changes of network folders aren't notified, so they are found by the full rescans
+    // (see MegaClient::exec()).  Over a slow mount, listing every folder and checking every file
+    // again each time is what takes long: the listing of each folder is hashed instead, and a
+    // folder listed the same as the last time doesn't get its entries checked again (its
+    // subfolders are still scanned).  A folder found unchanged is listed at longer and longer
+    // intervals, up to MAX_POLL_INTERVAL_DS, and at each rescan again once it changes.  The fsid
+    // tells that the folder at the path is still the one listed
+    struct PolledFolder
+    {
+        size_t listinghash = 0;
+        handle fsid = UNDEF;
+        dstime interval = 0;
+        dstime nextpoll = 0;
+        int scanseqno = 0;
+        bool listed = false;
+    };
+    map<LocalPath, PolledFolder> polledfolders;
+
+    // forget the folders that the last two rescans didn't reach (as deletemissing() does)
+    void prunepolled();
+
     // values related to possible files being updated
     m_off_t updatedfilesize = ~0;
     m_time_t updatedfilets = 0;
@@ -330,6 +466,10 @@ public:
     static const int FILE_UPDATE_DELAY_DS;
     static const int FILE_UPDATE_MAX_DELAY_SECS;
     static const dstime RECENT_VERSION_INTERVAL_SECS;
+    static const dstime CHANGE_CURSOR_INTERVAL_DS;
+    static const unsigned MAXTRANSFERS;
+    static const dstime MIN_POLL_INTERVAL_DS;
+    static const dstime MAX_POLL_INTERVAL_DS;
 
     UnifiedSync& mUnifiedSync;
 
@@ -338,6 +478,10 @@ protected :
 
 private:
     LocalPath mLocalPath;
+
+    // journal cursor taken at the last updatechangecursor(), to be persisted at the next one
+    string mPendingChangeCursor;
+    dstime mChangeCursorTime = 0;
 };
 
 
@@ -516,6 +660,55 @@ private:
     HMACSHA256 mSigner;
 }; // JSONSyncConfigIOContext
 
+// The tree states of the LocalNodes of the running syncs, by the hash of their full path, for the
+// queries of other threads that must not wait for the client's thread: the overlay icons of a
+// file manager, which asks for every file it shows (see MegaApiImpl::syncPathState()).
+// LocalNode::treestate() and the moves and deletions of LocalNodes keep it current, from the
+// client's thread; TREESTATE_NONE isn't kept.  Readers and writers hold its own mutex for one
+// lookup or update at a time, never sdkMutex
+class MEGA_API SyncTreeStates
+{
+public:
+    enum Found
+    {
+        NOT_SYNCED, // the path is in no sync
+        IN_DEBRIS,  // in the local debris of a sync
+        KNOWN,      // the state of its LocalNode is kept
+        UNKNOWN,    // in a sync, but no state is kept: no LocalNode, or TREESTATE_NONE
+    };
+
+    // what is known of path, and its state if KNOWN
+    Found get(const LocalPath& path, treestate_t& ts) const;
+
+    // a sync starts or stops
+    void addSync(const Sync*, const LocalPath& root, const LocalPath& debris);
+    void removeSync(const Sync*);
+
+    void set(const LocalNode&, treestate_t);
+
+    // l, and what is below it, goes (path: its full one)
+    void erase(const LocalNode& l, LocalPath& path);
+
+    // l, and what is below it, moved from oldpath (in sync from) to newpath
+    void moved(const Sync* from, const LocalNode& l, LocalPath& oldpath, LocalPath& newpath);
+
+private:
+    struct States
+    {
+        const Sync* sync;
+        LocalPath root;
+        LocalPath debris;
+        std::unordered_map<size_t, treestate_t> states;
+    };
+
+    vector<States> mSyncs;
+    mutable std::mutex mMutex;
+
+    States* statesOf(const Sync*);
+    void erase(States&, const LocalNode&, LocalPath&);
+    void move(States& from, States& to, const LocalNode&, LocalPath& oldpath, LocalPath& newpath);
+};
+
 struct Syncs
 {
     UnifiedSync* appendNewSync(const SyncConfig&, MegaClient& mc);
@@ -530,6 +723,13 @@ struct Syncs
     void forEachUnifiedSync(std::function<void(UnifiedSync&)> f);
     void forEachRunningSync(std::function<void(Sync* s)>);
     bool forEachRunningSync_shortcircuit(std::function<bool(Sync* s)>);
+
+    // as forEachRunningSync_shortcircuit(), but those with the fewest notifications in queue q
+    // first, each with a deadline for its share of a slice of MegaClient::EXECSLICEMS: what is
+    // left of the slice, split among the syncs with notifications that are still to go.  So a
+    // sync with a few changes doesn't wait behind the scan of a large one, which still gets the
+    // time the others didn't use
+    bool forEachRunningSyncByScanQueue(int q, std::function<bool(Sync* s, std::chrono::steady_clock::time_point deadline)>);
     void forEachRunningSyncContainingNode(Node* node, std::function<void(Sync* s)> f);
     void forEachSyncConfig(std::function<void(const SyncConfig&)>);
 
@@ -565,6 +765,9 @@ struct Syncs
     // for quick lock free reference by MegaApiImpl::syncPathState (don't slow down windows explorer)
     bool isEmpty = true;
 
+    // and the states it reports, also without the client's lock
+    SyncTreeStates treestates;
+
     unique_ptr<BackupMonitor> mHeartBeatMonitor;
 
     // Returns a reference to this user's internal configuration database.
@@ -0,0 +1,90 @@
+/**
+ * @file mega/threadconfig.h
+ * @brief Sizes, CPU affinity and priority of the threads the SDK starts
+ *
+ * (c) 2013-2021 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#ifndef MEGA_THREADCONFIG_H
+#define MEGA_THREADCONFIG_H 1
+
+#include <functional>
+#include <vector>
+
+#include "types.h"
+
+namespace mega {
+
+// The kinds of threads the SDK starts, each with settings of its own (eg. so that the many
+// instances of a server keep to some cores, or their workers yield to the app's threads)
+enum ThreadRole
+{
+    THREAD_ROLE_SDK,        // the thread of each MegaApi, and the one of its transfer callbacks
+    THREAD_ROLE_WORKER,     // MegaWorkerPool: encryption, fingerprints, folder listings
+    THREAD_ROLE_GFX,        // thumbnails and previews
+    THREAD_ROLE_SERVER,     // the event loops of the HTTP and FTP servers
+    THREAD_ROLE_SEARCH,     // the walks of large trees split among threads
+    THREAD_ROLE_BACKGROUND, // the database writer, the performance logger, the stall detector, the io_uring reaper
+    THREAD_ROLE_COUNT
+};
+
+struct MEGA_API ThreadSettings
+{
+    enum Priority
+    {
+        PRIORITY_DEFAULT,   // that of the thread starting them
+        PRIORITY_HIGH,      // above it, where the process is allowed to
+        PRIORITY_LOW,
+        PRIORITY_IDLE,      // only when nothing else wants the CPU
+    };
+
+    // for the roles with a pool: the worker threads shared by the MegaApi instances (0 for each
+    // to have its own, see MegaApiImpl::getSharedWorkerPool), those making the thumbnails and
+    // previews of each instance (0 for one), and those of a tree walk (0 for one per core, up to
+    // a limit).  Ignored by the roles of single threads
+    unsigned count = 0;
+
+    // the CPUs the threads may run on, any if empty
+    std::vector<unsigned> cpus;
+
+    Priority priority = PRIORITY_DEFAULT;
+};
+
+// Process-wide, for the threads started after each change
+class MEGA_API ThreadConfig
+{
+public:
+    static void set(ThreadRole role, const ThreadSettings& settings);
+    static ThreadSettings get(ThreadRole role);
+
+    // for the threads of the SDK to call first thing.  A setting the platform lacks (eg. the
+    // affinity on macOS), or isn't allowed to apply, is logged and the others apply anyway
+    static void apply(ThreadRole role);
+
+    // "0-3,8,10-11" (as taskset and the cgroups write them) into cpus; false if it isn't such a list
+    static bool parseCpuList(const char* list, std::vector<unsigned>& cpus);
+
+    // Runs a function on a thread of the app.  The worker pools created while one is set hand
+    // their jobs to it instead of starting threads of their own (see MegaWorkerPool)
+    using Executor = std::function<void(std::function<void()>)>;
+    static void setExecutor(Executor executor);
+    static Executor executor();
+};
+
+} // namespace
+
+#endif
@@ -42,6 +42,86 @@ struct TransferCategory
     unsigned directionIndex();
 };
 
+// How many transfers MegaClient::dispatchTransfers() keeps running, and how much work it queues
+// up in each TransferCategory.  The client tells its policy what it measures: the speed and the
+// active transfers of each direction on every dispatch pass, and the chunk requests that fail
+class MEGA_API TransferConcurrencyPolicy
+{
+public:
+    virtual ~TransferConcurrencyPolicy() { }
+
+    // transfers running at once, in total and in a direction
+    virtual unsigned maxTotalTransfers() const = 0;
+    virtual unsigned maxTransfers(direction_t) const = 0;
+
+    // bytes still to go that the transfers started in a category should add up to, for a direction
+    // moving speed bytes per second: enough to keep it busy for the next 30 seconds
+    virtual m_off_t targetOutstanding(direction_t, m_off_t speed) const;
+
+    // a direction's speed (see HttpIO::downloadSpeed) and active transfers at ds
+    virtual void sample(dstime, direction_t, m_off_t, unsigned) { }
+
+    // a chunk request of a transfer in the direction failed (other than for being over quota)
+    virtual void requestfailed(direction_t) { }
+};
+
+// fixed limits
+class MEGA_API FixedTransferConcurrency : public TransferConcurrencyPolicy
+{
+public:
+    // maximum number of concurrent transfers (uploads + downloads)
+    static const unsigned MAXTOTALTRANSFERS;
+
+    // maximum number of concurrent transfers (uploads or downloads)
+    static const unsigned MAXTRANSFERS;
+
+    unsigned maxTotalTransfers() const override;
+    unsigned maxTransfers(direction_t) const override;
+};
+
+// Additive increase, multiplicative decrease of the transfers in each direction, starting from
+// FixedTransferConcurrency::MAXTRANSFERS.  Every WINDOWDS, a direction that ran all the
+// transfers it could gets STEP more if its speed grew by a twentieth since its last such window,
+// and loses a quarter if the speed fell by a quarter or any of its requests failed.  Links that
+// more transfers don't make faster keep their limit; those that more transfers slow down (or
+// break) come down from it.  The work queued in a category grows with the limit, so that small
+// files can fill the slots
+class MEGA_API AdaptiveTransferConcurrency : public TransferConcurrencyPolicy
+{
+public:
+    static const unsigned MINTRANSFERS;
+    static const unsigned MAXTRANSFERS;
+    static const unsigned STEP;
+    static const dstime WINDOWDS;
+
+    AdaptiveTransferConcurrency();
+
+    unsigned maxTotalTransfers() const override;
+    unsigned maxTransfers(direction_t) const override;
+    m_off_t targetOutstanding(direction_t, m_off_t speed) const override;
+    void sample(dstime, direction_t, m_off_t speed, unsigned active) override;
+    void requestfailed(direction_t) override;
+
+private:
+    struct Direction
+    {
+        unsigned limit;
+
+        // the window being measured: since when, the speeds sampled, whether all the samples ran
+        // as many transfers as allowed, and the requests that failed
+        dstime windowstart = NEVER;
+        m_off_t speedsum = 0;
+        unsigned samples = 0;
+        bool saturated = true;
+        unsigned failures = 0;
+
+        // the mean speed of the last window that ran all it could, 0 if none yet
+        m_off_t lastspeed = 0;
+    };
+
+    std::array<Direction, 2> mDirections;
+};
+
 class DBTableTransactionCommitter;
 
 // pending/active up/download ordered by file fingerprint (size - mtime - sparse CRC)
@@ -114,28 +194,52 @@ struct MEGA_API Transfer : public FileFingerprint
     // remove file from transfer including in cache
     void removeTransferFile(error, File* f, DBTableTransactionCommitter* committer);
 
-    // previous wrong fingerprint
-    FileFingerprint badfp;
-
-    // flag to know if prevmetamac is valid
-    bool hasprevmetamac;
-
-    // previous wrong metamac
-    int64_t prevmetamac;
-
-    // flag to know if currentmetamac is valid
-    bool hascurrentmetamac;
-
-    // current wrong metamac
-    int64_t currentmetamac;
-
-    // transfer state
-    bool finished;
+    // what the fingerprint and MAC checks of the file found (see complete() and File::failed()),
+    // kept from one attempt to the next.  integrity() allocates it the first time they run, so
+    // that the transfers still queued (a backup can queue millions) don't carry it
+    struct Integrity
+    {
+        // previous wrong fingerprint
+        FileFingerprint badfp;
+
+        // previous wrong metamac, if hasprevmetamac
+        bool hasprevmetamac = false;
+        int64_t prevmetamac = 0;
+
+        // current wrong metamac, if hascurrentmetamac
+        bool hascurrentmetamac = false;
+        int64_t currentmetamac = 0;
+    };
+    std::unique_ptr<Integrity> integritystate;
+    Integrity& integrity();
+
+    // with MegaClient::asynccompletions: the fingerprint of a finished download, which a worker
+    // reads the whole file for.  complete() waits (returns) while it is queued in
+    // MegaClient::verifyingdownloads, and takes the result when exec() calls it back
+    struct Verification
+    {
+        std::atomic<bool> done;
+        bool queued = true;
+        bool opened = false;
+        bool retry = false;
+        FileFingerprint fingerprint;
+
+        Verification() : done(false) { }
+    };
+    std::shared_ptr<Verification> verification;
+
+    // have a worker fingerprint localfilename into verification
+    void verifyonworker();
 
     // temp URLs for upload/download data.  They can be cached.  For uploads, a new url means any previously uploaded data is abandoned.
     // downloads can have 6 for raid, 1 for non-raid.  Uploads always have 1
     std::vector<string> tempurls;
 
+    // the request for tempurls made while still queued (see MegaClient::prefetchdownloadurls),
+    // and when its URLs arrived (0 if tempurls didn't come from one)
+    Command* urlprefetch;
+    dstime urlprefetchds;
+
     // context of the async fopen operation
     AsyncIOContext* asyncopencontext;
 
@@ -148,8 +252,25 @@ struct MEGA_API Transfer : public FileFingerprint
     // state of the transfer
     transferstate_t state;
 
+    // the most urgent class of its files, as of when it was queued (see TransferList::classify)
+    transferclass_t transferclass;
+
+    // the limit on its own speed (see TokenBucket), on top of those of the client: none until
+    // MegaClient::settransferspeed() sets one
+    std::unique_ptr<TokenBucket> ratelimit;
+
+    // transfer state
+    bool finished;
+
     bool skipserialization;
 
+    // download a raid file from all 6 parts at once, and build it from the first 5 to arrive
+    // (see RaidBufferManager::setHedging): less tail latency, for a sixth more data
+    bool hedgeraid = false;
+
+    // its tctable record is out of date (see MegaClient::batchtransfercache)
+    bool cachedirty;
+
     Transfer(MegaClient*, direction_t);
     virtual ~Transfer();
 
@@ -159,6 +280,9 @@ struct MEGA_API Transfer : public FileFingerprint
     // unserialize a Transfer and add it to the transfer map
     static Transfer* unserialize(MegaClient *, string*, transfer_map *);
 
+    // read just what resuming needs to know of a serialized Transfer, without unserializing it
+    static bool unserializeindex(const string&, direction_t&, FileFingerprint&, m_time_t& lastaccesstime, uint64_t& priority);
+
     // examine a file on disk for video/audio attributes to attach to the file, on upload/download
     void addAnyMissingMediaFileAttributes(Node* node, LocalPath& localpath);
 
@@ -210,14 +334,28 @@ public:
     transfer_list::iterator begin(direction_t direction);
     transfer_list::iterator end(direction_t direction);
     bool getIterator(Transfer *transfer, transfer_list::iterator&, bool canHandleErasedElements = false);
-    std::array<vector<Transfer*>, 6> nexttransfers(std::function<bool(Transfer*)>& continuefunction);
+
+    // the transfers to start, in queue order, for each TransferCategory: those that
+    // continuefunction takes, until it turns down one of each category or directionfull says
+    // that no more of a direction can be taken.  With MegaClient::fairtransferclasses, the
+    // transfers of each class are offered in proportion to the weight of their class instead
+    std::array<vector<Transfer*>, 6> nexttransfers(std::function<bool(Transfer*)>& continuefunction,
+                                                   std::function<bool(direction_t)>& directionfull);
     Transfer *transferat(direction_t direction, unsigned int position);
 
+    // set the class of a queued transfer again, after a file of a more urgent one joined it
+    void classify(Transfer* transfer);
+
     std::array<transfer_list, 2> transfers;
     MegaClient *client;
     uint64_t currentpriority;
 
+    // the number of transfers in transfers[direction] of each class
+    std::array<std::array<size_t, TRANSFERCLASSES>, 2> classcounts;
+
 private:
+    std::array<vector<Transfer*>, TRANSFERCLASSES> readybyclass(direction_t direction, size_t atmost);
+
     void prepareIncreasePriority(Transfer *transfer, transfer_list::iterator srcit, transfer_list::iterator dstit, DBTableTransactionCommitter& committer);
     void prepareDecreasePriority(Transfer *transfer, transfer_list::iterator it, transfer_list::iterator dstit);
     bool isReady(Transfer *transfer);
@@ -236,6 +374,9 @@ struct MEGA_API DirectReadSlot
     DirectRead* dr;
     std::vector<HttpReq*> reqs;
 
+    // the storage hosts of its connections, counted in MegaClient::drhostconnections
+    std::vector<string> hosts;
+
     drs_list::iterator drs_it;
     SpeedController speedController;
     m_off_t speed;
@@ -246,9 +387,16 @@ struct MEGA_API DirectReadSlot
     DirectReadSlot(DirectRead*);
     ~DirectReadSlot();
 
+    // the storage host of a temp URL
+    static string host(const string& url);
+
+    // a slot for dr would not exceed MegaClient::maxdrslotsperhost on any of its hosts
+    static bool hostsavailable(DirectRead* dr);
+
 private:
     std::string adjustURLPort(std::string url);
     bool processAnyOutputPieces();
+    bool processCachedData();
 };
 
 struct MEGA_API DirectRead
@@ -260,11 +408,16 @@ struct MEGA_API DirectRead
 
     DirectReadBufferManager drbuf;
 
+    // the bytes at offset that MegaClient::streamingcache had, delivered before any downloaded,
+    // and how many are fetched after count for it (see StreamingCache::readahead())
+    string cached;
+    m_off_t readahead;
+
     DirectReadNode* drn;
     DirectReadSlot* drs;
 
     dr_list::iterator reads_it;
-    dr_list::iterator drq_it;
+    dr_list::iterator drq_it;  // while waiting for a slot
 
     void* appdata;
 
@@ -272,6 +425,12 @@ struct MEGA_API DirectRead
 
     void abort();
 
+    // set up drbuf for the part not in the cache, and the read-ahead
+    void startbuffer();
+
+    // all count bytes were delivered: the app is done with it, and it only fills the cache
+    bool readingahead() const { return progress >= count; }
+
     DirectRead(DirectReadNode*, m_off_t, m_off_t, int, void*);
     ~DirectRead();
 };
@@ -299,6 +458,9 @@ struct MEGA_API DirectReadNode
 
     dr_list reads;
 
+    // of its reads that have a DirectReadSlot
+    unsigned slots = 0;
+
     MegaClient* client;
 
     handledrn_map::iterator hdrn_it;
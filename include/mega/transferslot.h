@@ -26,6 +26,7 @@
 #include "node.h"
 #include "backofftimer.h"
 #include "raid.h"
+#include "metrics.h"
 
 namespace mega {
 
@@ -44,6 +45,44 @@ public:
     inline operator FileAccess* () { return fa.get(); }
 };
 
+// The connections a striped upload (see MegaClient::stripeduploads) sends chunks on, between 1
+// and a ceiling.  The first window starts as many as keep the link busy while each request waits
+// a round trip for its reply (the speed times the RTT, in requests); after that, every window
+// adds one if the speed grew by a twentieth and drops one if it fell by a quarter or a request
+// failed.  A window is WINDOWDS, or 8 round trips if those are longer
+class MEGA_API StripedUploadTuner
+{
+public:
+    static const dstime WINDOWDS;
+
+    StripedUploadTuner(unsigned initial, unsigned ceiling);
+
+    unsigned active() const;
+
+    // a request of size bytes succeeded, on a connection that took connectms to connect (0 if it
+    // was reused): the lowest such time is taken as the RTT
+    void requestdone(m_off_t size, int connectms);
+
+    // the upload's speed at ds
+    void sample(dstime ds, m_off_t speed);
+
+    void requestfailed();
+
+private:
+    unsigned mActive;
+    unsigned mCeiling;
+    int mRttMs = 0;
+    m_off_t mRequestSize = 0;
+
+    dstime mWindowStart = NEVER;
+    m_off_t mSpeedSum = 0;
+    unsigned mSamples = 0;
+    unsigned mFailures = 0;
+
+    // the mean speed of the last window, 0 if none yet
+    m_off_t mLastSpeed = 0;
+};
+
 class DBTableTransactionCommitter;
 
 // active transfer
@@ -102,9 +141,29 @@ struct MEGA_API TransferSlot
     vector<SpeedController> mReqSpeeds;
     SpeedController mTransferSpeed;
 
+    // with MegaClient::adaptiverequestsize: the size of the next request of each connection, and
+    // whether its last request was accounted for already
+    vector<m_off_t> mReqSizes;
+    vector<bool> mReqSizeAdapted;
+
+    // with MegaClient::stripeduploads, for large uploads: how many of the connections send
+    // chunks.  All of them finish the requests they have in flight
+    std::unique_ptr<StripedUploadTuner> mStriped;
+
     // only swap channels twice for speed issues, to prevent endless non-progress (counter is reset if we make overall progress, ie data reassembled)
     unsigned mRaidChannelSwapsForSlowness = 0;
 
+    // for the events of ClientMetrics::transferTrace: when the slot was created, and when the
+    // current step of each connection started (its request, decryption or disk io)
+    std::chrono::steady_clock::time_point mTraceStart;
+    vector<std::chrono::steady_clock::time_point> mTraceSteps;
+    bool mTracedUrls = false;
+    TraceRing& trace();
+
+    // the span of the current step of connection i, which ends now, as the next one starts
+    void tracestep(unsigned i, const char* name, std::initializer_list<TraceRing::Arg> args = {});
+    void tracechunk(unsigned i);
+
     // Manage download input buffers and file output buffers for file download.  Raid-aware, and automatically performs decryption and mac.
     TransferBufferManager transferbuf;
 
@@ -128,7 +187,7 @@ struct MEGA_API TransferSlot
 
     // compute the meta MAC based on the chunk MACs
     int64_t macsmac(chunkmac_map*);
-    int64_t macsmac_gaps(chunkmac_map*, size_t g1, size_t g2, size_t g3, size_t g4);
+    int64_t macsmac_gaps(chunkmac_map*, const chunkmac_map::FoldStates&, size_t g1, size_t g2, size_t g3, size_t g4);
 
     // tslots list position
     transferslot_list::iterator slots_it;
@@ -140,11 +199,22 @@ struct MEGA_API TransferSlot
     // transfer failure flag. MegaClient will increment the transfer->errorcount when it sees this set.
     bool failure;
 
+    // the storage server turned down the upload URL (or what was sent to it), so the chunks it
+    // acknowledged can't be built on (see MegaClient::keepuploadprogress)
+    bool urlrejected = false;
+
     TransferSlot(Transfer*);
     ~TransferSlot();
 
 private:
     void toggleport(HttpReqXfer* req);
+
+    // have a worker encrypt and MAC the upload data read into reqs[i]->out, in place, and mark the
+    // request REQ_PREPARED, so that the chunk goes to curl without being processed on this thread
+    void encryptupload(unsigned i, m_off_t pos, m_off_t npos);
+
+    // adjust mReqSizes[i] after a request of connection i succeeded or failed
+    void adaptrequestsize(unsigned i, bool failed);
     bool checkDownloadTransferFinished(DBTableTransactionCommitter& committer, MegaClient* client);
     bool checkMetaMacWithMissingLateEntries();
     bool tryRaidRecoveryFromHttpGetError(unsigned i, bool incrementErrors);
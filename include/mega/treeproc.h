@@ -43,10 +43,14 @@ public:
     void proc(MegaClient*, Node*);
 };
 
+// collects the nodes still waiting for their key, to apply them at once with apply()
 class MEGA_API TreeProcApplyKey : public TreeProc
 {
+    node_vector pending;
+
 public:
     void proc(MegaClient*, Node*);
+    void apply(MegaClient*);
 };
 
 class MEGA_API TreeProcCopy : public TreeProc
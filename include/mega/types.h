@@ -76,6 +76,7 @@ typedef unsigned char byte;
 #include <memory>
 #include <string>
 #include <chrono>
+#include <unordered_map>
 
 namespace mega {
 
@@ -117,6 +118,7 @@ struct GenericHttpReq;
 struct HttpReqCommandPutFA;
 struct LocalNode;
 class MegaClient;
+struct MegaNodeSnapshot;
 struct NewNode;
 struct Node;
 struct NodeCore;
@@ -399,7 +401,7 @@ typedef enum { SYNCDEL_NONE, SYNCDEL_DELETED, SYNCDEL_INFLIGHT, SYNCDEL_BIN,
 
 typedef vector<LocalNode*> localnode_vector;
 
-typedef map<handle, LocalNode*> handlelocalnode_map;
+typedef std::unordered_map<handle, LocalNode*> handlelocalnode_map;
 
 typedef set<LocalNode*> localnode_set;
 
@@ -477,8 +479,238 @@ typedef map<int, GenericHttpReq*> pendinghttp_map;
 // map an upload handle to the corresponding transer
 typedef map<handle, Transfer*> handletransfer_map;
 
+template <class T>
+class handle_hash_map
+{
+    // Open-addressing hash table keyed by handle, used as a replacement for map<handle, T> where lookups dominate.
+    // Slots are stored contiguously and probed linearly, so a lookup usually touches a single cache line instead
+    // of walking O(log n) tree nodes scattered around the heap.  Erasing uses backward-shift deletion, so there
+    // are no tombstones and probe sequences stay short even after many erases.
+    // Only the values (Node* in practice) live in the table, so pointers to the pointed-to objects remain stable.
+    // Differences from std::map:  iteration order is unspecified, and any insertion or erase invalidates iterators.
+    // UNDEF (all bits set) is reserved to mark empty slots and cannot be used as a key.
+
+public:
+    typedef std::pair<handle, T> value_type;
+
+private:
+    vector<value_type> mSlots;
+    size_t mSize = 0;
+
+    static size_t hashof(handle h)
+    {
+        // finalizer from MurmurHash3: handles are not guaranteed to be evenly spread over the low bits
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return size_t(h);
+    }
+
+    size_t idealslot(handle h) const
+    {
+        return hashof(h) & (mSlots.size() - 1);
+    }
+
+    size_t findslot(handle h) const
+    {
+        if (mSlots.empty() || h == UNDEF)
+        {
+            return mSlots.size();
+        }
+
+        for (size_t mask = mSlots.size() - 1, i = idealslot(h); ; i = (i + 1) & mask)
+        {
+            if (mSlots[i].first == h)
+            {
+                return i;
+            }
+
+            if (mSlots[i].first == UNDEF)
+            {
+                return mSlots.size();
+            }
+        }
+    }
+
+    void rehash(size_t capacity)
+    {
+        vector<value_type> old(capacity, value_type(UNDEF, T()));
+        old.swap(mSlots);
+
+        size_t mask = mSlots.size() - 1;
+        for (auto& v : old)
+        {
+            if (v.first != UNDEF)
+            {
+                size_t i = idealslot(v.first);
+                while (mSlots[i].first != UNDEF)
+                {
+                    i = (i + 1) & mask;
+                }
+                mSlots[i] = std::move(v);
+            }
+        }
+    }
+
+    // capacity is kept a power of two and at most 3/4 full
+    static size_t capacityfor(size_t n)
+    {
+        size_t capacity = 16;
+        while (capacity * 3 < n * 4)
+        {
+            capacity <<= 1;
+        }
+        return capacity;
+    }
+
+    void eraseslot(size_t i)
+    {
+        size_t mask = mSlots.size() - 1;
+
+        for (size_t j = (i + 1) & mask; mSlots[j].first != UNDEF; j = (j + 1) & mask)
+        {
+            // move the entry at j back into the hole at i, unless its ideal slot lies cyclically within (i, j]
+            size_t k = idealslot(mSlots[j].first);
+            if ((i <= j) ? (k <= i || k > j) : (k <= i && k > j))
+            {
+                mSlots[i] = std::move(mSlots[j]);
+                i = j;
+            }
+        }
+
+        mSlots[i] = value_type(UNDEF, T());
+        mSize--;
+    }
+
+public:
+    template <class TableT, class ValueT>
+    class iterator_t
+    {
+        template <class, class> friend class iterator_t;
+        friend class handle_hash_map;
+
+        TableT* mTable = nullptr;
+        size_t mIndex = 0;
+
+        void skipempty()
+        {
+            while (mIndex < mTable->mSlots.size() && mTable->mSlots[mIndex].first == UNDEF)
+            {
+                ++mIndex;
+            }
+        }
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef ValueT value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef ValueT* pointer;
+        typedef ValueT& reference;
+
+        iterator_t() = default;
+        iterator_t(TableT* table, size_t index) : mTable(table), mIndex(index) { skipempty(); }
+
+        // iterator -> const_iterator
+        template <class T2, class V2>
+        iterator_t(const iterator_t<T2, V2>& i) : mTable(i.mTable), mIndex(i.mIndex) { }
+
+        reference operator*() const { return mTable->mSlots[mIndex]; }
+        pointer operator->() const { return &mTable->mSlots[mIndex]; }
+
+        iterator_t& operator++() { ++mIndex; skipempty(); return *this; }
+        iterator_t operator++(int) { iterator_t i = *this; ++*this; return i; }
+
+        bool operator==(const iterator_t& i) const { return mIndex == i.mIndex; }
+        bool operator!=(const iterator_t& i) const { return mIndex != i.mIndex; }
+    };
+
+    typedef iterator_t<handle_hash_map, value_type> iterator;
+    typedef iterator_t<const handle_hash_map, const value_type> const_iterator;
+
+    iterator begin()                { return iterator(this, 0); }
+    iterator end()                  { return iterator(this, mSlots.size()); }
+    const_iterator begin() const    { return const_iterator(this, 0); }
+    const_iterator end() const      { return const_iterator(this, mSlots.size()); }
+
+    size_t size() const             { return mSize; }
+    bool empty() const              { return !mSize; }
+    size_t bucket_count() const     { return mSlots.size(); }
+
+    iterator find(handle h)                 { return iterator(this, findslot(h)); }
+    const_iterator find(handle h) const     { return const_iterator(this, findslot(h)); }
+    size_t count(handle h) const            { return findslot(h) != mSlots.size(); }
+
+    // make room for n entries in total without rehashing.  Call before bulk loads (eg. fetchnodes).
+    void reserve(size_t n)
+    {
+        size_t capacity = capacityfor(n);
+        if (capacity > mSlots.size())
+        {
+            rehash(capacity);
+        }
+    }
+
+    std::pair<iterator, bool> emplace(handle h, T value)
+    {
+        assert(h != UNDEF);
+
+        size_t i = findslot(h);
+        if (i != mSlots.size())
+        {
+            return std::make_pair(iterator(this, i), false);
+        }
+
+        if (mSlots.empty() || (mSize + 1) * 4 > mSlots.size() * 3)
+        {
+            rehash(capacityfor(mSize + 1));
+        }
+
+        size_t mask = mSlots.size() - 1;
+        for (i = idealslot(h); mSlots[i].first != UNDEF; i = (i + 1) & mask);
+
+        mSlots[i] = value_type(h, std::move(value));
+        mSize++;
+        return std::make_pair(iterator(this, i), true);
+    }
+
+    std::pair<iterator, bool> insert(value_type v)
+    {
+        return emplace(v.first, std::move(v.second));
+    }
+
+    T& operator[](handle h)
+    {
+        return emplace(h, T()).first->second;
+    }
+
+    size_t erase(handle h)
+    {
+        size_t i = findslot(h);
+        if (i == mSlots.size())
+        {
+            return 0;
+        }
+
+        eraseslot(i);
+        return 1;
+    }
+
+    void erase(iterator it)
+    {
+        assert(it.mTable == this && it.mIndex < mSlots.size());
+        eraseslot(it.mIndex);
+    }
+
+    // releases the table memory too, as the node tree is torn down completely on logout
+    void clear()
+    {
+        vector<value_type>().swap(mSlots);
+        mSize = 0;
+    }
+};
+
 // maps node handles to Node pointers
-typedef map<handle, Node*> node_map;
+typedef handle_hash_map<Node*> node_map;
 
 struct NodeCounter
 {
@@ -548,6 +780,9 @@ typedef enum { TRANSFERSTATE_NONE = 0, TRANSFERSTATE_QUEUED, TRANSFERSTATE_ACTIV
                TRANSFERSTATE_RETRYING, TRANSFERSTATE_COMPLETING, TRANSFERSTATE_COMPLETED,
                TRANSFERSTATE_CANCELLED, TRANSFERSTATE_FAILED } transferstate_t;
 
+// what a transfer is for, from the most urgent (see MegaClient::fairtransferclasses)
+typedef enum { TRANSFERCLASS_INTERACTIVE = 0, TRANSFERCLASS_SYNC, TRANSFERCLASS_BACKUP, TRANSFERCLASSES } transferclass_t;
+
 
 // FIXME: use forward_list instad (C++11)
 typedef list<HttpReqCommandPutFA*> putfa_list;
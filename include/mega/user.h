@@ -98,6 +98,10 @@ struct MEGA_API User : public Cacheable
     // actions to take after arrival of the public key
     deque<std::unique_ptr<PubKeyAction>> pkrs;
 
+    // attributes being fetched by MegaClient::getua(), and the tags of the calls made for them
+    // meanwhile, that get the same result (see CommandGetUA::procresult())
+    map<attr_t, vector<int>> uarequests;
+
 private:
     // persistent attributes (keyring, firstname...)
     userattr_map attrs;
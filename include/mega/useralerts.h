@@ -244,6 +244,9 @@ public:
     typedef deque<UserAlert::Base*> Alerts;
     Alerts alerts;
 
+    // by default, how many alerts are kept before the oldest are dropped
+    static const size_t DEFAULT_MAXALERTS = 10000;
+
     // collect new/updated alerts to notify the app with
     useralert_vector useralertnotify;
 
@@ -272,6 +275,12 @@ private:
 
     bool isUnwantedAlert(nameid type, int action);
 
+    // the latest alert of each type, user and folder that later ones may be merged into
+    typedef tuple<nameid, handle, handle> MergeKey;
+    map<MergeKey, UserAlert::Base*> mergeable;
+    static bool mergeKey(const UserAlert::Base*, MergeKey&);
+    size_t maxAlerts;
+
 public:
 
     // This is a separate class to encapsulate some MegaClient functionality
@@ -306,6 +315,15 @@ public:
 
     // re-init eg. on logout
     void clear();
+
+    // how many alerts to keep at most (0 for no limit)
+    void setMaxAlerts(size_t);
+
+    // drop the oldest alerts beyond the limit, once the app has been notified of the new ones
+    void trim();
+
+    // the alerts with an id greater than the one given, oldest first
+    void alertsAfter(unsigned int id, vector<UserAlert::Base*>&) const;
 };
 
 
@@ -22,6 +22,8 @@
 #ifndef MEGA_UTILS_H
 #define MEGA_UTILS_H 1
 
+#include <array>
+#include <atomic>
 #include <type_traits>
 #include <condition_variable>
 #include <thread>
@@ -34,6 +36,7 @@
 #undef SSIZE_MAX
 
 #include "mega/logging.h"
+#include "mega/threadconfig.h"
 
 // Needed for Windows Phone (MSVS 2013 - C++ version 9.8)
 #if defined(_WIN32) && _MSC_VER <= 1800 && __cplusplus < 201103L && !defined(_TIMESPEC_DEFINED) && ! __struct_timespec_defined
@@ -426,6 +429,10 @@ public:
         return utf8proc_toupper(c);
     }
 
+    // True if no byte has its high bit set (checked a word at a time), so the text is plain
+    // ASCII: already normalized, and with the trivial case folding.
+    static bool isAscii(const char* data, size_t size);
+
     // Platform-independent case-insensitive comparison.
     static int icasecmp(const std::string& lhs,
                         const std::string& rhs,
@@ -467,18 +474,53 @@ void tolower_string(std::string& str);
 int macOSmajorVersion();
 #endif
 
-// file chunk macs
-class chunkmac_map : public map<m_off_t, ChunkMAC>
+// file chunk macs, by position.  Kept sorted in one vector rather than a std::map: there are
+// tens of thousands in large files, they are mostly added in order (at the end), and the vector
+// has the layout of the serialized records
+class chunkmac_map
 {
 public:
+    typedef std::pair<m_off_t, ChunkMAC> value_type;
+    typedef std::vector<value_type>::iterator iterator;
+    typedef std::vector<value_type>::const_iterator const_iterator;
+
+    // inserting an entry invalidates the iterators and references to the others
+    ChunkMAC& operator[](m_off_t pos);
+    iterator find(m_off_t pos);
+    const_iterator find(m_off_t pos) const;
+
+    iterator begin() { return mMacs.begin(); }
+    iterator end() { return mMacs.end(); }
+    const_iterator begin() const { return mMacs.begin(); }
+    const_iterator end() const { return mMacs.end(); }
+    size_t size() const { return mMacs.size(); }
+    bool empty() const { return mMacs.empty(); }
+    void clear() { mMacs.clear(); }
+    void swap(chunkmac_map& other) { mMacs.swap(other.mMacs); }
+    bool operator==(const chunkmac_map& other) const;
+
     int64_t macsmac(SymmCipher *cipher);
-    int64_t macsmac_gaps(SymmCipher *cipher, size_t g1, size_t g2, size_t g3, size_t g4);
+
+    // the states of the fold of macsmac() before each entry from `from` on, and after the last
+    // one: macsmac_gaps() then folds only the entries from the first gap on
+    struct FoldStates
+    {
+        size_t from = 0;
+        std::vector<std::array<byte, SymmCipher::BLOCKSIZE>> states;
+    };
+    void macsmac_states(SymmCipher *cipher, size_t from, FoldStates& fs) const;
+
+    // macsmac() leaving out the entries [g1, g2) and [g3, g4), where g1 is at least fs.from
+    int64_t macsmac_gaps(SymmCipher *cipher, const FoldStates& fs, size_t g1, size_t g2, size_t g3, size_t g4) const;
     void serialize(string& d) const;
     bool unserialize(const char*& ptr, const char* end);
     void calcprogress(m_off_t size, m_off_t& chunkpos, m_off_t& completedprogress, m_off_t* lastblockprogress = nullptr);
     m_off_t nextUnprocessedPosFrom(m_off_t pos);
     m_off_t expandUnprocessedPiece(m_off_t pos, m_off_t npos, m_off_t fileSize, m_off_t maxReqSize);
     void finishedUploadChunks(chunkmac_map& macs);
+
+private:
+    std::vector<value_type> mMacs;
 };
 
 struct CacheableWriter
@@ -501,6 +543,11 @@ struct CacheableWriter
     void serializedouble(double field);
     void serializechunkmacs(const chunkmac_map& m);
 
+    // 7 bits per byte, low bits first (small values in few bytes); signed values zigzag encoded
+    void serializevarint(uint64_t field);
+    void serializesignedvarint(int64_t field);
+    void serializevarstring(const string& field);  // varint length, then the bytes
+
     // Each class that might get extended should store expansion flags at the end
     // When adding new fields to an existing class, set the next expansion flag true to indicate they are present.
     // If you turn on the last flag, then you must also add another set of expansion flags (all false) after the new fields, for further expansion later.
@@ -527,6 +574,9 @@ struct CacheableReader
     bool unserializefsfp(fsfp_t& s);
     bool unserializebool(bool& s);
     bool unserializechunkmacs(chunkmac_map& m);
+    bool unserializevarint(uint64_t& s);
+    bool unserializesignedvarint(int64_t& s);
+    bool unserializevarstring(string& s);
 
     bool unserializeexpansionflags(unsigned char field[8], unsigned usedFlagCount);
 
@@ -550,99 +600,243 @@ std::pair<bool, int64_t> generateMetaMac(SymmCipher &cipher, FileAccess &ifAcces
 
 std::pair<bool, int64_t> generateMetaMac(SymmCipher &cipher, InputStreamAccess &isAccess, const int64_t iv);
 
-// Helper class for MegaClient.  Suitable for expansion/templatizing for other use caes.
-// Maintains a small thread pool for executing independent operations such as encrypt/decrypt a block of data
-// The number of threads can be 0 (eg. for helper MegaApi that deals with public folder links) in which case something queued is
-// immediately executed synchronously on the caller's thread
-struct MegaClientAsyncQueue
+struct MegaClientAsyncQueue;
+
+// The worker threads of MegaClientAsyncQueue.  Each queue has its own unless it's given one to
+// share with other queues (eg. those of the many MegaApi instances of a server for folder
+// links), so that the threads don't grow with the number of clients.  Jobs run in the order
+// they are pushed, whichever queue they come from
+class MEGA_API MegaWorkerPool
 {
-    void push(std::function<void(SymmCipher&)> f, bool discardable);
-    void clearDiscardable();
+public:
+    // the threads are only started with the first job (instances that never need them, as
+    // those of short-lived helpers, don't pay for them).  With an executor there are none: each
+    // job hands it a call that runs the next one, and threadCount is how many parallelFor()
+    // expects to run at once.  The executor must make every call it's given, before the pool goes
+    explicit MegaWorkerPool(unsigned threadCount, ThreadConfig::Executor executor = ThreadConfig::executor());
+    ~MegaWorkerPool();
 
-    MegaClientAsyncQueue(Waiter& w, unsigned threadCount);
-    ~MegaClientAsyncQueue();
+    size_t size() const { return mThreadCount; }
 
 private:
-    Waiter& mWaiter;
-    std::mutex mMutex;
-    std::condition_variable mConditionVariable;
+    friend struct MegaClientAsyncQueue;
+
+    // as many threads as they could be (which size() reports from then on), if not done yet
+    void start();
+    std::atomic<size_t> mThreadCount;
+    std::atomic<bool> mStarted{false};
 
     struct Entry
     {
-        bool discardable = false;
+        MegaClientAsyncQueue* queue;
+        bool discardable;
         std::function<void(SymmCipher&)> f;
-        Entry(bool disc, std::function<void(SymmCipher&)>&& func)
-             : discardable(disc), f(func)
-        {}
     };
 
+    std::mutex mMutex;
+    std::condition_variable mConditionVariable;
+
+    // signalled when a job ends, for the queues waiting for theirs
+    std::condition_variable mJobDone;
+
     std::deque<Entry> mQueue;
+    bool mExit = false;
     std::vector<std::thread> mThreads;
-    SymmCipher mZeroThreadsCipher;
+
+    ThreadConfig::Executor mExecutor;
+
+    // calls handed to the executor and not made yet
+    size_t mSubmitted = 0;
 
     void asyncThreadLoop();
+
+    // what the executor calls
+    void runNext();
+
+    void run(Entry& entry, SymmCipher& cipher);
 };
 
-template<class T>
-struct ThreadSafeDeque
+// Helper class for MegaClient.  Suitable for expansion/templatizing for other use caes.
+// Maintains a small thread pool for executing independent operations such as encrypt/decrypt a block of data
+// The number of threads can be 0 (eg. for helper MegaApi that deals with public folder links) in which case something queued is
+// immediately executed synchronously on the caller's thread.  The pool can be shared with other queues
+// (see MegaWorkerPool): each queue's jobs wake its own waiter, and a queue waits for its jobs when destroyed
+struct MegaClientAsyncQueue
 {
-    // Just like a deque, but thread safe so that a separate thread can receive filesystem notifications as soon as they are available.
-    // When we try to do that on the same thread, the processing of queued notifications is too slow so more notifications bulid up than
-    // have been processed, so each time we get the outstanding ones from the buffer we gave to the OS, we need to give it an even
-    // larger buffer to write into, otherwise it runs out of space before this thread is idle and can get the next batch from the buffer.
-protected:
-    std::deque<T> mNotifications;
-    std::mutex m;
+    void push(std::function<void(SymmCipher&)> f, bool discardable);
+    void clearDiscardable();
+
+    // jobs of this queue queued or running
+    size_t pending();
+
+    // run f(0) ... f(count - 1) on the worker threads and the calling thread, returning once all are done.
+    // The calling thread takes items too, so this completes even while the workers are busy with other
+    // jobs.  Each item should be worth a thread handoff (eg. a batch of records rather than a single one)
+    void parallelFor(size_t count, const std::function<void(size_t, SymmCipher&)>& f);
+
+    // the same, with the calling thread running meanwhile() before it takes items, so that it can
+    // prepare the next round (eg. read more records) while the workers are on this one
+    void parallelFor(size_t count, const std::function<void(size_t, SymmCipher&)>& f, const std::function<void()>& meanwhile);
+
+    // with threads of its own, or those of pool when given
+    MegaClientAsyncQueue(Waiter& w, unsigned threadCount, std::shared_ptr<MegaWorkerPool> pool = nullptr);
+    ~MegaClientAsyncQueue();
+
+private:
+    friend class MegaWorkerPool;
+
+    Waiter& mWaiter;
+    std::shared_ptr<MegaWorkerPool> mPool;
+
+    // jobs of this queue in the pool, queued or running (guarded by the pool's mutex)
+    size_t mPending = 0;
+
+    SymmCipher mZeroThreadsCipher;
+};
 
+// Recursive mutex that can also be locked in shared mode (C++11 has no shared_mutex).
+// Exclusive locking works like std::recursive_timed_mutex.  Shared locks can be held by several threads
+// at once and can be taken recursively, also by the thread that owns the exclusive lock.  Threads waiting
+// for the exclusive lock keep new readers out, so a stream of readers cannot starve a writer.
+// A thread holding only a shared lock must not ask for the exclusive one: that upgrade is not supported.
+class MEGA_API RecursiveSharedMutex
+{
 public:
+    void lock();
+    bool try_lock();
+    void unlock();
 
-    bool peekFront(T& t)
+    template<class Rep, class Period>
+    bool try_lock_for(const std::chrono::duration<Rep, Period>& timeout)
     {
-        std::lock_guard<std::mutex> g(m);
-        if (!mNotifications.empty())
-        {
-            t = mNotifications.front();
-            return true;
-        }
-        return false;
+        return lockExclusive(&timeout);
     }
 
-    bool popFront(T& t)
+    void lock_shared();
+    void unlock_shared();
+
+    // while set, lock_shared() takes the exclusive lock: for when what readers do may write after all
+    void setexclusive(bool exclusive) { mExclusive = exclusive; }
+
+    // RAII for the shared lock, the counterpart of std::unique_lock for the exclusive one
+    class SharedGuard
     {
-        std::lock_guard<std::mutex> g(m);
-        if (!mNotifications.empty())
+    public:
+        explicit SharedGuard(RecursiveSharedMutex& m) : mMutex(m) { mMutex.lock_shared(); }
+        ~SharedGuard() { mMutex.unlock_shared(); }
+        MEGA_DISABLE_COPY_MOVE(SharedGuard)
+
+    private:
+        RecursiveSharedMutex& mMutex;
+    };
+
+private:
+    template<class Duration>
+    bool lockExclusive(const Duration* timeout)
+    {
+        std::unique_lock<std::mutex> g(mMutex);
+        auto me = std::this_thread::get_id();
+        if (mOwnerCount && mOwner == me)
         {
-            t = std::move(mNotifications.front());
-            mNotifications.pop_front();
+            ++mOwnerCount;
             return true;
         }
-        return false;
+        assert(mReaders.find(me) == mReaders.end());
+
+        auto available = [this]() { return !mOwnerCount && mReaders.empty(); };
+
+        ++mWritersWaiting;
+        bool locked = true;
+        if (!timeout)
+        {
+            mCondition.wait(g, available);
+        }
+        else
+        {
+            locked = mCondition.wait_for(g, *timeout, available);
+        }
+        --mWritersWaiting;
+
+        if (!locked)
+        {
+            // readers may have been waiting just because of us
+            mCondition.notify_all();
+            return false;
+        }
+
+        mOwner = me;
+        mOwnerCount = 1;
+        return true;
     }
 
-    void unpopFront(const T& t)
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::thread::id mOwner;
+    unsigned mOwnerCount = 0;
+    unsigned mWritersWaiting = 0;
+    std::map<std::thread::id, unsigned> mReaders;
+    std::atomic<bool> mExclusive{false};
+};
+
+// A queue that any number of threads push to, without locks, and only one thread pops from.
+// Filesystem notifications are received on separate threads as soon as they are available: when
+// that is done on the same thread, the processing of queued notifications is too slow so more
+// notifications build up than have been processed, and the buffers given to the OS run out of space.
+// Pushing never waits for the thread that pops, so the receiving threads never block either.
+template<class T>
+class MpscQueue
+{
+    struct Item
     {
-        std::lock_guard<std::mutex> g(m);
-        mNotifications.push_front(t);
-    }
+        std::atomic<Item*> next{nullptr};
+        T value;
+    };
 
-    void pushBack(T&& t)
+    // the last item pushed, and the one before the first to pop (already popped)
+    std::atomic<Item*> mHead;
+    Item* mTail;
+
+public:
+    MpscQueue()
+        : mHead(new Item)
+        , mTail(mHead.load())
     {
-        std::lock_guard<std::mutex> g(m);
-        mNotifications.push_back(t);
     }
 
-    bool empty()
+    ~MpscQueue()
     {
-        std::lock_guard<std::mutex> g(m);
-        return mNotifications.empty();
+        T t;
+        while (pop(t)) { }
+        delete mTail;
     }
 
-    size_t size()
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    // any thread
+    void push(T&& t)
     {
-        std::lock_guard<std::mutex> g(m);
-        return mNotifications.size();
+        Item* item = new Item;
+        item->value = std::move(t);
+
+        Item* prev = mHead.exchange(item, std::memory_order_acq_rel);
+        prev->next.store(item, std::memory_order_release);
     }
 
+    // the popping thread only.  An item being pushed meanwhile may not be seen until the next time
+    bool pop(T& t)
+    {
+        Item* next = mTail->next.load(std::memory_order_acquire);
+        if (!next)
+        {
+            return false;
+        }
+
+        t = std::move(next->value);
+        delete mTail;
+        mTail = next;
+        return true;
+    }
 };
 
 template<typename CharT>
@@ -38,9 +38,17 @@ struct MEGA_API WinDirAccess : public DirAccess
     WIN32_FIND_DATAW currentItemAttributes;
     friend class WinFileAccess;
 
+    // the folder opened by path (not globbing), and its handle for dnextbulk()
+    std::wstring folder;
+    HANDLE hDirectory;
+    std::vector<DWORDLONG> bulkbuffer;
+    DWORD bulkoffset;
+    bool bulkpending;
+
 public:
     bool dopen(LocalPath*, FileAccess*, bool) override;
     bool dnext(LocalPath&, LocalPath&, bool, nodetype_t*) override;
+    bool dnextbulk(LocalPath&, vector<Entry>&, size_t, bool, FileSystemAccess&) override;
 
     WinDirAccess();
     virtual ~WinDirAccess();
@@ -81,6 +89,9 @@ public:
     bool getextension(const LocalPath&, string&) const override;
     bool expanselocalpath(LocalPath& path, LocalPath& absolutepath) override;
 
+    bool changecursor(const LocalPath&, string&) override;
+    bool changessince(const LocalPath&, const string&, vector<LocalPath>&) override;
+
     void addevents(Waiter*, int) override;
 
     static bool istransient(DWORD);
@@ -168,6 +179,8 @@ public:
     bool fwrite(const byte *, unsigned, m_off_t);
 
     bool ftruncate() override;
+    bool fpreallocate(m_off_t size) override;
+    void setreadonce() override;
 
     bool sysread(byte *, unsigned, m_off_t) override;
     bool sysstat(m_time_t*, m_off_t*) override;
@@ -186,6 +199,8 @@ public:
     ~WinFileAccess();
 
 protected:
+    bool mReadOnce = false;
+
 #ifndef WINDOWS_PHONE
     AsyncIOContext* newasynccontext() override;
     static VOID CALLBACK asyncopfinished(
@@ -53,7 +53,13 @@ protected:
     string proxyPassword;
 
 public:
-    static const unsigned HTTP_POST_CHUNK_SIZE = 16384;
+    static const unsigned HTTP_POST_CHUNK_SIZE = 131072;
+
+    // the most read at once into the buffer of a transfer
+    static const unsigned HTTP_READ_CHUNK_SIZE = 262144;
+
+    // negotiate HTTP/2 on HTTPS connections (where WinHTTP supports it)
+    bool http2 = true;
 
     static VOID CALLBACK asynccallback(HINTERNET, DWORD_PTR, DWORD,
                                        LPVOID lpvStatusInformation,
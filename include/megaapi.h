@@ -379,6 +379,46 @@ public:
     virtual ~MegaLogger(){}
 };
 
+/**
+ * @brief A job of the SDK to run on a thread of the app
+ *
+ * See MegaExecutor.
+ */
+class MegaExecutorTask
+{
+public:
+    /**
+     * @brief Run the job
+     *
+     * Call it once, then delete the object.
+     */
+    virtual void run() = 0;
+    virtual ~MegaExecutorTask();
+};
+
+/**
+ * @brief Interface to run the jobs of the worker threads of the SDK on threads of the app
+ *
+ * You can implement this class and pass an object of your subclass to MegaApi::setWorkerExecutor
+ * so that the encryption of uploads, the fingerprints and other jobs of the worker threads run
+ * on a thread pool of the app instead of threads started by the SDK.
+ */
+class MegaExecutor
+{
+public:
+    /**
+     * @brief Run a job on a thread of the app
+     *
+     * This function is called from the threads of the SDK, and should return as soon as the job
+     * is queued. Every job must eventually run, from any thread of the app but not from within
+     * this call: a MegaApi waits for its jobs when deleted. See MegaExecutorTask::run.
+     *
+     * @param task Job to run. You take its ownership.
+     */
+    virtual void execute(MegaExecutorTask* task) = 0;
+    virtual ~MegaExecutor();
+};
+
 /**
  * @brief Represents a node (file/folder) in the MEGA account
  *
@@ -6285,6 +6325,24 @@ class MegaTransferListener
          */
         virtual void onTransferUpdate(MegaApi *api, MegaTransfer *transfer);
 
+        /**
+         * @brief This function is called to inform about the progress of several transfers at once
+         *
+         * It is only called when MegaApi::setTransferUpdateBatching is enabled, and then instead of
+         * onTransferUpdate for the progress of the transfers (changes of their state are still
+         * notified with onTransferUpdate). Each transfer appears once, with its latest progress.
+         *
+         * The listener of a single transfer (the one passed when it is started) keeps receiving
+         * onTransferUpdate instead.
+         *
+         * The SDK retains the ownership of the list and the transfers in it.
+         * Don't use them after this functions returns.
+         *
+         * @param api MegaApi object that started the transfers
+         * @param transfers Information about the transfers
+         */
+        virtual void onTransfersUpdate(MegaApi *api, MegaTransferList *transfers);
+
         /**
          * @brief This function is called when there is a temporary error processing a transfer
          *
@@ -6477,6 +6535,26 @@ class MegaGlobalListener
          */
         virtual void onNodesUpdate(MegaApi* api, MegaNodeList *nodes);
 
+        /**
+         * @brief This function is called instead of onNodesUpdate when MegaApi::setLightweightNodeUpdates is enabled
+         *
+         * Only the handles of the new or updated nodes are delivered, with what changed in each one (a bit
+         * mask of MegaNode::CHANGE_TYPE_* values, as MegaNode::getChanges returns). No copy of the
+         * nodes is made, which saves a lot of memory and time when many nodes change at once.
+         * Use MegaApi::getNodesByHandles to get the nodes that are needed. Removed nodes
+         * (MegaNode::CHANGE_TYPE_REMOVED) can't be retrieved any more.
+         *
+         * When the full account is reloaded or a large number of server notifications arrives at once,
+         * onNodesUpdate is still called with NULL.
+         *
+         * The SDK retains the ownership of both lists, which are valid until this function returns.
+         *
+         * @param api MegaApi object connected to the account
+         * @param handles Handles of the new or updated nodes
+         * @param changes What changed in each node, at the same position as its handle
+         */
+        virtual void onNodesChanged(MegaApi* api, MegaHandleList *handles, MegaIntegerList *changes);
+
         /**
          * @brief This function is called when the account has been updated (confirmed/upgraded/downgraded)
          *
@@ -6804,6 +6882,24 @@ class MegaListener
          */
         virtual void onTransferUpdate(MegaApi *api, MegaTransfer *transfer);
 
+        /**
+         * @brief This function is called to inform about the progress of several transfers at once
+         *
+         * It is only called when MegaApi::setTransferUpdateBatching is enabled, and then instead of
+         * onTransferUpdate for the progress of the transfers (changes of their state are still
+         * notified with onTransferUpdate). Each transfer appears once, with its latest progress.
+         *
+         * The listener of a single transfer (the one passed when it is started) keeps receiving
+         * onTransferUpdate instead.
+         *
+         * The SDK retains the ownership of the list and the transfers in it.
+         * Don't use them after this functions returns.
+         *
+         * @param api MegaApi object that started the transfers
+         * @param transfers Information about the transfers
+         */
+        virtual void onTransfersUpdate(MegaApi *api, MegaTransferList *transfers);
+
         /**
          * @brief This function is called when there is a temporary error processing a transfer
          *
@@ -6865,6 +6961,26 @@ class MegaListener
          */
         virtual void onNodesUpdate(MegaApi* api, MegaNodeList *nodes);
 
+        /**
+         * @brief This function is called instead of onNodesUpdate when MegaApi::setLightweightNodeUpdates is enabled
+         *
+         * Only the handles of the new or updated nodes are delivered, with what changed in each one (a bit
+         * mask of MegaNode::CHANGE_TYPE_* values, as MegaNode::getChanges returns). No copy of the
+         * nodes is made, which saves a lot of memory and time when many nodes change at once.
+         * Use MegaApi::getNodesByHandles to get the nodes that are needed. Removed nodes
+         * (MegaNode::CHANGE_TYPE_REMOVED) can't be retrieved any more.
+         *
+         * When the full account is reloaded or a large number of server notifications arrives at once,
+         * onNodesUpdate is still called with NULL.
+         *
+         * The SDK retains the ownership of both lists, which are valid until this function returns.
+         *
+         * @param api MegaApi object connected to the account
+         * @param handles Handles of the new or updated nodes
+         * @param changes What changed in each node, at the same position as its handle
+         */
+        virtual void onNodesChanged(MegaApi* api, MegaHandleList *handles, MegaIntegerList *changes);
+
         /**
          * @brief This function is called when the account has been updated (confirmed/upgraded/downgraded)
          *
@@ -7553,11 +7669,45 @@ class MegaApi
             LOG_LEVEL_MAX
         };
 
+        enum {
+            LOG_MODULE_TRANSFERS = 1,
+            LOG_MODULE_SYNC,
+            LOG_MODULE_SC,          // the action packets received from the API
+            LOG_MODULE_NET
+        };
+
+        enum {
+            THREAD_ROLE_SDK = 0,        // the thread of each MegaApi, and the one of its transfer callbacks
+            THREAD_ROLE_WORKER,         // encryption, fingerprints, folder listings
+            THREAD_ROLE_GFX,            // thumbnails and previews
+            THREAD_ROLE_SERVER,         // the HTTP and FTP servers
+            THREAD_ROLE_SEARCH,         // searches and other walks of large folder trees
+            THREAD_ROLE_BACKGROUND      // the database writer, the performance logger and the like
+        };
+
+        enum {
+            THREAD_PRIO_DEFAULT = 0,
+            THREAD_PRIO_HIGH,
+            THREAD_PRIO_LOW,
+            THREAD_PRIO_IDLE
+        };
+
         enum {
             ATTR_TYPE_THUMBNAIL = 0,
             ATTR_TYPE_PREVIEW = 1
         };
 
+        enum {
+            DB_TUNING_DEFAULT = 0,
+            DB_TUNING_LOW_MEMORY = 1,
+            DB_TUNING_THROUGHPUT = 2
+        };
+
+        enum {
+            DB_BACKEND_SQLITE = 0,
+            DB_BACKEND_MEMORY = 1
+        };
+
         enum {
             USER_ATTR_UNKNOWN = -1,
             USER_ATTR_AVATAR = 0,               // public - char array
@@ -7621,6 +7771,11 @@ class MegaApi
             TRANSFER_METHOD_AUTO_ALTERNATIVE = 4
         };
 
+        enum {
+            TRANSFER_CONCURRENCY_FIXED = 0,
+            TRANSFER_CONCURRENCY_ADAPTIVE = 1
+        };
+
         enum {
             PUSH_NOTIFICATION_ANDROID = 1,
             PUSH_NOTIFICATION_IOS_VOIP = 2,
@@ -8453,6 +8608,25 @@ class MegaApi
          * @param listener MegaRequestListener to track this request
          */
         void loginToFolder(const char* megaFolderLink, const char *authKey, MegaRequestListener *listener = NULL);
+
+        /**
+         * @brief Only browse the folder links this instance logs into
+         *
+         * For apps that open many folder links at once, each in its own MegaApi (a gateway
+         * or a link preview service, for example). The nodes of the folder are fetched with
+         * no local cache, and MegaApi::fetchNodes finishes as soon as they arrive, without
+         * the connection that keeps them up to date afterwards. So each instance costs the
+         * folder tree in memory and a single request to the server.
+         *
+         * The nodes don't follow later changes to the folder: log in again to get them
+         * anew. Pass nullptr as basePath to the constructor too, so that nothing is written
+         * to disk, and consider MegaApi::setSharedWorkerThreads.
+         *
+         * Call this function before MegaApi::fetchNodes. It's disabled by default.
+         *
+         * @param enable True to only browse folder links, false to keep them current
+         */
+        void setFolderLinkBrowseOnly(bool enable);
         /**
          * @brief Log in to a MEGA account using precomputed keys
          *
@@ -8744,6 +8918,131 @@ class MegaApi
          */
         char *getSequenceNumber();
 
+        /**
+         * @brief Returns metrics of the SDK's main operations, as a JSON object
+         *
+         * The SDK keeps them in every build, at little cost, for apps to monitor them.
+         * The durations (in microseconds) of these are given as
+         * {"count", "sum", "max", "p50", "p90", "p99", "p999"}, since the SDK started:
+         * - "exec": each pass of the SDK's thread
+         * - "dispatchtransfers": each round starting the transfers queued
+         * - "sc": each batch of action packets processed
+         * - "cs": each response to a batch of requests processed
+         * - "dbcommit": each commit of the local cache
+         *
+         * The percentiles are within 12.5% of the actual durations.
+         * These give how much work is pending at the moment:
+         * - "workerjobs": jobs of the worker threads queued or running (encryption, media extraction...)
+         * - "transferslots": transfers in progress
+         * - "queuedfa": file attributes waiting to be uploaded
+         * - "cmdspending": whether requests are waiting to be sent
+         *
+         * The batches of requests sent again are counted in "cseagain" (the API was busy),
+         * "csserverbusy" (HTTP 500) and "csfailures" (anything else).
+         * And "commands" has the requests by type (their "a"): {"count", "retries", "errors",
+         * "bytes" of their results, "latency" from when they were last sent until the response
+         * arrived, "parse" the time processing their results}. The latency of a request is that
+         * of its whole batch, to tell it from the time the SDK takes on it.
+         *
+         * "startup" is the report of the last load of the account (also logged, and sent as an
+         * event, once the account is up to date and its transfers resumed): the times (ms, -1
+         * if not reached) to "firstbyte" and "lastbyte" of the nodes read (from the local cache
+         * or the API), to "cached", "result", "syncsresumed" and "current", and in "phases" the
+         * time (ms) spent reading, decrypting and creating the nodes of the local cache ("dbread",
+         * "dbparse", "dblink"), parsing those of the API ("apiparse"), in "mergeshares",
+         * "applykeys", "syncsresume" (loading their state caches), "transfersload" (the
+         * transfer cache) and "transfersresume".
+         *
+         * You take the ownership of the returned value. Use delete [] to free it.
+         *
+         * @return The metrics as a JSON object
+         */
+        char *getMetrics();
+
+        /**
+         * @brief Keep the last events of the transfers, to see where they stall
+         *
+         * The SDK records the steps of every transfer in progress: getting its URLs, each chunk
+         * sent or received (with the time to connect and to the first byte), the waits for the
+         * worker threads and the encryption or decryption there, the disk reads and writes, the
+         * swaps of slow CloudRAID parts, the failed chunks, timeouts and retries.
+         *
+         * While this is 0 (the default) nothing is recorded. Setting a lower value drops the
+         * oldest events kept.
+         *
+         * @param events Number of events to keep, each about 100 bytes
+         * @see MegaApi::getTransferTrace
+         */
+        void setTransferTraceSize(int events);
+
+        /**
+         * @brief Returns the events kept since MegaApi::setTransferTraceSize
+         *
+         * They are in the Chrome trace event format, which chrome://tracing and
+         * https://ui.perfetto.dev show as a timeline: a process for each transfer (its tag)
+         * and a thread for each of its connections, 0 being the transfer as a whole.
+         *
+         * You take the ownership of the returned value. Use delete [] to free it.
+         *
+         * @return The events as JSON
+         */
+        char *getTransferTrace();
+
+        /**
+         * @brief Returns the approximate memory taken by the parts of the SDK, as a JSON object
+         *
+         * The sizes are estimates from the number and contents of the objects, in bytes, to tell
+         * which part a growth of the memory of the app comes from:
+         * - "nodes": {"count", "bytes"} of the nodes loaded
+         * - "localnodes": {"count", "bytes"} of the files and folders of the syncs running
+         * - "transfers": {"count", "bytes", "slots"} of the transfers queued, and those in progress
+         * - "transferbuffers": {"inuse", "idle"} bytes of the buffers of the downloads (of the
+         * whole process), CloudRAID parts included, and those kept for reuse
+         * - "gfx": {"jobs", "bitmapbytes"}: files waiting for their thumbnails and previews, and
+         * the memory of the images being processed
+         * - "useralerts": {"count"}
+         * - "db": the memory of the local cache engine (for SQLite, that of all its databases in
+         * the process)
+         * - "streamingbuffers": the buffers of the HTTP and FTP servers (of the whole process)
+         *
+         * Going through the nodes takes a few milliseconds per 100,000 of them.
+         * The same object is logged periodically (see MegaApi::setMemoryUsageLogInterval).
+         *
+         * You take the ownership of the returned value. Use delete [] to free it.
+         *
+         * @return The memory usage as a JSON object
+         */
+        char *getMemoryUsage();
+
+        /**
+         * @brief Set how often the SDK logs its memory usage
+         *
+         * The object MegaApi::getMemoryUsage returns is logged at the info level every
+         * this many seconds, 600 by default.
+         *
+         * @param seconds Interval between logs, 0 to stop them
+         */
+        void setMemoryUsageLogInterval(int seconds);
+
+        /**
+         * @brief Log the passes of the SDK's thread that take too long
+         *
+         * While the SDK's thread is busy (processing the responses of the API, starting
+         * transfers, calling the listeners...) it doesn't progress its transfers and requests,
+         * which the app sees as frozen. With this, a thread of the SDK watches it, and a pass
+         * that goes on for longer than thresholdMs is logged as a warning with the parts of the
+         * SDK it was in (such as "exec > cs > f" for the response of a fetchnodes). At most one
+         * stall is logged per minute; the others are counted in the next log.
+         *
+         * On Linux (glibc), macOS and iOS, each log can also have a sample of the stack of the
+         * SDK's thread at that moment. It's taken by interrupting that thread with SIGURG,
+         * for which the SDK installs a handler the first time.
+         *
+         * @param thresholdMs Duration of the passes to log, 0 (the default) to stop watching
+         * @param stackSamples Whether to add stack samples to the logs, where supported
+         */
+        void setStallDetection(int thresholdMs, bool stackSamples = false);
+
         /**
          * @brief Get an authentication token that can be used to identify the user account
          *
@@ -9695,6 +9994,26 @@ class MegaApi
          */
         static void setLogLevel(int logLevel);
 
+        /**
+         * @brief Set a more detailed log level for one part of the SDK
+         *
+         * The messages of that part are logged up to this level, and those of the rest up to the
+         * one of MegaApi::setLogLevel. A verbose log of the transfers, for example, doesn't take
+         * the time of a verbose log of everything.
+         *
+         * @param module Part of the SDK
+         *
+         * These are the valid values for this parameter:
+         * - MegaApi::LOG_MODULE_TRANSFERS = 1
+         * - MegaApi::LOG_MODULE_SYNC = 2
+         * - MegaApi::LOG_MODULE_SC = 3
+         * - MegaApi::LOG_MODULE_NET = 4
+         *
+         * @param logLevel Log level for the module, or MegaApi::LOG_LEVEL_FATAL to follow the
+         * one of MegaApi::setLogLevel again
+         */
+        static void setModuleLogLevel(int module, int logLevel);
+
         /**
          * @brief Set the limit of size to requests payload
          *
@@ -9703,6 +10022,90 @@ class MegaApi
          */
         static void setMaxPayloadLogSize(long long maxSize);
 
+        /**
+         * @brief Share the worker threads among the MegaApi instances created from now on
+         *
+         * By default each MegaApi has its own worker threads (see the workerThreadCount parameter
+         * of the constructors). With count > 0, the MegaApi instances created after this call share
+         * a single set of count worker threads instead, so that a process with many instances (eg.
+         * one for each folder link) doesn't have threads for every one of them. The instances that
+         * exist already keep theirs. With 0, instances get their own threads again.
+         *
+         * @param count Number of worker threads to share, or 0 not to share them
+         */
+        static void setSharedWorkerThreads(unsigned count);
+
+        /**
+         * @brief Set how many threads create the thumbnails and previews of the MegaApi instances created from now on
+         *
+         * By default a single thread creates the thumbnails and previews of the uploaded images
+         * and videos, one file after the other, which holds back the uploads of many photos (a
+         * camera roll, for example) on a machine with idle cores. With count > 1 the files are
+         * processed by that many threads at once. The previews of the uploads of syncs, and those
+         * missing from existing nodes, are made only when no others are waiting.
+         *
+         * Only the processor built into the SDK uses more than one thread: a MegaGfxProcessor
+         * passed to the constructor keeps being called from a single thread. The instances that
+         * exist already keep their threads.
+         *
+         * @param count Number of threads, 1 by default
+         */
+        static void setGfxThreads(unsigned count);
+
+        /**
+         * @brief Set the number, CPUs and priority of a kind of threads of the SDK
+         *
+         * For processes with many MegaApi instances on large machines (a server for folder links,
+         * for example), whose threads would otherwise move between all the cores. The settings
+         * apply to the threads started from now on, so call this function before creating any
+         * MegaApi. Threads of the libraries the SDK uses (eg. the DNS resolution of libcurl) keep
+         * their defaults.
+         *
+         * @param role Kind of threads
+         *
+         * These are the valid values for this parameter:
+         * - MegaApi::THREAD_ROLE_SDK = 0
+         * - MegaApi::THREAD_ROLE_WORKER = 1
+         * - MegaApi::THREAD_ROLE_GFX = 2
+         * - MegaApi::THREAD_ROLE_SERVER = 3
+         * - MegaApi::THREAD_ROLE_SEARCH = 4
+         * - MegaApi::THREAD_ROLE_BACKGROUND = 5
+         *
+         * @param count Number of threads, for the kinds that have several:
+         * - MegaApi::THREAD_ROLE_WORKER: as MegaApi::setSharedWorkerThreads
+         * - MegaApi::THREAD_ROLE_GFX: as MegaApi::setGfxThreads
+         * - MegaApi::THREAD_ROLE_SEARCH: at most this many threads walk a large folder tree, or one
+         * for each core (up to 16) with 0
+         *
+         * The others ignore it.
+         *
+         * @param cpus CPUs the threads may run on, as a list like "0-3,8,10-11", or NULL or an
+         * empty string for any. On Windows only the first 64 CPUs can be set; macOS doesn't support it.
+         *
+         * @param priority Priority of the threads, relative to the thread that starts them:
+         * - MegaApi::THREAD_PRIO_DEFAULT = 0 - The same
+         * - MegaApi::THREAD_PRIO_HIGH = 1 - Higher, if the process is allowed to raise it
+         * - MegaApi::THREAD_PRIO_LOW = 2 - Lower
+         * - MegaApi::THREAD_PRIO_IDLE = 3 - Only when nothing else wants the CPU
+         *
+         * @return False if a parameter isn't valid (and nothing changes)
+         */
+        static bool setThreadSettings(int role, unsigned count, const char* cpus, int priority);
+
+        /**
+         * @brief Run the jobs of the worker threads on threads of the app
+         *
+         * The MegaApi instances created from now on don't start worker threads: their jobs are
+         * handed to the executor, up to as many at once as the worker threads they would have
+         * had (the workerThreadCount parameter of the constructors, or MegaApi::setSharedWorkerThreads).
+         * The threads of the app keep their own affinity and priority.
+         *
+         * @param executor Executor of the jobs, or NULL for the instances to start their own
+         * threads again. The SDK doesn't take its ownership: keep it until the instances created
+         * with it are deleted.
+         */
+        static void setWorkerExecutor(MegaExecutor* executor);
+
         /**
          * @brief Enable log to console
          *
@@ -9789,8 +10192,12 @@ class MegaApi
          * @param logFileName Log file name (without path).¡
          * @param logToStdOut if true, logs are also output to standard output
          * @param archivedFilesAgeSeconds Number of seconds before archived files are removed. Defaults to one month.
+         * @param binary if true, the log file (logFileName with ".bin" appended) keeps binary records,
+         * which the threads that log write to buffers of their own without taking locks or formatting
+         * the time and level. Tools such as tests/tool/logdecode.cpp turn them back into text. If a
+         * thread logs faster than they are written, its messages are dropped and the log shows how many.
          */
-        static void setUseRotativePerformanceLogger(const char * logPath, const char * logFileName, bool logToStdOut = true, long int archivedFilesAgeSeconds = 30 * 86400);
+        static void setUseRotativePerformanceLogger(const char * logPath, const char * logFileName, bool logToStdOut = true, long int archivedFilesAgeSeconds = 30 * 86400, bool binary = false);
 #endif
         /**
          * @brief Create a folder in the MEGA account
@@ -10661,6 +11068,43 @@ class MegaApi
          */
         void cancelGetPreview(MegaNode* node, MegaRequestListener *listener = NULL);
 
+        /**
+         * @brief Keep the thumbnails and previews downloaded, up to a size
+         *
+         * With a size > 0, the thumbnails and previews that MegaApi::getThumbnail and
+         * MegaApi::getPreview download are kept, so that asking for them again (a gallery
+         * scrolled back, for example) doesn't download them again. They are kept as they
+         * are stored in MEGA, encrypted with the key of their node, on disk when this
+         * MegaApi has a basePath (in a cache of the session, deleted on logout) and in memory
+         * otherwise. The least recently used are dropped beyond the size.
+         *
+         * Disabled (0) by default.
+         *
+         * @param bytes Size of the cache in bytes, or 0 not to keep anything
+         */
+        void setFileAttributeCacheSize(long long bytes);
+
+        /**
+         * @brief Download the thumbnails of nodes the app is about to show
+         *
+         * The thumbnails of the nodes that have one, and that aren't kept already, are downloaded
+         * into the cache set up with MegaApi::setFileAttributeCacheSize (this does nothing without
+         * it), in batches per storage server, so that MegaApi::getThumbnail finds them there.
+         * For example, the next children of a folder a gallery is scrolling through.
+         *
+         * @param nodes Nodes whose thumbnails to download
+         */
+        void prefetchThumbnails(MegaNodeList* nodes);
+
+        /**
+         * @brief Download the previews of nodes the app is about to show
+         *
+         * As MegaApi::prefetchThumbnails, for the previews that MegaApi::getPreview gets.
+         *
+         * @param nodes Nodes whose previews to download
+         */
+        void prefetchPreviews(MegaNodeList* nodes);
+
         /**
          * @brief Set the thumbnail of a MegaNode
          *
@@ -12649,6 +13093,34 @@ class MegaApi
          */
         void startDownloadWithTopPriority(MegaNode* node, const char* localPath, const char *appData, MegaTransferListener *listener = NULL);
 
+        /**
+         * @brief Upload several files or folders to the same folder at once
+         *
+         * It is equivalent to call MegaApi::startUpload for each path, but the transfers are
+         * queued together, so it is cheaper for a large number of them. Each transfer has
+         * its own callbacks, like those started one by one.
+         *
+         * @param localPaths Local paths of the files or folders
+         * @param parent Parent node for the files or folders in the MEGA account
+         * @param listener MegaTransferListener to track these transfers
+         */
+        void startUploads(MegaStringList* localPaths, MegaNode* parent, MegaTransferListener *listener = NULL);
+
+        /**
+         * @brief Download several files or folders from MEGA at once
+         *
+         * It is equivalent to call MegaApi::startDownload for each node, but the transfers are
+         * queued together, so it is cheaper for a large number of them. Each transfer has
+         * its own callbacks, like those started one by one.
+         *
+         * @param nodes MegaNodeList with the files or folders
+         * @param localPath Destination path for the files or folders
+         * If this path is a local folder, it must end with a '\' or '/' character and the file names
+         * in MEGA will be used to store the files inside that folder.
+         * @param listener MegaTransferListener to track these transfers
+         */
+        void startDownloads(MegaNodeList* nodes, const char* localPath, MegaTransferListener *listener = NULL);
+
         /**
          * @brief Start an streaming download for a file in MEGA
          *
@@ -12686,6 +13158,24 @@ class MegaApi
          */
         void setStreamingMinimumRate(int bytesPerSecond);
 
+        /**
+         * @brief Set the size of the pieces in which streaming transfers deliver their data
+         *
+         * By default, MegaTransferListener::onTransferData (and onTransferUpdate) is called for
+         * each piece of data as it arrives from the network, which can be a few KB. With a chunk
+         * size set, the data is held back until there is at least that much (or the end of the
+         * requested range, or a failure, is reached) and then delivered in a single callback.
+         *
+         * Each callback through the bindings has a fixed cost (the MegaTransfer and the byte array
+         * passed to the managed code), so larger chunks let streaming through them get closer to
+         * the rate of the native library, at the cost of some latency and of that much memory per
+         * streaming transfer.
+         *
+         * @param bytes Minimum size of the data delivered by each callback, or 0 to deliver
+         * the data as it arrives
+         */
+        void setStreamingChunkSize(size_t bytes);
+
         /**
          * @brief Cancel a transfer
          *
@@ -13187,6 +13677,118 @@ class MegaApi
          */
         bool setMaxUploadSpeed(long long bpslimit);
 
+        /**
+         * @brief Tune the connections of transfers for links with a large bandwidth-delay product
+         *
+         * On fast links with a long round trip time, the default socket buffers of the OS limit
+         * the throughput of each connection. These settings apply to the transfer connections
+         * opened after the call (not to those of API requests).
+         *
+         * Pass 0 (or NULL) to leave a setting at its default.
+         *
+         * Currently, this method is only available using the cURL-based network layer.
+         * You can check if the function will have effect by checking the return value.
+         *
+         * The socket buffers each connection gets, and the throughput of each connection, are
+         * reported with the rest of the performance statistics of the SDK.
+         *
+         * @param socketBufferSize Size of the send and receive buffers of the sockets, in bytes
+         * @param notSentLowat Limit of unsent data queued in each socket, in bytes (TCP_NOTSENT_LOWAT,
+         * where the OS supports it)
+         * @param congestionControl TCP congestion control algorithm, for example "bbr" (Linux only,
+         * if the kernel provides it and allows the process to use it)
+         * @param receiveBufferSize Size of the receive buffer of the network layer for downloads, in bytes
+         * @return true if the network layer supports these settings, otherwise false
+         */
+        bool setTransferNetworkProfile(int socketBufferSize, int notSentLowat, const char* congestionControl, int receiveBufferSize);
+
+        /**
+         * @brief Deliver the transfer callbacks on a thread of their own
+         *
+         * By default, onTransferStart, onTransferUpdate, onTransferTemporaryError and onTransferFinish
+         * are called on the SDK thread, which doesn't
+         * process transfers or requests until they return. When this is enabled, they are called
+         * on a dedicated thread instead, in the same order, so a slow listener only delays
+         * the notifications it receives.
+         *
+         * In that mode:
+         * - The MegaTransfer and MegaError objects received are copies, valid until the callback returns.
+         * - If an onTransferUpdate of a transfer hasn't been delivered yet when the next one happens,
+         *   only the latest is delivered.
+         * - Updates are dropped while too many notifications are pending; the others never are.
+         * - MegaTransferListener::onTransferData is still called on the SDK thread.
+         *
+         * Once MegaApi::removeTransferListener or MegaApi::removeListener returns, the listener
+         * receives no more callbacks, unless it was called from one of them.
+         *
+         * Disabling it delivers the notifications still pending before returning, so it must not
+         * be called from a transfer callback.
+         *
+         * @param enable True to deliver the callbacks on a dedicated thread, false to deliver them on
+         * the SDK thread (the default)
+         */
+        void setAsyncTransferCallbacks(bool enable);
+
+        /**
+         * @brief Notify changes of nodes with MegaGlobalListener::onNodesChanged instead of onNodesUpdate
+         *
+         * onNodesUpdate receives a copy of all the nodes that changed, which takes a lot of memory when
+         * many nodes change at once (for example, after a large folder is moved). When
+         * this is enabled, listeners receive only the handles and what changed in each node,
+         * and can get the nodes they need with MegaApi::getNodesByHandles.
+         *
+         * The change applies to all the listeners of this MegaApi object.
+         *
+         * @param enable True to notify with onNodesChanged, false to notify with onNodesUpdate (the default)
+         */
+        void setLightweightNodeUpdates(bool enable);
+
+        /**
+         * @brief Notify the removal of a folder as a whole, without the nodes inside it
+         *
+         * When a folder is deleted, each node inside it is notified as removed too, which for
+         * a large folder means a very large list of nodes. When this is enabled, the nodes removed
+         * together with their parent folder are left out of MegaGlobalListener::onNodesUpdate and
+         * MegaGlobalListener::onNodesChanged: only the top node of each removed subtree is notified
+         * (with MegaNode::CHANGE_TYPE_REMOVED), meaning that everything below it has been removed.
+         *
+         * The change applies to all the listeners of this MegaApi object.
+         *
+         * @param enable True to notify only the top node of removed subtrees, false to notify all the
+         * removed nodes (the default)
+         */
+        void setSubtreeRemovalNotifications(bool enable);
+
+        /**
+         * @brief Set the minimum time between progress notifications of each transfer
+         *
+         * onTransferUpdate is called for a transfer at most once per this interval while only its progress
+         * changes. Changes of state are always notified. The first and last progress of a transfer are
+         * notified too. 0 notifies every
+         * change of the progress.
+         *
+         * The interval has a resolution of 100 milliseconds, which is the default.
+         *
+         * @param milliseconds Minimum time between progress notifications of a transfer
+         */
+        void setTransferUpdateInterval(int milliseconds);
+
+        /**
+         * @brief Notify the progress of all the transfers together
+         *
+         * When enabled, instead of onTransferUpdate for the progress of each transfer, the listeners added
+         * with MegaApi::addTransferListener and MegaApi::addListener receive MegaTransferListener::onTransfersUpdate
+         * at most once per interval. It carries the latest progress of every transfer with any. That
+         * saves most of the callbacks when many transfers are active.
+         *
+         * Before any other callback of the transfers, the pending progress is notified first, so the order of
+         * the notifications is kept.
+         *
+         * @param milliseconds Time between batches of progress notifications (with a resolution of
+         * 100 milliseconds), or 0 to disable batching (the default)
+         */
+        void setTransferUpdateBatching(int milliseconds);
+
         /**
          * @brief Get the maximum download speed in bytes per second
          *
@@ -13225,6 +13827,51 @@ class MegaApi
          */
         int getCurrentSpeed(int type);
 
+        /**
+         * @brief Choose how the SDK decides how many transfers run at once
+         *
+         * With MegaApi::TRANSFER_CONCURRENCY_ADAPTIVE, the number of transfers in each
+         * direction starts at the fixed limit and is adjusted every few seconds. It grows
+         * while more transfers make the direction faster, as on fast links with many small
+         * files, and shrinks when the speed drops or chunk requests fail, as on congested
+         * mobile networks. MegaApi::getMaxConcurrentTransfers returns the current limits.
+         *
+         * Transfers already running are not interrupted by this call.
+         *
+         * @param policy Concurrency policy
+         * Valid values for this parameter are:
+         * - MegaApi::TRANSFER_CONCURRENCY_FIXED = 0
+         * Up to 32 uploads or downloads, and 48 transfers in total. This is the default value.
+         * - MegaApi::TRANSFER_CONCURRENCY_ADAPTIVE = 1
+         * Adjusted to the measured speed of each direction
+         */
+        void setTransferConcurrency(int policy);
+
+        /**
+         * @brief Get how many transfers can run at once
+         *
+         * With MegaApi::TRANSFER_CONCURRENCY_ADAPTIVE, this changes as the SDK adjusts its
+         * limits, so it can be polled alongside MegaApi::getCurrentSpeed
+         *
+         * @param type MegaTransfer::TYPE_DOWNLOAD or MegaTransfer::TYPE_UPLOAD for the limit
+         * of a direction, or -1 for the limit of both together
+         * @return Maximum number of concurrent transfers, or 0 if the parameter is invalid
+         */
+        int getMaxConcurrentTransfers(int type);
+
+        /**
+         * @brief Limit the memory that downloads keep their data in
+         *
+         * Download data is received and reassembled in buffers that the SDK recycles. Once
+         * the buffers in use reach this limit, no more downloads are started until the ones
+         * in progress free some, so the limit can be exceeded by the requests in flight.
+         *
+         * The limit is shared by all MegaApi objects in the process.
+         *
+         * @param maxBytes Maximum number of bytes, or 0 for no limit (the default value)
+         */
+        void setMaxTransferBufferMemory(long long maxBytes);
+
         /**
          * @brief Get the active transfer method for downloads
          *
@@ -14487,6 +15134,27 @@ class MegaApi
          */
         MegaNodeList* getChildren(MegaNode *parent, int order = 1);
 
+        /**
+         * @brief Get a page of the child nodes of a MegaNode
+         *
+         * It returns the same nodes as MegaApi::getChildren(MegaNode*, int) from position offset
+         * on, up to limit of them, but only those nodes are sorted all the way and copied, so it is
+         * much cheaper for a large folder shown a few rows at a time. Nodes that compare equal
+         * with the order are kept in the same relative order in every call, so consecutive pages
+         * don't overlap as long as the folder doesn't change. The total number of children is
+         * returned by MegaApi::getNumChildren.
+         *
+         * You take the ownership of the returned value
+         *
+         * @param parent Parent node
+         * @param order Order for the returned list, as in MegaApi::getChildren(MegaNode*, int)
+         * @param offset Position of the first node to return
+         * @param limit Maximum number of nodes to return
+         *
+         * @return List with the requested child MegaNode objects
+         */
+        MegaNodeList* getChildren(MegaNode *parent, int order, int offset, int limit);
+
         /**
          * @brief Get all versions of a file
          * @param node Node to check
@@ -14696,6 +15364,20 @@ class MegaApi
          */
         MegaNode *getNodeByHandle(MegaHandle h);
 
+        /**
+         * @brief Get the MegaNodes that have the given handles
+         *
+         * This is the batch version of MegaApi::getNodeByHandle: only one lock of the SDK is taken for
+         * all the nodes. The handles that don't belong to a node are skipped, so the list
+         * may be shorter than the handles given.
+         *
+         * You take the ownership of the returned value.
+         *
+         * @param handles Handles of the nodes to get
+         * @return List with the nodes found, in the order of their handles
+         */
+        MegaNodeList *getNodesByHandles(MegaHandleList *handles);
+
         /**
          * @brief Get the MegaContactRequest that has a specific handle
          *
@@ -14738,6 +15420,30 @@ class MegaApi
         */
         MegaUserAlertList* getUserAlerts();
 
+        /**
+        * @brief Get the MegaUserAlerts for the logged in user that are newer than one already seen
+        *
+        * Alerts get increasing identifiers (MegaUserAlert::getId), so an app that keeps the
+        * highest one it has can fetch only what was added since, instead of the whole list.
+        * Alerts that were updated (merged with newer ones, or marked as seen) are reported
+        * by MegaListener::onUserAlertsUpdate.
+        *
+        * You take the ownership of the returned value
+        *
+        * @param id Identifier of the newest MegaUserAlert already known, or 0 for all of them
+        * @return List of MegaUserAlert objects with a greater identifier, oldest first
+        */
+        MegaUserAlertList* getUserAlertsAfter(unsigned id);
+
+        /**
+        * @brief Set how many MegaUserAlerts are kept for the logged in user
+        *
+        * Once there are more, the oldest ones are dropped. By default, 10000 are kept.
+        *
+        * @param max Maximum number of alerts, or 0 to keep all of them
+        */
+        void setMaxUserAlerts(unsigned max);
+
         /**
          * @brief Get the number of unread user alerts for the logged in user
          *
@@ -16344,6 +17050,50 @@ class MegaApi
          */
         bool areGfxFeaturesDisabled();
 
+        /**
+         * @brief Tune the local cache database for the device the app runs on
+         *
+         * The settings apply to the databases opened after this call, so it should be made
+         * before logging in or resuming a session.
+         *
+         * With MegaApi::DB_TUNING_THROUGHPUT, the database waits for the disk less often
+         * and checkpoints its write-ahead log once a minute. A power failure can then lose
+         * the most recent changes to the cache, which are fetched again from MEGA on the
+         * next session, but not corrupt it.
+         *
+         * @param profile Tuning profile
+         * Valid values for this parameter are:
+         * - MegaApi::DB_TUNING_DEFAULT = 0
+         * SQLite defaults. This is the default value.
+         * - MegaApi::DB_TUNING_LOW_MEMORY = 1
+         * Small page cache, for devices short of memory
+         * - MegaApi::DB_TUNING_THROUGHPUT = 2
+         * Large page cache, memory-mapped reads and fewer synchronous writes, for desktops and servers
+         */
+        void setDatabaseTuning(int profile);
+
+        /**
+         * @brief Choose where the local cache is kept
+         *
+         * MegaApi::DB_BACKEND_MEMORY keeps the cache of nodes, users and transfers in memory
+         * instead of in database files under the base path of this MegaApi. Nothing is read
+         * from or written to disk for it, so the state of the account is fetched from MEGA
+         * in every session, and transfers can't be resumed after the app is restarted. It
+         * suits short-lived instances, like the ones used to browse folder links.
+         *
+         * The backend can only be changed before logging in or resuming a session. Cached
+         * state is kept only for the lifetime of this MegaApi instance.
+         *
+         * @param backend Database backend
+         * Valid values for this parameter are:
+         * - MegaApi::DB_BACKEND_SQLITE = 0
+         * Database files under the base path, if one was provided in the constructor of
+         * MegaApi. This is the default value.
+         * - MegaApi::DB_BACKEND_MEMORY = 1
+         * In memory
+         */
+        void setDatabaseBackend(int backend);
+
         /**
          * @brief Change the API URL
          *
@@ -16639,6 +17389,38 @@ class MegaApi
          */
         bool createAvatar(const char *imagePath, const char *dstPath);
 
+        /**
+         * @brief Limit the memory taken by the images decoded to make thumbnails and previews
+         *
+         * Each image uploaded is decoded in full to make its thumbnail and preview, which for
+         * large photos (RAW files, for example) takes hundreds of MB, and more with several threads
+         * (see MegaApi::setGfxThreads). With a limit, the size of each bitmap is estimated from
+         * the header of its file, and a file waits for the others to be done rather than go beyond
+         * the limit, unless it's the only one being processed. Whatever the limit, images stop
+         * being uploaded while too many are waiting for their thumbnails and previews.
+         *
+         * There's no limit (0) by default.
+         *
+         * @param bytes Memory the bitmaps processed at once may take, or 0 for no limit
+         */
+        void setGfxMemoryBudget(long long bytes);
+
+        /**
+         * @brief Set the JPEG quality of the previews made for the images and videos uploaded
+         *
+         * Previews are the largest file attributes, and on slow networks they are most of what a
+         * gallery downloads. A lower quality makes them smaller for everyone who views them.
+         *
+         * Previews stay JPEG whatever the quality, because every MEGA client reads them that way.
+         * Thumbnails, and the images of MegaApi::createThumbnail, MegaApi::createPreview and
+         * MegaApi::createAvatar, keep the default quality.
+         *
+         * A MegaGfxProcessor passed to the constructor encodes its images itself, and ignores it.
+         *
+         * @param quality JPEG quality from 1 to 100, or 0 for the default (85)
+         */
+        void setPreviewQuality(int quality);
+
         /**
          * @brief Request the URL suitable for uploading a media file.
          *
@@ -17200,6 +17982,34 @@ class MegaApi
          */
         int httpServerGetMaxOutputSize();
 
+        /**
+         * @brief Set the number of threads serving the connections of the HTTP proxy server
+         *
+         * By default, a single thread accepts the connections and serves all of them. With
+         * more threads, that thread only accepts the connections and hands each one over to
+         * one of the others in turn, where it stays until it's closed. That spreads the work
+         * of many concurrent clients (especially with TLS) over several cores.
+         *
+         * HTTP proxy server listeners (MegaApi::httpServerAddListener) can be called from
+         * any of these threads, even at the same time.
+         *
+         * The new value will be taken into account the next time the server is started.
+         * More than one thread is not supported on Windows, where the value is ignored.
+         *
+         * @param threads Number of threads serving connections, or a number <= 1 to use a
+         * single thread
+         */
+        void httpServerSetLoopThreads(int threads);
+
+        /**
+         * @brief Get the number of threads serving the connections of the HTTP proxy server
+         *
+         * See MegaApi::httpServerSetLoopThreads
+         *
+         * @return Number of threads serving connections
+         */
+        int httpServerGetLoopThreads();
+
         /**
          * @brief Start an FTP server in specified port
          *
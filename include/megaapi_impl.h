@@ -24,6 +24,7 @@
 
 #include <atomic>
 #include <memory>
+#include <unordered_set>
 
 #include "mega.h"
 #include "mega/gfx/external.h"
@@ -229,7 +230,10 @@ protected:
     MegaErrorPrivate mLastError = { API_OK };
 };
 
-class MegaFolderUploadController : public MegaRequestListener, public MegaTransferListener, public MegaRecursiveOperation
+// Uploads a local folder: the whole local tree is scanned first, the folders missing in MEGA are
+// created with as few putnodes as possible (the subfolders of a new folder go in the same one,
+// up to MAX_NEWNODES), and the files of each folder are queued as soon as it exists
+class MegaFolderUploadController : public MegaTransferListener, public MegaRecursiveOperation
 {
 public:
     MegaFolderUploadController(MegaApiImpl *megaApi, MegaTransferPrivate *transfer);
@@ -237,17 +241,88 @@ public:
     void cancel() override;
 
 protected:
-    void onFolderAvailable(MegaHandle handle);
-    void checkCompletion();
+    struct Folder
+    {
+        LocalPath localPath;
+        string name;
+        size_t parent = 0;
+        vector<size_t> children;
+        vector<LocalPath> files;
+        FileSystemType fsType = FS_UNKNOWN;
+
+        // the node in MEGA, once it exists
+        handle remote = UNDEF;
+
+        // in a putnodes still to return, or failed to be created
+        bool sent = false;
+        bool failed = false;
+    };
 
-    std::list<LocalPath> pendingFolders;
+    // the folder uploaded first, and each folder after its parent
+    vector<Folder> folders;
+
+    // the folders not created yet (and not failed)
+    int pendingFolders = 0;
+
+    // expires with the controller, for the results of its putnodes that arrive later
+    std::shared_ptr<int> alive = std::make_shared<int>(0);
+
+    void scan(const LocalPath& localPath, const string& name, Node* parent);
+    void startFiles(size_t folder);
+    void createFolders();
+    void onFoldersCreated(const Error& e, vector<NewNode>& nn, const vector<size_t>& created);
+    void failFolder(size_t folder, const Error& e);
+    void checkCompletion();
 
 public:
-    void onRequestFinish(MegaApi* api, MegaRequest *request, MegaError *e) override;
     void onTransferStart(MegaApi *api, MegaTransfer *transfer) override;
     void onTransferUpdate(MegaApi *api, MegaTransfer *transfer) override;
     void onTransferFinish(MegaApi* api, MegaTransfer *transfer, MegaError *e) override;
-    ~MegaFolderUploadController();
+};
+
+// Copies a folder of the account that has more nodes than fit in one putnodes: the copy goes in
+// putnodes of up to MAX_NEWNODES (a folder that exists, with as much of its contents as fits),
+// each built only once the folder it goes into has been created, and with the attributes
+// encrypted with the new keys on the worker threads. Only the batches in flight are held in memory
+class MegaFolderCopyController : public std::enable_shared_from_this<MegaFolderCopyController>
+{
+public:
+    MegaFolderCopyController(MegaApiImpl *megaApi, int tag, handle target, const string& newName);
+    void start(Node* source);
+
+protected:
+    struct Folder
+    {
+        handle source = UNDEF;
+        handle copy = UNDEF;
+
+        // the children not copied yet, once listed
+        vector<handle> children;
+        bool listed = false;
+    };
+
+    // how many putnodes are sent at a time
+    static const int MAXINFLIGHT = 2;
+
+    MegaApiImpl *megaApi;
+    MegaClient *client;
+    int tag;
+    handle target;
+    string newName;
+
+    handle rootSource = UNDEF;
+    handle rootCopy = UNDEF;
+
+    // the copied folders with children still to copy
+    std::deque<Folder> ready;
+    int inflight = 0;
+    Error failure = API_OK;
+    bool incomplete = false;
+
+    void sendBatch(Node* root);
+    void addNode(Node* n, handle parent, vector<Node*>& nodes, vector<handle>& parents);
+    void onBatch(const Error& e, vector<NewNode>& nn, std::deque<std::pair<size_t, Folder>>& created);
+    void proceed();
 };
 
 
@@ -410,11 +485,41 @@ public:
     void onTransferFinish(MegaApi*, MegaTransfer *t, MegaError *e) override;
 };
 
+// Node data shared by MegaNodePrivate objects instead of being copied into each of them.
+// Immutable once built.  Node::apisnapshot keeps the last one built from a node until the node
+// changes, so listing the same nodes again costs one reference per MegaNode.
+struct MegaNodeSnapshot
+{
+    MegaNodeSnapshot() = default;
+    explicit MegaNodeSnapshot(Node *node);
+    MegaNodeSnapshot(const MegaNodeSnapshot&);
+    MegaNodeSnapshot& operator=(const MegaNodeSnapshot&) = delete;
+    ~MegaNodeSnapshot();
+
+    // the snapshot cached in node, or a new one if it changed since the last call
+    static std::shared_ptr<const MegaNodeSnapshot> of(Node *node);
+
+    const char *name = nullptr;
+    const char *fingerprint = nullptr;
+    const char *originalfingerprint = nullptr;
+    std::unique_ptr<attr_map> customAttrs;
+    std::string nodekey;
+    std::string attrstring;
+    std::string fileattrstring;
+    std::string deviceId;
+    int duration = -1;
+    double latitude = MegaNode::INVALID_COORDINATE;
+    double longitude = MegaNode::INVALID_COORDINATE;
+    MegaHandle restorehandle = UNDEF;
+    bool favourite = false;
+    nodelabel_t label = LBL_UNKNOWN;
+};
+
 class MegaNodePrivate : public MegaNode, public Cacheable
 {
     public:
         MegaNodePrivate(const char *name, int type, int64_t size, int64_t ctime, int64_t mtime,
-                        MegaHandle nodeMegaHandle, std::string *nodekey, std::string *attrstring, std::string *fileattrstring,
+                        MegaHandle nodeMegaHandle, const std::string *nodekey, const std::string *attrstring, const std::string *fileattrstring,
                         const char *fingerprint, const char *originalFingerprint, MegaHandle owner, MegaHandle parentHandle = INVALID_HANDLE,
                         const char *privateauth = NULL, const char *publicauth = NULL, bool isPublic = true,
                         bool isForeign = false, const char *chatauth = NULL);
@@ -492,6 +597,9 @@ class MegaNodePrivate : public MegaNode, public Cacheable
 #endif
 
         static MegaNode *fromNode(Node *node);
+
+        // the MegaNode::CHANGE_TYPE_* bits of what changed in the node
+        static int changesOf(const Node *node);
         MegaNode *copy() override;
 
         char *serialize() override;
@@ -501,22 +609,14 @@ class MegaNodePrivate : public MegaNode, public Cacheable
     protected:
         MegaNodePrivate(Node *node);
         int type;
-        const char *name;
-        const char *fingerprint;
-        const char *originalfingerprint;
-        attr_map *customAttrs;
+        std::shared_ptr<const MegaNodeSnapshot> mSnapshot;
         int64_t size;
         int64_t ctime;
         int64_t mtime;
         MegaHandle nodehandle;
         MegaHandle parenthandle;
-        MegaHandle restorehandle;
-        std::string nodekey;
-        std::string attrstring;
-        std::string fileattrstring;
         std::string privateAuth;
         std::string publicAuth;
-        std::string mDeviceId;
         const char *chatAuth;
         int tag;
         int changed;
@@ -531,17 +631,12 @@ class MegaNodePrivate : public MegaNode, public Cacheable
         PublicLink *plink;
         bool mNewLinkFormat;
         std::string *sharekey;   // for plinks of folders
-        int duration;
         int width;
         int height;
         int shortformat;
         int videocodecid;
-        double latitude;
-        double longitude;
         MegaNodeList *children;
         MegaHandle owner;
-        bool mFavourite;
-        nodelabel_t mLabel;
 
 #ifdef ENABLE_SYNC
         bool syncdeleted;
@@ -711,6 +806,10 @@ class MegaTransferPrivate : public MegaTransfer, public Cacheable
         void setForceNewUpload(bool forceNewUpload);
         void setStreamingTransfer(bool streamingTransfer);
         void setLastBytes(char *lastBytes);
+
+        // data of a streaming download held back until it's a whole chunk (MegaApi::setStreamingChunkSize)
+        string streamingChunk;
+
         void setLastError(const MegaError *e);
         void setFolderTransferTag(int tag);
         void setNotificationNumber(long long notificationNumber);
@@ -1898,6 +1997,15 @@ public:
                              SymmCipher* cipher, chunkmac_map* chunkmacs, uint64_t ctriv);
 
     byte* nextbuffer(unsigned bufsize) override;
+
+    using EncryptByChunks::encrypt;
+
+    // the same, a window of chunks at a time: while the worker threads of queue encrypt one, the
+    // calling thread writes the previous one and reads the next
+    bool encrypt(MegaClientAsyncQueue& queue, m_off_t pos, m_off_t npos, string& urlSuffix);
+
+    // the data read and written at once
+    static const unsigned WINDOWSIZE = 8 * 1024 * 1024;
 };
 
 class MegaBackgroundMediaUploadPrivate : public MegaBackgroundMediaUpload
@@ -1989,6 +2097,13 @@ class TreeProcessor
     public:
         virtual bool processNode(Node* node);
         virtual ~TreeProcessor();
+
+        // Processors whose results don't depend on the order the nodes are visited in can opt in to
+        // MegaApiImpl::processTree() walking large trees over several threads: clone() returns an empty
+        // processor with the same settings for each thread, and merge() adds the results of a clone to
+        // this one.  Processors returning null from clone() are only run on the calling thread.
+        virtual std::unique_ptr<TreeProcessor> clone() const;
+        virtual void merge(TreeProcessor& other);
 };
 
 class SearchTreeProcessor : public TreeProcessor
@@ -1996,6 +2111,8 @@ class SearchTreeProcessor : public TreeProcessor
     public:
         SearchTreeProcessor(MegaClient *client, const char *search, int type);
         virtual bool processNode(Node* node);
+        std::unique_ptr<TreeProcessor> clone() const override;
+        void merge(TreeProcessor& other) override;
         bool isValidTypeNode(Node *node);
         virtual ~SearchTreeProcessor() {}
         vector<Node *> &getResults();
@@ -2012,6 +2129,8 @@ class OutShareProcessor : public TreeProcessor
     public:
         OutShareProcessor(MegaClient&);
         virtual bool processNode(Node* node);
+        std::unique_ptr<TreeProcessor> clone() const override;
+        void merge(TreeProcessor& other) override;
         virtual ~OutShareProcessor() {}
         vector<Share *> getShares();
         vector<handle> getHandles();
@@ -2027,6 +2146,8 @@ class PendingOutShareProcessor : public TreeProcessor
     public:
         PendingOutShareProcessor();
         virtual bool processNode(Node* node);
+        std::unique_ptr<TreeProcessor> clone() const override;
+        void merge(TreeProcessor& other) override;
         virtual ~PendingOutShareProcessor() {}
         vector<Share *> &getShares();
         vector<handle> &getHandles();
@@ -2036,33 +2157,6 @@ class PendingOutShareProcessor : public TreeProcessor
         vector<handle> handles;
 };
 
-class SizeProcessor : public TreeProcessor
-{
-    protected:
-        long long totalBytes;
-
-    public:
-        SizeProcessor();
-        virtual bool processNode(Node* node);
-        long long getTotalBytes();
-};
-
-class TreeProcFolderInfo : public TreeProc
-{
-    public:
-        TreeProcFolderInfo();
-        virtual void proc(MegaClient*, Node*);
-        virtual ~TreeProcFolderInfo() {}
-        MegaFolderInfo *getResult();
-
-    protected:
-        int numFiles;
-        int numFolders;
-        int numVersions;
-        long long currentSize;
-        long long versionsSize;
-};
-
 class FavouriteProcessor : public TreeProcessor
 {
 public:
@@ -2075,12 +2169,17 @@ private:
     unsigned mMaxCount = 0;
 };
 
-//Thread safe request queue
+// Thread safe request queue.  Any thread can push, without locks (see MpscQueue).  The other
+// methods are for one consumer at a time: the SDK thread, which consumes with sdkMutex locked, or
+// another thread that holds sdkMutex
 class RequestQueue
 {
     protected:
+        MpscQueue<MegaRequestPrivate *> incoming;
+
+        // the requests taken from incoming so far (and those put back), in order
         std::deque<MegaRequestPrivate *> requests;
-        std::mutex mutex;
+        void takeIncoming();
 
     public:
         RequestQueue();
@@ -2093,20 +2192,42 @@ class RequestQueue
 };
 
 
-//Thread safe transfer queue
+// Thread safe transfer queue, pushed to without locks like RequestQueue (with the same rules for
+// the other methods).  The transfers of each folder transfer are indexed, so that cancelling them
+// doesn't go through the whole queue
 class TransferQueue
 {
     protected:
-        std::deque<MegaTransferPrivate *> transfers;
-        std::mutex mutex;
-        int lastPushedTransferTag = 0;
+        MpscQueue<MegaTransferPrivate *> incoming;
+        std::atomic<int> lastPushedTransferTag{0};
+
+        typedef std::list<MegaTransferPrivate *> transfer_list;
+        transfer_list transfers;
+        std::unordered_map<MegaTransferPrivate *, transfer_list::iterator> positions;
+
+        // the transfers queued with each folder tag (some may have left the queue already: those
+        // not in positions), and how many of them are still queued
+        struct FolderTransfers
+        {
+            vector<MegaTransferPrivate *> transfers;
+            size_t queued = 0;
+        };
+        std::unordered_map<int, FolderTransfers> folderTransfers;
+
+        void takeIncoming();
+        void insert(transfer_list::iterator before, MegaTransferPrivate *transfer);
+        transfer_list::iterator erase(transfer_list::iterator it);
 
     public:
         TransferQueue();
         void push(MegaTransferPrivate *transfer);
+        void push(vector<MegaTransferPrivate *> &&transfers);
         void push_front(MegaTransferPrivate *transfer);
         MegaTransferPrivate * pop();
 
+        // call f on the first transfers queued, up to count of them
+        void peek(size_t count, std::function<void(MegaTransferPrivate *)> f);
+
         /**
          * @brief pops and returns transfer up to the designated one
          * @param lastQueuedTransfer position of the last transfer to pop
@@ -2120,6 +2241,68 @@ class TransferQueue
         int getLastPushedTag() const;
 };
 
+// Delivers the transfer callbacks on a thread of its own, rather than on the SDK thread with the
+// SDK locked (see MegaApi::setAsyncTransferCallbacks()).  The listeners get copies of the transfers
+// and errors, in the order the events happened.  An update still queued is replaced by a newer one
+// of the same transfer, and updates are dropped while too many events are queued (Start, Finish and
+// TemporaryError never are)
+class TransferCallbackDispatcher
+{
+    public:
+        enum Event { START, UPDATE, FINISH, TEMPORARY_ERROR, BATCH };
+
+        // events queued beyond which updates are dropped
+        static const size_t MAXQUEUED = 10000;
+
+        TransferCallbackDispatcher(MegaApi* api);
+
+        // delivers what is queued, then stops the thread.  Not to be destroyed from a callback
+        ~TransferCallbackDispatcher();
+
+        // queue the event for the listeners, as they are now
+        void push(Event event, MegaTransferPrivate* transfer, MegaError* error,
+                  const set<MegaTransferListener*>& transferListeners, const set<MegaListener*>& listeners);
+
+        // queue a batch of progress updates for the listeners (the list is delivered as it is)
+        void push(unique_ptr<MegaTransferList> transfers,
+                  const set<MegaTransferListener*>& transferListeners, const set<MegaListener*>& listeners);
+
+        // the listener is not called again once this returns (unless from a callback of its own)
+        void removeListener(MegaTransferListener* listener);
+        void removeListener(MegaListener* listener);
+
+    private:
+        struct Item
+        {
+            Event event;
+            int tag;
+            unique_ptr<MegaTransfer> transfer;
+            unique_ptr<MegaError> error;
+            unique_ptr<MegaTransferList> transfers;
+            vector<MegaTransferListener*> transferListeners;
+            vector<MegaListener*> listeners;
+            MegaTransferListener* listener;
+        };
+
+        MegaApi* api;
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::deque<unique_ptr<Item>> items;
+
+        // the updates queued, by transfer tag
+        std::map<int, Item*> updates;
+
+        bool delivering = false;
+        bool stopping = false;
+        std::thread thread;
+
+        void loop();
+        void deliver(Item& item);
+
+        // wait until no callback is running, unless on the dispatcher thread
+        void waitIdle(std::unique_lock<std::mutex>& lock);
+};
+
 
 class MegaApiImpl : public MegaApp
 {
@@ -2196,6 +2379,12 @@ class MegaApiImpl : public MegaApp
         void login(const char* email, const char* password, MegaRequestListener *listener = NULL);
         char *dumpSession();
         char *getSequenceNumber();
+        char *getMetrics();
+        void setTransferTraceSize(int events);
+        char *getTransferTrace();
+        char *getMemoryUsage();
+        void setMemoryUsageLogInterval(int seconds);
+        void setStallDetection(int thresholdMs, bool stackSamples);
         char *getAccountAuth();
         void setAccountAuth(const char* auth);
 
@@ -2250,6 +2439,14 @@ class MegaApiImpl : public MegaApp
         void resetCredentials(MegaUser *user, MegaRequestListener *listener = NULL);
         char* getMyRSAPrivateKey();
         static void setLogLevel(int logLevel);
+        static void setModuleLogLevel(int module, int logLevel);
+        static void setSharedWorkerThreads(unsigned count);
+        static void setGfxThreads(unsigned count);
+
+        // the pool shared by the instances created after setSharedWorkerThreads(), or null
+        static std::shared_ptr<MegaWorkerPool> getSharedWorkerPool();
+        static bool setThreadSettings(int role, unsigned count, const char* cpus, int priority);
+        static void setWorkerExecutor(MegaExecutor* executor);
         static void setMaxPayloadLogSize(long long maxSize);
         static void addLoggerClass(MegaLogger *megaLogger);
         static void removeLoggerClass(MegaLogger *megaLogger);
@@ -2257,7 +2454,7 @@ class MegaApiImpl : public MegaApp
         static void log(int logLevel, const char* message, const char *filename = NULL, int line = -1);
         void setLoggingName(const char* loggingName);
 #ifdef USE_ROTATIVEPERFORMANCELOGGER
-        static void setUseRotativePerformanceLogger(const char * logPath, const char * logFileName, bool logToStdOut, long int archivedFilesAgeSeconds);
+        static void setUseRotativePerformanceLogger(const char * logPath, const char * logFileName, bool logToStdOut, long int archivedFilesAgeSeconds, bool binary);
 #endif
 
         bool platformSetRLimitNumFile(int newNumFileLimit) const;
@@ -2278,6 +2475,7 @@ class MegaApiImpl : public MegaApp
         void share(MegaNode *node, MegaUser* user, int level, MegaRequestListener *listener = NULL);
         void share(MegaNode* node, const char* email, int level, MegaRequestListener *listener = NULL);
         void loginToFolder(const char* megaFolderLink, const char *authKey = nullptr, MegaRequestListener *listener = NULL);
+        void setFolderLinkBrowseOnly(bool enable);
         void importFileLink(const char* megaFileLink, MegaNode* parent, MegaRequestListener *listener = NULL);
         void decryptPasswordProtectedLink(const char* link, const char* password, MegaRequestListener *listener = NULL);
         void encryptLinkWithPassword(const char* link, const char* password, MegaRequestListener *listener = NULL);
@@ -2290,6 +2488,8 @@ class MegaApiImpl : public MegaApp
         void setThumbnailByHandle(MegaNode* node, MegaHandle attributehandle, MegaRequestListener *listener = NULL);
         void getPreview(MegaNode* node, const char *dstFilePath, MegaRequestListener *listener = NULL);
 		void cancelGetPreview(MegaNode* node, MegaRequestListener *listener = NULL);
+        void setFileAttributeCacheSize(long long bytes);
+        void prefetchNodeAttributes(MegaNodeList* nodes, fatype type);
         void setPreview(MegaNode* node, const char *srcFilePath, MegaRequestListener *listener = NULL);
         void putPreview(MegaBackgroundMediaUpload* node, const char *srcFilePath, MegaRequestListener *listener = NULL);
         void setPreviewByHandle(MegaNode* node, MegaHandle attributehandle, MegaRequestListener *listener = NULL);
@@ -2376,8 +2576,16 @@ class MegaApiImpl : public MegaApp
         void startUploadForSupport(const char *localPath, bool isSourceTemporary, FileSystemType fsType, MegaTransferListener *listener=NULL);
         void startDownload(MegaNode* node, const char* localPath, MegaTransferListener *listener = NULL);
         void startDownload(bool startFirst, MegaNode *node, const char* target, int folderTransferTag, const char *appData, MegaTransferListener *listener);
+        void startUploads(MegaStringList *localPaths, MegaNode *parent, MegaTransferListener *listener);
+        void startDownloads(MegaNodeList *nodes, const char *localFolder, MegaTransferListener *listener);
+
+        // the transfers of the calls above, to queue several at once with startTransfers()
+        MegaTransferPrivate *createUploadTransfer(bool startFirst, const char* localPath, MegaNode* parent, const char* fileName, const char* targetUser, int64_t mtime, int folderTransferTag, bool isBackup, const char *appData, bool isSourceFileTemporary, bool forceNewUpload, FileSystemType fsType, MegaTransferListener *listener);
+        MegaTransferPrivate *createDownloadTransfer(bool startFirst, MegaNode *node, const char* target, int folderTransferTag, const char *appData, MegaTransferListener *listener);
+        void startTransfers(vector<MegaTransferPrivate *> &&transfers);
         void startStreaming(MegaNode* node, m_off_t startPos, m_off_t size, MegaTransferListener *listener);
         void setStreamingMinimumRate(int bytesPerSecond);
+        void setStreamingChunkSize(size_t bytes);
         void retryTransfer(MegaTransfer *transfer, MegaTransferListener *listener = NULL);
         void cancelTransfer(MegaTransfer *transfer, MegaRequestListener *listener=NULL);
         void cancelTransferByTag(int transferTag, MegaRequestListener *listener = NULL);
@@ -2398,11 +2606,20 @@ class MegaApiImpl : public MegaApp
         void setUploadMethod(int method);
         bool setMaxDownloadSpeed(m_off_t bpslimit);
         bool setMaxUploadSpeed(m_off_t bpslimit);
+        bool setTransferNetworkProfile(int socketBufferSize, int notSentLowat, const char* congestionControl, int receiveBufferSize);
+        void setAsyncTransferCallbacks(bool enable);
+        void setLightweightNodeUpdates(bool enable);
+        void setSubtreeRemovalNotifications(bool enable);
+        void setTransferUpdateInterval(int milliseconds);
+        void setTransferUpdateBatching(int milliseconds);
         int getMaxDownloadSpeed();
         int getMaxUploadSpeed();
         int getCurrentDownloadSpeed();
         int getCurrentUploadSpeed();
         int getCurrentSpeed(int type);
+        void setTransferConcurrency(int policy);
+        int getMaxConcurrentTransfers(int type);
+        void setMaxTransferBufferMemory(long long maxBytes);
         int getDownloadMethod();
         int getUploadMethod();
         MegaTransferData *getTransferData(MegaTransferListener *listener = NULL);
@@ -2486,6 +2703,7 @@ class MegaApiImpl : public MegaApp
 		int getNumChildFiles(MegaNode* parent);
 		int getNumChildFolders(MegaNode* parent);
         MegaNodeList* getChildren(MegaNode *parent, int order);
+        MegaNodeList* getChildren(MegaNode *parent, int order, int offset, int limit);
         MegaNodeList* getVersions(MegaNode *node);
         int getNumVersions(MegaNode *node);
         bool hasVersions(MegaNode *node);
@@ -2498,10 +2716,13 @@ class MegaApiImpl : public MegaApp
         char *getNodePathByNodeHandle(MegaHandle handle);
         MegaNode *getNodeByPath(const char *path, MegaNode *n = NULL);
         MegaNode *getNodeByHandle(handle handler);
+        MegaNodeList *getNodesByHandles(MegaHandleList *handles);
         MegaContactRequest *getContactRequestByHandle(MegaHandle handle);
         MegaUserList* getContacts();
         MegaUser* getContact(const char* uid);
         MegaUserAlertList* getUserAlerts();
+        MegaUserAlertList* getUserAlertsAfter(unsigned id);
+        void setMaxUserAlerts(unsigned max);
         int getNumUnreadUserAlerts();
         MegaNodeList *getInShares(MegaUser* user, int order);
         MegaNodeList *getInShares(int order);
@@ -2594,6 +2815,8 @@ class MegaApiImpl : public MegaApp
 
         void disableGfxFeatures(bool disable);
         bool areGfxFeaturesDisabled();
+        void setDatabaseTuning(int profile);
+        void setDatabaseBackend(int backend);
 
         void changeApiUrl(const char *apiURL, bool disablepkp = false);
 
@@ -2615,6 +2838,9 @@ class MegaApiImpl : public MegaApp
 
         static std::function<bool (Node*, Node*)>getComparatorFunction(int order, MegaClient& mc);
         static void sortByComparatorFunction(node_vector&, int order, MegaClient& mc);
+
+        // leave in v only the count nodes from offset on, in the order given, without sorting the rest
+        static void sortPageByComparatorFunction(node_vector& v, int order, MegaClient& mc, size_t offset, size_t count);
         static bool nodeNaturalComparatorASC(Node *i, Node *j);
         static bool nodeNaturalComparatorDESC(Node *i, Node *j);
         static bool nodeComparatorDefaultASC  (Node *i, Node *j);
@@ -2644,6 +2870,8 @@ class MegaApiImpl : public MegaApp
         bool createThumbnail(const char* imagePath, const char *dstPath);
         bool createPreview(const char* imagePath, const char *dstPath);
         bool createAvatar(const char* imagePath, const char *dstPath);
+        void setGfxMemoryBudget(long long bytes);
+        void setPreviewQuality(int quality);
 
         void backgroundMediaUploadRequestUploadURL(int64_t fullFileSize, MegaBackgroundMediaUpload* state, MegaRequestListener *listener);
         void backgroundMediaUploadComplete(MegaBackgroundMediaUpload* state, const char* utf8Name, MegaNode *parent, const char* fingerprint, const char* fingerprintoriginal,
@@ -2671,6 +2899,8 @@ class MegaApiImpl : public MegaApp
         int httpServerGetMaxBufferSize();
         void httpServerSetMaxOutputSize(int outputSize);
         int httpServerGetMaxOutputSize();
+        void httpServerSetLoopThreads(int threads);
+        int httpServerGetLoopThreads();
 
         // permissions
         void httpServerEnableFileServer(bool enable);
@@ -2807,6 +3037,7 @@ class MegaApiImpl : public MegaApp
         void fireOnTransferStart(MegaTransferPrivate *transfer);
         void fireOnTransferFinish(MegaTransferPrivate *transfer, unique_ptr<MegaErrorPrivate> e, DBTableTransactionCommitter& committer);
         void fireOnTransferUpdate(MegaTransferPrivate *transfer);
+        void fireOnTransfersUpdate(MegaTransferList *transfers);
         void fireOnTransferTemporaryError(MegaTransferPrivate *transfer, unique_ptr<MegaErrorPrivate> e);
         map<int, MegaTransferPrivate *> transferMap;
         map<int, MegaTransferPrivate *> folderTransferMap; //transferMap includes these, added for speedup
@@ -2845,9 +3076,11 @@ protected:
         void fireOnRequestUpdate(MegaRequestPrivate *request);
         void fireOnRequestTemporaryError(MegaRequestPrivate *request, unique_ptr<MegaErrorPrivate> e);
         bool fireOnTransferData(MegaTransferPrivate *transfer);
+        bool fireOnStreamingData(MegaTransferPrivate *transfer, char *buffer, m_off_t len, m_off_t speed, m_off_t meanSpeed);
         void fireOnUsersUpdate(MegaUserList *users);
         void fireOnUserAlertsUpdate(MegaUserAlertList *alerts);
         void fireOnNodesUpdate(MegaNodeList *nodes);
+        void fireOnNodesChanged(MegaHandleList *handles, MegaIntegerList *changes);
         void fireOnAccountUpdate();
         void fireOnContactRequestsUpdate(MegaContactRequestList *requests);
         void fireOnReloadNeeded();
@@ -2870,6 +3103,20 @@ protected:
 
         void processTransferPrepare(Transfer *t, MegaTransferPrivate *transfer);
         void processTransferUpdate(Transfer *tr, MegaTransferPrivate *transfer);
+
+        // onTransferUpdate of a transfer at most once per this many deciseconds, unless its state changes
+        dstime transferUpdateInterval = 1;
+
+        // when not 0, the progress of the transfers is notified to the listeners of all of them with
+        // onTransfersUpdate, at most once per this many deciseconds (the listener of each transfer
+        // still gets onTransferUpdate)
+        dstime transferBatchInterval = 0;
+        dstime lastTransferBatch = 0;
+        std::set<int> pendingTransferUpdates;
+
+        // notify the progress in pendingTransferUpdates, once the batch interval has elapsed (or now,
+        // if forced: before other transfer callbacks, to keep them in order)
+        void flushTransferUpdates(bool force);
         void processTransferComplete(Transfer *tr, MegaTransferPrivate *transfer);
         void processTransferFailed(Transfer *tr, MegaTransferPrivate *transfer, const Error &e, dstime timeleft);
         void processTransferRemoved(Transfer *tr, MegaTransferPrivate *transfer, const Error &e);
@@ -2889,6 +3136,7 @@ protected:
         MegaHTTPServer *httpServer;
         int httpServerMaxBufferSize;
         int httpServerMaxOutputSize;
+        int httpServerLoopThreads;
         bool httpServerEnableFiles;
         bool httpServerEnableFolders;
         bool httpServerOfflineAttributeEnabled;
@@ -2934,16 +3182,35 @@ protected:
         set<MegaGlobalListener *> globalListeners;
         set<MegaListener *> listeners;
         retryreason_t waitingRequest;
+        // the excluded names without wildcards are looked up, the others matched one by one
+        std::unordered_set<string> excludedLiteralNames;
         vector<string> excludedNames;
         vector<string> excludedPaths;
+#if defined(ENABLE_SYNC) && defined(USE_PCRE)
+        // the regular expressions of each sync, by backup id, compiled once and not for every
+        // entry that is_syncable() checks: again only when the sync's list changes
+        struct SyncRegExps
+        {
+            vector<string> source;
+            unique_ptr<MegaRegExp> compiled;
+        };
+        std::map<handle, SyncRegExps> mSyncRegExps;
+        std::mutex mSyncRegExpsMutex;
+#endif
         long long syncLowerSizeLimit;
         long long syncUpperSizeLimit;
-        std::recursive_timed_mutex sdkMutex;
-        using SdkMutexGuard = std::unique_lock<std::recursive_timed_mutex>;   // (equivalent to typedef)
+        // exclusive for anything that may change the client's state, shared for pure node queries
+        RecursiveSharedMutex sdkMutex;
+        using SdkMutexGuard = std::unique_lock<RecursiveSharedMutex>;   // (equivalent to typedef)
+        using SdkSharedGuard = RecursiveSharedMutex::SharedGuard;
         std::atomic<bool> syncPathStateLockTimeout{ false };
         MegaTransferPrivate *currentTransfer;
         MegaRequestPrivate *activeRequest;
         MegaTransferPrivate *activeTransfer;
+        std::shared_ptr<TransferCallbackDispatcher> transferCallbacks;
+        std::atomic<bool> lightweightNodeUpdates{false};
+        std::atomic<bool> subtreeRemovalNotifications{false};
+        std::atomic<size_t> streamingChunkSize{0};
         MegaError *activeError;
         MegaNodeList *activeNodes;
         MegaUserList *activeUsers;
@@ -2957,6 +3224,21 @@ protected:
         int threadExit;
         void loop();
 
+        // seconds between the logs of getMemoryUsage(), and when the last one was (in ds)
+        std::atomic<int> memoryUsageLogInterval{600};
+        dstime lastMemoryUsageLog = 0;
+        string memoryUsageJson();
+
+        // watches the passes of loop()
+        StallWatchdog stallWatchdog;
+
+        // what getNodeByPath() resolved, by the handle of the base node and the path (UNDEF if nothing).
+        // The WebDAV/FTP servers ask for the same paths over and over; any rename, move, deletion
+        // or new node reported by nodes_updated() drops it all, as it can change the result of any path
+        static const size_t MAXNODEPATHCACHE = 10000;
+        std::unordered_map<string, handle> nodePathCache;
+        void updateNodePathCache(Node**, int);
+
         int maxRetries;
 
         // a request-level error occurred
@@ -3272,6 +3554,10 @@ protected:
         Node *getNodeByFingerprintInternal(const char *fingerprint, Node *parent);
 
         bool processTree(Node* node, TreeProcessor* processor, bool recursive = 1, MegaCancelToken* cancelToken = nullptr);
+
+        // what processTree() of the cloud drive does for the nodes with outgoing shares, from the
+        // client's index of them when it is complete
+        void processOutShares(TreeProcessor* processor);
         void getNodeAttribute(MegaNode* node, int type, const char *dstFilePath, MegaRequestListener *listener = NULL);
 		    void cancelGetNodeAttribute(MegaNode *node, int type, MegaRequestListener *listener = NULL);
         void setNodeAttribute(MegaNode* node, int type, const char *srcFilePath, MegaHandle attributehandle, MegaRequestListener *listener = NULL);
@@ -3290,6 +3576,7 @@ protected:
         bool hasToForceUpload(const Node &node, const MegaTransferPrivate &transfer) const;
 
         friend class MegaBackgroundMediaUploadPrivate;
+        friend class MegaFolderCopyController;
 
 private:
         void setCookieSettings_sendPendingRequests(MegaRequestPrivate* request);
@@ -3335,14 +3622,31 @@ public:
     unsigned int availableSpace();
     unsigned int availableCapacity();
     uv_buf_t nextBuffer();
+
+    // the next data to send, up to the max output size, in as many as maxbufs buffers (the data
+    // wraps around the end of the ring into a second one), for a single scatter/gather write.
+    // Returns the number of buffers filled
+    unsigned int nextBuffers(uv_buf_t* bufs, unsigned int maxbufs);
     void freeData(unsigned int len);
     void setMaxBufferSize(unsigned int bufferSize);
     void setMaxOutputSize(unsigned int outputSize);
 
     static const unsigned int MAX_BUFFER_SIZE = 2097152;
-    static const unsigned int MAX_OUTPUT_SIZE = 16384;
+    static const unsigned int MAX_OUTPUT_SIZE = 131072;
+
+    // buffers of at least this size are kept when released, a few of them, for the next
+    // connections to take instead of allocating theirs
+    static const unsigned int POOLED_BUFFER_SIZE = 1048576;
+    static const size_t POOLED_BUFFERS = 4;
+
+    // the memory of all the buffers of the process, pooled ones included (see MegaApi::getMemoryUsage())
+    static std::atomic<m_off_t> totalCapacity;
 
 protected:
+    // a buffer of that capacity, from the pool if there is one, and back to it once released
+    static char* takeBuffer(unsigned int capacity);
+    void releaseBuffer();
+
     char *buffer;
     unsigned int capacity;
     unsigned int size;
@@ -3354,6 +3658,27 @@ protected:
 };
 
 class MegaTCPServer;
+class MegaTCPContext;
+
+// An event loop on its own thread, serving part of the connections accepted by a
+// MegaTCPServer (see MegaTCPServer::setLoopThreads)
+struct MegaTCPLoop
+{
+    MegaTCPServer *server = nullptr;
+    uv_loop_t uv_loop;
+    uv_async_t async; // new connections, or the server stopping
+    MegaThread thread;
+
+    // the sockets accepted by the server for this loop
+    std::mutex mutex;
+    std::deque<int> accepted;
+    bool stopping = false;
+    bool closed = false;
+
+    list<MegaTCPContext*> connections;
+    int remainingcloseevents = 0;
+};
+
 class MegaTCPContext : public MegaTransferListener, public MegaRequestListener
 {
 public:
@@ -3362,6 +3687,7 @@ public:
 
     // Connection management
     MegaTCPServer *server;
+    MegaTCPLoop *loop; // NULL for connections in the loop of the server
     uv_tcp_t tcphandle;
     uv_async_t asynchandle;
     uv_mutex_t mutex;
@@ -3375,6 +3701,10 @@ public:
     bool failed;
     bool pause;
 
+    // a threadpool job is using the socket: closing it waits until the job is done
+    bool workPending;
+    bool closeDeferred;
+
 #ifdef ENABLE_EVT_TLS
     //tls stuff:
     evt_tls_t *evt_tls;
@@ -3424,12 +3754,21 @@ protected:
     bool closing;
     int remainingcloseevents;
 
+    // with more than one loop thread, the loop of the server only accepts connections, and
+    // hands them over to the others in turn
+    int loopThreads;
+    std::vector<std::unique_ptr<MegaTCPLoop>> loops;
+    size_t nextLoop;
+
 #ifdef ENABLE_EVT_TLS
     // TLS
     bool evtrequirescleaning;
     evt_ctx_t evtctx;
     std::string certificatepath;
     std::string keypath;
+
+    // evt_ctx_get_tls() and evt_tls_free() change the connections listed in evtctx
+    std::mutex evtmutex;
 #endif
 
     // libuv callbacks
@@ -3463,6 +3802,21 @@ protected:
     static void closeConnection(MegaTCPContext *tcpctx);
     static void closeTCPConnection(MegaTCPContext *tcpctx);
 
+    // loop threads
+    void startLoops();
+    void stopLoops(bool wait);
+    void dispatchConnection(uv_stream_t *server_handle);
+    void openConnection(MegaTCPLoop *loop, int fd);
+    static void *loopEntryPoint(void *param);
+    static void onLoopAsync(uv_async_t *handle);
+    static void onDispatchedClose(uv_handle_t *handle);
+    static list<MegaTCPContext*> &connectionsOf(MegaTCPContext *tcpctx);
+    static int &closeEventsOf(MegaTCPContext *tcpctx);
+
+    // the work of tcpctx->workPending is done: true if the connection was closed meanwhile, and
+    // is closed now
+    static bool finishPendingWork(MegaTCPContext *tcpctx);
+
     void run();
     void initializeAndStartListening();
 
@@ -3495,6 +3849,8 @@ public:
     void setMaxOutputSize(int outputSize);
     int getMaxBufferSize();
     int getMaxOutputSize();
+    void setLoopThreads(int threads); // since the next start()
+    int getLoopThreads();
     void setRestrictedMode(int mode);
     int getRestrictedMode();
     bool isHandleAllowed(handle h);
@@ -3555,13 +3911,39 @@ public:
     bool overwrite;
     std::unique_ptr<FileAccess> tmpFileAccess;
     std::string tmpFileName;
+
+    // the synced copy of the node, sent with sendfile() instead of streaming the node
+    int localFile;
+    m_off_t localFileOffset;
+    int socketFd;
+    uv_work_t sendFileReq;
+    m_off_t sendFileResult;
+
     std::string newname; //newname for moved node
     MegaHandle nodeToMove; //node to be moved after delete
     MegaHandle newParentNode; //parent node for moved after delete
 
+    // Persistent connections
+    bool keepAliveRequested; // the client didn't ask to close the connection
+    bool keepAlive; // the response keeps the connection open for the next request
+    bool requestPending; // a request is being answered: those received meanwhile wait in pipelined
+    bool responseSent; // the next request starts once the streaming for this one is done
+    std::string pipelined;
+    std::atomic<int> activeStreams;
+
+    // Multipart responses (multipart/byteranges)
+    std::vector<std::pair<m_off_t, m_off_t>> requestedRanges; // as requested: a negative start is a suffix length
+    std::vector<std::pair<m_off_t, m_off_t>> ranges; // the [start, end) sent, in order
+    std::vector<std::string> rangeHeaders; // the part header of each range, then the closing boundary
+    size_t rangeIndex;
+    m_off_t streamPos; // the next byte of the node to stream
+
     uv_mutex_t mutex_responses;
     std::list<std::string> responses;
 
+    // back to the state before a request on this connection
+    void resetRequest();
+
     virtual void onTransferStart(MegaApi *, MegaTransfer *transfer);
     virtual bool onTransferData(MegaApi *, MegaTransfer *transfer, char *buffer, size_t size);
     virtual void onTransferFinish(MegaApi* api, MegaTransfer *transfer, MegaError *e);
@@ -3578,6 +3960,13 @@ protected:
     bool offlineAttribute;
     bool subtitlesSupportEnabled;
 
+    // PROPFIND bodies, per node and per URL / depth / offline attribute, until the node or its
+    // children change.  Read from the loop threads, invalidated from the SDK thread
+    static const size_t MAX_PROPFIND_CACHE_NODES = 256;
+    std::mutex propFindMutex;
+    std::map<handle, std::map<std::string, std::string>> propFindCache;
+    unsigned propFindGeneration;
+
     //virtual methods:
     virtual void processReceivedData(MegaTCPContext *ftpctx, ssize_t nread, const uv_buf_t * buf);
     virtual void processAsyncEvent(MegaTCPContext *ftpctx);
@@ -3601,6 +3990,25 @@ protected:
     static void sendNextBytes(MegaHTTPContext *httpctx);
     static int streamNode(MegaHTTPContext *httpctx);
 
+    // serving synced files from the local filesystem, without copies to user space
+    static const m_off_t SENDFILE_CHUNK_SIZE = 4194304;
+    static const int SENDFILE_TIMEOUT_SECONDS = 30;
+    static bool openLocalFile(MegaHTTPContext *httpctx);
+    static void sendLocalFile(MegaHTTPContext *httpctx);
+    static void sendLocalFileWork(uv_work_t *req);
+    static void onLocalFileSent(uv_work_t *req, int status);
+
+    // persistent connections
+    static const size_t MAX_PIPELINED_SIZE = 65536;
+    static std::string connectionHeader(MegaHTTPContext *httpctx);
+    void finishResponse(MegaHTTPContext *httpctx);
+    void processNextRequest(MegaHTTPContext *httpctx);
+
+    // multiple ranges
+    static const size_t MAX_BYTE_RANGES = 32;
+    static bool parseByteRanges(const std::string &value, std::vector<std::pair<m_off_t, m_off_t>> &ranges);
+    static void streamRanges(MegaHTTPContext *httpctx, const char *mimeType);
+
     //Utility funcitons
     static std::string getHTTPMethodName(int httpmethod);
     static std::string getHTTPErrorString(int errorcode);
@@ -3608,7 +4016,9 @@ protected:
 
     // WEBDAV related
     static std::string getWebDavPropFindResponseForNode(std::string baseURL, std::string subnodepath, MegaNode *node, MegaHTTPContext* httpctx);
-    static std::string getWebDavProfFindNodeContents(MegaNode *node, std::string baseURL, bool offlineAttribute);
+    static void writeWebDavPropFindNodeContents(std::ostream &web, MegaNode *node, const std::string &baseURL, bool offlineAttribute);
+    bool getCachedPropFind(handle h, const std::string &key, std::string &body, unsigned &generation);
+    void cachePropFind(handle h, const std::string &key, const std::string &body, unsigned generation);
 
     static void returnHttpCodeBasedOnRequestError(MegaHTTPContext* httpctx, MegaError *e, bool synchronous = true);
     static void returnHttpCode(MegaHTTPContext* httpctx, int errorCode, std::string errorMessage = string(), bool synchronous = true);
@@ -3635,6 +4045,9 @@ public:
     bool isSubtitlesSupportEnabled();
     void enableSubtitlesSupport(bool enable);
 
+    // drop the cached PROPFIND responses of the nodes (all of them if NULL)
+    void nodesUpdated(Node **n, int count);
+
 };
 
 class MegaFTPServer;
@@ -3765,6 +4178,11 @@ public:
     std::string cdup(handle parentHandle, MegaFTPContext* ftpctx);
     std::string cd(string newpath, MegaFTPContext* ftpctx);
     std::string shortenpath(std::string path);
+
+    // the defaults for the data connections, larger than those of the HTTP server: each one
+    // streams a whole file, and a full buffer pauses it until half of it is sent
+    static const int DATA_BUFFER_SIZE = 8388608;
+    static const int DATA_OUTPUT_SIZE = 1048576;
 };
 
 class MegaFTPDataContext;
@@ -3828,6 +4246,11 @@ public:
     std::unique_ptr<FileAccess> tmpFileAccess;
     size_t tmpFileSize;
 
+    // what STOR received, written to the temporary file in blocks of STOR_WRITE_SIZE
+    std::string storBuffer;
+    static const size_t STOR_WRITE_SIZE = 4194304;
+    bool flushStorBuffer();
+
     bool controlRespondedElsewhere;
     string controlResponseMessage;
     int controlResponseCode;
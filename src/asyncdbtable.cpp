@@ -0,0 +1,549 @@
+/**
+ * @file asyncdbtable.cpp
+ * @brief Database table whose commits are written by a thread of its own
+ *
+ * (c) 2013-2021 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <algorithm>
+
+#include "mega/asyncdbtable.h"
+#include "mega/filefingerprint.h"
+#include "mega/logging.h"
+#include "mega/threadconfig.h"
+
+namespace mega {
+
+void AsyncDbTable::Changes::merge(Changes&& later)
+{
+    if (later.truncate)
+    {
+        *this = std::move(later);
+        return;
+    }
+
+    for (auto& record : later.records)
+    {
+        records[record.first] = std::move(record.second);
+        columns.erase(record.first);
+    }
+
+    for (auto& node : later.columns)
+    {
+        columns[node.first] = std::move(node.second);
+    }
+
+    indexComplete |= later.indexComplete;
+}
+
+bool AsyncDbTable::Changes::lookup(uint32_t id, string* data, bool* found) const
+{
+    auto it = records.find(id);
+
+    if (it != records.end())
+    {
+        *found = it->second != nullptr;
+        if (*found)
+        {
+            *data = *it->second;
+        }
+        return true;
+    }
+
+    if (truncate)
+    {
+        *found = false;
+        return true;
+    }
+
+    return false;
+}
+
+AsyncDbTable::AsyncDbTable(PrnGen& rng, std::unique_ptr<DbTable> table)
+    : DbTable(rng, false)
+    , mTable(std::move(table))
+    , mFailed(false)
+{
+    try
+    {
+        mWriter = std::thread([this]()
+        {
+            ThreadConfig::apply(THREAD_ROLE_BACKGROUND);
+            writerLoop();
+        });
+        mThreaded = true;
+    }
+    catch (std::system_error& e)
+    {
+        LOG_err << "Failed to start the database writer thread, writing synchronously: " << e.what();
+    }
+}
+
+AsyncDbTable::~AsyncDbTable()
+{
+    resetCommitter();
+
+    if (mThreaded)
+    {
+        {
+            std::lock_guard<std::mutex> g(mMutex);
+            mStop = true;
+        }
+        mCondition.notify_all();
+        mWriter.join();
+    }
+}
+
+void AsyncDbTable::writerLoop()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    for (;;)
+    {
+        mCondition.wait(lock, [this]() { return mStop || !mCommitted.empty(); });
+
+        if (mCommitted.empty())
+        {
+            return;
+        }
+
+        mWriting = std::move(mCommitted);
+        mCommitted = Changes();
+
+        // get() may read mWriting meanwhile, but nothing changes it until the lock is back
+        lock.unlock();
+        write(mWriting);
+        lock.lock();
+
+        mWriting = Changes();
+        mCondition.notify_all();
+    }
+}
+
+void AsyncDbTable::write(const Changes& changes)
+{
+    if (mFailed)
+    {
+        // what follows a lost transaction would leave the table inconsistent
+        return;
+    }
+
+    RecordBatch puts;
+    NodeRecordBatch nodePuts;
+    vector<uint32_t> dels;
+
+    for (auto& record : changes.records)
+    {
+        auto node = changes.columns.find(record.first);
+
+        if (!record.second)
+        {
+            dels.push_back(record.first);
+        }
+        else if (node != changes.columns.end())
+        {
+            nodePuts.push_back(DbNodeRecord{record.first, node->second, *record.second});
+        }
+        else
+        {
+            puts.emplace_back(record.first, *record.second);
+        }
+    }
+
+    std::lock_guard<std::mutex> g(mTableMutex);
+
+    mTable->begin();
+
+    if (changes.truncate)
+    {
+        mTable->truncate();
+    }
+
+    if (mTable->delBatch(dels) && mTable->putBatch(puts) && mTable->putNodeBatch(nodePuts))
+    {
+        if (changes.indexComplete)
+        {
+            mTable->setNodeIndexComplete();
+        }
+
+        mTable->commit();
+    }
+    else
+    {
+        LOG_err << "Unable to write " << puts.size() + nodePuts.size() << " records and " << dels.size() << " deletions to the database";
+        mTable->abort();
+        mFailed = true;
+    }
+}
+
+// hand the changes of the transaction just committed to the writer
+void AsyncDbTable::enqueue()
+{
+    if (mCurrent.empty())
+    {
+        return;
+    }
+
+    if (!mThreaded)
+    {
+        write(mCurrent);
+    }
+    else
+    {
+        {
+            std::lock_guard<std::mutex> g(mMutex);
+            mCommitted.merge(std::move(mCurrent));
+        }
+        mCondition.notify_all();
+    }
+
+    mCurrent = Changes();
+    mScanningCurrent = false;
+}
+
+void AsyncDbTable::flush()
+{
+    if (mThreaded)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait(lock, [this]() { return mCommitted.empty() && mWriting.empty(); });
+    }
+}
+
+void AsyncDbTable::rewind()
+{
+    flush();
+
+    {
+        std::lock_guard<std::mutex> g(mTableMutex);
+        mTable->rewind();
+    }
+
+    mScanningTable = !mCurrent.truncate;
+    mScanningCurrent = true;
+    mScanPos = mCurrent.records.begin();
+}
+
+bool AsyncDbTable::next(uint32_t* id, string* data)
+{
+    while (mScanningTable)
+    {
+        bool more;
+        {
+            std::lock_guard<std::mutex> g(mTableMutex);
+            more = mTable->next(id, data);
+        }
+
+        if (!more)
+        {
+            mScanningTable = false;
+        }
+        else if (mCurrent.records.find(*id) == mCurrent.records.end())
+        {
+            return true;
+        }
+        // else changed by the current transaction: returned below if still there
+    }
+
+    for (; mScanningCurrent && mScanPos != mCurrent.records.end(); ++mScanPos)
+    {
+        if (mScanPos->second)
+        {
+            *id = mScanPos->first;
+            *data = *mScanPos->second;
+            ++mScanPos;
+            return true;
+        }
+    }
+
+    mScanningCurrent = false;
+    return false;
+}
+
+bool AsyncDbTable::get(uint32_t id, string* data)
+{
+    bool found;
+
+    if (mCurrent.lookup(id, data, &found))
+    {
+        return found;
+    }
+
+    {
+        std::lock_guard<std::mutex> g(mMutex);
+
+        if (mCommitted.lookup(id, data, &found) || mWriting.lookup(id, data, &found))
+        {
+            return found;
+        }
+    }
+
+    std::lock_guard<std::mutex> g(mTableMutex);
+    return mTable->get(id, data);
+}
+
+bool AsyncDbTable::put(uint32_t id, char* data, unsigned size)
+{
+    if (mFailed)
+    {
+        return false;
+    }
+
+    mCurrent.records[id].reset(new string(data, size));
+    mCurrent.columns.erase(id);
+
+    if (!mInTransaction)
+    {
+        enqueue();
+    }
+    return true;
+}
+
+bool AsyncDbTable::del(uint32_t id)
+{
+    if (mFailed)
+    {
+        return false;
+    }
+
+    mCurrent.records[id].reset();
+    mCurrent.columns.erase(id);
+
+    if (!mInTransaction)
+    {
+        enqueue();
+    }
+    return true;
+}
+
+bool AsyncDbTable::putBatch(const RecordBatch& batch)
+{
+    if (mFailed)
+    {
+        return false;
+    }
+
+    for (auto& record : batch)
+    {
+        mCurrent.records[record.first].reset(new string(record.second));
+        mCurrent.columns.erase(record.first);
+    }
+
+    if (!mInTransaction)
+    {
+        enqueue();
+    }
+    return true;
+}
+
+bool AsyncDbTable::delBatch(const vector<uint32_t>& ids)
+{
+    if (mFailed)
+    {
+        return false;
+    }
+
+    for (uint32_t id : ids)
+    {
+        mCurrent.records[id].reset();
+        mCurrent.columns.erase(id);
+    }
+
+    if (!mInTransaction)
+    {
+        enqueue();
+    }
+    return true;
+}
+
+bool AsyncDbTable::putNodeRecord(const DbNodeRecord& record)
+{
+    if (mFailed)
+    {
+        return false;
+    }
+
+    mCurrent.records[record.id].reset(new string(record.data));
+    mCurrent.columns[record.id] = record.columns;
+
+    if (!mInTransaction)
+    {
+        enqueue();
+    }
+    return true;
+}
+
+bool AsyncDbTable::query(const std::function<bool(DbTable&, NodeRefs*)>& inTable,
+                         const std::function<bool(const DbNodeColumns&)>& matches, NodeRefs* refs)
+{
+    refs->clear();
+
+    if (!mCurrent.truncate)
+    {
+        flush();
+
+        std::lock_guard<std::mutex> g(mTableMutex);
+        if (!inTable(*mTable, refs))
+        {
+            return false;
+        }
+    }
+
+    // records changed by the current transaction are returned as they are there
+    refs->erase(std::remove_if(refs->begin(), refs->end(), [this](const NodeRefs::value_type& ref)
+    {
+        return mCurrent.records.count(ref.first) > 0;
+    }), refs->end());
+
+    for (auto& node : mCurrent.columns)
+    {
+        if (matches(node.second))
+        {
+            refs->emplace_back(node.first, node.second.nodehandle);
+        }
+    }
+
+    return true;
+}
+
+bool AsyncDbTable::getChildren(handle parent, NodeRefs* refs)
+{
+    return query([parent](DbTable& table, NodeRefs* found) { return table.getChildren(parent, found); },
+                 [parent](const DbNodeColumns& columns) { return columns.parenthandle == parent; },
+                 refs);
+}
+
+bool AsyncDbTable::getByFingerprint(const FileFingerprint& fingerprint, NodeRefs* refs)
+{
+    string serialized;
+    fingerprint.serializefingerprint(&serialized);
+
+    return query([&fingerprint](DbTable& table, NodeRefs* found) { return table.getByFingerprint(fingerprint, found); },
+                 [&](const DbNodeColumns& columns) { return columns.size == fingerprint.size && columns.fingerprint == serialized; },
+                 refs);
+}
+
+bool AsyncDbTable::nodeIndexComplete()
+{
+    if (mCurrent.truncate || mCurrent.indexComplete)
+    {
+        return true;
+    }
+
+    flush();
+
+    std::lock_guard<std::mutex> g(mTableMutex);
+    return mTable->nodeIndexComplete();
+}
+
+void AsyncDbTable::setNodeIndexComplete()
+{
+    mCurrent.indexComplete = true;
+
+    if (!mInTransaction)
+    {
+        enqueue();
+    }
+}
+
+// space is reclaimed between the writer's transactions
+int64_t AsyncDbTable::reclaimableBytes()
+{
+    std::lock_guard<std::mutex> g(mTableMutex);
+    return mTable->reclaimableBytes();
+}
+
+int64_t AsyncDbTable::reclaimSpace(int64_t maxBytes)
+{
+    std::lock_guard<std::mutex> g(mTableMutex);
+    return mTable->reclaimSpace(maxBytes);
+}
+
+bool AsyncDbTable::vacuum()
+{
+    if (mInTransaction)
+    {
+        return false;
+    }
+
+    flush();
+
+    std::lock_guard<std::mutex> g(mTableMutex);
+    return mTable->vacuum();
+}
+
+void AsyncDbTable::truncate()
+{
+    mCurrent.truncate = true;
+    mCurrent.records.clear();
+    mCurrent.columns.clear();
+    mScanningCurrent = false;
+
+    if (!mInTransaction)
+    {
+        enqueue();
+    }
+}
+
+void AsyncDbTable::begin()
+{
+    mInTransaction = true;
+}
+
+void AsyncDbTable::commit()
+{
+    enqueue();
+    mInTransaction = false;
+}
+
+void AsyncDbTable::abort()
+{
+    mCurrent = Changes();
+    mScanningCurrent = false;
+    mInTransaction = false;
+}
+
+void AsyncDbTable::remove()
+{
+    flush();
+
+    mCurrent = Changes();
+    mScanningCurrent = false;
+    mInTransaction = false;
+
+    std::lock_guard<std::mutex> g(mTableMutex);
+    mTable->remove();
+}
+
+void AsyncDbTable::removeLater(vector<LocalPath>& files)
+{
+    flush();
+
+    mCurrent = Changes();
+    mScanningCurrent = false;
+    mInTransaction = false;
+
+    std::lock_guard<std::mutex> g(mTableMutex);
+    mTable->removeLater(files);
+}
+
+bool AsyncDbTable::inTransaction() const
+{
+    return mInTransaction;
+}
+
+} // namespace
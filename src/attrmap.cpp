@@ -22,6 +22,66 @@
 #include "mega/attrmap.h"
 
 namespace mega {
+FlatAttrMap::FlatAttrMap(std::initializer_list<value_type> values)
+{
+    for (const value_type& value : values)
+    {
+        insert(value);
+    }
+}
+
+FlatAttrMap::iterator FlatAttrMap::position(nameid name)
+{
+    return std::lower_bound(mEntries.begin(), mEntries.end(), name,
+                            [](const value_type& entry, nameid n) { return entry.first < n; });
+}
+
+FlatAttrMap::iterator FlatAttrMap::find(nameid name)
+{
+    iterator it = position(name);
+    return it != mEntries.end() && it->first == name ? it : mEntries.end();
+}
+
+FlatAttrMap::const_iterator FlatAttrMap::find(nameid name) const
+{
+    return const_cast<FlatAttrMap*>(this)->find(name);
+}
+
+string& FlatAttrMap::operator[](nameid name)
+{
+    return emplace(name, string()).first->second;
+}
+
+std::pair<FlatAttrMap::iterator, bool> FlatAttrMap::insert(const value_type& value)
+{
+    return emplace(value.first, value.second);
+}
+
+std::pair<FlatAttrMap::iterator, bool> FlatAttrMap::emplace(nameid name, string value)
+{
+    iterator it = position(name);
+
+    if (it != mEntries.end() && it->first == name)
+    {
+        return std::make_pair(it, false);
+    }
+
+    return std::make_pair(mEntries.emplace(it, name, std::move(value)), true);
+}
+
+size_t FlatAttrMap::erase(nameid name)
+{
+    iterator it = find(name);
+
+    if (it == mEntries.end())
+    {
+        return 0;
+    }
+
+    mEntries.erase(it);
+    return 1;
+}
+
 // approximate raw storage size of serialized AttrMap, not taking JSON escaping
 // or name length into account
 unsigned AttrMap::storagesize(int perrecord) const
@@ -158,19 +218,25 @@ const char* AttrMap::unserialize(const char* ptr , const char *end)
 
 // generate JSON object containing attr_map
 void AttrMap::getjson(string* s) const
+{
+    s->erase();
+    appendjson(s);
+}
+
+void AttrMap::appendjson(string* s) const
 {
     nameid id;
     char buf[8];
     const char* ptr;
     const char* pptr;
+    size_t start = s->size();
 
     // reserve estimated size of final string
-    s->erase();
-    s->reserve(storagesize(20));
+    s->reserve(start + storagesize(20));
 
     for (attr_map::const_iterator it = map.begin(); it != map.end(); it++)
     {
-        s->append(s->size() ? ",\"" : "\"");
+        s->append(s->size() > start ? ",\"" : "\"");
 
         if ((id = it->first))
         {
@@ -137,6 +137,210 @@ TimerWithBackoff::TimerWithBackoff(PrnGen &rng, int tag)
 }
 
 
+TimerWheel::TimerWheel(dstime now)
+    : mNow(now)
+{
+}
+
+static int lowestbit(uint64_t bits)
+{
+    int i = 0;
+    while (!(bits & 1))
+    {
+        bits >>= 1;
+        i++;
+    }
+    return i;
+}
+
+void TimerWheel::link(Entry* e, Entry** list, int level, int slot)
+{
+    e->mPrev = nullptr;
+    e->mNext = *list;
+    if (*list)
+    {
+        (*list)->mPrev = e;
+    }
+    *list = e;
+
+    e->mList = list;
+    e->mLevel = level;
+    e->mSlot = slot;
+    if (level >= 0)
+    {
+        mOccupied[level] |= uint64_t(1) << slot;
+    }
+}
+
+// in the lowest level whose slot for the deadline is still to come in the current round
+void TimerWheel::place(Entry* e)
+{
+    dstime d = e->mDeadline;
+    if (d <= mNow)
+    {
+        link(e, &mDue, -1, 0);
+        return;
+    }
+
+    for (int level = 0; level < LEVELS; level++)
+    {
+        int shift = SLOTBITS * (level + 1);
+        if ((d >> shift) == (mNow >> shift))
+        {
+            int slot = int((d >> (SLOTBITS * level)) & (SLOTS - 1));
+            link(e, &mSlots[level][slot], level, slot);
+            return;
+        }
+    }
+
+    link(e, &mOverflow, -1, 0);
+}
+
+void TimerWheel::add(Entry* e, dstime deadline)
+{
+    remove(e);
+
+    e->mDeadline = deadline;
+    place(e);
+    mCount++;
+}
+
+void TimerWheel::remove(Entry* e)
+{
+    if (!e->mList)
+    {
+        return;
+    }
+
+    if (e->mPrev)
+    {
+        e->mPrev->mNext = e->mNext;
+    }
+    else
+    {
+        *e->mList = e->mNext;
+    }
+
+    if (e->mNext)
+    {
+        e->mNext->mPrev = e->mPrev;
+    }
+
+    if (e->mLevel >= 0 && !*e->mList)
+    {
+        mOccupied[e->mLevel] &= ~(uint64_t(1) << e->mSlot);
+    }
+
+    e->mPrev = e->mNext = nullptr;
+    e->mList = nullptr;
+    mCount--;
+}
+
+// the time has reached a slot of this level: its entries go down (the slot of the level above first,
+// if this one starts a new round)
+void TimerWheel::cascade(int level)
+{
+    int slot = int((mNow >> (SLOTBITS * level)) & (SLOTS - 1));
+    if (!slot)
+    {
+        if (level + 1 < LEVELS)
+        {
+            cascade(level + 1);
+        }
+        else
+        {
+            Entry* e = mOverflow;
+            mOverflow = nullptr;
+            while (e)
+            {
+                Entry* next = e->mNext;
+                place(e);
+                e = next;
+            }
+        }
+    }
+
+    Entry* e = mSlots[level][slot];
+    mSlots[level][slot] = nullptr;
+    mOccupied[level] &= ~(uint64_t(1) << slot);
+    while (e)
+    {
+        Entry* next = e->mNext;
+        place(e);
+        e = next;
+    }
+}
+
+dstime TimerWheel::next() const
+{
+    return mDue ? mNow : nextstep();
+}
+
+// the next time with anything to move in the wheel: its first slot of the lowest level with any ahead
+dstime TimerWheel::nextstep() const
+{
+    for (int level = 0; level < LEVELS; level++)
+    {
+        int slot = int((mNow >> (SLOTBITS * level)) & (SLOTS - 1));
+        uint64_t ahead = slot == SLOTS - 1 ? 0 : mOccupied[level] & (~uint64_t(0) << (slot + 1));
+        if (ahead)
+        {
+            int shift = SLOTBITS * (level + 1);
+            return ((mNow >> shift) << shift) + (dstime(lowestbit(ahead)) << (SLOTBITS * level));
+        }
+    }
+
+    if (mOverflow)
+    {
+        int shift = SLOTBITS * LEVELS;
+        return ((mNow >> shift) + 1) << shift;
+    }
+
+    return NEVER;
+}
+
+// straight to each time when there is something to do, however long since the last call
+void TimerWheel::advance(dstime now)
+{
+    while (mNow < now)
+    {
+        dstime t = nextstep();
+        if (t == NEVER || t > now)
+        {
+            mNow = now;
+            break;
+        }
+
+        mNow = t;
+        if (!(t & (SLOTS - 1)))
+        {
+            cascade(1);
+        }
+
+        int slot = int(t & (SLOTS - 1));
+        Entry* e = mSlots[0][slot];
+        mSlots[0][slot] = nullptr;
+        mOccupied[0] &= ~(uint64_t(1) << slot);
+        while (e)
+        {
+            Entry* next = e->mNext;
+            link(e, &mDue, -1, 0);
+            e = next;
+        }
+    }
+}
+
+void BackoffTimerGroupTracker::add(BackoffTimerTracked* bt, TimerWheel::Entry* e)
+{
+    if (!timeouts.size())
+    {
+        // the time may have gone a long way since it was last used
+        timeouts.advance(Waiter::ds);
+    }
+
+    timeouts.add(e, bt->nextset() ? bt->nextset() : NEVER);
+}
+
 void BackoffTimerGroupTracker::update(dstime* waituntil, bool transfers)
 {
     // This function performs a similar action as calling BackoffTimer::update for all the timers in the group,
@@ -144,8 +348,14 @@ void BackoffTimerGroupTracker::update(dstime* waituntil, bool transfers)
     // wake up from any of the timers in this group, should any of them be in a back-off state.
     // There are also some side-effects specfic to transfers which are preserved from the old system.
 
+    timeouts.advance(Waiter::ds);
+
+    // put the ones to work on in a vector, as working on them moves them in the wheel
     vector<BackoffTimerTracked*> v;
-    v.reserve(timeouts.size());
+    timeouts.due([&v](TimerWheel::Entry* e)
+    {
+        v.push_back(static_cast<BackoffTimerTracked*>(e->owner));
+    });
 
     if (transfers)
     {
@@ -165,19 +375,6 @@ void BackoffTimerGroupTracker::update(dstime* waituntil, bool transfers)
         //    }
         //}
 
-        for (auto t : timeouts)
-        {
-            // put the ones to work on in a vector, as working on them changes their position in the map
-            if (t.first <= Waiter::ds)
-            {
-                v.push_back(t.second);
-            }
-            else
-            {
-                break;
-            }
-        }
-
         for (auto t : v)
         {
             t->update(waituntil);
@@ -188,7 +385,6 @@ void BackoffTimerGroupTracker::update(dstime* waituntil, bool transfers)
                 LOG_debug << "Disabling armed transfer backoff";
             }
         }
-
     }
     else
     {
@@ -201,25 +397,21 @@ void BackoffTimerGroupTracker::update(dstime* waituntil, bool transfers)
         //    }
         //}
 
-        // put the ones to work on in a vector, as working on them changes their position in the map
-        for (auto t : timeouts)
-        {
-            if (t.second->armed())
-            {
-                v.push_back(t.second);
-            }
-            if (t.first > Waiter::ds)
-            {
-                break;
-            }
-        }
-
         for (auto t : v)
         {
             // update may set next=1 so we can't just call the first one.
-            t->update(waituntil);
+            if (t->armed())
+            {
+                t->update(waituntil);
+            }
         }
+    }
 
+    // and the soonest of those still to come, as their update() would
+    dstime next = timeouts.next();
+    if (next > Waiter::ds && next < *waituntil)
+    {
+        *waituntil = next;
     }
 }
 
@@ -22,65 +22,128 @@
 #include "mega/base64.h"
 #include "mega/utils.h"
 
-namespace mega {
-// modified base64 conversion (no trailing '=' and '-_' instead of '+/')
-unsigned char Base64::to64(byte c)
-{
-    c &= 63;
-
-    if (c < 26)
-    {
-        return c + 'A';
-    }
-
-    if (c < 52)
-    {
-        return c - 26 + 'a';
-    }
+#include <cstring>
 
-    if (c < 62)
-    {
-        return c - 52 + '0';
-    }
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MEGA_BASE64_SSSE3 1
+#define MEGA_BASE64_SSSE3_TARGET __attribute__((target("ssse3")))
+#endif
 
-    if (c == 62)
-    {
-        return '-';
-    }
+namespace mega {
+namespace {
 
-    return '_';
+// modified base64 conversion (no trailing '=' and '-_' instead of '+/')
+const char alphabet64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+// the values of the base64 characters, 255 for the rest ('+' and '/' are read as '-' and '_')
+const byte values64[256] = {
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  62, 255,  62, 255,  63,
+     52,  53,  54,  55,  56,  57,  58,  59,  60,  61, 255, 255, 255, 255, 255, 255,
+    255,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14,
+     15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25, 255, 255, 255, 255,  63,
+    255,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,
+     41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255
+};
+
+#ifdef MEGA_BASE64_SSSE3
+// the SSSE3 code needs a runtime check, as it is not in the x86-64 baseline.  Before this is
+// initialized, in static constructors, it is false and the table-driven code is used
+const bool hasssse3 = (__builtin_cpu_init(), __builtin_cpu_supports("ssse3") != 0);
+
+// encode 12 bytes (of the 16 read) into 16 characters
+MEGA_BASE64_SSSE3_TARGET void btoa12(const byte* b, char* a)
+{
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+
+    // each 32-bit lane gets the 3 bytes of 4 characters, and their 6-bit values are moved to
+    // one byte each (see W. Mula, "Base64 encoding with SIMD instructions")
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+    __m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+    __m128i indices = _mm_or_si128(t0, t1);
+
+    // the offset from each value to its character, by range: 0 for 'A'-'Z' (13), 1-10 for the
+    // digits, 11 for '-' and 12 for '_', 0 again for 'a'-'z'
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '-' - 62, '_' - 63, 'A', 0, 0);
+
+    __m128i out = _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(a), out);
 }
 
-unsigned char Base64::from64(byte c)
+inline __m128i inrange(__m128i c, char lo, char hi)
 {
-    if ((c >= 'A') && (c <= 'Z'))
-    {
-        return c - 'A';
-    }
+    return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(char(lo - 1))), _mm_cmplt_epi8(c, _mm_set1_epi8(char(hi + 1))));
+}
 
-    if ((c >= 'a') && (c <= 'z'))
+// decode 16 characters into 12 bytes (of the 16 written).  False, and nothing written, if any
+// of them is not a base64 character
+MEGA_BASE64_SSSE3_TARGET bool atob16(const char* a, byte* b)
+{
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+
+    // signed compares: the characters from 128 on are in no range
+    __m128i upper = inrange(c, 'A', 'Z');
+    __m128i lower = inrange(c, 'a', 'z');
+    __m128i digit = inrange(c, '0', '9');
+    __m128i minus = _mm_cmpeq_epi8(c, _mm_set1_epi8('-'));
+    __m128i plus = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+    __m128i underscore = _mm_cmpeq_epi8(c, _mm_set1_epi8('_'));
+    __m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+
+    __m128i valid = _mm_or_si128(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, minus)),
+                                 _mm_or_si128(plus, _mm_or_si128(underscore, slash)));
+    if (_mm_movemask_epi8(valid) != 0xffff)
     {
-        return c - 'a' + 26;
+        return false;
     }
 
-    if ((c >= '0') && (c <= '9'))
-    {
-        return c - '0' + 52;
-    }
+    // the ranges don't overlap: the offset from each character to its value is one of these
+    __m128i offset = _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')),
+                                  _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+    offset = _mm_or_si128(offset, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+    offset = _mm_or_si128(offset, _mm_and_si128(minus, _mm_set1_epi8(62 - '-')));
+    offset = _mm_or_si128(offset, _mm_and_si128(plus, _mm_set1_epi8(62 - '+')));
+    offset = _mm_or_si128(offset, _mm_and_si128(underscore, _mm_set1_epi8(char(63 - '_'))));
+    offset = _mm_or_si128(offset, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+    __m128i values = _mm_add_epi8(c, offset);
+
+    // join the 6-bit values in pairs, then the pairs, into 24 bits per 32-bit lane
+    __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    __m128i lanes = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+
+    __m128i out = _mm_shuffle_epi8(lanes, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(b), out);
+    return true;
+}
+#endif
 
-    if (c == '-' || c == '+')
-    {
-        return 62;
-    }
+} // namespace
 
-    if (c == '_' || c == '/')
-    {
-        return 63;
-    }
+bool Base64::vectorcodec = true;
 
-    return 255;
+byte Base64::to64(byte c)
+{
+    return byte(alphabet64[c & 63]);
 }
 
+byte Base64::from64(byte c)
+{
+    return values64[c];
+}
 
 int Base64::atob(const string &in, string &out)
 {
@@ -101,43 +164,79 @@ std::string Base64::atob(const std::string &in)
 
 int Base64::atob(const char* a, byte* b, int blen)
 {
-    byte c[4];
-    int i;
     int p = 0;
 
-    c[3] = 0;
-
-    for (;;)
+#ifdef MEGA_BASE64_SSSE3
+    if (vectorcodec && hasssse3 && blen >= 16)
     {
-        for (i = 0; i < 4; i++)
+        // the 16 characters read at a time must be before the end of the string (memchr()
+        // reads no further than the first match)
+        size_t maxlen = size_t(blen) / 3 * 4;
+        const void* end = memchr(a, 0, maxlen);
+        size_t len = end ? size_t(static_cast<const char*>(end) - a) : maxlen;
+
+        for (; len >= 16 && blen - p >= 16 && atob16(a, b + p); len -= 16)
         {
-            if ((c[i] = from64(*a++)) == 255)
-            {
-                break;
-            }
+            a += 16;
+            p += 12;
         }
+    }
+#endif
 
-        if ((p >= blen) || !i)
+    // whole groups of 4 characters
+    const byte* s = reinterpret_cast<const byte*>(a);
+    while (blen - p >= 3)
+    {
+        byte c0 = values64[s[0]];
+        byte c1 = c0 == 255 ? 255 : values64[s[1]];
+        byte c2 = c1 == 255 ? 255 : values64[s[2]];
+        byte c3 = c2 == 255 ? 255 : values64[s[3]];
+        if (c3 == 255)
         {
-            return p;
+            break;
         }
 
-        b[p++] = (c[0] << 2) | ((c[1] & 0x30) >> 4);
+        b[p++] = byte((c0 << 2) | (c1 >> 4));
+        b[p++] = byte((c1 << 4) | (c2 >> 2));
+        b[p++] = byte((c2 << 6) | c3);
+        s += 4;
+    }
 
-        if ((p >= blen) || (i < 3))
-        {
-            return p;
-        }
+    // and the last, short or cut by blen
+    byte c[4];
+    int i;
 
-        b[p++] = (c[1] << 4) | ((c[2] & 0x3c) >> 2);
+    c[3] = 0;
 
-        if ((p >= blen) || (i < 4))
+    for (i = 0; i < 4; i++)
+    {
+        if ((c[i] = values64[*s++]) == 255)
         {
-            return p;
+            break;
         }
+    }
+
+    if ((p >= blen) || !i)
+    {
+        return p;
+    }
+
+    b[p++] = (c[0] << 2) | ((c[1] & 0x30) >> 4);
+
+    if ((p >= blen) || (i < 3))
+    {
+        return p;
+    }
 
-        b[p++] = (c[2] << 6) | c[3];
+    b[p++] = (c[1] << 4) | ((c[2] & 0x3c) >> 2);
+
+    if ((p >= blen) || (i < 4))
+    {
+        return p;
     }
+
+    b[p++] = (c[2] << 6) | c[3];
+    return p;
 }
 
 void Base64::itoa(int64_t val, string *result)
@@ -225,32 +324,38 @@ int Base64::btoa(const byte* b, int blen, char* a)
 {
     int p = 0;
 
-    for (;;)
+#ifdef MEGA_BASE64_SSSE3
+    if (vectorcodec && hasssse3)
     {
-        if (blen <= 0)
+        // 16 bytes are read for each 12
+        for (; blen >= 16; blen -= 12)
         {
-            break;
+            btoa12(b, a + p);
+            b += 12;
+            p += 16;
         }
+    }
+#endif
 
-        a[p++] = to64(*b >> 2);
-        a[p++] = to64((*b << 4) | (((blen > 1) ? b[1] : 0) >> 4));
-
-        if (blen < 2)
-        {
-            break;
-        }
+    for (; blen >= 3; blen -= 3)
+    {
+        uint32_t v = (uint32_t(b[0]) << 16) | (uint32_t(b[1]) << 8) | b[2];
+        a[p++] = alphabet64[v >> 18];
+        a[p++] = alphabet64[(v >> 12) & 63];
+        a[p++] = alphabet64[(v >> 6) & 63];
+        a[p++] = alphabet64[v & 63];
+        b += 3;
+    }
 
-        a[p++] = to64(b[1] << 2 | (((blen > 2) ? b[2] : 0) >> 6));
+    if (blen > 0)
+    {
+        a[p++] = alphabet64[b[0] >> 2];
+        a[p++] = alphabet64[((b[0] << 4) | ((blen > 1) ? b[1] >> 4 : 0)) & 63];
 
-        if (blen < 3)
+        if (blen > 1)
         {
-            break;
+            a[p++] = alphabet64[(b[1] << 2) & 63];
         }
-
-        a[p++] = to64(b[2]);
-
-        blen -= 3;
-        b += 3;
     }
 
     a[p] = 0;
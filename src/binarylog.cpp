@@ -0,0 +1,457 @@
+/**
+ * @file binarylog.cpp
+ * @brief Log records in a binary form, buffered in lock-free rings per thread
+ *
+ * (c) 2013-2021 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <sstream>
+#include <thread>
+
+#include "mega/binarylog.h"
+#include "mega/logging.h"
+
+namespace mega {
+
+namespace {
+
+// the size, then the type
+const size_t RECORDHEADER = 5;
+
+// a long message is cut to this part of the ring, so that a few always fit
+const size_t MAXRECORDSHARE = 4;
+
+void put(char* p, uint64_t v, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+    {
+        p[i] = char(v >> (8 * i));
+    }
+}
+
+uint64_t get(const char* p, int bytes)
+{
+    uint64_t v = 0;
+    for (int i = bytes; i--; )
+    {
+        v = (v << 8) | uint8_t(p[i]);
+    }
+    return v;
+}
+
+void appendRecord(std::string& out, BinaryLog::RecordType type, const char* fields, size_t fieldsSize, const char* text, size_t textSize)
+{
+    char header[RECORDHEADER];
+    put(header, uint64_t(1 + fieldsSize + textSize), 4);
+    header[4] = char(type);
+    out.append(header, RECORDHEADER);
+    out.append(fields, fieldsSize);
+    out.append(text, textSize);
+}
+
+void appendThread(std::string& out, uint16_t thread, const std::string& name)
+{
+    char fields[2];
+    put(fields, thread, 2);
+    appendRecord(out, BinaryLog::THREAD, fields, sizeof fields, name.data(), name.size());
+}
+
+uint64_t microsecondsNow()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+// the last writer and ring of this thread, so that it finds them without a lock.  Writers are
+// never given the id of another, so a cache of one that's gone never matches
+struct ThreadRingCache
+{
+    uint64_t writer;
+    BinaryLogRing* ring;
+};
+
+#ifdef WIN32
+thread_local ThreadRingCache threadRingCache = { 0, nullptr };
+#else
+__thread ThreadRingCache threadRingCache = { 0, nullptr };
+#endif
+
+std::atomic<uint64_t> nextWriterId{1};
+
+} // anonymous
+
+BinaryLogRing::BinaryLogRing(size_t bytes)
+    : mHead(0)
+    , mTail(0)
+    , mDropped(0)
+{
+    size_t size = 64;
+    while (size < bytes)
+    {
+        size <<= 1;
+    }
+    mBuffer.resize(size);
+    mMask = size - 1;
+}
+
+bool BinaryLogRing::push(const Piece* pieces, int count)
+{
+    size_t total = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        total += pieces[i].size;
+    }
+
+    // only this thread moves the head
+    size_t head = mHead.load(std::memory_order_relaxed);
+    size_t tail = mTail.load(std::memory_order_acquire);
+    if (total > mBuffer.size() - (head - tail))
+    {
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        size_t pos = head & mMask;
+        size_t first = std::min(pieces[i].size, mBuffer.size() - pos);
+        memcpy(&mBuffer[pos], pieces[i].data, first);
+        memcpy(&mBuffer[0], pieces[i].data + first, pieces[i].size - first);
+        head += pieces[i].size;
+    }
+
+    mHead.store(head, std::memory_order_release);
+    return true;
+}
+
+size_t BinaryLogRing::drain(std::string& out, uint16_t thread)
+{
+    size_t tail = mTail.load(std::memory_order_relaxed);
+    size_t head = mHead.load(std::memory_order_acquire);
+    size_t n = head - tail;
+
+    size_t pos = tail & mMask;
+    size_t first = std::min(n, mBuffer.size() - pos);
+    out.append(&mBuffer[pos], first);
+    out.append(&mBuffer[0], n - first);
+
+    mTail.store(head, std::memory_order_release);
+
+    if (uint64_t dropped = mDropped.exchange(0, std::memory_order_relaxed))
+    {
+        char fields[10];
+        put(fields, thread, 2);
+        put(fields + 2, dropped, 8);
+        appendRecord(out, BinaryLog::GAP, fields, sizeof fields, nullptr, 0);
+    }
+    return n;
+}
+
+size_t BinaryLogRing::pending() const
+{
+    return mHead.load(std::memory_order_acquire) - mTail.load(std::memory_order_acquire);
+}
+
+size_t BinaryLogRing::capacity() const
+{
+    return mBuffer.size();
+}
+
+BinaryLogWriter::BinaryLogWriter(size_t ringBytes)
+    : mRingBytes(ringBytes)
+    , mId(nextWriterId++)
+{
+}
+
+BinaryLogRing* BinaryLogWriter::threadRing()
+{
+    if (threadRingCache.writer == mId)
+    {
+        return threadRingCache.ring;
+    }
+
+    std::ostringstream name;
+    name << std::this_thread::get_id();
+
+    std::lock_guard<std::mutex> g(mRingsMutex);
+
+    // a thread that logged to another writer meanwhile keeps its ring here
+    BinaryLogRing* ring = nullptr;
+    for (auto& t : mRings)
+    {
+        if (t.name == name.str())
+        {
+            ring = t.ring.get();
+        }
+    }
+
+    // up to 65535 threads, after which those that come later don't log
+    if (!ring && mRings.size() < 0xffff)
+    {
+        mRings.emplace_back(ThreadRing{ name.str(), std::unique_ptr<BinaryLogRing>(new BinaryLogRing(mRingBytes)), false });
+        ring = mRings.back().ring.get();
+    }
+
+    threadRingCache.writer = mId;
+    threadRingCache.ring = ring;
+    return ring;
+}
+
+bool BinaryLogWriter::log(int level, const char* message, const char** pieces, const size_t* pieceSizes, int pieceCount)
+{
+    BinaryLogRing* ring = threadRing();
+    if (!ring)
+    {
+        return false;
+    }
+
+    size_t maxText = ring->capacity() / MAXRECORDSHARE;
+    size_t textSize = 0;
+
+    BinaryLogRing::Piece p[16];
+    int n = 1;
+
+    if (pieces)
+    {
+        for (int i = 0; i < pieceCount && n < int(sizeof p / sizeof *p); ++i)
+        {
+            size_t size = std::min(pieceSizes[i], maxText - textSize);
+            p[n++] = { pieces[i], size };
+            textSize += size;
+        }
+    }
+    else
+    {
+        textSize = std::min(strlen(message), maxText);
+        p[n++] = { message, textSize };
+    }
+
+    // the thread is written by the consumer, from the ring the record came in
+    char header[RECORDHEADER + 11];
+    put(header, uint64_t(1 + 11 + textSize), 4);
+    header[4] = char(BinaryLog::MESSAGE);
+    put(header + RECORDHEADER, microsecondsNow(), 8);
+    put(header + RECORDHEADER + 8, 0, 2);
+    header[RECORDHEADER + 10] = char(level);
+    p[0] = { header, sizeof header };
+
+    size_t before = ring->pending();
+    if (!ring->push(p, n))
+    {
+        return true;
+    }
+
+    // wake the consumer only once per half of the ring
+    size_t half = ring->capacity() / 2;
+    return before < half && before + sizeof header + textSize >= half;
+}
+
+void BinaryLogWriter::drain(std::string& out, bool threadNames)
+{
+    std::lock_guard<std::mutex> g(mRingsMutex);
+
+    for (size_t i = 0; i < mRings.size(); ++i)
+    {
+        auto& t = mRings[i];
+        uint16_t thread = uint16_t(i + 1);
+
+        if (threadNames || !t.named)
+        {
+            appendThread(out, thread, t.name);
+            t.named = true;
+        }
+
+        size_t start = out.size();
+        t.ring->drain(out, thread);
+
+        // the producers leave the thread out, it's the same for the whole ring
+        for (size_t pos = start; pos + RECORDHEADER <= out.size(); )
+        {
+            size_t size = size_t(get(&out[pos], 4));
+            if (out[pos + 4] == char(BinaryLog::MESSAGE))
+            {
+                put(&out[pos + RECORDHEADER + 8], thread, 2);
+            }
+            pos += 4 + size;
+        }
+    }
+}
+
+std::string BinaryLogWriter::header()
+{
+    return std::string(BinaryLog::MAGIC, BinaryLog::MAGICSIZE);
+}
+
+std::string BinaryLogWriter::message(int level, const std::string& text)
+{
+    char fields[11];
+    put(fields, microsecondsNow(), 8);
+    put(fields + 8, 0, 2);
+    fields[10] = char(level);
+
+    std::string out;
+    appendRecord(out, BinaryLog::MESSAGE, fields, sizeof fields, text.data(), text.size());
+    return out;
+}
+
+namespace BinaryLog {
+
+Reader::Reader(const char* data, size_t size)
+    : mPos(data)
+    , mEnd(data + size)
+{
+    mValid = size >= MAGICSIZE && !memcmp(data, MAGIC, MAGICSIZE);
+    if (mValid)
+    {
+        mPos += MAGICSIZE;
+    }
+}
+
+bool Reader::valid() const
+{
+    return mValid;
+}
+
+void Reader::feed(const char* data, size_t size)
+{
+    mPos = data;
+    mEnd = data + size;
+}
+
+bool Reader::next(Record& r)
+{
+    for (;;)
+    {
+        // files are appended to by each run, each one starting with the header
+        if (size_t(mEnd - mPos) >= MAGICSIZE && !memcmp(mPos, MAGIC, MAGICSIZE))
+        {
+            mPos += MAGICSIZE;
+            continue;
+        }
+
+        if (size_t(mEnd - mPos) < RECORDHEADER)
+        {
+            return false;
+        }
+
+        size_t size = size_t(get(mPos, 4));
+        if (!size || size > size_t(mEnd - mPos) - 4)
+        {
+            return false;
+        }
+
+        r = Record();
+        r.type = RecordType(uint8_t(mPos[4]));
+
+        const char* p = mPos + RECORDHEADER;
+        const char* end = mPos + 4 + size;
+        mPos = end;
+
+        switch (r.type)
+        {
+        case THREAD:
+            if (end - p < 2) return false;
+            r.thread = uint16_t(get(p, 2));
+            r.text.assign(p + 2, end);
+            if (mThreadNames.size() <= r.thread)
+            {
+                mThreadNames.resize(r.thread + 1u);
+            }
+            mThreadNames[r.thread] = r.text;
+            return true;
+
+        case MESSAGE:
+            if (end - p < 11) return false;
+            r.us = get(p, 8);
+            r.thread = uint16_t(get(p + 8, 2));
+            r.level = int8_t(p[10]);
+            r.text.assign(p + 11, end);
+            return true;
+
+        case GAP:
+            if (end - p < 10) return false;
+            r.thread = uint16_t(get(p, 2));
+            r.dropped = get(p + 2, 8);
+            return true;
+
+        default:
+            // a record of a later version
+            continue;
+        }
+    }
+}
+
+std::string Reader::format(const Record& r) const
+{
+    const std::string& thread = r.thread < mThreadNames.size() ? mThreadNames[r.thread] : std::string();
+
+    if (r.type == GAP)
+    {
+        std::ostringstream s;
+        s << "<log gap - " << r.dropped << " messages of " << thread << " dropped at this point>\n";
+        return s.str();
+    }
+
+    if (r.type != MESSAGE)
+    {
+        return std::string();
+    }
+
+    time_t t = time_t(r.us / 1000000);
+    struct tm gmt;
+#ifdef WIN32
+    gmtime_s(&gmt, &t);
+#else
+    gmtime_r(&t, &gmt);
+#endif
+
+    // as RotativePerformanceLogger writes them when it writes text
+    char time[80];
+    snprintf(time, sizeof time, "%02d/%02d/%02d-%02d:%02d:%02d.%06d ",
+             gmt.tm_mday, gmt.tm_mon + 1, gmt.tm_year % 100, gmt.tm_hour, gmt.tm_min, gmt.tm_sec,
+             int(r.us % 1000000));
+
+    const char* level = "     ";
+    switch (r.level)
+    {
+    case logFatal: level = "CRIT "; break;
+    case logError: level = "ERR  "; break;
+    case logWarning: level = "WARN "; break;
+    case logInfo: level = "INFO "; break;
+    case logDebug: level = "DBG  "; break;
+    case logMax: level = "DTL  "; break;
+    }
+
+    std::string line = time;
+    if (!thread.empty())
+    {
+        line += thread;
+        line += ' ';
+    }
+    line += level;
+    line += r.text;
+    line += '\n';
+    return line;
+}
+
+} // namespace BinaryLog
+
+} // namespace
@@ -45,9 +45,9 @@ void Command::cancel()
 }
 
 // returns completed command JSON string
-const char* Command::getstring()
+const string& Command::getstring() const
 {
-    return jsonWriter.getstring().c_str();
+    return jsonWriter.getstring();
 }
 
 //return true when the response is an error, false otherwise (in that case it doesn't consume JSON chars)
@@ -118,6 +118,7 @@ bool Command::checkError(Error& errorDetails, JSON& json)
 // add opcode
 void Command::cmd(const char* cmd)
 {
+    commandStr = cmd;
     jsonWriter.cmd(cmd);
 }
 
@@ -232,5 +233,10 @@ void Command::closeobject()
     jsonWriter.closeobject();
 }
 
+void Command::reserve(size_t n)
+{
+    jsonWriter.reserve(n);
+}
+
 } // namespace
 
@@ -173,16 +173,7 @@ bool CommandGetFA::procresult(Result r)
     {
         if (it != client->fafcs.end())
         {
-            faf_map::iterator fafsit;
-            for (fafsit = it->second->fafs[0].begin(); fafsit != it->second->fafs[0].end(); )
-            {
-                // move from fresh to pending
-                it->second->fafs[1][fafsit->first] = fafsit->second;
-                it->second->fafs[0].erase(fafsit++);
-            }
-
-            it->second->e = r.errorOrOK();
-            it->second->req.status = REQ_FAILURE;
+            it->second->urlfailed(r.errorOrOK());
         }
 
         return true;
@@ -205,20 +196,12 @@ bool CommandGetFA::procresult(Result r)
                     {
                         Node::copystring(&it->second->posturl, p);
                         it->second->urltime = Waiter::ds;
+                        it->second->gettingurl = false;
                         it->second->dispatch();
                     }
                     else
                     {
-                        faf_map::iterator fafsit;
-                        for (fafsit = it->second->fafs[0].begin(); fafsit != it->second->fafs[0].end(); )
-                        {
-                            // move from fresh to pending
-                            it->second->fafs[1][fafsit->first] = fafsit->second;
-                            it->second->fafs[0].erase(fafsit++);
-                        }
-
-                        it->second->e = API_EINTERNAL;
-                        it->second->req.status = REQ_FAILURE;
+                        it->second->urlfailed(API_EINTERNAL);
                     }
                 }
 
@@ -227,16 +210,10 @@ bool CommandGetFA::procresult(Result r)
             default:
                 if (!client->json.storeobject())
                 {
-                    faf_map::iterator fafsit;
-                    for (fafsit = it->second->fafs[0].begin(); fafsit != it->second->fafs[0].end(); )
+                    if (it != client->fafcs.end())
                     {
-                        // move from fresh to pending
-                        it->second->fafs[1][fafsit->first] = fafsit->second;
-                        it->second->fafs[0].erase(fafsit++);
+                        it->second->urlfailed(API_EINTERNAL);
                     }
-
-                    it->second->e = API_EINTERNAL;
-                    it->second->req.status = REQ_FAILURE;
                     return false;
                 }
         }
@@ -403,6 +380,9 @@ bool CommandPutFile::procresult(Result r)
 
                 if (tempurls.size() == 1)
                 {
+                    // the first chunk is still being encrypted
+                    client->httpio->prewarm(tempurls[0]);
+
                     tslot->transfer->tempurls = tempurls;
                     tslot->transferbuf.setIsRaid(tslot->transfer, tempurls, tslot->transfer->pos, tslot->maxRequestSize);
                     tslot->starttime = tslot->lastdata = client->waiter->ds;
@@ -604,6 +584,11 @@ bool CommandDirectRead::procresult(Result r)
                             tl = MegaClient::DEFAULT_BW_OVERQUOTA_BACKOFF_SECS;
                         }
 
+                        if (e == API_OK)
+                        {
+                            client->cachetempurls(drn->h, drn->p, drn->tempurls, drn->size);
+                        }
+
                         drn->cmdresult(e, e == API_EOVERQUOTA ? tl * 10 : 0);
                     }
 
@@ -655,22 +640,117 @@ CommandGetFile::CommandGetFile(MegaClient *client, TransferSlot* ctslot, const b
     tslot = ctslot;
     priv = p;
     ph = h;
+    prefetch = NULL;
+    prefetching = false;
 
-    if (!tslot)
+    if (!tslot && key)
     {
         memcpy(filekey, key, FILENODEKEYLENGTH);
     }
 }
 
+CommandGetFile::CommandGetFile(MegaClient *client, Transfer* t, handle h, bool p, const char *privateauth, const char *publicauth, const char *chatauth)
+    : CommandGetFile(client, NULL, NULL, h, p, privateauth, publicauth, chatauth)
+{
+    prefetch = t;
+    prefetching = true;
+}
+
 void CommandGetFile::cancel()
 {
     Command::cancel();
     tslot = NULL;
+    prefetch = NULL;
+}
+
+// keep the URLs of a queued download; on any error, it asks for them again when it gets a slot
+bool CommandGetFile::procprefetchresult(Result r)
+{
+    if (prefetch)
+    {
+        prefetch->urlprefetch = NULL;
+    }
+
+    if (r.wasErrorOrOK())
+    {
+        return true;
+    }
+
+    std::vector<string> tempurls;
+    m_off_t s = -1;
+    bool failed = false;
+
+    for (;;)
+    {
+        switch (client->json.getnameid())
+        {
+            case 'g':
+                if (client->json.enterarray())
+                {
+                    for (;;)
+                    {
+                        std::string tu;
+                        if (!client->json.storeobject(&tu))
+                        {
+                            break;
+                        }
+                        tempurls.push_back(tu);
+                    }
+                    client->json.leavearray();
+                }
+                else
+                {
+                    std::string tu;
+                    if (client->json.storeobject(&tu))
+                    {
+                        tempurls.push_back(tu);
+                    }
+                }
+                break;
+
+            case 's':
+                s = client->json.getint();
+                break;
+
+            case 'd':
+            case 'e':
+                client->json.storeobject();
+                failed = true;
+                break;
+
+            case EOO:
+                if (prefetch && !canceled && !failed && !prefetch->slot && s >= 0
+                        && (tempurls.size() == 1 || tempurls.size() == RAIDPARTS))
+                {
+                    prefetch->tempurls = tempurls;
+                    prefetch->urlprefetchds = Waiter::ds;
+                    client->cachetempurls(ph, priv, tempurls, s);
+
+                    // its first requests won't wait for the lookups either
+                    for (auto& u : tempurls)
+                    {
+                        client->httpio->prewarm(u);
+                    }
+                }
+                return true;
+
+            default:
+                if (!client->json.storeobject())
+                {
+                    return false;
+                }
+        }
+    }
 }
 
 // process file credentials
 bool CommandGetFile::procresult(Result r)
 {
+    if (prefetching)
+    {
+        return procprefetchresult(r);
+    }
+
     if (tslot)
     {
         tslot->pendingcmd = NULL;
@@ -881,6 +961,7 @@ bool CommandGetFile::procresult(Result r)
                                         if ((tempurls.size() == 1 || tempurls.size() == RAIDPARTS) && s >= 0)
                                         {
                                             tslot->transfer->tempurls = tempurls;
+                                            client->cachetempurls(ph, priv, tempurls, s);
                                             tslot->transferbuf.setIsRaid(tslot->transfer, tempurls, tslot->transfer->pos, tslot->maxRequestSize);
                                             tslot->progress();
                                             return true;
@@ -966,8 +1047,7 @@ CommandSetAttr::CommandSetAttr(MegaClient* client, Node* n, SymmCipher* cipher,
 
     string at;
 
-    n->attrs.getjson(&at);
-    client->makeattr(cipher, &at, at.c_str(), int(at.size()));
+    client->makeattr(cipher, &at, n->attrs);
 
     arg("n", (byte*)&n->nodehandle, MegaClient::NODEHANDLE);
     arg("at", (byte*)at.c_str(), int(at.size()));
@@ -976,6 +1056,9 @@ CommandSetAttr::CommandSetAttr(MegaClient* client, Node* n, SymmCipher* cipher,
     tag = client->reqtag;
     syncop = prevattr;
 
+    pipelinable = true;
+    pipelinekey = h;
+
     if(prevattr)
     {
         pa = prevattr;
@@ -1013,6 +1096,17 @@ CommandPutNodes::CommandPutNodes(MegaClient* client, handle th,
     type = userhandle ? USER_HANDLE : NODE_HANDLE;
     source = csource;
 
+    // the names and base64 values of each node, and the share keys they might need,
+    // so that batches of thousands are written without growing the string again and again
+    size_t estimate = 64;
+    for (const NewNode& n : nn)
+    {
+        estimate += 128 + JSONWriter::b64size(n.attrstring ? n.attrstring->size() : 0)
+                        + 2 * JSONWriter::b64size(n.nodekey.size())
+                        + (n.fileattributes ? n.fileattributes->size() : 0);
+    }
+    reserve(estimate);
+
     cmd("p");
     notself(client);
 
@@ -1025,6 +1119,10 @@ CommandPutNodes::CommandPutNodes(MegaClient* client, handle th,
     {
         arg("t", (byte*)&th, MegaClient::NODEHANDLE);
         targethandle = th;
+
+        // new nodes under a folder depend only on what else is done to it
+        pipelinable = true;
+        pipelinekey = th;
     }
 
     arg("sm",1);
@@ -1137,9 +1235,9 @@ CommandPutNodes::CommandPutNodes(MegaClient* client, handle th,
 }
 
 // add new nodes and handle->node handle mapping
-void CommandPutNodes::removePendingDBRecordsAndTempFiles()
+void CommandPutNodes::removePendingDBRecordsAndTempFiles(int filetag)
 {
-    pendingdbid_map::iterator it = client->pendingtcids.find(tag);
+    pendingdbid_map::iterator it = client->pendingtcids.find(filetag);
     if (it != client->pendingtcids.end())
     {
         if (client->tctable)
@@ -1156,7 +1254,7 @@ void CommandPutNodes::removePendingDBRecordsAndTempFiles()
         }
         client->pendingtcids.erase(it);
     }
-    pendingfiles_map::iterator pit = client->pendingfiles.find(tag);
+    pendingfiles_map::iterator pit = client->pendingfiles.find(filetag);
     if (pit != client->pendingfiles.end())
     {
         vector<LocalPath> &pfs = pit->second;
@@ -1168,9 +1266,58 @@ void CommandPutNodes::removePendingDBRecordsAndTempFiles()
     }
 }
 
+// the result of a batch goes to the app one node at a time, with the tag that node was queued with
+void CommandPutNodes::appresult(const Error& e, bool targetOverride)
+{
+    if (mResultFunction)
+    {
+        mResultFunction(e, nn);
+        return;
+    }
+
+    if (batchtags.empty())
+    {
+        client->app->putnodes_result(e, type, nn, targetOverride);
+        return;
+    }
+
+    assert(batchtags.size() == nn.size());
+    int restag = client->restag;
+
+    for (size_t i = 0; i < nn.size(); i++)
+    {
+        vector<NewNode> single(1);
+        single[0] = std::move(nn[i]);
+
+        Error nodeError = e;
+        bool nodeOverride = targetOverride;
+        if (!e)
+        {
+            Node* n = single[0].added ? client->nodebyhandle(single[0].mAddedHandle) : nullptr;
+            nodeError = n ? API_OK : API_ENOENT;
+            nodeOverride = n && n->parenthandle != targethandle;
+        }
+
+        client->restag = batchtags[i];
+        client->app->putnodes_result(nodeError, type, single, nodeOverride);
+    }
+
+    client->restag = restag;
+}
+
 bool CommandPutNodes::procresult(Result r)
 {
-    removePendingDBRecordsAndTempFiles();
+    if (batchtags.empty())
+    {
+        removePendingDBRecordsAndTempFiles(tag);
+    }
+    else
+    {
+        for (int batchtag : batchtags)
+        {
+            removePendingDBRecordsAndTempFiles(batchtag);
+        }
+    }
 
     if (r.wasErrorOrOK())
     {
@@ -1203,7 +1350,7 @@ bool CommandPutNodes::procresult(Result r)
 #endif
             if (source == PUTNODES_APP)
             {
-                client->app->putnodes_result(r.errorOrOK(), type, nn);
+                appresult(r.errorOrOK(), false);
                 return true;
             }
 #ifdef ENABLE_SYNC
@@ -1292,7 +1439,7 @@ bool CommandPutNodes::procresult(Result r)
             }
         }
 #endif
-        client->app->putnodes_result((!e && empty) ? API_ENOENT : static_cast<error>(e), type, nn, targetOverride);
+        appresult((!e && empty) ? API_ENOENT : static_cast<error>(e), targetOverride);
     }
 #ifdef ENABLE_SYNC
     else
@@ -1385,8 +1532,7 @@ bool CommandMoveNode::procresult(Result r)
                     {
                         LOG_err << "Error moving node to the Rubbish Bin";
                         syncn->syncdeleted = SYNCDEL_NONE;
-                        client->todebris.erase(syncn->todebris_it);
-                        syncn->todebris_it = client->todebris.end();
+                        client->todebris.erase(syncn);
                     }
                     else
                     {
@@ -3011,6 +3157,53 @@ bool CommandGetUA::procresult(Result r)
 {
     User *u = client->finduser(uid.c_str());
 
+    if (u)
+    {
+        auto it = u->uarequests.find(at);
+        if (it != u->uarequests.end())
+        {
+            // the getua() calls made while this request was in flight get its result too
+            vector<int> tags = move(it->second);
+            u->uarequests.erase(it);
+
+            if (!tags.empty())
+            {
+                MegaClient* c = client;
+                auto forall = [c, tags](std::function<void()> result)
+                {
+                    int creqtag = c->restag;
+                    for (int t : tags)
+                    {
+                        c->restag = t;
+                        result();
+                    }
+                    c->restag = creqtag;
+                };
+
+                CompletionErr completionErr = move(mCompletionErr);
+                mCompletionErr = [c, completionErr, forall](error e)
+                {
+                    completionErr(e);
+                    forall([c, e]() { c->app->getua_result(e); });
+                };
+
+                CompletionBytes completionBytes = move(mCompletionBytes);
+                mCompletionBytes = [c, completionBytes, forall](byte* b, unsigned l, attr_t t)
+                {
+                    completionBytes(b, l, t);
+                    forall([c, b, l, t]() { c->app->getua_result(b, l, t); });
+                };
+
+                CompletionTLV completionTLV = move(mCompletionTLV);
+                mCompletionTLV = [c, completionTLV, forall](TLVstore* tlv, attr_t t)
+                {
+                    completionTLV(tlv, t);
+                    forall([c, tlv, t]() { c->app->getua_result(tlv, t); });
+                };
+            }
+        }
+    }
+
     if (r.wasErrorOrOK())
     {
         if (r.wasError(API_ENOENT) && u)
@@ -3584,6 +3777,15 @@ bool CommandPubKeyRequest::procresult(Result r)
 
     if (u->isTemporary)
     {
+        for (auto it = client->pubkeyusers.begin(); it != client->pubkeyusers.end(); ++it)
+        {
+            if (it->second == u)
+            {
+                client->pubkeyusers.erase(it);
+                break;
+            }
+        }
+
         delete u;
         u = NULL;
     }
@@ -5489,38 +5691,68 @@ bool CommandFetchNodes::procresult(Result r)
     WAIT_CLASS::bumpds();
     client->fnstats.timeToLastByte = Waiter::ds - client->fnstats.startTime;
 
-    client->purgenodesusersabortsc(true);
+    // nodes read while the response was downloading are the new tree already
+    bool streamed = client->mFetchNodesStream && client->mFetchNodesStream->started();
+    if (!streamed && !client->reconcilingnodes)
+    {
+        client->purgenodesusersabortsc(true);
+    }
 
-    if (r.wasErrorOrOK())
+    // a merging reload that fails falls back to a regular one, which reports its own result
+    auto failed = [this](error e)
     {
         client->fetchingnodes = false;
-        client->app->fetchnodes_result(r.errorOrOK());
+
+        if (client->reconcilingnodes)
+        {
+            client->abortreconcile();
+        }
+        else
+        {
+            client->app->fetchnodes_result(e);
+        }
+    };
+
+    if (r.wasErrorOrOK())
+    {
+        failed(r.errorOrOK());
         return true;
     }
 
+    // The response is dominated by the node array, so estimate the node count from its size
+    // and size the node table once, rather than rehashing repeatedly while millions of nodes arrive.
+    // A typical node record is a little over 250 bytes of JSON.
+    if (client->json.pos && !streamed)
+    {
+        client->nodes.reserve(strlen(client->json.pos) / 256);
+    }
+
     for (;;)
     {
         switch (client->json.getnameid())
         {
             case 'f':
+            {
                 // nodes
+                FetchNodesStats::PhaseTimer pt(&client->fnstats.apiParseTimeUs);
                 if (!client->readnodes(&client->json, 0, PUTNODES_APP, nullptr, 0, false))
                 {
-                    client->fetchingnodes = false;
-                    client->app->fetchnodes_result(API_EINTERNAL);
+                    failed(API_EINTERNAL);
                     return false;
                 }
                 break;
-
+            }
             case MAKENAMEID2('f', '2'):
+            {
                 // old versions
+                FetchNodesStats::PhaseTimer pt(&client->fnstats.apiParseTimeUs);
                 if (!client->readnodes(&client->json, 0, PUTNODES_APP, nullptr, 0, false))
                 {
-                    client->fetchingnodes = false;
-                    client->app->fetchnodes_result(API_EINTERNAL);
+                    failed(API_EINTERNAL);
                     return false;
                 }
                 break;
+            }
 
             case MAKENAMEID2('o', 'k'):
                 // outgoing sharekeys
@@ -5538,8 +5770,7 @@ bool CommandFetchNodes::procresult(Result r)
                 // users/contacts
                 if (!client->readusers(&client->json, false))
                 {
-                    client->fetchingnodes = false;
-                    client->app->fetchnodes_result(API_EINTERNAL);
+                    failed(API_EINTERNAL);
                     return false;
                 }
                 break;
@@ -5558,8 +5789,7 @@ bool CommandFetchNodes::procresult(Result r)
                 // sequence number
                 if (!client->scsn.setScsn(&client->json))
                 {
-                    client->fetchingnodes = false;
-                    client->app->fetchnodes_result(API_EINTERNAL);
+                    failed(API_EINTERNAL);
                     return false;
                 }
                 break;
@@ -5595,13 +5825,28 @@ bool CommandFetchNodes::procresult(Result r)
             {
                 if (!client->scsn.ready())
                 {
-                    client->fetchingnodes = false;
-                    client->app->fetchnodes_result(API_EINTERNAL);
+                    failed(API_EINTERNAL);
                     return false;
                 }
 
+                if (client->reconcilingnodes)
+                {
+                    // the nodes in memory and sctable stay; what changed is written like action packets are
+                    client->endreconcile();
+                    client->pendingsccommit = false;
+                    return true;
+                }
+
                 client->mergenewshares(0);
                 client->applykeys();
+
+                if (client->browsingonly())
+                {
+                    // no action packets to catch up with: the tree is all there is
+                    client->browseonlyfetched(tag);
+                    return true;
+                }
+
                 client->initStatusTable();
                 client->initsc();
                 client->pendingsccommit = false;
@@ -5615,8 +5860,7 @@ bool CommandFetchNodes::procresult(Result r)
             default:
                 if (!client->json.storeobject())
                 {
-                    client->fetchingnodes = false;
-                    client->app->fetchnodes_result(API_EINTERNAL);
+                    failed(API_EINTERNAL);
                     return false;
                 }
         }
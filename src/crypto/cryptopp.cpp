@@ -21,6 +21,19 @@
 
 #include "mega.h"
 
+#include <cryptopp/cpu.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MEGA_CRC32_CLMUL 1
+#define MEGA_CRC32_CLMUL_TARGET __attribute__((target("pclmul,sse4.1")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#define MEGA_CRC32_CLMUL 1
+#define MEGA_CRC32_CLMUL_TARGET
+#endif
+
 namespace mega {
 #ifndef htobe64
 #define htobe64(x) (((uint64_t)htonl((uint32_t)((x) >> 32))) | (((uint64_t)htonl((uint32_t)x)) << 32))
@@ -62,30 +75,48 @@ SymmCipher::SymmCipher(const byte* key)
 }
 
 byte SymmCipher::zeroiv[BLOCKSIZE];
+bool SymmCipher::pipelinedctr = true;
 
 void SymmCipher::setkey(const byte* newkey, int type)
 {
-    memcpy(key, newkey, KEYLENGTH);
+    byte k[KEYLENGTH];
+    memcpy(k, newkey, KEYLENGTH);
 
     if (!type)
     {
-        xorblock(newkey + KEYLENGTH, key);
+        xorblock(newkey + KEYLENGTH, k);
     }
 
-    aesecb_e.SetKey(key, KEYLENGTH);
-    aesecb_d.SetKey(key, KEYLENGTH);
-
-    aescbc_e.SetKeyWithIV(key, KEYLENGTH, zeroiv);
-    aescbc_d.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+    // the same key again (the temporary ciphers are often set to the node they had): the modes
+    // keyed already stay so
+    if (!memcmp(k, key, KEYLENGTH))
+    {
+        return;
+    }
 
-    aesccm8_e.SetKeyWithIV(key, KEYLENGTH, zeroiv);
-    aesccm8_d.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+    memcpy(key, k, KEYLENGTH);
+    keyedmodes = 0;
+}
 
-    aesccm16_e.SetKeyWithIV(key, KEYLENGTH, zeroiv);
-    aesccm16_d.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+void SymmCipher::setmodekey(unsigned mode)
+{
+    switch (mode)
+    {
+        case ECB_E: aesecb_e.SetKey(key, KEYLENGTH); break;
+        case ECB_D: aesecb_d.SetKey(key, KEYLENGTH); break;
+        case CBC_E: aescbc_e.SetKeyWithIV(key, KEYLENGTH, zeroiv); break;
+        case CBC_D: aescbc_d.SetKeyWithIV(key, KEYLENGTH, zeroiv); break;
+        case CCM16_E: aesccm16_e.SetKeyWithIV(key, KEYLENGTH, zeroiv); break;
+        case CCM16_D: aesccm16_d.SetKeyWithIV(key, KEYLENGTH, zeroiv); break;
+        case CCM8_E: aesccm8_e.SetKeyWithIV(key, KEYLENGTH, zeroiv); break;
+        case CCM8_D: aesccm8_d.SetKeyWithIV(key, KEYLENGTH, zeroiv); break;
+        case GCM_E: aesgcm_e.SetKeyWithIV(key, KEYLENGTH, zeroiv); break;
+        case GCM_D: aesgcm_d.SetKeyWithIV(key, KEYLENGTH, zeroiv); break;
+        case CTR_E: aesctr_e.SetKeyWithIV(key, KEYLENGTH, zeroiv); break;
+        default: assert(false); return;
+    }
 
-    aesgcm_e.SetKeyWithIV(key, KEYLENGTH, zeroiv);
-    aesgcm_d.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+    keyedmodes |= mode;
 }
 
 bool SymmCipher::setkey(const string* key)
@@ -102,12 +133,14 @@ bool SymmCipher::setkey(const string* key)
 
 void SymmCipher::cbc_encrypt(byte* data, size_t len, const byte* iv)
 {
+    keymode(CBC_E);
     aescbc_e.Resynchronize(iv ? iv : zeroiv);
     aescbc_e.ProcessData(data, data, len);
 }
 
 void SymmCipher::cbc_decrypt(byte* data, size_t len, const byte* iv)
 {
+    keymode(CBC_D);
     aescbc_d.Resynchronize(iv ? iv : zeroiv);
     aescbc_d.ProcessData(data, data, len);
 }
@@ -117,6 +150,7 @@ void SymmCipher::cbc_encrypt_pkcs_padding(const string *data, const byte *iv, st
     using Transformation = StreamTransformationFilter;
 
     // Update IV.
+    keymode(CBC_E);
     aescbc_e.Resynchronize(iv ? iv : zeroiv);
 
     // Create sink.
@@ -143,6 +177,7 @@ bool SymmCipher::cbc_decrypt_pkcs_padding(const std::string* data, const byte* i
         using Transformation = StreamTransformationFilter;
 
         // Update IV.
+        keymode(CBC_D);
         aescbc_d.Resynchronize(iv ? iv : zeroiv);
 
         // Create sink.
@@ -181,6 +216,7 @@ bool SymmCipher::cbc_decrypt_pkcs_padding(const byte* data,
         using Transformation = StreamTransformationFilter;
 
         // Update IV.
+        keymode(CBC_D);
         aescbc_d.Resynchronize(iv ? iv : zeroiv);
 
         // Create sink.
@@ -211,24 +247,56 @@ bool SymmCipher::cbc_decrypt_pkcs_padding(const byte* data,
 
 void SymmCipher::ecb_encrypt(byte* data, byte* dst, size_t len)
 {
+    keymode(ECB_E);
     aesecb_e.ProcessData(dst ? dst : data, data, len);
 }
 
 void SymmCipher::ecb_decrypt(byte* data, size_t len)
 {
+    keymode(ECB_D);
     aesecb_d.ProcessData(data, data, len);
 }
 
+void SymmCipher::ecb_decrypt_keys(byte* const* keys, const unsigned* lengths, size_t count)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        assert(!(lengths[i] % BLOCKSIZE));
+        total += lengths[i];
+    }
+
+    std::vector<byte> buf(total);
+    byte* p = buf.data();
+    for (size_t i = 0; i < count; i++)
+    {
+        memcpy(p, keys[i], lengths[i]);
+        p += lengths[i];
+    }
+
+    keymode(ECB_D);
+    aesecb_d.ProcessData(buf.data(), buf.data(), total);
+
+    p = buf.data();
+    for (size_t i = 0; i < count; i++)
+    {
+        memcpy(keys[i], p, lengths[i]);
+        p += lengths[i];
+    }
+}
+
 void SymmCipher::ccm_encrypt(const string *data, const byte *iv, unsigned ivlen, unsigned taglen, string *result)
 {
     if (taglen == 16)
     {
+        keymode(CCM16_E);
         aesccm16_e.Resynchronize(iv, ivlen);
         aesccm16_e.SpecifyDataLengths(0, data->size(), 0);
         StringSource(*data, true, new AuthenticatedEncryptionFilter(aesccm16_e, new StringSink(*result)));
     }
     else if (taglen == 8)
     {
+        keymode(CCM8_E);
         aesccm8_e.Resynchronize(iv, ivlen);
         aesccm8_e.SpecifyDataLengths(0, data->size(), 0);
         StringSource(*data, true, new AuthenticatedEncryptionFilter(aesccm8_e, new StringSink(*result)));
@@ -240,12 +308,14 @@ bool SymmCipher::ccm_decrypt(const string *data, const byte *iv, unsigned ivlen,
     try {
         if (taglen == 16)
         {
+            keymode(CCM16_D);
             aesccm16_d.Resynchronize(iv, ivlen);
             aesccm16_d.SpecifyDataLengths(0, data->size() - taglen, 0);
             StringSource(*data, true, new AuthenticatedDecryptionFilter(aesccm16_d, new StringSink(*result)));
         }
         else if (taglen == 8)
         {
+            keymode(CCM8_D);
             aesccm8_d.Resynchronize(iv, ivlen);
             aesccm8_d.SpecifyDataLengths(0, data->size() - taglen, 0);
             StringSource(*data, true, new AuthenticatedDecryptionFilter(aesccm8_d, new StringSink(*result)));
@@ -261,12 +331,14 @@ bool SymmCipher::ccm_decrypt(const string *data, const byte *iv, unsigned ivlen,
 
 void SymmCipher::gcm_encrypt(const string *data, const byte *iv, unsigned ivlen, unsigned taglen, string *result)
 {
+    keymode(GCM_E);
     aesgcm_e.Resynchronize(iv, ivlen);
     StringSource(*data, true, new AuthenticatedEncryptionFilter(aesgcm_e, new StringSink(*result), false, taglen));
 }
 
 bool SymmCipher::gcm_decrypt(const string *data, const byte *iv, unsigned ivlen, unsigned taglen, string *result)
 {
+    keymode(GCM_D);
     aesgcm_d.Resynchronize(iv, ivlen);
     try {
         StringSource(*data, true, new AuthenticatedDecryptionFilter(aesgcm_d, new StringSink(*result), taglen));
@@ -374,6 +446,53 @@ void SymmCipher::ctr_crypt(byte* data, unsigned len, m_off_t pos, ctr_iv ctriv,
         memcpy(mac + sizeof ctriv, ctr, sizeof ctriv);
     }
 
+    if (pipelinedctr)
+    {
+        // the counter block is the nonce and the big-endian block number, as Crypto++ counts it.
+        // The CBC-MAC can't be pipelined: it goes block by block, over chunks still in the cache
+        keymode(CTR_E);
+        aesctr_e.Resynchronize(ctr);
+
+        auto cbcmac = [this, mac](const byte* block, unsigned n, bool wholeblocks)
+        {
+            for (; (int)n > 0; n -= BLOCKSIZE, block += BLOCKSIZE)
+            {
+                // what is encrypted is padded to whole blocks
+                if (wholeblocks || n >= (unsigned)BLOCKSIZE)
+                {
+                    xorblock(block, mac);
+                }
+                else
+                {
+                    xorblock(block, mac, n);
+                }
+
+                ecb_encrypt(mac);
+            }
+        };
+
+        while ((int)len > 0)
+        {
+            unsigned n = len < CTRCHUNK ? len : CTRCHUNK;
+
+            if (mac && encrypt)
+            {
+                cbcmac(data, n, true);
+            }
+
+            aesctr_e.ProcessData(data, data, n);
+
+            if (mac && !encrypt)
+            {
+                cbcmac(data, n, false);
+            }
+
+            len -= n;
+            data += n;
+        }
+        return;
+    }
+
     while ((int)len > 0)
     {
         if (encrypt)
@@ -414,6 +533,92 @@ void SymmCipher::ctr_crypt(byte* data, unsigned len, m_off_t pos, ctr_iv ctriv,
     }
 }
 
+void SymmCipher::ctr_crypt_chunks(CtrChunk* chunks, size_t count, ctr_iv ctriv, bool encrypt)
+{
+    for (size_t first = 0; first < count; first += MACLANES)
+    {
+        unsigned lanes = unsigned(std::min<size_t>(count - first, MACLANES));
+
+        // longest first: those still going at any offset are then the first ones
+        CtrChunk* lane[MACLANES];
+        for (unsigned i = 0; i < lanes; i++)
+        {
+            lane[i] = chunks + first + i;
+        }
+        std::sort(lane, lane + lanes, [](const CtrChunk* a, const CtrChunk* b) { return a->len > b->len; });
+
+        // the MACs side by side, to encrypt a block of each at once
+        byte macs[MACLANES * BLOCKSIZE];
+        for (unsigned i = 0; i < lanes; i++)
+        {
+            if (lane[i]->initmac)
+            {
+                MemAccess::set<int64_t>(lane[i]->mac, ctriv);
+                memcpy(lane[i]->mac + sizeof ctriv, lane[i]->mac, sizeof ctriv);
+            }
+            memcpy(macs + i * BLOCKSIZE, lane[i]->mac, BLOCKSIZE);
+        }
+
+        // a window at a time, so that the data is still in the cache for the second pass
+        for (unsigned offset = 0; offset < lane[0]->len; offset += CTRCHUNK)
+        {
+            unsigned windowlanes = lanes;
+            while (lane[windowlanes - 1]->len <= offset)
+            {
+                windowlanes--;
+            }
+
+            if (!encrypt)
+            {
+                for (unsigned i = 0; i < windowlanes; i++)
+                {
+                    unsigned n = std::min(lane[i]->len - offset, unsigned(CTRCHUNK));
+                    ctr_crypt(lane[i]->data + offset, n, lane[i]->pos + offset, ctriv, NULL, false, false);
+                }
+            }
+
+            unsigned active = windowlanes;
+            for (unsigned b = offset; b < offset + CTRCHUNK && b < lane[0]->len; b += BLOCKSIZE)
+            {
+                while (lane[active - 1]->len <= b)
+                {
+                    active--;
+                }
+
+                for (unsigned i = 0; i < active; i++)
+                {
+                    // what is encrypted is padded to whole blocks
+                    unsigned left = lane[i]->len - b;
+                    if (encrypt || left >= (unsigned)BLOCKSIZE)
+                    {
+                        xorblock(lane[i]->data + b, macs + i * BLOCKSIZE);
+                    }
+                    else
+                    {
+                        xorblock(lane[i]->data + b, macs + i * BLOCKSIZE, int(left));
+                    }
+                }
+
+                ecb_encrypt(macs, NULL, active * BLOCKSIZE);
+            }
+
+            if (encrypt)
+            {
+                for (unsigned i = 0; i < windowlanes; i++)
+                {
+                    unsigned n = std::min(lane[i]->len - offset, unsigned(CTRCHUNK));
+                    ctr_crypt(lane[i]->data + offset, n, lane[i]->pos + offset, ctriv, NULL, true, false);
+                }
+            }
+        }
+
+        for (unsigned i = 0; i < lanes; i++)
+        {
+            memcpy(lane[i]->mac, macs + i * BLOCKSIZE, BLOCKSIZE);
+        }
+    }
+}
+
 static void rsaencrypt(Integer* key, Integer* m)
 {
     *m = a_exp_b_mod_c(*m, key[AsymmCipher::PUB_E], key[AsymmCipher::PUB_PQ]);
@@ -734,13 +939,190 @@ void HashSHA256::get(std::string *retStr)
     hash.Final((byte*)retStr->data());
 }
 
+bool HashCRC32::clmulcrc = true;
+
+#ifdef MEGA_CRC32_CLMUL
+namespace {
+
+// the bytes left of a fold, one at a time
+uint32_t crc32bytes(uint32_t crc, const byte* data, size_t len)
+{
+    static const struct Table
+    {
+        uint32_t t[256];
+
+        Table()
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                {
+                    c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                }
+                t[i] = c;
+            }
+        }
+    } table;
+
+    while (len--)
+    {
+        crc = table.t[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+// len (at least 64, a multiple of 16) bytes folded 4 x 128 bits at a time, then reduced to the
+// CRC (Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ", as in zlib)
+MEGA_CRC32_CLMUL_TARGET uint32_t crc32clmul(uint32_t crc, const byte* buf, size_t len)
+{
+    alignas(16) static const uint64_t k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+    alignas(16) static const uint64_t k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+    alignas(16) static const uint64_t k5k0[] = { 0x0163cd6124, 0x0000000000 };
+    alignas(16) static const uint64_t poly[] = { 0x01db710641, 0x01f7011641 };
+
+    assert(len >= 64 && !(len % 16));
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(int(crc)));
+    x0 = _mm_load_si128((const __m128i*)k1k2);
+
+    buf += 64;
+    len -= 64;
+
+    // four streams of 128 bits
+    while (len >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+        y6 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+        y7 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+        y8 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        buf += 64;
+        len -= 64;
+    }
+
+    // the four into one
+    x0 = _mm_load_si128((const __m128i*)k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // the rest, 128 bits at a time
+    while (len >= 16)
+    {
+        x2 = _mm_loadu_si128((const __m128i*)buf);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        buf += 16;
+        len -= 16;
+    }
+
+    // 128 bits to 64
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x0 = _mm_load_si128((const __m128i*)poly);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return uint32_t(_mm_extract_epi32(x1, 1));
+}
+
+} // anonymous
+#endif
+
+HashCRC32::HashCRC32()
+    : crc(0xffffffff)
+{
+#ifdef MEGA_CRC32_CLMUL
+    clmul = clmulcrc && CryptoPP::HasCLMUL() && CryptoPP::HasSSE41();
+#else
+    clmul = false;
+#endif
+}
+
 void HashCRC32::add(const byte* data, unsigned len)
 {
+#ifdef MEGA_CRC32_CLMUL
+    if (clmul)
+    {
+        if (len >= 64)
+        {
+            unsigned folded = len & ~15u;
+            crc = crc32clmul(crc, data, folded);
+            data += folded;
+            len -= folded;
+        }
+        crc = crc32bytes(crc, data, len);
+        return;
+    }
+#endif
+
     hash.Update(data, len);
 }
 
 void HashCRC32::get(byte* out)
 {
+    if (clmul)
+    {
+        // as Crypto++ gives it: little-endian
+        uint32_t c = ~crc;
+        for (int i = 0; i < 4; i++)
+        {
+            out[i] = byte(c >> (8 * i));
+        }
+        crc = 0xffffffff;
+        return;
+    }
+
     hash.Final(out);
 }
 
@@ -20,6 +20,7 @@
  */
 
 #include "mega/db.h"
+#include "mega/node.h"
 #include "mega/utils.h"
 #include "mega/logging.h"
 
@@ -41,45 +42,238 @@ bool DbTable::put(uint32_t type, Cacheable* record, SymmCipher* key)
 {
     string data;
 
-    if (!record->serialize(&data))
+    if (!encrypt(type, record, key, &data))
     {
         //Don't return false if there are errors in the serialization
         //to let the SDK continue and save the rest of records
-        LOG_warn << "Serialization failed: " << type;
         return true;
     }
 
-    PaddedCBC::encrypt(rng, &data, key);
+    return put(record->dbid, &data);
+}
 
-    if (!record->dbid)
+void DbTable::addToBatch(RecordBatch& batch, uint32_t type, Cacheable* record, SymmCipher* key)
+{
+    string data;
+
+    if (encrypt(type, record, key, &data))
     {
-        record->dbid = (nextid += IDSPACING) | type;
+        batch.emplace_back(record->dbid, std::move(data));
     }
+}
 
-    return put(record->dbid, &data);
+bool DbTable::putBatch(const RecordBatch& batch)
+{
+    for (auto& record : batch)
+    {
+        if (!put(record.first, const_cast<char*>(record.second.data()), unsigned(record.second.size())))
+        {
+            return false;
+        }
+    }
+
+    return true;
 }
 
-// get next record, decrypt and unpad
-bool DbTable::next(uint32_t* type, string* data, SymmCipher* key)
+bool DbTable::delBatch(const vector<uint32_t>& ids)
 {
-    if (next(type, data))
+    for (uint32_t id : ids)
     {
-        if (!*type)
+        if (!del(id))
         {
-            return true;
+            return false;
         }
+    }
+
+    return true;
+}
+
+void DbTable::removeLater(vector<LocalPath>&)
+{
+    remove();
+}
 
-        if (*type > nextid)
+bool DbTable::delRange(const vector<uint32_t>& ids)
+{
+    return delBatch(ids);
+}
+
+bool DbTable::delSpaced(vector<uint32_t> ids)
+{
+    std::sort(ids.begin(), ids.end());
+
+    vector<uint32_t> singles;
+    vector<uint32_t> range;
+    for (size_t i = 0; i < ids.size(); )
+    {
+        size_t j = i + 1;
+        while (j < ids.size() && (ids[j] & -IDSPACING) == (ids[j - 1] & -IDSPACING) + IDSPACING)
         {
-            nextid = *type & - IDSPACING;
+            j++;
         }
 
-        return PaddedCBC::decrypt(data, key);
+        if (j - i > 1)
+        {
+            range.assign(ids.begin() + static_cast<ptrdiff_t>(i), ids.begin() + static_cast<ptrdiff_t>(j));
+            if (!delRange(range))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            singles.push_back(ids[i]);
+        }
+        i = j;
+    }
+
+    return delBatch(singles);
+}
+
+DbNodeColumns::DbNodeColumns(const Node& n)
+    : nodehandle(n.nodehandle)
+    , parenthandle(n.parent ? n.parent->nodehandle : UNDEF)
+    , type(n.type)
+    , size(n.size)
+    , ctime(n.ctime)
+{
+    if (n.type == FILENODE && n.isvalid)
+    {
+        n.serializefingerprint(&fingerprint);
+    }
+}
+
+// add or update node record with its columns
+bool DbTable::putNode(uint32_t type, Node* node, SymmCipher* key)
+{
+    DbNodeRecord record;
+
+    if (!encrypt(type, node, key, &record.data))
+    {
+        // as put(): don't stop the rest of the records from being saved
+        return true;
+    }
+
+    record.id = node->dbid;
+    record.columns = DbNodeColumns(*node);
+    return putNodeRecord(record);
+}
+
+void DbTable::addNodeToBatch(NodeRecordBatch& batch, uint32_t type, Node* node, SymmCipher* key)
+{
+    DbNodeRecord record;
+
+    if (encrypt(type, node, key, &record.data))
+    {
+        record.id = node->dbid;
+        record.columns = DbNodeColumns(*node);
+        batch.push_back(std::move(record));
+    }
+}
+
+bool DbTable::putNodeBatch(const NodeRecordBatch& batch)
+{
+    for (auto& record : batch)
+    {
+        if (!putNodeRecord(record))
+        {
+            return false;
+        }
     }
 
+    return true;
+}
+
+bool DbTable::putNodeRecord(const DbNodeRecord& record)
+{
+    return put(record.id, const_cast<char*>(record.data.data()), unsigned(record.data.size()));
+}
+
+bool DbTable::getChildren(handle, NodeRefs*)
+{
     return false;
 }
 
+bool DbTable::getByFingerprint(const FileFingerprint&, NodeRefs*)
+{
+    return false;
+}
+
+bool DbTable::nodeIndexComplete()
+{
+    return false;
+}
+
+void DbTable::setNodeIndexComplete()
+{
+}
+
+int64_t DbTable::reclaimableBytes()
+{
+    return 0;
+}
+
+int64_t DbTable::reclaimSpace(int64_t)
+{
+    return 0;
+}
+
+bool DbTable::vacuum()
+{
+    return false;
+}
+
+int64_t DbTable::dataVersion()
+{
+    return 0;
+}
+
+// serialize, pad and encrypt record, assigning its dbid if it has none
+bool DbTable::encrypt(uint32_t type, Cacheable* record, SymmCipher* key, string* data)
+{
+    if (!record->serialize(data))
+    {
+        LOG_warn << "Serialization failed: " << type;
+        return false;
+    }
+
+    PaddedCBC::encrypt(rng, data, key);
+
+    if (!record->dbid)
+    {
+        record->dbid = (nextid += IDSPACING) | type;
+    }
+
+    return true;
+}
+
+// get next record, decrypt and unpad
+bool DbTable::next(uint32_t* type, string* data, SymmCipher* key)
+{
+    return nextencrypted(type, data) && (!*type || PaddedCBC::decrypt(data, key));
+}
+
+// get next record, leaving it encrypted
+bool DbTable::nextencrypted(uint32_t* type, string* data)
+{
+    if (next(type, data))
+    {
+        reserveid(*type);
+        return true;
+    }
+
+    return false;
+}
+
+// don't assign ids up to this one's to new records
+void DbTable::reserveid(uint32_t id)
+{
+    if (id > nextid)
+    {
+        nextid = id & - IDSPACING;
+    }
+}
+
 DBTableTransactionCommitter *DbTable::getTransactionCommitter() const
 {
     return mTransactionCommitter;
@@ -118,12 +312,139 @@ void DbTable::checkCommitter(DBTableTransactionCommitter*)
     assert(mTransactionCommitter);
 }
 
+ReadOnlyDbTable::ReadOnlyDbTable(PrnGen& rng, std::unique_ptr<DbTable> table)
+  : DbTable(rng, false)
+  , mTable(std::move(table))
+{
+}
+
+ReadOnlyDbTable::~ReadOnlyDbTable()
+{
+    resetCommitter();
+}
+
+void ReadOnlyDbTable::rewind()
+{
+    mTable->rewind();
+}
+
+bool ReadOnlyDbTable::next(uint32_t* id, string* data)
+{
+    return mTable->next(id, data);
+}
+
+bool ReadOnlyDbTable::get(uint32_t id, string* data)
+{
+    return mTable->get(id, data);
+}
+
+bool ReadOnlyDbTable::put(uint32_t, char*, unsigned)
+{
+    return true;
+}
+
+bool ReadOnlyDbTable::del(uint32_t)
+{
+    return true;
+}
+
+bool ReadOnlyDbTable::putBatch(const RecordBatch&)
+{
+    return true;
+}
+
+bool ReadOnlyDbTable::delBatch(const vector<uint32_t>&)
+{
+    return true;
+}
+
+bool ReadOnlyDbTable::putNodeRecord(const DbNodeRecord&)
+{
+    return true;
+}
+
+bool ReadOnlyDbTable::getChildren(handle parent, NodeRefs* refs)
+{
+    return mTable->getChildren(parent, refs);
+}
+
+bool ReadOnlyDbTable::getByFingerprint(const FileFingerprint& fingerprint, NodeRefs* refs)
+{
+    return mTable->getByFingerprint(fingerprint, refs);
+}
+
+bool ReadOnlyDbTable::nodeIndexComplete()
+{
+    return mTable->nodeIndexComplete();
+}
+
+void ReadOnlyDbTable::setNodeIndexComplete()
+{
+}
+
+int64_t ReadOnlyDbTable::dataVersion()
+{
+    return mTable->dataVersion();
+}
+
+void ReadOnlyDbTable::truncate()
+{
+}
+
+void ReadOnlyDbTable::begin()
+{
+    mInTransaction = true;
+}
+
+void ReadOnlyDbTable::commit()
+{
+    mInTransaction = false;
+}
+
+void ReadOnlyDbTable::abort()
+{
+    mInTransaction = false;
+}
+
+void ReadOnlyDbTable::remove()
+{
+    mInTransaction = false;
+}
+
+bool ReadOnlyDbTable::inTransaction() const
+{
+    return mInTransaction;
+}
+
 const int DbAccess::LEGACY_DB_VERSION = 11;
-const int DbAccess::DB_VERSION = DbAccess::LEGACY_DB_VERSION + 1;
+// + 1: all records in statecache; + 2: node records in their own table, with indexed columns
+const int DbAccess::DB_VERSION = DbAccess::LEGACY_DB_VERSION + 2;
 
 DbAccess::DbAccess()
 {
     currentDbVersion = LEGACY_DB_VERSION;
 }
 
+DbTuning DbTuning::forProfile(int profile)
+{
+    DbTuning tuning;
+
+    switch (profile)
+    {
+        case PROFILE_LOW_MEMORY:
+            tuning.cacheSizeKiB = 1024;
+            break;
+
+        case PROFILE_THROUGHPUT:
+            tuning.synchronousNormal = true;
+            tuning.cacheSizeKiB = 64 * 1024;
+            tuning.mmapSize = 256 * 1024 * 1024;
+            tuning.pageSize = 8192;
+            tuning.checkpointIntervalSecs = 60;
+            break;
+    }
+
+    return tuning;
+}
+
 } // namespace
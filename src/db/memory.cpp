@@ -0,0 +1,340 @@
+/**
+ * @file memory.cpp
+ * @brief Database access interface keeping its tables in memory
+ *
+ * (c) 2013-2021 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include "mega/db/memory.h"
+#include "mega/filefingerprint.h"
+#include "mega/logging.h"
+
+namespace mega {
+
+void MemoryDbStore::put(uint32_t id, string data, const DbNodeColumns* nodeColumns)
+{
+    erase(id);
+    records[id] = std::move(data);
+
+    if (nodeColumns)
+    {
+        columns[id] = *nodeColumns;
+        children.emplace(nodeColumns->parenthandle, id);
+        if (!nodeColumns->fingerprint.empty())
+        {
+            fingerprints.emplace(nodeColumns->fingerprint, nodeColumns->size, id);
+        }
+    }
+}
+
+void MemoryDbStore::erase(uint32_t id)
+{
+    records.erase(id);
+
+    auto it = columns.find(id);
+    if (it != columns.end())
+    {
+        children.erase(std::make_pair(it->second.parenthandle, id));
+        fingerprints.erase(std::make_tuple(it->second.fingerprint, it->second.size, id));
+        columns.erase(it);
+    }
+}
+
+void MemoryDbStore::clear()
+{
+    records.clear();
+    columns.clear();
+    children.clear();
+    fingerprints.clear();
+}
+
+MemoryDbTable::MemoryDbTable(PrnGen& rng, std::shared_ptr<MemoryDbStore> store, bool checkAlwaysTransacted)
+  : DbTable(rng, checkAlwaysTransacted)
+  , mStore(std::move(store))
+{
+}
+
+MemoryDbTable::~MemoryDbTable()
+{
+    resetCommitter();
+
+    if (inTransaction())
+    {
+        abort();
+    }
+}
+
+void MemoryDbTable::rewind()
+{
+    mScanning = true;
+    mScanId = 0;
+}
+
+bool MemoryDbTable::next(uint32_t* index, string* data)
+{
+    if (!mScanning)
+    {
+        return false;
+    }
+
+    auto it = mStore->records.lower_bound(mScanId);
+    if (it == mStore->records.end())
+    {
+        mScanning = false;
+        return false;
+    }
+
+    *index = it->first;
+    *data = it->second;
+
+    // the last id can't be followed by another
+    mScanning = it->first != UINT32_MAX;
+    mScanId = it->first + 1;
+    return true;
+}
+
+bool MemoryDbTable::get(uint32_t index, string* data)
+{
+    checkTransaction();
+
+    auto it = mStore->records.find(index);
+    if (it == mStore->records.end())
+    {
+        return false;
+    }
+
+    *data = it->second;
+    return true;
+}
+
+bool MemoryDbTable::put(uint32_t index, char* data, unsigned len)
+{
+    checkTransaction();
+    saveForUndo(index);
+    mStore->put(index, string(data, len), nullptr);
+    return true;
+}
+
+bool MemoryDbTable::putNodeRecord(const DbNodeRecord& record)
+{
+    checkTransaction();
+    saveForUndo(record.id);
+    mStore->put(record.id, record.data, &record.columns);
+    return true;
+}
+
+bool MemoryDbTable::del(uint32_t index)
+{
+    checkTransaction();
+    saveForUndo(index);
+    mStore->erase(index);
+    return true;
+}
+
+bool MemoryDbTable::getChildren(handle parent, NodeRefs* refs)
+{
+    checkTransaction();
+
+    refs->clear();
+    for (auto it = mStore->children.lower_bound(std::make_pair(parent, uint32_t(0)));
+         it != mStore->children.end() && it->first == parent; ++it)
+    {
+        refs->emplace_back(it->second, mStore->columns[it->second].nodehandle);
+    }
+    return true;
+}
+
+bool MemoryDbTable::getByFingerprint(const FileFingerprint& fingerprint, NodeRefs* refs)
+{
+    checkTransaction();
+
+    string serialized;
+    fingerprint.serializefingerprint(&serialized);
+
+    refs->clear();
+    for (auto it = mStore->fingerprints.lower_bound(std::make_tuple(serialized, fingerprint.size, uint32_t(0)));
+         it != mStore->fingerprints.end() && std::get<0>(*it) == serialized && std::get<1>(*it) == fingerprint.size; ++it)
+    {
+        uint32_t id = std::get<2>(*it);
+        refs->emplace_back(id, mStore->columns[id].nodehandle);
+    }
+    return true;
+}
+
+bool MemoryDbTable::nodeIndexComplete()
+{
+    // node records are never stored without their columns
+    return true;
+}
+
+void MemoryDbTable::setNodeIndexComplete()
+{
+}
+
+void MemoryDbTable::truncate()
+{
+    checkTransaction();
+
+    if (mInTransaction && !mTruncated)
+    {
+        // from now on, abort() puts back the whole store as of begin()
+        mTruncated.reset(new MemoryDbStore(*mStore));
+        undo(*mTruncated);
+    }
+
+    mStore->clear();
+}
+
+void MemoryDbTable::begin()
+{
+    LOG_debug << "DB transaction BEGIN (memory)";
+    mInTransaction = true;
+}
+
+void MemoryDbTable::commit()
+{
+    LOG_debug << "DB transaction COMMIT (memory)";
+    mInTransaction = false;
+    mTruncated.reset();
+    mUndo.clear();
+}
+
+void MemoryDbTable::abort()
+{
+    LOG_debug << "DB transaction ROLLBACK (memory)";
+
+    if (mTruncated)
+    {
+        *mStore = std::move(*mTruncated);
+        mTruncated.reset();
+    }
+
+    undo(*mStore);
+    mInTransaction = false;
+}
+
+void MemoryDbTable::undo(MemoryDbStore& store)
+{
+    for (auto& record : mUndo)
+    {
+        if (record.second.first)
+        {
+            store.put(record.first, std::move(*record.second.first), record.second.second.get());
+        }
+        else
+        {
+            store.erase(record.first);
+        }
+    }
+
+    mUndo.clear();
+}
+
+void MemoryDbTable::remove()
+{
+    if (inTransaction())
+    {
+        abort();
+    }
+
+    mStore->clear();
+    mStore->removed = true;
+}
+
+bool MemoryDbTable::inTransaction() const
+{
+    return mInTransaction;
+}
+
+void MemoryDbTable::saveForUndo(uint32_t id)
+{
+    // only the state before the first change in the transaction is of interest
+    if (!mInTransaction || mTruncated || mUndo.count(id))
+    {
+        return;
+    }
+
+    auto& undo = mUndo[id];
+
+    auto record = mStore->records.find(id);
+    if (record != mStore->records.end())
+    {
+        undo.first.reset(new string(record->second));
+    }
+
+    auto columns = mStore->columns.find(id);
+    if (columns != mStore->columns.end())
+    {
+        undo.second.reset(new DbNodeColumns(columns->second));
+    }
+}
+
+MemoryDbAccess::MemoryDbAccess(const LocalPath& rootPath)
+  : mRootPath(rootPath)
+{
+    // no legacy tables to read: this is always the current layout
+    currentDbVersion = DB_VERSION;
+}
+
+MemoryDbTable* MemoryDbAccess::open(PrnGen& rng, FileSystemAccess& fsAccess, const string& name, const int flags)
+{
+    // readers only open what another client in the process writes
+    if ((flags & DB_OPEN_FLAG_READONLY) && !probe(fsAccess, name))
+    {
+        return nullptr;
+    }
+
+    auto& store = mStores[name];
+
+    if (!store || store->removed)
+    {
+        store = std::make_shared<MemoryDbStore>();
+    }
+
+    LOG_debug << "Opened in-memory database: " << name << " (" << store->records.size() << " records)";
+    return new MemoryDbTable(rng, store, (flags & DB_OPEN_FLAG_TRANSACTED) > 0);
+}
+
+bool MemoryDbAccess::probe(FileSystemAccess&, const string& name) const
+{
+    auto it = mStores.find(name);
+    return it != mStores.end() && !it->second->removed;
+}
+
+const LocalPath& MemoryDbAccess::rootPath() const
+{
+    return mRootPath;
+}
+
+m_off_t MemoryDbAccess::memoryUsed() const
+{
+    m_off_t bytes = 0;
+    for (auto& s : mStores)
+    {
+        for (auto& r : s.second->records)
+        {
+            bytes += m_off_t(r.second.size());
+        }
+        for (auto& c : s.second->columns)
+        {
+            bytes += m_off_t(sizeof c.second + c.second.fingerprint.size());
+        }
+    }
+    return bytes;
+}
+
+} // namespace
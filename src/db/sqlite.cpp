@@ -57,8 +57,36 @@ LocalPath SqliteDbAccess::databasePath(const FileSystemAccess& fsAccess,
 SqliteDbTable* SqliteDbAccess::open(PrnGen &rng, FileSystemAccess& fsAccess, const string& name, const int flags)
 {
     auto dbPath = databasePath(fsAccess, name, DB_VERSION);
+
+    if (flags & DB_OPEN_FLAG_READONLY)
+    {
+        return openReadOnly(rng, fsAccess, dbPath, flags);
+    }
     auto upgraded = true;
 
+    // from a layout without the node table: the node records are in statecache
+    auto migrated = false;
+
+    // rename a database, with its -shm and -wal files, to dbPath
+    auto moveToDbPath = [&](LocalPath& from)
+    {
+        if (!fsAccess.renamelocal(from, dbPath, false))
+        {
+            return false;
+        }
+
+        for (auto suffix : { "-shm", "-wal" })
+        {
+            auto localSuffix = LocalPath::fromPath(suffix, fsAccess);
+            auto fromFile = from + localSuffix;
+            auto toFile = dbPath + localSuffix;
+
+            fsAccess.renamelocal(fromFile, toFile);
+        }
+
+        return true;
+    };
+
     {
         auto legacyPath = databasePath(fsAccess, name, LEGACY_DB_VERSION);
         auto fileAccess = fsAccess.newfileaccess();
@@ -77,21 +105,10 @@ SqliteDbTable* SqliteDbAccess::open(PrnGen &rng, FileSystemAccess& fsAccess, con
             {
                 LOG_debug << "Trying to recycle a legacy database.";
 
-                if (fsAccess.renamelocal(legacyPath, dbPath, false))
+                if (moveToDbPath(legacyPath))
                 {
-                    auto suffix = LocalPath::fromPath("-shm", fsAccess);
-                    auto from = legacyPath + suffix;
-                    auto to = dbPath + suffix;
-
-                    fsAccess.renamelocal(from, to);
-
-                    suffix = LocalPath::fromPath("-wal", fsAccess);
-                    from = legacyPath + suffix;
-                    to = dbPath + suffix;
-
-                    fsAccess.renamelocal(from, to);
-
                     LOG_debug << "Legacy database recycled.";
+                    migrated = true;
                 }
                 else
                 {
@@ -109,10 +126,32 @@ SqliteDbTable* SqliteDbAccess::open(PrnGen &rng, FileSystemAccess& fsAccess, con
 
     if (upgraded)
     {
+        // the upgraded layout before the node table
+        auto previousPath = databasePath(fsAccess, name, DB_VERSION - 1);
+        auto fileAccess = fsAccess.newfileaccess();
+
+        if (fileAccess->fopen(previousPath))
+        {
+            LOG_debug << "Found database without a node table at: " << previousPath.toPath(fsAccess);
+
+            if (moveToDbPath(previousPath))
+            {
+                LOG_debug << "Database migrated.";
+                migrated = true;
+            }
+            else
+            {
+                LOG_debug << "Unable to migrate database, deleting...";
+                fsAccess.unlinklocal(previousPath);
+            }
+        }
+
         LOG_debug << "Using an upgraded DB: " << dbPath.toPath(fsAccess);
         currentDbVersion = DB_VERSION;
     }
 
+    auto created = !fsAccess.newfileaccess(false)->isfile(dbPath);
+
     const string dbPathStr = dbPath.toPath(fsAccess);
     sqlite3* db;
     int result = sqlite3_open(dbPathStr.c_str(), &db);
@@ -127,6 +166,30 @@ SqliteDbTable* SqliteDbAccess::open(PrnGen &rng, FileSystemAccess& fsAccess, con
         return nullptr;
     }
 
+    // settings from the tuning profile are best effort: the database works without them
+    auto tune = [&](const string& pragma)
+    {
+        if (sqlite3_exec(db, pragma.c_str(), nullptr, nullptr, nullptr))
+        {
+            LOG_warn << "Unable to apply " << pragma << " to database: " << dbPathStr;
+        }
+    };
+
+    // (a page size only takes for a database that is still empty)
+    if (tuning.pageSize)
+    {
+        tune("PRAGMA page_size=" + std::to_string(tuning.pageSize) + ";");
+    }
+
+    // so that reclaimSpace() can give back the space of deleted records (like the page size, this
+    // has to be set before the database is initialized, which switching to WAL does)
+    if (created)
+    {
+        tune("PRAGMA auto_vacuum=INCREMENTAL;");
+    }
+
+    int checkpointInterval = 0;
+
 #if !(TARGET_OS_IPHONE)
     result = sqlite3_exec(db, "PRAGMA journal_mode=WAL;", nullptr, nullptr, nullptr);
     if (result)
@@ -134,8 +197,30 @@ SqliteDbTable* SqliteDbAccess::open(PrnGen &rng, FileSystemAccess& fsAccess, con
         sqlite3_close(db);
         return nullptr;
     }
+
+    if (tuning.checkpointIntervalSecs)
+    {
+        tune("PRAGMA wal_autocheckpoint=0;");
+        checkpointInterval = tuning.checkpointIntervalSecs;
+    }
 #endif /* ! TARGET_OS_IPHONE */
 
+    if (tuning.synchronousNormal)
+    {
+        tune("PRAGMA synchronous=NORMAL;");
+    }
+
+    if (tuning.cacheSizeKiB)
+    {
+        // negative: in KiB rather than pages
+        tune("PRAGMA cache_size=-" + std::to_string(tuning.cacheSizeKiB) + ";");
+    }
+
+    if (tuning.mmapSize)
+    {
+        tune("PRAGMA mmap_size=" + std::to_string(tuning.mmapSize) + ";");
+    }
+
     const char* sql =
       "CREATE TABLE IF NOT EXISTS statecache ( "
       "    id INTEGER PRIMARY KEY ASC NOT NULL, "
@@ -149,11 +234,90 @@ SqliteDbTable* SqliteDbAccess::open(PrnGen &rng, FileSystemAccess& fsAccess, con
         return nullptr;
     }
 
+    // node records, with the columns they are queried by (handles as 64-bit integers).  The
+    // user_version is 1 once all node records are here: in a migrated database, until the client
+    // writes them again
+    if (upgraded)
+    {
+        sql =
+          "CREATE TABLE IF NOT EXISTS nodes ( "
+          "    id INTEGER PRIMARY KEY ASC NOT NULL, "
+          "    nodehandle INTEGER NOT NULL, "
+          "    parenthandle INTEGER NOT NULL, "
+          "    type INTEGER NOT NULL, "
+          "    size INTEGER NOT NULL, "
+          "    ctime INTEGER NOT NULL, "
+          "    fingerprint BLOB, "
+          "    content BLOB NOT NULL "
+          "); "
+          "CREATE INDEX IF NOT EXISTS nodes_nodehandle ON nodes (nodehandle); "
+          "CREATE INDEX IF NOT EXISTS nodes_parenthandle ON nodes (parenthandle); "
+          "CREATE INDEX IF NOT EXISTS nodes_fingerprint ON nodes (fingerprint, size);";
+
+        result = sqlite3_exec(db, sql, nullptr, nullptr, nullptr);
+        if (!result && created && !migrated)
+        {
+            result = sqlite3_exec(db, "PRAGMA user_version=1;", nullptr, nullptr, nullptr);
+        }
+
+        if (result)
+        {
+            sqlite3_close(db);
+            return nullptr;
+        }
+    }
+
     return new SqliteDbTable(rng,
                              db,
                              fsAccess,
                              dbPathStr,
-                             (flags & DB_OPEN_FLAG_TRANSACTED) > 0);
+                             (flags & DB_OPEN_FLAG_TRANSACTED) > 0,
+                             checkpointInterval,
+                             upgraded);
+}
+
+// a database in the current layout, as created and kept by another process: nothing is migrated,
+// and the connection doesn't change its journal mode (the owner's write-ahead log is what lets
+// it read while the owner writes)
+SqliteDbTable* SqliteDbAccess::openReadOnly(PrnGen& rng, FileSystemAccess& fsAccess, const LocalPath& dbPath, const int flags)
+{
+    const string dbPathStr = dbPath.toPath(fsAccess);
+
+    if (!fsAccess.newfileaccess(false)->isfile(dbPath))
+    {
+        LOG_debug << "No database to read at: " << dbPathStr;
+        return nullptr;
+    }
+
+    sqlite3* db = nullptr;
+    if (sqlite3_open_v2(dbPathStr.c_str(), &db, SQLITE_OPEN_READONLY, nullptr))
+    {
+        LOG_err << "Unable to open database for reading: " << dbPathStr;
+        sqlite3_close(db);
+        return nullptr;
+    }
+
+    // the settings of the tuning profile that belong to the connection, best effort
+    if (tuning.cacheSizeKiB)
+    {
+        sqlite3_exec(db, ("PRAGMA cache_size=-" + std::to_string(tuning.cacheSizeKiB) + ";").c_str(), nullptr, nullptr, nullptr);
+    }
+
+    if (tuning.mmapSize)
+    {
+        sqlite3_exec(db, ("PRAGMA mmap_size=" + std::to_string(tuning.mmapSize) + ";").c_str(), nullptr, nullptr, nullptr);
+    }
+
+    currentDbVersion = DB_VERSION;
+    LOG_debug << "Reading database: " << dbPathStr;
+
+    return new SqliteDbTable(rng,
+                             db,
+                             fsAccess,
+                             dbPathStr,
+                             (flags & DB_OPEN_FLAG_TRANSACTED) > 0,
+                             0,
+                             true);
 }
 
 bool SqliteDbAccess::probe(FileSystemAccess& fsAccess, const string& name) const
@@ -167,6 +331,13 @@ bool SqliteDbAccess::probe(FileSystemAccess& fsAccess, const string& name) const
         return true;
     }
 
+    dbPath = databasePath(fsAccess, name, DB_VERSION - 1);
+
+    if (fileAccess->isfile(dbPath))
+    {
+        return true;
+    }
+
     dbPath = databasePath(fsAccess, name, LEGACY_DB_VERSION);
 
     return fileAccess->isfile(dbPath);
@@ -177,13 +348,22 @@ const LocalPath& SqliteDbAccess::rootPath() const
     return mRootPath;
 }
 
-SqliteDbTable::SqliteDbTable(PrnGen &rng, sqlite3* db, FileSystemAccess &fsAccess, const string &path, const bool checkAlwaysTransacted)
+m_off_t SqliteDbAccess::memoryUsed() const
+{
+    return m_off_t(sqlite3_memory_used());
+}
+
+SqliteDbTable::SqliteDbTable(PrnGen &rng, sqlite3* db, FileSystemAccess &fsAccess, const string &path, const bool checkAlwaysTransacted, int checkpointIntervalSecs, bool nodeTable)
   : DbTable(rng, checkAlwaysTransacted)
   , db(db)
   , pStmt(nullptr)
   , dbfile(path)
   , fsaccess(&fsAccess)
+  , mNodeTable(nodeTable)
+  , mCheckpointInterval(checkpointIntervalSecs)
+  , mLastCheckpoint(std::chrono::steady_clock::now())
 {
+    mNodesInStatecache = mNodeTable && userversion() < 1;
 }
 
 SqliteDbTable::~SqliteDbTable()
@@ -196,6 +376,7 @@ SqliteDbTable::~SqliteDbTable()
     }
 
     sqlite3_finalize(pStmt);
+    finalize();
 
     if (inTransaction())
     {
@@ -232,7 +413,11 @@ void SqliteDbTable::rewind()
     }
     else
     {
-        result = sqlite3_prepare(db, "SELECT id, content FROM statecache", -1, &pStmt, NULL);
+        const char* sql = mNodeTable
+          ? "SELECT id, content FROM statecache UNION ALL SELECT id, content FROM nodes"
+          : "SELECT id, content FROM statecache";
+
+        result = sqlite3_prepare(db, sql, -1, &pStmt, NULL);
     }
 
     if (result != SQLITE_OK)
@@ -280,6 +465,50 @@ bool SqliteDbTable::next(uint32_t* index, string* data)
     return true;
 }
 
+// compile sql into stmt on first use; afterwards stmt is reused as left by sqlite3_reset()
+int SqliteDbTable::prepare(sqlite3_stmt*& stmt, const char* sql)
+{
+    return stmt ? SQLITE_OK : sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+}
+
+void SqliteDbTable::finalize()
+{
+    sqlite3_finalize(mGetStmt);
+    sqlite3_finalize(mPutStmt);
+    sqlite3_finalize(mDelStmt);
+    sqlite3_finalize(mDelRangeStmt);
+    sqlite3_finalize(mPutNodeStmt);
+    sqlite3_finalize(mDelNodeStmt);
+    sqlite3_finalize(mDelNodeRangeStmt);
+    sqlite3_finalize(mChildrenStmt);
+    sqlite3_finalize(mFingerprintStmt);
+    mGetStmt = mPutStmt = mDelStmt = mDelRangeStmt = nullptr;
+    mPutNodeStmt = mDelNodeStmt = mDelNodeRangeStmt = mChildrenStmt = mFingerprintStmt = nullptr;
+}
+
+int SqliteDbTable::userversion()
+{
+    return int(pragma("user_version"));
+}
+
+// the value of a PRAGMA that has one, or 0 if it can't be read
+int64_t SqliteDbTable::pragma(const char* name)
+{
+    sqlite3_stmt* stmt;
+    int64_t value = 0;
+
+    if (sqlite3_prepare_v2(db, (string("PRAGMA ") + name).c_str(), -1, &stmt, NULL) == SQLITE_OK)
+    {
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            value = sqlite3_column_int64(stmt, 0);
+        }
+    }
+
+    sqlite3_finalize(stmt);
+    return value;
+}
+
 // retrieve record by index
 bool SqliteDbTable::get(uint32_t index, string* data)
 {
@@ -290,25 +519,22 @@ bool SqliteDbTable::get(uint32_t index, string* data)
 
     checkTransaction();
 
-    sqlite3_stmt *stmt;
-    int rc;
-
-    rc = sqlite3_prepare(db, "SELECT content FROM statecache WHERE id = ?", -1, &stmt, NULL);
+    int rc = prepare(mGetStmt, mNodeTable
+                     ? "SELECT content FROM statecache WHERE id = ?1 UNION ALL SELECT content FROM nodes WHERE id = ?1"
+                     : "SELECT content FROM statecache WHERE id = ?");
     if (rc == SQLITE_OK)
     {
-        rc = sqlite3_bind_int(stmt, 1, index);
+        rc = sqlite3_bind_int(mGetStmt, 1, index);
         if (rc == SQLITE_OK)
         {
-            rc = sqlite3_step(stmt);
+            rc = sqlite3_step(mGetStmt);
             if (rc == SQLITE_ROW)
             {
-                data->assign((char*)sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0));
+                data->assign((char*)sqlite3_column_blob(mGetStmt, 0), sqlite3_column_bytes(mGetStmt, 0));
             }
         }
     }
 
-    sqlite3_finalize(stmt);
-
     if (rc != SQLITE_DONE && rc != SQLITE_ROW)
     {
         string err = string(" Error: ") + (sqlite3_errmsg(db) ? sqlite3_errmsg(db) : std::to_string(rc));
@@ -316,6 +542,7 @@ bool SqliteDbTable::get(uint32_t index, string* data)
         assert(!"Unable to get record from database.");
     }
 
+    sqlite3_reset(mGetStmt);
     return rc == SQLITE_ROW;
 }
 
@@ -329,20 +556,49 @@ bool SqliteDbTable::put(uint32_t index, char* data, unsigned len)
 
     checkTransaction();
 
-    sqlite3_stmt *stmt;
+    return putrecord(index, data, len);
+}
+
+bool SqliteDbTable::putBatch(const RecordBatch& batch)
+{
+    if (!db)
+    {
+        return false;
+    }
+
+    checkTransaction();
+
+    for (auto& record : batch)
+    {
+        if (!putrecord(record.first, record.second.data(), unsigned(record.second.size())))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool SqliteDbTable::putrecord(uint32_t index, const char* data, unsigned len)
+{
+    if (mNodeTable && !execid(mDelNodeStmt, "DELETE FROM nodes WHERE id = ?", index))
+    {
+        return false;
+    }
+
     bool result = false;
 
-    int rc = sqlite3_prepare(db, "INSERT OR REPLACE INTO statecache (id, content) VALUES (?, ?)", -1, &stmt, NULL);
+    int rc = prepare(mPutStmt, "INSERT OR REPLACE INTO statecache (id, content) VALUES (?, ?)");
     if (rc == SQLITE_OK)
     {
-        rc = sqlite3_bind_int(stmt, 1, index);
+        rc = sqlite3_bind_int(mPutStmt, 1, index);
         if (rc == SQLITE_OK)
         {
-            rc = sqlite3_bind_blob(stmt, 2, data, len, SQLITE_STATIC);
+            rc = sqlite3_bind_blob(mPutStmt, 2, data, len, SQLITE_STATIC);
             if (rc == SQLITE_OK)
             {
 
-                rc = sqlite3_step(stmt);
+                rc = sqlite3_step(mPutStmt);
                 if (rc == SQLITE_DONE)
                 {
                     result = true;
@@ -351,8 +607,6 @@ bool SqliteDbTable::put(uint32_t index, char* data, unsigned len)
         }
     }
 
-    sqlite3_finalize(stmt);
-
     if (!result)
     {
         string err = string(" Error: ") + (sqlite3_errmsg(db) ? sqlite3_errmsg(db) : std::to_string(rc));
@@ -360,6 +614,9 @@ bool SqliteDbTable::put(uint32_t index, char* data, unsigned len)
         assert(!"Unable to put record into database.");
     }
 
+    // the data is bound without a copy: don't keep referencing it
+    sqlite3_reset(mPutStmt);
+    sqlite3_clear_bindings(mPutStmt);
     return result;
 }
 
@@ -373,23 +630,338 @@ bool SqliteDbTable::del(uint32_t index)
 
     checkTransaction();
 
-    char buf[64];
+    return delrecord(index);
+}
+
+bool SqliteDbTable::delBatch(const vector<uint32_t>& ids)
+{
+    if (!db)
+    {
+        return false;
+    }
+
+    checkTransaction();
+
+    for (uint32_t id : ids)
+    {
+        if (!delrecord(id))
+        {
+            return false;
+        }
+    }
 
-    sprintf(buf, "DELETE FROM statecache WHERE id = %" PRIu32, index);
+    return true;
+}
 
-    int rc = sqlite3_exec(db, buf, 0, 0, nullptr);
-    if (rc != SQLITE_OK)
+// a single statement for the whole range (the removal of a large subtree, for example)
+bool SqliteDbTable::delRange(const vector<uint32_t>& ids)
+{
+    if (!db)
+    {
+        return false;
+    }
+
+    // ids are stored as signed integers, a range can't cross over to the negative ones
+    if (ids.size() < 2 || int(ids.front()) > int(ids.back()))
+    {
+        return delBatch(ids);
+    }
+
+    checkTransaction();
+
+    return execrange(mDelRangeStmt, "DELETE FROM statecache WHERE id BETWEEN ? AND ?", ids.front(), ids.back())
+        && (!mNodeTable || execrange(mDelNodeRangeStmt, "DELETE FROM nodes WHERE id BETWEEN ? AND ?", ids.front(), ids.back()));
+}
+
+bool SqliteDbTable::delrecord(uint32_t index)
+{
+    return execid(mDelStmt, "DELETE FROM statecache WHERE id = ?", index)
+        && (!mNodeTable || execid(mDelNodeStmt, "DELETE FROM nodes WHERE id = ?", index));
+}
+
+// run a statement that takes a record id and returns no rows
+bool SqliteDbTable::execid(sqlite3_stmt*& stmt, const char* sql, uint32_t index)
+{
+    int rc = prepare(stmt, sql);
+    if (rc == SQLITE_OK)
+    {
+        rc = sqlite3_bind_int(stmt, 1, index);
+        if (rc == SQLITE_OK)
+        {
+            rc = sqlite3_step(stmt);
+        }
+    }
+
+    if (rc != SQLITE_DONE)
     {
         string err = string(" Error: ") + (sqlite3_errmsg(db) ? sqlite3_errmsg(db) : std::to_string(rc));
         LOG_err << "Unable to delete record from database: " << dbfile << err;
         assert(!"Unable to delete record from database.");
+    }
+
+    sqlite3_reset(stmt);
+    return rc == SQLITE_DONE;
+}
+
+// the same, for the records from one id to another
+bool SqliteDbTable::execrange(sqlite3_stmt*& stmt, const char* sql, uint32_t first, uint32_t last)
+{
+    int rc = prepare(stmt, sql);
+    if (rc == SQLITE_OK)
+    {
+        rc = sqlite3_bind_int(stmt, 1, first);
+        if (rc == SQLITE_OK)
+        {
+            rc = sqlite3_bind_int(stmt, 2, last);
+            if (rc == SQLITE_OK)
+            {
+                rc = sqlite3_step(stmt);
+            }
+        }
+    }
+
+    if (rc != SQLITE_DONE)
+    {
+        string err = string(" Error: ") + (sqlite3_errmsg(db) ? sqlite3_errmsg(db) : std::to_string(rc));
+        LOG_err << "Unable to delete records from database: " << dbfile << err;
+        assert(!"Unable to delete records from database.");
+    }
+
+    sqlite3_reset(stmt);
+    return rc == SQLITE_DONE;
+}
+
+bool SqliteDbTable::putNodeRecord(const DbNodeRecord& record)
+{
+    if (!mNodeTable)
+    {
+        return DbTable::putNodeRecord(record);
+    }
+
+    if (!db)
+    {
+        return false;
+    }
+
+    checkTransaction();
+
+    // a record of each id, in either table (a migrated one moves to this one)
+    if (!execid(mDelStmt, "DELETE FROM statecache WHERE id = ?", record.id))
+    {
+        return false;
+    }
+
+    const DbNodeColumns& columns = record.columns;
+
+    int rc = prepare(mPutNodeStmt, "INSERT OR REPLACE INTO nodes (id, nodehandle, parenthandle, type, size, ctime, fingerprint, content) "
+                                   "VALUES (?, ?, ?, ?, ?, ?, ?, ?)");
+    if (rc == SQLITE_OK) rc = sqlite3_bind_int(mPutNodeStmt, 1, record.id);
+    if (rc == SQLITE_OK) rc = sqlite3_bind_int64(mPutNodeStmt, 2, sqlite3_int64(columns.nodehandle));
+    if (rc == SQLITE_OK) rc = sqlite3_bind_int64(mPutNodeStmt, 3, sqlite3_int64(columns.parenthandle));
+    if (rc == SQLITE_OK) rc = sqlite3_bind_int(mPutNodeStmt, 4, columns.type);
+    if (rc == SQLITE_OK) rc = sqlite3_bind_int64(mPutNodeStmt, 5, columns.size);
+    if (rc == SQLITE_OK) rc = sqlite3_bind_int64(mPutNodeStmt, 6, columns.ctime);
+    if (rc == SQLITE_OK)
+    {
+        rc = columns.fingerprint.empty()
+           ? sqlite3_bind_null(mPutNodeStmt, 7)
+           : sqlite3_bind_blob(mPutNodeStmt, 7, columns.fingerprint.data(), int(columns.fingerprint.size()), SQLITE_STATIC);
+    }
+    if (rc == SQLITE_OK) rc = sqlite3_bind_blob(mPutNodeStmt, 8, record.data.data(), int(record.data.size()), SQLITE_STATIC);
+    if (rc == SQLITE_OK) rc = sqlite3_step(mPutNodeStmt);
+
+    if (rc != SQLITE_DONE)
+    {
+        string err = string(" Error: ") + (sqlite3_errmsg(db) ? sqlite3_errmsg(db) : std::to_string(rc));
+        LOG_err << "Unable to put node record into database: " << dbfile << err;
+        assert(!"Unable to put node record into database.");
+    }
+
+    // the data is bound without a copy: don't keep referencing it
+    sqlite3_reset(mPutNodeStmt);
+    sqlite3_clear_bindings(mPutNodeStmt);
+    return rc == SQLITE_DONE;
+}
+
+bool SqliteDbTable::getChildren(handle parent, NodeRefs* refs)
+{
+    if (!db || !nodeIndexComplete())
+    {
+        return false;
+    }
+
+    checkTransaction();
+
+    int rc = prepare(mChildrenStmt, "SELECT id, nodehandle FROM nodes WHERE parenthandle = ?");
+    if (rc == SQLITE_OK)
+    {
+        rc = sqlite3_bind_int64(mChildrenStmt, 1, sqlite3_int64(parent));
+    }
+
+    return querynodes(mChildrenStmt, rc, refs);
+}
+
+bool SqliteDbTable::getByFingerprint(const FileFingerprint& fingerprint, NodeRefs* refs)
+{
+    if (!db || !nodeIndexComplete())
+    {
+        return false;
+    }
+
+    checkTransaction();
+
+    string serialized;
+    fingerprint.serializefingerprint(&serialized);
+
+    int rc = prepare(mFingerprintStmt, "SELECT id, nodehandle FROM nodes WHERE fingerprint = ? AND size = ?");
+    if (rc == SQLITE_OK)
+    {
+        rc = sqlite3_bind_blob(mFingerprintStmt, 1, serialized.data(), int(serialized.size()), SQLITE_STATIC);
+        if (rc == SQLITE_OK)
+        {
+            rc = sqlite3_bind_int64(mFingerprintStmt, 2, fingerprint.size);
+        }
+    }
+
+    return querynodes(mFingerprintStmt, rc, refs);
+}
+
+// collect the (id, nodehandle) rows of a query whose parameters are bound (if rc is SQLITE_OK)
+bool SqliteDbTable::querynodes(sqlite3_stmt* stmt, int rc, NodeRefs* refs)
+{
+    refs->clear();
+
+    if (rc == SQLITE_OK)
+    {
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            refs->emplace_back(uint32_t(sqlite3_column_int(stmt, 0)), handle(sqlite3_column_int64(stmt, 1)));
+        }
+    }
+
+    if (rc != SQLITE_DONE)
+    {
+        string err = string(" Error: ") + (sqlite3_errmsg(db) ? sqlite3_errmsg(db) : std::to_string(rc));
+        LOG_err << "Unable to query nodes in database: " << dbfile << err;
+        assert(!"Unable to query nodes in database.");
+    }
+
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return rc == SQLITE_DONE;
+}
+
+bool SqliteDbTable::nodeIndexComplete()
+{
+    return db && mNodeTable && !mNodesInStatecache;
+}
+
+void SqliteDbTable::setNodeIndexComplete()
+{
+    if (!db || !mNodeTable)
+    {
+        return;
+    }
+
+    checkTransaction();
+
+    int rc = sqlite3_exec(db, "PRAGMA user_version=1", 0, 0, NULL);
+    if (rc != SQLITE_OK)
+    {
+        string err = string(" Error: ") + (sqlite3_errmsg(db) ? sqlite3_errmsg(db) : std::to_string(rc));
+        LOG_err << "Unable to mark node records as indexed in database: " << dbfile << err;
+        return;
+    }
+
+    mNodesInStatecache = false;
+}
+
+// pages on the free list: the database keeps them for new records unless they are given back
+int64_t SqliteDbTable::reclaimableBytes()
+{
+    if (!db)
+    {
+        return 0;
+    }
+
+    return pragma("freelist_count") * pragma("page_size");
+}
+
+// with auto_vacuum=INCREMENTAL, move pages from the end of the file into free ones and truncate
+// it (in a transaction, when that commits; with a write-ahead log, at the next checkpoint)
+int64_t SqliteDbTable::reclaimSpace(int64_t maxBytes)
+{
+    if (!db || pragma("auto_vacuum") != 2)
+    {
+        return 0;
+    }
+
+    int64_t pageSize = pragma("page_size");
+    int64_t freePages = pragma("freelist_count");
+    if (!freePages || pageSize <= 0)
+    {
+        return 0;
+    }
+
+    int64_t pages = std::max<int64_t>(1, maxBytes / pageSize);
+    string sql = "PRAGMA incremental_vacuum(" + std::to_string(pages) + ")";
+
+    int rc = sqlite3_exec(db, sql.c_str(), 0, 0, NULL);
+    if (rc != SQLITE_OK)
+    {
+        string err = string(" Error: ") + (sqlite3_errmsg(db) ? sqlite3_errmsg(db) : std::to_string(rc));
+        LOG_warn << "Unable to reclaim space in database: " << dbfile << err;
+        return 0;
+    }
 
+    return (freePages - pragma("freelist_count")) * pageSize;
+}
+
+// the auto_vacuum mode of a database that has tables only changes with a VACUUM, which also
+// writes the records contiguously into a new file
+bool SqliteDbTable::vacuum()
+{
+    if (!db || inTransaction())
+    {
         return false;
     }
 
+    if (pragma("auto_vacuum") == 2)
+    {
+        return true;
+    }
+
+    sqlite3_finalize(pStmt);
+    pStmt = nullptr;
+
+    auto start = std::chrono::steady_clock::now();
+    int64_t reclaimable = reclaimableBytes();
+
+    int rc = sqlite3_exec(db, "PRAGMA auto_vacuum=INCREMENTAL; VACUUM", 0, 0, NULL);
+    if (rc != SQLITE_OK)
+    {
+        string err = string(" Error: ") + (sqlite3_errmsg(db) ? sqlite3_errmsg(db) : std::to_string(rc));
+        LOG_err << "Unable to vacuum database: " << dbfile << err;
+        return false;
+    }
+
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    LOG_info << "DB vacuum " << dbfile << ": " << reclaimable << " bytes reclaimed in " << ms << " ms";
     return true;
 }
 
+// sqlite's data_version changes when another connection commits, which with a write-ahead log
+// is seen as soon as there are new frames in it
+int64_t SqliteDbTable::dataVersion()
+{
+    if (!db)
+    {
+        return 0;
+    }
+
+    return pragma("data_version");
+}
+
 // truncate table
 void SqliteDbTable::truncate()
 {
@@ -400,13 +972,18 @@ void SqliteDbTable::truncate()
 
     checkTransaction();
 
-    int rc = sqlite3_exec(db, "DELETE FROM statecache", 0, 0, NULL);
+    int rc = sqlite3_exec(db, mNodeTable ? "DELETE FROM statecache; DELETE FROM nodes; PRAGMA user_version=1"
+                                         : "DELETE FROM statecache", 0, 0, NULL);
     if (rc != API_OK)
     {
         string err = string(" Error: ") + (sqlite3_errmsg(db) ? sqlite3_errmsg(db) : std::to_string(rc));
         LOG_err << "Unable to truncate database: " << dbfile << err;
         assert(!"Unable to truncate database.");
     }
+    else
+    {
+        mNodesInStatecache = false;
+    }
 }
 
 // begin transaction
@@ -444,6 +1021,43 @@ void SqliteDbTable::commit()
         LOG_err << "Unable to commit transaction on database: " << dbfile << err;
         assert(!"Unable to commit transaction on database.");
     }
+    else if (mCheckpointInterval
+             && std::chrono::steady_clock::now() - mLastCheckpoint >= std::chrono::seconds(mCheckpointInterval))
+    {
+        checkpoint();
+    }
+}
+
+// copy the pages of the write-ahead log that no reader needs into the database, without waiting
+// for readers or writers
+void SqliteDbTable::checkpoint()
+{
+    auto start = std::chrono::steady_clock::now();
+    int logFrames = 0;
+    int checkpointedFrames = 0;
+
+    int rc = sqlite3_wal_checkpoint_v2(db, nullptr, SQLITE_CHECKPOINT_PASSIVE, &logFrames, &checkpointedFrames);
+
+    mLastCheckpoint = std::chrono::steady_clock::now();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(mLastCheckpoint - start).count();
+
+    if (rc != SQLITE_OK)
+    {
+        string err = string(" Error: ") + (sqlite3_errmsg(db) ? sqlite3_errmsg(db) : std::to_string(rc));
+        LOG_warn << "Unable to checkpoint database: " << dbfile << err;
+        return;
+    }
+
+    m_off_t walSize = -1;
+    auto walPath = LocalPath::fromPath(dbfile + "-wal", *fsaccess);
+    auto fileAccess = fsaccess->newfileaccess(false);
+    if (fileAccess->fopen(walPath))
+    {
+        walSize = fileAccess->size;
+    }
+
+    LOG_debug << "DB checkpoint " << dbfile << ": " << checkpointedFrames << " of " << logFrames
+              << " WAL frames in " << ms << " ms. WAL size: " << walSize;
 }
 
 // abort transaction
@@ -463,9 +1077,23 @@ void SqliteDbTable::abort()
         LOG_err << "Unable to rollback transaction on database: " << dbfile << err;
         assert(!"Unable to rollback transaction on database.");
     }
+
+    // the transaction may have been the one completing the node index
+    mNodesInStatecache = mNodeTable && userversion() < 1;
 }
 
 void SqliteDbTable::remove()
+{
+    vector<LocalPath> files;
+    removeLater(files);
+
+    for (auto& file : files)
+    {
+        fsaccess->unlinklocal(file);
+    }
+}
+
+void SqliteDbTable::removeLater(vector<LocalPath>& files)
 {
     if (!db)
     {
@@ -473,18 +1101,37 @@ void SqliteDbTable::remove()
     }
 
     sqlite3_finalize(pStmt);
+    finalize();
 
     if (inTransaction())
     {
         abort();
     }
 
+#ifdef SQLITE_DBCONFIG_NO_CKPT_ON_CLOSE
+    // no point in copying the write-ahead log into a database about to be deleted
+    sqlite3_db_config(db, SQLITE_DBCONFIG_NO_CKPT_ON_CLOSE, 1, nullptr);
+#endif
+
     sqlite3_close(db);
 
     db = NULL;
 
-    auto localpath = LocalPath::fromPath(dbfile, *fsaccess);
-    fsaccess->unlinklocal(localpath);
+    // the database and the write-ahead log with its index, if they are still there
+    for (const char* suffix : { "", "-wal", "-shm" })
+    {
+        auto localpath = LocalPath::fromPath(dbfile + suffix, *fsaccess);
+        auto removed = LocalPath::fromPath(dbfile + suffix + ".removed", *fsaccess);
+        if (fsaccess->renamelocal(localpath, removed, true))
+        {
+            files.push_back(removed);
+        }
+        else if (!*suffix)
+        {
+            // deleted now, then, or a new database would open it
+            fsaccess->unlinklocal(localpath);
+        }
+    }
 }
 } // namespace
 
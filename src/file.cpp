@@ -37,6 +37,7 @@ File::File()
     hforeign = false;
     syncxfer = false;
     temporaryfile = false;
+    cachedirty = false;
     tag = 0;
 }
 
@@ -321,12 +322,8 @@ void File::completed(Transfer* t, LocalNode* l)
         // store fingerprint
         t->serializefingerprint(&attrs.map['c']);
 
-        string tattrstring;
-
-        attrs.getjson(&tattrstring);
-
         newnode->attrstring.reset(new string);
-        t->client->makeattr(t->transfercipher(), newnode->attrstring, tattrstring.c_str());
+        t->client->makeattr(t->transfercipher(), newnode->attrstring, attrs);
 
         if (targetuser.size())
         {
@@ -370,6 +367,16 @@ void File::completed(Transfer* t, LocalNode* l)
                 newnode->ovhandle = t->client->getovhandle(t->client->nodebyhandle(th), &name);
             }
 
+            bool batched = t->client->batchputnodes;
+#ifdef ENABLE_SYNC
+            batched = batched && !l;
+#endif
+            if (batched)
+            {
+                t->client->batchputnode(th, std::move(newnodes[0]), tag);
+                return;
+            }
+
             t->client->reqs.add(new CommandPutNodes(t->client,
                                                                   th, NULL,
                                                                   move(newnodes),
@@ -394,21 +401,23 @@ bool File::failed(error e)
 {
     if (e == API_EKEY)
     {
-        if (!transfer->hascurrentmetamac)
+        Transfer::Integrity& integrity = transfer->integrity();
+
+        if (!integrity.hascurrentmetamac)
         {
             // several integrity check errors uploading chunks
             return transfer->failcount < 1;
         }
 
-        if (transfer->hasprevmetamac && transfer->prevmetamac == transfer->currentmetamac)
+        if (integrity.hasprevmetamac && integrity.prevmetamac == integrity.currentmetamac)
         {
             // integrity check failed after download, two times with the same value
             return false;
         }
 
         // integrity check failed once, try again
-        transfer->prevmetamac = transfer->currentmetamac;
-        transfer->hasprevmetamac = true;
+        integrity.prevmetamac = integrity.currentmetamac;
+        integrity.hasprevmetamac = true;
         return transfer->failcount < 16;
     }
 
@@ -458,6 +467,7 @@ SyncFileGet::SyncFileGet(Sync* csync, Node* cn, const LocalPath& clocalname)
     n->syncget = this;
 
     sync->mUnifiedSync.mNextHeartbeat->adjustTransferCounts(0, 1, size, 0) ;
+    sync->downloadsinflight++;
 }
 
 SyncFileGet::~SyncFileGet()
@@ -466,6 +476,8 @@ SyncFileGet::~SyncFileGet()
     {
         n->syncget = NULL;
     }
+
+    sync->downloadended();
 }
 
 // create sync-specific temp download directory and set unique filename
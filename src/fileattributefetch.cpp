@@ -23,16 +23,16 @@
 #include "mega/megaclient.h"
 #include "mega/megaapp.h"
 #include "mega/logging.h"
+#include "mega/db.h"
 
 namespace mega {
 FileAttributeFetchChannel::FileAttributeFetchChannel(MegaClient* client)
-    : client(client), bt(client->rng), timeout(client->rng)
+    : client(client), bt(client->rng)
 {
-    req.binary = true;
-    req.status = REQ_READY;
     urltime = 0;
     fahref = UNDEF;
-    inbytes = 0;
+    gettingurl = false;
+    maxfetches = 1;
     e = API_EINTERNAL;
 }
 
@@ -47,51 +47,38 @@ FileAttributeFetch::FileAttributeFetch(handle h, string key, fatype t, int ctag)
 
 void FileAttributeFetchChannel::dispatch()
 {
-    faf_map::iterator it;
+    while (fafs[0].size() && fetches.size() < maxfetches)
+    {
+        // the fresh attributes shared among the fetches that can start
+        size_t room = maxfetches - fetches.size();
+        size_t count = std::max<size_t>((fafs[0].size() + room - 1) / room, size_t(MINFETCHBATCH));
 
-    // reserve space
-    req.outbuf.clear();
-    req.outbuf.reserve((fafs[0].size() + fafs[1].size()) * sizeof(handle));
+        std::unique_ptr<Fetch> f(new Fetch(client->rng));
+        f->req.binary = true;
+        f->req.outbuf.reserve(std::min(count, fafs[0].size()) * sizeof(handle));
 
-    for (int i = 2; i--; )
-    {
-        for (it = fafs[i].begin(); it != fafs[i].end(); )
+        for (faf_map::iterator it = fafs[0].begin(); it != fafs[0].end() && f->handles.size() < count; )
         {
-            req.outbuf.append((char*)&it->first, sizeof(handle));
+            f->req.outbuf.append((char*)&it->first, sizeof(handle));
+            f->handles.push_back(it->first);
 
-            if (!i)
-            {
-                // move from fresh to pending
-                fafs[1][it->first] = it->second;
-                fafs[0].erase(it++);
-            }
-            else
-            {
-                it++;
-            }
+            // move from fresh to pending
+            fafs[1][it->first] = it->second;
+            fafs[0].erase(it++);
         }
-    }
 
-    if (req.outbuf.size())
-    {
-        LOG_debug << "Getting file attribute";
+        LOG_debug << "Getting " << f->handles.size() << " file attributes";
         e = API_EFAILED;
-        inbytes = 0;
-        req.in.clear();
-        req.posturl = posturl;
-        req.post(client);
+        f->req.posturl = posturl;
+        f->req.post(client);
+        f->timeout.backoff(150);
 
-        timeout.backoff(150);
-    }
-    else
-    {
-        timeout.reset();
-        req.status = REQ_PREPARED;
+        fetches.push_back(std::move(f));
     }
 }
 
 // communicate received file attributes to the application
-void FileAttributeFetchChannel::parse(int /*fac*/, bool final)
+void FileAttributeFetchChannel::parse(Fetch& f, bool final)
 {
 #pragma pack(push,1)
     struct FaHeader
@@ -101,8 +88,8 @@ void FileAttributeFetchChannel::parse(int /*fac*/, bool final)
     };
 #pragma pack(pop)
 
-    const char* ptr = req.data();
-    const char* endptr = ptr + req.size();
+    const char* ptr = f.req.data();
+    const char* endptr = ptr + f.req.size();
     faf_map::iterator it;
     uint32_t falen = 0;
 
@@ -120,7 +107,7 @@ void FileAttributeFetchChannel::parse(int /*fac*/, bool final)
             }
             else
             {
-                req.purge(ptr - req.data());
+                f.req.purge(ptr - f.req.data());
             }
 
             break;
@@ -137,6 +124,9 @@ void FileAttributeFetchChannel::parse(int /*fac*/, bool final)
 
             if (!(falen & (SymmCipher::BLOCKSIZE - 1)))
             {
+                // kept as it arrived, encrypted
+                client->facache.put(it->first, ptr, falen);
+
                 if (client->tmpnodecipher.setkey(&it->second->nodekey))
                 {
                     client->tmpnodecipher.cbc_decrypt((byte*)ptr, falen);
@@ -153,17 +143,24 @@ void FileAttributeFetchChannel::parse(int /*fac*/, bool final)
 }
 
 // notify the application of the request failure and remove records no longer needed
-void FileAttributeFetchChannel::failed()
+void FileAttributeFetchChannel::failed(const vector<handle>& handles)
 {
-    for (faf_map::iterator it = fafs[1].begin(); it != fafs[1].end(); )
+    for (handle fah : handles)
     {
+        faf_map::iterator it = fafs[1].find(fah);
+        if (it == fafs[1].end())
+        {
+            // arrived, or cancelled
+            continue;
+        }
+
         client->restag = it->second->tag;
 
         if (client->app->fa_failed(it->second->nodehandle, it->second->type, it->second->retries, e))
         {
             // no retry desired
             delete it->second;
-            fafs[1].erase(it++);
+            fafs[1].erase(it);
         }
         else
         {
@@ -172,9 +169,260 @@ void FileAttributeFetchChannel::failed()
 
             // move from pending to fresh
             fafs[0][it->first] = it->second;
-            fafs[1].erase(it++);
-            req.status = REQ_PREPARED;
+            fafs[1].erase(it);
+        }
+    }
+}
+
+void FileAttributeFetchChannel::urlfailed(error err)
+{
+    gettingurl = false;
+    e = err;
+
+    vector<handle> handles;
+    for (faf_map::iterator it = fafs[0].begin(); it != fafs[0].end(); )
+    {
+        // move from fresh to pending
+        handles.push_back(it->first);
+        fafs[1][it->first] = it->second;
+        fafs[0].erase(it++);
+    }
+
+    failed(handles);
+    bt.backoff();
+    urltime = 0;
+}
+
+void FileAttributeFetchChannel::requeue(const Fetch& f)
+{
+    for (handle fah : f.handles)
+    {
+        faf_map::iterator it = fafs[1].find(fah);
+        if (it != fafs[1].end())
+        {
+            fafs[0][it->first] = it->second;
+            fafs[1].erase(it);
+        }
+    }
+}
+
+FileAttributeCache::FileAttributeCache()
+{
+}
+
+FileAttributeCache::~FileAttributeCache()
+{
+    commit();
+}
+
+void FileAttributeCache::setCapacity(m_off_t bytes)
+{
+    mCapacity = std::max<m_off_t>(bytes, 0);
+    evict();
+}
+
+bool FileAttributeCache::contains(handle fah) const
+{
+    return mEntries.count(fah) > 0;
+}
+
+bool FileAttributeCache::get(handle fah, string& data)
+{
+    auto it = mEntries.find(fah);
+    if (it == mEntries.end())
+    {
+        return false;
+    }
+
+    Entry& entry = it->second;
+    if (mTable)
+    {
+        string record;
+        bool read = mTable->get(entry.id, &record);
+        if (read)
+        {
+            handle h;
+            CacheableReader r(record);
+            read = r.unserializehandle(h) && h == fah && r.unserializestring(data) && data.size() == entry.size;
+        }
+
+        if (!read)
+        {
+            LOG_warn << "Unable to read a cached file attribute";
+            begin();
+            mTable->del(entry.id);
+            mSize -= m_off_t(entry.size);
+            mLru.erase(entry.lru);
+            mEntries.erase(it);
+            return false;
+        }
+    }
+    else
+    {
+        data = entry.data;
+    }
+
+    mLru.splice(mLru.begin(), mLru, entry.lru);
+    return true;
+}
+
+void FileAttributeCache::put(handle fah, const char* data, size_t len)
+{
+    if (!mCapacity || m_off_t(len) > mCapacity || mEntries.count(fah))
+    {
+        return;
+    }
+
+    Entry& entry = mEntries[fah];
+    entry.size = len;
+    entry.lru = mLru.insert(mLru.begin(), fah);
+    mSize += m_off_t(len);
+
+    if (mTable)
+    {
+        entry.id = mNextId++;
+
+        string record;
+        CacheableWriter w(record);
+        w.serializehandle(fah);
+        w.serializestring(string(data, len));
+
+        begin();
+        if (!mTable->put(entry.id, &record))
+        {
+            LOG_warn << "Unable to cache a file attribute";
         }
     }
+    else
+    {
+        entry.data.assign(data, len);
+    }
+
+    evict();
+}
+
+void FileAttributeCache::persist(std::unique_ptr<DbTable> table)
+{
+    close(false);
+    mTable = std::move(table);
+
+    if (!mTable)
+    {
+        return;
+    }
+
+    uint32_t id;
+    string record;
+    vector<uint32_t> unreadable;
+
+    // the first ones written are the first dropped: it's the order they were used in that
+    // isn't kept
+    std::map<uint32_t, handle> byid;
+
+    mTable->rewind();
+    while (mTable->next(&id, &record))
+    {
+        handle fah;
+        string data;
+        CacheableReader r(record);
+
+        if (r.unserializehandle(fah) && r.unserializestring(data) && !mEntries.count(fah))
+        {
+            Entry& entry = mEntries[fah];
+            entry.id = id;
+            entry.size = data.size();
+            mSize += m_off_t(data.size());
+            byid[id] = fah;
+        }
+        else
+        {
+            unreadable.push_back(id);
+        }
+
+        mNextId = std::max(mNextId, id + 1);
+    }
+
+    for (auto& i : byid)
+    {
+        mEntries[i.second].lru = mLru.insert(mLru.begin(), i.second);
+    }
+
+    if (!unreadable.empty())
+    {
+        LOG_warn << "Discarding " << unreadable.size() << " unreadable cached file attributes";
+        mTable->delBatch(unreadable);
+    }
+
+    LOG_debug << "Loaded " << mEntries.size() << " cached file attributes, " << mSize << " bytes";
+    evict();
+    commit();
+}
+
+bool FileAttributeCache::persisted() const
+{
+    return !!mTable;
+}
+
+void FileAttributeCache::commit()
+{
+    if (mUncommitted)
+    {
+        mTable->commit();
+        mUncommitted = false;
+    }
+}
+
+void FileAttributeCache::close(bool remove)
+{
+    if (remove && mTable)
+    {
+        if (mUncommitted)
+        {
+            mTable->abort();
+            mUncommitted = false;
+        }
+        mTable->remove();
+    }
+
+    commit();
+    mTable.reset();
+    mEntries.clear();
+    mLru.clear();
+    mSize = 0;
+    mNextId = 1;
+}
+
+void FileAttributeCache::begin()
+{
+    if (!mUncommitted)
+    {
+        mTable->begin();
+        mUncommitted = true;
+    }
+}
+
+void FileAttributeCache::evict()
+{
+    vector<uint32_t> dropped;
+
+    while (mSize > mCapacity && !mLru.empty())
+    {
+        auto it = mEntries.find(mLru.back());
+        assert(it != mEntries.end());
+        mLru.pop_back();
+
+        mSize -= m_off_t(it->second.size);
+        if (mTable)
+        {
+            dropped.push_back(it->second.id);
+        }
+        mEntries.erase(it);
+    }
+
+    if (!dropped.empty())
+    {
+        begin();
+        mTable->delBatch(dropped);
+    }
 }
 } // namespace
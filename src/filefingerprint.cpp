@@ -20,6 +20,7 @@
  */
 
 #include "mega/filefingerprint.h"
+#include "mega/db.h"
 #include "mega/serialize64.h"
 #include "mega/base64.h"
 #include "mega/logging.h"
@@ -80,28 +81,37 @@ FileFingerprint *FileFingerprint::unserialize(string *d)
     const char* ptr = d->data();
     const char* end = ptr + d->size();
 
-    if (ptr + sizeof(m_off_t) + sizeof(m_time_t) + 4 * sizeof(int32_t) + sizeof(bool) > end)
+    FileFingerprint *fp = new FileFingerprint();
+    if (!unserialize(ptr, end, *fp))
     {
-        LOG_err << "FileFingerprint unserialization failed - serialized string too short";
+        delete fp;
         return NULL;
     }
 
-    FileFingerprint *fp = new FileFingerprint();
+    d->erase(0, ptr - d->data());
+    return fp;
+}
 
-    fp->size = MemAccess::get<m_off_t>(ptr);
+bool FileFingerprint::unserialize(const char*& ptr, const char* end, FileFingerprint& fp)
+{
+    if (ptr + sizeof(m_off_t) + sizeof(m_time_t) + 4 * sizeof(int32_t) + sizeof(bool) > end)
+    {
+        LOG_err << "FileFingerprint unserialization failed - serialized string too short";
+        return false;
+    }
+
+    fp.size = MemAccess::get<m_off_t>(ptr);
     ptr += sizeof(m_off_t);
 
-    fp->mtime = MemAccess::get<m_time_t>(ptr);
+    fp.mtime = MemAccess::get<m_time_t>(ptr);
     ptr += sizeof(m_time_t);
 
-    memcpy(fp->crc.data(), ptr, sizeof(fp->crc));
-    ptr += sizeof(fp->crc);
+    memcpy(fp.crc.data(), ptr, sizeof(fp.crc));
+    ptr += sizeof(fp.crc);
 
-    fp->isvalid = MemAccess::get<bool>(ptr);
+    fp.isvalid = MemAccess::get<bool>(ptr);
     ptr += sizeof(bool);
-
-    d->erase(0, ptr - d->data());
-    return fp;
+    return true;
 }
 
 FileFingerprint::FileFingerprint(const FileFingerprint& other)
@@ -445,4 +455,325 @@ bool operator==(const LightFileFingerprint& lhs, const LightFileFingerprint& rhs
     return std::tie(lhs.mtime, lhs.size) == std::tie(rhs.mtime, rhs.size);
 }
 
+FileFingerprintCache::FileFingerprintCache()
+{
+}
+
+FileFingerprintCache::~FileFingerprintCache()
+{
+    commit();
+}
+
+void FileFingerprintCache::genfingerprint(const LocalPath& path, FileAccess* fa, FileFingerprint& fp)
+{
+    if (!lookup(path, fa, fp))
+    {
+        fp.genfingerprint(fa);
+        store(path, fa, fp);
+    }
+}
+
+bool FileFingerprintCache::lookup(const LocalPath& path, FileAccess* fa, FileFingerprint& fp)
+{
+    LightFileFingerprint light;
+    light.genfingerprint(fa->size, fa->mtime);
+    handle fsid = fa->fsidvalid ? fa->fsid : UNDEF;
+
+    auto it = mEntries.find(path);
+    if (it != mEntries.end() && it->second.light == light && it->second.fsid == fsid)
+    {
+        hits++;
+        fp = it->second.fingerprint;
+        return true;
+    }
+
+    if (fsid != UNDEF)
+    {
+        auto persisted = mByFsid.find(fsid);
+        if (persisted != mByFsid.end() && persisted->second.light == light)
+        {
+            hits++;
+            fp = persisted->second.fingerprint;
+            store(path, fa, fp);
+            return true;
+        }
+    }
+
+    misses++;
+    return false;
+}
+
+void FileFingerprintCache::store(const LocalPath& path, FileAccess* fa, const FileFingerprint& fp)
+{
+    LightFileFingerprint light;
+    light.genfingerprint(fa->size, fa->mtime);
+    handle fsid = fa->fsidvalid ? fa->fsid : UNDEF;
+
+    auto it = mEntries.find(path);
+
+    if (!fp.isvalid)
+    {
+        if (it != mEntries.end())
+        {
+            it->second.fsid = UNDEF;
+            it->second.light = LightFileFingerprint();
+        }
+        return;
+    }
+
+    if (it == mEntries.end())
+    {
+        if (mEntries.size() >= MAX_ENTRIES)
+        {
+            mEntries.erase(mAdded.front());
+            mAdded.pop_front();
+        }
+        it = mEntries.emplace(path, Entry()).first;
+        mAdded.push_back(path);
+    }
+
+    it->second.light = light;
+    it->second.fsid = fsid;
+    it->second.fingerprint = fp;
+
+    if (!mTable || fsid == UNDEF)
+    {
+        return;
+    }
+
+    auto persisted = mByFsid.find(fsid);
+    if (persisted == mByFsid.end())
+    {
+        if (mByFsid.size() >= MAX_PERSISTED)
+        {
+            return;
+        }
+        persisted = mByFsid.emplace(fsid, Persisted()).first;
+        persisted->second.id = mNextId++;
+    }
+    else if (persisted->second.light == light && persisted->second.fingerprint == fp)
+    {
+        return;
+    }
+
+    persisted->second.light = light;
+    persisted->second.fingerprint = fp;
+
+    string data;
+    CacheableWriter w(data);
+    w.serializehandle(fsid);
+    w.serializei64(light.size);
+    w.serializei64(light.mtime);
+    FileFingerprint copy(fp);
+    string serialized;
+    copy.serialize(&serialized);
+    w.serializestring(serialized);
+
+    if (!mUncommitted)
+    {
+        mTable->begin();
+        mUncommitted = true;
+    }
+
+    if (!mTable->put(persisted->second.id, &data))
+    {
+        LOG_warn << "Unable to persist a file fingerprint";
+    }
+}
+
+void FileFingerprintCache::persist(std::unique_ptr<DbTable> table)
+{
+    commit();
+    mTable = std::move(table);
+    mByFsid.clear();
+    mNextId = 1;
+
+    if (!mTable)
+    {
+        return;
+    }
+
+    uint32_t id;
+    string data;
+    vector<uint32_t> unreadable;
+
+    mTable->rewind();
+    while (mTable->next(&id, &data))
+    {
+        handle fsid;
+        int64_t size, mtime;
+        string serialized;
+        CacheableReader r(data);
+
+        unique_ptr<FileFingerprint> fp;
+        if (r.unserializehandle(fsid) && r.unserializei64(size) && r.unserializei64(mtime)
+                && r.unserializestring(serialized)
+                && (fp.reset(FileFingerprint::unserialize(&serialized)), fp)
+                && mByFsid.size() < MAX_PERSISTED)
+        {
+            Persisted& persisted = mByFsid[fsid];
+            persisted.id = id;
+            persisted.light.genfingerprint(size, mtime);
+            persisted.fingerprint = *fp;
+        }
+        else
+        {
+            unreadable.push_back(id);
+        }
+
+        mNextId = std::max(mNextId, id + 1);
+    }
+
+    if (!unreadable.empty())
+    {
+        LOG_warn << "Discarding " << unreadable.size() << " unreadable file fingerprints";
+        mTable->delBatch(unreadable);
+    }
+
+    LOG_debug << "Loaded " << mByFsid.size() << " file fingerprints";
+}
+
+bool FileFingerprintCache::persisted() const
+{
+    return !!mTable;
+}
+
+void FileFingerprintCache::commit()
+{
+    if (mUncommitted)
+    {
+        mTable->commit();
+        mUncommitted = false;
+    }
+}
+void FileFingerprintCache::clear()
+{
+    mEntries.clear();
+    mAdded.clear();
+}
+
+size_t FileFingerprintCache::size() const
+{
+    return mEntries.size();
+}
+
+AsyncFingerprinter::AsyncFingerprinter(MegaClientAsyncQueue& queue)
+    : mQueue(queue)
+{
+}
+
+bool AsyncFingerprinter::request(const LocalPath& path, unique_ptr<FileAccess> fa, const FileFingerprint* known)
+{
+    if (mJobs.count(path))
+    {
+        return true;
+    }
+
+    if (mJobs.size() >= MAX_REQUESTED)
+    {
+        // make room from the results no one came for
+        for (auto it = mJobs.begin(); it != mJobs.end(); )
+        {
+            std::lock_guard<std::mutex> g(it->second->mutex);
+            it = it->second->done ? mJobs.erase(it) : std::next(it);
+        }
+
+        if (mJobs.size() >= MAX_REQUESTED)
+        {
+            return false;
+        }
+    }
+
+    auto job = std::make_shared<Job>();
+    mJobs.emplace(path, job);
+
+    std::shared_ptr<FileAccess> file(std::move(fa));
+    LocalPath filepath = path;
+    m_off_t knownsize = known ? known->size : -1;
+    m_time_t knownmtime = known ? known->mtime : 0;
+    mQueue.push([job, file, filepath, knownsize, knownmtime](SymmCipher&) mutable
+    {
+        Result result;
+        if ((result.opened = file->fopen(filepath, true, false)))
+        {
+            result.type = file->type;
+            result.size = file->size;
+            result.mtime = file->mtime;
+
+            if (result.type == FILENODE && (result.size != knownsize || result.mtime != knownmtime))
+            {
+                result.fingerprint.genfingerprint(file.get());
+            }
+        }
+        file.reset();
+
+        std::lock_guard<std::mutex> g(job->mutex);
+        job->result = std::move(result);
+        job->done = true;
+        job->finished.notify_all();
+    }, true);
+
+    return true;
+}
+
+AsyncFingerprinter::State AsyncFingerprinter::take(const LocalPath& path, Result& out)
+{
+    auto it = mJobs.find(path);
+    if (it == mJobs.end())
+    {
+        return NOT_REQUESTED;
+    }
+
+    {
+        std::lock_guard<std::mutex> g(it->second->mutex);
+        if (!it->second->done)
+        {
+            return PENDING;
+        }
+        out = std::move(it->second->result);
+    }
+
+    mJobs.erase(it);
+    return DONE;
+}
+
+bool AsyncFingerprinter::genfingerprint(const LocalPath& path, FileAccess* fa, FileFingerprint& fp)
+{
+    auto it = mJobs.find(path);
+    if (it != mJobs.end())
+    {
+        std::shared_ptr<Job> job = std::move(it->second);
+        mJobs.erase(it);
+
+        std::unique_lock<std::mutex> g(job->mutex);
+        job->finished.wait(g, [&job]() { return job->done; });
+
+        const FileFingerprint& found = job->result.fingerprint;
+        if (found.isvalid && found.size == fa->size && found.mtime == fa->mtime)
+        {
+            bool changed = fp.size != found.size || fp.mtime != found.mtime
+                        || fp.crc != found.crc || !fp.isvalid;
+            fp = found;
+            return changed;
+        }
+    }
+
+    return fp.genfingerprint(fa);
+}
+
+void AsyncFingerprinter::forget(const LocalPath& path)
+{
+    mJobs.erase(path);
+}
+
+void AsyncFingerprinter::clear()
+{
+    mJobs.clear();
+}
+
+size_t AsyncFingerprinter::requested() const
+{
+    return mJobs.size();
+}
+
 } // mega
@@ -166,10 +166,76 @@ int compareUtf(UnicodeCodepointIterator<CharT> first1, bool unescaping1,
     return 1;
 }
 
+// whether the text can be compared unit by unit, with nothing to decode, unescape or skip
+bool isPlainAscii(const string& s, bool unescaping)
+{
+    return Utils::isAscii(s.data(), s.size())
+           && !(unescaping && s.find('%') != string::npos)
+#ifdef _WIN32
+           && !(!s.empty() && s[0] == '\\')
+#endif
+           ;
+}
+
+bool isPlainAscii(const std::wstring& s, bool unescaping)
+{
+    for (wchar_t c : s)
+    {
+        if (static_cast<unsigned>(c) >= 0x80 || (unescaping && c == L'%'))
+        {
+            return false;
+        }
+    }
+#ifdef _WIN32
+    return s.empty() || s[0] != L'\\';
+#else
+    return true;
+#endif
+}
+
+// the same result as the codepoint by codepoint comparison, for plain ASCII text
+template<typename StringT, typename StringU>
+int compareAscii(const StringT& s1, const StringU& s2, bool caseInsensitive)
+{
+    size_t n = std::min(s1.size(), s2.size());
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        int c1 = static_cast<int>(s1[i]);
+        int c2 = static_cast<int>(s2[i]);
+
+        if (c1 != c2)
+        {
+            if (caseInsensitive)
+            {
+                if (c1 >= 'a' && c1 <= 'z') c1 -= 'a' - 'A';
+                if (c2 >= 'a' && c2 <= 'z') c2 -= 'a' - 'A';
+            }
+
+            if (c1 != c2)
+            {
+                return c1 - c2;
+            }
+        }
+    }
+
+    if (s1.size() == s2.size())
+    {
+        return 0;
+    }
+
+    return s1.size() < s2.size() ? -1 : 1;
+}
+
 } // detail
 
 int compareUtf(const string& s1, bool unescaping1, const string& s2, bool unescaping2, bool caseInsensitive)
 {
+    if (detail::isPlainAscii(s1, unescaping1) && detail::isPlainAscii(s2, unescaping2))
+    {
+        return detail::compareAscii(s1, s2, caseInsensitive);
+    }
+
     return detail::compareUtf(
                 unicodeCodepointIterator(s1), unescaping1,
                 unicodeCodepointIterator(s2), unescaping2,
@@ -178,6 +244,11 @@ int compareUtf(const string& s1, bool unescaping1, const string& s2, bool unesca
 
 int compareUtf(const string& s1, bool unescaping1, const LocalPath& s2, bool unescaping2, bool caseInsensitive)
 {
+    if (detail::isPlainAscii(s1, unescaping1) && detail::isPlainAscii(s2.localpath, unescaping2))
+    {
+        return detail::compareAscii(s1, s2.localpath, caseInsensitive);
+    }
+
     return detail::compareUtf(
         unicodeCodepointIterator(s1), unescaping1,
         unicodeCodepointIterator(s2.localpath), unescaping2,
@@ -186,6 +257,11 @@ int compareUtf(const string& s1, bool unescaping1, const LocalPath& s2, bool une
 
 int compareUtf(const LocalPath& s1, bool unescaping1, const string& s2, bool unescaping2, bool caseInsensitive)
 {
+    if (detail::isPlainAscii(s1.localpath, unescaping1) && detail::isPlainAscii(s2, unescaping2))
+    {
+        return detail::compareAscii(s1.localpath, s2, caseInsensitive);
+    }
+
     return detail::compareUtf(
         unicodeCodepointIterator(s1.localpath), unescaping1,
         unicodeCodepointIterator(s2), unescaping2,
@@ -194,6 +270,11 @@ int compareUtf(const LocalPath& s1, bool unescaping1, const string& s2, bool une
 
 int compareUtf(const LocalPath& s1, bool unescaping1, const LocalPath& s2, bool unescaping2, bool caseInsensitive)
 {
+    if (detail::isPlainAscii(s1.localpath, unescaping1) && detail::isPlainAscii(s2.localpath, unescaping2))
+    {
+        return detail::compareAscii(s1.localpath, s2.localpath, caseInsensitive);
+    }
+
     return detail::compareUtf(
         unicodeCodepointIterator(s1.localpath), unescaping1,
         unicodeCodepointIterator(s2.localpath), unescaping2,
@@ -444,6 +525,12 @@ void FileSystemAccess::normalize(string* filename) const
 {
     if (!filename) return;
 
+    // most names are plain ASCII, which NFC leaves as it is
+    if (Utils::isAscii(filename->data(), filename->size()))
+    {
+        return;
+    }
+
     const char* cfilename = filename->c_str();
     size_t fnsize = filename->size();
     string result;
@@ -550,6 +637,150 @@ void DirNotify::notify(notifyqueue q, LocalNode* l, LocalPath&& path, bool immed
 
 }
 
+bool NotificationDeque::peekFront(Notification& n)
+{
+    collect();
+
+    if (mQueued.empty())
+    {
+        return false;
+    }
+
+    n = mQueued.front().notification;
+    return true;
+}
+
+bool NotificationDeque::popFront(Notification& n)
+{
+    collect();
+
+    if (mQueued.empty())
+    {
+        return false;
+    }
+
+    mByPath.erase(mQueued.front().path);
+    n = std::move(mQueued.front().notification);
+    mQueued.pop_front();
+    return true;
+}
+
+void NotificationDeque::unpopFront(const Notification& n)
+{
+    queue(Notification(n), true);
+}
+
+bool NotificationDeque::empty()
+{
+    collect();
+    return mQueued.empty();
+}
+
+size_t NotificationDeque::size()
+{
+    collect();
+    return mQueued.size();
+}
+
+void NotificationDeque::peek(size_t count, std::function<bool(const Notification&, const LocalPath&)> f)
+{
+    collect();
+
+    for (auto it = mQueued.begin(); count-- && it != mQueued.end() && f(it->notification, it->path); ++it)
+    {
+    }
+}
+
+void NotificationDeque::replaceLocalNodePointers(LocalNode* check, LocalNode* newvalue)
+{
+    // including those not collected yet, that could point to it too
+    collect();
+
+    for (auto& q : mQueued)
+    {
+        if (q.notification.localnode == check)
+        {
+            q.notification.localnode = newvalue;
+        }
+    }
+}
+
+void NotificationDeque::collect()
+{
+    Notification n;
+    while (mIncoming.pop(n))
+    {
+        queue(std::move(n), false);
+    }
+}
+
+void NotificationDeque::queue(Notification&& n, bool front)
+{
+    Queued q;
+
+#ifdef ENABLE_SYNC
+    if (n.localnode && n.localnode != (LocalNode*)~0)
+    {
+        // with room for the rest of the path
+        n.localnode->appendlocalpath(q.path, n.path.length() + 1);
+    }
+#endif
+    q.path.appendWithSeparator(n.path, false);
+
+    auto it = mByPath.find(q.path);
+    if (it != mByPath.end())
+    {
+        // once, when the latest is ready (immediately if either is)
+        const Notification& prev = it->second->notification;
+        if (!prev.timestamp || !n.timestamp)
+        {
+            n.timestamp = 0;
+        }
+        else
+        {
+            n.timestamp = std::max(prev.timestamp, n.timestamp);
+        }
+
+        mQueued.erase(it->second);
+        mByPath.erase(it);
+    }
+
+    q.notification = std::move(n);
+
+    auto queued = mQueued.insert(front ? mQueued.begin() : mQueued.end(), std::move(q));
+    mByPath.emplace(queued->path, queued);
+}
+
+bool DirAccess::dnextbulk(LocalPath& path, vector<Entry>& entries, size_t max, bool followsymlinks, FileSystemAccess& fsaccess)
+{
+    size_t count = 0;
+    Entry entry;
+
+    while (count < max && dnext(path, entry.name, followsymlinks, &entry.type))
+    {
+        ScopedLengthRestore restoreLen(path);
+        path.appendWithSeparator(entry.name, false);
+
+        // with the stat of the entry that dnext() did
+        auto fa = fsaccess.newfileaccess(false);
+        if ((entry.statok = fa->fopen(path, false, false, this)))
+        {
+            entry.type = fa->type;
+            entry.size = fa->size;
+            entry.mtime = fa->mtime;
+            entry.fsid = fa->fsid;
+            entry.fsidvalid = fa->fsidvalid;
+            entry.isSymLink = fa->mIsSymLink;
+        }
+
+        entries.push_back(std::move(entry));
+        entry = Entry();
+        count++;
+    }
+
+    return count > 0;
+}
+
 // default: no fingerprint
 fsfp_t DirNotify::fsfingerprint() const
 {
@@ -19,10 +19,192 @@
  * program.
  */
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MEGA_GFX_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define MEGA_GFX_NEON 1
+#endif
+
 #include "mega.h"
 #include "mega/gfx.h"
 
 namespace mega {
+
+namespace {
+
+// an output pixel is the average of the source pixels it covers, weighted by how much of each
+// it covers, in fixed point with these bits.  The weights of a pixel always add up to 1 << 14,
+// and the sums are exact in 32 bits, so the results are the same with and without vectors
+const int WEIGHTBITS = 14;
+
+// the horizontal pass keeps 7 bits more than the pixels have
+const int HORIZONTALSHIFT = 7;
+
+// along one side: the first source pixel of each output pixel, how many, and their weights
+struct Spans
+{
+    vector<int> first;
+    vector<int> count;
+    vector<int> offset;
+    vector<uint16_t> weights;
+
+    Spans(int s, int d)
+        : first(d), count(d), offset(d)
+    {
+        // in units of 1/(s*d) of the side, a source pixel is d long and an output one s
+        for (int i = 0; i < d; i++)
+        {
+            int64_t start = int64_t(i) * s;
+            int64_t end = start + s;
+            first[i] = int(start / d);
+            count[i] = int((end - 1) / d) - first[i] + 1;
+            offset[i] = int(weights.size());
+
+            int total = 0;
+            size_t largest = weights.size();
+            for (int j = first[i]; j < first[i] + count[i]; j++)
+            {
+                int64_t overlap = std::min<int64_t>(int64_t(j + 1) * d, end) - std::max<int64_t>(int64_t(j) * d, start);
+                auto weight = uint16_t((overlap << WEIGHTBITS) / s);
+                if (largest == weights.size() || weight > weights[largest])
+                {
+                    largest = weights.size();
+                }
+                weights.push_back(weight);
+                total += weight;
+            }
+
+            // the rounding down goes to the pixel covered the most
+            weights[largest] = uint16_t(weights[largest] + (1 << WEIGHTBITS) - total);
+        }
+    }
+};
+
+// one row of source pixels down to the output width, with HORIZONTALSHIFT bits more
+void horizontalpass(const byte* src, const Spans& spans, uint16_t* out)
+{
+    size_t d = spans.first.size();
+    for (size_t i = 0; i < d; i++)
+    {
+        const byte* p = src + size_t(spans.first[i]) * 4;
+        const uint16_t* w = &spans.weights[size_t(spans.offset[i])];
+        int n = spans.count[i];
+
+#if defined(MEGA_GFX_SSE2)
+        __m128i zero = _mm_setzero_si128();
+        __m128i acc = zero;
+        for (int j = 0; j < n; j++, p += 4)
+        {
+            // the 4 channels of a pixel in 16 bits, times its weight in 32
+            int32_t pixel;
+            memcpy(&pixel, p, 4);
+            __m128i channels = _mm_unpacklo_epi8(_mm_cvtsi32_si128(pixel), zero);
+            __m128i weight = _mm_set1_epi16(short(w[j]));
+            __m128i lo = _mm_mullo_epi16(channels, weight);
+            __m128i hi = _mm_mulhi_epu16(channels, weight);
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(lo, hi));
+        }
+        acc = _mm_srli_epi32(acc, WEIGHTBITS - HORIZONTALSHIFT);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i * 4), _mm_packs_epi32(acc, acc));
+#elif defined(MEGA_GFX_NEON)
+        uint32x4_t acc = vdupq_n_u32(0);
+        for (int j = 0; j < n; j++, p += 4)
+        {
+            uint32_t value;
+            memcpy(&value, p, 4);
+            uint8x8_t pixel = vreinterpret_u8_u32(vdup_n_u32(value));
+            acc = vmlal_n_u16(acc, vget_low_u16(vmovl_u8(pixel)), w[j]);
+        }
+        vst1_u16(out + i * 4, vmovn_u32(vshrq_n_u32(acc, WEIGHTBITS - HORIZONTALSHIFT)));
+#else
+        uint32_t acc[4] = { 0, 0, 0, 0 };
+        for (int j = 0; j < n; j++, p += 4)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                acc[c] += uint32_t(p[c]) * w[j];
+            }
+        }
+        for (int c = 0; c < 4; c++)
+        {
+            out[i * 4 + c] = uint16_t(acc[c] >> (WEIGHTBITS - HORIZONTALSHIFT));
+        }
+#endif
+    }
+}
+
+// acc += row * weight, for len values
+void accumulate(uint32_t* acc, const uint16_t* row, uint16_t weight, size_t len)
+{
+    size_t k = 0;
+
+#if defined(MEGA_GFX_SSE2)
+    __m128i w = _mm_set1_epi16(short(weight));
+    for (; k + 8 <= len; k += 8)
+    {
+        __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + k));
+        __m128i lo = _mm_mullo_epi16(values, w);
+        __m128i hi = _mm_mulhi_epu16(values, w);
+        __m128i* a = reinterpret_cast<__m128i*>(acc + k);
+        _mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a), _mm_unpacklo_epi16(lo, hi)));
+        _mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), _mm_unpackhi_epi16(lo, hi)));
+    }
+#elif defined(MEGA_GFX_NEON)
+    for (; k + 8 <= len; k += 8)
+    {
+        uint16x8_t values = vld1q_u16(row + k);
+        vst1q_u32(acc + k, vmlal_n_u16(vld1q_u32(acc + k), vget_low_u16(values), weight));
+        vst1q_u32(acc + k + 4, vmlal_n_u16(vld1q_u32(acc + k + 4), vget_high_u16(values), weight));
+    }
+#endif
+
+    for (; k < len; k++)
+    {
+        acc[k] += uint32_t(row[k]) * weight;
+    }
+}
+
+} // anonymous
+
+void GfxProc::downscale(const byte* src, int sw, int sh, ptrdiff_t srcstride, byte* dst, int dw, int dh, ptrdiff_t dststride)
+{
+    assert(dw > 0 && dh > 0 && dw <= sw && dh <= sh);
+
+    Spans columns(sw, dw);
+    Spans rows(sh, dh);
+
+    size_t len = size_t(dw) * 4;
+    vector<uint16_t> row(len);
+    vector<uint32_t> acc(len);
+    const uint32_t rounding = 1u << (WEIGHTBITS + HORIZONTALSHIFT - 1);
+
+    // consecutive output rows share at most the source row between them: the last one made
+    int rowmade = -1;
+
+    for (int i = 0; i < dh; i++)
+    {
+        std::fill(acc.begin(), acc.end(), 0);
+
+        for (int j = 0; j < rows.count[i]; j++)
+        {
+            int y = rows.first[i] + j;
+            if (y != rowmade)
+            {
+                horizontalpass(src + y * srcstride, columns, row.data());
+                rowmade = y;
+            }
+            accumulate(acc.data(), row.data(), rows.weights[size_t(rows.offset[i] + j)], len);
+        }
+
+        byte* out = dst + i * dststride;
+        for (size_t k = 0; k < len; k++)
+        {
+            out[k] = byte((acc[k] + rounding) >> (WEIGHTBITS + HORIZONTALSHIFT));
+        }
+    }
+}
 const int GfxProc::dimensions[][2] = {
     { 200, 0 },     // THUMBNAIL: square thumbnail, cropped from near center
     { 1000, 1000 }  // PREVIEW: scaled version inside 1000x1000 bounding square
@@ -90,8 +272,74 @@ const char* GfxProc::supportedvideoformats()
     return NULL;
 }
 
+GfxProc* GfxProc::newprocessor()
+{
+    return NULL;
+}
+
+m_off_t GfxProc::bitmapmemory(const LocalPath&, int)
+{
+    return 0;
+}
+
+void GfxProc::setmemorybudget(m_off_t bytes)
+{
+    std::lock_guard<std::mutex> g(budgetmutex);
+    memorybudget = std::max<m_off_t>(bytes, 0);
+    budgetfreed.notify_all();
+}
+
+void GfxProc::setpreviewquality(int quality)
+{
+    previewquality = std::min(std::max(quality, 0), 100);
+}
+
+bool GfxProc::behind()
+{
+    return requests.size() >= BEHINDJOBS * (workers.size() + 1);
+}
+
+size_t GfxProc::pendingjobs()
+{
+    return requests.size();
+}
+
+m_off_t GfxProc::bitmapmemoryinuse()
+{
+    std::lock_guard<std::mutex> g(budgetmutex);
+    return memoryinuse;
+}
+
+bool GfxProc::reservememory(m_off_t bytes)
+{
+    // called on a processing thread, with the budget of the owner
+    std::unique_lock<std::mutex> g(owner->budgetmutex);
+    owner->budgetfreed.wait(g, [this, bytes]()
+    {
+        m_off_t budget = owner->memorybudget;
+        return finished || !budget || !owner->memoryinuse || owner->memoryinuse + bytes <= budget;
+    });
+
+    if (finished)
+    {
+        return false;
+    }
+
+    owner->memoryinuse += bytes;
+    return true;
+}
+
+void GfxProc::releasememory(m_off_t bytes)
+{
+    std::lock_guard<std::mutex> g(owner->budgetmutex);
+    owner->memoryinuse -= bytes;
+    owner->budgetfreed.notify_all();
+}
+
 void *GfxProc::threadEntryPoint(void *param)
 {
+    ThreadConfig::apply(THREAD_ROLE_GFX);
+
     GfxProc* gfxProcessor = (GfxProc*)param;
     gfxProcessor->loop();
     return NULL;
@@ -104,7 +352,7 @@ void GfxProc::loop()
     {
         waiter.init(NEVER);
         waiter.wait();
-        while ((job = requests.pop()))
+        while ((job = owner->requests.pop()))
         {
             if (finished)
             {
@@ -112,11 +360,39 @@ void GfxProc::loop()
                 break;
             }
 
+            // the processors of the workers read paths through the owner's client too
+            client = owner->client;
+
+            // decode only as large as the largest size asked for: loaders that can (JPEG, with
+            // libjpeg's scaled decoding) then skip most of the pixels of a large photo.  The
+            // sizes are made from that one decode, largest first, each from the one before
+            // (this assumes that the width of a dimension is its largest side)
+            int size = 0;
+            for (fatype t : job->imagetypes)
+            {
+                size = std::max(size, dimensions[t][0]);
+            }
+
+            m_off_t memory = 0;
+            if (owner->memorybudget)
+            {
+                memory = bitmapmemory(job->localfilename, size);
+                if (memory <= 0)
+                {
+                    memory = UNKNOWNBITMAPMEMORY;
+                }
+            }
+
+            if (!reservememory(memory))
+            {
+                delete job;
+                break;
+            }
+
             mutex.lock();
             LOG_debug << "Processing media file: " << job->h;
 
-            // (this assumes that the width of the largest dimension is max)
-            if (readbitmap(NULL, job->localfilename, dimensions[sizeof dimensions/sizeof dimensions[0]-1][0]))
+            if (readbitmap(NULL, job->localfilename, size))
             {
                 for (unsigned i = 0; i < job->imagetypes.size(); i++)
                 {
@@ -132,6 +408,7 @@ void GfxProc::loop()
                         h = this->h;
                     }
 
+                    jpegquality = (job->imagetypes[i] == PREVIEW) ? owner->previewquality.load() : 0;
                     if (!resizebitmap(w, h, jpeg))
                     {
                         delete jpeg;
@@ -150,11 +427,18 @@ void GfxProc::loop()
             }
 
             mutex.unlock();
-            responses.push(job);
-            client->waiter->notify();
+            releasememory(memory);
+            owner->responses.push(job);
+            owner->client->waiter->notify();
         }
     }
 
+    if (owner != this)
+    {
+        // what's left is the owner's to discard
+        return;
+    }
+
     while ((job = requests.pop()))
     {
         delete job;
@@ -283,9 +567,9 @@ void GfxProc::transform(int& w, int& h, int& rw, int& rh, int& px, int& py)
 
 // load bitmap image, generate all designated sizes, attach to specified upload/node handle
 // FIXME: move to a worker thread to keep the engine nonblocking
-int GfxProc::gendimensionsputfa(FileAccess* /*fa*/, const LocalPath& localfilename, handle th, SymmCipher* key, int missing, bool checkAccess)
+int GfxProc::gendimensionsputfa(FileAccess* /*fa*/, const LocalPath& localfilename, handle th, SymmCipher* key, int missing, bool checkAccess, bool background)
 {
-    if (SimpleLogger::logCurrentLevel >= logDebug)
+    if (MEGA_LOG_ENABLED(logDebug))
     {
         LOG_debug << "Creating thumb/preview for " << localfilename.toPath(*client->fsaccess);
     }
@@ -312,11 +596,25 @@ int GfxProc::gendimensionsputfa(FileAccess* /*fa*/, const LocalPath& localfilena
     // get the count before it might be popped off and processed already
     auto count = int(job->imagetypes.size());
 
-    requests.push(job);
-    waiter.notify();
+    if (threadsrequested)
+    {
+        std::call_once(threadsonce, [this]() { startthreads(); });
+    }
+
+    requests.push(job, background);
+    notifyworkers();
     return count;
 }
 
+void GfxProc::notifyworkers()
+{
+    waiter.notify();
+    for (auto& worker : workers)
+    {
+        worker->waiter.notify();
+    }
+}
+
 bool GfxProc::savefa(const LocalPath& localfilepath, int width, int height, LocalPath& localdstpath)
 {
     if (!isgfx(localfilepath))
@@ -341,6 +639,7 @@ bool GfxProc::savefa(const LocalPath& localfilepath, int width, int height, Loca
     }
 
     string jpeg;
+    jpegquality = 0;
     bool success = resizebitmap(w, h, &jpeg);
     freebitmap();
     mutex.unlock();
@@ -366,22 +665,50 @@ bool GfxProc::savefa(const LocalPath& localfilepath, int width, int height, Loca
 }
 
 GfxProc::GfxProc()
+    : memorybudget(0)
+    , previewquality(0)
 {
     client = NULL;
     finished = false;
 }
 
-void GfxProc::startProcessingThread()
+void GfxProc::startProcessingThread(unsigned threads)
+{
+    threadsrequested = std::max(threads, 1u);
+}
+
+void GfxProc::startthreads()
 {
     thread.start(threadEntryPoint, this);
     threadstarted = true;
+
+    while (workers.size() + 1 < threadsrequested)
+    {
+        std::unique_ptr<GfxProc> worker(newprocessor());
+        if (!worker)
+        {
+            LOG_warn << "Media files are processed in a single thread by this processor";
+            break;
+        }
+
+        worker->owner = this;
+        worker->startthreads();
+        workers.push_back(std::move(worker));
+    }
 }
 
 GfxProc::~GfxProc()
 {
+    // they push to the queues of this one
+    workers.clear();
+
     finished = true;
     waiter.notify();
-    assert(threadstarted);
+    {
+        // a thread may be waiting for the budget
+        std::lock_guard<std::mutex> g(owner->budgetmutex);
+        owner->budgetfreed.notify_all();
+    }
     if (threadstarted)
     {
         thread.join();
@@ -393,27 +720,34 @@ GfxJobQueue::GfxJobQueue()
 
 }
 
-void GfxJobQueue::push(GfxJob *job)
+void GfxJobQueue::push(GfxJob *job, bool background)
 {
     mutex.lock();
-    jobs.push_back(job);
+    (background ? backgroundjobs : jobs).push_back(job);
     mutex.unlock();
 }
 
 GfxJob *GfxJobQueue::pop()
 {
     mutex.lock();
-    if (jobs.empty())
+    std::deque<GfxJob *>& q = jobs.empty() ? backgroundjobs : jobs;
+    if (q.empty())
     {
         mutex.unlock();
         return NULL;
     }
-    GfxJob *job = jobs.front();
-    jobs.pop_front();
+    GfxJob *job = q.front();
+    q.pop_front();
     mutex.unlock();
     return job;
 }
 
+size_t GfxJobQueue::size()
+{
+    std::lock_guard<std::mutex> g(mutex);
+    return jobs.size() + backgroundjobs.size();
+}
+
 GfxJob::GfxJob()
 {
 
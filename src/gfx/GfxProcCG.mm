@@ -205,7 +205,17 @@ bool GfxProcCG::resizebitmap(int rw, int rh, string* jpegout) {
         CFRelease(data);
         return false;
     }
-    CGImageDestinationAddImage(destination, image, imageParams);
+    CFDictionaryRef params = imageParams;
+    if (jpegquality) {
+        float comp = jpegquality / 100.0f;
+        CFNumberRef compression = CFNumberCreate(kCFAllocatorDefault, kCFNumberFloatType, &comp);
+        params = CFDictionaryCreate(kCFAllocatorDefault, (const void **)&kCGImageDestinationLossyCompressionQuality, (const void **)&compression, 1, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        CFRelease(compression);
+    }
+    CGImageDestinationAddImage(destination, image, params);
+    if (params != imageParams) {
+        CFRelease(params);
+    }
     bool success = CGImageDestinationFinalize(destination);
     CGImageRelease(image);
     CFRelease(destination);
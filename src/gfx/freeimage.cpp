@@ -86,6 +86,11 @@ GfxProcFreeImage::GfxProcFreeImage()
 }
 
 
+GfxProc* GfxProcFreeImage::newprocessor()
+{
+    return new GfxProcFreeImage();
+}
+
 #ifdef HAVE_FFMPEG
 
 #ifdef AV_CODEC_CAP_TRUNCATED
@@ -163,11 +168,23 @@ bool GfxProcFreeImage::readbitmapFfmpeg(FileAccess* fa, const LocalPath& imagePa
         return NULL;
     }
 
+    // the frame is scaled straight to about the size asked for, rather than converted at full
+    // resolution and resized afterwards: the short side no smaller than it, so that the square
+    // thumbnail cropped from it stays sharp
+    int targetWidth = width;
+    int targetHeight = height;
+    int shortSide = std::min(width, height);
+    if (size > 0 && shortSide > size)
+    {
+        targetWidth = int(int64_t(width) * size / shortSide);
+        targetHeight = int(int64_t(height) * size / shortSide);
+    }
+
     AVPixelFormat sourcePixelFormat = codecContext.pix_fmt;
     AVPixelFormat targetPixelFormat = AV_PIX_FMT_BGR24; //raw data expected by freeimage is in this format
     SwsContext* swsContext = sws_getContext(width, height, sourcePixelFormat,
-                                            width, height, targetPixelFormat,
-                                            SWS_FAST_BILINEAR, NULL, NULL, NULL);
+                                            targetWidth, targetHeight, targetPixelFormat,
+                                            targetWidth != width ? SWS_AREA : SWS_FAST_BILINEAR, NULL, NULL, NULL);
     if (!swsContext)
     {
         LOG_warn << "SWS Context not found: " << sourcePixelFormat;
@@ -186,9 +203,11 @@ bool GfxProcFreeImage::readbitmapFfmpeg(FileAccess* fa, const LocalPath& imagePa
         return NULL;
     }
 
-    // Force seeking to key frames
+    // Force seeking to key frames, and decode only those: the seek lands on one, and the frames
+    // after it are what makes the decoding of a long GOP (and of 4K video) slow
     formatContext->seek2any = false;
     videoStream->skip_to_keyframe = true;
+    codecContext.skip_frame = AVDISCARD_NONKEY;
     if (decoder->capabilities & CAP_TRUNCATED)
     {
         codecContext.flags |= CAP_TRUNCATED;
@@ -223,8 +242,8 @@ bool GfxProcFreeImage::readbitmapFfmpeg(FileAccess* fa, const LocalPath& imagePa
     }
 
     targetFrame->format = targetPixelFormat;
-    targetFrame->width = width;
-    targetFrame->height = height;
+    targetFrame->width = targetWidth;
+    targetFrame->height = targetHeight;
     if (av_image_alloc(targetFrame->data, targetFrame->linesize, targetFrame->width, targetFrame->height, targetPixelFormat, 32) < 0)
     {
         LOG_warn << "Error allocating frame";
@@ -302,12 +321,12 @@ bool GfxProcFreeImage::readbitmapFfmpeg(FileAccess* fa, const LocalPath& imagePa
                 if (scalingResult > 0)
                 {
                     int fav = targetPixelFormat;
-                    int imagesize = avpicture_get_size((enum AVPixelFormat)fav, width, height);
+                    int imagesize = avpicture_get_size((enum AVPixelFormat)fav, targetWidth, targetHeight);
                     FIMEMORY fmemory;
                     fmemory.data = malloc(imagesize);
 
                     if (avpicture_layout((AVPicture *)targetFrame, (enum AVPixelFormat)fav,
-                                    width, height, (unsigned char*)fmemory.data, imagesize) <= 0)
+                                    targetWidth, targetHeight, (unsigned char*)fmemory.data, imagesize) <= 0)
                     {
                         LOG_warn << "Error copying frame";
                         av_packet_unref(&packet);
@@ -322,9 +341,9 @@ bool GfxProcFreeImage::readbitmapFfmpeg(FileAccess* fa, const LocalPath& imagePa
                     }
 
                     //int pitch = imagesize/height;
-                    int pitch = width*3;
+                    int pitch = targetWidth*3;
 
-                    if (!(dib = FreeImage_ConvertFromRawBits((BYTE*)fmemory.data,width,height,
+                    if (!(dib = FreeImage_ConvertFromRawBits((BYTE*)fmemory.data,targetWidth,targetHeight,
                                                              pitch, 24, FI_RGBA_RED_SHIFT, FI_RGBA_GREEN_MASK,
                                                              FI_RGBA_BLUE_MASK | 0xFFFF, TRUE) ) )
                     {
@@ -465,6 +484,90 @@ bool GfxProcFreeImage::readbitmap(FileAccess* fa, const LocalPath& localname, in
     return true;
 }
 
+m_off_t GfxProcFreeImage::bitmapmemory(const LocalPath& localname, int size)
+{
+#ifdef FIF_LOAD_NOPIXELS
+#ifdef HAVE_FFMPEG
+    string extension;
+    if (client->fsaccess->getextension(localname, extension))
+    {
+        const char* ptr;
+        if ((ptr = strstr(supportedformatsFfmpeg(), extension.c_str())) && ptr[extension.size()] == '.')
+        {
+            // a frame: that of the stream, unknown without opening it
+            return 0;
+        }
+    }
+#endif
+
+    FREE_IMAGE_FORMAT fif = FreeImage_GetFileTypeX(localname.localpath.c_str());
+    if (fif == FIF_UNKNOWN || !FreeImage_FIFSupportsNoPixels(fif))
+    {
+        return 0;
+    }
+
+    // the header only (for RAW formats, the size of the image rather than of the embedded
+    // preview readbitmap() loads: an upper bound)
+    FIBITMAP* header = FreeImage_LoadX(fif, localname.localpath.c_str(), FIF_LOAD_NOPIXELS);
+    if (!header)
+    {
+        return 0;
+    }
+
+    m_off_t width = FreeImage_GetWidth(header);
+    m_off_t height = FreeImage_GetHeight(header);
+    m_off_t bytesperpixel = std::max(4u, FreeImage_GetBPP(header) / 8);
+    FreeImage_Unload(header);
+
+    if (fif == FIF_JPEG && size > 0)
+    {
+        // libjpeg scales by 1/2, 1/4 or 1/8 while the image stays at least size
+        int scale = 1;
+        while (scale < 8 && std::min(width, height) / (scale * 2) >= size)
+        {
+            scale *= 2;
+        }
+        width /= scale;
+        height /= scale;
+    }
+
+    return width * height * bytesperpixel;
+#else
+    (void)localname;
+    (void)size;
+    return 0;
+#endif
+}
+
+// dib scaled to w*h: by GfxProc::downscale() when smaller, in 32 bits, and by FreeImage otherwise
+// (upscaling, and bitmaps with more than 8 bits per channel)
+static FIBITMAP* rescale(FIBITMAP* dib, int w, int h)
+{
+    if (FreeImage_GetImageType(dib) == FIT_BITMAP && w <= int(FreeImage_GetWidth(dib)) && h <= int(FreeImage_GetHeight(dib)))
+    {
+        FIBITMAP* source = (FreeImage_GetBPP(dib) == 32) ? dib : FreeImage_ConvertTo32Bits(dib);
+        FIBITMAP* scaled = source ? FreeImage_Allocate(w, h, 32) : NULL;
+        if (scaled)
+        {
+            // both bottom-up
+            GfxProc::downscale(FreeImage_GetBits(source), int(FreeImage_GetWidth(source)), int(FreeImage_GetHeight(source)), ptrdiff_t(FreeImage_GetPitch(source)),
+                               FreeImage_GetBits(scaled), w, h, ptrdiff_t(FreeImage_GetPitch(scaled)));
+        }
+
+        if (source && source != dib)
+        {
+            FreeImage_Unload(source);
+        }
+
+        if (scaled)
+        {
+            return scaled;
+        }
+    }
+
+    return FreeImage_Rescale(dib, w, h, FILTER_BILINEAR);
+}
+
 bool GfxProcFreeImage::resizebitmap(int rw, int rh, string* jpegout)
 {
     FIBITMAP* tdib;
@@ -481,7 +584,7 @@ bool GfxProcFreeImage::resizebitmap(int rw, int rh, string* jpegout)
 
     jpegout->clear();
 
-    if ((tdib = FreeImage_Rescale(dib, w, h, FILTER_BILINEAR)))
+    if ((tdib = rescale(dib, w, h)))
     {
         FreeImage_Unload(dib);
 
@@ -510,7 +613,7 @@ bool GfxProcFreeImage::resizebitmap(int rw, int rh, string* jpegout)
                 #ifndef OLD_FREEIMAGE
                     JPEG_BASELINE | JPEG_OPTIMIZE |
                 #endif
-                    85))
+                    (jpegquality ? jpegquality : 85)))
                 {
                     BYTE* tdata;
                     DWORD tlen;
@@ -570,7 +570,7 @@ bool GfxProcQT::resizebitmap(int rw, int rh, string* jpegout)
     QByteArray ba;
     QBuffer buffer(&ba);
     buffer.open(QIODevice::WriteOnly);
-    finalImage.save(&buffer, "JPG", 85);
+    finalImage.save(&buffer, "JPG", jpegquality ? jpegquality : 85);
     jpegout->assign(ba.constData(), ba.size());
     return !!jpegout->size();
 }
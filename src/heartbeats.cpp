@@ -161,6 +161,12 @@ void HeartBeatSyncInfo::updateStatus(UnifiedSync& us)
     setStatus(status);
 }
 
+void HeartBeatSyncInfo::addScanLatency(dstime ds)
+{
+    mLastScanLatency = ds;
+    mMaxScanLatency = std::max(mMaxScanLatency, ds);
+}
+
 #endif
 
 ////////////// BackupInfo ////////////////
@@ -329,6 +335,9 @@ string BackupInfoSync::getSyncExtraData(UnifiedSync&)
 #endif
 
 ////////////// MegaBackupMonitor ////////////////
+constexpr dstime BackupMonitor::MIN_BEAT_DELAY_DS;
+constexpr dstime BackupMonitor::MAX_BEAT_DELAY_DS;
+
 BackupMonitor::BackupMonitor(MegaClient *client)
     : mClient(client)
 {
@@ -404,62 +413,104 @@ void BackupMonitor::onSyncConfigChanged()
     });
 }
 
-void BackupMonitor::beatBackupInfo(UnifiedSync& us)
+bool BackupMonitor::beatBackupInfo(UnifiedSync& us, m_time_t maxAge)
 {
-    // send registration or update in case we missed it
-    updateOrRegisterSync(us);
-
     if (ISUNDEF(us.mConfig.getBackupId()))
     {
         LOG_warn << "Backup not registered yet. Skipping heartbeat...";
-        return;
+        return false;
     }
 
     std::shared_ptr<HeartBeatSyncInfo> hbs = us.mNextHeartbeat;
 
-    if ( !hbs->mSending && (hbs->mModified
-         || m_time(nullptr) - hbs->lastBeat() > MAX_HEARBEAT_SECS_DELAY))
+    m_time_t now = m_time(nullptr);
+    bool overdue = now - hbs->lastBeat() > maxAge;
+    if (hbs->mSending || !(hbs->mModified || overdue))
     {
-        hbs->updateStatus(us);  //we asume this is costly: only do it when beating
-        hbs->setLastBeat(m_time(nullptr));
+        return false;
+    }
 
-        m_off_t inflightProgress = 0;
-        if (us.mSync)
-        {
-            inflightProgress = us.mSync->getInflightProgress();
-        }
+    hbs->updateStatus(us);  //we asume this is costly: only do it when beating
 
-        int8_t progress = (hbs->progress(inflightProgress) < 0) ? -1 : static_cast<int8_t>(std::lround(hbs->progress(inflightProgress)*100.0));
+    m_off_t inflightProgress = 0;
+    if (us.mSync)
+    {
+        inflightProgress = us.mSync->getInflightProgress();
+    }
 
-        hbs->mSending = true;
-        auto newCommand = new CommandBackupPutHeartBeat(mClient, us.mConfig.getBackupId(),  static_cast<uint8_t>(hbs->status()),
-                          progress, hbs->mPendingUps, hbs->mPendingDowns,
-                          hbs->lastAction(), hbs->lastItemUpdated(),
-                          [hbs](Error){
-                               hbs->mSending = false;
-                          });
+    int8_t progress = (hbs->progress(inflightProgress) < 0) ? -1 : static_cast<int8_t>(std::lround(hbs->progress(inflightProgress)*100.0));
 
-#ifdef ENABLE_SYNC
-        if (hbs->status() == HeartBeatSyncInfo::Status::UPTODATE && progress >= 100)
-        {
-            hbs->invalidateProgress(); // we invalidate progress, so as not to keep on reporting 100% progress after reached up to date
-            // note: new transfer updates will modify the progress and make it valid again
-        }
-#endif
+    if (!overdue
+        && hbs->mSentStatus == hbs->status()
+        && hbs->mSentProgress == progress
+        && hbs->mSentUps == hbs->mPendingUps
+        && hbs->mSentDowns == hbs->mPendingDowns
+        && hbs->mSentLastItem == hbs->lastItemUpdated())
+    {
+        // nothing the last heartbeat didn't tell already
+        hbs->mModified = false;
+        return false;
+    }
+
+    hbs->setLastBeat(now);
+    hbs->mSentStatus = hbs->status();
+    hbs->mSentProgress = progress;
+    hbs->mSentUps = hbs->mPendingUps;
+    hbs->mSentDowns = hbs->mPendingDowns;
+    hbs->mSentLastItem = hbs->lastItemUpdated();
+
+    if (hbs->mMaxScanLatency)
+    {
+        LOG_debug << "Sync " << Base64Str<MegaClient::BACKUPHANDLE>(us.mConfig.getBackupId()) << " scan latency: last " << hbs->mLastScanLatency
+                  << " ds, longest since the last heartbeat " << hbs->mMaxScanLatency << " ds";
+        hbs->mMaxScanLatency = 0;
+    }
+
+    hbs->mSending = true;
+    auto newCommand = new CommandBackupPutHeartBeat(mClient, us.mConfig.getBackupId(),  static_cast<uint8_t>(hbs->status()),
+                      progress, hbs->mPendingUps, hbs->mPendingDowns,
+                      hbs->lastAction(), hbs->lastItemUpdated(),
+                      [hbs](Error){
+                           hbs->mSending = false;
+                      });
 
-        mClient->reqs.add(newCommand);
+    if (hbs->status() == HeartBeatSyncInfo::Status::UPTODATE && progress >= 100)
+    {
+        hbs->invalidateProgress(); // we invalidate progress, so as not to keep on reporting 100% progress after reached up to date
+        // note: new transfer updates will modify the progress and make it valid again
     }
+
+    mClient->reqs.add(newCommand);
+    return true;
 }
 
 #endif
 
-void BackupMonitor::beat()
+dstime BackupMonitor::beat()
 {
+    bool sent = false;
+
 #ifdef ENABLE_SYNC
     mClient->syncs.forEachUnifiedSync([&](UnifiedSync& us){
-        beatBackupInfo(us);
+        // send registration or update in case we missed it
+        updateOrRegisterSync(us);
+
+        sent |= beatBackupInfo(us, MAX_HEARBEAT_SECS_DELAY);
     });
+
+    if (sent)
+    {
+        // all of them go in the same request: bring forward the beats of the unchanged backups
+        // that would be due before long, rather than having each of them wake the network later on
+        mClient->syncs.forEachUnifiedSync([&](UnifiedSync& us){
+            beatBackupInfo(us, MAX_HEARBEAT_SECS_DELAY / 2);
+        });
+    }
 #endif
+
+    // check often while there is activity, and less and less often while there is none
+    mBeatDelay = sent ? MIN_BEAT_DELAY_DS : std::min<dstime>(mBeatDelay * 2, MAX_BEAT_DELAY_DS);
+    return mBeatDelay;
 }
 
 }
@@ -19,6 +19,9 @@
  * program.
  */
 
+// the level of the net module applies (see SimpleLogger::setModuleLogLevel)
+#define MEGA_LOG_MODULE ::mega::logModuleNet
+
 #include "mega/http.h"
 #include "mega/megaclient.h"
 #include "mega/logging.h"
@@ -459,6 +462,212 @@ void HttpReq::disconnect()
     }
 }
 
+TransferBufferPool& TransferBufferPool::instance()
+{
+    // never destroyed: buffers can be released during the destruction of other statics
+    static TransferBufferPool* pool = new TransferBufferPool;
+    return *pool;
+}
+
+size_t TransferBufferPool::sizeClass(size_t size)
+{
+    if (size >= GRANULE)
+    {
+        return (size + GRANULE - 1) / GRANULE * GRANULE;
+    }
+
+    size_t c = 64;
+    while (c < size)
+    {
+        c <<= 1;
+    }
+    return c;
+}
+
+byte* TransferBufferPool::allocate(size_t size)
+{
+    size_t c = sizeClass(size);
+    byte* buf = NULL;
+
+    std::lock_guard<std::mutex> g(mMutex);
+
+    auto it = mIdle.find(c);
+    if (it != mIdle.end())
+    {
+        buf = it->second.back();
+        it->second.pop_back();
+        if (it->second.empty())
+        {
+            mIdle.erase(it);
+        }
+        mIdleBytes -= c;
+    }
+    else
+    {
+        buf = new byte[c];
+    }
+
+    mInUse[buf] = c;
+    mInUseBytes += c;
+    return buf;
+}
+
+void TransferBufferPool::release(byte* buf)
+{
+    if (!buf)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> g(mMutex);
+
+    auto it = mInUse.find(buf);
+    if (it == mInUse.end())
+    {
+        assert(false);
+        delete[] buf;
+        return;
+    }
+
+    size_t c = it->second;
+    mInUse.erase(it);
+    mInUseBytes -= c;
+
+    if (mIdleBytes + c > mIdleLimit)
+    {
+        delete[] buf;
+        return;
+    }
+
+    mIdle[c].push_back(buf);
+    mIdleBytes += c;
+}
+
+void TransferBufferPool::setCeiling(size_t bytes)
+{
+    std::lock_guard<std::mutex> g(mMutex);
+    mCeiling = bytes;
+}
+
+bool TransferBufferPool::overCeiling() const
+{
+    std::lock_guard<std::mutex> g(mMutex);
+    return mCeiling && mInUseBytes >= mCeiling;
+}
+
+void TransferBufferPool::setIdleLimit(size_t bytes)
+{
+    std::lock_guard<std::mutex> g(mMutex);
+    mIdleLimit = bytes;
+    trim();
+}
+
+size_t TransferBufferPool::inUse() const
+{
+    std::lock_guard<std::mutex> g(mMutex);
+    return mInUseBytes;
+}
+
+size_t TransferBufferPool::idle() const
+{
+    std::lock_guard<std::mutex> g(mMutex);
+    return mIdleBytes;
+}
+
+void TransferBufferPool::trim()
+{
+    while (mIdleBytes > mIdleLimit)
+    {
+        auto it = std::prev(mIdle.end());
+        delete[] it->second.back();
+        it->second.pop_back();
+        mIdleBytes -= it->first;
+        if (it->second.empty())
+        {
+            mIdle.erase(it);
+        }
+    }
+}
+
+void TokenBucket::setRate(m_off_t bps)
+{
+    mRate = bps > 0 ? bps : 0;
+    mTokens = std::min(mTokens, burst());
+}
+
+m_off_t TokenBucket::rate() const
+{
+    return mRate;
+}
+
+m_off_t TokenBucket::burst() const
+{
+    return std::max(mRate, MIN_BURST);
+}
+
+m_off_t TokenBucket::allowance(dstime ds)
+{
+    if (!mRate)
+    {
+        return std::numeric_limits<m_off_t>::max();
+    }
+
+    if (ds > mRefilled)
+    {
+        mTokens = std::min(burst(), mTokens + mRate * m_off_t(ds - mRefilled) / 10);
+        mRefilled = ds;
+    }
+    return mTokens;
+}
+
+void TokenBucket::consume(m_off_t bytes)
+{
+    if (mRate)
+    {
+        mTokens -= bytes;
+    }
+}
+
+dstime TokenBucket::availableAt(dstime ds) const
+{
+    if (!mRate || mTokens > 0)
+    {
+        return ds;
+    }
+
+    // the debt and the first byte after it, in whole ds
+    m_off_t owed = 1 - mTokens;
+    return mRefilled + dstime((owed * 10 + mRate - 1) / mRate);
+}
+
+m_off_t TokenBucket::allowance(const vector<TokenBucket*>& limits, dstime ds)
+{
+    m_off_t allowed = std::numeric_limits<m_off_t>::max();
+    for (TokenBucket* limit : limits)
+    {
+        allowed = std::min(allowed, limit->allowance(ds));
+    }
+    return allowed;
+}
+
+void TokenBucket::consume(const vector<TokenBucket*>& limits, m_off_t bytes)
+{
+    for (TokenBucket* limit : limits)
+    {
+        limit->consume(bytes);
+    }
+}
+
+dstime TokenBucket::availableAt(const vector<TokenBucket*>& limits, dstime ds)
+{
+    dstime at = ds;
+    for (TokenBucket* limit : limits)
+    {
+        at = std::max(at, limit->availableAt(ds));
+    }
+    return at;
+}
+
 HttpReq::HttpReq(bool b)
 {
     binary = b;
@@ -484,12 +693,13 @@ HttpReq::~HttpReq()
         httpio->cancel(this);
     }
 
-    delete[] buf;
+    TransferBufferPool::instance().release(buf);
 }
 
 void HttpReq::init()
 {
     httpstatus = 0;
+    connectms = 0;
     inpurge = 0;
     sslcheckfailed = false;
     bufpos = 0;
@@ -500,6 +710,7 @@ void HttpReq::init()
     outpos = 0;
     in.clear();
     contenttype.clear();
+    contentencoding.clear();
 }
 
 void HttpReq::setreq(const char* u, contenttype_t t)
@@ -546,7 +757,7 @@ HttpReq::http_buf_t::http_buf_t(byte* b, size_t s, size_t e)
 
 HttpReq::http_buf_t::~http_buf_t()
 {
-    delete[] buf;
+    TransferBufferPool::instance().release(buf);
 }
 
 void HttpReq::http_buf_t::swap(http_buf_t& other)
@@ -607,7 +818,7 @@ void HttpReq::purge(size_t numbytes)
 // set total response size
 void HttpReq::setcontentlength(m_off_t len)
 {
-    if (!buf && type != REQ_BINARY)
+    if (!buf && type != REQ_BINARY && !streamed)
     {
         in.reserve(static_cast<size_t>(len));
     }
@@ -686,13 +897,13 @@ void HttpReqDL::prepare(const char* tempurl, SymmCipher* /*key*/,
         // (re)allocate buffer
         if (buf)
         {
-            delete[] buf;
+            TransferBufferPool::instance().release(buf);
             buf = NULL;
         }
 
         if (size)
         {
-            buf = new byte[(size + SymmCipher::BLOCKSIZE - 1) & - SymmCipher::BLOCKSIZE];
+            buf = TransferBufferPool::instance().allocate((size + SymmCipher::BLOCKSIZE - 1) & - SymmCipher::BLOCKSIZE);
         }
         buflen = size;
     }
@@ -705,7 +916,7 @@ EncryptByChunks::EncryptByChunks(SymmCipher* k, chunkmac_map* m, uint64_t iv) :
     memset(crc, 0, CRCSIZE);
 }
 
-void EncryptByChunks::updateCRC(byte* data, unsigned size, unsigned offset)
+void EncryptByChunks::updateCRC(byte* crc, byte* data, unsigned size, unsigned offset)
 {
     uint32_t *intc = (uint32_t *)crc;
 
@@ -765,7 +976,7 @@ bool EncryptByChunks::encrypt(m_off_t pos, m_off_t npos, string& urlSuffix)
         (*macs)[startpos].finished = false;  // finished is only set true after confirmation of the chunk uploading.
         LOG_debug << "Encrypted chunk: " << startpos << " - " << endpos << "   Size: " << chunksize;
 
-        updateCRC(buf, unsigned(chunksize), unsigned(startpos - pos));
+        updateCRC(crc, buf, unsigned(chunksize), unsigned(startpos - pos));
 
         startpos = endpos;
         endpos = ChunkedHash::chunkceil(startpos, finalpos);
@@ -782,6 +993,44 @@ bool EncryptByChunks::encrypt(m_off_t pos, m_off_t npos, string& urlSuffix)
 }
 
 
+void EncryptByChunks::encryptchunks(MegaClientAsyncQueue& queue, byte* buffer, m_off_t bufferpos, const vector<m_off_t>& starts,
+                                    m_off_t pos, const std::function<void()>& meanwhile)
+{
+    // the chunks are independent: each gets its own MAC, and a CRC made at its offset in the
+    // piece, which are xored together afterwards
+    struct ChunkResult
+    {
+        byte mac[SymmCipher::BLOCKSIZE];
+        byte crc[CRCSIZE];
+    };
+    vector<ChunkResult> results(starts.size() - 1, ChunkResult());
+    const byte* filekey = key->key;
+    uint64_t iv = ctriv;
+
+    // the cipher passed is shared by the calling threads of parallelFor: use one per chunk instead
+    queue.parallelFor(results.size(), [&](size_t i, SymmCipher&)
+    {
+        SymmCipher cipher(filekey);
+        byte* buf = buffer + (starts[i] - bufferpos);
+        unsigned chunksize = unsigned(starts[i + 1] - starts[i]);
+
+        cipher.ctr_crypt(buf, chunksize, starts[i], iv, results[i].mac, 1);
+        updateCRC(results[i].crc, buf, chunksize, unsigned(starts[i] - pos));
+    }, meanwhile);
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        memcpy((*macs)[starts[i]].mac, results[i].mac, sizeof results[i].mac);
+        (*macs)[starts[i]].finished = false;  // finished is only set true after confirmation of the chunk uploading.
+        LOG_debug << "Encrypted chunk: " << starts[i] << " - " << starts[i + 1] << "   Size: " << starts[i + 1] - starts[i];
+
+        for (unsigned j = 0; j < CRCSIZE; j++)
+        {
+            crc[j] ^= results[i].crc[j];
+        }
+    }
+}
+
 EncryptBufferByChunks::EncryptBufferByChunks(byte* b, SymmCipher* k, chunkmac_map* m, uint64_t iv)
     : EncryptByChunks(k, m, iv)
     , chunkstart(b)
@@ -795,15 +1044,53 @@ byte* EncryptBufferByChunks::nextbuffer(unsigned bufsize)
     return pos;
 }
 
+bool EncryptBufferByChunks::encrypt(MegaClientAsyncQueue& queue, m_off_t pos, m_off_t npos, string& urlSuffix)
+{
+    vector<m_off_t> starts;
+    for (m_off_t p = pos; p < npos; p = ChunkedHash::chunkceil(p, npos))
+    {
+        starts.push_back(p);
+    }
+
+    if (starts.size() < 2)
+    {
+        return encrypt(pos, npos, urlSuffix);
+    }
+    starts.push_back(npos);
+
+    encryptchunks(queue, chunkstart, pos, starts, pos);
+    chunkstart += npos - pos;
+
+    ostringstream s;
+    s << "/" << pos << "?c=" << Base64Str<EncryptByChunks::CRCSIZE>(crc);
+    urlSuffix = s.str();
+
+    return true;
+}
+
 // prepare chunk for uploading: mac and encrypt
 void HttpReqUL::prepare(const char* tempurl, SymmCipher* key,
                         uint64_t ctriv, m_off_t pos,
                         m_off_t npos)
+{
+    prepare(tempurl, key, ctriv, pos, npos, nullptr);
+}
+
+void HttpReqUL::prepare(const char* tempurl, SymmCipher* key,
+                        uint64_t ctriv, m_off_t pos,
+                        m_off_t npos, MegaClientAsyncQueue* queue)
 {
     EncryptBufferByChunks eb((byte*)out->data(), key, &mChunkmacs, ctriv);
 
     string urlSuffix;
-    eb.encrypt(pos, npos, urlSuffix);
+    if (queue)
+    {
+        eb.encrypt(*queue, pos, npos, urlSuffix);
+    }
+    else
+    {
+        eb.encrypt(pos, npos, urlSuffix);
+    }
 
     // unpad for POSTing
     size = (unsigned)(npos - pos);
@@ -832,6 +1119,7 @@ void SpeedController::requestStarted()
 {
     mRequestPos = 0;
     mRequestStart = mLastRequestUpdate = Waiter::ds;
+    mRequestFirstData = 0;
 }
 
 m_off_t SpeedController::requestProgressed(m_off_t newPos)
@@ -840,6 +1128,10 @@ m_off_t SpeedController::requestProgressed(m_off_t newPos)
     {
         m_off_t delta = newPos - mRequestPos;
         calculateSpeed(delta);
+        if (!mRequestPos)
+        {
+            mRequestFirstData = Waiter::ds;
+        }
         mRequestPos = newPos;
         mLastRequestUpdate = Waiter::ds;
         return delta;
@@ -858,6 +1150,11 @@ dstime SpeedController::requestElapsedDs()
     return Waiter::ds - mRequestStart;
 }
 
+dstime SpeedController::requestFirstDataDs()
+{
+    return (mRequestPos ? mRequestFirstData : Waiter::ds) - mRequestStart;
+}
+
 m_off_t SpeedController::calculateSpeed(long long numBytes)
 {
     assert(numBytes >= 0);
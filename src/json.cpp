@@ -20,19 +20,195 @@
  */
 #include <cctype>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MEGA_JSON_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define MEGA_JSON_NEON 1
+#endif
+
+#if defined(_MSC_VER) && (defined(MEGA_JSON_SSE2) || defined(MEGA_JSON_NEON))
+#include <intrin.h>
+#endif
+
 #include "mega/json.h"
 #include "mega/base64.h"
 #include "mega/megaclient.h"
 #include "mega/logging.h"
 
 namespace mega {
+
+bool JSON::vectorscan = true;
+
+namespace {
+
+#if defined(MEGA_JSON_SSE2) || defined(MEGA_JSON_NEON)
+// index of the lowest set bit of a non-zero mask
+inline unsigned lowestbit(uint64_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long i;
+#if defined(_M_X64) || defined(_M_ARM64)
+    _BitScanForward64(&i, mask);
+#else
+    if (!_BitScanForward(&i, unsigned(mask)))
+    {
+        _BitScanForward(&i, unsigned(mask >> 32));
+        i += 32;
+    }
+#endif
+    return unsigned(i);
+#else
+    return unsigned(__builtin_ctzll(mask));
+#endif
+}
+#endif
+
+#if defined(MEGA_JSON_SSE2)
+const size_t BLOCK = 16;
+
+// bit i is set if block[i] is '"', '\\' or (if nul) NUL
+inline uint64_t stopmask(const char* block, bool aligned, bool nul)
+{
+    __m128i v = aligned ? _mm_load_si128(reinterpret_cast<const __m128i*>(block))
+                        : _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+    if (nul)
+    {
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    }
+    return unsigned(_mm_movemask_epi8(m));
+}
+#elif defined(MEGA_JSON_NEON)
+const size_t BLOCK = 16;
+
+// with 4 bits per byte (the narrowing shift packs the comparison into 64 bits), so callers divide by 4
+inline uint64_t stopmask(const char* block, bool, bool nul)
+{
+    uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(block));
+    uint8x16_t m = vorrq_u8(vceqq_u8(v, vdupq_n_u8('"')), vceqq_u8(v, vdupq_n_u8('\\')));
+    if (nul)
+    {
+        m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8(0)));
+    }
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+}
+#endif
+
+#if defined(MEGA_JSON_SSE2)
+const unsigned BITSPERBYTE = 1;
+#elif defined(MEGA_JSON_NEON)
+const unsigned BITSPERBYTE = 4;
+#endif
+
+// first '"', '\\' or NUL at or after ptr in a NUL-terminated buffer
+inline const char* findstringstop(const char* ptr)
+{
+#if defined(MEGA_JSON_SSE2) || defined(MEGA_JSON_NEON)
+    if (JSON::vectorscan)
+    {
+        // aligned blocks never cross into an unmapped page, so reading past the NUL is harmless
+        size_t misalign = size_t(uintptr_t(ptr) & (BLOCK - 1));
+        const char* block = ptr - misalign;
+        uint64_t mask = stopmask(block, true, true) >> (misalign * BITSPERBYTE);
+
+        if (mask)
+        {
+            return ptr + lowestbit(mask) / BITSPERBYTE;
+        }
+
+        for (;;)
+        {
+            block += BLOCK;
+            if ((mask = stopmask(block, true, true)))
+            {
+                return block + lowestbit(mask) / BITSPERBYTE;
+            }
+        }
+    }
+#endif
+
+    while (*ptr && *ptr != '"' && *ptr != '\\')
+    {
+        ptr++;
+    }
+
+    return ptr;
+}
+
+// first '"' or '\\' in [ptr, end), or end
+inline const char* findstringstop(const char* ptr, const char* end)
+{
+#if defined(MEGA_JSON_SSE2) || defined(MEGA_JSON_NEON)
+    if (JSON::vectorscan)
+    {
+        for (; end - ptr >= ptrdiff_t(BLOCK); ptr += BLOCK)
+        {
+            if (uint64_t mask = stopmask(ptr, false, false))
+            {
+                return ptr + lowestbit(mask) / BITSPERBYTE;
+            }
+        }
+    }
+#endif
+
+    while (ptr < end && *ptr != '"' && *ptr != '\\')
+    {
+        ptr++;
+    }
+
+    return ptr;
+}
+
+} // namespace
+
+// given ptr just past the opening quote of a string, the closing quote, or the terminating NUL if
+// there is none
+const char* JSON::stringend(const char* ptr)
+{
+    for (;;)
+    {
+        ptr = findstringstop(ptr);
+
+        if (*ptr != '\\')
+        {
+            return ptr;
+        }
+
+        // skip the escaped character, unless the buffer ends here
+        if (!*++ptr)
+        {
+            return ptr;
+        }
+
+        ptr++;
+    }
+}
 // store array or object in string s
 // reposition after object
 bool JSON::storeobject(string* s)
+{
+    JSONView v;
+
+    if (!storeobject(v))
+    {
+        return false;
+    }
+
+    if (s)
+    {
+        v.assignto(s);
+    }
+
+    return true;
+}
+
+// as above, without the copy
+bool JSON::storeobject(JSONView& v)
 {
     int openobject[2] = { 0 };
     const char* ptr;
-    bool escaped = false;
 
     while (*(const signed char*)pos > 0 && *pos <= ' ')
     {
@@ -67,13 +243,7 @@ bool JSON::storeobject(string* s)
         }
         else if (*ptr == '"')
         {
-            ptr++;
-
-            while (*ptr && (escaped || *ptr != '"'))
-            {
-                escaped = *ptr == '\\' && !escaped;
-                ptr++;
-            }
+            ptr = stringend(ptr + 1);
 
             if (!*ptr)
             {
@@ -102,16 +272,13 @@ bool JSON::storeobject(string* s)
 
         if (!openobject[0] && !openobject[1])
         {
-            if (s)
+            if (*pos == '"')
             {
-                if (*pos == '"')
-                {
-                    s->assign(pos + 1, ptr - pos - 2);
-                }
-                else
-                {
-                    s->assign(pos, ptr - pos);
-                }
+                v = JSONView(pos + 1, size_t(ptr - pos - 2));
+            }
+            else
+            {
+                v = JSONView(pos, size_t(ptr - pos));
             }
 
             pos = ptr;
@@ -151,32 +318,20 @@ nameid JSON::getnameid(const char* ptr) const
 
 std::string JSON::getname()
 {
-    const char* ptr = pos;
-    string name;
-
-    if (*ptr == ',' || *ptr == ':')
-    {
-        ptr++;
-    }
-
-    if (*ptr++ == '"')
-    {
-        while (*ptr && *ptr != '"')
-        {
-            name += *ptr;
-            ptr++;
-        }
-
-        pos = ptr + 2;
-    }
-
-    return name;
+    return getnameview().str();
 }
 
 std::string JSON::getnameWithoutAdvance() const
+{
+    JSON j(*this);
+    return j.getnameview().str();
+}
+
+// pos points to [,]"name":...
+// returns the name and repositions pos after :
+JSONView JSON::getnameview()
 {
     const char* ptr = pos;
-    string name;
 
     if (*ptr == ',' || *ptr == ':')
     {
@@ -185,14 +340,18 @@ std::string JSON::getnameWithoutAdvance() const
 
     if (*ptr++ == '"')
     {
+        const char* name = ptr;
+
         while (*ptr && *ptr != '"')
         {
-            name += *ptr;
             ptr++;
         }
+
+        pos = ptr + 2;
+        return JSONView(name, size_t(ptr - name));
     }
 
-    return name;
+    return JSONView();
 }
 
 // pos points to [,]"name":...
@@ -420,6 +579,20 @@ const char* JSON::getvalue()
     return r;
 }
 
+JSONView JSON::getvalueview()
+{
+    JSONView v;
+
+    if (*pos == ':' || *pos == ',')
+    {
+        pos++;
+    }
+
+    storeobject(v);
+
+    return v;
+}
+
 fsfp_t JSON::getfp()
 {
     return gethandle(sizeof(fsfp_t));
@@ -542,6 +715,49 @@ bool JSON::leaveobject()
     return false;
 }
 
+// find the end of a complete object or array, eg. in a partially received response
+const char* JSON::objectend(const char* ptr, const char* end)
+{
+    int depth = 0;
+    bool instring = false;
+
+    for (; ptr < end; ptr++)
+    {
+        if (instring)
+        {
+            ptr = findstringstop(ptr, end);
+
+            if (ptr == end)
+            {
+                break;
+            }
+
+            if (*ptr == '\\')
+            {
+                ptr++;
+            }
+            else
+            {
+                instring = false;
+            }
+        }
+        else if (*ptr == '"')
+        {
+            instring = true;
+        }
+        else if (*ptr == '{' || *ptr == '[')
+        {
+            depth++;
+        }
+        else if ((*ptr == '}' || *ptr == ']') && !--depth)
+        {
+            return ptr + 1;
+        }
+    }
+
+    return NULL;
+}
+
 // unescape JSON string (non-strict)
 void JSON::unescape(string* s)
 {
@@ -852,6 +1068,16 @@ void JSONWriter::closeobject()
     --mLevel;
 }
 
+void JSONWriter::reserve(size_t n)
+{
+    mJson.reserve(mJson.size() + n);
+}
+
+size_t JSONWriter::b64size(size_t n)
+{
+    return (n * 4 + 2) / 3;
+}
+
 const byte* JSONWriter::getbytes() const
 {
     return reinterpret_cast<const byte*>(mJson.data());
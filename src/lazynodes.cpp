@@ -0,0 +1,162 @@
+/**
+ * @file lazynodes.cpp
+ * @brief Index of the nodes left in the local cache by lazy loading
+ *
+ * (c) 2013-2021 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <algorithm>
+
+#include "mega/lazynodes.h"
+
+namespace mega {
+
+void LazyNodeIndex::add(handle h, handle parent, uint32_t dbid)
+{
+    auto result = mEntries.emplace(h, Entry{parent, dbid});
+
+    if (!result.second)
+    {
+        // re-added under a (possibly) different parent
+        handle previous;
+        uint32_t unused;
+        take(h, &unused, &previous);
+        mEntries.emplace(h, Entry{parent, dbid});
+    }
+
+    mChildren[parent].push_back(h);
+}
+
+bool LazyNodeIndex::take(handle h, uint32_t* dbid, handle* parent)
+{
+    auto it = mEntries.find(h);
+
+    if (it == mEntries.end())
+    {
+        return false;
+    }
+
+    *dbid = it->second.dbid;
+    *parent = it->second.parent;
+    mEntries.erase(it);
+
+    auto children = mChildren.find(*parent);
+    if (children != mChildren.end())
+    {
+        std::vector<handle>& v = children->second;
+        auto pos = std::find(v.begin(), v.end(), h);
+        if (pos != v.end())
+        {
+            *pos = v.back();
+            v.pop_back();
+        }
+
+        if (v.empty())
+        {
+            mChildren.erase(children);
+        }
+    }
+
+    return true;
+}
+
+bool LazyNodeIndex::takechildren(handle parent, std::vector<uint32_t>* dbids)
+{
+    auto children = mChildren.find(parent);
+
+    if (children == mChildren.end())
+    {
+        return false;
+    }
+
+    dbids->clear();
+    dbids->reserve(children->second.size());
+
+    for (handle h : children->second)
+    {
+        auto it = mEntries.find(h);
+        if (it != mEntries.end())
+        {
+            dbids->push_back(it->second.dbid);
+            mEntries.erase(it);
+        }
+    }
+
+    mChildren.erase(children);
+    return true;
+}
+
+bool LazyNodeIndex::contains(handle h) const
+{
+    return mEntries.find(h) != mEntries.end();
+}
+
+bool LazyNodeIndex::parentof(handle h, handle* parent) const
+{
+    auto it = mEntries.find(h);
+
+    if (it == mEntries.end())
+    {
+        return false;
+    }
+
+    *parent = it->second.parent;
+    return true;
+}
+
+bool LazyNodeIndex::haschildren(handle parent) const
+{
+    return mChildren.find(parent) != mChildren.end();
+}
+
+void LazyNodeIndex::clear()
+{
+    mEntries.clear();
+    mChildren.clear();
+    mRecent.clear();
+    mRecentPos.clear();
+}
+
+void LazyNodeIndex::touch(handle folder)
+{
+    auto it = mRecentPos.find(folder);
+
+    if (it != mRecentPos.end())
+    {
+        mRecent.splice(mRecent.begin(), mRecent, it->second);
+    }
+    else
+    {
+        mRecent.push_front(folder);
+        mRecentPos[folder] = mRecent.begin();
+    }
+}
+
+bool LazyNodeIndex::leastrecent(handle* folder)
+{
+    if (mRecent.empty())
+    {
+        return false;
+    }
+
+    *folder = mRecent.back();
+    mRecentPos.erase(*folder);
+    mRecent.pop_back();
+    return true;
+}
+
+} // namespace
@@ -51,6 +51,7 @@ Logger *SimpleLogger::logger = nullptr;
 
 // by the default, display logs with level equal or less than logInfo
 enum LogLevel SimpleLogger::logCurrentLevel = logInfo;
+enum LogLevel SimpleLogger::logModuleLevels[LOG_MODULES] = {};
 long long SimpleLogger::maxPayloadLogSize  = 10240;
 
 #ifdef ENABLE_LOG_PERFORMANCE
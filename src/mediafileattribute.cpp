@@ -25,6 +25,7 @@
 #include "mega/command.h"
 #include "mega/megaclient.h"
 #include "mega/megaapp.h"
+#include "mega/filefingerprint.h"
 
 #ifdef USE_MEDIAINFO
 #include "MediaInfo/MediaInfo.h"
@@ -272,6 +273,113 @@ void MediaFileInfo::sendOrQueueMediaPropertiesFileAttributesForExistingFile(Medi
     }
 }
 
+std::shared_ptr<MediaFileInfo::Extraction> MediaFileInfo::requestExtraction(MegaClient* client, const LocalPath& localpath, const FileFingerprint& fp)
+{
+    string key;
+    if (fp.isvalid)
+    {
+        fp.serializefingerprint(&key);
+
+        auto it = extractions.find(key);
+        if (it != extractions.end())
+        {
+            return it->second;
+        }
+    }
+
+    auto extraction = std::make_shared<Extraction>();
+    if (fp.isvalid)
+    {
+        while (extractions.size() >= MAXEXTRACTIONS)
+        {
+            // those still in progress finish for whoever waits for them
+            extractions.erase(extractionorder.front());
+            extractionorder.pop_front();
+        }
+        extractions.emplace(key, extraction);
+        extractionorder.push_back(key);
+    }
+
+    FileSystemAccess* fsaccess = client->fsaccess;
+    LocalPath path = localpath;
+    client->mAsyncQueue.push([extraction, fsaccess, path](SymmCipher&) mutable
+        {
+            extraction->vp.extractMediaPropertyFileAttributes(path, fsaccess);
+            extraction->done = true;
+        }, false);
+
+    return extraction;
+}
+
+unsigned MediaFileInfo::queueExtractionForUpload(const LocalPath& localpath, const FileFingerprint& fp, uint32_t fakey[4], MegaClient* client, handle uploadHandle)
+{
+    auto extraction = requestExtraction(client, localpath, fp);
+    if (extraction->done)
+    {
+        return queueMediaPropertiesFileAttributesForUpload(extraction->vp, fakey, client, uploadHandle);
+    }
+
+    ExtractionWait w;
+    w.extraction = std::move(extraction);
+    w.upload = true;
+    w.handle = uploadHandle;
+    memcpy(w.fakey, fakey, sizeof(w.fakey));
+    extractionwaits.push_back(std::move(w));
+    LOG_debug << "Upload waiting for its media attributes";
+    return 1;
+}
+
+void MediaFileInfo::queueExtractionForExistingFile(const LocalPath& localpath, const FileFingerprint& fp, uint32_t fakey[4], MegaClient* client, handle fileHandle)
+{
+    auto extraction = requestExtraction(client, localpath, fp);
+    if (extraction->done)
+    {
+        sendOrQueueMediaPropertiesFileAttributesForExistingFile(extraction->vp, fakey, client, fileHandle);
+        return;
+    }
+
+    ExtractionWait w;
+    w.extraction = std::move(extraction);
+    w.upload = false;
+    w.handle = fileHandle;
+    memcpy(w.fakey, fakey, sizeof(w.fakey));
+    extractionwaits.push_back(std::move(w));
+}
+
+void MediaFileInfo::checkExtractions(MegaClient* client)
+{
+    for (size_t i = 0; i < extractionwaits.size(); )
+    {
+        if (!extractionwaits[i].extraction->done)
+        {
+            i++;
+            continue;
+        }
+
+        // the calls below may queue more
+        ExtractionWait w = std::move(extractionwaits[i]);
+        extractionwaits.erase(extractionwaits.begin() + i);
+
+        if (!w.upload)
+        {
+            sendOrQueueMediaPropertiesFileAttributesForExistingFile(w.extraction->vp, w.fakey, client, w.handle);
+        }
+        else if (client->faputcompletion.find(w.handle) == client->faputcompletion.end())
+        {
+            LOG_debug << "Media attributes extracted for an upload no longer waiting - " << w.handle;
+        }
+        else
+        {
+            if (!queueMediaPropertiesFileAttributesForUpload(w.extraction->vp, w.fakey, client, w.handle))
+            {
+                // the codecs failed meanwhile: the upload completes without them
+                client->pendingfa[pair<handle, fatype>(w.handle, fatype(fa_media))] = pair<handle, int>(0, 0);
+            }
+            client->checkfacompletion(w.handle);
+        }
+    }
+}
+
 void MediaFileInfo::addUploadMediaFileAttributes(handle& uploadhandle, std::string* s)
 {
     std::map<handle, MediaFileInfo::queuedvp>::iterator i = uploadFileAttributes.find(uploadhandle);
@@ -804,7 +912,7 @@ void MediaProperties::extractMediaPropertyFileAttributes(LocalPath& localFilenam
                     fps = vro.To_int32u();
                 }
 
-                if (SimpleLogger::logCurrentLevel >= logDebug)
+                if (MEGA_LOG_ENABLED(logDebug))
                 {
                     LOG_debug << "MediaInfo on " << localFilename.toPath(*fsa) << " | " << vw.To_Local() << " " << vh.To_Local() << " " << vd.To_Local() << " " << vr.To_Local() << " |\"" << gci.To_Local() << "\",\"" << gf.To_Local() << "\",\"" << vci.To_Local() << "\",\"" << vcf.To_Local() << "\",\"" << aci.To_Local() << "\",\"" << acf.To_Local() << "\"";
                 }
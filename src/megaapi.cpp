@@ -1588,6 +1588,8 @@ void MegaTransferListener::onTransferFinish(MegaApi*, MegaTransfer *, MegaError*
 { }
 void MegaTransferListener::onTransferUpdate(MegaApi *, MegaTransfer *)
 { }
+void MegaTransferListener::onTransfersUpdate(MegaApi *, MegaTransferList *)
+{ }
 bool MegaTransferListener::onTransferData(MegaApi *, MegaTransfer *, char *, size_t)
 { return true; }
 void MegaTransferListener::onTransferTemporaryError(MegaApi *, MegaTransfer *, MegaError*)
@@ -1660,6 +1662,8 @@ void MegaGlobalListener::onUserAlertsUpdate(MegaApi *api, MegaUserAlertList *ale
 { }
 void MegaGlobalListener::onNodesUpdate(MegaApi *, MegaNodeList *)
 { }
+void MegaGlobalListener::onNodesChanged(MegaApi *, MegaHandleList *, MegaIntegerList *)
+{ }
 void MegaGlobalListener::onAccountUpdate(MegaApi *)
 { }
 void MegaGlobalListener::onContactRequestsUpdate(MegaApi *, MegaContactRequestList *)
@@ -1686,6 +1690,8 @@ void MegaListener::onTransferFinish(MegaApi *, MegaTransfer *, MegaError *)
 { }
 void MegaListener::onTransferUpdate(MegaApi *, MegaTransfer *)
 { }
+void MegaListener::onTransfersUpdate(MegaApi *, MegaTransferList *)
+{ }
 void MegaListener::onTransferTemporaryError(MegaApi *, MegaTransfer *, MegaError *)
 { }
 void MegaListener::onUsersUpdate(MegaApi *, MegaUserList *)
@@ -1694,6 +1700,8 @@ void MegaListener::onUserAlertsUpdate(MegaApi *, MegaUserAlertList *)
 { }
 void MegaListener::onNodesUpdate(MegaApi *, MegaNodeList *)
 { }
+void MegaListener::onNodesChanged(MegaApi *, MegaHandleList *, MegaIntegerList *)
+{ }
 void MegaListener::onAccountUpdate(MegaApi *)
 { }
 void MegaListener::onContactRequestsUpdate(MegaApi *, MegaContactRequestList *)
@@ -1910,6 +1918,31 @@ void MegaApi::setLogLevel(int logLevel)
     MegaApiImpl::setLogLevel(logLevel);
 }
 
+void MegaApi::setModuleLogLevel(int module, int logLevel)
+{
+    MegaApiImpl::setModuleLogLevel(module, logLevel);
+}
+
+void MegaApi::setSharedWorkerThreads(unsigned count)
+{
+    MegaApiImpl::setSharedWorkerThreads(count);
+}
+
+void MegaApi::setGfxThreads(unsigned count)
+{
+    MegaApiImpl::setGfxThreads(count);
+}
+
+bool MegaApi::setThreadSettings(int role, unsigned count, const char* cpus, int priority)
+{
+    return MegaApiImpl::setThreadSettings(role, count, cpus, priority);
+}
+
+void MegaApi::setWorkerExecutor(MegaExecutor* executor)
+{
+    MegaApiImpl::setWorkerExecutor(executor);
+}
+
 void MegaApi::setMaxPayloadLogSize(long long maxSize)
 {
     MegaApiImpl::setMaxPayloadLogSize(maxSize);
@@ -1946,9 +1979,9 @@ long long MegaApi::getSDKtime()
 }
 
 #ifdef USE_ROTATIVEPERFORMANCELOGGER
-void MegaApi::setUseRotativePerformanceLogger(const char * logPath, const char * logFileName, bool logToStdOut, long int archivedFilesAgeSeconds)
+void MegaApi::setUseRotativePerformanceLogger(const char * logPath, const char * logFileName, bool logToStdOut, long int archivedFilesAgeSeconds, bool binary)
 {
-    MegaApiImpl::setUseRotativePerformanceLogger(logPath, logFileName, logToStdOut, archivedFilesAgeSeconds);
+    MegaApiImpl::setUseRotativePerformanceLogger(logPath, logFileName, logToStdOut, archivedFilesAgeSeconds, binary);
 }
 #endif
 
@@ -2174,6 +2207,36 @@ char *MegaApi::getSequenceNumber()
     return pImpl->getSequenceNumber();
 }
 
+char *MegaApi::getMetrics()
+{
+    return pImpl->getMetrics();
+}
+
+void MegaApi::setTransferTraceSize(int events)
+{
+    pImpl->setTransferTraceSize(events);
+}
+
+char *MegaApi::getTransferTrace()
+{
+    return pImpl->getTransferTrace();
+}
+
+char *MegaApi::getMemoryUsage()
+{
+    return pImpl->getMemoryUsage();
+}
+
+void MegaApi::setMemoryUsageLogInterval(int seconds)
+{
+    pImpl->setMemoryUsageLogInterval(seconds);
+}
+
+void MegaApi::setStallDetection(int thresholdMs, bool stackSamples)
+{
+    pImpl->setStallDetection(thresholdMs, stackSamples);
+}
+
 char *MegaApi::getAccountAuth()
 {
     return pImpl->getAccountAuth();
@@ -2379,6 +2442,11 @@ void MegaApi::loginToFolder(const char* megaFolderLink, MegaRequestListener *lis
     pImpl->loginToFolder(megaFolderLink, nullptr, listener);
 }
 
+void MegaApi::setFolderLinkBrowseOnly(bool enable)
+{
+    pImpl->setFolderLinkBrowseOnly(enable);
+}
+
 void MegaApi::importFileLink(const char* megaFileLink, MegaNode *parent, MegaRequestListener *listener)
 {
     pImpl->importFileLink(megaFileLink, parent, listener);
@@ -2439,6 +2507,21 @@ void MegaApi::cancelGetPreview(MegaNode* node, MegaRequestListener *listener)
 	pImpl->cancelGetPreview(node, listener);
 }
 
+void MegaApi::setFileAttributeCacheSize(long long bytes)
+{
+    pImpl->setFileAttributeCacheSize(bytes);
+}
+
+void MegaApi::prefetchThumbnails(MegaNodeList* nodes)
+{
+    pImpl->prefetchNodeAttributes(nodes, GfxProc::THUMBNAIL);
+}
+
+void MegaApi::prefetchPreviews(MegaNodeList* nodes)
+{
+    pImpl->prefetchNodeAttributes(nodes, GfxProc::PREVIEW);
+}
+
 void MegaApi::setPreview(MegaNode* node, const char *srcFilePath, MegaRequestListener *listener)
 {
     pImpl->setPreview(node, srcFilePath, listener);
@@ -3043,6 +3126,36 @@ bool MegaApi::setMaxUploadSpeed(long long bpslimit)
     return pImpl->setMaxUploadSpeed(bpslimit);
 }
 
+bool MegaApi::setTransferNetworkProfile(int socketBufferSize, int notSentLowat, const char* congestionControl, int receiveBufferSize)
+{
+    return pImpl->setTransferNetworkProfile(socketBufferSize, notSentLowat, congestionControl, receiveBufferSize);
+}
+
+void MegaApi::setAsyncTransferCallbacks(bool enable)
+{
+    pImpl->setAsyncTransferCallbacks(enable);
+}
+
+void MegaApi::setLightweightNodeUpdates(bool enable)
+{
+    pImpl->setLightweightNodeUpdates(enable);
+}
+
+void MegaApi::setSubtreeRemovalNotifications(bool enable)
+{
+    pImpl->setSubtreeRemovalNotifications(enable);
+}
+
+void MegaApi::setTransferUpdateInterval(int milliseconds)
+{
+    pImpl->setTransferUpdateInterval(milliseconds);
+}
+
+void MegaApi::setTransferUpdateBatching(int milliseconds)
+{
+    pImpl->setTransferUpdateBatching(milliseconds);
+}
+
 int MegaApi::getCurrentDownloadSpeed()
 {
     return pImpl->getCurrentDownloadSpeed();
@@ -3058,6 +3171,21 @@ int MegaApi::getCurrentSpeed(int type)
     return pImpl->getCurrentSpeed(type);
 }
 
+void MegaApi::setTransferConcurrency(int policy)
+{
+    pImpl->setTransferConcurrency(policy);
+}
+
+int MegaApi::getMaxConcurrentTransfers(int type)
+{
+    return pImpl->getMaxConcurrentTransfers(type);
+}
+
+void MegaApi::setMaxTransferBufferMemory(long long maxBytes)
+{
+    pImpl->setMaxTransferBufferMemory(maxBytes);
+}
+
 int MegaApi::getDownloadMethod()
 {
     return pImpl->getDownloadMethod();
@@ -3218,6 +3346,16 @@ void MegaApi::startDownloadWithTopPriority(MegaNode *node, const char *localPath
     pImpl->startDownload(true, node, localPath, 0, appData, listener);
 }
 
+void MegaApi::startUploads(MegaStringList *localPaths, MegaNode *parent, MegaTransferListener *listener)
+{
+    pImpl->startUploads(localPaths, parent, listener);
+}
+
+void MegaApi::startDownloads(MegaNodeList *nodes, const char *localPath, MegaTransferListener *listener)
+{
+    pImpl->startDownloads(nodes, localPath, listener);
+}
+
 void MegaApi::cancelTransfer(MegaTransfer *t, MegaRequestListener *listener)
 {
     pImpl->cancelTransfer(t, listener);
@@ -3298,6 +3436,11 @@ void MegaApi::setStreamingMinimumRate(int bytesPerSecond)
     pImpl->setStreamingMinimumRate(bytesPerSecond);
 }
 
+void MegaApi::setStreamingChunkSize(size_t bytes)
+{
+    pImpl->setStreamingChunkSize(bytes);
+}
+
 #ifdef ENABLE_SYNC
 
 //Move local files inside synced folders to the "Rubbish" folder.
@@ -3629,6 +3772,16 @@ MegaUserAlertList* MegaApi::getUserAlerts()
     return pImpl->getUserAlerts();
 }
 
+MegaUserAlertList* MegaApi::getUserAlertsAfter(unsigned id)
+{
+    return pImpl->getUserAlertsAfter(id);
+}
+
+void MegaApi::setMaxUserAlerts(unsigned max)
+{
+    pImpl->setMaxUserAlerts(max);
+}
+
 int MegaApi::getNumUnreadUserAlerts()
 {
     return pImpl->getNumUnreadUserAlerts();
@@ -3818,6 +3971,16 @@ void MegaApi::disableGfxFeatures(bool disable)
     pImpl->disableGfxFeatures(disable);
 }
 
+void MegaApi::setDatabaseTuning(int profile)
+{
+    pImpl->setDatabaseTuning(profile);
+}
+
+void MegaApi::setDatabaseBackend(int backend)
+{
+    pImpl->setDatabaseBackend(backend);
+}
+
 bool MegaApi::areGfxFeaturesDisabled()
 {
     return pImpl->areGfxFeaturesDisabled();
@@ -4149,6 +4312,11 @@ MegaNodeList *MegaApi::getChildren(MegaNode* p, int order)
     return pImpl->getChildren(p, order);
 }
 
+MegaNodeList *MegaApi::getChildren(MegaNode *parent, int order, int offset, int limit)
+{
+    return pImpl->getChildren(parent, order, offset, limit);
+}
+
 MegaNodeList *MegaApi::getVersions(MegaNode *node)
 {
     return pImpl->getVersions(node);
@@ -4209,6 +4377,11 @@ MegaNode* MegaApi::getNodeByHandle(uint64_t h)
     return pImpl->getNodeByHandle(h);
 }
 
+MegaNodeList* MegaApi::getNodesByHandles(MegaHandleList* handles)
+{
+    return pImpl->getNodesByHandles(handles);
+}
+
 MegaContactRequest *MegaApi::getContactRequestByHandle(MegaHandle handle)
 {
     return pImpl->getContactRequestByHandle(handle);
@@ -4451,6 +4624,16 @@ int MegaApi::httpServerGetMaxOutputSize()
     return pImpl->httpServerGetMaxOutputSize();
 }
 
+void MegaApi::httpServerSetLoopThreads(int threads)
+{
+    pImpl->httpServerSetLoopThreads(threads);
+}
+
+int MegaApi::httpServerGetLoopThreads()
+{
+    return pImpl->httpServerGetLoopThreads();
+}
+
 //FTP Server:
 bool MegaApi::ftpServerStart(bool localOnly, int port, int dataportBegin, int dataPortEnd, bool useTLS, const char * certificatepath, const char * keypath)
 {
@@ -5374,6 +5557,16 @@ bool MegaApi::createAvatar(const char *imagePath, const char *dstPath)
     return pImpl->createAvatar(imagePath, dstPath);
 }
 
+void MegaApi::setGfxMemoryBudget(long long bytes)
+{
+    pImpl->setGfxMemoryBudget(bytes);
+}
+
+void MegaApi::setPreviewQuality(int quality)
+{
+    pImpl->setPreviewQuality(quality);
+}
+
 void MegaApi::backgroundMediaUploadRequestUploadURL(int64_t fullFileSize, MegaBackgroundMediaUpload* state, MegaRequestListener *listener)
 {
     return pImpl->backgroundMediaUploadRequestUploadURL(fullFileSize, state, listener);
@@ -5680,6 +5873,10 @@ bool MegaGfxProcessor::getBitmapData(char* /*bitmapData*/, size_t /*size*/)
 void MegaGfxProcessor::freeBitmap() { }
 
 MegaGfxProcessor::~MegaGfxProcessor() { }
+
+MegaExecutorTask::~MegaExecutorTask() { }
+
+MegaExecutor::~MegaExecutor() { }
 MegaPricing::~MegaPricing() { }
 
 int MegaPricing::getNumProducts()
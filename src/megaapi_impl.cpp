@@ -40,6 +40,9 @@
 #include <cctype>
 #include <locale>
 #include <thread>
+#include <atomic>
+#include <queue>
+#include <random>
 
 #ifndef _WIN32
 #ifndef _LARGEFILE64_SOURCE
@@ -49,6 +52,14 @@
 #include <sys/resource.h>
 #endif
 
+#if defined(HAVE_LIBUV) && defined(__linux__)
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 
 #ifdef __APPLE__
     #include <xlocale.h>
@@ -89,177 +100,9 @@ std::vector<std::string> regExpToVector(mega::MegaRegExp* regExp)
 
 namespace mega {
 
-MegaNodePrivate::MegaNodePrivate(const char *name, int type, int64_t size, int64_t ctime, int64_t mtime, uint64_t nodehandle,
-                                 string *nodekey, string *attrstring, string *fileattrstring, const char *fingerprint, const char *originalFingerprint, MegaHandle owner, MegaHandle parentHandle,
-                                 const char *privateauth, const char *publicauth, bool ispublic, bool isForeign, const char *chatauth)
-: MegaNode()
+MegaNodeSnapshot::MegaNodeSnapshot(Node *node)
 {
-    this->name = MegaApi::strdup(name);
-    this->fingerprint = MegaApi::strdup(fingerprint);
-    this->originalfingerprint = MegaApi::strdup(originalFingerprint);
-    this->customAttrs = NULL;
-    this->duration = -1;
-    this->width = -1;
-    this->height = -1;
-    this->shortformat = -1;
-    this->videocodecid = -1;
-    this->latitude = INVALID_COORDINATE;
-    this->longitude = INVALID_COORDINATE;
-    this->type = type;
-    this->size = size;
-    this->ctime = ctime;
-    this->mtime = mtime;
-    this->nodehandle = nodehandle;
-    this->parenthandle = parentHandle;
-    this->attrstring.assign(attrstring->data(), attrstring->size());
-    this->fileattrstring.assign(fileattrstring->data(), fileattrstring->size());
-    this->nodekey.assign(nodekey->data(), nodekey->size());
-    this->changed = 0;
-    this->thumbnailAvailable = (Node::hasfileattribute(fileattrstring, GfxProc::THUMBNAIL) != 0);
-    this->previewAvailable = (Node::hasfileattribute(fileattrstring, GfxProc::PREVIEW) != 0);
-    this->tag = 0;
-    this->isPublicNode = ispublic;
-    this->outShares = false;
-    this->inShare = false;
-    this->plink = NULL;
-    this->mNewLinkFormat = false;
-    this->sharekey = NULL;
-    this->foreign = isForeign;
-    this->children = NULL;
-    this->owner = owner;
-    this->mFavourite = false;
-    this->mLabel = LBL_UNKNOWN;
-
-    if (privateauth)
-    {
-        this->privateAuth = privateauth;
-    }
-
-    if (publicauth)
-    {
-        this->publicAuth = publicauth;
-    }
-
-    this->chatAuth = chatauth ? MegaApi::strdup(chatauth) : NULL;
-
-#ifdef ENABLE_SYNC
-    this->syncdeleted = false;
-#endif
-}
-
-MegaNodePrivate::MegaNodePrivate(MegaNode *node)
-: MegaNode()
-{
-    this->name = MegaApi::strdup(node->getName());
-    this->fingerprint = MegaApi::strdup(node->getFingerprint());
-    this->originalfingerprint = MegaApi::strdup(node->getOriginalFingerprint());
-    this->customAttrs = NULL;
-
-    MegaNodePrivate *np = dynamic_cast<MegaNodePrivate *>(node);
-    if (np)
-    {
-        this->duration = np->duration;
-        this->width = np->width;
-        this->height = np->height;
-        this->shortformat = np->shortformat;
-        this->videocodecid = np->videocodecid;
-        this->mFavourite = np->mFavourite;
-        this->mLabel = np->mLabel;
-    }
-    else
-    {
-        this->duration = node->getDuration();
-        this->width = node->getWidth();
-        this->height = node->getHeight();
-        this->shortformat = node->getShortformat();
-        this->videocodecid = node->getVideocodecid();
-        this->mFavourite = node->isFavourite();
-        this->mLabel = static_cast<nodelabel_t>(node->getLabel());
-    }
-
-    this->latitude = node->getLatitude();
-    this->longitude = node->getLongitude();
-    this->restorehandle = node->getRestoreHandle();
-    this->type = node->getType();
-    this->size = node->getSize();
-    this->ctime = node->getCreationTime();
-    this->mtime = node->getModificationTime();
-    this->nodehandle = node->getHandle();
-    this->parenthandle = node->getParentHandle();
-    string * attrstring = node->getAttrString();
-    this->attrstring.assign(attrstring->data(), attrstring->size());
-    char* fileAttributeString = node->getFileAttrString();
-    if (fileAttributeString)
-    {
-        this->fileattrstring = std::string(fileAttributeString);
-        delete [] fileAttributeString;
-    }
-    string *nodekey = node->getNodeKey();
-    this->nodekey.assign(nodekey->data(),nodekey->size());
-    this->changed = node->getChanges();
-    this->thumbnailAvailable = node->hasThumbnail();
-    this->previewAvailable = node->hasPreview();
-    this->tag = node->getTag();
-    this->isPublicNode = node->isPublic();
-    this->privateAuth = *node->getPrivateAuth();
-    this->publicAuth = *node->getPublicAuth();
-    this->chatAuth = node->getChatAuth() ? MegaApi::strdup(node->getChatAuth()) : NULL;
-    this->outShares = node->isOutShare();
-    this->inShare = node->isInShare();
-    this->foreign = node->isForeign();
-    this->sharekey = NULL;
-    this->children = NULL;
-    this->owner = node->getOwner();
-
-    if (node->isExported())
-    {
-        this->plink = new PublicLink(node->getPublicHandle(), node->getPublicLinkCreationTime(),
-                                     node->getExpirationTime(), node->isTakenDown(), node->getWritableLinkAuthKey());
-
-        if (type == FOLDERNODE)
-        {
-            MegaNodePrivate *n = dynamic_cast<MegaNodePrivate *>(node);
-            if (n)
-            {
-                string *sk = n->getSharekey();
-                if (sk)
-                {
-                    this->sharekey = new string(*sk);
-                }
-            }
-        }
-    }
-    else
-    {
-        this->plink = NULL;
-    }
-    this->mNewLinkFormat = np->isNewLinkFormat();
-
-    if (node->hasCustomAttrs())
-    {
-        this->customAttrs = new attr_map();
-        MegaStringList *names = node->getCustomAttrNames();
-        for (int i = 0; i < names->size(); i++)
-        {
-            (*customAttrs)[AttrMap::string2nameid(names->get(i))] = node->getCustomAttr(names->get(i));
-        }
-        delete names;
-    }
-
-#ifdef ENABLE_SYNC
-    this->syncdeleted = node->isSyncDeleted();
-    this->localPath = node->getLocalPath();
-#endif
-}
-
-MegaNodePrivate::MegaNodePrivate(Node *node)
-: MegaNode()
-{
-    this->name = MegaApi::strdup(node->displayname());
-    this->fingerprint = NULL;
-    this->originalfingerprint = NULL;
-    this->children = NULL;
-    this->chatAuth = NULL;
+    name = MegaApi::strdup(node->displayname());
 
     if (node->isvalid)
     {
@@ -278,18 +121,6 @@ MegaNodePrivate::MegaNodePrivate(Node *node)
         this->fingerprint = MegaApi::strdup(result.c_str());
     }
 
-    this->duration = -1;
-    this->width = -1;
-    this->height = -1;
-    this->shortformat = -1;
-    this->videocodecid = -1;
-    this->latitude = INVALID_COORDINATE;
-    this->longitude = INVALID_COORDINATE;
-    this->customAttrs = NULL;
-    this->restorehandle = UNDEF;
-    this->mFavourite = false;
-    this->mLabel = LBL_UNKNOWN;
-
     char buf[10];
     for (attr_map::iterator it = node->attrs.map.begin(); it != node->attrs.map.end(); it++)
     {
@@ -299,7 +130,7 @@ MegaNodePrivate::MegaNodePrivate(Node *node)
         {
            if (!customAttrs)
            {
-               customAttrs = new attr_map();
+               customAttrs.reset(new attr_map());
            }
 
            nameid id = AttrMap::string2nameid(&buf[1]);
@@ -369,16 +200,16 @@ MegaNodePrivate::MegaNodePrivate(Node *node)
 
                     if (longitude < -180 || longitude > 180)
                     {
-                        longitude = INVALID_COORDINATE;
+                        longitude = MegaNode::INVALID_COORDINATE;
                     }
                     if (latitude < -90 || latitude > 90)
                     {
-                        latitude = INVALID_COORDINATE;
+                        latitude = MegaNode::INVALID_COORDINATE;
                     }
-                    if (longitude == INVALID_COORDINATE || latitude == INVALID_COORDINATE)
+                    if (longitude == MegaNode::INVALID_COORDINATE || latitude == MegaNode::INVALID_COORDINATE)
                     {
-                        longitude = INVALID_COORDINATE;
-                        latitude = INVALID_COORDINATE;
+                        longitude = MegaNode::INVALID_COORDINATE;
+                        latitude = MegaNode::INVALID_COORDINATE;
                     }
                }
             }
@@ -407,7 +238,7 @@ MegaNodePrivate::MegaNodePrivate(Node *node)
                 }
                 else
                 {
-                    mFavourite = fav;
+                    favourite = fav;
                 }
             }
             else if (it->first == AttrMap::string2nameid("lbl"))
@@ -419,76 +250,243 @@ MegaNodePrivate::MegaNodePrivate(Node *node)
                 }
                 else
                 {
-                    mLabel = static_cast<nodelabel_t>(lbl);
+                    label = static_cast<nodelabel_t>(lbl);
                 }
             }
             else if (it->first == AttrMap::string2nameid("dev-id"))
             {
-                mDeviceId = it->second;
+                deviceId = it->second;
             }
         }
     }
 
-    this->type = node->type;
-    this->size = node->size;
-    this->ctime = node->ctime;
-    this->mtime = node->mtime;
-    this->nodehandle = node->nodehandle;
-    this->parenthandle = node->parent ? node->parent->nodehandle : INVALID_HANDLE;
-    this->owner = node->owner;
-
-    if(node->attrstring)
+    if (node->attrstring)
     {
-        this->attrstring.assign(node->attrstring->data(), node->attrstring->size());
+        attrstring.assign(node->attrstring->data(), node->attrstring->size());
     }
-    this->fileattrstring = node->fileattrstring;
-    this->nodekey = node->nodekeyUnchecked();
+    fileattrstring = node->fileattrstring;
+    nodekey = node->nodekeyUnchecked();
+}
 
-    this->changed = 0;
-    if(node->changed.attrs)
-    {
-        this->changed |= MegaNode::CHANGE_TYPE_ATTRIBUTES;
-    }
-    if(node->changed.ctime)
-    {
-        this->changed |= MegaNode::CHANGE_TYPE_TIMESTAMP;
-    }
-    if(node->changed.fileattrstring)
-    {
-        this->changed |= MegaNode::CHANGE_TYPE_FILE_ATTRIBUTES;
-    }
-    if(node->changed.inshare)
-    {
-        this->changed |= MegaNode::CHANGE_TYPE_INSHARE;
-    }
-    if(node->changed.outshares)
+MegaNodeSnapshot::MegaNodeSnapshot(const MegaNodeSnapshot& other)
+    : name(MegaApi::strdup(other.name))
+    , fingerprint(MegaApi::strdup(other.fingerprint))
+    , originalfingerprint(MegaApi::strdup(other.originalfingerprint))
+    , customAttrs(other.customAttrs ? new attr_map(*other.customAttrs) : nullptr)
+    , nodekey(other.nodekey)
+    , attrstring(other.attrstring)
+    , fileattrstring(other.fileattrstring)
+    , deviceId(other.deviceId)
+    , duration(other.duration)
+    , latitude(other.latitude)
+    , longitude(other.longitude)
+    , restorehandle(other.restorehandle)
+    , favourite(other.favourite)
+    , label(other.label)
+{
+}
+
+MegaNodeSnapshot::~MegaNodeSnapshot()
+{
+    delete [] name;
+    delete [] fingerprint;
+    delete [] originalfingerprint;
+}
+
+std::shared_ptr<const MegaNodeSnapshot> MegaNodeSnapshot::of(Node *node)
+{
+    // getters holding sdkMutex in shared mode may get here concurrently for the same node
+    std::shared_ptr<const MegaNodeSnapshot> snapshot = std::atomic_load(&node->apisnapshot);
+    if (!snapshot)
     {
-        this->changed |= MegaNode::CHANGE_TYPE_OUTSHARE;
+        snapshot = std::make_shared<const MegaNodeSnapshot>(node);
+        std::atomic_store(&node->apisnapshot, snapshot);
     }
-    if(node->changed.pendingshares)
+    return snapshot;
+}
+
+MegaNodePrivate::MegaNodePrivate(const char *name, int type, int64_t size, int64_t ctime, int64_t mtime, uint64_t nodehandle,
+                                 const string *nodekey, const string *attrstring, const string *fileattrstring, const char *fingerprint, const char *originalFingerprint, MegaHandle owner, MegaHandle parentHandle,
+                                 const char *privateauth, const char *publicauth, bool ispublic, bool isForeign, const char *chatauth)
+: MegaNode()
+{
+    auto snapshot = std::make_shared<MegaNodeSnapshot>();
+    snapshot->name = MegaApi::strdup(name);
+    snapshot->fingerprint = MegaApi::strdup(fingerprint);
+    snapshot->originalfingerprint = MegaApi::strdup(originalFingerprint);
+    snapshot->attrstring.assign(attrstring->data(), attrstring->size());
+    snapshot->fileattrstring.assign(fileattrstring->data(), fileattrstring->size());
+    snapshot->nodekey.assign(nodekey->data(), nodekey->size());
+    this->mSnapshot = std::move(snapshot);
+
+    this->width = -1;
+    this->height = -1;
+    this->shortformat = -1;
+    this->videocodecid = -1;
+    this->type = type;
+    this->size = size;
+    this->ctime = ctime;
+    this->mtime = mtime;
+    this->nodehandle = nodehandle;
+    this->parenthandle = parentHandle;
+    this->changed = 0;
+    this->thumbnailAvailable = (Node::hasfileattribute(fileattrstring, GfxProc::THUMBNAIL) != 0);
+    this->previewAvailable = (Node::hasfileattribute(fileattrstring, GfxProc::PREVIEW) != 0);
+    this->tag = 0;
+    this->isPublicNode = ispublic;
+    this->outShares = false;
+    this->inShare = false;
+    this->plink = NULL;
+    this->mNewLinkFormat = false;
+    this->sharekey = NULL;
+    this->foreign = isForeign;
+    this->children = NULL;
+    this->owner = owner;
+
+    if (privateauth)
     {
-        this->changed |= MegaNode::CHANGE_TYPE_PENDINGSHARE;
+        this->privateAuth = privateauth;
     }
-    if(node->changed.owner)
+
+    if (publicauth)
     {
-        this->changed |= MegaNode::CHANGE_TYPE_OWNER;
+        this->publicAuth = publicauth;
     }
-    if(node->changed.parent)
+
+    this->chatAuth = chatauth ? MegaApi::strdup(chatauth) : NULL;
+
+#ifdef ENABLE_SYNC
+    this->syncdeleted = false;
+#endif
+}
+
+MegaNodePrivate::MegaNodePrivate(MegaNode *node)
+: MegaNode()
+{
+    MegaNodePrivate *np = dynamic_cast<MegaNodePrivate *>(node);
+    if (np)
     {
-        this->changed |= MegaNode::CHANGE_TYPE_PARENT;
+        // the snapshot is immutable, so copies share it
+        this->mSnapshot = np->mSnapshot;
+        this->width = np->width;
+        this->height = np->height;
+        this->shortformat = np->shortformat;
+        this->videocodecid = np->videocodecid;
     }
-    if(node->changed.removed)
+    else
     {
-        this->changed |= MegaNode::CHANGE_TYPE_REMOVED;
+        auto snapshot = std::make_shared<MegaNodeSnapshot>();
+        snapshot->name = MegaApi::strdup(node->getName());
+        snapshot->fingerprint = MegaApi::strdup(node->getFingerprint());
+        snapshot->originalfingerprint = MegaApi::strdup(node->getOriginalFingerprint());
+        snapshot->duration = node->getDuration();
+        snapshot->favourite = node->isFavourite();
+        snapshot->label = static_cast<nodelabel_t>(node->getLabel());
+        snapshot->latitude = node->getLatitude();
+        snapshot->longitude = node->getLongitude();
+        snapshot->restorehandle = node->getRestoreHandle();
+        snapshot->deviceId = node->getDeviceId();
+
+        string * attrstring = node->getAttrString();
+        snapshot->attrstring.assign(attrstring->data(), attrstring->size());
+        char* fileAttributeString = node->getFileAttrString();
+        if (fileAttributeString)
+        {
+            snapshot->fileattrstring = std::string(fileAttributeString);
+            delete [] fileAttributeString;
+        }
+        string *nodekey = node->getNodeKey();
+        snapshot->nodekey.assign(nodekey->data(),nodekey->size());
+
+        if (node->hasCustomAttrs())
+        {
+            snapshot->customAttrs.reset(new attr_map());
+            MegaStringList *names = node->getCustomAttrNames();
+            for (int i = 0; i < names->size(); i++)
+            {
+                (*snapshot->customAttrs)[AttrMap::string2nameid(names->get(i))] = node->getCustomAttr(names->get(i));
+            }
+            delete names;
+        }
+        this->mSnapshot = std::move(snapshot);
+
+        this->width = node->getWidth();
+        this->height = node->getHeight();
+        this->shortformat = node->getShortformat();
+        this->videocodecid = node->getVideocodecid();
     }
-    if(node->changed.publiclink)
+
+    this->type = node->getType();
+    this->size = node->getSize();
+    this->ctime = node->getCreationTime();
+    this->mtime = node->getModificationTime();
+    this->nodehandle = node->getHandle();
+    this->parenthandle = node->getParentHandle();
+    this->changed = node->getChanges();
+    this->thumbnailAvailable = node->hasThumbnail();
+    this->previewAvailable = node->hasPreview();
+    this->tag = node->getTag();
+    this->isPublicNode = node->isPublic();
+    this->privateAuth = *node->getPrivateAuth();
+    this->publicAuth = *node->getPublicAuth();
+    this->chatAuth = node->getChatAuth() ? MegaApi::strdup(node->getChatAuth()) : NULL;
+    this->outShares = node->isOutShare();
+    this->inShare = node->isInShare();
+    this->foreign = node->isForeign();
+    this->sharekey = NULL;
+    this->children = NULL;
+    this->owner = node->getOwner();
+
+    if (node->isExported())
     {
-        this->changed |= MegaNode::CHANGE_TYPE_PUBLIC_LINK;
+        this->plink = new PublicLink(node->getPublicHandle(), node->getPublicLinkCreationTime(),
+                                     node->getExpirationTime(), node->isTakenDown(), node->getWritableLinkAuthKey());
+
+        if (type == FOLDERNODE)
+        {
+            MegaNodePrivate *n = dynamic_cast<MegaNodePrivate *>(node);
+            if (n)
+            {
+                string *sk = n->getSharekey();
+                if (sk)
+                {
+                    this->sharekey = new string(*sk);
+                }
+            }
+        }
     }
-    if(node->changed.newnode)
+    else
     {
-        this->changed |= MegaNode::CHANGE_TYPE_NEW;
+        this->plink = NULL;
     }
+    this->mNewLinkFormat = np->isNewLinkFormat();
+
+#ifdef ENABLE_SYNC
+    this->syncdeleted = node->isSyncDeleted();
+    this->localPath = node->getLocalPath();
+#endif
+}
+
+MegaNodePrivate::MegaNodePrivate(Node *node)
+: MegaNode()
+{
+    this->mSnapshot = MegaNodeSnapshot::of(node);
+    this->children = NULL;
+    this->chatAuth = NULL;
+    this->width = -1;
+    this->height = -1;
+    this->shortformat = -1;
+    this->videocodecid = -1;
+
+    this->type = node->type;
+    this->size = node->size;
+    this->ctime = node->ctime;
+    this->mtime = node->mtime;
+    this->nodehandle = node->nodehandle;
+    this->parenthandle = node->parent ? node->parent->nodehandle : INVALID_HANDLE;
+    this->owner = node->owner;
+
+    this->changed = changesOf(node);
 
 
 #ifdef ENABLE_SYNC
@@ -550,15 +548,15 @@ char *MegaNodePrivate::serialize()
 bool MegaNodePrivate::serialize(string *d)
 {
     CacheableWriter w(*d);
-    w.serializecstr(name, true);
-    w.serializecstr(fingerprint, true);
+    w.serializecstr(mSnapshot->name, true);
+    w.serializecstr(mSnapshot->fingerprint, true);
     w.serializei64(size);
     w.serializei64(ctime);
     w.serializei64(mtime);
     w.serializehandle(nodehandle);
     w.serializehandle(parenthandle);
-    w.serializestring(attrstring);
-    w.serializestring(nodekey);
+    w.serializestring(mSnapshot->attrstring);
+    w.serializestring(mSnapshot->nodekey);
     w.serializestring(privateAuth);
     w.serializestring(publicAuth);
     w.serializebool(isPublicNode);
@@ -567,7 +565,7 @@ bool MegaNodePrivate::serialize(string *d)
     bool hasChatAuth = chatAuth && chatAuth[0];
     bool hasOwner = true;
 
-    bool hasOriginalFingerprint = originalfingerprint && originalfingerprint[0];
+    bool hasOriginalFingerprint = mSnapshot->originalfingerprint && mSnapshot->originalfingerprint[0];
 
     w.serializeexpansionflags(hasChatAuth, hasOwner, hasOriginalFingerprint);
 
@@ -581,7 +579,7 @@ bool MegaNodePrivate::serialize(string *d)
     }
     if (hasOriginalFingerprint)
     {
-        w.serializecstr(originalfingerprint, false);
+        w.serializecstr(mSnapshot->originalfingerprint, false);
     }
 
     return true;
@@ -643,7 +641,7 @@ const char* MegaNodePrivate::getName()
 {
     if(type <= FOLDERNODE)
     {
-        return name;
+        return mSnapshot->name;
     }
 
     switch(type)
@@ -655,34 +653,34 @@ const char* MegaNodePrivate::getName()
         case RUBBISHNODE:
             return "Rubbish Bin";
         default:
-            return name;
+            return mSnapshot->name;
     }
 }
 
 const char *MegaNodePrivate::getFingerprint()
 {
-    return fingerprint;
+    return mSnapshot->fingerprint;
 }
 
 const char *MegaNodePrivate::getOriginalFingerprint()
 {
-    return originalfingerprint;
+    return mSnapshot->originalfingerprint;
 }
 
 bool MegaNodePrivate::hasCustomAttrs()
 {
-    return customAttrs != NULL;
+    return mSnapshot->customAttrs != NULL;
 }
 
 MegaStringList *MegaNodePrivate::getCustomAttrNames()
 {
-    if (!customAttrs)
+    if (!mSnapshot->customAttrs)
     {
         return new MegaStringList();
     }
 
     string_vector names;
-    for (attr_map::iterator it = customAttrs->begin(); it != customAttrs->end(); it++)
+    for (attr_map::iterator it = mSnapshot->customAttrs->begin(); it != mSnapshot->customAttrs->end(); it++)
     {
         names.push_back(AttrMap::nameid2string(it->first));
     }
@@ -691,7 +689,7 @@ MegaStringList *MegaNodePrivate::getCustomAttrNames()
 
 const char *MegaNodePrivate::getCustomAttr(const char *attrName)
 {
-    if (!customAttrs)
+    if (!mSnapshot->customAttrs)
     {
         return NULL;
     }
@@ -702,8 +700,8 @@ const char *MegaNodePrivate::getCustomAttr(const char *attrName)
         return NULL;
     }
 
-    attr_map::iterator it = customAttrs->find(n);
-    if (it == customAttrs->end())
+    attr_map::iterator it = mSnapshot->customAttrs->find(n);
+    if (it == mSnapshot->customAttrs->end())
     {
         return NULL;
     }
@@ -713,10 +711,10 @@ const char *MegaNodePrivate::getCustomAttr(const char *attrName)
 
 int MegaNodePrivate::getDuration()
 {
-    if (type == MegaNode::TYPE_FILE && nodekey.size() == FILENODEKEYLENGTH && fileattrstring.size())
+    if (type == MegaNode::TYPE_FILE && mSnapshot->nodekey.size() == FILENODEKEYLENGTH && mSnapshot->fileattrstring.size())
     {
-        uint32_t* attrKey = (uint32_t*)(nodekey.data() + FILENODEKEYLENGTH / 2);
-        MediaProperties mediaProperties = MediaProperties::decodeMediaPropertiesAttributes(fileattrstring, attrKey);
+        uint32_t* attrKey = (uint32_t*)(mSnapshot->nodekey.data() + FILENODEKEYLENGTH / 2);
+        MediaProperties mediaProperties = MediaProperties::decodeMediaPropertiesAttributes(mSnapshot->fileattrstring, attrKey);
         if (mediaProperties.shortformat != 255 // 255 = MediaInfo failed processing the file
                 && mediaProperties.shortformat != 254 // 254 = No information available
                 && mediaProperties.playtime > 0)
@@ -725,27 +723,27 @@ int MegaNodePrivate::getDuration()
         }
     }
 
-    return duration;
+    return mSnapshot->duration;
 }
 
 bool MegaNodePrivate::isFavourite()
 {
-    return mFavourite;
+    return mSnapshot->favourite;
 }
 
 int MegaNodePrivate::getLabel()
 {
-    return mLabel;
+    return mSnapshot->label;
 }
 
 int MegaNodePrivate::getWidth()
 {
     if (width == -1)    // not initialized yet, or not available
     {
-        if (type == MegaNode::TYPE_FILE && nodekey.size() == FILENODEKEYLENGTH && fileattrstring.size())
+        if (type == MegaNode::TYPE_FILE && mSnapshot->nodekey.size() == FILENODEKEYLENGTH && mSnapshot->fileattrstring.size())
         {
-            uint32_t* attrKey = (uint32_t*)(nodekey.data() + FILENODEKEYLENGTH / 2);
-            MediaProperties mediaProperties = MediaProperties::decodeMediaPropertiesAttributes(fileattrstring, attrKey);
+            uint32_t* attrKey = (uint32_t*)(mSnapshot->nodekey.data() + FILENODEKEYLENGTH / 2);
+            MediaProperties mediaProperties = MediaProperties::decodeMediaPropertiesAttributes(mSnapshot->fileattrstring, attrKey);
             if (mediaProperties.shortformat != 255 // 255 = MediaInfo failed processing the file
                     && mediaProperties.shortformat != 254 // 254 = No information available
                     && mediaProperties.width > 0)
@@ -762,10 +760,10 @@ int MegaNodePrivate::getHeight()
 {
     if (height == -1)    // not initialized yet, or not available
     {
-        if (type == MegaNode::TYPE_FILE && nodekey.size() == FILENODEKEYLENGTH && fileattrstring.size())
+        if (type == MegaNode::TYPE_FILE && mSnapshot->nodekey.size() == FILENODEKEYLENGTH && mSnapshot->fileattrstring.size())
         {
-            uint32_t* attrKey = (uint32_t*)(nodekey.data() + FILENODEKEYLENGTH / 2);
-            MediaProperties mediaProperties = MediaProperties::decodeMediaPropertiesAttributes(fileattrstring, attrKey);
+            uint32_t* attrKey = (uint32_t*)(mSnapshot->nodekey.data() + FILENODEKEYLENGTH / 2);
+            MediaProperties mediaProperties = MediaProperties::decodeMediaPropertiesAttributes(mSnapshot->fileattrstring, attrKey);
             if (mediaProperties.shortformat != 255 // 255 = MediaInfo failed processing the file
                     && mediaProperties.shortformat != 254 // 254 = No information available
                     && mediaProperties.height > 0)
@@ -782,10 +780,10 @@ int MegaNodePrivate::getShortformat()
 {
     if (shortformat == -1)    // not initialized yet, or not available
     {
-        if (type == MegaNode::TYPE_FILE && nodekey.size() == FILENODEKEYLENGTH && fileattrstring.size())
+        if (type == MegaNode::TYPE_FILE && mSnapshot->nodekey.size() == FILENODEKEYLENGTH && mSnapshot->fileattrstring.size())
         {
-            uint32_t* attrKey = (uint32_t*)(nodekey.data() + FILENODEKEYLENGTH / 2);
-            MediaProperties mediaProperties = MediaProperties::decodeMediaPropertiesAttributes(fileattrstring, attrKey);
+            uint32_t* attrKey = (uint32_t*)(mSnapshot->nodekey.data() + FILENODEKEYLENGTH / 2);
+            MediaProperties mediaProperties = MediaProperties::decodeMediaPropertiesAttributes(mSnapshot->fileattrstring, attrKey);
             if (mediaProperties.shortformat != 255 // 255 = MediaInfo failed processing the file
                 && mediaProperties.shortformat != 254 // 254 = No information available
                 && mediaProperties.shortformat > 0)
@@ -802,10 +800,10 @@ int MegaNodePrivate::getVideocodecid()
 {
     if (videocodecid == -1)    // not initialized yet, or not available
     {
-        if (type == MegaNode::TYPE_FILE && nodekey.size() == FILENODEKEYLENGTH && fileattrstring.size())
+        if (type == MegaNode::TYPE_FILE && mSnapshot->nodekey.size() == FILENODEKEYLENGTH && mSnapshot->fileattrstring.size())
         {
-            uint32_t* attrKey = (uint32_t*)(nodekey.data() + FILENODEKEYLENGTH / 2);
-            MediaProperties mediaProperties = MediaProperties::decodeMediaPropertiesAttributes(fileattrstring, attrKey);
+            uint32_t* attrKey = (uint32_t*)(mSnapshot->nodekey.data() + FILENODEKEYLENGTH / 2);
+            MediaProperties mediaProperties = MediaProperties::decodeMediaPropertiesAttributes(mSnapshot->fileattrstring, attrKey);
             if (mediaProperties.shortformat != 255 // 255 = MediaInfo failed processing the file
                 && mediaProperties.shortformat != 254 // 254 = No information available
                 && mediaProperties.videocodecid > 0)
@@ -820,12 +818,12 @@ int MegaNodePrivate::getVideocodecid()
 
 double MegaNodePrivate::getLatitude()
 {
-    return latitude;
+    return mSnapshot->latitude;
 }
 
 double MegaNodePrivate::getLongitude()
 {
-    return longitude;
+    return mSnapshot->longitude;
 }
 
 int64_t MegaNodePrivate::getSize()
@@ -845,7 +843,7 @@ int64_t MegaNodePrivate::getModificationTime()
 
 MegaHandle MegaNodePrivate::getRestoreHandle()
 {
-    return restorehandle;
+    return mSnapshot->restorehandle;
 }
 
 MegaHandle MegaNodePrivate::getParentHandle()
@@ -860,7 +858,8 @@ uint64_t MegaNodePrivate::getHandle()
 
 string *MegaNodePrivate::getNodeKey()
 {
-    return &nodekey;
+    // the snapshot may be shared with other MegaNodes: callers must not modify it
+    return const_cast<string*>(&mSnapshot->nodekey);
 }
 
 char *MegaNodePrivate::getBase64Key()
@@ -868,10 +867,10 @@ char *MegaNodePrivate::getBase64Key()
     char *key = NULL;
 
     // the key
-    if (type == FILENODE && nodekey.size() >= FILENODEKEYLENGTH)
+    if (type == FILENODE && mSnapshot->nodekey.size() >= FILENODEKEYLENGTH)
     {
         key = new char[FILENODEKEYLENGTH * 4 / 3 + 3];
-        Base64::btoa((const byte*)nodekey.data(), FILENODEKEYLENGTH, key);
+        Base64::btoa((const byte*)mSnapshot->nodekey.data(), FILENODEKEYLENGTH, key);
     }
     else if (type == FOLDERNODE && sharekey)
     {
@@ -888,16 +887,16 @@ char *MegaNodePrivate::getBase64Key()
 
 string *MegaNodePrivate::getAttrString()
 {
-    return &attrstring;
+    return const_cast<string*>(&mSnapshot->attrstring);
 }
 
 char *MegaNodePrivate::getFileAttrString()
 {
     char* fileAttributes = NULL;
 
-    if (fileattrstring.size() > 0)
+    if (mSnapshot->fileattrstring.size() > 0)
     {
-        fileAttributes = MegaApi::strdup(fileattrstring.c_str());
+        fileAttributes = MegaApi::strdup(mSnapshot->fileattrstring.c_str());
     }
 
     return fileAttributes;
@@ -929,8 +928,8 @@ MegaNode* MegaNodePrivate::getPublicNode()
     string key(skey);
 
     MegaNode *node = new MegaNodePrivate(
-                name, type, size, ctime, mtime,
-                plink->ph, &key, &attrstring, &fileattrstring, fingerprint, originalfingerprint,
+                mSnapshot->name, type, size, ctime, mtime,
+                plink->ph, &key, &mSnapshot->attrstring, &mSnapshot->fileattrstring, mSnapshot->fingerprint, mSnapshot->originalfingerprint,
                 INVALID_HANDLE);
 
     delete [] skey;
@@ -999,7 +998,7 @@ MegaHandle MegaNodePrivate::getOwner() const
 
 const char* MegaNodePrivate::getDeviceId() const
 {
-    return mDeviceId.c_str();
+    return mSnapshot->deviceId.c_str();
 }
 
 MegaBackgroundMediaUploadPrivate::MegaBackgroundMediaUploadPrivate(MegaApi* capi)
@@ -1159,7 +1158,7 @@ char *MegaBackgroundMediaUploadPrivate::encryptFile(const char* inputFilepath, i
 
                     EncryptFilePieceByChunks ef(fain.get(), startPos, faout.get(), 0, &cipher, &chunkmacs, ctriv);
                     string urlSuffix;
-                    if (ef.encrypt(startPos, endPos, urlSuffix))
+                    if (ef.encrypt(api->client->mAsyncQueue, startPos, endPos, urlSuffix))
                     {
                         ((int64_t*)filekey)[3] = chunkmacs.macsmac(&cipher);
                         return MegaApi::strdup(urlSuffix.c_str());
@@ -1208,6 +1207,82 @@ byte *EncryptFilePieceByChunks::nextbuffer(unsigned bufsize)
     return (byte*)buffer.data();
 }
 
+bool EncryptFilePieceByChunks::encrypt(MegaClientAsyncQueue& queue, m_off_t pos, m_off_t npos, string& urlSuffix)
+{
+    vector<m_off_t> starts;
+    for (m_off_t p = pos; p < npos; p = ChunkedHash::chunkceil(p, npos))
+    {
+        starts.push_back(p);
+    }
+
+    if (starts.size() < 2)
+    {
+        return encrypt(pos, npos, urlSuffix);
+    }
+    starts.push_back(npos);
+
+    // windows of whole chunks, as indexes into starts
+    vector<size_t> windows(1, 0);
+    for (size_t i = 1; i < starts.size(); i++)
+    {
+        if (i == starts.size() - 1 || starts[i + 1] - starts[windows.back()] > WINDOWSIZE)
+        {
+            windows.push_back(i);
+        }
+    }
+
+    string buffers[2];
+    auto readwindow = [&](size_t w, string& b)
+    {
+        m_off_t start = starts[windows[w]];
+        unsigned size = unsigned(starts[windows[w + 1]] - start);
+
+        // only the last chunk of the file can end off a block boundary, and its padding is in the buffer
+        b.resize(size + SymmCipher::BLOCKSIZE);
+        memset((void*)(b.data() + size), 0, SymmCipher::BLOCKSIZE);
+        return fain->frawread((byte*)b.data(), size, inpos + (start - pos));
+    };
+    auto writewindow = [&](size_t w, const string& b)
+    {
+        m_off_t start = starts[windows[w]];
+        return faout->fwrite((const byte*)b.data(), unsigned(starts[windows[w + 1]] - start), outpos + (start - pos));
+    };
+
+    size_t count = windows.size() - 1;
+    if (!readwindow(0, buffers[0]))
+    {
+        return false;
+    }
+
+    for (size_t w = 0; w < count; w++)
+    {
+        string& current = buffers[w & 1];
+        string& other = buffers[(w + 1) & 1];
+        bool ok = true;
+
+        vector<m_off_t> chunks(starts.begin() + windows[w], starts.begin() + windows[w + 1] + 1);
+        encryptchunks(queue, (byte*)current.data(), chunks.front(), chunks, pos, [&]()
+        {
+            ok = (!w || writewindow(w - 1, other)) && (w + 1 == count || readwindow(w + 1, other));
+        });
+
+        if (!ok)
+        {
+            return false;
+        }
+    }
+
+    if (!writewindow(count - 1, buffers[(count - 1) & 1]))
+    {
+        return false;
+    }
+
+    ostringstream s;
+    s << "/" << pos << "?c=" << Base64Str<EncryptByChunks::CRCSIZE>(crc);
+    urlSuffix = s.str();
+    return true;
+}
+
 #ifdef ENABLE_SYNC
 bool MegaNodePrivate::isSyncDeleted()
 {
@@ -1273,6 +1348,11 @@ bool MegaApiImpl::is_syncable(Sync *sync, const char *name, const LocalPath& loc
         return false;
     }
 
+    if (excludedLiteralNames.count(name))
+    {
+        return false;
+    }
+
     for (unsigned int i = 0; i < excludedNames.size(); i++)
     {
         if (WildcardMatch(name, excludedNames[i].c_str()))
@@ -1283,12 +1363,22 @@ bool MegaApiImpl::is_syncable(Sync *sync, const char *name, const LocalPath& loc
 
     MegaRegExp *regExp = NULL;
 #ifdef USE_PCRE
-    auto re = make_unique<MegaRegExp>(); // TODO: reconstructing this is far from optimal. reconsider placing it in SyncConfig (updated with mRegExps updates?)
-    for (const auto& v : sync->getConfig().getRegExps())
+    std::unique_lock<std::mutex> regExpsGuard(mSyncRegExpsMutex);
+    const auto& source = sync->getConfig().getRegExps();
+    if (!source.empty())
     {
-        re->addRegExp(v.c_str());
+        SyncRegExps& re = mSyncRegExps[sync->getConfig().getBackupId()];
+        if (!re.compiled || re.source != source)
+        {
+            re.source = source;
+            re.compiled = make_unique<MegaRegExp>();
+            for (const auto& v : source)
+            {
+                re.compiled->addRegExp(v.c_str());
+            }
+        }
+        regExp = re.compiled.get();
     }
-    regExp = re.get();
 #endif
 
     if (regExp || excludedPaths.size())
@@ -1762,10 +1852,11 @@ void MegaNodePrivate::setChildren(MegaNodeList *children)
 
 void MegaNodePrivate::setName(const char *newName)
 {
-    if (name)
-        delete [] name;
-
-    name = MegaApi::strdup(newName);
+    // copy on write: other MegaNodes may share the snapshot
+    auto snapshot = std::make_shared<MegaNodeSnapshot>(*mSnapshot);
+    delete [] snapshot->name;
+    snapshot->name = MegaApi::strdup(newName);
+    mSnapshot = std::move(snapshot);
 }
 
 string *MegaNodePrivate::getPublicAuth()
@@ -1780,11 +1871,7 @@ const char *MegaNodePrivate::getChatAuth()
 
 MegaNodePrivate::~MegaNodePrivate()
 {
-    delete[] name;
-    delete[] fingerprint;
-    delete[] originalfingerprint;
     delete [] chatAuth;
-    delete customAttrs;
     delete plink;
     delete sharekey;
     delete children;
@@ -2246,6 +2333,56 @@ bool MegaUserAlertPrivate::isOwnChange() const
     return tag != 0;
 }
 
+int MegaNodePrivate::changesOf(const Node *node)
+{
+    int changed = 0;
+    if(node->changed.attrs)
+    {
+        changed |= MegaNode::CHANGE_TYPE_ATTRIBUTES;
+    }
+    if(node->changed.ctime)
+    {
+        changed |= MegaNode::CHANGE_TYPE_TIMESTAMP;
+    }
+    if(node->changed.fileattrstring)
+    {
+        changed |= MegaNode::CHANGE_TYPE_FILE_ATTRIBUTES;
+    }
+    if(node->changed.inshare)
+    {
+        changed |= MegaNode::CHANGE_TYPE_INSHARE;
+    }
+    if(node->changed.outshares)
+    {
+        changed |= MegaNode::CHANGE_TYPE_OUTSHARE;
+    }
+    if(node->changed.pendingshares)
+    {
+        changed |= MegaNode::CHANGE_TYPE_PENDINGSHARE;
+    }
+    if(node->changed.owner)
+    {
+        changed |= MegaNode::CHANGE_TYPE_OWNER;
+    }
+    if(node->changed.parent)
+    {
+        changed |= MegaNode::CHANGE_TYPE_PARENT;
+    }
+    if(node->changed.removed)
+    {
+        changed |= MegaNode::CHANGE_TYPE_REMOVED;
+    }
+    if(node->changed.publiclink)
+    {
+        changed |= MegaNode::CHANGE_TYPE_PUBLIC_LINK;
+    }
+    if(node->changed.newnode)
+    {
+        changed |= MegaNode::CHANGE_TYPE_NEW;
+    }
+    return changed;
+}
+
 MegaNode *MegaNodePrivate::fromNode(Node *node)
 {
     if(!node) return NULL;
@@ -5266,6 +5403,14 @@ bool TreeProcessor::processNode(Node*)
 TreeProcessor::~TreeProcessor()
 { }
 
+std::unique_ptr<TreeProcessor> TreeProcessor::clone() const
+{
+    return nullptr; /* Not mergeable */
+}
+
+void TreeProcessor::merge(TreeProcessor&)
+{ }
+
 
 //Entry point for the blocking thread
 void *MegaApiImpl::threadEntryPoint(void *param)
@@ -5277,6 +5422,8 @@ void *MegaApiImpl::threadEntryPoint(void *param)
     ::sigaction(SIGPIPE, &noaction, 0);
 #endif
 
+    ThreadConfig::apply(THREAD_ROLE_SDK);
+
     MegaApiImpl *megaApiImpl = (MegaApiImpl *)param;
     megaApiImpl->loop();
     return 0;
@@ -5309,6 +5456,13 @@ MegaApiImpl::MegaApiImpl(MegaApi *api, const char *appKey, const char *basePath,
     init(api, appKey, NULL, basePath, userAgent, fseventsfd, workerThreadCount);
 }
 
+void MegaApiImpl::setGfxThreads(unsigned count)
+{
+    ThreadSettings settings = ThreadConfig::get(THREAD_ROLE_GFX);
+    settings.count = count;
+    ThreadConfig::set(THREAD_ROLE_GFX, settings);
+}
+
 void MegaApiImpl::init(MegaApi *api, const char *appKey, MegaGfxProcessor* processor, const char *basePath, const char *userAgent, int fseventsfd, unsigned clientWorkerThreadCount)
 {
     this->api = api;
@@ -5338,6 +5492,7 @@ void MegaApiImpl::init(MegaApi *api, const char *appKey, MegaGfxProcessor* proce
     httpServer = NULL;
     httpServerMaxBufferSize = 0;
     httpServerMaxOutputSize = 0;
+    httpServerLoopThreads = 1;
     httpServerEnableFiles = true;
     httpServerEnableFolders = false;
     httpServerOfflineAttributeEnabled = false;
@@ -5381,7 +5536,7 @@ void MegaApiImpl::init(MegaApi *api, const char *appKey, MegaGfxProcessor* proce
     else
     {
         gfxAccess = new MegaGfxProc();
-        gfxAccess->startProcessingThread();
+        gfxAccess->startProcessingThread(ThreadConfig::get(THREAD_ROLE_GFX).count);
     }
 
     if(!userAgent)
@@ -5394,7 +5549,7 @@ void MegaApiImpl::init(MegaApi *api, const char *appKey, MegaGfxProcessor* proce
     {
         this->appKey = appKey;
     }
-    client = new MegaClient(this, waiter, httpio, fsAccess, dbAccess, gfxAccess, appKey, userAgent, clientWorkerThreadCount);
+    client = new MegaClient(this, waiter, httpio, fsAccess, dbAccess, gfxAccess, appKey, userAgent, clientWorkerThreadCount, getSharedWorkerPool());
 
 #if defined(_WIN32) && !defined(WINDOWS_PHONE)
     httpio->unlock();
@@ -5415,6 +5570,9 @@ MegaApiImpl::~MegaApiImpl()
     thread.join();
     assert(client == nullptr);
 
+    // deliver the transfer callbacks still queued before the deletion completes
+    transferCallbacks.reset();
+
     delete mPushSettings;
     delete mTimezones;
 
@@ -5598,9 +5756,7 @@ bool MegaApiImpl::checkPassword(const char *password)
         }
 
         byte derivedKey[2 * SymmCipher::KEYLENGTH];
-        CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA512> pbkdf2;
-        pbkdf2.DeriveKey(derivedKey, sizeof(derivedKey), 0, (byte *)password, strlen(password),
-                         (const byte *)client->accountsalt.data(), client->accountsalt.size(), 100000);
+        client->pbkdf2key(password, client->accountsalt, derivedKey);
 
         SymmCipher cipher(derivedKey);
         cipher.ecb_decrypt((byte *)k.data());
@@ -5698,6 +5854,107 @@ void MegaApiImpl::setLogLevel(int logLevel)
     externalLogger.setLogLevel(logLevel);
 }
 
+void MegaApiImpl::setModuleLogLevel(int module, int logLevel)
+{
+    SimpleLogger::setModuleLogLevel(LogModule(module), LogLevel(logLevel));
+}
+
+namespace {
+
+std::mutex sharedWorkerPoolMutex;
+
+// alive while an instance uses it
+std::weak_ptr<MegaWorkerPool> sharedWorkerPool;
+
+class MegaExecutorTaskPrivate : public MegaExecutorTask
+{
+public:
+    explicit MegaExecutorTaskPrivate(std::function<void()> f) : mFunction(std::move(f)) {}
+    void run() override { mFunction(); }
+
+private:
+    std::function<void()> mFunction;
+};
+
+} // anonymous
+
+void MegaApiImpl::setSharedWorkerThreads(unsigned count)
+{
+    std::lock_guard<std::mutex> g(sharedWorkerPoolMutex);
+    ThreadSettings settings = ThreadConfig::get(THREAD_ROLE_WORKER);
+    settings.count = count;
+    ThreadConfig::set(THREAD_ROLE_WORKER, settings);
+    sharedWorkerPool.reset();
+}
+
+std::shared_ptr<MegaWorkerPool> MegaApiImpl::getSharedWorkerPool()
+{
+    std::lock_guard<std::mutex> g(sharedWorkerPoolMutex);
+    unsigned count = ThreadConfig::get(THREAD_ROLE_WORKER).count;
+    if (!count)
+    {
+        return nullptr;
+    }
+
+    auto pool = sharedWorkerPool.lock();
+    if (!pool)
+    {
+        pool = std::make_shared<MegaWorkerPool>(count);
+        sharedWorkerPool = pool;
+    }
+    return pool;
+}
+
+bool MegaApiImpl::setThreadSettings(int role, unsigned count, const char* cpus, int priority)
+{
+    if (role < MegaApi::THREAD_ROLE_SDK || role > MegaApi::THREAD_ROLE_BACKGROUND
+            || priority < MegaApi::THREAD_PRIO_DEFAULT || priority > MegaApi::THREAD_PRIO_IDLE)
+    {
+        return false;
+    }
+
+    static_assert(MegaApi::THREAD_ROLE_BACKGROUND == int(THREAD_ROLE_BACKGROUND), "thread roles differ");
+    static_assert(MegaApi::THREAD_PRIO_IDLE == int(ThreadSettings::PRIORITY_IDLE), "thread priorities differ");
+
+    ThreadSettings settings;
+    if (!ThreadConfig::parseCpuList(cpus, settings.cpus))
+    {
+        LOG_err << "Invalid list of CPUs for the threads of role " << role << ": " << cpus;
+        return false;
+    }
+    settings.count = count;
+    settings.priority = ThreadSettings::Priority(priority);
+
+    if (role == MegaApi::THREAD_ROLE_WORKER)
+    {
+        std::lock_guard<std::mutex> g(sharedWorkerPoolMutex);
+        ThreadConfig::set(THREAD_ROLE_WORKER, settings);
+        sharedWorkerPool.reset();
+    }
+    else
+    {
+        ThreadConfig::set(ThreadRole(role), settings);
+    }
+    return true;
+}
+
+void MegaApiImpl::setWorkerExecutor(MegaExecutor* executor)
+{
+    std::lock_guard<std::mutex> g(sharedWorkerPoolMutex);
+    if (executor)
+    {
+        ThreadConfig::setExecutor([executor](std::function<void()> f)
+        {
+            executor->execute(new MegaExecutorTaskPrivate(std::move(f)));
+        });
+    }
+    else
+    {
+        ThreadConfig::setExecutor(nullptr);
+    }
+    sharedWorkerPool.reset();
+}
+
 void MegaApiImpl::setMaxPayloadLogSize(long long maxSize)
 {
     SimpleLogger::setMaxPayloadLogSize(maxSize);
@@ -5738,9 +5995,9 @@ void MegaApiImpl::setLoggingName(const char* loggingName)
 }
 
 #ifdef USE_ROTATIVEPERFORMANCELOGGER
-void MegaApiImpl::setUseRotativePerformanceLogger(const char * logPath, const char * logFileName, bool logToStdOut, long int archivedFilesAgeSeconds)
+void MegaApiImpl::setUseRotativePerformanceLogger(const char * logPath, const char * logFileName, bool logToStdOut, long int archivedFilesAgeSeconds, bool binary)
 {
-    mega::RotativePerformanceLogger::Instance().initialize(logPath, logFileName, logToStdOut);
+    mega::RotativePerformanceLogger::Instance().initialize(logPath, logFileName, logToStdOut, binary);
     mega::RotativePerformanceLogger::Instance().setArchiveTimestamps(archivedFilesAgeSeconds);
     MegaApiImpl::addLoggerClass(&mega::RotativePerformanceLogger::Instance());
 }
@@ -6191,6 +6448,48 @@ char *MegaApiImpl::getSequenceNumber()
     return MegaApi::strdup(client->scsn.text());
 }
 
+char *MegaApiImpl::getMetrics()
+{
+    SdkMutexGuard g(sdkMutex);
+    return MegaApi::strdup(client->metricsjson().c_str());
+}
+
+void MegaApiImpl::setTransferTraceSize(int events)
+{
+    client->metrics.transferTrace->setCapacity(size_t(std::max(events, 0)));
+}
+
+char *MegaApiImpl::getTransferTrace()
+{
+    return MegaApi::strdup(client->metrics.transferTrace->tojson().c_str());
+}
+
+char *MegaApiImpl::getMemoryUsage()
+{
+    SdkMutexGuard g(sdkMutex);
+    return MegaApi::strdup(memoryUsageJson().c_str());
+}
+
+void MegaApiImpl::setMemoryUsageLogInterval(int seconds)
+{
+    memoryUsageLogInterval = std::max(seconds, 0);
+}
+
+void MegaApiImpl::setStallDetection(int thresholdMs, bool stackSamples)
+{
+    stallWatchdog.configure(thresholdMs, stackSamples);
+}
+
+string MegaApiImpl::memoryUsageJson()
+{
+    JSONWriter json;
+    json.beginobject();
+    client->memoryjson(json);
+    json.arg("streamingbuffers", StreamingBuffer::totalCapacity.load());
+    json.endobject();
+    return json.getstring();
+}
+
 char *MegaApiImpl::getAccountAuth()
 {
     SdkMutexGuard g(sdkMutex);
@@ -6449,14 +6748,19 @@ void MegaApiImpl::loop()
     httpio->lock();
 #endif
 
+    stallWatchdog.watch();
+
     while(true)
     {
+        stallWatchdog.pass();
         sdkMutex.lock();
         int r = client->preparewait();
         sdkMutex.unlock();
         if (!r)
         {
+            stallWatchdog.idle();
             r = client->dowait();
+            stallWatchdog.pass();
             sdkMutex.lock();
             r |= client->checkevents();
             sdkMutex.unlock();
@@ -6466,11 +6770,19 @@ void MegaApiImpl::loop()
         {
             WAIT_CLASS::bumpds();
             updateBackups();
-            if (sendPendingTransfers())
+            bool yielding;
+            {
+                StallWatchdog::Scope scope("transfers");
+                yielding = sendPendingTransfers();
+            }
+            if (yielding)
             {
                 yield();
             }
-            sendPendingRequests();
+            {
+                StallWatchdog::Scope scope("requests");
+                sendPendingRequests();
+            }
             sendPendingScRequest();
             if (threadExit)
             {
@@ -6479,6 +6791,18 @@ void MegaApiImpl::loop()
 
             sdkMutex.lock();
             client->exec();
+            flushTransferUpdates(false);
+
+            dstime interval = dstime(memoryUsageLogInterval) * 10;
+            if (!lastMemoryUsageLog)
+            {
+                lastMemoryUsageLog = Waiter::ds;
+            }
+            else if (interval && Waiter::ds - lastMemoryUsageLog >= interval)
+            {
+                LOG_info << "Memory usage: " << memoryUsageJson();
+                lastMemoryUsageLog = Waiter::ds;
+            }
             sdkMutex.unlock();
         }
     }
@@ -6487,6 +6811,9 @@ void MegaApiImpl::loop()
     delete client;
     client = nullptr;
     sdkMutex.unlock();
+
+    // this thread is about to end: nothing more to watch
+    stallWatchdog.idle();
 }
 
 
@@ -6647,6 +6974,12 @@ void MegaApiImpl::loginToFolder(const char* megaFolderLink, const char* authKey,
     waiter->notify();
 }
 
+void MegaApiImpl::setFolderLinkBrowseOnly(bool enable)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->browseonly = enable;
+}
+
 void MegaApiImpl::importFileLink(const char* megaFileLink, MegaNode *parent, MegaRequestListener *listener)
 {
     MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_IMPORT_LINK, listener);
@@ -6725,6 +7058,32 @@ void MegaApiImpl::cancelGetPreview(MegaNode* node, MegaRequestListener *listener
     cancelGetNodeAttribute(node, GfxProc::PREVIEW, listener);
 }
 
+void MegaApiImpl::setFileAttributeCacheSize(long long bytes)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->facache.setCapacity(bytes);
+}
+
+void MegaApiImpl::prefetchNodeAttributes(MegaNodeList* nodes, fatype type)
+{
+    if (!nodes)
+    {
+        return;
+    }
+
+    SdkMutexGuard g(sdkMutex);
+    if (!client->facache.capacity())
+    {
+        return;
+    }
+
+    for (int i = 0; i < nodes->size(); i++)
+    {
+        client->prefetchfa(client->nodebyhandle(nodes->get(i)->getHandle()), type);
+    }
+    waiter->notify();
+}
+
 void MegaApiImpl::setPreview(MegaNode* node, const char *srcFilePath, MegaRequestListener *listener)
 {
     setNodeAttribute(node, GfxProc::PREVIEW, srcFilePath, INVALID_HANDLE, listener);
@@ -7991,6 +8350,56 @@ bool MegaApiImpl::setMaxUploadSpeed(m_off_t bpslimit)
     return result;
 }
 
+bool MegaApiImpl::setTransferNetworkProfile(int socketBufferSize, int notSentLowat, const char* congestionControl, int receiveBufferSize)
+{
+    TransferNetworkProfile profile;
+    profile.socketbuffer = std::max(socketBufferSize, 0);
+    profile.notsentlowat = std::max(notSentLowat, 0);
+    profile.congestion = congestionControl ? congestionControl : "";
+    profile.receivebuffer = std::max(receiveBufferSize, 0);
+
+    SdkMutexGuard g(sdkMutex);
+    return client->httpio->settransferprofile(profile);
+}
+
+void MegaApiImpl::setTransferUpdateInterval(int milliseconds)
+{
+    SdkMutexGuard g(sdkMutex);
+    transferUpdateInterval = dstime(std::max(milliseconds, 0) / 100);
+}
+
+void MegaApiImpl::setTransferUpdateBatching(int milliseconds)
+{
+    SdkMutexGuard g(sdkMutex);
+    transferBatchInterval = dstime(std::max(milliseconds, 0) / 100);
+}
+
+void MegaApiImpl::setLightweightNodeUpdates(bool enable)
+{
+    lightweightNodeUpdates = enable;
+}
+
+void MegaApiImpl::setSubtreeRemovalNotifications(bool enable)
+{
+    subtreeRemovalNotifications = enable;
+}
+
+void MegaApiImpl::setAsyncTransferCallbacks(bool enable)
+{
+    SdkMutexGuard g(sdkMutex);
+    if (enable && !transferCallbacks)
+    {
+        transferCallbacks = std::make_shared<TransferCallbackDispatcher>(api);
+    }
+    else if (!enable && transferCallbacks)
+    {
+        // the events queued are delivered first, with the SDK unlocked as they would be anyway
+        auto callbacks = std::move(transferCallbacks);
+        g.unlock();
+        callbacks.reset();
+    }
+}
+
 int MegaApiImpl::getMaxDownloadSpeed()
 {
     return int(client->getmaxdownloadspeed());
@@ -8024,6 +8433,40 @@ int MegaApiImpl::getCurrentSpeed(int type)
     }
 }
 
+void MegaApiImpl::setTransferConcurrency(int policy)
+{
+    SdkMutexGuard g(sdkMutex);
+    if (policy == MegaApi::TRANSFER_CONCURRENCY_ADAPTIVE)
+    {
+        client->transferpolicy.reset(new AdaptiveTransferConcurrency);
+    }
+    else
+    {
+        client->transferpolicy.reset(new FixedTransferConcurrency);
+    }
+}
+
+int MegaApiImpl::getMaxConcurrentTransfers(int type)
+{
+    SdkMutexGuard g(sdkMutex);
+    switch (type)
+    {
+    case MegaTransfer::TYPE_DOWNLOAD:
+        return int(client->transferpolicy->maxTransfers(GET));
+    case MegaTransfer::TYPE_UPLOAD:
+        return int(client->transferpolicy->maxTransfers(PUT));
+    case -1:
+        return int(client->transferpolicy->maxTotalTransfers());
+    default:
+        return 0;
+    }
+}
+
+void MegaApiImpl::setMaxTransferBufferMemory(long long maxBytes)
+{
+    TransferBufferPool::instance().setCeiling(maxBytes > 0 ? size_t(maxBytes) : 0);
+}
+
 int MegaApiImpl::getDownloadMethod()
 {
     if (client->autodownport)
@@ -8367,7 +8810,7 @@ void MegaApiImpl::startTimer( int64_t period, MegaRequestListener *listener)
     waiter->notify();
 }
 
-void MegaApiImpl::startUpload(bool startFirst, const char *localPath, MegaNode *parent, const char *fileName, const char *targetUser, int64_t mtime, int folderTransferTag, bool isBackup, const char *appData, bool isSourceFileTemporary, bool forceNewUpload, FileSystemType fsType, MegaTransferListener *listener)
+MegaTransferPrivate *MegaApiImpl::createUploadTransfer(bool startFirst, const char *localPath, MegaNode *parent, const char *fileName, const char *targetUser, int64_t mtime, int folderTransferTag, bool isBackup, const char *appData, bool isSourceFileTemporary, bool forceNewUpload, FileSystemType fsType, MegaTransferListener *listener)
 {
     if (fsType == FS_UNKNOWN && localPath)
     {
@@ -8420,8 +8863,12 @@ void MegaApiImpl::startUpload(bool startFirst, const char *localPath, MegaNode *
     }
 
     transfer->setForceNewUpload(forceNewUpload);
+    return transfer;
+}
 
-    transferQueue.push(transfer);
+void MegaApiImpl::startUpload(bool startFirst, const char *localPath, MegaNode *parent, const char *fileName, const char *targetUser, int64_t mtime, int folderTransferTag, bool isBackup, const char *appData, bool isSourceFileTemporary, bool forceNewUpload, FileSystemType fsType, MegaTransferListener *listener)
+{
+    transferQueue.push(createUploadTransfer(startFirst, localPath, parent, fileName, targetUser, mtime, folderTransferTag, isBackup, appData, isSourceFileTemporary, forceNewUpload, fsType, listener));
     waiter->notify();
 }
 
@@ -8442,7 +8889,7 @@ void MegaApiImpl::startUploadForSupport(const char *localPath, bool isSourceTemp
     return startUpload(true, localPath, nullptr, nullptr, "pGTOqu7_Fek", -1, 0, false, nullptr, isSourceTemporary, false, fsType, listener);
 }
 
-void MegaApiImpl::startDownload(bool startFirst, MegaNode *node, const char* localPath, int folderTransferTag, const char *appData, MegaTransferListener *listener)
+MegaTransferPrivate *MegaApiImpl::createDownloadTransfer(bool startFirst, MegaNode *node, const char* localPath, int folderTransferTag, const char *appData, MegaTransferListener *listener)
 {
     MegaTransferPrivate* transfer = new MegaTransferPrivate(MegaTransfer::TYPE_DOWNLOAD, listener);
 
@@ -8484,13 +8931,85 @@ void MegaApiImpl::startDownload(bool startFirst, MegaNode *node, const char* loc
         transfer->setFolderTransferTag(folderTransferTag);
     }
 
-    transferQueue.push(transfer);
+    return transfer;
+}
+
+void MegaApiImpl::startDownload(bool startFirst, MegaNode *node, const char* localPath, int folderTransferTag, const char *appData, MegaTransferListener *listener)
+{
+    transferQueue.push(createDownloadTransfer(startFirst, node, localPath, folderTransferTag, appData, listener));
     waiter->notify();
 }
 
 void MegaApiImpl::startDownload(MegaNode *node, const char* localFolder, MegaTransferListener *listener)
 { startDownload(false, node, localFolder, 0, NULL, listener); }
 
+void MegaApiImpl::startTransfers(vector<MegaTransferPrivate *> &&transfers)
+{
+    if (!transfers.empty())
+    {
+        transferQueue.push(std::move(transfers));
+        waiter->notify();
+    }
+}
+
+void MegaApiImpl::startUploads(MegaStringList *localPaths, MegaNode *parent, MegaTransferListener *listener)
+{
+    if (!localPaths)
+    {
+        return;
+    }
+
+    vector<MegaTransferPrivate *> transfers;
+    transfers.reserve(size_t(localPaths->size()));
+
+    // the filesystem type is looked up once per folder of the files
+    string lastFolder;
+    FileSystemType fsType = FS_UNKNOWN;
+
+    for (int i = 0; i < localPaths->size(); i++)
+    {
+        const char *localPath = localPaths->get(i);
+        if (!localPath)
+        {
+            continue;
+        }
+
+        string path(localPath);
+        size_t separator = path.find_last_of(FileSystemAccess::getPathSeparator());
+        string folder = separator == string::npos ? string() : path.substr(0, separator + 1);
+        if (folder != lastFolder || fsType == FS_UNKNOWN)
+        {
+            lastFolder = folder;
+            fsType = fsAccess->getlocalfstype(LocalPath::fromPath(localPath, *fsAccess));
+        }
+
+        transfers.push_back(createUploadTransfer(false, localPath, parent, nullptr, nullptr, -1, 0, false, nullptr, false, false, fsType, listener));
+    }
+
+    startTransfers(std::move(transfers));
+}
+
+void MegaApiImpl::startDownloads(MegaNodeList *nodes, const char *localFolder, MegaTransferListener *listener)
+{
+    if (!nodes)
+    {
+        return;
+    }
+
+    vector<MegaTransferPrivate *> transfers;
+    transfers.reserve(size_t(nodes->size()));
+
+    for (int i = 0; i < nodes->size(); i++)
+    {
+        if (MegaNode *node = nodes->get(i))
+        {
+            transfers.push_back(createDownloadTransfer(false, node, localFolder, 0, nullptr, listener));
+        }
+    }
+
+    startTransfers(std::move(transfers));
+}
+
 void MegaApiImpl::cancelTransfer(MegaTransfer *t, MegaRequestListener *listener)
 {
     MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_CANCEL_TRANSFER, listener);
@@ -8546,6 +9065,11 @@ void MegaApiImpl::setStreamingMinimumRate(int bytesPerSecond)
     client->minstreamingrate = bytesPerSecond;
 }
 
+void MegaApiImpl::setStreamingChunkSize(size_t bytes)
+{
+    streamingChunkSize = bytes;
+}
+
 void MegaApiImpl::retryTransfer(MegaTransfer *transfer, MegaTransferListener *listener)
 {
     MegaTransferPrivate *t = dynamic_cast<MegaTransferPrivate*>(transfer);
@@ -8632,6 +9156,26 @@ int MegaApiImpl::syncPathState(string* path)
     }
 #endif
 
+    if (client->syncs.isEmpty)
+    {
+        return MegaApi::STATE_NONE;
+    }
+
+    // the states kept for the LocalNodes answer most queries without the SDK mutex
+    LocalPath localpath = LocalPath::fromPlatformEncoded(*path);
+    treestate_t ts;
+    switch (client->syncs.treestates.get(localpath, ts))
+    {
+        case SyncTreeStates::NOT_SYNCED:
+            return MegaApi::STATE_NONE;
+        case SyncTreeStates::IN_DEBRIS:
+            return MegaApi::STATE_IGNORED;
+        case SyncTreeStates::KNOWN:
+            return ts;
+        case SyncTreeStates::UNKNOWN:
+            break;
+    }
+
     // Avoid blocking on the mutex for a long time, as we may be blocking windows explorer (or another platform's equivalent) from opening or displaying a window, unrelated to sync folders
     // We try to lock the SDK mutex.  If we can't get it in 10ms then we return a simple default, and subsequent requests try to lock the mutex but don't wait.
     SdkMutexGuard g(sdkMutex, std::defer_lock);
@@ -8651,8 +9195,6 @@ int MegaApiImpl::syncPathState(string* path)
         return state;
     }
 
-    LocalPath localpath = LocalPath::fromPlatformEncoded(*path);
-
     client->syncs.forEachRunningSync_shortcircuit([&](Sync* sync) {
 
         if (!sync->localroot->localname.isContainingPathOf(localpath))
@@ -8900,11 +9442,13 @@ void MegaApiImpl::setExcludedNames(vector<string> *excludedNames)
     sdkMutex.lock();
     if (!excludedNames)
     {
+        this->excludedLiteralNames.clear();
         this->excludedNames.clear();
         sdkMutex.unlock();
         return;
     }
 
+    this->excludedLiteralNames.clear();
     this->excludedNames.clear();
     for (unsigned int i = 0; i < excludedNames->size(); i++)
     {
@@ -8912,7 +9456,14 @@ void MegaApiImpl::setExcludedNames(vector<string> *excludedNames)
         fsAccess->normalize(&name);
         if (name.size())
         {
-            this->excludedNames.push_back(name);
+            if (name.find_first_of("*?") == string::npos)
+            {
+                this->excludedLiteralNames.insert(name);
+            }
+            else
+            {
+                this->excludedNames.push_back(name);
+            }
             LOG_debug << "Excluded name: " << name;
         }
         else
@@ -9112,25 +9663,25 @@ void MegaApiImpl::resetTotalUploads()
 
 MegaNode *MegaApiImpl::getRootNode()
 {
-    sdkMutex.lock();
+    sdkMutex.lock_shared();
     MegaNode *result = MegaNodePrivate::fromNode(client->nodebyhandle(client->rootnodes[0]));
-    sdkMutex.unlock();
+    sdkMutex.unlock_shared();
     return result;
 }
 
 MegaNode* MegaApiImpl::getInboxNode()
 {
-    sdkMutex.lock();
+    sdkMutex.lock_shared();
     MegaNode *result = MegaNodePrivate::fromNode(client->nodebyhandle(client->rootnodes[1]));
-    sdkMutex.unlock();
+    sdkMutex.unlock_shared();
     return result;
 }
 
 MegaNode* MegaApiImpl::getRubbishNode()
 {
-    sdkMutex.lock();
+    sdkMutex.lock_shared();
     MegaNode *result = MegaNodePrivate::fromNode(client->nodebyhandle(client->rootnodes[2]));
-    sdkMutex.unlock();
+    sdkMutex.unlock_shared();
     return result;
 }
 
@@ -9138,7 +9689,7 @@ MegaNode *MegaApiImpl::getRootNode(MegaNode *node)
 {
     MegaNode *rootnode = NULL;
 
-    sdkMutex.lock();
+    sdkMutex.lock_shared();
 
     Node *n;
     if (node && (n = client->nodebyhandle(node->getHandle())))
@@ -9151,7 +9702,7 @@ MegaNode *MegaApiImpl::getRootNode(MegaNode *node)
         rootnode = MegaNodePrivate::fromNode(n);
     }
 
-    sdkMutex.unlock();
+    sdkMutex.unlock_shared();
 
     return rootnode;
 }
@@ -9293,6 +9844,22 @@ bool MegaApiImpl::createAvatar(const char *imagePath, const char *dstPath)
     return result;
 }
 
+void MegaApiImpl::setGfxMemoryBudget(long long bytes)
+{
+    if (gfxAccess)
+    {
+        gfxAccess->setmemorybudget(bytes);
+    }
+}
+
+void MegaApiImpl::setPreviewQuality(int quality)
+{
+    if (gfxAccess)
+    {
+        gfxAccess->setpreviewquality(quality);
+    }
+}
+
 void MegaApiImpl::backgroundMediaUploadRequestUploadURL(int64_t fullFileSize, MegaBackgroundMediaUpload* state, MegaRequestListener *listener)
 {
     MegaRequestPrivate* req = new MegaRequestPrivate(MegaRequest::TYPE_GET_BACKGROUND_UPLOAD_URL, listener);
@@ -9386,6 +9953,7 @@ bool MegaApiImpl::httpServerStart(bool localOnly, int port, bool useTLS, const c
     httpServer = new MegaHTTPServer(this, basePath, useTLS, certificatepath ? certificatepath : string(), keypath ? keypath : string(), useIPv6);
     httpServer->setMaxBufferSize(httpServerMaxBufferSize);
     httpServer->setMaxOutputSize(httpServerMaxOutputSize);
+    httpServer->setLoopThreads(httpServerLoopThreads);
     httpServer->enableFileServer(httpServerEnableFiles);
     httpServer->enableOfflineAttribute(httpServerOfflineAttributeEnabled);
     httpServer->enableFolderServer(httpServerEnableFolders);
@@ -9612,6 +10180,18 @@ int MegaApiImpl::httpServerGetMaxOutputSize()
     return value;
 }
 
+void MegaApiImpl::httpServerSetLoopThreads(int threads)
+{
+    SdkMutexGuard g(sdkMutex);
+    httpServerLoopThreads = std::max(threads, 1);
+}
+
+int MegaApiImpl::httpServerGetLoopThreads()
+{
+    SdkMutexGuard g(sdkMutex);
+    return httpServerLoopThreads;
+}
+
 void MegaApiImpl::httpServerEnableFileServer(bool enable)
 {
     sdkMutex.lock();
@@ -9958,7 +10538,7 @@ int MegaApiImpl::ftpServerGetMaxBufferSize()
     }
     else
     {
-        value = StreamingBuffer::MAX_BUFFER_SIZE;
+        value = MegaFTPServer::DATA_BUFFER_SIZE;
     }
     sdkMutex.unlock();
     return value;
@@ -9985,7 +10565,7 @@ int MegaApiImpl::ftpServerGetMaxOutputSize()
     }
     else
     {
-        value = StreamingBuffer::MAX_OUTPUT_SIZE;
+        value = MegaFTPServer::DATA_OUTPUT_SIZE;
     }
     sdkMutex.unlock();
     return value;
@@ -10693,6 +11273,21 @@ MegaUserAlertList* MegaApiImpl::getUserAlerts()
     return alertList;
 }
 
+MegaUserAlertList* MegaApiImpl::getUserAlertsAfter(unsigned id)
+{
+    SdkMutexGuard g(sdkMutex);
+
+    vector<UserAlert::Base*> v;
+    client->useralerts.alertsAfter(id, v);
+    return new MegaUserAlertListPrivate(v.data(), int(v.size()), client);
+}
+
+void MegaApiImpl::setMaxUserAlerts(unsigned max)
+{
+    SdkMutexGuard g(sdkMutex);
+    client->useralerts.setMaxAlerts(max);
+}
+
 int MegaApiImpl::getNumUnreadUserAlerts()
 {
     int result = 0;
@@ -10856,7 +11451,7 @@ MegaShareList *MegaApiImpl::getOutShares(int order)
     sdkMutex.lock();
 
     OutShareProcessor shareProcessor(*client);
-    processTree(client->nodebyhandle(client->rootnodes[0]), &shareProcessor, true);
+    processOutShares(&shareProcessor);
     shareProcessor.sortShares(order);
     MegaShareList *shareList = new MegaShareListPrivate(shareProcessor.getShares().data(), shareProcessor.getHandles().data(), int(shareProcessor.getShares().size()));
 
@@ -10917,7 +11512,7 @@ MegaShareList *MegaApiImpl::getPendingOutShares()
     sdkMutex.lock();
 
     PendingOutShareProcessor shareProcessor;
-    processTree(client->nodebyhandle(client->rootnodes[0]), &shareProcessor, true);
+    processOutShares(&shareProcessor);
     MegaShareList *shareList = new MegaShareListPrivate(shareProcessor.getShares().data(), shareProcessor.getHandles().data(), int(shareProcessor.getShares().size()));
 
     sdkMutex.unlock();
@@ -11114,7 +11709,7 @@ bool MegaApiImpl::processMegaTree(MegaNode* n, MegaTreeProcessor* processor, boo
 
     if (node->type != FILENODE)
     {
-        for (node_list::iterator it = node->children.begin(); it != node->children.end(); )
+        for (auto it = node->children.begin(); it != node->children.end(); )
         {
             MegaNode *megaNode = MegaNodePrivate::fromNode(*it++);
             if (recursive)
@@ -11143,6 +11738,75 @@ bool MegaApiImpl::processMegaTree(MegaNode* n, MegaTreeProcessor* processor, boo
     return result;
 }
 
+#ifdef ENABLE_SEARCH_INDEX
+// Recursive search answered from the client's name index instead of walking the node trees.
+// Candidates are kept if a recursive processTree() would have reached them: below `parent` through
+// folders or, without a parent, from one of `roots` (the first `nroots` rootnodes) or an inshare.
+static node_vector searchindexed(MegaClient* client, const char* searchString, int type, Node* parent, unsigned nroots, bool inshares, MegaCancelToken* cancelToken)
+{
+    unsigned types = 0;
+    switch (type)
+    {
+        case MegaApi::FILE_TYPE_PHOTO: types = SearchIndex::TYPE_PHOTO; break;
+        case MegaApi::FILE_TYPE_AUDIO: types = SearchIndex::TYPE_AUDIO; break;
+        case MegaApi::FILE_TYPE_VIDEO: types = SearchIndex::TYPE_VIDEO; break;
+        case MegaApi::FILE_TYPE_DOCUMENT: types = SearchIndex::TYPE_DOCUMENT; break;
+    }
+
+    // the processor applies exactly the same name and type matching as the tree walk
+    SearchTreeProcessor searchProcessor(client, searchString, type);
+
+    for (Node* n : client->mSearchIndex.find(searchString, types))
+    {
+        if (cancelToken && cancelToken->isCancelled())
+        {
+            break;
+        }
+
+        bool inscope = false;
+        if (parent)
+        {
+            for (Node* p = n->parent; p; p = p->parent)
+            {
+                if (p == parent)
+                {
+                    inscope = true;
+                    break;
+                }
+                if (p->type == FILENODE)
+                {
+                    break;  // versions are not visited
+                }
+            }
+        }
+        else
+        {
+            Node* top = n;
+            while (top->parent && top->parent->type != FILENODE)
+            {
+                top = top->parent;
+            }
+
+            if (!top->parent)
+            {
+                inscope = inshares && top->inshare;
+                for (unsigned i = 0; i < nroots && !inscope; i++)
+                {
+                    inscope = top->nodehandle == client->rootnodes[i];
+                }
+            }
+        }
+
+        if (inscope)
+        {
+            searchProcessor.processNode(n);
+        }
+    }
+
+    return std::move(searchProcessor.getResults());
+}
+#endif
+
 MegaNodeList *MegaApiImpl::search(const char *searchString, MegaCancelToken *cancelToken, int order, int type)
 {
     if (!searchString && (type < MegaApi::FILE_TYPE_PHOTO || type > MegaApi::FILE_TYPE_DOCUMENT))
@@ -11172,6 +11836,12 @@ MegaNodeList *MegaApiImpl::search(const char *searchString, MegaCancelToken *can
     node_vector result;
     Node *node;
 
+#ifdef ENABLE_SEARCH_INDEX
+    result = searchindexed(client, searchString, type, nullptr, sizeof client->rootnodes / sizeof *client->rootnodes, true, cancelToken);
+    sortByComparatorFunction(result, order, *client);
+    return new MegaNodeListPrivate(result.data(), int(result.size()));
+#endif
+
     // rootnodes
     for (unsigned int i = 0; i < (sizeof client->rootnodes / sizeof *client->rootnodes)
           && !(cancelToken && cancelToken->isCancelled()); i++)
@@ -11415,6 +12085,44 @@ bool MegaApiImpl::areGfxFeaturesDisabled()
     return !client->gfx || client->gfxdisabled;
 }
 
+void MegaApiImpl::setDatabaseTuning(int profile)
+{
+    SdkMutexGuard g(sdkMutex);
+    if (client->dbaccess)
+    {
+        client->dbaccess->tuning = DbTuning::forProfile(profile);
+    }
+}
+
+void MegaApiImpl::setDatabaseBackend(int backend)
+{
+    SdkMutexGuard g(sdkMutex);
+    if (client->sctable || client->tctable || client->statusTable)
+    {
+        LOG_warn << "The database backend can't be changed while tables are open";
+        return;
+    }
+
+    unique_ptr<DbAccess> dbaccess;
+    if (backend == MegaApi::DB_BACKEND_MEMORY)
+    {
+        dbaccess.reset(new MemoryDbAccess(basePath.empty() ? LocalPath() : LocalPath::fromPath(basePath, *fsAccess)));
+    }
+    else if (!basePath.empty())
+    {
+        dbaccess.reset(new MegaDbAccess(LocalPath::fromPath(basePath, *fsAccess)));
+    }
+
+    if (dbaccess && client->dbaccess)
+    {
+        dbaccess->tuning = client->dbaccess->tuning;
+    }
+
+    delete client->dbaccess;
+    client->dbaccess = dbaccess.release();
+    dbAccess = nullptr;  // owned by the client
+}
+
 const char *MegaApiImpl::getUserAgent()
 {
     return client->useragent.c_str();
@@ -11647,6 +12355,163 @@ void MegaApiImpl::resumeActionPackets()
     sdkMutex.unlock();
 }
 
+// trees with fewer nodes than this are not worth splitting between threads
+static const size_t MIN_NODES_PARALLEL_TREE_PROCESSING = 20000;
+static const unsigned MAX_TREE_PROCESSING_THREADS = 16;
+
+// processTree() for the worker threads: without locking, as the thread that started the walk holds sdkMutex
+static bool processSubtree(Node* node, TreeProcessor* processor, MegaCancelToken* cancelToken, const std::atomic<bool>& stop)
+{
+    if (stop || (cancelToken && cancelToken->isCancelled()))
+    {
+        return false;
+    }
+
+    if (node->type != FILENODE)
+    {
+        for (Node* child : node->children)
+        {
+            if (!processSubtree(child, processor, cancelToken, stop))
+            {
+                return false;
+            }
+        }
+    }
+
+    return processor->processNode(node);
+}
+
+// Walks the tree below node over nthreads threads (including the calling one), each with its own clone
+// of the processor, and merges their results into processor.  The caller holds sdkMutex during the walk,
+// so the nodes don't change while the workers read them.
+static bool processTreeParallel(Node* node, TreeProcessor* processor, std::unique_ptr<TreeProcessor> firstClone, unsigned nthreads, MegaCancelToken* cancelToken)
+{
+    auto weight = [](const Node* n)
+    {
+        NodeCounter nc = n->subnodeCounts();
+        return nc.files + nc.folders;
+    };
+
+    // split the tree in subtrees of similar size by expanding the largest one, until there are
+    // enough of them to keep all the threads busy
+    const size_t target = nthreads * 8;
+    const size_t minWeight = weight(node) / target;
+    auto lighter = [&weight](const Node* a, const Node* b) { return weight(a) < weight(b); };
+    std::priority_queue<Node*, node_vector, decltype(lighter)> subtrees(lighter);
+    node_vector expanded;   // processed last, on this thread, as they must come after their children
+
+    subtrees.push(node);
+    while (!subtrees.empty() && subtrees.size() < target)
+    {
+        Node* n = subtrees.top();
+        if (n->type == FILENODE || weight(n) <= minWeight)
+        {
+            break;
+        }
+
+        subtrees.pop();
+        expanded.push_back(n);
+        for (Node* child : n->children)
+        {
+            subtrees.push(child);
+        }
+    }
+
+    node_vector items;
+    items.reserve(subtrees.size());
+    for (; !subtrees.empty(); subtrees.pop())
+    {
+        items.push_back(subtrees.top());
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool> stop(false);
+    auto work = [&](TreeProcessor* p)
+    {
+        for (size_t i; !stop && (i = next++) < items.size(); )
+        {
+            if (!processSubtree(items[i], p, cancelToken, stop))
+            {
+                stop = true;
+            }
+        }
+    };
+
+    std::vector<std::unique_ptr<TreeProcessor>> clones;
+    clones.push_back(std::move(firstClone));
+    std::vector<std::thread> threads;
+    while (clones.size() < nthreads)
+    {
+        clones.push_back(processor->clone());
+        try
+        {
+            TreeProcessor* clone = clones.back().get();
+            threads.emplace_back([&work, clone]()
+            {
+                ThreadConfig::apply(THREAD_ROLE_SEARCH);
+                work(clone);
+            });
+        }
+        catch (std::system_error& e)
+        {
+            LOG_warn << "Failed to start tree processing thread: " << e.what();
+            clones.pop_back();
+            break;
+        }
+    }
+
+    work(clones.front().get());
+
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    for (auto& c : clones)
+    {
+        processor->merge(*c);
+    }
+
+    if (stop)
+    {
+        return false;
+    }
+
+    for (auto it = expanded.rbegin(); it != expanded.rend(); ++it)
+    {
+        if (!processor->processNode(*it))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void MegaApiImpl::processOutShares(TreeProcessor* processor)
+{
+    if (!client->lazyindex.empty())
+    {
+        processTree(client->nodebyhandle(client->rootnodes[0]), processor, true);
+        return;
+    }
+
+    // a node shared with several users is in the index once for each
+    handle_set handles;
+    for (auto& it : client->outsharesbypeer)
+    {
+        handles.insert(it.second.begin(), it.second.end());
+    }
+
+    for (handle h : handles)
+    {
+        Node* n = client->nodebyhandle(h);
+        if (n && client->getrootnode(n)->nodehandle == client->rootnodes[0])
+        {
+            processor->processNode(n);
+        }
+    }
+}
+
 bool MegaApiImpl::processTree(Node* node, TreeProcessor* processor, bool recursive, MegaCancelToken *cancelToken)
 {
     if (!node)
@@ -11679,7 +12544,22 @@ bool MegaApiImpl::processTree(Node* node, TreeProcessor* processor, bool recursi
 
     if (recursive && node->type != FILENODE)
     {
-        for (node_list::iterator it = node->children.begin(); it != node->children.end(); )
+        // large trees are split among several threads if the processor allows it
+        NodeCounter nc = node->subnodeCounts();
+        unsigned nthreads = ThreadConfig::get(THREAD_ROLE_SEARCH).count;
+        if (!nthreads)
+        {
+            nthreads = std::min(std::thread::hardware_concurrency(), MAX_TREE_PROCESSING_THREADS);
+        }
+        if (nthreads > 1 && nc.files + nc.folders >= MIN_NODES_PARALLEL_TREE_PROCESSING)
+        {
+            if (auto clone = processor->clone())
+            {
+                return processTreeParallel(node, processor, std::move(clone), nthreads, cancelToken);
+            }
+        }
+
+        for (auto it = node->children.begin(); it != node->children.end(); )
         {
             if (!processTree(*it++, processor, recursive, cancelToken))
             {
@@ -11733,9 +12613,18 @@ MegaNodeList* MegaApiImpl::search(MegaNode *n, const char* searchString, MegaCan
             return new MegaNodeListPrivate();
         }
 
+#ifdef ENABLE_SEARCH_INDEX
+        if (recursive)
+        {
+            node_vector vNodes = searchindexed(client, searchString, type, node, 0, false, cancelToken);
+            sortByComparatorFunction(vNodes, order, *client);
+            return new MegaNodeListPrivate(vNodes.data(), int(vNodes.size()));
+        }
+#endif
+
         // searchString and nodeType (if provided), are considered in search
         SearchTreeProcessor searchProcessor(client, searchString, type);
-        for (node_list::iterator it = node->children.begin(); it != node->children.end()
+        for (auto it = node->children.begin(); it != node->children.end()
              && !(cancelToken && cancelToken->isCancelled()); )
         {
             processTree(*it++, &searchProcessor, recursive, cancelToken);
@@ -11756,6 +12645,18 @@ MegaNodeList* MegaApiImpl::search(MegaNode *n, const char* searchString, MegaCan
             return new MegaNodeListPrivate();
         }
 
+#ifdef ENABLE_SEARCH_INDEX
+        if (recursive && (target == MegaApi::SEARCH_TARGET_ROOTNODE || target == MegaApi::SEARCH_TARGET_INSHARE || target == MegaApi::SEARCH_TARGET_ALL))
+        {
+            // cloud drive only, not Inbox or Rubbish
+            result = searchindexed(client, searchString, type, nullptr,
+                                   target != MegaApi::SEARCH_TARGET_INSHARE ? 1 : 0,
+                                   target != MegaApi::SEARCH_TARGET_ROOTNODE, cancelToken);
+            sortByComparatorFunction(result, order, *client);
+            return new MegaNodeListPrivate(result.data(), int(result.size()));
+        }
+#endif
+
         if (target == MegaApi::SEARCH_TARGET_ROOTNODE || target == MegaApi::SEARCH_TARGET_ALL)
         {
             // Search on rootnode (cloud, excludes Inbox and Rubbish)
@@ -11851,9 +12752,9 @@ long long MegaApiImpl::getSize(MegaNode *n)
         sdkMutex.unlock();
         return 0;
     }
-    SizeProcessor sizeProcessor;
-    processTree(node, &sizeProcessor);
-    long long result = sizeProcessor.getTotalBytes();
+    // versions are not included
+    NodeCounter nc = node->subnodeCounts();
+    long long result = nc.storage - nc.versionStorage;
     sdkMutex.unlock();
 
     return result;
@@ -11869,8 +12770,25 @@ char *MegaApiImpl::getFingerprint(const char *filePath)
     if(!fa->fopen(localpath, true, false))
         return NULL;
 
+    // the file is read, when it must be, without holding up the SDK thread
     FileFingerprint fp;
-    fp.genfingerprint(fa.get());
+    bool cache, cached;
+    {
+        SdkMutexGuard g(sdkMutex);
+        cache = client->cachefingerprints;
+        cached = cache && client->fingerprintcache.lookup(localpath, fa.get(), fp);
+    }
+
+    if (!cached)
+    {
+        fp.genfingerprint(fa.get());
+
+        if (cache)
+        {
+            SdkMutexGuard g(sdkMutex);
+            client->fingerprintcache.store(localpath, fa.get(), fp);
+        }
+    }
     m_off_t size = fa->size;
     if(fp.size < 0)
         return NULL;
@@ -12126,7 +13044,7 @@ MegaNode *MegaApiImpl::getNodeByCRC(const char *crc, MegaNode *parent)
     byte binarycrc[sizeof(node->crc)];
     Base64::atob(crc, binarycrc, sizeof(binarycrc));
 
-    for (node_list::iterator it = node->children.begin(); it != node->children.end(); it++)
+    for (auto it = node->children.begin(); it != node->children.end(); it++)
     {
         Node *child = (*it);
         if(!memcmp(child->crc.data(), binarycrc, sizeof(node->crc)))
@@ -12228,21 +13146,15 @@ vector<Node *> &SearchTreeProcessor::getResults()
     return mResults;
 }
 
-SizeProcessor::SizeProcessor()
+std::unique_ptr<TreeProcessor> SearchTreeProcessor::clone() const
 {
-    totalBytes=0;
+    return make_unique<SearchTreeProcessor>(mClient, mSearch, mFileType);
 }
 
-bool SizeProcessor::processNode(Node *node)
+void SearchTreeProcessor::merge(TreeProcessor& other)
 {
-    if(node->type == FILENODE)
-        totalBytes += node->size;
-    return true;
-}
-
-long long SizeProcessor::getTotalBytes()
-{
-    return totalBytes;
+    auto& o = static_cast<SearchTreeProcessor&>(other);
+    mResults.insert(mResults.end(), o.mResults.begin(), o.mResults.end());
 }
 
 void MegaApiImpl::file_added(File *f)
@@ -12384,14 +13296,14 @@ void MegaApiImpl::transfer_update(Transfer *t)
         }
 
         if (it == t->files.begin()
-                && transfer->getUpdateTime() == Waiter::ds
+                && Waiter::ds - transfer->getUpdateTime() < transferUpdateInterval
                 && transfer->getState() == t->state
                 && transfer->getPriority() == t->priority
                 && (!t->slot
                     || (t->slot->progressreported
                         && t->slot->progressreported != t->size)))
         {
-            // don't send more than one callback per decisecond
+            // don't send more than one callback per transferUpdateInterval
             // if the state doesn't change, the priority doesn't change
             // and there isn't anything new or it's not the first
             // nor the last callback
@@ -12465,6 +13377,15 @@ File *MegaApiImpl::file_resume(string *d, direction_t *type)
 dstime MegaApiImpl::pread_failure(const Error &e, int retry, void* param, dstime timeLeft)
 {
     MegaTransferPrivate *transfer = (MegaTransferPrivate *)param;
+
+    if (!transfer->streamingChunk.empty())
+    {
+        // what was held back won't be received again
+        fireOnStreamingData(transfer, &transfer->streamingChunk[0], m_off_t(transfer->streamingChunk.size()),
+                            transfer->getSpeed(), transfer->getMeanSpeed());
+        transfer->streamingChunk.clear();
+    }
+
     transfer->setUpdateTime(Waiter::ds);
     transfer->setDeltaSize(0);
     transfer->setSpeed(0);
@@ -12503,19 +13424,28 @@ dstime MegaApiImpl::pread_failure(const Error &e, int retry, void* param, dstime
 bool MegaApiImpl::pread_data(byte *buffer, m_off_t len, m_off_t, m_off_t speed, m_off_t meanSpeed, void* param)
 {
     MegaTransferPrivate *transfer = (MegaTransferPrivate *)param;
-    dstime currentTime = Waiter::ds;
-    transfer->setStartTime(currentTime);
-    transfer->setState(MegaTransfer::STATE_ACTIVE);
-    transfer->setUpdateTime(currentTime);
-    transfer->setDeltaSize(len);
-    transfer->setLastBytes((char *)buffer);
-    transfer->setTransferredBytes(transfer->getTransferredBytes() + len);
-    transfer->setSpeed(speed);
-    transfer->setMeanSpeed(meanSpeed);
+    string& chunk = transfer->streamingChunk;
+
+    size_t chunkSize = streamingChunkSize;
+    if (chunkSize || !chunk.empty())
+    {
+        // held back until there is a whole chunk, or it's the end
+        bool last = transfer->getTransferredBytes() + m_off_t(chunk.size()) + len == transfer->getTotalBytes();
+        chunk.append((char *)buffer, size_t(len));
+        if (!last && chunk.size() < chunkSize)
+        {
+            return true;
+        }
+
+        buffer = (byte *)&chunk[0];
+        len = m_off_t(chunk.size());
+    }
+
+    bool proceed = fireOnStreamingData(transfer, (char *)buffer, len, speed, meanSpeed);
+    chunk.clear();
 
     bool end = (transfer->getTransferredBytes() == transfer->getTotalBytes());
-    fireOnTransferUpdate(transfer);
-    if (!fireOnTransferData(transfer) || end)
+    if (!proceed || end)
     {
         transfer->setState(end ? MegaTransfer::STATE_COMPLETED : MegaTransfer::STATE_CANCELLED);
         DBTableTransactionCommitter committer(client->tctable);
@@ -13490,6 +14420,13 @@ bool MegaApiImpl::sync_syncable(Sync *sync, const char *name, LocalPath& localpa
 
 void MegaApiImpl::sync_removed(handle backupId)
 {
+#ifdef USE_PCRE
+    {
+        std::lock_guard<std::mutex> g(mSyncRegExpsMutex);
+        mSyncRegExps.erase(backupId);
+    }
+#endif
+
     if (auto megaSync = cachedMegaSyncPrivateByBackupId(backupId))
     {
         fireonSyncDeleted(megaSync);
@@ -14006,7 +14943,7 @@ void MegaApiImpl::putnodes_result(const Error& inputErr, targettype_t t, vector<
                     }
                     request->setParentHandle(unifiedSync->mConfig.getBackupId());
 
-                    auto sync = ::mega::make_unique<MegaSyncPrivate>(unifiedSync->mConfig, unifiedSync->mSync.get(), client);
+                    auto sync = make_unique<MegaSyncPrivate>(unifiedSync->mConfig, unifiedSync->mSync.get(), client);
 
                     fireOnSyncAdded(sync.get(), e ? MegaSync::NEW_TEMP_DISABLED : MegaSync::NEW);
                 }
@@ -14784,6 +15721,7 @@ void MegaApiImpl::logout_result(error e)
         totalUploads = 0;
         totalDownloads = 0;
         waitingRequest = RETRY_NONE;
+        excludedLiteralNames.clear();
         excludedNames.clear();
         excludedPaths.clear();
         syncLowerSizeLimit = 0;
@@ -15092,8 +16030,49 @@ void MegaApiImpl::nodes_updated(Node** n, int count)
         return;
     }
 
+    updateNodePathCache(n, count);
+
+#ifdef HAVE_LIBUV
+    Node** allNodes = n;
+    int allCount = count;
+#endif
+
+    // the nodes removed with their parent, left out: the parent goes with all below it
+    node_vector subtreeTops;
+    if (n != NULL && subtreeRemovalNotifications)
+    {
+        subtreeTops.reserve(size_t(count));
+        for (int i = 0; i < count; i++)
+        {
+            if (!n[i]->changed.removed || !n[i]->parent || !n[i]->parent->changed.removed)
+            {
+                subtreeTops.push_back(n[i]);
+            }
+        }
+
+        assert(!subtreeTops.empty());
+        n = subtreeTops.data();
+        count = int(subtreeTops.size());
+    }
+
     MegaNodeList *nodeList = NULL;
-    if (n != NULL)
+    if (n != NULL && lightweightNodeUpdates)
+    {
+        vector<handle> handles;
+        vector<int64_t> changes;
+        handles.reserve(size_t(count));
+        changes.reserve(size_t(count));
+        for (int i = 0; i < count; i++)
+        {
+            handles.push_back(n[i]->nodehandle);
+            changes.push_back(MegaNodePrivate::changesOf(n[i]));
+        }
+
+        MegaHandleListPrivate handleList(handles);
+        MegaIntegerListPrivate changeList(changes);
+        fireOnNodesChanged(&handleList, &changeList);
+    }
+    else if (n != NULL)
     {
         nodeList = new MegaNodeListPrivate(n, count);
         fireOnNodesUpdate(nodeList);
@@ -15103,6 +16082,13 @@ void MegaApiImpl::nodes_updated(Node** n, int count)
         fireOnNodesUpdate(NULL);
     }
     delete nodeList;
+
+#ifdef HAVE_LIBUV
+    if (httpServer)
+    {
+        httpServer->nodesUpdated(allNodes, allCount);
+    }
+#endif
 }
 
 void MegaApiImpl::account_details(AccountDetails*, bool, bool, bool, bool, bool, bool)
@@ -16341,7 +17327,14 @@ void MegaApiImpl::removeListener(MegaListener* listener)
 
     sdkMutex.lock();
     listeners.erase(listener);
+    auto callbacks = transferCallbacks;
     sdkMutex.unlock();
+
+    // not waiting with the SDK locked: the callback running may be calling it
+    if (callbacks)
+    {
+        callbacks->removeListener(listener);
+    }
 }
 
 void MegaApiImpl::removeRequestListener(MegaRequestListener* listener)
@@ -16383,7 +17376,13 @@ void MegaApiImpl::removeTransferListener(MegaTransferListener* listener)
     }
 
     transferQueue.removeListener(listener);
+    auto callbacks = transferCallbacks;
     sdkMutex.unlock();
+
+    if (callbacks)
+    {
+        callbacks->removeListener(listener);
+    }
 }
 
 void MegaApiImpl::removeBackupListener(MegaBackupListener* listener)
@@ -16569,10 +17568,18 @@ void MegaApiImpl::fireOnRequestTemporaryError(MegaRequestPrivate *request, uniqu
 
 void MegaApiImpl::fireOnTransferStart(MegaTransferPrivate *transfer)
 {
+    flushTransferUpdates(true);
     activeTransfer = transfer;
     notificationNumber++;
     transfer->setNotificationNumber(notificationNumber);
 
+    if (transferCallbacks)
+    {
+        transferCallbacks->push(TransferCallbackDispatcher::START, transfer, nullptr, transferListeners, listeners);
+        activeTransfer = NULL;
+        return;
+    }
+
     for(set<MegaTransferListener *>::iterator it = transferListeners.begin(); it != transferListeners.end() ;)
     {
         (*it++)->onTransferStart(api, transfer);
@@ -16594,6 +17601,7 @@ void MegaApiImpl::fireOnTransferStart(MegaTransferPrivate *transfer)
 
 void MegaApiImpl::fireOnTransferFinish(MegaTransferPrivate *transfer, unique_ptr<MegaErrorPrivate> e, DBTableTransactionCommitter& committer)
 {
+    flushTransferUpdates(true);
     activeTransfer = transfer;
     activeError = e.get();
     notificationNumber++;
@@ -16615,20 +17623,27 @@ void MegaApiImpl::fireOnTransferFinish(MegaTransferPrivate *transfer, unique_ptr
         LOG_info << "Transfer (" << transfer->getTransferString() << ") finished. File: " << transfer->getFileName();
     }
 
-    for(set<MegaTransferListener *>::iterator it = transferListeners.begin(); it != transferListeners.end() ;)
+    if (transferCallbacks)
     {
-        (*it++)->onTransferFinish(api, transfer, e.get());
+        transferCallbacks->push(TransferCallbackDispatcher::FINISH, transfer, e.get(), transferListeners, listeners);
     }
-
-    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+    else
     {
-        (*it++)->onTransferFinish(api, transfer, e.get());
-    }
+        for(set<MegaTransferListener *>::iterator it = transferListeners.begin(); it != transferListeners.end() ;)
+        {
+            (*it++)->onTransferFinish(api, transfer, e.get());
+        }
 
-    MegaTransferListener* listener = transfer->getListener();
-    if(listener)
-    {
-        listener->onTransferFinish(api, transfer, e.get());
+        for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+        {
+            (*it++)->onTransferFinish(api, transfer, e.get());
+        }
+
+        MegaTransferListener* listener = transfer->getListener();
+        if(listener)
+        {
+            listener->onTransferFinish(api, transfer, e.get());
+        }
     }
 
     transferMap.erase(transfer->getTag());
@@ -16644,6 +17659,7 @@ void MegaApiImpl::fireOnTransferFinish(MegaTransferPrivate *transfer, unique_ptr
 
 void MegaApiImpl::fireOnTransferTemporaryError(MegaTransferPrivate *transfer, unique_ptr<MegaErrorPrivate> e)
 {
+    flushTransferUpdates(true);
     activeTransfer = transfer;
     activeError = e.get();
     notificationNumber++;
@@ -16651,6 +17667,14 @@ void MegaApiImpl::fireOnTransferTemporaryError(MegaTransferPrivate *transfer, un
 
     transfer->setNumRetry(transfer->getNumRetry() + 1);
 
+    if (transferCallbacks)
+    {
+        transferCallbacks->push(TransferCallbackDispatcher::TEMPORARY_ERROR, transfer, e.get(), transferListeners, listeners);
+        activeTransfer = NULL;
+        activeError = NULL;
+        return;
+    }
+
     for(set<MegaTransferListener *>::iterator it = transferListeners.begin(); it != transferListeners.end() ;)
     {
         (*it++)->onTransferTemporaryError(api, transfer, e.get());
@@ -16678,10 +17702,18 @@ MegaClient *MegaApiImpl::getMegaClient()
 
 void MegaApiImpl::fireOnTransferUpdate(MegaTransferPrivate *transfer)
 {
+    flushTransferUpdates(true);
     activeTransfer = transfer;
     notificationNumber++;
     transfer->setNotificationNumber(notificationNumber);
 
+    if (transferCallbacks)
+    {
+        transferCallbacks->push(TransferCallbackDispatcher::UPDATE, transfer, nullptr, transferListeners, listeners);
+        activeTransfer = NULL;
+        return;
+    }
+
     for(set<MegaTransferListener *>::iterator it = transferListeners.begin(); it != transferListeners.end() ;)
     {
         (*it++)->onTransferUpdate(api, transfer);
@@ -16701,6 +17733,35 @@ void MegaApiImpl::fireOnTransferUpdate(MegaTransferPrivate *transfer)
     activeTransfer = NULL;
 }
 
+void MegaApiImpl::fireOnTransfersUpdate(MegaTransferList *transfers)
+{
+    for(set<MegaTransferListener *>::iterator it = transferListeners.begin(); it != transferListeners.end() ;)
+    {
+        (*it++)->onTransfersUpdate(api, transfers);
+    }
+
+    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+    {
+        (*it++)->onTransfersUpdate(api, transfers);
+    }
+}
+
+bool MegaApiImpl::fireOnStreamingData(MegaTransferPrivate *transfer, char *buffer, m_off_t len, m_off_t speed, m_off_t meanSpeed)
+{
+    dstime currentTime = Waiter::ds;
+    transfer->setStartTime(currentTime);
+    transfer->setState(MegaTransfer::STATE_ACTIVE);
+    transfer->setUpdateTime(currentTime);
+    transfer->setDeltaSize(len);
+    transfer->setLastBytes(buffer);
+    transfer->setTransferredBytes(transfer->getTransferredBytes() + len);
+    transfer->setSpeed(speed);
+    transfer->setMeanSpeed(meanSpeed);
+
+    fireOnTransferUpdate(transfer);
+    return fireOnTransferData(transfer);
+}
+
 bool MegaApiImpl::fireOnTransferData(MegaTransferPrivate *transfer)
 {
     activeTransfer = transfer;
@@ -16782,6 +17843,18 @@ void MegaApiImpl::fireOnNodesUpdate(MegaNodeList *nodes)
     activeNodes = NULL;
 }
 
+void MegaApiImpl::fireOnNodesChanged(MegaHandleList *handles, MegaIntegerList *changes)
+{
+    for(set<MegaGlobalListener *>::iterator it = globalListeners.begin(); it != globalListeners.end() ;)
+    {
+        (*it++)->onNodesChanged(api, handles, changes);
+    }
+    for(set<MegaListener *>::iterator it = listeners.begin(); it != listeners.end() ;)
+    {
+        (*it++)->onNodesChanged(api, handles, changes);
+    }
+}
+
 void MegaApiImpl::fireOnAccountUpdate()
 {
     for(set<MegaGlobalListener *>::iterator it = globalListeners.begin(); it != globalListeners.end() ;)
@@ -17031,6 +18104,8 @@ void MegaApiImpl::processTransferPrepare(Transfer *t, MegaTransferPrivate *trans
 void MegaApiImpl::processTransferUpdate(Transfer *tr, MegaTransferPrivate *transfer)
 {
     dstime currentTime = Waiter::ds;
+    bool progressOnly = transfer->getState() == tr->state && transfer->getPriority() == tr->priority;
+
     if (tr->slot)
     {
         m_off_t prevTransferredBytes = transfer->getTransferredBytes();
@@ -17060,9 +18135,67 @@ void MegaApiImpl::processTransferUpdate(Transfer *tr, MegaTransferPrivate *trans
     transfer->setState(tr->state);
     transfer->setPriority(tr->priority);
     transfer->setUpdateTime(currentTime);
+
+    if (transferBatchInterval && progressOnly)
+    {
+        notificationNumber++;
+        transfer->setNotificationNumber(notificationNumber);
+
+        // the listener of the transfer itself gets every update (folder transfers follow their files that way)
+        if (transferCallbacks)
+        {
+            transferCallbacks->push(TransferCallbackDispatcher::UPDATE, transfer, nullptr, {}, {});
+        }
+        else if (MegaTransferListener* listener = transfer->getListener())
+        {
+            activeTransfer = transfer;
+            listener->onTransferUpdate(api, transfer);
+            activeTransfer = NULL;
+        }
+
+        pendingTransferUpdates.insert(transfer->getTag());
+        flushTransferUpdates(false);
+        return;
+    }
+
     fireOnTransferUpdate(transfer);
 }
 
+void MegaApiImpl::flushTransferUpdates(bool force)
+{
+    if (pendingTransferUpdates.empty()
+            || (!force && Waiter::ds - lastTransferBatch < transferBatchInterval))
+    {
+        return;
+    }
+
+    vector<MegaTransfer*> transfers;
+    for (int tag : pendingTransferUpdates)
+    {
+        if (MegaTransferPrivate* transfer = getMegaTransferPrivate(tag))
+        {
+            transfers.push_back(transfer);
+        }
+    }
+    pendingTransferUpdates.clear();
+    lastTransferBatch = Waiter::ds;
+
+    if (transfers.empty())
+    {
+        return;
+    }
+
+    unique_ptr<MegaTransferList> list(new MegaTransferListPrivate(transfers.data(), int(transfers.size())));
+    if (transferCallbacks)
+    {
+        transferCallbacks->push(std::move(list), transferListeners, listeners);
+    }
+    else
+    {
+        fireOnTransfersUpdate(list.get());
+    }
+}
+
 void MegaApiImpl::processTransferComplete(Transfer *tr, MegaTransferPrivate *transfer)
 {
     dstime currentTime = Waiter::ds;
@@ -17381,24 +18514,52 @@ void MegaApiImpl::sortByComparatorFunction(node_vector& v, int order, MegaClient
     }
 }
 
-bool MegaApiImpl::nodeNaturalComparatorASC(Node *i, Node *j)
+namespace {
+
+// sort just the elements from offset to last, those that would be there after a full sort
+template<typename Iterator, typename Compare>
+void sortPage(Iterator begin, Iterator end, size_t offset, size_t last, Compare compare)
 {
-    int r = naturalsorting_compare(i->displayname(), j->displayname());
-    if (r < 0)
+    if (offset)
     {
-        return 1;
+        std::nth_element(begin, begin + offset, end, compare);
     }
-    return 0;
+    std::partial_sort(begin + offset, begin + last, end, compare);
 }
 
-bool MegaApiImpl::nodeNaturalComparatorDESC(Node *i, Node *j)
+} // anonymous
+
+void MegaApiImpl::sortPageByComparatorFunction(node_vector& v, int order, MegaClient& mc, size_t offset, size_t count)
 {
-    int r = naturalsorting_compare(i->displayname(), j->displayname());
-    if (r <= 0)
+    if (offset >= v.size())
     {
-        return 0;
+        v.clear();
+        return;
     }
-    return 1;
+
+    size_t last = offset + std::min(count, v.size() - offset);
+
+    if (auto f = getComparatorFunction(order, mc))
+    {
+        // nodes equal for the order go by handle, so that they are on the same page every time
+        sortPage(v.begin(), v.end(), offset, last, [&f](Node* i, Node* j)
+        {
+            return f(i, j) || (!f(j, i) && i->nodehandle < j->nodehandle);
+        });
+    }
+
+    v.resize(last);
+    v.erase(v.begin(), v.begin() + offset);
+}
+
+bool MegaApiImpl::nodeNaturalComparatorASC(Node *i, Node *j)
+{
+    return i->sortkeys().name < j->sortkeys().name;
+}
+
+bool MegaApiImpl::nodeNaturalComparatorDESC(Node *i, Node *j)
+{
+    return i->sortkeys().name > j->sortkeys().name;
 }
 
 bool MegaApiImpl::nodeComparatorDefaultASC(Node *i, Node *j)
@@ -17610,20 +18771,8 @@ bool MegaApiImpl::nodeComparatorPublicLinkCreationDESC(Node *i, Node *j)
 
 bool MegaApiImpl::nodeComparatorLabelASC(Node *i, Node *j)
 {
-    nameid labelId = AttrMap::string2nameid("lbl");
-    int iLabel = MegaNode::NODE_LBL_UNKNOWN;
-    auto iAttrIt = i->attrs.map.find(labelId);
-    if (iAttrIt != i->attrs.map.end())
-    {
-       iLabel = std::atoi(iAttrIt->second.c_str());
-    }
-
-    int jLabel = MegaNode::NODE_LBL_UNKNOWN;
-    auto jAttrIt = j->attrs.map.find(labelId);
-    if (jAttrIt != j->attrs.map.end())
-    {
-       jLabel = std::atoi(jAttrIt->second.c_str());
-    }
+    int iLabel = i->sortkeys().label;
+    int jLabel = j->sortkeys().label;
 
     if (iLabel == MegaNode::NODE_LBL_UNKNOWN && jLabel ==  MegaNode::NODE_LBL_UNKNOWN)
     {
@@ -17651,20 +18800,8 @@ bool MegaApiImpl::nodeComparatorLabelASC(Node *i, Node *j)
 
 bool MegaApiImpl::nodeComparatorLabelDESC(Node *i, Node *j)
 {
-    nameid labelId = AttrMap::string2nameid("lbl");
-    int iLabel = MegaNode::NODE_LBL_UNKNOWN;
-    auto iAttrIt = i->attrs.map.find(labelId);
-    if (iAttrIt != i->attrs.map.end())
-    {
-       iLabel = std::atoi(iAttrIt->second.c_str());
-    }
-
-    int jLabel = MegaNode::NODE_LBL_UNKNOWN;
-    auto jAttrIt = j->attrs.map.find(labelId);
-    if (jAttrIt != j->attrs.map.end())
-    {
-       jLabel = std::atoi(jAttrIt->second.c_str());
-    }
+    int iLabel = i->sortkeys().label;
+    int jLabel = j->sortkeys().label;
 
     if (iLabel == MegaNode::NODE_LBL_UNKNOWN && jLabel == MegaNode::NODE_LBL_UNKNOWN)
     {
@@ -17693,9 +18830,8 @@ bool MegaApiImpl::nodeComparatorLabelDESC(Node *i, Node *j)
 
 bool MegaApiImpl::nodeComparatorFavASC(Node *i, Node *j)
 {
-    nameid favId = AttrMap::string2nameid("fav");
-    bool iFav = (i->attrs.map.find(favId) != i->attrs.map.end());
-    bool jFav = (j->attrs.map.find(favId) != j->attrs.map.end());
+    bool iFav = i->sortkeys().favourite;
+    bool jFav = j->sortkeys().favourite;
 
     if (!(iFav ^ jFav))
     {
@@ -17714,9 +18850,8 @@ bool MegaApiImpl::nodeComparatorFavASC(Node *i, Node *j)
 
 bool MegaApiImpl::nodeComparatorFavDESC(Node *i, Node *j)
 {
-    nameid favId = AttrMap::string2nameid("fav");
-    bool iFav = (i->attrs.map.find(favId) != i->attrs.map.end());
-    bool jFav = (j->attrs.map.find(favId) != j->attrs.map.end());
+    bool iFav = i->sortkeys().favourite;
+    bool jFav = j->sortkeys().favourite;
 
     if (!(iFav ^ jFav))
     {
@@ -17747,11 +18882,13 @@ int MegaApiImpl::typeComparator(Node *i, Node *j)
     return -1;
 }
 
-bool MegaApiImpl::nodeComparatorPhotoASC(Node *i, Node *j, MegaClient& mc)
+bool MegaApiImpl::nodeComparatorPhotoASC(Node *i, Node *j, MegaClient&)
 {
-    bool i_photo = false, i_video = false, j_photo = false, j_video = false;
-    bool i_media = mc.nodeIsMedia(i, &i_photo, &i_video);
-    bool j_media = mc.nodeIsMedia(j, &j_photo, &j_video);
+    const NodeSortKeys& iKeys = i->sortkeys();
+    const NodeSortKeys& jKeys = j->sortkeys();
+    bool i_photo = iKeys.photo, i_video = iKeys.video, j_photo = jKeys.photo, j_video = jKeys.video;
+    bool i_media = i_photo || i_video;
+    bool j_media = j_photo || j_video;
 
     if (i_media != j_media)
     {
@@ -17767,11 +18904,13 @@ bool MegaApiImpl::nodeComparatorPhotoASC(Node *i, Node *j, MegaClient& mc)
     return nodeComparatorModificationASC(i, j);
 }
 
-bool MegaApiImpl::nodeComparatorPhotoDESC(Node *i, Node *j, MegaClient& mc)
+bool MegaApiImpl::nodeComparatorPhotoDESC(Node *i, Node *j, MegaClient&)
 {
-    bool i_photo = false, i_video = false, j_photo = false, j_video = false;
-    bool i_media = mc.nodeIsMedia(i, &i_photo, &i_video);
-    bool j_media = mc.nodeIsMedia(j, &j_photo, &j_video);
+    const NodeSortKeys& iKeys = i->sortkeys();
+    const NodeSortKeys& jKeys = j->sortkeys();
+    bool i_photo = iKeys.photo, i_video = iKeys.video, j_photo = jKeys.photo, j_video = jKeys.video;
+    bool i_media = i_photo || i_video;
+    bool j_media = j_photo || j_video;
 
     if (i_media != j_media)
     {
@@ -17787,11 +18926,13 @@ bool MegaApiImpl::nodeComparatorPhotoDESC(Node *i, Node *j, MegaClient& mc)
     return nodeComparatorModificationDESC(i, j);
 }
 
-bool MegaApiImpl::nodeComparatorVideoASC(Node *i, Node *j, MegaClient& mc)
+bool MegaApiImpl::nodeComparatorVideoASC(Node *i, Node *j, MegaClient&)
 {
-    bool i_photo = false, i_video = false, j_photo = false, j_video = false;
-    bool i_media = mc.nodeIsMedia(i, &i_photo, &i_video);
-    bool j_media = mc.nodeIsMedia(j, &j_photo, &j_video);
+    const NodeSortKeys& iKeys = i->sortkeys();
+    const NodeSortKeys& jKeys = j->sortkeys();
+    bool i_photo = iKeys.photo, i_video = iKeys.video, j_photo = jKeys.photo, j_video = jKeys.video;
+    bool i_media = i_photo || i_video;
+    bool j_media = j_photo || j_video;
 
     if (i_media != j_media)
     {
@@ -17807,11 +18948,13 @@ bool MegaApiImpl::nodeComparatorVideoASC(Node *i, Node *j, MegaClient& mc)
     return nodeComparatorModificationASC(i, j);
 }
 
-bool MegaApiImpl::nodeComparatorVideoDESC(Node *i, Node *j, MegaClient& mc)
+bool MegaApiImpl::nodeComparatorVideoDESC(Node *i, Node *j, MegaClient&)
 {
-    bool i_photo = false, i_video = false, j_photo = false, j_video = false;
-    bool i_media = mc.nodeIsMedia(i, &i_photo, &i_video);
-    bool j_media = mc.nodeIsMedia(j, &j_photo, &j_video);
+    const NodeSortKeys& iKeys = i->sortkeys();
+    const NodeSortKeys& jKeys = j->sortkeys();
+    bool i_photo = iKeys.photo, i_video = iKeys.video, j_photo = jKeys.photo, j_video = jKeys.video;
+    bool i_media = i_photo || i_video;
+    bool j_media = j_photo || j_video;
 
     if (i_media != j_media)
     {
@@ -17834,16 +18977,17 @@ int MegaApiImpl::getNumChildren(MegaNode* p)
         return 0;
     }
 
-    sdkMutex.lock();
+    sdkMutex.lock_shared();
     Node *parent = client->nodebyhandle(p->getHandle());
     if (!parent || parent->type == FILENODE)
     {
-        sdkMutex.unlock();
+        sdkMutex.unlock_shared();
         return 0;
     }
 
+    client->loadchildren(parent);
     int numChildren = int(parent->children.size());
-    sdkMutex.unlock();
+    sdkMutex.unlock_shared();
 
     return numChildren;
 }
@@ -17855,21 +18999,17 @@ int MegaApiImpl::getNumChildFiles(MegaNode* p)
         return 0;
     }
 
-    sdkMutex.lock();
+    sdkMutex.lock_shared();
     Node *parent = client->nodebyhandle(p->getHandle());
     if (!parent || parent->type == FILENODE)
     {
-        sdkMutex.unlock();
+        sdkMutex.unlock_shared();
         return 0;
     }
 
-    int numFiles = 0;
-    for (node_list::iterator it = parent->children.begin(); it != parent->children.end(); it++)
-    {
-        if ((*it)->type == FILENODE)
-            numFiles++;
-    }
-    sdkMutex.unlock();
+    client->loadchildren(parent);
+    int numFiles = int(parent->children.numFiles());
+    sdkMutex.unlock_shared();
 
     return numFiles;
 }
@@ -17881,21 +19021,17 @@ int MegaApiImpl::getNumChildFolders(MegaNode* p)
         return 0;
     }
 
-    sdkMutex.lock();
+    sdkMutex.lock_shared();
     Node *parent = client->nodebyhandle(p->getHandle());
     if (!parent || parent->type == FILENODE)
     {
-        sdkMutex.unlock();
+        sdkMutex.unlock_shared();
         return 0;
     }
 
-    int numFolders = 0;
-    for (node_list::iterator it = parent->children.begin(); it != parent->children.end(); it++)
-    {
-        if ((*it)->type != FILENODE)
-            numFolders++;
-    }
-    sdkMutex.unlock();
+    client->loadchildren(parent);
+    int numFolders = int(parent->children.numFolders());
+    sdkMutex.unlock_shared();
 
     return numFolders;
 }
@@ -17910,13 +19046,14 @@ MegaNodeList *MegaApiImpl::getChildren(MegaNode* p, int order)
 
     node_vector childrenNodes;
 
-    SdkMutexGuard guard(sdkMutex);
+    SdkSharedGuard guard(sdkMutex);
 
     Node *parent = client->nodebyhandle(p->getHandle());
     if (parent && parent->type != FILENODE)
     {
+        client->loadchildren(parent);
         childrenNodes.reserve(parent->children.size());
-        for (node_list::iterator it = parent->children.begin(); it != parent->children.end(); )
+        for (auto it = parent->children.begin(); it != parent->children.end(); )
         {
             childrenNodes.push_back(*it++);
         }
@@ -17928,6 +19065,27 @@ MegaNodeList *MegaApiImpl::getChildren(MegaNode* p, int order)
     return new MegaNodeListPrivate(childrenNodes.data(), int(childrenNodes.size()));
 }
 
+MegaNodeList *MegaApiImpl::getChildren(MegaNode *p, int order, int offset, int limit)
+{
+    if (!p || p->getType() == MegaNode::TYPE_FILE || offset < 0 || limit <= 0)
+    {
+        return new MegaNodeListPrivate();
+    }
+
+    node_vector childrenNodes;
+
+    SdkSharedGuard guard(sdkMutex);
+
+    Node *parent = client->nodebyhandle(p->getHandle());
+    if (parent && parent->type != FILENODE)
+    {
+        client->loadchildren(parent);
+        childrenNodes.assign(parent->children.begin(), parent->children.end());
+        sortPageByComparatorFunction(childrenNodes, order, *client, size_t(offset), size_t(limit));
+    }
+    return new MegaNodeListPrivate(childrenNodes.data(), int(childrenNodes.size()));
+}
+
 MegaNodeList *MegaApiImpl::getVersions(MegaNode *node)
 {
     if (!node || node->getType() != MegaNode::TYPE_FILE)
@@ -17935,18 +19093,25 @@ MegaNodeList *MegaApiImpl::getVersions(MegaNode *node)
         return new MegaNodeListPrivate();
     }
 
-    sdkMutex.lock();
+    sdkMutex.lock_shared();
     Node *current = client->nodebyhandle(node->getHandle());
     if (!current || current->type != FILENODE)
     {
-        sdkMutex.unlock();
+        sdkMutex.unlock_shared();
         return new MegaNodeListPrivate();
     }
 
     vector<Node*> versions;
     versions.push_back(current);
-    while (current->children.size())
+    for (;;)
     {
+        // lazyversions may have left the older ones in the local cache
+        client->loadchildren(current);
+        if (!current->children.size())
+        {
+            break;
+        }
+
         assert(current->children.back()->parent == current);
         current = current->children.back();
         assert(current->type == FILENODE);
@@ -17954,7 +19119,7 @@ MegaNodeList *MegaApiImpl::getVersions(MegaNode *node)
     }
 
     MegaNodeListPrivate *result = new MegaNodeListPrivate(versions.data(), int(versions.size()));
-    sdkMutex.unlock();
+    sdkMutex.unlock_shared();
     return result;
 }
 
@@ -17965,23 +19130,17 @@ int MegaApiImpl::getNumVersions(MegaNode *node)
         return 0;
     }
 
-    sdkMutex.lock();
+    sdkMutex.lock_shared();
     Node *current = client->nodebyhandle(node->getHandle());
     if (!current || current->type != FILENODE)
     {
-        sdkMutex.unlock();
+        sdkMutex.unlock_shared();
         return 0;
     }
 
-    int numVersions = 1;
-    while (current->children.size())
-    {
-        assert(current->children.back()->parent == current);
-        current = current->children.back();
-        assert(current->type == FILENODE);
-        numVersions++;
-    }
-    sdkMutex.unlock();
+    // the file and those below it, including any versions left in the local cache
+    int numVersions = int(current->subnodeCounts().files);
+    sdkMutex.unlock_shared();
     return numVersions;
 }
 
@@ -17992,11 +19151,11 @@ bool MegaApiImpl::hasVersions(MegaNode *node)
         return false;
     }
 
-    sdkMutex.lock();
+    sdkMutex.lock_shared();
     Node *current = client->nodebyhandle(node->getHandle());
     if (!current || current->type != FILENODE)
     {
-        sdkMutex.unlock();
+        sdkMutex.unlock_shared();
         return false;
     }
 
@@ -18004,8 +19163,8 @@ bool MegaApiImpl::hasVersions(MegaNode *node)
            || (current->children.back()->parent == current
                && current->children.back()->type == FILENODE));
 
-    bool result = current->children.size() != 0;
-    sdkMutex.unlock();
+    bool result = current->children.size() != 0 || client->lazyindex.haschildren(current->nodehandle);
+    sdkMutex.unlock_shared();
     return result;
 }
 
@@ -18027,7 +19186,7 @@ MegaChildrenLists *MegaApiImpl::getFileFolderChildren(MegaNode *p, int order)
         return new MegaChildrenListsPrivate();
     }
 
-    SdkMutexGuard guard(sdkMutex);
+    SdkSharedGuard guard(sdkMutex);
 
     Node *parent = client->nodebyhandle(p->getHandle());
     if (!parent || parent->type == FILENODE)
@@ -18035,10 +19194,12 @@ MegaChildrenLists *MegaApiImpl::getFileFolderChildren(MegaNode *p, int order)
         return new MegaChildrenListsPrivate();
     }
 
+    client->loadchildren(parent);
+
     node_vector files;
     node_vector folders;
 
-    for (node_list::iterator it = parent->children.begin(); it != parent->children.end(); )
+    for (auto it = parent->children.begin(); it != parent->children.end(); )
     {
         Node *n = *it++;
         if (n->type == FILENODE)
@@ -18068,16 +19229,16 @@ bool MegaApiImpl::hasChildren(MegaNode *parent)
         return false;
     }
 
-    sdkMutex.lock();
+    sdkMutex.lock_shared();
     Node *p = client->nodebyhandle(parent->getHandle());
     if (!p || p->type == FILENODE)
     {
-        sdkMutex.unlock();
+        sdkMutex.unlock_shared();
         return false;
     }
 
-    bool ret = p->children.size();
-    sdkMutex.unlock();
+    bool ret = p->children.size() || client->lazyindex.haschildren(p->nodehandle);
+    sdkMutex.unlock_shared();
 
     return ret;
 }
@@ -18283,6 +19444,27 @@ char* MegaApiImpl::getNodePathByNodeHandle(MegaHandle handle)
     return MegaApi::strdup(n->displaypath().c_str());
 }
 
+void MegaApiImpl::updateNodePathCache(Node** n, int count)
+{
+    if (nodePathCache.empty())
+    {
+        return;
+    }
+
+    // after fetchnodes, everything is new
+    bool changed = !n;
+    for (int i = 0; !changed && i < count; i++)
+    {
+        changed = n[i]->changed.removed || n[i]->changed.parent
+                || n[i]->changed.attrs || n[i]->changed.newnode;
+    }
+
+    if (changed)
+    {
+        nodePathCache.clear();
+    }
+}
+
 MegaNode* MegaApiImpl::getNodeByPath(const char *path, MegaNode* node)
 {
     if(!path) return NULL;
@@ -18291,6 +19473,23 @@ MegaNode* MegaApiImpl::getNodeByPath(const char *path, MegaNode* node)
     Node *cwd = NULL;
     if(node) cwd = client->nodebyhandle(node->getHandle());
 
+    handle cwdHandle = cwd ? cwd->nodehandle : UNDEF;
+    string cacheKey(reinterpret_cast<const char*>(&cwdHandle), sizeof cwdHandle);
+    cacheKey.append(path);
+
+    auto cached = nodePathCache.find(cacheKey);
+    if (cached != nodePathCache.end())
+    {
+        Node* found = nullptr;
+        if (cached->second == UNDEF || (found = client->nodebyhandle(cached->second)))
+        {
+            MegaNode *result = MegaNodePrivate::fromNode(found);
+            sdkMutex.unlock();
+            return result;
+        }
+        nodePathCache.erase(cached);
+    }
+
     vector<string> c;
     string s;
     int l = 0;
@@ -18299,6 +19498,20 @@ MegaNode* MegaApiImpl::getNodeByPath(const char *path, MegaNode* node)
     Node* n = nullptr;
     Node* nn;
 
+    auto remember = [&](Node* found)
+    {
+        if (remote)
+        {
+            return;
+        }
+
+        if (nodePathCache.size() >= MAXNODEPATHCACHE)
+        {
+            nodePathCache.clear();
+        }
+        nodePathCache[cacheKey] = found ? found->nodehandle : UNDEF;
+    };
+
     // split path by / or :
     do {
         if (!l)
@@ -18475,6 +19688,7 @@ MegaNode* MegaApiImpl::getNodeByPath(const char *path, MegaNode* node)
 
                     if (!nn)
                     {
+                        remember(nullptr);
                         sdkMutex.unlock();
                         return NULL;
                     }
@@ -18487,6 +19701,8 @@ MegaNode* MegaApiImpl::getNodeByPath(const char *path, MegaNode* node)
         l++;
     }
 
+    remember(n);
+
     MegaNode *result = MegaNodePrivate::fromNode(n);
     sdkMutex.unlock();
     return result;
@@ -18495,12 +19711,26 @@ MegaNode* MegaApiImpl::getNodeByPath(const char *path, MegaNode* node)
 MegaNode* MegaApiImpl::getNodeByHandle(handle handle)
 {
     if(handle == UNDEF) return NULL;
-    sdkMutex.lock();
+    sdkMutex.lock_shared();
     MegaNode *result = MegaNodePrivate::fromNode(client->nodebyhandle(handle));
-    sdkMutex.unlock();
+    sdkMutex.unlock_shared();
     return result;
 }
 
+MegaNodeList* MegaApiImpl::getNodesByHandles(MegaHandleList *handles)
+{
+    node_vector nodes;
+    SdkSharedGuard g(sdkMutex);
+    for (unsigned i = 0; handles && i < handles->size(); i++)
+    {
+        if (Node* n = client->nodebyhandle(handles->get(i)))
+        {
+            nodes.push_back(n);
+        }
+    }
+    return new MegaNodeListPrivate(nodes);
+}
+
 MegaContactRequest *MegaApiImpl::getContactRequestByHandle(MegaHandle handle)
 {
     sdkMutex.lock();
@@ -18531,9 +19761,23 @@ unsigned MegaApiImpl::sendPendingTransfers()
     SdkMutexGuard guard(sdkMutex);
     DBTableTransactionCommitter committer(client->tctable);
 
+    if (client->asyncfingerprints)
+    {
+        // the uploads coming up are fingerprinted on the worker threads meanwhile
+        transferQueue.peek(AsyncFingerprinter::LOOKAHEAD, [this](MegaTransferPrivate* transfer)
+        {
+            if (transfer->getType() == MegaTransfer::TYPE_UPLOAD && transfer->getPath())
+            {
+                string path = transfer->getPath();
+                client->fingerprinter.request(LocalPath::fromPath(path, *client->fsaccess), fsAccess->newfileaccess());
+            }
+        });
+    }
+
     while(MegaTransferPrivate *transfer = transferQueue.pop())
     {
         error e = API_OK;
+        bool fingerprinting = false;
         int nextTag = client->nextreqtag();
         transfer->setState(MegaTransfer::STATE_QUEUED);
 
@@ -18561,14 +19805,52 @@ unsigned MegaApiImpl::sendPendingTransfers()
                 string tmpString = localPath;
                 auto wLocalPath = LocalPath::fromPath(tmpString, *client->fsaccess);
 
-                auto fa = fsAccess->newfileaccess();
-                if (!fa->fopen(wLocalPath, true, false))
+                // what was found at the path, by a worker thread or here
+                AsyncFingerprinter::Result found;
+                switch (client->fingerprinter.take(wLocalPath, found))
+                {
+                    case AsyncFingerprinter::PENDING:
+                        fingerprinting = true;
+                        break;
+
+                    case AsyncFingerprinter::NOT_REQUESTED:
+                    {
+                        auto fa = fsAccess->newfileaccess();
+                        if ((found.opened = fa->fopen(wLocalPath, true, false)))
+                        {
+                            found.type = fa->type;
+                            found.size = fa->size;
+                            if (found.type == FILENODE)
+                            {
+                                if (client->cachefingerprints)
+                                {
+                                    client->fingerprintcache.genfingerprint(wLocalPath, fa.get(), found.fingerprint);
+                                }
+                                else
+                                {
+                                    found.fingerprint.genfingerprint(fa.get());
+                                }
+                            }
+                        }
+                        break;
+                    }
+
+                    case AsyncFingerprinter::DONE:
+                        break;
+                }
+
+                if (fingerprinting)
+                {
+                    break;
+                }
+
+                if (!found.opened)
                 {
                     e = API_EREAD;
                     break;
                 }
 
-                nodetype_t type = fa->type;
+                nodetype_t type = found.type;
                 if (type == FOLDERNODE && uploadToInbox)
                 {
                     //Folder upload is not possible when sending to Inbox:
@@ -18577,13 +19859,8 @@ unsigned MegaApiImpl::sendPendingTransfers()
                     e = API_EREAD;
                     break;
                 }
-                m_off_t size = fa->size;
-                FileFingerprint fp;
-                if (type == FILENODE)
-                {
-                    fp.genfingerprint(fa.get());
-                }
-                fa.reset();
+                m_off_t size = found.size;
+                FileFingerprint& fp = found.fingerprint;
 
                 if (type == FILENODE)
                 {
@@ -18993,6 +20270,13 @@ unsigned MegaApiImpl::sendPendingTransfers()
             }
         }
 
+        if (fingerprinting)
+        {
+            // back where it was, for when its fingerprint is ready (a worker wakes us up)
+            transferQueue.push_front(transfer);
+            break;
+        }
+
         if (e)
         {
             transferMap[nextTag] = transfer;
@@ -19184,6 +20468,9 @@ void MegaApiImpl::sendPendingRequests()
     int lastRequestType = -1;
     int lastRequestConsecutive = 0;
 
+    // a burst of requests is started in rounds, so that the client gets to run meanwhile
+    unsigned count = 0;
+    auto t0 = std::chrono::steady_clock::now();
 
     while(MegaRequestPrivate *request = requestQueue.pop())
     {
@@ -19667,6 +20954,15 @@ void MegaApiImpl::sendPendingRequests()
 
                 // determine number of nodes to be copied
                 client->proctree(node, &tc, false, ovhandle != UNDEF);
+
+                if (target && node->type != FILENODE && tc.nc > unsigned(MegaClient::MAX_NEWNODES))
+                {
+                    // too large for a single putnodes
+                    auto copy = std::make_shared<MegaFolderCopyController>(this, request->getTag(), target->nodehandle, newName ? sname : string());
+                    copy->start(node);
+                    break;
+                }
+
                 tc.allocnodes();
 
                 // build new nodes array
@@ -19925,6 +21221,9 @@ void MegaApiImpl::sendPendingRequests()
                 nocache = false;
             }
 
+            // node lookups can materialize nodes from the cache (see MegaClient::lazynodes)
+            sdkMutex.setexclusive(client->lazynodes || client->lazyversions);
+
             client->fetchnodes();
             break;
         }
@@ -20547,6 +21846,7 @@ void MegaApiImpl::sendPendingRequests()
 
                         e = client->setattr(current);
 
+                        client->loadchildren(current);
                         if (current->type != FILENODE || !current->children.size())
                         {
                             // If node is a folder or doesn't have any versions
@@ -21682,7 +22982,7 @@ void MegaApiImpl::sendPendingRequests()
                     }
                     request->setParentHandle(unifiedSync->mConfig.getBackupId());
 
-                    auto sync = ::mega::make_unique<MegaSyncPrivate>(unifiedSync->mConfig, unifiedSync->mSync.get(), client);
+                    auto sync = make_unique<MegaSyncPrivate>(unifiedSync->mConfig, unifiedSync->mSync.get(), client);
 
                     fireOnSyncAdded(sync.get(), e ? MegaSync::NEW_TEMP_DISABLED : MegaSync::NEW);
                 }
@@ -22819,11 +24119,11 @@ void MegaApiImpl::sendPendingRequests()
                 break;
             }
 
-            TreeProcFolderInfo folderProcessor;
-            client->proctree(node, &folderProcessor, false, false);
-            MegaFolderInfo *folderInfo = folderProcessor.getResult();
-            request->setMegaFolderInfo(folderInfo);
-            delete folderInfo;
+            // the counts include the node itself, and versions among the files
+            NodeCounter nc = node->subnodeCounts();
+            MegaFolderInfoPrivate folderInfo(int(nc.files - nc.versions), int(nc.folders) - (node->type == FOLDERNODE),
+                                             int(nc.versions), nc.storage - nc.versionStorage, nc.versionStorage);
+            request->setMegaFolderInfo(&folderInfo);
 
             fireOnRequestFinish(request, make_unique<MegaErrorPrivate>(API_OK));
             break;
@@ -23184,6 +24484,13 @@ void MegaApiImpl::sendPendingRequests()
 #ifdef ENABLE_SYNC
         client->syncs.syncConfigDBFlush();
 #endif
+
+        if (++count >= 1000 || std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count() > 100)
+        {
+            // the rest in the next round
+            waiter->notify();
+            break;
+        }
     }
 }
 
@@ -23554,49 +24861,101 @@ TransferQueue::TransferQueue()
 
 void TransferQueue::push(MegaTransferPrivate *transfer)
 {
-    mutex.lock();
-    transfers.push_back(transfer);
     transfer->setPlaceInQueue(++lastPushedTransferTag);
-    mutex.unlock();
+    incoming.push(std::move(transfer));
+}
+
+void TransferQueue::push(vector<MegaTransferPrivate *> &&transfers)
+{
+    // consecutive places for all of them
+    int place = lastPushedTransferTag.fetch_add(int(transfers.size()));
+    for (MegaTransferPrivate *transfer : transfers)
+    {
+        transfer->setPlaceInQueue(++place);
+        incoming.push(std::move(transfer));
+    }
+    transfers.clear();
+}
+
+void TransferQueue::takeIncoming()
+{
+    MegaTransferPrivate *transfer;
+    while (incoming.pop(transfer))
+    {
+        insert(transfers.end(), transfer);
+    }
+}
+
+void TransferQueue::insert(transfer_list::iterator before, MegaTransferPrivate *transfer)
+{
+    positions[transfer] = transfers.insert(before, transfer);
+
+    if (int folderTag = transfer->getFolderTransferTag())
+    {
+        FolderTransfers& f = folderTransfers[folderTag];
+        f.transfers.push_back(transfer);
+        f.queued++;
+    }
+}
+
+TransferQueue::transfer_list::iterator TransferQueue::erase(transfer_list::iterator it)
+{
+    MegaTransferPrivate *transfer = *it;
+    positions.erase(transfer);
+
+    if (int folderTag = transfer->getFolderTransferTag())
+    {
+        auto f = folderTransfers.find(folderTag);
+        if (f != folderTransfers.end() && !--f->second.queued)
+        {
+            folderTransfers.erase(f);
+        }
+    }
+
+    return transfers.erase(it);
 }
 
 void TransferQueue::push_front(MegaTransferPrivate *transfer)
 {
-    mutex.lock();
-    transfers.push_front(transfer);
-    mutex.unlock();
+    insert(transfers.begin(), transfer);
 }
 
 MegaTransferPrivate *TransferQueue::pop()
 {
-    mutex.lock();
+    takeIncoming();
     if(transfers.empty())
     {
-        mutex.unlock();
         return NULL;
     }
     MegaTransferPrivate *transfer = transfers.front();
-    transfers.pop_front();
-    mutex.unlock();
+    erase(transfers.begin());
     return transfer;
 }
 
+void TransferQueue::peek(size_t count, std::function<void(MegaTransferPrivate *)> f)
+{
+    takeIncoming();
+    size_t i = 0;
+    for (auto it = transfers.begin(); i < count && it != transfers.end(); ++it, ++i)
+    {
+        f(*it);
+    }
+}
+
 std::vector<MegaTransferPrivate *> TransferQueue::popUpTo(int lastQueuedTransfer, int direction)
 {
-    std::lock_guard<std::mutex> g(mutex);
+    takeIncoming();
     std::vector<MegaTransferPrivate*> toret;
+
+    // the places follow the order of the queue only roughly (threads push at once), so all of it is looked at
     for (auto it = transfers.begin(); it != transfers.end();)
     {
         MegaTransferPrivate *transfer = *it;
-        if (transfer->getPlaceInQueue() > lastQueuedTransfer)
-        {
-            break;
-        }
-
-        if (!transfer->isSyncTransfer() && transfer->getType() == direction)
+        if (transfer->getPlaceInQueue() <= lastQueuedTransfer
+                && !transfer->isSyncTransfer() && transfer->getType() == direction)
         {
             toret.push_back(transfer);
-            it = transfers.erase(it);
+            it = erase(it);
         }
         else
         {
@@ -23608,37 +24967,44 @@ std::vector<MegaTransferPrivate *> TransferQueue::popUpTo(int lastQueuedTransfer
 
 void TransferQueue::removeWithFolderTag(int folderTag, std::function<void(MegaTransferPrivate *)> callback)
 {
-    for (auto it = transfers.begin(); it != transfers.end();)
+    takeIncoming();
+
+    auto f = folderTransfers.find(folderTag);
+    if (f == folderTransfers.end())
+    {
+        return;
+    }
+
+    vector<MegaTransferPrivate *> candidates = std::move(f->second.transfers);
+    folderTransfers.erase(f);
+
+    for (MegaTransferPrivate *transfer : candidates)
     {
-        if ((*it)->getFolderTransferTag() == folderTag)
+        auto position = positions.find(transfer);
+        if (position == positions.end() || transfer->getFolderTransferTag() != folderTag)
         {
-            if (callback)
-            {
-                callback(*it);
-            }
-            it = transfers.erase(it);
+            // left the queue already
+            continue;
         }
-        else
+
+        transfers.erase(position->second);
+        positions.erase(position);
+
+        if (callback)
         {
-            it++;
+            callback(transfer);
         }
     }
 }
 
 void TransferQueue::removeListener(MegaTransferListener *listener)
 {
-    mutex.lock();
-
-    std::deque<MegaTransferPrivate *>::iterator it = transfers.begin();
-    while(it != transfers.end())
+    takeIncoming();
+    for (MegaTransferPrivate *transfer : transfers)
     {
-        MegaTransferPrivate *transfer = (*it);
         if(transfer->getListener() == listener)
             transfer->setListener(NULL);
-        it++;
     }
-
-    mutex.unlock();
 }
 
 RequestQueue::RequestQueue()
@@ -23647,75 +25013,258 @@ RequestQueue::RequestQueue()
 
 void RequestQueue::push(MegaRequestPrivate *request)
 {
-    mutex.lock();
-    requests.push_back(request);
-    mutex.unlock();
+    incoming.push(std::move(request));
+}
+
+void RequestQueue::takeIncoming()
+{
+    MegaRequestPrivate *request;
+    while (incoming.pop(request))
+    {
+        requests.push_back(request);
+    }
 }
 
 void RequestQueue::push_front(MegaRequestPrivate *request)
 {
-    mutex.lock();
     requests.push_front(request);
-    mutex.unlock();
 }
 
 MegaRequestPrivate *RequestQueue::pop()
 {
-    mutex.lock();
+    takeIncoming();
     if(requests.empty())
     {
-        mutex.unlock();
         return NULL;
     }
     MegaRequestPrivate *request = requests.front();
     requests.pop_front();
-    mutex.unlock();
     return request;
 }
 
 MegaRequestPrivate *RequestQueue::front()
 {
-    mutex.lock();
+    takeIncoming();
     if(requests.empty())
     {
-        mutex.unlock();
         return NULL;
     }
-    MegaRequestPrivate *request = requests.front();
-    mutex.unlock();
-    return request;
+    return requests.front();
 }
 
 void RequestQueue::removeListener(MegaRequestListener *listener)
 {
-    mutex.lock();
-
-    std::deque<MegaRequestPrivate *>::iterator it = requests.begin();
-    while(it != requests.end())
+    takeIncoming();
+    for (MegaRequestPrivate *request : requests)
     {
-        MegaRequestPrivate *request = (*it);
         if(request->getListener()==listener)
             request->setListener(NULL);
-        it++;
     }
-
-    mutex.unlock();
 }
 
 void RequestQueue::removeListener(MegaBackupListener *listener)
 {
-    mutex.lock();
-
-    std::deque<MegaRequestPrivate *>::iterator it = requests.begin();
-    while(it != requests.end())
+    takeIncoming();
+    for (MegaRequestPrivate *request : requests)
     {
-        MegaRequestPrivate *request = (*it);
         if(request->getBackupListener()==listener)
             request->setBackupListener(NULL);
-        it++;
     }
+}
 
-    mutex.unlock();
+TransferCallbackDispatcher::TransferCallbackDispatcher(MegaApi* api)
+    : api(api)
+{
+    thread = std::thread([this]()
+    {
+        ThreadConfig::apply(THREAD_ROLE_SDK);
+        loop();
+    });
+}
+
+TransferCallbackDispatcher::~TransferCallbackDispatcher()
+{
+    assert(thread.get_id() != std::this_thread::get_id());
+    {
+        std::lock_guard<std::mutex> g(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    thread.join();
+}
+
+void TransferCallbackDispatcher::push(Event event, MegaTransferPrivate* transfer, MegaError* error,
+                                      const set<MegaTransferListener*>& transferListeners, const set<MegaListener*>& listeners)
+{
+    std::unique_lock<std::mutex> g(mutex);
+
+    if (event == UPDATE)
+    {
+        auto it = updates.find(transfer->getTag());
+        if (it != updates.end())
+        {
+            // not delivered yet: the listeners will only see the latest state
+            it->second->transfer.reset(transfer->copy());
+            return;
+        }
+
+        if (items.size() >= MAXQUEUED)
+        {
+            return;
+        }
+    }
+
+    unique_ptr<Item> item(new Item);
+    item->event = event;
+    item->tag = transfer->getTag();
+    item->transfer.reset(transfer->copy());
+    item->error.reset(error ? error->copy() : nullptr);
+    item->transferListeners.assign(transferListeners.begin(), transferListeners.end());
+    item->listeners.assign(listeners.begin(), listeners.end());
+    item->listener = transfer->getListener();
+
+    if (event == UPDATE)
+    {
+        updates[item->tag] = item.get();
+    }
+    else
+    {
+        // an update queued before this event must not be replaced by one that comes after it
+        updates.erase(item->tag);
+    }
+
+    items.push_back(std::move(item));
+    g.unlock();
+    condition.notify_all();
+}
+
+void TransferCallbackDispatcher::push(unique_ptr<MegaTransferList> transfers,
+                                      const set<MegaTransferListener*>& transferListeners, const set<MegaListener*>& listeners)
+{
+    unique_ptr<Item> item(new Item);
+    item->event = BATCH;
+    item->tag = 0;
+    item->transfers = std::move(transfers);
+    item->transferListeners.assign(transferListeners.begin(), transferListeners.end());
+    item->listeners.assign(listeners.begin(), listeners.end());
+    item->listener = nullptr;
+
+    std::unique_lock<std::mutex> g(mutex);
+    items.push_back(std::move(item));
+    g.unlock();
+    condition.notify_all();
+}
+
+void TransferCallbackDispatcher::removeListener(MegaTransferListener* listener)
+{
+    std::unique_lock<std::mutex> g(mutex);
+    for (auto& item : items)
+    {
+        auto& v = item->transferListeners;
+        v.erase(std::remove(v.begin(), v.end(), listener), v.end());
+        if (item->listener == listener)
+        {
+            item->listener = nullptr;
+        }
+    }
+    waitIdle(g);
+}
+
+void TransferCallbackDispatcher::removeListener(MegaListener* listener)
+{
+    std::unique_lock<std::mutex> g(mutex);
+    for (auto& item : items)
+    {
+        auto& v = item->listeners;
+        v.erase(std::remove(v.begin(), v.end(), listener), v.end());
+    }
+    waitIdle(g);
+}
+
+void TransferCallbackDispatcher::waitIdle(std::unique_lock<std::mutex>& lock)
+{
+    if (thread.get_id() != std::this_thread::get_id())
+    {
+        condition.wait(lock, [this]() { return !delivering; });
+    }
+}
+
+void TransferCallbackDispatcher::loop()
+{
+    std::unique_lock<std::mutex> g(mutex);
+    for (;;)
+    {
+        condition.wait(g, [this]() { return stopping || !items.empty(); });
+        if (items.empty())
+        {
+            return;
+        }
+
+        unique_ptr<Item> item = std::move(items.front());
+        items.pop_front();
+        if (item->event == UPDATE)
+        {
+            updates.erase(item->tag);
+        }
+
+        delivering = true;
+        g.unlock();
+        deliver(*item);
+        g.lock();
+        delivering = false;
+        condition.notify_all();
+    }
+}
+
+void TransferCallbackDispatcher::deliver(Item& item)
+{
+    MegaTransfer* transfer = item.transfer.get();
+    MegaError* error = item.error.get();
+
+    // in the order of the synchronous callbacks: the transfer listeners, the others, and that of the transfer
+    auto forAll = [&item](const std::function<void(MegaTransferListener*)>& f, const std::function<void(MegaListener*)>& g)
+    {
+        for (auto l : item.transferListeners)
+        {
+            f(l);
+        }
+        for (auto l : item.listeners)
+        {
+            g(l);
+        }
+        if (item.listener)
+        {
+            f(item.listener);
+        }
+    };
+
+    switch (item.event)
+    {
+        case START:
+            forAll([&](MegaTransferListener* l) { l->onTransferStart(api, transfer); },
+                   [&](MegaListener* l) { l->onTransferStart(api, transfer); });
+            break;
+
+        case UPDATE:
+            forAll([&](MegaTransferListener* l) { l->onTransferUpdate(api, transfer); },
+                   [&](MegaListener* l) { l->onTransferUpdate(api, transfer); });
+            break;
+
+        case FINISH:
+            forAll([&](MegaTransferListener* l) { l->onTransferFinish(api, transfer, error); },
+                   [&](MegaListener* l) { l->onTransferFinish(api, transfer, error); });
+            break;
+
+        case TEMPORARY_ERROR:
+            forAll([&](MegaTransferListener* l) { l->onTransferTemporaryError(api, transfer, error); },
+                   [&](MegaListener* l) { l->onTransferTemporaryError(api, transfer, error); });
+            break;
+
+        case BATCH:
+            forAll([&](MegaTransferListener* l) { l->onTransfersUpdate(api, item.transfers.get()); },
+                   [&](MegaListener* l) { l->onTransfersUpdate(api, item.transfers.get()); });
+            break;
+    }
 }
 
 MegaHashSignatureImpl::MegaHashSignatureImpl(const char *base64Key)
@@ -24267,6 +25816,18 @@ void OutShareProcessor::sortShares(int order)
     MegaApiImpl::sortByComparatorFunction(mNodes, order, mClient);
 }
 
+std::unique_ptr<TreeProcessor> OutShareProcessor::clone() const
+{
+    return make_unique<OutShareProcessor>(mClient);
+}
+
+void OutShareProcessor::merge(TreeProcessor& other)
+{
+    auto& o = static_cast<OutShareProcessor&>(other);
+    mShares.insert(mShares.end(), o.mShares.begin(), o.mShares.end());
+    mNodes.insert(mNodes.end(), o.mNodes.begin(), o.mNodes.end());
+}
+
 PendingOutShareProcessor::PendingOutShareProcessor()
 {
 
@@ -24298,6 +25859,18 @@ vector<handle> &PendingOutShareProcessor::getHandles()
     return handles;
 }
 
+std::unique_ptr<TreeProcessor> PendingOutShareProcessor::clone() const
+{
+    return make_unique<PendingOutShareProcessor>();
+}
+
+void PendingOutShareProcessor::merge(TreeProcessor& other)
+{
+    auto& o = static_cast<PendingOutShareProcessor&>(other);
+    shares.insert(shares.end(), o.shares.begin(), o.shares.end());
+    handles.insert(handles.end(), o.handles.begin(), o.handles.end());
+}
+
 MegaPricingPrivate::~MegaPricingPrivate()
 {
     for(unsigned i = 0; i < currency.size(); i++)
@@ -24782,6 +26355,18 @@ int MegaRegExpPrivate::compile()
     const char *error;
     int eoffset;
 
+    // the previous pattern, if any
+    if (reCompiled != NULL)
+    {
+        pcre_free(reCompiled);
+        reCompiled = NULL;
+    }
+    if (reOptimization != NULL)
+    {
+        pcre_free(reOptimization);
+        reOptimization = NULL;
+    }
+
     if (pattern.empty())
     {
         return MegaRegExpPrivate::REGEXP_EMPTY;
@@ -25336,22 +26921,22 @@ void MegaFolderUploadController::start(MegaNode*)
     }
     else
     {
-        auto localpath = LocalPath::fromPath(transfer->getPath(), *client->fsaccess);
-        MegaNode *child = megaApi->getChildNode(parent, name);
+        recursive++;
+        scan(LocalPath::fromPath(transfer->getPath(), *client->fsaccess), name ? name : "", client->nodebyhandle(parent->getHandle()));
+        delete parent;
 
-        if(!child || !child->isFolder())
-        {
-            pendingFolders.push_back(localpath);
-            megaApi->createFolder(name, parent, this);
-        }
-        else
+        // the files of the folders that exist already go first, while the others are created
+        for (size_t i = 0; i < folders.size(); i++)
         {
-            pendingFolders.push_front(localpath);
-            onFolderAvailable(child->getHandle());
+            if (folders[i].remote != UNDEF)
+            {
+                startFiles(i);
+            }
         }
+        createFolders();
 
-        delete child;
-        delete parent;
+        recursive--;
+        checkCompletion();
     }
 }
 
@@ -25451,88 +27036,212 @@ void MegaFolderUploadController::cancel()
     transfer = nullptr;  // no final callback for this one since it is being destroyed now
 }
 
-void MegaFolderUploadController::onFolderAvailable(MegaHandle handle)
+void MegaFolderUploadController::scan(const LocalPath& localPath, const string& name, Node* parent)
 {
-    recursive++;
-    auto localPath = pendingFolders.front();
-    pendingFolders.pop_front();
+    folders.clear();
+    folders.emplace_back();
+    folders[0].localPath = localPath;
+    folders[0].name = name;
 
-    MegaNode *parent = megaApi->getNodeByHandle(handle);
+    Node* existing = parent ? client->childnodebyname(parent, name.c_str(), false) : nullptr;
+    if (existing && existing->type == FOLDERNODE)
+    {
+        folders[0].remote = existing->nodehandle;
+    }
 
-    LocalPath localname;
-    DirAccess* da;
-    da = client->fsaccess->newdiraccess();
-    if (da->dopen(&localPath, NULL, false))
+    // breadth first, so that each folder is visited after its parent
+    for (size_t i = 0; i < folders.size(); i++)
     {
-        FileSystemType fsType = client->fsaccess->getlocalfstype(localPath);
+        LocalPath path = folders[i].localPath;
+        if (folders[i].remote == UNDEF)
+        {
+            pendingFolders++;
+        }
 
-        nodetype_t dirEntryType;
-        while (da->dnext(localPath, localname, client->followsymlinks, &dirEntryType))
+        std::unique_ptr<DirAccess> da(client->fsaccess->newdiraccess());
+        if (!da->dopen(&path, NULL, false))
         {
-            ScopedLengthRestore restoreLen(localPath);
-            localPath.appendWithSeparator(localname, false);
+            LOG_warn << "Unable to open local folder to upload: " << path.toPath(*client->fsaccess);
+            continue;
+        }
+
+        FileSystemType fsType = client->fsaccess->getlocalfstype(path);
+        folders[i].fsType = fsType;
 
-            string name = localname.toName(*client->fsaccess, fsType);
-            if (dirEntryType == FILENODE)
+        // the whole folder first, in as few calls to the filesystem as it allows
+        vector<DirAccess::Entry> entries;
+        while (da->dnextbulk(path, entries, 512, client->followsymlinks, *client->fsaccess))
+        {
+        }
+
+        Node* remoteFolder = folders[i].remote != UNDEF ? client->nodebyhandle(folders[i].remote) : nullptr;
+
+        for (auto& entry : entries)
+        {
+            LocalPath entryPath = path;
+            entryPath.appendWithSeparator(entry.name, false);
+
+            if (entry.type == FILENODE)
             {
-                pendingTransfers++;
-                megaApi->startUpload(false, localPath.toPath(*client->fsaccess).c_str(), parent, (const char *)NULL, -1, tag, false, NULL, false, false, fsType, this);
+                folders[i].files.push_back(entryPath);
             }
-            else if (dirEntryType == FOLDERNODE)
+            else if (entry.type == FOLDERNODE)
             {
-                MegaNode *child = megaApi->getChildNode(parent, name.c_str());
-                if(!child || !child->isFolder())
-                {
-                    pendingFolders.push_back(localPath);
-                    megaApi->createFolder(name.c_str(), parent, this);
-                }
-                else
+                Folder folder;
+                folder.localPath = entryPath;
+                folder.name = entry.name.toName(*client->fsaccess, fsType);
+                folder.parent = i;
+
+                Node* child = remoteFolder ? client->childnodebyname(remoteFolder, folder.name.c_str(), false) : nullptr;
+                if (child && child->type == FOLDERNODE)
                 {
-                    pendingFolders.push_front(localPath);
-                    onFolderAvailable(child->getHandle());
+                    folder.remote = child->nodehandle;
                 }
-                delete child;
+
+                folders[i].children.push_back(folders.size());
+                folders.push_back(std::move(folder));
             }
         }
     }
 
-    delete da;
-    delete parent;
-    recursive--;
+    LOG_debug << "Folder upload of " << folders.size() << " folders, " << pendingFolders << " to create";
+}
 
-    checkCompletion();
+void MegaFolderUploadController::startFiles(size_t folder)
+{
+    Folder& f = folders[folder];
+    if (f.files.empty())
+    {
+        return;
+    }
+
+    std::unique_ptr<MegaNode> parent(megaApi->getNodeByHandle(f.remote));
+
+    vector<MegaTransferPrivate *> files;
+    files.reserve(f.files.size());
+    for (auto& path : f.files)
+    {
+        pendingTransfers++;
+        files.push_back(megaApi->createUploadTransfer(false, path.toPath(*client->fsaccess).c_str(), parent.get(), nullptr, nullptr, -1, tag, false, nullptr, false, false, f.fsType, this));
+    }
+    f.files.clear();
+
+    megaApi->startTransfers(std::move(files));
 }
 
-void MegaFolderUploadController::checkCompletion()
+void MegaFolderUploadController::createFolders()
 {
-    if (!cancelled && !recursive && !pendingFolders.size() && !pendingTransfers)
+    for (size_t i = 0; i < folders.size(); i++)
     {
-        LOG_debug << "Folder transfer finished - " << transfer->getTransferredBytes() << " of " << transfer->getTotalBytes();
-        transfer->setState(MegaTransfer::STATE_COMPLETED);
-        transfer->setLastError(&mLastError);
-        DBTableTransactionCommitter committer(client->tctable);
-        megaApi->fireOnTransferFinish(transfer, make_unique<MegaErrorPrivate>(!mIncompleteTransfers ? API_OK : API_EINCOMPLETE), committer);
+        Folder& f = folders[i];
+        handle target = i ? folders[f.parent].remote : transfer->getParentHandle();
+        if (f.remote != UNDEF || f.sent || f.failed || target == UNDEF)
+        {
+            continue;
+        }
+
+        // a new folder in one that exists, created with as many of its subfolders as fit
+        vector<NewNode> nn;
+        vector<size_t> created;
+        std::deque<size_t> subtree(1, i);
+        while (!subtree.empty() && nn.size() < size_t(MegaClient::MAX_NEWNODES))
+        {
+            size_t j = subtree.front();
+            subtree.pop_front();
+
+            nn.emplace_back();
+            client->putnodes_prepareOneFolder(&nn.back(), folders[j].name);
+
+            // temporary handles, for the subfolders to refer to their parent
+            nn.back().nodehandle = j + 1;
+            nn.back().parenthandle = j == i ? UNDEF : folders[j].parent + 1;
+
+            folders[j].sent = true;
+            created.push_back(j);
+            subtree.insert(subtree.end(), folders[j].children.begin(), folders[j].children.end());
+        }
+
+        auto cmd = new CommandPutNodes(client, target, NULL, std::move(nn), client->nextreqtag(), PUTNODES_APP);
+        std::weak_ptr<int> controller = alive;
+        cmd->mResultFunction = [this, controller, created](const Error& e, vector<NewNode>& nn)
+        {
+            if (!controller.expired())
+            {
+                onFoldersCreated(e, nn, created);
+            }
+        };
+        client->reqs.add(cmd);
     }
 }
 
-void MegaFolderUploadController::onRequestFinish(MegaApi *, MegaRequest *request, MegaError *e)
+void MegaFolderUploadController::onFoldersCreated(const Error& e, vector<NewNode>& nn, const vector<size_t>& created)
 {
-    int type = request->getType();
-    int errorCode = e->getErrorCode();
+    if (cancelled)
+    {
+        return;
+    }
 
-    if (type == MegaRequest::TYPE_CREATE_FOLDER)
+    for (auto& f : created)
     {
-        if (!errorCode)
+        folders[f].sent = false;
+    }
+
+    recursive++;
+    for (size_t k = 0; k < created.size(); k++)
+    {
+        size_t f = created[k];
+        if (!e && k < nn.size() && nn[k].added)
         {
-            onFolderAvailable(request->getNodeHandle());
+            folders[f].remote = nn[k].mAddedHandle;
+            pendingFolders--;
+            startFiles(f);
         }
-        else
+        else if (!folders[f].failed)
         {
-            pendingFolders.pop_front();
-            mLastError = *e;
+            failFolder(f, e ? e : Error(API_EINTERNAL));
+        }
+    }
+
+    // and the subfolders that didn't fit
+    createFolders();
+    recursive--;
+
+    checkCompletion();
+}
+
+void MegaFolderUploadController::failFolder(size_t folder, const Error& e)
+{
+    LOG_err << "Unable to create folder to upload: " << folders[folder].localPath.toPath(*client->fsaccess) << " (" << error(e) << ")";
+
+    mLastError = MegaErrorPrivate(e);
+
+    // with all that was in it
+    std::deque<size_t> subtree(1, folder);
+    while (!subtree.empty())
+    {
+        Folder& f = folders[subtree.front()];
+        subtree.pop_front();
+
+        if (!f.failed && f.remote == UNDEF)
+        {
+            f.failed = true;
+            f.files.clear();
+            pendingFolders--;
             mIncompleteTransfers++;
-            checkCompletion();
         }
+        subtree.insert(subtree.end(), f.children.begin(), f.children.end());
+    }
+}
+
+void MegaFolderUploadController::checkCompletion()
+{
+    if (!cancelled && !recursive && !pendingFolders && !pendingTransfers)
+    {
+        LOG_debug << "Folder transfer finished - " << transfer->getTransferredBytes() << " of " << transfer->getTotalBytes();
+        transfer->setState(MegaTransfer::STATE_COMPLETED);
+        transfer->setLastError(&mLastError);
+        DBTableTransactionCommitter committer(client->tctable);
+        megaApi->fireOnTransferFinish(transfer, make_unique<MegaErrorPrivate>(!mIncompleteTransfers ? API_OK : API_EINCOMPLETE), committer);
     }
 }
 
@@ -25588,12 +27297,234 @@ void MegaFolderUploadController::onTransferFinish(MegaApi *, MegaTransfer *t, Me
     }
 }
 
-MegaFolderUploadController::~MegaFolderUploadController()
+MegaFolderCopyController::MegaFolderCopyController(MegaApiImpl *megaApi, int tag, handle target, const string& newName)
+    : megaApi(megaApi)
+    , client(megaApi->getMegaClient())
+    , tag(tag)
+    , target(target)
+    , newName(newName)
 {
-    //we dettach this as request listener: could be pending create folder req finish
-    megaApi->removeRequestListener(this);
+}
 
-    //we shouldn't need to dettach as transfer listener: all listened transfer should have been cancelled/completed
+void MegaFolderCopyController::start(Node* source)
+{
+    rootSource = source->nodehandle;
+    sendBatch(source);
+}
+
+void MegaFolderCopyController::addNode(Node* n, handle parent, vector<Node*>& nodes, vector<handle>& parents)
+{
+    nodes.push_back(n);
+    parents.push_back(parent);
+
+    if (n->type == FILENODE)
+    {
+        // versions go with their file
+        client->loadchildren(n);
+        for (Node* v : n->children)
+        {
+            addNode(v, n->nodehandle, nodes, parents);
+        }
+    }
+}
+
+void MegaFolderCopyController::sendBatch(Node* root)
+{
+    vector<Node*> nodes;
+    vector<handle> parents;     // the original handle of the parent of each, if in the batch
+
+    // the folders the batch creates, and where they are in it
+    std::deque<std::pair<size_t, Folder>> created;
+
+    auto expand = [&](Folder& f, bool intoTarget)
+    {
+        if (!f.listed)
+        {
+            if (Node* n = client->nodebyhandle(f.source))
+            {
+                client->loadchildren(n);
+                for (Node* c : n->children)
+                {
+                    f.children.push_back(c->nodehandle);
+                }
+            }
+            f.listed = true;
+        }
+
+        while (!f.children.empty() && nodes.size() < size_t(MegaClient::MAX_NEWNODES))
+        {
+            Node* c = client->nodebyhandle(f.children.back());
+            f.children.pop_back();
+            if (!c)
+            {
+                continue;   // removed since
+            }
+
+            if (c->type == FOLDERNODE)
+            {
+                created.emplace_back(nodes.size(), Folder());
+                created.back().second.source = c->nodehandle;
+            }
+            addNode(c, intoTarget ? UNDEF : f.source, nodes, parents);
+        }
+    };
+
+    handle batchTarget;
+    if (root)
+    {
+        batchTarget = target;
+        created.emplace_back(0, Folder());
+        created.back().second.source = root->nodehandle;
+        addNode(root, UNDEF, nodes, parents);
+    }
+    else
+    {
+        batchTarget = ready.front().copy;
+        expand(ready.front(), true);
+        if (ready.front().children.empty())
+        {
+            ready.pop_front();
+        }
+    }
+
+    // and as much as fits of what goes in the new folders, breadth first
+    for (size_t i = 0; i < created.size() && nodes.size() < size_t(MegaClient::MAX_NEWNODES); i++)
+    {
+        expand(created[i].second, false);
+    }
+
+    if (nodes.empty())
+    {
+        return;
+    }
+
+    vector<NewNode> nn(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        NewNode& t = nn[i];
+        Node* n = nodes[i];
+
+        t.source = NEW_NODE;
+        t.type = n->type;
+        t.nodehandle = n->nodehandle;
+        t.parenthandle = parents[i];
+
+        // copy key (if file) or generate new key (if folder)
+        if (n->type == FILENODE)
+        {
+            t.nodekey = n->nodekey();
+        }
+        else
+        {
+            byte buf[FOLDERNODEKEYLENGTH];
+            client->rng.genblock(buf, sizeof buf);
+            t.nodekey.assign((char*)buf, FOLDERNODEKEYLENGTH);
+        }
+    }
+
+    // the attributes, encrypted with the new keys on the worker threads
+    const size_t ATTRBATCH = 256;
+    nameid rrname = AttrMap::string2nameid("rr");
+    client->mAsyncQueue.parallelFor((nn.size() + ATTRBATCH - 1) / ATTRBATCH, [&](size_t batch, SymmCipher& key)
+    {
+        for (size_t i = batch * ATTRBATCH; i < nn.size() && i < (batch + 1) * ATTRBATCH; i++)
+        {
+            NewNode& t = nn[i];
+            t.attrstring.reset(new string);
+            if (t.nodekey.size())
+            {
+                key.setkey((const byte*)t.nodekey.data(), t.type);
+
+                AttrMap tattrs;
+                tattrs.map = nodes[i]->attrs.map;
+                tattrs.map.erase(rrname);
+                if (root && !i && !newName.empty())
+                {
+                    tattrs.map['n'] = newName;
+                }
+
+                string attrstring;
+                tattrs.getjson(&attrstring);
+                client->makeattr(&key, t.attrstring, attrstring.c_str());
+            }
+        }
+    });
+
+    LOG_debug << "Copying " << nn.size() << " nodes into " << Base64Str<MegaClient::NODEHANDLE>(batchTarget);
+
+    auto cmd = new CommandPutNodes(client, batchTarget, NULL, std::move(nn), client->nextreqtag(), PUTNODES_APP);
+    auto self = shared_from_this();
+    auto folders = std::make_shared<std::deque<std::pair<size_t, Folder>>>(std::move(created));
+    cmd->mResultFunction = [self, folders](const Error& e, vector<NewNode>& nn)
+    {
+        self->onBatch(e, nn, *folders);
+    };
+    inflight++;
+    client->reqs.add(cmd);
+}
+
+void MegaFolderCopyController::onBatch(const Error& e, vector<NewNode>& nn, std::deque<std::pair<size_t, Folder>>& created)
+{
+    inflight--;
+
+    if (e)
+    {
+        LOG_err << "Unable to copy a part of the folder: " << error(e);
+        failure = e;
+    }
+    else
+    {
+        for (auto& f : created)
+        {
+            size_t k = f.first;
+            if (k < nn.size() && nn[k].added && nn[k].mAddedHandle != UNDEF)
+            {
+                f.second.copy = nn[k].mAddedHandle;
+                if (f.second.source == rootSource)
+                {
+                    rootCopy = f.second.copy;
+                }
+
+                if (!f.second.listed || !f.second.children.empty())
+                {
+                    ready.push_back(std::move(f.second));
+                }
+            }
+            else
+            {
+                incomplete = true;
+            }
+        }
+    }
+
+    proceed();
+}
+
+void MegaFolderCopyController::proceed()
+{
+    // the request may have been aborted meanwhile (eg. on logout)
+    auto it = megaApi->requestMap.find(tag);
+    if (it == megaApi->requestMap.end() || !it->second)
+    {
+        return;
+    }
+
+    while (!failure && inflight < MAXINFLIGHT && !ready.empty())
+    {
+        sendBatch(nullptr);
+    }
+
+    if (!inflight)
+    {
+        MegaRequestPrivate* request = it->second;
+
+#ifdef ENABLE_SYNC
+        client->syncdownrequired = true;
+#endif
+
+        request->setNodeHandle(rootCopy);
+        megaApi->fireOnRequestFinish(request, make_unique<MegaErrorPrivate>(failure ? failure : Error(incomplete ? API_EINCOMPLETE : API_OK)));
+    }
 }
 
 MegaBackupController::MegaBackupController(MegaApiImpl *megaApi, int tag, int folderTransferTag, handle parenthandle, const char* filename, bool attendPastBackups, const char *speriod, int64_t period, int maxBackups)
@@ -26916,6 +28847,9 @@ void MegaFolderDownloadController::downloadFolderNode(MegaNode *node, LocalPath&
         return;
     }
 
+    // the files of the folder are queued at once
+    vector<MegaTransferPrivate *> files;
+
     for (int i = 0; i < children->size(); i++)
     {
         MegaNode *child = children->get(i);
@@ -26928,7 +28862,7 @@ void MegaFolderDownloadController::downloadFolderNode(MegaNode *node, LocalPath&
         if (child->getType() == MegaNode::TYPE_FILE)
         {
             pendingTransfers++;
-            megaApi->startDownload(false, child, utf8path.c_str(), tag, transfer->getAppData(), this);
+            files.push_back(megaApi->createDownloadTransfer(false, child, utf8path.c_str(), tag, transfer->getAppData(), this));
         }
         else
         {
@@ -26936,6 +28870,8 @@ void MegaFolderDownloadController::downloadFolderNode(MegaNode *node, LocalPath&
         }
     }
 
+    megaApi->startTransfers(std::move(files));
+
     recursive--;
     checkCompletion();
     if (deleteChildren)
@@ -27021,9 +28957,79 @@ StreamingBuffer::StreamingBuffer()
     this->maxOutputSize = MAX_OUTPUT_SIZE;
 }
 
+namespace {
+
+// the released buffers (see StreamingBuffer::POOLED_BUFFER_SIZE), the oldest first
+struct StreamingBufferPool
+{
+    std::mutex mutex;
+    std::deque<std::pair<unsigned int, std::unique_ptr<char[]>>> buffers;
+};
+
+StreamingBufferPool& streamingBufferPool()
+{
+    static StreamingBufferPool pool;
+    return pool;
+}
+
+} // anonymous
+
 StreamingBuffer::~StreamingBuffer()
 {
-    delete [] buffer;
+    releaseBuffer();
+}
+
+std::atomic<m_off_t> StreamingBuffer::totalCapacity{0};
+
+char* StreamingBuffer::takeBuffer(unsigned int capacity)
+{
+    if (capacity >= POOLED_BUFFER_SIZE)
+    {
+        auto& pool = streamingBufferPool();
+        std::lock_guard<std::mutex> g(pool.mutex);
+
+        for (auto it = pool.buffers.begin(); it != pool.buffers.end(); ++it)
+        {
+            if (it->first == capacity)
+            {
+                char* b = it->second.release();
+                pool.buffers.erase(it);
+                return b;
+            }
+        }
+    }
+
+    totalCapacity += capacity;
+    return new char[capacity];
+}
+
+void StreamingBuffer::releaseBuffer()
+{
+    if (!buffer)
+    {
+        return;
+    }
+
+    if (capacity >= POOLED_BUFFER_SIZE)
+    {
+        auto& pool = streamingBufferPool();
+        std::lock_guard<std::mutex> g(pool.mutex);
+
+        if (pool.buffers.size() >= POOLED_BUFFERS)
+        {
+            totalCapacity -= pool.buffers.front().first;
+            pool.buffers.pop_front();
+        }
+        pool.buffers.emplace_back(capacity, std::unique_ptr<char[]>(buffer));
+    }
+    else
+    {
+        delete [] buffer;
+        totalCapacity -= capacity;
+    }
+
+    buffer = NULL;
+    capacity = 0;
 }
 
 void StreamingBuffer::init(m_off_t capacity)
@@ -27034,8 +29040,13 @@ void StreamingBuffer::init(m_off_t capacity)
         capacity = maxBufferSize;
     }
 
-    this->capacity = static_cast<unsigned>(capacity);
-    this->buffer = new char[this->capacity];
+    // a connection reused for another request inits it again, keeping the buffer if it fits
+    if (!this->buffer || this->capacity != capacity)
+    {
+        releaseBuffer();
+        this->capacity = static_cast<unsigned>(capacity);
+        this->buffer = takeBuffer(this->capacity);
+    }
     this->inpos = 0;
     this->outpos = 0;
     this->size = 0;
@@ -27096,27 +29107,28 @@ unsigned int StreamingBuffer::availableCapacity()
 
 uv_buf_t StreamingBuffer::nextBuffer()
 {
-    if (!size)
-    {
-        // no data available
-        return uv_buf_init(NULL, 0);
-    }
+    uv_buf_t resbuf = uv_buf_init(NULL, 0);
+    nextBuffers(&resbuf, 1);
+    return resbuf;
+}
 
-    // prepare output buffer
-    char *outbuf = buffer + outpos;
-    int len = size < maxOutputSize ? size : maxOutputSize;
-    if (outpos + len > capacity)
+unsigned int StreamingBuffer::nextBuffers(uv_buf_t* bufs, unsigned int maxbufs)
+{
+    unsigned int nbufs = 0;
+    unsigned int remaining = size < maxOutputSize ? size : maxOutputSize;
+    while (remaining && nbufs < maxbufs)
     {
-        len = capacity - outpos;
-    }
-
-    // update the internal state
-    size -= len;
-    outpos += len;
-    outpos %= capacity;
+        // up to the end of the ring
+        unsigned int len = std::min(remaining, capacity - outpos);
+        bufs[nbufs++] = uv_buf_init(buffer + outpos, len);
 
-    // return the buffer
-    return uv_buf_init(outbuf, len);
+        // update the internal state
+        remaining -= len;
+        size -= len;
+        outpos += len;
+        outpos %= capacity;
+    }
+    return nbufs;
 }
 
 void StreamingBuffer::freeData(unsigned int len)
@@ -27170,6 +29182,8 @@ MegaTCPServer::MegaTCPServer(MegaApiImpl *megaApi, string basePath, bool tls, st
     this->lastHandle = INVALID_HANDLE;
     this->remainingcloseevents = 0;
     this->closing = false;
+    this->loopThreads = 1;
+    this->nextLoop = 0;
     this->thread = new MegaThread();
 #ifdef ENABLE_EVT_TLS
     this->certificatepath = certificatepath;
@@ -27198,6 +29212,7 @@ MegaTCPServer::MegaTCPServer(MegaApiImpl *megaApi, string basePath, bool tls, st
 MegaTCPServer::~MegaTCPServer()
 {
     stop();
+    stopLoops(true);
     semaphoresdestroyed = true;
     uv_sem_destroy(&semaphoreStartup);
     uv_sem_destroy(&semaphoreEnd);
@@ -27224,13 +29239,217 @@ bool MegaTCPServer::start(int port, bool localOnly)
     this->port = port;
     this->localOnly = localOnly;
 
+    // those of a previous start that wasn't waited to stop
+    stopLoops(true);
+    startLoops();
+
     thread->start(threadEntryPoint, this);
     uv_sem_wait(&semaphoreStartup);
 
+    if (!started)
+    {
+        stopLoops(true);
+    }
+
     LOG_verbose << "MegaTCPServer::start. port = " << port << ", returning " << started;
     return started;
 }
 
+void MegaTCPServer::startLoops()
+{
+#ifndef _WIN32
+    for (int i = 0; loopThreads > 1 && i < loopThreads; i++)
+    {
+        std::unique_ptr<MegaTCPLoop> loop(new MegaTCPLoop());
+        loop->server = this;
+        uv_loop_init(&loop->uv_loop);
+        uv_async_init(&loop->uv_loop, &loop->async, onLoopAsync);
+        loop->async.data = loop.get();
+        loop->thread.start(loopEntryPoint, loop.get());
+        loops.push_back(std::move(loop));
+    }
+    nextLoop = 0;
+#endif
+}
+
+void MegaTCPServer::stopLoops(bool wait)
+{
+    for (auto& loop : loops)
+    {
+        std::lock_guard<std::mutex> g(loop->mutex);
+        if (!loop->stopping)
+        {
+            loop->stopping = true;
+            uv_async_send(&loop->async);
+        }
+    }
+
+    if (wait)
+    {
+        for (auto& loop : loops)
+        {
+            loop->thread.join();
+        }
+        loops.clear();
+    }
+}
+
+void *MegaTCPServer::loopEntryPoint(void *param)
+{
+#ifndef _WIN32
+    struct sigaction noaction;
+    memset(&noaction, 0, sizeof(noaction));
+    noaction.sa_handler = SIG_IGN;
+    ::sigaction(SIGPIPE, &noaction, 0);
+#endif
+
+    ThreadConfig::apply(THREAD_ROLE_SERVER);
+
+    MegaTCPLoop *loop = (MegaTCPLoop *)param;
+    uv_run(&loop->uv_loop, UV_RUN_DEFAULT);
+    uv_loop_close(&loop->uv_loop);
+    LOG_debug << "Connection loop thread exit, port = " << loop->server->port;
+    return NULL;
+}
+
+void MegaTCPServer::onLoopAsync(uv_async_t *handle)
+{
+    MegaTCPLoop *loop = (MegaTCPLoop *)handle->data;
+
+    std::deque<int> accepted;
+    bool stopping;
+    {
+        std::lock_guard<std::mutex> g(loop->mutex);
+        accepted.swap(loop->accepted);
+        stopping = loop->stopping;
+    }
+
+    for (int fd : accepted)
+    {
+        if (stopping)
+        {
+#ifndef _WIN32
+            ::close(fd);
+#endif
+            continue;
+        }
+        loop->server->openConnection(loop, fd);
+    }
+
+    if (stopping && !loop->closed)
+    {
+        // the thread ends once the connections are closed
+        loop->closed = true;
+        for (MegaTCPContext *tcpctx : loop->connections)
+        {
+            closeTCPConnection(tcpctx);
+        }
+        uv_close((uv_handle_t *)&loop->async, NULL);
+    }
+}
+
+void MegaTCPServer::dispatchConnection(uv_stream_t *server_handle)
+{
+#ifndef _WIN32
+    // libuv can't move a handle to another loop: the socket goes there, and its handle here is closed
+    uv_tcp_t *client = new uv_tcp_t();
+    uv_tcp_init(&uv_loop, client);
+
+    int fd = -1;
+    uv_os_fd_t clientfd;
+    if (!uv_accept(server_handle, (uv_stream_t*)client) && !uv_fileno((uv_handle_t*)client, &clientfd))
+    {
+        fd = ::dup(clientfd);
+    }
+    uv_close((uv_handle_t*)client, onDispatchedClose);
+
+    if (fd < 0)
+    {
+        LOG_err << "uv_accept failed";
+        return;
+    }
+
+    MegaTCPLoop *loop = loops[nextLoop++ % loops.size()].get();
+    std::lock_guard<std::mutex> g(loop->mutex);
+    if (loop->stopping)
+    {
+        ::close(fd);
+        return;
+    }
+    loop->accepted.push_back(fd);
+    uv_async_send(&loop->async);
+#endif
+}
+
+void MegaTCPServer::onDispatchedClose(uv_handle_t *handle)
+{
+    delete (uv_tcp_t*)handle;
+}
+
+void MegaTCPServer::openConnection(MegaTCPLoop *loop, int fd)
+{
+    MegaTCPContext* tcpctx = initializeContext((uv_stream_t*)&server);
+    tcpctx->loop = loop;
+
+    LOG_debug << "Connection received at port " << port << "! " << loop->connections.size() << " tcpctx = " << tcpctx;
+
+    // Mutex to protect the data buffer
+    uv_mutex_init(&tcpctx->mutex);
+
+    // Async handle to perform writes
+    uv_async_init(&loop->uv_loop, &tcpctx->asynchandle, onAsyncEvent);
+
+    uv_tcp_init(&loop->uv_loop, &tcpctx->tcphandle);
+    if (uv_tcp_open(&tcpctx->tcphandle, fd))
+    {
+        LOG_err << "uv_tcp_open failed";
+#ifndef _WIN32
+        ::close(fd);
+#endif
+        onClose((uv_handle_t*)&tcpctx->tcphandle);
+        return;
+    }
+
+#ifdef ENABLE_EVT_TLS
+    if (useTLS)
+    {
+        {
+            std::lock_guard<std::mutex> g(evtmutex);
+            tcpctx->evt_tls = evt_ctx_get_tls(&evtctx);
+        }
+        assert(tcpctx->evt_tls != NULL);
+        tcpctx->evt_tls->data = tcpctx;
+        if (evt_tls_accept(tcpctx->evt_tls, on_hd_complete))
+        {
+            LOG_err << "evt_tls_accept failed";
+            evt_tls_close(tcpctx->evt_tls, on_evt_tls_close);
+            return;
+        }
+
+        loop->connections.push_back(tcpctx);
+        readData(tcpctx);
+        return;
+    }
+#endif
+
+    loop->connections.push_back(tcpctx);
+    if (respondNewConnection(tcpctx))
+    {
+        // Start reading
+        readData(tcpctx);
+    }
+}
+
+list<MegaTCPContext*> &MegaTCPServer::connectionsOf(MegaTCPContext *tcpctx)
+{
+    return tcpctx->loop ? tcpctx->loop->connections : tcpctx->server->connections;
+}
+
+int &MegaTCPServer::closeEventsOf(MegaTCPContext *tcpctx)
+{
+    return tcpctx->loop ? tcpctx->loop->remainingcloseevents : tcpctx->server->remainingcloseevents;
+}
+
 #ifdef ENABLE_EVT_TLS
 int MegaTCPServer::uv_tls_writer(evt_tls_t *evt_tls, void *bfr, int sz)
 {
@@ -27473,6 +29692,7 @@ void MegaTCPServer::stop(bool doNotWait)
 
     LOG_debug << "Stopping MegaTCPServer port = " << port;
     uv_async_send(&exit_handle);
+    stopLoops(!doNotWait);
     if (!doNotWait)
     {
         LOG_verbose << "Waiting for sempahoreEnd to conclude server stop port = " << port;
@@ -27512,6 +29732,16 @@ int MegaTCPServer::getMaxBufferSize()
     return StreamingBuffer::MAX_BUFFER_SIZE;
 }
 
+void MegaTCPServer::setLoopThreads(int threads)
+{
+    loopThreads = std::max(threads, 1);
+}
+
+int MegaTCPServer::getLoopThreads()
+{
+    return loopThreads;
+}
+
 int MegaTCPServer::getMaxOutputSize()
 {
     if (maxOutputSize)
@@ -27619,6 +29849,8 @@ void *MegaTCPServer::threadEntryPoint(void *param)
     ::sigaction(SIGPIPE, &noaction, 0);
 #endif
 
+    ThreadConfig::apply(THREAD_ROLE_SERVER);
+
     MegaTCPServer *tcpServer = (MegaTCPServer *)param;
     tcpServer->run();
     return NULL;
@@ -27689,6 +29921,13 @@ void MegaTCPServer::onNewClient_tls(uv_stream_t *server_handle, int status)
         return;
     }
 
+    MegaTCPServer *tcpServer = (MegaTCPServer *)server_handle->data;
+    if (tcpServer->loops.size())
+    {
+        tcpServer->dispatchConnection(server_handle);
+        return;
+    }
+
     // Create an object to save context information
     MegaTCPContext* tcpctx = ((MegaTCPServer *)server_handle->data)->initializeContext(server_handle);
 
@@ -27748,6 +29987,13 @@ void MegaTCPServer::onNewClient(uv_stream_t* server_handle, int status)
         return;
     }
 
+    MegaTCPServer *tcpServer = (MegaTCPServer *)server_handle->data;
+    if (tcpServer->loops.size())
+    {
+        tcpServer->dispatchConnection(server_handle);
+        return;
+    }
+
     // Create an object to save context information
     MegaTCPContext* tcpctx = ((MegaTCPServer *)server_handle->data)->initializeContext(server_handle);
 
@@ -27831,8 +30077,8 @@ void MegaTCPServer::onClose(uv_handle_t* handle)
     tcpctx->megaApi->removeTransferListener(tcpctx);
     tcpctx->megaApi->removeRequestListener(tcpctx);
 
-    tcpctx->server->connections.remove(tcpctx);
-    LOG_debug << "Connection closed: " << tcpctx->server->connections.size() << " port = " << tcpctx->server->port << " closing async handle";
+    connectionsOf(tcpctx).remove(tcpctx);
+    LOG_debug << "Connection closed: " << connectionsOf(tcpctx).size() << " port = " << tcpctx->server->port << " closing async handle";
     uv_close((uv_handle_t *)&tcpctx->asynchandle, onAsyncEventClose);
 }
 
@@ -27843,18 +30089,22 @@ void MegaTCPServer::onAsyncEventClose(uv_handle_t *handle)
 
     int port = tcpctx->server->port;
 
-    tcpctx->server->remainingcloseevents--;
+    closeEventsOf(tcpctx)--;
     tcpctx->server->processOnAsyncEventClose(tcpctx);
 
-    LOG_verbose << "At onAsyncEventClose port = " << tcpctx->server->port << " remaining=" << tcpctx->server->remainingcloseevents;
+    LOG_verbose << "At onAsyncEventClose port = " << tcpctx->server->port << " remaining=" << closeEventsOf(tcpctx);
 
-    if (!tcpctx->server->remainingcloseevents && tcpctx->server->closing && !tcpctx->server->semaphoresdestroyed)
+    // the threads of other loops are joined instead
+    if (!tcpctx->loop && !tcpctx->server->remainingcloseevents && tcpctx->server->closing && !tcpctx->server->semaphoresdestroyed)
     {
         uv_sem_post(&tcpctx->server->semaphoreStartup);
         uv_sem_post(&tcpctx->server->semaphoreEnd);
     }
 
     uv_mutex_destroy(&tcpctx->mutex);
+#ifdef ENABLE_EVT_TLS
+    std::lock_guard<std::mutex> g(tcpctx->server->evtmutex);
+#endif
     delete tcpctx;
     LOG_debug << "Connection deleted, port = " << port;
 }
@@ -27937,6 +30187,9 @@ MegaTCPContext::MegaTCPContext()
 {
     size = -1;
     finished = false;
+    loop = NULL;
+    workPending = false;
+    closeDeferred = false;
     bytesWritten = 0;
 #ifdef ENABLE_EVT_TLS
     evt_tls = NULL;
@@ -28030,14 +30283,43 @@ void MegaTCPServer::closeConnection(MegaTCPContext *tcpctx)
 void MegaTCPServer::closeTCPConnection(MegaTCPContext *tcpctx)
 {
     tcpctx->finished = true;
+    if (tcpctx->workPending)
+    {
+        // the server doesn't finish stopping before the connection is closed
+        if (!tcpctx->closeDeferred)
+        {
+            tcpctx->closeDeferred = true;
+            closeEventsOf(tcpctx)++;
+        }
+        LOG_debug << "Closing the connection when its pending work is done";
+        return;
+    }
+
     if (!uv_is_closing((uv_handle_t*)&tcpctx->tcphandle))
     {
-        tcpctx->server->remainingcloseevents++;
-        LOG_verbose << "At closeTCPConnection port = " << tcpctx->server->port << " remainingcloseevent = " << tcpctx->server->remainingcloseevents;
+        closeEventsOf(tcpctx)++;
+        LOG_verbose << "At closeTCPConnection port = " << tcpctx->server->port << " remainingcloseevent = " << closeEventsOf(tcpctx);
         uv_close((uv_handle_t*)&tcpctx->tcphandle, onClose);
     }
 }
 
+bool MegaTCPServer::finishPendingWork(MegaTCPContext *tcpctx)
+{
+    tcpctx->workPending = false;
+    if (!tcpctx->finished)
+    {
+        return false;
+    }
+
+    if (tcpctx->closeDeferred)
+    {
+        tcpctx->closeDeferred = false;
+        closeEventsOf(tcpctx)--;
+    }
+    closeTCPConnection(tcpctx);
+    return true;
+}
+
 void MegaTCPServer::processOnAsyncEventClose(MegaTCPContext *tcpctx) // without this closing breaks!
 {
     LOG_debug << "At supposed to be virtual processOnAsyncEventClose";
@@ -28078,6 +30360,7 @@ MegaHTTPServer::MegaHTTPServer(MegaApiImpl *megaApi, string basePath, bool useTL
     this->folderServerEnabled = true;
     this->offlineAttribute = false;
     this->subtitlesSupportEnabled = false;
+    this->propFindGeneration = 0;
 }
 
 MegaTCPContext * MegaHTTPServer::initializeContext(uv_stream_t *server_handle)
@@ -28105,6 +30388,19 @@ void MegaHTTPServer::processReceivedData(MegaTCPContext *tcpctx, ssize_t nread,
 
     LOG_debug << "Received " << nread << " bytes";
 
+    if (nread > 0 && httpctx->requestPending)
+    {
+        // pipelined: parsed once the current request is answered
+        if (httpctx->pipelined.size() + size_t(nread) > MAX_PIPELINED_SIZE)
+        {
+            LOG_warn << "Finishing request. Too many pipelined requests";
+            closeConnection(httpctx);
+            return;
+        }
+        httpctx->pipelined.append(buf->base, size_t(nread));
+        return;
+    }
+
     ssize_t parsed = -1;
     if (nread >= 0)
     {
@@ -28121,6 +30417,13 @@ void MegaHTTPServer::processReceivedData(MegaTCPContext *tcpctx, ssize_t nread,
 
     LOG_verbose << " at onDataReceived, received " << nread << " parsed = " << parsed;
 
+    if (parsed >= 0 && nread > 0 && HTTP_PARSER_ERRNO(&httpctx->parser) == HPE_PAUSED)
+    {
+        // a request is complete (see onMessageComplete): the rest is for the next ones
+        httpctx->pipelined.assign(buf->base + parsed, size_t(nread - parsed));
+        return;
+    }
+
     if (parsed < 0 || nread < 0 || parsed < nread || httpctx->parser.upgrade)
     {
         LOG_debug << "Finishing request. Connection reset by peer or unsupported data";
@@ -28154,6 +30457,9 @@ void MegaHTTPServer::processWriteFinished(MegaTCPContext* tcpctx, int status)
             {
                 httpctx->resultCode = API_OK;
             }
+
+            finishResponse(httpctx);
+            return;
         }
 
         closeConnection(httpctx);
@@ -28172,13 +30478,17 @@ void MegaHTTPServer::processWriteFinished(MegaTCPContext* tcpctx, int status)
         if (httpctx->streamingBuffer.availableSpace() > httpctx->streamingBuffer.availableCapacity() / 2)
         {
             httpctx->pause = false;
-            m_off_t start = httpctx->rangeStart + httpctx->rangeWritten + httpctx->streamingBuffer.availableData();
-            m_off_t len =  httpctx->rangeEnd - httpctx->rangeStart - httpctx->rangeWritten - httpctx->streamingBuffer.availableData();
+            m_off_t start = httpctx->streamPos;
+            m_off_t len = httpctx->rangeEnd - httpctx->streamPos;
 
-            LOG_debug << "Resuming streaming from " << start << " len: " << len
-                     << " Buffer status: " << httpctx->streamingBuffer.availableSpace()
-                     << " of " << httpctx->streamingBuffer.availableCapacity() << " bytes free";
-            httpctx->megaApi->startStreaming(httpctx->node, start, len, httpctx);
+            if (len > 0)
+            {
+                LOG_debug << "Resuming streaming from " << start << " len: " << len
+                         << " Buffer status: " << httpctx->streamingBuffer.availableSpace()
+                         << " of " << httpctx->streamingBuffer.availableCapacity() << " bytes free";
+                httpctx->activeStreams++;
+                httpctx->megaApi->startStreaming(httpctx->node, start, len, httpctx);
+            }
         }
     }
     uv_mutex_unlock(&httpctx->mutex);
@@ -28282,6 +30592,71 @@ void MegaHTTPServer::enableSubtitlesSupport(bool enable)
     this->subtitlesSupportEnabled = enable;
 }
 
+bool MegaHTTPServer::getCachedPropFind(handle h, const string &key, string &body, unsigned &generation)
+{
+    std::lock_guard<std::mutex> g(propFindMutex);
+    generation = propFindGeneration;
+
+    auto node = propFindCache.find(h);
+    if (node != propFindCache.end())
+    {
+        auto it = node->second.find(key);
+        if (it != node->second.end())
+        {
+            body = it->second;
+            return true;
+        }
+    }
+    return false;
+}
+
+void MegaHTTPServer::cachePropFind(handle h, const string &key, const string &body, unsigned generation)
+{
+    std::lock_guard<std::mutex> g(propFindMutex);
+
+    // nodes updated while it was rendered: it may be stale already
+    if (generation != propFindGeneration)
+    {
+        return;
+    }
+
+    if (propFindCache.size() >= MAX_PROPFIND_CACHE_NODES && !propFindCache.count(h))
+    {
+        propFindCache.clear();
+    }
+    propFindCache[h][key] = body;
+}
+
+void MegaHTTPServer::nodesUpdated(Node **n, int count)
+{
+    std::lock_guard<std::mutex> g(propFindMutex);
+    propFindGeneration++;
+
+    if (propFindCache.empty())
+    {
+        return;
+    }
+
+    for (int i = 0; n && i < count; i++)
+    {
+        // a move leaves a listing of the old parent that is no longer known
+        if (n[i]->changed.parent || !n[i]->parent)
+        {
+            n = NULL;
+            break;
+        }
+
+        // its own entry, and the listing of its parent
+        propFindCache.erase(n[i]->nodehandle);
+        propFindCache.erase(n[i]->parent->nodehandle);
+    }
+
+    if (!n)
+    {
+        propFindCache.clear();
+    }
+}
+
 char *MegaHTTPServer::getWebDavLink(MegaNode *node)
 {
     allowedWebDavHandles.insert(node->getHandle());
@@ -28418,8 +30793,6 @@ int MegaHTTPServer::onHeaderValue(http_parser *parser, const char *at, size_t le
 {
     MegaHTTPContext* httpctx = (MegaHTTPContext*) parser->data;
     string value(at, length);
-    size_t index;
-    char *endptr;
 
     LOG_verbose << " onHeaderValue: " << httpctx->lastheader << " = " << value;
     if (httpctx->lastheader == "depth")
@@ -28442,27 +30815,10 @@ int MegaHTTPServer::onHeaderValue(http_parser *parser, const char *at, size_t le
     {
         LOG_debug << "Range header value: " << value;
         httpctx->range = false;
-        if (length > 7 && !memcmp(at, "bytes=", 6)
-                && ((index = value.find_first_of('-')) != string::npos))
+        if (parseByteRanges(value, httpctx->requestedRanges))
         {
-            endptr = (char *)value.c_str();
-            unsigned long long number = strtoull(value.c_str() + 6, &endptr, 10);
-            if (endptr == value.c_str() || *endptr != '-' || number == ULLONG_MAX)
-            {
-                return 0;
-            }
-
-            httpctx->rangeStart = number;
-            if (length > (index + 1))
-            {
-                number = strtoull(value.c_str() + index + 1, &endptr, 10);
-                if (endptr == value.c_str() || *endptr != '\0' || number == ULLONG_MAX)
-                {
-                    return 0;
-                }
-                httpctx->rangeEnd = number;
-            }
-            LOG_debug << "Range value parsed: " << httpctx->rangeStart << " - " << httpctx->rangeEnd;
+            LOG_debug << "Range value parsed: " << httpctx->requestedRanges.size() << " ranges, from "
+                      << httpctx->requestedRanges[0].first << " - " << httpctx->requestedRanges[0].second;
         }
     }
     return 0;
@@ -28519,10 +30875,8 @@ int MegaHTTPServer::onBody(http_parser *parser, const char *b, size_t n)
     return 0;
 }
 
-string MegaHTTPServer::getWebDavProfFindNodeContents(MegaNode *node, string baseURL, bool offlineAttribute)
+void MegaHTTPServer::writeWebDavPropFindNodeContents(std::ostream &web, MegaNode *node, const string &baseURL, bool offlineAttribute)
 {
-    std::ostringstream web;
-
     web << "<d:response>\r\n"
            "<d:href>" << webdavurlescape(baseURL) << "</d:href>\r\n"
            "<d:propstat>\r\n"
@@ -28555,16 +30909,11 @@ string MegaHTTPServer::getWebDavProfFindNodeContents(MegaNode *node, string base
     web << "</d:prop>\r\n"
            "</d:propstat>\r\n";
     web << "</d:response>\r\n";
-    return web.str();
 }
 
 string MegaHTTPServer::getWebDavPropFindResponseForNode(string baseURL, string subnodepath, MegaNode *node, MegaHTTPContext* httpctx)
 {
     std::ostringstream response;
-    std::ostringstream web;
-
-    web << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n"
-           "<d:multistatus xmlns:d=\"DAV:\" xmlns:Z=\"urn:schemas-microsoft-com::\">\r\n";
 
     string subbaseURL = baseURL + subnodepath;
     if (node->isFolder() && subbaseURL.size() && subbaseURL.at(subbaseURL.size() - 1) != '/')
@@ -28572,29 +30921,46 @@ string MegaHTTPServer::getWebDavPropFindResponseForNode(string baseURL, string s
         subbaseURL.append("/");
     }
     MegaHTTPServer* httpserver = dynamic_cast<MegaHTTPServer *>(httpctx->server);
+    bool offline = httpserver->isOfflineAttributeEnabled();
+    bool listChildren = node->isFolder() && (httpctx->depth != 0);
+
+    // clients ask for the same folders over and over: render them once until they change
+    string key = subbaseURL;
+    key.append(listChildren ? "\n1" : "\n0").append(offline ? "1" : "0");
 
-    web << getWebDavProfFindNodeContents(node, subbaseURL, httpserver->isOfflineAttributeEnabled());
-    if (node->isFolder() && (httpctx->depth != 0))
+    string sweb;
+    unsigned generation;
+    if (!httpserver->getCachedPropFind(node->getHandle(), key, sweb, generation))
     {
-        MegaNodeList *children = httpctx->megaApi->getChildren(node, MegaApi::ORDER_NONE);
-        for (int i = 0; i < children->size(); i++)
+        std::ostringstream web;
+        web << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n"
+               "<d:multistatus xmlns:d=\"DAV:\" xmlns:Z=\"urn:schemas-microsoft-com::\">\r\n";
+
+        writeWebDavPropFindNodeContents(web, node, subbaseURL, offline);
+        if (listChildren)
         {
-            MegaNode *child = children->get(i);
-            string childURL = subbaseURL + child->getName();
-            web << getWebDavProfFindNodeContents(child, childURL, httpserver->isOfflineAttributeEnabled());
+            MegaNodeList *children = httpctx->megaApi->getChildren(node, MegaApi::ORDER_NONE);
+            for (int i = 0; i < children->size(); i++)
+            {
+                MegaNode *child = children->get(i);
+                writeWebDavPropFindNodeContents(web, child, subbaseURL + child->getName(), offline);
+            }
+            delete children;
         }
-        delete children;
-    }
 
-    web << "</d:multistatus>"
-           "\r\n";
+        web << "</d:multistatus>"
+               "\r\n";
+
+        sweb = web.str();
+        httpserver->cachePropFind(node->getHandle(), key, sweb, generation);
+    }
 
-    string sweb = web.str();
     response << "HTTP/1.1 207 Multi-Status\r\n"
                 "content-length: " << sweb.size() << "\r\n"
                                                      "content-type: application/xml; charset=utf-8\r\n"
                                                      "server: MEGAsdk\r\n"
-                                                     "\r\n";
+             << connectionHeader(httpctx)
+             << "\r\n";
     response << sweb;
     httpctx->resultCode = API_OK;
     return response.str();
@@ -28757,7 +31123,7 @@ string MegaHTTPServer::getResponseForNode(MegaNode *node, MegaHTTPContext* httpc
     string sweb = web.str();
     response << "HTTP/1.1 200 OK\r\n"
         << "Content-Type: text/html; charset=utf-8\r\n"
-        << "Connection: close\r\n"
+        << connectionHeader(httpctx)
         << "Content-Length: " << sweb.size() << "\r\n"
         << "Access-Control-Allow-Origin: *\r\n"
         << "\r\n";
@@ -28955,6 +31321,11 @@ int MegaHTTPServer::onMessageComplete(http_parser *parser)
     MegaHTTPContext* httpctx = (MegaHTTPContext*) parser->data;
     httpctx->bytesWritten = 0;
     httpctx->size = 0;
+
+    // the next request in the data received is parsed after this one is answered
+    http_parser_pause(parser, 1);
+    httpctx->requestPending = true;
+    httpctx->keepAliveRequested = http_should_keep_alive(parser) != 0;
     httpctx->streamingBuffer.setMaxBufferSize(httpctx->server->getMaxBufferSize());
     httpctx->streamingBuffer.setMaxOutputSize(httpctx->server->getMaxOutputSize());
 
@@ -29059,8 +31430,8 @@ int MegaHTTPServer::onMessageComplete(http_parser *parser)
         }
 
         response << "content-length: 0\r\n"
-        "Connection: close\r\n"
-        "\r\n";
+                 << connectionHeader(httpctx)
+                 << "\r\n";
 
         httpctx->resultCode = API_OK;
         string resstr = response.str();
@@ -29774,6 +32145,33 @@ int MegaHTTPServer::streamNode(MegaHTTPContext *httpctx)
     }
 
     m_off_t totalSize = node->getSize();
+    if (httpctx->requestedRanges.size())
+    {
+        // the satisfiable ones, in the order requested
+        for (auto& r : httpctx->requestedRanges)
+        {
+            m_off_t rstart = r.first < 0 ? std::max<m_off_t>(totalSize - r.second, 0) : r.first;
+            m_off_t rend = r.first < 0 || r.second < 0 || r.second >= totalSize ? totalSize : r.second + 1;
+            if (rstart < rend)
+            {
+                httpctx->ranges.push_back(std::make_pair(rstart, rend));
+            }
+        }
+        httpctx->requestedRanges.clear();
+
+        if (httpctx->ranges.size() > 1)
+        {
+            streamRanges(httpctx, mimeType);
+            delete [] mimeType;
+            return 0;
+        }
+
+        // a single part is sent as for a single range, and none is not satisfiable
+        httpctx->rangeStart = httpctx->ranges.size() ? httpctx->ranges[0].first : totalSize;
+        httpctx->rangeEnd = httpctx->ranges.size() ? httpctx->ranges[0].second - 1 : -1;
+        httpctx->ranges.clear();
+    }
+
     m_off_t start = 0;
     m_off_t end = totalSize - 1;
     if (httpctx->rangeStart >= 0)
@@ -29819,7 +32217,7 @@ int MegaHTTPServer::streamNode(MegaHTTPContext *httpctx)
     }
 
     response << "Content-Type: " << mimeType << "\r\n"
-        << "Connection: close\r\n"
+        << connectionHeader(httpctx)
         << "Content-Length: " << len << "\r\n"
         << "Access-Control-Allow-Origin: *\r\n"
         << "Accept-Ranges: bytes\r\n"
@@ -29850,19 +32248,346 @@ int MegaHTTPServer::streamNode(MegaHTTPContext *httpctx)
 
     LOG_debug << "Requesting range. From " << start << "  size " << len;
     httpctx->rangeWritten = 0;
-    if (start || len)
+    httpctx->streamPos = start;
+    if (len && openLocalFile(httpctx))
     {
+        // sent once the headers are
+        LOG_debug << "Sending the range from the synced file";
+    }
+    else if (start || len)
+    {
+        httpctx->activeStreams++;
         httpctx->megaApi->startStreaming(node, start, len, httpctx);
     }
     else
     {
-        MegaHTTPServer *httpserver = ((MegaHTTPServer *)httpctx->server);
+        // the request finishes when the headers are sent
         LOG_debug << "Skipping startStreaming call since empty file";
-        httpserver->processWriteFinished(httpctx, 0);
     }
     return 0;
 }
 
+void MegaHTTPServer::streamRanges(MegaHTTPContext *httpctx, const char *mimeType)
+{
+    MegaNode *node = httpctx->node;
+    m_off_t totalSize = node->getSize();
+
+    std::random_device rd;
+    char boundary[32];
+    snprintf(boundary, sizeof(boundary), "MEGAsdk%08x%08x", rd(), rd());
+
+    // every range is preceded by its part header, and the last one followed by the closing boundary
+    m_off_t len = 0;
+    for (size_t i = 0; i < httpctx->ranges.size(); i++)
+    {
+        std::ostringstream part;
+        part << (i ? "\r\n" : "") << "--" << boundary << "\r\n"
+             << "Content-Type: " << mimeType << "\r\n"
+             << "Content-Range: bytes " << httpctx->ranges[i].first << "-" << (httpctx->ranges[i].second - 1) << "/" << totalSize << "\r\n"
+             << "\r\n";
+        httpctx->rangeHeaders.push_back(part.str());
+        len += httpctx->rangeHeaders.back().size() + (httpctx->ranges[i].second - httpctx->ranges[i].first);
+    }
+    httpctx->rangeHeaders.push_back(string("\r\n--") + boundary + "--\r\n");
+    len += httpctx->rangeHeaders.back().size();
+
+    std::ostringstream response;
+    response << "HTTP/1.1 206 Partial Content\r\n"
+             << "Content-Type: multipart/byteranges; boundary=" << boundary << "\r\n"
+             << connectionHeader(httpctx)
+             << "Content-Length: " << len << "\r\n"
+             << "Access-Control-Allow-Origin: *\r\n"
+             << "Accept-Ranges: bytes\r\n"
+             << "\r\n";
+
+    httpctx->pause = false;
+    httpctx->lastBuffer = NULL;
+    httpctx->lastBufferLen = 0;
+    httpctx->rangeIndex = 0;
+    httpctx->rangeStart = httpctx->ranges[0].first;
+    httpctx->rangeEnd = httpctx->ranges[0].second;
+    if (httpctx->transfer)
+    {
+        httpctx->transfer->setStartPos(httpctx->ranges.front().first);
+        httpctx->transfer->setEndPos(httpctx->ranges.back().second - 1);
+    }
+
+    // the first part header goes with the headers
+    string resstr = response.str();
+    if (httpctx->parser.method != HTTP_HEAD)
+    {
+        resstr.append(httpctx->rangeHeaders[0]);
+        httpctx->streamingBuffer.init(len + response.str().size());
+        httpctx->size = len - httpctx->rangeHeaders[0].size();
+    }
+
+    sendHeaders(httpctx, &resstr);
+    if (httpctx->parser.method == HTTP_HEAD)
+    {
+        httpctx->ranges.clear();
+        return;
+    }
+
+    LOG_debug << "Requesting " << httpctx->ranges.size() << " ranges. From " << httpctx->rangeStart << " size " << (httpctx->rangeEnd - httpctx->rangeStart);
+    httpctx->rangeWritten = 0;
+    httpctx->streamPos = httpctx->rangeStart;
+    httpctx->activeStreams++;
+    httpctx->megaApi->startStreaming(node, httpctx->rangeStart, httpctx->rangeEnd - httpctx->rangeStart, httpctx);
+}
+
+string MegaHTTPServer::connectionHeader(MegaHTTPContext *httpctx)
+{
+    // only responses whose end the client can tell without the connection closing
+    httpctx->keepAlive = httpctx->keepAliveRequested;
+    return httpctx->keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+}
+
+void MegaHTTPServer::finishResponse(MegaHTTPContext *httpctx)
+{
+    if (!httpctx->keepAlive || closing)
+    {
+        closeConnection(httpctx);
+        return;
+    }
+
+    // see processAsyncEvent
+    httpctx->responseSent = true;
+    uv_async_send(&httpctx->asynchandle);
+}
+
+void MegaHTTPServer::processNextRequest(MegaHTTPContext *httpctx)
+{
+    LOG_debug << "Response sent. Waiting for the next request on the connection";
+    if (httpctx->transfer)
+    {
+        httpctx->megaApi->fireOnStreamingFinish(httpctx->transfer.release(), make_unique<MegaErrorPrivate>(httpctx->resultCode)); // transfer will be deleted in fireOnStreamingFinish
+    }
+    httpctx->resetRequest();
+
+    // requests received while the last one was answered
+    http_parser_pause(&httpctx->parser, 0);
+    string pipelined;
+    pipelined.swap(httpctx->pipelined);
+    if (pipelined.size())
+    {
+        uv_buf_t buf = uv_buf_init((char *)pipelined.data(), static_cast<unsigned>(pipelined.size()));
+        processReceivedData(httpctx, static_cast<ssize_t>(pipelined.size()), &buf);
+    }
+}
+
+bool MegaHTTPServer::parseByteRanges(const string &value, std::vector<std::pair<m_off_t, m_off_t>> &ranges)
+{
+    ranges.clear();
+    if (value.compare(0, 6, "bytes="))
+    {
+        return false;
+    }
+
+    // first-last, first- or -suffixlength, separated by commas
+    const char *p = value.c_str() + 6;
+    while (*p)
+    {
+        while (*p == ' ' || *p == '\t')
+        {
+            p++;
+        }
+
+        char *endptr;
+        m_off_t first = -1;
+        if (*p != '-')
+        {
+            first = strtoll(p, &endptr, 10);
+            if (endptr == p || first < 0)
+            {
+                break;
+            }
+            p = endptr;
+        }
+
+        if (*p++ != '-')
+        {
+            break;
+        }
+
+        m_off_t last = -1;
+        if (*p >= '0' && *p <= '9')
+        {
+            last = strtoll(p, &endptr, 10);
+            p = endptr;
+        }
+
+        if ((first < 0 && last <= 0) || (last >= 0 && first > last) || ranges.size() == MAX_BYTE_RANGES)
+        {
+            break;
+        }
+        ranges.push_back(std::make_pair(first, last));
+
+        while (*p == ' ' || *p == '\t')
+        {
+            p++;
+        }
+
+        if (!*p)
+        {
+            return true;
+        }
+
+        if (*p++ != ',')
+        {
+            break;
+        }
+    }
+
+    // the whole header is ignored when a part of it is invalid
+    ranges.clear();
+    return false;
+}
+
+bool MegaHTTPServer::openLocalFile(MegaHTTPContext *httpctx)
+{
+#if defined(ENABLE_SYNC) && defined(__linux__)
+    // sendfile() would skip the TLS layer
+    if (httpctx->server->useTLS)
+    {
+        return false;
+    }
+
+    string path = httpctx->megaApi->getLocalPath(httpctx->node);
+    if (path.empty())
+    {
+        return false;
+    }
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    // only while the file is still the synced version of the node
+    struct stat st;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode)
+            || st.st_size != httpctx->node->getSize()
+            || st.st_mtime != httpctx->node->getModificationTime())
+    {
+        LOG_debug << "The local file doesn't match the node. Streaming it";
+        ::close(fd);
+        return false;
+    }
+
+    uv_os_fd_t socketFd;
+    if (uv_fileno((uv_handle_t*)&httpctx->tcphandle, &socketFd))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    httpctx->localFile = fd;
+    httpctx->localFileOffset = httpctx->rangeStart;
+    httpctx->socketFd = socketFd;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void MegaHTTPServer::sendLocalFile(MegaHTTPContext *httpctx)
+{
+    // the socket is written from the threadpool, as sendfile() may block to read the file
+    httpctx->workPending = true;
+    httpctx->sendFileReq.data = httpctx;
+    if (int err = uv_queue_work(httpctx->tcphandle.loop, &httpctx->sendFileReq, sendLocalFileWork, onLocalFileSent))
+    {
+        httpctx->workPending = false;
+        LOG_warn << "Finishing due to an error queueing the sendfile: " << err;
+        closeConnection(httpctx);
+    }
+}
+
+void MegaHTTPServer::sendLocalFileWork(uv_work_t *req)
+{
+#if defined(ENABLE_SYNC) && defined(__linux__)
+    MegaHTTPContext *httpctx = (MegaHTTPContext *)req->data;
+    m_off_t remaining = std::min(SENDFILE_CHUNK_SIZE, httpctx->rangeEnd - httpctx->localFileOffset);
+    m_off_t sent = 0;
+    int idleseconds = 0;
+    int err = 0;
+
+    while (remaining > 0)
+    {
+        off_t offset = httpctx->localFileOffset;
+        ssize_t r = ::sendfile(httpctx->socketFd, httpctx->localFile, &offset, size_t(remaining));
+        if (r > 0)
+        {
+            httpctx->localFileOffset += r;
+            remaining -= r;
+            sent += r;
+            idleseconds = 0;
+        }
+        else if (!r)
+        {
+            // the file is shorter than it was
+            err = EIO;
+            break;
+        }
+        else if (errno == EAGAIN)
+        {
+            // the socket is non-blocking: wait for the client to take more
+            struct pollfd pfd;
+            pfd.fd = httpctx->socketFd;
+            pfd.events = POLLOUT;
+            pfd.revents = 0;
+            if (!poll(&pfd, 1, 1000) && ++idleseconds >= SENDFILE_TIMEOUT_SECONDS)
+            {
+                err = ETIMEDOUT;
+                break;
+            }
+        }
+        else if (errno != EINTR)
+        {
+            err = errno;
+            break;
+        }
+    }
+
+    httpctx->sendFileResult = err ? -err : sent;
+#endif
+}
+
+void MegaHTTPServer::onLocalFileSent(uv_work_t *req, int status)
+{
+    MegaHTTPContext *httpctx = (MegaHTTPContext *)req->data;
+    if (finishPendingWork(httpctx))
+    {
+        LOG_debug << "HTTP link closed during the sendfile";
+        return;
+    }
+
+    if (status < 0 || httpctx->sendFileResult < 0)
+    {
+        LOG_warn << "Finishing request. Sendfile failed: " << (status < 0 ? status : httpctx->sendFileResult);
+        closeConnection(httpctx);
+        return;
+    }
+
+    httpctx->bytesWritten += httpctx->sendFileResult;
+    httpctx->rangeWritten += httpctx->sendFileResult;
+    LOG_verbose << "Bytes sent from file: " << httpctx->sendFileResult << " Remaining: " << (httpctx->size - httpctx->bytesWritten);
+
+    if (httpctx->size == httpctx->bytesWritten)
+    {
+        LOG_debug << "Finishing request. All data sent";
+        if (httpctx->resultCode == API_EINTERNAL)
+        {
+            httpctx->resultCode = API_OK;
+        }
+        static_cast<MegaHTTPServer *>(httpctx->server)->finishResponse(httpctx);
+        return;
+    }
+
+    sendLocalFile(httpctx);
+}
+
 void MegaHTTPServer::sendHeaders(MegaHTTPContext *httpctx, string *headers)
 {
     LOG_debug << "Response headers: " << *headers;
@@ -29915,6 +32640,16 @@ void MegaHTTPServer::processAsyncEvent(MegaTCPContext* tcpctx)
         return;
     }
 
+    if (httpctx->responseSent)
+    {
+        // the streaming transfers report to the context until they finish
+        if (!httpctx->activeStreams)
+        {
+            processNextRequest(httpctx);
+        }
+        return;
+    }
+
     if (httpctx->failed)
     {
         LOG_warn << "Streaming transfer failed. Closing connection.";
@@ -29971,6 +32706,12 @@ void MegaHTTPServer::sendNextBytes(MegaHTTPContext *httpctx)
         return;
     }
 
+    if (httpctx->workPending)
+    {
+        LOG_verbose << "Skipping write due to an ongoing sendfile";
+        return;
+    }
+
     uv_mutex_lock(&httpctx->mutex);
     if (httpctx->lastBufferLen)
     {
@@ -29978,6 +32719,14 @@ void MegaHTTPServer::sendNextBytes(MegaHTTPContext *httpctx)
         httpctx->lastBufferLen = 0;
     }
 
+    if (httpctx->localFile >= 0 && !httpctx->streamingBuffer.availableData())
+    {
+        // the headers are sent: the rest comes from the file
+        uv_mutex_unlock(&httpctx->mutex);
+        sendLocalFile(httpctx);
+        return;
+    }
+
     if (httpctx->tcphandle.write_queue_size > httpctx->streamingBuffer.availableCapacity() / 8)
     {
         LOG_warn << "Skipping write. Too much queued data";
@@ -29985,19 +32734,29 @@ void MegaHTTPServer::sendNextBytes(MegaHTTPContext *httpctx)
         return;
     }
 
-    uv_buf_t resbuf = httpctx->streamingBuffer.nextBuffer();
+    unsigned int maxbufs = 2;
+#ifdef ENABLE_EVT_TLS
+    if (httpctx->server->useTLS)
+    {
+        maxbufs = 1;  // evt_tls_write() takes a single buffer
+    }
+#endif
+    uv_buf_t resbufs[2];
+    unsigned int nbufs = httpctx->streamingBuffer.nextBuffers(resbufs, maxbufs);
+    uv_buf_t resbuf = nbufs ? resbufs[0] : uv_buf_init(NULL, 0);
+    size_t writelen = nbufs > 1 ? resbuf.len + resbufs[1].len : resbuf.len;
     uv_mutex_unlock(&httpctx->mutex);
 
-    if (!resbuf.len)
+    if (!writelen)
     {
         LOG_verbose << "Skipping write. No data available";
         return;
     }
 
-    LOG_verbose << "Writing " << resbuf.len << " bytes";
-    httpctx->rangeWritten += resbuf.len;
+    LOG_verbose << "Writing " << writelen << " bytes in " << nbufs << " buffers";
+    httpctx->rangeWritten += writelen;
     httpctx->lastBuffer = resbuf.base;
-    httpctx->lastBufferLen = resbuf.len;
+    httpctx->lastBufferLen = writelen;
 
 #ifdef ENABLE_EVT_TLS
     if (httpctx->server->useTLS)
@@ -30016,7 +32775,7 @@ void MegaHTTPServer::sendNextBytes(MegaHTTPContext *httpctx)
         uv_write_t *req = new uv_write_t();
         req->data = httpctx;
 
-        if (int err = uv_write(req, (uv_stream_t*)&httpctx->tcphandle, &resbuf, 1, onWriteFinished))
+        if (int err = uv_write(req, (uv_stream_t*)&httpctx->tcphandle, resbufs, nbufs, onWriteFinished))
         {
             delete req;
             LOG_warn << "Finishing due to an error in uv_write: " << err;
@@ -30052,13 +32811,96 @@ MegaHTTPContext::MegaHTTPContext()
     overwrite = true; //GVFS-DAV via command line does not include this header (assumed true)
     lastBuffer = NULL;
     lastBufferLen = 0;
+    localFile = -1;
+    localFileOffset = 0;
+    socketFd = -1;
+    sendFileResult = 0;
+    keepAliveRequested = false;
+    keepAlive = false;
+    requestPending = false;
+    responseSent = false;
+    activeStreams = 0;
+    rangeIndex = 0;
+    streamPos = 0;
 
     // Mutex to protect the data buffer
     uv_mutex_init(&mutex_responses);
 }
 
+void MegaHTTPContext::resetRequest()
+{
+    bytesWritten = 0;
+    size = -1;
+    lastBuffer = NULL;
+    lastBufferLen = 0;
+    failed = false;
+    pause = false;
+    nodereceived = false;
+    resultCode = API_EINTERNAL;
+
+    range = false;
+    rangeStart = -1;
+    rangeEnd = -1;
+    rangeWritten = -1;
+    requestedRanges.clear();
+    ranges.clear();
+    rangeHeaders.clear();
+    rangeIndex = 0;
+    streamPos = 0;
+
+    delete node;
+    node = NULL;
+    path.clear();
+    nodehandle.clear();
+    nodekey.clear();
+    nodename.clear();
+    nodesize = -1;
+    nodepubauth.clear();
+    nodeprivauth.clear();
+    nodechatauth.clear();
+
+    depth = -1;
+    lastheader.clear();
+    subpathrelative.clear();
+    delete [] messageBody;
+    messageBody = NULL;
+    messageBodySize = 0;
+    host.clear();
+    destination.clear();
+    overwrite = true;
+    tmpFileAccess.reset();
+    if (tmpFileName.size())
+    {
+        LocalPath localPath = LocalPath::fromPath(tmpFileName, *server->fsAccess);
+        server->fsAccess->unlinklocal(localPath);
+        tmpFileName.clear();
+    }
+    newname.clear();
+    nodeToMove = UNDEF;
+    newParentNode = UNDEF;
+
+#if defined(ENABLE_SYNC) && defined(__linux__)
+    if (localFile >= 0)
+    {
+        ::close(localFile);
+    }
+#endif
+    localFile = -1;
+
+    keepAliveRequested = false;
+    keepAlive = false;
+    requestPending = false;
+    responseSent = false;
+}
+
 MegaHTTPContext::~MegaHTTPContext()
 {
+#if defined(ENABLE_SYNC) && defined(__linux__)
+    if (localFile >= 0)
+    {
+        ::close(localFile);
+    }
+#endif
     delete node;
     if (tmpFileName.size())
     {
@@ -30093,15 +32935,46 @@ bool MegaHTTPContext::onTransferData(MegaApi *, MegaTransfer *transfer, char *bu
 
     // append the data to the buffer
     uv_mutex_lock(&mutex);
-    long long remaining = size + (transfer->getTotalBytes() - transfer->getTransferredBytes());
+
+    // the header of the next part of a multipart response goes right after the range
+    bool rangeDone = ranges.size() && streamPos + m_off_t(size) >= rangeEnd;
+    long long nextHeader = rangeDone ? rangeHeaders[rangeIndex + 1].size() : 0;
+
+    long long remaining = size + (transfer->getTotalBytes() - transfer->getTransferredBytes()) + nextHeader;
     long long availableSpace = streamingBuffer.availableSpace();
-    if (remaining > availableSpace && availableSpace < (2 * m_off_t(size)))
+    if (remaining > availableSpace && availableSpace < (2 * m_off_t(size) + nextHeader))
     {
         LOG_debug << "Buffer full: " << availableSpace << " of "
                  << streamingBuffer.availableCapacity() << " bytes available only. Pausing streaming";
         pause = true;
     }
     streamingBuffer.append(buffer, static_cast<unsigned>(size));
+    streamPos += size;
+
+    if (rangeDone)
+    {
+        const string& header = rangeHeaders[++rangeIndex];
+        streamingBuffer.append(header.data(), static_cast<unsigned>(header.size()));
+
+        if (rangeIndex < ranges.size())
+        {
+            rangeStart = ranges[rangeIndex].first;
+            rangeEnd = ranges[rangeIndex].second;
+            streamPos = rangeStart;
+
+            // a paused streaming resumes at the new range (see MegaHTTPServer::processWriteFinished)
+            if (!pause)
+            {
+                LOG_debug << "Requesting the next range. From " << rangeStart << " size " << (rangeEnd - rangeStart);
+                activeStreams++;
+                megaApi->startStreaming(node, rangeStart, rangeEnd - rangeStart, this);
+            }
+        }
+        else
+        {
+            ranges.clear();
+        }
+    }
     uv_mutex_unlock(&mutex);
 
     // notify the HTTP server
@@ -30109,8 +32982,13 @@ bool MegaHTTPContext::onTransferData(MegaApi *, MegaTransfer *transfer, char *bu
     return !pause;
 }
 
-void MegaHTTPContext::onTransferFinish(MegaApi *, MegaTransfer *, MegaError *e)
+void MegaHTTPContext::onTransferFinish(MegaApi *, MegaTransfer *transfer, MegaError *e)
 {
+    if (transfer->isStreamingTransfer())
+    {
+        activeStreams--;
+    }
+
     if (finished)
     {
         LOG_debug << "HTTP link closed, ignoring the result of the transfer";
@@ -31214,6 +34092,8 @@ void MegaFTPServer::processReceivedData(MegaTCPContext *tcpctx, ssize_t nread, c
 #else
                 MegaFTPDataServer *fds = new MegaFTPDataServer(megaApi, basePath, ftpctx, useTLS, string(), string());
 #endif
+                fds->setMaxBufferSize(maxBufferSize ? maxBufferSize : DATA_BUFFER_SIZE);
+                fds->setMaxOutputSize(maxOutputSize ? maxOutputSize : DATA_OUTPUT_SIZE);
                 bool result = fds->start(ftpctx->pasiveport, localOnly);
                 if (result)
                 {
@@ -32268,16 +35148,23 @@ void MegaFTPDataServer::processReceivedData(MegaTCPContext *tcpctx, ssize_t nrea
             }
         }
 
+        // gathered, so that the file is written in a few large blocks rather than one per read
         if (nread > 0)
         {
-            LOG_verbose << " Writing " << nread << " bytes " << " to temporal file: " << ftpdatactx->tmpFileName;
-            if (!ftpdatactx->tmpFileAccess->fwrite((const byte*)buf->base, static_cast<unsigned>(nread), ftpdatactx->tmpFileSize) )
-            {
-                ftpdatactx->setControlCodeUponDataClose(450);
-                remotePathToUpload = ""; //empty, so that we don't read in the next connections
-                closeConnection(tcpctx);
-            }
-            ftpdatactx->tmpFileSize += nread;
+            ftpdatactx->storBuffer.append(buf->base, static_cast<size_t>(nread));
+        }
+
+        if ((nread < 0 || ftpdatactx->storBuffer.size() >= MegaFTPDataContext::STOR_WRITE_SIZE)
+                && !ftpdatactx->flushStorBuffer())
+        {
+            ftpdatactx->setControlCodeUponDataClose(450);
+            ftpdatactx->tmpFileAccess.reset();
+            LocalPath localPath = LocalPath::fromPath(ftpdatactx->tmpFileName, *fds->fsAccess);
+            fds->fsAccess->unlinklocal(localPath);
+            ftpdatactx->tmpFileName = ""; // not to be uploaded
+            remotePathToUpload = ""; //empty, so that we don't read in the next connections
+            closeConnection(tcpctx);
+            return;
         }
     }
     else
@@ -32517,19 +35404,29 @@ void MegaFTPDataServer::sendNextBytes(MegaFTPDataContext *ftpdatactx)
         return;
     }
 
-    uv_buf_t resbuf = ftpdatactx->streamingBuffer.nextBuffer();
+    unsigned int maxbufs = 2;
+#ifdef ENABLE_EVT_TLS
+    if (ftpdatactx->server->useTLS)
+    {
+        maxbufs = 1;  // evt_tls_write() takes a single buffer
+    }
+#endif
+    uv_buf_t resbufs[2];
+    unsigned int nbufs = ftpdatactx->streamingBuffer.nextBuffers(resbufs, maxbufs);
+    uv_buf_t resbuf = nbufs ? resbufs[0] : uv_buf_init(NULL, 0);
+    size_t writelen = nbufs > 1 ? resbuf.len + resbufs[1].len : resbuf.len;
     uv_mutex_unlock(&ftpdatactx->mutex);
 
-    if (!resbuf.len)
+    if (!writelen)
     {
         LOG_verbose << "Skipping write. No data available." << " buffered = " << ftpdatactx->streamingBuffer.availableData();
         return;
     }
 
-    LOG_verbose << "Writing " << resbuf.len << " bytes" << " buffered = " << ftpdatactx->streamingBuffer.availableData();
-    ftpdatactx->rangeWritten += resbuf.len;
+    LOG_verbose << "Writing " << writelen << " bytes in " << nbufs << " buffers" << " buffered = " << ftpdatactx->streamingBuffer.availableData();
+    ftpdatactx->rangeWritten += writelen;
     ftpdatactx->lastBuffer = resbuf.base;
-    ftpdatactx->lastBufferLen = resbuf.len;
+    ftpdatactx->lastBufferLen = writelen;
 
 #ifdef ENABLE_EVT_TLS
     if (ftpdatactx->server->useTLS)
@@ -32548,7 +35445,7 @@ void MegaFTPDataServer::sendNextBytes(MegaFTPDataContext *ftpdatactx)
         uv_write_t *req = new uv_write_t();
         req->data = ftpdatactx;
 
-        if (int err = uv_write(req, (uv_stream_t*)&ftpdatactx->tcphandle, &resbuf, 1, onWriteFinished))
+        if (int err = uv_write(req, (uv_stream_t*)&ftpdatactx->tcphandle, resbufs, nbufs, onWriteFinished))
         {
             delete req;
             LOG_warn << "Finishing due to an error in uv_write: " << err;
@@ -32583,6 +35480,24 @@ MegaFTPDataContext::~MegaFTPDataContext()
     delete node;
 }
 
+bool MegaFTPDataContext::flushStorBuffer()
+{
+    if (storBuffer.empty())
+    {
+        return true;
+    }
+
+    LOG_verbose << " Writing " << storBuffer.size() << " bytes " << " to temporal file: " << tmpFileName;
+    if (!tmpFileAccess->fwrite((const byte*)storBuffer.data(), static_cast<unsigned>(storBuffer.size()), tmpFileSize))
+    {
+        return false;
+    }
+
+    tmpFileSize += storBuffer.size();
+    storBuffer.clear();
+    return true;
+}
+
 void MegaFTPDataContext::setControlCodeUponDataClose(int code, string msg)
 {
     controlResponseCode = code;
@@ -33594,41 +36509,6 @@ long long MegaFolderInfoPrivate::getVersionsSize() const
     return versionsSize;
 }
 
-TreeProcFolderInfo::TreeProcFolderInfo()
-{
-    numFiles = 0;
-    numFolders = 0;
-    numVersions = 0;
-    currentSize = 0;
-    versionsSize = 0;
-}
-
-void TreeProcFolderInfo::proc(MegaClient *, Node *node)
-{
-    if (node->parent && node->parent->type == FILENODE)
-    {
-        numVersions++;
-        versionsSize += node->size;
-    }
-    else
-    {
-        if (node->type == FILENODE)
-        {
-            numFiles++;
-            currentSize += node->size;
-        }
-        else
-        {
-            numFolders++;
-        }
-    }
-}
-
-MegaFolderInfo *TreeProcFolderInfo::getResult()
-{
-    return new MegaFolderInfoPrivate(numFiles, numFolders - 1, numVersions, currentSize, versionsSize);
-}
-
 MegaTimeZoneDetailsPrivate::MegaTimeZoneDetailsPrivate(vector<std::string> *timeZones, vector<int> *timeZoneOffsets, int defaultTimeZone)
 {
     this->timeZones = *timeZones;
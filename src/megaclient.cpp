@@ -48,22 +48,14 @@ string MegaClient::GELBURL = "https://gelb.karere.mega.nz/";
 // root URL for chat stats
 string MegaClient::CHATSTATSURL = "https://stats.karere.mega.nz";
 
-// maximum number of concurrent transfers (uploads + downloads)
-const unsigned MegaClient::MAXTOTALTRANSFERS = 48;
-
-// maximum number of concurrent transfers (uploads or downloads)
-const unsigned MegaClient::MAXTRANSFERS = 32;
-
 // maximum number of queued putfa before halting the upload queue
 const int MegaClient::MAXQUEUEDFA = 30;
 
-// maximum number of concurrent putfa
+// number of concurrent putfa to start with, and the most they grow to
 const int MegaClient::MAXPUTFA = 10;
+const int MegaClient::MAXPUTFASLOTS = 40;
 
 #ifdef ENABLE_SYNC
-// hearbeat frequency
-static constexpr int FREQUENCY_HEARTBEAT_DS = 300;
-
 // //bin/SyncDebris/yyyy-mm-dd base folder name
 const char* const MegaClient::SYNCDEBRISFOLDERNAME = "SyncDebris";
 #endif
@@ -156,20 +148,71 @@ bool MegaClient::decryptkey(const char* sk, byte* tk, int tl, SymmCipher* sc, in
 // apply queued new shares
 void MegaClient::mergenewshares(bool notify)
 {
+    FetchNodesStats::PhaseTimer pt(startupphase(fnstats.mergeSharesTimeUs));
     newshare_list::iterator it;
+    node_vector keyed;
 
     for (it = newshares.begin(); it != newshares.end(); )
     {
         NewShare* s = *it;
 
-        mergenewshare(s, notify);
+        mergenewshare(s, notify, keyed);
 
         delete s;
         newshares.erase(it++);
     }
+
+    // the keys below the shares that got theirs are applied in one go, once per subtree
+    // (a share nested in another that also got its key is reached from the outer one)
+    if (!keyed.empty())
+    {
+        node_set roots(keyed.begin(), keyed.end());
+        TreeProcApplyKey td;
+
+        for (Node* n : roots)
+        {
+            Node* p = n->parent;
+            while (p && !roots.count(p))
+            {
+                p = p->parent;
+            }
+
+            if (!p)
+            {
+                proctree(n, &td);
+            }
+        }
+        td.apply(this);
+    }
+
+    // and the foreign keys of all the shares removed go in a single command
+    if (nodekeyrewrite.size())
+    {
+        reqs.add(new CommandNodeKeyUpdate(this, &nodekeyrewrite));
+        nodekeyrewrite.clear();
+    }
+}
+
+void MegaClient::indexoutshare(handle peer, handle h, bool add)
+{
+    if (add)
+    {
+        outsharesbypeer[peer].insert(h);
+        return;
+    }
+
+    auto it = outsharesbypeer.find(peer);
+    if (it != outsharesbypeer.end())
+    {
+        it->second.erase(h);
+        if (it->second.empty())
+        {
+            outsharesbypeer.erase(it);
+        }
+    }
 }
 
-void MegaClient::mergenewshare(NewShare *s, bool notify)
+void MegaClient::mergenewshare(NewShare *s, bool notify, node_vector& keyed)
 {
     bool skreceived = false;
     Node* n;
@@ -232,6 +275,7 @@ void MegaClient::mergenewshare(NewShare *s, bool notify)
                     {
                         Share *delshare = shareit->second;
                         n->outshares->erase(shareit);
+                        indexoutshare(s->peer, n->nodehandle, false);
                         found = true;
                         if (notify)
                         {
@@ -255,6 +299,7 @@ void MegaClient::mergenewshare(NewShare *s, bool notify)
                     {
                         Share *delshare = shareit->second;
                         n->pendingshares->erase(shareit);
+                        indexoutshare(s->pending, n->nodehandle, false);
                         found = true;
                         if (notify)
                         {
@@ -274,7 +319,7 @@ void MegaClient::mergenewshare(NewShare *s, bool notify)
                 // Erase sharekey if no outgoing shares (incl pending) exist
                 if (s->remove_key && !n->outshares && !n->pendingshares)
                 {
-                    rewriteforeignkeys(n);
+                    rewriteforeignkeys(n, false);
 
                     delete n->sharekey;
                     n->sharekey = NULL;
@@ -328,6 +373,7 @@ void MegaClient::mergenewshare(NewShare *s, bool notify)
                                     // erase from pending shares & delete the pending share list if needed
                                     Share *delshare = shareit->second;
                                     n->pendingshares->erase(shareit);
+                                    indexoutshare(s->pending, n->nodehandle, false);
                                     if (notify)
                                     {
                                         n->changed.pendingshares = true;
@@ -378,6 +424,7 @@ void MegaClient::mergenewshare(NewShare *s, bool notify)
                         else
                         {
                             *sharep = new Share(ISUNDEF(s->peer) ? NULL : finduser(s->peer, 1), s->access, s->ts, findpcr(s->pending));
+                            indexoutshare(ISUNDEF(s->pending) ? s->peer : s->pending, n->nodehandle, true);
                         }
 
                         if (notify)
@@ -442,8 +489,7 @@ void MegaClient::mergenewshare(NewShare *s, bool notify)
                 {
                     if (skreceived && notify)
                     {
-                        TreeProcApplyKey td;
-                        proctree(n, &td);
+                        keyed.push_back(n);
                     }
                 }
             }
@@ -986,21 +1032,19 @@ Node* MegaClient::childnodebyname(Node* p, const char* name, bool skipfolders)
     }
 
     fsaccess->normalize(&nname);
+    loadchildren(p);
 
-    for (node_list::iterator it = p->children.begin(); it != p->children.end(); it++)
+    for (Node* child : p->children.byname(nname.c_str()))
     {
-        if (!strcmp(nname.c_str(), (*it)->displayname()))
+        if (child->type != FILENODE && !skipfolders)
         {
-            if ((*it)->type != FILENODE && !skipfolders)
-            {
-                return *it;
-            }
+            return child;
+        }
 
-            found = *it;
-            if (skipfolders)
-            {
-                return found;
-            }
+        found = child;
+        if (skipfolders)
+        {
+            return found;
         }
     }
 
@@ -1042,15 +1086,13 @@ vector<Node*> MegaClient::childnodesbyname(Node* p, const char* name, bool skipf
     }
 
     fsaccess->normalize(&nname);
+    loadchildren(p);
 
-    for (node_list::iterator it = p->children.begin(); it != p->children.end(); it++)
+    for (Node* child : p->children.byname(nname.c_str()))
     {
-        if (nname == (*it)->displayname())
+        if (child->type == FILENODE || !skipfolders)
         {
-            if ((*it)->type == FILENODE || !skipfolders)
-            {
-                found.push_back(*it);
-            }
+            found.push_back(child);
         }
     }
 
@@ -1081,6 +1123,8 @@ void MegaClient::init()
     syncsup = true;
     syncdownrequired = false;
     syncuprequired = false;
+    syncdownfull = true;
+    syncupfull = true;
 
     if (syncscanstate)
     {
@@ -1097,6 +1141,7 @@ void MegaClient::init()
     }
 
     pendingsc.reset();
+    nextsc.reset();
     pendingscUserAlerts.reset();
     mBlocked = false;
     mBlockedSet = false;
@@ -1125,9 +1170,13 @@ void MegaClient::init()
     mOptimizePurgeNodes = false;
 }
 
-MegaClient::MegaClient(MegaApp* a, Waiter* w, HttpIO* h, FileSystemAccess* f, DbAccess* d, GfxProc* g, const char* k, const char* u, unsigned workerThreadCount)
+MegaClient::MegaClient(MegaApp* a, Waiter* w, HttpIO* h, FileSystemAccess* f, DbAccess* d, GfxProc* g, const char* k, const char* u, unsigned workerThreadCount, std::shared_ptr<MegaWorkerPool> workerPool)
     : useralerts(*this), btugexpiration(rng), btcs(rng), btbadhost(rng), btworkinglock(rng), btsc(rng), btpfa(rng), btheartbeat(rng)
-    , mAsyncQueue(*w, workerThreadCount)
+    , mAsyncQueue(*w, workerThreadCount, std::move(workerPool))
+    , fingerprinter(mAsyncQueue)
+#ifdef ENABLE_SYNC
+    , dirlister(mAsyncQueue, *f)
+#endif
 #ifdef ENABLE_SYNC
     , syncs(*this)
     , syncfslockretrybt(rng), syncdownbt(rng), syncnaglebt(rng), syncextrabt(rng), syncscanbt(rng)
@@ -1151,6 +1200,7 @@ MegaClient::MegaClient(MegaApp* a, Waiter* w, HttpIO* h, FileSystemAccess* f, Db
     versions_disabled = false;
     accountsince = 0;
     accountversion = 0;
+    clearDerivedKeys();
     gmfa_enabled = false;
     gfxdisabled = false;
     ssrs_enabled = false;
@@ -1233,6 +1283,8 @@ MegaClient::MegaClient(MegaApp* a, Waiter* w, HttpIO* h, FileSystemAccess* f, Db
     connections[PUT] = 3;
     connections[GET] = 4;
 
+    transferpolicy.reset(new FixedTransferConcurrency);
+
     int i;
 
     // initialize random client application instance ID (for detecting own
@@ -1333,6 +1385,8 @@ std::string MegaClient::getWritableLinkAuthKey(handle nodeHandle)
 void MegaClient::exec()
 {
     CodeCounter::ScopeTimer ccst(performanceStats.execFunction);
+    StallWatchdog::Scope scope("exec");
+    auto execStart = std::chrono::steady_clock::now();
 
     WAIT_CLASS::bumpds();
 
@@ -1476,6 +1530,7 @@ void MegaClient::exec()
         // file attribute puts (handled sequentially as a FIFO)
         if (activefa.size())
         {
+            CodeCounter::ScopeTimer fatimer(performanceStats.execFileAttributes);
             putfa_list::iterator curfa = activefa.begin();
             while (curfa != activefa.end())
             {
@@ -1574,6 +1629,11 @@ void MegaClient::exec()
                         delete fa;
                         curfa = activefa.erase(curfa);
                         LOG_debug << "Remaining file attributes: " << activefa.size() << " active, " << queuedfa.size() << " queued";
+
+                        if (queuedfa.size() && putfaslots < MAXPUTFASLOTS)
+                        {
+                            putfaslots++;
+                        }
                         btpfa.reset();
                         faretrying = false;
                         break;
@@ -1586,6 +1646,7 @@ void MegaClient::exec()
                         queuedfa.push_back(fa);
                         btpfa.backoff();
                         faretrying = true;
+                        putfaslots = std::max(MAXPUTFA, putfaslots / 2);
                         break;
 
                     default:
@@ -1597,20 +1658,37 @@ void MegaClient::exec()
         if (btpfa.armed())
         {
             faretrying = false;
-            while (queuedfa.size() && activefa.size() < MAXPUTFA)
-            {
-                // dispatch most recent file attribute put
-                putfa_list::iterator curfa = queuedfa.begin();
-                HttpReqCommandPutFA* fa = *curfa;
-                queuedfa.erase(curfa);
-                activefa.push_back(fa);
+            dispatchputfa();
+        }
 
-                LOG_debug << "Adding file attribute to the request queue";
-                fa->status = REQ_INFLIGHT;
-                reqs.add(fa);
+#ifdef USE_MEDIAINFO
+        if (!mediaFileInfo.extractionwaits.empty())
+        {
+            mediaFileInfo.checkExtractions(this);
+        }
+#endif
+
+        while (!facachehits.empty())
+        {
+            auto hit = std::move(facachehits.front());
+            facachehits.pop_front();
+
+            restag = hit.first->tag;
+            if (tmpnodecipher.setkey(&hit.first->nodekey))
+            {
+                tmpnodecipher.cbc_decrypt((byte*)hit.second.data(), hit.second.size());
+                app->fa_complete(hit.first->nodehandle, hit.first->type, hit.second.data(), uint32_t(hit.second.size()));
             }
         }
 
+        if (facache.capacity() && !facacheopened && (loggedin() || loggedinfolderlink()))
+        {
+            openfacache();
+        }
+
+        // what this pass fetched goes to disk together
+        facache.commit();
+
         if (fafcs.size())
         {
             // file attribute fetching (handled in parallel on a per-cluster basis)
@@ -1622,88 +1700,104 @@ void MegaClient::exec()
             {
                 fc = cit->second;
 
-                // is this request currently in flight?
-                switch (static_cast<reqstatus_t>(fc->req.status))
+                for (auto fit = fc->fetches.begin(); fit != fc->fetches.end(); )
                 {
-                    case REQ_SUCCESS:
-                        if (fc->req.contenttype.find("text/html") != string::npos
-                            && !memcmp(fc->req.posturl.c_str(), "http:", 5))
-                        {
-                            LOG_warn << "Invalid Content-Type detected downloading file attr: " << fc->req.contenttype;
-                            fc->urltime = 0;
-                            usehttps = true;
-                            app->notify_change_to_https();
+                    FileAttributeFetchChannel::Fetch& f = **fit;
+                    bool done = true;
 
-                            sendevent(99436, "Automatic change to HTTPS", 0);
-                        }
-                        else
-                        {
-                            fc->parse(cit->first, true);
-                        }
+                    // is this request currently in flight?
+                    switch (static_cast<reqstatus_t>(f.req.status))
+                    {
+                        case REQ_SUCCESS:
+                            if (f.req.contenttype.find("text/html") != string::npos
+                                && !memcmp(f.req.posturl.c_str(), "http:", 5))
+                            {
+                                LOG_warn << "Invalid Content-Type detected downloading file attr: " << f.req.contenttype;
+                                fc->urltime = 0;
+                                usehttps = true;
+                                app->notify_change_to_https();
 
-                        // notify app in case some attributes were not returned, then redispatch
-                        fc->failed();
-                        fc->req.disconnect();
-                        fc->req.status = REQ_PREPARED;
-                        fc->timeout.reset();
-                        fc->bt.reset();
-                        break;
+                                sendevent(99436, "Automatic change to HTTPS", 0);
+                            }
+                            else
+                            {
+                                fc->parse(f, true);
+                            }
 
-                    case REQ_INFLIGHT:
-                        if (!fc->req.httpio)
-                        {
+                            // notify app in case some attributes were not returned, then redispatch
+                            fc->failed(f.handles);
+                            f.req.disconnect();
+                            fc->bt.reset();
+
+                            // the servers keep up: fetch more at once, while there are more
+                            if (fc->fafs[0].size() && fc->maxfetches < FileAttributeFetchChannel::MAXFETCHES)
+                            {
+                                fc->maxfetches++;
+                            }
                             break;
-                        }
 
-                        if (fc->inbytes != fc->req.in.size())
-                        {
-                            httpio->lock();
-                            fc->parse(cit->first, false);
-                            httpio->unlock();
+                        case REQ_INFLIGHT:
+                            if (!f.req.httpio)
+                            {
+                                done = false;
+                                break;
+                            }
 
-                            fc->timeout.backoff(100);
+                            if (f.inbytes != f.req.in.size())
+                            {
+                                httpio->lock();
+                                fc->parse(f, false);
+                                httpio->unlock();
 
-                            fc->inbytes = fc->req.in.size();
-                        }
+                                f.timeout.backoff(100);
 
-                        if (!fc->timeout.armed()) break;
+                                f.inbytes = f.req.in.size();
+                            }
 
-                        LOG_warn << "Timeout getting file attr";
-                        // timeout! fall through...
-                    case REQ_FAILURE:
-                        LOG_warn << "Error getting file attr";
+                            if (!f.timeout.armed())
+                            {
+                                done = false;
+                                break;
+                            }
 
-                        if (fc->req.httpstatus && fc->req.contenttype.find("text/html") != string::npos
-                                && !memcmp(fc->req.posturl.c_str(), "http:", 5))
-                        {
-                            LOG_warn << "Invalid Content-Type detected on failed file attr: " << fc->req.contenttype;
-                            usehttps = true;
-                            app->notify_change_to_https();
+                            LOG_warn << "Timeout getting file attr";
+                            // timeout! fall through...
+                        case REQ_FAILURE:
+                            LOG_warn << "Error getting file attr";
 
-                            sendevent(99436, "Automatic change to HTTPS", 0);
-                        }
+                            if (f.req.httpstatus && f.req.contenttype.find("text/html") != string::npos
+                                    && !memcmp(f.req.posturl.c_str(), "http:", 5))
+                            {
+                                LOG_warn << "Invalid Content-Type detected on failed file attr: " << f.req.contenttype;
+                                usehttps = true;
+                                app->notify_change_to_https();
 
-                        fc->failed();
-                        fc->timeout.reset();
-                        fc->bt.backoff();
-                        fc->urltime = 0;
-                        fc->req.disconnect();
-                        fc->req.status = REQ_PREPARED;
-                    default:
-                        ;
+                                sendevent(99436, "Automatic change to HTTPS", 0);
+                            }
+
+                            fc->failed(f.handles);
+                            fc->bt.backoff();
+                            fc->urltime = 0;
+                            fc->maxfetches = 1;
+                            f.req.disconnect();
+                            break;
+
+                        default:
+                            // disconnected: ask again for what it didn't get
+                            fc->requeue(f);
+                    }
+
+                    fit = done ? fc->fetches.erase(fit) : fit + 1;
                 }
 
-                if (fc->req.status != REQ_INFLIGHT && fc->bt.armed() && (fc->fafs[1].size() || fc->fafs[0].size()))
+                if (!fc->gettingurl && fc->fetches.size() < fc->maxfetches && fc->bt.armed() && fc->fafs[0].size())
                 {
-                    fc->req.in.clear();
-
                     if (!fc->urltime || (Waiter::ds - fc->urltime) > 600)
                     {
                         // fetches pending for this unconnected channel - dispatch fresh connection
                         LOG_debug << "Getting fresh download URL";
-                        fc->timeout.reset();
                         reqs.add(new CommandGetFA(this, cit->first, fc->fahref));
-                        fc->req.status = REQ_INFLIGHT;
+                        fc->gettingurl = true;
                     }
                     else
                     {
@@ -1735,6 +1829,13 @@ void MegaClient::exec()
                         break;
 
                     case REQ_INFLIGHT:
+                        if (mFetchNodesStream && pendingcs->httpio && pendingcs->size())
+                        {
+                            httpio->lock();
+                            readfetchnodeschunk(pendingcs, false);
+                            httpio->unlock();
+                        }
+
                         if (pendingcs->contentlength > 0)
                         {
                             if (fetchingnodes && fnstats.timeToFirstByte == NEVER
@@ -1757,6 +1858,11 @@ void MegaClient::exec()
                         abortlockrequest();
                         app->request_response_progress(pendingcs->bufpos, -1);
 
+                        if (mFetchNodesStream)
+                        {
+                            readfetchnodeschunk(pendingcs, true);
+                        }
+
                         if (pendingcs->in != "-3" && pendingcs->in != "-4")
                         {
                             if (*pendingcs->in.c_str() == '[')
@@ -1780,28 +1886,20 @@ void MegaClient::exec()
 
                                 delete pendingcs;
                                 pendingcs = NULL;
+                                mFetchNodesStream.reset();
 
                                 notifypurge();
                                 if (sctable && pendingsccommit && !reqs.cmdspending())
                                 {
                                     LOG_debug << "Executing postponed DB commit";
-                                    sctable->commit();
+                                    {
+                                        ClientMetrics::Timer mt(metrics.dbCommit, "dbcommit");
+                                        sctable->commit();
+                                    }
                                     sctable->begin();
                                     app->notify_dbcommit();
                                     pendingsccommit = false;
-                                }
-
-                                // increment unique request ID
-                                for (int i = sizeof reqid; i--; )
-                                {
-                                    if (reqid[i]++ < 'z')
-                                    {
-                                        break;
-                                    }
-                                    else
-                                    {
-                                        reqid[i] = 'a';
-                                    }
+                                    writestatesnapshot();
                                 }
 
                                 if (mOnCSCompletion)
@@ -1934,6 +2032,19 @@ void MegaClient::exec()
                         csretrying = true;
                         LOG_warn << "Retrying cs request in " << btcs.retryin() << " ds";
 
+                        if (reason == RETRY_API_LOCK || reason == RETRY_RATE_LIMIT)
+                        {
+                            metrics.csEAgain++;
+                        }
+                        else if (reason == RETRY_SERVERS_BUSY)
+                        {
+                            metrics.csServerBusy++;
+                        }
+                        else
+                        {
+                            metrics.csFailures++;
+                        }
+
                         reqs.requeuerequest();
 
                     default:
@@ -1948,7 +2059,7 @@ void MegaClient::exec()
 
             if (btcs.armed())
             {
-                if (reqs.cmdspending())
+                if (reqs.cmdspending() && reqs.readytosend())
                 {
                     abortlockrequest();
                     pendingcs = new HttpReq();
@@ -1957,29 +2068,23 @@ void MegaClient::exec()
                     pendingcs_serverBusySent = false;
 
                     bool suppressSID = true;
-                    reqs.serverrequest(pendingcs->out, suppressSID, pendingcs->includesFetchingNodes);
-
-                    pendingcs->posturl = APIURL;
-
-                    pendingcs->posturl.append("cs?id=");
-                    pendingcs->posturl.append(reqid, sizeof reqid);
-                    pendingcs->posturl.append(getAuthURI(suppressSID));
-                    pendingcs->posturl.append(appkey);
+                    string id = nextreqid();
+                    reqs.serverrequest(pendingcs->out, suppressSID, pendingcs->includesFetchingNodes, id);
 
-                    string version = "v=2";
-                    pendingcs->posturl.append("&" + version);
-                    if (lang.size())
+                    // a retried 'f' starts over: the new response replaces whatever was read of the previous one
+                    mFetchNodesStream.reset();
+                    // (a merging reload needs the nodes in memory until it is read whole)
+                    if (pendingcs->includesFetchingNodes && streamfetchnodes && !reconcilingnodes)
                     {
-                        pendingcs->posturl.append("&");
-                        pendingcs->posturl.append(lang);
+                        mFetchNodesStream.reset(new FetchNodesStream);
+                        pendingcs->streamed = true;
                     }
-                    pendingcs->type = REQ_JSON;
 
                     performanceStats.csRequestWaitTime.start();
-                    pendingcs->post(this);
+                    postcs(pendingcs, id, suppressSID);
                     continue;
                 }
-                else
+                else if (!reqs.cmdspending())
                 {
                     btcs.reset();
                 }
@@ -1987,6 +2092,13 @@ void MegaClient::exec()
             break;
         }
 
+        execpipelinedcs();
+
+        if (httpio->dnscachechanged && statusTable)
+        {
+            savednscache();
+        }
+
         // handle the request for the last 50 UserAlerts
         if (pendingscUserAlerts)
         {
@@ -2054,6 +2166,8 @@ void MegaClient::exec()
 
                 if (*pendingsc->in.c_str() == '{')
                 {
+                    prefetchnextsc();
+
                     insca = false;
                     insca_notlast = false;
                     jsonsc.begin(pendingsc->in.c_str());
@@ -2070,16 +2184,19 @@ void MegaClient::exec()
                     }
                     else if (e == API_ETOOMANY)
                     {
-                        LOG_warn << "Too many pending updates - reloading local state";
+                        if (fetchingnodes || !reconcilenodes())
+                        {
+                            LOG_warn << "Too many pending updates - reloading local state";
 #ifdef ENABLE_SYNC
-                        failSyncs(TOO_MANY_ACTION_PACKETS);
+                            failSyncs(TOO_MANY_ACTION_PACKETS);
 #endif
-                        int creqtag = reqtag;
-                        reqtag = fetchnodestag; // associate with ongoing request, if any
-                        fetchingnodes = false;
-                        fetchnodestag = 0;
-                        fetchnodes(true);
-                        reqtag = creqtag;
+                            int creqtag = reqtag;
+                            reqtag = fetchnodestag; // associate with ongoing request, if any
+                            fetchingnodes = false;
+                            fetchnodestag = 0;
+                            fetchnodes(true);
+                            reqtag = creqtag;
+                        }
                     }
                     else if (e == API_EAGAIN || e == API_ERATELIMIT)
                     {
@@ -2204,9 +2321,22 @@ void MegaClient::exec()
                 // completed - initiate next SC request
                 pendingsc.reset();
                 btsc.reset();
+
+                // unless it was sent already, for the scsn we are at now
+                if (nextsc)
+                {
+                    if (nextscsn == scsn.text() && !scsn.stopped() && !useralerts.begincatchup)
+                    {
+                        pendingsc = std::move(nextsc);
+
+                        // the timeout counts from now: it may have had nothing to wait for until now
+                        pendingsc->lastdata = Waiter::ds;
+                    }
+                    nextsc.reset();
+                }
             }
 #ifdef ENABLE_SYNC
-            else
+            else if (!scsliced)
             {
                 // remote changes require immediate attention of syncdown()
                 syncdownrequired = true;
@@ -2215,7 +2345,7 @@ void MegaClient::exec()
 #endif
         }
 
-        if (!pendingsc && !pendingscUserAlerts && scsn.ready() && btsc.armed() && !mBlocked)
+        if (!pendingsc && !pendingscUserAlerts && scsn.ready() && btsc.armed() && !mBlocked && !browsingonly())
         {
             if (useralerts.begincatchup)
             {
@@ -2233,24 +2363,7 @@ void MegaClient::exec()
             else
             {
                 pendingsc.reset(new HttpReq());
-                pendingsc->logname = clientname + "sc ";
-                if (scnotifyurl.size())
-                {
-                    pendingsc->posturl = scnotifyurl;
-                }
-                else
-                {
-                    pendingsc->posturl = APIURL;
-                    pendingsc->posturl.append("wsc");
-                }
-
-                pendingsc->protect = true;
-                pendingsc->posturl.append("?sn=");
-                pendingsc->posturl.append(scsn.text());
-                pendingsc->posturl.append(getAuthURI());
-
-                pendingsc->type = REQ_JSON;
-                pendingsc->post(this);
+                postsc(pendingsc.get(), scsn.text());
             }
             jsonsc.pos = NULL;
         }
@@ -2314,9 +2427,35 @@ void MegaClient::exec()
             }
         }
 
+        if (cachefingerprints)
+        {
+            if (!fingerprintcacheopened)
+            {
+                openfingerprintcache();
+            }
+
+            // what this pass fingerprinted goes to disk together
+            fingerprintcache.commit();
+        }
+
+        // the time of day may have moved on to other rules
+        if (!transferraterules.empty() && nexttransferratesds <= Waiter::ds)
+        {
+            applytransferraterules();
+        }
+
         // fill transfer slots from the queue
         if (nextDispatchTransfersDs <= Waiter::ds)
         {
+            // what the concurrency policy goes by
+            unsigned active[2] = { 0, 0 };
+            for (TransferSlot* ts : tslots)
+            {
+                active[ts->transfer->type]++;
+            }
+            transferpolicy->sample(Waiter::ds, GET, httpio->downloadSpeed, active[GET]);
+            transferpolicy->sample(Waiter::ds, PUT, httpio->uploadSpeed, active[PUT]);
+
             size_t lastCount = 0;
             size_t transferCount = transfers[GET].size() + transfers[PUT].size();
             do
@@ -2332,6 +2471,11 @@ void MegaClient::exec()
 
             // don't run this too often or it may use a lot of cpu without starting new transfers, if the list is long
             nextDispatchTransfersDs = transferCount ? Waiter::ds + 1 : 0;
+
+            if (prefetchdownloadurls)
+            {
+                prefetchurls();
+            }
         }
 
 #ifndef EMSCRIPTEN
@@ -2343,8 +2487,18 @@ void MegaClient::exec()
 
         if (!mBlocked) // handle active unpaused transfers
         {
+            CodeCounter::ScopeTimer transferstimer(performanceStats.execTransfers);
             DBTableTransactionCommitter committer(tctable);
 
+            // downloads verified on the workers complete in the order they finished
+            while (!verifyingdownloads.empty() && verifyingdownloads.front()->verification->done)
+            {
+                Transfer* t = verifyingdownloads.front();
+                verifyingdownloads.pop_front();
+                t->verification->queued = false;
+                t->complete(committer);
+            }
+
             while (slotit != tslots.end())
             {
                 transferslot_list::iterator it = slotit;
@@ -2363,6 +2517,8 @@ void MegaClient::exec()
         }
 
 #ifdef ENABLE_SYNC
+        CodeCounter::ScopeTimer syncstimer(performanceStats.execSyncs);
+
         // verify filesystem fingerprints, disable deviating syncs
         // (this covers mountovers, some device removals and some failures)
         syncs.forEachRunningSync([&](Sync* sync){
@@ -2439,6 +2595,8 @@ void MegaClient::exec()
                 syncsup = true;
                 syncactivity = true;
                 syncdownrequired = true;
+                syncdownfull = true;
+                syncupfull = true;
             }
         }
 
@@ -2535,7 +2693,7 @@ void MegaClient::exec()
 
                         syncs.stopCancelledFailedDisabled();
 
-                        syncs.forEachRunningSync_shortcircuit([&](Sync* sync) {
+                        syncs.forEachRunningSyncByScanQueue(q, [&](Sync* sync, std::chrono::steady_clock::time_point deadline) {
 
                             if (sync->state == SYNC_ACTIVE || sync->state == SYNC_INITIALSCAN)
                             {
@@ -2546,7 +2704,7 @@ void MegaClient::exec()
 
                                     syncops = true;
 
-                                    if ((dsretry = sync->procscanq(q)))
+                                    if ((dsretry = sync->procscanq(q, deadline)))
                                     {
                                         // we resume processing after dsretry has elapsed
                                         // (to avoid open-after-creation races with e.g. MS Office)
@@ -2617,7 +2775,7 @@ void MegaClient::exec()
                 {
                     syncs.forEachRunningSync([&](Sync* sync) {
 
-                        sync->cachenodes();
+                        sync->cachenodesifdue();
 
                         totalpending += sync->dirnotify->notifyq[q].size();
                         Notification notification;
@@ -2755,6 +2913,11 @@ void MegaClient::exec()
                             });
                             syncuprequired = !syncupdone || repeatsyncup;
 
+                            if (syncupdone)
+                            {
+                                syncupfull = false;
+                            }
+
                             if (EVER(nds))
                             {
                                 if (!syncnagleretry || (nds - Waiter::ds) < syncnaglebt.backoffdelta())
@@ -2799,6 +2962,7 @@ void MegaClient::exec()
                                             // recursively delete all LocalNodes that were deleted (not moved or renamed!)
                                             DBTableTransactionCommitter committer(tctable);  //  just one db transaction to remove all the LocalNodes that get deleted
                                             sync->deletemissing(sync->localroot.get());
+                                            sync->prunepolled();
                                             sync->cachenodes();
                                         }
 
@@ -2829,6 +2993,15 @@ void MegaClient::exec()
                                                 sync->dirnotify->mErrorCount = 0;
                                                 sync->fullscan = true;
                                                 sync->scanseqno++;
+
+                                                // the changes missed could be anywhere
+                                                syncdownfull = true;
+                                                syncupfull = true;
+                                            }
+                                            else if (!failed && !fsaccess->notifyfailed
+                                                     && !sync->dirnotify->mErrorCount.load() && !fsaccess->notifyerr)
+                                            {
+                                                sync->updatechangecursor();
                                             }
                                         }
                                     }
@@ -2888,7 +3061,8 @@ void MegaClient::exec()
                         else
                         {
                             LocalPath localpath = sync->localroot->localname;
-                            if (sync->state == SYNC_ACTIVE || sync->state == SYNC_INITIALSCAN)
+                            if ((sync->state == SYNC_ACTIVE || sync->state == SYNC_INITIALSCAN)
+                                    && sync->getConfig().isDownSync())
                             {
                                 LOG_debug << "Running syncdown on demand";
                                 if (!syncdown(sync->localroot.get(), localpath, true))
@@ -2905,6 +3079,8 @@ void MegaClient::exec()
                         }
                     });
 
+                    syncdownfull = false;
+
                     // notify the app if a lock is being retried
                     if (success)
                     {
@@ -2939,9 +3115,11 @@ void MegaClient::exec()
 
         // Flush changes made to internal configs.
         syncs.syncConfigDBFlush();
+        syncstimer.complete();
 #endif
 
         notifypurge();
+        evictnodes();
 
         if (!badhostcs && badhosts.size() && btbadhost.armed())
         {
@@ -2981,8 +3159,7 @@ void MegaClient::exec()
 #ifdef ENABLE_SYNC
         if (btheartbeat.armed())
         {
-            syncs.mHeartBeatMonitor->beat();
-            btheartbeat.backoff(FREQUENCY_HEARTBEAT_DS);
+            btheartbeat.backoff(syncs.mHeartBeatMonitor->beat());
         }
 #endif
 
@@ -3004,7 +3181,29 @@ void MegaClient::exec()
 
         httpio->updatedownloadspeed();
         httpio->updateuploadspeed();
-    } while (httpio->doio() || execdirectreads() || (!pendingcs && reqs.cmdspending() && btcs.armed()) || looprequested);
+    } while (httpio->doio() || execdirectreads() || (!pendingcs && reqs.cmdspending() && btcs.armed() && reqs.readytosend()) || looprequested);
+
+    if (!dirtytransfers.empty() && Waiter::ds >= transfercachedirtyds + TRANSFERCACHEFLUSHDS)
+    {
+        flushtransfercache();
+    }
+
+    if (!putnodesbatches.empty() && Waiter::ds >= putnodesbatchds + PUTNODESBATCHDS)
+    {
+        flushputnodes();
+    }
+
+    if (compactstatecache && sctable && Waiter::ds >= nextstatecachereclaim)
+    {
+        reclaimstatecache();
+    }
+
+    if (readonlystatecache && sctable && Waiter::ds >= nextsctablecheck)
+    {
+        checksctable();
+    }
+
+    runslicedjobs();
 
 
     NodeCounter storagesum;
@@ -3032,6 +3231,8 @@ void MegaClient::exec()
         LOG_info << performanceStats.report(false, httpio, waiter, reqs);
     }
 #endif
+
+    metrics.exec.record(std::chrono::steady_clock::now() - execStart);
 }
 
 // get next event time from all subsystems, then invoke the waiter if needed
@@ -3108,7 +3309,7 @@ int MegaClient::preparewait()
         }
 
         // retry failed server-client requests
-        if (!pendingsc && !pendingscUserAlerts && scsn.ready() && !mBlocked)
+        if (!pendingsc && !pendingscUserAlerts && scsn.ready() && !mBlocked && !browsingonly())
         {
             btsc.update(&nds);
         }
@@ -3138,11 +3339,15 @@ int MegaClient::preparewait()
         // retry failed file attribute gets
         for (fafc_map::iterator cit = fafcs.begin(); cit != fafcs.end(); cit++)
         {
-            if (cit->second->req.status == REQ_INFLIGHT)
+            for (auto& f : cit->second->fetches)
             {
-                cit->second->timeout.update(&nds);
+                if (f->req.status == REQ_INFLIGHT)
+                {
+                    f->timeout.update(&nds);
+                }
             }
-            else if (cit->second->fafs[1].size() || cit->second->fafs[0].size())
+
+            if (cit->second->fafs[0].size())
             {
                 cit->second->bt.update(&nds);
             }
@@ -3169,7 +3374,52 @@ int MegaClient::preparewait()
             btugexpiration.update(&nds);
         }
 
+        // the next slice of the jobs left, or of the action packets
+        if (!slicedjobs.empty() || (scsliced && jsonsc.pos))
+        {
+            nds = Waiter::ds;
+        }
+
+        // batched transfer cache records
+        if (!dirtytransfers.empty())
+        {
+            dstime flushds = transfercachedirtyds + TRANSFERCACHEFLUSHDS;
+            if (flushds < nds)
+            {
+                nds = (flushds > Waiter::ds) ? flushds : Waiter::ds;
+            }
+        }
+
+        // uploads waiting for their putnodes
+        if (!putnodesbatches.empty())
+        {
+            dstime flushds = putnodesbatchds + PUTNODESBATCHDS;
+            if (flushds < nds)
+            {
+                nds = (flushds > Waiter::ds) ? flushds : Waiter::ds;
+            }
+        }
+
+        // commits of the owner of the local cache
+        if (readonlystatecache && sctable && nextsctablecheck < nds)
+        {
+            nds = (nextsctablecheck > Waiter::ds) ? nextsctablecheck : Waiter::ds;
+        }
+
 #ifdef ENABLE_SYNC
+        // sync state caches waiting for their next write
+        if (syncstatecacheflushds)
+        {
+            syncs.forEachRunningSync([&](Sync* sync)
+            {
+                dstime flushds = sync->statecacheflushds();
+                if (flushds < nds)
+                {
+                    nds = (flushds > Waiter::ds) ? flushds : Waiter::ds;
+                }
+            });
+        }
+
         // sync rescan
         if (syncscanfailed)
         {
@@ -3426,14 +3676,14 @@ bool MegaClient::abortbackoff(bool includexfers)
         r = true;
     }
 
-    if (activefa.size() < MAXPUTFA && btpfa.arm())
+    if (activefa.size() < size_t(putfaslots) && btpfa.arm())
     {
         r = true;
     }
 
     for (fafc_map::iterator it = fafcs.begin(); it != fafcs.end(); it++)
     {
-        if (it->second->req.status != REQ_INFLIGHT && it->second->bt.arm())
+        if (!it->second->gettingurl && it->second->fetches.size() < it->second->maxfetches && it->second->bt.arm())
         {
             r = true;
         }
@@ -3453,6 +3703,7 @@ void MegaClient::dispatchTransfers()
     }
 
     CodeCounter::ScopeTimer ccst(performanceStats.dispatchTransfers);
+    ClientMetrics::Timer mt(metrics.dispatchTransfers, "dispatchtransfers");
 
     struct counter
     {
@@ -3493,13 +3744,14 @@ void MegaClient::dispatchTransfers()
             TransferCategory tc(t);
 
             // hard limit on puts/gets
-            if (counters[tc.directionIndex()].total >= MAXTRANSFERS)
+            unsigned maxTransfers = transferpolicy->maxTransfers(tc.direction);
+            if (counters[tc.directionIndex()].total >= maxTransfers)
             {
                 return false;
             }
 
             // only request half the max at most, to get a quicker response from the API and get overlap with transfers going
-            if (counters[tc.directionIndex()].added >= MAXTRANSFERS/2)
+            if (counters[tc.directionIndex()].added >= maxTransfers/2)
             {
                 return false;
             }
@@ -3512,9 +3764,7 @@ void MegaClient::dispatchTransfers()
 
             // queue up enough transfers that we can expect to keep busy for at least the next 30 seconds in this category
             m_off_t speed = (tc.direction == GET) ? httpio->downloadSpeed : httpio->uploadSpeed;
-            m_off_t targetOutstanding = 30 * speed;
-            targetOutstanding = std::max<m_off_t>(targetOutstanding, 2 * 1024 * 1024);
-            targetOutstanding = std::min<m_off_t>(targetOutstanding, 100 * 1024 * 1024);
+            m_off_t targetOutstanding = transferpolicy->targetOutstanding(tc.direction, speed);
 
             if (counters[tc.index()].remainingsum >= targetOutstanding)
             {
@@ -3527,7 +3777,16 @@ void MegaClient::dispatchTransfers()
             return true;
         };
 
-    std::array<vector<Transfer*>, 6> nextInCategory = transferlist.nexttransfers(testAddTransferFunction);
+    // the hard limits above hold for both categories of a direction
+    std::function<bool(direction_t)> directionFullFunction = [&counters, this](direction_t direction)
+        {
+            TransferCategory tc(direction, LARGEFILE);
+            unsigned maxTransfers = transferpolicy->maxTransfers(direction);
+            return counters[tc.directionIndex()].total >= maxTransfers
+                || counters[tc.directionIndex()].added >= maxTransfers/2;
+        };
+
+    std::array<vector<Transfer*>, 6> nextInCategory = transferlist.nexttransfers(testAddTransferFunction, directionFullFunction);
 
     // Iterate the 4 combinations in this order:
     static const TransferCategory categoryOrder[] = {
@@ -3539,6 +3798,14 @@ void MegaClient::dispatchTransfers()
 
     DBTableTransactionCommitter committer(tctable);
 
+    // the imagery of the uploads started already is still to be made: the images wait, rather
+    // than have more decoded bitmaps and uploads on hold pile up
+    bool gfxbehind = !gfxdisabled && gfx && gfx->behind();
+    if (gfxbehind)
+    {
+        LOG_debug << "Media file processing behind, holding image uploads";
+    }
+
     for (auto category : categoryOrder)
     {
         for (Transfer *nexttransfer : nextInCategory[category.index()])
@@ -3555,6 +3822,19 @@ void MegaClient::dispatchTransfers()
                 break;
             }
 
+            if (category.direction == GET && TransferBufferPool::instance().overCeiling())
+            {
+                // the downloads in progress hold all the buffer memory allowed: let them free some first
+                LOG_debug << "Transfer buffer ceiling reached: " << TransferBufferPool::instance().inUse();
+                break;
+            }
+
+            if (gfxbehind && category.direction == PUT && !nexttransfer->uploadhandle && !nexttransfer->files.empty()
+                    && gfx->isgfx(nexttransfer->files.front()->localname))
+            {
+                continue;
+            }
+
             if (nexttransfer->localfilename.empty())
             {
                 // this is a fresh transfer rather than the resumption of a partly
@@ -3700,6 +3980,19 @@ void MegaClient::dispatchTransfers()
 
                 if (openfinished && openok)
                 {
+                    if (nexttransfer->type == GET && preallocatedownloads
+                            && nexttransfer->size >= PREALLOCATEDOWNLOADSIZE)
+                    {
+                        // the space already reserved by an earlier session is kept
+                        ts->fa->fpreallocate(nexttransfer->size);
+                    }
+                    else if (nexttransfer->type == PUT && readuploadsonce
+                            && nexttransfer->size >= READONCEUPLOADSIZE)
+                    {
+                        // the file is only really opened to read each chunk
+                        ts->fa->setreadonce();
+                    }
+
                     NodeHandle h;
                     bool hprivate = true;
                     const char *privauth = NULL;
@@ -3765,7 +4058,9 @@ void MegaClient::dispatchTransfers()
                             if (!gfxdisabled && gfx && gfx->isgfx(nexttransfer->localfilename))
                             {
                                 // we want all imagery to be safely tucked away before completing the upload, so we bump minfa
-                                nexttransfer->minfa += gfx->gendimensionsputfa(ts->fa, nexttransfer->localfilename, nexttransfer->uploadhandle, nexttransfer->transfercipher(), -1, false);
+                                // (the uploads of syncs make way for those the app asked for)
+                                bool background = !nexttransfer->files.empty() && nexttransfer->files.front()->syncxfer;
+                                nexttransfer->minfa += gfx->gendimensionsputfa(ts->fa, nexttransfer->localfilename, nexttransfer->uploadhandle, nexttransfer->transfercipher(), -1, false, background);
                             }
                         }
                     }
@@ -3790,6 +4085,29 @@ void MegaClient::dispatchTransfers()
                         }
                     }
 
+                    if (nexttransfer->urlprefetch)
+                    {
+                        // the slot asks for its own
+                        nexttransfer->urlprefetch->cancel();
+                        nexttransfer->urlprefetch = NULL;
+                    }
+
+                    if (nexttransfer->urlprefetchds && Waiter::ds - nexttransfer->urlprefetchds > PREFETCHURLSEXPIRYDS)
+                    {
+                        LOG_debug << "Prefetched download URLs expired";
+                        nexttransfer->tempurls.clear();
+                    }
+                    nexttransfer->urlprefetchds = 0;
+
+                    m_off_t cachedsize;
+                    if (nexttransfer->type == GET && nexttransfer->tempurls.empty() && !h.isUndef()
+                            && cachedtempurls(h.as8byte(), hprivate, nexttransfer->tempurls, cachedsize)
+                            && cachedsize != nexttransfer->size)
+                    {
+                        // the API would tell of the new size: ask
+                        nexttransfer->tempurls.clear();
+                    }
+
                     // dispatch request for temporary source/target URL
                     if (nexttransfer->tempurls.size())
                     {
@@ -3845,6 +4163,47 @@ void MegaClient::dispatchTransfers()
     }
 }
 
+void MegaClient::prefetchurls()
+{
+    unsigned ahead = 0;
+
+    for (Transfer* t : transferlist.transfers[GET])
+    {
+        if (ahead >= PREFETCHURLS)
+        {
+            break;
+        }
+
+        if (t->slot || t->state == TRANSFERSTATE_PAUSED || t->state == TRANSFERSTATE_COMPLETING || !t->bt.armed())
+        {
+            continue;
+        }
+
+        ahead++;
+
+        if (t->urlprefetch
+                || (t->tempurls.size() && (!t->urlprefetchds || Waiter::ds - t->urlprefetchds <= PREFETCHURLSEXPIRYDS)))
+        {
+            continue;
+        }
+
+        // the same file whose credentials the slot would use
+        for (File* f : t->files)
+        {
+            if (!f->hprivate || f->hforeign || nodeByHandle(f->h))
+            {
+                t->tempurls.clear();
+                t->urlprefetchds = 0;
+                reqs.add(t->urlprefetch = new CommandGetFile(this, t, f->h.as8byte(), f->hprivate,
+                                                              f->privauth.size() ? f->privauth.c_str() : NULL,
+                                                              f->pubauth.size() ? f->pubauth.c_str() : NULL,
+                                                              f->chatauth));
+                break;
+            }
+        }
+    }
+}
+
 // generate upload handle for this upload
 // (after 65536 uploads, a node handle clash is possible, but far too unlikely
 // to be of real-world concern)
@@ -3932,6 +4291,8 @@ void MegaClient::freeq(direction_t d)
     transfers[d].clear();
     transferlist.transfers[GET].clear();
     transferlist.transfers[PUT].clear();
+    transferlist.classcounts[GET].fill(0);
+    transferlist.classcounts[PUT].fill(0);
 }
 
 bool MegaClient::isFetchingNodesPendingCS()
@@ -3948,6 +4309,204 @@ void MegaClient::nexttransferretry(direction_t d, dstime* dsmin)
     }
 }
 
+string MegaClient::nextreqid()
+{
+    string id(reqid, sizeof reqid);
+
+    for (int i = sizeof reqid; i--; )
+    {
+        if (reqid[i]++ < 'z')
+        {
+            break;
+        }
+        else
+        {
+            reqid[i] = 'a';
+        }
+    }
+
+    return id;
+}
+
+void MegaClient::postcs(HttpReq* req, const string& id, bool suppressSID)
+{
+    req->posturl = APIURL;
+
+    req->posturl.append("cs?id=");
+    req->posturl.append(id);
+    req->posturl.append(getAuthURI(suppressSID));
+    req->posturl.append(appkey);
+
+    string version = "v=2";
+    req->posturl.append("&" + version);
+    if (lang.size())
+    {
+        req->posturl.append("&");
+        req->posturl.append(lang);
+    }
+    req->type = REQ_JSON;
+
+    req->post(this);
+}
+
+void MegaClient::postsc(HttpReq* req, const char* sn)
+{
+    req->logname = clientname + "sc ";
+    if (scnotifyurl.size())
+    {
+        req->posturl = scnotifyurl;
+    }
+    else
+    {
+        req->posturl = APIURL;
+        req->posturl.append("wsc");
+    }
+
+    req->protect = true;
+    req->posturl.append("?sn=");
+    req->posturl.append(sn);
+    req->posturl.append(getAuthURI());
+
+    req->type = REQ_JSON;
+    req->post(this);
+}
+
+void MegaClient::prefetchnextsc()
+{
+    static const char packets[] = "{\"a\":[";
+    static const char snkey[] = ",\"sn\":\"";
+
+    nextsc.reset();
+
+    // the catch-up after a fetchnodes keeps to one request at a time
+    const string& in = pendingsc->in;
+    if (!prefetchsc || fetchingnodes || !statecurrent || useralerts.begincatchup
+            || in.compare(0, sizeof packets - 1, packets))
+    {
+        return;
+    }
+
+    // the sn element is the last one (see procsc())
+    size_t pos = in.rfind(snkey);
+    if (pos == string::npos || in.size() < 2 || in.compare(in.size() - 2, 2, "\"}"))
+    {
+        return;
+    }
+
+    pos += sizeof snkey - 1;
+    nextscsn = in.substr(pos, in.size() - 2 - pos);
+    if (nextscsn.empty() || nextscsn.find('"') != string::npos)
+    {
+        return;
+    }
+
+    nextsc.reset(new HttpReq());
+    postsc(nextsc.get(), nextscsn.c_str());
+}
+
+bool MegaClient::execpipelinedcs()
+{
+    bool done = false;
+
+    // one at a time: processing a response may clear them all (a logout)
+    for (auto it = pipelinedcs.begin(); it != pipelinedcs.end(); )
+    {
+        HttpReq* req = it->second.get();
+        if (req->status != REQ_SUCCESS && req->status != REQ_FAILURE)
+        {
+            ++it;
+            continue;
+        }
+
+        string id = it->first;
+        string in = std::move(req->in);
+        bool succeeded = req->status == REQ_SUCCESS && in != "-3" && in != "-4";
+        int httpstatus = req->httpstatus;
+        pipelinedcs.erase(it);
+        done = true;
+
+        if (!succeeded)
+        {
+            if (in == "-3" || in == "-4")
+            {
+                metrics.csEAgain++;
+            }
+            else if (httpstatus == 500)
+            {
+                metrics.csServerBusy++;
+            }
+            else
+            {
+                metrics.csFailures++;
+            }
+
+            // sent again as the head of the queue, with the same id, after what is in flight
+            LOG_warn << "Retrying pipelined cs request " << id;
+            reqs.pipelinedrequeue(id);
+        }
+        else if (*in.c_str() == '[')
+        {
+            reqs.pipelinedresponse(id, std::move(in), this);
+            notifypurge();
+        }
+        else
+        {
+            JSON json;
+            json.pos = in.c_str();
+            std::string requestError;
+            error e = API_EINTERNAL;
+            if (!json.storeobject(&requestError))
+            {
+                requestError = std::to_string(e);
+            }
+            else
+            {
+                if (strncmp(requestError.c_str(), "{\"err\":", 7) == 0)
+                {
+                    e = (error)atoi(requestError.c_str() + 7);
+                }
+                else
+                {
+                    e = (error)atoi(requestError.c_str());
+                }
+            }
+            if (!e)
+            {
+                e = API_EINTERNAL;
+                requestError = std::to_string(e);
+            }
+
+            if (e == API_EBLOCKED && sid.size())
+            {
+                block();
+            }
+
+            app->request_error(e);
+            reqs.pipelinederror(id, requestError, this);
+        }
+
+        it = pipelinedcs.begin();
+    }
+
+    // more batches while the one of pendingcs is in flight, if they don't depend on those sent
+    while (pendingcs && reqs.pipelined() + 1 < csdepth && btcs.armed()
+           && reqs.cmdspending() && reqs.readytosend())
+    {
+        unique_ptr<HttpReq> req(new HttpReq());
+        req->protect = true;
+        req->logname = clientname + "cs ";
+
+        bool suppressSID = true;
+        string id = nextreqid();
+        reqs.pipelinerequest(req->out, suppressSID, id);
+        postcs(req.get(), id, suppressSID);
+        pipelinedcs[id] = std::move(req);
+        done = true;
+    }
+
+    return done;
+}
+
 // disconnect all HTTP connections (slows down operations, but is semantically neutral)
 void MegaClient::disconnect()
 {
@@ -3957,11 +4516,21 @@ void MegaClient::disconnect()
         pendingcs->disconnect();
     }
 
+    for (auto& cs : pipelinedcs)
+    {
+        cs.second->disconnect();
+    }
+
     if (pendingsc)
     {
         pendingsc->disconnect();
     }
 
+    if (nextsc)
+    {
+        nextsc->disconnect();
+    }
+
     if (pendingscUserAlerts)
     {
         pendingscUserAlerts->disconnect();
@@ -3991,7 +4560,10 @@ void MegaClient::disconnect()
 
     for (fafc_map::iterator it = fafcs.begin(); it != fafcs.end(); it++)
     {
-        it->second->req.disconnect();
+        for (auto& f : it->second->fetches)
+        {
+            f->req.disconnect();
+        }
     }
 
     for (transferslot_list::iterator it = tslots.begin(); it != tslots.end(); it++)
@@ -4020,6 +4592,7 @@ void MegaClient::catchup()
 
         pendingsc.reset();
     }
+    nextsc.reset();
     btsc.reset();
     scnotifyurl.clear();
 }
@@ -4059,6 +4632,15 @@ void MegaClient::logout(bool keepSyncConfigsFile)
 void MegaClient::locallogout(bool removecaches, bool keepSyncsConfigFile)
 {
     mAsyncQueue.clearDiscardable();
+    fingerprinter.clear();
+    facache.close(removecaches);
+    facacheopened = false;
+    facachehits.clear();
+#ifdef ENABLE_SYNC
+    dirlister.clear();
+#endif
+    slicedjobs.clear();
+    putnodesbatches.clear();
 
     if (removecaches)
     {
@@ -4118,9 +4700,12 @@ void MegaClient::locallogout(bool removecaches, bool keepSyncsConfigFile)
     purgenodesusersabortsc(false);
 
     reqs.clear();
+    pubkeyusers.clear();
 
     delete pendingcs;
     pendingcs = NULL;
+    pipelinedcs.clear();
+    mFetchNodesStream.reset();
     scsn.clear();
     mBlocked = false;
     mBlockedSet = false;
@@ -4147,6 +4732,7 @@ void MegaClient::locallogout(bool removecaches, bool keepSyncsConfigFile)
 
     queuedfa.clear();
     activefa.clear();
+    putfaslots = MAXPUTFA;
     pendinghttp.clear();
     bttimers.clear();
     xferpaused[PUT] = false;
@@ -4199,6 +4785,7 @@ void MegaClient::locallogout(bool removecaches, bool keepSyncsConfigFile)
     sessionkey.clear();
     accountversion = 0;
     accountsalt.clear();
+    clearDerivedKeys();
     sid.clear();
     k.clear();
 
@@ -4223,9 +4810,12 @@ void MegaClient::locallogout(bool removecaches, bool keepSyncsConfigFile)
 
 void MegaClient::removeCaches(bool keepSyncsConfigFile)
 {
+    // the files of the databases are deleted on a worker, they can take long with a large account
+    vector<LocalPath> removed;
+
     if (sctable)
     {
-        sctable->remove();
+        sctable->removeLater(removed);
         delete sctable;
         sctable = NULL;
         pendingsccommit = false;
@@ -4233,7 +4823,7 @@ void MegaClient::removeCaches(bool keepSyncsConfigFile)
 
     if (statusTable)
     {
-        statusTable->remove();
+        statusTable->removeLater(removed);
         statusTable.reset();
     }
 
@@ -4244,7 +4834,7 @@ void MegaClient::removeCaches(bool keepSyncsConfigFile)
 
         if (sync->statecachetable)
         {
-            sync->statecachetable->remove();
+            sync->statecachetable->removeLater(removed);
             delete sync->statecachetable;
             sync->statecachetable = NULL;
         }
@@ -4263,6 +4853,20 @@ void MegaClient::removeCaches(bool keepSyncsConfigFile)
     }
 #endif
 
+    if (!removed.empty())
+    {
+        LOG_debug << "Deleting " << removed.size() << " database files on a worker";
+
+        FileSystemAccess* fs = fsaccess;
+        mAsyncQueue.push([fs, removed](SymmCipher&) mutable
+            {
+                for (auto& file : removed)
+                {
+                    fs->unlinklocal(file);
+                }
+            }, false);
+    }
+
     disabletransferresumption();
 }
 
@@ -4374,18 +4978,29 @@ void MegaClient::httprequest(const char *url, int method, bool binary, const cha
     }
 }
 
+// the sc channel logs at the level of its module, down to finalizesc()
+#undef MEGA_LOG_MODULE
+#define MEGA_LOG_MODULE ::mega::logModuleSc
+
 // process server-client request
 bool MegaClient::procsc()
 {
     CodeCounter::ScopeTimer ccst(performanceStats.scProcessingTime);
+    ClientMetrics::Timer mt(metrics.scProcessing, "sc");
 
     nameid name;
+    auto slicedeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SCSLICEMS);
+    scsliced = false;
 
 #ifdef ENABLE_SYNC
     char test[] = "},{\"a\":\"t\",\"i\":\"";
     char test2[32] = "\",\"t\":{\"f\":[{\"h\":\"";
     bool stop = false;
     bool newnodes = false;
+
+    // syncdown() runs before procsc() is called again, so only changes from here on count
+    scsyncchanged = false;
+    auto syncdownneeded = [this]() { return !batchactionpackets || scsyncchanged; };
 #endif
     Node* dn = NULL;
 
@@ -4412,10 +5027,14 @@ bool MegaClient::procsc()
                     {
                         if (!pendingcs && !csretrying && !reqs.cmdspending())
                         {
-                            sctable->commit();
+                            {
+                                ClientMetrics::Timer mt(metrics.dbCommit, "dbcommit");
+                                sctable->commit();
+                            }
                             sctable->begin();
                             app->notify_dbcommit();
                             pendingsccommit = false;
+                            writestatesnapshot();
                         }
                         else
                         {
@@ -4437,7 +5056,10 @@ bool MegaClient::procsc()
                             notifypurge();
                             if (sctable)
                             {
-                                sctable->commit();
+                                {
+                                    ClientMetrics::Timer mt(metrics.dbCommit, "dbcommit");
+                                    sctable->commit();
+                                }
                                 sctable->begin();
                                 pendingsccommit = false;
                             }
@@ -4461,7 +5083,12 @@ bool MegaClient::procsc()
                             //TODO: remove android control after android gives green light to this.
                             enabletransferresumption();
 #endif
-                            syncs.resumeResumableSyncsOnStartup();
+                            {
+                                FetchNodesStats::PhaseTimer pt(&fnstats.syncsResumeTimeUs);
+                                syncs.resumeResumableSyncsOnStartup();
+                            }
+                            syncdownfull = true;
+                            syncupfull = true;
 #endif
 
                             app->fetchnodes_result(API_OK);
@@ -4481,6 +5108,8 @@ bool MegaClient::procsc()
                         app->nodes_current();
                         LOG_debug << "Local filesystem up to date";
 
+                        writestatesnapshot();
+
                         if (notifyStorageChangeOnStateCurrent)
                         {
                             app->notify_storage(STORAGE_CHANGE);
@@ -4489,26 +5118,24 @@ bool MegaClient::procsc()
 
                         if (tctable && cachedfiles.size())
                         {
-                            DBTableTransactionCommitter committer(tctable);
-                            for (unsigned int i = 0; i < cachedfiles.size(); i++)
+                            // setting up the transfers of many files takes a while
+                            slicedjobs.push_back([this](std::chrono::steady_clock::time_point deadline)
                             {
-                                direction_t type = NONE;
-                                File *file = app->file_resume(&cachedfiles.at(i), &type);
-                                if (!file || (type != GET && type != PUT))
+                                bool done;
                                 {
-                                    tctable->del(cachedfilesdbids.at(i));
-                                    continue;
+                                    FetchNodesStats::PhaseTimer pt(&fnstats.transfersResumeTimeUs);
+                                    done = resumecachedfiles(deadline);
                                 }
-                                nextreqtag();
-                                file->dbid = cachedfilesdbids.at(i);
-                                if (!startxfer(type, file, committer))
+                                if (done)
                                 {
-                                    tctable->del(cachedfilesdbids.at(i));
-                                    continue;
+                                    reportstartup();
                                 }
-                            }
-                            cachedfiles.clear();
-                            cachedfilesdbids.clear();
+                                return done;
+                            });
+                        }
+                        else
+                        {
+                            reportstartup();
                         }
 
                         WAIT_CLASS::bumpds();
@@ -4593,7 +5220,7 @@ bool MegaClient::procsc()
                                 // node update
                                 sc_updatenode();
 #ifdef ENABLE_SYNC
-                                if (!fetchingnodes)
+                                if (!fetchingnodes && syncdownneeded())
                                 {
                                     // run syncdown() before continuing
                                     applykeys();
@@ -4626,7 +5253,7 @@ bool MegaClient::procsc()
                                 }
 
 #ifdef ENABLE_SYNC
-                                if (!fetchingnodes)
+                                if (!fetchingnodes && syncdownneeded())
                                 {
                                     if (stop)
                                     {
@@ -4639,6 +5266,9 @@ bool MegaClient::procsc()
                                         newnodes = true;
                                     }
                                 }
+
+                                // an unsynced move or folder addition doesn't need syncdown() right away
+                                stop = false;
 #endif
                                 break;
 
@@ -4647,7 +5277,7 @@ bool MegaClient::procsc()
                                 dn = sc_deltree();
 
 #ifdef ENABLE_SYNC
-                                if (fetchingnodes)
+                                if (fetchingnodes || !syncdownneeded())
                                 {
                                     break;
                                 }
@@ -4782,6 +5412,21 @@ bool MegaClient::procsc()
                 }
 
                 jsonsc.leaveobject();
+
+                // the rest of the packets wait for the next pass once the slice is over
+                if (std::chrono::steady_clock::now() >= slicedeadline)
+                {
+                    mergenewshares(1);
+                    applykeys();
+                    ++performanceStats.scSlices;
+#ifdef ENABLE_SYNC
+                    // (unless new nodes were seen, which syncdown() looks at first, as at the end of the array)
+                    scsliced = !newnodes;
+#else
+                    scsliced = true;
+#endif
+                    return false;
+                }
             }
             else
             {
@@ -4837,7 +5482,7 @@ void MegaClient::initsc()
             // 3. write new or modified nodes, purge deleted nodes
             for (node_map::iterator it = nodes.begin(); it != nodes.end(); it++)
             {
-                if (!(complete = sctable->put(CACHEDNODE, it->second, &key)))
+                if (!(complete = sctable->putNode(CACHEDNODE, it->second, &key)))
                 {
                     break;
                 }
@@ -4886,6 +5531,15 @@ void MegaClient::initStatusTable()
         DBTableTransactionCommitter committer(statusTable);
         statusTable->truncate();
     }
+
+    // written again by the next savednscache()
+    cacheddns = CachedDns();
+    httpio->dnscachechanged = true;
+
+#ifdef ENABLE_SYNC
+    // written again by the next savesyncdeletions()
+    syncdeletions = SyncDeletions();
+#endif
 }
 
 
@@ -4950,6 +5604,10 @@ void MegaClient::updatesc()
         if (complete)
         {
             // 3. write new or modified nodes, purge deleted nodes
+            // (in two batches: after a burst of action packets these are most of the writes)
+            DbTable::NodeRecordBatch puts;
+            vector<uint32_t> dels;
+
             for (node_vector::iterator it = nodenotify.begin(); it != nodenotify.end(); it++)
             {
                 char base64[12];
@@ -4957,22 +5615,22 @@ void MegaClient::updatesc()
                 {
                     if ((*it)->dbid)
                     {
-                        LOG_verbose << "Removing node from database: " << (Base64::btoa((byte*)&((*it)->nodehandle),MegaClient::NODEHANDLE,base64) ? base64 : "");
-                        if (!(complete = sctable->del((*it)->dbid)))
+                        // (just the top node of a removed subtree)
+                        if (!(*it)->parent || !(*it)->parent->changed.removed)
                         {
-                            break;
+                            LOG_verbose << "Removing node from database: " << (Base64::btoa((byte*)&((*it)->nodehandle),MegaClient::NODEHANDLE,base64) ? base64 : "");
                         }
+                        dels.push_back((*it)->dbid);
                     }
                 }
                 else
                 {
                     LOG_verbose << "Adding node to database: " << (Base64::btoa((byte*)&((*it)->nodehandle),MegaClient::NODEHANDLE,base64) ? base64 : "");
-                    if (!(complete = sctable->put(CACHEDNODE, *it, &key)))
-                    {
-                        break;
-                    }
+                    sctable->addNodeToBatch(puts, CACHEDNODE, *it, &key);
                 }
             }
+
+            complete = sctable->delSpaced(std::move(dels)) && sctable->putNodeBatch(puts);
         }
 
         if (complete)
@@ -5044,17 +5702,95 @@ void MegaClient::finalizesc(bool complete)
     }
 }
 
+#undef MEGA_LOG_MODULE
+#define MEGA_LOG_MODULE ::mega::logModuleGeneral
+
+StateSnapshot* MegaClient::statesnapshot() const
+{
+    auto table = dynamic_cast<SnapshottedDbTable*>(sctable);
+    return table ? &table->snapshot() : nullptr;
+}
+
+void MegaClient::writestatesnapshot()
+{
+    StateSnapshot* snapshot = statesnapshot();
+
+    // (not while lazynodes has left nodes out of memory)
+    if (!snapshot || !statecurrent || pendingsccommit || !snapshot->imagedue() || !lazyindex.empty())
+    {
+        return;
+    }
+
+    // the same records as the table's (see initsc()), with the scsn first and nodes parents first
+    string data;
+    auto add = [this, snapshot, &data](Cacheable* record)
+    {
+        if (!record->dbid || !record->serialize(&data))
+        {
+            // not in the table either
+            return true;
+        }
+
+        PaddedCBC::encrypt(rng, &data, &key);
+        return snapshot->addrecord(record->dbid, data.data(), data.size());
+    };
+
+    handle tscsn = cachedscsn;
+    bool complete = snapshot->beginimage() && snapshot->addrecord(CACHEDSCSN, reinterpret_cast<const char*>(&tscsn), sizeof tscsn);
+
+    for (user_map::iterator it = users.begin(); complete && it != users.end(); it++)
+    {
+        complete = add(&it->second);
+    }
+
+    for (handlepcr_map::iterator it = pcrindex.begin(); complete && it != pcrindex.end(); it++)
+    {
+        complete = add(it->second);
+    }
+
+#ifdef ENABLE_CHAT
+    for (textchat_map::iterator it = chats.begin(); complete && it != chats.end(); it++)
+    {
+        complete = add(it->second);
+    }
+#endif
+
+    node_vector pending;
+    for (node_map::iterator it = nodes.begin(); it != nodes.end(); it++)
+    {
+        if (!it->second->parent)
+        {
+            pending.push_back(it->second);
+        }
+    }
+
+    while (complete && !pending.empty())
+    {
+        Node* n = pending.back();
+        pending.pop_back();
+
+        complete = add(n);
+        pending.insert(pending.end(), n->children.begin(), n->children.end());
+    }
+
+    if (complete && snapshot->endimage())
+    {
+        LOG_debug << "State snapshot written at SCSN " << scsn.text() << " with " << nodes.size() << " nodes";
+    }
+}
+
 // queue node file attribute for retrieval or cancel retrieval
-error MegaClient::getfa(handle h, string *fileattrstring, const string &nodekey, fatype t, int cancel)
+namespace {
+
+// the handle of attribute t in a node's attribute string, and the cluster that stores it
+bool fileattributehandle(string* fileattrstring, fatype t, handle& fah, int& cluster)
 {
-    // locate this file attribute type in the nodes's attribute string
-    handle fah;
     int p, pp;
 
     // find position of file attribute or 0 if not present
     if (!(p = Node::hasfileattribute(fileattrstring, t)))
     {
-        return API_ENOENT;
+        return false;
     }
 
     pp = p - 1;
@@ -5066,15 +5802,38 @@ error MegaClient::getfa(handle h, string *fileattrstring, const string &nodekey,
 
     if (p == pp)
     {
-        return API_ENOENT;
+        return false;
     }
 
     if (Base64::atob(strchr(fileattrstring->c_str() + p, '*') + 1, (byte*)&fah, sizeof(fah)) != sizeof(fah))
+    {
+        return false;
+    }
+
+    cluster = atoi(fileattrstring->c_str() + pp);
+    return true;
+}
+
+} // anonymous
+
+error MegaClient::getfa(handle h, string *fileattrstring, const string &nodekey, fatype t, int cancel)
+{
+    // locate this file attribute type in the nodes's attribute string
+    handle fah;
+    int c;
+
+    if (!fileattributehandle(fileattrstring, t, fah, c))
     {
         return API_ENOENT;
     }
 
-    int c = atoi(fileattrstring->c_str() + pp);
+    string cached;
+    if (!cancel && facache.get(fah, cached))
+    {
+        facachehits.emplace_back(unique_ptr<FileAttributeFetch>(new FileAttributeFetch(h, nodekey, t, reqtag)), std::move(cached));
+        looprequested = true;
+        return API_OK;
+    }
 
     if (cancel)
     {
@@ -5092,10 +5851,13 @@ error MegaClient::getfa(handle h, string *fileattrstring, const string &nodekey,
                     delete it->second;
                     cit->second->fafs[i].erase(it);
 
-                    // none left: tear down connection
-                    if (!cit->second->fafs[1].size() && cit->second->req.status == REQ_INFLIGHT)
+                    // none left: tear down connections
+                    if (!cit->second->fafs[1].size())
                     {
-                        cit->second->req.disconnect();
+                        for (auto& f : cit->second->fetches)
+                        {
+                            f->req.disconnect();
+                        }
                     }
 
                     return API_OK;
@@ -5126,7 +5888,12 @@ error MegaClient::getfa(handle h, string *fileattrstring, const string &nodekey,
             {
                 *fafp = new FileAttributeFetch(h, nodekey, t, reqtag);
             }
-            else
+            else if (!(*fafp)->tag)
+            {
+                // a prefetch: now somebody is waiting for it
+                (*fafp)->tag = reqtag;
+            }
+            else
             {
                 restag = (*fafp)->tag;
                 return API_EEXIST;
@@ -5135,6 +5902,11 @@ error MegaClient::getfa(handle h, string *fileattrstring, const string &nodekey,
         else
         {
             FileAttributeFetch** fafp = &(*fafcp)->fafs[1][fah];
+            if (!(*fafp)->tag)
+            {
+                (*fafp)->tag = reqtag;
+                return API_OK;
+            }
             restag = (*fafp)->tag;
             return API_EEXIST;
         }
@@ -5143,6 +5915,63 @@ error MegaClient::getfa(handle h, string *fileattrstring, const string &nodekey,
     }
 }
 
+error MegaClient::prefetchfa(Node* n, fatype t)
+{
+    handle fah;
+    int c;
+
+    if (!n || !fileattributehandle(&n->fileattrstring, t, fah, c))
+    {
+        return API_ENOENT;
+    }
+
+    if (!facache.capacity() || facache.contains(fah))
+    {
+        return API_OK;
+    }
+
+    // nobody to tell when it arrives
+    int creqtag = reqtag;
+    reqtag = 0;
+    error e = getfa(n->nodehandle, &n->fileattrstring, n->nodekey(), t);
+    reqtag = creqtag;
+
+    return e == API_EEXIST ? API_OK : e;
+}
+
+void MegaClient::openfacache()
+{
+    facacheopened = true;
+
+    if (!dbaccess || readonlystatecache)
+    {
+        return;
+    }
+
+    string dbname;
+
+    if (sid.size() >= SIDLEN)
+    {
+        dbname.resize((SIDLEN - sizeof key.key) * 4 / 3 + 3);
+        dbname.resize(Base64::btoa((const byte*)sid.data() + sizeof key.key, SIDLEN - sizeof key.key, (char*)dbname.c_str()));
+    }
+    else if (loggedinfolderlink())
+    {
+        dbname.resize(NODEHANDLE * 4 / 3 + 3);
+        dbname.resize(Base64::btoa((const byte*)&mFolderLink.mPublicHandle, NODEHANDLE, (char*)dbname.c_str()));
+    }
+
+    if (dbname.size())
+    {
+        dbname.insert(0, "fa_");
+
+        if (DbTable* table = dbaccess->open(rng, *fsaccess, dbname))
+        {
+            facache.persist(unique_ptr<DbTable>(table));
+        }
+    }
+}
+
 // build pending attribute string for this handle and remove
 void MegaClient::pendingattrstring(handle h, string* fa)
 {
@@ -5174,12 +6003,20 @@ void MegaClient::putfa(handle th, fatype t, SymmCipher* key, std::unique_ptr<str
     LOG_debug << "File attribute added to queue - " << th << " : " << queuedfa.size() << " queued, " << activefa.size() << " active";
 
     // no other file attribute storage request currently in progress? POST this one.
-    while (activefa.size() < MAXPUTFA && queuedfa.size())
+    dispatchputfa();
+}
+
+void MegaClient::dispatchputfa()
+{
+    while (queuedfa.size() && activefa.size() < size_t(putfaslots))
     {
+        // dispatch most recent file attribute put
         putfa_list::iterator curfa = queuedfa.begin();
-        HttpReqCommandPutFA *fa = *curfa;
+        HttpReqCommandPutFA* fa = *curfa;
         queuedfa.erase(curfa);
         activefa.push_back(fa);
+
+        LOG_debug << "Adding file attribute to the request queue";
         fa->status = REQ_INFLIGHT;
         reqs.add(fa);
     }
@@ -5188,7 +6025,7 @@ void MegaClient::putfa(handle th, fatype t, SymmCipher* key, std::unique_ptr<str
 // has the limit of concurrent transfer tslots been reached?
 bool MegaClient::slotavail() const
 {
-    return !mBlocked && tslots.size() < MAXTOTALTRANSFERS;
+    return !mBlocked && tslots.size() < transferpolicy->maxTotalTransfers();
 }
 
 bool MegaClient::setstoragestatus(storagestatus_t status)
@@ -5277,7 +6114,7 @@ void MegaClient::sc_updatenode()
 {
     handle h = UNDEF;
     handle u = 0;
-    const char* a = NULL;
+    JSONView a;
     m_time_t ts = -1;
 
     for (;;)
@@ -5293,7 +6130,7 @@ void MegaClient::sc_updatenode()
                 break;
 
             case MAKENAMEID2('a', 't'):
-                a = jsonsc.getvalue();
+                a = jsonsc.getvalueview();
                 break;
 
             case MAKENAMEID2('t', 's'):
@@ -5315,20 +6152,22 @@ void MegaClient::sc_updatenode()
                             notify = true;
                         }
 
-                        if (a && ((n->attrstring && strcmp(n->attrstring->c_str(), a)) || !n->attrstring))
+                        if (a.data && (!n->attrstring || a != *n->attrstring))
                         {
                             if (!n->attrstring)
                             {
                                 n->attrstring.reset(new string);
                             }
-                            Node::copystring(n->attrstring.get(), a);
+                            a.assignto(n->attrstring.get());
                             n->changed.attrs = true;
                             notify = true;
                         }
 
                         if (ts != -1 && n->ctime != ts)
                         {
+                            mNodesByCtime.remove(n);
                             n->ctime = ts;
+                            mNodesByCtime.add(n);
                             n->changed.ctime = true;
                             notify = true;
                         }
@@ -7071,6 +7910,17 @@ void MegaClient::notifypurge(void)
 #endif
         DBTableTransactionCommitter committer(tctable);
 
+        // removed subtrees are counted out and detached by their top nodes, so the rest
+        // of their nodes don't update the ancestors as they are deleted one by one
+        for (i = 0; i < t; i++)
+        {
+            Node* n = nodenotify[i];
+            if (n->changed.removed && n->parent && !n->parent->changed.removed)
+            {
+                n->detachremoved();
+            }
+        }
+
         // check all notified nodes for removed status and purge
         for (i = 0; i < t; i++)
         {
@@ -7187,6 +8037,7 @@ void MegaClient::notifypurge(void)
 
         useralerts.useralertnotify.clear();
     }
+    useralerts.trim();
 
 #ifdef ENABLE_CHAT
     if ((t = int(chatnotify.size())))
@@ -7222,9 +8073,238 @@ Node* MegaClient::nodebyhandle(handle h) const
         return it->second;
     }
 
+    if (!lazyindex.empty())
+    {
+        // materializing doesn't change the state the client has, only how much of it is in memory
+        return const_cast<MegaClient*>(this)->loadnode(h);
+    }
+
     return nullptr;
 }
 
+Node* MegaClient::loadnode(handle h)
+{
+    uint32_t dbid;
+    handle ph;
+
+    if (!sctable || !lazyindex.take(h, &dbid, &ph))
+    {
+        return nullptr;
+    }
+
+    string data;
+    if (!sctable->get(dbid, &data) || !PaddedCBC::decrypt(&data, &key))
+    {
+        LOG_err << "Failed to read node from local cache: " << toNodeHandle(h);
+        return nullptr;
+    }
+
+    // the parent, if left in the table too, is materialized by the Node constructor's lookup.
+    // Shares read here are merged on their own, apart from any the caller is accumulating
+    newshare_list pending;
+    pending.swap(newshares);
+
+    node_vector dp;
+    Node* n = Node::unserialize(this, &data, &dp);
+    if (n)
+    {
+        n->dbid = dbid;
+        loadedversion(n);
+    }
+    else
+    {
+        LOG_err << "Failed - node record read error: " << toNodeHandle(h);
+    }
+
+    mergenewshares(0);
+    newshares.swap(pending);
+
+    // its parent becomes evictable with it
+    lazyindex.touch(ph);
+    return n;
+}
+
+void MegaClient::loadchildren(Node* n)
+{
+    if (lazyindex.empty())
+    {
+        return;
+    }
+
+    // (the children of a file are its versions, which go with it)
+    if (n->type != FILENODE)
+    {
+        lazyindex.touch(n->nodehandle);
+    }
+
+    std::vector<uint32_t> dbids;
+    if (!lazyindex.takechildren(n->nodehandle, &dbids))
+    {
+        return;
+    }
+
+    LOG_debug << "Loading " << dbids.size() << " children of " << toNodeHandle(n->nodehandle) << " from local cache";
+
+    newshare_list pending;
+    pending.swap(newshares);
+
+    string data;
+    node_vector dp;
+    for (uint32_t dbid : dbids)
+    {
+        Node* child;
+        if (sctable && sctable->get(dbid, &data) && PaddedCBC::decrypt(&data, &key)
+                && (child = Node::unserialize(this, &data, &dp)))
+        {
+            child->dbid = dbid;
+            loadedversion(child);
+        }
+        else
+        {
+            LOG_err << "Failed - node record read error: " << dbid;
+        }
+    }
+
+    mergenewshares(0);
+    newshares.swap(pending);
+}
+
+// a version that lazyversions left in the table was counted by the file it was left under, the
+// first one above with a counter, until now
+void MegaClient::loadedversion(Node* n)
+{
+    if (n->type != FILENODE)
+    {
+        return;
+    }
+
+    for (Node* p = n->parent; p && p->type == FILENODE; p = p->parent)
+    {
+        if (p->counter)
+        {
+            p->lazyversion(n->size, false);
+            return;
+        }
+    }
+}
+
+// with lazyversions, leave a version read from sctable there, counted by the nearest file above
+// it already in memory.  False (for it to be materialized) if it isn't a version, or its
+// parent hasn't been read yet
+bool MegaClient::leaveversion(const NodeRecord& record, uint32_t dbid)
+{
+    if (record.type != FILENODE || !record.shares.empty() || record.exported)
+    {
+        return false;
+    }
+
+    handle ph = record.ph;
+    node_map::iterator it;
+    while ((it = nodes.find(ph)) == nodes.end())
+    {
+        if (!lazyindex.parentof(ph, &ph))
+        {
+            return false;
+        }
+    }
+
+    Node* holder = it->second;
+    if (holder->type != FILENODE)
+    {
+        return false;
+    }
+
+    lazyindex.add(record.h, record.ph, dbid);
+    holder->lazyversion(record.size, true);
+    return true;
+}
+
+void MegaClient::loadtree(Node* n)
+{
+    if (lazyindex.empty())
+    {
+        return;
+    }
+
+    node_vector pending(1, n);
+    while (!pending.empty())
+    {
+        Node* folder = pending.back();
+        pending.pop_back();
+
+        loadchildren(folder);
+        for (Node* child : folder->children)
+        {
+            if (child->type != FILENODE)
+            {
+                pending.push_back(child);
+            }
+        }
+    }
+}
+
+// the files left in sctable, unlike those in memory, are not in mFingerprints
+void MegaClient::loadnodesbyfingerprint(const FileFingerprint& fingerprint)
+{
+    DbTable::NodeRefs refs;
+
+    if (lazyindex.empty() || !fingerprint.isvalid || !sctable || !sctable->getByFingerprint(fingerprint, &refs))
+    {
+        return;
+    }
+
+    for (auto& ref : refs)
+    {
+        if (lazyindex.contains(ref.second))
+        {
+            loadnode(ref.second);
+        }
+    }
+}
+
+void MegaClient::evictnodes()
+{
+    if (!lazynodes || nodes.size() <= lazynodeslimit)
+    {
+        return;
+    }
+
+    handle h;
+    node_vector evicted;
+    while (nodes.size() > lazynodeslimit && lazyindex.leastrecent(&h))
+    {
+        auto it = nodes.find(h);
+        if (it == nodes.end())
+        {
+            continue;
+        }
+
+        // only nodes whose state is all in their table record, and that nothing else points to
+        evicted.clear();
+        for (Node* child : it->second->children)
+        {
+            if (child->dbid && !child->notified && child->children.empty() && (child->type != FILENODE || !child->counter)
+                    && !child->inshare && !child->outshares && !child->pendingshares && !child->plink
+                    && !child->appdata && hdrns.find(child->nodehandle) == hdrns.end()
+#ifdef ENABLE_SYNC
+                    && !child->localnode && !child->syncget
+                    && todebris.find(child) == todebris.end() && tounlink.find(child) == tounlink.end()
+#endif
+                    )
+            {
+                evicted.push_back(child);
+            }
+        }
+
+        for (Node* child : evicted)
+        {
+            lazyindex.add(child->nodehandle, h, child->dbid);
+            nodes.erase(child->nodehandle);
+            delete child;
+        }
+    }
+}
+
 Node* MegaClient::nodeByHandle(NodeHandle h) const
 {
     if (h.isUndef()) return nullptr;
@@ -7293,30 +8373,46 @@ void MegaClient::makeattr(SymmCipher* key, string* attrstring, const char* json,
     {
         l = int(strlen(json));
     }
-    int ll = (l + 6 + SymmCipher::KEYLENGTH - 1) & - SymmCipher::KEYLENGTH;
-    byte* buf = new byte[ll];
 
-    memcpy(buf, "MEGA{", 5); // check for the presence of the magic number "MEGA"
-    memcpy(buf + 5, json, l);
-    buf[l + 5] = '}';
-    memset(buf + 6 + l, 0, ll - l - 6);
+    attrstring->reserve(size_t(l + 6 + SymmCipher::KEYLENGTH - 1) & - SymmCipher::KEYLENGTH);
+    attrstring->assign("MEGA{", 5); // check for the presence of the magic number "MEGA"
+    attrstring->append(json, l);
+    attrstring->push_back('}');
+    padandencryptattr(key, attrstring);
+}
 
-    key->cbc_encrypt(buf, ll);
+void MegaClient::makeattr(SymmCipher* key, const std::unique_ptr<string>& attrstring, const char* json, int l) const
+{
+    makeattr(key, attrstring.get(), json, l);
+}
 
-    attrstring->assign((char*)buf, ll);
+void MegaClient::makeattr(SymmCipher* key, string* attrstring, const AttrMap& attrs) const
+{
+    attrstring->assign("MEGA{", 5);
+    attrs.appendjson(attrstring);
+    attrstring->push_back('}');
+    padandencryptattr(key, attrstring);
+}
 
-    delete[] buf;
+void MegaClient::makeattr(SymmCipher* key, const std::unique_ptr<string>& attrstring, const AttrMap& attrs) const
+{
+    makeattr(key, attrstring.get(), attrs);
 }
 
-void MegaClient::makeattr(SymmCipher* key, const std::unique_ptr<string>& attrstring, const char* json, int l) const
+// zero-pad "MEGA{...}" to whole cipher blocks and encrypt it in place
+void MegaClient::padandencryptattr(SymmCipher* key, string* attrstring)
 {
-    makeattr(key, attrstring.get(), json, l);
+    attrstring->resize((attrstring->size() + SymmCipher::KEYLENGTH - 1) & - SymmCipher::KEYLENGTH, '\0');
+    key->cbc_encrypt((byte*)&(*attrstring)[0], attrstring->size());
 }
 
 // update node attributes
 // (with speculative instant completion)
 error MegaClient::setattr(Node* n, const char *prevattr)
 {
+    // callers update n->attrs directly before getting here
+    n->attrschanged();
+
     if (ststatus == STORAGE_PAYWALL)
     {
         return API_EPAYWALL;
@@ -7345,7 +8441,6 @@ error MegaClient::setattr(Node* n, const char *prevattr)
 
 void MegaClient::putnodes_prepareOneFolder(NewNode* newnode, std::string foldername, std::function<void(AttrMap&)> addAttrs)
 {
-    string attrstring;
     byte buf[FOLDERNODEKEYLENGTH];
 
     // set up new node as folder node
@@ -7369,9 +8464,8 @@ void MegaClient::putnodes_prepareOneFolder(NewNode* newnode, std::string foldern
     if (addAttrs)  addAttrs(attrs);
 
     // JSON-encode object and encrypt attribute string
-    attrs.getjson(&attrstring);
     newnode->attrstring.reset(new string);
-    makeattr(&tmpnodecipher, newnode->attrstring, attrstring.c_str());
+    makeattr(&tmpnodecipher, newnode->attrstring, attrs);
 }
 
 // send new nodes to API for processing
@@ -7661,6 +8755,7 @@ error MegaClient::unlink(Node* n, bool keepversions, int tag, std::function<void
     if (kv)
     {
         Node *newerversion = n->parent;
+        loadchildren(n);
         if (n->children.size())
         {
             Node *olderversion = n->children.back();
@@ -7774,6 +8869,12 @@ char* MegaClient::utf8_to_a32forjs(const char* str, int* len)
 // compute UTF-8 password hash
 error MegaClient::pw_key(const char* utf8pw, byte* key) const
 {
+    string id = derivedkeyid('1', utf8pw, string());
+    if (cachedderivedkey(id, key, SymmCipher::KEYLENGTH))
+    {
+        return API_OK;
+    }
+
     int t;
     char* pw;
 
@@ -7806,9 +8907,73 @@ error MegaClient::pw_key(const char* utf8pw, byte* key) const
     delete[] keys;
     delete[] pw;
 
+    cachederivedkey(id, key, SymmCipher::KEYLENGTH);
     return API_OK;
 }
 
+void MegaClient::pbkdf2key(const char* password, const string& salt, byte* derivedKey) const
+{
+    string id = derivedkeyid('2', password, salt);
+    if (cachedderivedkey(id, derivedKey, 2 * SymmCipher::KEYLENGTH))
+    {
+        return;
+    }
+
+    CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA512> pbkdf2;
+    pbkdf2.DeriveKey(derivedKey, 2 * SymmCipher::KEYLENGTH, 0, (byte *)password, strlen(password),
+                     (const byte *)salt.data(), salt.size(), 100000);
+
+    cachederivedkey(id, derivedKey, 2 * SymmCipher::KEYLENGTH);
+}
+
+string MegaClient::derivedkeyid(char type, const char* password, const string& salt) const
+{
+    // the salt has a fixed length per type: no separator needed before the password
+    HMACSHA256 hmac(derivedkeyssecret, sizeof derivedkeyssecret);
+    hmac.add((const byte*)&type, 1);
+    hmac.add((const byte*)salt.data(), salt.size());
+    hmac.add((const byte*)password, strlen(password));
+
+    string id(32, '\0');
+    hmac.get((byte*)id.data());
+    return id;
+}
+
+bool MegaClient::cachedderivedkey(const string& id, byte* key, size_t len) const
+{
+    auto it = derivedkeys.find(id);
+    if (it == derivedkeys.end() || it->second.size() != len)
+    {
+        return false;
+    }
+
+    memcpy(key, it->second.data(), len);
+    return true;
+}
+
+void MegaClient::cachederivedkey(const string& id, const byte* key, size_t len) const
+{
+    if (derivedkeys.size() >= MAXDERIVEDKEYS)
+    {
+        // only ever a few passwords in a session: typos of the one being retried
+        const_cast<MegaClient*>(this)->clearDerivedKeys();
+    }
+
+    derivedkeys[id].assign((const char*)key, len);
+}
+
+void MegaClient::clearDerivedKeys()
+{
+    for (auto& k : derivedkeys)
+    {
+        memset(const_cast<char*>(k.second.data()), 0, k.second.size());
+    }
+    derivedkeys.clear();
+
+    // new ids, so that those of the previous session say nothing of the new one
+    rng.genblock(derivedkeyssecret, sizeof derivedkeyssecret);
+}
+
 // compute generic string hash
 void MegaClient::stringhash(const char* s, byte* hash, SymmCipher* cipher)
 {
@@ -7851,330 +9016,517 @@ int MegaClient::readnodes(JSON* j, int notify, putsource_t source, vector<NewNod
         return 0;
     }
 
-    node_vector dp;
-    Node* n;
+    node_vector dp, added;
 
     while (j->enterobject())
     {
-        handle h = UNDEF, ph = UNDEF;
-        handle u = 0, su = UNDEF;
-        nodetype_t t = TYPE_UNKNOWN;
-        const char* a = NULL;
-        const char* k = NULL;
-        const char* fa = NULL;
-        const char *sk = NULL;
-        accesslevel_t rl = ACCESS_UNKNOWN;
-        m_off_t s = NEVER;
-        m_time_t ts = -1, sts = -1;
-        nameid name;
-        int nni = -1;
-
-        while ((name = j->getnameid()) != EOO)
+        if (!readnode(j, notify, source, nn, tag, false, dp, applykeys ? &added : nullptr))
         {
-            switch (name)
-            {
-                case 'h':   // new node: handle
-                    h = j->gethandle();
-                    break;
-
-                case 'p':   // parent node
-                    ph = j->gethandle();
-                    break;
-
-                case 'u':   // owner user
-                    u = j->gethandle(USERHANDLE);
-                    break;
-
-                case 't':   // type
-                    t = (nodetype_t)j->getint();
-                    break;
-
-                case 'a':   // attributes
-                    a = j->getvalue();
-                    break;
+            return 0;
+        }
+    }
 
-                case 'k':   // key(s)
-                    k = j->getvalue();
-                    break;
+    attachorphans(dp);
+    this->applykeys(added);
 
-                case 's':   // file size
-                    s = j->getint();
-                    break;
+    return j->leavearray();
+}
 
-                case 'i':   // related source NewNode index
-                    nni = int(j->getint());
-                    break;
+// any child nodes that arrived before their parents?
+void MegaClient::attachorphans(node_vector& dp)
+{
+    for (size_t i = dp.size(); i--; )
+    {
+        if (Node* n = nodebyhandle(dp[i]->parenthandle))
+        {
+            if (dp[i]->setparent(n) && reconcilingnodes && !dp[i]->changed.newnode)
+            {
+                // moved under a folder that arrived after it
+                dp[i]->changed.parent = true;
+                reconciled.push_back(dp[i]);
+            }
+        }
+    }
+    dp.clear();
+}
 
-                case MAKENAMEID2('t', 's'):  // actual creation timestamp
-                    ts = j->getint();
-                    break;
+void MegaClient::readfetchnodeschunk(HttpReq* req, bool final)
+{
+    // the 'f' command is sent on its own, so its result is the only element of the response array
+    static const char nodesprefix[] = "[{\"f\":[";
+    static const char versionsprefix[] = ",\"f2\":[";
+    const size_t prefixlen = sizeof nodesprefix - 1;
+    static_assert(sizeof versionsprefix == sizeof nodesprefix, "prefixes must have the same length");
 
-                case MAKENAMEID2('f', 'a'):  // file attributes
-                    fa = j->getvalue();
-                    break;
+    FetchNodesStats::PhaseTimer pt(&fnstats.apiParseTimeUs);
+    FetchNodesStream& fs = *mFetchNodesStream;
+    const char* start = req->data();
+    const char* end = start + req->size();
+    const char* ptr = start;
 
-                    // inbound share attributes
-                case 'r':   // share access level
-                    rl = (accesslevel_t)j->getint();
-                    break;
+    for (bool more = true; more; )
+    {
+        switch (fs.state)
+        {
+            case FetchNodesStream::PREFIX:
+                if (size_t(end - ptr) < prefixlen)
+                {
+                    more = false;
+                    if (final)
+                    {
+                        fs.state = FetchNodesStream::DISABLED;
+                    }
+                }
+                else if (memcmp(ptr, nodesprefix, prefixlen))
+                {
+                    // an error, or a layout we don't know: leave it all to CommandFetchNodes
+                    fs.state = FetchNodesStream::DISABLED;
+                }
+                else
+                {
+                    // from here on the response is consumed as it arrives, so the old tree goes now
+                    purgenodesusersabortsc(true);
 
-                case MAKENAMEID2('s', 'k'):  // share key
-                    sk = j->getvalue();
-                    break;
+                    // the response is dominated by the node arrays (see CommandFetchNodes::procresult())
+                    if (req->contentlength > 0)
+                    {
+                        nodes.reserve(size_t(req->contentlength / 256));
+                    }
 
-                case MAKENAMEID2('s', 'u'):  // sharing user
-                    su = j->gethandle(USERHANDLE);
-                    break;
+                    ptr += prefixlen;
+                    fs.state = FetchNodesStream::NODES;
+                }
+                break;
 
-                case MAKENAMEID3('s', 't', 's'):  // share timestamp
-                    sts = j->getint();
-                    break;
+            case FetchNodesStream::NODES:
+                if (ptr == end)
+                {
+                    more = false;
+                }
+                else if (*ptr == ',')
+                {
+                    ptr++;
+                }
+                else if (*ptr == ']')
+                {
+                    ptr++;
+                    attachorphans(fs.dp);
+                    fs.state = FetchNodesStream::NEXTARRAY;
+                }
+                else if (*ptr != '{')
+                {
+                    // leave the broken record for CommandFetchNodes to fail on
+                    LOG_err << "Parse error (streamed fetchnodes)";
+                    fs.state = FetchNodesStream::FAILED;
+                }
+                else if (const char* objend = JSON::objectend(ptr, end))
+                {
+                    JSON j;
+                    j.pos = ptr;
+                    j.enterobject();
 
-                default:
-                    if (!j->storeobject())
+                    // keys that don't depend on share keys yet to arrive are applied in batches (see below)
+                    if (readnode(&j, 0, PUTNODES_APP, nullptr, 0, false, fs.dp, &fs.pending))
                     {
-                        return 0;
+                        ptr = objend;
                     }
-            }
-        }
+                    else
+                    {
+                        LOG_err << "Parse error (streamed fetchnodes)";
+                        fs.state = FetchNodesStream::FAILED;
+                    }
+                }
+                else
+                {
+                    // wait for the rest of the record
+                    more = false;
+                }
+                break;
 
-        if (ISUNDEF(h))
-        {
-            warn("Missing node handle");
-        }
-        else
-        {
-            if (t == TYPE_UNKNOWN)
-            {
-                warn("Unknown node type");
-            }
-            else if (t == FILENODE || t == FOLDERNODE)
-            {
-                if (ISUNDEF(ph))
+            case FetchNodesStream::NEXTARRAY:
+                if (size_t(end - ptr) < prefixlen)
                 {
-                    warn("Missing parent");
+                    more = false;
+                    if (final)
+                    {
+                        fs.state = FetchNodesStream::DONE;
+                    }
                 }
-                else if (!a)
+                else if (memcmp(ptr, versionsprefix, prefixlen))
                 {
-                    warn("Missing node attributes");
+                    fs.state = FetchNodesStream::DONE;
                 }
-                else if (!k)
+                else
                 {
-                    warn("Missing node key");
+                    ptr += prefixlen;
+                    fs.state = FetchNodesStream::NODES;
                 }
+                break;
+
+            default:
+                more = false;
+        }
+    }
+
+    if (fs.pending.size() >= FetchNodesStream::KEYBATCH || (final && !fs.pending.empty()))
+    {
+        applykeys(fs.pending);
+        fs.pending.clear();
+    }
+
+    if (final && fs.started())
+    {
+        string rest(ptr, end);
+        bool inarray = fs.state == FetchNodesStream::NODES || fs.state == FetchNodesStream::FAILED;
 
-                if (t == FILENODE && ISUNDEF(s))
+        req->in = inarray ? "[{\"f\":[" : "[{\"f\":[]";
+        req->in.append(rest);
+        req->inpurge = 0;
+    }
+    else
+    {
+        req->purge(size_t(ptr - start));
+    }
+}
+
+// read and add/verify the node record that j has just entered.  Nodes whose parent is not known
+// yet are added to dp.  Returns false on malformed JSON
+bool MegaClient::readnode(JSON* j, int notify, putsource_t source, vector<NewNode>* nn, int tag, bool applykeys, node_vector& dp, node_vector* added)
+{
+    Node* n;
+
+    handle h = UNDEF, ph = UNDEF;
+    handle u = 0, su = UNDEF;
+    nodetype_t t = TYPE_UNKNOWN;
+    const char* a = NULL;
+    const char* k = NULL;
+    const char* fa = NULL;
+    const char *sk = NULL;
+    accesslevel_t rl = ACCESS_UNKNOWN;
+    m_off_t s = NEVER;
+    m_time_t ts = -1, sts = -1;
+    nameid name;
+    int nni = -1;
+
+    while ((name = j->getnameid()) != EOO)
+    {
+        switch (name)
+        {
+            case 'h':   // new node: handle
+                h = j->gethandle();
+                break;
+
+            case 'p':   // parent node
+                ph = j->gethandle();
+                break;
+
+            case 'u':   // owner user
+                u = j->gethandle(USERHANDLE);
+                break;
+
+            case 't':   // type
+                t = (nodetype_t)j->getint();
+                break;
+
+            case 'a':   // attributes
+                a = j->getvalue();
+                break;
+
+            case 'k':   // key(s)
+                k = j->getvalue();
+                break;
+
+            case 's':   // file size
+                s = j->getint();
+                break;
+
+            case 'i':   // related source NewNode index
+                nni = int(j->getint());
+                break;
+
+            case MAKENAMEID2('t', 's'):  // actual creation timestamp
+                ts = j->getint();
+                break;
+
+            case MAKENAMEID2('f', 'a'):  // file attributes
+                fa = j->getvalue();
+                break;
+
+                // inbound share attributes
+            case 'r':   // share access level
+                rl = (accesslevel_t)j->getint();
+                break;
+
+            case MAKENAMEID2('s', 'k'):  // share key
+                sk = j->getvalue();
+                break;
+
+            case MAKENAMEID2('s', 'u'):  // sharing user
+                su = j->gethandle(USERHANDLE);
+                break;
+
+            case MAKENAMEID3('s', 't', 's'):  // share timestamp
+                sts = j->getint();
+                break;
+
+            default:
+                if (!j->storeobject())
                 {
-                    warn("File node without file size");
+                    return false;
                 }
+        }
+    }
+
+    if (ISUNDEF(h))
+    {
+        warn("Missing node handle");
+    }
+    else
+    {
+        if (t == TYPE_UNKNOWN)
+        {
+            warn("Unknown node type");
+        }
+        else if (t == FILENODE || t == FOLDERNODE)
+        {
+            if (ISUNDEF(ph))
+            {
+                warn("Missing parent");
+            }
+            else if (!a)
+            {
+                warn("Missing node attributes");
+            }
+            else if (!k)
+            {
+                warn("Missing node key");
+            }
+
+            if (t == FILENODE && ISUNDEF(s))
+            {
+                warn("File node without file size");
             }
         }
+    }
+
+    if (fa && t != FILENODE)
+    {
+        warn("Spurious file attributes");
+    }
 
-        if (fa && t != FILENODE)
+    if (!warnlevel())
+    {
+        if (reconcilingnodes)
         {
-            warn("Spurious file attributes");
+            reconcileseen.insert(h);
         }
 
-        if (!warnlevel())
+        if ((n = nodebyhandle(h)))
         {
-            if ((n = nodebyhandle(h)))
+            Node* p = NULL;
+            if (!ISUNDEF(ph))
             {
-                Node* p = NULL;
-                if (!ISUNDEF(ph))
-                {
-                    p = nodebyhandle(ph);
-                }
+                p = nodebyhandle(ph);
+            }
 
-                if (n->changed.removed)
+            if (n->changed.removed)
+            {
+                // node marked for deletion is being resurrected, possibly
+                // with a new parent (server-client move operation)
+                n->changed.removed = false;
+            }
+            else if (reconcilingnodes)
+            {
+                // moves are expected in a reloaded tree, but a node doesn't change type
+                if (n->type != t)
                 {
-                    // node marked for deletion is being resurrected, possibly
-                    // with a new parent (server-client move operation)
-                    n->changed.removed = false;
+                    LOG_warn << "Reloaded node changed type: " << toNodeHandle(h);
+                    reconcilefailed = true;
                 }
-                else
+            }
+            else
+            {
+                // node already present - check for race condition
+                if ((n->parent && ph != n->parent->nodehandle && p &&  p->type != FILENODE) || n->type != t)
                 {
-                    // node already present - check for race condition
-                    if ((n->parent && ph != n->parent->nodehandle && p &&  p->type != FILENODE) || n->type != t)
-                    {
-                        app->reload("Node inconsistency");
+                    app->reload("Node inconsistency");
 
-                        static bool reloadnotified = false;
-                        if (!reloadnotified)
-                        {
-                            sendevent(99437, "Node inconsistency", 0);
-                            reloadnotified = true;
-                        }
+                    static bool reloadnotified = false;
+                    if (!reloadnotified)
+                    {
+                        sendevent(99437, "Node inconsistency", 0);
+                        reloadnotified = true;
                     }
                 }
+            }
 
-                if (!ISUNDEF(ph))
+            if (!ISUNDEF(ph))
+            {
+                if (p)
                 {
-                    if (p)
-                    {
-                        if (n->setparent(p))
-                        {
-                            n->changed.parent = true;
-                        }
-                    }
-                    else
+                    if (n->setparent(p))
                     {
-                        n->setparent(NULL);
-                        n->parenthandle = ph;
-                        dp.push_back(n);
+                        n->changed.parent = true;
                     }
                 }
-
-                if (a && k && n->attrstring)
+                else
                 {
-                    LOG_warn << "Updating the key of a NO_KEY node";
-                    Node::copystring(n->attrstring.get(), a);
-                    n->setkeyfromjson(k);
+                    n->setparent(NULL);
+                    n->parenthandle = ph;
+                    dp.push_back(n);
                 }
             }
-            else
+
+            if (a && k && n->attrstring)
+            {
+                LOG_warn << "Updating the key of a NO_KEY node";
+                Node::copystring(n->attrstring.get(), a);
+                n->setkeyfromjson(k);
+            }
+            else if (reconcilingnodes && (reconcilenode(n, a, fa) || n->changed.parent))
             {
-                byte buf[SymmCipher::KEYLENGTH];
+                reconciled.push_back(n);
+            }
+        }
+        else
+        {
+            byte buf[SymmCipher::KEYLENGTH];
 
-                if (!ISUNDEF(su))
+            if (!ISUNDEF(su))
+            {
+                if (t != FOLDERNODE)
                 {
-                    if (t != FOLDERNODE)
-                    {
-                        warn("Invalid share node type");
-                    }
-
-                    if (rl == ACCESS_UNKNOWN)
-                    {
-                        warn("Missing access level");
-                    }
-
-                    if (!sk)
-                    {
-                        LOG_warn << "Missing share key for inbound share";
-                    }
-
-                    if (warnlevel())
-                    {
-                        su = UNDEF;
-                    }
-                    else
-                    {
-                        if (sk)
-                        {
-                            decryptkey(sk, buf, sizeof buf, &key, 1, h);
-                        }
-                    }
+                    warn("Invalid share node type");
                 }
 
-                string fas;
-
-                Node::copystring(&fas, fa);
+                if (rl == ACCESS_UNKNOWN)
+                {
+                    warn("Missing access level");
+                }
 
-                // fallback timestamps
-                if (!(ts + 1))
+                if (!sk)
                 {
-                    ts = m_time();
+                    LOG_warn << "Missing share key for inbound share";
                 }
 
-                if (!(sts + 1))
+                if (warnlevel())
                 {
-                    sts = ts;
+                    su = UNDEF;
                 }
+                else
+                {
+                    if (sk)
+                    {
+                        decryptkey(sk, buf, sizeof buf, &key, 1, h);
+                    }
+                }
+            }
 
-                n = new Node(this, &dp, h, ph, t, s, u, fas.c_str(), ts);
-                n->changed.newnode = true;
+            // fallback timestamps
+            if (!(ts + 1))
+            {
+                ts = m_time();
+            }
 
-                n->tag = tag;
+            if (!(sts + 1))
+            {
+                sts = ts;
+            }
 
-                n->attrstring.reset(new string);
-                Node::copystring(n->attrstring.get(), a);
-                n->setkeyfromjson(k);
+            n = new Node(this, &dp, h, ph, t, s, u, fa, ts);
+            n->changed.newnode = true;
 
-                // folder link access: first returned record defines root node and identity
-				// (this code used to be in Node::Node but is not suitable for session resume)
-                if (ISUNDEF(*rootnodes))
-                {
-                    *rootnodes = h;
+            n->tag = tag;
 
-                    if (loggedIntoWritableFolder())
-                    {
-                        // If logged into writable folder, we need the sharekey set in the root node
-                        // so as to include it in subsequent put nodes
-                        n->sharekey = new SymmCipher(key); //we use the "master key", in this case the secret share key
-                    }
-                }
+            n->attrstring.reset(new string);
+            Node::copystring(n->attrstring.get(), a);
+            n->setkeyfromjson(k);
 
-                if (!ISUNDEF(su))
-                {
-                    newshares.push_back(new NewShare(h, 0, su, rl, sts, sk ? buf : NULL));
-                }
+            // folder link access: first returned record defines root node and identity
+            // (this code used to be in Node::Node but is not suitable for session resume)
+            if (ISUNDEF(*rootnodes))
+            {
+                *rootnodes = h;
 
-                if (u != me && !ISUNDEF(u) && !fetchingnodes)
+                if (loggedIntoWritableFolder())
                 {
-                    useralerts.noteSharedNode(u, t, ts, n);
+                    // If logged into writable folder, we need the sharekey set in the root node
+                    // so as to include it in subsequent put nodes
+                    n->sharekey = new SymmCipher(key); //we use the "master key", in this case the secret share key
                 }
+            }
 
-                if (nn && nni >= 0 && nni < int(nn->size()))
-                {
-                    auto& nn_nni = (*nn)[nni];
-                    nn_nni.added = true;
-                    nn_nni.mAddedHandle = h;
+            if (!ISUNDEF(su))
+            {
+                newshares.push_back(new NewShare(h, 0, su, rl, sts, sk ? buf : NULL));
+            }
+
+            if (u != me && !ISUNDEF(u) && !fetchingnodes)
+            {
+                useralerts.noteSharedNode(u, t, ts, n);
+            }
+
+            if (nn && nni >= 0 && nni < int(nn->size()))
+            {
+                auto& nn_nni = (*nn)[nni];
+                nn_nni.added = true;
+                nn_nni.mAddedHandle = h;
 
 #ifdef ENABLE_SYNC
-                    if (source == PUTNODES_SYNC)
+                if (source == PUTNODES_SYNC)
+                {
+                    if (nn_nni.localnode)
                     {
-                        if (nn_nni.localnode)
-                        {
-                            // overwrites/updates: associate LocalNode with newly created Node
-                            nn_nni.localnode->setnode(n);
-                            nn_nni.localnode->treestate(TREESTATE_SYNCED);
+                        // overwrites/updates: associate LocalNode with newly created Node
+                        nn_nni.localnode->setnode(n);
+                        nn_nni.localnode->treestate(TREESTATE_SYNCED);
 
-                            // updates cache with the new node associated
-                            nn_nni.localnode->sync->statecacheadd(nn_nni.localnode);
-                            nn_nni.localnode->newnode.reset(); // localnode ptr now null also
-                        }
+                        // updates cache with the new node associated
+                        nn_nni.localnode->sync->statecacheadd(nn_nni.localnode);
+                        nn_nni.localnode->newnode.reset(); // localnode ptr now null also
                     }
+                }
 #endif
 
-                    if (nn_nni.source == NEW_UPLOAD)
-                    {
-                        handle uh = nn_nni.uploadhandle;
-
-                        // do we have pending file attributes for this upload? set them.
-                        for (fa_map::iterator it = pendingfa.lower_bound(pair<handle, fatype>(uh, fatype(0)));
-                             it != pendingfa.end() && it->first.first == uh; )
-                        {
-                            reqs.add(new CommandAttachFA(this, h, it->first.second, it->second.first, it->second.second));
-                            pendingfa.erase(it++);
-                        }
+                if (nn_nni.source == NEW_UPLOAD)
+                {
+                    handle uh = nn_nni.uploadhandle;
 
-                        // FIXME: only do this for in-flight FA writes
-                        uhnh.insert(pair<handle, handle>(uh, h));
+                    // do we have pending file attributes for this upload? set them.
+                    for (fa_map::iterator it = pendingfa.lower_bound(pair<handle, fatype>(uh, fatype(0)));
+                         it != pendingfa.end() && it->first.first == uh; )
+                    {
+                        reqs.add(new CommandAttachFA(this, h, it->first.second, it->second.first, it->second.second));
+                        pendingfa.erase(it++);
                     }
+
+                    // FIXME: only do this for in-flight FA writes
+                    uhnh.insert(pair<handle, handle>(uh, h));
                 }
             }
+        }
 
-            if (notify)
-            {
-                notifynode(n);
-            }
+        if (notify)
+        {
+            notifynode(n);
+        }
+        else if (reconcilingnodes && n->changed.newnode)
+        {
+            reconciled.push_back(n);
+        }
 
-            if (applykeys)
-            {
-                n->applykey();
-            }
+        if (applykeys)
+        {
+            n->applykey();
         }
-    }
 
-    // any child nodes that arrived before their parents?
-    for (size_t i = dp.size(); i--; )
-    {
-        if ((n = nodebyhandle(dp[i]->parenthandle)))
+        if (added)
         {
-            dp[i]->setparent(n);
+            added->push_back(n);
         }
     }
 
-    return j->leavearray();
+    return true;
 }
 
 // decrypt and set encrypted sharekey
@@ -8613,35 +9965,203 @@ void MegaClient::procph(JSON *j)
                             LOG_warn << "node for public link not found";
                         }
 
-                        break;
-                    default:
-                       if (!j->storeobject())
-                       {
-                            return;
-                       }
-                }
+                        break;
+                    default:
+                       if (!j->storeobject())
+                       {
+                            return;
+                       }
+                }
+            }
+        }
+
+        j->leavearray();
+    }
+}
+
+void MegaClient::applykeys()
+{
+    CodeCounter::ScopeTimer ccst(performanceStats.applyKeys);
+    FetchNodesStats::PhaseTimer pt(startupphase(fnstats.applyKeysTimeUs));
+
+    int noKeyExpected = (rootnodes[0] != UNDEF) + (rootnodes[1] != UNDEF) + (rootnodes[2] != UNDEF);
+
+    if (nodes.size() > size_t(mAppliedKeyNodeCount + noKeyExpected))
+    {
+        node_vector v;
+        v.reserve(nodes.size());
+        for (auto& it : nodes)
+        {
+            v.push_back(it.second);
+        }
+        applykeys(v);
+    }
+
+    sendkeyrewrites();
+}
+
+void MegaClient::applykeys(const node_vector& v)
+{
+    // what Node::applykey() does, with the decryption of the key and attributes of each node done
+    // on the worker threads and the bookkeeping, which touches the client, on this one
+    struct KeyJob
+    {
+        Node* n;
+        const char* k;
+        const byte* wrappingkey;
+        byte key[FILENODEKEYLENGTH];
+        bool decrypted;
+        bool attrsdecrypted;
+        attr_map attrs;
+    };
+
+    auto keylength = [](const KeyJob& job)
+    {
+        return (job.n->type == FILENODE) ? FILENODEKEYLENGTH : FOLDERNODEKEYLENGTH;
+    };
+
+    auto decryptattrs = [&keylength](KeyJob& job, SymmCipher& nodecipher)
+    {
+        job.decrypted = true;
+
+        string nodekey(reinterpret_cast<const char*>(job.key), size_t(keylength(job)));
+        job.attrsdecrypted = nodecipher.setkey(&nodekey) && job.n->decryptattrs(nodecipher, job.attrs);
+    };
+
+    // keys still encrypted with our RSA key (see decryptkey()), which are rewritten once decrypted
+    std::vector<KeyJob> jobs, rsajobs;
+    jobs.reserve(v.size());
+
+    for (Node* n : v)
+    {
+        SymmCipher* sc;
+        const char* k;
+
+        if (n->type > FOLDERNODE || !(k = n->keytoapply(&sc)))
+        {
+            n->applykey();
+            continue;
+        }
+
+        size_t kl = strcspn(k, "\"/");
+        if (kl > 4 * FILENODEKEYLENGTH / 3 + 1)
+        {
+            rsajobs.push_back(KeyJob{n, k, nullptr, {}, false, false, {}});
+            continue;
+        }
+
+        jobs.push_back(KeyJob{n, k, sc->key, {}, false, false, {}});
+    }
+
+    const size_t BATCHSIZE = 512;
+
+    mAsyncQueue.parallelFor((jobs.size() + BATCHSIZE - 1) / BATCHSIZE, [&jobs, &keylength, &decryptattrs, BATCHSIZE](size_t batch, SymmCipher& wrappingcipher)
+    {
+        std::vector<KeyJob*> batchjobs;
+        for (size_t i = batch * BATCHSIZE; i < jobs.size() && i < (batch + 1) * BATCHSIZE; i++)
+        {
+            KeyJob& job = jobs[i];
+
+            if (Base64::atob(job.k, job.key, keylength(job)) == keylength(job))
+            {
+                batchjobs.push_back(&job);
+            }
+        }
+
+        // the keys wrapped with the same one (the master key, or a share key) are decrypted together
+        std::stable_sort(batchjobs.begin(), batchjobs.end(), [](const KeyJob* a, const KeyJob* b)
+        {
+            return std::less<const byte*>()(a->wrappingkey, b->wrappingkey);
+        });
+
+        std::vector<byte*> keys;
+        std::vector<unsigned> lengths;
+        for (size_t i = 0; i < batchjobs.size(); )
+        {
+            keys.clear();
+            lengths.clear();
+
+            size_t j = i;
+            for (; j < batchjobs.size() && batchjobs[j]->wrappingkey == batchjobs[i]->wrappingkey; j++)
+            {
+                keys.push_back(batchjobs[j]->key);
+                lengths.push_back(unsigned(keylength(*batchjobs[j])));
             }
+
+            wrappingcipher.setkey(batchjobs[i]->wrappingkey);
+            wrappingcipher.ecb_decrypt_keys(keys.data(), lengths.data(), keys.size());
+            i = j;
         }
 
-        j->leavearray();
-    }
-}
+        SymmCipher nodecipher;
+        for (KeyJob* job : batchjobs)
+        {
+            decryptattrs(*job, nodecipher);
+        }
+    });
 
-void MegaClient::applykeys()
-{
-    CodeCounter::ScopeTimer ccst(performanceStats.applyKeys);
+    // a few milliseconds each: in small batches, so that they spread over all the workers.
+    // AsymmCipher is not to be shared between threads, so each batch has its own copy of the key
+    const size_t RSABATCHSIZE = 8;
+    const AsymmCipher& privkey = asymkey;
 
-    int noKeyExpected = (rootnodes[0] != UNDEF) + (rootnodes[1] != UNDEF) + (rootnodes[2] != UNDEF);
+    mAsyncQueue.parallelFor((rsajobs.size() + RSABATCHSIZE - 1) / RSABATCHSIZE, [&rsajobs, &privkey, &keylength, &decryptattrs, RSABATCHSIZE](size_t batch, SymmCipher& nodecipher)
+    {
+        AsymmCipher rsakey(privkey);
+        std::vector<byte> buf;
 
-    if (nodes.size() > size_t(mAppliedKeyNodeCount + noKeyExpected))
+        for (size_t i = batch * RSABATCHSIZE; i < rsajobs.size() && i < (batch + 1) * RSABATCHSIZE; i++)
+        {
+            KeyJob& job = rsajobs[i];
+
+            int sl = int(strcspn(job.k, "\"/") / 4 * 3 + 3);
+            if (sl > 4096)
+            {
+                continue;
+            }
+
+            buf.resize(size_t(sl));
+            sl = Base64::atob(job.k, buf.data(), sl);
+
+            if (rsakey.decrypt(buf.data(), size_t(sl), job.key, size_t(keylength(job))))
+            {
+                decryptattrs(job, nodecipher);
+            }
+        }
+    });
+
+    for (KeyJob& job : jobs)
     {
-        for (auto& it : nodes)
+        if (!job.decrypted)
+        {
+            LOG_warn << "Corrupt or invalid symmetric node key";
+            continue;
+        }
+
+        job.n->setappliedkey(job.key);
+        if (job.attrsdecrypted)
         {
-            it.second->applykey();
+            job.n->setattrs(std::move(job.attrs));
         }
     }
 
-    sendkeyrewrites();
+    for (KeyJob& job : rsajobs)
+    {
+        if (!job.decrypted)
+        {
+            LOG_warn << "Corrupt or invalid RSA node key";
+            continue;
+        }
+
+        // stored symmetrically from now on (see sendkeyrewrites())
+        nodekeyrewrite.push_back(job.n->nodehandle);
+
+        job.n->setappliedkey(job.key);
+        if (job.attrsdecrypted)
+        {
+            job.n->setattrs(std::move(job.attrs));
+        }
+    }
 }
 
 void MegaClient::sendkeyrewrites()
@@ -8938,9 +10458,7 @@ void MegaClient::login2(const char *email, const char *password, string *salt, c
     Base64::atob(*salt, bsalt);
 
     byte derivedKey[2 * SymmCipher::KEYLENGTH];
-    CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA512> pbkdf2;
-    pbkdf2.DeriveKey(derivedKey, sizeof(derivedKey), 0, (byte *)password, strlen(password),
-                     (const byte *)bsalt.data(), bsalt.size(), 100000);
+    pbkdf2key(password, bsalt, derivedKey);
 
     login2(email, derivedKey, pin);
 }
@@ -9237,9 +10755,38 @@ void MegaClient::opensctable()
 
         if (dbname.size())
         {
-            sctable = dbaccess->open(rng, *fsaccess, dbname);
+            if (readonlystatecache)
+            {
+                sctable = dbaccess->open(rng, *fsaccess, dbname, DB_OPEN_FLAG_READONLY);
+                if (sctable)
+                {
+                    sctable = new ReadOnlyDbTable(rng, unique_ptr<DbTable>(sctable));
+                    sctabledataversion = sctable->dataVersion();
+                    nextsctablecheck = Waiter::ds + 10;
+                }
+            }
+            else
+            {
+                sctable = dbaccess->open(rng, *fsaccess, dbname);
+            }
             pendingsccommit = false;
 
+            if (sctable && asyncstatecache && !readonlystatecache)
+            {
+                sctable = new AsyncDbTable(rng, unique_ptr<DbTable>(sctable));
+            }
+
+            if (sctable && usestatesnapshot && !readonlystatecache)
+            {
+                unique_ptr<StateSnapshot> snapshot(new StateSnapshot(*fsaccess, dbaccess->rootPath(), dbname));
+                sctable = new SnapshottedDbTable(rng, unique_ptr<DbTable>(sctable), std::move(snapshot));
+            }
+
+            if (sctable && compactstatecache && sctable->reclaimableBytes() >= STATECACHEVACUUMBYTES)
+            {
+                sctable->vacuum();
+            }
+
             if (sctable)
             {
                 // sctable always has a transaction started.
@@ -9251,6 +10798,29 @@ void MegaClient::opensctable()
     }
 }
 
+bool MegaClient::CachedDns::serialize(string* d)
+{
+    d->assign(data);
+    return true;
+}
+
+void MegaClient::savednscache()
+{
+    httpio->dnscachechanged = false;
+
+    cacheddns.data.clear();
+    if (!statusTable || !httpio->serializednscache(&cacheddns.data))
+    {
+        return;
+    }
+
+    DBTableTransactionCommitter committer(statusTable);
+    if (!statusTable->put(CACHEDDNS, &cacheddns, &key))
+    {
+        LOG_err << "Failed to save the DNS cache";
+    }
+}
+
 void MegaClient::openStatusTable()
 {
     if (dbaccess && !statusTable)
@@ -9272,7 +10842,18 @@ void MegaClient::openStatusTable()
         {
             dbname.insert(0, "status_");
 
-            statusTable.reset(dbaccess->open(rng, *fsaccess, dbname));
+            if (readonlystatecache)
+            {
+                unique_ptr<DbTable> table(dbaccess->open(rng, *fsaccess, dbname, DB_OPEN_FLAG_READONLY));
+                if (table)
+                {
+                    statusTable.reset(new ReadOnlyDbTable(rng, std::move(table)));
+                }
+            }
+            else
+            {
+                statusTable.reset(dbaccess->open(rng, *fsaccess, dbname));
+            }
         }
     }
 }
@@ -9603,7 +11184,8 @@ void MegaClient::proctree(Node* n, TreeProc* tp, bool skipinshares, bool skipver
 {
     if (!skipversions || n->type != FILENODE)
     {
-        for (node_list::iterator it = n->children.begin(); it != n->children.end(); )
+        loadchildren(n);
+        for (auto it = n->children.begin(); it != n->children.end(); )
         {
             Node *child = *it++;
             if (!(skipinshares && child->inshare))
@@ -9643,7 +11225,12 @@ void MegaClient::queuepubkeyreq(const char *uid, std::unique_ptr<PubKeyAction> p
     User *u = finduser(uid, 0);
     if (!u && uid)
     {
-        if (strchr(uid, '@'))   // uid is an e-mail address
+        auto it = pubkeyusers.find(uid);
+        if (it != pubkeyusers.end())
+        {
+            u = it->second;
+        }
+        else if (strchr(uid, '@'))   // uid is an e-mail address
         {
             string nuid;
             Node::copystring(&nuid, uid);
@@ -9664,18 +11251,23 @@ void MegaClient::queuepubkeyreq(const char *uid, std::unique_ptr<PubKeyAction> p
                 u->isTemporary = true;
             }
         }
+
+        if (u && u->isTemporary)
+        {
+            pubkeyusers[uid] = u;
+        }
     }
 
     queuepubkeyreq(u, std::move(pka));
 }
 
 // rewrite keys of foreign nodes due to loss of underlying shareufskey
-void MegaClient::rewriteforeignkeys(Node* n)
+void MegaClient::rewriteforeignkeys(Node* n, bool send)
 {
     TreeProcForeignKeys rewrite;
     proctree(n, &rewrite);
 
-    if (nodekeyrewrite.size())
+    if (send && nodekeyrewrite.size())
     {
         reqs.add(new CommandNodeKeyUpdate(this, &nodekeyrewrite));
         nodekeyrewrite.clear();
@@ -10018,6 +11610,15 @@ void MegaClient::getua(User* u, const attr_t at, int ctag)
         }
         else
         {
+            auto it = u->uarequests.find(at);
+            if (it != u->uarequests.end())
+            {
+                // already on its way: this call gets the same result
+                it->second.push_back(tag);
+                return;
+            }
+
+            u->uarequests[at];
             reqs.add(new CommandGetUA(this, u->uid.c_str(), at, NULL, tag, nullptr, nullptr, nullptr));
         }
     }
@@ -10054,6 +11655,8 @@ void MegaClient::senddevcommand(const char *command, const char *email, long lon
 // queue node for notification
 void MegaClient::notifynode(Node* n)
 {
+    // whatever changed, MegaNodes created from now on must see it
+    n->dropsnapshot();
     n->applykey();
 
     if (!fetchingnodes)
@@ -10094,6 +11697,37 @@ void MegaClient::notifynode(Node* n)
         }
 
 #ifdef ENABLE_SYNC
+        // let procsc() know that syncdown() must see this change before more action packets are applied
+        // (not for the syncs that only upload)
+        if (!scsyncchanged)
+        {
+            if (n->localnode || (n->parent && n->parent->localnode))
+            {
+                LocalNode* l = n->localnode ? n->localnode.get() : n->parent->localnode.get();
+                scsyncchanged = l->sync->getConfig().isDownSync();
+            }
+            else
+            {
+                syncs.forEachRunningSyncContainingNode(n, [this](Sync* s) { scsyncchanged |= s->getConfig().isDownSync(); });
+            }
+        }
+
+        // the synced folders this node left and joined (the nearest one above, if its parent
+        // isn't synced yet) compare their children on the next passes
+        if (n->localnode && n->localnode->parent)
+        {
+            n->localnode->parent->setsyncdirty();
+        }
+
+        for (Node* p = n->parent; p; p = p->parent)
+        {
+            if (p->localnode)
+            {
+                p->localnode->setsyncdirty();
+                break;
+            }
+        }
+
         // is this a synced node that was moved to a non-synced location? queue for
         // deletion from LocalNodes.
         if (n->localnode && n->localnode->parent && n->parent && !n->parent->localnode)
@@ -10152,63 +11786,337 @@ void MegaClient::notifynode(Node* n)
             }
             else if (!n->changed.removed && n->changed.attrs && n->localnode && n->localnode->name.compare(n->displayname()))
             {
-                app->syncupdate_remote_rename(n->localnode->sync, n, n->localnode->name.c_str());
+                app->syncupdate_remote_rename(n->localnode->sync, n, n->localnode->name.c_str());
+            }
+        }
+#endif
+    }
+
+    if (!n->notified)
+    {
+        n->notified = true;
+        nodenotify.push_back(n);
+    }
+}
+
+void MegaClient::transfercacheadd(Transfer *transfer, DBTableTransactionCommitter* committer)
+{
+    if (tctable && !transfer->skipserialization && batchtransfercache)
+    {
+        if (!transfer->cachedirty)
+        {
+            transfer->cachedirty = true;
+            if (dirtytransfers.empty())
+            {
+                transfercachedirtyds = Waiter::ds;
+            }
+            dirtytransfers.insert(transfer);
+            if (++dirtytransfercache >= TRANSFERCACHEBATCH)
+            {
+                flushtransfercache();
+            }
+        }
+    }
+    else if (tctable && !transfer->skipserialization)
+    {
+        LOG_debug << "Caching transfer";
+        tctable->checkCommitter(committer);
+        tctable->put(MegaClient::CACHEDTRANSFER, transfer, &tckey);
+    }
+}
+
+void MegaClient::transfercachedel(Transfer *transfer, DBTableTransactionCommitter* committer)
+{
+    if (transfer->cachedirty)
+    {
+        transfer->cachedirty = false;
+        dirtytransfercache--;
+    }
+
+    if (tctable && transfer->dbid)
+    {
+        LOG_debug << "Removing cached transfer";
+        tctable->checkCommitter(committer);
+        tctable->del(transfer->dbid);
+    }
+}
+
+void MegaClient::filecacheadd(File *file, DBTableTransactionCommitter& committer)
+{
+    if (tctable && !file->syncxfer && batchtransfercache)
+    {
+        if (!file->cachedirty)
+        {
+            file->cachedirty = true;
+            if (dirtytransfers.empty())
+            {
+                transfercachedirtyds = Waiter::ds;
+            }
+            dirtytransfers.insert(file->transfer);
+            if (++dirtytransfercache >= TRANSFERCACHEBATCH)
+            {
+                flushtransfercache();
+            }
+        }
+    }
+    else if (tctable && !file->syncxfer)
+    {
+        LOG_debug << "Caching file";
+        tctable->checkCommitter(&committer);
+        tctable->put(MegaClient::CACHEDFILE, file, &tckey);
+    }
+}
+
+void MegaClient::filecachedel(File *file, DBTableTransactionCommitter* committer)
+{
+    if (file->cachedirty)
+    {
+        file->cachedirty = false;
+        dirtytransfercache--;
+    }
+
+    if (tctable && !file->syncxfer)
+    {
+        LOG_debug << "Removing cached file";
+        tctable->checkCommitter(committer);
+        tctable->del(file->dbid);
+    }
+
+    if (file->temporaryfile)
+    {
+        LOG_debug << "Removing temporary file";
+        fsaccess->unlinklocal(file->localname);
+    }
+}
+
+void MegaClient::runslicedjobs()
+{
+    if (slicedjobs.empty())
+    {
+        return;
+    }
+
+    CodeCounter::ScopeTimer ccst(performanceStats.slicedJobs);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(EXECSLICEMS);
+
+    do
+    {
+        // a job may add others, or end the session
+        SlicedJob job = std::move(slicedjobs.front());
+        slicedjobs.pop_front();
+
+        if (!job(deadline))
+        {
+            slicedjobs.push_front(std::move(job));
+            break;
+        }
+    } while (!slicedjobs.empty() && std::chrono::steady_clock::now() < deadline);
+}
+
+void MegaClient::indexcachednodes()
+{
+    LOG_debug << "Indexing " << nodes.size() << " nodes in local cache";
+
+    // nodes removed meanwhile are skipped, and those that change are written (with their columns)
+    // by updatesc() anyway
+    auto handles = std::make_shared<vector<handle>>();
+    handles->reserve(nodes.size());
+    for (auto& it : nodes)
+    {
+        handles->push_back(it.first);
+    }
+
+    DbTable* table = sctable;
+    size_t next = 0;
+
+    slicedjobs.push_back([this, table, handles, next](std::chrono::steady_clock::time_point deadline) mutable
+    {
+        if (table != sctable)
+        {
+            return true;
+        }
+
+        for (unsigned n = 0; next < handles->size(); ++next, ++n)
+        {
+            if (!(n & 63) && n && std::chrono::steady_clock::now() >= deadline)
+            {
+                return false;
+            }
+
+            Node* node = nodebyhandle((*handles)[next]);
+            if (node && !sctable->putNode(CACHEDNODE, node, &key))
+            {
+                LOG_err << "Unable to index the nodes in local cache";
+                return true;
+            }
+        }
+
+        sctable->setNodeIndexComplete();
+        LOG_debug << "Nodes in local cache indexed";
+        return true;
+    });
+}
+
+bool MegaClient::resumecachedfiles(std::chrono::steady_clock::time_point deadline)
+{
+    if (tctable && cachedfilesresumed < cachedfiles.size())
+    {
+        DBTableTransactionCommitter committer(tctable);
+        for (unsigned n = 0; cachedfilesresumed < cachedfiles.size(); ++n)
+        {
+            if (!(n & 15) && n && std::chrono::steady_clock::now() >= deadline)
+            {
+                return false;
+            }
+
+            size_t i = cachedfilesresumed++;
+            direction_t type = NONE;
+            File *file = app->file_resume(&cachedfiles.at(i), &type);
+            if (!file || (type != GET && type != PUT))
+            {
+                tctable->del(cachedfilesdbids.at(i));
+                continue;
+            }
+            nextreqtag();
+            file->dbid = cachedfilesdbids.at(i);
+            if (!startxfer(type, file, committer))
+            {
+                tctable->del(cachedfilesdbids.at(i));
+                continue;
             }
         }
-#endif
     }
 
-    if (!n->notified)
+    cachedfiles.clear();
+    cachedfilesdbids.clear();
+    cachedfilesresumed = 0;
+    return true;
+}
+
+// a slice of sctable's unused space at a time, when nothing else is going on
+void MegaClient::checksctable()
+{
+    nextsctablecheck = Waiter::ds + 10;
+
+    int64_t version = sctable->dataVersion();
+    if (version != sctabledataversion)
     {
-        n->notified = true;
-        nodenotify.push_back(n);
+        LOG_debug << "Local cache updated by its owner";
+        sctabledataversion = version;
+        app->notify_dbexternalcommit();
     }
 }
 
-void MegaClient::transfercacheadd(Transfer *transfer, DBTableTransactionCommitter* committer)
+void MegaClient::reclaimstatecache()
 {
-    if (tctable && !transfer->skipserialization)
+    if (fetchingnodes || !statecurrent || pendingcs || reqs.cmdspending() || jsonsc.pos)
     {
-        LOG_debug << "Caching transfer";
-        tctable->checkCommitter(committer);
-        tctable->put(MegaClient::CACHEDTRANSFER, transfer, &tckey);
+        nextstatecachereclaim = Waiter::ds + 10;
+        return;
+    }
+
+    int64_t reclaimed = sctable->reclaimSpace(STATECACHERECLAIMBYTES);
+    if (reclaimed > 0)
+    {
+        statecachereclaimed += reclaimed;
+        LOG_debug << "Reclaimed " << reclaimed << " bytes of the local cache (" << statecachereclaimed << " in this session)";
+        nextstatecachereclaim = Waiter::ds + 10;
+    }
+    else
+    {
+        // nothing to reclaim for now
+        nextstatecachereclaim = Waiter::ds + 600;
     }
 }
 
-void MegaClient::transfercachedel(Transfer *transfer, DBTableTransactionCommitter* committer)
+void MegaClient::flushtransfercache()
 {
-    if (tctable && transfer->dbid)
+    if (dirtytransfers.empty())
     {
-        LOG_debug << "Removing cached transfer";
-        tctable->checkCommitter(committer);
-        tctable->del(transfer->dbid);
+        return;
+    }
+
+    if (tctable)
+    {
+        LOG_debug << "Caching " << dirtytransfercache << " transfers and files";
+
+        DbTable::RecordBatch batch;
+        batch.reserve(dirtytransfercache);
+
+        for (Transfer* transfer : dirtytransfers)
+        {
+            if (transfer->cachedirty)
+            {
+                tctable->addToBatch(batch, MegaClient::CACHEDTRANSFER, transfer, &tckey);
+            }
+
+            for (File* file : transfer->files)
+            {
+                if (file->cachedirty)
+                {
+                    tctable->addToBatch(batch, MegaClient::CACHEDFILE, file, &tckey);
+                }
+            }
+        }
+
+        DBTableTransactionCommitter committer(tctable);
+        tctable->checkCommitter(&committer);
+        if (!tctable->putBatch(batch))
+        {
+            LOG_err << "Failed to cache transfers";
+        }
     }
+
+    discardtransfercache();
 }
 
-void MegaClient::filecacheadd(File *file, DBTableTransactionCommitter& committer)
+void MegaClient::discardtransfercache()
 {
-    if (tctable && !file->syncxfer)
+    for (Transfer* transfer : dirtytransfers)
     {
-        LOG_debug << "Caching file";
-        tctable->checkCommitter(&committer);
-        tctable->put(MegaClient::CACHEDFILE, file, &tckey);
+        transfer->cachedirty = false;
+        for (File* file : transfer->files)
+        {
+            file->cachedirty = false;
+        }
     }
+
+    dirtytransfers.clear();
+    dirtytransfercache = 0;
 }
 
-void MegaClient::filecachedel(File *file, DBTableTransactionCommitter* committer)
+void MegaClient::batchputnode(handle target, NewNode&& newnode, int tag)
 {
-    if (tctable && !file->syncxfer)
+    if (putnodesbatches.empty())
     {
-        LOG_debug << "Removing cached file";
-        tctable->checkCommitter(committer);
-        tctable->del(file->dbid);
+        putnodesbatchds = Waiter::ds;
     }
 
-    if (file->temporaryfile)
+    PutNodesBatch& batch = putnodesbatches[target];
+    batch.nodes.push_back(std::move(newnode));
+    batch.tags.push_back(tag);
+
+    if (batch.nodes.size() >= size_t(MAX_NEWNODES))
     {
-        LOG_debug << "Removing temporary file";
-        fsaccess->unlinklocal(file->localname);
+        auto cmd = new CommandPutNodes(this, target, NULL, std::move(batch.nodes), batch.tags.front(), PUTNODES_APP);
+        cmd->batchtags = std::move(batch.tags);
+        reqs.add(cmd);
+        putnodesbatches.erase(target);
+    }
+}
+
+void MegaClient::flushputnodes()
+{
+    for (auto& batch : putnodesbatches)
+    {
+        LOG_debug << "Putting " << batch.second.nodes.size() << " uploaded nodes in one request";
+
+        auto cmd = new CommandPutNodes(this, batch.first, NULL, std::move(batch.second.nodes), batch.second.tags.front(), PUTNODES_APP);
+        cmd->batchtags = std::move(batch.second.tags);
+        reqs.add(cmd);
     }
+
+    putnodesbatches.clear();
 }
 
 // queue user for notification
@@ -11430,80 +13338,268 @@ bool MegaClient::fetchsc(DbTable* sctable)
     LOG_info << "Loading session from local cache";
 
     mCachedStatus.clear();
-    sctable->rewind();
 
-    bool hasNext = sctable->next(&id, &data, &key);
-    WAIT_CLASS::bumpds();
-    fnstats.timeToFirstByte = Waiter::ds - fnstats.startTime;
+    // a snapshot in sync with the table holds the same records in one file, nodes parents first
+    StateSnapshot* snapshot = sctable == this->sctable ? statesnapshot() : nullptr;
+    bool fromsnapshot = snapshot && snapshot->load(cachedscsn);
 
-    while (hasNext)
+    if (fromsnapshot)
     {
-        switch (id & 15)
+        LOG_info << "Loading session from the state snapshot";
+    }
+    else
+    {
+        sctable->rewind();
+    }
+
+    auto nextrecord = [&]()
+    {
+        if (!fromsnapshot)
         {
-            case CACHEDSCSN:
-                if (data.size() != sizeof cachedscsn)
-                {
-                    return false;
-                }
-                break;
+            return sctable->nextencrypted(&id, &data);
+        }
 
-            case CACHEDNODE:
-                if ((n = Node::unserialize(this, &data, &dp)))
-                {
-                    n->dbid = id;
-                }
-                else
-                {
-                    LOG_err << "Failed - node record read error";
-                    return false;
-                }
-                break;
+        if (!snapshot->next(&id, &data))
+        {
+            return false;
+        }
 
-            case CACHEDPCR:
-                if ((pcr = PendingContactRequest::unserialize(&data)))
-                {
-                    mappcr(pcr->id, pcr);
-                    pcr->dbid = id;
-                }
-                else
-                {
-                    LOG_err << "Failed - pcr record read error";
-                    return false;
-                }
-                break;
+        sctable->reserveid(id);
+        return true;
+    };
 
-            case CACHEDUSER:
-                if ((u = User::unserialize(this, &data)))
-                {
-                    u->dbid = id;
-                }
-                else
-                {
-                    LOG_err << "Failed - user record read error";
-                    return false;
-                }
+    // Records are read in batches and go through a pipeline: while the worker threads decrypt and
+    // parse batch k (nodes into NodeRecords), this thread reads batch k + 1 and creates and links
+    // the nodes of batch k - 1, in order
+    const size_t BATCHSIZE = 1024;
+    const size_t DECRYPTSIZE = 128;
+
+    enum { DECRYPTFAILED, READY, PARSED, LEFTINTABLE, BADNODE };
+
+    struct Batch
+    {
+        std::vector<std::pair<uint32_t, string>> records;
+        std::vector<NodeRecord> parsed;
+        std::vector<char> status;
+        bool full = false;
+    } batches[3];
+
+    using steady = std::chrono::steady_clock;
+    auto ms = [](steady::duration d) { return std::chrono::duration_cast<std::chrono::milliseconds>(d).count(); };
+    steady::duration readtime{}, linktime{};
+    std::atomic<long long> parsetime{0};
+
+    bool firstbatch = true;
+    bool stopped = false;   // a record failed to decrypt: stop there, as DbTable::next() would
+    bool failed = false;    // a record could not be read: the cache is unusable
+
+    auto read = [&](Batch& b)
+    {
+        auto t0 = steady::now();
+        b.records.clear();
+        while (b.records.size() < BATCHSIZE && nextrecord())
+        {
+            b.records.emplace_back(id, std::move(data));
+        }
+        b.full = b.records.size() == BATCHSIZE;
+        readtime += steady::now() - t0;
+
+        if (firstbatch)
+        {
+            firstbatch = false;
+            WAIT_CLASS::bumpds();
+            fnstats.timeToFirstByte = Waiter::ds - fnstats.startTime;
+        }
+    };
+
+    auto parse = [this](Batch& b, size_t r, SymmCipher& sc)
+    {
+        uint32_t rid = b.records[r].first;
+        string& rdata = b.records[r].second;
+
+        if (rid && !PaddedCBC::decrypt(&rdata, &sc))
+        {
+            b.status[r] = DECRYPTFAILED;
+            return;
+        }
+
+        if ((rid & 15) != CACHEDNODE)
+        {
+            b.status[r] = READY;
+            return;
+        }
+
+        NodeRecord& record = b.parsed[r];
+        if (lazynodes)
+        {
+            if (!Node::unserializehandles(&rdata, &record.h, &record.ph))
+            {
+                b.status[r] = BADNODE;
+                return;
+            }
+
+            if (!ISUNDEF(record.ph))
+            {
+                b.status[r] = LEFTINTABLE;
+                return;
+            }
+        }
+
+        b.status[r] = record.unserialize(rdata, *fsaccess) ? PARSED : BADNODE;
+    };
+
+    auto link = [&](Batch& b)
+    {
+        auto t0 = steady::now();
+
+        for (size_t r = 0; r < b.records.size() && !stopped && !failed; r++)
+        {
+            if (b.status[r] == DECRYPTFAILED)
+            {
+                stopped = true;
                 break;
+            }
 
-            case CACHEDCHAT:
-#ifdef ENABLE_CHAT
-                {
-                    TextChat *chat;
-                    if ((chat = TextChat::unserialize(this, &data)))
+            id = b.records[r].first;
+
+            switch (id & 15)
+            {
+                case CACHEDSCSN:
+                    if (b.records[r].second.size() != sizeof cachedscsn)
                     {
-                        chat->dbid = id;
+                        failed = true;
+                    }
+                    break;
+
+                case CACHEDNODE:
+                    if (b.status[r] == LEFTINTABLE)
+                    {
+                        lazyindex.add(b.parsed[r].h, b.parsed[r].ph, id);
+                    }
+                    else if (b.status[r] == PARSED && lazyversions && leaveversion(b.parsed[r], id))
+                    {
+                        // a previous version, counted by the file it hangs from until it's looked up
+                    }
+                    else if (b.status[r] == PARSED && (n = Node::unserialize(this, b.parsed[r], &dp)))
+                    {
+                        n->dbid = id;
                     }
                     else
                     {
-                        LOG_err << "Failed - chat record read error";
-                        return false;
+                        LOG_err << "Failed - node record read error";
+                        failed = true;
+                    }
+                    break;
+
+                case CACHEDPCR:
+                    if ((pcr = PendingContactRequest::unserialize(&b.records[r].second)))
+                    {
+                        mappcr(pcr->id, pcr);
+                        pcr->dbid = id;
+                    }
+                    else
+                    {
+                        LOG_err << "Failed - pcr record read error";
+                        failed = true;
+                    }
+                    break;
+
+                case CACHEDUSER:
+                    if ((u = User::unserialize(this, &b.records[r].second)))
+                    {
+                        u->dbid = id;
+                    }
+                    else
+                    {
+                        LOG_err << "Failed - user record read error";
+                        failed = true;
+                    }
+                    break;
+
+                case CACHEDCHAT:
+#ifdef ENABLE_CHAT
+                    {
+                        TextChat *chat;
+                        if ((chat = TextChat::unserialize(this, &b.records[r].second)))
+                        {
+                            chat->dbid = id;
+                        }
+                        else
+                        {
+                            LOG_err << "Failed - chat record read error";
+                            failed = true;
+                        }
                     }
-                }
 #endif
-                break;
+                    break;
+            }
+        }
+
+        b.records.clear();
+        b.parsed.clear();
+        linktime += steady::now() - t0;
+    };
+
+    read(batches[0]);
+
+    for (size_t k = 0; ; k++)
+    {
+        Batch& current = batches[k % 3];
+        Batch* previous = k ? &batches[(k + 2) % 3] : nullptr;
+        Batch& next = batches[(k + 1) % 3];
+
+        current.status.assign(current.records.size(), DECRYPTFAILED);
+        current.parsed.clear();
+        current.parsed.resize(current.records.size());
+
+        mAsyncQueue.parallelFor((current.records.size() + DECRYPTSIZE - 1) / DECRYPTSIZE, [&](size_t item, SymmCipher& sc)
+        {
+            auto t0 = steady::now();
+            sc.setkey(key.key);
+            for (size_t r = item * DECRYPTSIZE; r < current.records.size() && r < (item + 1) * DECRYPTSIZE; r++)
+            {
+                parse(current, r, sc);
+            }
+            parsetime += ms(steady::now() - t0);
+        },
+        [&]()
+        {
+            if (previous)
+            {
+                link(*previous);
+            }
+
+            next.records.clear();
+            if (current.full && !stopped && !failed)
+            {
+                read(next);
+            }
+        });
+
+        if (failed)
+        {
+            return false;
+        }
+
+        if (stopped || next.records.empty())
+        {
+            link(current);
+            break;
         }
-        hasNext = sctable->next(&id, &data, &key);
     }
 
+    if (failed)
+    {
+        return false;
+    }
+
+    fnstats.dbReadTimeMs = ms(readtime);
+    fnstats.dbParseTimeMs = parsetime;
+    fnstats.dbLinkTimeMs = ms(linktime);
+
+    LOG_debug << "Local cache: " << fnstats.dbReadTimeMs << " ms reading, " << fnstats.dbParseTimeMs
+              << " ms decrypting and parsing (all threads), " << fnstats.dbLinkTimeMs << " ms creating nodes";
+
     WAIT_CLASS::bumpds();
     fnstats.timeToLastByte = Waiter::ds - fnstats.startTime;
 
@@ -11518,6 +13614,14 @@ bool MegaClient::fetchsc(DbTable* sctable)
 
     mergenewshares(0);
 
+    // a cache migrated from before the node table has node records without columns: write them
+    // again with theirs.  (Those that lazynodes left in the table wait for the next full reload)
+    if (sctable == this->sctable && lazyindex.empty() && dbaccess->currentDbVersion == DbAccess::DB_VERSION
+            && !sctable->nodeIndexComplete())
+    {
+        indexcachednodes();
+    }
+
     return true;
 }
 
@@ -11550,6 +13654,15 @@ bool MegaClient::fetchStatusTable(DbTable* table)
                 }
                 break;
             }
+#ifdef ENABLE_SYNC
+            case CACHEDSYNCDELETIONS:
+                resumesyncdeletions(data, id);
+                break;
+#endif
+            case CACHEDDNS:
+                cacheddns.dbid = id;
+                httpio->unserializednscache(data);
+                break;
         }
         hasNext = table->next(&id, &data, &key);
     }
@@ -11583,6 +13696,21 @@ void MegaClient::purgeOrphanTransfers(bool remove)
     for (int d = GET; d == GET || d == PUT; d += PUT - GET)
     {
         DBTableTransactionCommitter committer(tctable);
+
+        // the records still left are only unserialized to be purged
+        for (auto it = cachedtransferrecords[d].begin(); it != cachedtransferrecords[d].end(); )
+        {
+            if (remove || (purgeOrphanTransfers && (m_time() - it->second.lastaccesstime) >= 172500))
+            {
+                FileFingerprint fp = (it++)->first;
+                hydratecachedtransfer(direction_t(d), fp);
+            }
+            else
+            {
+                it = cachedtransferrecords[d].erase(it);
+            }
+        }
+
         while (cachedtransfers[d].size())
         {
             transfer_map::iterator it = cachedtransfers[d].begin();
@@ -11593,18 +13721,53 @@ void MegaClient::purgeOrphanTransfers(bool remove)
                 transfer->finished = true;
             }
 
-            app->transfer_removed(transfer);
-            delete transfer;
-            cachedtransfers[d].erase(it);
-        }
+            app->transfer_removed(transfer);
+            delete transfer;
+            cachedtransfers[d].erase(it);
+        }
+    }
+}
+
+void MegaClient::hydratecachedtransfer(direction_t d, const FileFingerprint& fp)
+{
+    auto it = cachedtransferrecords[d].find(fp);
+    if (it == cachedtransferrecords[d].end())
+    {
+        return;
+    }
+
+    uint32_t dbid = it->second.dbid;
+    Transfer* t = Transfer::unserialize(this, &it->second.data, cachedtransfers);
+    cachedtransferrecords[d].erase(it);
+    if (t)
+    {
+        t->dbid = dbid;
+        LOG_debug << "Cached transfer loaded";
+    }
+    else
+    {
+        tctable->del(dbid);
+        LOG_err << "Failed - transfer record read error";
     }
 }
 
 void MegaClient::closetc(bool remove)
 {
+    if (remove)
+    {
+        discardtransfercache();
+    }
+    else
+    {
+        flushtransfercache();
+    }
+
     pendingtcids.clear();
+    cachedtransferrecords[GET].clear();
+    cachedtransferrecords[PUT].clear();
     cachedfiles.clear();
     cachedfilesdbids.clear();
+    cachedfilesresumed = 0;
 
     if (remove && tctable)
     {
@@ -11615,11 +13778,13 @@ void MegaClient::closetc(bool remove)
 
 void MegaClient::enabletransferresumption(const char *loggedoutid)
 {
-    if (!dbaccess || tctable)
+    if (!dbaccess || tctable || readonlystatecache || browsingonly())
     {
         return;
     }
 
+    FetchNodesStats::PhaseTimer pt(startupphase(fnstats.transfersLoadTimeUs));
+
     string dbname;
     if (sid.size() >= SIDLEN)
     {
@@ -11654,8 +13819,11 @@ void MegaClient::enabletransferresumption(const char *loggedoutid)
 
     uint32_t id;
     string data;
-    Transfer* t;
+    direction_t type;
+    FileFingerprint fp;
+    CachedTransferRecord record;
 
+    // transfers are only indexed here, and unserialized as their files are resumed
     LOG_info << "Loading transfers from local cache";
     tctable->rewind();
     while (tctable->next(&id, &data, &tckey))
@@ -11663,14 +13831,18 @@ void MegaClient::enabletransferresumption(const char *loggedoutid)
         switch (id & 15)
         {
             case CACHEDTRANSFER:
-                if ((t = Transfer::unserialize(this, &data, cachedtransfers)))
+                if (Transfer::unserializeindex(data, type, fp, record.lastaccesstime, record.priority))
                 {
-                    t->dbid = id;
-                    if (t->priority > transferlist.currentpriority)
+                    record.dbid = id;
+                    record.data.swap(data);
+                    if (record.priority > transferlist.currentpriority)
+                    {
+                        transferlist.currentpriority = record.priority;
+                    }
+                    if (!cachedtransferrecords[type].emplace(fp, std::move(record)).second)
                     {
-                        transferlist.currentpriority = t->priority;
+                        LOG_warn << "Duplicate cached transfer";
                     }
-                    LOG_debug << "Cached transfer loaded";
                 }
                 else
                 {
@@ -11681,41 +13853,76 @@ void MegaClient::enabletransferresumption(const char *loggedoutid)
             case CACHEDFILE:
                 cachedfiles.push_back(data);
                 cachedfilesdbids.push_back(id);
-                LOG_debug << "Cached file loaded";
                 break;
         }
     }
 
-    // if we are logged in but the filesystem is not current yet
-    // postpone the resumption until the filesystem is updated
-    if ((!sid.size() && !loggedinfolderlink()) || statecurrent)
+    LOG_debug << "Cached transfers indexed: " << cachedtransferrecords[GET].size() + cachedtransferrecords[PUT].size()
+              << " Cached files: " << cachedfiles.size();
+
+    // the files of the transfers first in the queue are resumed first
+    vector<pair<uint64_t, size_t>> order;
+    order.reserve(cachedfiles.size());
+    for (size_t i = 0; i < cachedfiles.size(); ++i)
     {
-        DBTableTransactionCommitter committer(tctable);
-        for (unsigned int i = 0; i < cachedfiles.size(); i++)
+        uint64_t priority = std::numeric_limits<uint64_t>::max();
+        const char* ptr = cachedfiles[i].data();
+        const char* end = ptr + cachedfiles[i].size();
+        if (ptr < end)
         {
-            direction_t type = NONE;
-            File *file = app->file_resume(&cachedfiles.at(i), &type);
-            if (!file || (type != GET && type != PUT))
+            type = direction_t(*ptr++);
+            if ((type == GET || type == PUT) && FileFingerprint::unserialize(ptr, end, fp))
             {
-                tctable->del(cachedfilesdbids.at(i));
-                continue;
-            }
-            nextreqtag();
-            file->dbid = cachedfilesdbids.at(i);
-            if (!startxfer(type, file, committer))
-            {
-                tctable->del(cachedfilesdbids.at(i));
-                continue;
+                auto it = cachedtransferrecords[type].find(fp);
+                if (it != cachedtransferrecords[type].end())
+                {
+                    priority = it->second.priority;
+                }
             }
         }
-        cachedfiles.clear();
-        cachedfilesdbids.clear();
+        order.emplace_back(priority, i);
+    }
+    std::stable_sort(order.begin(), order.end(), [](const pair<uint64_t, size_t>& a, const pair<uint64_t, size_t>& b) { return a.first < b.first; });
+
+    vector<string> files(order.size());
+    vector<uint32_t> dbids(order.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        files[i].swap(cachedfiles[order[i].second]);
+        dbids[i] = cachedfilesdbids[order[i].second];
+    }
+    cachedfiles.swap(files);
+    cachedfilesdbids.swap(dbids);
+
+    // if we are logged in but the filesystem is not current yet
+    // postpone the resumption until the filesystem is updated
+    if (((!sid.size() && !loggedinfolderlink()) || statecurrent) && cachedfiles.size())
+    {
+        slicedjobs.push_back([this](std::chrono::steady_clock::time_point deadline)
+        {
+            return resumecachedfiles(deadline);
+        });
+    }
+}
+
+void MegaClient::openfingerprintcache()
+{
+    fingerprintcacheopened = true;
+
+    if (!dbaccess || readonlystatecache)
+    {
+        return;
+    }
+
+    if (DbTable* table = dbaccess->open(rng, *fsaccess, "fingerprints"))
+    {
+        fingerprintcache.persist(unique_ptr<DbTable>(table));
     }
 }
 
 void MegaClient::disabletransferresumption(const char *loggedoutid)
 {
-    if (!dbaccess)
+    if (!dbaccess || readonlystatecache)
     {
         return;
     }
@@ -11750,6 +13957,26 @@ void MegaClient::disabletransferresumption(const char *loggedoutid)
     closetc(true);
 }
 
+void MegaClient::browseonlyfetched(int tag)
+{
+    notifypurge();
+
+    WAIT_CLASS::bumpds();
+    fnstats.timeToCached = Waiter::ds - fnstats.startTime;
+    fnstats.timeToResult = fnstats.timeToCached;
+    fnstats.timeToCurrent = fnstats.timeToCached;
+    fnstats.nodesCached = nodes.size();
+    fnstats.nodesCurrent = fnstats.nodesCached;
+
+    fetchingnodes = false;
+    pendingsccommit = false;
+    statecurrent = true;
+    restag = tag;
+
+    app->fetchnodes_result(API_OK);
+    app->nodes_current();
+}
+
 void MegaClient::fetchnodes(bool nocache)
 {
     if (fetchingnodes)
@@ -11768,14 +13995,17 @@ void MegaClient::fetchnodes(bool nocache)
         fnstats.type = FetchNodesStats::TYPE_FOLDER;
     }
 
-    opensctable();
-
-    if (sctable && cachedscsn == UNDEF)
+    if (!browsingonly())
     {
-        sctable->truncate();
-    }
+        opensctable();
 
-    openStatusTable();
+        if (sctable && cachedscsn == UNDEF)
+        {
+            sctable->truncate();
+        }
+
+        openStatusTable();
+    }
 
     // only initial load from local cache
     if ((loggedin() == FULLACCOUNT || loggedIntoFolder() ) &&
@@ -11816,7 +14046,12 @@ void MegaClient::fetchnodes(bool nocache)
         enabletransferresumption();
 #endif
         syncs.resetSyncConfigDb();
-        syncs.resumeResumableSyncsOnStartup();
+        {
+            FetchNodesStats::PhaseTimer pt(&fnstats.syncsResumeTimeUs);
+            syncs.resumeResumableSyncsOnStartup();
+        }
+        syncdownfull = true;
+        syncupfull = true;
 #endif
         app->fetchnodes_result(API_OK);
 
@@ -11831,18 +14066,7 @@ void MegaClient::fetchnodes(bool nocache)
         fnstats.cache = nocache ? FetchNodesStats::API_NO_CACHE : FetchNodesStats::API_CACHE;
         fetchingnodes = true;
         pendingsccommit = false;
-
-        // prevent the processing of previous sc requests
-        pendingsc.reset();
-        pendingscUserAlerts.reset();
-        jsonsc.pos = NULL;
-        scnotifyurl.clear();
-        insca = false;
-        insca_notlast = false;
-        btsc.reset();
-
-        // don't allow to start new sc requests yet
-        scsn.clear();
+        discardsc();
 
 #ifdef ENABLE_SYNC
         // If there are syncs present at this time, this is a reload-account request.
@@ -11881,6 +14105,142 @@ void MegaClient::fetchnodes(bool nocache)
     }
 }
 
+// prevent the processing of previous sc requests, and don't allow to start new ones until the
+// tree being fetched provides its scsn
+void MegaClient::discardsc()
+{
+    pendingsc.reset();
+    nextsc.reset();
+    pendingscUserAlerts.reset();
+    jsonsc.pos = NULL;
+    scnotifyurl.clear();
+    insca = false;
+    insca_notlast = false;
+    btsc.reset();
+
+    scsn.clear();
+}
+
+bool MegaClient::reconcilenodes()
+{
+    if (!reconcilereloads || nodes.empty() || !lazyindex.empty())
+    {
+        return false;
+    }
+
+    LOG_warn << "Too many pending updates - reloading the tree to merge it into " << nodes.size() << " nodes";
+
+    WAIT_CLASS::bumpds();
+    fnstats.init();
+    fnstats.mode = FetchNodesStats::MODE_API;
+    fnstats.cache = FetchNodesStats::API_NO_CACHE;
+
+    fetchingnodes = true;
+    reconcilingnodes = true;
+    reconcilefailed = false;
+    reconcileseen.reserve(nodes.size());
+    statecurrent = false;
+    pendingsccommit = false;
+    discardsc();
+
+    reqs.add(new CommandFetchNodes(this, 0, true));
+    return true;
+}
+
+void MegaClient::endreconcile()
+{
+    reconcilingnodes = false;
+
+    if (reconcilefailed)
+    {
+        abortreconcile();
+        return;
+    }
+
+    // from here on, changes are notified as if they came in action packets (so the syncs see them)
+    fetchingnodes = false;
+
+    int creqtag = reqtag;
+    reqtag = 0;
+
+    mergenewshares(1);
+    applykeys();
+
+    size_t changed = reconciled.size();
+    for (Node* n : reconciled)
+    {
+        notifynode(n);
+    }
+    reconciled.clear();
+
+    size_t removed = 0;
+    TreeProcDel td;
+    for (auto& it : nodes)
+    {
+        if (!reconcileseen.count(it.first) && !it.second->changed.removed)
+        {
+            td.proc(this, it.second);
+            removed++;
+        }
+    }
+    reconcileseen.clear();
+
+    reqtag = creqtag;
+
+    LOG_info << "Reloaded tree merged. Changed or added: " << changed << " Removed: " << removed;
+}
+
+void MegaClient::abortreconcile()
+{
+    LOG_warn << "The reloaded tree can't be merged - reloading local state";
+
+    reconcilingnodes = false;
+    reconciled.clear();
+    reconcileseen.clear();
+
+#ifdef ENABLE_SYNC
+    failSyncs(TOO_MANY_ACTION_PACKETS);
+#endif
+    fetchingnodes = false;
+    fetchnodes(true);
+}
+
+bool MegaClient::reconcilenode(Node* n, const char* a, const char* fa)
+{
+    bool changed = false;
+    SymmCipher* cipher;
+
+    if (a && n->keyApplied() && (cipher = n->nodecipher()))
+    {
+        n->attrstring.reset(new string);
+        Node::copystring(n->attrstring.get(), a);
+
+        attr_map map;
+        if (n->decryptattrs(*cipher, map) && map != n->attrs.map)
+        {
+            n->setattrs(std::move(map));
+            n->changed.attrs = true;
+            changed = true;
+        }
+        n->attrstring.reset();
+    }
+
+    if (fa)
+    {
+        string fileattrstring;
+        Node::copystring(&fileattrstring, fa);
+
+        if (fileattrstring != n->fileattrstring)
+        {
+            n->fileattrstring = std::move(fileattrstring);
+            n->changed.fileattrstring = true;
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
 void MegaClient::fetchkeys()
 {
     fetchingkeys = true;
@@ -12580,6 +14940,7 @@ void MegaClient::purgenodesusersabortsc(bool keepOwnUser)
     {
         delete hdrns.begin()->second;
     }
+    streamingcache.clear();
 
     // sync configs don't need to be changed.  On session resume we'll resume the ones still enabled.
 #ifdef ENABLE_SYNC
@@ -12588,19 +14949,31 @@ void MegaClient::purgenodesusersabortsc(bool keepOwnUser)
 
     mOptimizePurgeNodes = true;
     mFingerprints.clear();
+    mNodesByCtime.clear();
+#ifdef ENABLE_SEARCH_INDEX
+    mSearchIndex.clear();
+#endif
     mNodeCounters.clear();
+    mPublicLinks.clear();
+    outsharesbypeer.clear();
+    mAppliedKeyNodeCount = 0;
+#ifdef ENABLE_SYNC
+    todebris.clear();
+    tounlink.clear();
+#endif
     for (node_map::iterator it = nodes.begin(); it != nodes.end(); it++)
     {
         delete it->second;
     }
     nodes.clear();
+    lazyindex.clear();
     mOptimizePurgeNodes = false;
 
 #ifdef ENABLE_SYNC
-    todebris.clear();
-    tounlink.clear();
+    syncdeletions = SyncDeletions();
     mFingerprints.clear();
 #endif
+    cacheddns = CachedDns();
 
     for (fafc_map::iterator cit = fafcs.begin(); cit != fafcs.end(); cit++)
     {
@@ -12635,6 +15008,14 @@ void MegaClient::purgenodesusersabortsc(bool keepOwnUser)
     chatnotify.clear();
 #endif
 
+    if (!keepOwnUser)
+    {
+        // no need to erase them from the indexes one by one
+        umindex.clear();
+        uhindex.clear();
+        users.clear();
+    }
+
     for (user_map::iterator it = users.begin(); it != users.end(); )
     {
         User *u = &(it->second);
@@ -12673,6 +15054,11 @@ void MegaClient::purgenodesusersabortsc(bool keepOwnUser)
         pendingsc->disconnect();
     }
 
+    if (nextsc)
+    {
+        nextsc->disconnect();
+    }
+
     if (pendingscUserAlerts)
     {
         pendingscUserAlerts->disconnect();
@@ -12747,6 +15133,67 @@ void MegaClient::queueread(handle h, bool p, SymmCipher* key, int64_t ctriv, m_o
     }
 }
 
+void MegaClient::cachetempurls(handle h, bool p, const vector<string>& urls, m_off_t size)
+{
+    if (!sharetempurls || (urls.size() != 1 && urls.size() != RAIDPARTS))
+    {
+        return;
+    }
+
+    // an entry per file recently streamed or downloaded: only those expired are worth the scan
+    if (tempurlcache.size() >= 1024)
+    {
+        for (auto it = tempurlcache.begin(); it != tempurlcache.end(); )
+        {
+            if (Waiter::ds - it->second.fetched > TEMPURLCACHEEXPIRYDS)
+            {
+                tempurlcache.erase(it++);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    encodehandletype(&h, p);
+    CachedTempUrls& cached = tempurlcache[h];
+    cached.urls = urls;
+    cached.size = size;
+    cached.fetched = Waiter::ds;
+}
+
+bool MegaClient::cachedtempurls(handle h, bool p, vector<string>& urls, m_off_t& size)
+{
+    if (!sharetempurls)
+    {
+        return false;
+    }
+
+    encodehandletype(&h, p);
+    auto it = tempurlcache.find(h);
+    if (it == tempurlcache.end())
+    {
+        return false;
+    }
+
+    if (Waiter::ds - it->second.fetched > TEMPURLCACHEEXPIRYDS)
+    {
+        tempurlcache.erase(it);
+        return false;
+    }
+
+    urls = it->second.urls;
+    size = it->second.size;
+    return true;
+}
+
+void MegaClient::uncachetempurls(handle h, bool p)
+{
+    encodehandletype(&h, p);
+    tempurlcache.erase(h);
+}
+
 // cancel direct read by node pointer / count / count
 void MegaClient::preadabort(Node* n, m_off_t offset, m_off_t count)
 {
@@ -12774,7 +15221,10 @@ void MegaClient::abortreads(handle h, bool p, m_off_t offset, m_off_t count)
         {
             if ((offset < 0 || offset == (*it)->offset) && (count < 0 || count == (*it)->count))
             {
-                app->pread_failure(API_EINCOMPLETE, (*it)->drn->retries, (*it)->appdata, 0);
+                if (!(*it)->readingahead())
+                {
+                    app->pread_failure(API_EINCOMPLETE, (*it)->drn->retries, (*it)->appdata, 0);
+                }
 
                 delete *(it++);
             }
@@ -12789,20 +15239,28 @@ bool MegaClient::execdirectreads()
     CodeCounter::ScopeTimer ccst(performanceStats.execdirectreads);
 
     bool r = false;
-    DirectReadSlot* drs;
 
-    if (drq.size() < MAXDRSLOTS)
+    // fill slots.  drq only holds the reads waiting for one, and only needs looking at again when
+    // one was queued or a slot freed.  Reads of nodes that have no slot yet go first, so that the
+    // reads of one stream can't hold those of the others back
+    if (drqdirty)
     {
-        // fill slots
-        for (dr_list::iterator it = drq.begin(); it != drq.end(); it++)
+        drqdirty = false;
+
+        for (int pass = 0; pass < 2 && drss.size() < maxdrslots; ++pass)
         {
-            if (!(*it)->drs)
+            for (dr_list::iterator it = drq.begin(); it != drq.end() && drss.size() < maxdrslots; )
             {
-                drs = new DirectReadSlot(*it);
-                (*it)->drs = drs;
-                r = true;
+                DirectRead* dr = *(it++);
+                if ((pass == 0 && dr->drn->slots) || !DirectReadSlot::hostsavailable(dr))
+                {
+                    continue;
+                }
 
-                if (drq.size() >= MAXDRSLOTS) break;
+                drq.erase(dr->drq_it);
+                dr->drq_it = drq.end();
+                dr->drs = new DirectReadSlot(dr);
+                r = true;
             }
         }
     }
@@ -13040,6 +15498,9 @@ error MegaClient::checkSyncConfig(SyncConfig& syncConfig, LocalPath& rootpath, s
         return API_ENOENT;
     }
 
+    // the sync engine walks the remote tree directly
+    loadtree(remotenode);
+
     if (error e = isnodesyncable(remotenode, &inshare, &syncConfig.mError))
     {
         syncConfig.mEnabled = false;
@@ -13353,18 +15814,28 @@ bool MegaClient::syncdown(LocalNode* l, LocalPath& localpath, bool rubbish)
         return true;
     }
 
+    if (!syncdownfull && !l->syncdowndirty)
+    {
+        return syncdownsubtree(l, localpath, rubbish);
+    }
+
+    l->syncdowndirty = false;
+
     list<string> strings;
     remotenode_map nchildren;
     remotenode_map::iterator rit;
 
     bool success = true;
 
+    // a transient failure in this folder: compare it again on the retry
+    bool retry = false;
+
     // build array of sync-relevant (in case of clashes, the newest alias wins)
     // remote children by name
     string localname;
 
     // build child hash - nameclash resolution: use newest/largest version
-    for (node_list::iterator it = l->node->children.begin(); it != l->node->children.end(); it++)
+    for (auto it = l->node->children.begin(); it != l->node->children.end(); it++)
     {
         attr_map::iterator ait;
 
@@ -13532,6 +16003,7 @@ bool MegaClient::syncdown(LocalNode* l, LocalPath& localpath, bool rubbish)
                     blockedfile = localpath;
                     LOG_warn << "Transient error deleting " << blockedfile.toPath(*fsaccess);
                     success = false;
+                    retry = true;
                     lit++;
                 }
             }
@@ -13584,12 +16056,16 @@ bool MegaClient::syncdown(LocalNode* l, LocalPath& localpath, bool rubbish)
 
                     rit->second->localnode->treestate(TREESTATE_SYNCED);
                 }
-                else if (success && fsaccess->transient_error)
+                else if (fsaccess->transient_error)
                 {
                     // schedule retry
-                    blockedfile = curpath;
-                    LOG_debug << "Transient error moving localnode " << blockedfile.toPath(*fsaccess);
-                    success = false;
+                    if (success)
+                    {
+                        blockedfile = curpath;
+                        LOG_debug << "Transient error moving localnode " << blockedfile.toPath(*fsaccess);
+                        success = false;
+                    }
+                    retry = true;
                 }
             }
             else
@@ -13603,7 +16079,13 @@ bool MegaClient::syncdown(LocalNode* l, LocalPath& localpath, bool rubbish)
             // missing node is not associated with an existing LocalNode
             if (rit->second->type == FILENODE)
             {
-                if (!rit->second->syncget)
+                if (!rit->second->syncget && l->sync->downloadsinflight >= Sync::MAXTRANSFERS)
+                {
+                    // enough of the sync's downloads in flight: this one when they end
+                    l->sync->downloadsheldback = true;
+                    retry = true;
+                }
+                else if (!rit->second->syncget)
                 {
                     bool download = true;
                     auto f = fsaccess->newfileaccess(false);
@@ -13670,18 +16152,59 @@ bool MegaClient::syncdown(LocalNode* l, LocalPath& localpath, bool rubbish)
                         LOG_debug << "Checkpath() failed " << (ll == NULL);
                     }
                 }
-                else if (success && fsaccess->transient_error)
+                else if (fsaccess->transient_error)
+                {
+                    if (success)
+                    {
+                        blockedfile = localpath;
+                        LOG_debug << "Transient error creating folder " << blockedfile.toPath(*fsaccess);
+                        success = false;
+                    }
+                    retry = true;
+                }
+                else
+                {
+                    LOG_debug << "Non transient error creating folder";
+                }
+            }
+        }
+    }
+
+    if (retry)
+    {
+        l->syncdowndirty = true;
+    }
+
+    l->endsyncdown();
+
+    return success;
+}
+
+bool MegaClient::syncdownsubtree(LocalNode* l, LocalPath& localpath, bool rubbish)
+{
+    bool success = true;
+
+    if (l->syncdownsubtree)
+    {
+        for (localnode_map::iterator it = l->children.begin(); it != l->children.end(); it++)
+        {
+            LocalNode* ll = it->second;
+
+            // the folders syncdown() of l would recurse into
+            if (ll->type == FOLDERNODE && ll->syncdownsubtree && !ll->deleted
+             && ll->node && ll->node->syncdeleted == SYNCDEL_NONE)
+            {
+                ScopedLengthRestore restoreLen(localpath);
+                localpath.appendWithSeparator(ll->localname, true);
+
+                if (!syncdown(ll, localpath, rubbish))
                 {
-                    blockedfile = localpath;
-                    LOG_debug << "Transient error creating folder " << blockedfile.toPath(*fsaccess);
                     success = false;
                 }
-                else if (!fsaccess->transient_error)
-                {
-                    LOG_debug << "Non transient error creating folder";
-                }
             }
         }
+
+        l->endsyncdown();
     }
 
     return success;
@@ -13697,8 +16220,18 @@ bool MegaClient::syncdown(LocalNode* l, LocalPath& localpath, bool rubbish)
 // for creation
 bool MegaClient::syncup(LocalNode* l, dstime* nds, size_t& parentPending)
 {
+    if (!syncupfull && !l->syncupdirty)
+    {
+        return syncupsubtree(l, nds, parentPending);
+    }
+
+    l->syncupdirty = false;
+
     bool insync = true;
 
+    // a child waits for an upload, a creation or its delays: look at this folder again next time
+    bool settled = true;
+
     list<string> strings;
     remotenode_map nchildren;
     remotenode_map::iterator rit;
@@ -13713,7 +16246,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds, size_t& parentPending)
     {
         // corresponding remote node present: build child hash - nameclash
         // resolution: use newest version
-        for (node_list::iterator it = l->node->children.begin(); it != l->node->children.end(); it++)
+        for (auto it = l->node->children.begin(); it != l->node->children.end(); it++)
         {
             // node must be alive
             if ((*it)->syncdeleted == SYNCDEL_NONE)
@@ -13787,7 +16320,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds, size_t& parentPending)
                 ll->reported = true;
 
                 char report[256];
-                sprintf(report, "%d %d %d %d", (int)lit->first->reportSize(), (int)localname.size(), (int)ll->name.size(), (int)ll->type);
+                sprintf(report, "%d %d %d %d", (int)lit->first.name->reportSize(), (int)localname.size(), (int)ll->name.size(), (int)ll->type);
                 // report a "no-name localnode" event
                 reportevent("LN", report, 0);
             }
@@ -13818,6 +16351,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds, size_t& parentPending)
             if (ll->type != rit->second->type || isSymLink)
             {
                 insync = false;
+                settled = false;
                 LOG_warn << "Type changed: " << localname << " LNtype: " << ll->type << " Ntype: " << rit->second->type << " isSymLink = " << isSymLink;
                 movetosyncdebris(rit->second, l->sync->inshare);
             }
@@ -13864,7 +16398,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds, size_t& parentPending)
                                         LOG_debug << "Restoring missing attributes: " << ll->name;
                                         SymmCipher *symmcipher = ll->node->nodecipher();
                                         auto llpath = ll->getLocalPath();
-                                        gfx->gendimensionsputfa(NULL, llpath, ll->node->nodehandle, symmcipher, missingattr);
+                                        gfx->gendimensionsputfa(NULL, llpath, ll->node->nodehandle, symmcipher, missingattr, true, true);
                                     }
                                 }
                             }
@@ -13988,6 +16522,8 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds, size_t& parentPending)
                     if (!syncup(ll, nds, numPending))
                     {
                         parentPending += numPending;
+                        l->syncupdirty = true;
+                        l->endsyncup();
                         return false;
                     }
                     continue;
@@ -14003,6 +16539,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds, size_t& parentPending)
         {
             // do not begin transfer until the file size / mtime has stabilized
             insync = false;
+            settled = false;
 
             if (ll->transfer)
             {
@@ -14022,6 +16559,12 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds, size_t& parentPending)
 
                 continue;
             }
+            else if (ll->sync->uploadsinflight >= Sync::MAXTRANSFERS)
+            {
+                // enough of the sync's uploads in flight: this one when they end
+                ll->sync->uploadsheldback = true;
+                continue;
+            }
             else
             {
                 Node *currentVersion = ll->node;
@@ -14048,6 +16591,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds, size_t& parentPending)
                             }
 
                             recentVersions++;
+                            loadchildren(version);
                             if (!version->children.size())
                             {
                                 break;
@@ -14126,6 +16670,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds, size_t& parentPending)
         else
         {
             LOG_verbose << "Unsynced LocalNode (folder): " << ll->name;
+            settled = false;
         }
 
         if (ll->created)
@@ -14194,6 +16739,8 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds, size_t& parentPending)
             {
                 LOG_warn << "Stopping syncup due to MAX_NEWNODES";
                 parentPending += numPending;
+                l->syncupdirty = true;
+                l->endsyncup();
                 return false;
             }
         }
@@ -14210,6 +16757,8 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds, size_t& parentPending)
             if (!syncup(ll, nds, numPending))
             {
                 parentPending += numPending;
+                l->syncupdirty = true;
+                l->endsyncup();
                 return false;
             }
         }
@@ -14222,6 +16771,37 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds, size_t& parentPending)
 
     parentPending += numPending;
 
+    if (!settled)
+    {
+        l->syncupdirty = true;
+    }
+
+    l->endsyncup();
+
+    return true;
+}
+
+bool MegaClient::syncupsubtree(LocalNode* l, dstime* nds, size_t& parentPending)
+{
+    if (l->syncupsubtree)
+    {
+        for (localnode_map::iterator it = l->children.begin(); it != l->children.end(); it++)
+        {
+            LocalNode* ll = it->second;
+
+            if (ll->type == FOLDERNODE && ll->syncupsubtree && !ll->deleted)
+            {
+                if (!syncup(ll, nds, parentPending))
+                {
+                    l->endsyncup();
+                    return false;
+                }
+            }
+        }
+
+        l->endsyncup();
+    }
+
     return true;
 }
 
@@ -14240,7 +16820,6 @@ void MegaClient::syncupdate()
     // creation on the server
     unsigned i, start, end;
     SymmCipher tkey;
-    string tattrstring;
     AttrMap tattrs;
     Node* n;
     LocalNode* l;
@@ -14331,10 +16910,9 @@ void MegaClient::syncupdate()
 
                 // set new name, encrypt and attach attributes
                 tattrs.map['n'] = l->name;
-                tattrs.getjson(&tattrstring);
                 tkey.setkey((const byte*)nnp->nodekey.data(), nnp->type);
                 nnp->attrstring.reset(new string);
-                makeattr(&tkey, nnp->attrstring, tattrstring.c_str());
+                makeattr(&tkey, nnp->attrstring, tattrs);
 
                 l->treestate(TREESTATE_SYNCING);
             }
@@ -14347,6 +16925,10 @@ void MegaClient::syncupdate()
 
                 nextreqtag();
                 startxfer(PUT, l, committer);
+                if (l->transfer)
+                {
+                    l->sync->uploadsinflight++;
+                }
 
                 l->sync->mUnifiedSync.mNextHeartbeat->adjustTransferCounts(1, 0, l->size, 0);
 
@@ -14440,13 +17022,26 @@ void MegaClient::movetosyncdebris(Node* dn, bool unlink)
     // no: enqueue this one
     if (!n)
     {
+        // what was queued below it (the LocalNodes of a folder are deleted before it) goes with
+        // it: one move for the folder instead of one for each of them
+        if (dn->type != FILENODE)
+        {
+            for (node_set* queued : { &todebris, &tounlink })
+            {
+                for (auto it = queued->begin(); it != queued->end(); )
+                {
+                    it = (*it)->isbelow(dn) ? queued->erase(it) : std::next(it);
+                }
+            }
+        }
+
         if (unlink)
         {
-            dn->tounlink_it = tounlink.insert(dn).first;
+            tounlink.insert(dn);
         }
         else
         {
-            dn->todebris_it = todebris.insert(dn).first;
+            todebris.insert(dn);
         }
     }
 }
@@ -14462,6 +17057,119 @@ void MegaClient::execsyncdeletions()
     {
         execsyncunlink();
     }
+
+    savesyncdeletions();
+}
+
+bool MegaClient::SyncDeletions::serialize(string* d)
+{
+    CacheableWriter w(*d);
+    for (const vector<handle>* handles : { &todebris, &tounlink })
+    {
+        w.serializeu32(uint32_t(handles->size()));
+        for (handle h : *handles)
+        {
+            w.serializehandle(h);
+        }
+    }
+    return true;
+}
+
+bool MegaClient::SyncDeletions::unserialize(const string& d)
+{
+    CacheableReader r(d);
+    for (vector<handle>* handles : { &todebris, &tounlink })
+    {
+        uint32_t count;
+        if (!r.unserializeu32(count))
+        {
+            return false;
+        }
+
+        handles->resize(count);
+        for (handle& h : *handles)
+        {
+            if (!r.unserializehandle(h))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void MegaClient::savesyncdeletions()
+{
+    if (!statusTable || readonlystatecache)
+    {
+        return;
+    }
+
+    vector<handle> debris, unlinks;
+    for (Node* n : todebris)
+    {
+        debris.push_back(n->nodehandle);
+    }
+    for (Node* n : tounlink)
+    {
+        unlinks.push_back(n->nodehandle);
+    }
+
+    if (debris == syncdeletions.todebris && unlinks == syncdeletions.tounlink)
+    {
+        return;
+    }
+
+    syncdeletions.todebris = std::move(debris);
+    syncdeletions.tounlink = std::move(unlinks);
+
+    DBTableTransactionCommitter committer(statusTable);
+    if (syncdeletions.todebris.empty() && syncdeletions.tounlink.empty())
+    {
+        if (syncdeletions.dbid)
+        {
+            statusTable->del(syncdeletions.dbid);
+            syncdeletions.dbid = 0;
+        }
+    }
+    else if (!statusTable->put(CACHEDSYNCDELETIONS, &syncdeletions, &key))
+    {
+        LOG_err << "Failed to save the pending sync deletions";
+    }
+}
+
+void MegaClient::resumesyncdeletions(const string& data, uint32_t dbid)
+{
+    syncdeletions.dbid = dbid;
+    if (!syncdeletions.unserialize(data))
+    {
+        LOG_err << "Failed - sync deletions record read error";
+        syncdeletions.todebris.clear();
+        syncdeletions.tounlink.clear();
+        return;
+    }
+
+    // those not in the rubbish bin yet are queued again (and not synced down meanwhile)
+    handle rubbish = rootnodes[RUBBISHNODE - ROOTNODE];
+    for (handle h : syncdeletions.todebris)
+    {
+        Node* n = nodebyhandle(h);
+        if (n && n->firstancestor()->nodehandle != rubbish)
+        {
+            n->syncdeleted = SYNCDEL_DELETED;
+            todebris.insert(n);
+        }
+    }
+    for (handle h : syncdeletions.tounlink)
+    {
+        if (Node* n = nodebyhandle(h))
+        {
+            n->syncdeleted = SYNCDEL_DELETED;
+            tounlink.insert(n);
+        }
+    }
+
+    LOG_debug << "Resuming " << todebris.size() << " moves to SyncDebris and " << tounlink.size() << " sync deletions";
 }
 
 void MegaClient::proclocaltree(LocalNode* n, LocalTreeProc* tp)
@@ -14533,7 +17241,6 @@ void MegaClient::execsyncunlink()
             unlink(tn, false, tn->tag);
         }
 
-        tn->tounlink_it = tounlink.end();
         tounlink.erase(tounlink.begin());
     } while (tounlink.size());
 }
@@ -14619,7 +17326,6 @@ void MegaClient::execmovetosyncdebris()
                 {
                     LOG_debug << "SyncDebris daily folder not created. Final target: " << n->syncdeleted;
                     n->syncdeleted = SYNCDEL_NONE;
-                    n->todebris_it = todebris.end();
                     todebris.erase(it++);
                 }
             }
@@ -14633,7 +17339,6 @@ void MegaClient::execmovetosyncdebris()
         {
             LOG_debug << "Move to SyncDebris finished. Final target: " << n->syncdeleted;
             n->syncdeleted = SYNCDEL_NONE;
-            n->todebris_it = todebris.end();
             todebris.erase(it++);
         }
         else
@@ -14652,8 +17357,7 @@ void MegaClient::execmovetosyncdebris()
         // create missing component(s) of the sync debris folder of the day
         vector<NewNode> nnVec;
         SymmCipher tkey;
-        string tattrstring;
-        AttrMap tattrs;
+            AttrMap tattrs;
 
         nnVec.resize((target == SYNCDEL_DEBRIS) ? 1 : 2);
 
@@ -14671,10 +17375,9 @@ void MegaClient::execmovetosyncdebris()
 
             // set new name, encrypt and attach attributes
             tattrs.map['n'] = (i || target == SYNCDEL_DEBRIS) ? buf : SYNCDEBRISFOLDERNAME;
-            tattrs.getjson(&tattrstring);
             tkey.setkey((const byte*)nn->nodekey.data(), FOLDERNODE);
             nn->attrstring.reset(new string);
-            makeattr(&tkey, nn->attrstring, tattrstring.c_str());
+            makeattr(&tkey, nn->attrstring, tattrs);
         }
 
         reqs.add(new CommandPutNodes(this, tn->nodehandle, NULL, move(nnVec),
@@ -14779,7 +17482,14 @@ bool MegaClient::startxfer(direction_t d, File* f, DBTableTransactionCommitter&
 
                 if (fa->fopen(f->localname, d == PUT, d == GET))
                 {
-                    f->genfingerprint(fa.get());
+                    if (cachefingerprints)
+                    {
+                        fingerprintcache.genfingerprint(f->localname, fa.get(), *f);
+                    }
+                    else
+                    {
+                        f->genfingerprint(fa.get());
+                    }
                 }
             }
 
@@ -14792,6 +17502,14 @@ bool MegaClient::startxfer(direction_t d, File* f, DBTableTransactionCommitter&
 
 #ifdef USE_MEDIAINFO
             mediaFileInfo.requestCodecMappingsOneTime(this, &f->localname);
+
+            // have the workers extract the media properties while it uploads
+            string ext;
+            if (!gfxdisabled && f->size >= 16 && !mediaFileInfo.mediaCodecsFailed
+                    && fsaccess->getextension(f->localname, ext) && MediaProperties::isMediaFilenameExt(ext))
+            {
+                mediaFileInfo.requestExtraction(this, f->localname, *f);
+            }
 #endif
         }
         else
@@ -14833,6 +17551,7 @@ bool MegaClient::startxfer(direction_t d, File* f, DBTableTransactionCommitter&
                 filecacheadd(f, committer);
             }
             app->file_added(f);
+            transferlist.classify(t);
 
             if (startfirst)
             {
@@ -14855,6 +17574,7 @@ bool MegaClient::startxfer(direction_t d, File* f, DBTableTransactionCommitter&
         }
         else
         {
+            hydratecachedtransfer(d, *f);
             it = cachedtransfers[d].find(f);
             if (it != cachedtransfers[d].end())
             {
@@ -15078,12 +17798,15 @@ void MegaClient::setmaxconnections(direction_t d, int num)
 
 Node* MegaClient::nodebyfingerprint(FileFingerprint* fingerprint)
 {
+    loadnodesbyfingerprint(*fingerprint);
     return mFingerprints.nodebyfingerprint(fingerprint);
 }
 
 #ifdef ENABLE_SYNC
 Node* MegaClient::nodebyfingerprint(LocalNode* localNode)
 {
+    loadnodesbyfingerprint(*localNode);
+
     std::unique_ptr<const node_vector>
       remoteNodes(mFingerprints.nodesbyfingerprint(localNode));
 
@@ -15141,15 +17864,10 @@ Node* MegaClient::nodebyfingerprint(LocalNode* localNode)
 
 node_vector *MegaClient::nodesbyfingerprint(FileFingerprint* fingerprint)
 {
+    loadnodesbyfingerprint(*fingerprint);
     return mFingerprints.nodesbyfingerprint(fingerprint);
 }
 
-static bool nodes_ctime_less(const Node* a, const Node* b)
-{
-    // heaps return the largest element
-    return a->ctime < b->ctime;
-}
-
 static bool nodes_ctime_greater(const Node* a, const Node* b)
 {
     return a->ctime > b->ctime;
@@ -15157,36 +17875,29 @@ static bool nodes_ctime_greater(const Node* a, const Node* b)
 
 node_vector MegaClient::getRecentNodes(unsigned maxcount, m_time_t since, bool includerubbishbin)
 {
-    // 1. Get nodes added/modified not older than `since`
+    // walk files from the most recent, stopping at `since` or after `maxcount` of them
     node_vector v;
-    v.reserve(nodes.size());
-    for (node_map::iterator i = nodes.begin(); i != nodes.end(); ++i)
+    unsigned count = 0;
+    for (auto i = mNodesByCtime.begin(); i != mNodesByCtime.end() && count < maxcount; ++i)
     {
-        if (i->second->type == FILENODE && i->second->ctime >= since &&  // recent files only
-            (!i->second->parent || i->second->parent->type != FILENODE)) // excluding versions
+        Node* n = *i;
+        if (n->ctime < since)
         {
-            v.push_back(i->second);
+            break;
         }
-    }
 
-    // heaps use a 'less' function, and pop_heap returns the largest item stored.
-    std::make_heap(v.begin(), v.end(), nodes_ctime_less);
+        if (n->parent && n->parent->type == FILENODE) // excluding versions
+        {
+            continue;
+        }
 
-    // 2. Order them chronologically and restrict them to a maximum of `maxcount`
-    node_vector v2;
-    unsigned maxItems = std::min(maxcount, unsigned(v.size()));
-    v2.reserve(maxItems);
-    while (v2.size() < maxItems && !v.empty())
-    {
-        std::pop_heap(v.begin(), v.end(), nodes_ctime_less);
-        Node* n = v.back();
-        v.pop_back();
+        ++count;
         if (includerubbishbin || n->firstancestor()->type != RUBBISHNODE)
         {
-            v2.push_back(n);
+            v.push_back(n);
         }
     }
-    return v2;
+    return v;
 }
 
 
@@ -15347,6 +18058,31 @@ bool MegaClient::nodeIsDocument(const Node *n) const
     return false;
 }
 
+#ifdef ENABLE_SEARCH_INDEX
+void MegaClient::updatesearchindex(Node* n)
+{
+    if ((n->type != FILENODE && n->type != FOLDERNODE) || n->attrstring)
+    {
+        // names of undecrypted nodes are not known yet
+        mSearchIndex.remove(n);
+        return;
+    }
+
+    unsigned types = 0;
+    string ext;
+    if (n->type == FILENODE && action_bucket_compare::getExtensionDotted(n, ext, *this))
+    {
+        // by extension only: the type checks done on the results may be stricter (eg. videos)
+        types |= action_bucket_compare::nodeIsPhoto(n, ext, false) ? SearchIndex::TYPE_PHOTO : 0;
+        types |= action_bucket_compare::nodeIsAudio(n, ext) ? SearchIndex::TYPE_AUDIO : 0;
+        types |= action_bucket_compare::webclient_mime_video_extensions.find(ext) != string::npos ? SearchIndex::TYPE_VIDEO : 0;
+        types |= action_bucket_compare::nodeIsDocument(n, ext) ? SearchIndex::TYPE_DOCUMENT : 0;
+    }
+
+    mSearchIndex.update(n, n->displayname(), types);
+}
+#endif
+
 recentactions_vector MegaClient::getRecentActions(unsigned maxcount, m_time_t since)
 {
     recentactions_vector rav;
@@ -15374,7 +18110,7 @@ recentactions_vector MegaClient::getRecentActions(unsigned maxcount, m_time_t si
                 ra.time = (*j)->ctime;
                 ra.user = (*j)->owner;
                 ra.parent = (*j)->parent ? (*j)->parent->nodehandle : UNDEF;
-                ra.updated = !(*j)->children.empty();   // children of files represent previous versions
+                ra.updated = !(*j)->children.empty() || lazyindex.haschildren((*j)->nodehandle);   // children of files represent previous versions
                 ra.media = nodeIsMedia(*j, nullptr, nullptr);
                 rav.push_back(ra);
             }
@@ -15399,36 +18135,27 @@ recentactions_vector MegaClient::getRecentActions(unsigned maxcount, m_time_t si
 
 void MegaClient::nodesbyoriginalfingerprint(const char* originalfingerprint, Node* parent, node_vector *nv)
 {
-    if (parent)
+    node_vector candidates;
+    mFingerprints.nodesbyoriginalfingerprint(originalfingerprint, candidates);
+
+    for (Node* n : candidates)
     {
-        for (node_list::iterator i = parent->children.begin(); i != parent->children.end(); ++i)
+        if (!parent)
         {
-            if ((*i)->type == FILENODE)
-            {
-                attr_map::const_iterator a = (*i)->attrs.map.find(MAKENAMEID2('c', '0'));
-                if (a != (*i)->attrs.map.end() && !a->second.compare(originalfingerprint))
-                {
-                    nv->push_back(*i);
-                }
-            }
-            else
-            {
-                nodesbyoriginalfingerprint(originalfingerprint, *i, nv);
-            }
+            nv->push_back(n);
+            continue;
         }
-    }
-    else
-    {
-        for (node_map::const_iterator i = nodes.begin(); i != nodes.end(); ++i)
+
+        // below parent, through folders only (file versions are not part of the subtree)
+        Node* p = n->parent;
+        while (p && p != parent && p->type != FILENODE)
         {
-            if (i->second->type == FILENODE)
-            {
-                attr_map::const_iterator a = i->second->attrs.map.find(MAKENAMEID2('c', '0'));
-                if (a != i->second->attrs.map.end() && !a->second.compare(originalfingerprint))
-                {
-                    nv->push_back(i->second);
-                }
-            }
+            p = p->parent;
+        }
+
+        if (p == parent)
+        {
+            nv->push_back(n);
         }
     }
 }
@@ -15496,6 +18223,62 @@ bool MegaClient::setmaxuploadspeed(m_off_t bpslimit)
     return httpio->setmaxuploadspeed(bpslimit >= 0 ? bpslimit : 0);
 }
 
+void MegaClient::settransferraterules(vector<TransferRateRule> rules)
+{
+    transferraterules = std::move(rules);
+    applytransferraterules();
+}
+
+void MegaClient::applytransferraterules()
+{
+    struct tm dt;
+    m_localtime(m_time(), &dt);
+    int minute = dt.tm_hour * 60 + dt.tm_min;
+
+    std::array<std::array<m_off_t, 2>, TRANSFERCLASSES> rates = {};
+    for (const TransferRateRule& rule : transferraterules)
+    {
+        bool applies = rule.fromminute == rule.tominute
+                || (rule.fromminute < rule.tominute
+                    ? minute >= rule.fromminute && minute < rule.tominute
+                    : minute >= rule.fromminute || minute < rule.tominute);
+
+        if (applies && rule.transferclass < TRANSFERCLASSES
+                && (rule.direction == GET || rule.direction == PUT))
+        {
+            rates[rule.transferclass][rule.direction] = rule.bps;
+        }
+    }
+
+    for (int c = 0; c < TRANSFERCLASSES; c++)
+    {
+        for (int d = GET; d <= PUT; d++)
+        {
+            if (classratelimits[c][d].rate() != rates[c][d])
+            {
+                LOG_debug << "Speed limit of transfer class " << c << (d == GET ? " downloads: " : " uploads: ") << rates[c][d];
+                classratelimits[c][d].setRate(rates[c][d]);
+            }
+        }
+    }
+
+    // rules change on the minute
+    nexttransferratesds = Waiter::ds + dstime(60 - dt.tm_sec) * 10;
+}
+
+void MegaClient::settransferspeed(Transfer* transfer, m_off_t bpslimit)
+{
+    if (!transfer->ratelimit)
+    {
+        if (bpslimit <= 0)
+        {
+            return;
+        }
+        transfer->ratelimit.reset(new TokenBucket);
+    }
+    transfer->ratelimit->setRate(bpslimit);
+}
+
 m_off_t MegaClient::getmaxdownloadspeed()
 {
     return httpio->getmaxdownloadspeed();
@@ -15756,6 +18539,126 @@ void MegaClient::getwelcomepdf()
     reqs.add(new CommandGetWelcomePDF(this));
 }
 
+void MegaClient::reportstartup()
+{
+    WAIT_CLASS::bumpds();
+
+    JSONWriter json;
+    json.beginobject();
+    fnstats.toJson(json);
+    json.arg("transfersresumed", m_off_t(Waiter::ds - fnstats.startTime) * 100);
+    json.endobject();
+
+    LOG_info << "Startup report: " << json.getstring();
+    sendevent(99455, json.getstring().c_str(), 0);
+}
+
+long long* MegaClient::startupphase(long long& us)
+{
+    return fetchingnodes || !statecurrent ? &us : nullptr;
+}
+
+string MegaClient::metricsjson()
+{
+    JSONWriter json;
+    json.beginobject();
+    metrics.tojson(json);
+    json.arg("workerjobs", m_off_t(mAsyncQueue.pending()));
+    json.arg("transferslots", m_off_t(tslots.size()));
+    json.arg("queuedfa", m_off_t(queuedfa.size() + activefa.size()));
+    json.arg("cmdspending", m_off_t(reqs.cmdspending()));
+    json.beginobject("startup");
+    fnstats.toJson(json);
+    json.endobject();
+    json.endobject();
+    return json.getstring();
+}
+
+// what a string takes beyond its own size: short ones live in its inline buffer
+static size_t heapsize(const string& s)
+{
+    return s.capacity() > sizeof(string) - 1 ? s.capacity() + 1 : 0;
+}
+
+void MegaClient::memoryjson(JSONWriter& json)
+{
+    // the objects, their strings, and a slot of the index of each
+    m_off_t nodebytes = 0;
+    for (auto& it : nodes)
+    {
+        const Node* n = it.second;
+        nodebytes += m_off_t(sizeof(*n) + sizeof(it) + heapsize(n->nodekeyUnchecked()) + heapsize(n->fileattrstring));
+        if (n->attrstring)
+        {
+            nodebytes += m_off_t(sizeof(string) + heapsize(*n->attrstring));
+        }
+        for (auto& a : n->attrs.map)
+        {
+            nodebytes += m_off_t(sizeof(a) + heapsize(a.second));
+        }
+    }
+
+    json.beginobject("nodes");
+    json.arg("count", m_off_t(nodes.size()));
+    json.arg("bytes", nodebytes);
+    json.endobject();
+
+#ifdef ENABLE_SYNC
+    m_off_t localnodes = 0;
+    syncs.forEachRunningSync([&](Sync* s)
+    {
+        localnodes += s->localnodes[FILENODE] + s->localnodes[FOLDERNODE];
+    });
+
+    json.beginobject("localnodes");
+    json.arg("count", localnodes);
+    json.arg("bytes", localnodes * m_off_t(sizeof(LocalNode)));
+    json.endobject();
+#endif
+
+    m_off_t transfercount = 0;
+    m_off_t transferbytes = 0;
+    for (auto& tm : transfers)
+    {
+        for (auto& it : tm)
+        {
+            const Transfer* t = it.second;
+            ++transfercount;
+            transferbytes += m_off_t(sizeof(*t) + t->chunkmacs.size() * sizeof(chunkmac_map::value_type) + t->files.size() * 3 * sizeof(void*));
+        }
+    }
+
+    json.beginobject("transfers");
+    json.arg("count", transfercount);
+    json.arg("bytes", transferbytes);
+    json.arg("slots", m_off_t(tslots.size()));
+    json.endobject();
+
+    // the data of the downloads, raid parts included
+    TransferBufferPool& pool = TransferBufferPool::instance();
+    json.beginobject("transferbuffers");
+    json.arg("inuse", m_off_t(pool.inUse()));
+    json.arg("idle", m_off_t(pool.idle()));
+    json.endobject();
+
+    if (gfx)
+    {
+        json.beginobject("gfx");
+        json.arg("jobs", m_off_t(gfx->pendingjobs()));
+        json.arg("bitmapbytes", gfx->bitmapmemoryinuse());
+        json.endobject();
+    }
+
+    json.beginobject("useralerts");
+    json.arg("count", m_off_t(useralerts.alerts.size()));
+    json.endobject();
+
+    if (dbaccess)
+    {
+        json.arg("db", dbaccess->memoryUsed());
+    }
+}
+
 #ifdef MEGA_MEASURE_CODE
 std::string MegaClient::PerformanceStats::report(bool reset, HttpIO* httpio, Waiter* waiter, const RequestDispatcher& reqs)
 {
@@ -15770,13 +18673,20 @@ std::string MegaClient::PerformanceStats::report(bool reset, HttpIO* httpio, Wai
         << dispatchTransfers.report(reset) << "\n"
         << applyKeys.report(reset) << "\n"
         << scProcessingTime.report(reset) << "\n"
+        << execFileAttributes.report(reset) << "\n"
+        << execTransfers.report(reset) << "\n"
+        << execSyncs.report(reset) << "\n"
+        << slicedJobs.report(reset) << "\n"
         << csResponseProcessingTime.report(reset) << "\n"
+        << " sc slices left for the next pass: " << scSlices << "\n"
         << " cs Request waiting time: " << csRequestWaitTime.report(reset) << "\n"
         << " cs requests sent/received: " << reqs.csRequestsSent << "/" << reqs.csRequestsCompleted << " batches: " << reqs.csBatchesSent << "/" << reqs.csBatchesReceived << "\n"
         << " transfers active time: " << transfersActiveTime.report(reset) << "\n"
         << " transfer starts/finishes: " << transferStarts << " " << transferFinishes << "\n"
         << " transfer temperror/fails: " << transferTempErrors << " " << transferFails << "\n"
+        << " request size grows/shrinks: " << requestSizeGrowths << " " << requestSizeShrinks << "\n"
         << " nowait reason: immedate: " << prepwaitImmediate << " zero: " << prepwaitZero << " httpio: " << prepwaitHttpio << " fsaccess: " << prepwaitFsaccess << " nonzero waits: " << nonzeroWait << "\n";
+
 #ifdef USE_CURL
     if (auto curlhttpio = dynamic_cast<CurlHttpIO*>(httpio))
     {
@@ -15784,7 +18694,9 @@ std::string MegaClient::PerformanceStats::report(bool reset, HttpIO* httpio, Wai
             << curlhttpio->countAddAresEventsCode.report(reset) << "\n"
             << curlhttpio->countAddCurlEventsCode.report(reset) << "\n"
             << curlhttpio->countProcessAresEventsCode.report(reset) << "\n"
-            << curlhttpio->countProcessCurlEventsCode.report(reset) << "\n";
+            << curlhttpio->countProcessCurlEventsCode.report(reset) << "\n"
+            << curlhttpio->transferSocketStats.report(reset) << "\n"
+            << curlhttpio->apiResponseBytes.report(reset) << "\n";
     }
 #endif
 #ifdef WIN32
@@ -15820,6 +18732,17 @@ void FetchNodesStats::init()
     e500Count = 0;
     eOthersCount = 0;
 
+    dbReadTimeMs = 0;
+    dbParseTimeMs = 0;
+    dbLinkTimeMs = 0;
+
+    apiParseTimeUs = 0;
+    mergeSharesTimeUs = 0;
+    applyKeysTimeUs = 0;
+    syncsResumeTimeUs = 0;
+    transfersLoadTimeUs = 0;
+    transfersResumeTimeUs = 0;
+
     startTime = Waiter::ds;
     timeToFirstByte = NEVER;
     timeToLastByte = NEVER;
@@ -15848,4 +18771,47 @@ void FetchNodesStats::toJsonArray(string *json)
     json->append(oss.str());
 }
 
+void FetchNodesStats::toJson(JSONWriter& json) const
+{
+    // the times to the steps are in ds, and NEVER for those not reached
+    auto step = [&json](const char* name, dstime ds)
+    {
+        json.arg(name, ds == NEVER ? m_off_t(-1) : m_off_t(ds) * 100);
+    };
+
+    json.arg("mode", m_off_t(mode));
+    json.arg("type", m_off_t(type));
+    json.arg("cache", m_off_t(cache));
+    json.arg("nodescached", m_off_t(nodesCached));
+    json.arg("nodescurrent", m_off_t(nodesCurrent));
+    json.arg("actionpackets", m_off_t(actionPackets));
+
+    step("firstbyte", timeToFirstByte);
+    step("lastbyte", timeToLastByte);
+    step("cached", timeToCached);
+    step("result", timeToResult);
+    step("syncsresumed", timeToSyncsResumed);
+    step("current", timeToCurrent);
+
+    json.beginobject("phases");
+    json.arg("dbread", m_off_t(dbReadTimeMs));
+    json.arg("dbparse", m_off_t(dbParseTimeMs));
+    json.arg("dblink", m_off_t(dbLinkTimeMs));
+    json.arg("apiparse", m_off_t(apiParseTimeUs / 1000));
+    json.arg("mergeshares", m_off_t(mergeSharesTimeUs / 1000));
+    json.arg("applykeys", m_off_t(applyKeysTimeUs / 1000));
+    json.arg("syncsresume", m_off_t(syncsResumeTimeUs / 1000));
+    json.arg("transfersload", m_off_t(transfersLoadTimeUs / 1000));
+    json.arg("transfersresume", m_off_t(transfersResumeTimeUs / 1000));
+    json.endobject();
+}
+
+FetchNodesStats::PhaseTimer::~PhaseTimer()
+{
+    if (mUs)
+    {
+        *mUs += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - mStart).count();
+    }
+}
+
 } // namespace
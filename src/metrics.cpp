@@ -0,0 +1,559 @@
+/**
+ * @file metrics.cpp
+ * @brief Always-on latency histograms of the client's main operations
+ *
+ * (c) 2013-2021 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include "mega/metrics.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if (defined(__linux__) && defined(__GLIBC__)) || defined(__APPLE__)
+#include <execinfo.h>
+#include <signal.h>
+#define MEGA_STALL_STACK_SAMPLES 1
+#endif
+
+#include "mega/json.h"
+#include "mega/logging.h"
+#include "mega/threadconfig.h"
+
+namespace mega {
+
+LatencyHistogram::LatencyHistogram()
+    : mCount(0)
+    , mSum(0)
+    , mMax(0)
+{
+    for (auto& b : mBuckets)
+    {
+        b.store(0, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::record(std::chrono::steady_clock::duration d)
+{
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    record(uint64_t(std::max<int64_t>(us, 0)));
+}
+
+void LatencyHistogram::record(uint64_t us)
+{
+    mBuckets[size_t(bucket(us))].fetch_add(1, std::memory_order_relaxed);
+    mCount.fetch_add(1, std::memory_order_relaxed);
+    mSum.fetch_add(us, std::memory_order_relaxed);
+
+    uint64_t max = mMax.load(std::memory_order_relaxed);
+    while (us > max && !mMax.compare_exchange_weak(max, us, std::memory_order_relaxed))
+    {
+    }
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const
+{
+    Snapshot s;
+    for (size_t i = 0; i < mBuckets.size(); i++)
+    {
+        s.buckets[i] = mBuckets[i].load(std::memory_order_relaxed);
+        s.count += s.buckets[i];
+    }
+
+    // from the buckets, which may be a little ahead of the sum while it records
+    s.sum = mSum.load(std::memory_order_relaxed);
+    s.max = mMax.load(std::memory_order_relaxed);
+    return s;
+}
+
+int LatencyHistogram::bucket(uint64_t us)
+{
+    if (us < uint64_t(SUBBUCKETS))
+    {
+        return int(us);
+    }
+
+    int msb = 0;
+    for (uint64_t v = us; v >>= 1; )
+    {
+        msb++;
+    }
+
+    int b = (msb - SUBBUCKETBITS + 1) * SUBBUCKETS + int((us >> (msb - SUBBUCKETBITS)) & (SUBBUCKETS - 1));
+    return std::min(b, BUCKETS - 1);
+}
+
+uint64_t LatencyHistogram::lowerbound(int bucket)
+{
+    if (bucket < 2 * SUBBUCKETS)
+    {
+        return uint64_t(bucket);
+    }
+
+    int msb = bucket / SUBBUCKETS - 1 + SUBBUCKETBITS;
+    return uint64_t(SUBBUCKETS + bucket % SUBBUCKETS) << (msb - SUBBUCKETBITS);
+}
+
+uint64_t LatencyHistogram::Snapshot::percentile(double fraction) const
+{
+    if (!count)
+    {
+        return 0;
+    }
+
+    auto target = uint64_t(fraction * double(count) + 0.5);
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        seen += buckets[size_t(i)];
+        if (seen >= target && seen)
+        {
+            // the end of the bucket, or the longest one in it
+            return (i + 1 < BUCKETS) ? std::min(lowerbound(i + 1) - 1, max) : max;
+        }
+    }
+    return max;
+}
+
+TraceRing::TraceRing()
+    : mCapacity(0)
+    , mEpoch(std::chrono::steady_clock::now())
+{
+}
+
+void TraceRing::setCapacity(size_t events)
+{
+    std::lock_guard<std::mutex> g(mMutex);
+
+    // oldest first from 0, for the new capacity to drop them
+    std::rotate(mEvents.begin(), mEvents.begin() + ptrdiff_t(mNext % std::max<size_t>(mEvents.size(), 1)), mEvents.end());
+    if (mEvents.size() > events)
+    {
+        mEvents.erase(mEvents.begin(), mEvents.end() - ptrdiff_t(events));
+    }
+    mEvents.shrink_to_fit();
+    mNext = mEvents.size();
+    mCapacity = events;
+}
+
+bool TraceRing::enabled() const
+{
+    return mCapacity.load(std::memory_order_relaxed) != 0;
+}
+
+void TraceRing::span(const char* name, int transfer, int lane, time_point start, std::initializer_list<Arg> args)
+{
+    if (enabled())
+    {
+        add(name, 'X', transfer, lane, start, std::chrono::steady_clock::now(), args);
+    }
+}
+
+void TraceRing::instant(const char* name, int transfer, int lane, std::initializer_list<Arg> args)
+{
+    if (enabled())
+    {
+        auto now = std::chrono::steady_clock::now();
+        add(name, 'i', transfer, lane, now, now, args);
+    }
+}
+
+void TraceRing::add(const char* name, char phase, int transfer, int lane, time_point start, time_point end, std::initializer_list<Arg> args)
+{
+    Event e;
+    e.name = name;
+    e.phase = phase;
+    e.transfer = transfer;
+    e.lane = lane;
+    e.start = start;
+    e.end = end;
+    e.nargs = 0;
+    for (auto& a : args)
+    {
+        if (e.nargs < MAXARGS)
+        {
+            e.args[e.nargs++] = a;
+        }
+    }
+
+    std::lock_guard<std::mutex> g(mMutex);
+    size_t capacity = mCapacity;
+    if (!capacity)
+    {
+        return;
+    }
+
+    if (mEvents.size() < capacity)
+    {
+        mEvents.push_back(e);
+    }
+    else
+    {
+        mEvents[mNext % capacity] = e;
+    }
+    mNext++;
+}
+
+string TraceRing::tojson()
+{
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    std::lock_guard<std::mutex> g(mMutex);
+
+    JSONWriter json;
+    json.beginobject();
+    json.beginarray("traceEvents");
+
+    size_t first = mEvents.empty() || mEvents.size() < mCapacity ? 0 : mNext % mEvents.size();
+    for (size_t n = 0; n < mEvents.size(); n++)
+    {
+        const Event& e = mEvents[(first + n) % mEvents.size()];
+        string phase(1, e.phase);
+
+        json.beginobject();
+        json.arg("name", e.name);
+        json.arg("ph", phase.c_str());
+        json.arg("pid", m_off_t(e.transfer));
+        json.arg("tid", m_off_t(e.lane));
+        json.arg("ts", m_off_t(duration_cast<microseconds>(e.start - mEpoch).count()));
+        if (e.phase == 'X')
+        {
+            json.arg("dur", m_off_t(duration_cast<microseconds>(e.end - e.start).count()));
+        }
+        else
+        {
+            // within its thread
+            json.arg("s", "t");
+        }
+        if (e.nargs)
+        {
+            json.beginobject("args");
+            for (int i = 0; i < e.nargs; i++)
+            {
+                json.arg(e.args[i].name, m_off_t(e.args[i].value));
+            }
+            json.endobject();
+        }
+        json.endobject();
+    }
+
+    json.endarray();
+    json.endobject();
+    return json.getstring();
+}
+
+namespace {
+
+// the watchdog of the thread, for its scopes
+#ifdef WIN32
+thread_local StallWatchdog* watchedBy = nullptr;
+#else
+__thread StallWatchdog* watchedBy = nullptr;
+#endif
+
+int64_t steadyUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#ifdef MEGA_STALL_STACK_SAMPLES
+// the frames the handler of SIGURG puts the stack of the thread it interrupts in: one sample at a
+// time, taken by the watchdog holding sampleMutex
+const int SAMPLEFRAMES = 64;
+void* sampleFrames[SAMPLEFRAMES];
+std::atomic<int> sampleFrameCount{-1};
+std::mutex sampleMutex;
+
+void sampleHandler(int)
+{
+    sampleFrameCount.store(backtrace(sampleFrames, SAMPLEFRAMES), std::memory_order_release);
+}
+
+void installSampleHandler()
+{
+    static std::once_flag installed;
+    std::call_once(installed, []()
+    {
+        // the first backtrace() loads what it needs (which the handler can't)
+        void* frame;
+        backtrace(&frame, 1);
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof sa);
+        sa.sa_handler = sampleHandler;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGURG, &sa, nullptr);
+    });
+}
+#endif
+
+} // anonymous
+
+const std::chrono::seconds StallWatchdog::LOGINTERVAL(60);
+
+StallWatchdog::StallWatchdog()
+{
+    for (auto& s : mScopes)
+    {
+        s.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+StallWatchdog::~StallWatchdog()
+{
+    configure(0, false);
+
+    if (watchedBy == this)
+    {
+        watchedBy = nullptr;
+    }
+}
+
+void StallWatchdog::watch()
+{
+#ifndef _WIN32
+    mWatched = pthread_self();
+#endif
+    watchedBy = this;
+    mWatching = true;
+}
+
+void StallWatchdog::configure(int thresholdMs, bool stackSamples)
+{
+    std::thread stopped;
+    {
+        std::lock_guard<std::mutex> g(mMutex);
+        mThresholdMs = std::max(thresholdMs, 0);
+        mStackSamples = stackSamples;
+
+        if (mThresholdMs && !mThread.joinable())
+        {
+            mStop = false;
+            mThread = std::thread([this]()
+            {
+                ThreadConfig::apply(THREAD_ROLE_BACKGROUND);
+                run();
+            });
+        }
+        else if (!mThresholdMs && mThread.joinable())
+        {
+            mStop = true;
+            stopped.swap(mThread);
+        }
+    }
+    mChanged.notify_all();
+
+#ifdef MEGA_STALL_STACK_SAMPLES
+    if (stackSamples && thresholdMs)
+    {
+        installSampleHandler();
+    }
+#endif
+
+    if (stopped.joinable())
+    {
+        stopped.join();
+    }
+}
+
+void StallWatchdog::pass()
+{
+    mPass.fetch_add(1, std::memory_order_relaxed);
+    mPassStart.store(steadyUs(), std::memory_order_release);
+}
+
+void StallWatchdog::idle()
+{
+    mPassStart.store(0, std::memory_order_release);
+}
+
+StallWatchdog::Scope::Scope(const char* name)
+    : mWatchdog(watchedBy)
+{
+    if (mWatchdog)
+    {
+        int depth = mWatchdog->mDepth.load(std::memory_order_relaxed);
+        if (depth < MAXSCOPES)
+        {
+            mWatchdog->mScopes[size_t(depth)].store(name, std::memory_order_relaxed);
+        }
+        mWatchdog->mDepth.store(depth + 1, std::memory_order_release);
+    }
+}
+
+StallWatchdog::Scope::~Scope()
+{
+    if (mWatchdog)
+    {
+        mWatchdog->mDepth.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+string StallWatchdog::scopes() const
+{
+    // read while the thread goes on: a scope may have just ended or begun
+    int depth = std::min(mDepth.load(std::memory_order_acquire), int(MAXSCOPES));
+
+    string s;
+    for (int i = 0; i < depth; i++)
+    {
+        if (const char* name = mScopes[size_t(i)].load(std::memory_order_relaxed))
+        {
+            s += s.empty() ? "" : " > ";
+            s += name;
+        }
+    }
+    return s;
+}
+
+uint64_t StallWatchdog::stalls() const
+{
+    return mStalls;
+}
+
+void StallWatchdog::run()
+{
+    std::unique_lock<std::mutex> g(mMutex);
+    while (!mStop)
+    {
+        // a few checks per threshold, for the stalls to be seen soon after they cross it
+        auto period = std::chrono::milliseconds(std::max(mThresholdMs / 4, 10));
+        mChanged.wait_for(g, period);
+        if (mStop || !mWatching)
+        {
+            continue;
+        }
+
+        int64_t start = mPassStart.load(std::memory_order_acquire);
+        uint64_t pass = mPass.load(std::memory_order_relaxed);
+        if (start && pass != mReportedPass && steadyUs() - start >= int64_t(mThresholdMs) * 1000)
+        {
+            mReportedPass = pass;
+            mStalls++;
+            report(steadyUs() - start);
+        }
+    }
+}
+
+void StallWatchdog::report(int64_t passUs)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (mStalls > 1 && now - mLastLog < LOGINTERVAL)
+    {
+        mSuppressed++;
+        return;
+    }
+    mLastLog = now;
+
+    string sample = mStackSamples ? stackSample() : string();
+
+    LOG_warn << "SDK thread stalled for " << passUs / 1000 << " ms, in: " << (mDepth ? scopes() : "(no scope)")
+             << (mSuppressed ? " (" + std::to_string(mSuppressed) + " other stalls not logged)" : "")
+             << sample;
+    mSuppressed = 0;
+}
+
+string StallWatchdog::stackSample()
+{
+#ifdef MEGA_STALL_STACK_SAMPLES
+    std::lock_guard<std::mutex> g(sampleMutex);
+
+    sampleFrameCount.store(-1, std::memory_order_relaxed);
+    if (pthread_kill(mWatched, SIGURG))
+    {
+        return string();
+    }
+
+    // the handler runs as soon as the thread is scheduled
+    int frames = -1;
+    for (int i = 0; i < 100 && (frames = sampleFrameCount.load(std::memory_order_acquire)) < 0; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (frames <= 0)
+    {
+        return string();
+    }
+
+    string s = "\nStack sample:";
+    if (char** symbols = backtrace_symbols(sampleFrames, frames))
+    {
+        // leaving out the frames of the handler itself
+        for (int i = 2; i < frames; i++)
+        {
+            s += "\n  ";
+            s += symbols[i];
+        }
+        free(symbols);
+    }
+    return s;
+#else
+    return string();
+#endif
+}
+
+void ClientMetrics::tojson(JSONWriter& json) const
+{
+    tojson(json, "exec", exec);
+    tojson(json, "dispatchtransfers", dispatchTransfers);
+    tojson(json, "sc", scProcessing);
+    tojson(json, "cs", csResponse);
+    tojson(json, "dbcommit", dbCommit);
+
+    json.arg("cseagain", m_off_t(csEAgain));
+    json.arg("csserverbusy", m_off_t(csServerBusy));
+    json.arg("csfailures", m_off_t(csFailures));
+
+    json.beginobject("commands");
+    for (auto& c : commands)
+    {
+        const CommandMetrics& m = c.second;
+        json.beginobject(c.first.c_str());
+        json.arg("count", m_off_t(m.count));
+        json.arg("retries", m_off_t(m.retries));
+        json.arg("errors", m_off_t(m.errors));
+        json.arg("bytes", m_off_t(m.responseBytes));
+        tojson(json, "latency", m.latency);
+        tojson(json, "parse", m.parse);
+        json.endobject();
+    }
+    json.endobject();
+}
+
+CommandMetrics& ClientMetrics::command(const char* name)
+{
+    return commands[name ? name : "?"];
+}
+
+void ClientMetrics::tojson(JSONWriter& json, const char* name, const LatencyHistogram& h)
+{
+    auto s = h.snapshot();
+
+    json.beginobject(name);
+    json.arg("count", m_off_t(s.count));
+    json.arg("sum", m_off_t(s.sum));
+    json.arg("max", m_off_t(s.max));
+    json.arg("p50", m_off_t(s.percentile(0.5)));
+    json.arg("p90", m_off_t(s.percentile(0.9)));
+    json.arg("p99", m_off_t(s.percentile(0.99)));
+    json.arg("p999", m_off_t(s.percentile(0.999)));
+    json.endobject();
+}
+
+} // namespace
@@ -31,8 +31,196 @@
 #include "mega/logging.h"
 #include "mega/heartbeats.h"
 
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
 namespace mega {
 
+// Compact node records (see Node::serializecompact()) start with COMPACTRECORD where a legacy one
+// has its size (or the negated type of a node other than a file), which it never is, then a byte
+// with the encoding version and COMPACT_DEFLATED if the rest is deflated
+static const m_off_t COMPACTRECORD = -0x100;
+static const byte COMPACT_VERSION = 1;
+static const byte COMPACT_DEFLATED = 0x80;
+
+// in the flags byte of the body
+enum
+{
+    COMPACT_HASPARENT = 1,
+    COMPACT_EXPORTED = 2,
+    COMPACT_LINKCTS = 4,
+    COMPACT_LINKAUTHKEY = 8,
+    COMPACT_LINKTAKENDOWN = 16,
+};
+
+// attribute names stored as their position here, plus one (zero is followed by the nameid).
+// Append only: records written with a code read it back with that position
+static const char* const COMPACT_ATTRNAMES[] = { "n", "c", "c0", "lbl", "fav", "rr", "gp", "l", "d", "dev-id" };
+
+static const vector<nameid>& compactattrnames()
+{
+    static const vector<nameid> ids = []()
+    {
+        vector<nameid> v;
+        for (const char* name : COMPACT_ATTRNAMES)
+        {
+            v.push_back(AttrMap::string2nameid(name));
+        }
+        return v;
+    }();
+    return ids;
+}
+
+#ifdef USE_ZLIB
+// raw deflate with a small window: the records are small, and millions of them are (de)compressed
+static const int COMPACT_WINDOWBITS = -9;
+
+static bool deflaterecord(const char* data, size_t size, string* out)
+{
+    z_stream z = {};
+    if (deflateInit2(&z, Z_BEST_SPEED, Z_DEFLATED, COMPACT_WINDOWBITS, 1, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return false;
+    }
+
+    out->resize(deflateBound(&z, uLong(size)));
+    z.next_in = (Bytef*)data;
+    z.avail_in = uInt(size);
+    z.next_out = (Bytef*)&(*out)[0];
+    z.avail_out = uInt(out->size());
+
+    bool ok = deflate(&z, Z_FINISH) == Z_STREAM_END;
+    out->resize(z.total_out);
+    deflateEnd(&z);
+    return ok;
+}
+
+static bool inflaterecord(const char* data, size_t size, size_t rawsize, string* out)
+{
+    z_stream z = {};
+    if (inflateInit2(&z, COMPACT_WINDOWBITS) != Z_OK)
+    {
+        return false;
+    }
+
+    out->resize(rawsize);
+    z.next_in = (Bytef*)data;
+    z.avail_in = uInt(size);
+    z.next_out = (Bytef*)&(*out)[0];
+    z.avail_out = uInt(rawsize);
+
+    bool ok = inflate(&z, Z_FINISH) == Z_STREAM_END && z.total_out == rawsize;
+    inflateEnd(&z);
+    return ok;
+}
+#endif
+
+#ifdef ENABLE_NODE_ARENA
+namespace {
+
+// Fixed-size slab allocator for Node objects.
+// Freed slots go on an intrusive free list and are reused first.  Once the last Node
+// is released (eg. on logout) all slabs are handed back to the heap.
+class NodeArena
+{
+    static const size_t NODESPERSLAB = 8192;
+
+    // slot size, rounded up so every slot is suitably aligned for a Node
+    static const size_t SLOTSIZE = (sizeof(Node) + alignof(Node) - 1) / alignof(Node) * alignof(Node);
+
+    std::mutex mMutex;
+    vector<unique_ptr<char[]>> mSlabs;
+    size_t mUsedInLastSlab = NODESPERSLAB;
+    void* mFreeList = nullptr;
+    size_t mLive = 0;
+
+public:
+    void* allocate()
+    {
+        std::lock_guard<std::mutex> g(mMutex);
+        ++mLive;
+
+        if (mFreeList)
+        {
+            void* p = mFreeList;
+            mFreeList = *static_cast<void**>(p);
+            return p;
+        }
+
+        if (mUsedInLastSlab == NODESPERSLAB)
+        {
+            mSlabs.emplace_back(new char[SLOTSIZE * NODESPERSLAB]);
+            mUsedInLastSlab = 0;
+        }
+
+        return mSlabs.back().get() + SLOTSIZE * mUsedInLastSlab++;
+    }
+
+    void deallocate(void* p)
+    {
+        std::lock_guard<std::mutex> g(mMutex);
+        assert(mLive);
+
+        if (!--mLive)
+        {
+            mSlabs.clear();
+            mUsedInLastSlab = NODESPERSLAB;
+            mFreeList = nullptr;
+            return;
+        }
+
+        *static_cast<void**>(p) = mFreeList;
+        mFreeList = p;
+    }
+};
+
+static_assert(sizeof(Node) >= sizeof(void*), "free list links are stored in released Node slots");
+
+NodeArena& nodeArena()
+{
+    // never destroyed, so that Nodes owned by static objects can still be released during shutdown
+    static NodeArena* arena = new NodeArena;
+    return *arena;
+}
+
+} // namespace
+
+void* Node::operator new(size_t size)
+{
+    assert(size == sizeof(Node));
+    return nodeArena().allocate();
+}
+
+void Node::operator delete(void* p, size_t size)
+{
+    assert(size == sizeof(Node));
+    if (p)
+    {
+        nodeArena().deallocate(p);
+    }
+}
+#endif
+
+// add or remove the counts of a subtree to/from the cached counters of the nodes above it
+static void updateancestorcounters(Node* p, const NodeCounter& nc, bool add)
+{
+    for (; p; p = p->parent)
+    {
+        if (p->counter && p->type != FILENODE)
+        {
+            if (add)
+            {
+                *p->counter += nc;
+            }
+            else
+            {
+                *p->counter -= nc;
+            }
+        }
+    }
+}
+
 Node::Node(MegaClient* cclient, node_vector* dp, handle h, handle ph,
            nodetype_t t, m_off_t s, handle u, const char* fa, m_time_t ts)
 {
@@ -51,8 +239,6 @@ Node::Node(MegaClient* cclient, node_vector* dp, handle h, handle ph,
     syncget = NULL;
 
     syncdeleted = SYNCDEL_NONE;
-    todebris_it = client->todebris.end();
-    tounlink_it = client->tounlink.end();
 #endif
 
     type = t;
@@ -72,6 +258,12 @@ Node::Node(MegaClient* cclient, node_vector* dp, handle h, handle ph,
 
     memset(&changed, 0, sizeof changed);
 
+    if (t != FILENODE)
+    {
+        counter.reset(new NodeCounter);
+        counter->folders = t == FOLDERNODE;
+    }
+
     Node* p;
 
     client->nodes[h] = this;
@@ -93,36 +285,48 @@ Node::Node(MegaClient* cclient, node_vector* dp, handle h, handle ph,
     }
 
     client->mFingerprints.newnode(this);
+    client->mNodesByCtime.add(this);
 }
 
 Node::~Node()
 {
-    if (keyApplied())
+    delete mSortKeys.load();
+
+    // when all the nodes go, what they are in is reset at once by purgenodesusersabortsc()
+    if (!client->mOptimizePurgeNodes)
     {
-        client->mAppliedKeyNodeCount--;
-        assert(client->mAppliedKeyNodeCount >= 0);
-    }
+        if (keyApplied())
+        {
+            client->mAppliedKeyNodeCount--;
+            assert(client->mAppliedKeyNodeCount >= 0);
+        }
 
-    // abort pending direct reads
-    client->preadabort(this);
+        // abort pending direct reads
+        client->preadabort(this);
+    }
 
     // remove node's fingerprint from hash
     if (!client->mOptimizePurgeNodes)
     {
         client->mFingerprints.remove(this);
+        client->mFingerprints.removeoriginal(this);
+        client->mNodesByCtime.remove(this);
+#ifdef ENABLE_SEARCH_INDEX
+        client->mSearchIndex.remove(this);
+#endif
     }
 
 #ifdef ENABLE_SYNC
     // remove from todebris node_set
-    if (todebris_it != client->todebris.end())
+    if (!client->todebris.empty())
     {
-        client->todebris.erase(todebris_it);
+        client->todebris.erase(this);
     }
 
     // remove from tounlink node_set
-    if (tounlink_it != client->tounlink.end())
+    if (!client->tounlink.empty())
     {
-        client->tounlink.erase(tounlink_it);
+        client->tounlink.erase(this);
     }
 #endif
 
@@ -131,6 +335,7 @@ Node::~Node()
         // delete outshares, including pointers from users for this node
         for (share_map::iterator it = outshares->begin(); it != outshares->end(); it++)
         {
+            client->indexoutshare(it->first, nodehandle, false);
             delete it->second;
         }
         delete outshares;
@@ -141,6 +346,7 @@ Node::~Node()
         // delete pending shares
         for (share_map::iterator it = pendingshares->begin(); it != pendingshares->end(); it++)
         {
+            client->indexoutshare(it->first, nodehandle, false);
             delete it->second;
         }
         delete pendingshares;
@@ -149,17 +355,28 @@ Node::~Node()
 
     if (!client->mOptimizePurgeNodes)
     {
-        // remove from parent's children
-        if (parent)
+        if (parent && parent->changed.removed)
         {
-            parent->children.erase(child_it);
+            // deleted with the rest of a removed subtree, already counted out (see detachremoved())
+            parent->children.erase(this);
         }
-
-        const Node* fa = firstancestor();
-        handle ancestor = fa->nodehandle;
-        if (ancestor == client->rootnodes[0] || ancestor == client->rootnodes[1] || ancestor == client->rootnodes[2] || fa->inshare)
+        else
         {
-            client->mNodeCounters[firstancestor()->nodehandle] -= subnodeCounts();
+            NodeCounter nc = subnodeCounts();
+
+            // remove from parent's children
+            if (parent)
+            {
+                updateancestorcounters(parent, nc, false);
+                parent->children.erase(this);
+            }
+
+            const Node* fa = firstancestor();
+            handle ancestor = fa->nodehandle;
+            if (ancestor == client->rootnodes[0] || ancestor == client->rootnodes[1] || ancestor == client->rootnodes[2] || fa->inshare)
+            {
+                client->mNodeCounters[firstancestor()->nodehandle] -= nc;
+            }
         }
 
         if (inshare)
@@ -169,13 +386,13 @@ Node::~Node()
 
         // delete child-parent associations (normally not used, as nodes are
         // deleted bottom-up)
-        for (node_list::iterator it = children.begin(); it != children.end(); it++)
+        for (Node* child : children)
         {
-            (*it)->parent = NULL;
+            child->parent = NULL;
         }
     }
 
-    if (plink)
+    if (plink && !client->mOptimizePurgeNodes)
     {
         client->mPublicLinks.erase(nodehandle);
     }
@@ -215,6 +432,7 @@ void Node::setkeyfromjson(const char* k)
     Node::copystring(&nodekeydata, k);
     if (keyApplied()) ++client->mAppliedKeyNodeCount;
     assert(client->mAppliedKeyNodeCount >= 0);
+    dropsnapshot();
 }
 
 // update node key and decrypt attributes
@@ -226,46 +444,168 @@ void Node::setkey(const byte* newkey)
         nodekeydata.assign(reinterpret_cast<const char*>(newkey), (type == FILENODE) ? FILENODEKEYLENGTH : FOLDERNODEKEYLENGTH);
         if (keyApplied()) ++client->mAppliedKeyNodeCount;
         assert(client->mAppliedKeyNodeCount >= 0);
+        dropsnapshot();
     }
 
     setattr();
 }
 
+bool Node::unserializehandles(const string* d, handle* h, handle* ph)
+{
+    string buffer;
+    CacheableReader r(*d);
+
+    if (NodeRecord::compactbody(*d, &buffer, &r))
+    {
+        // same layout as the start of the body read by NodeRecord::unserializecompact()
+        int64_t s;
+        byte flags;
+
+        *ph = UNDEF;
+        return r.unserializesignedvarint(s)
+            && r.unserializenodehandle(*h)
+            && r.unserializebyte(flags)
+            && (!(flags & COMPACT_HASPARENT) || r.unserializenodehandle(*ph));
+    }
+
+    // same layout as the start of the record read by NodeRecord::unserialize()
+    if (d->size() < sizeof(m_off_t) + 2 * MegaClient::NODEHANDLE)
+    {
+        return false;
+    }
+
+    const char* ptr = d->data() + sizeof(m_off_t);
+
+    *h = 0;
+    memcpy((char*)h, ptr, MegaClient::NODEHANDLE);
+    ptr += MegaClient::NODEHANDLE;
+
+    *ph = 0;
+    memcpy((char*)ph, ptr, MegaClient::NODEHANDLE);
+
+    if (!*ph)
+    {
+        *ph = UNDEF;
+    }
+
+    return true;
+}
+
 // parse serialized node and return Node object - updates nodes hash and parent
 // mismatch vector
 Node* Node::unserialize(MegaClient* client, const string* d, node_vector* dp)
 {
-    handle h, ph;
-    nodetype_t t;
-    m_off_t s;
-    handle u;
-    const byte* k = NULL;
+    NodeRecord record;
+
+    if (!record.unserialize(*d, *client->fsaccess))
+    {
+        return NULL;
+    }
+
+    return unserialize(client, record, dp);
+}
+
+Node* Node::unserialize(MegaClient* client, NodeRecord& r, node_vector* dp)
+{
+    Node* n = new Node(client, dp, r.h, r.ph, r.type, r.size, r.owner, r.fileattrstring.c_str(), r.ctime);
+
+    if (!r.key.empty())
+    {
+        n->setkey(reinterpret_cast<const byte*>(r.key.data()));
+    }
+
+    // inshare, outshares, or pending shares
+    for (auto& share : r.shares)
+    {
+        client->newshares.push_back(share.release());
+    }
+    r.shares.clear();
+
+    n->attrs = std::move(r.attrs);
+
+    if (r.exported)
+    {
+        n->plink = new PublicLink(r.linkhandle, r.linkcts, r.linkets, r.linktakendown, r.linkauthkey.c_str());
+        client->mPublicLinks[n->nodehandle] = n->plink->ph;
+    }
+
+    n->setfingerprint();
+    n->attrschanged();
+
+    return n;
+}
+
+bool NodeRecord::compactbody(const string& d, string* buffer, CacheableReader* body)
+{
+    if (d.size() < sizeof(m_off_t) + 1 || MemAccess::get<m_off_t>(d.data()) != COMPACTRECORD)
+    {
+        return false;
+    }
+
+    byte format = static_cast<byte>(d[sizeof(m_off_t)]);
+    body->ptr = d.data() + sizeof(m_off_t) + 1;
+    body->end = d.data() + d.size();
+
+    if ((format & ~COMPACT_DEFLATED) != COMPACT_VERSION)
+    {
+        LOG_err << "Unknown node record version: " << int(format);
+        return false;
+    }
+
+    if (format & COMPACT_DEFLATED)
+    {
+#ifdef USE_ZLIB
+        uint64_t rawsize;
+        if (!body->unserializevarint(rawsize)
+                || rawsize > 64 * 1024 * 1024   // would be a corrupt record
+                || !inflaterecord(body->ptr, size_t(body->end - body->ptr), size_t(rawsize), buffer))
+        {
+            return false;
+        }
+
+        body->ptr = buffer->data();
+        body->end = buffer->data() + buffer->size();
+#else
+        LOG_err << "Deflated node record, but built without zlib";
+        return false;
+#endif
+    }
+
+    return true;
+}
+
+// this only reads the record: the client is not touched, so this can run on any thread
+bool NodeRecord::unserialize(const string& d, const FileSystemAccess& fsaccess)
+{
+    if (d.size() >= sizeof(m_off_t) && MemAccess::get<m_off_t>(d.data()) == COMPACTRECORD)
+    {
+        return unserializecompact(d, fsaccess);
+    }
+
     const char* fa;
-    m_time_t ts;
     const byte* skey;
-    const char* ptr = d->data();
-    const char* end = ptr + d->size();
+    const char* ptr = d.data();
+    const char* end = ptr + d.size();
     unsigned short ll;
-    Node* n;
     int i;
     char isExported = '\0';
     char hasLinkCreationTs = '\0';
 
-    if (ptr + sizeof s + 2 * MegaClient::NODEHANDLE + MegaClient::USERHANDLE + 2 * sizeof ts + sizeof ll > end)
+    if (ptr + sizeof size + 2 * MegaClient::NODEHANDLE + MegaClient::USERHANDLE + 2 * sizeof ctime + sizeof ll > end)
     {
-        return NULL;
+        return false;
     }
 
-    s = MemAccess::get<m_off_t>(ptr);
-    ptr += sizeof s;
+    size = MemAccess::get<m_off_t>(ptr);
+    ptr += sizeof size;
 
-    if (s < 0 && s >= -RUBBISHNODE)
+    if (size < 0 && size >= -RUBBISHNODE)
     {
-        t = (nodetype_t)-s;
+        type = (nodetype_t)-size;
     }
     else
     {
-        t = FILENODE;
+        type = FILENODE;
     }
 
     h = 0;
@@ -281,37 +621,37 @@ Node* Node::unserialize(MegaClient* client, const string* d, node_vector* dp)
         ph = UNDEF;
     }
 
-    u = 0;
-    memcpy((char*)&u, ptr, MegaClient::USERHANDLE);
+    owner = 0;
+    memcpy((char*)&owner, ptr, MegaClient::USERHANDLE);
     ptr += MegaClient::USERHANDLE;
 
     // FIME: use m_time_t / Serialize64 instead
     ptr += sizeof(time_t);
 
-    ts = (uint32_t)MemAccess::get<time_t>(ptr);
+    ctime = (uint32_t)MemAccess::get<time_t>(ptr);
     ptr += sizeof(time_t);
 
-    if ((t == FILENODE) || (t == FOLDERNODE))
+    if ((type == FILENODE) || (type == FOLDERNODE))
     {
-        int keylen = ((t == FILENODE) ? FILENODEKEYLENGTH : FOLDERNODEKEYLENGTH);
+        int keylen = ((type == FILENODE) ? FILENODEKEYLENGTH : FOLDERNODEKEYLENGTH);
 
         if (ptr + keylen + 8 + sizeof(short) > end)
         {
-            return NULL;
+            return false;
         }
 
-        k = (const byte*)ptr;
+        key.assign(ptr, keylen);
         ptr += keylen;
     }
 
-    if (t == FILENODE)
+    if (type == FILENODE)
     {
         ll = MemAccess::get<unsigned short>(ptr);
         ptr += sizeof ll;
 
         if (ptr + ll > end)
         {
-            return NULL;
+            return false;
         }
 
         fa = ptr;
@@ -322,9 +662,12 @@ Node* Node::unserialize(MegaClient* client, const string* d, node_vector* dp)
         fa = NULL;
     }
 
+    // as the Node constructor would take it
+    Node::copystring(&fileattrstring, fa);
+
     if (ptr + sizeof isExported + sizeof hasLinkCreationTs > end)
     {
-        return NULL;
+        return false;
     }
 
     isExported = MemAccess::get<char>(ptr);
@@ -353,7 +696,7 @@ Node* Node::unserialize(MegaClient* client, const string* d, node_vector* dp)
 
     if (ptr + sizeof(short) > end)
     {
-        return NULL;
+        return false;
     }
 
     short numshares = MemAccess::get<short>(ptr);
@@ -363,7 +706,7 @@ Node* Node::unserialize(MegaClient* client, const string* d, node_vector* dp)
     {
         if (ptr + SymmCipher::KEYLENGTH > end)
         {
-            return NULL;
+            return false;
         }
 
         skey = (const byte*)ptr;
@@ -374,13 +717,6 @@ Node* Node::unserialize(MegaClient* client, const string* d, node_vector* dp)
         skey = NULL;
     }
 
-    n = new Node(client, dp, h, ph, t, s, u, fa, ts);
-
-    if (k)
-    {
-        n->setkey(k);
-    }
-
     // read inshare, outshares, or pending shares
     while (numshares)   // inshares: -1, outshare/s: num_shares
     {
@@ -392,7 +728,7 @@ Node* Node::unserialize(MegaClient* client, const string* d, node_vector* dp)
             break;
         }
 
-        client->newshares.push_back(newShare);
+        shares.emplace_back(newShare);
         if (numshares > 0)  // outshare/s
         {
             numshares--;
@@ -403,112 +739,331 @@ Node* Node::unserialize(MegaClient* client, const string* d, node_vector* dp)
         }
     }
 
-    ptr = n->attrs.unserialize(ptr, end);
+    ptr = attrs.unserialize(ptr, end);
     if (!ptr)
     {
-        delete n;
-        return NULL;
+        return false;
     }
 
     // It's needed to re-normalize node names because
     // the updated version of utf8proc doesn't provide
     // exactly the same output as the previous one that
     // we were using
-    attr_map::iterator it = n->attrs.map.find('n');
-    if (it != n->attrs.map.end())
+    attr_map::iterator it = attrs.map.find('n');
+    if (it != attrs.map.end())
     {
-        client->fsaccess->normalize(&(it->second));
+        fsaccess.normalize(&(it->second));
     }
 
-    PublicLink *plink = NULL;
+    exported = isExported;
     if (isExported)
     {
         if (ptr + MegaClient::NODEHANDLE + sizeof(m_time_t) + sizeof(bool) > end)
         {
-            delete n;
-            return NULL;
+            return false;
         }
 
-        handle ph = 0;
-        memcpy((char*)&ph, ptr, MegaClient::NODEHANDLE);
+        linkhandle = 0;
+        memcpy((char*)&linkhandle, ptr, MegaClient::NODEHANDLE);
         ptr += MegaClient::NODEHANDLE;
-        m_time_t ets = MemAccess::get<m_time_t>(ptr);
-        ptr += sizeof(ets);
-        bool takendown = MemAccess::get<bool>(ptr);
-        ptr += sizeof(takendown);
+        linkets = MemAccess::get<m_time_t>(ptr);
+        ptr += sizeof(linkets);
+        linktakendown = MemAccess::get<bool>(ptr);
+        ptr += sizeof(linktakendown);
 
-        m_time_t cts = 0;
+        linkcts = 0;
         if (hasLinkCreationTs)
         {
-            cts = MemAccess::get<m_time_t>(ptr);
-            ptr += sizeof(cts);
+            linkcts = MemAccess::get<m_time_t>(ptr);
+            ptr += sizeof(linkcts);
         }
 
-        plink = new PublicLink(ph, cts, ets, takendown, authKey ? authKey : "");
-        client->mPublicLinks[n->nodehandle] = plink->ph;
+        linkauthkey = authKey ? authKey : "";
     }
-    n->plink = plink;
 
-    n->setfingerprint();
+    return ptr == end;
+}
+
+bool NodeRecord::unserializecompact(const string& d, const FileSystemAccess& fsaccess)
+{
+    string buffer;
+    CacheableReader r(d);
 
-    if (ptr == end)
+    if (!compactbody(d, &buffer, &r))
     {
-        return n;
+        return false;
     }
-    else
+
+    int64_t s;
+    byte flags;
+    int64_t t;
+
+    if (!r.unserializesignedvarint(s)
+            || !r.unserializenodehandle(h)
+            || !r.unserializebyte(flags)
+            || ((flags & COMPACT_HASPARENT) && !r.unserializenodehandle(ph))
+            || !r.unserializehandle(owner)
+            || !r.unserializesignedvarint(t))
     {
-        delete n;
-        return NULL;
+        return false;
     }
-}
 
-// serialize node - nodes with pending or RSA keys are unsupported
-bool Node::serialize(string* d)
-{
-    // do not serialize encrypted nodes
-    if (attrstring)
-    {
-        LOG_warn << "Trying to serialize an encrypted node";
+    // as in the legacy encoding
+    size = s;
+    type = (s < 0 && s >= -RUBBISHNODE) ? (nodetype_t)-s : FILENODE;
+    ctime = t;
 
-        //Last attempt to decrypt the node
-        applykey();
-        setattr();
+    if (!(flags & COMPACT_HASPARENT))
+    {
+        ph = UNDEF;
+    }
 
-        if (attrstring)
+    if (type == FILENODE || type == FOLDERNODE)
+    {
+        key.resize((type == FILENODE) ? FILENODEKEYLENGTH : FOLDERNODEKEYLENGTH);
+        if (!r.unserializebinary((byte*)&key[0], key.size()))
         {
-            LOG_warn << "Skipping undecryptable node";
             return false;
         }
     }
 
-    switch (type)
+    if (type == FILENODE && !r.unserializevarstring(fileattrstring))
     {
-        case FILENODE:
-            if ((int)nodekeydata.size() != FILENODEKEYLENGTH)
-            {
-                return false;
-            }
-            break;
+        return false;
+    }
 
-        case FOLDERNODE:
-            if ((int)nodekeydata.size() != FOLDERNODEKEYLENGTH)
-            {
-                return false;
-            }
-            break;
+    // inshare (-1), or outshares and pending shares
+    int64_t numshares;
+    if (!r.unserializesignedvarint(numshares))
+    {
+        return false;
+    }
 
-        default:
-            if (nodekeydata.size())
+    if (numshares)
+    {
+        byte skey[SymmCipher::KEYLENGTH];
+        if (!r.unserializebinary(skey, sizeof skey))
+        {
+            return false;
+        }
+
+        for (int64_t i = (numshares < 0) ? 1 : numshares; i--; )
+        {
+            NewShare* newShare = Share::unserialize((numshares > 0) ? -1 : 0, h, skey, &r.ptr, r.end);
+            if (!newShare)
             {
+                LOG_err << "Failed to unserialize Share";
                 return false;
             }
+            shares.emplace_back(newShare);
+        }
     }
 
-    unsigned short ll;
-    short numshares;
-    m_off_t s;
-
-    s = type ? -type : size;
+    uint64_t numattrs;
+    if (!r.unserializevarint(numattrs))
+    {
+        return false;
+    }
+
+    const vector<nameid>& common = compactattrnames();
+    while (numattrs--)
+    {
+        uint64_t code;
+        nameid id;
+        string value;
+
+        if (!r.unserializevarint(code)
+                || (!code && !r.unserializevarint(id))
+                || code > common.size()
+                || !r.unserializevarstring(value))
+        {
+            return false;
+        }
+
+        attrs.map[code ? common[size_t(code - 1)] : id] = std::move(value);
+    }
+
+    // re-normalized, as in the legacy encoding
+    attr_map::iterator it = attrs.map.find('n');
+    if (it != attrs.map.end())
+    {
+        fsaccess.normalize(&(it->second));
+    }
+
+    exported = flags & COMPACT_EXPORTED;
+    if (exported)
+    {
+        if (!r.unserializenodehandle(linkhandle)
+                || !r.unserializesignedvarint(linkets)
+                || ((flags & COMPACT_LINKCTS) && !r.unserializesignedvarint(linkcts))
+                || ((flags & COMPACT_LINKAUTHKEY) && !r.unserializevarstring(linkauthkey)))
+        {
+            return false;
+        }
+
+        linktakendown = flags & COMPACT_LINKTAKENDOWN;
+    }
+
+    return !r.hasdataleft();
+}
+
+void Node::serializecompact(string* d)
+{
+    string body;
+    CacheableWriter w(body);
+
+    byte flags = (parent ? COMPACT_HASPARENT : 0)
+               | (plink ? COMPACT_EXPORTED | COMPACT_LINKCTS : 0)
+               | (plink && plink->mAuthKey.size() ? COMPACT_LINKAUTHKEY : 0)
+               | (plink && plink->takendown ? COMPACT_LINKTAKENDOWN : 0);
+
+    w.serializesignedvarint(type ? -type : size);
+    w.serializenodehandle(nodehandle);
+    w.serializebyte(flags);
+    if (parent)
+    {
+        w.serializenodehandle(parent->nodehandle);
+    }
+    w.serializehandle(owner);
+    w.serializesignedvarint(ctime);
+
+    body.append(nodekeydata);
+
+    if (type == FILENODE)
+    {
+        w.serializevarstring(fileattrstring);
+    }
+
+    int64_t numshares = inshare ? -1 : int64_t((outshares ? outshares->size() : 0) + (pendingshares ? pendingshares->size() : 0));
+    w.serializesignedvarint(numshares);
+
+    if (numshares)
+    {
+        w.serializebinary(sharekey->key, SymmCipher::KEYLENGTH);
+
+        if (inshare)
+        {
+            inshare->serialize(&body);
+        }
+        else
+        {
+            for (share_map* shares : { outshares, pendingshares })
+            {
+                if (shares)
+                {
+                    for (auto& share : *shares)
+                    {
+                        share.second->serialize(&body);
+                    }
+                }
+            }
+        }
+    }
+
+    const vector<nameid>& common = compactattrnames();
+    w.serializevarint(attrs.map.size());
+    for (auto& attr : attrs.map)
+    {
+        auto code = std::find(common.begin(), common.end(), attr.first);
+        if (code != common.end())
+        {
+            w.serializevarint(uint64_t(code - common.begin()) + 1);
+        }
+        else
+        {
+            w.serializevarint(0);
+            w.serializevarint(attr.first);
+        }
+        w.serializevarstring(attr.second);
+    }
+
+    if (plink)
+    {
+        w.serializenodehandle(plink->ph);
+        w.serializesignedvarint(plink->ets);
+        w.serializesignedvarint(plink->cts);
+        if (plink->mAuthKey.size())
+        {
+            w.serializevarstring(plink->mAuthKey);
+        }
+    }
+
+    d->append((const char*)&COMPACTRECORD, sizeof COMPACTRECORD);
+
+#ifdef USE_ZLIB
+    string deflated;
+    if (client->compressnoderecords && deflaterecord(body.data(), body.size(), &deflated))
+    {
+        string rawsize;
+        CacheableWriter(rawsize).serializevarint(body.size());
+
+        if (rawsize.size() + deflated.size() < body.size())
+        {
+            d->push_back(char(COMPACT_VERSION | COMPACT_DEFLATED));
+            d->append(rawsize);
+            d->append(deflated);
+            return;
+        }
+    }
+#endif
+
+    d->push_back(char(COMPACT_VERSION));
+    d->append(body);
+}
+
+// serialize node - nodes with pending or RSA keys are unsupported
+bool Node::serialize(string* d)
+{
+    // do not serialize encrypted nodes
+    if (attrstring)
+    {
+        LOG_warn << "Trying to serialize an encrypted node";
+
+        //Last attempt to decrypt the node
+        applykey();
+        setattr();
+
+        if (attrstring)
+        {
+            LOG_warn << "Skipping undecryptable node";
+            return false;
+        }
+    }
+
+    switch (type)
+    {
+        case FILENODE:
+            if ((int)nodekeydata.size() != FILENODEKEYLENGTH)
+            {
+                return false;
+            }
+            break;
+
+        case FOLDERNODE:
+            if ((int)nodekeydata.size() != FOLDERNODEKEYLENGTH)
+            {
+                return false;
+            }
+            break;
+
+        default:
+            if (nodekeydata.size())
+            {
+                return false;
+            }
+    }
+
+    if (client->compactnoderecords)
+    {
+        serializecompact(d);
+        return true;
+    }
+
+    unsigned short ll;
+    short numshares;
+    m_off_t s;
+
+    s = type ? -type : size;
 
     d->append((char*)&s, sizeof s);
 
@@ -729,34 +1284,132 @@ SymmCipher* Node::nodecipher()
 // decrypt attributes and build attribute hash
 void Node::setattr()
 {
-    byte* buf;
     SymmCipher* cipher;
+    attr_map map;
+
+    if (attrstring && (cipher = nodecipher()) && decryptattrs(*cipher, map))
+    {
+        setattrs(std::move(map));
+    }
+}
+
+bool Node::decryptattrs(SymmCipher& cipher, attr_map& map) const
+{
+    byte* buf;
 
-    if (attrstring && (cipher = nodecipher()) && (buf = decryptattr(cipher, attrstring->c_str(), attrstring->size())))
+    if (!attrstring || !(buf = decryptattr(&cipher, attrstring->c_str(), attrstring->size())))
     {
-        JSON json;
-        nameid name;
-        string* t;
+        return false;
+    }
 
-        attrs.map.clear();
-        json.begin((char*)buf + 5);
+    JSON json;
+    nameid name;
+    string* t;
+
+    json.begin((char*)buf + 5);
+
+    while ((name = json.getnameid()) != EOO && json.storeobject((t = &map[name])))
+    {
+        JSON::unescape(t);
 
-        while ((name = json.getnameid()) != EOO && json.storeobject((t = &attrs.map[name])))
+        if (name == 'n')
         {
-            JSON::unescape(t);
+            client->fsaccess->normalize(t);
+        }
+    }
+
+    delete[] buf;
+    return true;
+}
+
+void Node::setattrs(attr_map&& map)
+{
+    attrs.map = std::move(map);
+
+    setfingerprint();
+
+    attrstring.reset();
+
+    attrschanged();
+}
+
+// keep the lookups that depend on the node's attributes up to date
+void Node::attrschanged()
+{
+    if (parent)
+    {
+        parent->children.nameChanged(this);
+    }
+
+    client->mFingerprints.updateoriginal(this);
+
+#ifdef ENABLE_SEARCH_INDEX
+    client->updatesearchindex(this);
+#endif
+
+    dropsnapshot();
+}
+
+void Node::dropsnapshot()
+{
+    std::atomic_store(&apisnapshot, std::shared_ptr<const MegaNodeSnapshot>());
+    delete mSortKeys.exchange(nullptr);
+}
 
-            if (name == 'n')
+const NodeSortKeys& Node::sortkeys() const
+{
+    const NodeSortKeys* keys = mSortKeys.load(std::memory_order_acquire);
+    if (!keys)
+    {
+        std::unique_ptr<const NodeSortKeys> built(new NodeSortKeys(*this));
+        if (mSortKeys.compare_exchange_strong(keys, built.get(), std::memory_order_acq_rel))
+        {
+            keys = built.release();
+        }
+    }
+    return *keys;
+}
+
+NodeSortKeys::NodeSortKeys(const Node& node)
+{
+    // case is ignored (ASCII only, like strncasecmp), and each run of digits sorts by its value:
+    // before any other character, then by the count of digits without leading zeros, then digit by digit
+    for (const char *c = node.displayname(); *c; )
+    {
+        if (*c >= '0' && *c <= '9')
+        {
+            while (*c == '0' && c[1] >= '0' && c[1] <= '9')
             {
-                client->fsaccess->normalize(t);
+                c++;
             }
-        }
 
-        setfingerprint();
+            const char *digits = c;
+            while (*c >= '0' && *c <= '9')
+            {
+                c++;
+            }
 
-        delete[] buf;
+            name += '\x01';
+            name += char(std::min<ptrdiff_t>(c - digits, 255));
+            name.append(digits, size_t(c - digits));
+        }
+        else
+        {
+            name += '\x02';
+            name += (*c >= 'A' && *c <= 'Z') ? char(*c - 'A' + 'a') : *c;
+            c++;
+        }
+    }
 
-        attrstring.reset();
+    auto it = node.attrs.map.find(AttrMap::string2nameid("lbl"));
+    if (it != node.attrs.map.end())
+    {
+        label = std::atoi(it->second.c_str());
     }
+
+    favourite = node.attrs.map.find(AttrMap::string2nameid("fav")) != node.attrs.map.end();
+
+    node.client->nodeIsMedia(&node, &photo, &video);
 }
 
 // if present, configure FileFingerprint from attributes
@@ -883,135 +1536,405 @@ string Node::displaypath() const
         }
         path.insert(0, "/");
     }
-    return path;
+    return path;
+}
+
+// returns position of file attribute or 0 if not present
+int Node::hasfileattribute(fatype t) const
+{
+    return Node::hasfileattribute(&fileattrstring, t);
+}
+
+int Node::hasfileattribute(const string *fileattrstring, fatype t)
+{
+    char buf[24];
+
+    sprintf(buf, ":%u*", t);
+    return static_cast<int>(fileattrstring->find(buf) + 1);
+}
+
+// attempt to apply node key - sets nodekey to a raw key if successful
+bool Node::applykey()
+{
+    if (type > FOLDERNODE)
+    {
+        //Root nodes contain an empty attrstring
+        attrstring.reset();
+    }
+
+    SymmCipher* sc;
+    const char* k = keytoapply(&sc);
+    if (!k)
+    {
+        return false;
+    }
+
+    byte key[FILENODEKEYLENGTH];
+    unsigned keylength = (type == FILENODE) ? FILENODEKEYLENGTH : FOLDERNODEKEYLENGTH;
+
+    if (client->decryptkey(k, key, keylength, sc, 0, nodehandle))
+    {
+        setappliedkey(key);
+        setattr();
+    }
+
+    assert(keyApplied());
+    return true;
+}
+
+const char* Node::keytoapply(SymmCipher** cipher)
+{
+    if (keyApplied() || !nodekeydata.size())
+    {
+        return NULL;
+    }
+
+    int l = -1;
+    size_t t = 0;
+    handle h;
+    const char* k = NULL;
+    SymmCipher* sc = &client->key;
+    handle me = client->loggedin() ? client->me : *client->rootnodes;
+
+    while ((t = nodekeydata.find_first_of(':', t)) != string::npos)
+    {
+        // compound key: locate suitable subkey (always symmetric)
+        h = 0;
+
+        l = Base64::atob(nodekeydata.c_str() + (nodekeydata.find_last_of('/', t) + 1), (byte*)&h, sizeof h);
+        t++;
+
+        if (l == MegaClient::USERHANDLE)
+        {
+            // this is a user handle - reject if it's not me
+            if (h != me)
+            {
+                continue;
+            }
+        }
+        else
+        {
+            // look for share key if not folder access with folder master key
+            if (h != me)
+            {
+                Node* n;
+
+                // this is a share node handle - check if we have node and the
+                // share key
+                if (!(n = client->nodebyhandle(h)) || !n->sharekey)
+                {
+                    continue;
+                }
+
+                sc = n->sharekey;
+
+                // this key will be rewritten when the node leaves the outbound share
+                foreignkey = true;
+            }
+        }
+
+        k = nodekeydata.c_str() + t;
+        break;
+    }
+
+    // no: found => personal key, use directly
+    // otherwise, no suitable key available yet - bail (it might arrive soon)
+    if (!k)
+    {
+        if (l < 0)
+        {
+            k = nodekeydata.c_str();
+        }
+        else
+        {
+            return NULL;
+        }
+    }
+
+    *cipher = sc;
+    return k;
+}
+
+void Node::setappliedkey(const byte* key)
+{
+    client->mAppliedKeyNodeCount++;
+    nodekeydata.assign((const char*)key, (type == FILENODE) ? FILENODEKEYLENGTH : FOLDERNODEKEYLENGTH);
+    dropsnapshot();
+}
+
+NodeCounter Node::subnodeCounts() const
+{
+    if (counter && type != FILENODE)
+    {
+        return *counter;
+    }
+
+    // a file, with its versions
+    NodeCounter nc;
+    for (Node *child : children)
+    {
+        nc += child->subnodeCounts();
+    }
+    if (type == FILENODE)
+    {
+        nc.files += 1;
+        nc.storage += size;
+        if (parent && parent->type == FILENODE)
+        {
+            nc.versions += 1;
+            nc.versionStorage += size;
+        }
+        if (counter)
+        {
+            nc += *counter;
+        }
+    }
+    else if (type == FOLDERNODE)
+    {
+        nc.folders += 1;
+    }
+    return nc;
+}
+
+void Node::lazyversion(m_off_t versionsize, bool add)
+{
+    assert(type == FILENODE);
+
+    NodeCounter nc;
+    nc.files = 1;
+    nc.storage = versionsize;
+    nc.versions = 1;
+    nc.versionStorage = versionsize;
+
+    if (!counter)
+    {
+        counter.reset(new NodeCounter);
+    }
+
+    if (add)
+    {
+        *counter += nc;
+    }
+    else
+    {
+        *counter -= nc;
+    }
+
+    updateancestorcounters(parent, nc, add);
+
+    const Node* fa = firstancestor();
+    handle ancestor = fa->nodehandle;
+    if (ancestor == client->rootnodes[0] || ancestor == client->rootnodes[1] || ancestor == client->rootnodes[2] || fa->inshare)
+    {
+        if (add)
+        {
+            client->mNodeCounters[ancestor] += nc;
+        }
+        else
+        {
+            client->mNodeCounters[ancestor] -= nc;
+        }
+    }
+}
+
+NodeChildren::~NodeChildren() = default;
+
+Node* NodeChildren::back() const
+{
+    for (auto i = mNodes.size(); i--; )
+    {
+        if (mNodes[i])
+        {
+            return mNodes[i];
+        }
+    }
+    return nullptr;
+}
+
+void NodeChildren::push_back(Node* n)
+{
+    if (mErased > 16 && mErased * 2 > mNodes.size())
+    {
+        compact();
+    }
+
+    n->child_index = mNodes.size();
+    mNodes.push_back(n);
+
+    if (n->type == FILENODE)
+    {
+        mFiles++;
+    }
+
+    if (mNameIndex)
+    {
+        indexname(n);
+    }
+}
+
+void NodeChildren::erase(Node* n)
+{
+    assert(n->child_index < mNodes.size() && mNodes[n->child_index] == n);
+
+    if (mNameIndex)
+    {
+        unindexname(n);
+    }
+
+    if (n->type == FILENODE)
+    {
+        mFiles--;
+    }
+
+    // never shrink here, so that iterators (including end()) stay valid while erasing
+    mNodes[n->child_index] = nullptr;
+    mErased++;
 }
 
-// returns position of file attribute or 0 if not present
-int Node::hasfileattribute(fatype t) const
+void NodeChildren::compact()
 {
-    return Node::hasfileattribute(&fileattrstring, t);
+    size_t j = 0;
+    for (size_t i = 0; i < mNodes.size(); i++)
+    {
+        if (Node* n = mNodes[i])
+        {
+            n->child_index = j;
+            mNodes[j++] = n;
+        }
+    }
+    mNodes.resize(j);
+    mNodes.shrink_to_fit();
+    mErased = 0;
 }
 
-int Node::hasfileattribute(const string *fileattrstring, fatype t)
+// same as Node::displayname(), without the logging for undecrypted/unnamed nodes.
+// Undecrypted nodes are not indexed (they get indexed once setattr() decrypts them).
+static const char* indexablename(const Node* n)
 {
-    char buf[24];
+    if (n->attrstring)
+    {
+        return nullptr;
+    }
 
-    sprintf(buf, ":%u*", t);
-    return static_cast<int>(fileattrstring->find(buf) + 1);
+    auto it = n->attrs.map.find('n');
+    if (it == n->attrs.map.end())
+    {
+        return "CRYPTO_ERROR";
+    }
+
+    return it->second.empty() ? "BLANK" : it->second.c_str();
 }
 
-// attempt to apply node key - sets nodekey to a raw key if successful
-bool Node::applykey()
+static size_t namehash(const char* name)
 {
-    if (type > FOLDERNODE)
+    // FNV-1a
+    size_t h = size_t(14695981039346656037ULL);
+    while (*name)
     {
-        //Root nodes contain an empty attrstring
-        attrstring.reset();
+        h = (h ^ (unsigned char)*name++) * size_t(1099511628211ULL);
     }
+    return h;
+}
 
-    if (keyApplied() || !nodekeydata.size())
+void NodeChildren::indexname(Node* n)
+{
+    if (const char* name = indexablename(n))
     {
-        return false;
+        size_t h = namehash(name);
+        mNameIndex->nodes.emplace(h, n);
+        mNameIndex->hashes[n] = h;
     }
+}
 
-    int l = -1;
-    size_t t = 0;
-    handle h;
-    const char* k = NULL;
-    SymmCipher* sc = &client->key;
-    handle me = client->loggedin() ? client->me : *client->rootnodes;
-
-    while ((t = nodekeydata.find_first_of(':', t)) != string::npos)
+void NodeChildren::unindexname(Node* n)
+{
+    auto hit = mNameIndex->hashes.find(n);
+    if (hit == mNameIndex->hashes.end())
     {
-        // compound key: locate suitable subkey (always symmetric)
-        h = 0;
-
-        l = Base64::atob(nodekeydata.c_str() + (nodekeydata.find_last_of('/', t) + 1), (byte*)&h, sizeof h);
-        t++;
+        return;
+    }
 
-        if (l == MegaClient::USERHANDLE)
+    auto range = mNameIndex->nodes.equal_range(hit->second);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (it->second == n)
         {
-            // this is a user handle - reject if it's not me
-            if (h != me)
-            {
-                continue;
-            }
+            mNameIndex->nodes.erase(it);
+            break;
         }
-        else
-        {
-            // look for share key if not folder access with folder master key
-            if (h != me)
-            {
-                Node* n;
+    }
+    mNameIndex->hashes.erase(hit);
+}
 
-                // this is a share node handle - check if we have node and the
-                // share key
-                if (!(n = client->nodebyhandle(h)) || !n->sharekey)
-                {
-                    continue;
-                }
+void NodeChildren::nameChanged(Node* n)
+{
+    if (mNameIndex)
+    {
+        unindexname(n);
+        indexname(n);
+    }
+}
 
-                sc = n->sharekey;
+node_vector NodeChildren::byname(const char* name)
+{
+    node_vector found;
 
-                // this key will be rewritten when the node leaves the outbound share
-                foreignkey = true;
-            }
+    if (!mNameIndex && size() >= NAMEINDEXTHRESHOLD)
+    {
+        mNameIndex.reset(new NameIndex);
+        mNameIndex->nodes.reserve(size());
+        mNameIndex->hashes.reserve(size());
+        for (Node* n : *this)
+        {
+            indexname(n);
         }
-
-        k = nodekeydata.c_str() + t;
-        break;
     }
 
-    // no: found => personal key, use directly
-    // otherwise, no suitable key available yet - bail (it might arrive soon)
-    if (!k)
+    if (!mNameIndex)
     {
-        if (l < 0)
-        {
-            k = nodekeydata.c_str();
-        }
-        else
+        for (Node* n : *this)
         {
-            return false;
+            if (!strcmp(name, n->displayname()))
+            {
+                found.push_back(n);
+            }
         }
+        return found;
     }
 
-    byte key[FILENODEKEYLENGTH];
-    unsigned keylength = (type == FILENODE) ? FILENODEKEYLENGTH : FOLDERNODEKEYLENGTH;
-
-    if (client->decryptkey(k, key, keylength, sc, 0, nodehandle))
+    auto range = mNameIndex->nodes.equal_range(namehash(name));
+    for (auto it = range.first; it != range.second; ++it)
     {
-        client->mAppliedKeyNodeCount++;
-        nodekeydata.assign((const char*)key, keylength);
-        setattr();
+        if (!strcmp(name, indexablename(it->second)))
+        {
+            found.push_back(it->second);
+        }
     }
 
-    assert(keyApplied());
-    return true;
+    // keep the same order a scan of the children would give
+    std::sort(found.begin(), found.end(), [](const Node* a, const Node* b) { return a->child_index < b->child_index; });
+    return found;
 }
 
-NodeCounter Node::subnodeCounts() const
+void Node::detachremoved()
 {
-    NodeCounter nc;
-    for (Node *child : children)
-    {
-        nc += child->subnodeCounts();
-    }
-    if (type == FILENODE)
+    assert(changed.removed);
+
+    NodeCounter nc = subnodeCounts();
+
+    const Node* fa = firstancestor();
+    handle ancestor = fa->nodehandle;
+    if (ancestor == client->rootnodes[0] || ancestor == client->rootnodes[1] || ancestor == client->rootnodes[2] || fa->inshare)
     {
-        nc.files += 1;
-        nc.storage += size;
-        if (parent && parent->type == FILENODE)
-        {
-            nc.versions += 1;
-            nc.versionStorage += size;
-        }
+        client->mNodeCounters[ancestor] -= nc;
     }
-    else if (type == FOLDERNODE)
+
+    if (parent)
     {
-        nc.folders += 1;
+        updateancestorcounters(parent, nc, false);
+        parent->children.erase(this);
+        parent = nullptr;
     }
-    return nc;
 }
 
 // returns whether node was moved
@@ -1022,23 +1945,21 @@ bool Node::setparent(Node* p)
         return false;
     }
 
-    NodeCounter nc;
-    bool gotnc = false;
+    // recomputed after the move: whether a file counts as a version depends on its parent
+    NodeCounter nc = subnodeCounts();
 
     const Node *originalancestor = firstancestor();
     handle oah = originalancestor->nodehandle;
     if (oah == client->rootnodes[0] || oah == client->rootnodes[1] || oah == client->rootnodes[2] || originalancestor->inshare)
     {
-        nc = subnodeCounts();
-        gotnc = true;
-
         // nodes moving from cloud drive to rubbish for example, or between inshares from the same user.
         client->mNodeCounters[oah] -= nc;
     }
 
     if (parent)
     {
-        parent->children.erase(child_it);
+        updateancestorcounters(parent, nc, false);
+        parent->children.erase(this);
     }
 
 #ifdef ENABLE_SYNC
@@ -1047,20 +1968,18 @@ bool Node::setparent(Node* p)
 
     parent = p;
 
+    nc = subnodeCounts();
+
     if (parent)
     {
-        child_it = parent->children.insert(parent->children.end(), this);
+        parent->children.push_back(this);
+        updateancestorcounters(parent, nc, true);
     }
 
     const Node* newancestor = firstancestor();
     handle nah = newancestor->nodehandle;
     if (nah == client->rootnodes[0] || nah == client->rootnodes[1] || nah == client->rootnodes[2] || newancestor->inshare)
     {
-        if (!gotnc)
-        {
-            nc = subnodeCounts();
-        }
-
         client->mNodeCounters[nah] += nc;
     }
 
@@ -1193,14 +2112,34 @@ void LocalNode::setnameparent(LocalNode* newparent, const LocalPath* newlocalpat
     int nc = 0;
     Sync* oldsync = NULL;
 
+    // a move or a rename: the states for the overlay icons go to the new paths
+    LocalPath oldpath;
+    Sync* statesync = sync;
+    if (parent && newparent && !sync->mDestructorRunning)
+    {
+        getlocalpath(oldpath);
+    }
+
     if (parent)
     {
         // remove existing child linkage
         parent->children.erase(&localname);
 
+        if (!sync->mDestructorRunning)
+        {
+            parent->setsyncdirty();
+        }
+
         if (slocalname)
         {
-            parent->schildren.erase(slocalname.get());
+            if (parent->schildren)
+            {
+                parent->schildren->erase(slocalname.get());
+                if (parent->schildren->empty())
+                {
+                    parent->schildren.reset();
+                }
+            }
             slocalname.reset();
         }
     }
@@ -1290,17 +2229,31 @@ void LocalNode::setnameparent(LocalNode* newparent, const LocalPath* newlocalpat
 
         // (we don't construct a UTF-8 or sname for the root path)
         parent->children[&localname] = this;
+        parent->setsyncdirty();
 
         if (newshortname && *newshortname != localname)
         {
             slocalname = std::move(newshortname);
-            parent->schildren[slocalname.get()] = this;
+            if (!parent->schildren)
+            {
+                parent->schildren.reset(new localnode_map);
+            }
+            (*parent->schildren)[slocalname.get()] = this;
         }
         else
         {
             slocalname.reset();
         }
 
+        if (!oldpath.empty())
+        {
+            LocalPath newpath = getLocalPath();
+            if (newpath != oldpath)
+            {
+                sync->client->syncs.treestates.moved(statesync, *this, oldpath, newpath);
+            }
+        }
+
         treestate(TREESTATE_NONE);
 
         if (todelete)
@@ -1347,6 +2300,53 @@ void LocalNode::bumpnagleds()
     nagleds = sync->client->waiter->ds + 11;
 }
 
+void LocalNode::setsyncdirty()
+{
+    LocalNode* l = type == FOLDERNODE ? this : parent;
+
+    if (l)
+    {
+        l->syncdowndirty = true;
+        l->syncupdirty = true;
+
+        // the folders above have their subtree flags already if this one has
+        for (; l && !(l->syncdownsubtree && l->syncupsubtree); l = l->parent)
+        {
+            l->syncdownsubtree = true;
+            l->syncupsubtree = true;
+        }
+    }
+}
+
+// subtree is dirty or set on any child folder (those not visited by the pass keep theirs)
+static void endsyncpass(LocalNode* l, bool LocalNode::*dirty, bool LocalNode::*subtree)
+{
+    l->*subtree = l->*dirty;
+
+    for (localnode_map::iterator it = l->children.begin(); !(l->*subtree) && it != l->children.end(); it++)
+    {
+        l->*subtree = it->second->type == FOLDERNODE && it->second->*subtree;
+    }
+
+    if (l->*subtree)
+    {
+        for (LocalNode* p = l->parent; p && !(p->*subtree); p = p->parent)
+        {
+            p->*subtree = true;
+        }
+    }
+}
+
+void LocalNode::endsyncdown()
+{
+    endsyncpass(this, &LocalNode::syncdowndirty, &LocalNode::syncdownsubtree);
+}
+
+void LocalNode::endsyncup()
+{
+    endsyncpass(this, &LocalNode::syncupdirty, &LocalNode::syncupsubtree);
+}
+
 LocalNode::LocalNode()
 : deleted{false}
 , created{false}
@@ -1391,7 +2391,7 @@ void LocalNode::init(Sync* csync, nodetype_t ctype, LocalNode* cparent, const Lo
     scanseqno = sync->scanseqno;
 
     // mark fsid as not valid
-    fsid_it = sync->client->fsidnode.end();
+    fsid_mapped = false;
 
     // enable folder notification
     if (type == FOLDERNODE)
@@ -1423,6 +2423,7 @@ void LocalNode::treestate(treestate_t newts)
     if (ts != dts)
     {
         sync->client->app->syncupdate_treestate(this);
+        sync->client->syncs.treestates.set(*this, ts);
     }
 
     if (parent && ((newts == TREESTATE_NONE && ts != TREESTATE_NONE)
@@ -1473,6 +2474,12 @@ void LocalNode::setnode(Node* cnode)
 {
     deleted = false;
 
+    // a folder linked to another Node has other remote children to compare with
+    if (type == FOLDERNODE && node != cnode)
+    {
+        setsyncdirty();
+    }
+
     node.reset();
     if (cnode)
     {
@@ -1521,28 +2528,28 @@ void LocalNode::setfsid(handle newfsid, handlelocalnode_map& fsidnodes)
         return;
     }
 
-    if (fsid_it != fsidnodes.end())
+    if (fsid_mapped)
     {
         if (newfsid == fsid)
         {
             return;
         }
 
-        fsidnodes.erase(fsid_it);
+        fsidnodes.erase(fsid);
     }
 
     fsid = newfsid;
 
     pair<handlelocalnode_map::iterator, bool> r = fsidnodes.insert(std::make_pair(fsid, this));
 
-    fsid_it = r.first;
-
     if (!r.second)
     {
         // remove previous fsid assignment (the node is likely about to be deleted)
-        fsid_it->second->fsid_it = fsidnodes.end();
-        fsid_it->second = this;
+        r.first->second->fsid_mapped = false;
+        r.first->second = this;
     }
+
+    fsid_mapped = true;
 }
 
 LocalNode::~LocalNode()
@@ -1583,9 +2590,9 @@ LocalNode::~LocalNode()
     }
 
     // remove from fsidnode map, if present
-    if (fsid_it != sync->client->fsidnode.end())
+    if (fsid_mapped)
     {
-        sync->client->fsidnode.erase(fsid_it);
+        sync->client->fsidnode.erase(fsid);
     }
 
     sync->client->totalLocalNodes--;
@@ -1604,6 +2611,23 @@ LocalNode::~LocalNode()
         }
     }
 
+    // the states of this subtree for the overlay icons (a LocalNode deleted with its folder went
+    // with it, as its path is no longer complete)
+    if (parent && !sync->mDestructorRunning)
+    {
+        const LocalNode* top = this;
+        while (top->parent)
+        {
+            top = top->parent;
+        }
+
+        if (top == sync->localroot.get())
+        {
+            LocalPath path = getLocalPath();
+            sync->client->syncs.treestates.erase(*this, path);
+        }
+    }
+
     // remove parent association
     if (parent)
     {
@@ -1653,14 +2677,27 @@ void LocalNode::getlocalpath(LocalPath& path) const
     }
 
     path.erase();
+    appendlocalpath(path, 0);
+}
 
-    for (const LocalNode* l = this; l != nullptr; l = l->parent)
-    {
-        assert(!l->parent || l->parent->sync == sync);
+void LocalNode::appendlocalpath(LocalPath& path, size_t length) const
+{
+    assert(!parent || parent->sync == sync);
+
+    // the name and a separator
+    length += localname.length() + 1;
 
-        // sync root has absolute path, the rest are just their leafname
-        path.prependWithSeparator(l->localname);
+    if (parent)
+    {
+        parent->appendlocalpath(path, length);
+    }
+    else
+    {
+        path.reserve(length);
     }
+
+    // sync root has absolute path, the rest are just their leafname
+    path.appendWithSeparator(localname, false);
 }
 
 string LocalNode::localnodedisplaypath(FileSystemAccess& fsa) const
@@ -1673,14 +2710,28 @@ string LocalNode::localnodedisplaypath(FileSystemAccess& fsa) const
 // locate child by localname or slocalname
 LocalNode* LocalNode::childbyname(LocalPath* localname)
 {
-    localnode_map::iterator it;
-
-    if (!localname || ((it = children.find(localname)) == children.end() && (it = schildren.find(localname)) == schildren.end()))
+    if (!localname)
     {
         return NULL;
     }
 
-    return it->second;
+    localnode_map::iterator it = children.find(localname);
+    if (it != children.end())
+    {
+        return it->second;
+    }
+
+    if (schildren && (it = schildren->find(localname)) != schildren->end())
+    {
+        return it->second;
+    }
+
+    return NULL;
+}
+
+transferclass_t LocalNode::transferclass() const
+{
+    return sync && sync->getConfig().getType() == SyncConfig::TYPE_BACKUP ? TRANSFERCLASS_BACKUP : TRANSFERCLASS_SYNC;
 }
 
 void LocalNode::prepare()
@@ -1699,6 +2750,7 @@ void LocalNode::prepare()
 void LocalNode::terminated()
 {
     sync->mUnifiedSync.mNextHeartbeat->adjustTransferCounts(-1, 0, size, 0);
+    sync->uploadended();
 
     File::terminated();
 }
@@ -1708,6 +2760,7 @@ void LocalNode::terminated()
 void LocalNode::completed(Transfer* t, LocalNode*)
 {
     sync->mUnifiedSync.mNextHeartbeat->adjustTransferCounts(-1, 0, 0, size);
+    sync->uploadended();
 
     // complete to rubbish for later retrieval if the parent node does not
     // exist or is newer
@@ -1816,7 +2869,7 @@ LocalNode* LocalNode::unserialize(Sync* sync, const string* d)
     l->parent_dbid = parent_dbid;
 
     l->fsid = fsid;
-    l->fsid_it = sync->client->fsidnode.end();
+    l->fsid_mapped = false;
 
     l->localname = LocalPath::fromPlatformEncoded(localname);
     l->slocalname.reset(shortname.empty() ? nullptr : new LocalPath(LocalPath::fromPlatformEncoded(shortname)));
@@ -1873,6 +2926,8 @@ void Fingerprints::clear()
 {
     mFingerprints.clear();
     mSumSizes = 0;
+    mOriginalFingerprints.clear();
+    mOriginalFingerprintNodes.clear();
 }
 
 m_off_t Fingerprints::getSumSizes()
@@ -1897,4 +2952,80 @@ node_vector *Fingerprints::nodesbyfingerprint(FileFingerprint* fingerprint)
     return nodes;
 }
 
+void Fingerprints::updateoriginal(Node* n)
+{
+    if (n->type != FILENODE)
+    {
+        return;
+    }
+
+    auto a = n->attrs.map.find(MAKENAMEID2('c', '0'));
+    auto it = mOriginalFingerprintNodes.find(n);
+
+    if (it != mOriginalFingerprintNodes.end())
+    {
+        if (a != n->attrs.map.end() && it->second->first == a->second)
+        {
+            return;
+        }
+
+        mOriginalFingerprints.erase(it->second);
+        mOriginalFingerprintNodes.erase(it);
+    }
+
+    if (a != n->attrs.map.end())
+    {
+        mOriginalFingerprintNodes[n] = mOriginalFingerprints.emplace(a->second, n);
+    }
+}
+
+void Fingerprints::removeoriginal(Node* n)
+{
+    auto it = mOriginalFingerprintNodes.find(n);
+    if (it != mOriginalFingerprintNodes.end())
+    {
+        mOriginalFingerprints.erase(it->second);
+        mOriginalFingerprintNodes.erase(it);
+    }
+}
+
+void Fingerprints::nodesbyoriginalfingerprint(const char* originalfingerprint, node_vector& nv) const
+{
+    auto p = mOriginalFingerprints.equal_range(originalfingerprint);
+    for (auto it = p.first; it != p.second; ++it)
+    {
+        nv.push_back(it->second);
+    }
+}
+
+bool CtimeIndex::NodeCtimeCmp::operator()(const Node* a, const Node* b) const
+{
+    if (a->ctime != b->ctime)
+    {
+        return a->ctime > b->ctime;
+    }
+    return a->nodehandle < b->nodehandle;
+}
+
+void CtimeIndex::add(Node* n)
+{
+    if (n->type == FILENODE)
+    {
+        mNodes.insert(n);
+    }
+}
+
+void CtimeIndex::remove(Node* n)
+{
+    if (n->type == FILENODE)
+    {
+        mNodes.erase(n);
+    }
+}
+
+void CtimeIndex::clear()
+{
+    mNodes.clear();
+}
+
 } // namespace
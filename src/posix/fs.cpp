@@ -82,8 +82,10 @@ extern JavaVM *MEGAjvm;
 #endif /* __linux__ */
 
 #if defined(__APPLE__) || defined(USE_IOS)
+#include <sys/attr.h>
 #include <sys/mount.h>
 #include <sys/param.h>
+#include <sys/vnode.h>
 #endif /* __APPLE__ || USE_IOS */
 
 namespace mega {
@@ -161,10 +163,12 @@ int platformCompareUtf(const LocalPath& p1, bool unescape1, const LocalPath& p2,
     return compareUtf(p1, unescape1, p2, unescape2, false);
 }
 
-#ifdef HAVE_AIO_RT
+#if defined(HAVE_AIO_RT) || defined(HAVE_LIBURING)
 PosixAsyncIOContext::PosixAsyncIOContext() : AsyncIOContext()
 {
+#ifdef HAVE_AIO_RT
     aiocb = NULL;
+#endif
 }
 
 PosixAsyncIOContext::~PosixAsyncIOContext()
@@ -175,17 +179,173 @@ PosixAsyncIOContext::~PosixAsyncIOContext()
 
 void PosixAsyncIOContext::finish()
 {
-    if (aiocb)
+    // an operation queued on the io_uring has no aiocb
+    if (!finished && op != AsyncIOContext::NONE)
+    {
+        LOG_debug << "Synchronously waiting for async operation";
+        AsyncIOContext::finish();
+    }
+#ifdef HAVE_AIO_RT
+    delete aiocb;
+    aiocb = NULL;
+#endif
+    assert(finished || op == AsyncIOContext::NONE);
+}
+#endif
+
+#ifdef HAVE_LIBURING
+PosixIoUring* PosixIoUring::instance()
+{
+    static PosixIoUring ring;
+    static bool available = ring.init();
+    return available ? &ring : nullptr;
+}
+
+bool PosixIoUring::init()
+{
+    int e = io_uring_queue_init(ENTRIES, &mRing, 0);
+    if (e < 0)
+    {
+        LOG_warn << "io_uring not available, using AIO: " << -e;
+        return false;
+    }
+
+    mReaper = std::thread([this]()
+    {
+        ThreadConfig::apply(THREAD_ROLE_BACKGROUND);
+        reap();
+    });
+    LOG_debug << "Async file I/O through io_uring";
+    return true;
+}
+
+PosixIoUring::~PosixIoUring()
+{
+    if (!mReaper.joinable())
+    {
+        return;
+    }
+
+    // a NOP without a context stops the reaper, after the completions queued before it
+    {
+        std::lock_guard<std::mutex> g(mSubmitMutex);
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&mRing);
+        if (!sqe)
+        {
+            io_uring_submit(&mRing);
+            sqe = io_uring_get_sqe(&mRing);
+        }
+        assert(sqe);
+        io_uring_prep_nop(sqe);
+        io_uring_sqe_set_data(sqe, nullptr);
+        io_uring_submit(&mRing);
+    }
+
+    mReaper.join();
+    io_uring_queue_exit(&mRing);
+}
+
+void PosixIoUring::submit(int fd, AsyncIOContext* context)
+{
+    int e;
+    {
+        std::lock_guard<std::mutex> g(mSubmitMutex);
+
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&mRing);
+        if (!sqe)
+        {
+            // the submission queue is full of entries the kernel hasn't taken yet
+            io_uring_submit(&mRing);
+            sqe = io_uring_get_sqe(&mRing);
+        }
+
+        if (sqe)
+        {
+            if (context->op == AsyncIOContext::READ)
+            {
+                io_uring_prep_read(sqe, fd, context->dataBuffer, context->dataBufferLen, context->posOfBuffer);
+            }
+            else
+            {
+                io_uring_prep_write(sqe, fd, context->dataBuffer, context->dataBufferLen, context->posOfBuffer);
+            }
+            io_uring_sqe_set_data(sqe, context);
+
+            e = io_uring_submit(&mRing);
+        }
+        else
+        {
+            e = -EAGAIN;
+        }
+    }
+
+    if (e < 0)
+    {
+        LOG_warn << "Async " << (context->op == AsyncIOContext::READ ? "read" : "write") << " failed at startup: " << -e;
+        complete(context, e);
+    }
+}
+
+void PosixIoUring::reap()
+{
+    for (;;)
     {
-        if (!finished)
+        struct io_uring_cqe* cqe;
+        int e = io_uring_wait_cqe(&mRing, &cqe);
+        if (e == -EINTR)
+        {
+            continue;
+        }
+        if (e < 0)
+        {
+            LOG_err << "Error waiting for io_uring completions: " << -e;
+            return;
+        }
+
+        AsyncIOContext* context = static_cast<AsyncIOContext*>(io_uring_cqe_get_data(cqe));
+        int result = cqe->res;
+        io_uring_cqe_seen(&mRing, cqe);
+
+        if (!context)
         {
-            LOG_debug << "Synchronously waiting for async operation";
-            AsyncIOContext::finish();
+            return;
         }
-        delete aiocb;
-        aiocb = NULL;
+        complete(context, result);
+    }
+}
+
+void PosixIoUring::complete(AsyncIOContext* context, int result)
+{
+    // a short transfer (a regular file that got truncated, or a full disk) is failed rather
+    // than taken for the whole buffer, and retried
+    context->retry = result == -EAGAIN || (result >= 0 && unsigned(result) < context->dataBufferLen);
+    context->failed = result < 0 || unsigned(result) < context->dataBufferLen;
+    if (!context->failed)
+    {
+        auto posixContext = dynamic_cast<PosixAsyncIOContext*>(context);
+        if (context->op == AsyncIOContext::READ && posixContext && posixContext->readoncefd >= 0)
+        {
+            PosixFileAccess::readdone(posixContext->readoncefd, context->posOfBuffer, context->dataBufferLen);
+        }
+
+        if (context->op == AsyncIOContext::READ && context->pad)
+        {
+            memset(context->dataBuffer + context->dataBufferLen, 0, context->pad);
+        }
+        LOG_verbose << "Async " << (context->op == AsyncIOContext::READ ? "read" : "write") << " finished OK";
+    }
+    else
+    {
+        LOG_warn << "Async operation finished with error: " << (result < 0 ? -result : 0);
+    }
+
+    asyncfscallback userCallback = context->userCallback;
+    void *userData = context->userData;
+    context->finished = true;
+    if (userCallback)
+    {
+        userCallback(userData);
     }
-    assert(finished);
 }
 #endif
 
@@ -273,7 +433,37 @@ bool PosixFileAccess::sysopen(bool)
     // this is ok: this is not called with mFollowSymLinks = false, but from transfers doio.
     // When fully supporting symlinks, this might need to be reassessed
 
-    return (fd = open(adjustBasePath(nonblocking_localname).c_str(), O_RDONLY)) >= 0;
+    if ((fd = open(adjustBasePath(nonblocking_localname).c_str(), O_RDONLY)) < 0)
+    {
+        return false;
+    }
+
+    if (mReadOnce)
+    {
+#ifdef POSIX_FADV_SEQUENTIAL
+        // twice the read-ahead
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#elif defined(__APPLE__)
+        fcntl(fd, F_RDAHEAD, 1);
+        fcntl(fd, F_NOCACHE, 1);
+#endif
+    }
+    return true;
+}
+
+void PosixFileAccess::setreadonce()
+{
+    mReadOnce = true;
+}
+
+void PosixFileAccess::readdone(int fd, m_off_t pos, m_off_t len)
+{
+#ifdef POSIX_FADV_DONTNEED
+    // clean pages only, so the file's own writers lose nothing
+    posix_fadvise(fd, pos, len, POSIX_FADV_DONTNEED);
+#else
+    (void)fd; (void)pos; (void)len;
+#endif
 }
 
 void PosixFileAccess::sysclose()
@@ -288,6 +478,13 @@ void PosixFileAccess::sysclose()
 
 bool PosixFileAccess::asyncavailable()
 {
+#ifdef HAVE_LIBURING
+    if (PosixIoUring::instance())
+    {
+        return true;
+    }
+#endif
+
 #ifdef HAVE_AIO_RT
     #ifdef __APPLE__
         return false;
@@ -299,11 +496,14 @@ bool PosixFileAccess::asyncavailable()
 #endif
 }
 
-#ifdef HAVE_AIO_RT
+#if defined(HAVE_AIO_RT) || defined(HAVE_LIBURING)
 AsyncIOContext *PosixFileAccess::newasynccontext()
 {
     return new PosixAsyncIOContext();
 }
+#endif
+
+#ifdef HAVE_AIO_RT
 
 void PosixFileAccess::asyncopfinished(sigval sigev_value)
 {
@@ -315,6 +515,11 @@ void PosixFileAccess::asyncopfinished(sigval sigev_value)
     context->failed = (aio_return(aiocbp) < 0);
     if (!context->failed)
     {
+        if (context->op == AsyncIOContext::READ && context->readoncefd >= 0)
+        {
+            readdone(context->readoncefd, context->posOfBuffer, context->dataBufferLen);
+        }
+
         if (context->op == AsyncIOContext::READ && context->pad)
         {
             memset((void *)(((char *)(aiocbp->aio_buf)) + aiocbp->aio_nbytes), 0, context->pad);
@@ -342,7 +547,7 @@ void PosixFileAccess::asyncopfinished(sigval sigev_value)
 
 void PosixFileAccess::asyncsysopen(AsyncIOContext *context)
 {
-#ifdef HAVE_AIO_RT
+#if defined(HAVE_AIO_RT) || defined(HAVE_LIBURING)
     context->failed = !fopen(context->openPath, context->access & AsyncIOContext::ACCESS_READ,
                              context->access & AsyncIOContext::ACCESS_WRITE);
     context->retry = retry;
@@ -356,6 +561,22 @@ void PosixFileAccess::asyncsysopen(AsyncIOContext *context)
 
 void PosixFileAccess::asyncsysread(AsyncIOContext *context)
 {
+#if defined(HAVE_AIO_RT) || defined(HAVE_LIBURING)
+    auto readonceContext = dynamic_cast<PosixAsyncIOContext*>(context);
+    if (readonceContext && mReadOnce)
+    {
+        readonceContext->readoncefd = fd;
+    }
+#endif
+
+#ifdef HAVE_LIBURING
+    if (context && PosixIoUring::instance())
+    {
+        PosixIoUring::instance()->submit(fd, context);
+        return;
+    }
+#endif
+
 #ifdef HAVE_AIO_RT
     if (!context)
     {
@@ -405,6 +626,14 @@ void PosixFileAccess::asyncsysread(AsyncIOContext *context)
 
 void PosixFileAccess::asyncsyswrite(AsyncIOContext *context)
 {
+#ifdef HAVE_LIBURING
+    if (context && PosixIoUring::instance())
+    {
+        PosixIoUring::instance()->submit(fd, context);
+        return;
+    }
+#endif
+
 #ifdef HAVE_AIO_RT
     if (!context)
     {
@@ -466,11 +695,17 @@ bool PosixFileAccess::sysread(byte* dst, unsigned len, m_off_t pos)
 {
     retry = false;
 #ifndef __ANDROID__
-    return pread(fd, (char*)dst, len, pos) == len;
+    bool r = pread(fd, (char*)dst, len, pos) == len;
 #else
     lseek64(fd, pos, SEEK_SET);
-    return read(fd, (char*)dst, len) == len;
+    bool r = read(fd, (char*)dst, len) == len;
 #endif
+
+    if (r && mReadOnce)
+    {
+        readdone(fd, pos, len);
+    }
+    return r;
 }
 
 bool PosixFileAccess::fwrite(const byte* data, unsigned len, m_off_t pos)
@@ -499,6 +734,38 @@ bool PosixFileAccess::ftruncate()
     return false;
 }
 
+bool PosixFileAccess::fpreallocate(m_off_t size)
+{
+    retry = false;
+
+#ifdef __linux__
+    // not posix_fallocate(): where the filesystem can't, glibc would write the zeros itself
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) == 0)
+    {
+        return true;
+    }
+#elif defined(__APPLE__)
+    fstore_t store = { F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, size, 0 };
+    if (fcntl(fd, F_PREALLOCATE, &store) != -1)
+    {
+        return true;
+    }
+
+    // no contiguous extent that large: any will do
+    store.fst_flags = F_ALLOCATEALL;
+    if (fcntl(fd, F_PREALLOCATE, &store) != -1)
+    {
+        return true;
+    }
+#else
+    (void)size;
+    errno = EOPNOTSUPP;
+#endif
+
+    LOG_debug << "Unable to preallocate " << size << " bytes: " << errno;
+    return false;
+}
+
 int PosixFileAccess::stealFileDescriptor()
 {
     int toret = fd;
@@ -710,6 +977,15 @@ PosixFileSystemAccess::PosixFileSystemAccess(int fseventsfd)
     }
 #endif
 
+#ifdef MEGA_FANOTIFY
+    // (EPERM for the processes not allowed filesystem marks, EINVAL before Linux 5.9)
+    if ((fanotifyfd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_NONBLOCK | FAN_CLOEXEC,
+                                    O_RDONLY | O_LARGEFILE)) >= 0)
+    {
+        notifyfailed = false;
+    }
+#endif
+
 #ifdef __MACH__
 #if __LP64__
     typedef struct fsevent_clone_args {
@@ -788,6 +1064,13 @@ PosixFileSystemAccess::~PosixFileSystemAccess()
     {
         close(notifyfd);
     }
+
+#ifdef MEGA_FANOTIFY
+    if (fanotifyfd >= 0)
+    {
+        close(fanotifyfd);
+    }
+#endif
 }
 
 bool PosixFileSystemAccess::cwd(LocalPath& path) const
@@ -823,12 +1106,32 @@ void PosixFileSystemAccess::addevents(Waiter* w, int /*flags*/)
 
         pw->bumpmaxfd(notifyfd);
     }
+
+#ifdef MEGA_FANOTIFY
+    if (fanotifyfd >= 0)
+    {
+        PosixWaiter* pw = (PosixWaiter*)w;
+
+        MEGA_FD_SET(fanotifyfd, &pw->rfds);
+        MEGA_FD_SET(fanotifyfd, &pw->ignorefds);
+
+        pw->bumpmaxfd(fanotifyfd);
+    }
+#endif
 }
 
 // read all pending inotify events and queue them for processing
 int PosixFileSystemAccess::checkevents(Waiter* w)
 {
     int r = 0;
+
+#if defined(ENABLE_SYNC) && defined(MEGA_FANOTIFY)
+    if (fanotifyfd >= 0 && MEGA_FD_ISSET(fanotifyfd, &((PosixWaiter*)w)->rfds))
+    {
+        r |= checkfanotify();
+    }
+#endif
+
     if (notifyfd < 0)
     {
         return r;
@@ -990,7 +1293,7 @@ int PosixFileSystemAccess::checkevents(Waiter* w)
     char* paths[2];
     char* path;
     Sync* pathsync[2];
-    mega_fd_set_t rfds;
+    fd_set rfds;
     timeval tv = { 0, 0 };
     struct stat statbuf;
     static char rsrc[] = "/..namedfork/rsrc";
@@ -998,8 +1301,8 @@ int PosixFileSystemAccess::checkevents(Waiter* w)
 
     for (;;)
     {
-        MEGA_FD_ZERO(&rfds);
-        MEGA_FD_SET(notifyfd, &rfds);
+        FD_ZERO(&rfds);
+        FD_SET(notifyfd, &rfds);
 
         // ensure nonblocking behaviour
         if (select(notifyfd + 1, &rfds, NULL, NULL, &tv) <= 0) break;
@@ -1120,6 +1423,188 @@ int PosixFileSystemAccess::checkevents(Waiter* w)
     return r;
 }
 
+#ifdef MEGA_FANOTIFY
+static const uint64_t FANOTIFYMASK = FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO
+                                   | FAN_CLOSE_WRITE | FAN_ONDIR;
+
+// mark the filesystem of the sync (once for all of its syncs)
+bool PosixFileSystemAccess::fanotifyadd(PosixDirNotify* dn)
+{
+    struct statfs statfsbuf;
+
+    if (fanotifyfd < 0)
+    {
+        return false;
+    }
+
+    if ((dn->rootfd = open(dn->localbasepath.localpath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0
+     || fstatfs(dn->rootfd, &statfsbuf)
+     || fanotify_mark(fanotifyfd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FANOTIFYMASK, dn->rootfd, NULL) < 0)
+    {
+        // (EXDEV/ENODEV/EOPNOTSUPP for filesystems without file handles, such as FUSE or NFS)
+        LOG_debug << "Using inotify for " << dn->localbasepath.localpath << ". Error code: " << errno;
+
+        if (dn->rootfd >= 0)
+        {
+            close(dn->rootfd);
+            dn->rootfd = -1;
+        }
+        return false;
+    }
+
+    dn->fsid = statfsbuf.f_fsid;
+    dn->fanotify = true;
+    fanotifyroots.push_back(dn);
+
+    LOG_debug << "Using fanotify for " << dn->localbasepath.localpath;
+    return true;
+}
+
+void PosixFileSystemAccess::fanotifyremove(PosixDirNotify* dn)
+{
+    fanotifyroots.erase(std::remove(fanotifyroots.begin(), fanotifyroots.end(), dn), fanotifyroots.end());
+
+    if (fanlastroot == dn)
+    {
+        fanlastroot = nullptr;
+    }
+
+    // the mark stays while other syncs are in the same filesystem
+    bool shared = false;
+    for (PosixDirNotify* other : fanotifyroots)
+    {
+        shared |= !memcmp(&other->fsid, &dn->fsid, sizeof dn->fsid);
+    }
+
+    if (!shared)
+    {
+        fanotify_mark(fanotifyfd, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM, FANOTIFYMASK, dn->rootfd, NULL);
+    }
+
+    close(dn->rootfd);
+    dn->rootfd = -1;
+    dn->fanotify = false;
+}
+
+void PosixFileSystemAccess::fanotifynotify(PosixDirNotify* dn, const string& path)
+{
+    LOG_debug << "Filesystem notification. Root: " << dn->sync->localroot->name << "   Path: " << path;
+    dn->notify(DirNotify::DIREVENTS, dn->sync->localroot.get(), LocalPath::fromPlatformEncoded(path));
+}
+
+// read all pending fanotify events: each names the folder of the entry by handle, and the entry
+int PosixFileSystemAccess::checkfanotify()
+{
+    int r = 0;
+    alignas(fanotify_event_metadata) char buf[8192];
+    ssize_t len;
+    char procpath[32];
+    char dirpath[PATH_MAX];
+
+    while ((len = read(fanotifyfd, buf, sizeof buf)) > 0)
+    {
+        for (fanotify_event_metadata* m = (fanotify_event_metadata*)buf; FAN_EVENT_OK(m, len); m = FAN_EVENT_NEXT(m, len))
+        {
+            if (m->vers != FANOTIFY_METADATA_VERSION || (m->mask & FAN_Q_OVERFLOW))
+            {
+                notifyerr = true;
+                continue;
+            }
+
+            fanotify_event_info_fid* fid = (fanotify_event_info_fid*)(m + 1);
+            if ((char*)fid + sizeof *fid > (char*)m + m->event_len
+             || fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+            {
+                continue;
+            }
+
+            file_handle* fh = (file_handle*)fid->handle;
+            const char* name = (const char*)fh->f_handle + fh->handle_bytes;
+
+            // the path of the folder, opened through a sync in its filesystem (gone already
+            // if it was deleted too: that is notified in its own folder)
+            string path;
+            for (PosixDirNotify* dn : fanotifyroots)
+            {
+                if (!memcmp(&fid->fsid, &dn->fsid, sizeof dn->fsid))
+                {
+                    int fd = open_by_handle_at(dn->rootfd, fh, O_PATH | O_CLOEXEC);
+                    if (fd >= 0)
+                    {
+                        snprintf(procpath, sizeof procpath, "/proc/self/fd/%d", fd);
+                        ssize_t dirlen = readlink(procpath, dirpath, sizeof dirpath);
+                        if (dirlen > 0)
+                        {
+                            path.assign(dirpath, size_t(dirlen));
+                            if (strcmp(name, "."))
+                            {
+                                path.append(1, '/').append(name);
+                            }
+                        }
+                        close(fd);
+                    }
+                    break;
+                }
+            }
+
+            // the sync it is in, relative to its root, unless in the sync's local debris
+            PosixDirNotify* root = nullptr;
+            string relpath;
+            for (PosixDirNotify* dn : fanotifyroots)
+            {
+                const string& rootpath = dn->localbasepath.localpath;
+                const string& ignore = dn->ignore.localpath;
+
+                if (path.size() > rootpath.size() + 1
+                 && !path.compare(0, rootpath.size(), rootpath)
+                 && path[rootpath.size()] == '/')
+                {
+                    relpath = path.substr(rootpath.size() + 1);
+                    if (relpath.compare(0, ignore.size(), ignore)
+                     || (relpath.size() > ignore.size() && relpath[ignore.size()] != '/'))
+                    {
+                        root = dn;
+                    }
+                    break;
+                }
+            }
+
+            // a move is notified at its destination if in a sync, or at its source as a deletion
+            if (fanlastroot && !(root && (m->mask & FAN_MOVED_TO)))
+            {
+                fanotifynotify(fanlastroot, fanlastpath);
+                r |= Waiter::NEEDEXEC;
+            }
+            fanlastroot = nullptr;
+
+            if (root)
+            {
+                if (m->mask & FAN_MOVED_FROM)
+                {
+                    fanlastroot = root;
+                    fanlastpath = relpath;
+                }
+                else
+                {
+                    fanotifynotify(root, relpath);
+                    r |= Waiter::NEEDEXEC;
+                }
+            }
+        }
+    }
+
+    // as with inotify, the two events of a move are assumed to be read together
+    if (fanlastroot)
+    {
+        fanotifynotify(fanlastroot, fanlastpath);
+        fanlastroot = nullptr;
+        r |= Waiter::NEEDEXEC;
+    }
+
+    return r;
+}
+#endif
+
 // generate unique local filename in the same fs as relatedpath
 void PosixFileSystemAccess::tmpnamelocal(LocalPath& localname) const
 {
@@ -1821,9 +2306,26 @@ PosixDirNotify::PosixDirNotify(LocalPath& localbasepath, const LocalPath& ignore
     fsaccess = NULL;
 }
 
+#ifdef MEGA_FANOTIFY
+PosixDirNotify::~PosixDirNotify()
+{
+    if (fanotify)
+    {
+        fsaccess->fanotifyremove(this);
+    }
+}
+#endif
+
 void PosixDirNotify::addnotify(LocalNode* l, const LocalPath& path)
 {
 #ifdef ENABLE_SYNC
+#ifdef MEGA_FANOTIFY
+    if (fanotify)
+    {
+        return;
+    }
+#endif
+
 #ifdef USE_INOTIFY
     int wd;
 
@@ -1906,6 +2408,10 @@ DirNotify* PosixFileSystemAccess::newdirnotify(LocalPath& localpath, LocalPath&
 
     dirnotify->fsaccess = this;
 
+#ifdef MEGA_FANOTIFY
+    fanotifyadd(dirnotify);
+#endif
+
     return dirnotify;
 }
 
@@ -2101,6 +2607,159 @@ bool PosixDirAccess::dnext(LocalPath& path, LocalPath& name, bool followsymlinks
     return false;
 }
 
+bool PosixDirAccess::dnextbulk(LocalPath& path, vector<Entry>& entries, size_t max, bool followsymlinks, FileSystemAccess& fsaccess)
+{
+    if (globbing)
+    {
+        return DirAccess::dnextbulk(path, entries, max, followsymlinks, fsaccess);
+    }
+
+    size_t count = 0;
+
+#if defined(__APPLE__) && defined(ATTR_CMN_RETURNED_ATTRS)
+    // the names and attributes of many entries per getattrlistbulk()
+    struct attrlist attrs = {};
+    attrs.bitmapcount = ATTR_BIT_MAP_COUNT;
+    attrs.commonattr = ATTR_CMN_RETURNED_ATTRS | ATTR_CMN_NAME | ATTR_CMN_ERROR | ATTR_CMN_OBJTYPE | ATTR_CMN_MODTIME | ATTR_CMN_FILEID;
+    attrs.fileattr = ATTR_FILE_DATALENGTH;
+
+    std::vector<uint64_t> buffer(32 * 1024 / sizeof(uint64_t));
+    int fd = dirfd(dp);
+
+    while (count < max)
+    {
+        int n = getattrlistbulk(fd, &attrs, buffer.data(), buffer.size() * sizeof(uint64_t), 0);
+        if (n <= 0)
+        {
+            break;
+        }
+
+        const char* record = reinterpret_cast<const char*>(buffer.data());
+        for (int i = 0; i < n; i++)
+        {
+            // the attributes follow in the order of their bits, those that were returned
+            const char* p = record;
+            uint32_t length = *reinterpret_cast<const uint32_t*>(p);
+            p += sizeof(uint32_t);
+
+            attribute_set_t returned = *reinterpret_cast<const attribute_set_t*>(p);
+            p += sizeof(attribute_set_t);
+
+            uint32_t error = 0;
+            if (returned.commonattr & ATTR_CMN_ERROR)
+            {
+                error = *reinterpret_cast<const uint32_t*>(p);
+                p += sizeof(uint32_t);
+            }
+
+            const attrreference_t* nameref = reinterpret_cast<const attrreference_t*>(p);
+            const char* name = reinterpret_cast<const char*>(nameref) + nameref->attr_dataoffset;
+            p += sizeof(attrreference_t);
+
+            fsobj_type_t objtype = VNON;
+            if (returned.commonattr & ATTR_CMN_OBJTYPE)
+            {
+                objtype = *reinterpret_cast<const fsobj_type_t*>(p);
+                p += sizeof(fsobj_type_t);
+            }
+
+            Entry entry;
+
+            if (returned.commonattr & ATTR_CMN_MODTIME)
+            {
+                entry.mtime = reinterpret_cast<const struct timespec*>(p)->tv_sec;
+                p += sizeof(struct timespec);
+            }
+
+            if (returned.commonattr & ATTR_CMN_FILEID)
+            {
+                entry.fsid = (handle)*reinterpret_cast<const uint64_t*>(p);
+                entry.fsidvalid = true;
+                p += sizeof(uint64_t);
+            }
+
+            if (objtype == VREG && (returned.fileattr & ATTR_FILE_DATALENGTH))
+            {
+                entry.size = *reinterpret_cast<const off_t*>(p);
+            }
+
+            record += length;
+
+            struct stat statbuf;
+            if (objtype == VLNK && followsymlinks && !fstatat(fd, name, &statbuf, 0)
+             && (S_ISREG(statbuf.st_mode) || S_ISDIR(statbuf.st_mode)))
+            {
+                objtype = S_ISREG(statbuf.st_mode) ? VREG : VDIR;
+                entry.isSymLink = true;
+                entry.size = statbuf.st_size;
+                entry.mtime = statbuf.st_mtime;
+                entry.fsid = (handle)statbuf.st_ino;
+                entry.fsidvalid = true;
+            }
+
+            // symlinks aren't synced (yet), nor the other kinds
+            if (error || (objtype != VREG && objtype != VDIR))
+            {
+                continue;
+            }
+
+            entry.name = LocalPath::fromPlatformEncoded(name);
+            entry.type = objtype == VREG ? FILENODE : FOLDERNODE;
+            entry.statok = true;
+            FileSystemAccess::captimestamp(&entry.mtime);
+
+            entries.push_back(std::move(entry));
+            count++;
+        }
+    }
+#else
+    // the entries are stat()ed by their name in the folder, so the kernel doesn't walk the whole
+    // path again for each, and they aren't opened
+    int fd = dirfd(dp);
+    dirent* d;
+
+    while (count < max && (d = readdir(dp)))
+    {
+        if (*d->d_name == '.' && (!d->d_name[1] || (d->d_name[1] == '.' && !d->d_name[2])))
+        {
+            continue;
+        }
+
+        struct stat statbuf;
+        bool followed = false;
+        bool statok = !fstatat(fd, d->d_name, &statbuf, AT_SYMLINK_NOFOLLOW);
+
+        if (followsymlinks && statok && S_ISLNK(statbuf.st_mode))
+        {
+            followed = true;
+            statok = !fstatat(fd, d->d_name, &statbuf, 0);
+        }
+
+        // this evaluates false for symlinks (not synced yet), as in dnext()
+        if (!statok || !(S_ISREG(statbuf.st_mode) || S_ISDIR(statbuf.st_mode)))
+        {
+            continue;
+        }
+
+        Entry entry;
+        entry.name = LocalPath::fromPlatformEncoded(d->d_name);
+        entry.type = S_ISDIR(statbuf.st_mode) ? FOLDERNODE : FILENODE;
+        entry.statok = true;
+        entry.isSymLink = followed;
+        entry.size = (entry.type == FILENODE || followed) ? statbuf.st_size : 0;
+        entry.mtime = statbuf.st_mtime;
+        entry.fsid = (handle)statbuf.st_ino;
+        entry.fsidvalid = true;
+        FileSystemAccess::captimestamp(&entry.mtime);
+
+        entries.push_back(std::move(entry));
+        count++;
+    }
+#endif
+
+    return count > 0;
+}
+
 PosixDirAccess::PosixDirAccess()
 {
     dp = NULL;
@@ -19,10 +19,17 @@
  * program.
  */
 
+// the level of the net module applies (see SimpleLogger::setModuleLogLevel)
+#define MEGA_LOG_MODULE ::mega::logModuleNet
+
 #include "mega.h"
 #include "mega/posix/meganet.h"
 #include "mega/logging.h"
 
+#ifndef _WIN32
+#include <netinet/tcp.h>
+#endif
+
 #if defined(__ANDROID__) && ARES_VERSION >= 0x010F00
 #include <jni.h>
 extern JavaVM *MEGAjvm;
@@ -31,6 +38,7 @@ extern JavaVM *MEGAjvm;
 #define IPV6_RETRY_INTERVAL_DS 72000
 #define DNS_CACHE_TIMEOUT_DS 18000
 #define DNS_CACHE_EXPIRES 0
+#define DNS_CACHE_PERSISTED_MAX_AGE 86400
 #define MAX_SPEED_CONTROL_TIMEOUT_MS 500
 
 namespace mega {
@@ -248,6 +256,12 @@ CurlHttpIO::CurlHttpIO()
     }
 
     curlipv6 = data->features & CURL_VERSION_IPV6;
+#if LIBCURL_VERSION_NUM >= 0x072f00 // At least cURL 7.47.0
+    curlhttp2 = data->features & CURL_VERSION_HTTP2;
+#else
+    curlhttp2 = false;
+#endif
+    multiplex[API] = multiplex[GET] = multiplex[PUT] = true;
     LOG_debug << "IPv6 enabled: " << curlipv6;
 
     dnsok = false;
@@ -308,7 +322,9 @@ CurlHttpIO::CurlHttpIO()
 
     struct ares_options options;
     options.tries = 2;
-    ares_init_options(&ares, &options, ARES_OPT_TRIES);
+    options.sock_state_cb = ares_socket_state_callback;
+    options.sock_state_cb_data = this;
+    ares_init_options(&ares, &options, ARES_OPT_TRIES | ARES_OPT_SOCK_STATE_CB);
     arestimeout = -1;
 
     filterDNSservers();
@@ -340,6 +356,7 @@ CurlHttpIO::CurlHttpIO()
 
     curltimeoutreset[PUT] = -1;
     arerequestspaused[PUT] = false;
+    setmultiplexing();
 
     curlsh = curl_share_init();
     curl_share_setopt(curlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
@@ -836,7 +853,9 @@ void CurlHttpIO::disconnect()
     curlm[PUT] = curl_multi_init();
     struct ares_options options;
     options.tries = 2;
-    ares_init_options(&ares, &options, ARES_OPT_TRIES);
+    options.sock_state_cb = ares_socket_state_callback;
+    options.sock_state_cb_data = this;
+    ares_init_options(&ares, &options, ARES_OPT_TRIES | ARES_OPT_SOCK_STATE_CB);
     arestimeout = -1;
 
     curl_multi_setopt(curlm[API], CURLMOPT_SOCKETFUNCTION, api_socket_callback);
@@ -866,6 +885,9 @@ void CurlHttpIO::disconnect()
 #endif
     curltimeoutreset[PUT] = -1;
     arerequestspaused[PUT] = false;
+    setmultiplexing();
+    throttledrequests[GET].clear();
+    throttledrequests[PUT].clear();
 
     disconnecting = false;
     if (dnsservers.size())
@@ -891,6 +913,16 @@ bool CurlHttpIO::setmaxdownloadspeed(m_off_t bpslimit)
     return true;
 }
 
+void CurlHttpIO::setmultiplexing()
+{
+#if LIBCURL_VERSION_NUM >= 0x072f00 // At least cURL 7.47.0
+    for (int d : { API, GET, PUT })
+    {
+        curl_multi_setopt(curlm[d], CURLMOPT_PIPELINING, (curlhttp2 && multiplex[d]) ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+    }
+#endif
+}
+
 bool CurlHttpIO::setmaxuploadspeed(m_off_t bpslimit)
 {
     maxspeed[PUT] = bpslimit;
@@ -968,6 +1000,20 @@ void CurlHttpIO::addevents(Waiter* w, int)
         }
     }
 
+    // wake up when the first throttled request can go on, and not before
+    for (int d = GET; d == GET || d == PUT; d += PUT - GET)
+    {
+        for (auto& throttled : throttledrequests[d])
+        {
+            m_time_t ds = throttled.second - Waiter::ds;
+            long ms = ds > 0 ? long(ds * 100) : 0;
+            if (curltimeoutms < 0 || curltimeoutms > ms)
+            {
+                curltimeoutms = ms;
+            }
+        }
+    }
+
     if ((curltimeoutms < 0 || curltimeoutms > MAX_SPEED_CONTROL_TIMEOUT_MS)
             && (downloadSpeed || uploadSpeed))
     {
@@ -1010,6 +1056,235 @@ void CurlHttpIO::addevents(Waiter* w, int)
     }
 }
 
+// the hosts with their addresses, when they were resolved (as the time of day, since ds start
+// over in each run) and when IPv6 last failed for them
+bool CurlHttpIO::serializednscache(string* d)
+{
+    CacheableWriter w(*d);
+    m_time_t now = m_time();
+
+    w.serializeu32(uint32_t(dnscache.size()));
+    for (auto& h : dnscache)
+    {
+        const CurlDNSEntry& entry = h.second;
+        dstime resolved = std::max(entry.ipv4.size() ? entry.ipv4timestamp : 0, entry.ipv6.size() ? entry.ipv6timestamp : 0);
+
+        w.serializestring(h.first);
+        w.serializestring(entry.ipv4);
+        w.serializestring(entry.ipv6);
+        w.serializei64(now - m_time_t(Waiter::ds - resolved) / 10);
+        w.serializei64(entry.ipv6failed);
+    }
+    return true;
+}
+
+// a cached address is used right away, but one older than the DNS cache timeout is resolved
+// again while the connection to it is set up (see sockopt_callback()), and those older than
+// DNS_CACHE_PERSISTED_MAX_AGE are not kept: lookups don't tell their TTL
+void CurlHttpIO::unserializednscache(const string& d)
+{
+    CacheableReader r(d);
+    m_time_t now = m_time();
+    uint32_t count;
+
+    if (!r.unserializeu32(count))
+    {
+        return;
+    }
+
+    while (count--)
+    {
+        string hostname;
+        CurlDNSEntry entry;
+        int64_t resolved, ipv6failed;
+
+        if (!r.unserializestring(hostname) || !r.unserializestring(entry.ipv4) || !r.unserializestring(entry.ipv6)
+                || !r.unserializei64(resolved) || !r.unserializei64(ipv6failed))
+        {
+            LOG_warn << "Discarding a damaged DNS cache";
+            return;
+        }
+
+        if (now - resolved > DNS_CACHE_PERSISTED_MAX_AGE || dnscache.count(hostname))
+        {
+            continue;
+        }
+
+        entry.ipv4timestamp = entry.ipv6timestamp = Waiter::ds;
+        entry.ipv6failed = ipv6failed;
+        entry.mNeedsResolvingAgain = now - resolved >= DNS_CACHE_TIMEOUT_DS / 10;
+        dnscache[hostname] = entry;
+    }
+
+    LOG_debug << "DNS cache restored: " << dnscache.size() << " hosts";
+}
+
+// c-ares calls this with neither direction wanted when it's done with a socket, before closing it
+void CurlHttpIO::ares_socket_state_callback(void* data, ares_socket_t s, int readable, int writable)
+{
+#ifndef _WIN32
+    CurlHttpIO* httpio = static_cast<CurlHttpIO*>(data);
+    if (!readable && !writable && httpio->waiter)
+    {
+        httpio->waiter->forget(s);
+    }
+#endif
+}
+
+bool CurlHttpIO::settransferprofile(const TransferNetworkProfile& profile)
+{
+    LOG_info << "Transfer network profile: socket buffers " << profile.socketbuffer << ", notsent lowat " << profile.notsentlowat
+             << ", congestion control " << (profile.congestion.size() ? profile.congestion : "(default)") << ", receive buffer " << profile.receivebuffer;
+    transferprofile = profile;
+    return true;
+}
+
+// (the buffers are set before connecting, so that the window scale covers them)
+void CurlHttpIO::applytransferprofile(curl_socket_t s)
+{
+    const TransferNetworkProfile& profile = transferprofile;
+
+    if (profile.socketbuffer > 0)
+    {
+        int size = profile.socketbuffer;
+        if (setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char*)&size, sizeof size)
+                || setsockopt(s, SOL_SOCKET, SO_SNDBUF, (const char*)&size, sizeof size))
+        {
+            LOG_warn << "Unable to set the socket buffers to " << size << ": " << errno;
+        }
+    }
+
+#ifdef TCP_NOTSENT_LOWAT
+    if (profile.notsentlowat > 0)
+    {
+        int lowat = profile.notsentlowat;
+        if (setsockopt(s, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (const char*)&lowat, sizeof lowat))
+        {
+            LOG_warn << "Unable to set TCP_NOTSENT_LOWAT: " << errno;
+        }
+    }
+#endif
+
+#ifdef TCP_CONGESTION
+    if (profile.congestion.size()
+            && setsockopt(s, IPPROTO_TCP, TCP_CONGESTION, profile.congestion.c_str(), socklen_t(profile.congestion.size())))
+    {
+        LOG_warn << "Unable to use the congestion control " << profile.congestion << ": " << errno;
+    }
+#endif
+
+    // what the OS granted (Linux reports twice the size asked, for its bookkeeping)
+    int rcvbuf = 0, sndbuf = 0;
+    socklen_t len = sizeof rcvbuf;
+    getsockopt(s, SOL_SOCKET, SO_RCVBUF, (char*)&rcvbuf, &len);
+    len = sizeof sndbuf;
+    getsockopt(s, SOL_SOCKET, SO_SNDBUF, (char*)&sndbuf, &len);
+
+    transferSocketStats.sockets++;
+    transferSocketStats.rcvbuf += uint64_t(rcvbuf);
+    transferSocketStats.sndbuf += uint64_t(sndbuf);
+}
+
+std::string CurlHttpIO::ApiResponseBytes::report(bool reset)
+{
+    std::ostringstream s;
+    s << " API responses received/decoded: " << wire << "/" << decoded << " bytes";
+    if (reset)
+    {
+        wire = decoded = 0;
+    }
+    return s.str();
+}
+
+std::string CurlHttpIO::TransferSocketStats::report(bool reset)
+{
+    std::ostringstream s;
+    s << " transfer sockets: " << sockets;
+    if (sockets)
+    {
+        s << " avg rcvbuf: " << rcvbuf / sockets << " avg sndbuf: " << sndbuf / sockets;
+    }
+    const char* names[2] = { "GET", "PUT" };
+    for (int d = GET; d <= PUT; d++)
+    {
+        s << " " << names[d] << " requests: " << requests[d] << " bytes: " << bytes[d]
+          << " avg per connection: " << (seconds[d] > 0 ? uint64_t(double(bytes[d]) / seconds[d]) : 0) << " B/s";
+    }
+
+    if (reset)
+    {
+        *this = TransferSocketStats();
+    }
+    return s.str();
+}
+
+// a lookup started by prewarm()
+struct CurlPrewarm
+{
+    CurlHttpIO* httpio;
+    string hostname;
+};
+
+void CurlHttpIO::prewarm(const string& url)
+{
+    string u = url;
+    string scheme, hostname;
+    int port;
+
+    if (proxyurl.size() || !crackurl(&u, &scheme, &hostname, &port) || prewarming.count(hostname))
+    {
+        return;
+    }
+
+    map<string, CurlDNSEntry>::iterator it = dnscache.find(hostname);
+    if (it != dnscache.end()
+            && ((it->second.ipv4.size() && !it->second.isIPv4Expired())
+                || (it->second.ipv6.size() && !it->second.isIPv6Expired())))
+    {
+        return;
+    }
+
+#if !TARGET_OS_IPHONE
+    LOG_debug << "Resolving " << hostname << " ahead of its requests";
+    int& pending = prewarming[hostname];
+    if (ipv6requestsenabled)
+    {
+        pending++;
+        ares_gethostbyname(ares, hostname.c_str(), PF_INET6, prewarm_callback, new CurlPrewarm{ this, hostname });
+    }
+    pending++;
+    ares_gethostbyname(ares, hostname.c_str(), PF_INET, prewarm_callback, new CurlPrewarm{ this, hostname });
+#endif
+}
+
+void CurlHttpIO::prewarm_callback(void* arg, int status, int, hostent* host)
+{
+    unique_ptr<CurlPrewarm> prewarm(static_cast<CurlPrewarm*>(arg));
+    CurlHttpIO* httpio = prewarm->httpio;
+
+    auto it = httpio->prewarming.find(prewarm->hostname);
+    if (it != httpio->prewarming.end() && !--it->second)
+    {
+        httpio->prewarming.erase(it);
+    }
+
+    // only what a request would cache (see ares_completed_callback()), if it hasn't meanwhile
+    if (status == ARES_SUCCESS && host && host->h_addr_list[0])
+    {
+        char ip[INET6_ADDRSTRLEN];
+        mega_inet_ntop(host->h_addrtype, host->h_addr_list[0], ip, sizeof(ip));
+
+        CurlDNSEntry& dnsEntry = httpio->dnscache[prewarm->hostname];
+        string& cached = host->h_addrtype == PF_INET6 ? dnsEntry.ipv6 : dnsEntry.ipv4;
+        if (cached.empty())
+        {
+            cached = ip;
+            httpio->dnscachechanged = true;
+            (host->h_addrtype == PF_INET6 ? dnsEntry.ipv6timestamp : dnsEntry.ipv4timestamp) = Waiter::ds;
+        }
+    }
+}
+
 void CurlHttpIO::proxy_ready_callback(void* arg, int status, int, hostent* host)
 {
     // the name of a proxy has been resolved
@@ -1191,6 +1466,7 @@ void CurlHttpIO::ares_completed_callback(void* arg, int status, int, struct host
             if (!incache)
             {
                 dnsEntry.ipv6 = ip;
+                httpio->dnscachechanged = true;
             }
             dnsEntry.ipv6timestamp = Waiter::ds;
         }
@@ -1199,6 +1475,7 @@ void CurlHttpIO::ares_completed_callback(void* arg, int status, int, struct host
             if (!incache)
             {
                 dnsEntry.ipv4 = ip;
+                httpio->dnscachechanged = true;
             }
             dnsEntry.ipv4timestamp = Waiter::ds;
         }
@@ -1360,7 +1637,7 @@ void CurlHttpIO::send_request(CurlHttpContext* httpctx)
     int len = httpctx->len;
     const char* data = httpctx->data;
 
-    if (SimpleLogger::logCurrentLevel >= logDebug)
+    if (MEGA_LOG_ENABLED(logDebug))
     {
         string safeurl = req->posturl;
         size_t sid = safeurl.find("sid=");
@@ -1474,11 +1751,26 @@ void CurlHttpIO::send_request(CurlHttpContext* httpctx)
         curl_easy_setopt(curl, CURLOPT_SOCKOPTDATA, (void*)req);
         curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
 
+#if LIBCURL_VERSION_NUM >= 0x072f00 // At least cURL 7.47.0
+        if (httpio->curlhttp2 && httpio->multiplex[httpctx->d])
+        {
+            // HTTP/2 where the server offers it over TLS, else HTTP/1.1 as before (the storage
+            // servers on plain HTTP included).  A new request waits for the connection being set
+            // up to the same server, to go on it instead of opening one more
+            curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+            curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+        }
+#endif
+
 
         if (httpio->maxspeed[GET] && httpio->maxspeed[GET] <= 102400)
         {
             curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, 4096L);
         }
+        else if (httpctx->d == GET && httpio->transferprofile.receivebuffer > 0)
+        {
+            curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, httpio->transferprofile.receivebuffer);
+        }
 
         if (req->minspeed)
         {
@@ -1815,7 +2107,9 @@ void CurlHttpIO::post(HttpReq* req, const char* data, unsigned len)
         ares_destroy(ares);
         struct ares_options options;
         options.tries = 2;
-        ares_init_options(&ares, &options, ARES_OPT_TRIES);
+        options.sock_state_cb = ares_socket_state_callback;
+        options.sock_state_cb_data = this;
+        ares_init_options(&ares, &options, ARES_OPT_TRIES | ARES_OPT_SOCK_STATE_CB);
 
         if (dnsservers.size())
         {
@@ -1900,7 +2194,10 @@ void CurlHttpIO::post(HttpReq* req, const char* data, unsigned len)
         dnsEntry = &it->second;
     }
 
-    if (ipv6requestsenabled)
+    // IPv6 failed for this host lately: IPv4, without trying it first
+    bool useipv6 = ipv6requestsenabled && !(dnsEntry && dnsEntry->ipv6disabled());
+
+    if (useipv6)
     {
         if (dnsEntry && dnsEntry->ipv6.size() && !dnsEntry->isIPv6Expired())
         {
@@ -1930,7 +2227,7 @@ void CurlHttpIO::post(HttpReq* req, const char* data, unsigned len)
 #if TARGET_OS_IPHONE
     send_request(httpctx);
 #else
-    if (ipv6requestsenabled)
+    if (useipv6)
     {
         httpctx->ares_pending++;
         LOG_debug << "Resolving IPv6 address for " << httpctx->hostname;
@@ -1998,6 +2295,7 @@ void CurlHttpIO::cancel(HttpReq* req)
         {
             numconnections[httpctx->d]--;
             pausedrequests[httpctx->d].erase(httpctx->curl);
+            throttledrequests[httpctx->d].erase(httpctx->curl);
             curl_multi_remove_handle(curlm[httpctx->d], httpctx->curl);
             curl_easy_cleanup(httpctx->curl);
             curl_slist_free_all(httpctx->headers);
@@ -2076,6 +2374,8 @@ bool CurlHttpIO::doio()
             }
         }
 
+        resumethrottled((direction_t)d);
+
         if (!arerequestspaused[d])
         {
             processcurlevents((direction_t)d);
@@ -2087,6 +2387,34 @@ bool CurlHttpIO::doio()
     return result;
 }
 
+void CurlHttpIO::throttle(CurlHttpContext* httpctx, dstime resumeds)
+{
+    throttledrequests[httpctx->d][httpctx->curl] = resumeds;
+}
+
+void CurlHttpIO::resumethrottled(direction_t d)
+{
+    // resuming runs the callbacks, which may throttle the request again
+    vector<CURL*> due;
+    for (auto it = throttledrequests[d].begin(); it != throttledrequests[d].end(); )
+    {
+        if (it->second <= Waiter::ds)
+        {
+            due.push_back(it->first);
+            it = throttledrequests[d].erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    for (CURL* easy_handle : due)
+    {
+        curl_easy_pause(easy_handle, CURLPAUSE_CONT);
+    }
+}
+
 bool CurlHttpIO::multidoio(CURLM *curlmhandle)
 {
     int dummy = 0;
@@ -2169,6 +2497,41 @@ bool CurlHttpIO::multidoio(CURLM *curlmhandle)
                 curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &httpstatus);
                 req->httpstatus = int(httpstatus);
 
+                double lookuptime = 0, connecttime = 0;
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_NAMELOOKUP_TIME, &lookuptime);
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_CONNECT_TIME, &connecttime);
+                req->connectms = connecttime > lookuptime ? int((connecttime - lookuptime) * 1000) : 0;
+
+                double starttransfertime = 0;
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_STARTTRANSFER_TIME, &starttransfertime);
+                req->ttfbms = int(starttransfertime * 1000);
+
+                CurlHttpContext* donectx = (CurlHttpContext*)req->httpiohandle;
+                if (donectx && donectx->d == API && errorCode == CURLE_OK)
+                {
+                    // what compression saves on the API responses: CURLINFO_SIZE_DOWNLOAD counts
+                    // the bytes before decoding, bufpos those after
+                    double wire = 0;
+                    curl_easy_getinfo(msg->easy_handle, CURLINFO_SIZE_DOWNLOAD, &wire);
+                    apiResponseBytes.wire += uint64_t(wire);
+                    apiResponseBytes.decoded += uint64_t(req->bufpos);
+
+                    if (req->contentencoding.size() && req->bufpos >= 1048576)
+                    {
+                        LOG_debug << req->logname << "Received " << uint64_t(wire) << " bytes as " << req->contentencoding
+                                  << " for " << req->bufpos << " of response";
+                    }
+                }
+                else if (donectx && errorCode == CURLE_OK)
+                {
+                    double bytes = 0, seconds = 0;
+                    curl_easy_getinfo(msg->easy_handle, donectx->d == GET ? CURLINFO_SIZE_DOWNLOAD : CURLINFO_SIZE_UPLOAD, &bytes);
+                    curl_easy_getinfo(msg->easy_handle, CURLINFO_TOTAL_TIME, &seconds);
+                    transferSocketStats.requests[donectx->d]++;
+                    transferSocketStats.bytes[donectx->d] += uint64_t(bytes);
+                    transferSocketStats.seconds[donectx->d] += seconds;
+                }
+
                 LOG_debug << "CURLMSG_DONE with HTTP status: " << req->httpstatus << " from "
                           << (req->httpiohandle ? (((CurlHttpContext*)req->httpiohandle)->hostname + " - " + ((CurlHttpContext*)req->httpiohandle)->hostip) : "(unknown) ");
                 if (req->httpstatus)
@@ -2252,12 +2615,14 @@ bool CurlHttpIO::multidoio(CURLM *curlmhandle)
                     {
                         dnsEntry.ipv6.clear();
                         dnsEntry.ipv6timestamp = 0;
+                        dnsEntry.ipv6failed = m_time();
                     }
                     else
                     {
                         dnsEntry.ipv4.clear();
                         dnsEntry.ipv4timestamp = 0;
                     }
+                    dnscachechanged = true;
 
                     ipv6requestsenabled = !httpctx->isIPv6 && ipv6available();
 
@@ -2278,6 +2643,7 @@ bool CurlHttpIO::multidoio(CURLM *curlmhandle)
                         {
                             numconnections[httpctx->d]--;
                             pausedrequests[httpctx->d].erase(msg->easy_handle);
+                            throttledrequests[httpctx->d].erase(msg->easy_handle);
                             curl_multi_remove_handle(curlmhandle, msg->easy_handle);
                             curl_easy_cleanup(msg->easy_handle);
                             curl_slist_free_all(httpctx->headers);
@@ -2323,6 +2689,7 @@ bool CurlHttpIO::multidoio(CURLM *curlmhandle)
             {
                 numconnections[httpctx->d]--;
                 pausedrequests[httpctx->d].erase(httpctx->curl);
+                throttledrequests[httpctx->d].erase(httpctx->curl);
 
                 curl_slist_free_all(httpctx->headers);
                 req->httpiohandle = NULL;
@@ -2413,6 +2780,21 @@ size_t CurlHttpIO::read_data(void* ptr, size_t size, size_t nmemb, void* source)
         return 0;
     }
 
+    if (!req->ratelimits.empty())
+    {
+        m_off_t allowed = TokenBucket::allowance(req->ratelimits, Waiter::ds);
+        if (allowed <= 0)
+        {
+            httpio->throttle(httpctx, TokenBucket::availableAt(req->ratelimits, Waiter::ds));
+            return CURL_READFUNC_PAUSE;
+        }
+
+        if (nread > size_t(allowed))
+        {
+            nread = size_t(allowed);
+        }
+    }
+
     req->lastdata = Waiter::ds;
 
     if (httpio->maxspeed[PUT])
@@ -2436,6 +2818,7 @@ size_t CurlHttpIO::read_data(void* ptr, size_t size, size_t nmemb, void* source)
         }
     }
 
+    TokenBucket::consume(req->ratelimits, nread);
     memcpy(ptr, buf, nread);
     req->outpos += nread;
     //LOG_debug << req->logname << "Supplying " << nread << " bytes to cURL to send";
@@ -2449,6 +2832,15 @@ size_t CurlHttpIO::write_data(void* ptr, size_t size, size_t nmemb, void* target
     CurlHttpIO* httpio = (CurlHttpIO*)req->httpio;
     if (httpio)
     {
+        // a block can't be taken in part: it goes whole while something is allowed
+        if (len && !req->ratelimits.empty()
+                && TokenBucket::allowance(req->ratelimits, Waiter::ds) <= 0)
+        {
+            CurlHttpContext* httpctx = (CurlHttpContext*)req->httpiohandle;
+            httpio->throttle(httpctx, TokenBucket::availableAt(req->ratelimits, Waiter::ds));
+            return CURL_WRITEFUNC_PAUSE;
+        }
+
         if (httpio->maxspeed[GET])
         {
             CurlHttpContext* httpctx = (CurlHttpContext*)req->httpiohandle;
@@ -2469,6 +2861,7 @@ size_t CurlHttpIO::write_data(void* ptr, size_t size, size_t nmemb, void* target
 
         if (len)
         {
+            TokenBucket::consume(req->ratelimits, len);
             req->put(ptr, len, true);
         }
 
@@ -2499,28 +2892,35 @@ size_t CurlHttpIO::check_header(void* ptr, size_t size, size_t nmemb, void* targ
             LOG_warn << "Receiving a second response. Resetting Content-Length";
             req->contentlength = -1;
         }
+        req->contentencoding.clear();
 
         return size * nmemb;
     }
-    else if (len > 15 && !memcmp(ptr, "Content-Length:", 15))
+    // (header names arrive in lowercase over HTTP/2)
+    else if (len > 15 && !strncasecmp((const char*)ptr, "Content-Length:", 15))
     {
         if (req->contentlength < 0)
         {
             req->setcontentlength(atoll((char*)ptr + 15));
         }
     }
-    else if (len > 24 && !memcmp(ptr, "Original-Content-Length:", 24))
+    else if (len > 24 && !strncasecmp((const char*)ptr, "Original-Content-Length:", 24))
     {
         req->setcontentlength(atoll((char*)ptr + 24));
     }
-    else if (len > 17 && !memcmp(ptr, "X-MEGA-Time-Left:", 17))
+    else if (len > 17 && !strncasecmp((const char*)ptr, "X-MEGA-Time-Left:", 17))
     {
         req->timeleft = atol((char*)ptr + 17);
     }
-    else if (len > 15 && !memcmp(ptr, "Content-Type:", 13))
+    else if (len > 15 && !strncasecmp((const char*)ptr, "Content-Type:", 13))
     {
         req->contenttype.assign((char *)ptr + 13, len - 15);
     }
+    else if (len > 19 && !strncasecmp((const char*)ptr, "Content-Encoding:", 17))
+    {
+        req->contentencoding.assign((char *)ptr + 17, len - 19);
+        req->contentencoding.erase(0, req->contentencoding.find_first_not_of(' '));
+    }
     else
     {
         return len;
@@ -2592,6 +2992,11 @@ int CurlHttpIO::socket_callback(CURL *, curl_socket_t s, int what, void *userp,
 
 #if defined(_WIN32)
             it->second.closeEvent();
+#else
+            if (httpio->waiter)
+            {
+                httpio->waiter->forget(s);
+            }
 #endif
             it->second.mode = 0;
         }
@@ -2628,11 +3033,17 @@ int CurlHttpIO::socket_callback(CURL *, curl_socket_t s, int what, void *userp,
 // This one was causing us to issue additional c-ares requests, when normal usage already sends those requests
 // CURL doco: When set, this callback function gets called by libcurl when the socket has been created, but before the connect call to allow applications to change specific socket options.The callback's purpose argument identifies the exact purpose for this particular socket:
 
-int CurlHttpIO::sockopt_callback(void *clientp, curl_socket_t, curlsocktype)
+int CurlHttpIO::sockopt_callback(void *clientp, curl_socket_t curlfd, curlsocktype purpose)
 {
     HttpReq *req = (HttpReq*)clientp;
     CurlHttpIO* httpio = (CurlHttpIO*)req->httpio;
     CurlHttpContext* httpctx = (CurlHttpContext*)req->httpiohandle;
+
+    if (httpio && httpctx && httpctx->d != API && purpose == CURLSOCKTYPE_IPCXN)
+    {
+        httpio->applytransferprofile(curlfd);
+    }
+
     if (httpio && !httpio->disconnecting
             && httpctx && httpctx->isCachedIp && !httpctx->ares_pending && httpio->dnscache[httpctx->hostname].mNeedsResolvingAgain)
     {
@@ -2858,6 +3269,11 @@ bool CurlDNSEntry::isIPv6Expired()
     return (DNS_CACHE_EXPIRES && (Waiter::ds - ipv6timestamp) >= DNS_CACHE_TIMEOUT_DS);
 }
 
+bool CurlDNSEntry::ipv6disabled() const
+{
+    return ipv6failed && m_time() - ipv6failed < IPV6_RETRY_INTERVAL_DS / 10;
+}
+
 #if (defined(ANDROID) || defined(__ANDROID__)) && ARES_VERSION >= 0x010F00
 
 void CurlHttpIO::initialize_android()
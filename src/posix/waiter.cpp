@@ -26,12 +26,33 @@
     #include <poll.h> //poll
 #endif
 
+#ifdef USE_EPOLL
+    #include <sys/epoll.h>
+    #include <climits>
+#endif
+
+#ifdef USE_KQUEUE
+    #include <sys/event.h>
+#endif
+
+#ifdef MEGA_NOTIFY_EVENTFD
+    #include <sys/eventfd.h>
+#endif
+
 namespace mega {
 dstime Waiter::ds;
 
 PosixWaiter::PosixWaiter()
 {
     // pipe to be able to leave the select() call
+#ifdef MEGA_NOTIFY_EVENTFD
+    m_pipe[0] = m_pipe[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_pipe[0] < 0)
+    {
+        LOG_fatal << "Error creating eventfd";
+        throw std::runtime_error("Error creating eventfd");
+    }
+#else
     if (pipe(m_pipe) < 0)
     {
         LOG_fatal << "Error creating pipe";
@@ -42,6 +63,20 @@ PosixWaiter::PosixWaiter()
     {
         LOG_err << "fcntl error";
     }
+#endif
+
+#ifdef USE_EPOLL
+    mEventFd = epoll_create1(EPOLL_CLOEXEC);
+#elif defined(USE_KQUEUE)
+    mEventFd = kqueue();
+#endif
+#ifdef MEGA_EVENT_WAITER
+    if (mEventFd < 0)
+    {
+        LOG_fatal << "Error creating the event queue";
+        throw std::runtime_error("Error creating the event queue");
+    }
+#endif
 
     maxfd = -1;
 }
@@ -49,8 +84,86 @@ PosixWaiter::PosixWaiter()
 PosixWaiter::~PosixWaiter()
 {
     close(m_pipe[0]);
+#ifndef MEGA_NOTIFY_EVENTFD
     close(m_pipe[1]);
+#endif
+#ifdef MEGA_EVENT_WAITER
+    close(mEventFd);
+#endif
+}
+
+#ifdef MEGA_EVENT_WAITER
+void PosixWaiter::forget(int fd)
+{
+    auto it = mRegistered.find(fd);
+    if (it != mRegistered.end())
+    {
+        registerfd(fd, 0, it->second);
+        mRegistered.erase(it);
+    }
+}
+
+// pass the change of what fd is waited for to the kernel
+bool PosixWaiter::registerfd(int fd, int events, int previous)
+{
+#ifdef USE_EPOLL
+    epoll_event ev;
+    memset(&ev, 0, sizeof ev);
+    ev.data.fd = fd;
+    ev.events = ((events & EVREAD) ? EPOLLIN : 0)
+              | ((events & EVWRITE) ? EPOLLOUT : 0)
+              | ((events & EVEXCEPT) ? EPOLLPRI : 0);
+
+    if (!events)
+    {
+        // (gone already if it was closed)
+        epoll_ctl(mEventFd, EPOLL_CTL_DEL, fd, &ev);
+        return true;
+    }
+
+    // the kernel may know it or not, whatever we think: an fd closed without forget() is gone
+    // from it, and one reused with the same number isn't in it
+    if (!epoll_ctl(mEventFd, previous ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev))
+    {
+        return true;
+    }
+    return !epoll_ctl(mEventFd, previous ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+#else
+    // kqueue has a filter per direction, and none for exceptional conditions (out-of-band data
+    // makes the socket readable)
+    if (events & EVEXCEPT)
+    {
+        events = (events & ~EVEXCEPT) | EVREAD;
+    }
+    if (previous & EVEXCEPT)
+    {
+        previous = (previous & ~EVEXCEPT) | EVREAD;
+    }
+
+    struct kevent changes[2];
+    int n = 0;
+    for (int filter : { EVREAD, EVWRITE })
+    {
+        if ((events & filter) != (previous & filter))
+        {
+            EV_SET(&changes[n], fd, filter == EVREAD ? EVFILT_READ : EVFILT_WRITE,
+                   (events & filter) ? EV_ADD : EV_DELETE, 0, 0, nullptr);
+            n++;
+        }
+    }
+
+    // the deletions of a closed fd fail, which is fine
+    for (int i = 0; i < n; i++)
+    {
+        if (kevent(mEventFd, &changes[i], 1, nullptr, 0, nullptr) < 0 && (changes[i].flags & EV_ADD))
+        {
+            return false;
+        }
+    }
+    return true;
+#endif
 }
+#endif
 
 void PosixWaiter::init(dstime ds)
 {
@@ -116,7 +229,80 @@ int PosixWaiter::wait()
         tv.tv_usec = us - tv.tv_sec * 1000000;
     }
 
-#ifdef USE_POLL
+#if defined(MEGA_EVENT_WAITER)
+    // what each fd is waited for now, merged with what the kernel was told for the previous wait
+    std::map<int, int> wanted;
+    for (int fd : rfds) wanted[fd] |= EVREAD;
+    for (int fd : wfds) wanted[fd] |= EVWRITE;
+    for (int fd : efds) wanted[fd] |= EVEXCEPT;
+
+    auto w = wanted.begin();
+    auto r = mRegistered.begin();
+    while (w != wanted.end() || r != mRegistered.end())
+    {
+        if (r == mRegistered.end() || (w != wanted.end() && w->first < r->first))
+        {
+            if (!registerfd(w->first, w->second, 0))
+            {
+                LOG_err << "Unable to wait for fd " << w->first << ": " << errno;
+            }
+            mRegistered.emplace_hint(r, w->first, w->second);
+            ++w;
+        }
+        else if (w == wanted.end() || r->first < w->first)
+        {
+            registerfd(r->first, 0, r->second);
+            r = mRegistered.erase(r);
+        }
+        else
+        {
+            if (w->second != r->second)
+            {
+                if (!registerfd(w->first, w->second, r->second))
+                {
+                    LOG_err << "Unable to wait for fd " << w->first << ": " << errno;
+                }
+                r->second = w->second;
+            }
+            ++w;
+            ++r;
+        }
+    }
+
+    // select() semantics from here on: the sets have the fds that are ready
+    MEGA_FD_ZERO(&rfds);
+    MEGA_FD_ZERO(&wfds);
+    MEGA_FD_ZERO(&efds);
+
+#ifdef USE_EPOLL
+    int timeout = (maxds + 1) ? int(std::min<dstime>(maxds, INT_MAX / 100) * 100) : -1;
+    std::vector<epoll_event> events(std::max<size_t>(wanted.size(), 1));
+    numfd = epoll_wait(mEventFd, events.data(), int(events.size()), timeout);
+    for (int i = 0; i < numfd; i++)
+    {
+        int fd = events[i].data.fd;
+        uint32_t e = events[i].events;
+        if (e & (EPOLLIN | EPOLLHUP | EPOLLERR)) MEGA_FD_SET(fd, &rfds);
+        if (e & (EPOLLOUT | EPOLLERR)) MEGA_FD_SET(fd, &wfds);
+        if (e & EPOLLPRI) MEGA_FD_SET(fd, &efds);
+    }
+#else
+    timespec ts;
+    if (maxds + 1)
+    {
+        ts.tv_sec = tv.tv_sec;
+        ts.tv_nsec = tv.tv_usec * 1000;
+    }
+    std::vector<struct kevent> events(std::max<size_t>(wanted.size() * 2, 1));
+    numfd = kevent(mEventFd, nullptr, 0, events.data(), int(events.size()), (maxds + 1) ? &ts : nullptr);
+    for (int i = 0; i < numfd; i++)
+    {
+        int fd = int(events[i].ident);
+        if (events[i].filter == EVFILT_READ) MEGA_FD_SET(fd, &rfds);
+        if (events[i].filter == EVFILT_WRITE || (events[i].flags & (EV_EOF | EV_ERROR))) MEGA_FD_SET(fd, &wfds);
+    }
+#endif
+#elif defined(USE_POLL)
     dstime ms = 1000 / 10 * maxds;
 
     auto total = rfds.size() +  wfds.size() +  efds.size();
@@ -149,18 +335,21 @@ int PosixWaiter::wait()
     numfd = select(maxfd + 1, &rfds, &wfds, &efds, maxds + 1 ? &tv : NULL);
 #endif
 
-    // empty pipe
-    uint8_t buf;
+    // empty pipe.  The flag is cleared first: a notify() from then on writes again, and one
+    // that the read below finds already is just handled by this pass
+    alreadyNotified = false;
     bool external = false;
 
+#ifdef MEGA_NOTIFY_EVENTFD
+    uint64_t count;
+    external = read(m_pipe[0], &count, sizeof count) > 0;
+#else
+    uint8_t buf;
+    while (read(m_pipe[0], &buf, sizeof buf) > 0)
     {
-        std::lock_guard<std::mutex> g(mMutex);
-        while (read(m_pipe[0], &buf, sizeof buf) > 0)
-        {
-            external = true;
-        }
-        alreadyNotified = false;
+        external = true;
     }
+#endif
 
     // timeout or error
     if (external || numfd <= 0)
@@ -169,7 +358,19 @@ int PosixWaiter::wait()
     }
 
     // request exec() to be run only if a non-ignored fd was triggered
-#ifdef USE_POLL
+#if defined(MEGA_EVENT_WAITER)
+    for (const mega_fd_set_t* fds : { &rfds, &wfds, &efds })
+    {
+        for (int fd : *fds)
+        {
+            if (!MEGA_FD_ISSET(fd, &ignorefds))
+            {
+                return NEEDEXEC;
+            }
+        }
+    }
+    return 0;
+#elif defined(USE_POLL)
     for (unsigned int i = 0 ; i < total ; i++)
     {
         if  ((fds[i].revents & (POLLIN_SET | POLLOUT_SET | POLLEX_SET) )  && !MEGA_FD_ISSET(fds[i].fd, &ignorefds) )
@@ -188,11 +389,14 @@ int PosixWaiter::wait()
 
 void PosixWaiter::notify()
 {
-    std::lock_guard<std::mutex> g(mMutex);
-    if (!alreadyNotified)
+    if (!alreadyNotified.exchange(true))
     {
+#ifdef MEGA_NOTIFY_EVENTFD
+        uint64_t one = 1;
+        write(m_pipe[1], &one, sizeof one);
+#else
         write(m_pipe[1], "0", 1);
-        alreadyNotified = true;
+#endif
     }
 }
 } // namespace
@@ -19,6 +19,17 @@
  * program.
  */
 
+// the level of the transfers module applies (see SimpleLogger::setModuleLogLevel)
+#define MEGA_LOG_MODULE ::mega::logModuleTransfers
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MEGA_RAID_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define MEGA_RAID_NEON 1
+#endif
+
 #include "mega/raid.h"
 
 #include "mega/transfer.h"
@@ -114,7 +125,7 @@ RaidBufferManager::FilePiece::FilePiece()
 
 RaidBufferManager::FilePiece::FilePiece(m_off_t p, size_t len)
     : pos(p)
-    , buf(new byte[len + std::min<size_t>(SymmCipher::BLOCKSIZE, RAIDSECTOR)], 0, len)   // SymmCipher::ctr_crypt requirement: decryption: data must be padded to BLOCKSIZE.  Also make sure we can xor up to RAIDSECTOR more for convenience
+    , buf(TransferBufferPool::instance().allocate(len + std::min<size_t>(SymmCipher::BLOCKSIZE, RAIDSECTOR)), 0, len)   // SymmCipher::ctr_crypt requirement: decryption: data must be padded to BLOCKSIZE.  Also make sure we can xor up to RAIDSECTOR more for convenience
 {
 }
 
@@ -204,7 +215,8 @@ void RaidBufferManager::setIsRaid(const std::vector<std::string>& tempUrls, m_of
         raidLinesPerChunk = std::min<unsigned>(raidLinesPerChunk, 64 * 1024);
         raidLinesPerChunk = std::max<unsigned>(raidLinesPerChunk, 8 * 1024);
 
-        unusedRaidConnection = g_faultyServers.selectWorstServer(tempurls);
+        // hedging keeps even a server that failed recently in the race: it only slows itself
+        unusedRaidConnection = hedging ? unsigned(RAIDPARTS) : g_faultyServers.selectWorstServer(tempurls);
     }
 
     DEBUG_TEST_HOOK_RAIDBUFFERMANAGER_SETISRAID(this)
@@ -249,6 +261,24 @@ bool RaidBufferManager::isRaidConnectionProgressBlocked(unsigned connectionNum)
     return connectionPaused[connectionNum];
 }
 
+void RaidBufferManager::setHedging(bool hedge)
+{
+    hedging = hedge;
+}
+
+bool RaidBufferManager::isHedging() const
+{
+    return hedging;
+}
+
+bool RaidBufferManager::isRaidConnectionSuperseded(unsigned connectionNum)
+{
+    // only once everything it sent was used or dropped: what it still holds would otherwise be lost
+    return hedging && isRaid() && unusedRaidConnection == RAIDPARTS
+        && raidinputparts[connectionNum].empty()
+        && transferPos(connectionNum) + m_off_t(raidLinesPerChunk * RAIDSECTOR) <= raidpartspos;
+}
+
 
 const std::string& RaidBufferManager::tempURL(unsigned connectionNum)
 {
@@ -286,6 +316,20 @@ void RaidBufferManager::submitBuffer(unsigned connectionNum, FilePiece* piece)
         }
 
         std::deque<FilePiece*>& connectionpieces = raidinputparts[connectionNum];
+
+        if (hedging && connectionpieces.empty() && piece->pos < raidpartspos)
+        {
+            // the lines were built from the other parts: keep only what comes after them
+            m_off_t pieceend = piece->pos + m_off_t(piece->buf.datalen());
+            if (pieceend <= raidpartspos)
+            {
+                delete piece;
+                return;
+            }
+            piece->buf.start += size_t(raidpartspos - piece->pos);
+            piece->pos = raidpartspos;
+        }
+
         m_off_t contiguouspos = connectionpieces.empty() ? raidpartspos : connectionpieces.back()->pos + connectionpieces.back()->buf.datalen();
 
         assert(piece->pos == contiguouspos);
@@ -360,6 +404,13 @@ std::pair<m_off_t, m_off_t> RaidBufferManager::nextNPosForConnection(unsigned co
         m_off_t curpos = transferPos(connectionNum);  // if we use submitBuffer, transferPos() may be updated to protect against single connection failure recovery
         m_off_t maxpos = transferSize(connectionNum);
 
+        if (hedging && curpos < raidpartspos)
+        {
+            // a straggler that was left behind: those lines are built already
+            assert(raidinputparts[connectionNum].empty());
+            curpos = transferPos(connectionNum) = raidpartspos;
+        }
+
         // if this connection gets too far ahead of the others, pause it until the others catch up a bit
         if ((curpos >= raidpartspos + RaidReadAheadChunksPausePoint * raidLinesPerChunk * RAIDSECTOR) ||
             (curpos > raidpartspos + RaidReadAheadChunksUnpausePoint * raidLinesPerChunk * RAIDSECTOR && connectionPaused[connectionNum]))
@@ -434,27 +485,54 @@ void RaidBufferManager::combineRaidParts(unsigned connectionNum)
     assert(raidpartspos * (RAIDPARTS - 1) == outputfilepos + m_off_t(leftoverchunk.buf.datalen()));
 
     size_t partslen = 0x10000000, sumdatalen = 0, xorlen = 0;
+    size_t partlens[RAIDPARTS];
     for (unsigned i = RAIDPARTS; i--; )
     {
         if (raidinputparts[i].empty())
         {
-            partslen = 0;
+            partlens[i] = 0;
         }
         else
         {
             FilePiece& r = *raidinputparts[i].front();
             assert(r.pos == raidpartspos);  // check all are in sync at the front
-            partslen = std::min<size_t>(partslen, r.buf.datalen());
+            partlens[i] = r.buf.datalen();
             (i > 0 ? sumdatalen : xorlen) += r.buf.datalen();
         }
+        partslen = std::min<size_t>(partslen, partlens[i]);
     }
     partslen -= partslen % RAIDSECTOR; // restrict to raidline boundary
 
+    // with hedging, the part that arrived last can be left out of the full raid lines, if the
+    // other 5 have more of them
+    unsigned skippedpart = RAIDPARTS;
+    if (hedging && unusedRaidConnection == RAIDPARTS)
+    {
+        unsigned last = unsigned(std::min_element(partlens, partlens + RAIDPARTS) - partlens);
+        size_t otherslen = 0x10000000;
+        for (unsigned i = RAIDPARTS; i--; )
+        {
+            if (i != last)
+            {
+                otherslen = std::min<size_t>(otherslen, partlens[i]);
+            }
+        }
+        otherslen -= otherslen % RAIDSECTOR;
+
+        if (otherslen > partslen)
+        {
+            skippedpart = last;
+            partslen = otherslen;
+            (last > 0 ? sumdatalen : xorlen) += otherslen - partlens[last];  // as recovered from the others
+        }
+    }
+
     // for correct mac processing, we need to process the output file in pieces delimited by the chunkfloor / chunkceil algorithm
     m_off_t newdatafilepos = outputfilepos + leftoverchunk.buf.datalen();
     assert(newdatafilepos + m_off_t(sumdatalen) <= acquirelimitpos);
     bool processToEnd =  (newdatafilepos + m_off_t(sumdatalen) == acquirelimitpos)   // data to the end
-              &&  (newdatafilepos / (RAIDPARTS - 1) + m_off_t(xorlen) == raidPartSize(0, acquirelimitpos));  // parity to the end
+              &&  (newdatafilepos / (RAIDPARTS - 1) + m_off_t(xorlen) == raidPartSize(0, acquirelimitpos))  // parity to the end
+              &&  skippedpart == RAIDPARTS;  // the last line, which may have partial sectors, is built from all the parts
 
     assert(!partslen || !processToEnd || sumdatalen - partslen * (RAIDPARTS - 1) <= RAIDLINE);
 
@@ -463,7 +541,7 @@ void RaidBufferManager::combineRaidParts(unsigned connectionNum)
         m_off_t macchunkpos = calcOutputChunkPos(newdatafilepos + partslen * (RAIDPARTS - 1));
 
         size_t buflen = static_cast<size_t>(processToEnd ? sumdatalen : partslen * (RAIDPARTS - 1));
-        FilePiece* outputrec = combineRaidParts(partslen, buflen, outputfilepos, leftoverchunk);  // includes a bit of extra space for non-full sectors if we are at the end of the file
+        FilePiece* outputrec = combineRaidParts(partslen, buflen, outputfilepos, leftoverchunk, skippedpart);  // includes a bit of extra space for non-full sectors if we are at the end of the file
         rollInputBuffers(partslen);
         raidpartspos += partslen;
         sumdatalen -= partslen * (RAIDPARTS - 1);
@@ -521,7 +599,7 @@ void RaidBufferManager::combineRaidParts(unsigned connectionNum)
     }
 }
 
-RaidBufferManager::FilePiece* RaidBufferManager::combineRaidParts(size_t partslen, size_t bufflen, m_off_t filepos, FilePiece& prevleftoverchunk)
+RaidBufferManager::FilePiece* RaidBufferManager::combineRaidParts(size_t partslen, size_t bufflen, m_off_t filepos, FilePiece& prevleftoverchunk, unsigned skippedpart)
 {
     assert(prevleftoverchunk.buf.datalen() == 0 || prevleftoverchunk.pos == filepos);
 
@@ -538,35 +616,108 @@ RaidBufferManager::FilePiece* RaidBufferManager::combineRaidParts(size_t partsle
         byte* inputbufs[RAIDPARTS];
         for (unsigned i = RAIDPARTS; i--; )
         {
-            FilePiece* inputPiece = raidinputparts[i].front();
-            inputbufs[i] = inputPiece->buf.isNull() ? NULL : inputPiece->buf.datastart();
+            FilePiece* inputPiece = i == skippedpart ? NULL : raidinputparts[i].front();
+            inputbufs[i] = !inputPiece || inputPiece->buf.isNull() ? NULL : inputPiece->buf.datastart();
         }
 
         byte* b = result->buf.datastart() + prevleftoverchunk.buf.datalen();
-        byte* endpos = b + partslen * (RAIDPARTS-1);
+        assert(b + partslen * (RAIDPARTS-1) <= result->buf.datastart() + result->buf.datalen());
+        combineRaidLines(b, inputbufs, partslen);
+    }
+    return result;
+}
+
+bool RaidBufferManager::vectorcombine = true;
+
+#if defined(MEGA_RAID_SSE2) || defined(MEGA_RAID_NEON)
+namespace {
+
+// a raid sector in a register
+#if defined(MEGA_RAID_SSE2)
+typedef __m128i Sector;
+
+inline Sector loadsector(const byte* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+inline void storesector(byte* p, Sector s) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), s); }
+inline Sector xorsectors(Sector a, Sector b) { return _mm_xor_si128(a, b); }
+#else
+typedef uint8x16_t Sector;
+
+inline Sector loadsector(const byte* p) { return vld1q_u8(p); }
+inline void storesector(byte* p, Sector s) { vst1q_u8(p, s); }
+inline Sector xorsectors(Sector a, Sector b) { return veorq_u8(a, b); }
+#endif
+
+static_assert(sizeof(Sector) == RAIDSECTOR, "a raid sector is one vector register");
 
-        for (unsigned i = 0; b < endpos; i += RAIDSECTOR)
+} // namespace
+#endif
+
+void RaidBufferManager::combineRaidLines(byte* dest, byte* const inputbufs[RAIDPARTS], size_t partslen)
+{
+    assert(partslen % RAIDSECTOR == 0);
+
+#if defined(MEGA_RAID_SSE2) || defined(MEGA_RAID_NEON)
+    if (vectorcombine)
+    {
+        // the parity part is 0, so only a missing data part needs to be recovered (0 if none is).
+        // Read in its place the parity: the XOR of the 5 sectors read is then the missing one
+        const byte* parts[RAIDPARTS];
+        unsigned missing = 0;
+        for (unsigned j = RAIDPARTS; j--; )
         {
-            for (unsigned j = 1; j < RAIDPARTS; ++j)
+            parts[j] = inputbufs[j];
+            if (!inputbufs[j])
             {
-                assert(b + RAIDSECTOR <= result->buf.datastart() + result->buf.datalen());
-                if (inputbufs[j])
-                {
-                    memcpy(b, inputbufs[j] + i, RAIDSECTOR);
-                }
-                else
-                {
-                    recoverSectorFromParity(b, inputbufs, i);
-                }
-                b += RAIDSECTOR;
+                missing = j;
             }
         }
-        assert(b == endpos);
+        parts[missing] = parts[0];
+
+        for (size_t i = 0; i < partslen; i += RAIDSECTOR)
+        {
+            Sector s1 = loadsector(parts[1] + i);
+            Sector s2 = loadsector(parts[2] + i);
+            Sector s3 = loadsector(parts[3] + i);
+            Sector s4 = loadsector(parts[4] + i);
+            Sector s5 = loadsector(parts[5] + i);
+
+            storesector(dest, s1);
+            storesector(dest + RAIDSECTOR, s2);
+            storesector(dest + 2 * RAIDSECTOR, s3);
+            storesector(dest + 3 * RAIDSECTOR, s4);
+            storesector(dest + 4 * RAIDSECTOR, s5);
+
+            if (missing)
+            {
+                // overwrite the parity stored for it
+                storesector(dest + (missing - 1) * RAIDSECTOR,
+                            xorsectors(xorsectors(xorsectors(s1, s2), xorsectors(s3, s4)), s5));
+            }
+
+            dest += (RAIDPARTS - 1) * RAIDSECTOR;
+        }
+        return;
+    }
+#endif
+
+    for (unsigned i = 0; i < partslen; i += RAIDSECTOR)
+    {
+        for (unsigned j = 1; j < RAIDPARTS; ++j)
+        {
+            if (inputbufs[j])
+            {
+                memcpy(dest, inputbufs[j] + i, RAIDSECTOR);
+            }
+            else
+            {
+                recoverSectorFromParity(dest, inputbufs, i);
+            }
+            dest += RAIDSECTOR;
+        }
     }
-    return result;
 }
 
-void RaidBufferManager::recoverSectorFromParity(byte* dest, byte* inputbufs[], unsigned offset)
+void RaidBufferManager::recoverSectorFromParity(byte* dest, byte* const inputbufs[], unsigned offset)
 {
     assert(sizeof(m_off_t)*2 == RAIDSECTOR);
     bool set = false;
@@ -624,14 +775,18 @@ void RaidBufferManager::combineLastRaidLine(byte* dest, size_t remainingbytes)
 
 void RaidBufferManager::rollInputBuffers(size_t dataToDiscard)
 {
-    // remove finished input buffers
+    // remove finished input buffers.  A part left out by hedging may have less than that, and
+    // whatever else of it arrives is trimmed by submitBuffer()
     for (unsigned i = RAIDPARTS; i--; )
     {
-        if (!raidinputparts[i].empty())
+        size_t remaining = dataToDiscard;
+        while (remaining && !raidinputparts[i].empty())
         {
             FilePiece& ip = *raidinputparts[i].front();
-            ip.buf.start += dataToDiscard;
-            ip.pos += dataToDiscard;
+            size_t n = std::min(remaining, ip.buf.datalen());
+            ip.buf.start += n;
+            ip.pos += n;
+            remaining -= n;
             if (ip.buf.start >= ip.buf.end)
             {
                 delete raidinputparts[i].front();
@@ -664,6 +819,11 @@ bool RaidBufferManager::FilePiece::finalize(bool parallel, m_off_t filesize, int
     m_off_t endpos = ChunkedHash::chunkceil(startpos, finalpos);
     unsigned chunksize = static_cast<unsigned>(endpos - startpos);
 
+    // the whole chunks are decrypted together, with their MACs interleaved (once all are in
+    // chunkmacs, as adding entries moves the others)
+    vector<SymmCipher::CtrChunk> wholechunks;
+    vector<m_off_t> wholechunkids;
+
     while (chunksize)
     {
         m_off_t chunkid = ChunkedHash::chunkfloor(startpos);
@@ -679,10 +839,10 @@ bool RaidBufferManager::FilePiece::finalize(bool parallel, m_off_t filesize, int
                 if (parallel)
                 {
                     // these parts can be done on a thread - they are independent chunks, or the earlier part of the chunk is already done.
-                    cipher->ctr_crypt(chunkstart, chunksize, startpos, ctriv, chunkmac.mac, false, !chunkmac.finished && !chunkmac.offset);
+                    SymmCipher::CtrChunk c = { chunkstart, chunksize, startpos, nullptr, !chunkmac.finished && !chunkmac.offset };
+                    wholechunks.push_back(c);
+                    wholechunkids.push_back(chunkid);
                     LOG_debug << "Finished chunk: " << startpos << " - " << endpos << "   Size: " << chunksize;
-                    chunkmac.finished = true;
-                    chunkmac.offset = 0;
                 }
                 else
                 {
@@ -704,6 +864,23 @@ bool RaidBufferManager::FilePiece::finalize(bool parallel, m_off_t filesize, int
         chunksize = static_cast<unsigned>(endpos - startpos);
     }
 
+    if (!wholechunks.empty())
+    {
+        for (size_t i = 0; i < wholechunks.size(); i++)
+        {
+            wholechunks[i].mac = chunkmacs[wholechunkids[i]].mac;
+        }
+
+        cipher->ctr_crypt_chunks(wholechunks.data(), wholechunks.size(), ctriv, false);
+
+        for (m_off_t chunkid : wholechunkids)
+        {
+            ChunkMAC& chunkmac = chunkmacs[chunkid];
+            chunkmac.finished = true;
+            chunkmac.offset = 0;
+        }
+    }
+
     finalized = !queueParallel;
     if (finalized)
         finalizedCV.notify_one();
@@ -767,7 +944,8 @@ bool RaidBufferManager::tryRaidHttpGetErrorRecovery(unsigned errorConnectionNum,
 
 bool RaidBufferManager::detectSlowestRaidConnection(unsigned thisConnection, unsigned& slowestConnection)
 {
-    if (isRaid() && unusedRaidConnection == RAIDPARTS)
+    // hedged transfers keep all 6 connections: the slowest one is left out line by line instead
+    if (isRaid() && unusedRaidConnection == RAIDPARTS && !hedging)
     {
         connectionStarted[thisConnection] = true;
         int count = 0;
@@ -817,6 +995,7 @@ TransferBufferManager::TransferBufferManager()
 
 void TransferBufferManager::setIsRaid(Transfer* t, std::vector<std::string>& tempUrls, m_off_t resumepos, m_off_t maxRequestSize)
 {
+    setHedging(t->hedgeraid);
     RaidBufferManager::setIsRaid(tempUrls, resumepos, t->size, t->size, maxRequestSize);
 
     transfer = t;
@@ -915,6 +1094,9 @@ void TransferBufferManager::bufferWriteCompletedAction(FilePiece& r)
 DirectReadBufferManager::DirectReadBufferManager(DirectRead* dr)
 {
     directRead = dr;
+
+    // streaming is the most sensitive to a slow server
+    setHedging(true);
 }
 
 m_off_t& DirectReadBufferManager::transferPos(unsigned connectionNum)
@@ -31,6 +31,19 @@ bool Request::isFetchNodes() const
     return cmds.size() == 1 && dynamic_cast<CommandFetchNodes*>(cmds.back());
 }
 
+bool Request::pipelinable(set<handle>& keys) const
+{
+    for (Command* c : cmds)
+    {
+        if (!c->pipelinable)
+        {
+            return false;
+        }
+        keys.insert(c->pipelinekey);
+    }
+    return !cmds.empty();
+}
+
 void Request::add(Command* c)
 {
     cmds.push_back(c);
@@ -44,7 +57,16 @@ size_t Request::size() const
 void Request::get(string* req, bool& suppressSID) const
 {
     // concatenate all command objects, resulting in an API request
-    *req = "[";
+    // (sized up front, as a batch of large putnodes easily runs into megabytes)
+    size_t total = 2;
+    for (const Command* c : cmds)
+    {
+        total += c->getstring().size() + 3;
+    }
+
+    req->clear();
+    req->reserve(total);
+    req->append("[");
 
     suppressSID = true; // only if all commands in batch are suppressSID
 
@@ -101,9 +123,14 @@ void Request::process(MegaClient* client)
         auto cmdJSON = client->json;
         bool parsedOk = true;
 
+        CommandMetrics& metrics = client->metrics.command(cmd->commandStr);
+        StallWatchdog::Scope scope(cmd->commandStr ? cmd->commandStr : "?");
+        auto parseStart = std::chrono::steady_clock::now();
+
         Error e;
         if (cmd->checkError(e, client->json))
         {
+            metrics.errors += error(e) != API_OK;
             parsedOk = cmd->procresult(Command::Result(Command::CmdError, e));
         }
         else
@@ -132,6 +159,15 @@ void Request::process(MegaClient* client)
             }
 #endif
         }
+
+        metrics.count++;
+        metrics.retries += retries;
+        if (client->json.pos && cmdJSON.pos)
+        {
+            metrics.responseBytes += uint64_t(client->json.pos - cmdJSON.pos);
+        }
+        metrics.latency.record(latency);
+        metrics.parse.record(std::chrono::steady_clock::now() - parseStart);
     }
 
     json = client->json;
@@ -146,6 +182,7 @@ void Request::process(MegaClient* client)
 void Request::serverresponse(std::string&& movestring, MegaClient* client)
 {
     assert(processindex == 0);
+    latency = std::chrono::steady_clock::now() - sent;
     jsonresponse = std::move(movestring);
     json.begin(jsonresponse.c_str());
 
@@ -182,6 +219,8 @@ void Request::clear()
     json.pos = NULL;
     processindex = 0;
     stopProcessing = false;
+    id.clear();
+    retries = 0;
 }
 
 bool Request::empty() const
@@ -193,6 +232,9 @@ void Request::swap(Request& r)
 {
     // we use swap to move between queues, but process only after it gets into the completedreqs
     cmds.swap(r.cmds);
+    id.swap(r.id);
+    std::swap(sent, r.sent);
+    std::swap(retries, r.retries);
     assert(jsonresponse.empty() && r.jsonresponse.empty());
     assert(json.pos == NULL && r.json.pos == NULL);
     assert(processindex == 0 && r.processindex == 0);
@@ -247,7 +289,7 @@ bool RequestDispatcher::cmdspending() const
     return !nextreqs.front().empty();
 }
 
-void RequestDispatcher::serverrequest(string *out, bool& suppressSID, bool &includesFetchingNodes)
+void RequestDispatcher::serverrequest(string *out, bool& suppressSID, bool &includesFetchingNodes, string& id)
 {
     assert(inflightreq.empty());
     inflightreq.swap(nextreqs.front());
@@ -256,6 +298,12 @@ void RequestDispatcher::serverrequest(string *out, bool& suppressSID, bool &incl
     {
         nextreqs.push_back(Request());
     }
+    if (inflightreq.id.empty())
+    {
+        inflightreq.id = id;
+    }
+    id = inflightreq.id;
+    inflightreq.sent = std::chrono::steady_clock::now();
     inflightreq.get(out, suppressSID);
     includesFetchingNodes = inflightreq.isFetchNodes();
 #ifdef MEGA_MEASURE_CODE
@@ -270,6 +318,7 @@ void RequestDispatcher::requeuerequest()
     csBatchesReceived += 1;
 #endif
     assert(!inflightreq.empty());
+    inflightreq.retries++;
     if (!nextreqs.front().empty())
     {
         nextreqs.push_front(Request());
@@ -280,16 +329,19 @@ void RequestDispatcher::requeuerequest()
 void RequestDispatcher::serverresponse(std::string&& movestring, MegaClient *client)
 {
     CodeCounter::ScopeTimer ccst(client->performanceStats.csResponseProcessingTime);
+    ClientMetrics::Timer mt(client->metrics.csResponse, "cs");
 
 #ifdef MEGA_MEASURE_CODE
     csBatchesReceived += 1;
     csRequestsCompleted += inflightreq.size();
 #endif
     processing = true;
+    processingreq = &inflightreq;
     inflightreq.serverresponse(std::move(movestring), client);
     inflightreq.process(client);
     assert(inflightreq.empty());
     processing = false;
+    processingreq = nullptr;
     if (clearWhenSafe)
     {
         clear();
@@ -301,10 +353,12 @@ void RequestDispatcher::servererror(const std::string& e, MegaClient *client)
     // notify all the commands in the batch of the failure
     // so that they can deallocate memory, take corrective action etc.
     processing = true;
+    processingreq = &inflightreq;
     inflightreq.servererror(e, client);
     inflightreq.process(client);
     assert(inflightreq.empty());
     processing = false;
+    processingreq = nullptr;
     if (clearWhenSafe)
     {
         clear();
@@ -317,11 +371,16 @@ void RequestDispatcher::clear()
     {
         // we are being called from a command that is in progress (eg. logout) - delay wiping the data structure until that call ends.
         clearWhenSafe = true;
-        inflightreq.stopProcessing = true;
+        processingreq->stopProcessing = true;
     }
     else
     {
         inflightreq.clear();
+        for (auto& r : pipelinedreqs)
+        {
+            r.second.clear();
+        }
+        pipelinedreqs.clear();
         for (auto& r : nextreqs)
         {
             r.clear();
@@ -333,4 +392,142 @@ void RequestDispatcher::clear()
     }
 }
 
+bool RequestDispatcher::readytosend() const
+{
+    if (inflightreq.empty() && pipelinedreqs.empty())
+    {
+        return true;
+    }
+
+    set<handle> busy;
+    if (!inflightreq.empty() && !inflightreq.pipelinable(busy))
+    {
+        return false;
+    }
+    for (auto& r : pipelinedreqs)
+    {
+        if (!r.second.pipelinable(busy))
+        {
+            return false;
+        }
+    }
+
+    set<handle> next;
+    if (!nextreqs.front().pipelinable(next))
+    {
+        return false;
+    }
+    for (handle h : next)
+    {
+        if (busy.count(h))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t RequestDispatcher::pipelined() const
+{
+    return pipelinedreqs.size();
+}
+
+void RequestDispatcher::pipelinerequest(string* out, bool& suppressSID, string& id)
+{
+    if (!nextreqs.front().id.empty())
+    {
+        id = nextreqs.front().id;
+    }
+
+    Request& r = pipelinedreqs[id];
+    assert(r.empty());
+    r.swap(nextreqs.front());
+    r.id = id;
+    r.sent = std::chrono::steady_clock::now();
+    nextreqs.pop_front();
+    if (nextreqs.empty())
+    {
+        nextreqs.push_back(Request());
+    }
+    r.get(out, suppressSID);
+#ifdef MEGA_MEASURE_CODE
+    csRequestsSent += r.size();
+    csBatchesSent += 1;
+#endif
+}
+
+void RequestDispatcher::pipelinedresponse(const string& id, string&& movestring, MegaClient* client)
+{
+    auto it = pipelinedreqs.find(id);
+    if (it == pipelinedreqs.end())
+    {
+        // cleared meanwhile
+        return;
+    }
+
+#ifdef MEGA_MEASURE_CODE
+    csBatchesReceived += 1;
+    csRequestsCompleted += it->second.size();
+#endif
+    processing = true;
+    processingreq = &it->second;
+    it->second.serverresponse(std::move(movestring), client);
+    it->second.process(client);
+    assert(it->second.empty());
+    processing = false;
+    processingreq = nullptr;
+    if (clearWhenSafe)
+    {
+        clear();
+    }
+    else
+    {
+        pipelinedreqs.erase(it);
+    }
+}
+
+void RequestDispatcher::pipelinederror(const string& id, const std::string& e, MegaClient* client)
+{
+    auto it = pipelinedreqs.find(id);
+    if (it == pipelinedreqs.end())
+    {
+        return;
+    }
+
+    processing = true;
+    processingreq = &it->second;
+    it->second.servererror(e, client);
+    it->second.process(client);
+    assert(it->second.empty());
+    processing = false;
+    processingreq = nullptr;
+    if (clearWhenSafe)
+    {
+        clear();
+    }
+    else
+    {
+        pipelinedreqs.erase(it);
+    }
+}
+
+void RequestDispatcher::pipelinedrequeue(const string& id)
+{
+    auto it = pipelinedreqs.find(id);
+    if (it == pipelinedreqs.end())
+    {
+        return;
+    }
+
+    it->second.retries++;
+
+    // before those queued after it (the order among those in flight doesn't matter)
+    if (!nextreqs.front().empty())
+    {
+        nextreqs.push_front(Request());
+    }
+    nextreqs.front().swap(it->second);
+    pipelinedreqs.erase(it);
+}
+
 } // namespace
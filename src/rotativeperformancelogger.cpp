@@ -39,6 +39,7 @@
 #include <zlib.h>
 
 #include "megaapi_impl.h"
+#include "mega/binarylog.h"
 #include "mega/rotativeperformancelogger.h"
 
 #ifdef WIN32
@@ -131,7 +132,7 @@ class RotativePerformanceLoggerLoggingThread
     LogLinkedList mLogListFirst;
     LogLinkedList* mLogListLast = &mLogListFirst;
     bool mLogExit = false;
-    bool mFlushLog = false;
+    std::atomic<bool> mFlushLog{false};
     bool mCloseLog = false;
     bool mForceRenew = false; //to force removal of all logs and create an empty new log
     int mFlushOnLevel = MegaApi::LOG_LEVEL_WARNING;
@@ -141,6 +142,10 @@ class RotativePerformanceLoggerLoggingThread
     ArchiveType mArchiveType = archiveTypeTimestamp;
     long int archiveMaxFileAgeSeconds = 30 * 86400; // one month
 
+    // records instead of text, without locks for the threads that log (see binarylog.h)
+    std::unique_ptr<BinaryLogWriter> mBinaryLog;
+    std::atomic<bool> mBinaryPending{false};
+
     friend RotativePerformanceLogger;
 
 public:
@@ -154,6 +159,7 @@ public:
         if (!mLogThread)
         {
             mLogThread.reset(new std::thread([this, logsPath, fileName]() {
+                ThreadConfig::apply(THREAD_ROLE_BACKGROUND);
                 logThreadFunction(logsPath, fileName);
             }));
         }
@@ -165,7 +171,7 @@ public:
     {
         std::unique_ptr<MegaFileSystemAccess> fsAccess(new MegaFileSystemAccess());
 
-        std::ifstream file(localPath.localpath.c_str(), std::ofstream::out);
+        std::ifstream file(localPath.localpath.c_str(), std::ifstream::in | std::ifstream::binary);
         if (!file.is_open())
         {
             std::cerr << "Unable to open log file for reading: " << localPath.toPath(*fsAccess) << std::endl;
@@ -184,11 +190,11 @@ public:
             return;
         }
 
-        std::string line;
-        while (std::getline(file, line))
+        // in blocks, as the binary logs have no lines
+        std::unique_ptr<char[]> buffer(new char[65536]);
+        while (file.read(buffer.get(), 65536) || file.gcount())
         {
-            line.push_back('\n');
-            if (gzputs(gzfile.get(), line.c_str()) == -1)
+            if (gzwrite(gzfile.get(), buffer.get(), unsigned(file.gcount())) <= 0)
             {
                 std::cerr << "Unable to compress log file: " << localPath.toPath(*fsAccess) << std::endl;
                 return;
@@ -396,14 +402,36 @@ private:
         }
     }
 
+    // what a file starts with (in binary, its header), and its size
+    long long startFile(std::ofstream& outputFile)
+    {
+        if (!mBinaryLog)
+        {
+            return 0;
+        }
+        outputFile << BinaryLogWriter::header();
+        return static_cast<long long>(BinaryLog::MAGICSIZE);
+    }
+
     void logThreadFunction(LocalPath logsPath, LocalPath fileName)
     {
         LocalPath fileNameFullPath = logsPath;
         fileNameFullPath.appendWithSeparator(fileName, false);
 
-        std::ofstream outputFile(fileNameFullPath.localpath.c_str(), std::ofstream::out | std::ofstream::app);
+        std::ofstream outputFile(fileNameFullPath.localpath.c_str(), std::ofstream::out | std::ofstream::app | std::ofstream::binary);
+
+        // each run appends its own header, which readers skip.  A new file names the threads again
+        bool newFile = true;
+        BinaryLog::Reader stdoutReader(nullptr, 0);
 
-        outputFile << "----------------------------- program start -----------------------------\n";
+        if (mBinaryLog)
+        {
+            outputFile << BinaryLogWriter::header() << BinaryLogWriter::message(MegaApi::LOG_LEVEL_INFO, "program start");
+        }
+        else
+        {
+            outputFile << "----------------------------- program start -----------------------------\n";
+        }
         long long outFileSize = outputFile.tellp();
 
         while (!mLogExit)
@@ -421,9 +449,10 @@ private:
                     std::cerr << "Error removing log file " << fileNameFullPath.toPath(*mFsAccess) << std::endl;
                 }
 
-                outputFile.open(fileNameFullPath.localpath.c_str(), std::ofstream::out);
+                outputFile.open(fileNameFullPath.localpath.c_str(), std::ofstream::out | std::ofstream::binary);
 
-                outFileSize = 0;
+                outFileSize = startFile(outputFile);
+                newFile = true;
 
                 mForceRenew = false;
             }
@@ -442,13 +471,15 @@ private:
                 mFsAccess->renamelocal(fileNameFullPath, newNameZipping, true);
 
                 std::thread t([=]() {
+                    ThreadConfig::apply(THREAD_ROLE_BACKGROUND);
                     std::lock_guard<std::mutex> g(mLogRotationMutex); // prevent another rotation while we work on this file
                     gzipCompressOnRotate(newNameZipping, newNameDone);
                 });
                 t.detach();
 
-                outputFile.open(fileNameFullPath.localpath.c_str(), std::ofstream::out);
-                outFileSize = 0;
+                outputFile.open(fileNameFullPath.localpath.c_str(), std::ofstream::out | std::ofstream::binary);
+                outFileSize = startFile(outputFile);
+                newFile = true;
             }
 
             LogLinkedList* newMessages = nullptr;
@@ -456,8 +487,9 @@ private:
             {
                 std::unique_lock<std::mutex> lock(mLogMutex);
                 mLogConditionVariable.wait_for(lock, std::chrono::milliseconds(500), [this, &newMessages, &topLevelMemoryGap]() {
-                        if (mForceRenew || mLogListFirst.mNext || mLogExit || mFlushLog || mCloseLog)
+                        if (mForceRenew || mLogListFirst.mNext || mLogExit || mFlushLog || mCloseLog || mBinaryPending)
                         {
+                            mBinaryPending = false;
                             newMessages = mLogListFirst.mNext;
                             mLogListFirst.mNext = nullptr;
                             mLogListLast = &mLogListFirst;
@@ -513,6 +545,30 @@ private:
                 p->notifyWaiter();
                 free(p);
             }
+
+            if (mBinaryLog)
+            {
+                std::string records;
+                mBinaryLog->drain(records, newFile);
+                newFile = false;
+
+                if (outputFile)
+                {
+                    outputFile << records;
+                    outFileSize += static_cast<long long>(records.size());
+                }
+
+                if (RotativePerformanceLogger::Instance().mLogToStdout && !records.empty())
+                {
+                    BinaryLog::Record r;
+                    stdoutReader.feed(records.data(), records.size());
+                    while (stdoutReader.next(r))
+                    {
+                        std::cout << stdoutReader.format(r);
+                    }
+                    std::cout << std::flush;
+                }
+            }
             if (mFlushLog || mNextFlushTime <= std::chrono::steady_clock::now())
             {
                 mFlushLog = false;
@@ -551,10 +607,11 @@ RotativePerformanceLogger::~RotativePerformanceLogger()
     mLoggingThread->mLogThread.reset();
 }
 
-void RotativePerformanceLogger::initialize(const char * logsPath, const char * logFileName, bool logToStdout)
+void RotativePerformanceLogger::initialize(const char * logsPath, const char * logFileName, bool logToStdout, bool binary)
 {
+    // the binary logs are kept apart, so that no file has both
     auto logsPathLocalPath = LocalPath::fromPlatformEncoded(logsPath);
-    auto logFileNameLocalPath = LocalPath::fromPlatformEncoded(logFileName);
+    auto logFileNameLocalPath = LocalPath::fromPlatformEncoded(std::string(logFileName) + (binary ? ".bin" : ""));
 
     mLogToStdout = logToStdout;
 
@@ -562,6 +619,10 @@ void RotativePerformanceLogger::initialize(const char * logsPath, const char * l
     fsAccess->mkdirlocal(logsPathLocalPath, false);
 
     mLoggingThread.reset(new RotativePerformanceLoggerLoggingThread());
+    if (binary)
+    {
+        mLoggingThread->mBinaryLog.reset(new BinaryLogWriter());
+    }
     mLoggingThread->startLoggingThread(logsPathLocalPath, logFileNameLocalPath);
 
     MegaApi::setLogLevel(MegaApi::LOG_LEVEL_MAX);
@@ -683,6 +744,21 @@ void RotativePerformanceLogger::log(const char*, int loglevel, const char*, cons
 
 void RotativePerformanceLoggerLoggingThread::log(int loglevel, const char *message, const char **directMessages, size_t *directMessagesSizes, int numberMessages)
 {
+    if (mBinaryLog)
+    {
+        // no lock and no formatting here: the logging thread writes the records as they are
+        if (mBinaryLog->log(loglevel, message, directMessages, directMessagesSizes, numberMessages))
+        {
+            mBinaryPending = true;
+            mLogConditionVariable.notify_one();
+        }
+        if (loglevel <= mFlushOnLevel)
+        {
+            mFlushLog = true;
+        }
+        return;
+    }
+
     bool direct = directMessages != nullptr;
 
     char timebuf[LOG_TIME_CHARS + 1];
@@ -0,0 +1,169 @@
+/**
+ * @file searchindex.cpp
+ * @brief Node name index for substring searches
+ *
+ * (c) 2013-2021 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include "mega/searchindex.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace mega {
+
+string SearchIndex::lowercase(const char* s)
+{
+    string result(s);
+    for (char& c : result)
+    {
+        if (c >= 'A' && c <= 'Z')
+        {
+            c = static_cast<char>(c - 'A' + 'a');
+        }
+    }
+    return result;
+}
+
+void SearchIndex::trigrams(const string& name, std::vector<trigram>& out)
+{
+    out.clear();
+    for (size_t i = 0; i + 3 <= name.size(); i++)
+    {
+        out.push_back(trigram(static_cast<unsigned char>(name[i])) << 16
+                    | trigram(static_cast<unsigned char>(name[i + 1])) << 8
+                    | trigram(static_cast<unsigned char>(name[i + 2])));
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+void SearchIndex::unindex(Node* n, const Entry& e)
+{
+    std::vector<trigram> tg;
+    trigrams(e.name, tg);
+    for (trigram t : tg)
+    {
+        auto it = mTrigrams.find(t);
+        if (it != mTrigrams.end())
+        {
+            it->second.erase(n);
+            if (it->second.empty())
+            {
+                mTrigrams.erase(it);
+            }
+        }
+    }
+}
+
+void SearchIndex::update(Node* n, const string& name, unsigned types)
+{
+    string lname = lowercase(name.c_str());
+
+    auto it = mEntries.find(n);
+    if (it != mEntries.end())
+    {
+        it->second.types = types;
+        if (it->second.name == lname)
+        {
+            return;
+        }
+        unindex(n, it->second);
+        it->second.name = std::move(lname);
+    }
+    else
+    {
+        it = mEntries.emplace(n, Entry{std::move(lname), types}).first;
+    }
+
+    std::vector<trigram> tg;
+    trigrams(it->second.name, tg);
+    for (trigram t : tg)
+    {
+        mTrigrams[t].insert(n);
+    }
+}
+
+void SearchIndex::remove(Node* n)
+{
+    auto it = mEntries.find(n);
+    if (it != mEntries.end())
+    {
+        unindex(n, it->second);
+        mEntries.erase(it);
+    }
+}
+
+void SearchIndex::clear()
+{
+    mEntries.clear();
+    mTrigrams.clear();
+}
+
+node_vector SearchIndex::find(const char* search, unsigned types) const
+{
+    node_vector result;
+    string lsearch = lowercase(search ? search : "");
+
+    auto matches = [&](const Entry& e)
+    {
+        return (!types || (e.types & types))
+            && (lsearch.empty() || strstr(e.name.c_str(), lsearch.c_str()));
+    };
+
+    std::vector<trigram> tg;
+    trigrams(lsearch, tg);
+    if (tg.empty())
+    {
+        // too short to use the trigrams
+        for (const auto& e : mEntries)
+        {
+            if (matches(e.second))
+            {
+                result.push_back(e.first);
+            }
+        }
+        return result;
+    }
+
+    // every match contains all the trigrams of the search string: only check the nodes having the rarest one
+    const std::unordered_set<Node*>* rarest = nullptr;
+    for (trigram t : tg)
+    {
+        auto it = mTrigrams.find(t);
+        if (it == mTrigrams.end())
+        {
+            return result;
+        }
+        if (!rarest || it->second.size() < rarest->size())
+        {
+            rarest = &it->second;
+        }
+    }
+
+    for (Node* n : *rarest)
+    {
+        auto it = mEntries.find(n);
+        if (it != mEntries.end() && matches(it->second))
+        {
+            result.push_back(n);
+        }
+    }
+    return result;
+}
+
+} // namespace
@@ -0,0 +1,580 @@
+/**
+ * @file statesnapshot.cpp
+ * @brief Compacted copy of the local state cache for fast session resumption
+ *
+ * (c) 2013-2021 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include "mega/statesnapshot.h"
+#include "mega/logging.h"
+#include "mega/utils.h"
+
+namespace mega {
+
+const char StateSnapshot::MAGIC[8] = { 'M', 'E', 'G', 'A', 'S', 'N', 'P', '1' };
+
+namespace {
+
+// each record and log entry starts with its id and size
+const size_t HEADERSIZE = 2 * sizeof(uint32_t);
+
+// the image is written in chunks of about this size
+const size_t IMAGECHUNK = 1 << 20;
+
+// a log offset standing for a deleted record
+const size_t REMOVED = size_t(-1);
+
+void appendheader(string* s, uint32_t id, uint32_t size)
+{
+    s->append(reinterpret_cast<const char*>(&id), sizeof id);
+    s->append(reinterpret_cast<const char*>(&size), sizeof size);
+}
+
+// the entry at pos of a sequence of them, if it fits
+bool readheader(const string& s, size_t pos, uint32_t* id, uint32_t* size)
+{
+    if (s.size() - pos < HEADERSIZE)
+    {
+        return false;
+    }
+
+    *id = MemAccess::get<uint32_t>(s.data() + pos);
+    *size = MemAccess::get<uint32_t>(s.data() + pos + sizeof(uint32_t));
+    return true;
+}
+
+// the scsn record (id 0) is stored unencrypted, as a handle
+bool readscsn(const char* data, uint32_t size, handle* scsn)
+{
+    if (size != sizeof *scsn)
+    {
+        return false;
+    }
+
+    *scsn = MemAccess::get<handle>(data);
+    return true;
+}
+
+} // namespace
+
+StateSnapshot::StateSnapshot(FileSystemAccess& fsaccess, const LocalPath& rootpath, const string& name)
+    : mFsAccess(fsaccess)
+    , mImagePath(path(rootpath, name, ".snap"))
+    , mTempPath(path(rootpath, name, ".snap.tmp"))
+    , mLogPath(path(rootpath, name, ".log"))
+{
+}
+
+LocalPath StateSnapshot::path(const LocalPath& rootpath, const string& name, const char* suffix) const
+{
+    LocalPath p = rootpath;
+    p.appendWithSeparator(LocalPath::fromPath("megaclient_statesnapshot_" + name + suffix, mFsAccess), false);
+    return p;
+}
+
+bool StateSnapshot::load(handle scsn)
+{
+    release();
+    mLogFile.reset();
+    mPending.clear();
+
+    auto fa = mFsAccess.newfileaccess(false);
+    if (!fa->fopen(mImagePath, true, false)
+            || !fa->fread(&mImage, unsigned(fa->size), 0, 0)
+            || mImage.size() < sizeof MAGIC
+            || memcmp(mImage.data(), MAGIC, sizeof MAGIC))
+    {
+        LOG_debug << "No usable state snapshot";
+        release();
+        return false;
+    }
+
+    // the image must be complete, and start with the scsn it was written at
+    handle snapshotscsn = UNDEF;
+    uint32_t id, size;
+    size_t pos = sizeof MAGIC;
+
+    while (readheader(mImage, pos, &id, &size) && mImage.size() - pos - HEADERSIZE >= size)
+    {
+        if (pos == sizeof MAGIC && (id || !readscsn(mImage.data() + pos + HEADERSIZE, size, &snapshotscsn)))
+        {
+            break;
+        }
+
+        pos += HEADERSIZE + size;
+    }
+
+    if (pos != mImage.size() || ISUNDEF(snapshotscsn))
+    {
+        LOG_warn << "Corrupt state snapshot image";
+        release();
+        return false;
+    }
+
+    // replay the committed part of the log.  A torn entry at the end, or entries without their
+    // commit marker, belong to a transaction that the table may not have committed either
+    fa = mFsAccess.newfileaccess(false);
+    if (fa->fopen(mLogPath, true, false) && !fa->fread(&mLog, unsigned(fa->size), 0, 0))
+    {
+        mLog.clear();
+    }
+
+    size_t committed = 0;
+    std::vector<std::pair<uint32_t, size_t>> transaction;
+
+    for (pos = 0; readheader(mLog, pos, &id, &size); )
+    {
+        size_t datasize = (size == DELETED) ? 0 : size;
+
+        if (mLog.size() - pos - HEADERSIZE < datasize)
+        {
+            break;
+        }
+
+        if (id == COMMIT)
+        {
+            for (auto& entry : transaction)
+            {
+                mChanged[entry.first] = entry.second;
+
+                if (entry.second != REMOVED)
+                {
+                    mPuts.push_back(entry.second);
+
+                    if (!entry.first)
+                    {
+                        readscsn(mLog.data() + entry.second + HEADERSIZE, MemAccess::get<uint32_t>(mLog.data() + entry.second + sizeof(uint32_t)), &snapshotscsn);
+                    }
+                }
+            }
+
+            transaction.clear();
+            committed = pos + HEADERSIZE;
+        }
+        else
+        {
+            transaction.emplace_back(id, (size == DELETED) ? REMOVED : pos);
+        }
+
+        pos += HEADERSIZE + datasize;
+    }
+
+    mLog.resize(committed);
+
+    if (snapshotscsn != scsn)
+    {
+        LOG_debug << "State snapshot is not in sync with the local cache";
+        discard();
+        return false;
+    }
+
+    // keep logging where the committed entries end
+    if (!openlog(mLog))
+    {
+        discard();
+        return false;
+    }
+
+    mImageSize = m_off_t(mImage.size());
+    mImagePos = sizeof MAGIC;
+    mPutPos = 0;
+
+    LOG_debug << "Loaded state snapshot: " << mImage.size() << " bytes of image, " << mLog.size() << " bytes of log";
+    return true;
+}
+
+bool StateSnapshot::next(uint32_t* id, string* data)
+{
+    uint32_t size;
+
+    while (readheader(mImage, mImagePos, id, &size))
+    {
+        size_t pos = mImagePos;
+        mImagePos += HEADERSIZE + size;
+
+        if (!mChanged.count(*id))
+        {
+            data->assign(mImage, pos + HEADERSIZE, size);
+            return true;
+        }
+    }
+
+    while (mPutPos < mPuts.size())
+    {
+        size_t pos = mPuts[mPutPos++];
+
+        readheader(mLog, pos, id, &size);
+
+        // only the latest put of each record counts
+        if (mChanged[*id] == pos)
+        {
+            data->assign(mLog, pos + HEADERSIZE, size);
+            return true;
+        }
+    }
+
+    release();
+    return false;
+}
+
+bool StateSnapshot::beginimage()
+{
+    mLogFile.reset();
+    mPending.clear();
+    release();
+
+    mImageFile = mFsAccess.newfileaccess(false);
+    mImageBuffer.assign(MAGIC, sizeof MAGIC);
+    mImageSize = 0;
+
+    if (!mImageFile->fopen(mTempPath, false, true) || !mImageFile->ftruncate())
+    {
+        LOG_warn << "Unable to create state snapshot: " << mTempPath.toPath(mFsAccess);
+        writefailed();
+        return false;
+    }
+
+    return true;
+}
+
+bool StateSnapshot::addrecord(uint32_t id, const char* data, size_t size)
+{
+    if (!mImageFile)
+    {
+        return false;
+    }
+
+    appendheader(&mImageBuffer, id, uint32_t(size));
+    mImageBuffer.append(data, size);
+
+    return mImageBuffer.size() < IMAGECHUNK || flushimage();
+}
+
+bool StateSnapshot::flushimage()
+{
+    if (!mImageFile->fwrite(reinterpret_cast<const byte*>(mImageBuffer.data()), unsigned(mImageBuffer.size()), mImageSize))
+    {
+        LOG_warn << "Unable to write state snapshot: " << mTempPath.toPath(mFsAccess);
+        writefailed();
+        return false;
+    }
+
+    mImageSize += m_off_t(mImageBuffer.size());
+    mImageBuffer.clear();
+    return true;
+}
+
+bool StateSnapshot::endimage()
+{
+    if (!mImageFile || !flushimage())
+    {
+        return false;
+    }
+
+    mImageFile.reset();
+
+    if (!mFsAccess.renamelocal(mTempPath, mImagePath, true) || !openlog(string()))
+    {
+        LOG_warn << "Unable to replace state snapshot: " << mImagePath.toPath(mFsAccess);
+        writefailed();
+        return false;
+    }
+
+    LOG_debug << "State snapshot written: " << mImageSize << " bytes";
+    return true;
+}
+
+bool StateSnapshot::openlog(const string& committed)
+{
+    mLogFile = mFsAccess.newfileaccess(false);
+    mLogSize = m_off_t(committed.size());
+
+    if (mLogFile->fopen(mLogPath, false, true)
+            && mLogFile->ftruncate()
+            && (committed.empty() || mLogFile->fwrite(reinterpret_cast<const byte*>(committed.data()), unsigned(committed.size()), 0)))
+    {
+        return true;
+    }
+
+    LOG_warn << "Unable to open state snapshot log: " << mLogPath.toPath(mFsAccess);
+    mLogFile.reset();
+    return false;
+}
+
+void StateSnapshot::logput(uint32_t id, const char* data, unsigned size)
+{
+    if (mLogFile)
+    {
+        appendheader(&mPending, id, size);
+        mPending.append(data, size);
+    }
+}
+
+void StateSnapshot::logdel(uint32_t id)
+{
+    if (mLogFile)
+    {
+        appendheader(&mPending, id, DELETED);
+    }
+}
+
+void StateSnapshot::logcommit()
+{
+    if (mLogFile && !mPending.empty())
+    {
+        appendheader(&mPending, COMMIT, 0);
+
+        if (!mLogFile->fwrite(reinterpret_cast<const byte*>(mPending.data()), unsigned(mPending.size()), mLogSize))
+        {
+            // the log would miss changes the table has: the image can't be used anymore
+            LOG_warn << "Unable to append to state snapshot log: " << mLogPath.toPath(mFsAccess);
+            writefailed();
+            return;
+        }
+
+        mLogSize += m_off_t(mPending.size());
+    }
+
+    mPending.clear();
+}
+
+void StateSnapshot::logabort()
+{
+    mPending.clear();
+}
+
+void StateSnapshot::discard()
+{
+    mImageFile.reset();
+    mLogFile.reset();
+    mImageBuffer.clear();
+    mPending.clear();
+    mImageSize = 0;
+    mLogSize = 0;
+    release();
+
+    mFsAccess.unlinklocal(mImagePath);
+    mFsAccess.unlinklocal(mTempPath);
+    mFsAccess.unlinklocal(mLogPath);
+}
+
+bool StateSnapshot::imagedue() const
+{
+    // rewriting the image costs about as much as replaying a log of its size
+    return !mWriteFailed && (!mLogFile || mLogSize > mImageSize / 2);
+}
+
+void StateSnapshot::writefailed()
+{
+    // the table is read as before from now on; another image is attempted in the next session
+    discard();
+    mWriteFailed = true;
+}
+
+void StateSnapshot::release()
+{
+    string().swap(mImage);
+    string().swap(mLog);
+    mChanged.clear();
+    mPuts.clear();
+    mImagePos = 0;
+    mPutPos = 0;
+}
+
+SnapshottedDbTable::SnapshottedDbTable(PrnGen& rng, std::unique_ptr<DbTable> table, std::unique_ptr<StateSnapshot> snapshot)
+    : DbTable(rng, false)
+    , mTable(std::move(table))
+    , mSnapshot(std::move(snapshot))
+{
+}
+
+SnapshottedDbTable::~SnapshottedDbTable()
+{
+    resetCommitter();
+}
+
+StateSnapshot& SnapshottedDbTable::snapshot()
+{
+    return *mSnapshot;
+}
+
+void SnapshottedDbTable::rewind()
+{
+    mTable->rewind();
+}
+
+bool SnapshottedDbTable::next(uint32_t* id, string* data)
+{
+    return mTable->next(id, data);
+}
+
+bool SnapshottedDbTable::get(uint32_t id, string* data)
+{
+    return mTable->get(id, data);
+}
+
+bool SnapshottedDbTable::put(uint32_t id, char* data, unsigned size)
+{
+    if (!mTable->put(id, data, size))
+    {
+        return false;
+    }
+
+    mSnapshot->logput(id, data, size);
+    return true;
+}
+
+bool SnapshottedDbTable::del(uint32_t id)
+{
+    if (!mTable->del(id))
+    {
+        return false;
+    }
+
+    mSnapshot->logdel(id);
+    return true;
+}
+
+bool SnapshottedDbTable::putBatch(const RecordBatch& batch)
+{
+    if (!mTable->putBatch(batch))
+    {
+        return false;
+    }
+
+    for (auto& record : batch)
+    {
+        mSnapshot->logput(record.first, record.second.data(), unsigned(record.second.size()));
+    }
+    return true;
+}
+
+bool SnapshottedDbTable::delBatch(const vector<uint32_t>& ids)
+{
+    if (!mTable->delBatch(ids))
+    {
+        return false;
+    }
+
+    for (uint32_t id : ids)
+    {
+        mSnapshot->logdel(id);
+    }
+    return true;
+}
+
+bool SnapshottedDbTable::delRange(const vector<uint32_t>& ids)
+{
+    if (!mTable->delRange(ids))
+    {
+        return false;
+    }
+
+    for (uint32_t id : ids)
+    {
+        mSnapshot->logdel(id);
+    }
+    return true;
+}
+
+bool SnapshottedDbTable::putNodeRecord(const DbNodeRecord& record)
+{
+    if (!mTable->putNodeRecord(record))
+    {
+        return false;
+    }
+
+    mSnapshot->logput(record.id, record.data.data(), unsigned(record.data.size()));
+    return true;
+}
+
+bool SnapshottedDbTable::getChildren(handle parent, NodeRefs* refs)
+{
+    return mTable->getChildren(parent, refs);
+}
+
+bool SnapshottedDbTable::getByFingerprint(const FileFingerprint& fingerprint, NodeRefs* refs)
+{
+    return mTable->getByFingerprint(fingerprint, refs);
+}
+
+bool SnapshottedDbTable::nodeIndexComplete()
+{
+    return mTable->nodeIndexComplete();
+}
+
+void SnapshottedDbTable::setNodeIndexComplete()
+{
+    mTable->setNodeIndexComplete();
+}
+
+int64_t SnapshottedDbTable::reclaimableBytes()
+{
+    return mTable->reclaimableBytes();
+}
+
+int64_t SnapshottedDbTable::reclaimSpace(int64_t maxBytes)
+{
+    return mTable->reclaimSpace(maxBytes);
+}
+
+bool SnapshottedDbTable::vacuum()
+{
+    return mTable->vacuum();
+}
+
+void SnapshottedDbTable::truncate()
+{
+    mSnapshot->discard();
+    mTable->truncate();
+}
+
+void SnapshottedDbTable::begin()
+{
+    mTable->begin();
+}
+
+void SnapshottedDbTable::commit()
+{
+    mTable->commit();
+    mSnapshot->logcommit();
+}
+
+void SnapshottedDbTable::abort()
+{
+    mTable->abort();
+    mSnapshot->logabort();
+}
+
+void SnapshottedDbTable::remove()
+{
+    mSnapshot->discard();
+    mTable->remove();
+}
+
+void SnapshottedDbTable::removeLater(vector<LocalPath>& files)
+{
+    mSnapshot->discard();
+    mTable->removeLater(files);
+}
+
+bool SnapshottedDbTable::inTransaction() const
+{
+    return mTable->inTransaction();
+}
+
+} // namespace
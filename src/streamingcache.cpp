@@ -0,0 +1,192 @@
+/**
+ * @file streamingcache.cpp
+ * @brief Decrypted file data kept for streaming reads
+ *
+ * (c) 2013-2021 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include "mega/streamingcache.h"
+
+#include <algorithm>
+
+#include "mega/waiter.h"
+
+namespace mega {
+
+void StreamingCache::setCapacity(m_off_t bytes)
+{
+    mCapacity = std::max<m_off_t>(bytes, 0);
+    evict();
+}
+
+void StreamingCache::put(handle h, m_off_t pos, const byte* data, size_t len)
+{
+    if (!mCapacity || !len)
+    {
+        return;
+    }
+
+    NodeData& node = mNodes[h];
+    m_off_t end = pos + m_off_t(len);
+
+    // only the gaps between the segments kept already
+    auto it = node.segments.upper_bound(pos);
+    if (it != node.segments.begin())
+    {
+        auto prev = std::prev(it);
+        pos = std::max(pos, prev->first + m_off_t(prev->second.data.size()));
+    }
+
+    while (pos < end)
+    {
+        m_off_t gapend = it == node.segments.end() ? end : std::min(end, it->first);
+        if (pos < gapend)
+        {
+            insert(h, node, pos, data + (len - size_t(end - pos)), size_t(gapend - pos));
+        }
+
+        if (it == node.segments.end())
+        {
+            break;
+        }
+
+        pos = std::max(pos, it->first + m_off_t(it->second.data.size()));
+        ++it;
+    }
+
+    evict();
+}
+
+size_t StreamingCache::get(handle h, m_off_t pos, m_off_t len, string& out)
+{
+    auto n = mNodes.find(h);
+    if (n == mNodes.end() || len <= 0)
+    {
+        return 0;
+    }
+
+    auto& segments = n->second.segments;
+    auto it = segments.upper_bound(pos);
+    if (it == segments.begin())
+    {
+        return 0;
+    }
+    --it;
+
+    size_t appended = 0;
+    m_off_t end = pos + len;
+    while (it != segments.end() && it->first <= pos && pos < end)
+    {
+        const string& data = it->second.data;
+        m_off_t segmentend = it->first + m_off_t(data.size());
+        if (segmentend <= pos)
+        {
+            break;
+        }
+
+        size_t take = size_t(std::min(segmentend, end) - pos);
+        out.append(data, size_t(pos - it->first), take);
+        appended += take;
+        pos += m_off_t(take);
+
+        mLru.splice(mLru.begin(), mLru, it->second.lru);
+        ++it;
+    }
+    return appended;
+}
+
+m_off_t StreamingCache::readahead(handle h, m_off_t offset, m_off_t count, m_off_t minrate)
+{
+    if (!mCapacity)
+    {
+        return 0;
+    }
+
+    NodeData& node = mNodes[h];
+
+    // a read where the last one ended tells how fast the node is played
+    if (offset == node.readend && Waiter::ds > node.readstart)
+    {
+        m_off_t rate = (node.readend - node.readoffset) * 10 / m_off_t(Waiter::ds - node.readstart);
+        node.rate = node.rate ? (node.rate + rate) / 2 : rate;
+    }
+    else if (offset != node.readend)
+    {
+        // a seek: the rate is of the playback, not of the jumps
+        node.rate = 0;
+    }
+
+    node.readoffset = offset;
+    node.readend = offset + count;
+    node.readstart = Waiter::ds;
+
+    // no more than a quarter of the cache, to keep what was read before too
+    return std::min(std::max(node.rate, minrate) * READAHEADSECONDS, mCapacity / 4);
+}
+
+void StreamingCache::remove(handle h)
+{
+    auto n = mNodes.find(h);
+    if (n != mNodes.end())
+    {
+        for (auto& s : n->second.segments)
+        {
+            mSize -= m_off_t(s.second.data.size());
+            mLru.erase(s.second.lru);
+        }
+        mNodes.erase(n);
+    }
+}
+
+void StreamingCache::clear()
+{
+    mNodes.clear();
+    mLru.clear();
+    mSize = 0;
+}
+
+void StreamingCache::insert(handle h, NodeData& node, m_off_t pos, const byte* data, size_t len)
+{
+    Segment& s = node.segments[pos];
+    s.data.assign(reinterpret_cast<const char*>(data), len);
+    s.lru = mLru.insert(mLru.begin(), SegmentKey(h, pos));
+    mSize += m_off_t(len);
+}
+
+void StreamingCache::evict()
+{
+    while (mSize > mCapacity && !mLru.empty())
+    {
+        SegmentKey key = mLru.back();
+        mLru.pop_back();
+
+        auto n = mNodes.find(key.first);
+        assert(n != mNodes.end());
+        auto s = n->second.segments.find(key.second);
+        assert(s != n->second.segments.end());
+
+        mSize -= m_off_t(s->second.data.size());
+        n->second.segments.erase(s);
+
+        if (n->second.segments.empty())
+        {
+            mNodes.erase(n);
+        }
+    }
+}
+
+} // namespace
@@ -18,6 +18,10 @@
  * You should have received a copy of the license along with this
  * program.
  */
+
+// the level of the sync module applies (see SimpleLogger::setModuleLogLevel)
+#define MEGA_LOG_MODULE ::mega::logModuleSync
+
 #include <cctype>
 #include <type_traits>
 #include <unordered_set>
@@ -39,6 +43,10 @@ const int Sync::EXTRA_SCANNING_DELAY_DS = 150;
 const int Sync::FILE_UPDATE_DELAY_DS = 30;
 const int Sync::FILE_UPDATE_MAX_DELAY_SECS = 60;
 const dstime Sync::RECENT_VERSION_INTERVAL_SECS = 10800;
+const dstime Sync::CHANGE_CURSOR_INTERVAL_DS = 600;
+const unsigned Sync::MAXTRANSFERS = 1000;
+const dstime Sync::MIN_POLL_INTERVAL_DS = 300;
+const dstime Sync::MAX_POLL_INTERVAL_DS = 6000;
 
 namespace {
 
@@ -139,22 +147,28 @@ void hashCombineFingerprint(LightFileFingerprint& ffp, const LightFileFingerprin
     hashCombine(ffp.mtime, other.mtime);
 }
 
-// Combines the fingerprints of all file nodes in the given map
+// Combines the fingerprints of all file nodes in the given map, in the order of their names (as
+// for the paths on disk below: the map itself is ordered by the hashes of the names)
 bool combinedFingerprint(LightFileFingerprint& ffp, const localnode_map& nodeMap)
 {
-    bool success = false;
+    vector<const LocalNode*> files;
     for (const auto& nodePair : nodeMap)
     {
-        const LocalNode& l = *nodePair.second;
-        if (l.type == FILENODE)
+        if (nodePair.second->type == FILENODE)
         {
-            LightFileFingerprint lFfp;
-            lFfp.genfingerprint(l.size, l.mtime);
-            hashCombineFingerprint(ffp, lFfp);
-            success = true;
+            files.push_back(nodePair.second);
         }
     }
-    return success;
+
+    std::sort(files.begin(), files.end(), [](const LocalNode* a, const LocalNode* b) { return a->localname < b->localname; });
+
+    for (const LocalNode* l : files)
+    {
+        LightFileFingerprint lFfp;
+        lFfp.genfingerprint(l->size, l->mtime);
+        hashCombineFingerprint(ffp, lFfp);
+    }
+    return !files.empty();
 }
 
 // Combines the fingerprints of all files in the given paths
@@ -234,12 +248,12 @@ void collectAllLocalNodes(FingerprintCache& fingerprints, FingerprintLocalNodeMa
                           LocalNode& l, handlelocalnode_map& fsidnodes)
 {
     // invalidate fsid of `l`
-    l.fsid = mega::UNDEF;
-    if (l.fsid_it != fsidnodes.end())
+    if (l.fsid_mapped)
     {
-        fsidnodes.erase(l.fsid_it);
-        l.fsid_it = fsidnodes.end();
+        fsidnodes.erase(l.fsid);
+        l.fsid_mapped = false;
     }
+    l.fsid = mega::UNDEF;
     // collect fingerprint
     LightFileFingerprint ffp;
     if (computeFingerprint(ffp, l))
@@ -530,7 +544,8 @@ bool SyncConfig::operator==(const SyncConfig& rhs) const
            && mSyncType == rhs.mSyncType
            && mError == rhs.mError
            && mBackupId == rhs.mBackupId
-           && mWarning == rhs.mWarning;
+           && mWarning == rhs.mWarning
+           && mChangeCursor == rhs.mChangeCursor;
 }
 
 bool SyncConfig::operator!=(const SyncConfig& rhs) const
@@ -588,6 +603,11 @@ SyncConfig::Type SyncConfig::getType() const
     return mSyncType;
 }
 
+bool SyncConfig::isDownSync() const
+{
+    return mSyncType == TYPE_DOWN || mSyncType == TYPE_TWOWAY;
+}
+
 
 SyncError SyncConfig::getError() const
 {
@@ -732,6 +752,101 @@ const char* SyncConfig::synctypename(const SyncConfig::Type type)
     }
 }
 
+AsyncDirLister::AsyncDirLister(MegaClientAsyncQueue& queue, FileSystemAccess& fsaccess)
+    : mQueue(queue)
+    , mFsAccess(fsaccess)
+{
+}
+
+void AsyncDirLister::list(FileSystemAccess& fsaccess, LocalPath path, bool followsymlinks, Listing& out)
+{
+    out.entries.clear();
+
+    unique_ptr<DirAccess> da(fsaccess.newdiraccess());
+    if (!(out.opened = da->dopen(&path, nullptr, false)))
+    {
+        return;
+    }
+
+    while (da->dnextbulk(path, out.entries, BULKENTRIES, followsymlinks, fsaccess))
+    {
+    }
+}
+
+bool AsyncDirLister::request(const LocalPath& path, bool followsymlinks)
+{
+    if (mJobs.count(path))
+    {
+        return true;
+    }
+
+    if (mJobs.size() >= MAX_REQUESTED)
+    {
+        // make room from the listings no one came for
+        for (auto it = mJobs.begin(); it != mJobs.end(); )
+        {
+            std::lock_guard<std::mutex> g(it->second->mutex);
+            it = it->second->done ? mJobs.erase(it) : std::next(it);
+        }
+
+        if (mJobs.size() >= MAX_REQUESTED)
+        {
+            return false;
+        }
+    }
+
+    auto job = std::make_shared<Job>();
+    job->requested = Waiter::ds;
+    mJobs.emplace(path, job);
+
+    FileSystemAccess& fsaccess = mFsAccess;
+    LocalPath folder = path;
+
+    // not discardable: take() may be waiting for it
+    mQueue.push([job, &fsaccess, folder, followsymlinks](SymmCipher&)
+    {
+        Listing listing;
+        list(fsaccess, folder, followsymlinks, listing);
+
+        std::lock_guard<std::mutex> g(job->mutex);
+        job->listing = std::move(listing);
+        job->done = true;
+        job->finished.notify_all();
+    }, false);
+
+    return true;
+}
+
+bool AsyncDirLister::take(const LocalPath& path, Listing& out)
+{
+    auto it = mJobs.find(path);
+    if (it == mJobs.end())
+    {
+        return false;
+    }
+
+    std::shared_ptr<Job> job = std::move(it->second);
+    mJobs.erase(it);
+
+    // one that finishes while waited for is current
+    std::unique_lock<std::mutex> g(job->mutex);
+    bool waiting = !job->done;
+    job->finished.wait(g, [&job]() { return job->done; });
+
+    if (!waiting && Waiter::ds - job->requested > MAXAGE)
+    {
+        return false;
+    }
+
+    out = std::move(job->listing);
+    return true;
+}
+
+void AsyncDirLister::clear()
+{
+    mJobs.clear();
+}
+
 // new Syncs are automatically inserted into the session's syncs list
 // and a full read of the subtree is initiated
 Sync::Sync(UnifiedSync& us, const char* cdebris,
@@ -797,6 +912,8 @@ Sync::Sync(UnifiedSync& us, const char* cdebris,
     localroot->init(this, FOLDERNODE, NULL, mLocalPath, nullptr);  // the root node must have the absolute path.  We don't store shortname, to avoid accidentally using relative paths.
     localroot->setnode(remotenode);
 
+    client->syncs.treestates.addSync(this, mLocalPath, localdebris);
+
 #ifdef __APPLE__
     if (macOSmajorVersion() >= 19) //macOS catalina+
     {
@@ -846,6 +963,11 @@ Sync::Sync(UnifiedSync& us, const char* cdebris,
 
             statecachetable = client->dbaccess->open(client->rng, *client->fsaccess, dbname);
 
+            if (statecachetable && client->asyncstatecache)
+            {
+                statecachetable = new AsyncDbTable(client->rng, unique_ptr<DbTable>(statecachetable));
+            }
+
             readstatecache();
         }
     }
@@ -869,9 +991,18 @@ Sync::~Sync()
         client->proctree(localroot->node, &tdsg);
     }
 
+    // what is queued for it, held back by syncstatecacheflushds, goes first
+    if (statecachetable && (state == SYNC_ACTIVE || state == SYNC_INITIALSCAN))
+    {
+        cachenodes();
+    }
+
     // The database is closed; deleting localnodes will not remove them
     delete statecachetable;
 
+    // nor their states, one by one
+    client->syncs.treestates.removeSync(this);
+
     client->syncactivity = true;
 
     {
@@ -971,6 +1102,8 @@ bool Sync::readstatecache()
         addstatecachechildren(0, &tmap, localroot->localname, localroot.get(), 100);
         cachenodes();
 
+        statecacheloaded = !localroot->children.empty();
+
         // trigger a single-pass full scan to identify deleted nodes
         fullscan = true;
         scanseqno++;
@@ -981,6 +1114,68 @@ bool Sync::readstatecache()
     return false;
 }
 
+// the bytes of the files under l, as the initial scan counts them
+static m_off_t localtreebytes(const LocalNode* l)
+{
+    m_off_t bytes = 0;
+
+    for (auto& it : l->children)
+    {
+        bytes += it.second->type == FILENODE ? it.second->size : localtreebytes(it.second);
+    }
+
+    return bytes;
+}
+
+bool Sync::replaychanges()
+{
+    const string& cursor = getConfig().mChangeCursor;
+    vector<LocalPath> changed;
+
+    if (!statecacheloaded || cursor.empty()
+     || !client->fsaccess->changessince(mLocalPath, cursor, changed))
+    {
+        return false;
+    }
+
+    LOG_debug << "Replaying " << changed.size() << " changes since the last run: " << mLocalPath.toPath(*client->fsaccess);
+
+    // the cached LocalNodes stand as they are: none is missing unless notified
+    fullscan = false;
+    scanseqno--;
+    localbytes = localtreebytes(localroot.get());
+
+    for (auto& path : changed)
+    {
+        dirnotify->notify(DirNotify::DIREVENTS, localroot.get(), std::move(path));
+    }
+
+    return true;
+}
+
+void Sync::updatechangecursor()
+{
+    if (mChangeCursorTime && Waiter::ds - mChangeCursorTime < CHANGE_CURSOR_INTERVAL_DS)
+    {
+        return;
+    }
+
+    mChangeCursorTime = Waiter::ds;
+
+    SyncConfig& config = getConfig();
+
+    if (!mPendingChangeCursor.empty() && mPendingChangeCursor != config.mChangeCursor)
+    {
+        config.mChangeCursor = mPendingChangeCursor;
+        client->syncs.saveSyncConfig(config);
+    }
+
+    if (!client->fsaccess->changecursor(mLocalPath, mPendingChangeCursor))
+    {
+        mPendingChangeCursor.clear();
+    }
+}
+
 SyncConfig& Sync::getConfig()
 {
     return mUnifiedSync.mConfig;
@@ -1018,9 +1213,14 @@ void Sync::statecacheadd(LocalNode* l)
     insertq.insert(l);
 }
 
+bool Sync::statecachepending() const
+{
+    return statecachetable && (state == SYNC_ACTIVE || (state == SYNC_INITIALSCAN && insertq.size() > 100)) && (deleteq.size() || insertq.size());
+}
+
 void Sync::cachenodes()
 {
-    if (statecachetable && (state == SYNC_ACTIVE || (state == SYNC_INITIALSCAN && insertq.size() > 100)) && (deleteq.size() || insertq.size()))
+    if (statecachepending())
     {
         LOG_debug << "Saving LocalNode database with " << insertq.size() << " additions and " << deleteq.size() << " deletions";
         statecachetable->begin();
@@ -1033,25 +1233,44 @@ void Sync::cachenodes()
 
         deleteq.clear();
 
-        // additions - we iterate until completion or until we get stuck
-        bool added;
+        // additions, in one pass: each after those of its parents that have no dbid yet (which
+        // its record refers to), the way up from it being queued with it.  Those below a parent
+        // that isn't queued and has no dbid stay queued
+        localnode_set pending;
+        pending.swap(insertq);
+        vector<LocalNode*> chain;
+
+        while (!pending.empty())
+        {
+            chain.assign(1, *pending.begin());
 
-        do {
-            added = false;
+            bool stuck = false;
+            for (LocalNode* p = chain.back()->parent; p != localroot.get() && !(p && p->dbid); p = p->parent)
+            {
+                if (!p || !pending.count(p))
+                {
+                    stuck = true;
+                    break;
+                }
+                chain.push_back(p);
+            }
 
-            for (set<LocalNode*>::iterator it = insertq.begin(); it != insertq.end(); )
+            for (auto it = chain.rbegin(); it != chain.rend(); ++it)
             {
-                if ((*it)->parent->dbid || (*it)->parent == localroot.get())
+                if (stuck)
+                {
+                    insertq.insert(*it);
+                }
+                else
                 {
                     statecachetable->put(MegaClient::CACHEDLOCALNODE, *it, &client->key);
-                    insertq.erase(it++);
-                    added = true;
                 }
-                else it++;
+                pending.erase(*it);
             }
-        } while (added);
+        }
 
         statecachetable->commit();
+        statecacheflushed = Waiter::ds;
 
         if (insertq.size())
         {
@@ -1060,6 +1279,24 @@ void Sync::cachenodes()
     }
 }
 
+void Sync::cachenodesifdue()
+{
+    if (Waiter::ds >= statecacheflushds())
+    {
+        cachenodes();
+    }
+}
+
+dstime Sync::statecacheflushds() const
+{
+    if (!statecachepending())
+    {
+        return NEVER;
+    }
+
+    return statecacheflushed + client->syncstatecacheflushds;
+}
+
 void Sync::changestate(syncstate_t newstate, SyncError newSyncError, bool newEnableFlag, bool notifyApp)
 {
     getConfig().setError(newSyncError);
@@ -1125,9 +1362,8 @@ LocalNode* Sync::localnodebypath(LocalNode* l, const LocalPath& localpath, Local
             *parent = l;
         }
 
-        localnode_map::iterator it;
-        if ((it = l->children.find(&component)) == l->children.end()
-            && (it = l->schildren.find(&component)) == l->schildren.end())
+        LocalNode* child = l->childbyname(&component);
+        if (!child)
         {
             // no full match: store residual path, return NULL with the
             // matching component LocalNode in parent
@@ -1144,7 +1380,7 @@ LocalNode* Sync::localnodebypath(LocalNode* l, const LocalPath& localpath, Local
             return NULL;
         }
 
-        l = it->second;
+        l = child;
     }
 
     // full match: no residual path, return corresponding LocalNode
@@ -1171,46 +1407,103 @@ bool Sync::scan(LocalPath* localpath, FileAccess* fa)
     }
     if (!localdebris.isContainingPathOf(*localpath))
     {
-        DirAccess* da;
-        LocalPath localname;
         string name;
         bool success;
 
-        if (SimpleLogger::logCurrentLevel >= logDebug)
+        if (MEGA_LOG_ENABLED(logDebug))
         {
             LOG_debug << "Scanning folder: " << localpath->toPath(*client->fsaccess);
         }
 
-        da = client->fsaccess->newdiraccess();
+        // the new files found go to checkpath() through the notification queue: have them
+        // fingerprinted meanwhile
+        LocalNode* folder = nullptr;
+        bool prefetch = client->asyncfingerprints && !initializing;
+
+        // a rescan of a network folder doesn't list it before it's due
+        PolledFolder* polled = nullptr;
+        if (isnetwork && fullscan && !initializing)
+        {
+            polled = &polledfolders[*localpath];
+            folder = localnodebypath(NULL, *localpath);
+            if (folder && (folder->fsid == UNDEF || folder->fsid != polled->fsid))
+            {
+                *polled = PolledFolder();
+            }
+            polled->fsid = folder ? folder->fsid : UNDEF;
+            polled->scanseqno = scanseqno;
+
+            if (folder && polled->nextpoll > Waiter::ds)
+            {
+                scanunchanged(*localpath, folder);
+                return true;
+            }
+        }
+        else if (prefetch)
+        {
+            folder = localnodebypath(NULL, *localpath);
+        }
+
+        // listed ahead on a worker if this is a subfolder of one scanned before
+        AsyncDirLister::Listing listing;
+        if (!client->dirlister.take(*localpath, listing))
+        {
+            AsyncDirLister::list(*client->fsaccess, *localpath, client->followsymlinks, listing);
+        }
+
+        if (polled && listing.opened)
+        {
+            size_t hash = listing.entries.size();
+            for (AsyncDirLister::Entry& entry : listing.entries)
+            {
+                for (size_t v : { entry.name.hash(), size_t(entry.type), size_t(entry.statok), size_t(entry.size),
+                                  size_t(entry.mtime), size_t(entry.fsid) })
+                {
+                    hash ^= v + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+                }
+            }
+
+            bool unchanged = folder && polled->listed && polled->listinghash == hash;
+            polled->listinghash = hash;
+            polled->listed = true;
+            polled->interval = unchanged ? std::min(std::max(polled->interval * 2, MIN_POLL_INTERVAL_DS), MAX_POLL_INTERVAL_DS) : 0;
+            polled->nextpoll = Waiter::ds + polled->interval;
+
+            if (unchanged)
+            {
+                LOG_verbose << "Unchanged since the last rescan: " << localpath->toPath(*client->fsaccess)
+                            << ", next listed in " << polled->interval << " ds";
+                scanunchanged(*localpath, folder);
+                return true;
+            }
+        }
+        else if (polled)
+        {
+            polledfolders.erase(*localpath);
+        }
 
         // scan the dir, mark all items with a unique identifier
-        if ((success = da->dopen(localpath, fa, false)))
+        if ((success = listing.opened))
         {
-            while (da->dnext(*localpath, localname, client->followsymlinks))
+            // which entries are synced, and the listings of the subfolders among them requested
+            // before any is scanned
+            vector<bool> syncable(listing.entries.size());
+            for (size_t i = 0; i < listing.entries.size(); i++)
             {
-                name = localname.toName(*client->fsaccess, mFilesystemType);
+                AsyncDirLister::Entry& entry = listing.entries[i];
+                name = entry.name.toName(*client->fsaccess, mFilesystemType);
 
                 ScopedLengthRestore restoreLen(*localpath);
-                localpath->appendWithSeparator(localname, false);
+                localpath->appendWithSeparator(entry.name, false);
 
                 // check if this record is to be ignored
                 if (client->app->sync_syncable(this, name.c_str(), *localpath))
                 {
                     // skip the sync's debris folder
-                    if (!localdebris.isContainingPathOf(*localpath))
+                    syncable[i] = !localdebris.isContainingPathOf(*localpath);
+                    if (syncable[i] && entry.type == FOLDERNODE && polldue(*localpath))
                     {
-                        LocalNode *l = NULL;
-                        if (initializing)
-                        {
-                            // preload all cached LocalNodes
-                            l = checkpath(NULL, localpath, nullptr, nullptr, false, da);
-                        }
-
-                        if (!l || l == (LocalNode*)~0)
-                        {
-                            // new record: place in notification queue
-                            dirnotify->notify(DirNotify::DIREVENTS, NULL, LocalPath(*localpath));
-                        }
+                        client->dirlister.request(*localpath, client->followsymlinks);
                     }
                 }
                 else
@@ -1218,22 +1511,106 @@ bool Sync::scan(LocalPath* localpath, FileAccess* fa)
                     LOG_debug << "Excluded: " << name;
                 }
             }
-        }
 
-        delete da;
+            for (size_t i = 0; i < listing.entries.size(); i++)
+            {
+                if (!syncable[i])
+                {
+                    continue;
+                }
+
+                AsyncDirLister::Entry& entry = listing.entries[i];
+                ScopedLengthRestore restoreLen(*localpath);
+                localpath->appendWithSeparator(entry.name, false);
+
+                LocalNode *l = NULL;
+                if (initializing)
+                {
+                    // preload all cached LocalNodes
+                    l = checkpath(NULL, localpath, nullptr, nullptr, false, &entry);
+                }
+
+                if (!l || l == (LocalNode*)~0)
+                {
+                    if (prefetch && entry.type == FILENODE && (!folder || !folder->childbyname(&entry.name)))
+                    {
+                        client->fingerprinter.request(*localpath, client->fsaccess->newfileaccess(client->followsymlinks));
+                    }
+
+                    // new record: place in notification queue
+                    dirnotify->notify(DirNotify::DIREVENTS, NULL, LocalPath(*localpath));
+                }
+            }
+        }
 
         return success;
     }
     else return false;
 }
 
+bool Sync::polldue(const LocalPath& localpath)
+{
+    if (!isnetwork || !fullscan || initializing)
+    {
+        return true;
+    }
+
+    auto it = polledfolders.find(localpath);
+    return it == polledfolders.end() || it->second.nextpoll <= Waiter::ds;
+}
+
+void Sync::scanunchanged(LocalPath& localpath, LocalNode* l)
+{
+    // the subfolders due are listed on the workers meanwhile, as scan() does
+    for (auto& c : l->children)
+    {
+        LocalNode* child = c.second;
+        child->scanseqno = scanseqno;
+
+        if (child->type == FOLDERNODE)
+        {
+            ScopedLengthRestore restoreLen(localpath);
+            localpath.appendWithSeparator(*c.first.name, false);
+            if (polldue(localpath))
+            {
+                client->dirlister.request(localpath, client->followsymlinks);
+            }
+        }
+    }
+
+    for (auto& c : l->children)
+    {
+        if (c.second->type == FOLDERNODE)
+        {
+            ScopedLengthRestore restoreLen(localpath);
+            localpath.appendWithSeparator(*c.first.name, false);
+            scan(&localpath, nullptr);
+        }
+    }
+}
+
+void Sync::prunepolled()
+{
+    for (auto it = polledfolders.begin(); it != polledfolders.end(); )
+    {
+        if (scanseqno - it->second.scanseqno > 1)
+        {
+            it = polledfolders.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
 // check local path - if !localname, localpath is relative to l, with l == NULL
 // being the root of the sync
 // if localname is set, localpath is absolute and localname its last component
 // path references a new FOLDERNODE: returns created node
 // path references a existing FILENODE: returns node
 // otherwise, returns NULL
-LocalNode* Sync::checkpath(LocalNode* l, LocalPath* input_localpath, string* const localname, dstime *backoffds, bool wejustcreatedthisfolder, DirAccess* iteratingDir)
+LocalNode* Sync::checkpath(LocalNode* l, LocalPath* input_localpath, string* const localname, dstime *backoffds, bool wejustcreatedthisfolder, AsyncDirLister::Entry* scanned)
 {
     LocalNode* ll = l;
     bool newnode = false, changed = false;
@@ -1343,7 +1720,26 @@ LocalNode* Sync::checkpath(LocalNode* l, LocalPath* input_localpath, string* con
 
         // match cached LocalNode state during initial/rescan to prevent costly re-fingerprinting
         // (just compare the fsids, sizes and mtimes to detect changes)
-        if (fa->fopen(*localpathNew, false, false, iteratingDir))
+        bool opened;
+        if (scanned)
+        {
+            // as the listing found it, without opening it
+            if ((opened = scanned->statok))
+            {
+                fa->type = scanned->type;
+                fa->size = scanned->size;
+                fa->mtime = scanned->mtime;
+                fa->fsid = scanned->fsid;
+                fa->fsidvalid = scanned->fsidvalid;
+                fa->mIsSymLink = scanned->isSymLink;
+            }
+        }
+        else
+        {
+            opened = fa->fopen(*localpathNew, false, false);
+        }
+
+        if (opened)
         {
             if (cl && fa->fsidvalid && fa->fsid == cl->fsid)
             {
@@ -1463,6 +1859,7 @@ LocalNode* Sync::checkpath(LocalNode* l, LocalPath* input_localpath, string* con
 
                                         // mark as seen / undo possible deletion
                                         it->second->setnotseen(0);
+                                        keepmoved(it->second);
 
                                         statecacheadd(it->second);
 
@@ -1486,7 +1883,7 @@ LocalNode* Sync::checkpath(LocalNode* l, LocalPath* input_localpath, string* con
 
                             m_off_t dsize = l->size > 0 ? l->size : 0;
 
-                            if (l->genfingerprint(fa.get()) && l->size >= 0)
+                            if (client->fingerprinter.genfingerprint(*localpathNew, fa.get(), *l) && l->size >= 0)
                             {
                                 localbytes -= dsize - l->size;
                             }
@@ -1683,6 +2080,7 @@ LocalNode* Sync::checkpath(LocalNode* l, LocalPath* input_localpath, string* con
 
                     // unmark possible deletion
                     it->second->setnotseen(0);
+                    keepmoved(it->second);
 
                     // immediately scan folder to detect deviations from cached state
                     if (fullscan && fa->type == FOLDERNODE)
@@ -1752,7 +2150,7 @@ LocalNode* Sync::checkpath(LocalNode* l, LocalPath* input_localpath, string* con
                         localbytes -= l->size;
                     }
 
-                    if (l->genfingerprint(fa.get()))
+                    if (client->fingerprinter.genfingerprint(*localpathNew, fa.get(), *l))
                     {
                         changed = true;
                         l->bumpnagleds();
@@ -1835,25 +2233,7 @@ LocalNode* Sync::checkpath(LocalNode* l, LocalPath* input_localpath, string* con
 bool Sync::checkValidNotification(int q, Notification& notification)
 {
     // This code moved from filtering before going on notifyq, to filtering after when it's thread-safe to do so
-
-    if (q == DirNotify::DIREVENTS || q == DirNotify::EXTRA)
-    {
-        Notification next;
-        while (dirnotify->notifyq[q].peekFront(next)
-            && next.localnode == notification.localnode && next.path == notification.path)
-        {
-            dirnotify->notifyq[q].popFront(next);  // this is the only thread removing from the queue so it will be the same item
-            if (!notification.timestamp || !next.timestamp)
-            {
-                notification.timestamp = 0;  // immediate
-            }
-            else
-            {
-                notification.timestamp = std::max(notification.timestamp, next.timestamp);
-            }
-            LOG_debug << "Next notification repeats, skipping duplicate";
-        }
-    }
+    // (repeats of the same path are coalesced by the queue already)
 
     if (notification.timestamp && !initializing && q == DirNotify::DIREVENTS)
     {
@@ -1890,16 +2270,74 @@ bool Sync::checkValidNotification(int q, Notification& notification)
 // add or refresh local filesystem item from scan stack, add items to scan stack
 // returns 0 if a parent node is missing, ~0 if control should be yielded, or the time
 // until a retry should be made (500 ms minimum latency).
-dstime Sync::procscanq(int q)
+void Sync::prefetchfingerprints(int q, dstime dsmin)
+{
+    if (!client->asyncfingerprints || initializing
+            || client->fingerprinter.requested() >= AsyncFingerprinter::LOOKAHEAD)
+    {
+        return;
+    }
+
+    struct Candidate
+    {
+        LocalPath path;
+        LocalNode* l;
+    };
+    vector<Candidate> candidates;
+
+    dirnotify->notifyq[q].peek(AsyncFingerprinter::LOOKAHEAD, [this, dsmin, &candidates](const Notification& n, const LocalPath& path)
+    {
+        // those still changing may change again before they are processed
+        if (n.timestamp > dsmin)
+        {
+            return false;
+        }
+
+        if (n.localnode != (LocalNode*)~0)
+        {
+            LocalNode* l = localnodebypath(n.localnode, n.path);
+            if (!l || l->type == FILENODE)
+            {
+                candidates.push_back(Candidate{path, l});
+            }
+        }
+        return true;
+    });
+
+    // read the files in the order of their fsids (inodes, roughly where they are on the disk),
+    // then the new ones, whose fsids aren't known yet
+    std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b)
+    {
+        handle afsid = a.l ? a.l->fsid : UNDEF;
+        handle bfsid = b.l ? b.l->fsid : UNDEF;
+        return afsid < bfsid;
+    });
+
+    for (Candidate& c : candidates)
+    {
+        if (!client->fingerprinter.request(c.path, client->fsaccess->newfileaccess(client->followsymlinks), c.l))
+        {
+            break;
+        }
+    }
+}
+
+dstime Sync::procscanq(int q, std::chrono::steady_clock::time_point deadline)
 {
     dstime dsmin = Waiter::ds - SCANNING_DELAY_DS;
     LocalNode* l;
 
+    prefetchfingerprints(q, dsmin);
+
     Notification notification;
     while (dirnotify->notifyq[q].popFront(notification))
     {
         if (!checkValidNotification(q, notification))
         {
+            if (std::chrono::steady_clock::now() >= deadline)
+            {
+                break;
+            }
             continue;
         }
 
@@ -1912,12 +2350,39 @@ dstime Sync::procscanq(int q)
             return notification.timestamp - dsmin;
         }
 
+        mUnifiedSync.mNextHeartbeat->addScanLatency(dsmin - notification.timestamp);
+
         if ((l = notification.localnode) != (LocalNode*)~0)
         {
             dstime backoffds = 0;
             LOG_verbose << "Checkpath: " << notification.path.toPath(*client->fsaccess);
 
+            // the folder notified, and the one of what changed in it, compare their children
+            // on the next passes of syncdown() and syncup()
+            if (l)
+            {
+                l->setsyncdirty();
+            }
+
+            // what was fingerprinted ahead for it but not used (the file hadn't changed) goes
+            LocalPath fullpath;
+            if (client->fingerprinter.requested())
+            {
+                fullpath = l ? l->getLocalPath() : LocalPath();
+                fullpath.appendWithSeparator(notification.path, false);
+            }
+
             l = checkpath(l, &notification.path, NULL, &backoffds, false, nullptr);
+
+            if (!fullpath.empty())
+            {
+                client->fingerprinter.forget(fullpath);
+            }
+
+            if (l && l != (LocalNode*)~0)
+            {
+                l->setsyncdirty();
+            }
             if (backoffds)
             {
                 LOG_verbose << "Scanning deferred during " << backoffds << " ds";
@@ -1939,15 +2404,16 @@ dstime Sync::procscanq(int q)
         }
         else
         {
-            string utf8path = notification.path.toPath(*client->fsaccess);
-            LOG_debug << "Notification skipped: " << utf8path;
+            LOG_debug << "Notification skipped: " << notification.path.toPath(*client->fsaccess);
         }
 
         // we return control to the application in case a filenode was added
         // (in order to avoid lengthy blocking episodes due to multiple
         // consecutive fingerprint calculations)
-        // or if new nodes are being added due to a copy/delete operation
-        if ((l && l != (LocalNode*)~0 && l->type == FILENODE) || client->syncadding)
+        // or if new nodes are being added due to a copy/delete operation,
+        // or once the slice of this pass is over
+        if ((l && l != (LocalNode*)~0 && l->type == FILENODE) || client->syncadding
+                || std::chrono::steady_clock::now() >= deadline)
         {
             break;
         }
@@ -1968,6 +2434,73 @@ dstime Sync::procscanq(int q)
     return dstime(~0);
 }
 
+void Sync::uploadended()
+{
+    if (uploadsinflight)
+    {
+        uploadsinflight--;
+    }
+
+    // those held back go once half of the window is free, not one at a time
+    if (uploadsheldback && uploadsinflight <= MAXTRANSFERS / 2)
+    {
+        uploadsheldback = false;
+        client->syncuprequired = true;
+        client->syncactivity = true;
+    }
+}
+
+void Sync::downloadended()
+{
+    if (downloadsinflight)
+    {
+        downloadsinflight--;
+    }
+
+    if (downloadsheldback && downloadsinflight <= MAXTRANSFERS / 2)
+    {
+        downloadsheldback = false;
+        client->syncdownrequired = true;
+        client->syncactivity = true;
+    }
+}
+
+void Sync::keepmoved(LocalNode* moved)
+{
+    if (moved->type != FOLDERNODE)
+    {
+        return;
+    }
+
+    // the moved LocalNodes keep their fsid, and those of files their size and mtime: it's them
+    // if they still match
+    vector<LocalNode*> below;
+    for (LocalNode* l : client->localsyncnotseen)
+    {
+        for (LocalNode* p = l->parent; p; p = p->parent)
+        {
+            if (p == moved)
+            {
+                below.push_back(l);
+                break;
+            }
+        }
+    }
+
+    for (LocalNode* l : below)
+    {
+        auto path = l->getLocalPath();
+        auto fa = client->fsaccess->newfileaccess(false);
+        if (fa->fopen(path, true, false)
+                && fa->fsidvalid && fa->fsid == l->fsid && fa->type == l->type
+                && (l->type != FILENODE || (fa->mtime == l->mtime && fa->size == l->size)))
+        {
+            LOG_debug << "Moved along with its folder: " << l->localnodedisplaypath(*client->fsaccess);
+            l->setnotseen(0);
+        }
+    }
+}
+
 // delete all child LocalNodes that have been missing for two consecutive scans (*l must still exist)
 void Sync::deletemissing(LocalNode* l)
 {
@@ -2235,7 +2768,8 @@ error UnifiedSync::startSync(MegaClient* client, const char* debris, LocalPath*
 
     LOG_debug << "Initial scan sync: " << mConfig.getLocalPath().toPath(*client->fsaccess);
 
-    if (mSync->scan(&rootpath, openedLocalFolder.get()))
+    // the change journal of the filesystem can spare the scan of what didn't change
+    if (mSync->replaychanges() || mSync->scan(&rootpath, openedLocalFolder.get()))
     {
         client->syncsup = false;
         mSync->initializing = false;
@@ -2270,6 +2804,133 @@ void UnifiedSync::changedConfigState(bool notifyApp)
     }
 }
 
+SyncTreeStates::Found SyncTreeStates::get(const LocalPath& path, treestate_t& ts) const
+{
+    std::lock_guard<std::mutex> g(mMutex);
+    for (auto& s : mSyncs)
+    {
+        if (!s.root.isContainingPathOf(path))
+        {
+            continue;
+        }
+
+        if (s.debris.isContainingPathOf(path))
+        {
+            return IN_DEBRIS;
+        }
+
+        auto it = s.states.find(path.hash());
+        if (it == s.states.end())
+        {
+            return UNKNOWN;
+        }
+
+        ts = it->second;
+        return KNOWN;
+    }
+    return NOT_SYNCED;
+}
+
+void SyncTreeStates::addSync(const Sync* sync, const LocalPath& root, const LocalPath& debris)
+{
+    std::lock_guard<std::mutex> g(mMutex);
+    mSyncs.push_back(States{sync, root, debris, {}});
+}
+
+void SyncTreeStates::removeSync(const Sync* sync)
+{
+    std::lock_guard<std::mutex> g(mMutex);
+    mSyncs.erase(std::remove_if(mSyncs.begin(), mSyncs.end(), [sync](const States& s) { return s.sync == sync; }), mSyncs.end());
+}
+
+void SyncTreeStates::set(const LocalNode& l, treestate_t ts)
+{
+    // not for the folders of a subtree being deleted, which are no longer linked to the root
+    const LocalNode* top = &l;
+    while (top->parent)
+    {
+        top = top->parent;
+    }
+
+    if (top != l.sync->localroot.get())
+    {
+        return;
+    }
+
+    LocalPath path = l.getLocalPath();
+
+    std::lock_guard<std::mutex> g(mMutex);
+    if (States* s = statesOf(l.sync))
+    {
+        s->states[path.hash()] = ts;
+    }
+}
+
+void SyncTreeStates::erase(const LocalNode& l, LocalPath& path)
+{
+    std::lock_guard<std::mutex> g(mMutex);
+    if (States* s = statesOf(l.sync))
+    {
+        erase(*s, l, path);
+    }
+}
+
+void SyncTreeStates::moved(const Sync* from, const LocalNode& l, LocalPath& oldpath, LocalPath& newpath)
+{
+    std::lock_guard<std::mutex> g(mMutex);
+    States* fromStates = statesOf(from);
+    States* toStates = statesOf(l.sync);
+    if (fromStates && toStates)
+    {
+        move(*fromStates, *toStates, l, oldpath, newpath);
+    }
+}
+
+SyncTreeStates::States* SyncTreeStates::statesOf(const Sync* sync)
+{
+    for (auto& s : mSyncs)
+    {
+        if (s.sync == sync)
+        {
+            return &s;
+        }
+    }
+    return nullptr;
+}
+
+void SyncTreeStates::erase(States& s, const LocalNode& l, LocalPath& path)
+{
+    if (l.ts != TREESTATE_NONE)
+    {
+        s.states.erase(path.hash());
+    }
+
+    for (auto& c : l.children)
+    {
+        ScopedLengthRestore restoreLen(path);
+        path.appendWithSeparator(c.second->localname, true);
+        erase(s, *c.second, path);
+    }
+}
+
+void SyncTreeStates::move(States& from, States& to, const LocalNode& l, LocalPath& oldpath, LocalPath& newpath)
+{
+    if (l.ts != TREESTATE_NONE)
+    {
+        from.states.erase(oldpath.hash());
+        to.states[newpath.hash()] = l.ts;
+    }
+
+    for (auto& c : l.children)
+    {
+        ScopedLengthRestore restoreOld(oldpath);
+        ScopedLengthRestore restoreNew(newpath);
+        oldpath.appendWithSeparator(c.second->localname, true);
+        newpath.appendWithSeparator(c.second->localname, true);
+        move(from, to, *c.second, oldpath, newpath);
+    }
+}
+
 Syncs::Syncs(MegaClient& mc)
   : mClient(mc)
 {
@@ -2567,6 +3228,44 @@ bool Syncs::forEachRunningSync_shortcircuit(std::function<bool(Sync* s)> f)
     return true;
 }
 
+bool Syncs::forEachRunningSyncByScanQueue(int q, std::function<bool(Sync* s, std::chrono::steady_clock::time_point deadline)> f)
+{
+    vector<std::pair<size_t, Sync*>> order;
+    size_t busy = 0;
+    for (auto& s : mSyncVec)
+    {
+        if (s->mSync)
+        {
+            order.emplace_back(s->mSync->dirnotify->notifyq[q].size(), s->mSync.get());
+            busy += order.back().first ? 1 : 0;
+        }
+    }
+
+    // those as busy, in the order they were added
+    std::stable_sort(order.begin(), order.end(), [](const std::pair<size_t, Sync*>& a, const std::pair<size_t, Sync*>& b) {
+        return a.first < b.first;
+    });
+
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(MegaClient::EXECSLICEMS);
+    for (auto& o : order)
+    {
+        auto deadline = end;
+        if (o.first)
+        {
+            auto now = std::chrono::steady_clock::now();
+            auto share = end > now ? (end - now) / std::chrono::steady_clock::duration::rep(busy) : std::chrono::steady_clock::duration(0);
+            deadline = now + share;
+            --busy;
+        }
+
+        if (!f(o.second, deadline))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
 void Syncs::forEachSyncConfig(std::function<void(const SyncConfig&)> f)
 {
     for (auto& s : mSyncVec)
@@ -3613,6 +4312,7 @@ bool JSONSyncConfigIOContext::decrypt(const string& in, string& out)
 bool JSONSyncConfigIOContext::deserialize(SyncConfig& config, JSON& reader) const
 {
     const auto TYPE_BACKUP_ID       = MAKENAMEID2('i', 'd');
+    const auto TYPE_CHANGE_CURSOR   = MAKENAMEID2('c', 'c');
     const auto TYPE_ENABLED         = MAKENAMEID2('e', 'n');
     const auto TYPE_FINGERPRINT     = MAKENAMEID2('f', 'p');
     const auto TYPE_LAST_ERROR      = MAKENAMEID2('l', 'e');
@@ -3632,6 +4332,10 @@ bool JSONSyncConfigIOContext::deserialize(SyncConfig& config, JSON& reader) cons
             // success if we reached the end of the object
             return *reader.pos == '}';
 
+        case TYPE_CHANGE_CURSOR:
+            reader.storebinary(&config.mChangeCursor);
+            break;
+
         case TYPE_ENABLED:
             config.mEnabled = reader.getbool();
             break;
@@ -3753,6 +4457,11 @@ void JSONSyncConfigIOContext::serialize(const SyncConfig& config,
     writer.arg("st", config.mSyncType);
     writer.arg("en", config.mEnabled);
 
+    if (!config.mChangeCursor.empty())
+    {
+        writer.arg_B64("cc", config.mChangeCursor);
+    }
+
     writer.beginarray("er");
     for (auto& s : config.mRegExps)
     {
@@ -0,0 +1,245 @@
+/**
+ * @file threadconfig.cpp
+ * @brief Sizes, CPU affinity and priority of the threads the SDK starts
+ *
+ * (c) 2013-2021 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include "mega/threadconfig.h"
+#include "mega/logging.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#endif
+
+namespace mega {
+
+namespace {
+
+struct Config
+{
+    std::mutex mutex;
+    ThreadSettings settings[THREAD_ROLE_COUNT];
+    ThreadConfig::Executor executor;
+};
+
+Config& config()
+{
+    static Config c;
+    return c;
+}
+
+// what the platform can't do is only worth a line in the log, not one per thread
+void unsupported(std::atomic<bool>& logged, const char* what)
+{
+    if (!logged.exchange(true))
+    {
+        LOG_warn << "Thread " << what << " not supported on this platform, ignored";
+    }
+}
+
+// 0 when set, or else the error of the system
+int setAffinity(const std::vector<unsigned>& cpus)
+{
+#ifdef _WIN32
+    // without processor groups, as far as the first 64 CPUs
+    DWORD_PTR mask = 0;
+    for (unsigned cpu : cpus)
+    {
+        if (cpu < sizeof(mask) * 8)
+        {
+            mask |= DWORD_PTR(1) << cpu;
+        }
+    }
+    if (!mask)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+    return SetThreadAffinityMask(GetCurrentThread(), mask) ? 0 : int(GetLastError());
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned cpu : cpus)
+    {
+        if (cpu < CPU_SETSIZE)
+        {
+            CPU_SET(cpu, &set);
+        }
+    }
+
+    // 0 for the calling thread (also on Android, which has no pthread_setaffinity_np)
+    return sched_setaffinity(0, sizeof set, &set) ? errno : 0;
+#else
+    static std::atomic<bool> logged{false};
+    unsupported(logged, "affinity");
+    return 0;
+#endif
+}
+
+int setPriority(ThreadSettings::Priority priority)
+{
+#ifdef _WIN32
+    int p = priority == ThreadSettings::PRIORITY_HIGH ? THREAD_PRIORITY_ABOVE_NORMAL
+          : priority == ThreadSettings::PRIORITY_LOW ? THREAD_PRIORITY_BELOW_NORMAL
+          : THREAD_PRIORITY_IDLE;
+    return SetThreadPriority(GetCurrentThread(), p) ? 0 : int(GetLastError());
+#elif defined(__linux__)
+    // the nice value is per thread on Linux, and starts as that of the thread that made this one
+    id_t tid = static_cast<id_t>(syscall(SYS_gettid));
+    errno = 0;
+    int nice = getpriority(PRIO_PROCESS, tid);
+    if (errno)
+    {
+        return errno;
+    }
+    nice = priority == ThreadSettings::PRIORITY_HIGH ? nice - 5
+         : priority == ThreadSettings::PRIORITY_LOW ? nice + 5
+         : 19;
+    return setpriority(PRIO_PROCESS, tid, std::min(std::max(nice, -20), 19)) ? errno : 0;
+#elif defined(__APPLE__)
+    qos_class_t qos = priority == ThreadSettings::PRIORITY_HIGH ? QOS_CLASS_USER_INITIATED
+                    : priority == ThreadSettings::PRIORITY_LOW ? QOS_CLASS_UTILITY
+                    : QOS_CLASS_BACKGROUND;
+    return pthread_set_qos_class_self_np(qos, 0);
+#else
+    static std::atomic<bool> logged{false};
+    unsupported(logged, "priority");
+    return 0;
+#endif
+}
+
+} // anonymous
+
+void ThreadConfig::set(ThreadRole role, const ThreadSettings& settings)
+{
+    assert(role < THREAD_ROLE_COUNT);
+    std::lock_guard<std::mutex> g(config().mutex);
+    config().settings[role] = settings;
+}
+
+ThreadSettings ThreadConfig::get(ThreadRole role)
+{
+    assert(role < THREAD_ROLE_COUNT);
+    std::lock_guard<std::mutex> g(config().mutex);
+    return config().settings[role];
+}
+
+void ThreadConfig::apply(ThreadRole role)
+{
+    ThreadSettings settings = get(role);
+
+    if (!settings.cpus.empty())
+    {
+        if (int e = setAffinity(settings.cpus))
+        {
+            LOG_warn << "Unable to set the CPU affinity of a thread of role " << role << ": " << e;
+        }
+    }
+
+    if (settings.priority != ThreadSettings::PRIORITY_DEFAULT)
+    {
+        if (int e = setPriority(settings.priority))
+        {
+            LOG_warn << "Unable to set the priority of a thread of role " << role << ": " << e;
+        }
+    }
+}
+
+bool ThreadConfig::parseCpuList(const char* list, std::vector<unsigned>& cpus)
+{
+    std::vector<unsigned> parsed;
+    const char* p = list;
+
+    while (p && *p)
+    {
+        char* end;
+        errno = 0;
+        unsigned long first = strtoul(p, &end, 10);
+        if (end == p || *p == '-' || *p == '+' || errno)
+        {
+            return false;
+        }
+
+        unsigned long last = first;
+        if (*end == '-')
+        {
+            p = end + 1;
+            last = strtoul(p, &end, 10);
+            if (end == p || *p == '-' || *p == '+' || errno || last < first)
+            {
+                return false;
+            }
+        }
+
+        // as many as a cpu_set_t holds, to keep a typo from asking for billions of them
+        if (last >= 1024)
+        {
+            return false;
+        }
+
+        for (unsigned long cpu = first; cpu <= last; ++cpu)
+        {
+            parsed.push_back(unsigned(cpu));
+        }
+
+        if (*end == ',')
+        {
+            ++end;
+            if (!*end)
+            {
+                return false;
+            }
+        }
+        else if (*end)
+        {
+            return false;
+        }
+        p = end;
+    }
+
+    cpus = std::move(parsed);
+    return true;
+}
+
+void ThreadConfig::setExecutor(Executor executor)
+{
+    std::lock_guard<std::mutex> g(config().mutex);
+    config().executor = std::move(executor);
+}
+
+ThreadConfig::Executor ThreadConfig::executor()
+{
+    std::lock_guard<std::mutex> g(config().mutex);
+    return config().executor;
+}
+
+} // namespace
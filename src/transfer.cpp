@@ -19,6 +19,9 @@
  * program.
  */
 
+// the level of the transfers module applies (see SimpleLogger::setModuleLogLevel)
+#define MEGA_LOG_MODULE ::mega::logModuleTransfers
+
 #include "mega/transfer.h"
 #include "mega/megaclient.h"
 #include "mega/transferslot.h"
@@ -57,6 +60,112 @@ unsigned TransferCategory::directionIndex()
     return direction;
 }
 
+const unsigned FixedTransferConcurrency::MAXTOTALTRANSFERS = 48;
+const unsigned FixedTransferConcurrency::MAXTRANSFERS = 32;
+
+const unsigned AdaptiveTransferConcurrency::MINTRANSFERS = 4;
+const unsigned AdaptiveTransferConcurrency::MAXTRANSFERS = 256;
+const unsigned AdaptiveTransferConcurrency::STEP = 4;
+const dstime AdaptiveTransferConcurrency::WINDOWDS = 50;
+
+m_off_t TransferConcurrencyPolicy::targetOutstanding(direction_t, m_off_t speed) const
+{
+    m_off_t target = 30 * speed;
+    target = std::max<m_off_t>(target, 2 * 1024 * 1024);
+    return std::min<m_off_t>(target, 100 * 1024 * 1024);
+}
+
+unsigned FixedTransferConcurrency::maxTotalTransfers() const
+{
+    return MAXTOTALTRANSFERS;
+}
+
+unsigned FixedTransferConcurrency::maxTransfers(direction_t) const
+{
+    return MAXTRANSFERS;
+}
+
+AdaptiveTransferConcurrency::AdaptiveTransferConcurrency()
+{
+    for (auto& d : mDirections)
+    {
+        d.limit = FixedTransferConcurrency::MAXTRANSFERS;
+    }
+}
+
+unsigned AdaptiveTransferConcurrency::maxTotalTransfers() const
+{
+    return mDirections[GET].limit + mDirections[PUT].limit;
+}
+
+unsigned AdaptiveTransferConcurrency::maxTransfers(direction_t direction) const
+{
+    assert(direction == GET || direction == PUT);
+    return mDirections[direction].limit;
+}
+
+m_off_t AdaptiveTransferConcurrency::targetOutstanding(direction_t direction, m_off_t speed) const
+{
+    m_off_t target = 30 * speed;
+    target = std::max<m_off_t>(target, 2 * 1024 * 1024);
+    return std::min<m_off_t>(target, m_off_t(100 * 1024 * 1024) * maxTransfers(direction) / FixedTransferConcurrency::MAXTRANSFERS);
+}
+
+void AdaptiveTransferConcurrency::sample(dstime ds, direction_t direction, m_off_t speed, unsigned active)
+{
+    assert(direction == GET || direction == PUT);
+    Direction& d = mDirections[direction];
+
+    if (d.windowstart == NEVER)
+    {
+        d.windowstart = ds;
+    }
+
+    d.speedsum += speed;
+    d.samples++;
+    d.saturated = d.saturated && active >= d.limit;
+
+    if (ds - d.windowstart < WINDOWDS)
+    {
+        return;
+    }
+
+    m_off_t meanspeed = d.speedsum / d.samples;
+    unsigned limit = d.limit;
+
+    if (d.failures || (d.saturated && d.lastspeed && meanspeed < d.lastspeed - d.lastspeed / 4))
+    {
+        d.limit = std::max(MINTRANSFERS, d.limit - d.limit / 4);
+    }
+    else if (d.saturated && (!d.lastspeed || meanspeed > d.lastspeed + d.lastspeed / 20))
+    {
+        d.limit = std::min(MAXTRANSFERS, d.limit + STEP);
+    }
+
+    if (d.saturated || d.failures)
+    {
+        d.lastspeed = meanspeed;
+    }
+
+    if (d.limit != limit)
+    {
+        LOG_debug << "Concurrent " << (direction == GET ? "downloads" : "uploads") << ": " << limit << " -> " << d.limit
+                  << " (" << meanspeed << " B/s, " << d.failures << " failed requests)";
+    }
+
+    d.windowstart = ds;
+    d.speedsum = 0;
+    d.samples = 0;
+    d.saturated = true;
+    d.failures = 0;
+}
+
+void AdaptiveTransferConcurrency::requestfailed(direction_t direction)
+{
+    assert(direction == GET || direction == PUT);
+    mDirections[direction].failures++;
+}
+
 Transfer::Transfer(MegaClient* cclient, direction_t ctype)
     : bt(cclient->rng, cclient->transferRetryBackoffs[ctype])
 {
@@ -73,16 +182,19 @@ Transfer::Transfer(MegaClient* cclient, direction_t ctype)
     slot = NULL;
     asyncopencontext = NULL;
     progresscompleted = 0;
-    hasprevmetamac = false;
-    hascurrentmetamac = false;
     finished = false;
     lastaccesstime = 0;
     ultoken = NULL;
 
     priority = 0;
     state = TRANSFERSTATE_NONE;
+    transferclass = TRANSFERCLASS_INTERACTIVE;
 
     skipserialization = false;
+    cachedirty = false;
+
+    urlprefetch = NULL;
+    urlprefetchds = 0;
 
     faputcompletion_it = client->faputcompletion.end();
     transfers_it = client->transfers[type].end();
@@ -91,11 +203,35 @@ Transfer::Transfer(MegaClient* cclient, direction_t ctype)
 // delete transfer with underlying slot, notify files
 Transfer::~Transfer()
 {
+    if (urlprefetch)
+    {
+        urlprefetch->cancel();
+    }
+
+    if (verification && verification->queued)
+    {
+        auto it = std::find(client->verifyingdownloads.begin(), client->verifyingdownloads.end(), this);
+        assert(it != client->verifyingdownloads.end());
+        client->verifyingdownloads.erase(it);
+    }
+
     if (faputcompletion_it != client->faputcompletion.end())
     {
         client->faputcompletion.erase(faputcompletion_it);
     }
 
+    if (client->dirtytransfers.erase(this))
+    {
+        // records not written yet are dropped with the transfer
+        client->dirtytransfercache -= cachedirty;
+        cachedirty = false;
+        for (File* f : files)
+        {
+            client->dirtytransfercache -= f->cachedirty;
+            f->cachedirty = false;
+        }
+    }
+
     for (file_list::iterator it = files.begin(); it != files.end(); it++)
     {
         if (finished)
@@ -163,6 +299,12 @@ bool Transfer::serialize(string *d)
         return false;
     }
 
+    FileFingerprint badfp;
+    if (integritystate)
+    {
+        badfp = integritystate->badfp;
+    }
+
     if (!badfp.serialize(d))
     {
         LOG_err << "Error serializing Transfer: Unable to serialize badfp";
@@ -276,7 +418,10 @@ Transfer *Transfer::unserialize(MegaClient *client, string *d, transfer_map* tra
     delete fp;
 
     fp = FileFingerprint::unserialize(d);
-    t->badfp = *fp;
+    if (fp && fp->isvalid)
+    {
+        t->integrity().badfp = *fp;
+    }
     delete fp;
 
     ptr = d->data();
@@ -364,6 +509,56 @@ Transfer *Transfer::unserialize(MegaClient *client, string *d, transfer_map* tra
     return t;
 }
 
+bool Transfer::unserializeindex(const string& d, direction_t& type, FileFingerprint& fp, m_time_t& lastaccesstime, uint64_t& priority)
+{
+    unsigned short ll;
+    const char* ptr = d.data();
+    const char* end = ptr + d.size();
+
+    if (ptr + sizeof(direction_t) + sizeof(ll) > end)
+    {
+        return false;
+    }
+
+    type = MemAccess::get<direction_t>(ptr);
+    ptr += sizeof(direction_t);
+    if (type != GET && type != PUT)
+    {
+        return false;
+    }
+
+    // path, keys and chunkmacs are skipped over
+    ll = MemAccess::get<unsigned short>(ptr);
+    ptr += sizeof(ll) + ll + FILENODEKEYLENGTH + sizeof(int64_t) + sizeof(int64_t) + SymmCipher::KEYLENGTH;
+    if (ptr + sizeof(ll) > end)
+    {
+        return false;
+    }
+
+    ll = MemAccess::get<unsigned short>(ptr);
+    ptr += sizeof(ll) + ll * (sizeof(m_off_t) + sizeof(ChunkMAC));
+
+    FileFingerprint badfp;
+    if (ptr > end
+            || !FileFingerprint::unserialize(ptr, end, fp)
+            || !FileFingerprint::unserialize(ptr, end, badfp)
+            || ptr + sizeof(m_time_t) > end)
+    {
+        return false;
+    }
+
+    lastaccesstime = MemAccess::get<m_time_t>(ptr);
+
+    // the priority closes the record, before its version
+    if (d.size() < sizeof(uint64_t) + 1 || d.back())
+    {
+        return false;
+    }
+
+    priority = MemAccess::get<uint64_t>(end - 1 - sizeof(uint64_t));
+    return true;
+}
+
 SymmCipher *Transfer::transfercipher()
 {
     client->tmptransfercipher.setkey(transferkey.data());
@@ -387,6 +582,9 @@ void Transfer::failed(const Error& e, DBTableTransactionCommitter& committer, ds
     bool defer = false;
 
     LOG_debug << "Transfer failed with error " << e;
+    client->metrics.transferTrace->instant("failed", tag, 0, { { "error", error(e) },
+                                                               { "failcount", failcount },
+                                                               { "timeleft", timeleft } });
 
     if (e == API_EOVERQUOTA || e == API_EPAYWALL)
     {
@@ -491,19 +689,38 @@ void Transfer::failed(const Error& e, DBTableTransactionCommitter& committer, ds
         it++;
     }
 
-    tempurls.clear();
-    if (type == PUT)
+    bool modified = false;
+    if (type == PUT && slot && slot->fa && (slot->fa->mtime != mtime || slot->fa->size != size))
     {
-        chunkmacs.clear();
-        progresscompleted = 0;
-        ultoken.reset();
-        pos = 0;
+        LOG_warn << "Modification detected during active upload. Size: " << size << "  Mtime: " << mtime
+                 << "    FaSize: " << slot->fa->size << "  FaMtime: " << slot->fa->mtime;
+        defer = false;
+        modified = true;
+    }
+
+    if (type == PUT && defer && !modified && client->keepuploadprogress
+            && e == API_EAGAIN && slot && !slot->urlrejected && !ultoken && tempurls.size())
+    {
+        // the URL takes the remaining chunks; the retry starts after the last acknowledged one
+        LOG_debug << "Keeping upload progress: " << progresscompleted << " of " << size;
+    }
+    else
+    {
+        if (type == GET && !tempurls.empty())
+        {
+            for (File* f : files)
+            {
+                client->uncachetempurls(f->h.as8byte(), f->hprivate);
+            }
+        }
 
-        if (slot && slot->fa && (slot->fa->mtime != mtime || slot->fa->size != size))
+        tempurls.clear();
+        if (type == PUT)
         {
-            LOG_warn << "Modification detected during active upload. Size: " << size << "  Mtime: " << mtime
-                     << "    FaSize: " << slot->fa->size << "  FaMtime: " << slot->fa->mtime;
-            defer = false;
+            chunkmacs.clear();
+            progresscompleted = 0;
+            ultoken.reset();
+            pos = 0;
         }
     }
 
@@ -531,6 +748,8 @@ void Transfer::failed(const Error& e, DBTableTransactionCommitter& committer, ds
                 && e != API_EPAYWALL)
             {
                 client->syncdownrequired = true;
+                client->syncdownfull = true;
+                client->syncupfull = true;
             }
 
             if (e == API_EBUSINESSPASTDUE && !alreadyDisabled)
@@ -575,17 +794,15 @@ void Transfer::addAnyMissingMediaFileAttributes(Node* node, /*const*/ LocalPath&
             // if we don't have the codec id mappings yet, send the request
             client->mediaFileInfo.requestCodecMappingsOneTime(client, NULL);
 
-            // always get the attribute string; it may indicate this version of the mediaInfo library was unable to interpret the file
-            MediaProperties vp;
-            vp.extractMediaPropertyFileAttributes(localpath, client->fsaccess);
-
+            // always get the attribute string; it may indicate this version of the mediaInfo library was unable to interpret the file.
+            // A worker extracts it (usually started when the upload was queued), and the upload waits for it on hold
             if (type == PUT)
             {
-                minfa += client->mediaFileInfo.queueMediaPropertiesFileAttributesForUpload(vp, attrKey, client, uploadhandle);
+                minfa += client->mediaFileInfo.queueExtractionForUpload(localpath, *this, attrKey, client, uploadhandle);
             }
             else
             {
-                client->mediaFileInfo.sendOrQueueMediaPropertiesFileAttributesForExistingFile(vp, attrKey, client, node->nodehandle);
+                client->mediaFileInfo.queueExtractionForExistingFile(localpath, *this, attrKey, client, node->nodehandle);
             }
         }
     }
@@ -596,6 +813,12 @@ void Transfer::addAnyMissingMediaFileAttributes(Node* node, /*const*/ LocalPath&
 // fingerprint, notify app, notify files
 void Transfer::complete(DBTableTransactionCommitter& committer)
 {
+    if (verification && verification->queued)
+    {
+        // exec() calls back once the worker is done, and those before are
+        return;
+    }
+
     CodeCounter::ScopeTimer ccst(client->performanceStats.transferComplete);
 
     state = TRANSFERSTATE_COMPLETING;
@@ -655,14 +878,39 @@ void Transfer::complete(DBTableTransactionCommitter& committer)
             }
         }
 
-        if (!fixedfingerprint && success && fa->fopen(localfilename, true, false))
+        bool opened = false;
+        bool retry = false;
+        if (!fixedfingerprint && success)
+        {
+            if (verification)
+            {
+                opened = verification->opened;
+                retry = verification->retry;
+                fingerprint = verification->fingerprint;
+                verification.reset();
+            }
+            else if (client->asynccompletions)
+            {
+                return verifyonworker();
+            }
+            else if ((opened = fa->fopen(localfilename, true, false)))
+            {
+                fingerprint.genfingerprint(fa.get());
+            }
+            else
+            {
+                retry = fa->retry;
+            }
+        }
+
+        if (opened)
         {
-            fingerprint.genfingerprint(fa.get());
             if (isvalid && !(fingerprint == *(FileFingerprint*)this))
             {
                 LOG_err << "Fingerprint mismatch";
 
                 // enforce the verification of the fingerprint for sync transfers only
+                FileFingerprint& badfp = integrity().badfp;
                 if (syncxfer && (!badfp.isvalid || !(badfp == fingerprint)))
                 {
                     badfp = fingerprint;
@@ -694,7 +942,7 @@ void Transfer::complete(DBTableTransactionCommitter& committer)
         {
             if (syncxfer && !fixedfingerprint && success)
             {
-                transient_error = fa->retry;
+                transient_error = retry;
                 LOG_debug << "Unable to validate fingerprint " << transient_error;
             }
         }
@@ -882,7 +1130,7 @@ void Transfer::complete(DBTableTransactionCommitter& committer)
 
                                 if (missingattr)
                                 {
-                                    client->gfx->gendimensionsputfa(NULL, localname, n->nodehandle, n->nodecipher(), missingattr);
+                                    client->gfx->gendimensionsputfa(NULL, localname, n->nodehandle, n->nodecipher(), missingattr, true, true);
                                 }
 
                                 addAnyMissingMediaFileAttributes(n, localname);
@@ -914,6 +1162,8 @@ void Transfer::complete(DBTableTransactionCommitter& committer)
                             if (f->syncxfer)
                             {
                                 client->syncdownrequired = true;
+                                client->syncdownfull = true;
+                                client->syncupfull = true;
                             }
 #endif
                             client->app->file_removed(f, API_EWRITE);
@@ -1021,6 +1271,8 @@ void Transfer::complete(DBTableTransactionCommitter& committer)
                 if (f->syncxfer)
                 {
                     client->syncdownrequired = true;
+                    client->syncdownfull = true;
+                    client->syncupfull = true;
                 }
 #endif
                 it++; // the next line will remove the current item and invalidate that iterator
@@ -1050,6 +1302,41 @@ void Transfer::complete(DBTableTransactionCommitter& committer)
     }
 }
 
+Transfer::Integrity& Transfer::integrity()
+{
+    if (!integritystate)
+    {
+        integritystate.reset(new Integrity);
+    }
+    return *integritystate;
+}
+
+void Transfer::verifyonworker()
+{
+    LOG_debug << "Verifying download on a worker: " << localfilename.toPath(*client->fsaccess);
+
+    verification = std::make_shared<Verification>();
+    client->verifyingdownloads.push_back(this);
+
+    auto v = verification;
+    std::shared_ptr<FileAccess> fa(client->fsaccess->newfileaccess().release());
+    LocalPath path = localfilename;
+
+    client->mAsyncQueue.push([v, fa, path](SymmCipher&) mutable
+        {
+            if ((v->opened = fa->fopen(path, true, false)))
+            {
+                v->fingerprint.genfingerprint(fa.get());
+            }
+            else
+            {
+                v->retry = fa->retry;
+            }
+            fa.reset();
+            v->done = true;
+        }, false);
+}
+
 void Transfer::completefiles()
 {
     // notify all files and give them an opportunity to self-destruct
@@ -1145,6 +1432,13 @@ void DirectReadNode::dispatch()
         schedule(DirectReadSlot::TIMEOUT_DS);
         if (!pendingcmd)
         {
+            if (tempurls.empty() && client->cachedtempurls(h, p, tempurls, size))
+            {
+                LOG_debug << "Streaming with cached temporary URLs";
+                cmdresult(API_OK);
+                return;
+            }
+
             pendingcmd = new CommandDirectRead(client, this);
             client->reqs.add(pendingcmd);
         }
@@ -1172,8 +1466,15 @@ void DirectReadNode::retry(const Error& e, dstime timeleft)
     }
 
     // signal failure to app , obtain minimum desired retry time
-    for (dr_list::iterator it = reads.begin(); it != reads.end(); it++)
+    for (dr_list::iterator it = reads.begin(); it != reads.end(); )
     {
+        if ((*it)->readingahead())
+        {
+            // the app has all it asked for: just stop filling the cache
+            delete *(it++);
+            continue;
+        }
+
         (*it)->abort();
 
         if (e)
@@ -1185,6 +1486,14 @@ void DirectReadNode::retry(const Error& e, dstime timeleft)
                 minretryds = retryds;
             }
         }
+        ++it;
+    }
+
+    if (reads.empty())
+    {
+        LOG_debug << "Removing DirectReadNode. It was only reading ahead.";
+        delete this;
+        return;
     }
 
     if (e == API_EOVERQUOTA && timeleft)
@@ -1202,6 +1511,11 @@ void DirectReadNode::retry(const Error& e, dstime timeleft)
     }
 
     tempurls.clear();
+    if (e)
+    {
+        // they may be what failed
+        client->uncachetempurls(h, p);
+    }
 
     if (!e || !minretryds)
     {
@@ -1239,7 +1553,7 @@ void DirectReadNode::cmdresult(const Error &e, dstime timeleft)
             if (dr->drbuf.tempUrlVector().empty())
             {
                 // DirectRead starting
-                dr->drbuf.setIsRaid(dr->drn->tempurls, dr->offset, dr->offset + dr->count, dr->drn->size, 2097152);  // 2 MB max buffer usage approx for streaming
+                dr->startbuffer();
             }
             else
             {
@@ -1248,6 +1562,7 @@ void DirectReadNode::cmdresult(const Error &e, dstime timeleft)
             }
 
             dr->drq_it = client->drq.insert(client->drq.end(), *it);
+            client->drqdirty = true;
         }
 
         schedule(DirectReadSlot::TIMEOUT_DS);
@@ -1281,6 +1596,26 @@ void DirectReadNode::enqueue(m_off_t offset, m_off_t count, int reqtag, void* ap
     new DirectRead(this, count, offset, reqtag, appdata);
 }
 
+bool DirectReadSlot::processCachedData()
+{
+    if (dr->progress >= m_off_t(dr->cached.size()))
+    {
+        return true;
+    }
+
+    size_t len = dr->cached.size() - size_t(dr->progress);
+    if (!dr->drn->client->app->pread_data((byte*)dr->cached.data() + dr->progress, len, pos, speed, meanSpeed, dr->appdata))
+    {
+        return false;
+    }
+
+    LOG_debug << "Streaming " << len << " bytes from the cache at " << pos;
+    pos += len;
+    dr->progress += len;
+    string().swap(dr->cached);
+    return true;
+}
+
 bool DirectReadSlot::processAnyOutputPieces()
 {
     bool continueDirectRead = true;
@@ -1291,7 +1626,14 @@ bool DirectReadSlot::processAnyOutputPieces()
         speed = speedController.calculateSpeed();
         meanSpeed = speedController.getMeanSpeed();
         dr->drn->client->httpio->updatedownloadspeed(len);
-        continueDirectRead = dr->drn->client->app->pread_data(outputPiece->buf.datastart(), len, pos, speed, meanSpeed, dr->appdata);
+        dr->drn->client->streamingcache.put(dr->drn->h, pos, outputPiece->buf.datastart(), len);
+
+        // what comes after count is read ahead, for the cache only
+        m_off_t applen = std::min<m_off_t>(len, dr->offset + dr->count - pos);
+        if (applen > 0)
+        {
+            continueDirectRead = dr->drn->client->app->pread_data(outputPiece->buf.datastart(), applen, pos, speed, meanSpeed, dr->appdata);
+        }
 
         dr->drbuf.bufferWriteCompleted(0, true);
 
@@ -1307,6 +1649,13 @@ bool DirectReadSlot::processAnyOutputPieces()
 
 bool DirectReadSlot::doio()
 {
+    if (!processCachedData())
+    {
+        // app-requested abort
+        delete dr;
+        return true;
+    }
+
     for (unsigned connectionNum = unsigned(reqs.size()); connectionNum--; )
     {
         HttpReq* req = reqs[connectionNum];
@@ -1358,6 +1707,13 @@ bool DirectReadSlot::doio()
             {
                 req->status = REQ_READY;
             }
+            else if (dr->drbuf.isRaidConnectionSuperseded(connectionNum))
+            {
+                LOG_debug << "Hedged raid connection " << connectionNum << " fell a chunk behind, restarting it from the other parts";
+                req->disconnect();
+                req->in.clear();
+                req->status = REQ_READY;
+            }
         }
 
         if (req->status == REQ_READY)
@@ -1500,11 +1856,14 @@ DirectRead::DirectRead(DirectReadNode* cdrn, m_off_t ccount, m_off_t coffset, in
 
     reads_it = drn->reads.insert(drn->reads.end(), this);
 
+    readahead = 0;
+
     if (!drn->tempurls.empty())
     {
         // we already have tempurl(s): queue for immediate fetching
-        drbuf.setIsRaid(drn->tempurls, offset, offset + count, drn->size, 2097152);  // 2 MB max buffer usage approx
+        startbuffer();
         drq_it = drn->client->drq.insert(drn->client->drq.end(), this);
+        drn->client->drqdirty = true;
     }
     else
     {
@@ -1513,6 +1872,18 @@ DirectRead::DirectRead(DirectReadNode* cdrn, m_off_t ccount, m_off_t coffset, in
     }
 }
 
+void DirectRead::startbuffer()
+{
+    StreamingCache& cache = drn->client->streamingcache;
+    cache.get(drn->h, offset, count, cached);
+
+    int minrate = drn->client->minstreamingrate;
+    m_off_t ahead = cache.readahead(drn->h, offset, count, minrate > 0 ? minrate : DirectReadSlot::MIN_BYTES_PER_SECOND);
+    readahead = std::max<m_off_t>(0, std::min(ahead, drn->size - offset - count));
+
+    drbuf.setIsRaid(drn->tempurls, offset + m_off_t(cached.size()), offset + count + readahead, drn->size, 2097152);  // 2 MB max buffer usage approx for streaming
+}
+
 DirectRead::~DirectRead()
 {
     abort();
@@ -1559,7 +1930,7 @@ DirectReadSlot::DirectReadSlot(DirectRead* cdr)
     dr = cdr;
 
     pos = dr->offset + dr->progress;
-    dr->nextrequestpos = pos;
+    dr->nextrequestpos = std::max<m_off_t>(pos, dr->offset + m_off_t(dr->cached.size()));
 
     speed = meanSpeed = 0;
 
@@ -1573,13 +1944,36 @@ DirectReadSlot::DirectReadSlot(DirectRead* cdr)
 
     drs_it = dr->drn->client->drss.insert(dr->drn->client->drss.end(), this);
 
+    hosts.reserve(dr->drbuf.tempUrlVector().size());
+    for (const string& url : dr->drbuf.tempUrlVector())
+    {
+        hosts.push_back(host(url));
+        ++dr->drn->client->drhostconnections[hosts.back()];
+    }
+    ++dr->drn->slots;
+
     dr->drn->partiallen = 0;
     dr->drn->partialstarttime = Waiter::ds;
 }
 
 DirectReadSlot::~DirectReadSlot()
 {
-    dr->drn->client->drss.erase(drs_it);
+    MegaClient* client = dr->drn->client;
+    client->drss.erase(drs_it);
+
+    for (const string& h : hosts)
+    {
+        auto it = client->drhostconnections.find(h);
+        assert(it != client->drhostconnections.end());
+        if (it != client->drhostconnections.end() && !--it->second)
+        {
+            client->drhostconnections.erase(it);
+        }
+    }
+    --dr->drn->slots;
+
+    // another read can have the slot
+    client->drqdirty = true;
 
     LOG_debug << "Deleting DirectReadSlot";
     for (size_t i = reqs.size(); i--; )
@@ -1588,6 +1982,37 @@ DirectReadSlot::~DirectReadSlot()
     }
 }
 
+string DirectReadSlot::host(const string& url)
+{
+    size_t n = url.find("://");
+    if (n == string::npos)
+    {
+        return url;
+    }
+
+    n += 3;
+    return url.substr(n, url.find('/', n) - n);
+}
+
+bool DirectReadSlot::hostsavailable(DirectRead* dr)
+{
+    MegaClient* client = dr->drn->client;
+    if (!client->maxdrslotsperhost)
+    {
+        return true;
+    }
+
+    for (const string& url : dr->drbuf.tempUrlVector())
+    {
+        auto it = client->drhostconnections.find(host(url));
+        if (it != client->drhostconnections.end() && it->second >= client->maxdrslotsperhost)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
 bool priority_comparator(const LazyEraseTransferPtr& i, const LazyEraseTransferPtr& j)
 {
     return (i.transfer ? i.transfer->priority : i.preErasurePriority) < (j.transfer ? j.transfer->priority : j.preErasurePriority);
@@ -1596,6 +2021,19 @@ bool priority_comparator(const LazyEraseTransferPtr& i, const LazyEraseTransferP
 TransferList::TransferList()
 {
     currentpriority = PRIORITY_START;
+    classcounts[GET].fill(0);
+    classcounts[PUT].fill(0);
+}
+
+// the most urgent class of the files of a transfer
+static transferclass_t filesclass(Transfer* transfer)
+{
+    transferclass_t c = transfer->files.empty() ? TRANSFERCLASS_INTERACTIVE : TRANSFERCLASS_BACKUP;
+    for (File* f : transfer->files)
+    {
+        c = std::min(c, f->transferclass());
+    }
+    return c;
 }
 
 void TransferList::addtransfer(Transfer *transfer, DBTableTransactionCommitter& committer, bool startFirst)
@@ -1607,6 +2045,9 @@ void TransferList::addtransfer(Transfer *transfer, DBTableTransactionCommitter&
 
     assert(transfer->type == PUT || transfer->type == GET);
 
+    transfer->transferclass = filesclass(transfer);
+    classcounts[transfer->type][transfer->transferclass]++;
+
     if (!transfer->priority)
     {
         if (startFirst && transfers[transfer->type].size())
@@ -1640,6 +2081,19 @@ void TransferList::removetransfer(Transfer *transfer)
     if (getIterator(transfer, it, true))
     {
         transfers[transfer->type].erase(it);
+        classcounts[transfer->type][transfer->transferclass]--;
+    }
+}
+
+void TransferList::classify(Transfer* transfer)
+{
+    transferclass_t c = filesclass(transfer);
+    transfer_list::iterator it;
+    if (c < transfer->transferclass && getIterator(transfer, it))
+    {
+        classcounts[transfer->type][transfer->transferclass]--;
+        classcounts[transfer->type][c]++;
+        transfer->transferclass = c;
     }
 }
 
@@ -1928,7 +2382,8 @@ bool TransferList::getIterator(Transfer *transfer, transfer_list::iterator& it,
     return false;
 }
 
-std::array<vector<Transfer*>, 6> TransferList::nexttransfers(std::function<bool(Transfer*)>& continuefunction)
+std::array<vector<Transfer*>, 6> TransferList::nexttransfers(std::function<bool(Transfer*)>& continuefunction,
+                                                            std::function<bool(direction_t)>& directionfull)
 {
     std::array<vector<Transfer*>, 6> chosenTransfers;
 
@@ -1936,33 +2391,91 @@ std::array<vector<Transfer*>, 6> TransferList::nexttransfers(std::function<bool(
 
     for (direction_t direction : putget)
     {
-        for (Transfer *transfer : transfers[direction])
+        // the limits applied by continuefunction only tighten as transfers are chosen: once it
+        // turns down a transfer of a category, it would turn down the rest of that category too.
+        // The walk stops when the direction or both categories are full, so a pass costs the
+        // transfers it looks at until then rather than the whole queue
+        bool continueLarge = true;
+        bool continueSmall = true;
+
+        if (client->fairtransferclasses)
         {
-            bool continueLarge = true;
-            bool continueSmall = true;
+            // no more than that can start in a pass
+            auto ready = readybyclass(direction, client->transferpolicy->maxTransfers(direction));
 
-            if ((!transfer->slot && isReady(transfer))
-                || (transfer->asyncopencontext
-                    && transfer->asyncopencontext->finished))
+            // smooth weighted round robin: each turn, every class with transfers left gains its
+            // weight and the one with the most credit offers its next transfer, paying back the
+            // weights of all of them
+            std::array<long long, TRANSFERCLASSES> credit = {};
+            std::array<size_t, TRANSFERCLASSES> next = {};
+
+            while (continueLarge || continueSmall)
             {
+                long long total = 0;
+                int chosen = -1;
+
+                for (int c = 0; c < TRANSFERCLASSES; c++)
+                {
+                    if (next[c] < ready[c].size())
+                    {
+                        unsigned weight = std::max(1u, client->transferclassweights[c]);
+                        credit[c] += weight;
+                        total += weight;
+                        if (chosen < 0 || credit[c] > credit[chosen])
+                        {
+                            chosen = c;
+                        }
+                    }
+                }
+
+                if (chosen < 0)
+                {
+                    break;
+                }
+                credit[chosen] -= total;
+
+                Transfer* transfer = ready[chosen][next[chosen]++];
                 TransferCategory tc(transfer);
+                bool& continueCategory = (tc.sizetype == LARGEFILE) ? continueLarge : continueSmall;
 
-                if (tc.sizetype == LARGEFILE && continueLarge)
+                if (continueCategory)
                 {
-                    continueLarge = continuefunction(transfer);
-                    if (continueLarge)
+                    continueCategory = continuefunction(transfer);
+                    if (continueCategory)
                     {
                         chosenTransfers[tc.index()].push_back(transfer);
                     }
+                    else if (directionfull(direction))
+                    {
+                        break;
+                    }
                 }
-                else if (tc.sizetype == SMALLFILE && continueSmall)
+            }
+            continue;
+        }
+
+        for (Transfer *transfer : transfers[direction])
+        {
+            if ((!transfer->slot && isReady(transfer))
+                || (transfer->asyncopencontext
+                    && transfer->asyncopencontext->finished))
+            {
+                TransferCategory tc(transfer);
+                bool& continueCategory = (tc.sizetype == LARGEFILE) ? continueLarge : continueSmall;
+
+                if (continueCategory)
                 {
-                    continueSmall = continuefunction(transfer);
-                    if (continueSmall)
+                    continueCategory = continuefunction(transfer);
+                    if (continueCategory)
                     {
                         chosenTransfers[tc.index()].push_back(transfer);
                     }
+                    else if (directionfull(direction))
+                    {
+                        break;
+                    }
                 }
+
                 if (!continueLarge && !continueSmall)
                 {
                     break;
@@ -1973,6 +2486,38 @@ std::array<vector<Transfer*>, 6> TransferList::nexttransfers(std::function<bool(
     return chosenTransfers;
 }
 
+std::array<vector<Transfer*>, TRANSFERCLASSES> TransferList::readybyclass(direction_t direction, size_t atmost)
+{
+    std::array<vector<Transfer*>, TRANSFERCLASSES> ready;
+    std::array<size_t, TRANSFERCLASSES> seen = {};
+
+    for (Transfer *transfer : transfers[direction])
+    {
+        transferclass_t c = transfer->transferclass;
+        seen[c]++;
+
+        if (ready[c].size() < atmost
+            && ((!transfer->slot && isReady(transfer))
+                || (transfer->asyncopencontext
+                    && transfer->asyncopencontext->finished)))
+        {
+            ready[c].push_back(transfer);
+        }
+
+        // the walk ends once each class has enough, or has no more transfers further on
+        bool done = true;
+        for (int i = 0; done && i < TRANSFERCLASSES; i++)
+        {
+            done = ready[i].size() >= atmost || seen[i] >= classcounts[direction][i];
+        }
+        if (done)
+        {
+            break;
+        }
+    }
+    return ready;
+}
+
 Transfer *TransferList::transferat(direction_t direction, unsigned int position)
 {
     if (transfers[direction].size() > position)
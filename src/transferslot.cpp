@@ -19,6 +19,9 @@
  * program.
  */
 
+// the level of the transfers module applies (see SimpleLogger::setModuleLogLevel)
+#define MEGA_LOG_MODULE ::mega::logModuleTransfers
+
 #include "mega/transferslot.h"
 #include "mega/node.h"
 #include "mega/transfer.h"
@@ -51,6 +54,85 @@ void TransferSlotFileAccess::reset(std::unique_ptr<FileAccess>&& p)
     transfer->bt.enable(!!p);
 }
 
+const dstime StripedUploadTuner::WINDOWDS = 20;
+
+StripedUploadTuner::StripedUploadTuner(unsigned initial, unsigned ceiling)
+    : mActive(std::max(1u, std::min(initial, ceiling)))
+    , mCeiling(std::max(1u, ceiling))
+{
+}
+
+unsigned StripedUploadTuner::active() const
+{
+    return mActive;
+}
+
+void StripedUploadTuner::requestdone(m_off_t size, int connectms)
+{
+    mRequestSize = size;
+
+    if (connectms > 0 && (!mRttMs || connectms < mRttMs))
+    {
+        mRttMs = connectms;
+    }
+}
+
+void StripedUploadTuner::sample(dstime ds, m_off_t speed)
+{
+    if (mWindowStart == NEVER)
+    {
+        mWindowStart = ds;
+    }
+
+    mSpeedSum += speed;
+    mSamples++;
+
+    if (ds - mWindowStart < std::max<dstime>(WINDOWDS, dstime(mRttMs * 8 / 100)))
+    {
+        return;
+    }
+
+    m_off_t meanspeed = mSpeedSum / mSamples;
+    unsigned active = mActive;
+
+    if (mFailures || (mLastSpeed && meanspeed < mLastSpeed - mLastSpeed / 4))
+    {
+        mActive = std::max(1u, mActive - 1);
+    }
+    else if (!mLastSpeed)
+    {
+        // each connection waits a round trip for the reply to every request: enough requests for
+        // the data sent in one round trip, and at least one more connection to see if it helps
+        m_off_t target = mActive + 1;
+        if (mRttMs && mRequestSize > 0)
+        {
+            target = std::max<m_off_t>(target, 1 + meanspeed * mRttMs / 1000 / mRequestSize);
+        }
+        mActive = unsigned(std::min<m_off_t>(mCeiling, target));
+    }
+    else if (meanspeed > mLastSpeed + mLastSpeed / 20)
+    {
+        mActive = std::min(mCeiling, mActive + 1);
+    }
+
+    if (mActive != active)
+    {
+        LOG_debug << "Striped upload connections: " << active << " -> " << mActive
+                  << " (" << meanspeed << " B/s, RTT " << mRttMs << " ms, " << mFailures << " failed requests)";
+    }
+
+    mLastSpeed = meanspeed;
+    mWindowStart = ds;
+    mSpeedSum = 0;
+    mSamples = 0;
+    mFailures = 0;
+}
+
+void StripedUploadTuner::requestfailed()
+{
+    mFailures++;
+}
+
 
 // transfer attempts are considered failed after XFERTIMEOUT deciseconds
 // without data flow
@@ -95,6 +177,8 @@ TransferSlot::TransferSlot(Transfer* ctransfer)
     transfer->slot = this;
     transfer->state = TRANSFERSTATE_ACTIVE;
 
+    mTraceStart = std::chrono::steady_clock::now();
+
     slots_it = transfer->client->tslots.end();
 
     maxRequestSize = MAX_REQ_SIZE;
@@ -148,19 +232,56 @@ bool TransferSlot::createconnectionsonce()
             return false;   // too soon, we don't know raid / non-raid yet
         }
 
-        connections = transferbuf.isRaid() ? RAIDPARTS : (transfer->size > 131072 ? transfer->client->connections[transfer->type] : 1);
+        MegaClient* client = transfer->client;
+        connections = transferbuf.isRaid() ? RAIDPARTS : (transfer->size > 131072 ? client->connections[transfer->type] : 1);
+
+        if (transfer->type == PUT && client->stripeduploads && !transferbuf.isRaid()
+                && transfer->size >= MegaClient::STRIPEDUPLOADSIZE)
+        {
+            unsigned ceiling = std::max(unsigned(connections), std::min(client->maxstripedconnections, MegaClient::MAX_NUM_CONNECTIONS));
+            mStriped.reset(new StripedUploadTuner(unsigned(connections), ceiling));
+            connections = int(ceiling);
+        }
+
         LOG_debug << "Populating transfer slot with " << connections << " connections, max request size of " << maxRequestSize << " bytes";
         reqs.resize(connections);
         mReqSpeeds.resize(connections);
+        mReqSizes.assign(connections, maxRequestSize);
+        mReqSizeAdapted.assign(connections, true);
+        mTraceSteps.resize(connections);
         asyncIO = new AsyncIOContext*[connections]();
     }
     return true;
 }
 
+TraceRing& TransferSlot::trace()
+{
+    return *transfer->client->metrics.transferTrace;
+}
+
+void TransferSlot::tracestep(unsigned i, const char* name, std::initializer_list<TraceRing::Arg> args)
+{
+    trace().span(name, transfer->tag, int(i) + 1, mTraceSteps[i], args);
+    mTraceSteps[i] = std::chrono::steady_clock::now();
+}
+
+void TransferSlot::tracechunk(unsigned i)
+{
+    tracestep(i, "chunk", { { "pos", reqs[i]->pos },
+                            { "size", m_off_t(reqs[i]->size) },
+                            { "connectms", reqs[i]->connectms },
+                            { "ttfbms", reqs[i]->ttfbms } });
+}
+
 // delete slot and associated resources, but keep transfer intact (can be
 // reused on a new slot)
 TransferSlot::~TransferSlot()
 {
+    trace().span("slot", transfer->tag, 0, mTraceStart, { { "type", transfer->type },
+                                                          { "size", transfer->size },
+                                                          { "completed", transfer->progresscompleted },
+                                                          { "finished", transfer->finished } });
+
     if (transfer->type == GET && !transfer->finished
             && transfer->progresscompleted != transfer->size
             && !transfer->asyncopencontext)
@@ -330,6 +451,84 @@ void TransferSlot::toggleport(HttpReqXfer *req)
     }
 }
 
+void TransferSlot::encryptupload(unsigned i, m_off_t pos, m_off_t npos)
+{
+    string finaltempurl = transferbuf.tempURL(i);
+    if (transfer->client->usealtupport && !memcmp(finaltempurl.c_str(), "http:", 5))
+    {
+        size_t index = finaltempurl.find("/", 8);
+        if(index != string::npos && finaltempurl.find(":", 8) == string::npos)
+        {
+            finaltempurl.insert(index, ":8080");
+        }
+    }
+
+    auto req = reqs[i];    // shared_ptr so no object is deleted out from under the worker
+    auto transferkey = transfer->transferkey;
+    auto ctriv = transfer->ctriv;
+    auto queue = &transfer->client->mAsyncQueue;
+    auto trace = transfer->client->metrics.transferTrace;
+    auto tag = transfer->tag;
+    auto queued = std::chrono::steady_clock::now();
+    req->pos = pos;
+    req->status = REQ_ENCRYPTING;
+
+    // the chunks of the request are spread over the other workers too
+    queue->push([req, transferkey, ctriv, finaltempurl, pos, npos, queue, trace, tag, i, queued](SymmCipher& sc)
+        {
+            trace->span("encryptwait", tag, int(i) + 1, queued);
+            auto start = std::chrono::steady_clock::now();
+
+            sc.setkey(transferkey.data());
+            static_cast<HttpReqUL*>(req.get())->prepare(finaltempurl.c_str(), &sc, ctriv, pos, npos, queue);
+
+            trace->span("encrypt", tag, int(i) + 1, start, { { "pos", pos }, { "size", npos - pos } });
+            req->status = REQ_PREPARED;
+        }, true);   // discardable - if the transfer or client are being destroyed, we won't be sending that data.
+}
+
+void TransferSlot::adaptrequestsize(unsigned i, bool failed)
+{
+    MegaClient* client = transfer->client;
+
+    if (!client->adaptiverequestsize || transfer->type != GET || transferbuf.isRaid() || mReqSizeAdapted[i])
+    {
+        return;
+    }
+    mReqSizeAdapted[i] = true;
+
+    m_off_t size = mReqSizes[i];
+
+    if (failed)
+    {
+        size = std::max<m_off_t>(client->minrequestsize, size / 2);
+    }
+    else
+    {
+        // the request took the wait for its first data plus the time to stream it: at the rate
+        // it streamed, how much data would make that wait a tenth of the whole
+        dstime firstdata = mReqSpeeds[i].requestFirstDataDs();
+        dstime streaming = std::max<dstime>(1, mReqSpeeds[i].requestElapsedDs() - firstdata);
+        m_off_t rate = m_off_t(reqs[i]->size) * 10 / streaming;
+        m_off_t target = rate * firstdata * 9 / 10;
+
+        // only a request that was as large as allowed shows that a larger one would do better
+        if (target > size && m_off_t(reqs[i]->size) * 2 > size)
+        {
+            size = std::min<m_off_t>(client->maxrequestsize, size * 2);
+        }
+    }
+
+    size = std::max<m_off_t>(client->minrequestsize, std::min<m_off_t>(client->maxrequestsize, size));
+
+    if (size != mReqSizes[i])
+    {
+        LOG_debug << "Request size of connection " << i << (size > mReqSizes[i] ? " raised" : " lowered") << " to " << size;
+        (size > mReqSizes[i] ? client->performanceStats.requestSizeGrowths : client->performanceStats.requestSizeShrinks)++;
+        mReqSizes[i] = size;
+    }
+}
+
 // abort all HTTP connections
 void TransferSlot::disconnect()
 {
@@ -347,9 +546,9 @@ int64_t TransferSlot::macsmac(chunkmac_map* m)
     return m->macsmac(transfer->transfercipher());
 }
 
-int64_t TransferSlot::macsmac_gaps(chunkmac_map* m, size_t g1, size_t g2, size_t g3, size_t g4)
+int64_t TransferSlot::macsmac_gaps(chunkmac_map* m, const chunkmac_map::FoldStates& fs, size_t g1, size_t g2, size_t g3, size_t g4)
 {
-    return m->macsmac_gaps(transfer->transfercipher(), g1, g2, g3, g4);
+    return m->macsmac_gaps(transfer->transfercipher(), fs, g1, g2, g3, g4);
 }
 
 bool TransferSlot::checkMetaMacWithMissingLateEntries()
@@ -364,17 +563,21 @@ bool TransferSlot::checkMetaMacWithMissingLateEntries()
     size_t end = transfer->chunkmacs.size();
     size_t finalN = std::min<size_t>(32 * 3, end);
 
+    // all the gaps are in the last entries: the fold of those before them is done only once
+    chunkmac_map::FoldStates fs;
+    transfer->chunkmacs.macsmac_states(transfer->transfercipher(), end - std::min<size_t>(std::max<size_t>(32 * 3, 16 * 2 + 8), end), fs);
+
     // first check for the most likely - a single connection gap (or two but completely consecutive making a single gap)
     for (size_t countBack = 1; countBack <= finalN; ++countBack)
     {
         size_t start1 = end - countBack; 
         for (size_t len1 = 1; len1 <= 64 && start1 + len1 <= end; ++len1)
         {
-            if (transfer->metamac == macsmac_gaps(&transfer->chunkmacs, start1, start1 + len1, end, end))
+            if (transfer->metamac == macsmac_gaps(&transfer->chunkmacs, fs, start1, start1 + len1, end, end))
             {
                 LOG_warn << "Found mac gaps were at " << start1 << " " << len1 << " from " << end;
                 auto correctMac = macsmac(&transfer->chunkmacs);
-                transfer->currentmetamac = correctMac;
+                transfer->integrity().currentmetamac = correctMac;
                 transfer->metamac = correctMac;
                 // TODO: update the Node's key to be correct (needs some API additions before enabling)
                 return true;
@@ -384,7 +587,7 @@ bool TransferSlot::checkMetaMacWithMissingLateEntries()
 
     // now check for two separate pieces missing (much less likely)
     // limit to checking up to 16Mb pieces wtih up to 8Mb between to avoid excessive CPU
-    // takes about 1 second on a fairly modest laptop for a 100Mb file (in a release build)
+    // (each check folds only the entries from start1 on, whatever the size of the file)
     finalN = std::min<size_t>(16 * 2 + 8, transfer->chunkmacs.size());
     for (size_t start1 = end - finalN; start1 < end; ++start1)
     {
@@ -394,11 +597,11 @@ bool TransferSlot::checkMetaMacWithMissingLateEntries()
             {
                 for (size_t len2 = 1; len2 <= 16 && start2 + len2 <= end; ++len2)
                 {
-                    if (transfer->metamac == macsmac_gaps(&transfer->chunkmacs, start1, start1 + len1, start2, start2 + len2))
+                    if (transfer->metamac == macsmac_gaps(&transfer->chunkmacs, fs, start1, start1 + len1, start2, start2 + len2))
                     {
                         LOG_warn << "Found mac gaps were at " << start1 << " " << len1 << " " << start2 << " " << len2 << " from " << end;
                         auto correctMac = macsmac(&transfer->chunkmacs);
-                        transfer->currentmetamac = correctMac;
+                        transfer->integrity().currentmetamac = correctMac;
                         transfer->metamac = correctMac;
                         // TODO: update the Node's key to be correct (needs some API additions before enabling)
                         return true;
@@ -414,15 +617,16 @@ bool TransferSlot::checkDownloadTransferFinished(DBTableTransactionCommitter& co
 {
     if (transfer->progresscompleted == transfer->size)
     {
+        Transfer::Integrity& integrity = transfer->integrity();
         if (transfer->progresscompleted)
         {
-            transfer->currentmetamac = macsmac(&transfer->chunkmacs);
-            transfer->hascurrentmetamac = true;
+            integrity.currentmetamac = macsmac(&transfer->chunkmacs);
+            integrity.hascurrentmetamac = true;
         }
 
         // verify meta MAC
         if (!transfer->size
-            || (transfer->currentmetamac == transfer->metamac)
+            || (integrity.currentmetamac == transfer->metamac)
             || checkMetaMacWithMissingLateEntries())
         {
             client->transfercacheadd(transfer, &committer);
@@ -456,11 +660,13 @@ bool TransferSlot::testForSlowRaidConnection(unsigned connectionNum, bool& incre
         if ((Waiter::ds - reqs[connectionNum]->lastdata) > (XFERTIMEOUT / 2))
         {
             LOG_warn << "Raid connection " << connectionNum << " has not received data for " << (XFERTIMEOUT / 2) << " deciseconds";
+            trace().instant("raidstalled", transfer->tag, int(connectionNum) + 1);
             incrementErrors = true;
             return true;
         }
 
         if (!transferbuf.isUnusedRaidConection(connectionNum)           // connection in use
+                && !transferbuf.isHedging()                             // hedging leaves the slowest part out already
                 && mReqSpeeds[connectionNum].requestElapsedDs() > 50    // enough elapsed time to be considered
                 && mRaidChannelSwapsForSlowness < 2)                    // no more than 2 swaps due to slown connections
         {
@@ -495,6 +701,9 @@ bool TransferSlot::testForSlowRaidConnection(unsigned connectionNum, bool& incre
                          << " while they are managing " << averageOtherRate;
 
                 mRaidChannelSwapsForSlowness += 1;
+                trace().instant("raidswap", transfer->tag, int(connectionNum) + 1, { { "speed", thisRate },
+                                                                                     { "otherspeed", averageOtherRate },
+                                                                                     { "swaps", mRaidChannelSwapsForSlowness } });
                 incrementErrors = false;
                 return true;
             }
@@ -516,11 +725,12 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
             if (fa && transfer->type == GET)
             {
                 LOG_debug << "Verifying cached download";
-                transfer->currentmetamac = macsmac(&transfer->chunkmacs);
-                transfer->hascurrentmetamac = true;
+                Transfer::Integrity& integrity = transfer->integrity();
+                integrity.currentmetamac = macsmac(&transfer->chunkmacs);
+                integrity.hascurrentmetamac = true;
 
                 // verify meta MAC
-                if (transfer->currentmetamac == transfer->metamac)
+                if (integrity.currentmetamac == transfer->metamac)
                 {
                     return transfer->complete(committer);
                 }
@@ -556,6 +766,14 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
         return;
     }
 
+    if (!mTracedUrls)
+    {
+        // from the slot's creation, when the command for them is sent
+        trace().span("tempurls", transfer->tag, 0, mTraceStart, { { "connections", connections },
+                                                                  { "raid", transferbuf.isRaid() } });
+        mTracedUrls = true;
+    }
+
     dstime backoff = 0;
     m_off_t p = 0;
 
@@ -616,6 +834,12 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                             reqs[i]->status = REQ_READY;
                         }
                     }
+                    else if (transfer->type == GET && transferbuf.isRaidConnectionSuperseded(i))
+                    {
+                        LOG_debug << "Hedged raid connection " << i << " fell a chunk behind, restarting it from the other parts";
+                        reqs[i]->disconnect();
+                        reqs[i]->status = REQ_READY;
+                    }
 
                     if (EVER(reqs[i]->lastdata) && reqs[i]->lastdata > lastdata)
                     {
@@ -629,6 +853,7 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                 {
                     m_off_t delta = mReqSpeeds[i].requestProgressed(reqs[i]->size);
                     mTransferSpeed.calculateSpeed(delta);
+                    adaptrequestsize(i, false);
 
                     if (client->orderdownloadedchunks && transfer->type == GET && !transferbuf.isRaid() && transfer->progresscompleted != static_cast<HttpReqDL*>(reqs[i].get())->dlpos)
                     {
@@ -653,6 +878,13 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
 
                     if (transfer->type == PUT)
                     {
+                        tracechunk(unsigned(i));
+
+                        if (mStriped)
+                        {
+                            mStriped->requestdone(reqs[i]->size, reqs[i]->connectms);
+                        }
+
                         // completed put transfers are signalled through the
                         // return of the upload token
                         if (reqs[i]->in.size())
@@ -756,10 +988,12 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                                 }
                                 client->sendevent(99436, "Automatic change to HTTPS", 0);
 
+                                urlrejected = true;
                                 return transfer->failed(API_EAGAIN, committer);
                             }
 
                             // fail with returned error
+                            urlrejected = true;
                             return transfer->failed(e, committer);
                         }
 
@@ -788,6 +1022,7 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
 
                             if (!downloadRequest->buffer_released)
                             {
+                                tracechunk(unsigned(i));
                                 transferbuf.submitBuffer(i, new TransferBufferManager::FilePiece(downloadRequest->dlpos, downloadRequest->release_buf())); // resets size & bufpos.  finalize() is taken care of in the transferbuf
                                 downloadRequest->buffer_released = true;
                             }
@@ -805,12 +1040,21 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                                     auto transferkey = transfer->transferkey;
                                     auto ctriv = transfer->ctriv;
                                     auto filesize = transfer->size;
+                                    auto trace = client->metrics.transferTrace;
+                                    auto tag = transfer->tag;
+                                    auto queued = std::chrono::steady_clock::now();
                                     req->status = REQ_DECRYPTING;
 
-                                    client->mAsyncQueue.push([req, outputPiece, transferkey, ctriv, filesize](SymmCipher& sc)
+                                    client->mAsyncQueue.push([req, outputPiece, transferkey, ctriv, filesize, trace, tag, i, queued](SymmCipher& sc)
                                     {
+                                        trace->span("decryptwait", tag, i + 1, queued);
+                                        auto start = std::chrono::steady_clock::now();
+
                                         sc.setkey(transferkey.data());
                                         outputPiece->finalize(true, filesize, ctriv, &sc, nullptr);
+
+                                        trace->span("decrypt", tag, i + 1, start, { { "pos", outputPiece->pos },
+                                                                                    { "size", m_off_t(outputPiece->buf.datalen()) } });
                                         req->status = REQ_DECRYPTED;
                                     }, false);  // not discardable:  if we downloaded the data, don't waste it - decrypt and write as much as we can to file
                                 }
@@ -872,12 +1116,19 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                             p += outputPiece->buf.datalen();
 
                             LOG_debug << "Writing data asynchronously at " << outputPiece->pos << " to " << (outputPiece->pos + outputPiece->buf.datalen());
+                            mTraceSteps[i] = std::chrono::steady_clock::now();
                             asyncIO[i] = fa->asyncfwrite(outputPiece->buf.datastart(), static_cast<unsigned>(outputPiece->buf.datalen()), outputPiece->pos);
                             reqs[i]->status = REQ_ASYNCIO;
                         }
                         else
                         {
-                            if (fa->fwrite(outputPiece->buf.datastart(), static_cast<unsigned>(outputPiece->buf.datalen()), outputPiece->pos))
+                            mTraceSteps[i] = std::chrono::steady_clock::now();
+                            bool written = fa->fwrite(outputPiece->buf.datastart(), static_cast<unsigned>(outputPiece->buf.datalen()), outputPiece->pos);
+                            tracestep(unsigned(i), "write", { { "pos", outputPiece->pos },
+                                                              { "size", m_off_t(outputPiece->buf.datalen()) },
+                                                              { "ok", written } });
+
+                            if (written)
                             {
                                 LOG_verbose << "Sync write succeeded";
                                 transferbuf.bufferWriteCompleted(i, true);
@@ -913,35 +1164,15 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                     if (asyncIO[i]->finished)
                     {
                         LOG_verbose << "Processing finished async fs operation";
+                        tracestep(unsigned(i), transfer->type == PUT ? "read" : "write", { { "pos", asyncIO[i]->posOfBuffer },
+                                                                                           { "size", m_off_t(asyncIO[i]->dataBufferLen) },
+                                                                                           { "ok", !asyncIO[i]->failed } });
                         if (!asyncIO[i]->failed)
                         {
                             if (transfer->type == PUT)
                             {
                                 LOG_verbose << "Async read succeeded";
-                                m_off_t npos = asyncIO[i]->posOfBuffer + asyncIO[i]->dataBufferLen;
-                                string finaltempurl = transferbuf.tempURL(i);
-                                if (client->usealtupport && !memcmp(finaltempurl.c_str(), "http:", 5))
-                                {
-                                    size_t index = finaltempurl.find("/", 8);
-                                    if(index != string::npos && finaltempurl.find(":", 8) == string::npos)
-                                    {
-                                        finaltempurl.insert(index, ":8080");
-                                    }
-                                }
-
-                                auto pos = asyncIO[i]->posOfBuffer;
-                                auto req = reqs[i];    // shared_ptr so no object is deleted out from under the worker
-                                auto transferkey = transfer->transferkey;
-                                auto ctriv = transfer->ctriv;
-                                req->pos = pos;
-                                req->status = REQ_ENCRYPTING;
-
-                                client->mAsyncQueue.push([req, transferkey, ctriv, finaltempurl, pos, npos](SymmCipher& sc)
-                                    {
-                                        sc.setkey(transferkey.data());
-                                        req->prepare(finaltempurl.c_str(), &sc, ctriv, pos, npos);
-                                        req->status = REQ_PREPARED;
-                                    }, true);   // discardable - if the transfer or client are being destroyed, we won't be sending that data.
+                                encryptupload(i, asyncIO[i]->posOfBuffer, asyncIO[i]->posOfBuffer + asyncIO[i]->dataBufferLen);
                             }
                             else
                             {
@@ -1005,6 +1236,21 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
 
                 case REQ_FAILURE:
                     LOG_warn << "Failed chunk. HTTP status: " << reqs[i]->httpstatus << " on channel " << i;
+                    tracestep(unsigned(i), "chunkfailed", { { "pos", reqs[i]->pos },
+                                                            { "httpstatus", reqs[i]->httpstatus },
+                                                            { "connectms", reqs[i]->connectms },
+                                                            { "ttfbms", reqs[i]->ttfbms } });
+                    if (reqs[i]->httpstatus != 509)
+                    {
+                        client->transferpolicy->requestfailed(transfer->type);
+                        adaptrequestsize(i, true);
+
+                        if (mStriped)
+                        {
+                            mStriped->requestfailed();
+                        }
+                    }
+
                     if (reqs[i]->httpstatus && reqs[i]->contenttype.find("text/html") != string::npos
                             && !memcmp(reqs[i]->posturl.c_str(), "http:", 5))
                     {
@@ -1014,6 +1260,7 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
 
                         client->sendevent(99436, "Automatic change to HTTPS", 0);
 
+                        urlrejected = true;
                         return transfer->failed(API_EAGAIN, committer);
                     }
 
@@ -1056,6 +1303,7 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                         // for raid parts and 503, it's appropriate to try another raid source
                         if (!tryRaidRecoveryFromHttpGetError(i, true))
                         {
+                            urlrejected = true;
                             return transfer->failed(API_EAGAIN, committer);
                         }
                     }
@@ -1103,11 +1351,12 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
 
         if (!failure)
         {
-            if (!reqs[i] || (reqs[i]->status == REQ_READY))
+            if ((!reqs[i] || (reqs[i]->status == REQ_READY))
+                    && (!mStriped || unsigned(i) < mStriped->active() || asyncIO[i]))
             {
                 bool newInputBufferSupplied = false;
                 bool pauseConnectionInputForRaid = false;
-                std::pair<m_off_t, m_off_t> posrange = transferbuf.nextNPosForConnection(i, maxRequestSize, connections, newInputBufferSupplied, pauseConnectionInputForRaid, client->httpio->uploadSpeed);
+                std::pair<m_off_t, m_off_t> posrange = transferbuf.nextNPosForConnection(i, client->adaptiverequestsize ? mReqSizes[i] : maxRequestSize, connections, newInputBufferSupplied, pauseConnectionInputForRaid, client->httpio->uploadSpeed);
 
                 // we might have a raid-reassembled block to write, or a previously loaded block, or a skip block to process.
                 bool newOutputBufferSupplied = false;
@@ -1156,13 +1405,18 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                                 asyncIO[i] = NULL;
                             }
 
+                            mTraceSteps[i] = std::chrono::steady_clock::now();
                             asyncIO[i] = fa->asyncfread(reqs[i]->out, size, (-(int)size) & (SymmCipher::BLOCKSIZE - 1), pos);
                             reqs[i]->status = REQ_ASYNCIO;
                             prepare = false;
                         }
                         else
                         {
-                            if (!fa->fread(reqs[i]->out, size, (-(int)size) & (SymmCipher::BLOCKSIZE - 1), transfer->pos))
+                            mTraceSteps[i] = std::chrono::steady_clock::now();
+                            bool read = fa->fread(reqs[i]->out, size, (-(int)size) & (SymmCipher::BLOCKSIZE - 1), transfer->pos);
+                            tracestep(unsigned(i), "read", { { "pos", pos }, { "size", m_off_t(size) }, { "ok", read } });
+
+                            if (!read)
                             {
                                 LOG_warn << "Error preparing transfer: " << fa->retry;
                                 if (!fa->retry)
@@ -1173,8 +1427,12 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
                                 // retry the read shortly
                                 backoff = 2;
                                 posrange.second = transfer->pos;
-                                prepare = false;
                             }
+                            else
+                            {
+                                encryptupload(i, posrange.first, posrange.second);
+                            }
+                            prepare = false;
                         }
                     }
 
@@ -1230,13 +1488,25 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
 
             if (reqs[i] && (reqs[i]->status == REQ_PREPARED) && !backoff)
             {
+                mTraceSteps[i] = std::chrono::steady_clock::now();
                 mReqSpeeds[i].requestStarted();
+                mReqSizeAdapted[i] = false;
                 reqs[i]->minspeed = true;
+                reqs[i]->ratelimits = { &client->classratelimits[transfer->transferclass][transfer->type] };
+                if (transfer->ratelimit)
+                {
+                    reqs[i]->ratelimits.push_back(transfer->ratelimit.get());
+                }
                 reqs[i]->post(client);
             }
         }
     }
 
+    if (mStriped)
+    {
+        mStriped->sample(Waiter::ds, mTransferSpeed.calculateSpeed());
+    }
+
     if (transfer->type == GET && transferbuf.isRaid())
     {
         // for Raid, additionally we need the raid data that's waiting to be recombined
@@ -1272,6 +1542,7 @@ void TransferSlot::doio(MegaClient* client, DBTableTransactionCommitter& committ
     if (Waiter::ds - lastdata >= XFERTIMEOUT && !failure)
     {
         LOG_warn << "Failed chunk(s) due to a timeout: no data moved for " << (XFERTIMEOUT/10) << " seconds" ;
+        trace().instant("timeout", transfer->tag, 0);
         failure = true;
         bool changeport = false;
 
@@ -83,17 +83,27 @@ void TreeProcDel::proc(MegaClient* client, Node* n)
     }
 }
 
-void TreeProcApplyKey::proc(MegaClient *client, Node *n)
+void TreeProcApplyKey::proc(MegaClient*, Node *n)
 {
     if (n->attrstring)
     {
-        n->applykey();
+        pending.push_back(n);
+    }
+}
+
+void TreeProcApplyKey::apply(MegaClient* client)
+{
+    client->applykeys(pending);
+
+    for (Node* n : pending)
+    {
         if (!n->attrstring)
         {
             n->changed.attrs = true;
             client->notifynode(n);
         }
     }
+    pending.clear();
 }
 
 #ifdef ENABLE_SYNC
@@ -697,6 +697,7 @@ UserAlerts::UserAlerts(MegaClient& cmc)
     , provisionalmode(false)
     , notingSharedNodes(false)
     , ignoreNodesUnderShare(UNDEF)
+    , maxAlerts(DEFAULT_MAXALERTS)
 {
 }
 
@@ -823,56 +824,38 @@ void UserAlerts::add(UserAlert::Base* unb)
         return;
     }
 
-    if (!alerts.empty() && unb->type == UserAlert::type_put && alerts.back()->type == UserAlert::type_put)
+    // look for the alert of the same kind that it may be combined with, without searching the list
+    MergeKey key;
+    bool keyed = mergeKey(unb, key);
+    auto merge = keyed ? mergeable.find(key) : mergeable.end();
+    if (merge != mergeable.end() && unb->timestamp - merge->second->timestamp < 300)
     {
-        // If it's file/folders added, and the prior one is for the same user and within 5 mins then we can combine instead
-        UserAlert::NewSharedNodes* np = dynamic_cast<UserAlert::NewSharedNodes*>(unb);
-        UserAlert::NewSharedNodes* op = dynamic_cast<UserAlert::NewSharedNodes*>(alerts.back());
-        if (np && op)
+        // If it's file/folders added or removed, and the prior one is for the same user (and folder) and within 5 mins then we can combine instead
+        UserAlert::Base* prior = merge->second;
+        if (unb->type == UserAlert::type_put)
         {
-            if (np->userHandle == op->userHandle && np->timestamp - op->timestamp < 300 &&
-                np->parentHandle == op->parentHandle && !ISUNDEF(np->parentHandle))
-            {
-                op->fileCount += np->fileCount;
-                op->folderCount += np->folderCount;
-                LOG_debug << "Merged user alert, type " << np->type << " ts " << np->timestamp;
-
-                if (catchupdone && (useralertnotify.empty() || useralertnotify.back() != alerts.back()))
-                {
-                    alerts.back()->seen = false;
-                    alerts.back()->tag = 0;
-                    useralertnotify.push_back(alerts.back());
-                    LOG_debug << "Updated user alert added to notify queue";
-                }
-                delete unb;
-                return;
-            }
+            UserAlert::NewSharedNodes* np = static_cast<UserAlert::NewSharedNodes*>(unb);
+            UserAlert::NewSharedNodes* op = static_cast<UserAlert::NewSharedNodes*>(prior);
+            op->fileCount += np->fileCount;
+            op->folderCount += np->folderCount;
         }
-    }
-
-    if (!alerts.empty() && unb->type == UserAlert::type_d && alerts.back()->type == UserAlert::type_d)
-    {
-        // If it's file/folders removed, and the prior one is for the same user and within 5 mins then we can combine instead
-        UserAlert::RemovedSharedNode* nd = dynamic_cast<UserAlert::RemovedSharedNode*>(unb);
-        UserAlert::RemovedSharedNode* od = dynamic_cast<UserAlert::RemovedSharedNode*>(alerts.back());
-        if (nd && od)
+        else
         {
-            if (nd->userHandle == od->userHandle && nd->timestamp - od->timestamp < 300)
-            {
-                od->itemsNumber += nd->itemsNumber;
-                LOG_debug << "Merged user alert, type " << nd->type << " ts " << nd->timestamp;
+            UserAlert::RemovedSharedNode* nd = static_cast<UserAlert::RemovedSharedNode*>(unb);
+            UserAlert::RemovedSharedNode* od = static_cast<UserAlert::RemovedSharedNode*>(prior);
+            od->itemsNumber += nd->itemsNumber;
+        }
+        LOG_debug << "Merged user alert, type " << unb->type << " ts " << unb->timestamp;
 
-                if (catchupdone && (useralertnotify.empty() || useralertnotify.back() != alerts.back()))
-                {
-                    alerts.back()->seen = false;
-                    alerts.back()->tag = 0;
-                    useralertnotify.push_back(alerts.back());
-                    LOG_debug << "Updated user alert added to notify queue";
-                }
-                delete unb;
-                return;
-            }
+        if (catchupdone && (useralertnotify.empty() || useralertnotify.back() != prior))
+        {
+            prior->seen = false;
+            prior->tag = 0;
+            useralertnotify.push_back(prior);
+            LOG_debug << "Updated user alert added to notify queue";
         }
+        delete unb;
+        return;
     }
 
     if (!alerts.empty() && unb->type == UserAlert::type_psts && static_cast<UserAlert::Payment*>(unb)->success)
@@ -893,6 +876,10 @@ void UserAlerts::add(UserAlert::Base* unb)
 
     unb->updateEmail(&mc);
     alerts.push_back(unb);
+    if (keyed)
+    {
+        mergeable[key] = unb;
+    }
     LOG_debug << "Added user alert, type " << alerts.back()->type << " ts " << alerts.back()->timestamp;
 
     if (catchupdone)
@@ -1183,6 +1170,7 @@ void UserAlerts::clear()
         delete *i;
     }
     alerts.clear();
+    mergeable.clear();
     useralertnotify.clear();
     begincatchup = false;
     catchupdone = false;
@@ -1193,6 +1181,73 @@ void UserAlerts::clear()
     nextid = 0;
 }
 
+bool UserAlerts::mergeKey(const UserAlert::Base* b, MergeKey& key)
+{
+    if (b->type == UserAlert::type_put)
+    {
+        auto np = dynamic_cast<const UserAlert::NewSharedNodes*>(b);
+        if (np && !ISUNDEF(np->parentHandle))
+        {
+            key = MergeKey(b->type, b->userHandle, np->parentHandle);
+            return true;
+        }
+    }
+    else if (b->type == UserAlert::type_d)
+    {
+        if (dynamic_cast<const UserAlert::RemovedSharedNode*>(b))
+        {
+            key = MergeKey(b->type, b->userHandle, UNDEF);
+            return true;
+        }
+    }
+    return false;
+}
+
+void UserAlerts::setMaxAlerts(size_t max)
+{
+    maxAlerts = max;
+    trim();
+}
+
+void UserAlerts::trim()
+{
+    // the app may not have been told about the ones pending notification yet
+    if (!maxAlerts || alerts.size() <= maxAlerts || !useralertnotify.empty())
+    {
+        return;
+    }
+
+    size_t excess = alerts.size() - maxAlerts;
+    for (size_t i = 0; i < excess; ++i)
+    {
+        UserAlert::Base* b = alerts.front();
+        alerts.pop_front();
+
+        MergeKey key;
+        if (mergeKey(b, key))
+        {
+            auto it = mergeable.find(key);
+            if (it != mergeable.end() && it->second == b)
+            {
+                mergeable.erase(it);
+            }
+        }
+        delete b;
+    }
+    LOG_debug << "Dropped " << excess << " old user alerts";
+}
+
+void UserAlerts::alertsAfter(unsigned int id, vector<UserAlert::Base*>& v) const
+{
+    for (Alerts::const_iterator i = alerts.begin(); i != alerts.end(); ++i)
+    {
+        if ((*i)->id > id)
+        {
+            v.push_back(*i);
+        }
+    }
+}
+
 UserAlerts::~UserAlerts()
 {
     clear();
@@ -180,6 +180,27 @@ void CacheableWriter::serializedouble(double field)
     dest.append((char*)&field, sizeof(field));
 }
 
+void CacheableWriter::serializevarint(uint64_t field)
+{
+    while (field >= 0x80)
+    {
+        dest.push_back(char(field | 0x80));
+        field >>= 7;
+    }
+    dest.push_back(char(field));
+}
+
+void CacheableWriter::serializesignedvarint(int64_t field)
+{
+    serializevarint((uint64_t(field) << 1) ^ uint64_t(field >> 63));
+}
+
+void CacheableWriter::serializevarstring(const string& field)
+{
+    serializevarint(field.size());
+    dest.append(field);
+}
+
 void CacheableWriter::serializeexpansionflags(bool b0, bool b1, bool b2, bool b3, bool b4, bool b5, bool b6, bool b7)
 {
     unsigned char b[8];
@@ -271,15 +292,59 @@ bool CacheableReader::unserializebinary(byte* data, size_t len)
 }
 
 
+// the entries are serialized as they are kept: the position, then the ChunkMAC
+static_assert(sizeof(chunkmac_map::value_type) == sizeof(m_off_t) + sizeof(ChunkMAC), "chunkmac_map entries are not packed as serialized");
+
+static bool chunkmacposless(const chunkmac_map::value_type& a, const chunkmac_map::value_type& b)
+{
+    return a.first < b.first;
+}
+
+ChunkMAC& chunkmac_map::operator[](m_off_t pos)
+{
+    // the usual case: after the last one
+    if (mMacs.empty() || mMacs.back().first < pos)
+    {
+        mMacs.emplace_back(pos, ChunkMAC());
+        return mMacs.back().second;
+    }
+
+    auto it = std::lower_bound(mMacs.begin(), mMacs.end(), value_type(pos, ChunkMAC()), chunkmacposless);
+    if (it == mMacs.end() || it->first != pos)
+    {
+        it = mMacs.emplace(it, pos, ChunkMAC());
+    }
+    return it->second;
+}
+
+chunkmac_map::iterator chunkmac_map::find(m_off_t pos)
+{
+    auto it = std::lower_bound(mMacs.begin(), mMacs.end(), value_type(pos, ChunkMAC()), chunkmacposless);
+    return it != mMacs.end() && it->first == pos ? it : mMacs.end();
+}
+
+chunkmac_map::const_iterator chunkmac_map::find(m_off_t pos) const
+{
+    auto it = std::lower_bound(mMacs.begin(), mMacs.end(), value_type(pos, ChunkMAC()), chunkmacposless);
+    return it != mMacs.end() && it->first == pos ? it : mMacs.end();
+}
+
+bool chunkmac_map::operator==(const chunkmac_map& other) const
+{
+    return size() == other.size() && std::equal(begin(), end(), other.begin(), [](const value_type& a, const value_type& b)
+    {
+        return a.first == b.first
+            && !memcmp(a.second.mac, b.second.mac, sizeof a.second.mac)
+            && a.second.offset == b.second.offset
+            && a.second.finished == b.second.finished;
+    });
+}
+
 void chunkmac_map::serialize(string& d) const
 {
     unsigned short ll = (unsigned short)size();
     d.append((char*)&ll, sizeof(ll));
-    for (const_iterator it = begin(); it != end(); it++)
-    {
-        d.append((char*)&it->first, sizeof(it->first));
-        d.append((char*)&it->second, sizeof(it->second));
-    }
+    d.append((const char*)mMacs.data(), ll * sizeof(value_type));
 }
 
 bool chunkmac_map::unserialize(const char*& ptr, const char* end)
@@ -292,6 +357,21 @@ bool chunkmac_map::unserialize(const char*& ptr, const char* end)
 
     ptr += sizeof(ll);
 
+    if (mMacs.empty())
+    {
+        mMacs.resize(ll);
+        memcpy((void*)mMacs.data(), ptr, ll * sizeof(value_type));
+        ptr += ll * sizeof(value_type);
+
+        // they were written in order, but anything else would break the lookups
+        if (!std::is_sorted(mMacs.begin(), mMacs.end(), chunkmacposless))
+        {
+            std::stable_sort(mMacs.begin(), mMacs.end(), chunkmacposless);
+            mMacs.erase(std::unique(mMacs.begin(), mMacs.end(), [](const value_type& a, const value_type& b) { return a.first == b.first; }), mMacs.end());
+        }
+        return true;
+    }
+
     for (int i = 0; i < ll; i++)
     {
         m_off_t pos = MemAccess::get<m_off_t>(ptr);
@@ -373,6 +453,17 @@ void chunkmac_map::finishedUploadChunks(chunkmac_map& macs)
     }
 }
 
+// the file mac of the fold of the chunk macs
+static int64_t foldedmacsmac(byte* mac)
+{
+    uint32_t* m = (uint32_t*)mac;
+
+    m[0] ^= m[1];
+    m[1] = m[2] ^ m[3];
+
+    return MemAccess::get<int64_t>((const char*)mac);
+}
+
 // coalesce block macs into file mac
 int64_t chunkmac_map::macsmac(SymmCipher *cipher)
 {
@@ -386,35 +477,54 @@ int64_t chunkmac_map::macsmac(SymmCipher *cipher)
         cipher->ecb_encrypt(mac);
     }
 
-    uint32_t* m = (uint32_t*)mac;
+    // LOG_debug << "macsmac final: " << Base64Str<sizeof int64_t>(mac);
+    return foldedmacsmac(mac);
+}
 
-    m[0] ^= m[1];
-    m[1] = m[2] ^ m[3];
+void chunkmac_map::macsmac_states(SymmCipher *cipher, size_t from, FoldStates& fs) const
+{
+    fs.from = std::min(from, size());
+    fs.states.clear();
+    fs.states.reserve(size() - fs.from + 1);
 
-    // LOG_debug << "macsmac final: " << Base64Str<sizeof int64_t>(mac);
-    return MemAccess::get<int64_t>((const char*)mac);
+    std::array<byte, SymmCipher::BLOCKSIZE> mac = {};
+
+    size_t n = 0;
+    for (const_iterator it = begin(); ; it++, n++)
+    {
+        if (n >= fs.from)
+        {
+            fs.states.push_back(mac);
+        }
+
+        if (it == end())
+        {
+            break;
+        }
+
+        SymmCipher::xorblock(it->second.mac, mac.data());
+        cipher->ecb_encrypt(mac.data());
+    }
 }
 
-int64_t chunkmac_map::macsmac_gaps(SymmCipher *cipher, size_t g1, size_t g2, size_t g3, size_t g4)
+int64_t chunkmac_map::macsmac_gaps(SymmCipher *cipher, const FoldStates& fs, size_t g1, size_t g2, size_t g3, size_t g4) const
 {
-    byte mac[SymmCipher::BLOCKSIZE] = { 0 };
+    assert(g1 >= fs.from && g1 - fs.from < fs.states.size());
+
+    // the entries before the first gap are folded already
+    std::array<byte, SymmCipher::BLOCKSIZE> mac = fs.states[g1 - fs.from];
+    const_iterator it = begin() + g1;
 
-    int n = 0;
-    for (chunkmac_map::iterator it = begin(); it != end(); it++, n++)
+    for (size_t n = g1; it != end(); it++, n++)
     {
         if ((n >= g1 && n < g2) || (n >= g3 && n < g4)) continue;
 
         assert(it->first == ChunkedHash::chunkfloor(it->first));
-        SymmCipher::xorblock(it->second.mac, mac);
-        cipher->ecb_encrypt(mac);
+        SymmCipher::xorblock(it->second.mac, mac.data());
+        cipher->ecb_encrypt(mac.data());
     }
 
-    uint32_t* m = (uint32_t*)mac;
-
-    m[0] ^= m[1];
-    m[1] = m[2] ^ m[3];
-
-    return MemAccess::get<int64_t>((const char*)mac);
+    return foldedmacsmac(mac.data());
 }
 
 bool CacheableReader::unserializechunkmacs(chunkmac_map& m)
@@ -527,6 +637,53 @@ bool CacheableReader::unserializebyte(byte& field)
     return true;
 }
 
+bool CacheableReader::unserializevarint(uint64_t& field)
+{
+    uint64_t value = 0;
+    const char* p = ptr;
+
+    for (unsigned shift = 0; p < end && shift < 64; shift += 7)
+    {
+        byte b = static_cast<byte>(*p++);
+        value |= uint64_t(b & 0x7f) << shift;
+
+        if (!(b & 0x80))
+        {
+            field = value;
+            ptr = p;
+            fieldnum += 1;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool CacheableReader::unserializesignedvarint(int64_t& field)
+{
+    uint64_t value;
+    if (!unserializevarint(value))
+    {
+        return false;
+    }
+    field = int64_t(value >> 1) ^ -int64_t(value & 1);
+    return true;
+}
+
+bool CacheableReader::unserializevarstring(string& s)
+{
+    const char* start = ptr;
+    uint64_t len;
+    if (!unserializevarint(len) || len > uint64_t(end - ptr))
+    {
+        ptr = start;
+        return false;
+    }
+    s.assign(ptr, size_t(len));
+    ptr += len;
+    return true;
+}
+
 bool CacheableReader::unserializedouble(double& field)
 {
     if (ptr + sizeof(double) > end)
@@ -1719,6 +1876,31 @@ std::string Utils::hexToString(const std::string &input)
     return output;
 }
 
+bool Utils::isAscii(const char* data, size_t size)
+{
+    size_t i = 0;
+
+    for ( ; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        if (word & 0x8080808080808080ull)
+        {
+            return false;
+        }
+    }
+
+    for ( ; i < size; ++i)
+    {
+        if (static_cast<unsigned char>(data[i]) & 0x80)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 int Utils::icasecmp(const std::string& lhs,
                     const std::string& rhs,
                     const size_t length)
@@ -2361,27 +2543,152 @@ std::pair<bool, int64_t> generateMetaMac(SymmCipher &cipher, InputStreamAccess &
 
 void MegaClientAsyncQueue::push(std::function<void(SymmCipher&)> f, bool discardable)
 {
-    if (mThreads.empty())
+    if (f)
+    {
+        mPool->start();
+    }
+
+    if (!mPool->size())
     {
         if (f)
         {
             f(mZeroThreadsCipher);
         }
     }
-    else
+    else if (f)
+    {
+        {
+            std::lock_guard<std::mutex> g(mPool->mMutex);
+            mPool->mQueue.push_back(MegaWorkerPool::Entry{this, discardable, std::move(f)});
+            mPending++;
+            if (mPool->mExecutor)
+            {
+                mPool->mSubmitted++;
+            }
+        }
+
+        if (mPool->mExecutor)
+        {
+            MegaWorkerPool* pool = mPool.get();
+            mPool->mExecutor([pool]() { pool->runNext(); });
+        }
+        else
+        {
+            mPool->mConditionVariable.notify_one();
+        }
+    }
+}
+
+void MegaClientAsyncQueue::parallelFor(size_t count, const std::function<void(size_t, SymmCipher&)>& f)
+{
+    parallelFor(count, f, nullptr);
+}
+
+void MegaClientAsyncQueue::parallelFor(size_t count, const std::function<void(size_t, SymmCipher&)>& f, const std::function<void()>& meanwhile)
+{
+    struct State
+    {
+        std::atomic<size_t> next{0};
+        size_t done = 0;
+        std::mutex m;
+        std::condition_variable cv;
+    };
+
+    // workers that only start once everything is done must not touch f or anything of the caller's
+    auto state = std::make_shared<State>();
+    auto work = [state, count, &f](SymmCipher& cipher)
     {
+        for (size_t i; (i = state->next++) < count; )
         {
-            std::lock_guard<std::mutex> g(mMutex);
-            mQueue.emplace_back(discardable, std::move(f));
+            f(i, cipher);
+
+            std::lock_guard<std::mutex> g(state->m);
+            if (++state->done == count)
+            {
+                state->cv.notify_all();
+            }
         }
-        mConditionVariable.notify_one();
+    };
+
+    for (size_t i = std::min(mPool->size(), count ? count - 1 : 0); i--; )
+    {
+        push([state, count, work](SymmCipher& cipher)
+        {
+            if (state->next < count)
+            {
+                work(cipher);
+            }
+        }, false);
     }
+
+    if (meanwhile)
+    {
+        meanwhile();
+    }
+
+    work(mZeroThreadsCipher);
+
+    std::unique_lock<std::mutex> g(state->m);
+    state->cv.wait(g, [&state, count]() { return state->done == count; });
 }
 
-MegaClientAsyncQueue::MegaClientAsyncQueue(Waiter& w, unsigned threadCount)
+MegaClientAsyncQueue::MegaClientAsyncQueue(Waiter& w, unsigned threadCount, std::shared_ptr<MegaWorkerPool> pool)
     : mWaiter(w)
+    , mPool(pool ? std::move(pool) : std::make_shared<MegaWorkerPool>(threadCount))
+{
+}
+
+MegaClientAsyncQueue::~MegaClientAsyncQueue()
+{
+    clearDiscardable();
+
+    // the jobs left use the client, and run before it goes (those of other queues may run meanwhile)
+    std::unique_lock<std::mutex> g(mPool->mMutex);
+    mPool->mJobDone.wait(g, [this]() { return !mPending; });
+}
+
+void MegaClientAsyncQueue::clearDiscardable()
+{
+    std::lock_guard<std::mutex> g(mPool->mMutex);
+    auto& queue = mPool->mQueue;
+    auto newEnd = std::remove_if(queue.begin(), queue.end(), [this](MegaWorkerPool::Entry& entry){ return entry.queue == this && entry.discardable; });
+    mPending -= size_t(queue.end() - newEnd);
+    queue.erase(newEnd, queue.end());
+}
+
+size_t MegaClientAsyncQueue::pending()
 {
-    for (int i = threadCount; i--; )
+    std::lock_guard<std::mutex> g(mPool->mMutex);
+    return mPending;
+}
+
+MegaWorkerPool::MegaWorkerPool(unsigned threadCount, ThreadConfig::Executor executor)
+    : mThreadCount(threadCount)
+    , mExecutor(std::move(executor))
+{
+}
+
+void MegaWorkerPool::start()
+{
+    if (mStarted)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> g(mMutex);
+    if (mStarted)
+    {
+        return;
+    }
+
+    if (mExecutor)
+    {
+        mStarted = true;
+        LOG_debug << "MegaClient Worker jobs run by the app's executor, up to " << mThreadCount << " at once";
+        return;
+    }
+
+    for (size_t i = mThreadCount; i--; )
     {
         try
         {
@@ -2396,44 +2703,182 @@ MegaClientAsyncQueue::MegaClientAsyncQueue(Waiter& w, unsigned threadCount)
             break;
         }
     }
+    mThreadCount = mThreads.size();
+    mStarted = true;
     LOG_debug << "MegaClient Worker threads running: " << mThreads.size();
 }
 
-MegaClientAsyncQueue::~MegaClientAsyncQueue()
+MegaWorkerPool::~MegaWorkerPool()
 {
-    clearDiscardable();
-    push(nullptr, false);
+    {
+        std::unique_lock<std::mutex> g(mMutex);
+        assert(mQueue.empty());
+        mExit = true;
+
+        // the executor may still have calls to make for jobs discarded meanwhile
+        mJobDone.wait(g, [this]() { return !mSubmitted; });
+    }
     mConditionVariable.notify_all();
-    LOG_warn << "~MegaClientAsyncQueue() joining threads";
+    if (mThreads.empty())
+    {
+        return;
+    }
+    LOG_warn << "~MegaWorkerPool() joining threads";
     for (auto& t : mThreads)
     {
         t.join();
     }
-    LOG_warn << "~MegaClientAsyncQueue() ends";
+    LOG_warn << "~MegaWorkerPool() ends";
 }
 
-void MegaClientAsyncQueue::clearDiscardable()
+void MegaWorkerPool::asyncThreadLoop()
 {
-    std::lock_guard<std::mutex> g(mMutex);
-    auto newEnd = std::remove_if(mQueue.begin(), mQueue.end(), [](Entry& entry){ return entry.discardable; });
-    mQueue.erase(newEnd, mQueue.end());
-}
+    ThreadConfig::apply(THREAD_ROLE_WORKER);
 
-void MegaClientAsyncQueue::asyncThreadLoop()
-{
     SymmCipher cipher;
     for (;;)
     {
-        std::function<void(SymmCipher&)> f;
+        Entry entry;
         {
             std::unique_lock<std::mutex> g(mMutex);
-            mConditionVariable.wait(g, [this]() { return !mQueue.empty(); });
-            f = std::move(mQueue.front().f);
-            if (!f) return;   // nullptr is not popped, and causes all the threads to exit
+            mConditionVariable.wait(g, [this]() { return !mQueue.empty() || mExit; });
+            if (mQueue.empty()) return;
+            entry = std::move(mQueue.front());
             mQueue.pop_front();
         }
-        f(cipher);
-        mWaiter.notify();
+
+        run(entry, cipher);
+    }
+}
+
+void MegaWorkerPool::runNext()
+{
+    // for as long as the app's thread lasts, rather than one for each job
+    thread_local SymmCipher cipher;
+
+    Entry entry;
+    {
+        std::lock_guard<std::mutex> g(mMutex);
+        if (!mQueue.empty())
+        {
+            entry = std::move(mQueue.front());
+            mQueue.pop_front();
+        }
+    }
+
+    if (entry.f)
+    {
+        run(entry, cipher);
+    }
+
+    // notified under the lock, as the pool may go as soon as this is the last call
+    std::lock_guard<std::mutex> g(mMutex);
+    mSubmitted--;
+    mJobDone.notify_all();
+}
+
+void MegaWorkerPool::run(Entry& entry, SymmCipher& cipher)
+{
+    entry.f(cipher);
+    entry.queue->mWaiter.notify();
+
+    {
+        std::lock_guard<std::mutex> g(mMutex);
+        entry.queue->mPending--;
+    }
+    mJobDone.notify_all();
+}
+
+void RecursiveSharedMutex::lock()
+{
+    lockExclusive<std::chrono::milliseconds>(nullptr);
+}
+
+bool RecursiveSharedMutex::try_lock()
+{
+    std::lock_guard<std::mutex> g(mMutex);
+    auto me = std::this_thread::get_id();
+    if (mOwnerCount && mOwner == me)
+    {
+        ++mOwnerCount;
+        return true;
+    }
+
+    if (mOwnerCount || !mReaders.empty())
+    {
+        return false;
+    }
+
+    mOwner = me;
+    mOwnerCount = 1;
+    return true;
+}
+
+void RecursiveSharedMutex::unlock()
+{
+    std::lock_guard<std::mutex> g(mMutex);
+    assert(mOwnerCount && mOwner == std::this_thread::get_id());
+    if (!--mOwnerCount)
+    {
+        mOwner = std::thread::id();
+        mCondition.notify_all();
+    }
+}
+
+void RecursiveSharedMutex::lock_shared()
+{
+    std::unique_lock<std::mutex> g(mMutex);
+    auto me = std::this_thread::get_id();
+    if (mOwnerCount && mOwner == me)
+    {
+        // the owner reads under its exclusive lock
+        ++mOwnerCount;
+        return;
+    }
+
+    auto it = mReaders.find(me);
+    if (it != mReaders.end())
+    {
+        // recursive shared locks are let in even if a writer is waiting, otherwise we would deadlock
+        ++it->second;
+        return;
+    }
+
+    if (mExclusive)
+    {
+        // released by unlock_shared() as the owner
+        g.unlock();
+        lock();
+        return;
+    }
+
+    mCondition.wait(g, [this]() { return !mOwnerCount && !mWritersWaiting; });
+    mReaders[me] = 1;
+}
+
+void RecursiveSharedMutex::unlock_shared()
+{
+    std::lock_guard<std::mutex> g(mMutex);
+    auto me = std::this_thread::get_id();
+    if (mOwnerCount && mOwner == me)
+    {
+        if (!--mOwnerCount)
+        {
+            mOwner = std::thread::id();
+            mCondition.notify_all();
+        }
+        return;
+    }
+
+    auto it = mReaders.find(me);
+    assert(it != mReaders.end());
+    if (it != mReaders.end() && !--it->second)
+    {
+        mReaders.erase(it);
+        if (mReaders.empty())
+        {
+            mCondition.notify_all();
+        }
     }
 }
 
@@ -27,6 +27,7 @@
 #if defined(_WIN32) || defined(WINDOWS_PHONE)
 #include <winsock2.h>
 #include <Windows.h>
+#include <winioctl.h>
 #endif
 
 namespace mega {
@@ -199,6 +200,31 @@ bool WinFileAccess::ftruncate()
     return false;
 }
 
+void WinFileAccess::setreadonce()
+{
+    // the cache manager reads further ahead, and reuses the pages read sooner
+    mReadOnce = true;
+}
+
+bool WinFileAccess::fpreallocate(m_off_t size)
+{
+    retry = false;
+
+    // reserves the clusters without moving the end of file, or exposing what they held before
+    // (SetFileValidData would, and needs SE_MANAGE_VOLUME_NAME)
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = size;
+
+    if (SetFileInformationByHandle(hFile, FileAllocationInfo, &info, sizeof(info)))
+    {
+        return true;
+    }
+
+    auto error = GetLastError();
+    LOG_debug << "Unable to preallocate " << size << " bytes: " << error;
+    return false;
+}
+
 m_time_t FileTime_to_POSIX(FILETIME* ft)
 {
     LARGE_INTEGER date;
@@ -234,7 +260,7 @@ bool WinFileAccess::sysstat(m_time_t* mtime, m_off_t* size)
     }
 
     errorcode = 0;
-    if (SimpleLogger::logCurrentLevel >= logDebug && skipattributes(fad.dwFileAttributes))
+    if (MEGA_LOG_ENABLED(logDebug) && skipattributes(fad.dwFileAttributes))
     {
         LOG_debug << "Incompatible attributes (" << fad.dwFileAttributes << ") for file " << nonblocking_localname.toPath(gWfsa);
     }
@@ -271,7 +297,8 @@ bool WinFileAccess::sysopen(bool async)
 #else
     hFile = CreateFileW(nonblocking_localname.localpath.c_str(), GENERIC_READ,
                         FILE_SHARE_WRITE | FILE_SHARE_READ,
-                        NULL, OPEN_EXISTING, async ? FILE_FLAG_OVERLAPPED : 0, NULL);
+                        NULL, OPEN_EXISTING,
+                        (async ? FILE_FLAG_OVERLAPPED : 0) | (mReadOnce ? FILE_FLAG_SEQUENTIAL_SCAN : 0), NULL);
 #endif
 
     if (hFile == INVALID_HANDLE_VALUE)
@@ -594,7 +621,7 @@ bool WinFileAccess::fopen_impl(LocalPath& namePath, bool read, bool write, bool
         // also, ignore some other obscure filesystem object categories
         if (!ignoreAttributes && skipattributes(fad.dwFileAttributes))
         {
-            if (SimpleLogger::logCurrentLevel >= logDebug)
+            if (MEGA_LOG_ENABLED(logDebug))
             {
                 LOG_debug << "Excluded: " << namePath.toPath(gWfsa) << "   Attributes: " << fad.dwFileAttributes;
             }
@@ -895,7 +922,7 @@ bool WinFileSystemAccess::renamelocal(LocalPath& oldnamePath, LocalPath& newname
     if (!r)
     {
         DWORD e = GetLastError();
-        if (SimpleLogger::logCurrentLevel >= logWarning && !skip_errorreport)
+        if (MEGA_LOG_ENABLED(logWarning) && !skip_errorreport)
         {
             LOG_warn << "Unable to move file: " << oldnamePath.toPath(gWfsa) <<
                         " to " << newnamePath.toPath(gWfsa) << ". Error code: " << e;
@@ -1299,6 +1326,223 @@ void WinFileSystemAccess::statsid(string *id) const
 #endif
 }
 
+#ifndef WINDOWS_PHONE
+// the volume of path, opened to read its change journal (this needs the rights of an administrator)
+static HANDLE openjournalvolume(const wchar_t* path)
+{
+    wchar_t mountpoint[MAX_PATH + 1];
+    wchar_t volume[MAX_PATH + 1];
+
+    if (!GetVolumePathNameW(path, mountpoint, MAX_PATH + 1)
+     || !GetVolumeNameForVolumeMountPointW(mountpoint, volume, MAX_PATH + 1))
+    {
+        return INVALID_HANDLE_VALUE;
+    }
+
+    // without the trailing backslash, it's the volume that is opened rather than its root folder
+    size_t len = wcslen(volume);
+    if (len && volume[len - 1] == L'\\')
+    {
+        volume[len - 1] = 0;
+    }
+
+    return CreateFileW(volume, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+}
+
+// the path of an open file or folder, as the journal paths are built
+static bool finalpathname(HANDLE h, wstring& path)
+{
+    path.resize(MAX_PATH);
+    DWORD len = GetFinalPathNameByHandleW(h, &path[0], DWORD(path.size()), FILE_NAME_NORMALIZED);
+
+    if (len >= path.size())
+    {
+        path.resize(len);
+        len = GetFinalPathNameByHandleW(h, &path[0], DWORD(path.size()), FILE_NAME_NORMALIZED);
+    }
+
+    if (!len || len >= path.size())
+    {
+        return false;
+    }
+
+    path.resize(len);
+    return true;
+}
+
+static bool queryjournal(HANDLE hVolume, USN_JOURNAL_DATA_V0& journal)
+{
+    DWORD bytes;
+    return DeviceIoControl(hVolume, FSCTL_QUERY_USN_JOURNAL, NULL, 0, &journal, sizeof journal, &bytes, NULL) != 0;
+}
+#endif
+
+// the cursor is the id of the USN journal of the volume and the next USN in it
+bool WinFileSystemAccess::changecursor(const LocalPath& path, string& cursor)
+{
+#ifndef WINDOWS_PHONE
+    HANDLE hVolume = openjournalvolume(path.localpath.c_str());
+    if (hVolume == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    USN_JOURNAL_DATA_V0 journal;
+    bool queried = queryjournal(hVolume, journal);
+    CloseHandle(hVolume);
+
+    if (queried)
+    {
+        cursor.assign((const char*)&journal.UsnJournalID, sizeof journal.UsnJournalID);
+        cursor.append((const char*)&journal.NextUsn, sizeof journal.NextUsn);
+        return true;
+    }
+#endif
+    return false;
+}
+
+bool WinFileSystemAccess::changessince(const LocalPath& path, const string& cursor, vector<LocalPath>& changed)
+{
+#ifndef WINDOWS_PHONE
+    // past that, a scan is as quick
+    const size_t MAXCHANGES = 100000;
+
+    DWORDLONG journalid;
+    USN usn;
+
+    if (cursor.size() != sizeof journalid + sizeof usn)
+    {
+        return false;
+    }
+
+    memcpy(&journalid, cursor.data(), sizeof journalid);
+    memcpy(&usn, cursor.data() + sizeof journalid, sizeof usn);
+
+    HANDLE hVolume = openjournalvolume(path.localpath.c_str());
+    if (hVolume == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    wstring root;
+    HANDLE hRoot = CreateFileW(path.localpath.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                               NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    bool ok = hRoot != INVALID_HANDLE_VALUE && finalpathname(hRoot, root);
+
+    if (hRoot != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hRoot);
+    }
+
+    // a journal that was recreated, or has dropped the records since the cursor, can't tell
+    USN_JOURNAL_DATA_V0 journal;
+    ok = ok && queryjournal(hVolume, journal)
+            && journal.UsnJournalID == journalid
+            && usn >= journal.LowestValidUsn
+            && usn <= journal.NextUsn;
+
+    LocalPath rootpath = LocalPath::fromPlatformEncoded(std::move(root));
+
+    // the paths of the folders the records are in, by file reference number (empty if gone)
+    std::map<DWORDLONG, wstring> folders;
+    std::set<LocalPath> paths;
+
+    READ_USN_JOURNAL_DATA_V0 read = {};
+    read.StartUsn = usn;
+    read.ReasonMask = 0xFFFFFFFF;
+    read.UsnJournalID = journalid;
+
+    std::vector<DWORDLONG> buffer(8192);
+
+    while (ok && read.StartUsn < journal.NextUsn)
+    {
+        DWORD bytes;
+        if (!DeviceIoControl(hVolume, FSCTL_READ_USN_JOURNAL, &read, sizeof read, buffer.data(), DWORD(buffer.size() * sizeof(DWORDLONG)), &bytes, NULL))
+        {
+            LOG_warn << "Unable to read the change journal: " << GetLastError();
+            ok = false;
+            break;
+        }
+
+        if (bytes <= sizeof(USN))
+        {
+            break;
+        }
+
+        for (DWORD offset = sizeof(USN); offset < bytes; )
+        {
+            auto record = reinterpret_cast<const USN_RECORD_V2*>(reinterpret_cast<const char*>(buffer.data()) + offset);
+            offset += record->RecordLength;
+
+            if (record->MajorVersion != 2)
+            {
+                continue;
+            }
+
+            auto folder = folders.find(record->ParentFileReferenceNumber);
+            if (folder == folders.end())
+            {
+                // a folder deleted since is left out: the record of the deletion of the
+                // topmost one is in a folder that still exists
+                wstring folderpath;
+                FILE_ID_DESCRIPTOR id = {};
+                id.dwSize = sizeof id;
+                id.Type = FileIdType;
+                id.FileId.QuadPart = LONGLONG(record->ParentFileReferenceNumber);
+
+                HANDLE hFolder = OpenFileById(hVolume, &id, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                              NULL, FILE_FLAG_BACKUP_SEMANTICS);
+                if (hFolder != INVALID_HANDLE_VALUE)
+                {
+                    if (!finalpathname(hFolder, folderpath))
+                    {
+                        folderpath.clear();
+                    }
+                    CloseHandle(hFolder);
+                }
+
+                folder = folders.emplace(record->ParentFileReferenceNumber, std::move(folderpath)).first;
+            }
+
+            if (folder->second.empty())
+            {
+                continue;
+            }
+
+            wstring name = folder->second;
+            name.push_back(L'\\');
+            name.append(reinterpret_cast<const wchar_t*>(reinterpret_cast<const char*>(record) + record->FileNameOffset),
+                        record->FileNameLength / sizeof(wchar_t));
+
+            LocalPath p = LocalPath::fromPlatformEncoded(std::move(name));
+            size_t index;
+
+            if (rootpath.isContainingPathOf(p, &index) && index < p.localpath.size())
+            {
+                paths.insert(p.subpathFrom(index));
+
+                if (paths.size() > MAXCHANGES)
+                {
+                    ok = false;
+                }
+            }
+        }
+
+        read.StartUsn = *reinterpret_cast<const USN*>(buffer.data());
+    }
+
+    CloseHandle(hVolume);
+
+    if (ok)
+    {
+        changed.assign(paths.begin(), paths.end());
+    }
+    return ok;
+#else
+    return false;
+#endif
+}
+
 // set DirNotify's root LocalNode
 void WinDirNotify::addnotify(LocalNode* l, const LocalPath&)
 {
@@ -1416,7 +1660,7 @@ void WinDirNotify::process(DWORD dwBytes)
                     || (fni->FileNameLength > ignore.localpath.size()
                         && fni->FileName[ignore.localpath.size() - 1] == L'\\')))
             {
-                if (SimpleLogger::logCurrentLevel >= logDebug)
+                if (MEGA_LOG_ENABLED(logDebug))
                 {
 #ifdef ENABLE_SYNC
                     // Outputting this logging on the notification thread slows it down considerably, risking missing notifications.
@@ -1438,7 +1682,7 @@ void WinDirNotify::process(DWORD dwBytes)
                 notify(DIREVENTS, localrootnode, LocalPath::fromPlatformEncoded(std::wstring(fni->FileName, fni->FileNameLength / sizeof(fni->FileName[0]))));
 #endif
             }
-            else if (SimpleLogger::logCurrentLevel >= logDebug)
+            else if (MEGA_LOG_ENABLED(logDebug))
             {
 #ifdef ENABLE_SYNC
                 // Outputting this logging on the notification thread slows it down considerably, risking missing notifications.
@@ -1801,13 +2045,16 @@ bool WinDirAccess::dopen(LocalPath* nameArg, FileAccess* f, bool glob)
         std::wstring name = nameArg->localpath;
         if (!glob)
         {
+            folder = name;
             name.append(L"\\*");
         }
 
 #ifdef WINDOWS_PHONE
         hFind = FindFirstFileExW(name.c_str(), FindExInfoBasic, &ffd, FindExSearchNameMatch, NULL, 0);
 #else
-        hFind = FindFirstFileW(name.c_str(), &ffd);
+        // (the short names are only wanted when globbing, as patterns can match them)
+        hFind = FindFirstFileExW(name.c_str(), glob ? FindExInfoStandard : FindExInfoBasic, &ffd,
+                                 FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
 #endif
 
         if (glob)
@@ -1860,7 +2107,7 @@ bool WinDirAccess::dnext(LocalPath& /*path*/, LocalPath& nameArg, bool /*follows
         }
         else
         {
-            if (ffdvalid && SimpleLogger::logCurrentLevel >= logDebug)
+            if (ffdvalid && MEGA_LOG_ENABLED(logDebug))
             {
                 if (*ffd.cFileName != '.' && (ffd.cFileName[1] && ((ffd.cFileName[1] != '.') || ffd.cFileName[2])))
                     LOG_debug << "Excluded: " << ffd.cFileName << "   Attributes: " << ffd.dwFileAttributes;
@@ -1874,10 +2121,96 @@ bool WinDirAccess::dnext(LocalPath& /*path*/, LocalPath& nameArg, bool /*follows
     }
 }
 
+bool WinDirAccess::dnextbulk(LocalPath& path, vector<Entry>& entries, size_t max, bool followsymlinks, FileSystemAccess& fsaccess)
+{
+#ifndef WINDOWS_PHONE
+    if (hDirectory == INVALID_HANDLE_VALUE && !folder.empty())
+    {
+        // the ids, sizes and times of many entries per call, rather than opening each for its id
+        hDirectory = CreateFileW(folder.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                 NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+        folder.clear();
+
+        // the file reference numbers listed are those of NTFS and ReFS (FAT has none)
+        wchar_t fsname[MAX_PATH + 1];
+        if (hDirectory != INVALID_HANDLE_VALUE
+         && (!GetVolumeInformationByHandleW(hDirectory, NULL, 0, NULL, NULL, NULL, fsname, MAX_PATH + 1)
+          || (_wcsicmp(fsname, L"NTFS") && _wcsicmp(fsname, L"ReFS"))))
+        {
+            CloseHandle(hDirectory);
+            hDirectory = INVALID_HANDLE_VALUE;
+        }
+
+        if (hDirectory != INVALID_HANDLE_VALUE)
+        {
+            bulkbuffer.resize(8192);
+            bulkoffset = 0;
+            bulkpending = !!GetFileInformationByHandleEx(hDirectory, FileIdBothDirectoryRestartInfo, bulkbuffer.data(),
+                                                         DWORD(bulkbuffer.size() * sizeof(DWORDLONG)));
+        }
+    }
+
+    if (hDirectory != INVALID_HANDLE_VALUE)
+    {
+        size_t count = 0;
+
+        while (count < max && bulkpending)
+        {
+            auto info = reinterpret_cast<const FILE_ID_BOTH_DIR_INFO*>(reinterpret_cast<const char*>(bulkbuffer.data()) + bulkoffset);
+            wstring name(info->FileName, info->FileNameLength / sizeof(wchar_t));
+
+            bool skip = WinFileAccess::skipattributes(info->FileAttributes)
+                     || ((info->FileAttributes & FILE_ATTRIBUTE_DIRECTORY) && (name == L"." || name == L".."));
+
+            Entry entry;
+            if (!skip)
+            {
+                FILETIME lastwrite;
+                lastwrite.dwLowDateTime = info->LastWriteTime.LowPart;
+                lastwrite.dwHighDateTime = DWORD(info->LastWriteTime.HighPart);
+
+                entry.name = LocalPath::fromPlatformEncoded(std::move(name));
+                entry.type = (info->FileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? FOLDERNODE : FILENODE;
+                entry.statok = true;
+                entry.size = entry.type == FILENODE ? info->EndOfFile.QuadPart : 0;
+                entry.mtime = FileTime_to_POSIX(&lastwrite);
+                entry.fsid = (handle)info->FileId.QuadPart;
+                entry.fsidvalid = true;
+            }
+
+            if (info->NextEntryOffset)
+            {
+                bulkoffset += info->NextEntryOffset;
+            }
+            else
+            {
+                // the buffer is read: refill it (ERROR_NO_MORE_FILES at the end)
+                bulkoffset = 0;
+                bulkpending = !!GetFileInformationByHandleEx(hDirectory, FileIdBothDirectoryInfo, bulkbuffer.data(),
+                                                             DWORD(bulkbuffer.size() * sizeof(DWORDLONG)));
+            }
+
+            if (!skip)
+            {
+                entries.push_back(std::move(entry));
+                count++;
+            }
+        }
+
+        return count > 0;
+    }
+#endif
+
+    return DirAccess::dnextbulk(path, entries, max, followsymlinks, fsaccess);
+}
+
 WinDirAccess::WinDirAccess()
 {
     ffdvalid = false;
     hFind = INVALID_HANDLE_VALUE;
+    hDirectory = INVALID_HANDLE_VALUE;
+    bulkoffset = 0;
+    bulkpending = false;
 }
 
 WinDirAccess::~WinDirAccess()
@@ -1886,5 +2219,10 @@ WinDirAccess::~WinDirAccess()
     {
         FindClose(hFind);
     }
+
+    if (hDirectory != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hDirectory);
+    }
 }
 } // namespace
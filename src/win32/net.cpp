@@ -22,6 +22,9 @@
 // FIXME: Work around WinHTTP's inability to POST additional data
 // after having read from the HTTP connection
 
+// the level of the net module applies (see SimpleLogger::setModuleLogLevel)
+#define MEGA_LOG_MODULE ::mega::logModuleNet
+
 #include "meganet.h"
 #include <winhttp.h>
 
@@ -237,9 +240,19 @@ VOID CALLBACK WinHttpIO::asynccallback(HINTERNET hInternet, DWORD_PTR dwContext,
                     ptr = (char*)httpctx->zin.data() + zprevsize;
                 }
                 else
-                {                    
+                {
+                    // transfer data goes straight into its buffer: ask for as much as fits, not only what
+                    // has arrived, to need fewer reads (the read completes with what it got)
+                    if (req->buf && size < HTTP_READ_CHUNK_SIZE)
+                    {
+                        size = HTTP_READ_CHUNK_SIZE;
+                    }
+
                     ptr = (char*)req->reserveput((unsigned*)&size);
-                    req->bufpos += size;
+                    if (!req->buf)
+                    {
+                        req->bufpos += size;
+                    }
                 }
 
                 if (!WinHttpReadData(hInternet, ptr, size, NULL))
@@ -288,6 +301,11 @@ VOID CALLBACK WinHttpIO::asynccallback(HINTERNET hInternet, DWORD_PTR dwContext,
                 }
                 else
                 {
+                    if (req->buf)
+                    {
+                        req->bufpos += dwStatusInformationLength;
+                    }
+
                     // data was copied direct to buf or to req->in.
                     assert(req->buf && (byte*)lpvStatusInformation >= req->buf && (byte*)lpvStatusInformation + dwStatusInformationLength <= req->buf + req->buflen ||
                            !req->buf && (char*)lpvStatusInformation >= req->in.data() && (char*)lpvStatusInformation + dwStatusInformationLength <= req->in.data() + req->in.size());
@@ -537,7 +555,7 @@ VOID CALLBACK WinHttpIO::asynccallback(HINTERNET hInternet, DWORD_PTR dwContext,
 // POST request to URL
 void WinHttpIO::post(HttpReq* req, const char* data, unsigned len)
 {
-    if (SimpleLogger::logCurrentLevel >= logDebug)
+    if (MEGA_LOG_ENABLED(logDebug))
     {
         string safeurl = req->posturl;
         size_t sid = safeurl.find("sid=");
@@ -598,6 +616,14 @@ void WinHttpIO::post(HttpReq* req, const char* data, unsigned len)
 
             if (httpctx->hRequest)
             {
+#ifdef WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL
+                if (http2)
+                {
+                    DWORD protocols = WINHTTP_PROTOCOL_FLAG_HTTP2;
+                    WinHttpSetOption(httpctx->hRequest, WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL, &protocols, sizeof protocols);
+                }
+#endif
+
                 if (proxyUsername.size())
                 {
                     LOG_verbose << "Setting proxy credentials";
@@ -0,0 +1,458 @@
+/**
+ * @file tests/benchmark/Core_benchmark.cpp
+ * @brief Microbenchmarks of the primitives that transfers, fetchnodes and syncs spend their time in
+ *
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+// The inputs are generated from fixed seeds and built outside the timed loops, so two builds
+// measure the same work.  To compare them, run each with
+//   --benchmark_repetitions=10 --benchmark_report_aggregates_only=true --benchmark_format=json
+// and diff the medians (Google Benchmark's tools/compare.py does it).  Where an optimization has
+// a switch (JSON::vectorscan, Base64::vectorcodec, RaidBufferManager::vectorcombine), the
+// benchmark takes it as its last argument, so both paths are measured by the same binary
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <mega.h>
+
+#include "../unit/DefaultedFileAccess.h"
+#include "../unit/utils.h"
+
+using mega::nameid;
+using mega::RAIDPARTS;
+using mega::RAIDSECTOR;
+
+namespace {
+
+std::string randomBytes(size_t len, unsigned seed = 42)
+{
+    std::mt19937 rng(seed);
+    std::string s(len, 0);
+    for (auto& c : s)
+    {
+        c = char(rng());
+    }
+    return s;
+}
+
+// sets a static switch for the scope of a benchmark
+class Switch
+{
+public:
+    Switch(bool& value, bool on)
+        : mValue(value)
+        , mPrevious(value)
+    {
+        mValue = on;
+    }
+
+    ~Switch()
+    {
+        mValue = mPrevious;
+    }
+
+private:
+    bool& mValue;
+    bool mPrevious;
+};
+
+struct MockClient
+{
+    mega::MegaApp app;
+    ::mega::FSACCESS_CLASS fs;
+    std::shared_ptr<mega::MegaClient> cli = mt::makeClient(app, fs);
+};
+
+// a file in memory
+class MemoryFileAccess : public mt::DefaultedFileAccess
+{
+public:
+    MemoryFileAccess(const std::string& content)
+        : mContent(content)
+    {
+        size = m_off_t(mContent.size());
+        mtime = 1600000000;
+    }
+
+    bool sysstat(mega::m_time_t* curr_mtime, m_off_t* curr_size) override
+    {
+        *curr_mtime = mtime;
+        *curr_size = size;
+        return true;
+    }
+
+    bool sysopen(bool = false) override
+    {
+        return true;
+    }
+
+    bool sysread(mega::byte* buffer, const unsigned len, const m_off_t offset) override
+    {
+        memcpy(buffer, mContent.data() + offset, len);
+        return true;
+    }
+
+    void sysclose() override
+    {
+    }
+
+private:
+    const std::string& mContent;
+};
+
+// the bytes of one of the files, in a chunk of a transfer
+void BM_SymmCipher_ctr_crypt(benchmark::State& state)
+{
+    mega::SymmCipher cipher;
+    std::string key = randomBytes(mega::SymmCipher::KEYLENGTH);
+    cipher.setkey(reinterpret_cast<const mega::byte*>(key.data()));
+
+    std::string data = randomBytes(size_t(state.range(0)));
+    mega::byte mac[mega::SymmCipher::BLOCKSIZE];
+    bool encrypt = state.range(1) != 0;
+
+    for (auto _ : state)
+    {
+        cipher.ctr_crypt(reinterpret_cast<mega::byte*>(&data[0]), unsigned(data.size()), 0, 0x0123456789abcdefULL, mac, encrypt);
+        benchmark::DoNotOptimize(mac);
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_SymmCipher_ctr_crypt)->ArgNames({"bytes", "encrypt"})->Args({16 << 10, 1})->Args({1 << 20, 1})->Args({1 << 20, 0});
+
+// the mac of a file of that many chunk macs, at the end of a transfer
+void BM_chunkmac_map_macsmac(benchmark::State& state)
+{
+    mega::SymmCipher cipher;
+    std::string key = randomBytes(mega::SymmCipher::KEYLENGTH);
+    cipher.setkey(reinterpret_cast<const mega::byte*>(key.data()));
+
+    mega::chunkmac_map macs;
+    std::string random = randomBytes(size_t(state.range(0)) * mega::SymmCipher::BLOCKSIZE);
+    for (int64_t i = 0; i < state.range(0); ++i)
+    {
+        auto& chunk = macs[i << 20];
+        memcpy(chunk.mac, random.data() + i * mega::SymmCipher::BLOCKSIZE, mega::SymmCipher::BLOCKSIZE);
+        chunk.finished = true;
+    }
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(macs.macsmac(&cipher));
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_chunkmac_map_macsmac)->ArgName("chunks")->Arg(100)->Arg(10000);
+
+// the raid lines of the parts of a download, with all six or with one missing (rebuilt from the
+// parity), as combineRaidParts() has them made
+void BM_RaidBufferManager_combineRaidLines(benchmark::State& state)
+{
+    Switch mode(mega::RaidBufferManager::vectorcombine, state.range(1) != 0);
+
+    size_t lines = 1 << 14;
+    size_t partslen = lines * RAIDSECTOR;
+    std::vector<std::string> parts;
+    for (unsigned j = 0; j < RAIDPARTS; ++j)
+    {
+        parts.push_back(randomBytes(partslen, 42 + j));
+    }
+
+    mega::byte* inputbufs[RAIDPARTS];
+    unsigned missing = unsigned(state.range(0));
+    for (unsigned j = 0; j < RAIDPARTS; ++j)
+    {
+        inputbufs[j] = j == missing ? nullptr : reinterpret_cast<mega::byte*>(&parts[j][0]);
+    }
+
+    std::vector<mega::byte> out(partslen * (RAIDPARTS - 1));
+    for (auto _ : state)
+    {
+        mega::RaidBufferManager::combineRaidLines(out.data(), inputbufs, partslen);
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(out.size()));
+}
+BENCHMARK(BM_RaidBufferManager_combineRaidLines)->ArgNames({"missing", "vector"})
+    ->Args({RAIDPARTS, 0})->Args({RAIDPARTS, 1})->Args({3, 0})->Args({3, 1});
+
+// the "f" array of a fetchnodes response, of files and folders with the fields the API sends
+std::string fetchnodesPayload(int count)
+{
+    std::mt19937 rng(42);
+    std::string json = "[";
+
+    for (int i = 0; i < count; ++i)
+    {
+        std::string handle = mega::Base64::btoa(randomBytes(6, unsigned(i)));
+        std::string parent = mega::Base64::btoa(randomBytes(6, unsigned(i / 20)));
+        bool file = i % 10 != 0;
+        size_t attrs = 32 + rng() % 64;
+        unsigned seed = unsigned(rng());
+
+        json += i ? ",{" : "{";
+        json += "\"h\":\"" + handle + "\",\"p\":\"" + parent + "\",\"u\":\"AAAAAAAAAAA\",";
+        json += "\"t\":" + std::to_string(file ? 0 : 1) + ",";
+        json += "\"a\":\"" + mega::Base64::btoa(randomBytes(attrs, seed)) + "\",";
+        json += "\"k\":\"AAAAAAAAAAA:" + mega::Base64::btoa(randomBytes(file ? 32 : 16, seed + 1)) + "\",";
+        if (file)
+        {
+            json += "\"s\":" + std::to_string(rng() % 100000000) + ",";
+            json += "\"fa\":\"" + std::to_string(rng() % 1000) + ":0*" + mega::Base64::btoa(randomBytes(8, seed + 2)) + "\",";
+        }
+        json += "\"ts\":" + std::to_string(1500000000 + rng() % 100000000) + "}";
+    }
+    return json + "]";
+}
+
+// scans the nodes as MegaClient::readnode() does, without making them
+void BM_JSON_fetchnodes(benchmark::State& state)
+{
+    Switch mode(mega::JSON::vectorscan, state.range(1) != 0);
+    std::string payload = fetchnodesPayload(int(state.range(0)));
+
+    for (auto _ : state)
+    {
+        mega::JSON j(payload);
+        j.enterarray();
+
+        size_t count = 0;
+        while (j.enterobject())
+        {
+            nameid name;
+            while ((name = j.getnameid()) != EOO)
+            {
+                switch (name)
+                {
+                    case 'h':
+                    case 'p':
+                        benchmark::DoNotOptimize(j.gethandle());
+                        break;
+
+                    case 'u':
+                        benchmark::DoNotOptimize(j.gethandle(mega::MegaClient::USERHANDLE));
+                        break;
+
+                    case 't':
+                    case 's':
+                    case MAKENAMEID2('t', 's'):
+                        benchmark::DoNotOptimize(j.getint());
+                        break;
+
+                    case 'a':
+                    case 'k':
+                    case MAKENAMEID2('f', 'a'):
+                        benchmark::DoNotOptimize(j.getvalue());
+                        break;
+
+                    default:
+                        j.storeobject();
+                }
+            }
+            j.leaveobject();
+            ++count;
+        }
+        j.leavearray();
+        benchmark::DoNotOptimize(count);
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(payload.size()));
+    state.SetItemsProcessed(int64_t(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_JSON_fetchnodes)->ArgNames({"nodes", "vector"})->Args({100000, 0})->Args({100000, 1});
+
+// skips the whole array, as the parts of a response that aren't read are
+void BM_JSON_storeobject(benchmark::State& state)
+{
+    Switch mode(mega::JSON::vectorscan, state.range(0) != 0);
+    std::string payload = fetchnodesPayload(100000);
+
+    for (auto _ : state)
+    {
+        mega::JSON j(payload);
+        benchmark::DoNotOptimize(j.storeobject());
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(payload.size()));
+}
+BENCHMARK(BM_JSON_storeobject)->ArgName("vector")->Arg(0)->Arg(1);
+
+// a file node as the local cache has it, with a name, a modification time and file attributes
+mega::Node& cachedNode(mega::MegaClient& client, mega::handle handle)
+{
+    auto& n = mt::makeNode(client, mega::FILENODE, handle);
+    n.size = 123456789;
+    n.owner = 43;
+    n.ctime = 1500000000;
+    n.attrs.map['n'] = "IMG_20210314_153000.jpg";
+    n.attrs.map['c'] = "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA";
+    n.fileattrstring = "100:0*AAAAAAAAAAA/101:1*AAAAAAAAAAA";
+    return n;
+}
+
+void BM_Node_serialize(benchmark::State& state)
+{
+    MockClient client;
+    client.cli->compactnoderecords = state.range(0) != 0;
+    auto& n = cachedNode(*client.cli, 42);
+
+    std::string data;
+    for (auto _ : state)
+    {
+        data.clear();
+        benchmark::DoNotOptimize(n.serialize(&data));
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()));
+}
+BENCHMARK(BM_Node_serialize)->ArgName("compact")->Arg(0)->Arg(1);
+
+void BM_Node_unserialize(benchmark::State& state)
+{
+    MockClient client;
+    client.cli->compactnoderecords = state.range(0) != 0;
+
+    std::string data;
+    {
+        auto& n = cachedNode(*client.cli, 42);
+        n.serialize(&data);
+        client.cli->nodes.erase(42);
+        delete &n;
+    }
+
+    mega::node_vector dp;
+    for (auto _ : state)
+    {
+        mega::Node* n = mega::Node::unserialize(client.cli.get(), &data, &dp);
+        benchmark::DoNotOptimize(n);
+
+        state.PauseTiming();
+        client.cli->nodes.erase(42);
+        delete n;
+        dp.clear();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()));
+}
+BENCHMARK(BM_Node_unserialize)->ArgName("compact")->Arg(0)->Arg(1);
+
+void BM_Base64_btoa(benchmark::State& state)
+{
+    Switch mode(mega::Base64::vectorcodec, state.range(1) != 0);
+    std::string data = randomBytes(size_t(state.range(0)));
+
+    std::string out;
+    for (auto _ : state)
+    {
+        mega::Base64::btoa(data, out);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_Base64_btoa)->ArgNames({"bytes", "vector"})->Args({6, 0})->Args({6, 1})->Args({64 << 10, 0})->Args({64 << 10, 1});
+
+void BM_Base64_atob(benchmark::State& state)
+{
+    Switch mode(mega::Base64::vectorcodec, state.range(1) != 0);
+    std::string data = mega::Base64::btoa(randomBytes(size_t(state.range(0))));
+
+    std::string out;
+    for (auto _ : state)
+    {
+        mega::Base64::atob(data, out);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_Base64_atob)->ArgNames({"bytes", "vector"})->Args({6, 0})->Args({6, 1})->Args({64 << 10, 0})->Args({64 << 10, 1});
+
+// small files are read whole, the larger ones only in samples
+void BM_FileFingerprint_genfingerprint(benchmark::State& state)
+{
+    std::string content = randomBytes(size_t(state.range(0)));
+    MemoryFileAccess fa(content);
+
+    for (auto _ : state)
+    {
+        mega::FileFingerprint ffp;
+        benchmark::DoNotOptimize(ffp.genfingerprint(&fa));
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()));
+}
+BENCHMARK(BM_FileFingerprint_genfingerprint)->ArgName("bytes")->Arg(100)->Arg(16 << 10)->Arg(20 << 20);
+
+// names that are equal but for the last characters, as those of a folder of photos are
+void BM_compareUtf(benchmark::State& state)
+{
+    bool unescaping = state.range(0) != 0;
+    bool caseInsensitive = state.range(1) != 0;
+
+    std::vector<std::string> names;
+    for (int i = 0; i < 1000; ++i)
+    {
+        names.push_back("Vacaciones en Mall%c3%b3rca 2021/IMG_" + std::to_string(20210000 + i * 7919 % 1000) + ".JPG");
+    }
+
+    for (auto _ : state)
+    {
+        int sum = 0;
+        for (size_t i = 1; i < names.size(); ++i)
+        {
+            sum += mega::compareUtf(names[i - 1], unescaping, names[i], unescaping, caseInsensitive);
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(names.size() - 1));
+}
+BENCHMARK(BM_compareUtf)->ArgNames({"unescaping", "caseInsensitive"})->Args({0, 0})->Args({1, 0})->Args({1, 1});
+
+// lookups of the nodes of an account of that many, in an order unrelated to that of insertion
+void BM_MegaClient_nodebyhandle(benchmark::State& state)
+{
+    MockClient client;
+
+    std::mt19937_64 rng(42);
+    std::vector<mega::handle> handles;
+    for (int64_t i = 0; i < state.range(0); ++i)
+    {
+        mega::handle h = rng() & 0xFFFFFFFFFFFF;
+        if (!client.cli->nodebyhandle(h))
+        {
+            mt::makeNode(*client.cli, mega::FILENODE, h);
+            handles.push_back(h);
+        }
+    }
+    std::shuffle(handles.begin(), handles.end(), rng);
+
+    for (auto _ : state)
+    {
+        for (mega::handle h : handles)
+        {
+            benchmark::DoNotOptimize(client.cli->nodebyhandle(h));
+        }
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(handles.size()));
+}
+BENCHMARK(BM_MegaClient_nodebyhandle)->ArgName("nodes")->Arg(1000)->Arg(1000000);
+
+} // anonymous
+
+BENCHMARK_MAIN();
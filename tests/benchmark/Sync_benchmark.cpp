@@ -0,0 +1,507 @@
+/**
+ * @file tests/benchmark/Sync_benchmark.cpp
+ * @brief How fast a sync scans a synthetic local tree and follows changes in it
+ *
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <mega/megaclient.h>
+#include <mega/megaapp.h>
+#include <mega/heartbeats.h>
+#include <mega/sync.h>
+#include <mega/filesystem.h>
+
+#include "../unit/DefaultedDirAccess.h"
+#include "../unit/DefaultedFileAccess.h"
+#include "../unit/DefaultedFileSystemAccess.h"
+#include "../unit/utils.h"
+
+#ifdef ENABLE_SYNC
+
+namespace {
+
+using mega::LocalPath;
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options
+{
+    int depth = 3;      // levels of folders below the root
+    int width = 10;     // folders in each folder
+    int files = 20;     // files in each folder
+    int size = 1000;    // bytes of each file
+    int changes = 1000; // files modified or added once the tree is synced
+};
+
+// The local tree the sync sees, generated rather than on a disk.  The files have no contents
+// kept: their bytes are made up from their fsid as they are read.  The workers of the dir lister
+// read it too, so it has a mutex
+class SyntheticTree
+{
+public:
+    struct Item
+    {
+        mega::nodetype_t type;
+        m_off_t size;
+        mega::m_time_t mtime;
+        mega::handle fsid;
+        std::vector<LocalPath> children;
+    };
+
+    SyntheticTree(const LocalPath& root, const Options& options)
+        : mRoot(root)
+    {
+        add(LocalPath(), root, mega::FOLDERNODE, 0);
+        build(root, options, options.depth);
+    }
+
+    const LocalPath& root() const { return mRoot; }
+
+    bool find(const LocalPath& path, Item& out)
+    {
+        std::lock_guard<std::mutex> g(mMutex);
+        auto it = mItems.find(path);
+        if (it == mItems.end())
+        {
+            return false;
+        }
+        out = it->second;
+        return true;
+    }
+
+    // a new item in folder (none for the root), returning its path
+    LocalPath add(const LocalPath& folder, const LocalPath& name, mega::nodetype_t type, m_off_t size)
+    {
+        std::lock_guard<std::mutex> g(mMutex);
+
+        LocalPath path = folder;
+        path.appendWithSeparator(name, false);
+
+        Item& item = mItems[path];
+        item.type = type;
+        item.size = size;
+        item.mtime = mMTime++;
+        item.fsid = mNextFsid++;
+
+        if (!folder.empty())
+        {
+            mItems[folder].children.push_back(name);
+        }
+        if (type == mega::FILENODE)
+        {
+            mFiles.push_back(path);
+        }
+        return path;
+    }
+
+    void modify(const LocalPath& path)
+    {
+        std::lock_guard<std::mutex> g(mMutex);
+        Item& item = mItems[path];
+        item.size++;
+        item.mtime = mMTime++;
+    }
+
+    const std::vector<LocalPath>& files() const { return mFiles; }
+
+    std::vector<LocalPath> folders()
+    {
+        std::lock_guard<std::mutex> g(mMutex);
+        std::vector<LocalPath> folders;
+        for (auto& i : mItems)
+        {
+            if (i.second.type == mega::FOLDERNODE)
+            {
+                folders.push_back(i.first);
+            }
+        }
+        return folders;
+    }
+
+private:
+    std::mutex mMutex;
+    std::map<LocalPath, Item> mItems;
+    std::vector<LocalPath> mFiles;
+    LocalPath mRoot;
+    mega::handle mNextFsid = 1;
+    mega::m_time_t mMTime = 1600000000;
+
+    void build(const LocalPath& folder, const Options& options, int depth)
+    {
+        for (int i = 0; i < options.files; i++)
+        {
+            add(folder, LocalPath::fromPlatformEncoded("f_" + std::to_string(i)), mega::FILENODE, options.size);
+        }
+
+        if (depth > 0)
+        {
+            for (int i = 0; i < options.width; i++)
+            {
+                build(add(folder, LocalPath::fromPlatformEncoded("d_" + std::to_string(i)), mega::FOLDERNODE, 0), options, depth - 1);
+            }
+        }
+    }
+};
+
+class SyntheticFileAccess : public mt::DefaultedFileAccess
+{
+public:
+    explicit SyntheticFileAccess(SyntheticTree& tree)
+        : mTree(tree)
+    {}
+
+    bool fopen(LocalPath& path, bool, bool, mega::DirAccess*, bool) override
+    {
+        mPath = path;
+        return sysopen();
+    }
+
+    bool sysstat(mega::m_time_t* curr_mtime, m_off_t* curr_size) override
+    {
+        *curr_mtime = mtime;
+        *curr_size = size;
+        return true;
+    }
+
+    bool sysopen(bool = false) override
+    {
+        SyntheticTree::Item item;
+        if (!mTree.find(mPath, item))
+        {
+            return false;
+        }
+        type = item.type;
+        size = item.type == mega::FILENODE ? item.size : 0;
+        mtime = item.mtime;
+        fsid = item.fsid;
+        fsidvalid = true;
+        return true;
+    }
+
+    bool sysread(mega::byte* buffer, unsigned len, m_off_t offset) override
+    {
+        for (unsigned i = 0; i < len; i++)
+        {
+            buffer[i] = mega::byte(fsid + mega::handle(offset) + i);
+        }
+        return true;
+    }
+
+    void sysclose() override
+    {}
+
+private:
+    SyntheticTree& mTree;
+    LocalPath mPath;
+};
+
+class SyntheticDirAccess : public mt::DefaultedDirAccess
+{
+public:
+    explicit SyntheticDirAccess(SyntheticTree& tree)
+        : mTree(tree)
+    {}
+
+    bool dopen(LocalPath* path, mega::FileAccess*, bool) override
+    {
+        SyntheticTree::Item item;
+        if (!mTree.find(*path, item) || item.type != mega::FOLDERNODE)
+        {
+            return false;
+        }
+        mChildren = std::move(item.children);
+        mNext = 0;
+        return true;
+    }
+
+    bool dnext(LocalPath& path, LocalPath& name, bool, mega::nodetype_t* type) override
+    {
+        if (mNext >= mChildren.size())
+        {
+            return false;
+        }
+
+        name = mChildren[mNext++];
+        if (type)
+        {
+            mega::ScopedLengthRestore restoreLen(path);
+            path.appendWithSeparator(name, false);
+            SyntheticTree::Item item;
+            *type = mTree.find(path, item) ? item.type : mega::TYPE_UNKNOWN;
+        }
+        return true;
+    }
+
+private:
+    SyntheticTree& mTree;
+    std::vector<LocalPath> mChildren;
+    size_t mNext = 0;
+};
+
+class SyntheticFileSystemAccess : public mt::DefaultedFileSystemAccess
+{
+public:
+    explicit SyntheticFileSystemAccess(SyntheticTree& tree)
+        : mTree(tree)
+    {}
+
+    std::unique_ptr<mega::FileAccess> newfileaccess(bool) override
+    {
+        return std::unique_ptr<mega::FileAccess>{new SyntheticFileAccess{mTree}};
+    }
+
+    mega::DirAccess* newdiraccess() override
+    {
+        return new SyntheticDirAccess{mTree};
+    }
+
+    void local2path(const std::string* local, std::string* path) const override
+    {
+        *path = *local;
+    }
+
+    void path2local(const std::string* local, std::string* path) const override
+    {
+        *path = *local;
+    }
+
+    bool getsname(const LocalPath&, LocalPath&) const override
+    {
+        return false;
+    }
+
+private:
+    SyntheticTree& mTree;
+};
+
+// the latencies of the slices that MegaClient::exec() gives to the scanning, in ms
+struct Slices
+{
+    std::vector<double> ms;
+
+    double percentile(double p)
+    {
+        if (ms.empty())
+        {
+            return 0;
+        }
+        std::sort(ms.begin(), ms.end());
+        return ms[std::min(ms.size() - 1, size_t(p / 100 * double(ms.size())))];
+    }
+};
+
+// process the notifications of the sync as exec() does, a slice at a time, until there are none
+// left.  The delay before a recent change is scanned is skipped, by moving the clock of the
+// waiter
+void drain(mega::Sync& sync, Slices& slices)
+{
+    auto& q = sync.dirnotify->notifyq[mega::DirNotify::DIREVENTS];
+
+    while (!q.empty())
+    {
+        auto start = Clock::now();
+        mega::dstime retry = sync.procscanq(mega::DirNotify::DIREVENTS, start + std::chrono::milliseconds(mega::MegaClient::EXECSLICEMS));
+        slices.ms.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+
+        if (!retry)
+        {
+            std::cerr << "The scan waits for a remote node, which the benchmark doesn't create" << std::endl;
+            break;
+        }
+        if (EVER(retry))
+        {
+            mega::Waiter::ds += retry;
+        }
+    }
+}
+
+double peakRssMB()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return double(counters.PeakWorkingSetSize) / (1024 * 1024);
+    }
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return double(usage.ru_maxrss) / (1024 * 1024);
+#else
+    return double(usage.ru_maxrss) / 1024;
+#endif
+#endif
+}
+
+void report(const char* phase, double seconds, const std::string& rate, Slices& slices)
+{
+    std::cout << phase << ": " << seconds << " s, " << rate
+              << ", slices p50 " << slices.percentile(50) << " ms, p90 " << slices.percentile(90)
+              << " ms, p99 " << slices.percentile(99) << " ms, max " << slices.percentile(100)
+              << " ms, peak RSS " << peakRssMB() << " MB" << std::endl;
+}
+
+bool parse(int argc, char* argv[], Options& options)
+{
+    struct Option
+    {
+        const char* name;
+        int* value;
+    };
+    Option known[] = {
+        { "--depth=", &options.depth },
+        { "--width=", &options.width },
+        { "--files=", &options.files },
+        { "--size=", &options.size },
+        { "--changes=", &options.changes },
+    };
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool found = false;
+        for (auto& o : known)
+        {
+            size_t len = strlen(o.name);
+            if (!strncmp(argv[i], o.name, len))
+            {
+                *o.value = atoi(argv[i] + len);
+                found = *o.value >= 0;
+            }
+        }
+        if (!found)
+        {
+            std::cerr << "Usage: " << argv[0] << " [--depth=N] [--width=N] [--files=N] [--size=BYTES] [--changes=N]" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+} // anonymous
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parse(argc, argv, options))
+    {
+        return 1;
+    }
+
+    mega::SimpleLogger::setLogLevel(mega::logError);
+    mega::Waiter::ds = 1000;
+
+    std::cout << "Generating a tree of depth " << options.depth << ", " << options.width << " folders and "
+              << options.files << " files of " << options.size << " bytes per folder" << std::endl;
+
+    SyntheticTree tree(LocalPath::fromPlatformEncoded("bench"), options);
+    std::cout << "Files: " << tree.files().size() << ", folders: " << tree.folders().size() << std::endl;
+
+    // the API is a client whose requests go nowhere: the sync is measured up to the LocalNodes,
+    // which is what it does before the uploads start
+    mega::MegaApp app;
+    SyntheticFileSystemAccess fsaccess(tree);
+    auto client = mt::makeClient(app, fsaccess);
+    auto us = mt::makeSync(*client, "bench");
+    mega::Sync& sync = *us->mSync;
+
+    // the initial scan, as exec() starts it for a new sync
+    sync.state = mega::SYNC_INITIALSCAN;
+    Slices slices;
+    auto start = Clock::now();
+    LocalPath root = tree.root();
+    if (!sync.scan(&root, nullptr))
+    {
+        std::cerr << "The root of the tree can't be scanned" << std::endl;
+        return 1;
+    }
+    sync.initializing = false;
+    drain(sync, slices);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    unsigned scanned = sync.localnodes[mega::FILENODE];
+    if (scanned != tree.files().size())
+    {
+        std::cerr << "Only " << scanned << " files of " << tree.files().size() << " were scanned" << std::endl;
+    }
+    report("Initial scan", seconds, std::to_string(unsigned(scanned / std::max(seconds, 1e-9))) + " files/s", slices);
+
+    // then the changes that the filesystem notifies: half of them modify files, the other half add
+    // them, all over the tree
+    sync.fullscan = false;
+    std::mt19937 rng(42);
+    auto folders = tree.folders();
+    std::vector<LocalPath> changed;
+    for (int i = 0; i < options.changes; i++)
+    {
+        if (i % 2 && !tree.files().empty())
+        {
+            const LocalPath& path = tree.files()[rng() % tree.files().size()];
+            tree.modify(path);
+            changed.push_back(path);
+        }
+        else
+        {
+            changed.push_back(tree.add(folders[rng() % folders.size()], LocalPath::fromPlatformEncoded("new_" + std::to_string(i)), mega::FILENODE, options.size));
+        }
+    }
+
+    slices = Slices();
+    start = Clock::now();
+    for (auto& path : changed)
+    {
+        sync.dirnotify->notify(mega::DirNotify::DIREVENTS, nullptr, LocalPath(path));
+    }
+    drain(sync, slices);
+    seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    if (sync.localnodes[mega::FILENODE] != tree.files().size())
+    {
+        std::cerr << "The sync has " << sync.localnodes[mega::FILENODE] << " files of " << tree.files().size() << std::endl;
+    }
+    report("Convergence after changes", seconds, std::to_string(unsigned(double(changed.size()) / std::max(seconds, 1e-9))) + " events/s", slices);
+
+    return 0;
+}
+
+#else
+
+int main()
+{
+    std::cerr << "The SDK was built without syncs" << std::endl;
+    return 1;
+}
+
+#endif
@@ -0,0 +1,488 @@
+/**
+ * @file tests/benchmark/Transfer_benchmark.cpp
+ * @brief How fast uploads and downloads go through a link shaped by tcprelay
+ *
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <asio.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+#include <mega.h>
+#include <megaapi.h>
+
+#include "../tool/tcprelay/tcprelay.h"
+
+#ifdef MEGASDK_DEBUG_TEST_HOOKS_ENABLED
+
+namespace {
+
+const char* APP_KEY = "8QxzVRxD";
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options
+{
+    int size = 100;        // MB of the file uploaded and downloaded
+    int runs = 3;          // of each
+    int rtt = 0;           // ms added to each round trip
+    int loss = 0;          // permille of the reads that arrive late, as if lost and retransmitted
+    int bandwidth = 0;     // bytes per second of the whole link, or unlimited
+    std::string output = "transfer_benchmark.json";
+};
+
+// The relays of tcprelay, one for each storage server the transfers use: the SDK's requests to
+// them are sent to localhost instead (see routeThroughRelay), and the relays shape the link.
+// They have a thread of their own, as in tcprelay itself
+class Relays
+{
+public:
+    explicit Relays(size_t bandwidth)
+        : mWork(new asio::io_service::work(mService))
+        , mBandwidth(bandwidth)
+        , mThread([this]() { mService.run(); })
+    {
+    }
+
+    ~Relays()
+    {
+        mWork.reset();
+        mService.stop();
+        mThread.join();
+    }
+
+    // the port relaying to host, started the first time, or 0 if host can't be relayed
+    uint16_t port(const std::string& host)
+    {
+        std::lock_guard<std::mutex> g(mMutex);
+
+        auto it = mPorts.find(host);
+        if (it != mPorts.end())
+        {
+            return it->second;
+        }
+
+        asio::ip::address_v6 address;
+        if (!resolve(host, address))
+        {
+            std::cerr << "Unable to resolve " << host << std::endl;
+            return mPorts[host] = 0;
+        }
+
+        // the first port free
+        for (uint16_t port = mNextPort; port < mNextPort + 100; ++port)
+        {
+            try
+            {
+                std::unique_ptr<TcpRelayAcceptor> acceptor(new TcpRelayAcceptor(mService, host, port, asio::ip::tcp::endpoint(address, 80),
+                    [this](std::unique_ptr<TcpRelay> relay)
+                    {
+                        std::lock_guard<std::mutex> g(mMutex);
+                        mRelays.emplace_back(std::move(relay));
+                    }));
+                acceptor->SetBytesPerSecond(mBandwidth);
+
+                TcpRelayAcceptor* a = acceptor.get();
+                mService.post([a]() { a->Start(); });
+                mAcceptors.emplace_back(std::move(acceptor));
+
+                mNextPort = uint16_t(port + 1);
+                return mPorts[host] = port;
+            }
+            catch (std::exception&)
+            {
+            }
+        }
+        std::cerr << "No port free to relay " << host << std::endl;
+        return mPorts[host] = 0;
+    }
+
+    // what the relays took, to tell it from the SDK's
+    double cpuSeconds()
+    {
+#if defined(_WIN32)
+        FILETIME creation, exit, kernel, user;
+        if (!GetThreadTimes(mThread.native_handle(), &creation, &exit, &kernel, &user))
+        {
+            return 0;
+        }
+        auto seconds = [](const FILETIME& t) { return double((uint64_t(t.dwHighDateTime) << 32) | t.dwLowDateTime) / 1e7; };
+        return seconds(kernel) + seconds(user);
+#elif defined(__APPLE__)
+        return 0;
+#else
+        clockid_t id;
+        struct timespec ts;
+        if (pthread_getcpuclockid(mThread.native_handle(), &id) || clock_gettime(id, &ts))
+        {
+            return 0;
+        }
+        return double(ts.tv_sec) + double(ts.tv_nsec) / 1e9;
+#endif
+    }
+
+private:
+    static bool resolve(const std::string& host, asio::ip::address_v6& address)
+    {
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_protocol = IPPROTO_TCP;
+        hints.ai_socktype = SOCK_STREAM;
+
+        struct addrinfo* result = nullptr;
+        if (getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0)
+        {
+            return false;
+        }
+
+        // the acceptors listen on IPv6, as in tcprelay
+        const auto* ai_addr = reinterpret_cast<struct sockaddr_in*>(result->ai_addr);
+        address = asio::ip::make_address_v6(asio::ip::v4_mapped, asio::ip::make_address_v4(ntohl(ai_addr->sin_addr.s_addr)));
+        freeaddrinfo(result);
+        return true;
+    }
+
+    asio::io_service mService;
+    std::unique_ptr<asio::io_service::work> mWork;
+    size_t mBandwidth;
+
+    std::mutex mMutex;
+    std::map<std::string, uint16_t> mPorts;
+    std::vector<std::unique_ptr<TcpRelayAcceptor>> mAcceptors;
+    std::vector<std::unique_ptr<TcpRelay>> mRelays;
+    uint16_t mNextPort = 3677;
+
+    std::thread mThread;
+};
+
+Relays* relays = nullptr;
+
+// the transfers go to the storage servers over http, the only requests relayed: those to the API
+// are over https, and stay direct
+bool routeThroughRelay(mega::HttpReq* req)
+{
+    const std::string scheme = "http://";
+    std::string& url = req->posturl;
+    if (url.compare(0, scheme.size(), scheme))
+    {
+        return false;
+    }
+
+    // the relays connect to port 80, whichever port the url has
+    size_t hostEnd = url.find_first_of(":/", scheme.size());
+    size_t pathStart = url.find('/', scheme.size());
+    std::string host = url.substr(scheme.size(), hostEnd - scheme.size());
+    if (host == "localhost")
+    {
+        return false;
+    }
+
+    if (uint16_t port = relays->port(host))
+    {
+        url = "http://localhost:" + std::to_string(port) + (pathStart == std::string::npos ? std::string() : url.substr(pathStart));
+    }
+    return false;
+}
+
+double processCpuSeconds()
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+    {
+        return 0;
+    }
+    auto seconds = [](const FILETIME& t) { return double((uint64_t(t.dwHighDateTime) << 32) | t.dwLowDateTime) / 1e7; };
+    return seconds(kernel) + seconds(user);
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return double(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + double(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+#endif
+}
+
+double peakRssMB()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return double(counters.PeakWorkingSetSize) / (1024 * 1024);
+    }
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return double(usage.ru_maxrss) / (1024 * 1024);
+#else
+    return double(usage.ru_maxrss) / 1024;
+#endif
+#endif
+}
+
+// the same bytes on every run, so that runs compare
+bool writeFile(const std::string& path, int megabytes)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    std::mt19937 rng(42);
+    std::vector<uint32_t> block(256 * 1024 / sizeof(uint32_t));
+    for (int i = 0; i < 4 * megabytes && file; ++i)
+    {
+        for (auto& w : block)
+        {
+            w = rng();
+        }
+        file.write(reinterpret_cast<const char*>(block.data()), std::streamsize(block.size() * sizeof(uint32_t)));
+    }
+    return bool(file);
+}
+
+bool succeeded(mega::SynchronousRequestListener& listener, const char* what)
+{
+    listener.wait();
+    if (listener.getError()->getErrorCode() != mega::MegaError::API_OK)
+    {
+        std::cerr << what << " failed: " << listener.getError()->getErrorString() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+struct Result
+{
+    const char* scenario;
+    int run;
+    m_off_t bytes;
+    double seconds;
+    double cpuSeconds;
+    double peakRss;
+    std::string metrics;
+};
+
+// a transfer, started by start with the listener to wait for
+bool measure(mega::MegaApi& api, const char* scenario, int run, const std::function<void(mega::MegaTransferListener*)>& start, std::vector<Result>& results, mega::MegaHandle* uploaded = nullptr)
+{
+    mega::SynchronousTransferListener listener;
+
+    double cpu = processCpuSeconds() - relays->cpuSeconds();
+    auto began = Clock::now();
+    start(&listener);
+    listener.wait();
+
+    Result r;
+    r.scenario = scenario;
+    r.run = run;
+    r.seconds = std::chrono::duration<double>(Clock::now() - began).count();
+    r.cpuSeconds = processCpuSeconds() - relays->cpuSeconds() - cpu;
+    r.peakRss = peakRssMB();
+
+    if (listener.getError()->getErrorCode() != mega::MegaError::API_OK)
+    {
+        std::cerr << scenario << " failed: " << listener.getError()->getErrorString() << std::endl;
+        return false;
+    }
+    r.bytes = listener.getTransfer()->getTotalBytes();
+    if (uploaded)
+    {
+        *uploaded = listener.getTransfer()->getNodeHandle();
+    }
+
+    // exec() and the rest since the SDK started, as getMetrics() has them
+    std::unique_ptr<char[]> metrics(api.getMetrics());
+    r.metrics = metrics ? metrics.get() : "{}";
+
+    double mb = double(r.bytes) / (1024 * 1024);
+    std::cout << scenario << " " << run << ": " << mb / std::max(r.seconds, 1e-9) << " MB/s, "
+              << r.cpuSeconds * 1024 / std::max(mb, 1e-9) << " s of cpu per GB, peak RSS " << r.peakRss << " MB" << std::endl;
+
+    results.push_back(std::move(r));
+    return true;
+}
+
+std::string tojson(const Options& options, const std::vector<Result>& results)
+{
+    std::ostringstream s;
+    s << "{\"sdk\":\"" << MEGA_MAJOR_VERSION << "." << MEGA_MINOR_VERSION << "." << MEGA_MICRO_VERSION << "\","
+      << "\"options\":{\"size\":" << options.size << ",\"runs\":" << options.runs << ",\"rtt\":" << options.rtt
+      << ",\"loss\":" << options.loss << ",\"bandwidth\":" << options.bandwidth << "},\"results\":[";
+
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const Result& r = results[i];
+        double mb = double(r.bytes) / (1024 * 1024);
+        s << (i ? "," : "") << "{\"scenario\":\"" << r.scenario << "\",\"run\":" << r.run << ",\"bytes\":" << r.bytes
+          << ",\"seconds\":" << r.seconds << ",\"mbps\":" << mb / std::max(r.seconds, 1e-9)
+          << ",\"cpupergb\":" << r.cpuSeconds * 1024 / std::max(mb, 1e-9) << ",\"peakrss\":" << r.peakRss
+          << ",\"metrics\":" << r.metrics << "}";
+    }
+    s << "]}";
+    return s.str();
+}
+
+bool parse(int argc, char* argv[], Options& options)
+{
+    struct Option
+    {
+        const char* name;
+        int* value;
+    };
+    Option known[] = {
+        { "--size=", &options.size },
+        { "--runs=", &options.runs },
+        { "--rtt=", &options.rtt },
+        { "--loss=", &options.loss },
+        { "--bandwidth=", &options.bandwidth },
+    };
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool found = false;
+        for (auto& o : known)
+        {
+            size_t len = strlen(o.name);
+            if (!strncmp(argv[i], o.name, len))
+            {
+                *o.value = atoi(argv[i] + len);
+                found = *o.value >= 0;
+            }
+        }
+        if (!strncmp(argv[i], "--output=", 9))
+        {
+            options.output = argv[i] + 9;
+            found = !options.output.empty();
+        }
+        if (!found)
+        {
+            std::cerr << "Usage: " << argv[0] << " [--size=MB] [--runs=N] [--rtt=MS] [--loss=PERMILLE] [--bandwidth=BYTESPERSEC] [--output=FILE]" << std::endl
+                      << "Logs in as MEGA_EMAIL with MEGA_PWD, and uploads and downloads a file of that size" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+} // anonymous
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parse(argc, argv, options) || !getenv("MEGA_EMAIL") || !getenv("MEGA_PWD"))
+    {
+        if (!getenv("MEGA_EMAIL") || !getenv("MEGA_PWD"))
+        {
+            std::cerr << "Set MEGA_EMAIL and MEGA_PWD to the account to transfer with" << std::endl;
+        }
+        return 1;
+    }
+
+    // as tcprelay's commands speed, latency and loss do
+    g_showrequest = false;
+    g_overallspeed = options.bandwidth ? uint64_t(options.bandwidth) : 1000000000;
+    g_latencyms = unsigned(options.rtt / 2);
+    g_losspermille = unsigned(options.loss);
+
+    Relays shaped(1u << 30);
+    relays = &shaped;
+    mega::globalMegaTestHooks.onHttpReqPost = routeThroughRelay;
+
+    const std::string localFile = "transfer_benchmark_" + std::to_string(options.size) + "MB.bin";
+    const std::string downloadFile = "transfer_benchmark_download.bin";
+    if (!writeFile(localFile, options.size))
+    {
+        std::cerr << "Unable to write " << localFile << std::endl;
+        return 1;
+    }
+
+    mega::MegaApi::setLogLevel(mega::MegaApi::LOG_LEVEL_ERROR);
+    mega::MegaApi api(APP_KEY, ".", "TransferBenchmark");
+
+    mega::SynchronousRequestListener login, fetch;
+    api.login(getenv("MEGA_EMAIL"), getenv("MEGA_PWD"), &login);
+    if (!succeeded(login, "Login"))
+    {
+        return 1;
+    }
+    api.fetchNodes(&fetch);
+    if (!succeeded(fetch, "Fetching the nodes"))
+    {
+        return 1;
+    }
+    std::unique_ptr<mega::MegaNode> root(api.getRootNode());
+
+    std::vector<Result> results;
+    bool ok = true;
+    for (int run = 0; run < options.runs && ok; ++run)
+    {
+        mega::MegaHandle uploaded = mega::INVALID_HANDLE;
+        std::string name = "transfer_benchmark_" + std::to_string(run) + ".bin";
+
+        ok = measure(api, "upload", run, [&](mega::MegaTransferListener* l) { api.startUpload(localFile.c_str(), root.get(), name.c_str(), l); }, results, &uploaded);
+
+        std::unique_ptr<mega::MegaNode> node(api.getNodeByHandle(uploaded));
+        ok = ok && node && measure(api, "download", run, [&](mega::MegaTransferListener* l) { api.startDownload(node.get(), downloadFile.c_str(), l); }, results);
+
+        if (node)
+        {
+            mega::SynchronousRequestListener removed;
+            api.remove(node.get(), &removed);
+            succeeded(removed, "Removing the file uploaded");
+        }
+    }
+
+    std::ofstream(options.output) << tojson(options, results) << std::endl;
+    std::cout << "Results in " << options.output << std::endl;
+
+    mega::globalMegaTestHooks.onHttpReqPost = nullptr;
+    relays = nullptr;
+    return ok ? 0 : 1;
+}
+
+#else
+
+int main()
+{
+    std::cerr << "The SDK was built without DEBUG, which the test hooks that route the transfers need" << std::endl;
+    return 1;
+}
+
+#endif
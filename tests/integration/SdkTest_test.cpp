@@ -4261,6 +4261,74 @@ TEST_F(SdkTest, SdkTestCloudraidTransferWithSingleChannelTimeouts)
 
 
 
+/**
+* @brief TEST_F SdkTestUploadResumesAfterRestart
+*
+* - Upload a large file slowly, and destroy the megaApi object part way through, as if the process was killed
+* - Recreate it and resume the session: the upload continues from the chunks already acknowledged, not from the start
+*
+*/
+TEST_F(SdkTest, SdkTestUploadResumesAfterRestart)
+{
+    LOG_info << "___TEST Upload resumes after restart___";
+    ASSERT_NO_FATAL_FAILURE(getAccountsForTest(1));
+
+    std::unique_ptr<MegaNode> rootnode{megaApi[0]->getRootNode()};
+    deleteFile(UPFILE);
+    createFile(UPFILE, true);
+    int64_t filesize = static_cast<int64_t>(fs::file_size(fs::u8path(UPFILE)));
+
+    megaApi[0]->setMaxUploadSpeed(filesize / 30); // should take 30 seconds, not counting the restart
+    std::string sessionId = megaApi[0]->dumpSession();
+
+    onTransferUpdate_progress = 0;
+    onTransferUpdate_filesize = 0;
+    mApi[0].transferFlags[MegaTransfer::TYPE_UPLOAD] = false;
+    megaApi[0]->startUpload(UPFILE.c_str(), rootnode.get());
+
+    second_timer t;
+    while (t.elapsed() < 60 && onTransferUpdate_progress < filesize / 3)
+    {
+        WaitMillisec(100);
+    }
+    ASSERT_GE(onTransferUpdate_progress, filesize / 3) << "Upload made no progress before the restart";
+    ASSERT_FALSE(mApi[0].transferFlags[MegaTransfer::TYPE_UPLOAD]) << "Upload finished before the restart";
+
+    // no logout: whatever the transfer cache holds at this point is what a new process finds
+    megaApi[0].reset();
+    WaitMillisec(100);
+
+    onTransferUpdate_progress = 0;
+    onTransferUpdate_filesize = 0;
+    megaApi[0].reset(new MegaApi(APP_KEY.c_str(), megaApiCacheFolder(0).c_str(), USER_AGENT.c_str(), unsigned(THREADS_PER_MEGACLIENT)));
+    mApi[0].megaApi = megaApi[0].get();
+    megaApi[0]->addListener(this);
+    megaApi[0]->setMaxUploadSpeed(filesize / 30);
+
+    ASSERT_NO_FATAL_FAILURE(resumeSession(sessionId.c_str()));
+    ASSERT_NO_FATAL_FAILURE(fetchnodes(0));
+
+    // the first progress reported after the restart already counts the acknowledged chunks
+    t.reset();
+    while (t.elapsed() < 60 && !onTransferUpdate_progress)
+    {
+        WaitMillisec(10);
+    }
+    ASSERT_GT(onTransferUpdate_progress, 0) << "Upload did not resume";
+    ASSERT_GE(onTransferUpdate_progress, filesize / 6) << "Upload restarted from the beginning";
+
+    ASSERT_TRUE(waitForResponse(&mApi[0].transferFlags[MegaTransfer::TYPE_UPLOAD], 600))
+        << "Resumed upload failed after " << 600 << " seconds";
+    ASSERT_EQ(MegaError::API_OK, mApi[0].lastError) << "Cannot finish the resumed upload (error: " << mApi[0].lastError << ")";
+
+    std::unique_ptr<MegaNode> n1{megaApi[0]->getNodeByHandle(mApi[0].h)};
+    ASSERT_NE(n1.get(), nullptr);
+    ASSERT_EQ(filesize, n1->getSize());
+
+    megaApi[0]->setMaxUploadSpeed(-1);
+}
+
+
 /**
 * @brief TEST_F SdkTestOverquotaNonCloudraid
 *
@@ -0,0 +1,83 @@
+/**
+ * @file tests/tool/logdecode.cpp
+ * @brief A helper tool to turn the binary logs of RotativePerformanceLogger into text
+ *
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+#include <iostream>
+#include <string>
+
+#include <zlib.h>
+
+#include "mega/binarylog.h"
+
+using namespace mega;
+
+// the whole file, whether it is the current log or a rotated .gz one
+static bool readLog(const char* path, std::string& data)
+{
+    gzFile f = gzopen(path, "rb");
+    if (!f)
+    {
+        return false;
+    }
+
+    char buffer[65536];
+    int n;
+    while ((n = gzread(f, buffer, sizeof buffer)) > 0)
+    {
+        data.append(buffer, size_t(n));
+    }
+    gzclose(f);
+    return n == 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <log.bin | log.bin.<timestamp>.gz>..." << std::endl;
+        return 1;
+    }
+
+    int result = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string data;
+        if (!readLog(argv[i], data))
+        {
+            std::cerr << "Unable to read " << argv[i] << std::endl;
+            result = 1;
+            continue;
+        }
+
+        BinaryLog::Reader reader(data.data(), data.size());
+        if (!reader.valid())
+        {
+            std::cerr << argv[i] << " is not a binary log" << std::endl;
+            result = 1;
+            continue;
+        }
+
+        BinaryLog::Record r;
+        while (reader.next(r))
+        {
+            std::cout << reader.format(r);
+        }
+    }
+    return result;
+}
@@ -604,6 +604,17 @@ void exec_speed(ac::ACState& s)
     g_overallspeed = unsigned(atoi(s.words[1].s.c_str()));
 }
 
+void exec_latency(ac::ACState& s)
+{
+    g_latencyms = unsigned(atoi(s.words[1].s.c_str()));
+    cout << "Round trip adds " << 2 * g_latencyms << " ms" << endl;
+}
+
+void exec_loss(ac::ACState& s)
+{
+    g_losspermille = unsigned(atoi(s.words[1].s.c_str()));
+}
+
 ac::ACN autocompleteSyntax()
 {
     using namespace autocomplete;
@@ -627,6 +638,8 @@ ac::ACN autocompleteSyntax()
     p->Add(exec_showrequest, sequence(text("showrequest"), opt(either(text("on"), text("off")))));
     p->Add(exec_showreply, sequence(text("showreply"), opt(either(text("on"), text("off")))));
     p->Add(exec_speed, sequence(text("speed"), param("bytespersec")));
+    p->Add(exec_latency, sequence(text("latency"), param("millisec-each-way")));
+    p->Add(exec_loss, sequence(text("loss"), param("permille")));
 
     p->Add(exec_report, sequence(text("report")));
     p->Add(exec_help, sequence(either(text("help"), text("?"))));
@@ -745,7 +758,8 @@ void Sleep(unsigned int ms)
 
 #endif /* ! _WIN32 */
 
-int main()
+// each argument is a command run at startup, eg: tcprelay "latency 50" "loss 5" adddefaultrelays
+int main(int argc, char* argv[])
 {
     ofstream mylog("tcprelaylog.txt");
     logstream = &mylog;
@@ -782,6 +796,16 @@ int main()
 
     std::thread relayRunnerThread([&]() { g_relays.RunRelays(); });
 
+    for (int i = 1; i < argc; ++i)
+    {
+        string consoleOutput;
+        autoExec(argv[i], strlen(argv[i]), autocompleteTemplate, false, consoleOutput, true);
+        if (!consoleOutput.empty())
+        {
+            cout << consoleOutput << endl;
+        }
+    }
+
     while (!g_exitprogram)
     {
 #if defined(WIN32) && defined(NO_READLINE)
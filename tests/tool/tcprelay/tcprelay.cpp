@@ -21,6 +21,7 @@
 
 #include "tcprelay.h"
 #include <functional>
+#include <random>
 #include <regex>
 #include <iostream>
 #include <sys/timeb.h>
@@ -32,6 +33,11 @@ std::ostream* logstream = nullptr;
 bool g_showreplyheaders = false;
 bool g_showrequest = true;
 uint64_t g_overallspeed = 1000000000;
+unsigned g_latencyms = 0;
+unsigned g_losspermille = 0;
+
+// the same losses on each run, for benchmarks to compare
+static std::mt19937 s_lossrng(42);
 
 atomic<unsigned> TcpRelay::Side::s_activesenders(0);
 BucketCountArray<30> TcpRelay::s_send_rate_all_buckets;
@@ -256,6 +262,7 @@ void TcpRelay::ReceiveHandler(Direction& d, const asio::error_code& ec, std::siz
             //LOGF("received %d bytes, passing them on", (int)bytes_received);
         }
         d.circular_buf.CommitNewHeadBytes(bytes_received);
+        DelayArrival(d, bytes_received);
         if (!d.outgoing.send_in_progress)
             StartSending(d);
         StartReceiving(d);  
@@ -277,6 +284,34 @@ void TcpRelay::RestartSending(Direction& d, const asio::error_code& ec)
     }
 }
 
+void TcpRelay::DelayArrival(Direction& d, size_t bytes)
+{
+    auto due = std::chrono::steady_clock::now() + std::chrono::milliseconds(g_latencyms);
+
+    // a lost segment arrives again after a round trip, or the minimum retransmission timeout.
+    // What came after it waits for it, as TCP delivers in order
+    if (g_losspermille && s_lossrng() % 1000 < g_losspermille)
+    {
+        due += std::chrono::milliseconds(std::max(2 * g_latencyms, 200u));
+    }
+    if (!d.arrivals.empty() && d.arrivals.back().due > due)
+    {
+        due = d.arrivals.back().due;
+    }
+    d.arrivals.push_back({ due, bytes });
+}
+
+size_t TcpRelay::DueBytes(Direction& d)
+{
+    auto now = std::chrono::steady_clock::now();
+    while (!d.arrivals.empty() && d.arrivals.front().due <= now)
+    {
+        d.due_bytes += d.arrivals.front().bytes;
+        d.arrivals.pop_front();
+    }
+    return d.due_bytes;
+}
+
 void TcpRelay::StartSending(Direction& d, bool restarted)
 {
     if (stopped) return;
@@ -305,6 +340,15 @@ void TcpRelay::StartSending(Direction& d, bool restarted)
 
     auto range = d.circular_buf.PeekTailBytes(sendrate / 5 /*ReadSize*/);   // 10 shots per second so we can catch up when needed, on average we send / skip / send / skip
 
+    // nothing before it is due: the timer restarts us then
+    range.len = min(range.len, DueBytes(d));
+    if (!range.len && !d.arrivals.empty())
+    {
+        d.outgoing.send_timer.expires_at(d.arrivals.front().due);
+        d.outgoing.send_timer.async_wait([this, &d](const asio::error_code& ec) { RestartSending(d, ec); });
+        return;
+    }
+
     if (range.len > 0)
     {
         static int call_id = 0;
@@ -353,6 +397,7 @@ void TcpRelay::SendHandler(Direction& d, const asio::error_code& ec, std::size_t
         s_send_rate_all_buckets.AddToCurrentBucket(bytes_sent);
 
         d.circular_buf.RecycleTailBytes(bytes_sent);
+        d.due_bytes -= bytes_sent;
         StartSending(d);  // if any more data has arrived in the meantime, send it now
 
         if (!d.incoming.receive_in_progress)
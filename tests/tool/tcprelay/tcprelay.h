@@ -33,6 +33,8 @@ extern std::ostream* logstream;
 extern bool g_showreplyheaders;
 extern bool g_showrequest;
 extern uint64_t g_overallspeed;
+extern unsigned g_latencyms;      // added to each direction, so the round trip gets twice this
+extern unsigned g_losspermille;   // of the reads held back, as a TCP retransmission would be
 
 template <unsigned BucketCount>
 class BucketCountArray
@@ -287,6 +289,16 @@ public:
         Side& incoming;
         Side& outgoing;
         CircularBuffer<BufSize>& circular_buf;
+
+        // bytes received but not yet due to be sent on, in order, for the latency and loss
+        struct Arrival
+        {
+            std::chrono::steady_clock::time_point due;
+            size_t bytes;
+        };
+        std::deque<Arrival> arrivals;
+        size_t due_bytes = 0;
+
         Direction(const std::string& n, Side& a, Side& b, CircularBuffer<BufSize>& buf) : directionName(n), incoming(a), outgoing(b), circular_buf(buf) {}
     };
 
@@ -302,6 +314,8 @@ public:
     void ReceiveHandler(Direction& d, const asio::error_code& ec, std::size_t bytes_received);
     void RestartSending(Direction& d, const asio::error_code& ec);
     void StartSending(Direction& d, bool restarted = false);
+    void DelayArrival(Direction& d, size_t bytes);
+    size_t DueBytes(Direction& d);
     void SendHandler(Direction& d, const asio::error_code& ec, std::size_t bytes_sent, int id);
     void Pause(bool b);
 };
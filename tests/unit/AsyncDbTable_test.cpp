@@ -0,0 +1,290 @@
+/**
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+
+#include <gtest/gtest.h>
+
+#include <mega/asyncdbtable.h>
+
+#include "DefaultedDbTable.h"
+
+namespace {
+
+// what is committed only changes on commit(), which can be held until release()
+class TransactedDbTable : public mt::DefaultedDbTable
+{
+public:
+    using mt::DefaultedDbTable::DefaultedDbTable;
+
+    bool get(uint32_t id, std::string* data) override
+    {
+        auto& records = inTransaction() ? working : committed;
+        auto it = records.find(id);
+        if (it == records.end())
+        {
+            return false;
+        }
+        *data = it->second;
+        return true;
+    }
+
+    bool put(uint32_t id, char* data, unsigned size) override
+    {
+        working[id].assign(data, size);
+        workingParents.erase(id);
+        return true;
+    }
+
+    bool del(uint32_t id) override
+    {
+        working.erase(id);
+        workingParents.erase(id);
+        return true;
+    }
+
+    bool putNodeRecord(const mega::DbNodeRecord& record) override
+    {
+        working[record.id] = record.data;
+        workingParents[record.id] = record.columns.parenthandle;
+        return true;
+    }
+
+    bool getChildren(mega::handle parent, NodeRefs* refs) override
+    {
+        refs->clear();
+        for (auto& node : committedParents)
+        {
+            if (node.second == parent)
+            {
+                refs->emplace_back(node.first, node.first);  // ids double as handles here
+            }
+        }
+        return indexed;
+    }
+
+    bool nodeIndexComplete() override { return indexed; }
+    void setNodeIndexComplete() override { indexed = true; }
+
+    void rewind() override { pos = committed.begin(); }
+
+    bool next(uint32_t* id, std::string* data) override
+    {
+        if (pos == committed.end())
+        {
+            return false;
+        }
+        *id = pos->first;
+        *data = pos->second;
+        ++pos;
+        return true;
+    }
+
+    void truncate() override { working.clear(); workingParents.clear(); }
+    void begin() override { working = committed; workingParents = committedParents; transacted = true; }
+    void abort() override { transacted = false; }
+    bool inTransaction() const override { return transacted; }
+
+    void commit() override
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        committing = true;
+        condition.notify_all();
+        condition.wait(lock, [this]() { return !held; });
+
+        committed = working;
+        committedParents = workingParents;
+        transacted = false;
+        committing = false;
+        commits++;
+    }
+
+    void hold() { std::lock_guard<std::mutex> g(mutex); held = true; }
+
+    void waitForCommit()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this]() { return committing; });
+    }
+
+    void release()
+    {
+        {
+            std::lock_guard<std::mutex> g(mutex);
+            held = false;
+        }
+        condition.notify_all();
+    }
+
+    std::map<uint32_t, std::string> committed;
+    std::map<uint32_t, std::string> working;
+    std::map<uint32_t, std::string>::const_iterator pos;
+    std::map<uint32_t, mega::handle> committedParents;
+    std::map<uint32_t, mega::handle> workingParents;
+    bool indexed = false;
+    bool transacted = false;
+    int commits = 0;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool held = false;
+    bool committing = false;
+};
+
+class AsyncDbTableTest : public ::testing::Test
+{
+public:
+    AsyncDbTableTest()
+    {
+        std::unique_ptr<mega::DbTable> t(table = new TransactedDbTable(rng, false));
+        async.reset(new mega::AsyncDbTable(rng, std::move(t)));
+    }
+
+    void put(uint32_t id, std::string data)
+    {
+        ASSERT_TRUE(async->put(id, &data[0], unsigned(data.size())));
+    }
+
+    bool has(uint32_t id, const std::string& expected)
+    {
+        std::string data;
+        return async->get(id, &data) && data == expected;
+    }
+
+    mega::PrnGen rng;
+    TransactedDbTable* table;
+    std::unique_ptr<mega::AsyncDbTable> async;
+};
+
+} // anonymous
+
+TEST_F(AsyncDbTableTest, onlyCommittedChangesAreWritten)
+{
+    async->begin();
+    put(16, "a");
+    put(32, "b");
+    async->commit();
+
+    async->begin();
+    put(48, "c");
+    EXPECT_TRUE(has(16, "a"));
+    EXPECT_TRUE(has(48, "c"));
+
+    async->flush();
+    EXPECT_EQ((std::map<uint32_t, std::string>{{16, "a"}, {32, "b"}}), table->committed);
+
+    async->abort();
+    EXPECT_FALSE(has(48, "c"));
+    EXPECT_TRUE(has(32, "b"));
+}
+
+TEST_F(AsyncDbTableTest, commitsQueuedWhileWritingAreMerged)
+{
+    table->hold();
+
+    async->begin();
+    put(16, "a");
+    async->commit();
+    table->waitForCommit();
+
+    // the writer is stuck in the first commit
+    async->begin();
+    ASSERT_TRUE(async->del(16));
+    put(32, "b");
+    async->commit();
+
+    async->begin();
+    put(48, "c");
+    async->commit();
+
+    EXPECT_FALSE(has(16, "a"));
+    EXPECT_TRUE(has(32, "b"));
+    EXPECT_TRUE(has(48, "c"));
+
+    table->release();
+    async->flush();
+
+    EXPECT_EQ(2, table->commits);
+    EXPECT_EQ((std::map<uint32_t, std::string>{{32, "b"}, {48, "c"}}), table->committed);
+}
+
+TEST_F(AsyncDbTableTest, scanIncludesTheCurrentTransaction)
+{
+    async->begin();
+    put(16, "a");
+    put(32, "b");
+    async->commit();
+
+    async->begin();
+    put(32, "b2");
+    put(48, "c");
+    ASSERT_TRUE(async->del(16));
+
+    std::map<uint32_t, std::string> scanned;
+    uint32_t id;
+    std::string data;
+    async->rewind();
+    while (async->next(&id, &data))
+    {
+        scanned[id] = data;
+    }
+    EXPECT_EQ((std::map<uint32_t, std::string>{{32, "b2"}, {48, "c"}}), scanned);
+
+    async->truncate();
+    put(64, "d");
+    async->commit();
+    async->flush();
+    EXPECT_EQ((std::map<uint32_t, std::string>{{64, "d"}}), table->committed);
+}
+
+TEST_F(AsyncDbTableTest, nodeQueriesIncludeTheCurrentTransaction)
+{
+    auto node = [](uint32_t id, mega::handle parent)
+    {
+        mega::DbNodeRecord record{id, mega::DbNodeColumns(), "node"};
+        record.columns.nodehandle = id;
+        record.columns.parenthandle = parent;
+        return record;
+    };
+
+    mega::DbTable::NodeRefs refs;
+    EXPECT_FALSE(async->nodeIndexComplete());
+
+    async->begin();
+    ASSERT_TRUE(async->putNodeBatch({ node(16, 1), node(32, 1), node(48, 2) }));
+    async->setNodeIndexComplete();
+    async->commit();
+
+    async->begin();
+    ASSERT_TRUE(async->del(16));
+    ASSERT_TRUE(async->putNodeRecord(node(48, 1)));
+    ASSERT_TRUE(async->putNodeRecord(node(64, 1)));
+    put(32, "no longer a node with columns");
+
+    ASSERT_TRUE(async->getChildren(1, &refs));
+    std::sort(refs.begin(), refs.end());
+    EXPECT_EQ((mega::DbTable::NodeRefs{{48, 48}, {64, 64}}), refs);
+    async->commit();
+
+    async->flush();
+    EXPECT_TRUE(table->indexed);
+    EXPECT_EQ((std::map<uint32_t, mega::handle>{{48, 1}, {64, 1}}), table->committedParents);
+}
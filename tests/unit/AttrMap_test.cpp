@@ -58,4 +58,39 @@ TEST(AttrMap, unserialize_32bit)
 
     ASSERT_EQ(expMap.map, newMap.map);
 }
-#endif
\ No newline at end of file
+#endif
+TEST(AttrMap, flatMapKeepsNamesSorted)
+{
+    mega::attr_map map;
+    map['n'] = "name";
+    map['c'] = "fingerprint";
+    EXPECT_TRUE(map.emplace('l', "1").second);
+    EXPECT_FALSE(map.emplace('n', "other").second);
+    EXPECT_EQ("name", map['n']);
+
+    std::vector<mega::nameid> names;
+    for (auto& it : map)
+    {
+        names.push_back(it.first);
+    }
+    EXPECT_EQ((std::vector<mega::nameid>{'c', 'l', 'n'}), names);
+
+    EXPECT_EQ(1u, map.erase('l'));
+    EXPECT_EQ(0u, map.erase('l'));
+    EXPECT_EQ(map.end(), map.find('l'));
+    EXPECT_EQ((mega::attr_map{{'n', "name"}, {'c', "fingerprint"}}), map);
+}
+
+TEST(AttrMap, appendjson)
+{
+    mega::AttrMap map;
+    map.map['n'] = "name";
+    map.map[mega::AttrMap::string2nameid("fav")] = "1";
+
+    std::string json;
+    map.getjson(&json);
+
+    std::string appended = "MEGA{";
+    map.appendjson(&appended);
+    EXPECT_EQ("MEGA{" + json, appended);
+}
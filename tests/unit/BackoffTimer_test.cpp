@@ -0,0 +1,196 @@
+/**
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <memory>
+#include <random>
+#include <set>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <mega/backofftimer.h>
+#include <mega/waiter.h>
+
+using mega::dstime; // for NEVER
+
+namespace {
+
+std::set<mega::TimerWheel::Entry*> due(const mega::TimerWheel& wheel)
+{
+    std::set<mega::TimerWheel::Entry*> entries;
+    wheel.due([&](mega::TimerWheel::Entry* e) { entries.insert(e); });
+    return entries;
+}
+
+} // anonymous
+
+TEST(TimerWheel, entriesBecomeDueAtTheirDeadline)
+{
+    mega::TimerWheel wheel(1000);
+    mega::TimerWheel::Entry soon(nullptr), later(nullptr), farAway(nullptr), past(nullptr);
+
+    wheel.add(&soon, 1010);
+    wheel.add(&later, 1000 + 5000);
+    wheel.add(&farAway, 1000 + (1 << 25));
+    wheel.add(&past, 10);
+    EXPECT_EQ(4u, wheel.size());
+
+    // what is already due is so right away
+    EXPECT_EQ(std::set<mega::TimerWheel::Entry*>({ &past }), due(wheel));
+    EXPECT_EQ(1000u, wheel.next());
+    wheel.remove(&past);
+    EXPECT_EQ(1010u, wheel.next());
+
+    wheel.advance(1009);
+    EXPECT_TRUE(due(wheel).empty());
+    wheel.advance(1010);
+    EXPECT_EQ(std::set<mega::TimerWheel::Entry*>({ &soon }), due(wheel));
+    wheel.remove(&soon);
+
+    // the higher levels ask to be advanced when their slot comes, a little early
+    auto next = wheel.next();
+    EXPECT_GT(next, 1010u);
+    EXPECT_LE(next, 6000u);
+
+    wheel.advance(5999);
+    EXPECT_TRUE(due(wheel).empty());
+    EXPECT_EQ(6000u, wheel.next());
+    wheel.advance(6000);
+    EXPECT_EQ(std::set<mega::TimerWheel::Entry*>({ &later }), due(wheel));
+
+    // removed and added again later, it moves
+    wheel.add(&later, 7000);
+    EXPECT_TRUE(due(wheel).empty());
+
+    // beyond the top level, and in a single jump
+    wheel.advance(1000 + (1 << 25) + 100);
+    EXPECT_EQ(std::set<mega::TimerWheel::Entry*>({ &later, &farAway }), due(wheel));
+
+    wheel.remove(&later);
+    wheel.remove(&farAway);
+    wheel.remove(&farAway);
+    EXPECT_EQ(0u, wheel.size());
+    EXPECT_EQ(NEVER, wheel.next());
+}
+
+TEST(TimerWheel, matchesTheDeadlinesOfManyEntries)
+{
+    std::mt19937 rng(42);
+    mega::dstime now = 123456;
+    mega::TimerWheel wheel(now);
+
+    std::vector<std::unique_ptr<mega::TimerWheel::Entry>> entries;
+    for (int i = 0; i < 2000; ++i)
+    {
+        entries.emplace_back(new mega::TimerWheel::Entry(nullptr));
+    }
+
+    auto randomDelay = [&rng]() -> mega::dstime
+    {
+        // from tenths of seconds to weeks
+        return mega::dstime(rng() % (mega::dstime(1) << (rng() % 25)));
+    };
+
+    for (int round = 0; round < 500; ++round)
+    {
+        // some are (re)scheduled or cancelled, wherever they are
+        for (int i = 0; i < 50; ++i)
+        {
+            auto& e = entries[rng() % entries.size()];
+            if (rng() % 4)
+            {
+                wheel.add(e.get(), now + randomDelay());
+            }
+            else
+            {
+                wheel.remove(e.get());
+            }
+        }
+
+        now += randomDelay() / 16;
+        wheel.advance(now);
+
+        std::set<mega::TimerWheel::Entry*> expected;
+        mega::dstime earliest = NEVER;
+        size_t linked = 0;
+        for (auto& e : entries)
+        {
+            if (e->linked())
+            {
+                linked++;
+                if (e->deadline() <= now)
+                {
+                    expected.insert(e.get());
+                }
+                else
+                {
+                    earliest = std::min(earliest, e->deadline());
+                }
+            }
+        }
+
+        ASSERT_EQ(linked, wheel.size());
+        ASSERT_EQ(expected, due(wheel));
+
+        // never late, and once the due ones are gone, never earlier than now
+        auto next = wheel.next();
+        ASSERT_LE(next, expected.empty() ? earliest : now);
+        ASSERT_GE(next, now);
+    }
+}
+
+TEST(BackoffTimerGroupTracker, wakesUpForTheSoonestTimer)
+{
+    mega::PrnGen rng;
+    mega::BackoffTimerGroupTracker tracker;
+    mega::Waiter::ds = 100000;
+
+    mega::BackoffTimerTracked a(rng, tracker), b(rng, tracker);
+    a.backoff(50);
+    b.backoff(20);
+    EXPECT_EQ(2u, tracker.size());
+
+    mega::dstime waituntil = NEVER;
+    tracker.update(&waituntil, true);
+    EXPECT_EQ(100020u, waituntil);
+
+    // a transfer's timer fires once, then it is out of the group
+    mega::Waiter::ds += 20;
+    waituntil = NEVER;
+    tracker.update(&waituntil, true);
+    EXPECT_EQ(0u, waituntil);
+    EXPECT_TRUE(b.armed());
+    EXPECT_EQ(1u, tracker.size());
+
+    // the other one's, possibly a little early at first
+    waituntil = NEVER;
+    tracker.update(&waituntil, true);
+    EXPECT_GT(waituntil, mega::Waiter::ds);
+    EXPECT_LE(waituntil, 100050u);
+
+    mega::Waiter::ds = waituntil;
+    waituntil = NEVER;
+    tracker.update(&waituntil, true);
+    EXPECT_EQ(100050u, waituntil);
+
+    // and disabled timers are left out
+    a.enable(false);
+    EXPECT_EQ(0u, tracker.size());
+    a.enable(true);
+    EXPECT_EQ(1u, tracker.size());
+}
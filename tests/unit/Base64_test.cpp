@@ -0,0 +1,202 @@
+/**
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include <mega/base64.h>
+
+namespace {
+
+using mega::byte;
+
+// restores the default codec on scope exit
+class CodecMode
+{
+public:
+    explicit CodecMode(bool vector)
+        : mPrevious(mega::Base64::vectorcodec)
+    {
+        mega::Base64::vectorcodec = vector;
+    }
+
+    ~CodecMode()
+    {
+        mega::Base64::vectorcodec = mPrevious;
+    }
+
+private:
+    bool mPrevious;
+};
+
+// the codec one character at a time, as it was before the tables and vectors
+std::string referenceBtoa(const std::string& in)
+{
+    const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    const byte* b = reinterpret_cast<const byte*>(in.data());
+    int blen = int(in.size());
+    std::string a;
+
+    while (blen > 0)
+    {
+        a += alphabet[(*b >> 2) & 63];
+        a += alphabet[((*b << 4) | (((blen > 1) ? b[1] : 0) >> 4)) & 63];
+        if (blen < 2) break;
+        a += alphabet[(b[1] << 2 | (((blen > 2) ? b[2] : 0) >> 6)) & 63];
+        if (blen < 3) break;
+        a += alphabet[b[2] & 63];
+        blen -= 3;
+        b += 3;
+    }
+    return a;
+}
+
+byte referenceFrom64(byte c)
+{
+    if (c >= 'A' && c <= 'Z') return byte(c - 'A');
+    if (c >= 'a' && c <= 'z') return byte(c - 'a' + 26);
+    if (c >= '0' && c <= '9') return byte(c - '0' + 52);
+    if (c == '-' || c == '+') return 62;
+    if (c == '_' || c == '/') return 63;
+    return 255;
+}
+
+std::string referenceAtob(const char* a, int blen)
+{
+    byte c[4];
+    int i;
+    std::string b;
+
+    c[3] = 0;
+
+    for (;;)
+    {
+        for (i = 0; i < 4; i++)
+        {
+            if ((c[i] = referenceFrom64(byte(*a++))) == 255) break;
+        }
+        if (int(b.size()) >= blen || !i) return b;
+        b += char((c[0] << 2) | ((c[1] & 0x30) >> 4));
+        if (int(b.size()) >= blen || i < 3) return b;
+        b += char((c[1] << 4) | ((c[2] & 0x3c) >> 2));
+        if (int(b.size()) >= blen || i < 4) return b;
+        b += char((c[2] << 6) | c[3]);
+    }
+}
+
+std::string randomBytes(std::mt19937& rng, size_t len)
+{
+    std::string s(len, 0);
+    for (auto& c : s)
+    {
+        c = char(rng());
+    }
+    return s;
+}
+
+std::string atob(const std::string& a, int blen)
+{
+    std::string b(size_t(blen), 0);
+    b.resize(size_t(mega::Base64::atob(a.c_str(), reinterpret_cast<byte*>(&b[0]), blen)));
+    return b;
+}
+
+} // anonymous
+
+TEST(Base64, encodeMatchesReference)
+{
+    std::mt19937 rng(42);
+    for (size_t len = 0; len < 200; ++len)
+    {
+        auto data = randomBytes(rng, len);
+        auto expected = referenceBtoa(data);
+        for (bool vector : { false, true })
+        {
+            CodecMode mode(vector);
+            ASSERT_EQ(expected, mega::Base64::btoa(data)) << "length " << len << (vector ? ", vector" : "");
+        }
+    }
+}
+
+TEST(Base64, decodeMatchesReference)
+{
+    std::mt19937 rng(42);
+    const std::string others = "+/=\" .\x80\xff";
+
+    for (size_t len = 0; len < 200; ++len)
+    {
+        std::string a = referenceBtoa(randomBytes(rng, len));
+
+        // the standard characters are read too, and anything else ends the string
+        std::string variants[3] = { a, a, a };
+        std::replace(variants[1].begin(), variants[1].end(), '-', '+');
+        std::replace(variants[1].begin(), variants[1].end(), '_', '/');
+        if (!a.empty())
+        {
+            variants[2][rng() % a.size()] = others[rng() % others.size()];
+        }
+
+        for (auto& v : variants)
+        {
+            // and the output buffer can be shorter than the data
+            for (int blen : { int(len) + 3, int(len), int(len / 2) + 1 })
+            {
+                auto expected = referenceAtob(v.c_str(), blen);
+                for (bool vector : { false, true })
+                {
+                    CodecMode mode(vector);
+                    ASSERT_EQ(expected, atob(v, blen)) << v << ", " << blen << " bytes" << (vector ? ", vector" : "");
+                }
+            }
+        }
+    }
+}
+
+TEST(Base64, speed)
+{
+    std::mt19937 rng(42);
+
+    // a large attribute blob, and the handles of a fetchnodes
+    auto blob = randomBytes(rng, 1024 * 1024);
+    auto handle = randomBytes(rng, 6);
+
+    using clock = std::chrono::steady_clock;
+
+    auto rate = [&](const std::string& data, int rounds, bool vector)
+    {
+        CodecMode mode(vector);
+        std::string a, b;
+
+        auto start = clock::now();
+        for (int i = 0; i < rounds; ++i)
+        {
+            mega::Base64::btoa(data, a);
+            mega::Base64::atob(a, b);
+        }
+        double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        EXPECT_EQ(data, b);
+        return double(data.size()) * rounds / std::max(seconds, 1e-9) / (1024 * 1024);
+    };
+
+    std::cout << "[          ] base64 of 1 MB and back: tables " << rate(blob, 20, false) << " MB/s, vector " << rate(blob, 20, true) << " MB/s" << std::endl;
+    std::cout << "[          ] base64 of handles and back: " << rate(handle, 1000000, true) << " MB/s" << std::endl;
+}
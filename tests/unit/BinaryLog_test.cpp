@@ -0,0 +1,167 @@
+/**
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <mega/binarylog.h>
+#include <mega/logging.h>
+
+namespace {
+
+std::vector<mega::BinaryLog::Record> read(const std::string& data)
+{
+    mega::BinaryLog::Reader reader(data.data(), data.size());
+    EXPECT_TRUE(reader.valid());
+
+    std::vector<mega::BinaryLog::Record> records;
+    mega::BinaryLog::Record r;
+    while (reader.next(r))
+    {
+        records.push_back(r);
+    }
+    return records;
+}
+
+} // anonymous
+
+TEST(BinaryLog, ringWrapsAround)
+{
+    mega::BinaryLogRing ring(64);
+    std::string out;
+
+    // pushed and drained a few times, the records cross its end
+    for (int i = 0; i < 10; ++i)
+    {
+        std::string record(20, char('a' + i));
+        mega::BinaryLogRing::Piece pieces[] = { { record.data(), 5 }, { record.data() + 5, 15 } };
+        ASSERT_TRUE(ring.push(pieces, 2));
+        ASSERT_EQ(20u, ring.pending());
+
+        out.clear();
+        EXPECT_EQ(20u, ring.drain(out, 1));
+        EXPECT_EQ(record, out);
+    }
+
+    // and what doesn't fit is dropped whole
+    std::string record(40, 'x');
+    mega::BinaryLogRing::Piece piece = { record.data(), record.size() };
+    EXPECT_TRUE(ring.push(&piece, 1));
+    EXPECT_FALSE(ring.push(&piece, 1));
+    EXPECT_EQ(40u, ring.pending());
+}
+
+TEST(BinaryLog, writesAndReadsTheMessagesOfEachThread)
+{
+    mega::BinaryLogWriter writer;
+    std::string file = mega::BinaryLogWriter::header() + mega::BinaryLogWriter::message(mega::logInfo, "program start");
+
+    writer.log(mega::logWarning, "first");
+    std::thread([&]() { writer.log(mega::logDebug, "other thread"); }).join();
+
+    const char* pieces[] = { "in ", "pieces" };
+    size_t sizes[] = { 3, 6 };
+    writer.log(mega::logError, nullptr, pieces, sizes, 2);
+    writer.drain(file);
+
+    auto records = read(file);
+    ASSERT_EQ(6u, records.size());
+
+    EXPECT_EQ(mega::BinaryLog::MESSAGE, records[0].type);
+    EXPECT_EQ(0, records[0].thread);
+    EXPECT_EQ("program start", records[0].text);
+
+    EXPECT_EQ(mega::BinaryLog::THREAD, records[1].type);
+    EXPECT_EQ(1, records[1].thread);
+    EXPECT_EQ("first", records[2].text);
+    EXPECT_EQ(mega::logWarning, records[2].level);
+    EXPECT_EQ(1, records[2].thread);
+    EXPECT_EQ("in pieces", records[3].text);
+
+    EXPECT_EQ(mega::BinaryLog::THREAD, records[4].type);
+    EXPECT_EQ(2, records[5].thread);
+    EXPECT_EQ("other thread", records[5].text);
+    EXPECT_EQ(mega::logDebug, records[5].level);
+    EXPECT_NE(0u, records[5].us);
+
+    // a new file names all the threads again, and a file appended by another run reads on
+    file += mega::BinaryLogWriter::header();
+    writer.log(mega::logInfo, "second run");
+    writer.drain(file, true);
+
+    records = read(file);
+    ASSERT_EQ(9u, records.size());
+    EXPECT_EQ(mega::BinaryLog::THREAD, records[6].type);
+    EXPECT_EQ("second run", records[7].text);
+    EXPECT_EQ(mega::BinaryLog::THREAD, records[8].type);
+    EXPECT_EQ(2, records[8].thread);
+}
+
+TEST(BinaryLog, recordsTheMessagesDropped)
+{
+    mega::BinaryLogWriter writer(256);
+    std::string file = mega::BinaryLogWriter::header();
+
+    for (int i = 0; i < 20; ++i)
+    {
+        writer.log(mega::logInfo, "a message of some length");
+    }
+    writer.drain(file);
+
+    // the name of the thread, the messages that fit, and how many didn't
+    auto records = read(file);
+    ASSERT_EQ(8u, records.size());
+    auto& gap = records.back();
+    EXPECT_EQ(mega::BinaryLog::GAP, gap.type);
+    EXPECT_EQ(14u, gap.dropped);
+
+    // and long messages are cut to fit
+    writer.log(mega::logInfo, std::string(1000, 'x').c_str());
+    file = mega::BinaryLogWriter::header();
+    writer.drain(file);
+    records = read(file);
+    ASSERT_EQ(1u, records.size());
+    EXPECT_EQ(std::string(64, 'x'), records[0].text);
+}
+
+TEST(BinaryLog, formatsAsTheTextLogs)
+{
+    std::string file = mega::BinaryLogWriter::header();
+    mega::BinaryLogWriter writer;
+    writer.log(mega::logWarning, "low disk");
+    writer.drain(file);
+
+    mega::BinaryLog::Reader reader(file.data(), file.size());
+    mega::BinaryLog::Record r;
+    ASSERT_TRUE(reader.next(r));
+    std::string thread = r.text;
+    ASSERT_TRUE(reader.next(r));
+
+    // 14/10/26-10:20:30.123456 <thread> WARN low disk
+    auto line = reader.format(r);
+    ASSERT_EQ(25u + thread.size() + 1 + 5 + 9, line.size());
+    EXPECT_EQ('/', line[2]);
+    EXPECT_EQ('.', line[17]);
+    EXPECT_EQ(thread + " WARN low disk\n", line.substr(25));
+
+    r.type = mega::BinaryLog::GAP;
+    r.dropped = 3;
+    EXPECT_EQ("<log gap - 3 messages of " + thread + " dropped at this point>\n", reader.format(r));
+}
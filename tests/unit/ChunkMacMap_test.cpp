@@ -89,3 +89,72 @@ TEST(ChunkMacMap, unserialize_32bit)
     ASSERT_TRUE(newMap.unserialize(data, d.c_str() + d.size()));
     EXPECT_EQ(map, newMap);
 }
+
+TEST(ChunkMacMap, macsmac_gaps)
+{
+    mega::byte key[mega::SymmCipher::KEYLENGTH] = { 1, 2, 3 };
+    mega::SymmCipher cipher(key);
+
+    mega::chunkmac_map map;
+    m_off_t pos = 0;
+    for (int i = 0; i < 60; i++)
+    {
+        std::fill(map[pos].mac, map[pos].mac + mega::SymmCipher::BLOCKSIZE, mega::byte(i));
+        pos = mega::ChunkedHash::chunkceil(pos);
+    }
+
+    mega::chunkmac_map::FoldStates fs;
+    map.macsmac_states(&cipher, 40, fs);
+
+    // the same as the macsmac() of the map without those entries
+    auto without = [&](size_t g1, size_t g2, size_t g3, size_t g4)
+    {
+        mega::chunkmac_map m;
+        size_t n = 0;
+        for (auto& it : map)
+        {
+            if ((n < g1 || n >= g2) && (n < g3 || n >= g4))
+            {
+                m[it.first] = it.second;
+            }
+            n++;
+        }
+        return m.macsmac(&cipher);
+    };
+
+    EXPECT_EQ(map.macsmac(&cipher), map.macsmac_gaps(&cipher, fs, 60, 60, 60, 60));
+    EXPECT_EQ(without(40, 45, 60, 60), map.macsmac_gaps(&cipher, fs, 40, 45, 60, 60));
+    EXPECT_EQ(without(50, 51, 55, 60), map.macsmac_gaps(&cipher, fs, 50, 51, 55, 60));
+    EXPECT_EQ(without(59, 60, 60, 60), map.macsmac_gaps(&cipher, fs, 59, 60, 60, 60));
+}
+
+TEST(ChunkMacMap, keepsPositionsInOrder)
+{
+    mega::chunkmac_map map;
+    for (m_off_t pos : { 300, 100, 500, 200, 100, 400 })
+    {
+        map[pos].offset = unsigned(pos);
+    }
+
+    ASSERT_EQ(5u, map.size());
+    m_off_t last = 0;
+    for (auto& it : map)
+    {
+        EXPECT_LT(last, it.first);
+        EXPECT_EQ(unsigned(it.first), it.second.offset);
+        last = it.first;
+    }
+
+    EXPECT_EQ(200, map.find(200)->first);
+    EXPECT_EQ(map.end(), map.find(250));
+    EXPECT_EQ(map.end(), map.find(600));
+
+    // read back as written
+    std::string d;
+    map.serialize(d);
+    mega::chunkmac_map newMap;
+    auto data = d.c_str();
+    ASSERT_TRUE(newMap.unserialize(data, d.c_str() + d.size()));
+    EXPECT_EQ(map, newMap);
+    EXPECT_EQ(d.c_str() + d.size(), data);
+}
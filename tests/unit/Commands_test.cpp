@@ -366,3 +366,62 @@ TEST(Commands, CommandQueryGoogleAds)
     ::mega::Command::Result r(::mega::Command::Outcome::CmdArray);
     command.procresult(r);
 }
+
+namespace {
+
+class PipelinedCommand : public ::mega::Command
+{
+public:
+    PipelinedCommand(bool canPipeline, handle key)
+    {
+        cmd("x");
+        batchSeparately = true;
+        pipelinable = canPipeline;
+        pipelinekey = key;
+    }
+
+    bool procresult(Result) override
+    {
+        return true;
+    }
+};
+
+} // anonymous
+
+TEST(Commands, RequestDispatcher_pipelinesOnlyBatchesOnOtherNodes)
+{
+    ::mega::RequestDispatcher reqs;
+    string out;
+    bool suppressSID, fetchingNodes;
+
+    reqs.add(new PipelinedCommand(true, 1));
+    reqs.add(new PipelinedCommand(true, 2));
+    reqs.add(new PipelinedCommand(true, 2));
+    reqs.add(new PipelinedCommand(false, UNDEF));
+
+    ASSERT_TRUE(reqs.readytosend());
+    string id = "a";
+    reqs.serverrequest(&out, suppressSID, fetchingNodes, id);
+    ASSERT_EQ("a", id);
+
+    // another node: it can go while the first one is in flight
+    ASSERT_TRUE(reqs.readytosend());
+    id = "b";
+    reqs.pipelinerequest(&out, suppressSID, id);
+    ASSERT_EQ(1u, reqs.pipelined());
+
+    // the same node, and then one that isn't pipelinable, wait
+    ASSERT_FALSE(reqs.readytosend());
+
+    // a failed one is sent again first, under its own id
+    reqs.pipelinedrequeue("b");
+    ASSERT_EQ(0u, reqs.pipelined());
+    ASSERT_TRUE(reqs.readytosend());
+    id = "c";
+    reqs.pipelinerequest(&out, suppressSID, id);
+    ASSERT_EQ("b", id);
+
+    reqs.clear();
+    ASSERT_FALSE(reqs.cmdspending());
+    ASSERT_TRUE(reqs.readytosend());
+}
@@ -20,9 +20,66 @@
 #include "../src/crypto/sodium.cpp"
 #include <math.h>
 #include "gtest/gtest.h"
+#include "utils.h"
+
+#include <array>
+#include <chrono>
+#include <iostream>
 
 using namespace mega;
 
+namespace {
+
+// restores the default ctr_crypt() on scope exit
+class CtrMode
+{
+public:
+    explicit CtrMode(bool pipelined)
+        : mPrevious(SymmCipher::pipelinedctr)
+    {
+        SymmCipher::pipelinedctr = pipelined;
+    }
+
+    ~CtrMode()
+    {
+        SymmCipher::pipelinedctr = mPrevious;
+    }
+
+private:
+    bool mPrevious;
+};
+
+// the CRC32 of data in pieces of the sizes given, with or without the CLMUL folding
+std::array<byte, 4> crc32(bool clmul, const std::vector<byte>& data, const std::vector<size_t>& pieces)
+{
+    bool previous = HashCRC32::clmulcrc;
+    HashCRC32::clmulcrc = clmul;
+    HashCRC32 crc;
+    HashCRC32::clmulcrc = previous;
+
+    size_t pos = 0;
+    for (size_t len : pieces)
+    {
+        crc.add(data.data() + pos, unsigned(len));
+        pos += len;
+    }
+
+    std::array<byte, 4> result;
+    crc.get(result.data());
+    return result;
+}
+
+// ctr_crypt() of len bytes of data, which is padded to whole blocks
+std::vector<byte> ctrCrypt(SymmCipher& cipher, bool pipelined, std::vector<byte> data, unsigned len, m_off_t pos, byte* mac, bool encrypt)
+{
+    CtrMode mode(pipelined);
+    cipher.ctr_crypt(data.data(), len, pos, 0x0123456789abcdefull, mac, encrypt);
+    data.resize(len);
+    return data;
+}
+
+} // anonymous
+
 // Test encryption/decryption using AES in mode GCM
 // (test vectors from 'tlvstore_test.js', in Webclient)
 TEST(Crypto, AES_GCM)
@@ -160,6 +217,342 @@ TEST(Crypto, AES_CCM)
     ASSERT_STREQ(result.data(), plainText.data()) << "CCM decryption: plain text doesn't match the expected value";
 }
 
+TEST(Crypto, CRC32_clmulMatchesCryptopp)
+{
+    std::string check = "123456789";
+    std::vector<byte> data(check.begin(), check.end());
+    std::array<byte, 4> expected = {{ 0x26, 0x39, 0xf4, 0xcb }};
+    EXPECT_EQ(expected, crc32(true, data, { data.size() }));
+    EXPECT_EQ(expected, crc32(false, data, { data.size() }));
+
+    PrnGen rng;
+    data.resize(100000);
+    rng.genblock(data.data(), data.size());
+
+    // whole and in pieces, of the sizes of fingerprints (64 byte blocks, quarters of 8 KB) and odd ones
+    std::vector<std::vector<size_t>> splits = { { 0 }, { 1 }, { 63 }, { 64 }, { 65 }, { 64, 64, 64 }, { 2048 }, { 2048, 2047 },
+                                                { 100000 }, { 17, 99983 }, { 50000, 3, 49997 } };
+    for (auto& pieces : splits)
+    {
+        EXPECT_EQ(crc32(false, data, pieces), crc32(true, data, pieces)) << "first piece " << pieces[0];
+    }
+
+    // and a second CRC from the same object starts over
+    HashCRC32 crc;
+    byte first[4], second[4];
+    crc.add(data.data(), 1000);
+    crc.get(first);
+    crc.add(data.data(), 1000);
+    crc.get(second);
+    EXPECT_EQ(0, memcmp(first, second, sizeof first));
+}
+
+TEST(Crypto, CRC32_speed)
+{
+    PrnGen rng;
+    std::vector<byte> data(8192);
+    rng.genblock(data.data(), data.size());
+
+    using clock = std::chrono::steady_clock;
+
+    // what genfingerprint() hashes: 32 blocks of 64 bytes per CRC of a large file, or a quarter
+    // of a file of up to 8 KB
+    auto rate = [&](bool clmul, unsigned piece)
+    {
+        bool previous = HashCRC32::clmulcrc;
+        HashCRC32::clmulcrc = clmul;
+        HashCRC32 crc;
+        HashCRC32::clmulcrc = previous;
+
+        byte out[4];
+        const int rounds = 20000;
+        auto start = clock::now();
+        for (int i = 0; i < rounds; ++i)
+        {
+            for (unsigned pos = 0; pos + piece <= 2048; pos += piece)
+            {
+                crc.add(data.data() + pos, piece);
+            }
+            crc.get(out);
+        }
+        double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        return 2048.0 * rounds / std::max(seconds, 1e-9) / (1024 * 1024);
+    };
+
+    for (unsigned piece : { 64u, 2048u })
+    {
+        std::cout << "[          ] CRC32 of 2 KB in " << piece << " byte pieces: Crypto++ " << rate(false, piece)
+                  << " MB/s, CLMUL (where the CPU has it) " << rate(true, piece) << " MB/s" << std::endl;
+    }
+}
+
+// A cipher rekeyed back and forth must work as a new one, whichever modes were keyed before
+TEST(Crypto, AES_modesKeyedOnFirstUse)
+{
+    PrnGen rng;
+    byte key1[FILENODEKEYLENGTH], key2[SymmCipher::KEYLENGTH];
+    rng.genblock(key1, sizeof key1);
+    rng.genblock(key2, sizeof key2);
+
+    string data = rng.genstring(100);
+    byte iv[SymmCipher::BLOCKSIZE];
+    rng.genblock(iv, sizeof iv);
+
+    auto crypt = [&](SymmCipher& cipher)
+    {
+        string out, s;
+        cipher.gcm_encrypt(&data, iv, 12, 16, &s);
+        out += s;
+        s.clear();
+        cipher.ccm_encrypt(&data, iv, 12, 8, &s);
+        out += s;
+
+        std::vector<byte> b(data.begin(), data.begin() + 96);
+        cipher.cbc_encrypt(b.data(), b.size());
+        cipher.ecb_encrypt(b.data(), nullptr, b.size());
+        return out + string(b.begin(), b.end());
+    };
+
+    // node keys, as the temporary ciphers are set to
+    SymmCipher fresh1, fresh2;
+    fresh1.setkey(key1, FILENODE);
+    fresh2.setkey(key2);
+    string expected1 = crypt(fresh1);
+    string expected2 = crypt(fresh2);
+
+    SymmCipher cipher;
+    for (int i = 0; i < 3; i++)
+    {
+        cipher.setkey(key1, FILENODE);
+        ASSERT_EQ(expected1, crypt(cipher));
+        cipher.setkey(key1, FILENODE);
+        ASSERT_EQ(expected1, crypt(cipher));
+
+        // only one mode used with the other key
+        cipher.setkey(key2);
+        byte block[SymmCipher::BLOCKSIZE], expectedblock[SymmCipher::BLOCKSIZE];
+        memcpy(block, data.data(), sizeof block);
+        memcpy(expectedblock, data.data(), sizeof block);
+        cipher.ecb_encrypt(block);
+        fresh2.ecb_encrypt(expectedblock);
+        ASSERT_EQ(0, memcmp(expectedblock, block, sizeof block));
+    }
+
+    SymmCipher copy(fresh2);
+    ASSERT_EQ(expected2, crypt(copy));
+}
+
+// Keys decrypted together must be the same as one by one
+TEST(Crypto, AES_ECB_decryptKeys)
+{
+    PrnGen rng;
+    byte key[SymmCipher::KEYLENGTH];
+    rng.genblock(key, sizeof key);
+    SymmCipher cipher(key);
+
+    // file and folder node keys
+    std::vector<std::vector<byte>> onebyone, together;
+    std::vector<byte*> keys;
+    std::vector<unsigned> lengths;
+    for (int i = 0; i < 100; i++)
+    {
+        std::vector<byte> k(i % 3 ? FILENODEKEYLENGTH : FOLDERNODEKEYLENGTH);
+        rng.genblock(k.data(), k.size());
+        onebyone.push_back(k);
+        together.push_back(k);
+    }
+
+    for (size_t i = 0; i < together.size(); i++)
+    {
+        cipher.ecb_decrypt(onebyone[i].data(), onebyone[i].size());
+        keys.push_back(together[i].data());
+        lengths.push_back(unsigned(together[i].size()));
+    }
+    cipher.ecb_decrypt_keys(keys.data(), lengths.data(), keys.size());
+
+    ASSERT_EQ(onebyone, together);
+}
+
+// The pipelined AES-CTR must give the same data and CBC-MAC as the block by block one
+TEST(Crypto, AES_CTR_pipelinedMatchesBlockwise)
+{
+    PrnGen rng;
+    byte key[SymmCipher::KEYLENGTH];
+    rng.genblock(key, sizeof key);
+    SymmCipher cipher(key);
+
+    // the second position carries from the low byte of the block number
+    for (m_off_t pos : { m_off_t(0), m_off_t(255 * SymmCipher::BLOCKSIZE), m_off_t(5) << 40 })
+    for (unsigned len : { 1u, 16u, 100u, SymmCipher::CTRCHUNK, SymmCipher::CTRCHUNK + 17, 70000u })
+    for (bool encrypt : { true, false })
+    for (bool withmac : { false, true })
+    {
+        std::vector<byte> data(len + SymmCipher::BLOCKSIZE);
+        rng.genblock(data.data(), len);
+
+        byte blockwisemac[SymmCipher::BLOCKSIZE], pipelinedmac[SymmCipher::BLOCKSIZE];
+        auto blockwise = ctrCrypt(cipher, false, data, len, pos, withmac ? blockwisemac : nullptr, encrypt);
+        auto pipelined = ctrCrypt(cipher, true, data, len, pos, withmac ? pipelinedmac : nullptr, encrypt);
+
+        ASSERT_EQ(blockwise, pipelined) << "pos " << pos << ", len " << len << (encrypt ? ", encrypting" : ", decrypting");
+        if (withmac)
+        {
+            ASSERT_EQ(0, memcmp(blockwisemac, pipelinedmac, sizeof blockwisemac)) << "pos " << pos << ", len " << len;
+        }
+
+        if (encrypt)
+        {
+            // and back
+            pipelined.resize(len + SymmCipher::BLOCKSIZE);
+            data.resize(len);
+            ASSERT_EQ(data, ctrCrypt(cipher, true, pipelined, len, pos, nullptr, false));
+        }
+    }
+}
+
+// Interleaving the MACs of several chunks must give the same as one chunk after another
+TEST(Crypto, AES_CTR_chunksMatchOneByOne)
+{
+    PrnGen rng;
+    byte key[SymmCipher::KEYLENGTH];
+    rng.genblock(key, sizeof key);
+    SymmCipher cipher(key);
+
+    // more than MACLANES, of different lengths (the last ones of a file, or empty)
+    std::vector<unsigned> lens = { 131072, 262144, 100, 4113, 0, 16, 393216, 524288, 1048576, 1048576, 77777, 5, 4096 };
+
+    for (bool encrypt : { true, false })
+    {
+        std::vector<std::vector<byte>> onebyone, together;
+        std::vector<std::vector<byte>> onebyonemacs, togethermacs;
+        std::vector<SymmCipher::CtrChunk> chunks;
+
+        for (size_t i = 0; i < lens.size(); i++)
+        {
+            std::vector<byte> data(lens[i] + SymmCipher::BLOCKSIZE);
+            rng.genblock(data.data(), lens[i]);
+            onebyone.push_back(data);
+            together.push_back(data);
+
+            // some continue the MAC of an earlier part of the chunk
+            std::vector<byte> mac(SymmCipher::BLOCKSIZE);
+            rng.genblock(mac.data(), mac.size());
+            onebyonemacs.push_back(mac);
+            togethermacs.push_back(mac);
+        }
+
+        for (size_t i = 0; i < lens.size(); i++)
+        {
+            m_off_t pos = m_off_t(i) * 2 * 1024 * 1024;
+            bool initmac = i % 3 != 1;
+            cipher.ctr_crypt(onebyone[i].data(), lens[i], pos, 77, onebyonemacs[i].data(), encrypt, initmac);
+
+            SymmCipher::CtrChunk c = { together[i].data(), lens[i], pos, togethermacs[i].data(), initmac };
+            chunks.push_back(c);
+        }
+        cipher.ctr_crypt_chunks(chunks.data(), chunks.size(), 77, encrypt);
+
+        for (size_t i = 0; i < lens.size(); i++)
+        {
+            ASSERT_TRUE(std::equal(onebyone[i].begin(), onebyone[i].begin() + lens[i], together[i].begin())) << "chunk " << i;
+            ASSERT_EQ(onebyonemacs[i], togethermacs[i]) << "chunk " << i;
+        }
+    }
+}
+
+TEST(Crypto, AES_CTR_speed)
+{
+    PrnGen rng;
+    byte key[SymmCipher::KEYLENGTH];
+    rng.genblock(key, sizeof key);
+    SymmCipher cipher(key);
+
+    // a large chunk of a transfer
+    const unsigned len = 16 * 1024 * 1024;
+    std::vector<byte> data(len + SymmCipher::BLOCKSIZE);
+
+    using clock = std::chrono::steady_clock;
+
+    auto rate = [&](bool pipelined, bool withmac)
+    {
+        CtrMode mode(pipelined);
+        byte mac[SymmCipher::BLOCKSIZE];
+
+        const int rounds = 4;
+        auto start = clock::now();
+        for (int i = 0; i < rounds; ++i)
+        {
+            cipher.ctr_crypt(data.data(), len, 0, 0, withmac ? mac : nullptr, false);
+        }
+        double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        return double(len) * rounds / std::max(seconds, 1e-9) / (1024 * 1024);
+    };
+
+    for (bool withmac : { false, true })
+    {
+        std::cout << "[          ] AES-CTR of " << len / (1024 * 1024) << " MB" << (withmac ? " with CBC-MAC" : "")
+                  << ": block by block " << rate(false, withmac) << " MB/s, pipelined " << rate(true, withmac) << " MB/s" << std::endl;
+    }
+
+    // the same data as 1 MB chunks with their MACs interleaved
+    const unsigned chunksize = 1024 * 1024;
+    std::vector<SymmCipher::CtrChunk> chunks;
+    std::vector<std::vector<byte>> macs(len / chunksize, std::vector<byte>(SymmCipher::BLOCKSIZE));
+    for (unsigned i = 0; i < len / chunksize; i++)
+    {
+        SymmCipher::CtrChunk c = { data.data() + i * chunksize, chunksize, m_off_t(i) * chunksize, macs[i].data(), true };
+        chunks.push_back(c);
+    }
+
+    const int rounds = 4;
+    auto start = clock::now();
+    for (int i = 0; i < rounds; ++i)
+    {
+        cipher.ctr_crypt_chunks(chunks.data(), chunks.size(), 0, false);
+    }
+    double seconds = std::chrono::duration<double>(clock::now() - start).count();
+    std::cout << "[          ] AES-CTR of " << len / (1024 * 1024) << " MB in 1 MB chunks, MACs interleaved: "
+              << double(len) * rounds / std::max(seconds, 1e-9) / (1024 * 1024) << " MB/s" << std::endl;
+}
+
+TEST(Crypto, PasswordKeysDerivedOncePerSession)
+{
+    MegaApp app;
+    FSACCESS_CLASS fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+
+    string salt(32, 'S');
+    byte expected[2 * SymmCipher::KEYLENGTH];
+    CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA512> pbkdf2;
+    pbkdf2.DeriveKey(expected, sizeof expected, 0, (const byte*)"secret", 6, (const byte*)salt.data(), salt.size(), 100000);
+
+    // derived, then from the cache
+    for (int i = 2; i--; )
+    {
+        byte derived[sizeof expected];
+        client->pbkdf2key("secret", salt, derived);
+        ASSERT_EQ(0, memcmp(expected, derived, sizeof expected));
+    }
+    ASSERT_EQ(1u, client->derivedkeys.size());
+
+    // neither the password nor the salt alone tell the keys apart
+    byte other[sizeof expected];
+    client->pbkdf2key("secreT", salt, other);
+    ASSERT_NE(0, memcmp(expected, other, sizeof expected));
+    client->pbkdf2key("secret", string(32, 'T'), other);
+    ASSERT_NE(0, memcmp(expected, other, sizeof expected));
+
+    byte pwkey[SymmCipher::KEYLENGTH], cachedpwkey[SymmCipher::KEYLENGTH];
+    ASSERT_EQ(API_OK, client->pw_key("secret", pwkey));
+    ASSERT_EQ(API_OK, client->pw_key("secret", cachedpwkey));
+    ASSERT_EQ(0, memcmp(pwkey, cachedpwkey, sizeof pwkey));
+    ASSERT_EQ(4u, client->derivedkeys.size());
+
+    // nothing is kept past the session
+    client->locallogout(false, true);
+    ASSERT_TRUE(client->derivedkeys.empty());
+}
+
 #ifdef ENABLE_CHAT
 // Test functions of Ed25519:
 // - Binary & Hex fingerprints of public key
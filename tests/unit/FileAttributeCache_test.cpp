@@ -0,0 +1,100 @@
+/**
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <gtest/gtest.h>
+
+#include <mega/db/memory.h>
+#include <mega/fileattributefetch.h>
+#include "megafs.h"
+
+namespace {
+
+void put(mega::FileAttributeCache& cache, mega::handle fah, size_t len)
+{
+    std::string data(len, char('a' + fah));
+    cache.put(fah, data.data(), data.size());
+}
+
+std::string get(mega::FileAttributeCache& cache, mega::handle fah)
+{
+    std::string data;
+    return cache.get(fah, data) ? data : "missing";
+}
+
+} // anonymous
+
+TEST(FileAttributeCache, keepsNothingWithoutCapacity)
+{
+    mega::FileAttributeCache cache;
+    put(cache, 1, 100);
+    EXPECT_EQ(0, cache.size());
+    EXPECT_FALSE(cache.contains(1));
+    EXPECT_EQ("missing", get(cache, 1));
+}
+
+TEST(FileAttributeCache, dropsTheLeastRecentlyUsed)
+{
+    mega::FileAttributeCache cache;
+    cache.setCapacity(300);
+
+    put(cache, 1, 100);
+    put(cache, 2, 100);
+    put(cache, 3, 100);
+
+    // used again: attribute 2 is now the oldest
+    EXPECT_EQ(std::string(100, 'b'), get(cache, 1));
+
+    put(cache, 4, 100);
+    EXPECT_EQ(300, cache.size());
+    EXPECT_FALSE(cache.contains(2));
+    EXPECT_TRUE(cache.contains(1));
+    EXPECT_EQ(std::string(100, 'e'), get(cache, 4));
+
+    // and nothing larger than the whole cache
+    put(cache, 5, 400);
+    EXPECT_FALSE(cache.contains(5));
+    EXPECT_TRUE(cache.contains(3));
+}
+
+TEST(FileAttributeCache, persistsInTheTable)
+{
+    mega::FSACCESS_CLASS fsAccess;
+    mega::PrnGen rng;
+    mega::MemoryDbAccess access;
+
+    {
+        mega::FileAttributeCache cache;
+        cache.setCapacity(1000);
+        cache.persist(std::unique_ptr<mega::DbTable>(access.open(rng, fsAccess, "fa")));
+        put(cache, 1, 100);
+        put(cache, 2, 200);
+    }
+
+    // the first ones written are the first dropped when it loads them again
+    mega::FileAttributeCache cache;
+    cache.setCapacity(250);
+    cache.persist(std::unique_ptr<mega::DbTable>(access.open(rng, fsAccess, "fa")));
+    EXPECT_TRUE(cache.persisted());
+    EXPECT_EQ(200, cache.size());
+    EXPECT_FALSE(cache.contains(1));
+    EXPECT_EQ(std::string(200, 'c'), get(cache, 2));
+
+    cache.close(true);
+    EXPECT_EQ(0, cache.size());
+    EXPECT_FALSE(access.probe(fsAccess, "fa"));
+}
@@ -20,12 +20,15 @@
 #include <memory>
 #include <numeric>
 #include <string>
+#include <thread>
 
 #include <gtest/gtest.h>
 
+#include <mega/db/memory.h>
 #include <mega/filefingerprint.h>
 
 #include "DefaultedFileAccess.h"
+#include "DefaultedFileSystemAccess.h"
 
 namespace {
 
@@ -117,6 +120,26 @@ private:
     MockFileAccess mFa;
 };
 
+// opens as a file of its content, whatever the path
+class MockOpenableFileAccess : public MockFileAccess
+{
+public:
+    using MockFileAccess::MockFileAccess;
+
+    bool fopen(mega::LocalPath&, bool, bool, mega::DirAccess* = nullptr, bool = false) override
+    {
+        type = mega::FILENODE;
+        return true;
+    }
+};
+
+class NullWaiter : public mega::Waiter
+{
+public:
+    int wait() override { return 0; }
+    void notify() override {}
+};
+
 } // anonymous
 
 TEST(FileFingerprint, FileFingerprintCmp_compareNotSmaller)
@@ -600,3 +623,143 @@ TEST(FileFingerprint, light_genfingerprint_firstNotSmaller)
     ffp2.mtime = 13;
     ASSERT_FALSE(mega::LightFileFingerprintCmp{}(&ffp1, &ffp2));
 }
+
+TEST(FileFingerprint, FileFingerprintCache_skipsReadingUnchangedFiles)
+{
+    mega::FileFingerprintCache cache;
+    const auto path = mega::LocalPath::fromPlatformEncoded("file");
+
+    mega::FileFingerprint ffp;
+    MockFileAccess fa{1, {3, 4, 5, 6}};
+    cache.genfingerprint(path, &fa, ffp);
+    ASSERT_TRUE(ffp.isvalid);
+    ASSERT_EQ(1u, cache.misses);
+
+    // the same size and mtime: not read
+    mega::FileFingerprint cached;
+    MockFileAccess unread{1, {3, 4, 5, 6}, true};
+    cache.genfingerprint(path, &unread, cached);
+    ASSERT_EQ(1u, cache.hits);
+    ASSERT_TRUE(cached.isvalid);
+    ASSERT_EQ(ffp, cached);
+
+    // a new mtime: read again
+    MockFileAccess touched{2, {3, 4, 5, 6}};
+    cache.genfingerprint(path, &touched, cached);
+    ASSERT_EQ(2u, cache.misses);
+    ASSERT_EQ(2, cached.mtime);
+    ASSERT_EQ(1u, cache.size());
+}
+
+TEST(FileFingerprint, FileFingerprintCache_persistsByFsid)
+{
+    mega::PrnGen rng;
+    mega::MemoryDbAccess access;
+    mt::DefaultedFileSystemAccess fsAccess;
+    const std::vector<mega::byte> content = {3, 4, 5, 6};
+
+    mega::FileFingerprint ffp;
+    {
+        mega::FileFingerprintCache cache;
+        cache.persist(std::unique_ptr<mega::DbTable>(access.open(rng, fsAccess, "fingerprints")));
+        ASSERT_TRUE(cache.persisted());
+
+        MockFileAccess fa{1, content};
+        fa.fsid = 7;
+        fa.fsidvalid = true;
+        cache.genfingerprint(mega::LocalPath::fromPlatformEncoded("file"), &fa, ffp);
+        ASSERT_TRUE(ffp.isvalid);
+        cache.commit();
+    }
+
+    // found by fsid after a restart, under another name
+    mega::FileFingerprintCache cache;
+    cache.persist(std::unique_ptr<mega::DbTable>(access.open(rng, fsAccess, "fingerprints")));
+
+    mega::FileFingerprint cached;
+    MockFileAccess unread{1, content, true};
+    unread.fsid = 7;
+    unread.fsidvalid = true;
+    ASSERT_TRUE(cache.lookup(mega::LocalPath::fromPlatformEncoded("renamed"), &unread, cached));
+    ASSERT_EQ(ffp, cached);
+
+    // not once it changed
+    MockFileAccess touched{2, content, true};
+    touched.fsid = 7;
+    touched.fsidvalid = true;
+    ASSERT_FALSE(cache.lookup(mega::LocalPath::fromPlatformEncoded("renamed"), &touched, cached));
+}
+
+TEST(FileFingerprint, AsyncFingerprinter_fingerprintsOnTheWorkers)
+{
+    NullWaiter waiter;
+    mega::MegaClientAsyncQueue queue(waiter, 2);
+    mega::AsyncFingerprinter fingerprinter(queue);
+
+    const auto first = mega::LocalPath::fromPlatformEncoded("first");
+    const auto second = mega::LocalPath::fromPlatformEncoded("second");
+    const std::vector<mega::byte> content = {3, 4, 5, 6};
+
+    mega::FileFingerprint expected;
+    MockFileAccess fa{1, content};
+    ASSERT_TRUE(expected.genfingerprint(&fa));
+
+    ASSERT_TRUE(fingerprinter.request(first, std::unique_ptr<mega::FileAccess>(new MockOpenableFileAccess{1, content})));
+    ASSERT_TRUE(fingerprinter.request(second, std::unique_ptr<mega::FileAccess>(new MockOpenableFileAccess{1, content})));
+    ASSERT_EQ(2u, fingerprinter.requested());
+
+    // taken without reading the file
+    mega::FileFingerprint ffp;
+    MockFileAccess unread{1, content, true};
+    ASSERT_TRUE(fingerprinter.genfingerprint(first, &unread, ffp));
+    ASSERT_EQ(expected, ffp);
+    ASSERT_TRUE(ffp.isvalid);
+
+    mega::AsyncFingerprinter::Result result;
+    mega::AsyncFingerprinter::State state;
+    while ((state = fingerprinter.take(second, result)) == mega::AsyncFingerprinter::PENDING)
+    {
+        std::this_thread::yield();
+    }
+    ASSERT_EQ(mega::AsyncFingerprinter::DONE, state);
+    ASSERT_TRUE(result.opened);
+    ASSERT_EQ(mega::FILENODE, result.type);
+    ASSERT_EQ(4, result.size);
+    ASSERT_EQ(expected, result.fingerprint);
+
+    ASSERT_EQ(0u, fingerprinter.requested());
+    ASSERT_EQ(mega::AsyncFingerprinter::NOT_REQUESTED, fingerprinter.take(second, result));
+}
+
+TEST(FileFingerprint, AsyncFingerprinter_skipsFilesKnownUnchanged)
+{
+    NullWaiter waiter;
+    mega::MegaClientAsyncQueue queue(waiter, 2);
+    mega::AsyncFingerprinter fingerprinter(queue);
+
+    const auto path = mega::LocalPath::fromPlatformEncoded("file");
+    const std::vector<mega::byte> content = {3, 4, 5, 6};
+
+    // the sync's LocalNode has the size and mtime found: the file isn't read
+    mega::FileFingerprint known;
+    known.size = 4;
+    known.mtime = 1;
+    ASSERT_TRUE(fingerprinter.request(path, std::unique_ptr<mega::FileAccess>(new MockOpenableFileAccess{1, content, true}), &known));
+
+    mega::AsyncFingerprinter::Result result;
+    mega::AsyncFingerprinter::State state;
+    while ((state = fingerprinter.take(path, result)) == mega::AsyncFingerprinter::PENDING)
+    {
+        std::this_thread::yield();
+    }
+    ASSERT_EQ(mega::AsyncFingerprinter::DONE, state);
+    ASSERT_TRUE(result.opened);
+    ASSERT_EQ(4, result.size);
+    ASSERT_FALSE(result.fingerprint.isvalid);
+
+    // and a request not needed in the end is forgotten
+    ASSERT_TRUE(fingerprinter.request(path, std::unique_ptr<mega::FileAccess>(new MockOpenableFileAccess{2, content})));
+    fingerprinter.forget(path);
+    ASSERT_EQ(0u, fingerprinter.requested());
+    ASSERT_EQ(mega::AsyncFingerprinter::NOT_REQUESTED, fingerprinter.take(path, result));
+}
@@ -0,0 +1,128 @@
+/**
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include <mega.h>
+#include <mega/gfx.h>
+
+namespace {
+
+using mega::byte;
+
+std::vector<byte> randomBitmap(std::mt19937& rng, int w, int h)
+{
+    std::vector<byte> bitmap(size_t(w) * h * 4);
+    for (auto& c : bitmap)
+    {
+        c = byte(rng());
+    }
+    return bitmap;
+}
+
+std::vector<byte> downscale(const std::vector<byte>& src, int sw, int sh, int dw, int dh)
+{
+    std::vector<byte> dst(size_t(dw) * dh * 4);
+    mega::GfxProc::downscale(src.data(), sw, sh, sw * 4, dst.data(), dw, dh, dw * 4);
+    return dst;
+}
+
+// the exact average of the area of the source that an output pixel covers
+double referenceAverage(const std::vector<byte>& src, int sw, int sh, int dw, int dh, int x, int y, int c)
+{
+    double x0 = double(x) * sw / dw, x1 = double(x + 1) * sw / dw;
+    double y0 = double(y) * sh / dh, y1 = double(y + 1) * sh / dh;
+    double sum = 0;
+
+    for (int j = int(y0); j < sh && j < y1; j++)
+    {
+        for (int i = int(x0); i < sw && i < x1; i++)
+        {
+            double cx = std::min<double>(i + 1, x1) - std::max<double>(i, x0);
+            double cy = std::min<double>(j + 1, y1) - std::max<double>(j, y0);
+            if (cx > 0 && cy > 0)
+            {
+                sum += cx * cy * src[(size_t(j) * sw + i) * 4 + c];
+            }
+        }
+    }
+    return sum / ((x1 - x0) * (y1 - y0));
+}
+
+} // anonymous
+
+TEST(GfxProc, downscaleAveragesTheAreaCovered)
+{
+    // 2x2 blocks to one pixel each
+    std::vector<byte> src = {
+        0, 10, 20, 255,     100, 30, 20, 255,
+        200, 50, 20, 255,   100, 70, 24, 255,
+    };
+    EXPECT_EQ(std::vector<byte>({ 100, 40, 21, 255 }), downscale(src, 2, 2, 1, 1));
+
+    // and the same size is a copy
+    EXPECT_EQ(src, downscale(src, 2, 2, 2, 2));
+}
+
+TEST(GfxProc, downscaleMatchesReference)
+{
+    std::mt19937 rng(42);
+    for (int round = 0; round < 100; round++)
+    {
+        int sw = 1 + int(rng() % 200), sh = 1 + int(rng() % 200);
+        int dw = 1 + int(rng() % sw), dh = 1 + int(rng() % sh);
+        auto src = randomBitmap(rng, sw, sh);
+        auto dst = downscale(src, sw, sh, dw, dh);
+
+        for (int y = 0; y < dh; y++)
+        {
+            for (int x = 0; x < dw; x++)
+            {
+                for (int c = 0; c < 4; c++)
+                {
+                    // the weights are rounded to 14 bits
+                    double expected = referenceAverage(src, sw, sh, dw, dh, x, y, c);
+                    ASSERT_NEAR(expected, dst[(size_t(y) * dw + x) * 4 + c], 2.5) << sw << "x" << sh << " to " << dw << "x" << dh;
+                }
+            }
+        }
+    }
+}
+
+TEST(GfxProc, downscaleBottomUp)
+{
+    std::mt19937 rng(42);
+    int sw = 97, sh = 61, dw = 20, dh = 13;
+    auto src = randomBitmap(rng, sw, sh);
+    auto expected = downscale(src, sw, sh, dw, dh);
+
+    // the last row first, with negative strides, is the same bitmap
+    std::vector<byte> dst(expected.size());
+    mega::GfxProc::downscale(src.data() + size_t(sh - 1) * sw * 4, sw, sh, -sw * 4,
+                             dst.data() + size_t(dh - 1) * dw * 4, dw, dh, -dw * 4);
+
+    // but the weights are laid out from the other end
+    for (size_t i = 0; i < dst.size(); i++)
+    {
+        ASSERT_NEAR(expected[i], dst[i], 2);
+    }
+}
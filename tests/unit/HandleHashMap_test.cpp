@@ -0,0 +1,187 @@
+/**
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include <mega/types.h>
+
+namespace {
+
+std::vector<mega::handle> randomHandles(size_t n, unsigned seed)
+{
+    std::mt19937_64 rng(seed);
+    std::set<mega::handle> seen;
+    std::vector<mega::handle> handles;
+    handles.reserve(n);
+    while (handles.size() < n)
+    {
+        // node handles are 6 bytes
+        mega::handle h = rng() & 0xFFFFFFFFFFFF;
+        if (seen.insert(h).second)
+        {
+            handles.push_back(h);
+        }
+    }
+    return handles;
+}
+
+}
+
+TEST(HandleHashMap, insertFindErase)
+{
+    mega::handle_hash_map<int> m;
+    EXPECT_TRUE(m.empty());
+    EXPECT_EQ(m.find(1), m.end());
+    EXPECT_EQ(m.erase(1), 0u);
+
+    m[1] = 10;
+    m[2] = 20;
+    EXPECT_TRUE(m.emplace(3, 30).second);
+    EXPECT_FALSE(m.emplace(3, 31).second);
+    EXPECT_EQ(m.size(), 3u);
+    EXPECT_EQ(m.find(3)->second, 30);
+    EXPECT_EQ(m.count(2), 1u);
+    EXPECT_EQ(m.count(4), 0u);
+
+    EXPECT_EQ(m.erase(2), 1u);
+    EXPECT_EQ(m.find(2), m.end());
+    EXPECT_EQ(m.size(), 2u);
+
+    m.erase(m.find(1));
+    EXPECT_EQ(m.size(), 1u);
+    EXPECT_EQ(m.find(3)->second, 30);
+
+    m.clear();
+    EXPECT_TRUE(m.empty());
+    EXPECT_EQ(m.begin(), m.end());
+    EXPECT_EQ(m.find(3), m.end());
+}
+
+TEST(HandleHashMap, matchesStdMapUnderRandomOperations)
+{
+    std::mt19937_64 rng(42);
+    mega::handle_hash_map<mega::handle> m;
+    std::map<mega::handle, mega::handle> reference;
+
+    // a small key space forces long probe sequences and plenty of backward-shift erases
+    for (int i = 0; i < 200000; ++i)
+    {
+        mega::handle h = rng() % 2000;
+        if (rng() % 3)
+        {
+            m[h] = h * 7;
+            reference[h] = h * 7;
+        }
+        else
+        {
+            ASSERT_EQ(m.erase(h), reference.erase(h));
+        }
+        ASSERT_EQ(m.size(), reference.size());
+    }
+
+    for (mega::handle h = 0; h < 2000; ++h)
+    {
+        auto it = m.find(h);
+        auto rit = reference.find(h);
+        ASSERT_EQ(it == m.end(), rit == reference.end());
+        if (rit != reference.end())
+        {
+            ASSERT_EQ(it->second, rit->second);
+        }
+    }
+
+    size_t visited = 0;
+    for (const auto& v : m)
+    {
+        ASSERT_EQ(reference[v.first], v.second);
+        ++visited;
+    }
+    EXPECT_EQ(visited, reference.size());
+}
+
+TEST(HandleHashMap, reserveAvoidsRehash)
+{
+    mega::handle_hash_map<int> m;
+    m.reserve(100000);
+    auto buckets = m.bucket_count();
+
+    for (auto h : randomHandles(100000, 1))
+    {
+        m[h] = 1;
+    }
+
+    EXPECT_EQ(m.size(), 100000u);
+    EXPECT_EQ(m.bucket_count(), buckets);
+}
+
+TEST(HandleHashMap, lookupThroughputVersusStdMap)
+{
+    // Micro-benchmark: report lookup throughput of the hash table that backs MegaClient::nodes
+    // against the ordered map it replaced.  Timings are only reported, not asserted.
+    const size_t nodeCount = 500000;
+    const size_t lookups = 2000000;
+
+    auto handles = randomHandles(nodeCount, 7);
+
+    std::map<mega::handle, mega::Node*> ordered;
+    mega::handle_hash_map<mega::Node*> hashed;
+    hashed.reserve(nodeCount);
+    for (auto h : handles)
+    {
+        ordered[h] = reinterpret_cast<mega::Node*>(h);
+        hashed[h] = reinterpret_cast<mega::Node*>(h);
+    }
+
+    std::mt19937 rng(3);
+    std::vector<mega::handle> queries(lookups);
+    for (auto& q : queries)
+    {
+        q = handles[rng() % nodeCount];
+    }
+
+    using clock = std::chrono::steady_clock;
+
+    size_t orderedFound = 0;
+    auto start = clock::now();
+    for (auto q : queries)
+    {
+        orderedFound += ordered.find(q) != ordered.end();
+    }
+    auto orderedTime = clock::now() - start;
+
+    size_t hashedFound = 0;
+    start = clock::now();
+    for (auto q : queries)
+    {
+        hashedFound += hashed.find(q) != hashed.end();
+    }
+    auto hashedTime = clock::now() - start;
+
+    EXPECT_EQ(orderedFound, lookups);
+    EXPECT_EQ(hashedFound, lookups);
+
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+    std::cout << "[          ] " << lookups << " lookups over " << nodeCount << " nodes: std::map "
+              << duration_cast<milliseconds>(orderedTime).count() << " ms, handle_hash_map "
+              << duration_cast<milliseconds>(hashedTime).count() << " ms" << std::endl;
+}
@@ -0,0 +1,193 @@
+/**
+ * (c) 2020 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include <mega/json.h>
+
+namespace {
+
+// restores the default scan on scope exit
+class ScanMode
+{
+public:
+    explicit ScanMode(bool vector)
+        : mPrevious(mega::JSON::vectorscan)
+    {
+        mega::JSON::vectorscan = vector;
+    }
+
+    ~ScanMode()
+    {
+        mega::JSON::vectorscan = mPrevious;
+    }
+
+private:
+    bool mPrevious;
+};
+
+struct ScanResult
+{
+    bool stored;
+    std::string value;
+    std::ptrdiff_t pos;
+    std::ptrdiff_t valuepos;
+    std::ptrdiff_t stringend;
+    std::ptrdiff_t objectend;
+
+    bool operator==(const ScanResult& other) const
+    {
+        return stored == other.stored && value == other.value && pos == other.pos
+            && valuepos == other.valuepos && stringend == other.stringend && objectend == other.objectend;
+    }
+};
+
+ScanResult scan(const char* data, size_t size, bool vector)
+{
+    ScanMode mode(vector);
+    ScanResult r;
+
+    mega::JSON json;
+    json.pos = data;
+    r.stored = json.storeobject(&r.value);
+    r.pos = json.pos - data;
+
+    json.pos = data;
+    r.valuepos = json.getvalue() - data;
+
+    r.stringend = mega::JSON::stringend(data + 1) - data;
+
+    const char* end = mega::JSON::objectend(data, data + size);
+    r.objectend = end ? end - data : -1;
+
+    return r;
+}
+
+} // anonymous
+
+TEST(JSON, storeobject_skipsEscapedQuotes)
+{
+    std::string data = "{\"a\":\"x\\\"}y\",\"b\":[1,{\"c\":\"\\\\\"}]},rest";
+    mega::JSON json(data);
+    std::string object;
+
+    ASSERT_TRUE(json.storeobject(&object));
+    EXPECT_EQ(data.substr(0, data.size() - 5), object);
+    EXPECT_EQ(",rest", std::string(json.pos));
+}
+
+TEST(JSON, stringend_longStrings)
+{
+    // long enough to span several vector blocks from any alignment
+    for (size_t offset = 0; offset < 32; offset++)
+    {
+        std::string data(offset, ' ');
+        data += "[\"" + std::string(70, 'a') + "\\\"" + std::string(40, 'b') + "\"]tail";
+
+        const char* start = data.c_str() + offset + 2;
+        EXPECT_EQ(start + 112, mega::JSON::stringend(start));
+        EXPECT_EQ(start + 114, mega::JSON::objectend(data.c_str() + offset, data.c_str() + data.size()));
+    }
+}
+
+TEST(JSON, vectorScanMatchesScalarScan)
+{
+    // structural characters, string delimiters and escapes are over-represented to hit the edge cases
+    static const char alphabet[] = "\"\"\"\\\\{}[],:0-.eaZ ";
+    std::mt19937 rng(0x4a534f4e);
+    std::uniform_int_distribution<size_t> length(0, 96);
+    std::uniform_int_distribution<size_t> letter(0, sizeof alphabet - 2);
+    std::uniform_int_distribution<size_t> offset(0, 31);
+
+    for (int i = 0; i < 100000; i++)
+    {
+        std::string body;
+        body += "{[\""[i % 3];
+        for (size_t n = length(rng); n--; )
+        {
+            body += alphabet[letter(rng)];
+        }
+
+        // vary the alignment of the data, and leave garbage after the NUL for the vector loads to read
+        std::vector<char> buffer(offset(rng), 'x');
+        size_t start = buffer.size();
+        buffer.insert(buffer.end(), body.begin(), body.end());
+        buffer.push_back('\0');
+        buffer.insert(buffer.end(), 32, '"');
+
+        const char* data = buffer.data() + start;
+        ScanResult scalar = scan(data, body.size(), false);
+        ScanResult vector = scan(data, body.size(), true);
+
+        ASSERT_TRUE(scalar == vector) << "input: " << body;
+    }
+}
+
+TEST(JSON, views_pointIntoTheBuffer)
+{
+    std::string data = "{\"name\":\"value\",\"obj\":{\"a\":[1,2]},\"n\":-12}";
+    mega::JSON json(data);
+
+    ASSERT_TRUE(json.enterobject());
+
+    mega::JSONView name = json.getnameview();
+    EXPECT_TRUE(name == "name");
+    EXPECT_EQ(data.c_str() + 2, name.data);
+
+    mega::JSONView value = json.getvalueview();
+    EXPECT_TRUE(value == "value");
+    EXPECT_FALSE(value == "valu");
+    EXPECT_FALSE(value == "values");
+    EXPECT_TRUE(value == std::string("value"));
+    EXPECT_EQ(data.c_str() + 9, value.data);
+
+    EXPECT_EQ("obj", json.getname());
+    EXPECT_EQ("{\"a\":[1,2]}", json.getvalueview().str());
+
+    EXPECT_EQ("n", json.getnameWithoutAdvance());
+    EXPECT_EQ("n", json.getnameview().str());
+    EXPECT_EQ("-12", json.getvalueview().str());
+
+    EXPECT_TRUE(json.getnameview().empty());
+    EXPECT_TRUE(json.leaveobject());
+}
+
+TEST(JSONWriter, b64sizeMatchesTheWrittenValues)
+{
+    for (int n = 0; n < 40; ++n)
+    {
+        std::string value(n, 'x');
+        mega::JSONWriter writer;
+        writer.arg("a", reinterpret_cast<const mega::byte*>(value.data()), n);
+
+        // "a":"<value>"
+        EXPECT_EQ(writer.size(), 6 + mega::JSONWriter::b64size(n)) << n;
+    }
+
+    // and a reserved writer keeps its buffer as it is filled
+    mega::JSONWriter writer;
+    writer.reserve(1000);
+    const char* buffer = writer.getstring().data();
+    for (int i = 0; i < 50; ++i)
+    {
+        writer.arg("k", "value");
+    }
+    EXPECT_EQ(buffer, writer.getstring().data());
+}
@@ -0,0 +1,85 @@
+/**
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include <mega/lazynodes.h>
+
+TEST(LazyNodeIndex, takeRemovesFromParent)
+{
+    mega::LazyNodeIndex index;
+    index.add(10, 1, 16);
+    index.add(11, 1, 32);
+    index.add(12, 2, 48);
+
+    uint32_t dbid;
+    mega::handle parent;
+    ASSERT_TRUE(index.parentof(12, &parent));
+    EXPECT_EQ(2u, parent);
+    EXPECT_FALSE(index.parentof(1, &parent));
+
+    ASSERT_TRUE(index.take(10, &dbid, &parent));
+    EXPECT_EQ(16u, dbid);
+    EXPECT_EQ(1u, parent);
+    EXPECT_FALSE(index.contains(10));
+    EXPECT_FALSE(index.take(10, &dbid, &parent));
+
+    std::vector<uint32_t> dbids;
+    ASSERT_TRUE(index.takechildren(1, &dbids));
+    EXPECT_EQ(std::vector<uint32_t>{32}, dbids);
+    EXPECT_FALSE(index.haschildren(1));
+    EXPECT_FALSE(index.takechildren(1, &dbids));
+
+    ASSERT_TRUE(index.take(12, &dbid, &parent));
+    EXPECT_FALSE(index.haschildren(2));
+    EXPECT_TRUE(index.empty());
+}
+
+TEST(LazyNodeIndex, readdedUnderAnotherParent)
+{
+    mega::LazyNodeIndex index;
+    index.add(10, 1, 16);
+    index.add(10, 2, 16);
+
+    EXPECT_EQ(1u, index.size());
+    EXPECT_FALSE(index.haschildren(1));
+
+    std::vector<uint32_t> dbids;
+    ASSERT_TRUE(index.takechildren(2, &dbids));
+    EXPECT_EQ(std::vector<uint32_t>{16}, dbids);
+}
+
+TEST(LazyNodeIndex, leastRecentFolderFirst)
+{
+    mega::LazyNodeIndex index;
+    index.touch(1);
+    index.touch(2);
+    index.touch(3);
+    index.touch(1);
+
+    mega::handle folder;
+    ASSERT_TRUE(index.leastrecent(&folder));
+    EXPECT_EQ(2u, folder);
+    ASSERT_TRUE(index.leastrecent(&folder));
+    EXPECT_EQ(3u, folder);
+    ASSERT_TRUE(index.leastrecent(&folder));
+    EXPECT_EQ(1u, folder);
+    EXPECT_FALSE(index.leastrecent(&folder));
+}
@@ -26,6 +26,8 @@
 #include <megaapi.h>
 #include <megaapi_impl.h>
 
+#include "utils.h"
+
 using namespace std;
 using namespace mega;
 
@@ -218,3 +220,131 @@ TEST(MegaApi, getMimeType)
 
     ASSERT_EQ(600, successCount);
 }
+
+TEST(MegaApi, MegaNode_snapshotSharedUntilNodeChanges)
+{
+    MegaApp app;
+    FSACCESS_CLASS fs;
+    auto client = mt::makeClient(app, fs);
+    auto& n = mt::makeNode(*client, FILENODE, 1);
+    n.attrs.map['n'] = "first";
+    n.attrschanged();
+
+    unique_ptr<MegaNode> a{MegaNodePrivate::fromNode(&n)};
+    unique_ptr<MegaNode> b{MegaNodePrivate::fromNode(&n)};
+    unique_ptr<MegaNode> copy{a->copy()};
+    ASSERT_EQ(string{"first"}, a->getName());
+    ASSERT_EQ(a->getName(), b->getName());      // same snapshot, no copy made
+    ASSERT_EQ(a->getName(), copy->getName());
+
+    // a node change is only seen by the MegaNodes created after it
+    n.attrs.map['n'] = "second";
+    n.attrschanged();
+    unique_ptr<MegaNode> c{MegaNodePrivate::fromNode(&n)};
+    ASSERT_EQ(string{"second"}, c->getName());
+    ASSERT_EQ(string{"first"}, a->getName());
+
+    // renaming a copy leaves the others alone
+    static_cast<MegaNodePrivate*>(copy.get())->setName("renamed");
+    ASSERT_EQ(string{"renamed"}, copy->getName());
+    ASSERT_EQ(string{"first"}, b->getName());
+}
+
+TEST(MegaApi, EncryptFilePieceByChunks_windowsMatchTheBuffer)
+{
+    FSACCESS_CLASS fs;
+    LocalPath in, out;
+    ASSERT_TRUE(fs.cwd(in));
+    out = in;
+    in.appendWithSeparator(LocalPath::fromPath("piece.in", fs), false);
+    out.appendWithSeparator(LocalPath::fromPath("piece.out", fs), false);
+
+    // several windows of chunks, from a chunk boundary to the end of the file
+    m_off_t pos = 1179648;
+    m_off_t npos = pos + 2 * EncryptFilePieceByChunks::WINDOWSIZE + 5000;
+    unsigned size = unsigned(npos - pos);
+    string data(size_t(npos), '\0');
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = char(i * 31 + (i >> 8));
+    }
+
+    {
+        auto fa = fs.newfileaccess(false);
+        ASSERT_TRUE(fa->fopen(in, false, true));
+        ASSERT_TRUE(fa->fwrite((const byte*)data.data(), unsigned(data.size()), 0));
+    }
+
+    byte keydata[SymmCipher::KEYLENGTH] = { 1, 2, 3 };
+    SymmCipher key(keydata);
+
+    string expected = data.substr(size_t(pos));
+    expected.resize(size + SymmCipher::BLOCKSIZE);
+    chunkmac_map expectedMacs;
+    string expectedSuffix;
+    EncryptBufferByChunks buffer((byte*)&expected[0], &key, &expectedMacs, 0x1234);
+    ASSERT_TRUE(buffer.encrypt(pos, npos, expectedSuffix));
+    expected.resize(size);
+
+    WAIT_CLASS waiter;
+    MegaClientAsyncQueue queue(waiter, 3);
+    chunkmac_map macs;
+    string suffix;
+    {
+        auto fain = fs.newfileaccess(false);
+        auto faout = fs.newfileaccess(false);
+        ASSERT_TRUE(fain->fopen(in, true, false));
+        fs.unlinklocal(out);
+        ASSERT_TRUE(faout->fopen(out, false, true));
+
+        EncryptFilePieceByChunks file(fain.get(), pos, faout.get(), 0, &key, &macs, 0x1234);
+        ASSERT_TRUE(file.encrypt(queue, pos, npos, suffix));
+    }
+
+    EXPECT_EQ(expectedSuffix, suffix);
+    EXPECT_EQ(expectedMacs.macsmac(&key), macs.macsmac(&key));
+
+    auto fa = fs.newfileaccess(false);
+    ASSERT_TRUE(fa->fopen(out, true, false));
+    string encrypted;
+    ASSERT_TRUE(fa->fread(&encrypted, size, 0, 0));
+    EXPECT_TRUE(expected == encrypted);
+
+    fa.reset();
+    fs.unlinklocal(in);
+    fs.unlinklocal(out);
+}
+
+#ifdef HAVE_LIBUV
+TEST(MegaApi, StreamingBuffer_reusesTheBuffersReleased)
+{
+    // a capacity no other buffer of the process has
+    const unsigned capacity = StreamingBuffer::POOLED_BUFFER_SIZE * 3 + 1;
+    char* released;
+    {
+        StreamingBuffer b;
+        b.setMaxBufferSize(capacity);
+        b.init(capacity);
+        ASSERT_EQ(capacity, b.availableCapacity());
+        b.append("x", 1);
+        released = b.nextBuffer().base;
+    }
+
+    // the next connection takes it, and the memory stays counted while it is in the pool
+    auto total = StreamingBuffer::totalCapacity.load();
+    StreamingBuffer b;
+    b.setMaxBufferSize(capacity);
+    b.init(capacity);
+    b.append("x", 1);
+    ASSERT_EQ(released, b.nextBuffer().base);
+    ASSERT_EQ(total, StreamingBuffer::totalCapacity.load());
+
+    // and small buffers are just freed
+    {
+        StreamingBuffer small;
+        small.init(1000);
+        ASSERT_EQ(total + 1000, StreamingBuffer::totalCapacity.load());
+    }
+    ASSERT_EQ(total, StreamingBuffer::totalCapacity.load());
+}
+#endif
@@ -0,0 +1,160 @@
+/**
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <gtest/gtest.h>
+
+#include <mega/db/memory.h>
+#include "megafs.h"
+
+namespace {
+
+class MemoryDbTableTest : public ::testing::Test
+{
+public:
+    std::unique_ptr<mega::DbTable> open(const std::string& name = "test")
+    {
+        return std::unique_ptr<mega::DbTable>(access.open(rng, fsAccess, name));
+    }
+
+    static bool put(mega::DbTable& table, uint32_t id, std::string data)
+    {
+        return table.put(id, &data[0], unsigned(data.size()));
+    }
+
+    static mega::DbNodeRecord node(uint32_t id, mega::handle h, mega::handle parent, const std::string& fingerprint = "")
+    {
+        mega::DbNodeRecord record;
+        record.id = id;
+        record.columns.nodehandle = h;
+        record.columns.parenthandle = parent;
+        record.columns.size = 10;
+        record.columns.fingerprint = fingerprint;
+        record.data = "node" + std::to_string(id);
+        return record;
+    }
+
+    mega::FSACCESS_CLASS fsAccess;
+    mega::PrnGen rng;
+    mega::MemoryDbAccess access;
+};
+
+} // anonymous
+
+TEST_F(MemoryDbTableTest, recordsOutliveTheTable)
+{
+    EXPECT_FALSE(access.probe(fsAccess, "test"));
+
+    auto table = open();
+    ASSERT_TRUE(put(*table, 32, "b"));
+    ASSERT_TRUE(put(*table, 16, "a"));
+    table.reset();
+
+    EXPECT_TRUE(access.probe(fsAccess, "test"));
+    EXPECT_FALSE(access.probe(fsAccess, "other"));
+
+    table = open();
+    table->rewind();
+
+    uint32_t id;
+    std::string data;
+    ASSERT_TRUE(table->next(&id, &data));
+    EXPECT_EQ(16u, id);
+    EXPECT_EQ("a", data);
+
+    // records can be deleted while scanned
+    ASSERT_TRUE(table->del(16));
+    ASSERT_TRUE(table->next(&id, &data));
+    EXPECT_EQ(32u, id);
+    EXPECT_FALSE(table->next(&id, &data));
+
+    table->remove();
+    EXPECT_FALSE(access.probe(fsAccess, "test"));
+    EXPECT_FALSE(open()->get(32, &data));
+}
+
+TEST_F(MemoryDbTableTest, abortUndoesTheTransaction)
+{
+    auto table = open();
+    ASSERT_TRUE(put(*table, 16, "a"));
+    ASSERT_TRUE(table->putNodeRecord(node(32, 1, 2)));
+
+    table->begin();
+    ASSERT_TRUE(put(*table, 16, "a2"));
+    ASSERT_TRUE(table->del(32));
+    ASSERT_TRUE(put(*table, 48, "c"));
+    table->abort();
+
+    std::string data;
+    ASSERT_TRUE(table->get(16, &data));
+    EXPECT_EQ("a", data);
+    ASSERT_TRUE(table->get(32, &data));
+    EXPECT_FALSE(table->get(48, &data));
+
+    mega::DbTable::NodeRefs refs;
+    ASSERT_TRUE(table->getChildren(2, &refs));
+    EXPECT_EQ(mega::DbTable::NodeRefs{ std::make_pair(32u, mega::handle(1)) }, refs);
+
+    // a truncated table comes back whole
+    table->begin();
+    ASSERT_TRUE(put(*table, 64, "d"));
+    table->truncate();
+    ASSERT_TRUE(put(*table, 80, "e"));
+    table->abort();
+
+    EXPECT_TRUE(table->get(16, &data));
+    EXPECT_FALSE(table->get(64, &data));
+    EXPECT_FALSE(table->get(80, &data));
+
+    table->begin();
+    ASSERT_TRUE(table->del(16));
+    table->commit();
+    EXPECT_FALSE(table->get(16, &data));
+}
+
+TEST_F(MemoryDbTableTest, nodeQueries)
+{
+    auto table = open();
+    EXPECT_TRUE(table->nodeIndexComplete());
+
+    mega::FileFingerprint fp;
+    fp.size = 10;
+    fp.mtime = 5;
+    fp.isvalid = true;
+    std::string serialized;
+    fp.serializefingerprint(&serialized);
+
+    ASSERT_TRUE(table->putNodeRecord(node(16, 1, 100, serialized)));
+    ASSERT_TRUE(table->putNodeRecord(node(32, 2, 100)));
+    ASSERT_TRUE(table->putNodeRecord(node(48, 3, 200, serialized)));
+
+    mega::DbTable::NodeRefs refs;
+    ASSERT_TRUE(table->getChildren(100, &refs));
+    EXPECT_EQ(2u, refs.size());
+
+    ASSERT_TRUE(table->getByFingerprint(fp, &refs));
+    mega::DbTable::NodeRefs expected = { {16, 1}, {48, 3} };
+    EXPECT_EQ(expected, refs);
+
+    // a plain record loses the columns
+    ASSERT_TRUE(put(*table, 48, "moved"));
+    ASSERT_TRUE(table->getByFingerprint(fp, &refs));
+    expected = { {16, 1} };
+    EXPECT_EQ(expected, refs);
+    ASSERT_TRUE(table->getChildren(200, &refs));
+    EXPECT_TRUE(refs.empty());
+}
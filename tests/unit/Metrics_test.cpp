@@ -0,0 +1,166 @@
+/**
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <mega.h>
+#include <mega/json.h>
+#include <mega/metrics.h>
+
+using mega::LatencyHistogram;
+
+TEST(LatencyHistogram, bucketsAreWithinAnEighth)
+{
+    for (uint64_t us : { 0ull, 1ull, 7ull, 8ull, 15ull, 16ull, 17ull, 1000ull, 123456789ull })
+    {
+        int b = LatencyHistogram::bucket(us);
+        uint64_t lower = LatencyHistogram::lowerbound(b);
+        uint64_t upper = LatencyHistogram::lowerbound(b + 1);
+        EXPECT_LE(lower, us);
+        EXPECT_LT(us, upper);
+        EXPECT_LE(upper - lower, std::max<uint64_t>(1, lower / 8)) << us;
+    }
+
+    // and the longest ones in the last
+    EXPECT_EQ(LatencyHistogram::BUCKETS - 1, LatencyHistogram::bucket(~0ull));
+}
+
+TEST(LatencyHistogram, percentiles)
+{
+    LatencyHistogram h;
+    EXPECT_EQ(0u, h.snapshot().percentile(0.5));
+
+    for (uint64_t us = 1; us <= 1000; us++)
+    {
+        h.record(us);
+    }
+
+    auto s = h.snapshot();
+    EXPECT_EQ(1000u, s.count);
+    EXPECT_EQ(500500u, s.sum);
+    EXPECT_EQ(1000u, s.max);
+
+    auto p50 = s.percentile(0.5);
+    EXPECT_GE(p50, 500u);
+    EXPECT_LE(p50, 500u + 500u / 8);
+    EXPECT_EQ(1000u, s.percentile(1));
+}
+
+TEST(ClientMetrics, json)
+{
+    mega::ClientMetrics metrics;
+    metrics.exec.record(std::chrono::milliseconds(2));
+    metrics.command("f").count++;
+    metrics.command(nullptr).errors++;
+
+    mega::JSONWriter json;
+    json.beginobject();
+    metrics.tojson(json);
+    json.endobject();
+
+    EXPECT_NE(std::string::npos, json.getstring().find("\"exec\":{\"count\":1,\"sum\":2000,\"max\":2000"));
+    EXPECT_NE(std::string::npos, json.getstring().find("\"commands\":{\"?\":{\"count\":0,\"retries\":0,\"errors\":1"));
+    EXPECT_NE(std::string::npos, json.getstring().find("\"f\":{\"count\":1,"));
+}
+
+TEST(FetchNodesStats, startupReport)
+{
+    mega::FetchNodesStats stats;
+    stats.mode = mega::FetchNodesStats::MODE_DB;
+    stats.timeToCached = 12;
+    stats.dbReadTimeMs = 300;
+    {
+        mega::FetchNodesStats::PhaseTimer pt(&stats.applyKeysTimeUs);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    {
+        mega::FetchNodesStats::PhaseTimer pt(nullptr);
+    }
+
+    mega::JSONWriter json;
+    json.beginobject();
+    stats.toJson(json);
+    json.endobject();
+
+    auto s = json.getstring();
+    EXPECT_NE(std::string::npos, s.find("\"mode\":0,"));
+    EXPECT_NE(std::string::npos, s.find("\"cached\":1200,"));
+    EXPECT_NE(std::string::npos, s.find("\"current\":-1,"));
+    EXPECT_NE(std::string::npos, s.find("\"phases\":{\"dbread\":300,"));
+    EXPECT_GE(stats.applyKeysTimeUs, 2000);
+    EXPECT_EQ(std::string::npos, s.find("\"applykeys\":0,"));
+}
+
+TEST(StallWatchdog, findsTheLongPassesAndTheirScopes)
+{
+    mega::StallWatchdog watchdog;
+    watchdog.watch();
+    watchdog.configure(20, true);
+
+    std::string during;
+    {
+        mega::StallWatchdog::Scope exec("exec");
+        watchdog.pass();
+        {
+            mega::StallWatchdog::Scope cs("cs");
+            during = watchdog.scopes();
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        watchdog.idle();
+    }
+
+    EXPECT_EQ("exec > cs", during);
+    EXPECT_EQ("", watchdog.scopes());
+    EXPECT_EQ(1u, watchdog.stalls());
+
+    // short passes and waits are not stalls
+    for (int i = 0; i < 5; i++)
+    {
+        watchdog.pass();
+        watchdog.idle();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    watchdog.configure(0, false);
+    EXPECT_EQ(1u, watchdog.stalls());
+}
+
+TEST(TraceRing, keepsTheLastEvents)
+{
+    mega::TraceRing trace;
+    trace.instant("dropped", 1, 0);
+    EXPECT_EQ("{\"traceEvents\":[]}", trace.tojson());
+
+    trace.setCapacity(2);
+    trace.instant("a", 1, 0);
+    trace.span("b", 1, 2, std::chrono::steady_clock::now(), { { "pos", 1024 } });
+    trace.instant("c", 2, 1);
+
+    auto json = trace.tojson();
+    EXPECT_EQ(std::string::npos, json.find("\"a\""));
+    EXPECT_NE(std::string::npos, json.find("{\"name\":\"b\",\"ph\":\"X\",\"pid\":1,\"tid\":2,"));
+    EXPECT_NE(std::string::npos, json.find("\"args\":{\"pos\":1024}"));
+    EXPECT_LT(json.find("\"b\""), json.find("\"c\""));
+
+    // a smaller ring keeps the newest
+    trace.setCapacity(1);
+    json = trace.tojson();
+    EXPECT_EQ(std::string::npos, json.find("\"b\""));
+    EXPECT_NE(std::string::npos, json.find("\"c\""));
+}
@@ -0,0 +1,501 @@
+/**
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <gtest/gtest.h>
+
+#include <mega.h>
+
+#include "utils.h"
+
+namespace {
+
+struct MockClient
+{
+    mega::MegaApp app;
+    ::mega::FSACCESS_CLASS fs;
+    std::shared_ptr<mega::MegaClient> cli = mt::makeClient(app, fs);
+};
+
+mega::Node& makeNamedNode(mega::MegaClient& client, mega::nodetype_t type, mega::handle handle, mega::Node& parent, const std::string& name)
+{
+    auto& n = mt::makeNode(client, type, handle, &parent);
+    n.attrs.map['n'] = name;
+    parent.children.nameChanged(&n);
+    return n;
+}
+
+void deleteNode(mega::MegaClient& client, mega::Node& n)
+{
+    client.nodes.erase(n.nodehandle);
+    delete &n;
+}
+
+}
+
+TEST(Node, children_keepInsertionOrderAndCounts)
+{
+    MockClient client;
+    auto& folder = mt::makeNode(*client.cli, mega::FOLDERNODE, 1);
+
+    std::vector<mega::Node*> expected;
+    for (mega::handle h = 10; h < 20; ++h)
+    {
+        expected.push_back(&makeNamedNode(*client.cli, h % 3 ? mega::FILENODE : mega::FOLDERNODE, h, folder, std::to_string(h)));
+    }
+
+    EXPECT_EQ(10u, folder.children.size());
+    EXPECT_EQ(6u, folder.children.numFiles());
+    EXPECT_EQ(4u, folder.children.numFolders());
+    EXPECT_EQ(expected.back(), folder.children.back());
+
+    // remove a file and a folder from the middle
+    deleteNode(*client.cli, *expected[4]);
+    deleteNode(*client.cli, *expected[2]);
+    expected.erase(expected.begin() + 4);
+    expected.erase(expected.begin() + 2);
+
+    EXPECT_EQ(8u, folder.children.size());
+    EXPECT_EQ(5u, folder.children.numFiles());
+    EXPECT_EQ(3u, folder.children.numFolders());
+    EXPECT_EQ(expected, std::vector<mega::Node*>(folder.children.begin(), folder.children.end()));
+}
+
+TEST(Node, children_lookupByNameInLargeFolder)
+{
+    MockClient client;
+    auto& folder = mt::makeNode(*client.cli, mega::FOLDERNODE, 1);
+
+    // enough children for the name index to be built
+    for (mega::handle h = 100; h < 1100; ++h)
+    {
+        makeNamedNode(*client.cli, mega::FILENODE, h, folder, "file" + std::to_string(h));
+    }
+
+    auto& file = *client.cli->childnodebyname(&folder, "file500");
+    EXPECT_EQ(500u, file.nodehandle);
+    EXPECT_EQ(nullptr, client.cli->childnodebyname(&folder, "file5000"));
+
+    // the index follows renames, additions and removals once it exists
+    file.attrs.map['n'] = "renamed";
+    folder.children.nameChanged(&file);
+    EXPECT_EQ(&file, client.cli->childnodebyname(&folder, "renamed"));
+    EXPECT_EQ(nullptr, client.cli->childnodebyname(&folder, "file500"));
+
+    auto& subfolder = makeNamedNode(*client.cli, mega::FOLDERNODE, 2000, folder, "file600");
+    EXPECT_EQ(&subfolder, client.cli->childnodebyname(&folder, "file600"));  // folders take precedence
+    EXPECT_EQ(601u, client.cli->childnodebyname(&folder, "file601")->nodehandle);
+    EXPECT_EQ(600u, client.cli->childnodebyname(&folder, "file600", true)->nodehandle);
+    EXPECT_EQ(2u, client.cli->childnodesbyname(&folder, "file600", false).size());
+
+    deleteNode(*client.cli, subfolder);
+    EXPECT_EQ(600u, client.cli->childnodebyname(&folder, "file600")->nodehandle);
+    EXPECT_EQ(1000u, folder.children.numFiles());
+    EXPECT_EQ(0u, folder.children.numFolders());
+}
+
+TEST(Node, children_moveBetweenParents)
+{
+    MockClient client;
+    auto& a = mt::makeNode(*client.cli, mega::FOLDERNODE, 1);
+    auto& b = mt::makeNode(*client.cli, mega::FOLDERNODE, 2);
+
+    std::vector<mega::Node*> nodes;
+    for (mega::handle h = 10; h < 110; ++h)
+    {
+        nodes.push_back(&makeNamedNode(*client.cli, mega::FILENODE, h, a, std::to_string(h)));
+    }
+
+    // moving most children away leaves erased entries behind in a that get compacted on the next insertion
+    for (size_t i = 0; i < 90; ++i)
+    {
+        nodes[i]->setparent(&b);
+    }
+    EXPECT_EQ(10u, a.children.size());
+    EXPECT_EQ(90u, b.children.size());
+
+    nodes[0]->setparent(&a);
+    EXPECT_EQ(11u, a.children.size());
+    EXPECT_EQ(nodes[0], a.children.back());
+    EXPECT_EQ(nodes[0], client.cli->childnodebyname(&a, "10"));
+    EXPECT_EQ(nullptr, client.cli->childnodebyname(&b, "10"));
+    EXPECT_EQ(nodes[50], client.cli->childnodebyname(&b, "60"));
+
+    size_t count = 0;
+    for (mega::Node* n : a.children)
+    {
+        EXPECT_EQ(&a, n->parent);
+        ++count;
+    }
+    EXPECT_EQ(11u, count);
+}
+
+TEST(Node, nodesByOriginalFingerprint)
+{
+    MockClient client;
+    auto& root = mt::makeNode(*client.cli, mega::FOLDERNODE, 1);
+    auto& folder = mt::makeNode(*client.cli, mega::FOLDERNODE, 2, &root);
+    auto& other = mt::makeNode(*client.cli, mega::FOLDERNODE, 3, &root);
+
+    const mega::nameid c0 = mega::AttrMap::string2nameid("c0");
+
+    auto makeFile = [&](mega::handle h, mega::Node& parent, const std::string& fp) -> mega::Node&
+    {
+        auto& n = mt::makeNode(*client.cli, mega::FILENODE, h, &parent);
+        n.attrs.map[c0] = fp;
+        client.cli->mFingerprints.updateoriginal(&n);
+        return n;
+    };
+
+    auto& a = makeFile(10, folder, "fpA");
+    auto& b = makeFile(11, other, "fpA");
+    auto& version = makeFile(12, a, "fpA");
+    makeFile(13, folder, "fpB");
+
+    mega::node_vector nv;
+    client.cli->nodesbyoriginalfingerprint("fpA", nullptr, &nv);
+    EXPECT_EQ(3u, nv.size());
+
+    nv.clear();
+    client.cli->nodesbyoriginalfingerprint("fpA", &folder, &nv);
+    EXPECT_EQ(mega::node_vector{&a}, nv);
+
+    nv.clear();
+    client.cli->nodesbyoriginalfingerprint("fpA", &a, &nv);
+    EXPECT_EQ(mega::node_vector{&version}, nv);
+
+    // changing the attribute moves the node to its new key
+    b.attrs.map[c0] = "fpB";
+    client.cli->mFingerprints.updateoriginal(&b);
+    nv.clear();
+    client.cli->nodesbyoriginalfingerprint("fpB", &root, &nv);
+    EXPECT_EQ(2u, nv.size());
+
+    deleteNode(*client.cli, b);
+    nv.clear();
+    client.cli->nodesbyoriginalfingerprint("fpB", nullptr, &nv);
+    EXPECT_EQ(1u, nv.size());
+    nv.clear();
+    client.cli->nodesbyoriginalfingerprint("fpC", nullptr, &nv);
+    EXPECT_TRUE(nv.empty());
+}
+
+TEST(Node, getRecentNodes)
+{
+    MockClient client;
+    auto& root = mt::makeNode(*client.cli, mega::ROOTNODE, 1);
+    auto& rubbish = mt::makeNode(*client.cli, mega::RUBBISHNODE, 2);
+    auto& folder = mt::makeNode(*client.cli, mega::FOLDERNODE, 3, &root);
+
+    auto makeFile = [&](mega::handle h, mega::Node& parent, mega::m_time_t ctime) -> mega::Node&
+    {
+        auto& n = mt::makeNode(*client.cli, mega::FILENODE, h, &parent);
+        client.cli->mNodesByCtime.remove(&n);
+        n.ctime = ctime;
+        client.cli->mNodesByCtime.add(&n);
+        return n;
+    };
+
+    auto& old = makeFile(10, folder, 100);
+    auto& recent = makeFile(11, root, 300);
+    auto& binned = makeFile(12, rubbish, 400);
+    makeFile(13, recent, 500); // a version of `recent`
+    auto& middle = makeFile(14, folder, 200);
+
+    EXPECT_EQ((mega::node_vector{&recent, &middle, &old}), client.cli->getRecentNodes(10, 0, false));
+    EXPECT_EQ((mega::node_vector{&binned, &recent, &middle, &old}), client.cli->getRecentNodes(10, 0, true));
+    EXPECT_EQ((mega::node_vector{&recent, &middle}), client.cli->getRecentNodes(10, 150, false));
+    EXPECT_EQ((mega::node_vector{&binned, &recent}), client.cli->getRecentNodes(2, 0, true));
+
+    deleteNode(*client.cli, middle);
+    EXPECT_EQ((mega::node_vector{&recent, &old}), client.cli->getRecentNodes(10, 0, false));
+}
+
+TEST(Node, subnodeCountsFollowTreeChanges)
+{
+    MockClient client;
+    auto& root = mt::makeNode(*client.cli, mega::ROOTNODE, 1);
+    auto& a = mt::makeNode(*client.cli, mega::FOLDERNODE, 2, &root);
+    auto& b = mt::makeNode(*client.cli, mega::FOLDERNODE, 3, &a);
+
+    auto makeFile = [&](mega::handle h, mega::Node& parent, m_off_t size) -> mega::Node&
+    {
+        auto& n = mt::makeNode(*client.cli, mega::FILENODE, h, nullptr);
+        n.size = size;
+        n.setparent(&parent);
+        return n;
+    };
+
+    auto& f1 = makeFile(10, b, 100);
+    makeFile(11, f1, 10);   // a version of f1
+    makeFile(12, a, 1000);
+
+    auto check = [](const mega::Node& n, m_off_t storage, m_off_t versionStorage, size_t files, size_t folders, size_t versions)
+    {
+        auto nc = n.subnodeCounts();
+        EXPECT_EQ(storage, nc.storage);
+        EXPECT_EQ(versionStorage, nc.versionStorage);
+        EXPECT_EQ(files, nc.files);
+        EXPECT_EQ(folders, nc.folders);
+        EXPECT_EQ(versions, nc.versions);
+    };
+
+    check(root, 1110, 10, 3, 2, 1);
+    check(a, 1110, 10, 3, 2, 1);
+    check(b, 110, 10, 2, 1, 1);
+    check(f1, 110, 10, 2, 0, 1);
+
+    // moving a subtree
+    b.setparent(&root);
+    check(root, 1110, 10, 3, 2, 1);
+    check(a, 1000, 0, 1, 1, 0);
+    check(b, 110, 10, 2, 1, 1);
+
+    // a file becoming a version of another one
+    auto& f3 = *client.cli->nodebyhandle(12);
+    f3.setparent(&f1);
+    check(root, 1110, 1010, 3, 2, 2);
+    check(a, 0, 0, 0, 1, 0);
+    check(b, 1110, 1010, 3, 1, 2);
+
+    deleteNode(*client.cli, f3);
+    check(root, 110, 10, 2, 2, 1);
+    check(b, 110, 10, 2, 1, 1);
+}
+
+TEST(Node, lazyVersionsStayInTheCounts)
+{
+    MockClient client;
+    auto& root = mt::makeNode(*client.cli, mega::ROOTNODE, 1);
+    auto& a = mt::makeNode(*client.cli, mega::FOLDERNODE, 2, &root);
+    auto& f = mt::makeNode(*client.cli, mega::FILENODE, 10, nullptr);
+    f.size = 100;
+    f.setparent(&a);
+
+    // two versions left in the table
+    f.lazyversion(10, true);
+    f.lazyversion(20, true);
+    EXPECT_EQ(3u, f.subnodeCounts().files);
+    EXPECT_EQ(2u, a.subnodeCounts().versions);
+    EXPECT_EQ(130, root.subnodeCounts().storage);
+    EXPECT_EQ(30, root.subnodeCounts().versionStorage);
+
+    // one of them materialized: counted as a child instead
+    auto& v = mt::makeNode(*client.cli, mega::FILENODE, 11, nullptr);
+    v.size = 10;
+    v.setparent(&f);
+    f.lazyversion(10, false);
+    EXPECT_EQ(3u, f.subnodeCounts().files);
+    EXPECT_EQ(2u, a.subnodeCounts().versions);
+    EXPECT_EQ(130, root.subnodeCounts().storage);
+
+    // and the file, with what it holds, moves as a whole
+    auto& b = mt::makeNode(*client.cli, mega::FOLDERNODE, 3, &root);
+    f.setparent(&b);
+    EXPECT_EQ(0u, a.subnodeCounts().files);
+    EXPECT_EQ(3u, b.subnodeCounts().files);
+    EXPECT_EQ(30, b.subnodeCounts().versionStorage);
+}
+
+TEST(Node, subtreeRemovalUpdatesOnlyWhatRemains)
+{
+    MockClient client;
+    auto& root = mt::makeNode(*client.cli, mega::ROOTNODE, 1);
+    auto& a = mt::makeNode(*client.cli, mega::FOLDERNODE, 2, &root);
+    auto& b = mt::makeNode(*client.cli, mega::FOLDERNODE, 3, &a);
+    auto& c = mt::makeNode(*client.cli, mega::FOLDERNODE, 4, &b);
+
+    auto makeFile = [&](mega::handle h, mega::Node& parent, m_off_t size) -> mega::Node&
+    {
+        auto& n = mt::makeNode(*client.cli, mega::FILENODE, h, nullptr);
+        n.size = size;
+        n.setparent(&parent);
+        return n;
+    };
+
+    auto& f1 = makeFile(10, b, 100);
+    makeFile(11, f1, 10);   // a version of f1
+    makeFile(12, c, 5);
+    makeFile(13, a, 1000);
+
+    client.cli->rootnodes[0] = root.nodehandle;
+    client.cli->mNodeCounters[root.nodehandle] = root.subnodeCounts();
+
+    mega::TreeProcDel td;
+    client.cli->proctree(&b, &td);
+    client.cli->notifypurge();
+
+    for (mega::handle h : { 3, 4, 10, 11, 12 })
+    {
+        EXPECT_EQ(nullptr, client.cli->nodebyhandle(h));
+    }
+    EXPECT_EQ(1u, a.children.size());
+
+    auto nc = a.subnodeCounts();
+    EXPECT_EQ(1000, nc.storage);
+    EXPECT_EQ(0, nc.versionStorage);
+    EXPECT_EQ(1u, nc.files);
+    EXPECT_EQ(1u, nc.folders);
+    EXPECT_EQ(0u, nc.versions);
+
+    auto& total = client.cli->mNodeCounters[root.nodehandle];
+    EXPECT_EQ(1000, total.storage);
+    EXPECT_EQ(1u, total.files);
+    EXPECT_EQ(1u, total.folders);
+    EXPECT_EQ(0u, total.versions);
+}
+
+TEST(Node, readFetchNodesWhileDownloading)
+{
+    MockClient client;
+    client.cli->mFetchNodesStream.reset(new mega::MegaClient::FetchNodesStream);
+
+    // the first folder arrives before its parent; brackets and quotes in strings must not end a record
+    const std::string response = "[{\"f\":[{\"h\":\"AAAAAAAB\",\"t\":2},"
+                                 "{\"h\":\"AAAAAAAC\",\"p\":\"AAAAAAAD\",\"t\":1,\"a\":\"x\",\"k\":\"AAAAAAAAAAAAAAAAAAAAAA\"},"
+                                 "{\"h\":\"AAAAAAAD\",\"p\":\"AAAAAAAB\",\"t\":1,\"a\":\"}]\\\"{\",\"k\":\"AAAAAAAAAAAAAAAAAAAAAA\"}],"
+                                 "\"f2\":[{\"h\":\"AAAAAAAE\",\"t\":3}],\"ok\":[],\"sn\":\"AAAAAAAAAAA\"}]";
+
+    mega::HttpReq req;
+    for (size_t i = 0; i < response.size(); i += 5)
+    {
+        std::string chunk = response.substr(i, 5);
+        req.put(const_cast<char*>(chunk.data()), unsigned(chunk.size()), true);
+        client.cli->readfetchnodeschunk(&req, false);
+
+        // consumed records don't stay buffered
+        EXPECT_LT(req.size(), 120u);
+    }
+    client.cli->readfetchnodeschunk(&req, true);
+
+    auto h = [](const char* b64)
+    {
+        mega::handle h = 0;
+        mega::Base64::atob(b64, reinterpret_cast<mega::byte*>(&h), mega::MegaClient::NODEHANDLE);
+        return h;
+    };
+    EXPECT_EQ(4u, client.cli->nodes.size());
+    ASSERT_NE(nullptr, client.cli->nodebyhandle(h("AAAAAAAC")));
+    EXPECT_EQ(client.cli->nodebyhandle(h("AAAAAAAD")), client.cli->nodebyhandle(h("AAAAAAAC"))->parent);
+    EXPECT_NE(nullptr, client.cli->nodebyhandle(h("AAAAAAAE")));
+
+    // what's left for CommandFetchNodes
+    EXPECT_EQ("[{\"f\":[],\"ok\":[],\"sn\":\"AAAAAAAAAAA\"}]", req.in);
+}
+
+TEST(Node, recordReadOnAnotherThreadMatchesUnserialize)
+{
+    MockClient client;
+    auto& root = mt::makeNode(*client.cli, mega::ROOTNODE, 1);
+    auto& file = makeNamedNode(*client.cli, mega::FILENODE, 2, root, "name.txt");
+    file.attrs.map['c'] = "fingerprint";
+    file.size = 42;
+    file.setpubliclink(3, 100, 200, false);
+
+    std::string data;
+    ASSERT_TRUE(file.serialize(&data));
+
+    mega::NodeRecord record;
+    mega::FSACCESS_CLASS fs;
+    ASSERT_TRUE(record.unserialize(data, fs));
+    EXPECT_EQ(2u, record.h);
+    EXPECT_EQ(1u, record.ph);
+    EXPECT_EQ(mega::FILENODE, record.type);
+    EXPECT_EQ(42, record.size);
+    EXPECT_EQ(file.nodekey(), record.key);
+    EXPECT_EQ(file.attrs.map, record.attrs.map);
+    EXPECT_TRUE(record.exported);
+    EXPECT_EQ(3u, record.linkhandle);
+
+    // truncated records are rejected
+    mega::NodeRecord truncated;
+    EXPECT_FALSE(truncated.unserialize(data.substr(0, data.size() - 1), fs));
+
+    MockClient other;
+    mega::node_vector dp;
+    mega::Node* n = mega::Node::unserialize(other.cli.get(), record, &dp);
+    ASSERT_NE(nullptr, n);
+    EXPECT_EQ(file.attrs.map, n->attrs.map);
+    EXPECT_EQ(file.nodekey(), n->nodekey());
+    ASSERT_NE(nullptr, n->plink);
+    EXPECT_EQ(3u, n->plink->ph);
+    EXPECT_EQ(1u, dp.size());
+}
+
+TEST(Node, sortkeys_orderNamesNaturally)
+{
+    MockClient client;
+    auto& folder = mt::makeNode(*client.cli, mega::FOLDERNODE, 1);
+
+    auto key = [&](const std::string& name)
+    {
+        static mega::handle h = 100;
+        return makeNamedNode(*client.cli, mega::FILENODE, ++h, folder, name).sortkeys().name;
+    };
+
+    EXPECT_LT(key("file2"), key("file10"));
+    EXPECT_LT(key("a"), key("a1"));
+    EXPECT_LT(key("9z"), key(" z"));
+    EXPECT_LT(key("abc"), key("ABD"));
+    EXPECT_EQ(key("File01.txt"), key("file1.TXT"));
+    EXPECT_LT(key("x99999999999999999999"), key("x100000000000000000000"));
+}
+
+TEST(Node, sortkeys_rebuiltAfterChange)
+{
+    MockClient client;
+    auto& folder = mt::makeNode(*client.cli, mega::FOLDERNODE, 1);
+    auto& n = makeNamedNode(*client.cli, mega::FILENODE, 2, folder, "one");
+
+    EXPECT_FALSE(n.sortkeys().favourite);
+    std::string before = n.sortkeys().name;
+
+    n.attrs.map['n'] = "two";
+    n.attrs.map[mega::AttrMap::string2nameid("fav")] = "1";
+    n.dropsnapshot();
+
+    EXPECT_NE(before, n.sortkeys().name);
+    EXPECT_TRUE(n.sortkeys().favourite);
+}
+
+TEST(Node, memoryjson_growsWithTheNodes)
+{
+    MockClient client;
+    auto& folder = mt::makeNode(*client.cli, mega::FOLDERNODE, 1);
+
+    auto bytes = [&]()
+    {
+        mega::JSONWriter json;
+        json.beginobject();
+        client.cli->memoryjson(json);
+        json.endobject();
+
+        std::string s = json.getstring();
+        EXPECT_NE(std::string::npos, s.find("\"transferbuffers\":{"));
+
+        auto pos = s.find("\"nodes\":{\"count\":" + std::to_string(client.cli->nodes.size()) + ",\"bytes\":");
+        EXPECT_NE(std::string::npos, pos);
+        return std::stoll(s.substr(s.find("\"bytes\":", pos) + 8));
+    };
+
+    auto before = bytes();
+    EXPECT_GE(before, static_cast<long long>(sizeof(mega::Node)));
+
+    // the long names count too
+    makeNamedNode(*client.cli, mega::FILENODE, 2, folder, std::string(1000, 'x'));
+    EXPECT_GE(bytes(), before + static_cast<long long>(sizeof(mega::Node)) + 1000);
+}
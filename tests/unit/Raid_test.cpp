@@ -0,0 +1,213 @@
+/**
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include <mega/raid.h>
+
+namespace {
+
+using mega::RAIDPARTS;
+using mega::RAIDSECTOR;
+
+// restores the default combine on scope exit
+class CombineMode
+{
+public:
+    explicit CombineMode(bool vector)
+        : mPrevious(mega::RaidBufferManager::vectorcombine)
+    {
+        mega::RaidBufferManager::vectorcombine = vector;
+    }
+
+    ~CombineMode()
+    {
+        mega::RaidBufferManager::vectorcombine = mPrevious;
+    }
+
+private:
+    bool mPrevious;
+};
+
+// the 6 parts of data (of a whole number of raid lines): part 0 is the parity of the other 5
+std::vector<std::vector<mega::byte>> split(const std::vector<mega::byte>& data)
+{
+    size_t partslen = data.size() / (RAIDPARTS - 1);
+    std::vector<std::vector<mega::byte>> parts(RAIDPARTS, std::vector<mega::byte>(partslen));
+
+    for (size_t line = 0; line < partslen / RAIDSECTOR; ++line)
+    {
+        for (unsigned j = 1; j < RAIDPARTS; ++j)
+        {
+            for (unsigned k = 0; k < RAIDSECTOR; ++k)
+            {
+                mega::byte b = data[(line * (RAIDPARTS - 1) + j - 1) * RAIDSECTOR + k];
+                parts[j][line * RAIDSECTOR + k] = b;
+                parts[0][line * RAIDSECTOR + k] ^= b;
+            }
+        }
+    }
+    return parts;
+}
+
+void combine(std::vector<std::vector<mega::byte>>& parts, unsigned missing, bool vector, std::vector<mega::byte>& result)
+{
+    CombineMode mode(vector);
+
+    mega::byte* inputbufs[RAIDPARTS];
+    for (unsigned j = RAIDPARTS; j--; )
+    {
+        inputbufs[j] = j == missing ? nullptr : parts[j].data();
+    }
+
+    result.assign(parts[0].size() * (RAIDPARTS - 1), 0);
+    mega::RaidBufferManager::combineRaidLines(result.data(), inputbufs, parts[0].size());
+}
+
+std::vector<mega::byte> randomData(size_t lines)
+{
+    std::mt19937 rng(42);
+    std::vector<mega::byte> data(lines * RAIDSECTOR * (RAIDPARTS - 1));
+    for (auto& b : data)
+    {
+        b = mega::byte(rng());
+    }
+    return data;
+}
+
+// combines the parts as streaming would, without the decryption
+class PlainRaidBuffers : public mega::RaidBufferManager
+{
+    void finalize(FilePiece&) override { }
+    m_off_t calcOutputChunkPos(m_off_t acquiredpos) override { return acquiredpos; }
+};
+
+// submit the lines [from, to) of a part
+void submitLines(mega::RaidBufferManager& buffers, unsigned part, const std::vector<mega::byte>& data, size_t from, size_t to)
+{
+    auto piece = new mega::RaidBufferManager::FilePiece(m_off_t(from * RAIDSECTOR), (to - from) * RAIDSECTOR);
+    memcpy(piece->buf.datastart(), data.data() + from * RAIDSECTOR, (to - from) * RAIDSECTOR);
+    buffers.submitBuffer(part, piece);
+}
+
+} // anonymous
+
+TEST(Raid, hedgedPartsBuildLinesFromTheFirstFive)
+{
+    // two chunks (of the smallest size) of raid lines
+    const size_t chunk = 8 * 1024;
+    auto data = randomData(2 * chunk);
+    auto parts = split(data);
+
+    PlainRaidBuffers buffers;
+    buffers.setHedging(true);
+    buffers.setIsRaid(std::vector<std::string>(RAIDPARTS, "http://raid"), 0, data.size(), data.size(), 0);
+
+    // the parity is slow: the first chunk is built without it
+    for (unsigned j = 1; j < RAIDPARTS; ++j)
+    {
+        submitLines(buffers, j, parts[j], 0, chunk);
+    }
+
+    auto output = buffers.getAsyncOutputBufferPointer(0);
+    ASSERT_TRUE(output);
+    ASSERT_EQ(chunk * mega::RAIDLINE, output->buf.datalen());
+    EXPECT_TRUE(std::equal(data.begin(), data.begin() + chunk * mega::RAIDLINE, output->buf.datastart()));
+    buffers.bufferWriteCompleted(0, true);
+
+    // a whole chunk behind: better sent again
+    EXPECT_TRUE(buffers.isRaidConnectionSuperseded(0));
+    EXPECT_FALSE(buffers.isRaidConnectionSuperseded(1));
+
+    // what it sends for lines built already is dropped, and the rest kept
+    submitLines(buffers, 0, parts[0], 0, chunk + 4096);
+    EXPECT_FALSE(buffers.isRaidConnectionSuperseded(0));
+    EXPECT_EQ(m_off_t(4096 * RAIDSECTOR), buffers.progress());
+
+    // now a data part is the slowest, and is left out: its lines are recovered from the parity
+    for (unsigned j = 1; j < RAIDPARTS; ++j)
+    {
+        submitLines(buffers, j, parts[j], chunk, j == 4 ? chunk + 2048 : 2 * chunk);
+    }
+
+    output = buffers.getAsyncOutputBufferPointer(0);
+    ASSERT_TRUE(output);
+    ASSERT_EQ(4096 * mega::RAIDLINE, output->buf.datalen());
+    EXPECT_TRUE(std::equal(data.begin() + chunk * mega::RAIDLINE, data.begin() + (chunk + 4096) * mega::RAIDLINE, output->buf.datastart()));
+    buffers.bufferWriteCompleted(0, true);
+}
+
+TEST(Raid, combineRaidLinesRecoversAnyPart)
+{
+    auto data = randomData(1000);
+    auto parts = split(data);
+
+    // RAIDPARTS: none missing
+    std::vector<mega::byte> result;
+    for (unsigned missing = 0; missing <= RAIDPARTS; ++missing)
+    {
+        combine(parts, missing, false, result);
+        EXPECT_EQ(data, result) << "scalar, missing part " << missing;
+        combine(parts, missing, true, result);
+        EXPECT_EQ(data, result) << "vector, missing part " << missing;
+    }
+}
+
+TEST(Raid, combineRaidLinesSpeed)
+{
+    // 5 MB from each part, as from a large request per connection
+    auto data = randomData(5 * 1024 * 1024 / RAIDSECTOR);
+    auto parts = split(data);
+
+    using clock = std::chrono::steady_clock;
+
+    // the output buffer exists already, as in RaidBufferManager::combineRaidParts
+    std::vector<mega::byte> result(data.size());
+    mega::byte* inputbufs[RAIDPARTS];
+
+    auto rate = [&](unsigned missing, bool vector)
+    {
+        CombineMode mode(vector);
+        for (unsigned j = RAIDPARTS; j--; )
+        {
+            inputbufs[j] = j == missing ? nullptr : parts[j].data();
+        }
+
+        const int rounds = 10;
+        auto start = clock::now();
+        for (int i = 0; i < rounds; ++i)
+        {
+            mega::RaidBufferManager::combineRaidLines(result.data(), inputbufs, parts[0].size());
+        }
+        double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        EXPECT_EQ(data, result);
+        return double(data.size()) * rounds / std::max(seconds, 1e-9) / 1e9;
+    };
+
+    for (unsigned missing : { 0u, 3u })
+    {
+        std::cout << "[          ] combining " << data.size() / (1024 * 1024) << " MB, missing part " << missing
+                  << ": scalar " << rate(missing, false) << " GB/s, vector " << rate(missing, true) << " GB/s" << std::endl;
+    }
+}
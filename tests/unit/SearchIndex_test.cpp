@@ -0,0 +1,94 @@
+/**
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include <mega/searchindex.h>
+
+namespace {
+
+// the index never dereferences the nodes
+mega::Node* fakeNode(uintptr_t id)
+{
+    return reinterpret_cast<mega::Node*>(id * 8);
+}
+
+mega::node_vector sorted(mega::node_vector v)
+{
+    std::sort(v.begin(), v.end());
+    return v;
+}
+
+}
+
+TEST(SearchIndex, findsCaseInsensitiveSubstrings)
+{
+    mega::SearchIndex index;
+    index.update(fakeNode(1), "Holiday Photos", 0);
+    index.update(fakeNode(2), "IMG_0001.JPG", mega::SearchIndex::TYPE_PHOTO);
+    index.update(fakeNode(3), "img_0002.jpg", mega::SearchIndex::TYPE_PHOTO);
+    index.update(fakeNode(4), "notes.txt", mega::SearchIndex::TYPE_DOCUMENT);
+
+    EXPECT_EQ(4u, index.size());
+    EXPECT_EQ(sorted({fakeNode(2), fakeNode(3)}), sorted(index.find("img_000", 0)));
+    EXPECT_EQ(sorted({fakeNode(2), fakeNode(3)}), sorted(index.find(".Jpg", 0)));
+    EXPECT_EQ(mega::node_vector{fakeNode(1)}, index.find("day pho", 0));
+    EXPECT_TRUE(index.find("photos!", 0).empty());
+    EXPECT_TRUE(index.find("xyz", 0).empty());
+
+    // searches too short for trigrams
+    EXPECT_EQ(sorted({fakeNode(1), fakeNode(4)}), sorted(index.find("o", 0)));
+    EXPECT_EQ(4u, index.find("", 0).size());
+    EXPECT_EQ(4u, index.find(nullptr, 0).size());
+}
+
+TEST(SearchIndex, filtersByType)
+{
+    mega::SearchIndex index;
+    index.update(fakeNode(1), "a.jpg", mega::SearchIndex::TYPE_PHOTO);
+    index.update(fakeNode(2), "a.mp4", mega::SearchIndex::TYPE_VIDEO);
+    index.update(fakeNode(3), "a.pdf", mega::SearchIndex::TYPE_DOCUMENT);
+
+    EXPECT_EQ(mega::node_vector{fakeNode(2)}, index.find(nullptr, mega::SearchIndex::TYPE_VIDEO));
+    EXPECT_EQ(mega::node_vector{fakeNode(3)}, index.find("a.", mega::SearchIndex::TYPE_DOCUMENT));
+    EXPECT_TRUE(index.find("mp4", mega::SearchIndex::TYPE_AUDIO).empty());
+}
+
+TEST(SearchIndex, followsRenamesAndRemovals)
+{
+    mega::SearchIndex index;
+    index.update(fakeNode(1), "draft report.doc", mega::SearchIndex::TYPE_DOCUMENT);
+    index.update(fakeNode(2), "final report.doc", mega::SearchIndex::TYPE_DOCUMENT);
+
+    index.update(fakeNode(1), "archive.zip", 0);
+    EXPECT_EQ(2u, index.size());
+    EXPECT_EQ(mega::node_vector{fakeNode(2)}, index.find("report", 0));
+    EXPECT_EQ(mega::node_vector{fakeNode(1)}, index.find("archive", 0));
+    EXPECT_TRUE(index.find("archive", mega::SearchIndex::TYPE_DOCUMENT).empty());
+
+    index.remove(fakeNode(2));
+    index.remove(fakeNode(3));
+    EXPECT_EQ(1u, index.size());
+    EXPECT_TRUE(index.find("report", 0).empty());
+
+    index.clear();
+    EXPECT_EQ(0u, index.size());
+    EXPECT_TRUE(index.find("archive", 0).empty());
+}
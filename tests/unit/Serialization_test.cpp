@@ -311,6 +311,50 @@ TEST(Serialization, CacheableReaderWriter_fsfp_t)
     ASSERT_EQ(42, fsfp);
 }
 
+TEST(Serialization, CacheableReaderWriter_varint)
+{
+    std::string data;
+    mega::CacheableWriter w(data);
+    w.serializevarint(0);
+    w.serializevarint(127);
+    w.serializevarint(128);
+    w.serializevarint(UINT64_MAX);
+    w.serializesignedvarint(-1);
+    w.serializesignedvarint(INT64_MIN);
+    w.serializevarstring("abc");
+
+    // one byte up to 127, and small negative numbers are small too
+    ASSERT_EQ(1u + 1u + 2u + 10u + 1u + 10u + 4u, data.size());
+
+    mega::CacheableReader r(data);
+    uint64_t u;
+    int64_t i;
+    std::string str;
+    ASSERT_TRUE(r.unserializevarint(u));
+    ASSERT_EQ(0u, u);
+    ASSERT_TRUE(r.unserializevarint(u));
+    ASSERT_EQ(127u, u);
+    ASSERT_TRUE(r.unserializevarint(u));
+    ASSERT_EQ(128u, u);
+    ASSERT_TRUE(r.unserializevarint(u));
+    ASSERT_EQ(UINT64_MAX, u);
+    ASSERT_TRUE(r.unserializesignedvarint(i));
+    ASSERT_EQ(-1, i);
+    ASSERT_TRUE(r.unserializesignedvarint(i));
+    ASSERT_EQ(INT64_MIN, i);
+    ASSERT_TRUE(r.unserializevarstring(str));
+    ASSERT_EQ("abc", str);
+    ASSERT_FALSE(r.hasdataleft());
+
+    // truncated
+    std::string partial = data.substr(0, 3);
+    mega::CacheableReader p(partial);
+    ASSERT_TRUE(p.unserializevarint(u));
+    ASSERT_TRUE(p.unserializevarint(u));
+    ASSERT_FALSE(p.unserializevarint(u));
+    ASSERT_EQ(partial.data() + 2, p.ptr);
+}
+
 namespace {
 
 //struct MockFileSystemAccess : mt::DefaultedFileSystemAccess
@@ -944,3 +988,93 @@ TEST(Serialization, Node_forFolder_withoutShares_32bit)
     auto dn = mega::Node::unserialize(client.cli.get(), &data, &dp);
     checkDeserializedNode(*dn, *n, true);
 }
+
+TEST(Serialization, Node_compact_forFile)
+{
+    MockClient client;
+    auto& parent = mt::makeNode(*client.cli, mega::FOLDERNODE, 43);
+    std::unique_ptr<mega::Node> n{&mt::makeNode(*client.cli, mega::FILENODE, 42, &parent)};
+    n->size = 12;
+    n->owner = 88;
+    n->ctime = 44;
+    n->attrs.map = {
+        {'n', "name"},
+        {101, "foo"},
+    };
+    n->fileattrstring = "blah";
+    n->plink = new mega::PublicLink{n->nodehandle, 1, 2, true, "someAuthKey"};
+
+    std::string legacy;
+    ASSERT_TRUE(n->serialize(&legacy));
+
+    client.cli->compactnoderecords = true;
+    std::string data;
+    ASSERT_TRUE(n->serialize(&data));
+    ASSERT_LT(data.size(), legacy.size());
+
+    mega::node_vector dp;
+    auto dn = mega::Node::unserialize(client.cli.get(), &data, &dp);
+    ASSERT_NE(nullptr, dn);
+    checkDeserializedNode(*dn, *n);
+    ASSERT_EQ(n->plink->mAuthKey, dn->plink->mAuthKey);
+
+    // either encoding reads back the same
+    mega::NodeRecord fromLegacy, fromCompact;
+    ASSERT_TRUE(fromLegacy.unserialize(legacy, *client.cli->fsaccess));
+    ASSERT_TRUE(fromCompact.unserialize(data, *client.cli->fsaccess));
+    ASSERT_EQ(fromLegacy.size, fromCompact.size);
+    ASSERT_EQ(fromLegacy.ph, fromCompact.ph);
+    ASSERT_EQ(fromLegacy.key, fromCompact.key);
+    ASSERT_EQ(fromLegacy.fileattrstring, fromCompact.fileattrstring);
+    ASSERT_EQ(fromLegacy.attrs.map, fromCompact.attrs.map);
+}
+
+TEST(Serialization, Node_compact_forFolder_withoutParent)
+{
+    MockClient client;
+    client.cli->compactnoderecords = true;
+    client.cli->compressnoderecords = true;
+    std::unique_ptr<mega::Node> n{&mt::makeNode(*client.cli, mega::FOLDERNODE, 42)};
+    n->size = -1;
+    n->owner = 43;
+    n->ctime = 44;
+    n->attrs.map = {
+        {'n', std::string(200, 'x')},
+    };
+
+    std::string data;
+    ASSERT_TRUE(n->serialize(&data));
+#ifdef USE_ZLIB
+    ASSERT_LT(data.size(), 100u);
+#endif
+
+    mega::node_vector dp;
+    auto dn = mega::Node::unserialize(client.cli.get(), &data, &dp);
+    ASSERT_NE(nullptr, dn);
+    checkDeserializedNode(*dn, *n);
+
+    // a truncated record is rejected
+    data.resize(data.size() - 1);
+    ASSERT_EQ(nullptr, mega::Node::unserialize(client.cli.get(), &data, &dp));
+}
+
+#ifdef ENABLE_SYNC
+TEST(Serialization, SyncDeletions)
+{
+    mega::MegaClient::SyncDeletions deletions;
+    deletions.todebris = {1, 2, 0xffffffffffff};
+    deletions.tounlink = {3};
+
+    std::string data;
+    ASSERT_TRUE(deletions.serialize(&data));
+
+    mega::MegaClient::SyncDeletions read;
+    ASSERT_TRUE(read.unserialize(data));
+    ASSERT_EQ(deletions.todebris, read.todebris);
+    ASSERT_EQ(deletions.tounlink, read.tounlink);
+
+    // a truncated record is rejected
+    data.resize(data.size() - 1);
+    ASSERT_FALSE(read.unserialize(data));
+}
+#endif
@@ -18,8 +18,11 @@
 
 #include <gtest/gtest.h>
 
+#include <mega.h>
 #include <mega/share.h>
 
+#include "utils.h"
+
 void checkNewShares(const mega::NewShare& exp, const mega::NewShare& act)
 {
     ASSERT_EQ(exp.h, act.h);
@@ -69,3 +72,34 @@ TEST(Share, unserialize_32bit)
     const mega::NewShare expectedNewShare{100, -1, 42, mega::RDONLY, 13, key, NULL, 123};
     checkNewShares(expectedNewShare, *newShare);
 }
+
+TEST(Share, outSharesAreIndexedByPeer)
+{
+    mega::MegaApp app;
+    ::mega::FSACCESS_CLASS fs;
+    auto client = mt::makeClient(app, fs);
+
+    auto& root = mt::makeNode(*client, mega::ROOTNODE, 1);
+    auto& folder = mt::makeNode(*client, mega::FOLDERNODE, 2, &root);
+    auto& subfolder = mt::makeNode(*client, mega::FOLDERNODE, 3, &folder);
+
+    client->newshares.push_back(new mega::NewShare(2, 1, 42, mega::FULL, 0, nullptr));
+    client->newshares.push_back(new mega::NewShare(3, 1, 42, mega::RDONLY, 0, nullptr));
+    client->newshares.push_back(new mega::NewShare(3, 1, mega::UNDEF, mega::RDONLY, 0, nullptr, nullptr, 77));
+    client->mergenewshares(false);
+
+    ASSERT_EQ(2u, client->outsharesbypeer.size());
+    EXPECT_EQ(mega::handle_set({ 2, 3 }), client->outsharesbypeer[42]);
+    EXPECT_EQ(mega::handle_set({ 3 }), client->outsharesbypeer[77]);
+    ASSERT_TRUE(subfolder.pendingshares);
+
+    // the share removed leaves the index, and the peer with it once it has no others
+    client->newshares.push_back(new mega::NewShare(2, 1, 42, mega::ACCESS_UNKNOWN, 0, nullptr));
+    client->newshares.push_back(new mega::NewShare(3, 1, mega::UNDEF, mega::ACCESS_UNKNOWN, 0, nullptr, nullptr, 77));
+    client->mergenewshares(false);
+
+    ASSERT_EQ(1u, client->outsharesbypeer.size());
+    EXPECT_EQ(mega::handle_set({ 3 }), client->outsharesbypeer[42]);
+    EXPECT_FALSE(folder.outshares);
+    EXPECT_FALSE(subfolder.pendingshares);
+}
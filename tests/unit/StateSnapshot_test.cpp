@@ -0,0 +1,210 @@
+/**
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <map>
+
+#include <gtest/gtest.h>
+
+#include <mega/statesnapshot.h>
+#include "megafs.h"
+
+#include "DefaultedDbTable.h"
+
+namespace {
+
+using Records = std::vector<std::pair<uint32_t, std::string>>;
+
+// no transactions; enough for SnapshottedDbTable to forward to
+class MemoryDbTable : public mt::DefaultedDbTable
+{
+public:
+    using mt::DefaultedDbTable::DefaultedDbTable;
+
+    bool put(uint32_t id, char* data, unsigned size) override
+    {
+        records[id].assign(data, size);
+        return true;
+    }
+
+    bool del(uint32_t id) override
+    {
+        records.erase(id);
+        return true;
+    }
+
+    void truncate() override { records.clear(); }
+    void begin() override { }
+    void commit() override { }
+    void abort() override { }
+    bool inTransaction() const override { return true; }
+
+    std::map<uint32_t, std::string> records;
+};
+
+class StateSnapshotTest : public ::testing::Test
+{
+public:
+    StateSnapshotTest()
+    {
+        fsAccess.cwd(rootPath);
+        rootPath.appendWithSeparator(mega::LocalPath::fromPath("snapshot", fsAccess), false);
+        fsAccess.emptydirlocal(rootPath);
+        fsAccess.rmdirlocal(rootPath);
+        fsAccess.mkdirlocal(rootPath, false);
+    }
+
+    ~StateSnapshotTest()
+    {
+        fsAccess.emptydirlocal(rootPath);
+        fsAccess.rmdirlocal(rootPath);
+    }
+
+    std::unique_ptr<mega::StateSnapshot> snapshot()
+    {
+        return std::unique_ptr<mega::StateSnapshot>(new mega::StateSnapshot(fsAccess, rootPath, "test"));
+    }
+
+    static std::string scsn(mega::handle h)
+    {
+        return std::string(reinterpret_cast<const char*>(&h), sizeof h);
+    }
+
+    static Records all(mega::StateSnapshot& s)
+    {
+        Records records;
+        uint32_t id;
+        std::string data;
+
+        while (s.next(&id, &data))
+        {
+            records.emplace_back(id, data);
+        }
+        return records;
+    }
+
+    void writeImage(mega::StateSnapshot& s, const Records& records)
+    {
+        ASSERT_TRUE(s.beginimage());
+        for (auto& r : records)
+        {
+            ASSERT_TRUE(s.addrecord(r.first, r.second.data(), r.second.size()));
+        }
+        ASSERT_TRUE(s.endimage());
+    }
+
+    mega::FSACCESS_CLASS fsAccess;
+    mega::PrnGen rng;
+    mega::LocalPath rootPath;
+};
+
+} // anonymous
+
+TEST_F(StateSnapshotTest, imageIsReadBackInOrder)
+{
+    Records image = { {0, scsn(1)}, {32 | 1, "root"}, {16 | 1, "child"}, {48 | 2, "user"} };
+
+    auto s = snapshot();
+    EXPECT_TRUE(s->imagedue());
+    writeImage(*s, image);
+    EXPECT_FALSE(s->imagedue());
+
+    auto loaded = snapshot();
+    EXPECT_FALSE(loaded->load(2));
+
+    // a mismatch discards the files
+    loaded = snapshot();
+    EXPECT_FALSE(loaded->load(1));
+
+    s = snapshot();
+    writeImage(*s, image);
+    loaded = snapshot();
+    ASSERT_TRUE(loaded->load(1));
+    EXPECT_EQ(image, all(*loaded));
+}
+
+TEST_F(StateSnapshotTest, committedChangesAreReplayed)
+{
+    std::unique_ptr<mega::DbTable> table(new MemoryDbTable(rng, false));
+    auto memory = static_cast<MemoryDbTable*>(table.get());
+    mega::SnapshottedDbTable snapshotted(rng, std::move(table), snapshot());
+
+    writeImage(snapshotted.snapshot(), { {0, scsn(1)}, {16 | 1, "a"}, {32 | 1, "b"}, {48 | 1, "c"} });
+
+    std::string s2 = scsn(2), b2 = "b2", d = "d";
+    snapshotted.put(0, &s2[0], unsigned(s2.size()));
+    snapshotted.put(32 | 1, &b2[0], unsigned(b2.size()));
+    snapshotted.del(16 | 1);
+    snapshotted.put(64 | 1, &d[0], unsigned(d.size()));
+    snapshotted.commit();
+    EXPECT_EQ(s2, memory->records[0]);
+
+    // not committed: must not show up
+    std::string s3 = scsn(3), e = "e";
+    snapshotted.put(0, &s3[0], unsigned(s3.size()));
+    snapshotted.put(80 | 1, &e[0], unsigned(e.size()));
+    snapshotted.abort();
+
+    auto loaded = snapshot();
+    ASSERT_TRUE(loaded->load(2));
+    Records expected = { {48 | 1, "c"}, {0, s2}, {32 | 1, "b2"}, {64 | 1, "d"} };
+    EXPECT_EQ(expected, all(*loaded));
+
+    // the loaded snapshot keeps logging after what it replayed
+    std::string s4 = scsn(4);
+    loaded->logput(0, s4.data(), unsigned(s4.size()));
+    loaded->logdel(48 | 1);
+    loaded->logcommit();
+
+    loaded = snapshot();
+    ASSERT_TRUE(loaded->load(4));
+    expected = { {32 | 1, "b2"}, {64 | 1, "d"}, {0, s4} };
+    EXPECT_EQ(expected, all(*loaded));
+}
+
+TEST_F(StateSnapshotTest, truncateDiscardsTheSnapshot)
+{
+    std::unique_ptr<mega::DbTable> table(new MemoryDbTable(rng, false));
+    mega::SnapshottedDbTable snapshotted(rng, std::move(table), snapshot());
+
+    writeImage(snapshotted.snapshot(), { {0, scsn(1)}, {16 | 1, "a"} });
+    snapshotted.truncate();
+    EXPECT_TRUE(snapshotted.snapshot().imagedue());
+
+    EXPECT_FALSE(snapshot()->load(1));
+}
+
+TEST_F(StateSnapshotTest, batchesAreLogged)
+{
+    std::unique_ptr<mega::DbTable> table(new MemoryDbTable(rng, false));
+    auto memory = static_cast<MemoryDbTable*>(table.get());
+    mega::SnapshottedDbTable snapshotted(rng, std::move(table), snapshot());
+
+    writeImage(snapshotted.snapshot(), { {0, scsn(1)}, {16 | 1, "a"}, {32 | 1, "b"} });
+
+    mega::DbTable::RecordBatch puts = { {0, scsn(2)}, {48 | 1, "c"}, {64 | 1, "d"} };
+    ASSERT_TRUE(snapshotted.delBatch({16 | 1, 32 | 1}));
+    ASSERT_TRUE(snapshotted.putBatch(puts));
+    snapshotted.commit();
+
+    EXPECT_EQ(0u, memory->records.count(16 | 1));
+    EXPECT_EQ("d", memory->records[64 | 1]);
+
+    auto loaded = snapshot();
+    ASSERT_TRUE(loaded->load(2));
+    EXPECT_EQ(puts, all(*loaded));
+}
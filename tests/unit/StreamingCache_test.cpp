@@ -0,0 +1,129 @@
+/**
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <gtest/gtest.h>
+
+#include <mega/streamingcache.h>
+#include <mega/waiter.h>
+
+namespace {
+
+// the bytes of a file are their position, mod 256
+std::string fileData(m_off_t pos, size_t len)
+{
+    std::string data(len, 0);
+    for (size_t i = 0; i < len; ++i)
+    {
+        data[i] = char((pos + m_off_t(i)) & 0xff);
+    }
+    return data;
+}
+
+void put(mega::StreamingCache& cache, mega::handle h, m_off_t pos, size_t len)
+{
+    auto data = fileData(pos, len);
+    cache.put(h, pos, reinterpret_cast<const mega::byte*>(data.data()), len);
+}
+
+std::string get(mega::StreamingCache& cache, mega::handle h, m_off_t pos, m_off_t len)
+{
+    std::string out;
+    size_t n = cache.get(h, pos, len, out);
+    EXPECT_EQ(out.size(), n);
+    return out;
+}
+
+} // anonymous
+
+TEST(StreamingCache, keepsNothingWithoutCapacity)
+{
+    mega::StreamingCache cache;
+    put(cache, 1, 0, 100);
+    EXPECT_EQ(0, cache.size());
+    EXPECT_EQ("", get(cache, 1, 0, 100));
+    EXPECT_EQ(0, cache.readahead(1, 0, 100, 1000));
+}
+
+TEST(StreamingCache, servesContiguousRuns)
+{
+    mega::StreamingCache cache;
+    cache.setCapacity(1000);
+
+    put(cache, 1, 100, 100);
+    put(cache, 1, 300, 100);
+
+    // overlaps keep only the gaps
+    put(cache, 1, 150, 200);
+    EXPECT_EQ(300, cache.size());
+
+    EXPECT_EQ(fileData(120, 280), get(cache, 1, 120, 1000));
+    EXPECT_EQ(fileData(180, 20), get(cache, 1, 180, 20));
+    EXPECT_EQ("", get(cache, 1, 50, 100));
+    EXPECT_EQ("", get(cache, 1, 400, 100));
+    EXPECT_EQ("", get(cache, 2, 120, 100));
+
+    cache.remove(1);
+    EXPECT_EQ(0, cache.size());
+    EXPECT_EQ("", get(cache, 1, 120, 100));
+}
+
+TEST(StreamingCache, dropsTheLeastRecentlyUsed)
+{
+    mega::StreamingCache cache;
+    cache.setCapacity(300);
+
+    put(cache, 1, 0, 100);
+    put(cache, 2, 0, 100);
+    put(cache, 1, 100, 100);
+
+    // read again: the segment of node 2 is now the oldest
+    get(cache, 1, 0, 100);
+
+    put(cache, 3, 0, 100);
+    EXPECT_EQ(300, cache.size());
+    EXPECT_EQ("", get(cache, 2, 0, 100));
+    EXPECT_EQ(fileData(0, 200), get(cache, 1, 0, 200));
+
+    // that read used the second segment last
+    cache.setCapacity(100);
+    EXPECT_EQ(100, cache.size());
+    EXPECT_EQ("", get(cache, 1, 0, 100));
+    EXPECT_EQ(fileData(100, 100), get(cache, 1, 100, 100));
+}
+
+TEST(StreamingCache, readsAheadAtThePlaybackRate)
+{
+    mega::StreamingCache cache;
+    cache.setCapacity(100 * 1024 * 1024);
+
+    const m_off_t minrate = 1000;
+    mega::Waiter::ds = 1000;
+    EXPECT_EQ(minrate * mega::StreamingCache::READAHEADSECONDS, cache.readahead(1, 0, 100000, minrate));
+
+    // the next read, a second later, shows 100 KB/s
+    mega::Waiter::ds += 10;
+    EXPECT_EQ(100000 * mega::StreamingCache::READAHEADSECONDS, cache.readahead(1, 100000, 100000, minrate));
+
+    // a seek starts over
+    mega::Waiter::ds += 10;
+    EXPECT_EQ(minrate * mega::StreamingCache::READAHEADSECONDS, cache.readahead(1, 5000000, 100000, minrate));
+
+    // and never more than a quarter of the cache
+    cache.setCapacity(4000);
+    EXPECT_EQ(1000, cache.readahead(1, 0, 100000, minrate));
+}
@@ -16,6 +16,7 @@
  * program.
  */
 
+#include <iostream>
 #include <memory>
 #include <numeric>
 
@@ -28,6 +29,7 @@
 #include <mega/heartbeats.h>
 #include <mega/sync.h>
 #include <mega/filesystem.h>
+#include <mega/db/memory.h>
 
 #include "constants.h"
 #include "FsNode.h"
@@ -158,7 +160,7 @@ public:
 
     bool dopen(mega::LocalPath* path, mega::FileAccess* fa, bool) override
     {
-        assert(fa->type == mega::FOLDERNODE);
+        assert(!fa || fa->type == mega::FOLDERNODE);
         const auto fsNodePair = mFsNodes.find(*path);
         if (fsNodePair != mFsNodes.end())
         {
@@ -171,7 +173,7 @@ public:
         }
     }
 
-    bool dnext(mega::LocalPath& localpath, mega::LocalPath& localname, bool = true, mega::nodetype_t* = NULL) override
+    bool dnext(mega::LocalPath& localpath, mega::LocalPath& localname, bool = true, mega::nodetype_t* type = NULL) override
     {
         assert(mCurrentFsNode);
         assert(mCurrentFsNode->getPath() == localpath);
@@ -179,6 +181,10 @@ public:
         if (mCurrentChildIndex < children.size())
         {
             localname = children[mCurrentChildIndex]->getName();
+            if (type)
+            {
+                *type = children[mCurrentChildIndex]->getType();
+            }
             ++mCurrentChildIndex;
             return true;
         }
@@ -251,12 +257,12 @@ struct Fixture
 
     bool iteratorsCorrect(mega::LocalNode& l) const
     {
-        if (l.fsid_it == mLocalNodes.end())
+        if (!l.fsid_mapped)
         {
             return false;
         }
         auto localNodePair = mLocalNodes.find(l.fsid);
-        if (l.fsid_it != localNodePair)
+        if (localNodePair == mLocalNodes.end())
         {
             return false;
         }
@@ -1090,6 +1096,379 @@ TEST(Sync, assignFilesystemIds_whenFileTypeIsUnexpected_hittingAssert)
 #endif
 */
 
+TEST(Sync, AsyncDirLister_listsFoldersOnTheWorkers)
+{
+    struct NullWaiter : mega::Waiter
+    {
+        int wait() override { return 0; }
+        void notify() override {}
+    };
+
+    mt::FsNode d{nullptr, mega::FOLDERNODE, "d"};
+    mt::FsNode d_0{&d, mega::FOLDERNODE, "d_0"};
+    mt::FsNode f_1{&d, mega::FILENODE, "f_1"};
+
+    std::map<LocalPath, const mt::FsNode*> fsNodes;
+    mt::collectAllFsNodes(fsNodes, d);
+    MockFileSystemAccess fsAccess{fsNodes};
+
+    NullWaiter waiter;
+    mega::MegaClientAsyncQueue queue(waiter, 2);
+    mega::AsyncDirLister lister(queue, fsAccess);
+
+    ASSERT_TRUE(lister.request(d.getPath(), false));
+    ASSERT_TRUE(lister.request(d_0.getPath(), false));
+
+    // as dnext() found them, with the metadata of the entries
+    mega::AsyncDirLister::Listing listing;
+    ASSERT_TRUE(lister.take(d.getPath(), listing));
+    ASSERT_TRUE(listing.opened);
+    ASSERT_EQ(2u, listing.entries.size());
+    ASSERT_EQ(d_0.getName(), listing.entries[0].name);
+    ASSERT_EQ(mega::FOLDERNODE, listing.entries[0].type);
+    ASSERT_EQ(f_1.getName(), listing.entries[1].name);
+    ASSERT_EQ(mega::FILENODE, listing.entries[1].type);
+    ASSERT_TRUE(listing.entries[1].statok);
+    ASSERT_EQ(f_1.getSize(), listing.entries[1].size);
+    ASSERT_EQ(f_1.getFsId(), listing.entries[1].fsid);
+
+    // each listing is taken once
+    ASSERT_FALSE(lister.take(d.getPath(), listing));
+    ASSERT_TRUE(lister.take(d_0.getPath(), listing));
+    ASSERT_TRUE(listing.opened);
+    ASSERT_TRUE(listing.entries.empty());
+
+    // and those not requested are listed by the caller
+    mega::AsyncDirLister::list(fsAccess, d.getPath(), false, listing);
+    ASSERT_EQ(2u, listing.entries.size());
+    mega::AsyncDirLister::list(fsAccess, LocalPath::fromPlatformEncoded("missing"), false, listing);
+    ASSERT_FALSE(listing.opened);
+    ASSERT_TRUE(listing.entries.empty());
+}
+
+TEST(Sync, LocalNode_setsyncdirtyMarksTheWayToTheChange)
+{
+    Fixture fx{"d"};
+
+    mega::LocalNode& ld = *fx.mSync->localroot;
+    auto ld_0 = mt::makeLocalNode(*fx.mSync, ld, mega::FOLDERNODE, "d_0");
+    auto ld_1 = mt::makeLocalNode(*fx.mSync, ld, mega::FOLDERNODE, "d_1");
+    auto ld_0_0 = mt::makeLocalNode(*fx.mSync, *ld_0, mega::FOLDERNODE, "d_0_0");
+    auto lf_0_0_0 = mt::makeLocalNode(*fx.mSync, *ld_0_0, mega::FILENODE, "f_0_0_0");
+
+    // passes over every folder, ended bottom up as syncdown() and syncup() do
+    for (mega::LocalNode* l : { ld_0_0.get(), ld_0.get(), ld_1.get(), &ld })
+    {
+        l->syncdowndirty = false;
+        l->syncupdirty = false;
+        l->endsyncdown();
+        l->endsyncup();
+    }
+    ASSERT_FALSE(ld.syncdownsubtree);
+    ASSERT_FALSE(ld.syncupsubtree);
+
+    // a change of the file marks its folder, and only the way to it above
+    lf_0_0_0->setsyncdirty();
+    ASSERT_TRUE(ld_0_0->syncdowndirty);
+    ASSERT_TRUE(ld_0_0->syncupdirty);
+    ASSERT_TRUE(ld_0->syncdownsubtree);
+    ASSERT_FALSE(ld_0->syncdowndirty);
+    ASSERT_TRUE(ld.syncupsubtree);
+    ASSERT_FALSE(ld.syncupdirty);
+    ASSERT_FALSE(ld_1->syncdownsubtree);
+
+    // syncdown() of the folder leaves the marks of syncup()
+    ld_0_0->syncdowndirty = false;
+    for (mega::LocalNode* l : { ld_0_0.get(), ld_0.get(), &ld })
+    {
+        l->endsyncdown();
+    }
+    ASSERT_FALSE(ld.syncdownsubtree);
+    ASSERT_TRUE(ld.syncupsubtree);
+
+    // and a folder that needs another pass keeps the way to it marked
+    ld_0_0->syncdowndirty = true;
+    ld_0_0->endsyncdown();
+    ld_0->endsyncdown();
+    ASSERT_TRUE(ld_0->syncdownsubtree);
+    ASSERT_TRUE(ld.syncdownsubtree);
+    ASSERT_FALSE(ld_1->syncdownsubtree);
+}
+
+TEST(Sync, LocalNode_childrenAndFsidsFoundAfterRenames)
+{
+    Fixture fx{"d"};
+    mega::FSACCESS_CLASS fsaccess;
+
+    mega::LocalNode& ld = *fx.mSync->localroot;
+    std::vector<std::unique_ptr<mega::LocalNode>> files;
+    for (int i = 0; i < 100; ++i)
+    {
+        files.push_back(mt::makeLocalNode(*fx.mSync, ld, mega::FILENODE, "f_" + std::to_string(i)));
+    }
+
+    // renamed under the same parent: found by the new name only, and still by its fsid
+    auto newpath = ld.getLocalPath();
+    newpath.appendWithSeparator(mega::LocalPath::fromPath("g_50", fsaccess), true);
+    files[50]->setnameparent(&ld, &newpath, nullptr);
+
+    for (int i = 0; i < 100; ++i)
+    {
+        auto name = mega::LocalPath::fromPath((i == 50 ? "g_" : "f_") + std::to_string(i), fsaccess);
+        ASSERT_EQ(files[i].get(), ld.childbyname(&name)) << i;
+
+        auto it = fx.mClient->fsidnode.find(files[i]->fsid);
+        ASSERT_NE(fx.mClient->fsidnode.end(), it);
+        ASSERT_EQ(files[i].get(), it->second);
+    }
+
+    auto oldname = mega::LocalPath::fromPath("f_50", fsaccess);
+    ASSERT_EQ(nullptr, ld.childbyname(&oldname));
+    ASSERT_EQ(100u, ld.children.size());
+
+    // a node taking over an fsid leaves the previous one without it
+    files[1]->setfsid(files[0]->fsid, fx.mClient->fsidnode);
+    ASSERT_FALSE(files[0]->fsid_mapped);
+    ASSERT_EQ(files[1].get(), fx.mClient->fsidnode[files[0]->fsid]);
+
+    files[0].reset();
+    ASSERT_EQ(files[1].get(), fx.mClient->fsidnode[files[1]->fsid]);
+}
+
+TEST(Sync, SyncTreeStates_followTheLocalNodes)
+{
+    Fixture fx{"d"};
+    mega::FSACCESS_CLASS fsaccess;
+    const mega::SyncTreeStates& states = fx.mClient->syncs.treestates;
+
+    mega::LocalNode& ld = *fx.mSync->localroot;
+    auto d_1 = mt::makeLocalNode(*fx.mSync, ld, mega::FOLDERNODE, "d_1");
+    auto f = mt::makeLocalNode(*fx.mSync, *d_1, mega::FILENODE, "f");
+    auto fpath = f->getLocalPath();
+
+    mega::treestate_t ts = mega::TREESTATE_NONE;
+    ASSERT_EQ(mega::SyncTreeStates::UNKNOWN, states.get(fpath, ts));
+
+    f->treestate(mega::TREESTATE_SYNCING);
+    ASSERT_EQ(mega::SyncTreeStates::KNOWN, states.get(fpath, ts));
+    ASSERT_EQ(mega::TREESTATE_SYNCING, ts);
+    ASSERT_EQ(mega::SyncTreeStates::KNOWN, states.get(d_1->getLocalPath(), ts));
+    ASSERT_EQ(mega::TREESTATE_SYNCING, ts);
+
+    // the folder renamed: what is below it is at the new path
+    auto newpath = ld.getLocalPath();
+    newpath.appendWithSeparator(mega::LocalPath::fromPath("d_2", fsaccess), true);
+    d_1->setnameparent(&ld, &newpath, nullptr);
+
+    ASSERT_EQ(mega::SyncTreeStates::UNKNOWN, states.get(fpath, ts));
+    ASSERT_EQ(mega::SyncTreeStates::KNOWN, states.get(f->getLocalPath(), ts));
+    ASSERT_EQ(mega::TREESTATE_SYNCING, ts);
+
+    f->treestate(mega::TREESTATE_SYNCED);
+    ASSERT_EQ(mega::SyncTreeStates::KNOWN, states.get(f->getLocalPath(), ts));
+    ASSERT_EQ(mega::TREESTATE_SYNCED, ts);
+
+    // deleted
+    fpath = f->getLocalPath();
+    f.reset();
+    ASSERT_EQ(mega::SyncTreeStates::UNKNOWN, states.get(fpath, ts));
+
+    ASSERT_EQ(mega::SyncTreeStates::NOT_SYNCED, states.get(mega::LocalPath::fromPath("elsewhere", fsaccess), ts));
+}
+
+TEST(Sync, cachenodes_writesParentsFirstInOnePass)
+{
+    mega::PrnGen rng;
+    mega::MemoryDbAccess access;
+    Fixture fx{"d"};
+    fx.mSync->statecachetable = access.open(rng, fx.mFsAccess, "statecache");
+    fx.mSync->state = mega::SYNC_ACTIVE;
+
+    mega::LocalNode& ld = *fx.mSync->localroot;
+    auto ld_0 = mt::makeLocalNode(*fx.mSync, ld, mega::FOLDERNODE, "d_0");
+    auto ld_0_0 = mt::makeLocalNode(*fx.mSync, *ld_0, mega::FOLDERNODE, "d_0_0");
+    auto lf_0_0_0 = mt::makeLocalNode(*fx.mSync, *ld_0_0, mega::FILENODE, "f_0_0_0");
+    auto lf_1 = mt::makeLocalNode(*fx.mSync, ld, mega::FILENODE, "f_1");
+    auto ld_2 = mt::makeLocalNode(*fx.mSync, ld, mega::FOLDERNODE, "d_2");
+    auto lf_2_0 = mt::makeLocalNode(*fx.mSync, *ld_2, mega::FILENODE, "f_2_0");
+
+    // queued children first; the parent of the last isn't queued, nor written before
+    for (mega::LocalNode* l : { lf_0_0_0.get(), ld_0_0.get(), ld_0.get(), lf_1.get(), lf_2_0.get() })
+    {
+        fx.mSync->statecacheadd(l);
+    }
+
+    fx.mSync->cachenodes();
+
+    for (mega::LocalNode* l : { lf_0_0_0.get(), ld_0_0.get(), ld_0.get(), lf_1.get() })
+    {
+        ASSERT_TRUE(l->dbid) << l->name;
+    }
+    ASSERT_FALSE(lf_2_0->dbid);
+    ASSERT_EQ(mega::localnode_set{lf_2_0.get()}, fx.mSync->insertq);
+
+    // and each was written after its parent, with its dbid (from the start of the record: the
+    // size or type, the fsid and the parent's dbid)
+    uint32_t id;
+    std::string data;
+    std::map<uint32_t, uint32_t> parents;
+    fx.mSync->statecachetable->rewind();
+    while (fx.mSync->statecachetable->next(&id, &data, &fx.mClient->key))
+    {
+        mega::CacheableReader r(data);
+        int64_t size;
+        mega::handle fsid;
+        uint32_t parent_dbid;
+        ASSERT_TRUE(r.unserializei64(size) && r.unserializehandle(fsid) && r.unserializeu32(parent_dbid));
+        parents[id] = parent_dbid;
+    }
+    ASSERT_EQ(4u, parents.size());
+    ASSERT_EQ(0u, parents[lf_1->dbid]);
+    ASSERT_EQ(ld_0->dbid, parents[ld_0_0->dbid]);
+    ASSERT_EQ(ld_0_0->dbid, parents[lf_0_0_0->dbid]);
+}
+
+TEST(Sync, LocalNode_bytesPerNode)
+{
+    Fixture fx{"d"};
+
+    mega::LocalNode& ld = *fx.mSync->localroot;
+    std::vector<std::unique_ptr<mega::LocalNode>> files;
+    for (int i = 0; i < 1000; ++i)
+    {
+        files.push_back(mt::makeLocalNode(*fx.mSync, ld, mega::FILENODE, "IMG_" + std::to_string(10000 + i) + ".jpg"));
+    }
+
+    // without short names, no folder has the map for them
+    ASSERT_FALSE(ld.schildren);
+
+    // a node, its entry in the children of its folder (the key and value, three links and the
+    // color of a tree node) and its entry in the fsid map (the pair, a link and its bucket)
+    const size_t entry = sizeof(mega::localnode_map::value_type) + 4 * sizeof(void*);
+    const size_t fsidentry = sizeof(mega::handlelocalnode_map::value_type) + 2 * sizeof(void*);
+    const size_t perNode = sizeof(mega::LocalNode) + entry + fsidentry;
+
+    std::cout << "[          ] bytes per LocalNode: " << perNode << " (" << sizeof(mega::LocalNode)
+              << " of which the File of its uploads is " << sizeof(mega::File) << "), and the heap for names past "
+              << std::string().capacity() << " characters" << std::endl;
+}
+
+TEST(Sync, transfersHeldBackGoWhenHalfOfTheWindowIsFree)
+{
+    Fixture fx{"d"};
+    mega::Sync& sync = *fx.mSync;
+
+    sync.uploadsinflight = mega::Sync::MAXTRANSFERS;
+    sync.uploadsheldback = true;
+    fx.mClient->syncuprequired = false;
+
+    while (sync.uploadsinflight > mega::Sync::MAXTRANSFERS / 2 + 1)
+    {
+        sync.uploadended();
+        ASSERT_FALSE(fx.mClient->syncuprequired);
+    }
+
+    sync.uploadended();
+    ASSERT_TRUE(fx.mClient->syncuprequired);
+    ASSERT_FALSE(sync.uploadsheldback);
+
+    // the downloads, the same
+    sync.downloadsinflight = mega::Sync::MAXTRANSFERS / 2 + 1;
+    sync.downloadsheldback = true;
+    fx.mClient->syncdownrequired = false;
+    sync.downloadended();
+    ASSERT_TRUE(fx.mClient->syncdownrequired);
+
+    // nothing held back: nothing to run again
+    fx.mClient->syncuprequired = false;
+    sync.uploadended();
+    ASSERT_FALSE(fx.mClient->syncuprequired);
+}
+
+TEST(Sync, scan_networkFolderListedTheSameIsNotCheckedAgain)
+{
+    Fixture fx{"d"};
+    mega::Sync& sync = *fx.mSync;
+
+    mt::FsNode d{nullptr, mega::FOLDERNODE, "d"};
+    mt::FsNode d_0{&d, mega::FOLDERNODE, "d_0"};
+    mt::FsNode f_1{&d, mega::FILENODE, "f_1"};
+    mt::FsNode f_2{&d_0, mega::FILENODE, "f_2"};
+    mt::collectAllFsNodes(fx.mFsNodes, d);
+
+    // the LocalNodes of the scans before
+    sync.localroot->setfsid(d.getFsId(), fx.mClient->fsidnode);
+    auto ld_0 = mt::makeLocalNode(sync, *sync.localroot, mega::FOLDERNODE, "d_0");
+    auto lf_1 = mt::makeLocalNode(sync, *sync.localroot, mega::FILENODE, "f_1");
+    auto lf_2 = mt::makeLocalNode(sync, *ld_0, mega::FILENODE, "f_2");
+
+    sync.isnetwork = true;
+    sync.initializing = false;
+    sync.fullscan = true;
+
+    auto& q = sync.dirnotify->notifyq[mega::DirNotify::DIREVENTS];
+    auto rescan = [&](const mt::FsNode& folder)
+    {
+        LocalPath path = folder.getPath();
+        ASSERT_TRUE(sync.scan(&path, nullptr));
+    };
+    auto notified = [&q]()
+    {
+        size_t n = 0;
+        mega::Notification notification;
+        while (q.popFront(notification))
+        {
+            n++;
+        }
+        return n;
+    };
+
+    // the first rescan checks everything
+    sync.scanseqno++;
+    rescan(d);
+    rescan(d_0);
+    ASSERT_EQ(3u, notified());
+
+    // the next finds the same listings: the entries are seen without notifying them
+    sync.scanseqno++;
+    rescan(d);
+    ASSERT_EQ(0u, notified());
+    ASSERT_EQ(sync.scanseqno, lf_1->scanseqno);
+    ASSERT_EQ(sync.scanseqno, lf_2->scanseqno);
+    ASSERT_EQ(mega::Sync::MIN_POLL_INTERVAL_DS, sync.polledfolders[d.getPath()].interval);
+
+    // a new file isn't listed before the folder is due again
+    mt::FsNode f_3{&d, mega::FILENODE, "f_3"};
+    fx.mFsNodes[f_3.getPath()] = &f_3;
+    sync.scanseqno++;
+    rescan(d);
+    ASSERT_EQ(0u, notified());
+
+    mega::Waiter::ds += mega::Sync::MIN_POLL_INTERVAL_DS;
+    rescan(d);
+    ASSERT_EQ(3u, notified());
+    ASSERT_EQ(0u, sync.polledfolders[d.getPath()].interval);
+
+    // (the listing of d_0 was requested for the checkpath() of it)
+    mega::AsyncDirLister::Listing listing;
+    ASSERT_TRUE(fx.mClient->dirlister.take(d_0.getPath(), listing));
+
+    // and those the rescans no longer reach are forgotten
+    sync.scanseqno += 2;
+    sync.prunepolled();
+    ASSERT_TRUE(sync.polledfolders.empty());
+}
+
+TEST(Sync, SyncConfig_isDownSync)
+{
+    for (auto type : { mega::SyncConfig::TYPE_UP, mega::SyncConfig::TYPE_DOWN, mega::SyncConfig::TYPE_TWOWAY, mega::SyncConfig::TYPE_BACKUP })
+    {
+        const mega::SyncConfig config{LocalPath(), "foo", 42, "remote", 123, {}, true, type};
+        ASSERT_EQ(type == mega::SyncConfig::TYPE_DOWN || type == mega::SyncConfig::TYPE_TWOWAY, config.isDownSync())
+            << mega::SyncConfig::synctypename(type);
+    }
+}
+
 
 
 namespace mega {
@@ -1899,6 +2278,7 @@ TEST_F(JSONSyncConfigIOContextTest, Serialize)
         config.mRemoteNode = 3;
         config.mWarning = LOCAL_IS_FAT;
         config.mSyncType = SyncConfig::TYPE_BACKUP;
+        config.mChangeCursor = Utilities::randomBytes(16);
 
         written.emplace(config.mBackupId, config);
     }
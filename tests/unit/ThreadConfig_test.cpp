@@ -0,0 +1,84 @@
+/**
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <gtest/gtest.h>
+
+#include <mega/threadconfig.h>
+
+TEST(ThreadConfig, parsesCpuLists)
+{
+    std::vector<unsigned> cpus;
+    ASSERT_TRUE(mega::ThreadConfig::parseCpuList("0-3,8,10-11", cpus));
+    EXPECT_EQ(std::vector<unsigned>({ 0, 1, 2, 3, 8, 10, 11 }), cpus);
+
+    ASSERT_TRUE(mega::ThreadConfig::parseCpuList("5", cpus));
+    EXPECT_EQ(std::vector<unsigned>({ 5 }), cpus);
+
+    // none is any
+    ASSERT_TRUE(mega::ThreadConfig::parseCpuList("", cpus));
+    EXPECT_TRUE(cpus.empty());
+    ASSERT_TRUE(mega::ThreadConfig::parseCpuList(nullptr, cpus));
+    EXPECT_TRUE(cpus.empty());
+
+    // and what isn't a list leaves cpus as it was
+    cpus = { 7 };
+    for (const char* list : { "1,", ",1", "3-1", "-1", "1-", "a", "1;2", "0-100000", "1--2" })
+    {
+        EXPECT_FALSE(mega::ThreadConfig::parseCpuList(list, cpus)) << list;
+    }
+    EXPECT_EQ(std::vector<unsigned>({ 7 }), cpus);
+}
+
+#ifdef __linux__
+TEST(ThreadConfig, appliesTheSettingsOfTheRole)
+{
+    mega::ThreadSettings settings;
+    settings.cpus = { 0 };
+    settings.priority = mega::ThreadSettings::PRIORITY_LOW;
+    mega::ThreadConfig::set(mega::THREAD_ROLE_SEARCH, settings);
+    EXPECT_EQ(std::vector<unsigned>({ 0 }), mega::ThreadConfig::get(mega::THREAD_ROLE_SEARCH).cpus);
+
+    int before = getpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)));
+    cpu_set_t set;
+    int after = 0;
+    std::thread([&]()
+    {
+        mega::ThreadConfig::apply(mega::THREAD_ROLE_SEARCH);
+        sched_getaffinity(0, sizeof set, &set);
+        after = getpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)));
+    }).join();
+
+    EXPECT_EQ(1, CPU_COUNT(&set));
+    EXPECT_TRUE(CPU_ISSET(0, &set));
+    EXPECT_EQ(std::min(before + 5, 19), after);
+
+    // only on the threads of the role
+    EXPECT_EQ(before, getpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid))));
+    mega::ThreadConfig::set(mega::THREAD_ROLE_SEARCH, mega::ThreadSettings());
+}
+#endif
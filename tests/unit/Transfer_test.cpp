@@ -76,15 +76,65 @@ TEST(Transfer, serialize_unserialize)
     };
     tf.state = mega::TRANSFERSTATE_PAUSED;
     tf.priority = 4;
+    tf.size = 100;
+    tf.mtime = 5;
+    tf.isvalid = true;
+    tf.chunkmacs[0].finished = true;
 
     std::string d;
     ASSERT_TRUE(tf.serialize(&d));
 
+    // the index resuming starts from
+    mega::direction_t type = mega::PUT;
+    mega::FileFingerprint fp;
+    mega::m_time_t lastaccesstime = 0;
+    uint64_t priority = 0;
+    ASSERT_TRUE(mega::Transfer::unserializeindex(d, type, fp, lastaccesstime, priority));
+    EXPECT_EQ(mega::GET, type);
+    EXPECT_EQ(static_cast<mega::FileFingerprint&>(tf), fp);
+    EXPECT_EQ(3, lastaccesstime);
+    EXPECT_EQ(4u, priority);
+    EXPECT_FALSE(mega::Transfer::unserializeindex(d.substr(0, d.size() - 1), type, fp, lastaccesstime, priority));
+
     mega::transfer_map tfMap;
     auto newTf = std::unique_ptr<mega::Transfer>{mega::Transfer::unserialize(client.get(), &d, &tfMap)};
     checkTransfers(tf, *newTf);
 }
 
+TEST(Transfer, queuedTransfersCarryNoRetryState)
+{
+    mega::MegaApp app;
+    ::mega::FSACCESS_CLASS fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+
+    mega::Transfer tf{client.get(), mega::GET};
+    client->settransferspeed(&tf, 0);
+    EXPECT_FALSE(tf.ratelimit);
+
+    std::string d;
+    ASSERT_TRUE(tf.serialize(&d));
+
+    mega::transfer_map tfMap;
+    auto newTf = std::unique_ptr<mega::Transfer>{mega::Transfer::unserialize(client.get(), &d, &tfMap)};
+    ASSERT_TRUE(newTf);
+    EXPECT_FALSE(newTf->integritystate);
+
+    // a bad fingerprint found by an attempt is kept in the cache
+    tf.integrity().badfp.size = 10;
+    tf.integrity().badfp.mtime = 5;
+    tf.integrity().badfp.isvalid = true;
+    d.clear();
+    ASSERT_TRUE(tf.serialize(&d));
+
+    newTf.reset(mega::Transfer::unserialize(client.get(), &d, &tfMap));
+    ASSERT_TRUE(newTf && newTf->integritystate);
+    EXPECT_EQ(tf.integrity().badfp, newTf->integritystate->badfp);
+
+    client->settransferspeed(&tf, 1000);
+    ASSERT_TRUE(tf.ratelimit);
+    EXPECT_EQ(1000, tf.ratelimit->rate());
+}
+
 #ifndef WIN32
 TEST(Transfer, unserialize_32bit)
 {
@@ -152,3 +202,220 @@ TEST(Transfer, unserialize_32bit)
     checkTransfers(tf, *newTf);
 }
 #endif
+
+TEST(TransferList, nexttransfers_stopsOnceDirectionIsFull)
+{
+    mega::MegaApp app;
+    ::mega::FSACCESS_CLASS fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+
+    // small uploads, and a large one at the end of the queue
+    std::vector<std::unique_ptr<mega::Transfer>> transfers;
+    {
+        mega::DBTableTransactionCommitter committer(client->tctable);
+        for (int i = 0; i < 101; ++i)
+        {
+            transfers.emplace_back(new mega::Transfer(client.get(), mega::PUT));
+            transfers.back()->size = i < 100 ? 10 : 1 << 20;
+            client->transferlist.addtransfer(transfers.back().get(), committer);
+        }
+    }
+
+    int calls = 0;
+    std::function<bool(mega::Transfer*)> continuefunction = [&calls](mega::Transfer*)
+    {
+        return ++calls <= 2;
+    };
+
+    bool full = false;
+    std::function<bool(mega::direction_t)> directionfull = [&full](mega::direction_t)
+    {
+        return full;
+    };
+
+    mega::TransferCategory small(mega::PUT, mega::SMALLFILE);
+    mega::TransferCategory large(mega::PUT, mega::LARGEFILE);
+
+    // a full category leaves the other one to be taken from
+    auto chosen = client->transferlist.nexttransfers(continuefunction, directionfull);
+    ASSERT_EQ(2u, chosen[small.index()].size());
+    EXPECT_EQ(transfers[0].get(), chosen[small.index()][0]);
+    EXPECT_EQ(transfers[1].get(), chosen[small.index()][1]);
+    EXPECT_TRUE(chosen[large.index()].empty());
+    EXPECT_EQ(4, calls);
+
+    // a full direction ends the walk
+    calls = 0;
+    full = true;
+    chosen = client->transferlist.nexttransfers(continuefunction, directionfull);
+    EXPECT_EQ(2u, chosen[small.index()].size());
+    EXPECT_EQ(3, calls);
+}
+
+TEST(TransferConcurrency, adaptiveFollowsTheSpeed)
+{
+    mega::AdaptiveTransferConcurrency policy;
+    EXPECT_EQ(32u, policy.maxTransfers(mega::PUT));
+    EXPECT_EQ(64u, policy.maxTotalTransfers());
+
+    mega::dstime ds = 0;
+    policy.sample(ds, mega::PUT, 1000, 32);
+
+    // one window of samples of the uploads
+    auto window = [&](m_off_t speed, unsigned active)
+    {
+        for (int i = 0; i < 5; ++i)
+        {
+            ds += 10;
+            policy.sample(ds, mega::PUT, speed, active);
+        }
+        return policy.maxTransfers(mega::PUT);
+    };
+
+    // more transfers while they make uploads faster
+    EXPECT_EQ(36u, window(1000, 32));
+    EXPECT_EQ(40u, window(2000, 36));
+    EXPECT_EQ(40u, window(2000, 40));
+
+    // fewer when the speed falls, or requests fail
+    EXPECT_EQ(30u, window(1000, 40));
+    policy.requestfailed(mega::PUT);
+    EXPECT_EQ(23u, window(1000, 10));
+
+    // a direction that doesn't use all its transfers keeps its limit
+    EXPECT_EQ(23u, window(5000, 5));
+
+    EXPECT_EQ(32u, policy.maxTransfers(mega::GET));
+    EXPECT_EQ(55u, policy.maxTotalTransfers());
+    EXPECT_EQ(m_off_t(100 * 1024 * 1024) * 23 / 32, policy.targetOutstanding(mega::PUT, 10 * 1024 * 1024));
+}
+
+TEST(TransferSlot, stripedUploadTunerFollowsTheSpeed)
+{
+    mega::dstime ds = 0;
+
+    // one window of samples of the upload
+    auto window = [&](mega::StripedUploadTuner& tuner, m_off_t speed)
+    {
+        for (int i = 0; i < 2; ++i)
+        {
+            ds += 10;
+            tuner.sample(ds, speed);
+        }
+        return tuner.active();
+    };
+
+    // without a round trip measured, the first window tries one more connection
+    mega::StripedUploadTuner tuner(3, 6);
+    EXPECT_EQ(3u, tuner.active());
+    tuner.requestdone(1024 * 1024, 0);
+    tuner.sample(ds, 1000);
+    EXPECT_EQ(4u, window(tuner, 1000));
+
+    // more while they make the upload faster, fewer when it slows down or requests fail
+    EXPECT_EQ(5u, window(tuner, 2000));
+    EXPECT_EQ(6u, window(tuner, 3000));
+    EXPECT_EQ(6u, window(tuner, 4000));
+    EXPECT_EQ(5u, window(tuner, 2000));
+    tuner.requestfailed();
+    EXPECT_EQ(4u, window(tuner, 2000));
+    EXPECT_EQ(4u, window(tuner, 2000));
+
+    // 20 MB/s with 200 ms round trips: 4 MB in flight, in requests of 1 MB
+    mega::StripedUploadTuner measured(1, 6);
+    measured.requestdone(1024 * 1024, 250);
+    measured.requestdone(1024 * 1024, 200);
+    measured.requestdone(1024 * 1024, 0);
+    measured.sample(ds, 20 * 1024 * 1024);
+    EXPECT_EQ(5u, window(measured, 20 * 1024 * 1024));
+
+    // never beyond the ceiling
+    mega::StripedUploadTuner capped(2, 3);
+    capped.requestdone(1024 * 1024, 200);
+    capped.sample(ds, 100 * 1024 * 1024);
+    EXPECT_EQ(3u, window(capped, 100 * 1024 * 1024));
+}
+
+TEST(Transfer, verifyonworker_fingerprintsTheDownload)
+{
+    mega::MegaApp app;
+    ::mega::FSACCESS_CLASS fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+
+    mega::LocalPath path;
+    ASSERT_TRUE(fsaccess.cwd(path));
+    path.appendWithSeparator(mega::LocalPath::fromPath("verified", fsaccess), false);
+    {
+        auto fa = fsaccess.newfileaccess();
+        ASSERT_TRUE(fa->fopen(path, false, true));
+        const mega::byte data[] = "downloaded";
+        ASSERT_TRUE(fa->fwrite(data, 10, 0));
+    }
+
+    mega::FileFingerprint expected;
+    {
+        auto fa = fsaccess.newfileaccess();
+        ASSERT_TRUE(fa->fopen(path, true, false));
+        expected.genfingerprint(fa.get());
+    }
+
+    std::unique_ptr<mega::Transfer> tf{new mega::Transfer(client.get(), mega::GET)};
+    tf->localfilename = path;
+    tf->verifyonworker();
+
+    // queued until exec() completes it, even once done
+    ASSERT_EQ(1u, client->verifyingdownloads.size());
+    EXPECT_EQ(tf.get(), client->verifyingdownloads.front());
+
+    while (!tf->verification->done)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_TRUE(tf->verification->opened);
+    EXPECT_EQ(expected, tf->verification->fingerprint);
+
+    // a transfer that goes away leaves the queue
+    tf.reset();
+    EXPECT_TRUE(client->verifyingdownloads.empty());
+
+    fsaccess.unlinklocal(path);
+}
+
+TEST(DirectReadSlot, hostOfTempUrl)
+{
+    EXPECT_EQ("gfs262n300.userstorage.mega.co.nz", mega::DirectReadSlot::host("https://gfs262n300.userstorage.mega.co.nz/dl/abc"));
+    EXPECT_EQ("gfs262n300.userstorage.mega.co.nz:8080", mega::DirectReadSlot::host("http://gfs262n300.userstorage.mega.co.nz:8080/dl/abc"));
+    EXPECT_EQ("host", mega::DirectReadSlot::host("http://host"));
+}
+
+TEST(MegaClient, tempUrlsAreSharedUntilTheyExpire)
+{
+    mega::MegaApp app;
+    mega::FSACCESS_CLASS fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+
+    std::vector<std::string> urls{ "http://host/dl" };
+    std::vector<std::string> found;
+    m_off_t size = 0;
+
+    // nothing kept unless asked for
+    client->cachetempurls(1, true, urls, 100);
+    EXPECT_FALSE(client->cachedtempurls(1, true, found, size));
+
+    client->sharetempurls = true;
+    mega::Waiter::ds = 1000;
+    client->cachetempurls(1, true, urls, 100);
+
+    // the handle of a node and a public handle of the same value are different files
+    EXPECT_FALSE(client->cachedtempurls(1, false, found, size));
+    ASSERT_TRUE(client->cachedtempurls(1, true, found, size));
+    EXPECT_EQ(urls, found);
+    EXPECT_EQ(100, size);
+
+    mega::Waiter::ds += mega::MegaClient::TEMPURLCACHEEXPIRYDS + 1;
+    EXPECT_FALSE(client->cachedtempurls(1, true, found, size));
+
+    client->cachetempurls(1, true, urls, 100);
+    client->uncachetempurls(1, true);
+    EXPECT_FALSE(client->cachedtempurls(1, true, found, size));
+}
@@ -0,0 +1,91 @@
+/**
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <gtest/gtest.h>
+
+#include <mega/megaclient.h>
+#include <mega/megaapp.h>
+#include <mega/useralerts.h>
+
+#include "utils.h"
+#include "mega.h"
+
+namespace
+{
+
+mega::UserAlert::NewSharedNodes* newFiles(mega::UserAlerts& ua, int files, mega::handle user, mega::handle folder, mega::m_time_t ts)
+{
+    return new mega::UserAlert::NewSharedNodes(0, files, user, folder, ts, ua.nextId());
+}
+
+} // anonymous
+
+TEST(UserAlerts, mergesWithTheLatestAlertOfTheSameUserAndFolder)
+{
+    mega::MegaApp app;
+    mega::FSACCESS_CLASS fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+    auto& ua = client->useralerts;
+
+    ua.add(newFiles(ua, 1, 1, 10, 1000));
+    ua.add(newFiles(ua, 1, 2, 10, 1010));
+    ua.add(newFiles(ua, 2, 1, 10, 1020));   // merged into the first, though it's not the last one
+    ua.add(newFiles(ua, 1, 1, 11, 1030));
+    ua.add(newFiles(ua, 4, 1, 10, 1400));   // too late to be merged
+
+    ASSERT_EQ(4u, ua.alerts.size());
+    EXPECT_EQ(3u, static_cast<mega::UserAlert::NewSharedNodes*>(ua.alerts[0])->fileCount);
+    EXPECT_EQ(1u, static_cast<mega::UserAlert::NewSharedNodes*>(ua.alerts[1])->fileCount);
+    EXPECT_EQ(4u, static_cast<mega::UserAlert::NewSharedNodes*>(ua.alerts[3])->fileCount);
+
+    // later ones go into the newest
+    ua.add(newFiles(ua, 1, 1, 10, 1410));
+    ASSERT_EQ(4u, ua.alerts.size());
+    EXPECT_EQ(5u, static_cast<mega::UserAlert::NewSharedNodes*>(ua.alerts[3])->fileCount);
+}
+
+TEST(UserAlerts, keepsOnlyTheNewestAndReturnsThoseAfterAnId)
+{
+    mega::MegaApp app;
+    mega::FSACCESS_CLASS fsaccess;
+    auto client = mt::makeClient(app, fsaccess);
+    auto& ua = client->useralerts;
+
+    for (int i = 0; i < 10; ++i)
+    {
+        ua.add(newFiles(ua, 1, mega::handle(i), 10, 1000 + i));
+    }
+
+    std::vector<mega::UserAlert::Base*> v;
+    ua.alertsAfter(ua.alerts[6]->id, v);
+    ASSERT_EQ(3u, v.size());
+    EXPECT_EQ(ua.alerts[7], v[0]);
+    EXPECT_EQ(ua.alerts[9], v[2]);
+
+    ua.setMaxAlerts(4);
+    ASSERT_EQ(4u, ua.alerts.size());
+    EXPECT_EQ(6u, ua.alerts.front()->userHandle);
+
+    // what was dropped is no longer merged into
+    ua.add(newFiles(ua, 1, 0, 10, 1010));
+    ASSERT_EQ(5u, ua.alerts.size());
+    ua.trim();
+    ASSERT_EQ(4u, ua.alerts.size());
+    EXPECT_EQ(0u, ua.alerts.back()->userHandle);
+    EXPECT_EQ(1u, static_cast<mega::UserAlert::NewSharedNodes*>(ua.alerts.back())->fileCount);
+}
@@ -0,0 +1,72 @@
+/**
+ * (c) 2021 by Mega Limited, Wellsford, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <mega.h>
+
+#ifndef _WIN32
+TEST(PosixWaiter, notifiesFromOtherThreadsCoalesced)
+{
+    mega::PosixWaiter waiter;
+
+    // however many times and from however many threads, the next wait returns right away
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+    {
+        threads.emplace_back([&waiter]()
+        {
+            for (int j = 0; j < 1000; ++j)
+            {
+                waiter.notify();
+            }
+        });
+    }
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    waiter.init(100);
+    EXPECT_TRUE(waiter.wait() & mega::Waiter::NEEDEXEC);
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+
+    // and nothing is left to wake up the one after (which times out)
+    start = std::chrono::steady_clock::now();
+    waiter.init(2);
+    waiter.wait();
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(150));
+
+    // a notify while waiting ends the wait
+    std::thread notifier([&waiter]()
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        waiter.notify();
+    });
+    start = std::chrono::steady_clock::now();
+    waiter.init(100);
+    EXPECT_TRUE(waiter.wait() & mega::Waiter::NEEDEXEC);
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+    notifier.join();
+}
+#endif
@@ -17,17 +17,25 @@
  */
 
 #include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <tuple>
 
 #include <gtest/gtest.h>
 
 #include <mega/base64.h>
 #include <mega/filesystem.h>
+#include <mega/http.h>
 #include <mega/utils.h>
 #include "megafs.h"
 
 #include <mega/db.h>
 #include <mega/db/sqlite.h>
+#include <mega/filefingerprint.h>
 
 TEST(utils, hashCombine_integer)
 {
@@ -379,6 +387,33 @@ TEST_F(ComparatorTest, CompareLocalPathAgainstString)
     }
 }
 
+TEST_F(ComparatorTest, AsciiComparesAsUnicode)
+{
+    // plain ASCII compares unit by unit, and the same as when some text has to be decoded
+    EXPECT_EQ(ciCompare(string("abc[d"), string("ABC[D")), 0);
+    EXPECT_EQ(ciCompare(string("abc[d"), string("ABC%5bD")), 0);
+    EXPECT_EQ(compare(string("a_z"), string("a_Z")), compare(string("a_z\xc3\xa9"), string("a_Z\xc3\xa9")));
+    EXPECT_EQ(ciCompare(string("a_z"), string("A_{")), ciCompare(string("a_z\xc3\xa9"), string("A_{\xc3\xa9")));
+    EXPECT_LT(ciCompare(fromPath("abc"), string("ABCD")), 0);
+    EXPECT_GT(compare(fromPath("abd"), fromPath("abc")), 0);
+
+    // and needs no normalization
+    string text = "long enough to be checked by words";
+    EXPECT_TRUE(Utils::isAscii(text.data(), text.size()));
+    text += "\xc3\xa9";
+    EXPECT_FALSE(Utils::isAscii(text.data(), text.size()));
+
+    FSACCESS_CLASS fsAccess;
+    string name = "plain name.txt";
+    fsAccess.normalize(&name);
+    EXPECT_EQ("plain name.txt", name);
+
+    // while other names still are
+    name = "e\xcc\x81";
+    fsAccess.normalize(&name);
+    EXPECT_EQ("\xc3\xa9", name);
+}
+
 TEST(Conversion, HexVal)
 {
     // Decimal [0-9]
@@ -655,6 +690,76 @@ TEST(Filesystem, NormalizeRelativeEmpty)
     EXPECT_EQ(NormalizeRelative(path), path);
 }
 
+TEST(Filesystem, preallocateKeepsTheFileSize)
+{
+    using namespace mega;
+
+    FSACCESS_CLASS fsAccess;
+    LocalPath path;
+    ASSERT_TRUE(fsAccess.cwd(path));
+    path.appendWithSeparator(LocalPath::fromPath("preallocated", fsAccess), false);
+    fsAccess.unlinklocal(path);
+
+    {
+        auto fileAccess = fsAccess.newfileaccess(false);
+        ASSERT_TRUE(fileAccess->fopen(path, false, true));
+
+        const byte data[] = "0123456789";
+        ASSERT_TRUE(fileAccess->fwrite(data, 10, 0));
+
+        // whether or not the filesystem reserves the space, nothing else changes
+        fileAccess->fpreallocate(1 << 20);
+        ASSERT_TRUE(fileAccess->fwrite(data, 10, 100));
+    }
+
+    auto fileAccess = fsAccess.newfileaccess(false);
+    ASSERT_TRUE(fileAccess->fopen(path, true, false));
+    EXPECT_EQ(110, fileAccess->size);
+
+    string read;
+    ASSERT_TRUE(fileAccess->fread(&read, 10, 0, 90));
+    EXPECT_EQ(string(10, '\0'), read);
+
+    fileAccess.reset();
+    EXPECT_TRUE(fsAccess.unlinklocal(path));
+}
+
+TEST(Filesystem, readOnceReadsTheSame)
+{
+    using namespace mega;
+
+    FSACCESS_CLASS fsAccess;
+    LocalPath path;
+    ASSERT_TRUE(fsAccess.cwd(path));
+    path.appendWithSeparator(LocalPath::fromPath("readonce", fsAccess), false);
+    fsAccess.unlinklocal(path);
+
+    string data(1 << 16, 'x');
+    {
+        auto fileAccess = fsAccess.newfileaccess(false);
+        ASSERT_TRUE(fileAccess->fopen(path, false, true));
+        ASSERT_TRUE(fileAccess->fwrite(reinterpret_cast<const byte*>(data.data()), unsigned(data.size()), 0));
+    }
+
+    // as an upload reads it: opened by name for each read, which is when the hints apply
+    auto fileAccess = fsAccess.newfileaccess();
+    ASSERT_TRUE(fileAccess->fopen(path));
+    fileAccess->setreadonce();
+
+    string read;
+    ASSERT_TRUE(fileAccess->fread(&read, 4096, 0, 0));
+    EXPECT_EQ(data.substr(0, 4096), read);
+    ASSERT_TRUE(fileAccess->fread(&read, 4096, 0, 4096));
+    EXPECT_EQ(data.substr(4096, 4096), read);
+
+    // dropped from the cache, not from the file
+    ASSERT_TRUE(fileAccess->fread(&read, 4096, 0, 0));
+    EXPECT_EQ(data.substr(0, 4096), read);
+
+    fileAccess.reset();
+    EXPECT_TRUE(fsAccess.unlinklocal(path));
+}
+
 class SqliteDBTest
   : public ::testing::Test
 {
@@ -980,3 +1085,740 @@ TEST_F(SqliteDBTest, RootPath)
     EXPECT_EQ(dbAccess.rootPath(), rootPath);
 }
 
+TEST_F(SqliteDBTest, NodeQueries)
+{
+    SqliteDbAccess dbAccess(rootPath);
+    dbAccess.currentDbVersion = DbAccess::DB_VERSION;
+
+    unique_ptr<SqliteDbTable> dbTable(dbAccess.open(rng, fsAccess, name));
+    ASSERT_TRUE(!!dbTable);
+    EXPECT_TRUE(dbTable->nodeIndexComplete());
+
+    FileFingerprint fingerprint;
+    fingerprint.size = 100;
+    fingerprint.mtime = 1600000000;
+    fingerprint.crc.fill(7);
+    fingerprint.isvalid = true;
+
+    DbNodeRecord file{16 | 1, DbNodeColumns(), "file"};
+    file.columns.nodehandle = 2;
+    file.columns.parenthandle = 1;
+    file.columns.type = FILENODE;
+    file.columns.size = fingerprint.size;
+    fingerprint.serializefingerprint(&file.columns.fingerprint);
+
+    DbNodeRecord folder{32 | 1, DbNodeColumns(), "folder"};
+    folder.columns.nodehandle = 3;
+    folder.columns.parenthandle = 1;
+    folder.columns.type = FOLDERNODE;
+
+    string scsn = "scsn";
+
+    dbTable->begin();
+    ASSERT_TRUE(dbTable->put(0, &scsn[0], unsigned(scsn.size())));
+    ASSERT_TRUE(dbTable->putNodeBatch({ file, folder }));
+
+    DbTable::NodeRefs refs;
+    ASSERT_TRUE(dbTable->getChildren(1, &refs));
+    sort(refs.begin(), refs.end());
+    EXPECT_EQ(DbTable::NodeRefs({ { 16 | 1, 2 }, { 32 | 1, 3 } }), refs);
+
+    ASSERT_TRUE(dbTable->getByFingerprint(fingerprint, &refs));
+    EXPECT_EQ(DbTable::NodeRefs({ { 16 | 1, 2 } }), refs);
+
+    fingerprint.size++;
+    ASSERT_TRUE(dbTable->getByFingerprint(fingerprint, &refs));
+    EXPECT_TRUE(refs.empty());
+
+    // node records are read back as any other
+    string data;
+    ASSERT_TRUE(dbTable->get(32 | 1, &data));
+    EXPECT_EQ("folder", data);
+
+    ASSERT_TRUE(dbTable->del(32 | 1));
+    ASSERT_TRUE(dbTable->getChildren(1, &refs));
+    EXPECT_EQ(DbTable::NodeRefs({ { 16 | 1, 2 } }), refs);
+    dbTable->commit();
+
+    uint32_t id;
+    vector<uint32_t> ids;
+    dbTable->rewind();
+    while (dbTable->next(&id, &data))
+    {
+        ids.push_back(id);
+    }
+    EXPECT_EQ(vector<uint32_t>({ 0, 16 | 1 }), ids);
+}
+
+TEST_F(SqliteDBTest, DeleteSpacedRecordsByRange)
+{
+    SqliteDbAccess dbAccess(rootPath);
+    dbAccess.currentDbVersion = DbAccess::DB_VERSION;
+
+    unique_ptr<SqliteDbTable> dbTable(dbAccess.open(rng, fsAccess, name));
+    ASSERT_TRUE(!!dbTable);
+
+    string data = "data";
+    dbTable->begin();
+    for (uint32_t id : { 0u, 16u | 1, 32u | 1, 48u | 2, 64u | 1, 80u | 1, 96u | 2 })
+    {
+        ASSERT_TRUE(dbTable->put(id, &data[0], unsigned(data.size())));
+    }
+
+    // the first two in a range, but not the records around those that are left
+    ASSERT_TRUE(dbTable->delSpaced({ 96 | 2, 16 | 1, 64 | 1, 32 | 1 }));
+    dbTable->commit();
+
+    uint32_t id;
+    vector<uint32_t> ids;
+    dbTable->rewind();
+    while (dbTable->next(&id, &data))
+    {
+        ids.push_back(id);
+    }
+    EXPECT_EQ(vector<uint32_t>({ 0, 48 | 2, 80 | 1 }), ids);
+}
+
+TEST_F(SqliteDBTest, RemoveLaterMovesTheFilesAside)
+{
+    SqliteDbAccess dbAccess(rootPath);
+    dbAccess.currentDbVersion = DbAccess::DB_VERSION;
+
+    unique_ptr<SqliteDbTable> dbTable(dbAccess.open(rng, fsAccess, name));
+    ASSERT_TRUE(!!dbTable);
+
+    string data = "data";
+    dbTable->begin();
+    ASSERT_TRUE(dbTable->put(16 | 1, &data[0], unsigned(data.size())));
+    dbTable->commit();
+
+    auto dbFile = dbTable->dbFile();
+    vector<LocalPath> files;
+    dbTable->removeLater(files);
+    ASSERT_FALSE(files.empty());
+
+    // a new database takes its place right away
+    auto fileAccess = fsAccess.newfileaccess(false);
+    EXPECT_FALSE(fileAccess->isfile(dbFile));
+
+    dbTable.reset(dbAccess.open(rng, fsAccess, name));
+    ASSERT_TRUE(!!dbTable);
+    EXPECT_FALSE(dbTable->get(16 | 1, &data));
+
+    for (auto& file : files)
+    {
+        EXPECT_TRUE(fileAccess->isfile(file));
+        EXPECT_TRUE(fsAccess.unlinklocal(file));
+    }
+}
+
+TEST_F(SqliteDBTest, MigratePreviousLayout)
+{
+    SqliteDbAccess dbAccess(rootPath);
+    dbAccess.currentDbVersion = DbAccess::DB_VERSION;
+
+    // Create a database with all records in statecache.
+    {
+        auto path = dbAccess.databasePath(fsAccess, name, DbAccess::DB_VERSION - 1);
+
+        sqlite3* db;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(path.toPath(fsAccess).c_str(), &db));
+        EXPECT_EQ(SQLITE_OK, sqlite3_exec(db,
+                                          "CREATE TABLE statecache (id INTEGER PRIMARY KEY ASC NOT NULL, content BLOB NOT NULL); "
+                                          "INSERT INTO statecache VALUES (0, 'scsn'), (17, 'node');",
+                                          nullptr, nullptr, nullptr));
+        sqlite3_close(db);
+    }
+
+    EXPECT_TRUE(dbAccess.probe(fsAccess, name));
+
+    unique_ptr<SqliteDbTable> dbTable(dbAccess.open(rng, fsAccess, name));
+    ASSERT_TRUE(!!dbTable);
+    EXPECT_EQ(dbAccess.databasePath(fsAccess, name, DbAccess::DB_VERSION), dbTable->dbFile());
+
+    // Node records may still be in statecache: queries can't be answered.
+    DbTable::NodeRefs refs;
+    EXPECT_FALSE(dbTable->nodeIndexComplete());
+    EXPECT_FALSE(dbTable->getChildren(UNDEF, &refs));
+
+    string data;
+    ASSERT_TRUE(dbTable->get(17, &data));
+    EXPECT_EQ("node", data);
+
+    // Writing a node record with its columns moves it to the node table.
+    DbNodeRecord node{17, DbNodeColumns(), "node2"};
+    node.columns.nodehandle = 5;
+    node.columns.type = FOLDERNODE;
+
+    dbTable->begin();
+    ASSERT_TRUE(dbTable->putNodeRecord(node));
+    dbTable->setNodeIndexComplete();
+    dbTable->commit();
+
+    ASSERT_TRUE(dbTable->getChildren(UNDEF, &refs));
+    EXPECT_EQ(DbTable::NodeRefs({ { 17, 5 } }), refs);
+
+    uint32_t id;
+    vector<uint32_t> ids;
+    dbTable->rewind();
+    while (dbTable->next(&id, &data))
+    {
+        ids.push_back(id);
+    }
+    EXPECT_EQ(vector<uint32_t>({ 0, 17 }), ids);
+
+    dbTable.reset();
+    dbTable.reset(dbAccess.open(rng, fsAccess, name));
+    ASSERT_TRUE(!!dbTable);
+    EXPECT_TRUE(dbTable->nodeIndexComplete());
+}
+
+TEST_F(SqliteDBTest, ReclaimSpace)
+{
+    SqliteDbAccess dbAccess(rootPath);
+    dbAccess.currentDbVersion = DbAccess::DB_VERSION;
+
+    unique_ptr<SqliteDbTable> dbTable(dbAccess.open(rng, fsAccess, name));
+    ASSERT_TRUE(!!dbTable);
+
+    string data(4096, 'x');
+    dbTable->begin();
+    for (uint32_t id = 0; id < 256; ++id)
+    {
+        ASSERT_TRUE(dbTable->put(id << 4, &data[0], unsigned(data.size())));
+    }
+    dbTable->commit();
+
+    EXPECT_EQ(0, dbTable->reclaimableBytes());
+    EXPECT_EQ(0, dbTable->reclaimSpace(1 << 20));
+
+    dbTable->begin();
+    for (uint32_t id = 0; id < 200; ++id)
+    {
+        ASSERT_TRUE(dbTable->del(id << 4));
+    }
+    dbTable->commit();
+
+    // A new database can be compacted a slice at a time.
+    int64_t reclaimable = dbTable->reclaimableBytes();
+    EXPECT_GT(reclaimable, int64_t(data.size()) * 100);
+
+    int64_t reclaimed = dbTable->reclaimSpace(64 << 10);
+    EXPECT_GT(reclaimed, 0);
+    EXPECT_LE(reclaimed, 64 << 10);
+    EXPECT_EQ(reclaimable - reclaimed, dbTable->reclaimableBytes());
+
+    // Also in a transaction.
+    dbTable->begin();
+    EXPECT_GT(dbTable->reclaimSpace(reclaimable), 0);
+    dbTable->commit();
+    EXPECT_EQ(0, dbTable->reclaimableBytes());
+
+    ASSERT_TRUE(dbTable->get(255 << 4, &data));
+    EXPECT_TRUE(dbTable->vacuum());
+}
+
+TEST_F(SqliteDBTest, VacuumEnablesReclaimSpace)
+{
+    SqliteDbAccess dbAccess(rootPath);
+    dbAccess.currentDbVersion = DbAccess::DB_VERSION;
+
+    // Create a database without incremental vacuum, as the SDK did before.
+    {
+        auto path = dbAccess.databasePath(fsAccess, name, DbAccess::DB_VERSION);
+
+        sqlite3* db;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(path.toPath(fsAccess).c_str(), &db));
+        EXPECT_EQ(SQLITE_OK, sqlite3_exec(db,
+                                          "CREATE TABLE statecache (id INTEGER PRIMARY KEY ASC NOT NULL, content BLOB NOT NULL); "
+                                          "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 200) "
+                                          "INSERT INTO statecache SELECT i * 16, zeroblob(4096) FROM n; "
+                                          "DELETE FROM statecache WHERE id > 160;",
+                                          nullptr, nullptr, nullptr));
+        sqlite3_close(db);
+    }
+
+    unique_ptr<SqliteDbTable> dbTable(dbAccess.open(rng, fsAccess, name));
+    ASSERT_TRUE(!!dbTable);
+
+    EXPECT_GT(dbTable->reclaimableBytes(), 0);
+    EXPECT_EQ(0, dbTable->reclaimSpace(1 << 20));
+
+    dbTable->begin();
+    EXPECT_FALSE(dbTable->vacuum());
+    dbTable->abort();
+
+    ASSERT_TRUE(dbTable->vacuum());
+    EXPECT_EQ(0, dbTable->reclaimableBytes());
+
+    string data;
+    ASSERT_TRUE(dbTable->get(160, &data));
+    EXPECT_FALSE(dbTable->get(176, &data));
+}
+
+TEST_F(SqliteDBTest, ReadOnlySeesOwnerCommits)
+{
+    SqliteDbAccess dbAccess(rootPath);
+    dbAccess.currentDbVersion = DbAccess::DB_VERSION;
+
+    // Nothing to read until the owner has created the database.
+    EXPECT_FALSE(dbAccess.open(rng, fsAccess, name, DB_OPEN_FLAG_READONLY));
+
+    unique_ptr<SqliteDbTable> owner(dbAccess.open(rng, fsAccess, name));
+    ASSERT_TRUE(!!owner);
+
+    string a = "a", b = "b";
+    owner->begin();
+    ASSERT_TRUE(owner->put(16, &a[0], unsigned(a.size())));
+    owner->commit();
+
+    unique_ptr<DbTable> table(dbAccess.open(rng, fsAccess, name, DB_OPEN_FLAG_READONLY));
+    ASSERT_TRUE(!!table);
+    ReadOnlyDbTable reader(rng, std::move(table));
+
+    string data;
+    ASSERT_TRUE(reader.get(16, &data));
+    EXPECT_EQ("a", data);
+
+    // The reader's transactions don't hold back the owner's commits, nor do its writes land.
+    reader.begin();
+    EXPECT_TRUE(reader.inTransaction());
+    EXPECT_TRUE(reader.put(32, &b[0], unsigned(b.size())));
+    reader.truncate();
+
+    auto version = reader.dataVersion();
+
+    owner->begin();
+    ASSERT_TRUE(owner->del(16));
+    ASSERT_TRUE(owner->put(48, &b[0], unsigned(b.size())));
+    owner->commit();
+
+    EXPECT_NE(version, reader.dataVersion());
+    EXPECT_FALSE(reader.get(16, &data));
+    EXPECT_FALSE(reader.get(32, &data));
+    ASSERT_TRUE(reader.get(48, &data));
+    EXPECT_EQ("b", data);
+
+    reader.commit();
+    reader.remove();
+    EXPECT_TRUE(owner->get(48, &data));
+}
+
+
+TEST(RecursiveSharedMutex, readersShareTheLock)
+{
+    mega::RecursiveSharedMutex m;
+    std::atomic<int> readers(0);
+    std::atomic<bool> release(false);
+
+    auto reader = [&]()
+    {
+        mega::RecursiveSharedMutex::SharedGuard g(m);
+        mega::RecursiveSharedMutex::SharedGuard recursive(m);
+        ++readers;
+        while (!release)
+        {
+            std::this_thread::yield();
+        }
+    };
+
+    std::thread t1(reader);
+    std::thread t2(reader);
+    while (readers < 2)
+    {
+        std::this_thread::yield();
+    }
+
+    // both readers are inside at once, and keep writers out
+    EXPECT_FALSE(m.try_lock());
+    EXPECT_FALSE(m.try_lock_for(std::chrono::milliseconds(20)));
+
+    release = true;
+    t1.join();
+    t2.join();
+
+    EXPECT_TRUE(m.try_lock());
+    m.unlock();
+}
+
+TEST(RecursiveSharedMutex, writerExcludesReaders)
+{
+    mega::RecursiveSharedMutex m;
+    std::atomic<bool> read(false);
+
+    m.lock();
+    m.lock();   // recursive
+    {
+        // the owner can read under its own lock
+        mega::RecursiveSharedMutex::SharedGuard g(m);
+    }
+
+    std::thread t([&]()
+    {
+        mega::RecursiveSharedMutex::SharedGuard g(m);
+        read = true;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(read);
+    m.unlock();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(read);
+    m.unlock();
+
+    t.join();
+    EXPECT_TRUE(read);
+}
+
+namespace {
+
+class NullWaiter : public mega::Waiter
+{
+public:
+    int wait() override { return 0; }
+    void notify() override {}
+};
+
+} // anonymous
+
+TEST(MegaClientAsyncQueue, parallelForRunsEachItemOnce)
+{
+    NullWaiter waiter;
+    mega::MegaClientAsyncQueue queue(waiter, 3);
+
+    std::vector<std::atomic<int>> runs(1000);
+    for (auto& r : runs)
+    {
+        r = 0;
+    }
+
+    queue.parallelFor(runs.size(), [&runs](size_t i, mega::SymmCipher&)
+    {
+        ++runs[i];
+    });
+
+    for (auto& r : runs)
+    {
+        EXPECT_EQ(1, r);
+    }
+
+    // nothing to do, and a single item, are handled on the calling thread
+    queue.parallelFor(0, [](size_t, mega::SymmCipher&) { FAIL(); });
+
+    std::thread::id ran;
+    queue.parallelFor(1, [&ran](size_t, mega::SymmCipher&) { ran = std::this_thread::get_id(); });
+    EXPECT_EQ(std::this_thread::get_id(), ran);
+}
+
+TEST(MegaClientAsyncQueue, parallelForRunsMeanwhileOnTheCallingThread)
+{
+    NullWaiter waiter;
+    mega::MegaClientAsyncQueue queue(waiter, 3);
+
+    std::atomic<int> items{0};
+    std::thread::id ran;
+    queue.parallelFor(100, [&items](size_t, mega::SymmCipher&) { ++items; },
+                      [&ran]() { ran = std::this_thread::get_id(); });
+
+    EXPECT_EQ(100, items);
+    EXPECT_EQ(std::this_thread::get_id(), ran);
+
+    bool called = false;
+    queue.parallelFor(0, [](size_t, mega::SymmCipher&) { FAIL(); }, [&called]() { called = true; });
+    EXPECT_TRUE(called);
+}
+
+TEST(MegaClientAsyncQueue, poolThreadsStartWithTheFirstJob)
+{
+    // never used, nothing to start or join
+    {
+        NullWaiter waiter;
+        mega::MegaClientAsyncQueue queue(waiter, 3);
+    }
+
+    NullWaiter waiter;
+    mega::MegaClientAsyncQueue queue(waiter, 3);
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::thread::id ran;
+    queue.push([&](mega::SymmCipher&)
+    {
+        std::lock_guard<std::mutex> g(m);
+        ran = std::this_thread::get_id();
+        cv.notify_one();
+    }, false);
+
+    std::unique_lock<std::mutex> g(m);
+    ASSERT_TRUE(cv.wait_for(g, std::chrono::seconds(10), [&]() { return ran != std::thread::id(); }));
+    EXPECT_NE(std::this_thread::get_id(), ran);
+}
+
+TEST(MegaClientAsyncQueue, sharedPoolRunsTheJobsOfEachQueue)
+{
+    struct CountingWaiter : NullWaiter
+    {
+        std::atomic<int> notified{0};
+        void notify() override { ++notified; }
+    };
+
+    auto pool = std::make_shared<mega::MegaWorkerPool>(2);
+    CountingWaiter waiter1, waiter2;
+    std::atomic<int> jobs1{0}, jobs2{0};
+
+    {
+        mega::MegaClientAsyncQueue queue1(waiter1, 5, pool);
+        mega::MegaClientAsyncQueue queue2(waiter2, 5, pool);
+
+        for (int i = 0; i < 50; ++i)
+        {
+            queue1.push([&jobs1](mega::SymmCipher&) { ++jobs1; }, false);
+            queue2.push([&jobs2](mega::SymmCipher&) { ++jobs2; }, false);
+        }
+
+        // each queue waits for its own jobs when it goes
+    }
+
+    EXPECT_EQ(2u, pool->size());
+    EXPECT_EQ(50, jobs1);
+    EXPECT_EQ(50, jobs2);
+    EXPECT_EQ(50, waiter1.notified);
+    EXPECT_EQ(50, waiter2.notified);
+}
+
+TEST(MegaClientAsyncQueue, poolHandsItsJobsToTheExecutor)
+{
+    std::mutex m;
+    std::deque<std::function<void()>> calls;
+    auto pool = std::make_shared<mega::MegaWorkerPool>(2, [&](std::function<void()> f)
+    {
+        std::lock_guard<std::mutex> g(m);
+        calls.push_back(std::move(f));
+    });
+
+    NullWaiter waiter;
+    std::atomic<int> jobs{0};
+    std::thread::id ran;
+    {
+        mega::MegaClientAsyncQueue queue(waiter, 5, pool);
+        for (int i = 0; i < 10; ++i)
+        {
+            queue.push([&](mega::SymmCipher&)
+            {
+                ++jobs;
+                ran = std::this_thread::get_id();
+            }, i % 2 == 0);
+        }
+
+        // nothing runs until the executor makes its calls, also those of the jobs discarded
+        EXPECT_EQ(0, jobs);
+        queue.clearDiscardable();
+        EXPECT_EQ(5u, queue.pending());
+        EXPECT_EQ(10u, calls.size());
+
+        std::thread app([&]()
+        {
+            for (;;)
+            {
+                std::function<void()> f;
+                {
+                    std::lock_guard<std::mutex> g(m);
+                    if (calls.empty()) return;
+                    f = std::move(calls.front());
+                    calls.pop_front();
+                }
+                f();
+            }
+        });
+        app.join();
+    }
+
+    EXPECT_EQ(5, jobs);
+    EXPECT_NE(std::this_thread::get_id(), ran);
+    EXPECT_EQ(2u, pool->size());
+
+    // with an executor that runs them right away, parallelFor still does every item
+    NullWaiter inlineWaiter;
+    mega::MegaClientAsyncQueue queue(inlineWaiter, 0, std::make_shared<mega::MegaWorkerPool>(3, [](std::function<void()> f) { f(); }));
+    std::atomic<int> items{0};
+    queue.parallelFor(100, [&items](size_t, mega::SymmCipher&) { ++items; });
+    EXPECT_EQ(100, items);
+}
+
+TEST(EncryptBufferByChunks, parallelMatchesSequential)
+{
+    NullWaiter waiter;
+    mega::MegaClientAsyncQueue queue(waiter, 3);
+
+    mega::byte keydata[mega::SymmCipher::KEYLENGTH];
+    for (unsigned i = 0; i < sizeof keydata; i++)
+    {
+        keydata[i] = mega::byte(i * 7 + 1);
+    }
+    mega::SymmCipher key(keydata);
+
+    // from a chunk boundary, over several chunks, ending in a partial one
+    m_off_t pos = 393216;
+    m_off_t npos = pos + 3 * 1048576 + 1000;
+    unsigned size = unsigned(npos - pos);
+
+    std::string data(size + (-(int)size & (mega::SymmCipher::BLOCKSIZE - 1)), '\0');
+    for (unsigned i = 0; i < size; i++)
+    {
+        data[i] = char(i * 31 + (i >> 8));
+    }
+    std::string parallel = data;
+
+    mega::chunkmac_map macs, parallelMacs;
+    std::string suffix, parallelSuffix;
+
+    mega::EncryptBufferByChunks sequential((mega::byte*)&data[0], &key, &macs, 0x1234);
+    ASSERT_TRUE(sequential.encrypt(pos, npos, suffix));
+
+    mega::EncryptBufferByChunks inParallel((mega::byte*)&parallel[0], &key, &parallelMacs, 0x1234);
+    ASSERT_TRUE(inParallel.encrypt(queue, pos, npos, parallelSuffix));
+
+    EXPECT_EQ(data, parallel);
+    EXPECT_EQ(suffix, parallelSuffix);
+    EXPECT_EQ(macs.macsmac(&key), parallelMacs.macsmac(&key));
+    EXPECT_GT(macs.size(), 2u);
+}
+
+TEST(TransferBufferPool, recyclesBuffersBySizeClass)
+{
+    auto& pool = mega::TransferBufferPool::instance();
+    size_t inUse = pool.inUse();
+
+    // sizes within a granule share a class
+    mega::byte* a = pool.allocate(1048576 + 16);
+    EXPECT_EQ(inUse + 1048576 + mega::TransferBufferPool::GRANULE, pool.inUse());
+    pool.release(a);
+    EXPECT_EQ(inUse, pool.inUse());
+
+    mega::byte* b = pool.allocate(1048576 + 1000);
+    EXPECT_EQ(a, b);
+
+    // a different class doesn't get it
+    mega::byte* c = pool.allocate(100);
+    EXPECT_NE(b, c);
+    pool.release(c);
+    pool.release(nullptr);
+
+    pool.setCeiling(pool.inUse());
+    EXPECT_TRUE(pool.overCeiling());
+    pool.release(b);
+    EXPECT_FALSE(pool.overCeiling());
+    pool.setCeiling(0);
+
+    // idle buffers beyond the limit are freed
+    pool.setIdleLimit(0);
+    EXPECT_EQ(0u, pool.idle());
+    pool.setIdleLimit(mega::TransferBufferPool::DEFAULT_IDLE_LIMIT);
+}
+
+TEST(TokenBucket, limitsBurstsAndPaysBackDebt)
+{
+    mega::TokenBucket bucket;
+    EXPECT_EQ(std::numeric_limits<m_off_t>::max(), bucket.allowance(100));
+
+    // a second's worth at most
+    bucket.setRate(100000);
+    EXPECT_EQ(100000, bucket.allowance(100));
+
+    // taken into debt, which is paid back before anything else goes
+    bucket.consume(150000);
+    EXPECT_EQ(-50000, bucket.allowance(100));
+    EXPECT_EQ(106u, bucket.availableAt(100));
+    EXPECT_EQ(10000, bucket.allowance(106));
+
+    // the tightest limit decides
+    mega::TokenBucket other;
+    other.setRate(1 << 20);
+    std::vector<mega::TokenBucket*> both = { &bucket, &other };
+    EXPECT_EQ(10000, mega::TokenBucket::allowance(both, 106));
+    mega::TokenBucket::consume(both, 20000);
+    EXPECT_EQ(108u, mega::TokenBucket::availableAt(both, 106));
+    EXPECT_EQ((1 << 20) - 20000, other.allowance(106));
+}
+
+TEST(MpscQueue, keepsTheOrderOfEachProducer)
+{
+    mega::MpscQueue<std::pair<int, int>> queue;
+    const int producers = 4;
+    const int items = 20000;
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&queue, p]()
+        {
+            for (int i = 0; i < items; ++i)
+            {
+                queue.push(std::make_pair(p, i));
+            }
+        });
+    }
+
+    // popped meanwhile, on this thread only
+    std::vector<int> next(producers, 0);
+    int popped = 0;
+    std::pair<int, int> item;
+    while (popped < producers * items)
+    {
+        if (queue.pop(item))
+        {
+            ASSERT_EQ(next[item.first]++, item.second);
+            ++popped;
+        }
+    }
+
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    EXPECT_FALSE(queue.pop(item));
+}
+
+TEST(NotificationDeque, coalescesRepeatedPaths)
+{
+    FSACCESS_CLASS fsAccess;
+    mega::NotificationDeque queue;
+    auto notify = [&](const std::string& path, mega::dstime timestamp)
+    {
+        mega::Notification n;
+        n.timestamp = timestamp;
+        n.localnode = nullptr;
+        n.path = mega::LocalPath::fromPath(path, fsAccess);
+        queue.pushBack(std::move(n));
+    };
+
+    notify("a", 10);
+    notify("b", 11);
+    notify("a", 12);
+    notify("c", 0);
+    notify("c", 13);
+    EXPECT_EQ(3u, queue.size());
+
+    // in the order of their last notification, with its time (or immediately)
+    mega::Notification n;
+    ASSERT_TRUE(queue.popFront(n));
+    EXPECT_EQ("b", n.path.toPath(fsAccess));
+    EXPECT_EQ(11u, n.timestamp);
+
+    ASSERT_TRUE(queue.popFront(n));
+    EXPECT_EQ("a", n.path.toPath(fsAccess));
+    EXPECT_EQ(12u, n.timestamp);
+
+    // put back, and notified again meanwhile
+    queue.unpopFront(n);
+    notify("a", 14);
+    ASSERT_TRUE(queue.peekFront(n));
+    EXPECT_EQ("c", n.path.toPath(fsAccess));
+    EXPECT_EQ(0u, n.timestamp);
+
+    ASSERT_TRUE(queue.popFront(n));
+    ASSERT_TRUE(queue.popFront(n));
+    EXPECT_EQ("a", n.path.toPath(fsAccess));
+    EXPECT_EQ(14u, n.timestamp);
+    EXPECT_TRUE(queue.empty());
+}